@@ -38,6 +38,9 @@
 
 #include <misc/debug.h>
 #include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/hashfun.h>
 #include <misc/ethernet_proto.h>
 #include <misc/ipv4_proto.h>
 #include <misc/udp_proto.h>
@@ -46,6 +49,9 @@
 
 #include "BArpProbe.h"
 
+#include "BArpProbeEngine_hash.h"
+#include <structure/CHash_impl.h>
+
 #include <generated/blog_channel_BArpProbe.h>
 
 #define STATE_INITIAL 1
@@ -53,25 +59,77 @@
 #define STATE_EXIST 3
 #define STATE_EXIST_PANIC 4
 
-static void dgram_handler (BArpProbe *o, int event)
+#define ENGINE_INITIAL_BUCKETS 16
+
+// lets through ARP replies for IPv4 over Ethernet only
+static const struct sock_filter arp_reply_sock_filter[] = {
+    BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 0),                                                          // A <- hardware type, protocol type
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (ARP_HARDWARE_TYPE_ETHERNET << 16) | ETHERTYPE_IPV4, 0, 3), // Ethernet and IPv4 ?
+    BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 4),                                                          // A <- sizes, opcode
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (6 << 24) | (4 << 16) | ARP_OPCODE_REPLY, 0, 1),           // sizes 6 and 4, reply ?
+    BPF_STMT(BPF_RET + BPF_K, sizeof(struct arp_packet)),                                           // return ARP packet
+    BPF_STMT(BPF_RET + BPF_K, 0)                                                                    // ignore
+};
+
+static void engine_free_dgram (BArpProbeEngine *o)
+{
+    ASSERT(o->have_dgram)
+    
+    // free recv interface
+    BDatagram_RecvAsync_Free(&o->dgram);
+    
+    // free send interface
+    BDatagram_SendAsync_Free(&o->dgram);
+    
+    // free dgram
+    BDatagram_Free(&o->dgram);
+    
+    o->have_dgram = 0;
+    o->send_sending = 0;
+}
+
+static void engine_dgram_handler (BArpProbeEngine *o, int event)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
     
     BLog(BLOG_ERROR, "packet socket error");
     
-    // report error
-    DEBUGERROR(&o->d_err, o->handler(o->user, BARPPROBE_EVENT_ERROR));
-    return;
+    // free the socket now, as required
+    engine_free_dgram(o);
+    
+    // have every probe report the error
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&o->probes_list); n; n = LinkedList1Node_Next(n)) {
+        BArpProbe *p = UPPER_OBJECT(n, BArpProbe, probes_list_node);
+        BPending_Set(&p->error_job);
+    }
+    
+    // forget queued requests
+    while (!LinkedList1_IsEmpty(&o->send_list)) {
+        BArpProbe *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_list), BArpProbe, send_list_node);
+        LinkedList1_Remove(&o->send_list, &p->send_list_node);
+        p->send_queued = 0;
+    }
 }
 
-static void send_request (BArpProbe *o)
+static void engine_send_next (BArpProbeEngine *o)
 {
-    if (o->send_sending) {
-        BLog(BLOG_ERROR, "cannot send packet while another packet is being sent!");
+    ASSERT(o->have_dgram)
+    ASSERT(!o->send_sending)
+    
+    LinkedList1Node *n = LinkedList1_GetFirst(&o->send_list);
+    if (!n) {
         return;
     }
     
-    // build packet
+    // dequeue probe
+    BArpProbe *p = UPPER_OBJECT(n, BArpProbe, send_list_node);
+    ASSERT(p->send_queued)
+    LinkedList1_Remove(&o->send_list, &p->send_list_node);
+    p->send_queued = 0;
+    
+    // build packet; with a batching send interface it is copied right away,
+    // so the next one can be built in the same buffer
     struct arp_packet *arp = &o->send_packet;
     arp->hardware_type = hton16(ARP_HARDWARE_TYPE_ETHERNET);
     arp->protocol_type = hton16(ETHERTYPE_IPV4);
@@ -81,7 +139,7 @@ static void send_request (BArpProbe *o)
     memcpy(arp->sender_mac, o->if_mac, 6);
     arp->sender_ip = hton32(0);
     memset(arp->target_mac, 0, sizeof(arp->target_mac));
-    arp->target_ip = o->addr;
+    arp->target_ip = p->addr;
     
     // send packet
     PacketPassInterface_Sender_Send(o->send_if, (uint8_t *)&o->send_packet, sizeof(o->send_packet));
@@ -90,22 +148,49 @@ static void send_request (BArpProbe *o)
     o->send_sending = 1;
 }
 
-static void send_if_handler_done (BArpProbe *o)
+static void engine_send_if_handler_done (BArpProbeEngine *o)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
     ASSERT(o->send_sending)
     
     // set not sending
     o->send_sending = 0;
+    
+    // send the next queued request
+    engine_send_next(o);
 }
 
-static void recv_if_handler_done (BArpProbe *o, int data_len)
+static void probe_reply (BArpProbe *o)
+{
+    int old_state = o->state;
+    
+    // set minus one missed
+    o->num_missed = -1;
+    
+    // set timer
+    BReactor_SetTimerAfter(o->engine->reactor, &o->timer, BARPPROBE_EXIST_WAITSEND);
+    
+    // set state exist
+    o->state = STATE_EXIST;
+    
+    // report exist if needed, from a job, since the handler may free any
+    // probe of the engine
+    if (old_state == STATE_INITIAL || old_state == STATE_NOEXIST) {
+        BPending_Set(&o->exist_job);
+    }
+}
+
+static void engine_recv_if_handler_done (BArpProbeEngine *o, int data_len)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= sizeof(struct arp_packet))
     
-    // receive next packet
+    // keep packet and receive next packet
+    struct arp_packet arp;
+    memcpy(&arp, &o->recv_packet, sizeof(arp));
     PacketRecvInterface_Receiver_Recv(o->recv_if, (uint8_t *)&o->recv_packet);
     
     if (data_len != sizeof(struct arp_packet)) {
@@ -113,60 +198,84 @@ static void recv_if_handler_done (BArpProbe *o, int data_len)
         return;
     }
     
-    struct arp_packet *arp = &o->recv_packet;
-    
-    if (ntoh16(arp->hardware_type) != ARP_HARDWARE_TYPE_ETHERNET) {
+    if (ntoh16(arp.hardware_type) != ARP_HARDWARE_TYPE_ETHERNET) {
         BLog(BLOG_WARNING, "receive: wrong hardware type");
         return;
     }
     
-    if (ntoh16(arp->protocol_type) != ETHERTYPE_IPV4) {
+    if (ntoh16(arp.protocol_type) != ETHERTYPE_IPV4) {
         BLog(BLOG_WARNING, "receive: wrong protocol type");
         return;
     }
     
-    if (ntoh8(arp->hardware_size) != 6) {
+    if (ntoh8(arp.hardware_size) != 6) {
         BLog(BLOG_WARNING, "receive: wrong hardware size");
         return;
     }
     
-    if (ntoh8(arp->protocol_size) != 4) {
+    if (ntoh8(arp.protocol_size) != 4) {
         BLog(BLOG_WARNING, "receive: wrong protocol size");
         return;
     }
     
-    if (ntoh16(arp->opcode) != ARP_OPCODE_REPLY) {
+    if (ntoh16(arp.opcode) != ARP_OPCODE_REPLY) {
         return;
     }
     
-    if (arp->sender_ip != o->addr) {
+    // pass to every probe for the sender address
+    BArpProbeEngineHashRef ref = BArpProbeEngineHash_Lookup(&o->probes_hash, 0, arp.sender_ip);
+    while (ref.link) {
+        probe_reply(ref.ptr);
+        ref = BArpProbeEngineHash_GetNextEqual(&o->probes_hash, 0, ref);
+    }
+}
+
+static void engine_queue_request (BArpProbeEngine *o, BArpProbe *p)
+{
+    // the socket has failed, and the probe is about to report it
+    if (!o->have_dgram) {
         return;
     }
     
-    int old_state = o->state;
+    // a request for the probe is already waiting
+    if (p->send_queued) {
+        return;
+    }
     
-    // set minus one missed
-    o->num_missed = -1;
+    LinkedList1_Append(&o->send_list, &p->send_list_node);
+    p->send_queued = 1;
     
-    // set timer
-    BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_EXIST_WAITSEND);
+    if (!o->send_sending) {
+        engine_send_next(o);
+    }
+}
+
+static void error_job_handler (BArpProbe *o)
+{
+    DebugObject_Access(&o->d_obj);
     
-    // set state exist
-    o->state = STATE_EXIST;
+    // report error
+    DEBUGERROR(&o->d_err, o->handler(o->user, BARPPROBE_EVENT_ERROR));
+    return;
+}
+
+static void exist_job_handler (BArpProbe *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_EXIST)
     
-    // report exist if needed
-    if (old_state == STATE_INITIAL || old_state == STATE_NOEXIST) {
-        o->handler(o->user, BARPPROBE_EVENT_EXIST);
-        return;
-    }
+    // report exist
+    o->handler(o->user, BARPPROBE_EVENT_EXIST);
+    return;
 }
 
 static void timer_handler (BArpProbe *o)
 {
     DebugObject_Access(&o->d_obj);
+    BReactor *reactor = o->engine->reactor;
     
     // send request
-    send_request(o);
+    engine_queue_request(o->engine, o);
     
     switch (o->state) {
         case STATE_INITIAL: {
@@ -179,7 +288,7 @@ static void timer_handler (BArpProbe *o)
             // all attempts failed?
             if (o->num_missed == BARPPROBE_INITIAL_NUM_ATTEMPTS) {
                 // set timer
-                BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
+                BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
                 
                 // set state noexist
                 o->state = STATE_NOEXIST;
@@ -190,12 +299,12 @@ static void timer_handler (BArpProbe *o)
             }
             
             // set timer
-            BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_INITIAL_WAITRECV);
+            BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_INITIAL_WAITRECV);
         } break;
         
         case STATE_NOEXIST: {
             // set timer
-            BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
+            BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
         } break;
         
         case STATE_EXIST: {
@@ -208,7 +317,7 @@ static void timer_handler (BArpProbe *o)
             // all missed?
             if (o->num_missed == BARPPROBE_EXIST_NUM_NOREPLY) {
                 // set timer
-                BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_EXIST_PANIC_WAITRECV);
+                BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_EXIST_PANIC_WAITRECV);
                 
                 // set zero missed
                 o->num_missed = 0;
@@ -219,7 +328,7 @@ static void timer_handler (BArpProbe *o)
             }
             
             // set timer
-            BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_EXIST_WAITRECV);
+            BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_EXIST_WAITRECV);
         } break;
         
         case STATE_EXIST_PANIC: {
@@ -232,7 +341,7 @@ static void timer_handler (BArpProbe *o)
             // all missed?
             if (o->num_missed == BARPPROBE_EXIST_PANIC_NUM_NOREPLY) {
                 // set timer
-                BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
+                BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_NOEXIST_WAITRECV);
                 
                 // set state panic
                 o->state = STATE_NOEXIST;
@@ -243,21 +352,17 @@ static void timer_handler (BArpProbe *o)
             }
             
             // set timer
-            BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_EXIST_PANIC_WAITRECV);
+            BReactor_SetTimerAfter(reactor, &o->timer, BARPPROBE_EXIST_PANIC_WAITRECV);
         } break;
     }
 }
 
-int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *reactor, void *user, BArpProbe_handler handler)
+int BArpProbeEngine_Init (BArpProbeEngine *o, const char *ifname, BReactor *reactor)
 {
     ASSERT(ifname)
-    ASSERT(handler)
     
     // init arguments
-    o->addr = addr;
     o->reactor = reactor;
-    o->user = user;
-    o->handler = handler;
     
     // get interface information
     int if_mtu;
@@ -277,10 +382,29 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
         goto fail0;
     }
     
+    // init probes hash table
+    if (!BArpProbeEngineHash_Init(&o->probes_hash, ENGINE_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "BArpProbeEngineHash_Init failed");
+        goto fail0;
+    }
+    
     // init dgram
-    if (!BDatagram_Init(&o->dgram, BADDR_TYPE_PACKET, o->reactor, o, (BDatagram_handler)dgram_handler)) {
+    if (!BDatagram_Init(&o->dgram, BADDR_TYPE_PACKET, o->reactor, o, (BDatagram_handler)engine_dgram_handler)) {
         BLog(BLOG_ERROR, "BDatagram_Init failed");
-        goto fail0;
+        goto fail1;
+    }
+    
+    // set socket filter, so that requests and other traffic don't wake us up
+    {
+        struct sock_filter filter[sizeof(arp_reply_sock_filter) / sizeof(arp_reply_sock_filter[0])];
+        memcpy(filter, arp_reply_sock_filter, sizeof(filter));
+        struct sock_fprog fprog = {
+            .len = sizeof(filter) / sizeof(filter[0]),
+            .filter = filter
+        };
+        if (setsockopt(BDatagram_GetFd(&o->dgram), SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+            BLog(BLOG_NOTICE, "not using socket filter");
+        }
     }
     
     // bind dgram
@@ -288,7 +412,7 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
     BAddr_InitPacket(&bind_addr, hton16(ETHERTYPE_ARP), if_index, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_HOST, if_mac);
     if (!BDatagram_Bind(&o->dgram, bind_addr)) {
         BLog(BLOG_ERROR, "BDatagram_Bind failed");
-        goto fail1;
+        goto fail2;
     }
     
     // set dgram send addresses
@@ -299,30 +423,156 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
     BIPAddr_InitInvalid(&local_addr);
     BDatagram_SetSendAddrs(&o->dgram, dest_addr, local_addr);
     
-    // init send interface
-    BDatagram_SendAsync_Init(&o->dgram, sizeof(struct arp_packet));
+    // init send interface; requests which become due together go out in one
+    // system call
+    if (!BDatagram_SendAsync_Init2(&o->dgram, sizeof(struct arp_packet), BARPPROBEENGINE_SEND_BATCH)) {
+        BLog(BLOG_ERROR, "BDatagram_SendAsync_Init2 failed");
+        goto fail2;
+    }
     o->send_if = BDatagram_SendAsync_GetIf(&o->dgram);
-    PacketPassInterface_Sender_Init(o->send_if, (PacketPassInterface_handler_done)send_if_handler_done, o);
+    PacketPassInterface_Sender_Init(o->send_if, (PacketPassInterface_handler_done)engine_send_if_handler_done, o);
     
     // set not sending
     o->send_sending = 0;
     
     // init recv interface
-    BDatagram_RecvAsync_Init(&o->dgram, sizeof(struct arp_packet));
+    if (!BDatagram_RecvAsync_Init2(&o->dgram, sizeof(struct arp_packet), BARPPROBEENGINE_RECV_BATCH)) {
+        BLog(BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
+        goto fail3;
+    }
     o->recv_if = BDatagram_RecvAsync_GetIf(&o->dgram);
-    PacketRecvInterface_Receiver_Init(o->recv_if, (PacketRecvInterface_handler_done)recv_if_handler_done, o);
+    PacketRecvInterface_Receiver_Init(o->recv_if, (PacketRecvInterface_handler_done)engine_recv_if_handler_done, o);
     
-    // init timer
-    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
+    // set have dgram
+    o->have_dgram = 1;
+    
+    // init lists
+    LinkedList1_Init(&o->send_list);
+    LinkedList1_Init(&o->probes_list);
+    
+    // set no probes
+    o->num_probes = 0;
     
     // receive first packet
     PacketRecvInterface_Receiver_Recv(o->recv_if, (uint8_t *)&o->recv_packet);
     
-    // send request
-    send_request(o);
+    DebugObject_Init(&o->d_obj);
+    return 1;
     
-    // set timer
-    BReactor_SetTimerAfter(o->reactor, &o->timer, BARPPROBE_INITIAL_WAITRECV);
+fail3:
+    BDatagram_SendAsync_Free(&o->dgram);
+fail2:
+    BDatagram_Free(&o->dgram);
+fail1:
+    BArpProbeEngineHash_Free(&o->probes_hash);
+fail0:
+    return 0;
+}
+
+void BArpProbeEngine_Free (BArpProbeEngine *o)
+{
+    DebugObject_Free(&o->d_obj);
+    ASSERT(o->num_probes == 0)
+    ASSERT(LinkedList1_IsEmpty(&o->probes_list))
+    ASSERT(LinkedList1_IsEmpty(&o->send_list))
+    
+    // free dgram
+    if (o->have_dgram) {
+        engine_free_dgram(o);
+    }
+    
+    // free probes hash table
+    BArpProbeEngineHash_Free(&o->probes_hash);
+}
+
+int BArpProbeEngine_HasFailed (BArpProbeEngine *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return !o->have_dgram;
+}
+
+size_t BArpProbeEngine_GetNumProbes (BArpProbeEngine *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_probes;
+}
+
+int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *reactor, void *user, BArpProbe_handler handler)
+{
+    ASSERT(ifname)
+    ASSERT(handler)
+    
+    // allocate engine
+    BArpProbeEngine *engine = (BArpProbeEngine *)BAlloc(sizeof(*engine));
+    if (!engine) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // init engine
+    if (!BArpProbeEngine_Init(engine, ifname, reactor)) {
+        goto fail1;
+    }
+    
+    // init probe
+    if (!BArpProbe_InitEngine(o, engine, addr, user, handler)) {
+        goto fail2;
+    }
+    
+    // free engine along with the probe
+    o->own_engine = engine;
+    
+    return 1;
+    
+fail2:
+    BArpProbeEngine_Free(engine);
+fail1:
+    BFree(engine);
+fail0:
+    return 0;
+}
+
+int BArpProbe_InitEngine (BArpProbe *o, BArpProbeEngine *engine, uint32_t addr, void *user, BArpProbe_handler handler)
+{
+    DebugObject_Access(&engine->d_obj);
+    ASSERT(handler)
+    
+    // init arguments
+    o->addr = addr;
+    o->engine = engine;
+    o->user = user;
+    o->handler = handler;
+    
+    // set no own engine
+    o->own_engine = NULL;
+    
+    // grow hash table to have at least as many buckets as there are probes
+    if (engine->num_probes == SIZE_MAX) {
+        BLog(BLOG_ERROR, "too many probes");
+        goto fail0;
+    }
+    while (engine->probes_hash.num_buckets < engine->num_probes + 1) {
+        if (!BArpProbeEngineHash_MultiplyBuckets(&engine->probes_hash, 0, 1)) {
+            BLog(BLOG_ERROR, "BArpProbeEngineHash_MultiplyBuckets failed");
+            goto fail0;
+        }
+    }
+    
+    // insert to engine
+    o->hash = badvpn_hash_4((const uint8_t *)&addr, badvpn_hash_seed());
+    BArpProbeEngineHashRef ref = {o, o};
+    BArpProbeEngineHash_InsertMulti(&engine->probes_hash, 0, ref);
+    LinkedList1_Append(&engine->probes_list, &o->probes_list_node);
+    engine->num_probes++;
+    
+    // init jobs
+    BPending_Init(&o->error_job, BReactor_PendingGroup(engine->reactor), (BPending_handler)error_job_handler, o);
+    BPending_Init(&o->exist_job, BReactor_PendingGroup(engine->reactor), (BPending_handler)exist_job_handler, o);
+    
+    // init timer
+    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
     
     // set zero missed
     o->num_missed = 0;
@@ -330,12 +580,24 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
     // set state initial
     o->state = STATE_INITIAL;
     
-    DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
+    // set no request queued
+    o->send_queued = 0;
+    
+    if (engine->have_dgram) {
+        // send request
+        engine_queue_request(engine, o);
+        
+        // set timer
+        BReactor_SetTimerAfter(engine->reactor, &o->timer, BARPPROBE_INITIAL_WAITRECV);
+    } else {
+        // report error
+        BPending_Set(&o->error_job);
+    }
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(engine->reactor));
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail1:
-    BDatagram_Free(&o->dgram);
 fail0:
     return 0;
 }
@@ -344,16 +606,29 @@ void BArpProbe_Free (BArpProbe *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
+    BArpProbeEngine *engine = o->engine;
     
     // free timer
-    BReactor_RemoveTimer(o->reactor, &o->timer);
+    BReactor_RemoveTimer(engine->reactor, &o->timer);
     
-    // free recv interface
-    BDatagram_RecvAsync_Free(&o->dgram);
+    // free jobs
+    BPending_Free(&o->exist_job);
+    BPending_Free(&o->error_job);
     
-    // free send interface
-    BDatagram_SendAsync_Free(&o->dgram);
+    // remove queued request
+    if (o->send_queued) {
+        LinkedList1_Remove(&engine->send_list, &o->send_list_node);
+    }
     
-    // free dgram
-    BDatagram_Free(&o->dgram);
+    // remove from engine
+    engine->num_probes--;
+    LinkedList1_Remove(&engine->probes_list, &o->probes_list_node);
+    BArpProbeEngineHashRef ref = {o, o};
+    BArpProbeEngineHash_Remove(&engine->probes_hash, 0, ref);
+    
+    // free own engine
+    if (o->own_engine) {
+        BArpProbeEngine_Free(o->own_engine);
+        BFree(o->own_engine);
+    }
 }
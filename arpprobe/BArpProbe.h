@@ -31,12 +31,16 @@
 #define BADVPN_BARPPROBE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <misc/debug.h>
 #include <misc/debugerror.h>
 #include <misc/arp_proto.h>
 #include <misc/ethernet_proto.h>
 #include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <structure/CHash.h>
+#include <structure/LinkedList1.h>
 #include <system/BDatagram.h>
 #include <system/BReactor.h>
 
@@ -49,32 +53,142 @@
 #define BARPPROBE_EXIST_PANIC_WAITRECV 1000
 #define BARPPROBE_EXIST_PANIC_NUM_NOREPLY 6
 
+// number of requests an engine passes to the socket in one sendmmsg()
+#define BARPPROBEENGINE_SEND_BATCH 64
+
+// number of replies an engine reads from the socket in one recvmmsg()
+#define BARPPROBEENGINE_RECV_BATCH 16
+
 #define BARPPROBE_EVENT_EXIST 1
 #define BARPPROBE_EVENT_NOEXIST 2
 #define BARPPROBE_EVENT_ERROR 3
 
 typedef void (*BArpProbe_handler) (void *user, int event);
 
+struct BArpProbe_s;
+
+typedef struct BArpProbe_s *BArpProbeEngineHash_link;
+typedef uint32_t BArpProbeEngineHash_key;
+
+#include "BArpProbeEngine_hash.h"
+#include <structure/CHash_decl.h>
+
+/**
+ * Shared ARP probing engine for one network interface.
+ * 
+ * Any number of {@link BArpProbe} objects may probe through one engine. The
+ * engine has a single packet socket, with a socket filter letting only ARP
+ * replies through, and finds the probes interested in a reply in a hash table
+ * by IP address. Requests which become due together are sent with as few
+ * system calls as possible.
+ * 
+ * If the socket fails, every probe of the engine reports
+ * {@link BARPPROBE_EVENT_ERROR}, and probes later initialized with it do too.
+ */
 typedef struct {
-    uint32_t addr;
     BReactor *reactor;
-    void *user;
-    BArpProbe_handler handler;
-    BDatagram dgram;
     uint8_t if_mac[6];
+    int have_dgram;
+    BDatagram dgram;
     PacketPassInterface *send_if;
     int send_sending;
     struct arp_packet send_packet;
     PacketRecvInterface *recv_if;
     struct arp_packet recv_packet;
+    LinkedList1 send_list;
+    LinkedList1 probes_list;
+    size_t num_probes;
+    BArpProbeEngineHash probes_hash;
+    DebugObject d_obj;
+} BArpProbeEngine;
+
+typedef struct BArpProbe_s {
+    uint32_t addr;
+    BArpProbeEngine *engine;
+    BArpProbeEngine *own_engine;
+    void *user;
+    BArpProbe_handler handler;
     BTimer timer;
     int state;
     int num_missed;
+    int send_queued;
+    LinkedList1Node send_list_node;
+    LinkedList1Node probes_list_node;
+    size_t hash;
+    BArpProbeEngineHash_link hash_next;
+    BPending error_job;
+    BPending exist_job;
     DebugError d_err;
     DebugObject d_obj;
 } BArpProbe;
 
+/**
+ * Initializes an ARP probing engine for a network interface.
+ * 
+ * @param o the object
+ * @param ifname name of the network interface
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
+ */
+int BArpProbeEngine_Init (BArpProbeEngine *o, const char *ifname, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the engine.
+ * There must be no probes using the engine.
+ * 
+ * @param o the object
+ */
+void BArpProbeEngine_Free (BArpProbeEngine *o);
+
+/**
+ * Determines whether the engine's socket has failed. Probes then initialized
+ * with the engine only report {@link BARPPROBE_EVENT_ERROR}.
+ * 
+ * @param o the object
+ * @return 1 if the socket has failed, 0 if not
+ */
+int BArpProbeEngine_HasFailed (BArpProbeEngine *o);
+
+/**
+ * Returns the number of probes using the engine.
+ * 
+ * @param o the object
+ * @return number of probes
+ */
+size_t BArpProbeEngine_GetNumProbes (BArpProbeEngine *o);
+
+/**
+ * Initializes a probe with its own engine.
+ * 
+ * @param o the object
+ * @param ifname name of the network interface
+ * @param addr IPv4 address to probe, in network byte order
+ * @param reactor reactor we live in
+ * @param user argument to handler
+ * @param handler handler called when the presence of the host is determined
+ *                or changes, or on error
+ * @return 1 on success, 0 on failure
+ */
 int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *reactor, void *user, BArpProbe_handler handler) WARN_UNUSED;
+
+/**
+ * Initializes a probe using a shared engine.
+ * 
+ * @param o the object
+ * @param engine engine to probe through. It must outlive the probe.
+ * @param addr IPv4 address to probe, in network byte order
+ * @param user argument to handler
+ * @param handler handler called when the presence of the host is determined
+ *                or changes, or on error
+ * @return 1 on success, 0 on failure
+ */
+int BArpProbe_InitEngine (BArpProbe *o, BArpProbeEngine *engine, uint32_t addr, void *user, BArpProbe_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the probe.
+ * 
+ * @param o the object
+ */
 void BArpProbe_Free (BArpProbe *o);
 
 #endif
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME BArpProbeEngineHash
+#define CHASH_PARAM_ENTRY struct BArpProbe_s
+#define CHASH_PARAM_LINK BArpProbeEngineHash_link
+#define CHASH_PARAM_KEY BArpProbeEngineHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((BArpProbeEngineHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) ((size_t)badvpn_hash_4((const uint8_t *)&(key), badvpn_hash_seed()))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->addr == (entry2).ptr->addr)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->addr)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
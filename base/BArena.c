@@ -0,0 +1,408 @@
+/**
+ * @file BArena.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef BADVPN_LINUX
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <misc/balloc.h>
+#include <misc/balign.h>
+#include <base/BLog.h>
+
+#include "BArena.h"
+
+#include <generated/blog_channel_BArena.h>
+
+// mbind() mode; not taken from <numaif.h>, which is part of libnuma
+#define BARENA_MPOL_PREFERRED 1
+
+// number of NUMA nodes covered by the node mask passed to mbind()
+#define BARENA_MAX_NODES 1024
+
+// chunks start with a link to the next chunk, padded to a cache line
+#define BARENA_CHUNK_HEADER_SIZE 64
+
+static size_t class_size (int c)
+{
+    ASSERT(c >= 0)
+    ASSERT(c < BARENA_NUM_CLASSES)
+    
+    // 64, 96, 128, 192, 256, ...
+    return (size_t)((c % 2) ? 96 : 64) << (c / 2);
+}
+
+static int class_for_size (size_t bytes)
+{
+    for (int c = 0; c < BARENA_NUM_CLASSES; c++) {
+        if (bytes <= class_size(c)) {
+            return c;
+        }
+    }
+    
+    return -1;
+}
+
+static size_t large_size (size_t bytes)
+{
+    ASSERT(bytes > class_size(BARENA_NUM_CLASSES - 1))
+    
+    // large blocks are mapped in whole chunks, so that they can use huge pages
+    if (balign_up_overflows(bytes, BARENA_CHUNK_SIZE)) {
+        return 0;
+    }
+    
+    return balign_up(bytes, BARENA_CHUNK_SIZE);
+}
+
+#ifdef BADVPN_LINUX
+
+static void bind_region (BArena *o, void *addr, size_t size)
+{
+    // find the node we are running on when mapping the first chunk
+    if (o->node == -1) {
+        unsigned int cpu;
+        unsigned int node;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0 || node >= BARENA_MAX_NODES) {
+            BLog(BLOG_INFO, "cannot determine NUMA node, not binding memory");
+            o->node = -2;
+        } else {
+            o->node = node;
+        }
+    }
+    
+    if (o->node < 0) {
+        return;
+    }
+    
+    // prefer the node, allowing other nodes when it runs out of memory
+    unsigned long mask[BARENA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[o->node / (8 * sizeof(unsigned long))] |= 1UL << (o->node % (8 * sizeof(unsigned long)));
+    
+    if (syscall(SYS_mbind, addr, size, BARENA_MPOL_PREFERRED, mask, (unsigned long)BARENA_MAX_NODES + 1, 0) < 0) {
+        BLog(BLOG_INFO, "mbind failed, not binding memory");
+        o->node = -2;
+    }
+}
+
+static void * map_region (BArena *o, size_t size)
+{
+    ASSERT(size > 0)
+    ASSERT(size % BARENA_CHUNK_SIZE == 0)
+    
+    char *addr;
+    
+    if (o->pages == BARENA_PAGES_HUGETLB && !o->hugetlb_failed) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            goto done;
+        }
+        
+        BLog(BLOG_WARNING, "cannot map huge pages, using transparent huge pages");
+        o->hugetlb_failed = 1;
+    }
+    
+    if (o->pages == BARENA_PAGES_NORMAL) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            BLog(BLOG_ERROR, "mmap failed");
+            return NULL;
+        }
+        goto done;
+    }
+    
+    // transparent huge pages need the region to be aligned to the huge page
+    // size, so map more and cut off the excess
+    if (size > SIZE_MAX - BARENA_CHUNK_SIZE) {
+        return NULL;
+    }
+    char *map = mmap(NULL, size + BARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap failed");
+        return NULL;
+    }
+    
+    addr = (char *)balign_up((uintptr_t)map, BARENA_CHUNK_SIZE);
+    if (addr > map) {
+        munmap(map, addr - map);
+    }
+    if (addr + size < map + size + BARENA_CHUNK_SIZE) {
+        munmap(addr + size, (map + size + BARENA_CHUNK_SIZE) - (addr + size));
+    }
+    
+    // failure only means normal pages will be used
+    madvise(addr, size, MADV_HUGEPAGE);
+    
+done:
+    bind_region(o, addr, size);
+    o->bytes_mapped += size;
+    
+    return addr;
+}
+
+static void unmap_region (BArena *o, void *addr, size_t size)
+{
+    ASSERT(o->bytes_mapped >= size)
+    
+    if (munmap(addr, size) < 0) {
+        BLog(BLOG_ERROR, "munmap failed");
+    }
+    
+    o->bytes_mapped -= size;
+}
+
+#else
+
+static void * map_region (BArena *o, size_t size)
+{
+    ASSERT(size > 0)
+    
+    void *addr = BAlloc(size);
+    if (!addr) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return NULL;
+    }
+    
+    o->bytes_mapped += size;
+    
+    return addr;
+}
+
+static void unmap_region (BArena *o, void *addr, size_t size)
+{
+    ASSERT(o->bytes_mapped >= size)
+    
+    BFree(addr);
+    
+    o->bytes_mapped -= size;
+}
+
+#endif
+
+static void push_block (BArena *o, int c, void *block)
+{
+    *(void **)block = o->free_lists[c];
+    o->free_lists[c] = block;
+}
+
+static void retire_chunk (BArena *o)
+{
+    // give what is left of the current chunk to the largest classes it fits
+    for (int c = BARENA_NUM_CLASSES - 1; c >= 0; c--) {
+        while (o->chunk_left >= class_size(c)) {
+            push_block(o, c, o->chunk_pos);
+            o->chunk_pos += class_size(c);
+            o->chunk_left -= class_size(c);
+        }
+    }
+}
+
+static int refill_class (BArena *o, int c)
+{
+    ASSERT(!o->free_lists[c])
+    
+    size_t size = class_size(c);
+    
+    // start a new chunk if the current one is used up
+    if (o->chunk_left < size) {
+        char *chunk = map_region(o, BARENA_CHUNK_SIZE);
+        if (!chunk) {
+            return 0;
+        }
+        
+        retire_chunk(o);
+        
+        *(void **)chunk = o->chunks;
+        o->chunks = chunk;
+        o->chunk_pos = chunk + BARENA_CHUNK_HEADER_SIZE;
+        o->chunk_left = BARENA_CHUNK_SIZE - BARENA_CHUNK_HEADER_SIZE;
+    }
+    
+    push_block(o, c, o->chunk_pos);
+    o->chunk_pos += size;
+    o->chunk_left -= size;
+    
+    return 1;
+}
+
+void BArena_Init (BArena *o, int pages)
+{
+    ASSERT(pages == BARENA_PAGES_NORMAL || pages == BARENA_PAGES_THP || pages == BARENA_PAGES_HUGETLB)
+    
+    o->pages = pages;
+    o->node = -1;
+    o->hugetlb_failed = 0;
+    o->chunks = NULL;
+    o->chunk_pos = NULL;
+    o->chunk_left = 0;
+    for (int c = 0; c < BARENA_NUM_CLASSES; c++) {
+        o->free_lists[c] = NULL;
+    }
+    o->bytes_mapped = 0;
+    o->bytes_used = 0;
+    
+    DebugCounter_Init(&o->d_allocs);
+    DebugObject_Init(&o->d_obj);
+}
+
+void BArena_Free (BArena *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_allocs);
+    ASSERT(o->bytes_used == 0)
+    
+    // unmap chunks
+    while (o->chunks) {
+        void *chunk = o->chunks;
+        o->chunks = *(void **)chunk;
+        unmap_region(o, chunk, BARENA_CHUNK_SIZE);
+    }
+    
+    ASSERT(o->bytes_mapped == 0)
+}
+
+void * BArena_Alloc (BArena *o, size_t bytes)
+{
+    if (!o) {
+        return BAlloc(bytes);
+    }
+    DebugObject_Access(&o->d_obj);
+    
+    int c = class_for_size(bytes);
+    
+    // large blocks get a mapping of their own
+    if (c < 0) {
+        size_t size = large_size(bytes);
+        if (size == 0) {
+            return NULL;
+        }
+        void *block = map_region(o, size);
+        if (!block) {
+            return NULL;
+        }
+        o->bytes_used += size;
+        DebugCounter_Increment(&o->d_allocs);
+        return block;
+    }
+    
+    if (!o->free_lists[c] && !refill_class(o, c)) {
+        return NULL;
+    }
+    
+    // take block from free list
+    void *block = o->free_lists[c];
+    o->free_lists[c] = *(void **)block;
+    
+    o->bytes_used += class_size(c);
+    DebugCounter_Increment(&o->d_allocs);
+    
+    return block;
+}
+
+void * BArena_AllocArray (BArena *o, size_t count, size_t bytes)
+{
+    if (!o) {
+        return BAllocArray(count, bytes);
+    }
+    
+    if (bytes != 0 && count > SIZE_MAX / bytes) {
+        return NULL;
+    }
+    
+    return BArena_Alloc(o, count * bytes);
+}
+
+void BArena_Release (BArena *o, void *ptr, size_t bytes)
+{
+    ASSERT(ptr)
+    
+    if (!o) {
+        BFree(ptr);
+        return;
+    }
+    DebugObject_Access(&o->d_obj);
+    DebugCounter_Decrement(&o->d_allocs);
+    
+    int c = class_for_size(bytes);
+    
+    if (c < 0) {
+        size_t size = large_size(bytes);
+        ASSERT(size > 0)
+        ASSERT(o->bytes_used >= size)
+        o->bytes_used -= size;
+        unmap_region(o, ptr, size);
+        return;
+    }
+    
+    ASSERT(o->bytes_used >= class_size(c))
+    o->bytes_used -= class_size(c);
+    
+    push_block(o, c, ptr);
+}
+
+size_t BArena_BytesMapped (BArena *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->bytes_mapped;
+}
+
+size_t BArena_BytesUsed (BArena *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->bytes_used;
+}
+
+int BArena_ParsePages (const char *str, int *out_pages)
+{
+    if (!strcmp(str, "normal")) {
+        *out_pages = BARENA_PAGES_NORMAL;
+    }
+    else if (!strcmp(str, "thp")) {
+        *out_pages = BARENA_PAGES_THP;
+    }
+    else if (!strcmp(str, "hugetlb")) {
+        *out_pages = BARENA_PAGES_HUGETLB;
+    }
+    else {
+        return 0;
+    }
+    
+    return 1;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file BArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Per-thread allocator for long-lived buffers, backed by large chunks of
+ * memory which can use huge pages and are placed on the NUMA node of the
+ * thread using them.
+ */
+
+#ifndef BADVPN_BARENA_H
+#define BADVPN_BARENA_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <base/DebugObject.h>
+
+// kinds of pages backing the chunks
+#define BARENA_PAGES_NORMAL 1
+#define BARENA_PAGES_THP 2
+#define BARENA_PAGES_HUGETLB 3
+
+// size of chunks, which is also the size of a huge page
+#define BARENA_CHUNK_SIZE ((size_t)2 * 1024 * 1024)
+
+// size classes go from 64 bytes to 1 MiB, two per power of two
+#define BARENA_NUM_CLASSES 29
+
+/**
+ * Allocator for buffers which live as long as the objects owning them,
+ * such as packet buffers and object pool slabs.
+ * 
+ * Memory is mapped in chunks of {@link BARENA_CHUNK_SIZE} bytes and carved
+ * into blocks of fixed size classes; released blocks are kept on a free list
+ * of their class and reused. Allocations larger than the biggest class get a
+ * mapping of their own, which is unmapped when they are released. Chunks are
+ * only unmapped when the arena is freed, so like {@link BObjectPool}, the
+ * arena stays at its high-water mark.
+ * 
+ * On Linux, chunks are backed by transparent huge pages or hugetlbfs pages if
+ * requested, and bound (as a preference) to the NUMA node of the CPU the
+ * owning thread is running on when the arena maps its first chunk. Elsewhere,
+ * chunks come from {@link BAlloc}.
+ * 
+ * An arena is not thread-safe. The usual setup is an arena per reactor
+ * thread, attached to the reactor's pending group with
+ * {@link BPendingGroup_SetArena}, where flow objects pick it up.
+ */
+typedef struct {
+    int pages;
+    int node;
+    int hugetlb_failed;
+    void *chunks;
+    char *chunk_pos;
+    size_t chunk_left;
+    void *free_lists[BARENA_NUM_CLASSES];
+    size_t bytes_mapped;
+    size_t bytes_used;
+    DebugCounter d_allocs;
+    DebugObject d_obj;
+} BArena;
+
+/**
+ * Initializes the arena.
+ * No memory is mapped until the first allocation.
+ * 
+ * @param o the object
+ * @param pages kind of pages backing the chunks, one of BARENA_PAGES_*.
+ *              If hugetlbfs pages cannot be mapped, transparent huge pages
+ *              are used instead.
+ */
+void BArena_Init (BArena *o, int pages);
+
+/**
+ * Frees the arena and unmaps its memory.
+ * All allocated blocks must have been released.
+ * 
+ * @param o the object
+ */
+void BArena_Free (BArena *o);
+
+/**
+ * Allocates a block.
+ * 
+ * @param o the object, or NULL to allocate with {@link BAlloc}
+ * @param bytes size of the block
+ * @return pointer to the block, aligned for any type, or NULL on failure
+ */
+void * BArena_Alloc (BArena *o, size_t bytes);
+
+/**
+ * Allocates a block for an array, checking the size for overflow.
+ * 
+ * @param o the object, or NULL to allocate with {@link BAllocArray}
+ * @param count number of elements
+ * @param bytes size of one element
+ * @return pointer to the block, aligned for any type, or NULL on failure
+ */
+void * BArena_AllocArray (BArena *o, size_t count, size_t bytes);
+
+/**
+ * Releases a block.
+ * 
+ * @param o the object the block was allocated from, or NULL if it was
+ *          allocated with {@link BAlloc}
+ * @param ptr the block
+ * @param bytes size the block was allocated with; for blocks from
+ *              {@link BArena_AllocArray}, count times the element size
+ */
+void BArena_Release (BArena *o, void *ptr, size_t bytes);
+
+/**
+ * Returns the number of bytes mapped by the arena.
+ * 
+ * @param o the object
+ * @return number of bytes mapped
+ */
+size_t BArena_BytesMapped (BArena *o);
+
+/**
+ * Returns the number of bytes in allocated blocks, counting each block
+ * at the size of its class.
+ * 
+ * @param o the object
+ * @return number of bytes allocated
+ */
+size_t BArena_BytesUsed (BArena *o);
+
+/**
+ * Parses the name of a kind of pages: "normal", "thp" or "hugetlb".
+ * 
+ * @param str the name
+ * @param out_pages on success, the BARENA_PAGES_* value is returned here
+ * @return 1 on success, 0 if the name is not known
+ */
+int BArena_ParsePages (const char *str, int *out_pages);
+
+#endif
@@ -30,6 +30,12 @@
 #include <stdio.h>
 #include <stddef.h>
 
+#ifdef BADVPN_USE_WINAPI
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 #include "BLog.h"
 
 #ifndef BADVPN_PLUGIN
@@ -68,3 +74,63 @@ void BLog_InitStderr (void)
 {
     BLog_Init(stderr_log, stdout_stderr_free);
 }
+
+static int64_t ratelimit_now_ms (void)
+{
+#ifdef BADVPN_USE_WINAPI
+    return GetTickCount64();
+#else
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+        return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+#endif
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    return (int64_t)time(NULL) * 1000;
+#endif
+}
+
+int BLogRateLimit_Allow (BLogRateLimit *o, int interval_ms, int burst, int channel, int level)
+{
+    ASSERT(interval_ms > 0)
+    ASSERT(burst > 0)
+    
+    if (!BLog_WouldLog(channel, level)) {
+        return 0;
+    }
+    
+    int64_t now = ratelimit_now_ms();
+    unsigned long report_suppressed = 0;
+    int allow;
+    
+    // the state is shared by all threads logging from this call site
+    BMutex_Lock(&blog_global.mutex);
+    
+    // start a new interval if needed
+    if (!o->started || now - o->interval_start >= interval_ms) {
+        report_suppressed = o->suppressed;
+        o->started = 1;
+        o->interval_start = now;
+        o->count = 0;
+        o->suppressed = 0;
+    }
+    
+    if (o->count < burst) {
+        o->count++;
+        allow = 1;
+    } else {
+        o->suppressed++;
+        allow = 0;
+    }
+    
+    BMutex_Unlock(&blog_global.mutex);
+    
+    if (report_suppressed > 0) {
+        BLog_LogToChannel(channel, level, "%lu similar messages suppressed", report_suppressed);
+    }
+    
+    return allow;
+}
@@ -35,6 +35,7 @@
 #define BADVPN_BLOG_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <misc/debug.h>
@@ -51,8 +52,33 @@
 #define BLOG_INFO 4
 #define BLOG_DEBUG 5
 
-#define BLog(...) BLog_LogToChannel(BLOG_CURRENT_CHANNEL, __VA_ARGS__)
-#define BContextLog(context, ...) BLog_ContextLog((context), BLOG_CURRENT_CHANNEL, __VA_ARGS__)
+// Messages above this level are compiled out of BLog and BContextLog
+// calls, including the evaluation of their arguments. Can be lowered
+// at build time for hot paths which log per packet.
+#ifndef BLOG_COMPILE_LEVEL
+#define BLOG_COMPILE_LEVEL BLOG_DEBUG
+#endif
+
+#define BLOG_ENABLED(channel, level) ((level) <= BLOG_COMPILE_LEVEL && BLog_WouldLog((channel), (level)))
+
+// The level check is done before the arguments are evaluated.
+#define BLog(level, ...) ((void)(BLOG_ENABLED(BLOG_CURRENT_CHANNEL, (level)) && (BLog_LogToChannel(BLOG_CURRENT_CHANNEL, (level), __VA_ARGS__), 1)))
+#define BContextLog(context, level, ...) ((void)(BLOG_ENABLED(BLOG_CURRENT_CHANNEL, (level)) && (BLog_ContextLog((context), BLOG_CURRENT_CHANNEL, (level), __VA_ARGS__), 1)))
+
+// Executes the statement stmt at most burst times per interval_ms
+// milliseconds for this call site, and only if the channel would log
+// at this level. When a new interval starts after some executions were
+// suppressed, the number of suppressed messages is logged first.
+#define BLog_RateLimited(interval_ms, burst, channel, level, stmt) \
+    do { \
+        static BLogRateLimit blog__ratelimit; \
+        if ((level) <= BLOG_COMPILE_LEVEL && BLogRateLimit_Allow(&blog__ratelimit, (interval_ms), (burst), (channel), (level))) { \
+            stmt; \
+        } \
+    } while (0)
+
+#define BLogRateLimited(interval_ms, burst, level, ...) BLog_RateLimited((interval_ms), (burst), BLOG_CURRENT_CHANNEL, (level), BLog_LogToChannel(BLOG_CURRENT_CHANNEL, (level), __VA_ARGS__))
+
 #define BLOG_CCCC(context) BLog_MakeChannelContext((context), BLOG_CURRENT_CHANNEL)
 
 typedef void (*_BLog_log_func) (int channel, int level, const char *msg);
@@ -93,6 +119,13 @@ typedef struct {
     int channel;
 } BLogChannelContext;
 
+typedef struct {
+    int started;
+    int64_t interval_start;
+    int count;
+    unsigned long suppressed;
+} BLogRateLimit;
+
 static int BLogGlobal_GetChannelByName (const char *channel_name);
 
 static void BLog_Init (_BLog_log_func log_func, _BLog_free_func free_func);
@@ -118,6 +151,7 @@ static void BLog_ChannelContextLog (BLogChannelContext ccontext, int level, cons
 
 void BLog_InitStdout (void);
 void BLog_InitStderr (void);
+int BLogRateLimit_Allow (BLogRateLimit *o, int interval_ms, int burst, int channel, int level);
 
 int BLogGlobal_GetChannelByName (const char *channel_name)
 {
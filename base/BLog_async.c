@@ -0,0 +1,247 @@
+/**
+ * @file BLog_async.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <misc/debug.h>
+#include <structure/ChunkBufferSPSC.h>
+
+#include "BLog_async.h"
+
+#include <generated/blog_channel_BLogAsync.h>
+
+#define RING_BYTES (1024 * 1024)
+#define IDLE_TIMEOUT_MS 1000
+
+struct record_header {
+    int channel;
+    int level;
+};
+
+#define RECORD_MTU ((int)(sizeof(struct record_header) + sizeof(blog_global.logbuf)))
+
+static struct {
+    _BLog_log_func log_func;
+    _BLog_free_func free_func;
+    struct ChunkBuffer2_block *blocks;
+    ChunkBufferSPSC ring;
+    int wake_fds[2];
+    pthread_t thread;
+    int sleeping;
+    int quit;
+    unsigned long dropped;
+    unsigned long dropped_reported;
+    char msgbuf[sizeof(blog_global.logbuf)];
+} async_global;
+
+static void wake_writer (void)
+{
+    // only make a system call if the writer is about to sleep
+    if (__atomic_exchange_n(&async_global.sleeping, 0, __ATOMIC_ACQ_REL)) {
+        char c = 0;
+        if (write(async_global.wake_fds[1], &c, 1) < 0) {
+            // the pipe is full, so the writer will wake up anyway
+        }
+    }
+}
+
+static void async_log (int channel, int level, const char *msg)
+{
+    uint8_t *dest = ChunkBufferSPSC_ProducerGet(&async_global.ring);
+    if (!dest) {
+        __atomic_add_fetch(&async_global.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    size_t msg_len = strlen(msg);
+    
+    struct record_header header;
+    header.channel = channel;
+    header.level = level;
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), msg, msg_len);
+    
+    ChunkBufferSPSC_ProducerSubmit(&async_global.ring, sizeof(header) + msg_len);
+    
+    wake_writer();
+}
+
+// Passes all queued messages to the backend, returning whether
+// there were any.
+static int write_batch (void)
+{
+    int any = 0;
+    
+    uint8_t *data;
+    int len;
+    while ((len = ChunkBufferSPSC_ConsumerGet(&async_global.ring, &data)) >= 0) {
+        ASSERT(len >= (int)sizeof(struct record_header))
+        
+        struct record_header header;
+        memcpy(&header, data, sizeof(header));
+        
+        size_t msg_len = len - sizeof(header);
+        memcpy(async_global.msgbuf, data + sizeof(header), msg_len);
+        async_global.msgbuf[msg_len] = '\0';
+        
+        ChunkBufferSPSC_ConsumerConsume(&async_global.ring);
+        
+        async_global.log_func(header.channel, header.level, async_global.msgbuf);
+        any = 1;
+    }
+    
+    unsigned long dropped = __atomic_load_n(&async_global.dropped, __ATOMIC_RELAXED);
+    if (dropped != async_global.dropped_reported) {
+        snprintf(async_global.msgbuf, sizeof(async_global.msgbuf), "dropped %lu log messages (writer overrun)", dropped - async_global.dropped_reported);
+        async_global.log_func(BLOG_CURRENT_CHANNEL, BLOG_WARNING, async_global.msgbuf);
+        async_global.dropped_reported = dropped;
+        any = 1;
+    }
+    
+    if (any) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    
+    return any;
+}
+
+static void * writer_thread (void *unused)
+{
+    while (1) {
+        if (write_batch()) {
+            continue;
+        }
+        
+        if (__atomic_load_n(&async_global.quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        // announce that we're going to sleep, then check again so that
+        // a message submitted in between is not missed
+        __atomic_store_n(&async_global.sleeping, 1, __ATOMIC_SEQ_CST);
+        
+        if (write_batch()) {
+            __atomic_store_n(&async_global.sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        
+        struct pollfd pfd;
+        pfd.fd = async_global.wake_fds[0];
+        pfd.events = POLLIN;
+        poll(&pfd, 1, IDLE_TIMEOUT_MS);
+        
+        // drain wakeups
+        char buf[64];
+        while (read(async_global.wake_fds[0], buf, sizeof(buf)) > 0);
+        
+        __atomic_store_n(&async_global.sleeping, 0, __ATOMIC_RELAXED);
+    }
+    
+    return NULL;
+}
+
+static void async_free (void)
+{
+    // stop the writer; it writes out everything queued before exiting
+    __atomic_store_n(&async_global.quit, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&async_global.sleeping, 1, __ATOMIC_SEQ_CST);
+    wake_writer();
+    
+    int res = pthread_join(async_global.thread, NULL);
+    B_USE(res)
+    ASSERT(res == 0)
+    
+    close(async_global.wake_fds[0]);
+    close(async_global.wake_fds[1]);
+    free(async_global.blocks);
+    
+    async_global.free_func();
+}
+
+int BLog_StartAsync (void)
+{
+    ASSERT(blog_global.initialized)
+    ASSERT(blog_global.log_func != async_log)
+    
+    int num_blocks = RING_BYTES / sizeof(struct ChunkBuffer2_block);
+    
+    if (!(async_global.blocks = malloc(num_blocks * sizeof(struct ChunkBuffer2_block)))) {
+        goto fail0;
+    }
+    
+    ChunkBufferSPSC_Init(&async_global.ring, async_global.blocks, num_blocks, RECORD_MTU);
+    
+    if (pipe(async_global.wake_fds) < 0) {
+        goto fail1;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        if (fcntl(async_global.wake_fds[i], F_SETFL, O_NONBLOCK) < 0 ||
+            fcntl(async_global.wake_fds[i], F_SETFD, FD_CLOEXEC) < 0
+        ) {
+            goto fail2;
+        }
+    }
+    
+    async_global.log_func = blog_global.log_func;
+    async_global.free_func = blog_global.free_func;
+    async_global.sleeping = 0;
+    async_global.quit = 0;
+    async_global.dropped = 0;
+    async_global.dropped_reported = 0;
+    
+    if (pthread_create(&async_global.thread, NULL, writer_thread, NULL) != 0) {
+        goto fail2;
+    }
+    
+    // switch over; this is done with the BLog mutex held so that no
+    // message is being passed to the backend at the same time
+    BMutex_Lock(&blog_global.mutex);
+    blog_global.log_func = async_log;
+    blog_global.free_func = async_free;
+    BMutex_Unlock(&blog_global.mutex);
+    
+    return 1;
+    
+fail2:
+    close(async_global.wake_fds[0]);
+    close(async_global.wake_fds[1]);
+fail1:
+    free(async_global.blocks);
+fail0:
+    return 0;
+}
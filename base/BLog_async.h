@@ -0,0 +1,58 @@
+/**
+ * @file BLog_async.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Asynchronous BLog backend wrapper.
+ * 
+ * Once started, messages are no longer passed to the log backend by the
+ * logging thread. Instead they are copied into a lock-free single-producer
+ * single-consumer ring (producers are already serialized by the BLog mutex),
+ * and a background writer thread hands them to the backend in batches,
+ * flushing the standard output streams once per batch. When the ring is
+ * full, messages are dropped and counted; the writer reports the number of
+ * dropped messages through the backend.
+ */
+
+#ifndef BADVPN_BLOG_ASYNC_H
+#define BADVPN_BLOG_ASYNC_H
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+/**
+ * Makes logging asynchronous. Must be called after the logger has been
+ * initialized (e.g. with {@link BLog_InitStderr}) and before any other
+ * threads log. {@link BLog_Free} stops the writer thread after it has
+ * written out all queued messages, then frees the backend.
+ * 
+ * @return 1 on success, 0 on failure (logging stays synchronous)
+ */
+int BLog_StartAsync (void) WARN_UNUSED;
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * @file BMetrics.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+
+#include "BMetrics.h"
+
+static LinkedList1 metrics_list;
+
+static void init_common (BMetric *o, const char *name, const char *labels, const char *help, int type)
+{
+    ASSERT(name)
+    ASSERT(help)
+    
+    o->name = name;
+    o->labels = labels;
+    o->help = help;
+    o->type = type;
+    o->value = 0;
+    o->gauge = 0;
+    o->gauge_func = NULL;
+    o->gauge_func_user = NULL;
+    o->hist_sum = 0;
+    memset(o->hist_buckets, 0, sizeof(o->hist_buckets));
+    o->statsd_value = 0;
+    o->statsd_sum = 0;
+    
+    LinkedList1_Append(&metrics_list, &o->list_node);
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+static int append_uint (ExpString *out, uint64_t v)
+{
+    char buf[24];
+    sprintf(buf, "%"PRIu64, v);
+    return ExpString_Append(out, buf);
+}
+
+static int append_int (ExpString *out, int64_t v)
+{
+    char buf[24];
+    sprintf(buf, "%"PRId64, v);
+    return ExpString_Append(out, buf);
+}
+
+static int64_t gauge_value (BMetric *o)
+{
+    return (o->gauge_func ? o->gauge_func(o->gauge_func_user) : o->gauge);
+}
+
+// Writes name[suffix]{labels[,extra]} followed by a space.
+static int write_series (ExpString *out, BMetric *o, const char *suffix, const char *extra_label)
+{
+    if (!ExpString_Append(out, o->name) || !ExpString_Append(out, suffix)) {
+        return 0;
+    }
+    
+    int have_labels = (o->labels && o->labels[0]);
+    
+    if (have_labels || extra_label) {
+        if (!ExpString_AppendChar(out, '{') ||
+            (have_labels && !ExpString_Append(out, o->labels)) ||
+            (have_labels && extra_label && !ExpString_AppendChar(out, ',')) ||
+            (extra_label && !ExpString_Append(out, extra_label)) ||
+            !ExpString_AppendChar(out, '}')
+        ) {
+            return 0;
+        }
+    }
+    
+    return ExpString_AppendChar(out, ' ');
+}
+
+static int write_prometheus_samples (ExpString *out, BMetric *o)
+{
+    switch (o->type) {
+        case BMETRIC_TYPE_COUNTER: {
+            if (!write_series(out, o, "", NULL) || !append_uint(out, o->value) || !ExpString_AppendChar(out, '\n')) {
+                return 0;
+            }
+        } break;
+        
+        case BMETRIC_TYPE_GAUGE: {
+            if (!write_series(out, o, "", NULL) || !append_int(out, gauge_value(o)) || !ExpString_AppendChar(out, '\n')) {
+                return 0;
+            }
+        } break;
+        
+        case BMETRIC_TYPE_HISTOGRAM: {
+            uint64_t cumulative = 0;
+            for (int b = 0; b < BMETRICS_HIST_BUCKETS - 1; b++) {
+                cumulative += o->hist_buckets[b];
+                char le[32];
+                sprintf(le, "le=\"%"PRIu64"\"", (b == 0 ? 0 : ((uint64_t)1 << b) - 1));
+                if (!write_series(out, o, "_bucket", le) || !append_uint(out, cumulative) || !ExpString_AppendChar(out, '\n')) {
+                    return 0;
+                }
+            }
+            if (!write_series(out, o, "_bucket", "le=\"+Inf\"") || !append_uint(out, o->value) || !ExpString_AppendChar(out, '\n') ||
+                !write_series(out, o, "_sum", NULL) || !append_uint(out, o->hist_sum) || !ExpString_AppendChar(out, '\n') ||
+                !write_series(out, o, "_count", NULL) || !append_uint(out, o->value) || !ExpString_AppendChar(out, '\n')
+            ) {
+                return 0;
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+    
+    return 1;
+}
+
+// Writes the name with the label values appended, separated by dots.
+static int write_statsd_name (ExpString *out, BMetric *o, const char *suffix)
+{
+    if (!ExpString_Append(out, o->name)) {
+        return 0;
+    }
+    
+    if (o->labels) {
+        int in_value = 0;
+        for (const char *c = o->labels; *c; c++) {
+            if (*c == '"') {
+                in_value = !in_value;
+                if (in_value && !ExpString_AppendChar(out, '.')) {
+                    return 0;
+                }
+            }
+            else if (in_value && !ExpString_AppendChar(out, (*c == ':' || *c == '|' || *c == '.') ? '_' : *c)) {
+                return 0;
+            }
+        }
+    }
+    
+    return ExpString_Append(out, suffix);
+}
+
+static int write_statsd_line (ExpString *out, BMetric *o, const char *suffix, int64_t v, const char *type)
+{
+    return write_statsd_name(out, o, suffix) && ExpString_AppendChar(out, ':') && append_int(out, v) &&
+           ExpString_AppendChar(out, '|') && ExpString_Append(out, type) && ExpString_AppendChar(out, '\n');
+}
+
+void BMetric_InitCounter (BMetric *o, const char *name, const char *labels, const char *help)
+{
+    init_common(o, name, labels, help, BMETRIC_TYPE_COUNTER);
+}
+
+void BMetric_InitGauge (BMetric *o, const char *name, const char *labels, const char *help)
+{
+    init_common(o, name, labels, help, BMETRIC_TYPE_GAUGE);
+}
+
+void BMetric_InitGaugeFunc (BMetric *o, const char *name, const char *labels, const char *help, BMetric_gauge_func func, void *user)
+{
+    ASSERT(func)
+    
+    init_common(o, name, labels, help, BMETRIC_TYPE_GAUGE);
+    o->gauge_func = func;
+    o->gauge_func_user = user;
+}
+
+void BMetric_InitHistogram (BMetric *o, const char *name, const char *labels, const char *help)
+{
+    init_common(o, name, labels, help, BMETRIC_TYPE_HISTOGRAM);
+}
+
+void BMetric_Free (BMetric *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    LinkedList1_Remove(&metrics_list, &o->list_node);
+}
+
+int BMetrics_WritePrometheus (ExpString *out)
+{
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&metrics_list); n; n = LinkedList1Node_Next(n)) {
+        BMetric *o = UPPER_OBJECT(n, BMetric, list_node);
+        o->exported = 0;
+    }
+    
+    // write each family once, with all metrics of the same name under it
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&metrics_list); n; n = LinkedList1Node_Next(n)) {
+        BMetric *o = UPPER_OBJECT(n, BMetric, list_node);
+        if (o->exported) {
+            continue;
+        }
+        
+        const char *type_str = (o->type == BMETRIC_TYPE_COUNTER ? "counter" : o->type == BMETRIC_TYPE_GAUGE ? "gauge" : "histogram");
+        
+        if (!ExpString_Append(out, "# HELP ") || !ExpString_Append(out, o->name) || !ExpString_AppendChar(out, ' ') ||
+            !ExpString_Append(out, o->help) || !ExpString_AppendChar(out, '\n') ||
+            !ExpString_Append(out, "# TYPE ") || !ExpString_Append(out, o->name) || !ExpString_AppendChar(out, ' ') ||
+            !ExpString_Append(out, type_str) || !ExpString_AppendChar(out, '\n')
+        ) {
+            return 0;
+        }
+        
+        for (LinkedList1Node *n2 = n; n2; n2 = LinkedList1Node_Next(n2)) {
+            BMetric *o2 = UPPER_OBJECT(n2, BMetric, list_node);
+            if (o2->exported || strcmp(o2->name, o->name)) {
+                continue;
+            }
+            if (!write_prometheus_samples(out, o2)) {
+                return 0;
+            }
+            o2->exported = 1;
+        }
+    }
+    
+    return 1;
+}
+
+int BMetrics_WriteStatsd (ExpString *out)
+{
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&metrics_list); n; n = LinkedList1Node_Next(n)) {
+        BMetric *o = UPPER_OBJECT(n, BMetric, list_node);
+        DebugObject_Access(&o->d_obj);
+        
+        switch (o->type) {
+            case BMETRIC_TYPE_COUNTER: {
+                if (!write_statsd_line(out, o, "", o->value - o->statsd_value, "c")) {
+                    return 0;
+                }
+                o->statsd_value = o->value;
+            } break;
+            
+            case BMETRIC_TYPE_GAUGE: {
+                int64_t v = gauge_value(o);
+                // a signed gauge value means a change, so reset it to zero first
+                if (v < 0 && !write_statsd_line(out, o, "", 0, "g")) {
+                    return 0;
+                }
+                if (!write_statsd_line(out, o, "", v, "g")) {
+                    return 0;
+                }
+            } break;
+            
+            case BMETRIC_TYPE_HISTOGRAM: {
+                if (!write_statsd_line(out, o, ".count", o->value - o->statsd_value, "c") ||
+                    !write_statsd_line(out, o, ".sum", o->hist_sum - o->statsd_sum, "c")
+                ) {
+                    return 0;
+                }
+                o->statsd_value = o->value;
+                o->statsd_sum = o->hist_sum;
+            } break;
+            
+            default: ASSERT(0);
+        }
+    }
+    
+    return 1;
+}
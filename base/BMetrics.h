@@ -0,0 +1,230 @@
+/**
+ * @file BMetrics.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Registry of runtime metrics (counters, gauges and histograms) which can be
+ * exported in the Prometheus text format or as StatsD lines, e.g. by
+ * {@link BMetricsExporter}.
+ * 
+ * Metrics are registered globally while they are initialized. Updating one is
+ * a plain memory write, cheap enough for per-packet use; consequently metrics
+ * must only be updated and exported from a single thread (the reactor's).
+ * Histograms have power-of-two buckets: bucket 0 counts zeros and bucket i
+ * counts values v with 2^(i-1) <= v < 2^i, the last one also everything
+ * larger.
+ */
+
+#ifndef BADVPN_BMETRICS_H
+#define BADVPN_BMETRICS_H
+
+#include <stdint.h>
+
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+
+#define BMETRIC_TYPE_COUNTER 1
+#define BMETRIC_TYPE_GAUGE 2
+#define BMETRIC_TYPE_HISTOGRAM 3
+
+#define BMETRICS_HIST_BUCKETS 24
+
+/**
+ * Computes the value of a gauge when it is exported.
+ * 
+ * @param user as in {@link BMetric_InitGaugeFunc}
+ * @return current value
+ */
+typedef int64_t (*BMetric_gauge_func) (void *user);
+
+typedef struct {
+    const char *name;
+    const char *labels;
+    const char *help;
+    int type;
+    uint64_t value;
+    int64_t gauge;
+    BMetric_gauge_func gauge_func;
+    void *gauge_func_user;
+    uint64_t hist_sum;
+    uint64_t hist_buckets[BMETRICS_HIST_BUCKETS];
+    uint64_t statsd_value;
+    uint64_t statsd_sum;
+    int exported;
+    LinkedList1Node list_node;
+    DebugObject d_obj;
+} BMetric;
+
+/**
+ * Initializes and registers a counter, starting at zero.
+ * 
+ * @param o the object
+ * @param name metric name, e.g. "badvpn_udpgw_bytes_total". Must stay valid
+ *             while the metric exists.
+ * @param labels labels in Prometheus syntax without braces, e.g.
+ *               "direction=\"in\"", or NULL. Must stay valid.
+ * @param help one line description. Metrics with the same name should have the
+ *             same type and help. Must stay valid.
+ */
+void BMetric_InitCounter (BMetric *o, const char *name, const char *labels, const char *help);
+
+/**
+ * Initializes and registers a gauge which is set explicitly, starting at zero.
+ * Arguments are as in {@link BMetric_InitCounter}.
+ */
+void BMetric_InitGauge (BMetric *o, const char *name, const char *labels, const char *help);
+
+/**
+ * Initializes and registers a gauge whose value is computed by a function
+ * each time it is exported.
+ * Arguments are as in {@link BMetric_InitCounter}, and:
+ * 
+ * @param func function computing the value
+ * @param user argument to func
+ */
+void BMetric_InitGaugeFunc (BMetric *o, const char *name, const char *labels, const char *help, BMetric_gauge_func func, void *user);
+
+/**
+ * Initializes and registers a histogram.
+ * Arguments are as in {@link BMetric_InitCounter}; the name should include
+ * the unit of observed values.
+ */
+void BMetric_InitHistogram (BMetric *o, const char *name, const char *labels, const char *help);
+
+/**
+ * Unregisters and frees the metric.
+ * 
+ * @param o the object
+ */
+void BMetric_Free (BMetric *o);
+
+/**
+ * Increments a counter.
+ * 
+ * @param o the object, a counter
+ * @param v amount to add
+ */
+static void BMetric_Add (BMetric *o, uint64_t v);
+
+/**
+ * Sets a gauge which is set explicitly.
+ * 
+ * @param o the object, a gauge not using a function
+ * @param v new value
+ */
+static void BMetric_Set (BMetric *o, int64_t v);
+
+/**
+ * Adds to a gauge which is set explicitly.
+ * 
+ * @param o the object, a gauge not using a function
+ * @param v amount to add, may be negative
+ */
+static void BMetric_AddGauge (BMetric *o, int64_t v);
+
+/**
+ * Records a value into a histogram.
+ * 
+ * @param o the object, a histogram
+ * @param v observed value
+ */
+static void BMetric_Observe (BMetric *o, uint64_t v);
+
+/**
+ * Returns the value of a counter.
+ * 
+ * @param o the object, a counter
+ * @return number of all increments so far
+ */
+static uint64_t BMetric_Value (BMetric *o);
+
+/**
+ * Writes all registered metrics in the Prometheus text exposition format.
+ * 
+ * @param out string to append to
+ * @return 1 on success, 0 on allocation failure
+ */
+int BMetrics_WritePrometheus (ExpString *out) WARN_UNUSED;
+
+/**
+ * Writes all registered metrics as StatsD lines, one per line. Counters and
+ * histogram counts and sums are written as the increase since the previous
+ * call, gauges as their value. Label values are appended to the name,
+ * separated by dots.
+ * 
+ * @param out string to append to
+ * @return 1 on success, 0 on allocation failure
+ */
+int BMetrics_WriteStatsd (ExpString *out) WARN_UNUSED;
+
+void BMetric_Add (BMetric *o, uint64_t v)
+{
+    ASSERT(o->type == BMETRIC_TYPE_COUNTER)
+    
+    o->value += v;
+}
+
+void BMetric_Set (BMetric *o, int64_t v)
+{
+    ASSERT(o->type == BMETRIC_TYPE_GAUGE)
+    ASSERT(!o->gauge_func)
+    
+    o->gauge = v;
+}
+
+void BMetric_AddGauge (BMetric *o, int64_t v)
+{
+    ASSERT(o->type == BMETRIC_TYPE_GAUGE)
+    ASSERT(!o->gauge_func)
+    
+    o->gauge += v;
+}
+
+void BMetric_Observe (BMetric *o, uint64_t v)
+{
+    ASSERT(o->type == BMETRIC_TYPE_HISTOGRAM)
+    
+    int b = 0;
+    while (b < BMETRICS_HIST_BUCKETS - 1 && (v >> b) != 0) {
+        b++;
+    }
+    
+    o->value++;
+    o->hist_sum += v;
+    o->hist_buckets[b]++;
+}
+
+uint64_t BMetric_Value (BMetric *o)
+{
+    ASSERT(o->type == BMETRIC_TYPE_COUNTER)
+    
+    return o->value;
+}
+
+#endif
@@ -42,6 +42,9 @@ void BPendingGroup_Init (BPendingGroup *g)
     // init jobs list
     BPending__List_Init(&g->jobs);
     
+    // buffers are allocated with BAlloc until an arena is set
+    g->arena = NULL;
+    
     // init pending counter
     DebugCounter_Init(&g->pending_ctr);
     
@@ -56,6 +59,20 @@ void BPendingGroup_Free (BPendingGroup *g)
     DebugObject_Free(&g->d_obj);
 }
 
+void BPendingGroup_SetArena (BPendingGroup *g, BArena *arena)
+{
+    DebugObject_Access(&g->d_obj);
+    
+    g->arena = arena;
+}
+
+BArena * BPendingGroup_Arena (BPendingGroup *g)
+{
+    DebugObject_Access(&g->d_obj);
+    
+    return g->arena;
+}
+
 int BPendingGroup_HasJobs (BPendingGroup *g)
 {
     DebugObject_Access(&g->d_obj);
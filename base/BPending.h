@@ -39,6 +39,7 @@
 #include <misc/debugcounter.h>
 #include <structure/SLinkedList.h>
 #include <base/DebugObject.h>
+#include <base/BArena.h>
 
 struct BSmallPending_s;
 
@@ -69,9 +70,16 @@ typedef void (*BPending_handler) (void *user);
 
 /**
  * Object that contains a list of jobs pending execution.
+ * The owner of the group decides when the jobs run relative to other events.
+ * The reactor's group (see {@link BReactor_PendingGroup}) runs all pending
+ * jobs before any timer or file descriptor event, except when a job budget
+ * is set (see {@link BReactor_SetJobBudget}); then single events may be
+ * dispatched between jobs, and a handler may see a job still pending that
+ * was set before the event happened.
  */
 typedef struct {
     BPending__List jobs;
+    BArena *arena;
     DebugCounter pending_ctr;
     DebugObject d_obj;
 } BPendingGroup;
@@ -115,6 +123,25 @@ void BPendingGroup_Init (BPendingGroup *g);
  */
 void BPendingGroup_Free (BPendingGroup *g);
 
+/**
+ * Sets the arena which objects using this group allocate their buffers from.
+ * Since a group belongs to one thread, so does the arena. It must stay
+ * alive until all objects which allocated from it are freed; objects
+ * initialized before this call keep using the previous arena.
+ * 
+ * @param g the object
+ * @param arena the arena, or NULL to allocate with {@link BAlloc}
+ */
+void BPendingGroup_SetArena (BPendingGroup *g, BArena *arena);
+
+/**
+ * Returns the arena set with {@link BPendingGroup_SetArena}.
+ * 
+ * @param g the object
+ * @return the arena, or NULL if none is set
+ */
+BArena * BPendingGroup_Arena (BPendingGroup *g);
+
 /**
  * Checks if there is at least one job in the queue.
  * 
@@ -166,6 +166,11 @@ function make_add_count_assert ($msg, $entry)
     return "";
 }
 
+function entry_is_single ($entry)
+{
+    return in_array($entry["cardinality"], array("optional", "required"));
+}
+
 function make_add_length_assert ($msg, $entry)
 {
     if ($entry["type"]["type"] == "data") {
@@ -276,6 +281,18 @@ EOD;
     int {$entry["name"]}_pos;
 
 EOD;
+            if (entry_is_single($entry)) {
+                echo <<<EOD
+    int {$entry["name"]}_off;
+
+EOD;
+                if ($entry["type"]["type"] == "data") {
+                    echo <<<EOD
+    int {$entry["name"]}_len;
+
+EOD;
+                }
+            }
         }
 
         echo <<<EOD
@@ -435,6 +452,18 @@ EOD;
     o->{$entry["name"]}_pos = 0;
 
 EOD;
+            if (entry_is_single($entry)) {
+                echo <<<EOD
+    o->{$entry["name"]}_off = 0;
+
+EOD;
+                if ($entry["type"]["type"] == "data") {
+                    echo <<<EOD
+    o->{$entry["name"]}_len = 0;
+
+EOD;
+                }
+            }
         }
 
         echo <<<EOD
@@ -496,6 +525,15 @@ EOD;
                         }
                         o->{$entry["name"]}_span = pos - o->{$entry["name"]}_start;
                         {$entry["name"]}_count++;
+
+EOD;
+                if (entry_is_single($entry)) {
+                    echo <<<EOD
+                        o->{$entry["name"]}_off = pos - sizeof(struct BProto_uint{$bits}_s);
+
+EOD;
+                }
+                echo <<<EOD
                         break;
 
 EOD;
@@ -559,6 +597,21 @@ EOD;
                         }
                         o->{$entry["name"]}_span = pos - o->{$entry["name"]}_start;
                         {$entry["name"]}_count++;
+
+EOD;
+            if (entry_is_single($entry)) {
+                echo <<<EOD
+                        o->{$entry["name"]}_off = pos - payload_len;
+
+EOD;
+                if ($entry["type"]["type"] == "data") {
+                    echo <<<EOD
+                        o->{$entry["name"]}_len = payload_len;
+
+EOD;
+                }
+            }
+            echo <<<EOD
                         break;
 
 EOD;
@@ -645,6 +698,69 @@ EOD;
             $forward_decl = make_parser_forward_decl($msg, $entry);
             $type = make_type_name($msg, $entry);
 
+            if (entry_is_single($entry)) {
+                // the field occurs at most once and Init recorded where
+                echo <<<EOD
+{$decl}
+{
+    ASSERT(o->{$entry["name"]}_pos == 0 || o->{$entry["name"]}_pos == o->{$entry["name"]}_span)
+
+    if (o->{$entry["name"]}_pos == o->{$entry["name"]}_span) {
+        return 0;
+    }
+
+
+EOD;
+                switch ($entry["type"]["type"]) {
+                    case "uint":
+                        echo <<<EOD
+    struct BProto_uint{$entry["type"]["size"]}_s val;
+    memcpy(&val, o->buf + o->{$entry["name"]}_off, sizeof(val));
+    o->{$entry["name"]}_pos = o->{$entry["name"]}_span;
+
+    *v = ltoh{$entry["type"]["size"]}(val.v);
+
+EOD;
+                        break;
+                    case "data":
+                        echo <<<EOD
+    o->{$entry["name"]}_pos = o->{$entry["name"]}_span;
+
+    *data = o->buf + o->{$entry["name"]}_off;
+    *data_len = o->{$entry["name"]}_len;
+
+EOD;
+                        break;
+                    case "constdata":
+                        echo <<<EOD
+    o->{$entry["name"]}_pos = o->{$entry["name"]}_span;
+
+    *data = o->buf + o->{$entry["name"]}_off;
+
+EOD;
+                        break;
+                    default:
+                        assert(0);
+                }
+                echo <<<EOD
+    return 1;
+}
+
+{$reset_decl}
+{
+    o->{$entry["name"]}_pos = 0;
+}
+
+{$forward_decl}
+{
+    o->{$entry["name"]}_pos = o->{$entry["name"]}_span;
+}
+
+
+EOD;
+                continue;
+            }
+
             echo <<<EOD
 {$decl}
 {
@@ -34,6 +34,8 @@
 #include <protocol/dataproto.h>
 #include <misc/byteorder.h>
 #include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/lz4.h>
 #include <base/BLog.h>
 
 #include <client/DPReceive.h>
@@ -42,14 +44,7 @@
 
 static DPReceivePeer * find_peer (DPReceiveDevice *o, peerid_t id)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->peers_list); node; node = LinkedList1Node_Next(node)) {
-        DPReceivePeer *p = UPPER_OBJECT(node, DPReceivePeer, list_node);
-        if (p->peer_id == id) {
-            return p;
-        }
-    }
-    
-    return NULL;
+    return (DPReceivePeer *)PeerTable_Get(&o->peers_table, id);
 }
 
 static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, int packet_len)
@@ -60,10 +55,15 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     ASSERT(packet_len >= 0)
     ASSERT(packet_len <= device->packet_mtu)
     
+    // count packet
+    peer->stats.packets++;
+    peer->stats.bytes += packet_len;
+    
     uint8_t *data = packet;
     int data_len = packet_len;
     
     int local = 0;
+    int invalid = 1;
     DPReceivePeer *src_peer;
     DPReceivePeer *relay_dest_peer = NULL;
     
@@ -98,6 +98,18 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
         data_len -= sizeof(id);
     }
     
+    // decompress payload; the frame is consumed before the next packet arrives,
+    // so one buffer is enough
+    if (flags & DATAPROTO_FLAGS_COMPRESSED) {
+        int frame_len = lz4_decompress(data, data_len, device->decompress_buf, device->device_mtu);
+        if (frame_len < 0) {
+            BLog(BLOG_WARNING, "failed to decompress frame");
+            goto out;
+        }
+        data = device->decompress_buf;
+        data_len = frame_len;
+    }
+    
     // check remaining data
     if (data_len > device->device_mtu) {
         BLog(BLOG_WARNING, "frame too large");
@@ -106,9 +118,19 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     
     // inform sink of received packet
     if (peer->dp_sink) {
-        DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES));
+        DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES), !!(flags & DATAPROTO_FLAGS_ACCEPTS_COMPRESSION));
+        
+        // keep-alives may carry timing information
+        if (num_ids == 0 && data_len >= sizeof(struct dataproto_keepalive)) {
+            struct dataproto_keepalive ka;
+            memcpy(&ka, data, sizeof(ka));
+            DataProtoSink_ReceivedKeepalive(peer->dp_sink, &ka, !!(flags & DATAPROTO_FLAGS_PROBE));
+        }
     }
     
+    // packet is well-formed; unknown peers are not counted as invalid
+    invalid = 0;
+    
     if (num_ids == 1) {
         // find source peer
         if (!(src_peer = find_peer(device, from_id))) {
@@ -127,12 +149,14 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
             // check if relaying is allowed
             if (!peer->is_relay_client) {
                 BLog(BLOG_WARNING, "relaying not allowed");
+                invalid = 1;
                 goto out;
             }
             
             // provided source ID must be the peer sending the frame
             if (src_peer != peer) {
                 BLog(BLOG_WARNING, "relay source must be the sending peer");
+                invalid = 1;
                 goto out;
             }
             
@@ -146,6 +170,7 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
             // destination cannot be source
             if (dest_peer == src_peer) {
                 BLog(BLOG_WARNING, "relay destination cannot be the source");
+                invalid = 1;
                 goto out;
             }
             
@@ -154,6 +179,17 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     }
     
 out:
+    // update counters
+    if (invalid) {
+        peer->stats.packets_invalid++;
+    }
+    if (local) {
+        peer->stats.frames_local++;
+    }
+    if (relay_dest_peer) {
+        peer->stats.frames_relayed++;
+    }
+    
     // accept packet
     PacketPassInterface_Done(&o->recv_if);
     
@@ -164,7 +200,7 @@ out:
     
     // relay frame
     if (relay_dest_peer) {
-        DPRelayRouter_SubmitFrame(&device->relay_router, &src_peer->relay_source, &relay_dest_peer->relay_sink, data, data_len, device->relay_flow_buffer_size, device->relay_flow_inactivity_time);
+        DPRelayRouter_SubmitFrame(&device->relay_router, &src_peer->relay_source, &relay_dest_peer->relay_sink, data, data_len, device->relay_flow_buffer_size);
     }
 }
 
@@ -186,21 +222,30 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
     // remember packet MTU
     o->packet_mtu = DATAPROTO_MAX_OVERHEAD + o->device_mtu;
     
+    // allocate decompression buffer
+    if (!(o->decompress_buf = (uint8_t *)BAlloc(o->device_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
     // init relay router
-    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, o->reactor)) {
+    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, o->relay_flow_inactivity_time, o->reactor)) {
         BLog(BLOG_ERROR, "DPRelayRouter_Init failed");
-        goto fail0;
+        goto fail1;
     }
     
     // have no peer ID
     o->have_peer_id = 0;
     
-    // init peers list
-    LinkedList1_Init(&o->peers_list);
+    // init peers table
+    PeerTable_Init(&o->peers_table);
     
     DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_peers_ctr);
     return 1;
     
+fail1:
+    BFree(o->decompress_buf);
 fail0:
     return 0;
 }
@@ -208,10 +253,16 @@ fail0:
 void DPReceiveDevice_Free (DPReceiveDevice *o)
 {
     DebugObject_Free(&o->d_obj);
-    ASSERT(LinkedList1_IsEmpty(&o->peers_list))
+    DebugCounter_Free(&o->d_peers_ctr);
+    
+    // free peers table
+    PeerTable_Free(&o->peers_table);
     
     // free relay router
     DPRelayRouter_Free(&o->relay_router);
+    
+    // free decompression buffer
+    BFree(o->decompress_buf);
 }
 
 void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id)
@@ -223,7 +274,7 @@ void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id)
     o->have_peer_id = 1;
 }
 
-void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t peer_id, FrameDeciderPeer *decider_peer, int is_relay_client)
+int DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t peer_id, FrameDeciderPeer *decider_peer, int is_relay_client)
 {
     DebugObject_Access(&device->d_obj);
     ASSERT(is_relay_client == 0 || is_relay_client == 1)
@@ -234,8 +285,17 @@ void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t pee
     o->decider_peer = decider_peer;
     o->is_relay_client = is_relay_client;
     
+    // insert to peers table
+    if (!PeerTable_Add(&device->peers_table, o->peer_id, o)) {
+        BLog(BLOG_ERROR, "PeerTable_Add failed");
+        goto fail0;
+    }
+    
     // init relay source
-    DPRelaySource_Init(&o->relay_source, &device->relay_router, o->peer_id, device->reactor);
+    if (!DPRelaySource_Init(&o->relay_source, &device->relay_router, o->peer_id, device->reactor)) {
+        BLog(BLOG_ERROR, "DPRelaySource_Init failed");
+        goto fail1;
+    }
     
     // init relay sink
     DPRelaySink_Init(&o->relay_sink, o->peer_id);
@@ -243,11 +303,18 @@ void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t pee
     // have no sink
     o->dp_sink = NULL;
     
-    // insert to peers list
-    LinkedList1_Append(&device->peers_list, &o->list_node);
+    // zero counters
+    memset(&o->stats, 0, sizeof(o->stats));
     
+    DebugCounter_Increment(&device->d_peers_ctr);
     DebugCounter_Init(&o->d_receivers_ctr);
     DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    PeerTable_Remove(&device->peers_table, o->peer_id);
+fail0:
+    return 0;
 }
 
 void DPReceivePeer_Free (DPReceivePeer *o)
@@ -256,8 +323,10 @@ void DPReceivePeer_Free (DPReceivePeer *o)
     DebugCounter_Free(&o->d_receivers_ctr);
     ASSERT(!o->dp_sink)
     
-    // remove from peers list
-    LinkedList1_Remove(&o->device->peers_list, &o->list_node);
+    DebugCounter_Decrement(&o->device->d_peers_ctr);
+    
+    // remove from peers table
+    PeerTable_Remove(&o->device->peers_table, o->peer_id);
     
     // free relay sink
     DPRelaySink_Free(&o->relay_sink);
@@ -289,6 +358,13 @@ void DPReceivePeer_DetachSink (DPReceivePeer *o)
     o->dp_sink = NULL;
 }
 
+void DPReceivePeer_GetStats (DPReceivePeer *o, struct DPReceivePeer_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *stats = o->stats;
+}
+
 void DPReceiveReceiver_Init (DPReceiveReceiver *o, DPReceivePeer *peer)
 {
     DebugObject_Access(&peer->d_obj);
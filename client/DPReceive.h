@@ -34,19 +34,29 @@
 #ifndef BADVPN_CLIENT_DPRECEIVE_H
 #define BADVPN_CLIENT_DPRECEIVE_H
 
+#include <stdint.h>
+
 #include <protocol/scproto.h>
 #include <misc/debugcounter.h>
 #include <misc/debug.h>
-#include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <client/DataProto.h>
 #include <client/DPRelay.h>
 #include <client/FrameDecider.h>
+#include <client/PeerTable.h>
 
 typedef void (*DPReceiveDevice_output_func) (void *output_user, uint8_t *data, int data_len);
 
 struct DPReceiveReceiver_s;
 
+struct DPReceivePeer_stats {
+    uint64_t packets; // packets received from the peer
+    uint64_t bytes; // bytes received from the peer, including DataProto headers
+    uint64_t frames_local; // frames passed to the device
+    uint64_t frames_relayed; // frames submitted for relaying
+    uint64_t packets_invalid; // packets rejected
+};
+
 typedef struct {
     int device_mtu;
     DPReceiveDevice_output_func output_func;
@@ -55,11 +65,13 @@ typedef struct {
     int relay_flow_buffer_size;
     int relay_flow_inactivity_time;
     int packet_mtu;
+    uint8_t *decompress_buf;
     DPRelayRouter relay_router;
     int have_peer_id;
     peerid_t peer_id;
-    LinkedList1 peers_list;
+    PeerTable peers_table;
     DebugObject d_obj;
+    DebugCounter d_peers_ctr;
 } DPReceiveDevice;
 
 typedef struct {
@@ -70,7 +82,7 @@ typedef struct {
     DPRelaySource relay_source;
     DPRelaySink relay_sink;
     DataProtoSink *dp_sink;
-    LinkedList1Node list_node;
+    struct DPReceivePeer_stats stats;
     DebugObject d_obj;
     DebugCounter d_receivers_ctr;
 } DPReceivePeer;
@@ -86,10 +98,11 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
 void DPReceiveDevice_Free (DPReceiveDevice *o);
 void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id);
 
-void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t peer_id, FrameDeciderPeer *decider_peer, int is_relay_client);
+int DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t peer_id, FrameDeciderPeer *decider_peer, int is_relay_client) WARN_UNUSED;
 void DPReceivePeer_Free (DPReceivePeer *o);
 void DPReceivePeer_AttachSink (DPReceivePeer *o, DataProtoSink *dp_sink);
 void DPReceivePeer_DetachSink (DPReceivePeer *o);
+void DPReceivePeer_GetStats (DPReceivePeer *o, struct DPReceivePeer_stats *stats);
 
 void DPReceiveReceiver_Init (DPReceiveReceiver *o, DPReceivePeer *peer);
 void DPReceiveReceiver_Free (DPReceiveReceiver *o);
@@ -29,6 +29,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <misc/offset.h>
 #include <base/BLog.h>
@@ -37,11 +38,20 @@
 
 #include <generated/blog_channel_DPRelay.h>
 
-static void flow_inactivity_handler (struct DPRelay_flow *flow);
+#define DPRELAY_FLOWS_HASH_CAPACITY 8
 
-static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink, int num_packets, int inactivity_time)
+static size_t hash_peer_id (peerid_t id)
+{
+    return (size_t)id * 2654435761u;
+}
+
+#include "DPRelay_flows_hash.h"
+#include <structure/OHash_impl.h>
+
+static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink, int num_packets)
 {
     ASSERT(num_packets > 0)
+    DPRelayRouter *router = src->router;
     
     // allocate structure
     struct DPRelay_flow *flow = (struct DPRelay_flow *)malloc(sizeof(*flow));
@@ -54,18 +64,40 @@ static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink,
     flow->src = src;
     flow->sink = sink;
     
-    // init DataProtoFlow
-    if (!DataProtoFlow_Init(&flow->dp_flow, &src->router->dp_source, src->source_id, sink->dest_id, num_packets, inactivity_time, flow, (DataProtoFlow_handler_inactivity)flow_inactivity_handler)) {
+    // init DataProtoFlow; inactivity is tracked by the router for all flows at once
+    if (!DataProtoFlow_Init(&flow->dp_flow, &router->dp_source, src->source_id, sink->dest_id, num_packets, -1, NULL, NULL)) {
         BLog(BLOG_ERROR, "relay flow %d->%d: DataProtoFlow_Init failed", (int)src->source_id, (int)sink->dest_id);
         goto fail1;
     }
     
+    // insert to source hash, by destination
+    if (!DPRelayFlowsHash_Insert(&src->flows_hash, 0, DPRelayFlowsHashDerefNonNull(0, flow), NULL)) {
+        BLog(BLOG_ERROR, "relay flow %d->%d: DPRelayFlowsHash_Insert failed", (int)src->source_id, (int)sink->dest_id);
+        goto fail2;
+    }
+    
     // insert to source list
     LinkedList1_Append(&src->flows_list, &flow->src_list_node);
     
     // insert to sink list
     LinkedList1_Append(&sink->flows_list, &flow->sink_list_node);
     
+    // insert to router list
+    LinkedList1_Append(&router->flows_list, &flow->router_list_node);
+    
+    // set active, so it survives until the next inactivity check
+    flow->active = 1;
+    
+    // zero counters
+    flow->stats.frames = 0;
+    flow->stats.bytes = 0;
+    flow->stats.dropped = 0;
+    
+    // start checking for inactivity
+    if (router->inactivity_time >= 0 && !BTimer_IsRunning(&router->inactivity_timer)) {
+        BReactor_SetTimer(router->reactor, &router->inactivity_timer);
+    }
+    
     // attach flow if needed
     if (sink->dp_sink) {
         DataProtoFlow_Attach(&flow->dp_flow, sink->dp_sink);
@@ -75,6 +107,8 @@ static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink,
     
     return flow;
     
+fail2:
+    DataProtoFlow_Free(&flow->dp_flow);
 fail1:
     free(flow);
 fail0:
@@ -83,15 +117,16 @@ fail0:
 
 static void free_flow (struct DPRelay_flow *flow)
 {
+    BLog(BLOG_INFO, "relay flow %d->%d: freed after %"PRIu64" frames, %"PRIu64" bytes, %"PRIu64" dropped",
+         (int)flow->src->source_id, (int)flow->sink->dest_id, flow->stats.frames, flow->stats.bytes, flow->stats.dropped);
+    
     // detach flow if needed
     if (flow->sink->dp_sink) {
         DataProtoFlow_Detach(&flow->dp_flow);
     }
     
-    // remove posible router reference
-    if (flow->src->router->current_flow == flow) {
-        flow->src->router->current_flow = NULL;
-    }
+    // remove from router list
+    LinkedList1_Remove(&flow->src->router->flows_list, &flow->router_list_node);
     
     // remove from sink list
     LinkedList1_Remove(&flow->sink->flows_list, &flow->sink_list_node);
@@ -99,6 +134,9 @@ static void free_flow (struct DPRelay_flow *flow)
     // remove from source list
     LinkedList1_Remove(&flow->src->flows_list, &flow->src_list_node);
     
+    // remove from source hash
+    DPRelayFlowsHash_Remove(&flow->src->flows_hash, 0, DPRelayFlowsHashDerefNonNull(0, flow));
+    
     // free DataProtoFlow
     DataProtoFlow_Free(&flow->dp_flow);
     
@@ -106,67 +144,68 @@ static void free_flow (struct DPRelay_flow *flow)
     free(flow);
 }
 
-static void flow_inactivity_handler (struct DPRelay_flow *flow)
+static void inactivity_timer_handler (DPRelayRouter *o)
 {
-    BLog(BLOG_INFO, "relay flow %d->%d: timed out", (int)flow->src->source_id, (int)flow->sink->dest_id);
-    
-    free_flow(flow);
-}
-
-static struct DPRelay_flow * source_find_flow (DPRelaySource *o, DPRelaySink *sink)
-{
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->flows_list); node; node = LinkedList1Node_Next(node)) {
-        struct DPRelay_flow *flow = UPPER_OBJECT(node, struct DPRelay_flow, src_list_node);
-        ASSERT(flow->src == o)
-        if (flow->sink == sink) {
-            return flow;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->inactivity_time >= 0)
+    
+    // free flows which had no frames since the last check,
+    // and start the next period for the others
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->flows_list);
+    while (node) {
+        struct DPRelay_flow *flow = UPPER_OBJECT(node, struct DPRelay_flow, router_list_node);
+        node = LinkedList1Node_Next(node);
+        
+        if (!flow->active) {
+            BLog(BLOG_INFO, "relay flow %d->%d: timed out", (int)flow->src->source_id, (int)flow->sink->dest_id);
+            free_flow(flow);
+        } else {
+            flow->active = 0;
         }
     }
     
-    return NULL;
+    // keep checking while there are flows
+    if (!LinkedList1_IsEmpty(&o->flows_list)) {
+        BReactor_SetTimer(o->reactor, &o->inactivity_timer);
+    }
 }
 
-static void router_dp_source_handler (DPRelayRouter *o, const uint8_t *frame, int frame_len)
+static struct DPRelay_flow * source_find_flow (DPRelaySource *o, DPRelaySink *sink)
 {
-    DebugObject_Access(&o->d_obj);
-    
-    if (!o->current_flow) {
-        return;
-    }
-    
-    // route frame to current flow
-    DataProtoFlow_Route(&o->current_flow->dp_flow, 0);
+    struct DPRelay_flow *flow = DPRelayFlowsHash_Lookup(&o->flows_hash, 0, sink->dest_id).ptr;
+    ASSERT(!flow || flow->src == o)
+    ASSERT(!flow || flow->sink == sink)
     
-    // set no current flow
-    o->current_flow = NULL;
+    return flow;
 }
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int inactivity_time, BReactor *reactor)
 {
     ASSERT(frame_mtu >= 0)
     ASSERT(frame_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
     
     // init arguments
     o->frame_mtu = frame_mtu;
+    o->inactivity_time = inactivity_time;
+    o->reactor = reactor;
     
-    // init BufferWriter
-    BufferWriter_Init(&o->writer, frame_mtu, BReactor_PendingGroup(reactor));
-    
-    // init DataProtoSource
-    if (!DataProtoSource_Init(&o->dp_source, BufferWriter_GetOutput(&o->writer), (DataProtoSource_handler)router_dp_source_handler, o, reactor)) {
-        BLog(BLOG_ERROR, "DataProtoSource_Init failed");
-        goto fail1;
+    // init DataProtoSource; frames are written into it directly
+    if (!DataProtoSource_InitDirect(&o->dp_source, frame_mtu, reactor)) {
+        BLog(BLOG_ERROR, "DataProtoSource_InitDirect failed");
+        goto fail0;
     }
     
-    // have no current flow
-    o->current_flow = NULL;
+    // init flows list
+    LinkedList1_Init(&o->flows_list);
+    
+    // init inactivity timer
+    BTimer_Init(&o->inactivity_timer, inactivity_time, (BTimer_handler)inactivity_timer_handler, o);
     
     DebugCounter_Init(&o->d_ctr);
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail1:
-    BufferWriter_Free(&o->writer);
+fail0:
     return 0;
 }
 
@@ -174,53 +213,62 @@ void DPRelayRouter_Free (DPRelayRouter *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugCounter_Free(&o->d_ctr);
-    ASSERT(!o->current_flow) // have no sources
+    ASSERT(LinkedList1_IsEmpty(&o->flows_list)) // have no sources
+    
+    // free inactivity timer
+    BReactor_RemoveTimer(o->reactor, &o->inactivity_timer);
     
     // free DataProtoSource
     DataProtoSource_Free(&o->dp_source);
-    
-    // free BufferWriter
-    BufferWriter_Free(&o->writer);
 }
 
-void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets, int inactivity_time)
+void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets)
 {
     DebugObject_Access(&o->d_obj);
     DebugObject_Access(&src->d_obj);
     DebugObject_Access(&sink->d_obj);
-    ASSERT(!o->current_flow)
     ASSERT(src->router == o)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->frame_mtu)
     ASSERT(num_packets > 0)
     
-    // get memory location
-    uint8_t *out;
-    if (!BufferWriter_StartPacket(&o->writer, &out)) {
-        BLog(BLOG_ERROR, "BufferWriter_StartPacket failed for frame %d->%d !?", (int)src->source_id, (int)sink->dest_id);
-        return;
-    }
-    
-    // write frame
-    memcpy(out, data, data_len);
-    
-    // submit frame
-    BufferWriter_EndPacket(&o->writer, data_len);
-    
     // get a flow
-    // this comes _after_ writing the packet, in case flow initialization schedules jobs
     struct DPRelay_flow *flow = source_find_flow(src, sink);
     if (!flow) {
-        if (!(flow = create_flow(src, sink, num_packets, inactivity_time))) {
+        if (!(flow = create_flow(src, sink, num_packets))) {
             return;
         }
     }
     
-    // remember flow so we know where to route the frame in router_dp_source_handler
-    o->current_flow = flow;
+    // set active
+    flow->active = 1;
+    
+    // write frame
+    memcpy(DataProtoSource_DirectBuffer(&o->dp_source), data, data_len);
+    DataProtoSource_DirectFrame(&o->dp_source, data_len);
+    
+    // route frame to flow
+    if (!DataProtoFlow_Route(&flow->dp_flow, 0)) {
+        flow->stats.dropped++;
+        return;
+    }
+    
+    flow->stats.frames++;
+    flow->stats.bytes += data_len;
+}
+
+void DPRelayRouter_GetFlowStats (DPRelayRouter *o, DPRelayRouter_stats_handler handler, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(handler)
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->flows_list); node; node = LinkedList1Node_Next(node)) {
+        struct DPRelay_flow *flow = UPPER_OBJECT(node, struct DPRelay_flow, router_list_node);
+        handler(user, flow->src->source_id, flow->sink->dest_id, &flow->stats);
+    }
 }
 
-void DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor)
+int DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor)
 {
     DebugObject_Access(&router->d_obj);
     
@@ -231,8 +279,15 @@ void DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t sourc
     // init flows list
     LinkedList1_Init(&o->flows_list);
     
+    // init flows hash, by destination
+    if (!DPRelayFlowsHash_Init(&o->flows_hash, DPRELAY_FLOWS_HASH_CAPACITY)) {
+        BLog(BLOG_ERROR, "relay source %d: DPRelayFlowsHash_Init failed", (int)source_id);
+        return 0;
+    }
+    
     DebugCounter_Increment(&o->router->d_ctr);
     DebugObject_Init(&o->d_obj);
+    return 1;
 }
 
 void DPRelaySource_Free (DPRelaySource *o)
@@ -246,6 +301,9 @@ void DPRelaySource_Free (DPRelaySource *o)
         struct DPRelay_flow *flow = UPPER_OBJECT(node, struct DPRelay_flow, src_list_node);
         free_flow(flow);
     }
+    
+    // free flows hash
+    DPRelayFlowsHash_Free(&o->flows_hash);
 }
 
 void DPRelaySink_Init (DPRelaySink *o, peerid_t dest_id)
@@ -37,17 +37,33 @@
 #include <protocol/dataproto.h>
 #include <misc/debug.h>
 #include <structure/LinkedList1.h>
+#include <structure/OHash.h>
 #include <base/DebugObject.h>
-#include <flow/BufferWriter.h>
+#include <system/BReactor.h>
 #include <client/DataProto.h>
 
 struct DPRelay_flow;
 
+typedef struct DPRelay_flow *DPRelayFlowsHash_link;
+
+#include "DPRelay_flows_hash.h"
+#include <structure/OHash_decl.h>
+
+struct DPRelay_flow_stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t dropped;
+};
+
+typedef void (*DPRelayRouter_stats_handler) (void *user, peerid_t source_id, peerid_t dest_id, const struct DPRelay_flow_stats *stats);
+
 typedef struct {
     int frame_mtu;
-    BufferWriter writer;
+    int inactivity_time;
+    BReactor *reactor;
     DataProtoSource dp_source;
-    struct DPRelay_flow *current_flow;
+    LinkedList1 flows_list;
+    BTimer inactivity_timer;
     DebugObject d_obj;
     DebugCounter d_ctr;
 } DPRelayRouter;
@@ -56,6 +72,7 @@ typedef struct {
     DPRelayRouter *router;
     peerid_t source_id;
     LinkedList1 flows_list;
+    DPRelayFlowsHash flows_hash;
     DebugObject d_obj;
 } DPRelaySource;
 
@@ -72,13 +89,17 @@ struct DPRelay_flow {
     DataProtoFlow dp_flow;
     LinkedList1Node src_list_node;
     LinkedList1Node sink_list_node;
+    LinkedList1Node router_list_node;
+    int active;
+    struct DPRelay_flow_stats stats;
 };
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor) WARN_UNUSED;
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int inactivity_time, BReactor *reactor) WARN_UNUSED;
 void DPRelayRouter_Free (DPRelayRouter *o);
-void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets, int inactivity_time);
+void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets);
+void DPRelayRouter_GetFlowStats (DPRelayRouter *o, DPRelayRouter_stats_handler handler, void *user);
 
-void DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor);
+int DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor) WARN_UNUSED;
 void DPRelaySource_Free (DPRelaySource *o);
 
 void DPRelaySink_Init (DPRelaySink *o, peerid_t dest_id);
@@ -0,0 +1,11 @@
+#define OHASH_PARAM_NAME DPRelayFlowsHash
+#define OHASH_PARAM_ENTRY struct DPRelay_flow
+#define OHASH_PARAM_LINK DPRelayFlowsHash_link
+#define OHASH_PARAM_KEY peerid_t
+#define OHASH_PARAM_ARG int
+#define OHASH_PARAM_NULL ((DPRelayFlowsHash_link)NULL)
+#define OHASH_PARAM_DEREF(arg, link) (link)
+#define OHASH_PARAM_ENTRYHASH(arg, entry) hash_peer_id((entry).ptr->sink->dest_id)
+#define OHASH_PARAM_KEYHASH(arg, key) hash_peer_id((key))
+#define OHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->sink->dest_id == (entry2).ptr->sink->dest_id)
+#define OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->sink->dest_id)
@@ -27,6 +27,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -42,8 +43,14 @@
 static void monitor_handler (DataProtoSink *o);
 static void refresh_up_job (DataProtoSink *o);
 static void receive_timer_handler (DataProtoSink *o);
+static void set_keepalive_interval (DataProtoSink *o, btime_t interval);
+static void update_rtt (DataProtoSink *o, int rtt);
+static btime_t probe_timeout (DataProtoSink *o);
+static void probe_timer_handler (DataProtoSink *o);
+static void fill_keepalive (DataProtoSink *o, uint8_t *data, btime_t now);
 static void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len);
 static void up_job_handler (DataProtoSink *o);
+static void source_finish_shared (DataProtoSource *o);
 static void flow_buffer_free (struct DataProtoFlow_buffer *b);
 static void flow_buffer_attach (struct DataProtoFlow_buffer *b, DataProtoSink *sink);
 static void flow_buffer_detach (struct DataProtoFlow_buffer *b);
@@ -55,6 +62,12 @@ void monitor_handler (DataProtoSink *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    // while idle, wait longer for each keep-alive, if the peer adapts to it
+    if (o->adaptive && o->peer_keepalive && o->up && o->ka_interval < o->max_keepalive_time) {
+        btime_t interval = 2 * o->ka_interval;
+        set_keepalive_interval(o, (interval < o->max_keepalive_time ? interval : o->max_keepalive_time));
+    }
+    
     // send keep-alive
     PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
 }
@@ -78,21 +91,161 @@ void receive_timer_handler (DataProtoSink *o)
     refresh_up_job(o);
 }
 
+void set_keepalive_interval (DataProtoSink *o, btime_t interval)
+{
+    o->ka_interval = interval;
+    PacketPassInactivityMonitor_SetInterval(&o->monitor, o->ka_interval);
+}
+
+void update_rtt (DataProtoSink *o, int rtt)
+{
+    ASSERT(rtt >= 0)
+    
+    // smoothed average and variation as for TCP's retransmission timer
+    if (o->rtt < 0) {
+        o->rtt = rtt;
+        o->rtt_var = rtt / 2;
+    } else {
+        int diff = (o->rtt > rtt ? o->rtt - rtt : rtt - o->rtt);
+        o->rtt_var = (3 * o->rtt_var + diff) / 4;
+        o->rtt = (7 * o->rtt + rtt) / 8;
+    }
+}
+
+btime_t probe_timeout (DataProtoSink *o)
+{
+    ASSERT(o->adaptive)
+    
+    if (o->rtt < 0) {
+        return o->suspect_time;
+    }
+    
+    btime_t timeout = o->rtt + 4 * (btime_t)o->rtt_var;
+    if (timeout < DATAPROTOSINK_MIN_PROBE_TIMEOUT) {
+        timeout = DATAPROTOSINK_MIN_PROBE_TIMEOUT;
+    }
+    if (timeout > o->suspect_time) {
+        timeout = o->suspect_time;
+    }
+    
+    return timeout;
+}
+
+void probe_timer_handler (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->adaptive)
+    
+    btime_t now = BReactor_GetTime(o->reactor);
+    
+    if (!o->probing) {
+        // nothing to check if the link is down, or if nothing was sent since
+        // the last receive; the next frame sent restarts the timer
+        if (!o->up || o->last_send_time <= o->last_receive_time) {
+            return;
+        }
+        
+        // wait until nothing has been received for the suspect time
+        btime_t deadline = o->last_receive_time + o->suspect_time;
+        if (deadline > now) {
+            BReactor_SetTimerAbsolute(o->reactor, &o->probe_timer, deadline);
+            return;
+        }
+        
+        // start probing
+        o->probing = 1;
+        o->probes_sent = 0;
+    }
+    else if (o->probes_sent == o->num_probes) {
+        // no probe was answered, consider down; also stop reporting that
+        // we are receiving, so that the peer sends a keep-alive as soon as
+        // one of ours gets through
+        o->probing = 0;
+        o->up = 0;
+        BReactor_RemoveTimer(o->reactor, &o->receive_timer);
+        refresh_up_job(o);
+        return;
+    }
+    
+    // send a keep-alive asking for an answer
+    o->probes_sent++;
+    o->probe_pending = 1;
+    PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+    
+    BReactor_SetTimerAfter(o->reactor, &o->probe_timer, probe_timeout(o));
+}
+
+void fill_keepalive (DataProtoSink *o, uint8_t *data, btime_t now)
+{
+    struct dataproto_keepalive ka;
+    
+    // timestamp, never zero
+    uint32_t timestamp = now;
+    ka.timestamp = htol32(timestamp != 0 ? timestamp : 1);
+    
+    // echo the peer's last timestamp, with how long we held it
+    ka.echo_timestamp = htol32(o->echo_timestamp);
+    ka.echo_delay = htol32(o->echo_timestamp != 0 ? (uint32_t)(now - o->echo_time) : 0);
+    
+    // our interval, so that the peer knows when to expect the next keep-alive
+    ka.interval = htol32(o->ka_interval);
+    
+    memcpy(data, &ka, sizeof(ka));
+}
+
 void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(data_len >= sizeof(struct dataproto_header))
     
+    // count packet
+    o->packets_sent++;
+    o->bytes_sent += data_len;
+    
+    btime_t now = BReactor_GetTime(o->reactor);
+    
+    struct dataproto_header header;
+    memcpy(&header, data, sizeof(header));
+    
     int flags = 0;
     
+    if (ltoh16(header.num_peer_ids) == 0) {
+        // keep-alive from our keep-alive source, fill in the payload
+        ASSERT(data_len == DATAPROTOKEEPALIVESOURCE_PACKET_SIZE)
+        fill_keepalive(o, data + sizeof(header), now);
+        
+        // if probing, ask for an answer
+        if (o->probe_pending) {
+            flags |= DATAPROTO_FLAGS_PROBE;
+            o->probe_pending = 0;
+        }
+    } else {
+        o->last_send_time = now;
+        
+        if (o->adaptive && o->peer_keepalive) {
+            // frames are flowing, go back to the base keep-alive interval
+            if (o->ka_interval != o->keepalive_time) {
+                set_keepalive_interval(o, o->keepalive_time);
+            }
+            
+            // check that we keep hearing from the peer
+            if (!BTimer_IsRunning(&o->probe_timer)) {
+                BReactor_SetTimerAfter(o->reactor, &o->probe_timer, o->suspect_time);
+            }
+        }
+    }
+    
     // if we are receiving keepalives, set the flag
     if (BTimer_IsRunning(&o->receive_timer)) {
         flags |= DATAPROTO_FLAGS_RECEIVING_KEEPALIVES;
     }
     
+    // if we can decompress, say so
+    if (o->compression) {
+        flags |= DATAPROTO_FLAGS_ACCEPTS_COMPRESSION;
+    }
+    
     // modify existing packet here
-    struct dataproto_header header;
-    memcpy(&header, data, sizeof(header));
     header.flags = hton8(flags);
     memcpy(data, &header, sizeof(header));
 }
@@ -118,12 +271,36 @@ void source_router_handler (DataProtoSource *o, uint8_t *buf, int recv_len)
     // remember packet
     o->current_buf = buf;
     o->current_recv_len = recv_len;
+    o->current_shared = 0;
+    
+    // classify packet
+    o->current_latency = (o->classifier ? o->classifier(o->classifier_user, buf + DATAPROTO_MAX_OVERHEAD, recv_len) : 0);
+    ASSERT(o->current_latency == 0 || o->current_latency == 1)
     
     // call handler
     o->handler(o->user, buf + DATAPROTO_MAX_OVERHEAD, recv_len);
     return;
 }
 
+void source_finish_shared (DataProtoSource *o)
+{
+    if (!o->current_shared) {
+        return;
+    }
+    
+    // let the flow buffers take over the frame
+    if (o->direct) {
+        RouteBufferSource_FinishShared(&o->rbs);
+    } else {
+        PacketRouter_FinishShared(&o->router);
+    }
+    
+    o->current_shared = 0;
+    
+    // the frame may have been moved, don't allow further routing
+    o->current_buf = NULL;
+}
+
 void flow_buffer_free (struct DataProtoFlow_buffer *b)
 {
     ASSERT(!b->sink)
@@ -153,6 +330,15 @@ void flow_buffer_attach (struct DataProtoFlow_buffer *b, DataProtoSink *sink)
     // connect to queue flow
     PacketPassConnector_ConnectOutput(&b->connector, PacketPassFairQueueFlow_GetInput(&b->sink_qflow));
     
+    #ifdef BADVPN_FLOW_STATS
+    if (sink->stats_name[0]) {
+        char flow_name[FLOWSTATS_NAME_SIZE];
+        snprintf(flow_name, sizeof(flow_name), "flow %d->%d", (int)b->flow->source_id, (int)b->flow->dest_id);
+        PacketPassInterface_SetStatsName(PacketPassFairQueueFlow_GetInput(&b->sink_qflow), NULL, flow_name, NULL);
+        PacketPassInterface_SetStatsName(PacketPassFairQueueFlow_GetInput(&b->sink_qflow), sink->stats_name, NULL, "PacketPassFairQueue");
+    }
+    #endif
+    
     // set DataProto
     b->sink = sink;
 }
@@ -224,31 +410,71 @@ void flow_buffer_qflow_handler_busy (struct DataProtoFlow_buffer *b)
     flow_buffer_finish_detach(b);
 }
 
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user)
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, int latency_num_packets, BThreadWorkDispatcher *compression_twd, DataProtoSink_handler handler, void *user)
 {
     ASSERT(PacketPassInterface_HasCancel(output))
     ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTO_MAX_OVERHEAD)
+    ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTOKEEPALIVESOURCE_PACKET_SIZE)
+    ASSERT(latency_num_packets >= 0)
     
     // init arguments
     o->reactor = reactor;
+    o->output = output;
+    o->latency_num_packets = latency_num_packets;
+    o->keepalive_time = keepalive_time;
+    o->tolerance_time = tolerance_time;
+    o->compression = !!compression_twd;
     o->handler = handler;
     o->user = user;
     
     // set frame MTU
     o->frame_mtu = PacketPassInterface_GetMTU(output) - DATAPROTO_MAX_OVERHEAD;
     
+    // init compressor, after the notifier so that it sees the flags
+    PacketPassInterface *notifier_output = output;
+    if (o->compression) {
+        if (!DataProtoCompressor_Init(&o->compressor, output, BReactor_PendingGroup(o->reactor), compression_twd)) {
+            BLog(BLOG_ERROR, "DataProtoCompressor_Init failed");
+            goto fail0;
+        }
+        notifier_output = DataProtoCompressor_GetInput(&o->compressor);
+    }
+    
     // init notifier
-    PacketPassNotifier_Init(&o->notifier, output, BReactor_PendingGroup(o->reactor));
+    PacketPassNotifier_Init(&o->notifier, notifier_output, BReactor_PendingGroup(o->reactor));
     PacketPassNotifier_SetHandler(&o->notifier, (PacketPassNotifier_handler_notify)notifier_handler, o);
     
     // init monitor
     PacketPassInactivityMonitor_Init(&o->monitor, PacketPassNotifier_GetInput(&o->notifier), o->reactor, keepalive_time, (PacketPassInactivityMonitor_handler)monitor_handler, o);
     PacketPassInactivityMonitor_Force(&o->monitor);
     
+    // with a low-latency class, the queue goes through a priority queue
+    // where the low-latency buffer takes precedence
+    PacketPassInterface *queue_output = PacketPassInactivityMonitor_GetInput(&o->monitor);
+    if (o->latency_num_packets > 0) {
+        // init priority queue
+        PacketPassPriorityQueue_Init(&o->prio_queue, queue_output, BReactor_PendingGroup(o->reactor), 1);
+        
+        // init low-latency and normal priority queue flows
+        PacketPassPriorityQueueFlow_Init(&o->latency_qflow, &o->prio_queue, 0);
+        PacketPassPriorityQueueFlow_Init(&o->prio_qflow, &o->prio_queue, 1);
+        
+        // init low-latency writer
+        BufferWriter_Init(&o->latency_writer, DATAPROTO_MAX_OVERHEAD + o->frame_mtu, BReactor_PendingGroup(o->reactor));
+        
+        // init low-latency buffer
+        if (!PacketBuffer_Init(&o->latency_buffer, BufferWriter_GetOutput(&o->latency_writer), PacketPassPriorityQueueFlow_GetInput(&o->latency_qflow), o->latency_num_packets, BReactor_PendingGroup(o->reactor))) {
+            BLog(BLOG_ERROR, "PacketBuffer_Init failed");
+            goto fail1;
+        }
+        
+        queue_output = PacketPassPriorityQueueFlow_GetInput(&o->prio_qflow);
+    }
+    
     // init queue
-    if (!PacketPassFairQueue_Init(&o->queue, PacketPassInactivityMonitor_GetInput(&o->monitor), BReactor_PendingGroup(o->reactor), 1, 1)) {
+    if (!PacketPassFairQueue_Init(&o->queue, queue_output, BReactor_PendingGroup(o->reactor), 1, 1)) {
         BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
-        goto fail1;
+        goto fail1a;
     }
     
     // init keepalive queue flow
@@ -269,9 +495,25 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
     // init receive timer
     BTimer_Init(&o->receive_timer, tolerance_time, (BTimer_handler)receive_timer_handler, o);
     
+    // init probe timer
+    BTimer_Init(&o->probe_timer, 0, (BTimer_handler)probe_timer_handler, o);
+    
     // init handler job
     BPending_Init(&o->up_job, BReactor_PendingGroup(o->reactor), (BPending_handler)up_job_handler, o);
     
+    // base keep-alive timing until we hear from the peer
+    o->receive_tolerance = o->tolerance_time;
+    o->ka_interval = o->keepalive_time;
+    o->adaptive = 0;
+    o->peer_keepalive = 0;
+    o->echo_timestamp = 0;
+    o->rtt = -1;
+    o->rtt_var = 0;
+    o->last_send_time = BReactor_GetTime(o->reactor);
+    o->last_receive_time = o->last_send_time;
+    o->probing = 0;
+    o->probe_pending = 0;
+    
     // set not up
     o->up = 0;
     o->up_report = 0;
@@ -279,6 +521,13 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
     // set no detaching buffer
     o->detaching_buffer = NULL;
     
+    // zero counters
+    o->packets_sent = 0;
+    o->bytes_sent = 0;
+    
+    // set no stats name
+    o->stats_name[0] = '\0';
+    
     DebugCounter_Init(&o->d_ctr);
     DebugObject_Init(&o->d_obj);
     return 1;
@@ -288,9 +537,23 @@ fail2:
     DataProtoKeepaliveSource_Free(&o->ka_source);
     PacketPassFairQueueFlow_Free(&o->ka_qflow);
     PacketPassFairQueue_Free(&o->queue);
+fail1a:
+    if (o->latency_num_packets > 0) {
+        PacketBuffer_Free(&o->latency_buffer);
+    }
 fail1:
+    if (o->latency_num_packets > 0) {
+        BufferWriter_Free(&o->latency_writer);
+        PacketPassPriorityQueueFlow_Free(&o->prio_qflow);
+        PacketPassPriorityQueueFlow_Free(&o->latency_qflow);
+        PacketPassPriorityQueue_Free(&o->prio_queue);
+    }
     PacketPassInactivityMonitor_Free(&o->monitor);
     PacketPassNotifier_Free(&o->notifier);
+    if (o->compression) {
+        DataProtoCompressor_Free(&o->compressor);
+    }
+fail0:
     return 0;
 }
 
@@ -301,6 +564,9 @@ void DataProtoSink_Free (DataProtoSink *o)
     
     // allow freeing queue flows
     PacketPassFairQueue_PrepareFree(&o->queue);
+    if (o->latency_num_packets > 0) {
+        PacketPassPriorityQueue_PrepareFree(&o->prio_queue);
+    }
     
     // release detaching buffer
     if (o->detaching_buffer) {
@@ -311,6 +577,9 @@ void DataProtoSink_Free (DataProtoSink *o)
     // free handler job
     BPending_Free(&o->up_job);
     
+    // free probe timer
+    BReactor_RemoveTimer(o->reactor, &o->probe_timer);
+    
     // free receive timer
     BReactor_RemoveTimer(o->reactor, &o->receive_timer);
     
@@ -329,20 +598,44 @@ void DataProtoSink_Free (DataProtoSink *o)
     // free queue
     PacketPassFairQueue_Free(&o->queue);
     
+    // free low-latency class
+    if (o->latency_num_packets > 0) {
+        PacketBuffer_Free(&o->latency_buffer);
+        BufferWriter_Free(&o->latency_writer);
+        PacketPassPriorityQueueFlow_Free(&o->prio_qflow);
+        PacketPassPriorityQueueFlow_Free(&o->latency_qflow);
+        PacketPassPriorityQueue_Free(&o->prio_queue);
+    }
+    
     // free monitor
     PacketPassInactivityMonitor_Free(&o->monitor);
     
     // free notifier
     PacketPassNotifier_Free(&o->notifier);
+    
+    // free compressor
+    if (o->compression) {
+        DataProtoCompressor_Free(&o->compressor);
+    }
 }
 
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int peer_accepts_compression)
 {
     ASSERT(peer_receiving == 0 || peer_receiving == 1)
+    ASSERT(peer_accepts_compression == 0 || peer_accepts_compression == 1)
     DebugObject_Access(&o->d_obj);
     
+    // compress if the peer can decompress
+    if (o->compression) {
+        DataProtoCompressor_SetPeerAccepts(&o->compressor, peer_accepts_compression);
+    }
+    
     // reset receive timer
-    BReactor_SetTimer(o->reactor, &o->receive_timer);
+    BReactor_SetTimerAfter(o->reactor, &o->receive_timer, o->receive_tolerance);
+    
+    // the peer is alive, stop probing
+    o->last_receive_time = BReactor_GetTime(o->reactor);
+    o->probing = 0;
     
     if (!peer_receiving) {
         // peer reports not receiving, consider down
@@ -357,6 +650,115 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
     refresh_up_job(o);
 }
 
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const struct dataproto_keepalive *ka, int probe)
+{
+    ASSERT(probe == 0 || probe == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    btime_t now = BReactor_GetTime(o->reactor);
+    uint32_t timestamp = ltoh32(ka->timestamp);
+    uint32_t echo_timestamp = ltoh32(ka->echo_timestamp);
+    uint32_t interval = ltoh32(ka->interval);
+    
+    // the peer understands keep-alive payloads
+    o->peer_keepalive = 1;
+    
+    // remember the timestamp to echo back
+    if (timestamp != 0) {
+        o->echo_timestamp = timestamp;
+        o->echo_time = now;
+    }
+    
+    // measure round-trip time, less the time the peer held our timestamp
+    if (echo_timestamp != 0) {
+        int32_t rtt = (uint32_t)now - echo_timestamp - ltoh32(ka->echo_delay);
+        if (rtt >= 0 && rtt <= DATAPROTOSINK_MAX_RTT) {
+            update_rtt(o, rtt);
+        }
+    }
+    
+    // tolerate as many of the peer's keep-alive intervals as of ours
+    btime_t tolerance = o->tolerance_time;
+    if (interval > o->keepalive_time) {
+        tolerance = o->tolerance_time * interval / o->keepalive_time;
+        if (tolerance > DATAPROTOSINK_MAX_TOLERANCE_FACTOR * o->tolerance_time) {
+            tolerance = DATAPROTOSINK_MAX_TOLERANCE_FACTOR * o->tolerance_time;
+        }
+    }
+    if (tolerance != o->receive_tolerance) {
+        o->receive_tolerance = tolerance;
+        BReactor_SetTimerAfter(o->reactor, &o->receive_timer, o->receive_tolerance);
+    }
+    
+    // answer a probe right away
+    if (probe) {
+        PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+    }
+}
+
+void DataProtoSink_EnableAdaptiveKeepalive (DataProtoSink *o, btime_t max_keepalive_time, btime_t suspect_time, int num_probes)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->adaptive)
+    ASSERT(max_keepalive_time >= o->keepalive_time)
+    ASSERT(suspect_time > 0)
+    ASSERT(num_probes > 0)
+    
+    o->adaptive = 1;
+    o->max_keepalive_time = max_keepalive_time;
+    o->suspect_time = suspect_time;
+    o->num_probes = num_probes;
+}
+
+void DataProtoSink_GetStats (DataProtoSink *o, struct DataProtoSink_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    stats->packets_sent = o->packets_sent;
+    stats->bytes_sent = o->bytes_sent;
+    stats->packets_compressed = 0;
+    stats->bytes_saved = 0;
+    stats->up = o->up;
+    stats->rtt = o->rtt;
+    stats->rtt_var = o->rtt_var;
+    stats->keepalive_interval = o->ka_interval;
+    stats->probes = (o->probing ? o->probes_sent : 0);
+    
+    if (o->compression) {
+        struct DataProtoCompressor_stats cstats;
+        DataProtoCompressor_GetStats(&o->compressor, &cstats);
+        stats->packets_compressed = cstats.packets_compressed;
+        stats->bytes_saved = cstats.bytes_saved;
+    }
+}
+
+void DataProtoSink_SetStatsName (DataProtoSink *o, const char *name)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    #ifdef BADVPN_FLOW_STATS
+    snprintf(o->stats_name, sizeof(o->stats_name), "%s", name);
+    
+    PacketPassInterface_SetStatsName(PacketPassFairQueueFlow_GetInput(&o->ka_qflow), name, "keepalive", "PacketPassFairQueue");
+    
+    if (o->latency_num_packets > 0) {
+        PacketPassInterface_SetStatsName(PacketPassPriorityQueueFlow_GetInput(&o->latency_qflow), name, "low-latency buffer", "PacketPassPriorityQueue");
+        PacketPassInterface_SetStatsName(PacketPassPriorityQueueFlow_GetInput(&o->prio_qflow), name, "PacketPassFairQueue", "PacketPassPriorityQueue");
+        PacketPassInterface_SetStatsName(PacketPassInactivityMonitor_GetInput(&o->monitor), name, "PacketPassPriorityQueue", "PacketPassInactivityMonitor");
+    } else {
+        PacketPassInterface_SetStatsName(PacketPassInactivityMonitor_GetInput(&o->monitor), name, "PacketPassFairQueue", "PacketPassInactivityMonitor");
+    }
+    
+    PacketPassInterface_SetStatsName(PacketPassNotifier_GetInput(&o->notifier), name, "PacketPassInactivityMonitor", "PacketPassNotifier");
+    if (o->compression) {
+        PacketPassInterface_SetStatsName(DataProtoCompressor_GetInput(&o->compressor), name, "PacketPassNotifier", "DataProtoCompressor");
+        PacketPassInterface_SetStatsName(o->output, name, "DataProtoCompressor", NULL);
+    } else {
+        PacketPassInterface_SetStatsName(o->output, name, "PacketPassNotifier", NULL);
+    }
+    #endif
+}
+
 int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(PacketRecvInterface_GetMTU(input) <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
@@ -367,9 +769,16 @@ int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataPr
     o->user = user;
     o->reactor = reactor;
     
+    // have no classifier
+    o->classifier = NULL;
+    o->classifier_user = NULL;
+    
     // remember frame MTU
     o->frame_mtu = PacketRecvInterface_GetMTU(input);
     
+    // frames come from input
+    o->direct = 0;
+    
     // init router
     if (!PacketRouter_Init(&o->router, DATAPROTO_MAX_OVERHEAD + o->frame_mtu, DATAPROTO_MAX_OVERHEAD, input, (PacketRouter_handler)source_router_handler, o, BReactor_PendingGroup(reactor))) {
         BLog(BLOG_ERROR, "PacketRouter_Init failed");
@@ -384,13 +793,87 @@ fail0:
     return 0;
 }
 
+int DataProtoSource_InitDirect (DataProtoSource *o, int frame_mtu, BReactor *reactor)
+{
+    ASSERT(frame_mtu >= 0)
+    ASSERT(frame_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
+    
+    // init arguments
+    o->handler = NULL;
+    o->user = NULL;
+    o->reactor = reactor;
+    o->frame_mtu = frame_mtu;
+    
+    // have no classifier
+    o->classifier = NULL;
+    o->classifier_user = NULL;
+    
+    // frames are written by the user
+    o->direct = 1;
+    
+    // init route buffer source
+    if (!RouteBufferSource_Init(&o->rbs, DATAPROTO_MAX_OVERHEAD + o->frame_mtu)) {
+        BLog(BLOG_ERROR, "RouteBufferSource_Init failed");
+        goto fail0;
+    }
+    
+    // have no current frame
+    o->current_buf = NULL;
+    o->current_shared = 0;
+    
+    DebugCounter_Init(&o->d_ctr);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
 void DataProtoSource_Free (DataProtoSource *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugCounter_Free(&o->d_ctr);
     
-    // free router
-    PacketRouter_Free(&o->router);
+    if (o->direct) {
+        // free route buffer source
+        RouteBufferSource_Free(&o->rbs);
+    } else {
+        // free router
+        PacketRouter_Free(&o->router);
+    }
+}
+
+void DataProtoSource_SetClassifier (DataProtoSource *o, DataProtoSource_classifier classifier, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->classifier = classifier;
+    o->classifier_user = user;
+}
+
+uint8_t * DataProtoSource_DirectBuffer (DataProtoSource *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->direct)
+    
+    // finish routing the previous frame
+    source_finish_shared(o);
+    
+    return RouteBufferSource_Pointer(&o->rbs) + DATAPROTO_MAX_OVERHEAD;
+}
+
+void DataProtoSource_DirectFrame (DataProtoSource *o, int frame_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->direct)
+    ASSERT(frame_len >= 0)
+    ASSERT(frame_len <= o->frame_mtu)
+    
+    // set current frame
+    o->current_buf = RouteBufferSource_Pointer(&o->rbs);
+    o->current_recv_len = frame_len;
+    o->current_latency = 0;
+    o->current_shared = 0;
 }
 
 int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time, void *user,
@@ -408,6 +891,11 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     // set no desired sink
     o->sink_desired = NULL;
     
+    // zero counters
+    o->stats.frames_routed = 0;
+    o->stats.frames_dropped = 0;
+    o->stats.frames_aqm_dropped = 0;
+    
     // allocate buffer structure
     struct DataProtoFlow_buffer *b = (struct DataProtoFlow_buffer *)malloc(sizeof(*b));
     if (!b) {
@@ -483,10 +971,12 @@ void DataProtoFlow_Free (DataProtoFlow *o)
     }
 }
 
-void DataProtoFlow_Route (DataProtoFlow *o, int more)
+static int flow_route (DataProtoFlow *o, int more)
 {
     DebugObject_Access(&o->d_obj);
-    PacketRouter_AssertRoute(&o->source->router);
+    if (!o->source->direct) {
+        PacketRouter_AssertRoute(&o->source->router);
+    }
     ASSERT(o->source->current_buf)
     ASSERT(more == 0 || more == 1)
     struct DataProtoFlow_buffer *b = o->b;
@@ -500,17 +990,88 @@ void DataProtoFlow_Route (DataProtoFlow *o, int more)
     memcpy(o->source->current_buf, &header, sizeof(header));
     memcpy(o->source->current_buf + sizeof(header), &id, sizeof(id));
     
+    // copy low-latency frames into the low-latency class of the sink, if we're
+    // attached to one which has it; the current buffer stays with the source
+    DataProtoSink *sink = b->sink;
+    if (o->source->current_latency && sink && sink == o->sink_desired && sink->latency_num_packets > 0) {
+        int len = DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len;
+        uint8_t *out;
+        if (!BufferWriter_StartPacket(&sink->latency_writer, &out)) {
+            BLog(BLOG_NOTICE, "low-latency buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
+            o->stats.frames_dropped++;
+            return 0;
+        }
+        memcpy(out, o->source->current_buf, len);
+        BufferWriter_EndPacket(&sink->latency_writer, len);
+        o->stats.frames_routed++;
+        return 1;
+    }
+    
+    // route a frame going to more flows by reference, so that the flows'
+    // buffers share it instead of each getting its own copy
+    if (more || o->source->current_shared) {
+        int res;
+        if (o->source->direct) {
+            res = RouteBufferSource_RouteShared(&o->source->rbs, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf, DATAPROTO_MAX_OVERHEAD);
+        } else {
+            res = PacketRouter_RouteShared(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf, DATAPROTO_MAX_OVERHEAD);
+        }
+        
+        o->source->current_shared = 1;
+        
+        if (!res) {
+            BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
+            o->stats.frames_dropped++;
+            return 0;
+        }
+        
+        o->stats.frames_routed++;
+        
+        return 1;
+    }
+    
     // route
     uint8_t *next_buf;
-    if (!PacketRouter_Route(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf,
-                            &next_buf, DATAPROTO_MAX_OVERHEAD, (more ? o->source->current_recv_len : 0)
-    )) {
-        BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
-        return;
+    if (o->source->direct) {
+        if (!RouteBufferSource_Route(&o->source->rbs, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf,
+                                     DATAPROTO_MAX_OVERHEAD, (more ? o->source->current_recv_len : 0)
+        )) {
+            BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
+            o->stats.frames_dropped++;
+            return 0;
+        }
+        next_buf = RouteBufferSource_Pointer(&o->source->rbs);
+    } else {
+        if (!PacketRouter_Route(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf,
+                                &next_buf, DATAPROTO_MAX_OVERHEAD, (more ? o->source->current_recv_len : 0)
+        )) {
+            BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
+            o->stats.frames_dropped++;
+            return 0;
+        }
     }
     
     // remember next buffer, or don't allow further routing if more==0
     o->source->current_buf = (more ? next_buf : NULL);
+    
+    o->stats.frames_routed++;
+    
+    return 1;
+}
+
+int DataProtoFlow_Route (DataProtoFlow *o, int more)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(more == 0 || more == 1)
+    
+    int res = flow_route(o, more);
+    
+    // if this was the last flow for the frame, finish routing it
+    if (!more) {
+        source_finish_shared(o->source);
+    }
+    
+    return res;
 }
 
 void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink)
@@ -564,3 +1125,18 @@ void DataProtoFlow_Detach (DataProtoFlow *o)
     
     DebugCounter_Decrement(&sink->d_ctr);
 }
+
+void DataProtoFlow_GetStats (DataProtoFlow *o, struct DataProtoFlow_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *stats = o->stats;
+    stats->frames_aqm_dropped = RouteBuffer_GetCoDelDrops(&o->b->rbuf);
+}
+
+void DataProtoFlow_EnableCoDel (DataProtoFlow *o, int target, int interval)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    RouteBuffer_EnableCoDel(&o->b->rbuf, target, interval);
+}
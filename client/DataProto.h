@@ -36,11 +36,15 @@
 
 #include <stdint.h>
 
+#include <protocol/dataproto.h>
 #include <misc/debugcounter.h>
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
 #include <flow/PacketPassFairQueue.h>
+#include <flow/PacketPassPriorityQueue.h>
+#include <flow/BufferWriter.h>
+#include <flow/PacketBuffer.h>
 #include <flow/PacketPassNotifier.h>
 #include <flow/PacketRecvBlocker.h>
 #include <flow/SinglePacketBuffer.h>
@@ -48,34 +52,119 @@
 #include <flow/PacketRouter.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
 #include <client/DataProtoKeepaliveSource.h>
+#include <client/DataProtoCompressor.h>
+
+/**
+ * Shortest time to wait for the answer to a probe (see
+ * {@link DataProtoSink_EnableAdaptiveKeepalive}), in milliseconds.
+ */
+#define DATAPROTOSINK_MIN_PROBE_TIMEOUT 100
+
+/**
+ * Round-trip time samples above this, in milliseconds, are ignored.
+ */
+#define DATAPROTOSINK_MAX_RTT 60000
+
+/**
+ * The receive tolerance is scaled up by at most this factor when
+ * the peer reports a longer keep-alive interval.
+ */
+#define DATAPROTOSINK_MAX_TOLERANCE_FACTOR 4
 
 typedef void (*DataProtoSink_handler) (void *user, int up);
 typedef void (*DataProtoSource_handler) (void *user, const uint8_t *frame, int frame_len);
+typedef int (*DataProtoSource_classifier) (void *user, const uint8_t *frame, int frame_len);
 typedef void (*DataProtoFlow_handler_inactivity) (void *user);
 
+/**
+ * Counters of a {@link DataProtoSink}.
+ */
+struct DataProtoSink_stats {
+    uint64_t packets_sent; // packets sent, including keep-alives
+    uint64_t bytes_sent; // bytes sent, including DataProto headers, before compression
+    uint64_t packets_compressed; // packets sent with a compressed payload
+    uint64_t bytes_saved; // bytes by which compression reduced bytes_sent
+    int up; // whether the link is considered up
+    int rtt; // smoothed round-trip time in milliseconds, or -1 if not measured yet
+    int rtt_var; // round-trip time variation in milliseconds
+    int keepalive_interval; // current keep-alive interval in milliseconds
+    int probes; // probes sent without an answer, while the link is suspected down
+};
+
+/**
+ * Counters of a {@link DataProtoFlow}.
+ */
+struct DataProtoFlow_stats {
+    uint64_t frames_routed; // frames put into a buffer for sending
+    uint64_t frames_dropped; // frames dropped because the buffer was full
+    uint64_t frames_aqm_dropped; // frames dropped by CoDel, see DataProtoFlow_EnableCoDel
+};
+
 struct DataProtoFlow_buffer;
 
 /**
  * Frame destination.
  * Represents a peer as a destination for sending frames to.
+ * 
+ * Optionally, the sink has a low-latency class with its own buffer, which
+ * is always sent before frames of the normal class and keep-alives. Flows
+ * attached to the sink put frames into this class when their source
+ * classifies them as low-latency (see {@link DataProtoSource_SetClassifier}).
+ * 
+ * Keep-alives carry timestamps from which the round-trip time to the peer is
+ * measured (see struct {@link dataproto_keepalive}). With adaptive keep-alives
+ * (see {@link DataProtoSink_EnableAdaptiveKeepalive}), the keep-alive interval
+ * grows while the link is idle, and the link is probed when frames are being
+ * sent but nothing has been received for a while.
  */
 typedef struct {
     BReactor *reactor;
+    PacketPassInterface *output;
     int frame_mtu;
+    int latency_num_packets;
     PacketPassFairQueue queue;
+    PacketPassPriorityQueue prio_queue;
+    PacketPassPriorityQueueFlow prio_qflow;
+    PacketPassPriorityQueueFlow latency_qflow;
+    BufferWriter latency_writer;
+    PacketBuffer latency_buffer;
     PacketPassInactivityMonitor monitor;
     PacketPassNotifier notifier;
+    int compression;
+    DataProtoCompressor compressor;
     DataProtoKeepaliveSource ka_source;
     PacketRecvBlocker ka_blocker;
     SinglePacketBuffer ka_buffer;
     PacketPassFairQueueFlow ka_qflow;
     BTimer receive_timer;
+    btime_t keepalive_time;
+    btime_t tolerance_time;
+    btime_t receive_tolerance;
+    btime_t ka_interval;
+    int adaptive;
+    btime_t max_keepalive_time;
+    btime_t suspect_time;
+    int num_probes;
+    int peer_keepalive;
+    uint32_t echo_timestamp;
+    btime_t echo_time;
+    int rtt;
+    int rtt_var;
+    btime_t last_send_time;
+    btime_t last_receive_time;
+    BTimer probe_timer;
+    int probing;
+    int probes_sent;
+    int probe_pending;
     int up;
     int up_report;
     DataProtoSink_handler handler;
     void *user;
     BPending up_job;
     struct DataProtoFlow_buffer *detaching_buffer;
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    char stats_name[FLOWSTATS_NAME_SIZE];
     DebugObject d_obj;
     DebugCounter d_ctr;
 } DataProtoSink;
@@ -83,15 +172,23 @@ typedef struct {
 /**
  * Receives frames from a {@link PacketRecvInterface} input and
  * allows the user to route them to buffers in {@link DataProtoFlow}'s.
+ * Alternatively, when initialized with {@link DataProtoSource_InitDirect},
+ * the user writes frames into the source directly and routes them right away.
  */
 typedef struct {
     DataProtoSource_handler handler;
     void *user;
+    DataProtoSource_classifier classifier;
+    void *classifier_user;
     BReactor *reactor;
     int frame_mtu;
+    int direct;
     PacketRouter router;
+    RouteBufferSource rbs;
     uint8_t *current_buf;
     int current_recv_len;
+    int current_latency;
+    int current_shared;
     DebugObject d_obj;
     DebugCounter d_ctr;
 } DataProtoSource;
@@ -107,6 +204,7 @@ typedef struct {
     peerid_t dest_id;
     DataProtoSink *sink_desired;
     struct DataProtoFlow_buffer *b;
+    struct DataProtoFlow_stats stats;
     DebugObject d_obj;
 } DataProtoFlow;
 
@@ -126,15 +224,24 @@ struct DataProtoFlow_buffer {
  * @param o the object
  * @param reactor reactor we live in
  * @param output output interface. Must support cancel functionality. Its MTU must be
- *               >=DATAPROTO_MAX_OVERHEAD.
+ *               >=DATAPROTOKEEPALIVESOURCE_PACKET_SIZE.
  * @param keepalive_time keepalive time
  * @param tolerance_time after how long of not having received anything from the peer
- *                       to consider the link down
+ *                       to consider the link down. If the peer reports a longer
+ *                       keep-alive interval than keepalive_time, this is scaled up
+ *                       accordingly.
+ * @param latency_num_packets number of packets the buffer of the low-latency class
+ *                            should hold, or 0 to not have a low-latency class.
+ *                            Must be >=0.
+ * @param compression_twd if not NULL, payloads are compressed in this thread work
+ *                        dispatcher (see {@link DataProtoCompressor}) once the peer
+ *                        reports accepting compression, and sent packets report that
+ *                        we accept it
  * @param handler up state handler
  * @param user value to pass to handler
  * @return 1 on success, 0 on failure
  */
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user) WARN_UNUSED;
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, int latency_num_packets, BThreadWorkDispatcher *compression_twd, DataProtoSink_handler handler, void *user) WARN_UNUSED;
 
 /**
  * Frees the sink.
@@ -151,8 +258,60 @@ void DataProtoSink_Free (DataProtoSink *o);
  * @param o the object
  * @param peer_receiving whether the DATAPROTO_FLAGS_RECEIVING_KEEPALIVES flag was set in the packet.
  *                       Must be 0 or 1.
+ * @param peer_accepts_compression whether the DATAPROTO_FLAGS_ACCEPTS_COMPRESSION flag was set
+ *                                 in the packet. Must be 0 or 1.
  */
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving);
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int peer_accepts_compression);
+
+/**
+ * Notifies the sink that a keep-alive with a payload was received from the peer.
+ * Must be called after {@link DataProtoSink_Received} for the packet.
+ * Must not be in freeing state.
+ * 
+ * @param o the object
+ * @param ka payload of the keep-alive
+ * @param probe whether the DATAPROTO_FLAGS_PROBE flag was set in the packet.
+ *              Must be 0 or 1.
+ */
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const struct dataproto_keepalive *ka, int probe);
+
+/**
+ * Enables adaptive keep-alives.
+ * Only takes effect once the peer has sent a keep-alive with a payload, since
+ * older peers neither adapt their tolerance to our interval nor answer probes.
+ * 
+ * While nothing but keep-alives is sent, the keep-alive interval doubles after
+ * each keep-alive, up to max_keepalive_time; sending a frame resets it. When
+ * frames are being sent but nothing has been received from the peer for
+ * suspect_time, keep-alives asking for an immediate answer are sent, each after
+ * a timeout based on the measured round-trip time, and the link is considered
+ * down if num_probes of them go unanswered.
+ * 
+ * @param o the object
+ * @param max_keepalive_time longest keep-alive interval. Must be >=keepalive_time
+ *                           given to {@link DataProtoSink_Init}.
+ * @param suspect_time time without receiving anything after which to probe. Must be >0.
+ * @param num_probes number of probes. Must be >0.
+ */
+void DataProtoSink_EnableAdaptiveKeepalive (DataProtoSink *o, btime_t max_keepalive_time, btime_t suspect_time, int num_probes);
+
+/**
+ * Returns the counters.
+ * 
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void DataProtoSink_GetStats (DataProtoSink *o, struct DataProtoSink_stats *stats);
+
+/**
+ * Names the sink's interfaces for flow instrumentation (see {@link FlowStats}),
+ * including those of flows attached from now on.
+ * Does nothing unless built with BADVPN_FLOW_STATS.
+ * 
+ * @param o the object
+ * @param name prefix for the names of the elements of the sink, e.g. "peer 3"
+ */
+void DataProtoSink_SetStatsName (DataProtoSink *o, const char *name);
 
 /**
  * Initiazes the source.
@@ -167,6 +326,20 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving);
  */
 int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
 
+/**
+ * Initiazes the source for direct submission of frames.
+ * Instead of being received from an input, frames are written to
+ * {@link DataProtoSource_DirectBuffer} and submitted with
+ * {@link DataProtoSource_DirectFrame}, saving the jobs and the copy
+ * of going through a {@link PacketRecvInterface}.
+ * 
+ * @param o the object
+ * @param frame_mtu maximum frame size. Must be >=0 and <= INT_MAX - DATAPROTO_MAX_OVERHEAD.
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
+ */
+int DataProtoSource_InitDirect (DataProtoSource *o, int frame_mtu, BReactor *reactor) WARN_UNUSED;
+
 /**
  * Frees the source.
  * There must be no {@link DataProtoFlow}'s using this source.
@@ -175,6 +348,41 @@ int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataPr
  */
 void DataProtoSource_Free (DataProtoSource *o);
 
+/**
+ * Sets the classifier which decides which frames are low-latency.
+ * Low-latency frames routed to a flow attached to a sink with a low-latency
+ * class are copied into that class instead of the flow's buffer; they may
+ * therefore overtake earlier frames of the flow.
+ * Initially there is no classifier and all frames are in the normal class.
+ * 
+ * @param o the object
+ * @param classifier function called for each frame before the handler, returning
+ *                   1 if the frame is low-latency and 0 if not; NULL for no classifier
+ * @param user value passed to classifier
+ */
+void DataProtoSource_SetClassifier (DataProtoSource *o, DataProtoSource_classifier classifier, void *user);
+
+/**
+ * Returns the location where to write the next frame.
+ * The source must have been initialized with {@link DataProtoSource_InitDirect}.
+ * The location is valid until a frame is routed.
+ * 
+ * @param o the object
+ * @return location of at least frame_mtu bytes
+ */
+uint8_t * DataProtoSource_DirectBuffer (DataProtoSource *o);
+
+/**
+ * Makes the frame written to {@link DataProtoSource_DirectBuffer} the current
+ * frame, so that it can be routed with {@link DataProtoFlow_Route} until it has
+ * been routed with more=0. The classifier is not used.
+ * The source must have been initialized with {@link DataProtoSource_InitDirect}.
+ * 
+ * @param o the object
+ * @param frame_len length of the frame. Must be >=0 and <=frame_mtu.
+ */
+void DataProtoSource_DirectFrame (DataProtoSource *o, int frame_len);
+
 /**
  * Initializes the flow.
  * The flow is initialized in not attached state.
@@ -206,15 +414,17 @@ void DataProtoFlow_Free (DataProtoFlow *o);
 
 /**
  * Routes a frame from the flow's source to this flow.
- * Must be called from within the job context of the {@link DataProtoSource_handler} handler.
+ * Must be called from within the job context of the {@link DataProtoSource_handler} handler,
+ * or after {@link DataProtoSource_DirectFrame} for a direct source.
  * Must not be called after this has been called with more=0 for the current frame.
  * 
  * @param o the object
  * @param more whether the current frame may have to be routed to more
  *             flows. If 0, must not be called again until the handler is
  *             called for the next frame. Must be 0 or 1.
+ * @return 1 if the frame was buffered, 0 if it was dropped because the buffer is full
  */
-void DataProtoFlow_Route (DataProtoFlow *o, int more);
+int DataProtoFlow_Route (DataProtoFlow *o, int more);
 
 /**
  * Attaches the flow to a sink.
@@ -234,4 +444,25 @@ void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink);
  */
 void DataProtoFlow_Detach (DataProtoFlow *o);
 
+/**
+ * Returns the counters.
+ * 
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void DataProtoFlow_GetStats (DataProtoFlow *o, struct DataProtoFlow_stats *stats);
+
+/**
+ * Enables CoDel active queue management on the flow's buffer, so that
+ * frames which have been waiting too long are dropped instead of sent.
+ * Together with the sink's fair queue this behaves like FQ-CoDel.
+ * Must be called right after {@link DataProtoFlow_Init}, before any frames
+ * are routed to the flow.
+ * 
+ * @param o the object
+ * @param target target queue delay in milliseconds. Must be >0.
+ * @param interval CoDel interval in milliseconds. Must be >0.
+ */
+void DataProtoFlow_EnableCoDel (DataProtoFlow *o, int target, int interval);
+
 #endif
@@ -0,0 +1,228 @@
+/**
+ * @file DataProtoCompressor.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <protocol/dataproto.h>
+#include <misc/byteorder.h>
+
+#include "DataProtoCompressor.h"
+
+static void work_func (DataProtoCompressor *o);
+static void work_handler (DataProtoCompressor *o);
+static void input_handler_send (DataProtoCompressor *o, uint8_t *data, int data_len);
+static void input_handler_requestcancel (DataProtoCompressor *o);
+static void output_handler_done (DataProtoCompressor *o);
+
+static void work_func (DataProtoCompressor *o)
+{
+    int payload_len = o->in_len - o->in_offset;
+    int cap = payload_len - payload_len / DATAPROTOCOMPRESSOR_MIN_SAVING_DIV - 1;
+    
+    o->tw_out_len = lz4_compress(&o->lz4, o->in_data + o->in_offset, payload_len, o->buf + o->in_offset, cap);
+}
+
+static void work_handler (DataProtoCompressor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->tw_have)
+    
+    // free work
+    BThreadWork_Free(&o->tw);
+    o->tw_have = 0;
+    
+    if (o->tw_out_len == 0) {
+        // didn't compress well enough, skip the next few packets
+        o->skip_next = (o->skip_next == 0 ? 1 : o->skip_next * 2);
+        if (o->skip_next > DATAPROTOCOMPRESSOR_MAX_SKIP) {
+            o->skip_next = DATAPROTOCOMPRESSOR_MAX_SKIP;
+        }
+        o->skip_left = o->skip_next;
+        
+        // send original packet
+        PacketPassInterface_Sender_Send(o->output, o->in_data, o->in_len);
+        return;
+    }
+    
+    o->skip_next = 0;
+    
+    // copy header and peer IDs, mark as compressed
+    memcpy(o->buf, o->in_data, o->in_offset);
+    struct dataproto_header header;
+    memcpy(&header, o->buf, sizeof(header));
+    header.flags = hton8(ltoh8(header.flags) | DATAPROTO_FLAGS_COMPRESSED);
+    memcpy(o->buf, &header, sizeof(header));
+    
+    // count packet
+    int out_len = o->in_offset + o->tw_out_len;
+    o->stats.packets_compressed++;
+    o->stats.bytes_saved += o->in_len - out_len;
+    
+    // send compressed packet
+    PacketPassInterface_Sender_Send(o->output, o->buf, out_len);
+}
+
+static void input_handler_send (DataProtoCompressor *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->tw_have)
+    ASSERT(data_len >= sizeof(struct dataproto_header))
+    
+    struct dataproto_header header;
+    memcpy(&header, data, sizeof(header));
+    int offset = sizeof(header) + ltoh16(header.num_peer_ids) * sizeof(struct dataproto_peer_id);
+    ASSERT(offset <= data_len)
+    
+    // pass packets unchanged if the peer can't decompress them,
+    // if they are too small, or if compression is backing off
+    if (!o->peer_accepts || data_len - offset < DATAPROTOCOMPRESSOR_MIN_PAYLOAD) {
+        goto pass;
+    }
+    if (o->skip_left > 0) {
+        o->skip_left--;
+        goto pass;
+    }
+    
+    // remember packet
+    o->in_data = data;
+    o->in_len = data_len;
+    o->in_offset = offset;
+    
+    // start work
+    BThreadWork_Init(&o->tw, o->twd, (BThreadWork_handler_done)work_handler, o, (BThreadWork_work_func)work_func, o);
+    o->tw_have = 1;
+    return;
+    
+pass:
+    PacketPassInterface_Sender_Send(o->output, data, data_len);
+}
+
+static void input_handler_requestcancel (DataProtoCompressor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // still compressing, drop the packet
+    if (o->tw_have) {
+        BThreadWork_Free(&o->tw);
+        o->tw_have = 0;
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    PacketPassInterface_Sender_RequestCancel(o->output);
+}
+
+static void output_handler_done (DataProtoCompressor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->tw_have)
+    
+    PacketPassInterface_Done(&o->input);
+}
+
+int DataProtoCompressor_Init (DataProtoCompressor *o, PacketPassInterface *output, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+{
+    ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTO_MAX_OVERHEAD)
+    
+    // init arguments
+    o->output = output;
+    o->twd = twd;
+    
+    // allocate buffer
+    if (!(o->buf = (uint8_t *)malloc(PacketPassInterface_GetMTU(o->output)))) {
+        goto fail0;
+    }
+    
+    // init input
+    PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init compressor
+    lz4_state_init(&o->lz4);
+    
+    // set compression disabled, no work, not skipping
+    o->peer_accepts = 0;
+    o->tw_have = 0;
+    o->skip_left = 0;
+    o->skip_next = 0;
+    
+    // zero counters
+    o->stats.packets_compressed = 0;
+    o->stats.bytes_saved = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void DataProtoCompressor_Free (DataProtoCompressor *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free work
+    if (o->tw_have) {
+        BThreadWork_Free(&o->tw);
+    }
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free buffer
+    free(o->buf);
+}
+
+PacketPassInterface * DataProtoCompressor_GetInput (DataProtoCompressor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+void DataProtoCompressor_SetPeerAccepts (DataProtoCompressor *o, int peer_accepts)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(peer_accepts == 0 || peer_accepts == 1)
+    
+    o->peer_accepts = peer_accepts;
+}
+
+void DataProtoCompressor_GetStats (DataProtoCompressor *o, struct DataProtoCompressor_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *stats = o->stats;
+}
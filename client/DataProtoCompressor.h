@@ -0,0 +1,149 @@
+/**
+ * @file DataProtoCompressor.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A {@link PacketPassInterface} layer which LZ4-compresses the payloads of
+ * DataProto packets.
+ */
+
+#ifndef BADVPN_DATAPROTOCOMPRESSOR_H
+#define BADVPN_DATAPROTOCOMPRESSOR_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/lz4.h>
+#include <base/DebugObject.h>
+#include <flow/PacketPassInterface.h>
+#include <threadwork/BThreadWork.h>
+
+/**
+ * Payloads smaller than this are not compressed.
+ */
+#define DATAPROTOCOMPRESSOR_MIN_PAYLOAD 128
+
+/**
+ * A compressed payload is only used if it is smaller than the original
+ * by at least 1/DATAPROTOCOMPRESSOR_MIN_SAVING_DIV of its size.
+ */
+#define DATAPROTOCOMPRESSOR_MIN_SAVING_DIV 16
+
+/**
+ * After a payload does not compress, the following payloads are passed
+ * without trying; the number of them doubles with every further failure,
+ * up to this many.
+ */
+#define DATAPROTOCOMPRESSOR_MAX_SKIP 64
+
+struct DataProtoCompressor_stats {
+    uint64_t packets_compressed;
+    uint64_t bytes_saved;
+};
+
+/**
+ * A {@link PacketPassInterface} layer which LZ4-compresses the payloads of
+ * DataProto packets.
+ * 
+ * Packets are passed on unchanged until {@link DataProtoCompressor_SetPeerAccepts}
+ * enables compression. Then payloads of at least DATAPROTOCOMPRESSOR_MIN_PAYLOAD
+ * bytes are compressed in a {@link BThreadWork}; if the result is small enough,
+ * a copy of the packet with the compressed payload and the DATAPROTO_FLAGS_COMPRESSED
+ * flag is sent, otherwise the original packet. Payloads which do not compress
+ * make the compressor pass the following ones without trying for a while, so
+ * already compressed or encrypted traffic costs little.
+ * 
+ * Input packets must consist of a DataProto header, its destination peer IDs
+ * and the payload.
+ */
+typedef struct {
+    PacketPassInterface input;
+    PacketPassInterface *output;
+    BThreadWorkDispatcher *twd;
+    int peer_accepts;
+    uint8_t *buf;
+    uint8_t *in_data;
+    int in_len;
+    int in_offset;
+    int tw_have;
+    BThreadWork tw;
+    int tw_out_len;
+    int skip_left;
+    int skip_next;
+    struct lz4_state lz4;
+    struct DataProtoCompressor_stats stats;
+    DebugObject d_obj;
+} DataProtoCompressor;
+
+/**
+ * Initializes the object.
+ * Compression starts disabled.
+ * 
+ * @param o the object
+ * @param output output interface. Its MTU must be >=DATAPROTO_MAX_OVERHEAD.
+ *               If it supports cancel functionality, so will the input.
+ * @param pg pending group
+ * @param twd thread work dispatcher to compress in
+ * @return 1 on success, 0 on failure
+ */
+int DataProtoCompressor_Init (DataProtoCompressor *o, PacketPassInterface *output, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void DataProtoCompressor_Free (DataProtoCompressor *o);
+
+/**
+ * Returns the input interface.
+ * Its MTU will be the same as that of the output interface.
+ * 
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * DataProtoCompressor_GetInput (DataProtoCompressor *o);
+
+/**
+ * Sets whether the peer accepts compressed packets, i.e. whether payloads
+ * of following packets are compressed.
+ * 
+ * @param o the object
+ * @param peer_accepts whether the peer accepts compression. Must be 0 or 1.
+ */
+void DataProtoCompressor_SetPeerAccepts (DataProtoCompressor *o, int peer_accepts);
+
+/**
+ * Returns the counters.
+ * 
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void DataProtoCompressor_GetStats (DataProtoCompressor *o, struct DataProtoCompressor_stats *stats);
+
+#endif
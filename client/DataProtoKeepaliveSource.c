@@ -44,14 +44,17 @@ static void output_handler_recv (DataProtoKeepaliveSource *o, uint8_t *data)
     header.num_peer_ids = htol16(0);
     memcpy(data, &header, sizeof(header));
     
+    // leave room for the payload, filled in by the sender
+    memset(data + sizeof(header), 0, sizeof(struct dataproto_keepalive));
+    
     // finish packet
-    PacketRecvInterface_Done(&o->output, sizeof(struct dataproto_header));
+    PacketRecvInterface_Done(&o->output, DATAPROTOKEEPALIVESOURCE_PACKET_SIZE);
 }
 
 void DataProtoKeepaliveSource_Init (DataProtoKeepaliveSource *o, BPendingGroup *pg)
 {
     // init output
-    PacketRecvInterface_Init(&o->output, sizeof(struct dataproto_header), (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    PacketRecvInterface_Init(&o->output, DATAPROTOKEEPALIVESOURCE_PACKET_SIZE, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
     
     DebugObject_Init(&o->d_obj);
 }
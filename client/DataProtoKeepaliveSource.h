@@ -34,12 +34,16 @@
 #ifndef BADVPN_DATAPROTOKEEPALIVESOURCE_H
 #define BADVPN_DATAPROTOKEEPALIVESOURCE_H
 
+#include <protocol/dataproto.h>
 #include <base/DebugObject.h>
 #include <flow/PacketRecvInterface.h>
 
+#define DATAPROTOKEEPALIVESOURCE_PACKET_SIZE (sizeof(struct dataproto_header) + sizeof(struct dataproto_keepalive))
+
 /**
  * A {@link PacketRecvInterface} source which provides DataProto keepalive packets.
- * These packets have no payload, no destination peers and flags zero.
+ * These packets have no destination peers, flags zero, and a zeroed
+ * struct {@link dataproto_keepalive} as the payload, for the sender to fill in.
  */
 typedef struct {
     DebugObject d_obj;
@@ -63,7 +67,7 @@ void DataProtoKeepaliveSource_Free (DataProtoKeepaliveSource *o);
 
 /**
  * Returns the output interface.
- * The MTU of the output interface will be sizeof(struct dataproto_header).
+ * The MTU of the output interface will be DATAPROTOKEEPALIVESOURCE_PACKET_SIZE.
  *
  * @param o the object
  * @return output interface
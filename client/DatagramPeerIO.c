@@ -27,6 +27,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <misc/minmax.h>
+
 #include <client/DatagramPeerIO.h>
 
 #include <generated/blog_channel_DatagramPeerIO.h>
@@ -35,31 +37,102 @@
 #define DATAGRAMPEERIO_MODE_CONNECT 1
 #define DATAGRAMPEERIO_MODE_BIND 2
 
+// number of datagrams sent or received per system call
+#define DATAGRAMPEERIO_IO_BATCH 16
+
+// path MTU discovery: socket MTU assumed to work on any path
+// (IPv6 minimum MTU less IPv6 and UDP headers)
+#define DATAGRAMPEERIO_PMTU_BASE_SOCKET_MTU 1232
+// how long to wait for a probe acknowledgement
+#define DATAGRAMPEERIO_PMTU_PROBE_TIMER 1000
+// how many times a size is probed before it is considered too large
+#define DATAGRAMPEERIO_PMTU_MAX_PROBES 3
+// stop searching when the bounds are this close
+#define DATAGRAMPEERIO_PMTU_ACCURACY 8
+// how often to search again in case the path changed
+#define DATAGRAMPEERIO_PMTU_RAISE_TIMER 600000
+
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static void init_io (DatagramPeerIO *o);
+static int init_io (DatagramPeerIO *o);
 static void free_io (DatagramPeerIO *o);
 static void dgram_handler (DatagramPeerIO *o, int event);
 static void reset_mode (DatagramPeerIO *o);
 static void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void pmtu_start (DatagramPeerIO *o);
+static void pmtu_next (DatagramPeerIO *o);
+static void pmtu_send_probe (DatagramPeerIO *o, int len);
+static void pmtu_timer_handler (DatagramPeerIO *o);
+static void recv_probe_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len);
+static void recv_probe_ack_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len);
 
-void init_io (DatagramPeerIO *o)
+int init_io (DatagramPeerIO *o)
 {
     // init dgram recv interface
-    BDatagram_RecvAsync_Init(&o->dgram, o->effective_socket_mtu);
+    if (!BDatagram_RecvAsync_Init2(&o->dgram, o->effective_socket_mtu, DATAGRAMPEERIO_IO_BATCH)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
+        goto fail0;
+    }
+    
+    // init dgram send interface
+    if (!BDatagram_SendAsync_Init2(&o->dgram, o->effective_socket_mtu, DATAGRAMPEERIO_IO_BATCH)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_SendAsync_Init2 failed");
+        goto fail1;
+    }
+    
+    if (o->udp_offload) {
+        // enable offload where supported; without it we just use batching
+        if (!BDatagram_RecvAsync_SetGRO(&o->dgram, 1)) {
+            PeerLog(o, BLOG_INFO, "UDP GRO not available");
+        }
+        if (!BDatagram_SendAsync_SetGSO(&o->dgram, 1)) {
+            PeerLog(o, BLOG_INFO, "UDP GSO not available");
+        }
+    }
+    
+#ifdef BADVPN_USE_AF_XDP
+    // receive through AF_XDP as well; without it we just use the socket
+    if (o->xsk && !BDatagram_RecvAsync_SetXdp(&o->dgram, o->xsk)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_RecvAsync_SetXdp failed");
+    }
+#endif
+    
+    // set up path MTU discovery; until the first packet is received,
+    // packets are limited to the base size
+    o->pmtu_active = 0;
+    if (o->pmtu_discovery) {
+        if (BDatagram_SetPathMtuProbe(&o->dgram, 1)) {
+            o->pmtu_active = 1;
+        } else {
+            PeerLog(o, BLOG_INFO, "path MTU probing not available");
+        }
+    }
+    o->pmtu_lo = o->pmtu_base;
+    o->pmtu_hi = o->spproto_payload_mtu + 1;
+    o->pmtu_have_recv = 0;
+    o->pmtu_probe_len = 0;
+    o->pmtu_current = (o->pmtu_active ? o->pmtu_base : o->spproto_payload_mtu);
+    FragmentProtoDisassembler_SetPacketMtu(&o->send_disassembler, o->pmtu_current);
     
     // connect source
     PacketRecvConnector_ConnectInput(&o->recv_connector, BDatagram_RecvAsync_GetIf(&o->dgram));
     
-    // init dgram send interface
-    BDatagram_SendAsync_Init(&o->dgram, o->effective_socket_mtu);
-    
     // connect sink
     PacketPassConnector_ConnectOutput(&o->send_connector, BDatagram_SendAsync_GetIf(&o->dgram));
+    
+    return 1;
+    
+fail1:
+    BDatagram_RecvAsync_Free(&o->dgram);
+fail0:
+    return 0;
 }
 
 void free_io (DatagramPeerIO *o)
 {
+    // stop path MTU discovery
+    BReactor_RemoveTimer(o->reactor, &o->pmtu_timer);
+    
     // disconnect sink
     PacketPassConnector_DisconnectOutput(&o->send_connector);
     
@@ -113,9 +186,19 @@ void reset_mode (DatagramPeerIO *o)
 
 void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len)
 {
-    ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
     DebugObject_Access(&o->d_obj);
     
+    // the peer is reachable, start path MTU discovery
+    if (o->pmtu_active && !o->pmtu_have_recv) {
+        o->pmtu_have_recv = 1;
+        pmtu_start(o);
+    }
+    
+    if (o->mode != DATAGRAMPEERIO_MODE_BIND) {
+        return;
+    }
+    
     // obtain addresses from last received packet
     BAddr addr;
     BIPAddr local_addr;
@@ -131,6 +214,112 @@ void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_l
     BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
 }
 
+void pmtu_start (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtu_active)
+    
+    // search the whole range; the base size is assumed to work
+    o->pmtu_lo = o->pmtu_base;
+    o->pmtu_hi = o->spproto_payload_mtu + 1;
+    
+    pmtu_next(o);
+}
+
+void pmtu_next (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtu_active)
+    ASSERT(o->pmtu_lo < o->pmtu_hi)
+    
+    if (o->pmtu_hi - o->pmtu_lo <= DATAGRAMPEERIO_PMTU_ACCURACY) {
+        // search finished, use the largest size known to work
+        if (o->pmtu_current != o->pmtu_lo) {
+            PeerLog(o, BLOG_INFO, "path MTU %d", spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->pmtu_lo));
+            o->pmtu_current = o->pmtu_lo;
+            FragmentProtoDisassembler_SetPacketMtu(&o->send_disassembler, o->pmtu_current);
+        }
+        
+        // search again later
+        o->pmtu_probe_len = 0;
+        BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, DATAGRAMPEERIO_PMTU_RAISE_TIMER);
+        return;
+    }
+    
+    // try the maximum first, which usually works, then bisect
+    int len;
+    if (o->pmtu_hi > o->spproto_payload_mtu) {
+        len = o->spproto_payload_mtu;
+    } else {
+        len = o->pmtu_lo + (o->pmtu_hi - o->pmtu_lo) / 2;
+    }
+    
+    o->pmtu_probe_tries = 0;
+    pmtu_send_probe(o, len);
+}
+
+void pmtu_send_probe (DatagramPeerIO *o, int len)
+{
+    ASSERT(o->pmtu_active)
+    ASSERT(len > o->pmtu_lo)
+    ASSERT(len < o->pmtu_hi)
+    
+    // each try has its own identifier, so that a late acknowledgement
+    // is not mistaken for one of a later probe
+    o->pmtu_probe_id++;
+    o->pmtu_probe_len = len;
+    o->pmtu_probe_tries++;
+    
+    FragmentProtoDisassembler_SendProbe(&o->send_disassembler, o->pmtu_probe_id, len);
+    
+    BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, DATAGRAMPEERIO_PMTU_PROBE_TIMER);
+}
+
+void pmtu_timer_handler (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->pmtu_active)
+    
+    // time to search again?
+    if (o->pmtu_probe_len == 0) {
+        pmtu_start(o);
+        return;
+    }
+    
+    // probe again
+    if (o->pmtu_probe_tries < DATAGRAMPEERIO_PMTU_MAX_PROBES) {
+        pmtu_send_probe(o, o->pmtu_probe_len);
+        return;
+    }
+    
+    // size is too large
+    o->pmtu_hi = o->pmtu_probe_len;
+    pmtu_next(o);
+}
+
+void recv_probe_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // answer, even if we're not probing ourselves
+    FragmentProtoDisassembler_SendProbeAck(&o->send_disassembler, probe_id, probe_len);
+}
+
+void recv_probe_ack_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // check that it's for the outstanding probe
+    if (!o->pmtu_active || o->pmtu_probe_len == 0 || probe_id != o->pmtu_probe_id || probe_len != o->pmtu_probe_len) {
+        return;
+    }
+    
+    // size works
+    o->pmtu_lo = o->pmtu_probe_len;
+    
+    BReactor_RemoveTimer(o->reactor, &o->pmtu_timer);
+    pmtu_next(o);
+}
+
 int DatagramPeerIO_Init (
     DatagramPeerIO *o,
     BReactor *reactor,
@@ -139,7 +328,11 @@ int DatagramPeerIO_Init (
     struct spproto_security_params sp_params,
     btime_t latency,
     int num_frames,
+    int max_frames,
     PacketPassInterface *recv_userif,
+    int udp_offload,
+    int pmtu_discovery,
+    int crypto_pipeline,
     int otp_warning_count,
     BThreadWorkDispatcher *twd,
     void *user,
@@ -153,7 +346,11 @@ int DatagramPeerIO_Init (
     ASSERT(socket_mtu >= 0)
     spproto_assert_security_params(sp_params);
     ASSERT(num_frames > 0)
+    ASSERT(max_frames >= num_frames)
     ASSERT(PacketPassInterface_GetMTU(recv_userif) >= payload_mtu)
+    ASSERT(udp_offload == 0 || udp_offload == 1)
+    ASSERT(pmtu_discovery == 0 || pmtu_discovery == 1)
+    ASSERT(crypto_pipeline >= 1)
     if (SPPROTO_HAVE_OTP(sp_params)) {
         ASSERT(otp_warning_count > 0)
         ASSERT(otp_warning_count <= sp_params.otp_num)
@@ -166,10 +363,15 @@ int DatagramPeerIO_Init (
     o->user = user;
     o->logfunc = logfunc;
     o->handler_error = handler_error;
+    o->udp_offload = udp_offload;
+    o->pmtu_discovery = pmtu_discovery;
+#ifdef BADVPN_USE_AF_XDP
+    o->xsk = NULL;
+#endif
     
     // check num frames (for FragmentProtoAssembler)
-    if (num_frames >= FPA_MAX_TIME) {
-        PeerLog(o, BLOG_ERROR, "num_frames is too big");
+    if (max_frames > FPA_MAX_FRAMES) {
+        PeerLog(o, BLOG_ERROR, "max_frames is too big");
         goto fail0;
     }
     
@@ -191,22 +393,31 @@ int DatagramPeerIO_Init (
         goto fail0;
     }
     
+    // calculate path MTU discovery base size
+    o->pmtu_base = spproto_payload_mtu_for_carrier_mtu(o->sp_params, bmin_int(DATAGRAMPEERIO_PMTU_BASE_SOCKET_MTU, socket_mtu));
+    if (o->pmtu_base <= (int)sizeof(struct fragmentproto_chunk_header) || o->pmtu_base > o->spproto_payload_mtu) {
+        o->pmtu_base = o->spproto_payload_mtu;
+    }
+    
     // init receiving
     
     // init assembler
-    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->spproto_payload_mtu, recv_userif, num_frames, fragmentproto_max_chunks_for_frame(o->spproto_payload_mtu, o->payload_mtu),
+    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->spproto_payload_mtu, recv_userif, num_frames, max_frames, fragmentproto_max_chunks_for_frame(o->spproto_payload_mtu, o->payload_mtu),
                                      BReactor_PendingGroup(o->reactor), o->user, o->logfunc
     )) {
         PeerLog(o, BLOG_ERROR, "FragmentProtoAssembler_Init failed");
         goto fail0;
     }
     
+    // receive path MTU discovery control chunks
+    FragmentProtoAssembler_SetHandlers(&o->recv_assembler, (FragmentProtoAssembler_handler_probe)recv_probe_handler, (FragmentProtoAssembler_handler_probe_ack)recv_probe_ack_handler, o);
+    
     // init notifier
     PacketPassNotifier_Init(&o->recv_notifier, FragmentProtoAssembler_GetInput(&o->recv_assembler), BReactor_PendingGroup(o->reactor));
     
     // init decoder
-    if (!SPProtoDecoder_Init(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
-        PeerLog(o, BLOG_ERROR, "SPProtoDecoder_Init failed");
+    if (!SPProtoDecoder_Init2(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc, crypto_pipeline)) {
+        PeerLog(o, BLOG_ERROR, "SPProtoDecoder_Init2 failed");
         goto fail1;
     }
     SPProtoDecoder_SetHandlers(&o->recv_decoder, handler_otp_ready, user);
@@ -226,8 +437,8 @@ int DatagramPeerIO_Init (
     FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency);
     
     // init encoder
-    if (!SPProtoEncoder_Init(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd)) {
-        PeerLog(o, BLOG_ERROR, "SPProtoEncoder_Init failed");
+    if (!SPProtoEncoder_Init2(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd, crypto_pipeline)) {
+        PeerLog(o, BLOG_ERROR, "SPProtoEncoder_Init2 failed");
         goto fail3;
     }
     SPProtoEncoder_SetHandlers(&o->send_encoder, handler_otp_warning, user);
@@ -241,6 +452,10 @@ int DatagramPeerIO_Init (
         goto fail4;
     }
     
+    // init path MTU discovery timer
+    BTimer_Init(&o->pmtu_timer, 0, (BTimer_handler)pmtu_timer_handler, o);
+    o->pmtu_probe_id = 0;
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
     
@@ -315,14 +530,26 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
     BIPAddr_InitInvalid(&local_addr);
     BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
     
+    // we only talk to this address, use a connected socket
+    if (!BDatagram_SetAutoConnect(&o->dgram, 1)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SetAutoConnect failed");
+    }
+    
     // init I/O
-    init_io(o);
+    if (!init_io(o)) {
+        goto fail1;
+    }
+    
+    // set recv notifier handler
+    PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
     
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_CONNECT;
     
     return 1;
     
+fail1:
+    BDatagram_Free(&o->dgram);
 fail0:
     return 0;
 }
@@ -348,7 +575,9 @@ int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr)
     }
     
     // init I/O
-    init_io(o);
+    if (!init_io(o)) {
+        goto fail1;
+    }
     
     // set recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
@@ -364,9 +593,20 @@ fail0:
     return 0;
 }
 
+#ifdef BADVPN_USE_AF_XDP
+
+void DatagramPeerIO_SetXdp (DatagramPeerIO *o, BXdpSocket *xsk)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->xsk = xsk;
+}
+
+#endif
+
 void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // set sending key
@@ -378,7 +618,7 @@ void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key
 
 void DatagramPeerIO_RemoveEncryptionKey (DatagramPeerIO *o)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // remove sending key
@@ -423,3 +663,34 @@ void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o)
     // remove receiving seeds
     SPProtoDecoder_RemoveOTPSeeds(&o->recv_decoder);
 }
+
+void DatagramPeerIO_GetAssemblerStats (DatagramPeerIO *o, struct FragmentProtoAssembler_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    FragmentProtoAssembler_GetStats(&o->recv_assembler, stats);
+}
+
+void DatagramPeerIO_SetStatsName (DatagramPeerIO *o, const char *name)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // send chain
+    PacketPassInterface_SetStatsName(FragmentProtoDisassembler_GetInput(&o->send_disassembler), name, NULL, "FragmentProtoDisassembler");
+    PacketRecvInterface_SetStatsName(FragmentProtoDisassembler_GetOutput(&o->send_disassembler), name, "FragmentProtoDisassembler", "SPProtoEncoder");
+    PacketRecvInterface_SetStatsName(SPProtoEncoder_GetOutput(&o->send_encoder), name, "SPProtoEncoder", "SinglePacketBuffer");
+    PacketPassInterface_SetStatsName(PacketPassConnector_GetInput(&o->send_connector), name, "SinglePacketBuffer", "socket");
+    
+    // receive chain
+    PacketRecvInterface_SetStatsName(PacketRecvConnector_GetOutput(&o->recv_connector), name, "socket", "SinglePacketBuffer");
+    PacketPassInterface_SetStatsName(SPProtoDecoder_GetInput(&o->recv_decoder), name, "SinglePacketBuffer", "SPProtoDecoder");
+    PacketPassInterface_SetStatsName(PacketPassNotifier_GetInput(&o->recv_notifier), name, "SPProtoDecoder", "PacketPassNotifier");
+    PacketPassInterface_SetStatsName(FragmentProtoAssembler_GetInput(&o->recv_assembler), name, "PacketPassNotifier", "FragmentProtoAssembler");
+}
+
+void DatagramPeerIO_GetDecoderStats (DatagramPeerIO *o, struct SPProtoDecoder_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    SPProtoDecoder_GetStats(&o->recv_decoder, stats);
+}
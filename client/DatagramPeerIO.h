@@ -106,6 +106,11 @@ typedef struct {
     DatagramPeerIO_handler_error handler_error;
     int spproto_payload_mtu;
     int effective_socket_mtu;
+    int udp_offload;
+    int pmtu_discovery;
+#ifdef BADVPN_USE_AF_XDP
+    BXdpSocket *xsk;
+#endif
     
     // sending base
     FragmentProtoDisassembler send_disassembler;
@@ -120,6 +125,18 @@ typedef struct {
     PacketPassNotifier recv_notifier;
     FragmentProtoAssembler recv_assembler;
     
+    // path MTU discovery
+    int pmtu_active;
+    int pmtu_base;
+    int pmtu_lo;
+    int pmtu_hi;
+    int pmtu_current;
+    int pmtu_have_recv;
+    int pmtu_probe_len;
+    int pmtu_probe_tries;
+    fragmentproto_frameid pmtu_probe_id;
+    BTimer pmtu_timer;
+    
     // mode
     int mode;
     
@@ -144,7 +161,17 @@ typedef struct {
  * @param sp_params SPProto security parameters
  * @param latency latency parameter to {@link FragmentProtoDisassembler_Init}.
  * @param num_frames num_frames parameter to {@link FragmentProtoAssembler_Init}. Must be >0.
+ * @param max_frames max_frames parameter to {@link FragmentProtoAssembler_Init}. Must be >=num_frames.
  * @param recv_userif interface to pass received packets to the user. Its MTU must be >=payload_mtu.
+ * @param udp_offload whether to try UDP segmentation and receive offload (GSO/GRO) on the socket.
+ *                    Must be 0 or 1. If the system does not support it, datagrams are sent and
+ *                    received individually.
+ * @param pmtu_discovery whether to discover the path MTU by probing once a packet has been
+ *                       received from the peer. Must be 0 or 1. If enabled, packets start at
+ *                       a size which fits any path and grow to the largest size that is
+ *                       acknowledged by the peer. Probes from the peer are answered regardless.
+ * @param crypto_pipeline maximum number of packets being encrypted or decrypted at once
+ *                        in each direction (see {@link SPProtoEncoder_Init2}). Must be >=1.
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
  *                          In this case, must be >0 and <=sp_params.otp_num.
  * @param twd thread work dispatcher
@@ -163,7 +190,11 @@ int DatagramPeerIO_Init (
     struct spproto_security_params sp_params,
     btime_t latency,
     int num_frames,
+    int max_frames,
     PacketPassInterface *recv_userif,
+    int udp_offload,
+    int pmtu_discovery,
+    int crypto_pipeline,
     int otp_warning_count,
     BThreadWorkDispatcher *twd,
     void *user,
@@ -213,9 +244,24 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
  */
 int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
 
+#ifdef BADVPN_USE_AF_XDP
+/**
+ * Sets an AF_XDP socket to additionally receive datagrams through, see
+ * {@link BDatagram_RecvAsync_SetXdp}. Takes effect when the next
+ * {@link DatagramPeerIO_Connect} or {@link DatagramPeerIO_Bind} is done;
+ * if the port can't be registered, datagrams are received through the
+ * socket only.
+ * The AF_XDP socket must outlive the object.
+ * 
+ * @param o the object
+ * @param xsk AF_XDP socket, or NULL to stop using it
+ */
+void DatagramPeerIO_SetXdp (DatagramPeerIO *o, BXdpSocket *xsk);
+#endif
+
 /**
  * Sets the encryption key to use for sending and receiving.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
  * @param encryption_key key to use
@@ -224,7 +270,7 @@ void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key
 
 /**
  * Removed the encryption key to use for sending and receiving.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
  */
@@ -268,4 +314,29 @@ void DatagramPeerIO_AddOTPRecvSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t
  */
 void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o);
 
+/**
+ * Returns the frame counters of the receive assembler.
+ *
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void DatagramPeerIO_GetAssemblerStats (DatagramPeerIO *o, struct FragmentProtoAssembler_stats *stats);
+
+/**
+ * Names the interfaces of the send and receive chains for flow instrumentation
+ * (see {@link FlowStats}). Does nothing unless built with BADVPN_FLOW_STATS.
+ *
+ * @param o the object
+ * @param name prefix for the names of the elements, e.g. "peer 3"
+ */
+void DatagramPeerIO_SetStatsName (DatagramPeerIO *o, const char *name);
+
+/**
+ * Returns the packet counters of the receive decoder.
+ *
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void DatagramPeerIO_GetDecoderStats (DatagramPeerIO *o, struct SPProtoDecoder_stats *stats);
+
 #endif
@@ -40,52 +40,77 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_impl.h>
-
-static void free_frame (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
+static int round_up_pow2 (int x)
 {
-    // remove from used list
-    LinkedList1_Remove(&o->frames_used, &frame->list_node);
-    // remove from used tree
-    FPAFramesTree_Remove(&o->frames_used_tree, 0, frame);
+    ASSERT(x > 0)
+    ASSERT(x <= FPA_MAX_FRAMES)
+    
+    int r = 1;
+    while (r < x) {
+        r <<= 1;
+    }
     
-    // append to free list
-    LinkedList1_Append(&o->frames_free, &frame->list_node);
+    return r;
 }
 
-static void free_oldest_frame (FragmentProtoAssembler *o)
+static int frame_slot (FragmentProtoAssembler *o, fragmentproto_frameid id)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->frames_used))
-    
-    // obtain oldest frame (first on the list)
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_used);
-    ASSERT(list_node)
-    struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
-    
-    // free frame
-    free_frame(o, frame);
+    return (id & (o->num_frames - 1));
 }
 
-static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAssembler *o, fragmentproto_frameid id)
+static uint8_t * frame_buffer (FragmentProtoAssembler *o, int slot)
 {
-    ASSERT(!FPAFramesTree_LookupExact(&o->frames_used_tree, 0, id))
-    
-    // if there are no free entries, free the oldest used one
-    if (LinkedList1_IsEmpty(&o->frames_free)) {
-        PeerLog(o, BLOG_INFO, "freeing used frame");
-        free_oldest_frame(o);
+    return o->frames_buffer + (size_t)slot * o->output_mtu;
+}
+
+static uint64_t * frame_bitmap (FragmentProtoAssembler *o, int slot)
+{
+    return o->frames_bitmap + (size_t)slot * o->bitmap_words;
+}
+
+static int bitmap_range_any (const uint64_t *bm, int start, int len)
+{
+    while (len > 0) {
+        int bit = start % 64;
+        int n = (len < 64 - bit ? len : 64 - bit);
+        uint64_t mask = (n == 64 ? UINT64_MAX : (((uint64_t)1 << n) - 1) << bit);
+        if (bm[start / 64] & mask) {
+            return 1;
+        }
+        start += n;
+        len -= n;
     }
     
-    // obtain frame entry
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_free);
-    ASSERT(list_node)
-    struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
+    return 0;
+}
+
+static void bitmap_range_set (uint64_t *bm, int start, int len)
+{
+    while (len > 0) {
+        int bit = start % 64;
+        int n = (len < 64 - bit ? len : 64 - bit);
+        uint64_t mask = (n == 64 ? UINT64_MAX : (((uint64_t)1 << n) - 1) << bit);
+        bm[start / 64] |= mask;
+        start += n;
+        len -= n;
+    }
+}
+
+static void free_frame (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
+{
+    ASSERT(frame->used)
+    ASSERT(o->num_used > 0)
     
-    // remove from free list
-    LinkedList1_Remove(&o->frames_free, &frame->list_node);
+    frame->used = 0;
+    o->num_used--;
+}
+
+static void init_frame (FragmentProtoAssembler *o, int slot, fragmentproto_frameid id)
+{
+    struct FragmentProtoAssembler_frame *frame = &o->frames_entries[slot];
+    ASSERT(!frame->used)
     
-    // initialize values
+    frame->used = 1;
     frame->id = id;
     frame->time = o->time;
     frame->num_chunks = 0;
@@ -93,18 +118,9 @@ static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAs
     frame->length = -1;
     frame->length_so_far = 0;
     
-    // append to used list
-    LinkedList1_Append(&o->frames_used, &frame->list_node);
-    // insert to used tree
-    int res = FPAFramesTree_Insert(&o->frames_used_tree, 0, frame, NULL);
-    ASSERT_EXECUTE(res)
+    memset(frame_bitmap(o, slot), 0, o->bitmap_words * sizeof(uint64_t));
     
-    return frame;
-}
-
-static int chunks_overlap (int c1_start, int c1_len, int c2_start, int c2_len)
-{
-    return (c1_start + c1_len > c2_start && c2_start + c2_len > c1_start);
+    o->num_used++;
 }
 
 static int frame_is_timed_out (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
@@ -114,37 +130,148 @@ static int frame_is_timed_out (FragmentProtoAssembler *o, struct FragmentProtoAs
     return (o->time - frame->time > o->time_tolerance);
 }
 
+static int grow_window (FragmentProtoAssembler *o)
+{
+    ASSERT(o->num_frames < o->max_frames)
+    
+    int old_num = o->num_frames;
+    int new_num = 2 * old_num;
+    
+    // enlarge arrays; on failure, whatever was already enlarged stays
+    // valid and is used at the old size
+    struct FragmentProtoAssembler_frame *entries = (struct FragmentProtoAssembler_frame *)BReallocArray(o->frames_entries, new_num, sizeof(o->frames_entries[0]));
+    if (!entries) {
+        return 0;
+    }
+    o->frames_entries = entries;
+    
+    uint64_t *bitmap = (uint64_t *)BReallocArray(o->frames_bitmap, (size_t)new_num * o->bitmap_words, sizeof(uint64_t));
+    if (!bitmap) {
+        return 0;
+    }
+    o->frames_bitmap = bitmap;
+    
+    // the frame data comes from the arena, which cannot reallocate
+    uint8_t *buffer = (uint8_t *)BArena_AllocArray(o->arena, new_num, o->output_mtu);
+    if (!buffer) {
+        return 0;
+    }
+    memcpy(buffer, o->frames_buffer, (size_t)old_num * o->output_mtu);
+    BArena_Release(o->arena, o->frames_buffer, (size_t)old_num * o->output_mtu);
+    o->frames_buffer = buffer;
+    
+    o->num_frames = new_num;
+    
+    // the window grew, so does the tolerance
+    o->time_tolerance = new_num;
+    
+    // new slots are empty
+    for (int i = old_num; i < new_num; i++) {
+        o->frames_entries[i].used = 0;
+    }
+    
+    // move frames which belong into the upper half
+    for (int i = 0; i < old_num; i++) {
+        struct FragmentProtoAssembler_frame *frame = &o->frames_entries[i];
+        if (!frame->used) {
+            continue;
+        }
+        int slot = frame_slot(o, frame->id);
+        if (slot == i) {
+            continue;
+        }
+        ASSERT(slot == i + old_num)
+        o->frames_entries[slot] = *frame;
+        memcpy(frame_bitmap(o, slot), frame_bitmap(o, i), o->bitmap_words * sizeof(uint64_t));
+        memcpy(frame_buffer(o, slot), frame_buffer(o, i), o->output_mtu);
+        frame->used = 0;
+    }
+    
+    PeerLog(o, BLOG_INFO, "window grown to %d frames", new_num);
+    
+    return 1;
+}
+
+static struct FragmentProtoAssembler_frame * lookup_frame (FragmentProtoAssembler *o, fragmentproto_frameid id, int *out_slot)
+{
+    while (1) {
+        int slot = frame_slot(o, id);
+        struct FragmentProtoAssembler_frame *frame = &o->frames_entries[slot];
+        
+        if (frame->used) {
+            if (frame_is_timed_out(o, frame)) {
+                // frame is timed out, remove it and use a new one
+                PeerLog(o, BLOG_INFO, "freeing timed out frame (while processing chunk)");
+                free_frame(o, frame);
+                o->stats.frames_timed_out++;
+            }
+            else if (frame->id != id) {
+                // a frame still in time occupies the slot; don't let a late
+                // chunk throw away a newer frame
+                if ((int16_t)(fragmentproto_frameid)(id - frame->id) < 0) {
+                    PeerLog(o, BLOG_INFO, "chunk of an old frame");
+                    o->stats.chunks_late++;
+                    return NULL;
+                }
+                
+                // if the occupant received a chunk recently, frames are in
+                // flight concurrently beyond the window; make room by growing
+                // the window if possible. An occupant idle for half the window
+                // is most likely lost and is just evicted.
+                int recent = (o->time - frame->time < o->num_frames / 2);
+                if (recent && o->num_frames < o->max_frames && grow_window(o)) {
+                    continue;
+                }
+                
+                PeerLog(o, BLOG_INFO, "freeing used frame");
+                free_frame(o, frame);
+                o->stats.frames_evicted++;
+            }
+        }
+        
+        if (!frame->used) {
+            init_frame(o, slot, id);
+        }
+        
+        *out_slot = slot;
+        return frame;
+    }
+}
+
 static void reduce_times (FragmentProtoAssembler *o)
 {
-    // find the frame with minimal time, removing timed out frames
-    struct FragmentProtoAssembler_frame *minframe = NULL;
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_used);
-    while (list_node) {
-        LinkedList1Node *next = LinkedList1Node_Next(list_node);
-        struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
+    // find the minimal time, removing timed out frames
+    int have_min = 0;
+    uint32_t min_time = 0;
+    for (int i = 0; i < o->num_frames; i++) {
+        struct FragmentProtoAssembler_frame *frame = &o->frames_entries[i];
+        if (!frame->used) {
+            continue;
+        }
         if (frame_is_timed_out(o, frame)) {
             PeerLog(o, BLOG_INFO, "freeing timed out frame (while reducing times)");
             free_frame(o, frame);
+            o->stats.frames_timed_out++;
         } else {
-            if (!minframe || frame->time < minframe->time) {
-                minframe = frame;
+            if (!have_min || frame->time < min_time) {
+                have_min = 1;
+                min_time = frame->time;
             }
         }
-        list_node = next;
     }
     
-    if (!minframe) {
+    if (!have_min) {
         // have no frames, set packet time to zero
         o->time = 0;
         return;
     }
     
-    uint32_t min_time = minframe->time;
-    
     // subtract minimal time from all frames
-    for (list_node = LinkedList1_GetFirst(&o->frames_used); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
-        frame->time -= min_time;
+    for (int i = 0; i < o->num_frames; i++) {
+        struct FragmentProtoAssembler_frame *frame = &o->frames_entries[i];
+        if (frame->used) {
+            frame->time -= min_time;
+        }
     }
     
     // subtract minimal time from packet time
@@ -176,31 +303,20 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     ASSERT(chunk_end >= 0)
     ASSERT(chunk_end <= o->output_mtu)
     
-    // lookup frame
-    struct FragmentProtoAssembler_frame *frame = FPAFramesTree_LookupExact(&o->frames_used_tree, 0, frame_id);
+    // lookup frame, allocating a new one if needed
+    int slot;
+    struct FragmentProtoAssembler_frame *frame = lookup_frame(o, frame_id, &slot);
     if (!frame) {
-        // frame not found, add a new one
-        frame = allocate_new_frame(o, frame_id);
-    } else {
-        // have existing frame with that ID
-        // check frame time
-        if (frame_is_timed_out(o, frame)) {
-            // frame is timed out, remove it and use a new one
-            PeerLog(o, BLOG_INFO, "freeing timed out frame (while processing chunk)");
-            free_frame(o, frame);
-            frame = allocate_new_frame(o, frame_id);
-        }
+        return 0;
     }
     
     ASSERT(frame->num_chunks < o->num_chunks)
     
     // check if the chunk overlaps with any existing chunks
-    for (int i = 0; i < frame->num_chunks; i++) {
-        struct FragmentProtoAssembler_chunk *chunk = &frame->chunks[i];
-        if (chunks_overlap(chunk->start, chunk->len, chunk_start, chunk_len)) {
-            PeerLog(o, BLOG_INFO, "chunk overlaps with existing chunk");
-            goto fail_frame;
-        }
+    uint64_t *bitmap = frame_bitmap(o, slot);
+    if (bitmap_range_any(bitmap, chunk_start, chunk_len)) {
+        PeerLog(o, BLOG_INFO, "chunk overlaps with existing chunk");
+        goto fail_frame;
     }
     
     if (is_last) {
@@ -230,10 +346,8 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     // update frame time
     frame->time = o->time;
     
-    // add chunk entry
-    struct FragmentProtoAssembler_chunk *chunk = &frame->chunks[frame->num_chunks];
-    chunk->start = chunk_start;
-    chunk->len = chunk_len;
+    // mark chunk range
+    bitmap_range_set(bitmap, chunk_start, chunk_len);
     frame->num_chunks++;
     
     // update sum
@@ -251,7 +365,8 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     }
     
     // copy chunk payload to buffer
-    memcpy(frame->buffer + chunk_start, payload, chunk_len);
+    uint8_t *buffer = frame_buffer(o, slot);
+    memcpy(buffer + chunk_start, payload, chunk_len);
     
     // is frame incomplete?
     if (frame->length < 0 || frame->sum < frame->length) {
@@ -271,9 +386,11 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     
     // free frame entry
     free_frame(o, frame);
+    o->stats.frames_completed++;
     
-    // send frame
-    PacketPassInterface_Sender_Send(o->output, frame->buffer, frame->length);
+    // send frame; the slot is not reused before the output is done,
+    // since no more input is processed until then
+    PacketPassInterface_Sender_Send(o->output, buffer, frame->length);
     
     return 1;
     
@@ -301,18 +418,34 @@ static void process_input (FragmentProtoAssembler *o)
         int chunk_len = ltoh16(header.chunk_len);
         int is_last = ltoh8(header.is_last);
         
-        // check is_last field
-        if (!(is_last == 0 || is_last == 1)) {
-            PeerLog(o, BLOG_INFO, "chunk is_last wrong");
-            break;
-        }
-        
         // obtain data
         if (o->in_len - o->in_pos < chunk_len) {
             PeerLog(o, BLOG_INFO, "too little data for chunk data");
             break;
         }
         
+        // handle control chunks
+        if (is_last == FRAGMENTPROTO_CHUNK_PROBE) {
+            o->in_pos += chunk_len;
+            if (o->handler_probe) {
+                o->handler_probe(o->handler_user, frame_id, o->in_len);
+            }
+            continue;
+        }
+        if (is_last == FRAGMENTPROTO_CHUNK_PROBE_ACK) {
+            o->in_pos += chunk_len;
+            if (o->handler_probe_ack) {
+                o->handler_probe_ack(o->handler_user, frame_id, chunk_start);
+            }
+            continue;
+        }
+        
+        // check is_last field
+        if (!(is_last == 0 || is_last == 1)) {
+            PeerLog(o, BLOG_INFO, "chunk is_last wrong");
+            break;
+        }
+        
         // process chunk
         int res = process_chunk(o, frame_id, chunk_start, chunk_len, is_last, o->in + o->in_pos);
         o->in_pos += chunk_len;
@@ -326,7 +459,7 @@ static void process_input (FragmentProtoAssembler *o)
     // increment packet time
     if (o->time == FPA_MAX_TIME) {
         reduce_times(o);
-        if (!LinkedList1_IsEmpty(&o->frames_used)) {
+        if (o->num_used > 0) {
             ASSERT(o->time < FPA_MAX_TIME) // If there was a frame with zero time, it was removed because
                                            // time_tolerance < FPA_MAX_TIME. So something >0 was subtracted.
             o->time++;
@@ -367,11 +500,12 @@ static void output_handler_done (FragmentProtoAssembler *o)
     process_input(o);
 }
 
-int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc)
+int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int max_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc)
 {
     ASSERT(input_mtu >= 0)
     ASSERT(num_frames > 0)
-    ASSERT(num_frames < FPA_MAX_TIME) // needed so we can always subtract times when packet time is maximum
+    ASSERT(num_frames <= max_frames)
+    ASSERT(max_frames <= FPA_MAX_FRAMES) // also keeps time_tolerance < FPA_MAX_TIME
     ASSERT(num_chunks > 0)
     
     // init arguments
@@ -389,44 +523,51 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
     // remebmer output MTU
     o->output_mtu = PacketPassInterface_GetMTU(o->output);
     
+    // set window size
+    o->num_frames = round_up_pow2(num_frames);
+    o->max_frames = round_up_pow2(max_frames);
+    
+    // one bit per byte of frame data
+    o->bitmap_words = ((size_t)o->output_mtu + 63) / 64;
+    
     // set packet time to zero
     o->time = 0;
     
     // set time tolerance to num_frames
-    o->time_tolerance = num_frames;
+    o->time_tolerance = o->num_frames;
     
     // allocate frames
-    if (!(o->frames_entries = (struct FragmentProtoAssembler_frame *)BAllocArray(num_frames, sizeof(o->frames_entries[0])))) {
+    if (!(o->frames_entries = (struct FragmentProtoAssembler_frame *)BAllocArray(o->num_frames, sizeof(o->frames_entries[0])))) {
         goto fail1;
     }
     
-    // allocate chunks
-    if (!(o->frames_chunks = (struct FragmentProtoAssembler_chunk *)BAllocArray2(num_frames, o->num_chunks, sizeof(o->frames_chunks[0])))) {
+    // allocate chunk bitmaps
+    if (!(o->frames_bitmap = (uint64_t *)BAllocArray2(o->num_frames, o->bitmap_words, sizeof(o->frames_bitmap[0])))) {
         goto fail2;
     }
     
     // allocate buffers
-    if (!(o->frames_buffer = (uint8_t *)BAllocArray(num_frames, o->output_mtu))) {
+    o->arena = BPendingGroup_Arena(pg);
+    if (!(o->frames_buffer = (uint8_t *)BArena_AllocArray(o->arena, o->num_frames, o->output_mtu))) {
         goto fail3;
     }
     
-    // init frame lists
-    LinkedList1_Init(&o->frames_free);
-    LinkedList1_Init(&o->frames_used);
-    
     // initialize frame entries
-    for (int i = 0; i < num_frames; i++) {
-        struct FragmentProtoAssembler_frame *frame = &o->frames_entries[i];
-        // set chunks array pointer
-        frame->chunks = o->frames_chunks + (size_t)i * o->num_chunks;
-        // set buffer pointer
-        frame->buffer = o->frames_buffer + (size_t)i * o->output_mtu;
-        // add to free list
-        LinkedList1_Append(&o->frames_free, &frame->list_node);
+    for (int i = 0; i < o->num_frames; i++) {
+        o->frames_entries[i].used = 0;
     }
+    o->num_used = 0;
     
-    // init tree
-    FPAFramesTree_Init(&o->frames_used_tree);
+    // init counters
+    o->stats.frames_completed = 0;
+    o->stats.frames_evicted = 0;
+    o->stats.frames_timed_out = 0;
+    o->stats.chunks_late = 0;
+    
+    // have no handlers
+    o->handler_probe = NULL;
+    o->handler_probe_ack = NULL;
+    o->handler_user = NULL;
     
     // have no input packet
     o->in_len = -1;
@@ -436,7 +577,7 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
     return 1;
     
 fail3:
-    BFree(o->frames_chunks);
+    BFree(o->frames_bitmap);
 fail2:
     BFree(o->frames_entries);
 fail1:
@@ -449,10 +590,10 @@ void FragmentProtoAssembler_Free (FragmentProtoAssembler *o)
     DebugObject_Free(&o->d_obj);
 
     // free buffers
-    BFree(o->frames_buffer);
+    BArena_Release(o->arena, o->frames_buffer, (size_t)o->num_frames * o->output_mtu);
     
-    // free chunks
-    BFree(o->frames_chunks);
+    // free chunk bitmaps
+    BFree(o->frames_bitmap);
     
     // free frames
     BFree(o->frames_entries);
@@ -467,3 +608,20 @@ PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o
     
     return &o->input;
 }
+
+void FragmentProtoAssembler_SetHandlers (FragmentProtoAssembler *o, FragmentProtoAssembler_handler_probe handler_probe, FragmentProtoAssembler_handler_probe_ack handler_probe_ack, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler_probe = handler_probe;
+    o->handler_probe_ack = handler_probe_ack;
+    o->handler_user = user;
+}
+
+void FragmentProtoAssembler_GetStats (FragmentProtoAssembler *o, struct FragmentProtoAssembler_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *stats = o->stats;
+    stats->num_frames = o->num_frames;
+}
@@ -38,42 +38,66 @@
 
 #include <protocol/fragmentproto.h>
 #include <misc/debug.h>
-#include <misc/compare.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
-#include <structure/LinkedList1.h>
-#include <structure/SAvl.h>
 #include <flow/PacketPassInterface.h>
 
 #define FPA_MAX_TIME UINT32_MAX
 
-struct FragmentProtoAssembler_frame;
+// upper bound for the number of frame slots; the frame ID space is 16 bits,
+// so a larger window could never hold more distinct frames
+#define FPA_MAX_FRAMES 32768
 
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_decl.h>
+/**
+ * Handler called when a path MTU probe is received.
+ * The handler must not free the object.
+ * 
+ * @param user as in {@link FragmentProtoAssembler_SetHandlers}
+ * @param probe_id identifier of the probe
+ * @param probe_len length of the FragmentProto packet carrying the probe
+ */
+typedef void (*FragmentProtoAssembler_handler_probe) (void *user, fragmentproto_frameid probe_id, int probe_len);
 
-struct FragmentProtoAssembler_chunk {
-    int start;
-    int len;
-};
+/**
+ * Handler called when an acknowledgement of a path MTU probe is received.
+ * The handler must not free the object.
+ * 
+ * @param user as in {@link FragmentProtoAssembler_SetHandlers}
+ * @param probe_id identifier of the acknowledged probe
+ * @param probe_len length of the acknowledged probe packet, as reported by the peer
+ */
+typedef void (*FragmentProtoAssembler_handler_probe_ack) (void *user, fragmentproto_frameid probe_id, int probe_len);
 
 struct FragmentProtoAssembler_frame {
-    LinkedList1Node list_node; // node in free or used list
-    struct FragmentProtoAssembler_chunk *chunks; // array of chunks, up to num_chunks
-    uint8_t *buffer; // buffer with frame data, size output_mtu
+    int used; // whether the slot holds a frame
     // everything below only defined when frame entry is used
     fragmentproto_frameid id; // frame identifier
     uint32_t time; // packet time when the last chunk was received
-    FPAFramesTreeNode tree_node; // node fields in tree for searching frames by id
     int num_chunks; // number of valid chunks
     int sum; // sum of all chunks' lengths
     int length; // length of the frame, or -1 if not yet known
     int length_so_far; // if length=-1, current data set's upper bound
 };
 
+/**
+ * Frame counters of a {@link FragmentProtoAssembler}.
+ */
+struct FragmentProtoAssembler_stats {
+    uint64_t frames_completed; // frames fully assembled and passed to output
+    uint64_t frames_evicted; // incomplete frames dropped because a newer frame needed their slot
+    uint64_t frames_timed_out; // incomplete frames dropped because no chunk arrived in time
+    uint64_t chunks_late; // chunks dropped because their slot already holds a newer frame
+    int num_frames; // current number of frame slots
+};
+
 /**
  * Object which decodes packets according to FragmentProto.
  *
+ * Frames are kept in a ring of slots indexed by the frame ID modulo the
+ * number of slots, which is a power of two. When a frame still in time
+ * would be evicted from its slot by another frame, the ring is doubled,
+ * up to max_frames. Chunk placement within a frame is tracked with a bitmap.
+ *
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketPassInterface}.
  */
@@ -86,12 +110,18 @@ typedef struct {
     int num_chunks;
     uint32_t time;
     int time_tolerance;
+    int num_frames;
+    int max_frames;
+    int num_used;
+    size_t bitmap_words;
     struct FragmentProtoAssembler_frame *frames_entries;
-    struct FragmentProtoAssembler_chunk *frames_chunks;
+    uint64_t *frames_bitmap;
+    BArena *arena;
     uint8_t *frames_buffer;
-    LinkedList1 frames_free;
-    LinkedList1 frames_used;
-    FPAFramesTree frames_used_tree;
+    struct FragmentProtoAssembler_stats stats;
+    FragmentProtoAssembler_handler_probe handler_probe;
+    FragmentProtoAssembler_handler_probe_ack handler_probe_ack;
+    void *handler_user;
     int in_len;
     uint8_t *in;
     int in_pos;
@@ -105,16 +135,19 @@ typedef struct {
  * @param o the object
  * @param input_mtu maximum input packet size. Must be >=0.
  * @param output output interface
- * @param num_frames number of frames we can hold. Must be >0 and < FPA_MAX_TIME.
+ * @param num_frames initial number of frames we can hold. Must be >0 and <= max_frames.
+ *  Rounded up to a power of two.
  *  To make the assembler tolerate out-of-order input of degree D, set to D+2.
  *  Here, D is the minimum size of a hypothetical buffer needed to order the input.
+ * @param max_frames maximum number of frames the window may grow to.
+ *  Must be <= FPA_MAX_FRAMES. Rounded up to a power of two.
  * @param num_chunks maximum number of chunks a frame can come in. Must be >0.
  * @param pg pending group
  * @param user argument to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
  * @return 1 on success, 0 on failure
  */
-int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int max_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -131,4 +164,23 @@ void FragmentProtoAssembler_Free (FragmentProtoAssembler *o);
  */
 PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o);
 
+/**
+ * Sets handlers for path MTU discovery control chunks.
+ * Initially no handlers are set and control chunks are ignored.
+ *
+ * @param o the object
+ * @param handler_probe handler for received probes, or NULL
+ * @param handler_probe_ack handler for received probe acknowledgements, or NULL
+ * @param user argument to handlers
+ */
+void FragmentProtoAssembler_SetHandlers (FragmentProtoAssembler *o, FragmentProtoAssembler_handler_probe handler_probe, FragmentProtoAssembler_handler_probe_ack handler_probe_ack, void *user);
+
+/**
+ * Returns the frame counters.
+ *
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void FragmentProtoAssembler_GetStats (FragmentProtoAssembler *o, struct FragmentProtoAssembler_stats *stats);
+
 #endif
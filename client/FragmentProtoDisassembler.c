@@ -36,10 +36,27 @@
 
 #include "client/FragmentProtoDisassembler.h"
 
+#define OUT_AVAIL ((o->packet_mtu - o->out_used) - (int)sizeof(struct fragmentproto_chunk_header))
+
+static void finish_output (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->out)
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // stop timer (if it's running)
+    if (o->latency >= 0) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+    }
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, o->out_used);
+}
+
 static void write_chunks (FragmentProtoDisassembler *o)
 {
     #define IN_AVAIL (o->in_len - o->in_used)
-    #define OUT_AVAIL ((o->output_mtu - o->out_used) - (int)sizeof(struct fragmentproto_chunk_header))
     
     ASSERT(o->in_len >= 0)
     ASSERT(o->out)
@@ -83,16 +100,7 @@ static void write_chunks (FragmentProtoDisassembler *o)
     
     // should we finish the output packet?
     if (OUT_AVAIL <= 0 || o->latency < 0) {
-        // set no output packet
-        o->out = NULL;
-        
-        // stop timer (if it's running)
-        if (o->latency >= 0) {
-            BReactor_RemoveTimer(o->reactor, &o->timer);
-        }
-        
-        // finish output
-        PacketRecvInterface_Done(&o->output, o->out_used);
+        finish_output(o);
     } else {
         // start timer if we have output and it's not running (output was empty before)
         if (!BTimer_IsRunning(&o->timer)) {
@@ -101,6 +109,53 @@ static void write_chunks (FragmentProtoDisassembler *o)
     }
 }
 
+static void write_control (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->out)
+    ASSERT(o->probe_pending || o->ack_pending)
+    
+    // write probe, in a packet of its own
+    if (o->probe_pending && o->out_used == 0) {
+        struct fragmentproto_chunk_header header;
+        header.frame_id = htol16(o->probe_id);
+        header.chunk_start = htol16(0);
+        header.chunk_len = htol16(o->probe_len - sizeof(header));
+        header.is_last = FRAGMENTPROTO_CHUNK_PROBE;
+        memcpy(o->out, &header, sizeof(header));
+        memset(o->out + sizeof(header), 0, o->probe_len - sizeof(header));
+        o->out_used = o->probe_len;
+        
+        o->probe_pending = 0;
+        
+        finish_output(o);
+        return;
+    }
+    
+    // write probe acknowledgement
+    if (o->ack_pending) {
+        ASSERT(o->packet_mtu - o->out_used >= (int)sizeof(struct fragmentproto_chunk_header))
+        
+        struct fragmentproto_chunk_header header;
+        header.frame_id = htol16(o->ack_id);
+        header.chunk_start = htol16(o->ack_len);
+        header.chunk_len = htol16(0);
+        header.is_last = FRAGMENTPROTO_CHUNK_PROBE_ACK;
+        memcpy(o->out + o->out_used, &header, sizeof(header));
+        o->out_used += sizeof(header);
+        
+        o->ack_pending = 0;
+    }
+    
+    // continue with frame data if there is room, else send the packet
+    // right away; a pending probe goes into the next packet
+    if (o->in_len >= 0 && OUT_AVAIL > 0 && !o->probe_pending) {
+        write_chunks(o);
+        return;
+    }
+    
+    finish_output(o);
+}
+
 static void input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
@@ -140,6 +195,12 @@ static void output_handler_recv (FragmentProtoDisassembler *o, uint8_t *data)
     o->out = data;
     o->out_used = 0;
     
+    // control chunks go first
+    if (o->probe_pending || o->ack_pending) {
+        write_control(o);
+        return;
+    }
+    
     // if there is no input, wait for it
     if (o->in_len < 0) {
         return;
@@ -154,11 +215,7 @@ static void timer_handler (FragmentProtoDisassembler *o)
     ASSERT(o->out)
     ASSERT(o->in_len == -1)
     
-    // set no output packet
-    o->out = NULL;
-    
-    // finish output
-    PacketRecvInterface_Done(&o->output, o->out_used);
+    finish_output(o);
 }
 
 void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency)
@@ -171,6 +228,7 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     // init arguments
     o->reactor = reactor;
     o->output_mtu = output_mtu;
+    o->packet_mtu = output_mtu;
     o->chunk_mtu = chunk_mtu;
     o->latency = latency;
     
@@ -195,6 +253,10 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     // start with zero frame ID
     o->frame_id = 0;
     
+    // have no control chunks to send
+    o->probe_pending = 0;
+    o->ack_pending = 0;
+    
     DebugObject_Init(&o->d_obj);
 }
 
@@ -227,3 +289,52 @@ PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassem
     
     return &o->output;
 }
+
+void FragmentProtoDisassembler_SetPacketMtu (FragmentProtoDisassembler *o, int packet_mtu)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(packet_mtu > sizeof(struct fragmentproto_chunk_header))
+    ASSERT(packet_mtu <= o->output_mtu)
+    
+    o->packet_mtu = packet_mtu;
+    
+    // send a pending packet which no longer has room for a chunk
+    if (o->out && OUT_AVAIL <= 0) {
+        ASSERT(o->in_len == -1)
+        finish_output(o);
+    }
+}
+
+void FragmentProtoDisassembler_SendProbe (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(probe_len >= sizeof(struct fragmentproto_chunk_header))
+    ASSERT(probe_len <= o->output_mtu)
+    
+    // remember probe, replacing any not yet sent
+    o->probe_pending = 1;
+    o->probe_id = probe_id;
+    o->probe_len = probe_len;
+    
+    // write it if we have an output packet
+    if (o->out) {
+        write_control(o);
+    }
+}
+
+void FragmentProtoDisassembler_SendProbeAck (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(probe_len >= 0)
+    ASSERT(probe_len <= UINT16_MAX)
+    
+    // remember acknowledgement, replacing any not yet sent
+    o->ack_pending = 1;
+    o->ack_id = probe_id;
+    o->ack_len = probe_len;
+    
+    // write it if we have an output packet
+    if (o->out) {
+        write_control(o);
+    }
+}
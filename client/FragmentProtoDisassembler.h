@@ -48,12 +48,17 @@
  * Object which encodes packets into packets composed of chunks
  * according to FragmentProto.
  *
+ * Frame data is packed into packets up to the packet MTU, which starts at the
+ * output MTU and can be lowered with {@link FragmentProtoDisassembler_SetPacketMtu}.
+ * Path MTU probes and their acknowledgements can be sent as control chunks.
+ *
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketRecvInterface}.
  */
 typedef struct {
     BReactor *reactor;
     int output_mtu;
+    int packet_mtu;
     int chunk_mtu;
     btime_t latency;
     PacketPassInterface input;
@@ -65,6 +70,12 @@ typedef struct {
     uint8_t *out;
     int out_used;
     fragmentproto_frameid frame_id;
+    int probe_pending;
+    fragmentproto_frameid probe_id;
+    int probe_len;
+    int ack_pending;
+    fragmentproto_frameid ack_id;
+    int ack_len;
     DebugObject d_obj;
 } FragmentProtoDisassembler;
 
@@ -106,4 +117,35 @@ PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassemb
  */
 PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassembler *o);
 
+/**
+ * Sets the maximum size of packets carrying frame data.
+ * Probes may still be up to the output MTU.
+ *
+ * @param o the object
+ * @param packet_mtu packet MTU. Must be >sizeof(struct fragmentproto_chunk_header)
+ *                   and <=output_mtu.
+ */
+void FragmentProtoDisassembler_SetPacketMtu (FragmentProtoDisassembler *o, int packet_mtu);
+
+/**
+ * Sends a path MTU probe, as a packet of its own ahead of further frame data.
+ * If a probe is still waiting to be sent, it is replaced.
+ *
+ * @param o the object
+ * @param probe_id probe identifier
+ * @param probe_len length of the probe packet. Must be >=sizeof(struct fragmentproto_chunk_header)
+ *                  and <=output_mtu.
+ */
+void FragmentProtoDisassembler_SendProbe (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len);
+
+/**
+ * Sends an acknowledgement of a received path MTU probe, ahead of further frame data.
+ * If an acknowledgement is still waiting to be sent, it is replaced.
+ *
+ * @param o the object
+ * @param probe_id identifier of the received probe
+ * @param probe_len length of the received probe packet. Must be >=0 and <=UINT16_MAX.
+ */
+void FragmentProtoDisassembler_SendProbeAck (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len);
+
 #endif
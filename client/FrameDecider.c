@@ -29,6 +29,7 @@
 
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <misc/debug.h>
 #include <misc/offset.h>
@@ -51,14 +52,16 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
+static size_t hash_mac (const uint8_t *mac)
 {
-    int c = memcmp(mac1, mac2, 6);
-    return B_COMPARE(c, 0);
+    // a MAC fits into 48 bits; a multiplicative hash spreads it over the whole word
+    uint64_t x = 0;
+    memcpy(&x, mac, 6);
+    return (size_t)((x * UINT64_C(0x9E3779B97F4A7C15)) >> 16);
 }
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_impl.h>
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_impl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_impl.h>
@@ -66,12 +69,18 @@ static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
 #include "FrameDecider_multicast_tree.h"
 #include <structure/SAvl_impl.h>
 
+static FDMacsHashRef mac_entry_ref (struct _FrameDecider_mac_entry *entry)
+{
+    FDMacsHashRef ref = {entry, entry};
+    return ref;
+}
+
 static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
 {
     FrameDecider *d = o->d;
     
-    // locate entry in tree
-    struct _FrameDecider_mac_entry *e_entry = FDMacsTree_LookupExact(&d->macs_tree, 0, mac);
+    // locate entry in hash table
+    struct _FrameDecider_mac_entry *e_entry = FDMacsHash_Lookup(&d->macs_hash, 0, mac).ptr;
     if (e_entry) {
         if (e_entry->peer == o) {
             // this is our MAC; only move it to the end of the used list
@@ -81,7 +90,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         }
         
         // some other peer has that MAC; disassociate it
-        FDMacsTree_Remove(&d->macs_tree, 0, e_entry);
+        FDMacsHash_Remove(&d->macs_hash, 0, mac_entry_ref(e_entry));
         LinkedList1_Remove(&e_entry->peer->mac_entries_used, &e_entry->list_node);
         LinkedList1_Append(&e_entry->peer->mac_entries_free, &e_entry->list_node);
     }
@@ -102,7 +111,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         ASSERT(entry->peer == o)
         
         // remove from used
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        FDMacsHash_Remove(&d->macs_hash, 0, mac_entry_ref(entry));
         LinkedList1_Remove(&o->mac_entries_used, &entry->list_node);
     }
     
@@ -110,10 +119,11 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
     
     // set MAC in entry
     memcpy(entry->mac, mac, sizeof(entry->mac));
+    entry->hash = hash_mac(entry->mac);
     
     // add to used
     LinkedList1_Append(&o->mac_entries_used, &entry->list_node);
-    int res = FDMacsTree_Insert(&d->macs_tree, 0, entry, NULL);
+    int res = FDMacsHash_Insert(&d->macs_hash, 0, mac_entry_ref(entry), NULL);
     ASSERT_EXECUTE(res)
 }
 
@@ -320,7 +330,7 @@ static void group_entry_timer_handler (struct _FrameDecider_group_entry *group_e
     remove_group_entry(group_entry);
 }
 
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
 {
     ASSERT(max_peer_macs > 0)
     ASSERT(max_peer_groups > 0)
@@ -335,8 +345,14 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     // init peers list
     LinkedList1_Init(&o->peers_list);
     
-    // init MAC tree
-    FDMacsTree_Init(&o->macs_tree);
+    // init MAC hash table; it is grown as peers are added
+    if (!FDMacsHash_Init(&o->macs_hash, max_peer_macs)) {
+        BLog(BLOG_ERROR, "FDMacsHash_Init failed");
+        return 0;
+    }
+    
+    // no peers, so no MAC entries yet
+    o->num_mac_entries = 0;
     
     // init multicast tree
     FDMulticastTree_Init(&o->multicast_tree);
@@ -348,14 +364,18 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     o->decide_flood_current = NULL;
     
     DebugObject_Init(&o->d_obj);
+    return 1;
 }
 
 void FrameDecider_Free (FrameDecider *o)
 {
     ASSERT(FDMulticastTree_IsEmpty(&o->multicast_tree))
-    ASSERT(FDMacsTree_IsEmpty(&o->macs_tree))
+    ASSERT(o->num_mac_entries == 0)
     ASSERT(LinkedList1_IsEmpty(&o->peers_list))
     DebugObject_Free(&o->d_obj);
+    
+    // free MAC hash table
+    FDMacsHash_Free(&o->macs_hash);
 }
 
 void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int frame_len)
@@ -496,7 +516,7 @@ out:;
     }
     
     // look for MAC entry
-    struct _FrameDecider_mac_entry *entry = FDMacsTree_LookupExact(&o->macs_tree, 0, eh.dest);
+    struct _FrameDecider_mac_entry *entry = FDMacsHash_Lookup(&o->macs_hash, 0, eh.dest).ptr;
     if (entry) {
         o->decide_state = DECIDE_STATE_UNICAST;
         o->decide_unicast_peer = entry->peer;
@@ -574,6 +594,20 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
         goto fail1;
     }
     
+    // grow MAC hash table to have at least as many buckets as there are MAC entries
+    if (d->num_mac_entries > SIZE_MAX - d->max_peer_macs) {
+        PeerLog(o, BLOG_ERROR, "too many MAC entries");
+        goto fail2;
+    }
+    size_t num_mac_entries = d->num_mac_entries + d->max_peer_macs;
+    while (d->macs_hash.num_buckets < num_mac_entries) {
+        if (!FDMacsHash_MultiplyBuckets(&d->macs_hash, 0, 1)) {
+            PeerLog(o, BLOG_ERROR, "FDMacsHash_MultiplyBuckets failed");
+            goto fail2;
+        }
+    }
+    d->num_mac_entries = num_mac_entries;
+    
     // insert to peers list
     LinkedList1_Append(&d->peers_list, &o->list_node);
     
@@ -617,6 +651,8 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
     
     return 1;
     
+fail2:
+    BFree(o->group_entries);
 fail1:
     BFree(o->mac_entries);
 fail0:
@@ -647,13 +683,14 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         BReactor_RemoveTimer(d->reactor, &entry->timer);
     }
     
-    // remove used MAC entries from tree
+    // remove used MAC entries from hash table
     for (node = LinkedList1_GetFirst(&o->mac_entries_used); node; node = LinkedList1Node_Next(node)) {
         struct _FrameDecider_mac_entry *entry = UPPER_OBJECT(node, struct _FrameDecider_mac_entry, list_node);
         
-        // remove from tree
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        // remove from hash table
+        FDMacsHash_Remove(&d->macs_hash, 0, mac_entry_ref(entry));
     }
+    d->num_mac_entries -= d->max_peer_macs;
     
     // remove from peers list
     if (d->decide_flood_current == &o->list_node) {
@@ -36,10 +36,12 @@
 #define BADVPN_CLIENT_FRAMEDECIDER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <structure/LinkedList1.h>
 #include <structure/LinkedList3.h>
 #include <structure/SAvl.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
@@ -48,10 +50,11 @@ struct _FrameDeciderPeer;
 struct _FrameDecider_mac_entry;
 struct _FrameDecider_group_entry;
 
-typedef const uint8_t *FDMacsTree_key;
+typedef struct _FrameDecider_mac_entry *FDMacsHash_link;
+typedef const uint8_t *FDMacsHash_key;
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_decl.h>
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_decl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_decl.h>
@@ -64,7 +67,8 @@ struct _FrameDecider_mac_entry {
     LinkedList1Node list_node; // node in FrameDeciderPeer.mac_entries_free or FrameDeciderPeer.mac_entries_used
     // defined when used:
     uint8_t mac[6];
-    FDMacsTreeNode tree_node; // node in FrameDecider.macs_tree, indexed by mac
+    size_t hash; // hash of mac
+    FDMacsHash_link hash_next; // next in FrameDecider.macs_hash bucket, indexed by mac
 };
 
 struct _FrameDecider_group_entry {
@@ -96,7 +100,8 @@ typedef struct {
     btime_t igmp_last_member_query_time;
     BReactor *reactor;
     LinkedList1 peers_list;
-    FDMacsTree macs_tree;
+    FDMacsHash macs_hash;
+    size_t num_mac_entries;
     FDMulticastTree multicast_tree;
     int decide_state;
     LinkedList1Node *decide_flood_current;
@@ -136,8 +141,9 @@ typedef struct _FrameDeciderPeer {
  * @param igmp_last_member_query_time IGMP Last Member Query Time value. When a Group-Specific
  *        Query is detected in {@link FrameDecider_AnalyzeAndDecide}, this is how long we wait for a peer
  *        belonging to the group to send a join before we remove the group from it.
+ * @return 1 on success, 0 on failure
  */
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor);
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -143,16 +143,6 @@ void listener_handler (PasswordListener *l)
             goto fail3;
         }
         
-        // set require client certificate
-        if (SSL_OptionSet(client->sock->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
-            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
-            goto fail3;
-        }
-        if (SSL_OptionSet(client->sock->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
-            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
-            goto fail3;
-        }
-        
         // initialize SSLConnection
         BSSLConnection_Init(&client->sslcon, client->sock->ssl_prfd, 0, BReactor_PendingGroup(l->bsys), client, (BSSLConnection_handler)client_sslcon_handler);
         
@@ -288,6 +278,16 @@ int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispa
             BLog(BLOG_ERROR, "SSL_ConfigSecureServer failed");
             goto fail2;
         }
+        
+        // set require client certificate; accepted sockets inherit this
+        if (SSL_OptionSet(l->model_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
+            goto fail2;
+        }
+        if (SSL_OptionSet(l->model_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
+            goto fail2;
+        }
     }
     
     // initialize client entries
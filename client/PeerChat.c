@@ -103,13 +103,13 @@ static SECStatus client_auth_data_callback (PeerChat *o, PRFileDesc *fd, CERTDis
     DebugObject_Access(&o->d_obj);
     ASSERT(o->ssl_mode == PEERCHAT_SSL_CLIENT)
     
-    CERTCertificate *cert = CERT_DupCertificate(o->ssl_cert);
+    CERTCertificate *cert = CERT_DupCertificate(o->ssl_model->cert);
     if (!cert) {
         PeerLog(o, BLOG_ERROR, "CERT_DupCertificate failed");
         goto fail0;
     }
     
-    SECKEYPrivateKey *key = SECKEY_CopyPrivateKey(o->ssl_key);
+    SECKEYPrivateKey *key = SECKEY_CopyPrivateKey(o->ssl_model->key);
     if (!key) {
         PeerLog(o, BLOG_ERROR, "SECKEY_CopyPrivateKey failed");
         goto fail1;
@@ -193,13 +193,64 @@ static void ssl_recv_decoder_handler_error (PeerChat *o)
     return;
 }
 
-int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key,
+int PeerChatSSLModel_Init (PeerChatSSLModel *o, CERTCertificate *cert, SECKEYPrivateKey *key)
+{
+    ASSERT(cert)
+    ASSERT(key)
+    
+    // init arguments
+    o->cert = cert;
+    o->key = key;
+    
+    // initialize model SSL fd
+    DummyPRFileDesc_Create(&o->model_dprfd);
+    if (!(o->model_prfd = SSL_ImportFD(NULL, &o->model_dprfd))) {
+        BLog(BLOG_ERROR, "SSL_ImportFD failed");
+        ASSERT_FORCE(PR_Close(&o->model_dprfd) == PR_SUCCESS)
+        goto fail0;
+    }
+    
+    // set server certificate
+    if (SSL_ConfigSecureServer(o->model_prfd, cert, key, NSS_FindCertKEAType(cert)) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_ConfigSecureServer failed");
+        goto fail1;
+    }
+    
+    // set require client certificate
+    if (SSL_OptionSet(o->model_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
+        goto fail1;
+    }
+    if (SSL_OptionSet(o->model_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
+        goto fail1;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    ASSERT_FORCE(PR_Close(o->model_prfd) == PR_SUCCESS)
+fail0:
+    return 0;
+}
+
+void PeerChatSSLModel_Free (PeerChatSSLModel *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free model SSL fd
+    ASSERT_FORCE(PR_Close(o->model_prfd) == PR_SUCCESS)
+}
+
+int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, PeerChatSSLModel *ssl_model,
                    uint8_t *ssl_peer_cert, int ssl_peer_cert_len, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user,
                    BLog_logfunc logfunc,
                    PeerChat_handler_error handler_error,
                    PeerChat_handler_message handler_message)
 {
     ASSERT(ssl_mode == PEERCHAT_SSL_NONE || ssl_mode == PEERCHAT_SSL_CLIENT || ssl_mode == PEERCHAT_SSL_SERVER)
+    ASSERT(ssl_mode == PEERCHAT_SSL_NONE || ssl_model)
     ASSERT(ssl_mode == PEERCHAT_SSL_NONE || ssl_peer_cert_len >= 0)
     ASSERT(logfunc)
     ASSERT(handler_error)
@@ -207,8 +258,7 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
     
     // init arguments
     o->ssl_mode = ssl_mode;
-    o->ssl_cert = ssl_cert;
-    o->ssl_key = ssl_key;
+    o->ssl_model = ssl_model;
     o->ssl_peer_cert = ssl_peer_cert;
     o->ssl_peer_cert_len = ssl_peer_cert_len;
     o->user = user;
@@ -243,14 +293,20 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
         // init SSL StreamPacketSender
         StreamPacketSender_Init(&o->ssl_sp_sender, send_buf_output, pg);
         
+        // process records in threads too if handshakes are
+        if ((ssl_flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE)) {
+            ssl_flags |= BSSLCONNECTION_FLAG_THREADWORK_IO;
+        }
+        
         // init SSL bottom prfd
         if (!BSSLConnection_MakeBackend(&o->ssl_bottom_prfd, StreamPacketSender_GetInput(&o->ssl_sp_sender), SimpleStreamBuffer_GetOutput(&o->ssl_recv_buf), twd, ssl_flags)) {
             PeerLog(o, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
             goto fail2;
         }
         
-        // init SSL prfd
-        if (!(o->ssl_prfd = SSL_ImportFD(NULL, &o->ssl_bottom_prfd))) {
+        // init SSL prfd; the server takes its certificate configuration from the model
+        PRFileDesc *model_prfd = (o->ssl_mode == PEERCHAT_SSL_SERVER ? o->ssl_model->model_prfd : NULL);
+        if (!(o->ssl_prfd = SSL_ImportFD(model_prfd, &o->ssl_bottom_prfd))) {
             ASSERT_FORCE(PR_Close(&o->ssl_bottom_prfd) == PR_SUCCESS)
             PeerLog(o, BLOG_ERROR, "SSL_ImportFD failed");
             goto fail2;
@@ -262,23 +318,7 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
             goto fail3;
         }
         
-        if (o->ssl_mode == PEERCHAT_SSL_SERVER) {
-            // set server certificate
-            if (SSL_ConfigSecureServer(o->ssl_prfd, o->ssl_cert, o->ssl_key, NSS_FindCertKEAType(o->ssl_cert)) != SECSuccess) {
-                PeerLog(o, BLOG_ERROR, "SSL_ConfigSecureServer failed");
-                goto fail3;
-            }
-            
-            // set require client certificate
-            if (SSL_OptionSet(o->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
-                PeerLog(o, BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
-                goto fail3;
-            }
-            if (SSL_OptionSet(o->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
-                PeerLog(o, BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
-                goto fail3;
-            }
-        } else {
+        if (o->ssl_mode == PEERCHAT_SSL_CLIENT) {
             // set client certificate callback
             if (SSL_GetClientAuthDataHook(o->ssl_prfd, (SSLGetClientAuthData)client_auth_data_callback, o) != SECSuccess) {
                 PeerLog(o, BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
@@ -50,6 +50,7 @@
 #include <flow/PacketBuffer.h>
 #include <flow/BufferWriter.h>
 #include <nspr_support/BSSLConnection.h>
+#include <nspr_support/DummyPRFileDesc.h>
 #include <client/SCOutmsgEncoder.h>
 #include <client/SimpleStreamBuffer.h>
 
@@ -62,13 +63,25 @@
 
 //#define PEERCHAT_SIMULATE_ERROR 40
 
+/**
+ * SSL settings shared by the chats with all peers.
+ * The server side certificate configuration, which builds the certificate
+ * chain, is done once here, and chat SSL sockets are created from it.
+ */
+typedef struct {
+    CERTCertificate *cert;
+    SECKEYPrivateKey *key;
+    PRFileDesc model_dprfd;
+    PRFileDesc *model_prfd;
+    DebugObject d_obj;
+} PeerChatSSLModel;
+
 typedef void (*PeerChat_handler_error) (void *user);
 typedef void (*PeerChat_handler_message) (void *user, uint8_t *data, int data_len);
 
 typedef struct {
     int ssl_mode;
-    CERTCertificate *ssl_cert;
-    SECKEYPrivateKey *ssl_key;
+    PeerChatSSLModel *ssl_model;
     uint8_t *ssl_peer_cert;
     int ssl_peer_cert_len;
     void *user;
@@ -109,7 +122,36 @@ typedef struct {
     DebugObject d_obj;
 } PeerChat;
 
-int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key,
+/**
+ * Initializes the SSL settings for peer chats.
+ * {@link DummyPRFileDesc_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param cert our certificate. Must remain valid until the model is freed.
+ * @param key private key of our certificate. Must remain valid until the model is freed.
+ * @return 1 on success, 0 on failure
+ */
+int PeerChatSSLModel_Init (PeerChatSSLModel *o, CERTCertificate *cert, SECKEYPrivateKey *key) WARN_UNUSED;
+
+/**
+ * Frees the SSL settings for peer chats.
+ * There must be no chats using them.
+ * 
+ * @param o the object
+ */
+void PeerChatSSLModel_Free (PeerChatSSLModel *o);
+
+/**
+ * Initializes a chat with a peer.
+ * If ssl_flags has {@link BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE}, the SSL
+ * records of the chat are also processed in threads, as if
+ * {@link BSSLCONNECTION_FLAG_THREADWORK_IO} was given. Chat traffic is light
+ * but mostly handshake and peer setup work, which should not hold up the
+ * reactor.
+ * 
+ * @param ssl_model SSL settings, unless ssl_mode is PEERCHAT_SSL_NONE
+ */
+int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, PeerChatSSLModel *ssl_model,
                    uint8_t *ssl_peer_cert, int ssl_peer_cert_len, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user,
                    BLog_logfunc logfunc,
                    PeerChat_handler_error handler_error,
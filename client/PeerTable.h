@@ -0,0 +1,157 @@
+/**
+ * @file PeerTable.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Table of peers indexed directly by peer ID.
+ */
+
+#ifndef BADVPN_CLIENT_PEERTABLE_H
+#define BADVPN_CLIENT_PEERTABLE_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <protocol/scproto.h>
+
+#define PEERTABLE_MIN_SIZE 64
+
+/**
+ * Table of peers indexed directly by peer ID, for O(1) lookups.
+ * The table grows to cover the largest ID added and never shrinks, so its
+ * size is bounded by the ID range the server hands out, not by the number
+ * of peers. The server spreads IDs over all of peerid_t so that it doesn't
+ * reuse them soon, so expect up to 65536 entries, 512 KiB with 64-bit
+ * pointers. Keep one table per client, not one per peer; for per-peer maps
+ * keyed by peer ID, use a hash table.
+ */
+typedef struct {
+    void **entries;
+    size_t size;
+} PeerTable;
+
+/**
+ * Initializes the table. Memory is allocated with the first entry.
+ * 
+ * @param o the object
+ */
+static void PeerTable_Init (PeerTable *o);
+
+/**
+ * Frees the table.
+ * 
+ * @param o the object
+ */
+static void PeerTable_Free (PeerTable *o);
+
+/**
+ * Returns the entry for a peer ID.
+ * 
+ * @param o the object
+ * @param id peer ID
+ * @return entry, or NULL if there is none
+ */
+static void * PeerTable_Get (PeerTable *o, peerid_t id);
+
+/**
+ * Adds an entry for a peer ID, growing the table if needed.
+ * 
+ * @param o the object
+ * @param id peer ID. There must be no entry for it.
+ * @param entry entry. Must not be NULL.
+ * @return 1 on success, 0 on failure
+ */
+static int PeerTable_Add (PeerTable *o, peerid_t id, void *entry) WARN_UNUSED;
+
+/**
+ * Removes the entry for a peer ID.
+ * 
+ * @param o the object
+ * @param id peer ID. There must be an entry for it.
+ */
+static void PeerTable_Remove (PeerTable *o, peerid_t id);
+
+void PeerTable_Init (PeerTable *o)
+{
+    o->entries = NULL;
+    o->size = 0;
+}
+
+void PeerTable_Free (PeerTable *o)
+{
+    BFree(o->entries);
+}
+
+void * PeerTable_Get (PeerTable *o, peerid_t id)
+{
+    if (id >= o->size) {
+        return NULL;
+    }
+    
+    return o->entries[id];
+}
+
+int PeerTable_Add (PeerTable *o, peerid_t id, void *entry)
+{
+    ASSERT(entry)
+    ASSERT(!PeerTable_Get(o, id))
+    
+    // grow to cover the ID, doubling the size
+    if (id >= o->size) {
+        size_t new_size = (o->size > 0 ? o->size : PEERTABLE_MIN_SIZE);
+        while (new_size <= id) {
+            new_size *= 2;
+        }
+        
+        void **new_entries = (void **)BReallocArray(o->entries, new_size, sizeof(new_entries[0]));
+        if (!new_entries) {
+            return 0;
+        }
+        for (size_t i = o->size; i < new_size; i++) {
+            new_entries[i] = NULL;
+        }
+        
+        o->entries = new_entries;
+        o->size = new_size;
+    }
+    
+    o->entries[id] = entry;
+    
+    return 1;
+}
+
+void PeerTable_Remove (PeerTable *o, peerid_t id)
+{
+    ASSERT(PeerTable_Get(o, id))
+    
+    o->entries[id] = NULL;
+}
+
+#endif
@@ -28,8 +28,10 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <misc/balign.h>
+#include <misc/balloc.h>
 #include <misc/byteorder.h>
 #include <security/BHash.h>
 
@@ -39,40 +41,60 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static void decode_work_func (SPProtoDecoder *o)
+static void pipeline_accept_input (SPProtoDecoder *o, uint8_t *data, int data_len);
+static void pipeline_maybe_accept_input (SPProtoDecoder *o);
+static void pipeline_release_first (SPProtoDecoder *o);
+static void pipeline_maybe_output (SPProtoDecoder *o);
+
+static int decode_buffer (SPProtoDecoder *o, BEncryption *encryptor, BAead *aead, BHash *hash_ctx, uint8_t *in, int in_len, uint8_t *buf, uint8_t **out, uint16_t *out_seed_id, otp_t *out_otp)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->in_len <= o->input_mtu)
-    
-    uint8_t *in = o->in;
-    int in_len = o->in_len;
-    
-    o->tw_out_len = -1;
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
     
     uint8_t *plaintext;
     int plaintext_len;
     
     // decrypt if needed
-    if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // input must have a nonce and a tag
+        if (in_len < BAEAD_NONCE_SIZE + BAEAD_TAG_SIZE) {
+            PeerLog(o, BLOG_WARNING, "packet does not have a nonce and tag");
+            return -1;
+        }
+        
+        // check if we have encryption key
+        if (!o->have_encryption_key) {
+            PeerLog(o, BLOG_WARNING, "have no encryption key");
+            return -1;
+        }
+        
+        // decrypt in place and verify tag
+        plaintext = in + BAEAD_NONCE_SIZE;
+        plaintext_len = in_len - BAEAD_NONCE_SIZE - BAEAD_TAG_SIZE;
+        if (!BAead_Decrypt(aead, in, plaintext, plaintext, plaintext_len, plaintext + plaintext_len)) {
+            PeerLog(o, BLOG_WARNING, "packet has wrong tag");
+            return -1;
+        }
+    } else if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         plaintext = in;
         plaintext_len = in_len;
     } else {
         // input must be a multiple of blocks size
         if (in_len % o->enc_block_size != 0) {
             PeerLog(o, BLOG_WARNING, "packet size not a multiple of block size");
-            return;
+            return -1;
         }
         
         // input must have an IV block
         if (in_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have an IV");
-            return;
+            return -1;
         }
         
         // check if we have encryption key
         if (!o->have_encryption_key) {
             PeerLog(o, BLOG_WARNING, "have no encryption key");
-            return;
+            return -1;
         }
         
         // copy IV as BEncryption_Decrypt changes the IV
@@ -82,13 +104,13 @@ static void decode_work_func (SPProtoDecoder *o)
         // decrypt
         uint8_t *ciphertext = in + o->enc_block_size;
         int ciphertext_len = in_len - o->enc_block_size;
-        plaintext = o->buf;
-        BEncryption_Decrypt(&o->encryptor, ciphertext, plaintext, ciphertext_len, iv);
+        plaintext = buf;
+        BEncryption_Decrypt(encryptor, ciphertext, plaintext, ciphertext_len, iv);
         
         // read padding
         if (ciphertext_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have a padding block");
-            return;
+            return -1;
         }
         int i;
         for (i = ciphertext_len - 1; i >= ciphertext_len - o->enc_block_size; i--) {
@@ -97,12 +119,12 @@ static void decode_work_func (SPProtoDecoder *o)
             }
             if (plaintext[i] != 0) {
                 PeerLog(o, BLOG_WARNING, "packet padding wrong (nonzero byte)");
-                return;
+                return -1;
             }
         }
         if (i < ciphertext_len - o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet padding wrong (all zeroes)");
-            return;
+            return -1;
         }
         plaintext_len = i;
     }
@@ -110,14 +132,14 @@ static void decode_work_func (SPProtoDecoder *o)
     // check for header
     if (plaintext_len < SPPROTO_HEADER_LEN(o->sp_params)) {
         PeerLog(o, BLOG_WARNING, "packet has no header");
-        return;
+        return -1;
     }
     uint8_t *header = plaintext;
     
     // check data length
     if (plaintext_len - SPPROTO_HEADER_LEN(o->sp_params) > o->output_mtu) {
         PeerLog(o, BLOG_WARNING, "packet too long");
-        return;
+        return -1;
     }
     
     // check OTP
@@ -125,8 +147,8 @@ static void decode_work_func (SPProtoDecoder *o)
         // remember seed and OTP (can't check from here)
         struct spproto_otpdata header_otpd;
         memcpy(&header_otpd, header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), sizeof(header_otpd));
-        o->tw_out_seed_id = ltoh16(header_otpd.seed_id);
-        o->tw_out_otp = header_otpd.otp;
+        *out_seed_id = ltoh16(header_otpd.seed_id);
+        *out_otp = header_otpd.otp;
     }
     
     // check hash
@@ -139,19 +161,28 @@ static void decode_work_func (SPProtoDecoder *o)
         memset(header_hash, 0, o->hash_size);
         // calculate hash
         uint8_t hash_calc[BHASH_MAX_SIZE];
-        BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash_calc);
+        BHash_Start(hash_ctx);
+        BHash_Update(hash_ctx, plaintext, plaintext_len);
+        BHash_Finish(hash_ctx, hash_calc);
         // set hash field to its original value
         memcpy(header_hash, hash, o->hash_size);
         // compare hashes
         if (memcmp(hash, hash_calc, o->hash_size)) {
             PeerLog(o, BLOG_WARNING, "packet has wrong hash");
-            return;
+            return -1;
         }
     }
     
     // return packet
-    o->tw_out = plaintext + SPPROTO_HEADER_LEN(o->sp_params);
-    o->tw_out_len = plaintext_len - SPPROTO_HEADER_LEN(o->sp_params);
+    *out = plaintext + SPPROTO_HEADER_LEN(o->sp_params);
+    return plaintext_len - SPPROTO_HEADER_LEN(o->sp_params);
+}
+
+static void decode_work_func (SPProtoDecoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    
+    o->tw_out_len = decode_buffer(o, &o->encryptor, &o->aead, &o->hash, o->in, o->in_len, o->buf, &o->tw_out, &o->tw_out_seed_id, &o->tw_out_otp);
 }
 
 static void decode_work_handler (SPProtoDecoder *o)
@@ -174,10 +205,12 @@ static void decode_work_handler (SPProtoDecoder *o)
     
     if (o->tw_out_len < 0) {
         // cannot decode, finish input packet
+        o->stats.packets_failed++;
         PacketPassInterface_Done(&o->input);
         o->in_len = -1;
     } else {
         // submit decoded packet to output
+        o->stats.packets_decoded++;
         PacketPassInterface_Sender_Send(o->output, o->tw_out, o->tw_out_len);
     }
 }
@@ -190,6 +223,18 @@ static void input_handler_send (SPProtoDecoder *o, uint8_t *data, int data_len)
     ASSERT(!o->tw_have)
     DebugObject_Access(&o->d_obj);
     
+    if (o->num_slots > 1) {
+        if (o->slots_used < o->num_slots) {
+            // copy packet into a slot and start decoding
+            pipeline_accept_input(o, data, data_len);
+        } else {
+            // wait for a free slot
+            o->in = data;
+            o->in_len = data_len;
+        }
+        return;
+    }
+    
     // remember input
     o->in = data;
     o->in_len = data_len;
@@ -201,9 +246,22 @@ static void input_handler_send (SPProtoDecoder *o, uint8_t *data, int data_len)
 
 static void output_handler_done (SPProtoDecoder *o)
 {
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(o->slots_sending)
+        
+        // release slot of sent packet
+        o->slots_sending = 0;
+        pipeline_release_first(o);
+        
+        // submit the next packet if it is decoded
+        pipeline_maybe_output(o);
+        return;
+    }
+    
     ASSERT(o->in_len >= 0)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // finish input packet
     PacketPassInterface_Done(&o->input);
@@ -212,6 +270,23 @@ static void output_handler_done (SPProtoDecoder *o)
 
 static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
 {
+    if (o->num_slots > 1) {
+        // stop works and ignore packets, except one being sent to the output
+        for (int i = o->slots_sending; i < o->slots_used; i++) {
+            struct SPProtoDecoder_slot *slot = &o->slots[(o->slots_start + i) % o->num_slots];
+            ASSERT(slot->state == SPPROTODECODER_SLOT_STATE_WORKING || slot->state == SPPROTODECODER_SLOT_STATE_DONE)
+            if (slot->state == SPPROTODECODER_SLOT_STATE_WORKING) {
+                BThreadWork_Free(&slot->tw);
+            }
+            slot->state = SPPROTODECODER_SLOT_STATE_FREE;
+        }
+        o->slots_used = o->slots_sending;
+        
+        // accept a waiting input packet
+        pipeline_maybe_accept_input(o);
+        return;
+    }
+    
     ASSERT(!(o->tw_have) || o->in_len >= 0)
     
     if (o->tw_have) {
@@ -225,11 +300,237 @@ static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
     }
 }
 
+static void free_buffers (SPProtoDecoder *o)
+{
+    if (o->num_slots == 1) {
+        // free plaintext buffer
+        if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+            free(o->buf);
+        }
+    } else {
+        // free slots
+        for (int i = 0; i < o->num_slots; i++) {
+            free(o->slots[i].buf);
+            free(o->slots[i].in);
+        }
+        BFree(o->slots);
+    }
+}
+
+static int init_aeads (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_AEAD(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        return BAead_Init(&o->aead, BAEAD_MODE_DECRYPT, o->sp_params.aead_mode);
+    }
+    
+    // each slot gets its own context so that works can run concurrently
+    for (int i = 0; i < o->num_slots; i++) {
+        if (!BAead_Init(&o->slots[i].aead, BAEAD_MODE_DECRYPT, o->sp_params.aead_mode)) {
+            while (i-- > 0) {
+                BAead_Free(&o->slots[i].aead);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_aeads (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_AEAD(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BAead_Free(&o->aead);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BAead_Free(&o->slots[i].aead);
+    }
+}
+
+static int init_hashes (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_HASH(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        return BHash_Init(&o->hash, o->sp_params.hash_mode);
+    }
+    
+    // likewise for hash contexts, so that concurrent works share nothing
+    for (int i = 0; i < o->num_slots; i++) {
+        if (!BHash_Init(&o->slots[i].hash, o->sp_params.hash_mode)) {
+            while (i-- > 0) {
+                BHash_Free(&o->slots[i].hash);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_hashes (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_HASH(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BHash_Free(&o->hash);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BHash_Free(&o->slots[i].hash);
+    }
+}
+
+static void init_encryptors (SPProtoDecoder *o, uint8_t *encryption_key)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
+        return;
+    }
+    
+    // cipher contexts hold state too, so each slot gets its own
+    for (int i = 0; i < o->num_slots; i++) {
+        BEncryption_Init(&o->slots[i].encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
+    }
+}
+
+static void free_encryptors (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BEncryption_Free(&o->encryptor);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BEncryption_Free(&o->slots[i].encryptor);
+    }
+}
+
+static void slot_work_func (struct SPProtoDecoder_slot *slot)
+{
+    SPProtoDecoder *o = slot->o;
+    ASSERT(slot->state == SPPROTODECODER_SLOT_STATE_WORKING)
+    
+    slot->out_len = decode_buffer(o, &slot->encryptor, &slot->aead, &slot->hash, slot->in, slot->in_len, slot->buf, &slot->out, &slot->out_seed_id, &slot->out_otp);
+}
+
+static void slot_work_handler (struct SPProtoDecoder_slot *slot)
+{
+    SPProtoDecoder *o = slot->o;
+    ASSERT(slot->state == SPPROTODECODER_SLOT_STATE_WORKING)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&slot->tw);
+    slot->state = SPPROTODECODER_SLOT_STATE_DONE;
+    
+    // submit the oldest packet if it is decoded
+    pipeline_maybe_output(o);
+}
+
+static void pipeline_accept_input (SPProtoDecoder *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(o->slots_used < o->num_slots)
+    
+    struct SPProtoDecoder_slot *slot = &o->slots[(o->slots_start + o->slots_used) % o->num_slots];
+    ASSERT(slot->state == SPPROTODECODER_SLOT_STATE_FREE)
+    
+    // copy packet
+    memcpy(slot->in, data, data_len);
+    slot->in_len = data_len;
+    
+    // start decoding
+    slot->state = SPPROTODECODER_SLOT_STATE_WORKING;
+    BThreadWork_Init(&slot->tw, o->twd, (BThreadWork_handler_done)slot_work_handler, slot, (BThreadWork_work_func)slot_work_func, slot);
+    o->slots_used++;
+    
+    // accept input packet
+    PacketPassInterface_Done(&o->input);
+}
+
+static void pipeline_maybe_accept_input (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    if (o->in_len >= 0 && o->slots_used < o->num_slots) {
+        int in_len = o->in_len;
+        o->in_len = -1;
+        pipeline_accept_input(o, o->in, in_len);
+    }
+}
+
+static void pipeline_release_first (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(o->slots_used > 0)
+    ASSERT(!o->slots_sending)
+    
+    struct SPProtoDecoder_slot *slot = &o->slots[o->slots_start];
+    ASSERT(slot->state == SPPROTODECODER_SLOT_STATE_DONE)
+    
+    // release slot
+    slot->state = SPPROTODECODER_SLOT_STATE_FREE;
+    o->slots_start = (o->slots_start + 1) % o->num_slots;
+    o->slots_used--;
+    
+    // accept a waiting input packet
+    pipeline_maybe_accept_input(o);
+}
+
+static void pipeline_maybe_output (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    while (!o->slots_sending && o->slots_used > 0) {
+        struct SPProtoDecoder_slot *slot = &o->slots[o->slots_start];
+        if (slot->state != SPPROTODECODER_SLOT_STATE_DONE) {
+            return;
+        }
+        
+        // check OTP, in the order packets were received
+        if (SPPROTO_HAVE_OTP(o->sp_params) && slot->out_len >= 0) {
+            if (!OTPChecker_CheckOTP(&o->otpchecker, slot->out_seed_id, slot->out_otp)) {
+                PeerLog(o, BLOG_WARNING, "packet has wrong OTP");
+                slot->out_len = -1;
+            }
+        }
+        
+        if (slot->out_len < 0) {
+            // cannot decode, drop packet
+            o->stats.packets_failed++;
+            pipeline_release_first(o);
+            continue;
+        }
+        
+        // submit decoded packet to output
+        o->stats.packets_decoded++;
+        o->slots_sending = 1;
+        PacketPassInterface_Sender_Send(o->output, slot->out, slot->out_len);
+    }
+}
+
 int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc)
+{
+    return SPProtoDecoder_Init2(o, output, sp_params, num_otp_seeds, pg, twd, user, logfunc, 1);
+}
+
+int SPProtoDecoder_Init2 (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc, int num_slots)
 {
     spproto_assert_security_params(sp_params);
     ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketPassInterface_GetMTU(output)) >= 0)
     ASSERT(!SPPROTO_HAVE_OTP(sp_params) || num_otp_seeds >= 2)
+    ASSERT(num_slots >= 1)
     
     // init arguments
     o->output = output;
@@ -237,6 +538,7 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     o->twd = twd;
     o->user = user;
     o->logfunc = logfunc;
+    o->num_slots = num_slots;
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
@@ -258,12 +560,48 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     // calculate input MTU
     o->input_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->output_mtu);
     
-    // allocate plaintext buffer
+    // calculate plaintext buffer size
+    int buf_size = 0;
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
-        if (!(o->buf = (uint8_t *)malloc(buf_size))) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
+    }
+    
+    if (o->num_slots == 1) {
+        // allocate plaintext buffer
+        if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+            if (!(o->buf = (uint8_t *)malloc(buf_size))) {
+                goto fail0;
+            }
+        }
+    } else {
+        // allocate slots
+        if (!(o->slots = (struct SPProtoDecoder_slot *)BAllocArray(o->num_slots, sizeof(o->slots[0])))) {
             goto fail0;
         }
+        
+        // allocate slot buffers
+        for (int i = 0; i < o->num_slots; i++) {
+            struct SPProtoDecoder_slot *slot = &o->slots[i];
+            slot->o = o;
+            slot->state = SPPROTODECODER_SLOT_STATE_FREE;
+            slot->in = (uint8_t *)malloc(o->input_mtu);
+            slot->buf = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? (uint8_t *)malloc(buf_size) : NULL);
+            if (!slot->in || (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !slot->buf)) {
+                free(slot->buf);
+                free(slot->in);
+                while (i-- > 0) {
+                    free(o->slots[i].buf);
+                    free(o->slots[i].in);
+                }
+                BFree(o->slots);
+                goto fail0;
+            }
+        }
+        
+        // have no packets in slots
+        o->slots_start = 0;
+        o->slots_used = 0;
+        o->slots_sending = 0;
     }
     
     // init input
@@ -276,8 +614,22 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
         }
     }
     
+    // init AEAD contexts
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        if (!init_aeads(o)) {
+            goto fail2;
+        }
+    }
+    
+    // init hash contexts
+    if (SPPROTO_HAVE_HASH(o->sp_params)) {
+        if (!init_hashes(o)) {
+            goto fail3;
+        }
+    }
+    
     // have no encryption key
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
+    if (SPPROTO_HAVE_KEY(o->sp_params)) {
         o->have_encryption_key = 0;
     }
     
@@ -287,15 +639,25 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     // have no work
     o->tw_have = 0;
     
+    // zero counters
+    o->stats.packets_decoded = 0;
+    o->stats.packets_failed = 0;
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail3:
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        free_aeads(o);
+    }
+fail2:
+    if (SPPROTO_HAVE_OTP(o->sp_params)) {
+        OTPChecker_Free(&o->otpchecker);
+    }
 fail1:
     PacketPassInterface_Free(&o->input);
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
-    }
+    free_buffers(o);
 fail0:
     return 0;
 }
@@ -309,9 +671,28 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
         BThreadWork_Free(&o->tw);
     }
     
-    // free encryptor
+    // free slot works
+    if (o->num_slots > 1) {
+        for (int i = 0; i < o->num_slots; i++) {
+            if (o->slots[i].state == SPPROTODECODER_SLOT_STATE_WORKING) {
+                BThreadWork_Free(&o->slots[i].tw);
+            }
+        }
+    }
+    
+    // free hash contexts
+    if (SPPROTO_HAVE_HASH(o->sp_params)) {
+        free_hashes(o);
+    }
+    
+    // free AEAD contexts
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        free_aeads(o);
+    }
+    
+    // free encryptors
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+        free_encryptors(o);
     }
     
     // free OTP checker
@@ -322,10 +703,8 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
     // free input
     PacketPassInterface_Free(&o->input);
     
-    // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
-    }
+    // free buffers
+    free_buffers(o);
 }
 
 PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o)
@@ -337,35 +716,48 @@ PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o)
 
 void SPProtoDecoder_SetEncryptionKey (SPProtoDecoder *o, uint8_t *encryption_key)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // stop existing work
     maybe_stop_work_and_ignore(o);
     
-    // free encryptor
-    if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // set key in AEAD contexts
+        if (o->num_slots == 1) {
+            BAead_SetKey(&o->aead, encryption_key);
+        } else {
+            for (int i = 0; i < o->num_slots; i++) {
+                BAead_SetKey(&o->slots[i].aead, encryption_key);
+            }
+        }
+    } else {
+        // free encryptors
+        if (o->have_encryption_key) {
+            free_encryptors(o);
+        }
+        
+        // init encryptors
+        init_encryptors(o, encryption_key);
     }
     
-    // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
-    
     // have encryption key
     o->have_encryption_key = 1;
 }
 
 void SPProtoDecoder_RemoveEncryptionKey (SPProtoDecoder *o)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // stop existing work
     maybe_stop_work_and_ignore(o);
     
     if (o->have_encryption_key) {
-        // free encryptor
-        BEncryption_Free(&o->encryptor);
+        // free encryptors
+        if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+            free_encryptors(o);
+        }
         
         // have no encryption key
         o->have_encryption_key = 0;
@@ -396,3 +788,10 @@ void SPProtoDecoder_SetHandlers (SPProtoDecoder *o, SPProtoDecoder_otp_handler o
         OTPChecker_SetHandlers(&o->otpchecker, otp_handler, user);
     }
 }
+
+void SPProtoDecoder_GetStats (SPProtoDecoder *o, struct SPProtoDecoder_stats *stats)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *stats = o->stats;
+}
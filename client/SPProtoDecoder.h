@@ -41,6 +41,8 @@
 #include <base/BLog.h>
 #include <protocol/spproto.h>
 #include <security/BEncryption.h>
+#include <security/BAead.h>
+#include <security/BHash.h>
 #include <security/OTPChecker.h>
 #include <flow/PacketPassInterface.h>
 
@@ -51,12 +53,40 @@
  */
 typedef void (*SPProtoDecoder_otp_handler) (void *user);
 
+#define SPPROTODECODER_SLOT_STATE_FREE 1
+#define SPPROTODECODER_SLOT_STATE_WORKING 2
+#define SPPROTODECODER_SLOT_STATE_DONE 3
+
+struct SPProtoDecoder_slot {
+    struct SPProtoDecoder_s *o;
+    int state;
+    uint8_t *in;
+    uint8_t *buf;
+    int in_len;
+    BThreadWork tw;
+    uint16_t out_seed_id;
+    otp_t out_otp;
+    BEncryption encryptor;
+    BAead aead;
+    BHash hash;
+    uint8_t *out;
+    int out_len;
+};
+
+/**
+ * Packet counters of a {@link SPProtoDecoder}.
+ */
+struct SPProtoDecoder_stats {
+    uint64_t packets_decoded; // packets decoded and passed to output
+    uint64_t packets_failed; // packets dropped because they failed to decode or had a wrong OTP
+};
+
 /**
  * Object which decodes packets according to SPProto.
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketPassInterface}.
  */
-typedef struct {
+typedef struct SPProtoDecoder_s {
     PacketPassInterface *output;
     struct spproto_security_params sp_params;
     BThreadWorkDispatcher *twd;
@@ -72,6 +102,8 @@ typedef struct {
     OTPChecker otpchecker;
     int have_encryption_key;
     BEncryption encryptor;
+    BAead aead;
+    BHash hash;
     uint8_t *in;
     int in_len;
     int tw_have;
@@ -80,6 +112,12 @@ typedef struct {
     otp_t tw_out_otp;
     uint8_t *tw_out;
     int tw_out_len;
+    int num_slots;
+    struct SPProtoDecoder_slot *slots;
+    int slots_start;
+    int slots_used;
+    int slots_sending;
+    struct SPProtoDecoder_stats stats;
     DebugObject d_obj;
 } SPProtoDecoder;
 
@@ -103,6 +141,28 @@ typedef struct {
  */
 int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc) WARN_UNUSED;
 
+/**
+ * Initializes the object, possibly decoding multiple packets in parallel.
+ * With num_slots=1 this is equivalent to {@link SPProtoDecoder_Init}, and packets are
+ * decoded directly from the input buffer.
+ * With num_slots>1, input packets are copied into one of num_slots slots and accepted
+ * immediately, and up to num_slots packets are decoded concurrently in the thread pool.
+ * Decoded packets are checked against OTPs and passed to the output in the order
+ * they were received.
+ *
+ * @param o the object
+ * @param output output interface, as in {@link SPProtoDecoder_Init}
+ * @param sp_params SPProto parameters
+ * @param num_otp_seeds as in {@link SPProtoDecoder_Init}
+ * @param pg pending group
+ * @param twd thread work dispatcher
+ * @param user argument to handlers
+ * @param logfunc function which prepends the log prefix using {@link BLog_Append}
+ * @param num_slots maximum number of packets being decoded at once. Must be >=1.
+ * @return 1 on success, 0 on failure
+ */
+int SPProtoDecoder_Init2 (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc, int num_slots) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
@@ -122,16 +182,16 @@ PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o);
 
 /**
  * Sets an encryption key for decrypting packets.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
- * @param encryption_key key to use
+ * @param encryption_key key to use, {@link spproto_key_size}(sp_params) bytes
  */
 void SPProtoDecoder_SetEncryptionKey (SPProtoDecoder *o, uint8_t *encryption_key);
 
 /**
  * Removes an encryption key if one is configured.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
  */
@@ -168,4 +228,12 @@ void SPProtoDecoder_RemoveOTPSeeds (SPProtoDecoder *o);
  */
 void SPProtoDecoder_SetHandlers (SPProtoDecoder *o, SPProtoDecoder_otp_handler otp_handler, void *user);
 
+/**
+ * Returns the packet counters.
+ *
+ * @param o the object
+ * @param stats where to store the counters
+ */
+void SPProtoDecoder_GetStats (SPProtoDecoder *o, struct SPProtoDecoder_stats *stats);
+
 #endif
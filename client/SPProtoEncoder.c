@@ -31,15 +31,23 @@
 #include <stdlib.h>
 
 #include <misc/balign.h>
+#include <misc/balloc.h>
 #include <misc/offset.h>
 #include <misc/byteorder.h>
+#include <misc/usdt.h>
 #include <security/BRandom.h>
 #include <security/BHash.h>
 
 #include "SPProtoEncoder.h"
 
+static int have_otp_and_key (SPProtoEncoder *o);
 static int can_encode (SPProtoEncoder *o);
 static void encode_packet (SPProtoEncoder *o);
+static uint8_t * plaintext_location (SPProtoEncoder *o, uint8_t *buf, uint8_t *out);
+static void next_nonce (SPProtoEncoder *o, uint8_t *nonce);
+static int encode_header (SPProtoEncoder *o, BHash *hash, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp);
+static int encode_padding_and_iv (SPProtoEncoder *o, uint8_t *plaintext, int plaintext_len, uint8_t *out, uint8_t *iv);
+static int encode_buffer (SPProtoEncoder *o, BEncryption *encryptor, BAead *aead, BHash *hash, uint8_t *plaintext, int in_len, uint8_t *out, uint16_t seed_id, otp_t otp, uint8_t *nonce);
 static void encode_work_func (SPProtoEncoder *o);
 static void encode_work_handler (SPProtoEncoder *o);
 static void maybe_encode (SPProtoEncoder *o);
@@ -48,17 +56,39 @@ static void input_handler_done (SPProtoEncoder *o, int data_len);
 static void handler_job_hander (SPProtoEncoder *o);
 static void otpgenerator_handler (SPProtoEncoder *o);
 static void maybe_stop_work (SPProtoEncoder *o);
+static struct SPProtoEncoder_slot * get_slot (SPProtoEncoder *o, int i);
+static struct SPProtoEncoder_slot * batch_slot (SPProtoEncoder *o, struct SPProtoEncoder_slot *slot, int i);
+static uint8_t * slot_plaintext (SPProtoEncoder *o, struct SPProtoEncoder_slot *slot);
+static void slot_work_func (struct SPProtoEncoder_slot *slot);
+static void slot_work_handler (struct SPProtoEncoder_slot *slot);
+static void pipeline_maybe_receive (SPProtoEncoder *o);
+static void pipeline_maybe_encode (SPProtoEncoder *o);
+static void pipeline_maybe_output (SPProtoEncoder *o);
+static void encode_job_handler (SPProtoEncoder *o);
+static void free_buffers (SPProtoEncoder *o);
+static int init_aeads (SPProtoEncoder *o);
+static void free_aeads (SPProtoEncoder *o);
+static int init_hashes (SPProtoEncoder *o);
+static void free_hashes (SPProtoEncoder *o);
+static void init_encryptors (SPProtoEncoder *o, uint8_t *encryption_key);
+static void free_encryptors (SPProtoEncoder *o);
+
+static int have_otp_and_key (SPProtoEncoder *o)
+{
+    return (
+        (!SPPROTO_HAVE_OTP(o->sp_params) || OTPGenerator_GetPosition(&o->otpgen) < o->sp_params.otp_num) &&
+        (!SPPROTO_HAVE_KEY(o->sp_params) || o->have_encryption_key)
+    );
+}
 
 static int can_encode (SPProtoEncoder *o)
 {
+    ASSERT(o->num_slots == 1)
     ASSERT(o->in_len >= 0)
     ASSERT(o->out_have)
     ASSERT(!o->tw_have)
     
-    return (
-        (!SPPROTO_HAVE_OTP(o->sp_params) || OTPGenerator_GetPosition(&o->otpgen) < o->sp_params.otp_num) &&
-        (!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
-    );
+    return have_otp_and_key(o);
 }
 
 static void encode_packet (SPProtoEncoder *o)
@@ -74,6 +104,13 @@ static void encode_packet (SPProtoEncoder *o)
         o->tw_otp = OTPGenerator_GetOTP(&o->otpgen);
     }
     
+    // generate nonce
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        next_nonce(o, o->tw_nonce);
+    }
+    
+    BTRACE2(spproto_encode_start, o, 1);
+    
     // start work
     BThreadWork_Init(&o->tw, o->twd, (BThreadWork_handler_done)encode_work_handler, o, (BThreadWork_work_func)encode_work_func, o);
     o->tw_have = 1;
@@ -84,28 +121,45 @@ static void encode_packet (SPProtoEncoder *o)
     }
 }
 
-static void encode_work_func (SPProtoEncoder *o)
+static uint8_t * plaintext_location (SPProtoEncoder *o, uint8_t *buf, uint8_t *out)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->out_have)
-    ASSERT(!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
+    // when encrypting, the plaintext is kept separately so that the
+    // packet can be encoded again after a key change
+    return (SPPROTO_HAVE_KEY(o->sp_params) ? buf : out);
+}
+
+static void next_nonce (SPProtoEncoder *o, uint8_t *nonce)
+{
+    ASSERT(SPPROTO_HAVE_AEAD(o->sp_params))
+    ASSERT(o->have_encryption_key)
     
-    ASSERT(o->in_len <= o->input_mtu)
+    // random part, then counter
+    uint32_t counter = hton32(o->aead_nonce_counter);
+    memcpy(nonce, o->aead_nonce_random, SPPROTO_AEAD_NONCE_RANDOM_LEN);
+    memcpy(nonce + SPPROTO_AEAD_NONCE_RANDOM_LEN, &counter, SPPROTO_AEAD_NONCE_COUNTER_LEN);
     
-    // determine plaintext location
-    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    // advance counter, choose a new random part when it wraps around
+    if (++o->aead_nonce_counter == 0) {
+        BRandom_randomize(o->aead_nonce_random, sizeof(o->aead_nonce_random));
+    }
+}
+
+static int encode_header (SPProtoEncoder *o, BHash *hash, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp)
+{
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
     
     // plaintext begins with header
     uint8_t *header = plaintext;
     
     // plaintext is header + payload
-    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + o->in_len;
+    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + in_len;
     
     // write OTP
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
         struct spproto_otpdata header_otpd;
-        header_otpd.seed_id = htol16(o->tw_seed_id);
-        header_otpd.otp = o->tw_otp;
+        header_otpd.seed_id = htol16(seed_id);
+        header_otpd.otp = otp;
         memcpy(header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), &header_otpd, sizeof(header_otpd));
     }
     
@@ -115,40 +169,84 @@ static void encode_work_func (SPProtoEncoder *o)
         // zero hash field
         memset(header_hash, 0, o->hash_size);
         // calculate hash
-        uint8_t hash[BHASH_MAX_SIZE];
-        BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash);
+        uint8_t hash_calc[BHASH_MAX_SIZE];
+        BHash_Start(hash);
+        BHash_Update(hash, plaintext, plaintext_len);
+        BHash_Finish(hash, hash_calc);
         // set hash field
-        memcpy(header_hash, hash, o->hash_size);
+        memcpy(header_hash, hash_calc, o->hash_size);
+    }
+    
+    return plaintext_len;
+}
+
+static int encode_padding_and_iv (SPProtoEncoder *o, uint8_t *plaintext, int plaintext_len, uint8_t *out, uint8_t *iv)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    // encrypting pad(header + payload)
+    int cyphertext_len = balign_up((plaintext_len + 1), o->enc_block_size);
+    
+    // write padding
+    plaintext[plaintext_len] = 1;
+    for (int i = plaintext_len + 1; i < cyphertext_len; i++) {
+        plaintext[i] = 0;
     }
     
+    // generate IV
+    BRandom_randomize(out, o->enc_block_size);
+    
+    // copy IV because BEncryption_Encrypt changes the IV
+    memcpy(iv, out, o->enc_block_size);
+    
+    return cyphertext_len;
+}
+
+static int encode_buffer (SPProtoEncoder *o, BEncryption *encryptor, BAead *aead, BHash *hash, uint8_t *plaintext, int in_len, uint8_t *out, uint16_t seed_id, otp_t otp, uint8_t *nonce)
+{
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
+    ASSERT(!SPPROTO_HAVE_KEY(o->sp_params) || o->have_encryption_key)
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params) || plaintext == out)
+    
+    // write header
+    int plaintext_len = encode_header(o, hash, plaintext, in_len, seed_id, otp);
+    
     int out_len;
     
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        // encrypting pad(header + payload)
-        int cyphertext_len = balign_up((plaintext_len + 1), o->enc_block_size);
-        
-        // write padding
-        plaintext[plaintext_len] = 1;
-        for (int i = plaintext_len + 1; i < cyphertext_len; i++) {
-            plaintext[i] = 0;
-        }
-        
-        // generate IV
-        BRandom_randomize(o->out, o->enc_block_size);
-        
-        // copy IV because BEncryption_Encrypt changes the IV
+        // pad and generate IV
         uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
-        memcpy(iv, o->out, o->enc_block_size);
+        int cyphertext_len = encode_padding_and_iv(o, plaintext, plaintext_len, out, iv);
         
         // encrypt
-        BEncryption_Encrypt(&o->encryptor, plaintext, o->out + o->enc_block_size, cyphertext_len, iv);
+        BEncryption_Encrypt(encryptor, plaintext, out + o->enc_block_size, cyphertext_len, iv);
         out_len = o->enc_block_size + cyphertext_len;
+    } else if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // write nonce
+        memcpy(out, nonce, BAEAD_NONCE_SIZE);
+        
+        // encrypt, append tag
+        uint8_t *ciphertext = out + BAEAD_NONCE_SIZE;
+        BAead_Encrypt(aead, nonce, plaintext, ciphertext, plaintext_len, ciphertext + plaintext_len);
+        out_len = BAEAD_NONCE_SIZE + plaintext_len + BAEAD_TAG_SIZE;
     } else {
         out_len = plaintext_len;
     }
     
-    // remember length
-    o->tw_out_len = out_len;
+    return out_len;
+}
+
+static void encode_work_func (SPProtoEncoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->out_have)
+    
+    // determine plaintext location
+    uint8_t *plaintext = plaintext_location(o, o->buf, o->out);
+    
+    // encode, remember length
+    o->tw_out_len = encode_buffer(o, &o->encryptor, &o->aead, &o->hash, plaintext, o->in_len, o->out, o->tw_seed_id, o->tw_otp, o->tw_nonce);
 }
 
 static void encode_work_handler (SPProtoEncoder *o)
@@ -161,6 +259,8 @@ static void encode_work_handler (SPProtoEncoder *o)
     BThreadWork_Free(&o->tw);
     o->tw_have = 0;
     
+    BTRACE2(spproto_encode_done, o, 1);
+    
     // finish packet
     o->in_len = -1;
     o->out_have = 0;
@@ -176,17 +276,30 @@ static void maybe_encode (SPProtoEncoder *o)
 
 static void output_handler_recv (SPProtoEncoder *o, uint8_t *data)
 {
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(!o->out_have)
+        
+        // remember output packet
+        o->out_have = 1;
+        o->out = data;
+        
+        // submit the oldest packet if it is encoded
+        pipeline_maybe_output(o);
+        return;
+    }
+    
     ASSERT(o->in_len == -1)
     ASSERT(!o->out_have)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // remember output packet
     o->out_have = 1;
     o->out = data;
     
     // determine plaintext location
-    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    uint8_t *plaintext = plaintext_location(o, o->buf, o->out);
     
     // schedule receive
     PacketRecvInterface_Receiver_Recv(o->input, plaintext + SPPROTO_HEADER_LEN(o->sp_params));
@@ -196,10 +309,32 @@ static void input_handler_done (SPProtoEncoder *o, int data_len)
 {
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->input_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(o->slots_receiving)
+        ASSERT(o->slots_used < o->num_slots)
+        
+        // remember input packet in its slot
+        struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_used);
+        ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_FREE)
+        slot->state = SPPROTOENCODER_SLOT_STATE_PENDING;
+        slot->in_len = data_len;
+        o->slots_used++;
+        o->slots_receiving = 0;
+        
+        // encode later, so that packets already queued at the input
+        // are received first and end up in the same batch
+        BPending_Set(&o->encode_job);
+        
+        // receive the next packet if there is a free slot
+        pipeline_maybe_receive(o);
+        return;
+    }
+    
     ASSERT(o->in_len == -1)
     ASSERT(o->out_have)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // remember input packet
     o->in_len = data_len;
@@ -230,11 +365,29 @@ static void otpgenerator_handler (SPProtoEncoder *o)
     o->otpgen_seed_id = o->otpgen_pending_seed_id;
     
     // possibly continue I/O
-    maybe_encode(o);
+    if (o->num_slots > 1) {
+        pipeline_maybe_encode(o);
+    } else {
+        maybe_encode(o);
+    }
 }
 
 static void maybe_stop_work (SPProtoEncoder *o)
 {
+    if (o->num_slots > 1) {
+        // stop existing works; packets will be encoded again, in order
+        for (int i = 0; i < o->slots_started; i++) {
+            struct SPProtoEncoder_slot *slot = get_slot(o, i);
+            ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_WORKING || slot->state == SPPROTOENCODER_SLOT_STATE_DONE)
+            if (slot->state == SPPROTOENCODER_SLOT_STATE_WORKING && slot->batch_len > 0) {
+                BThreadWork_Free(&slot->tw);
+            }
+            slot->state = SPPROTOENCODER_SLOT_STATE_PENDING;
+        }
+        o->slots_started = 0;
+        return;
+    }
+    
     // stop existing work
     if (o->tw_have) {
         BThreadWork_Free(&o->tw);
@@ -242,7 +395,307 @@ static void maybe_stop_work (SPProtoEncoder *o)
     }
 }
 
+static struct SPProtoEncoder_slot * get_slot (SPProtoEncoder *o, int i)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_slots)
+    
+    return &o->slots[(o->slots_start + i) % o->num_slots];
+}
+
+static struct SPProtoEncoder_slot * batch_slot (SPProtoEncoder *o, struct SPProtoEncoder_slot *slot, int i)
+{
+    ASSERT(slot->batch_len > 0)
+    ASSERT(i >= 0)
+    ASSERT(i < slot->batch_len)
+    
+    return &o->slots[((slot - o->slots) + i) % o->num_slots];
+}
+
+static uint8_t * slot_plaintext (SPProtoEncoder *o, struct SPProtoEncoder_slot *slot)
+{
+    return plaintext_location(o, slot->buf, slot->out);
+}
+
+static void slot_work_func (struct SPProtoEncoder_slot *slot)
+{
+    SPProtoEncoder *o = slot->o;
+    ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_WORKING)
+    ASSERT(slot->batch_len > 0)
+    
+    if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        for (int i = 0; i < slot->batch_len; i++) {
+            struct SPProtoEncoder_slot *s = batch_slot(o, slot, i);
+            s->out_len = encode_buffer(o, &s->encryptor, &s->aead, &s->hash, slot_plaintext(o, s), s->in_len, s->out, s->seed_id, s->otp, s->nonce);
+        }
+        return;
+    }
+    
+    // prepare all packets of the batch, then encrypt them together
+    uint8_t ivs[SPPROTOENCODER_MAX_BATCH][BENCRYPTION_MAX_BLOCK_SIZE];
+    struct BEncryption_batch_item items[SPPROTOENCODER_MAX_BATCH];
+    
+    for (int i = 0; i < slot->batch_len; i++) {
+        struct SPProtoEncoder_slot *s = batch_slot(o, slot, i);
+        uint8_t *plaintext = slot_plaintext(o, s);
+        
+        int plaintext_len = encode_header(o, &s->hash, plaintext, s->in_len, s->seed_id, s->otp);
+        int cyphertext_len = encode_padding_and_iv(o, plaintext, plaintext_len, s->out, ivs[i]);
+        
+        items[i].in = plaintext;
+        items[i].out = s->out + o->enc_block_size;
+        items[i].len = cyphertext_len;
+        items[i].iv = ivs[i];
+        s->out_len = o->enc_block_size + cyphertext_len;
+    }
+    
+    BEncryption_EncryptBatch(&slot->encryptor, items, slot->batch_len);
+}
+
+static void slot_work_handler (struct SPProtoEncoder_slot *slot)
+{
+    SPProtoEncoder *o = slot->o;
+    ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_WORKING)
+    ASSERT(slot->batch_len > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&slot->tw);
+    
+    BTRACE2(spproto_encode_done, o, slot->batch_len);
+    
+    // all packets of the batch are encoded
+    for (int i = 0; i < slot->batch_len; i++) {
+        batch_slot(o, slot, i)->state = SPPROTOENCODER_SLOT_STATE_DONE;
+    }
+    
+    // submit the oldest packet if it is encoded
+    pipeline_maybe_output(o);
+}
+
+static void pipeline_maybe_receive (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    if (o->slots_receiving || o->slots_used == o->num_slots) {
+        return;
+    }
+    
+    struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_used);
+    ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_FREE)
+    
+    // receive into the next free slot
+    o->slots_receiving = 1;
+    PacketRecvInterface_Receiver_Recv(o->input, slot_plaintext(o, slot) + SPPROTO_HEADER_LEN(o->sp_params));
+}
+
+static void pipeline_maybe_encode (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    // start works in order, so that OTPs are used in the order packets are sent;
+    // consecutive packets are grouped into batches encoded by a single work
+    while (o->slots_started < o->slots_used && have_otp_and_key(o)) {
+        struct SPProtoEncoder_slot *first = get_slot(o, o->slots_started);
+        int batch_len = 0;
+        
+        do {
+            struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_started);
+            ASSERT(slot->state == SPPROTOENCODER_SLOT_STATE_PENDING)
+            
+            // generate OTP, remember seed ID
+            if (SPPROTO_HAVE_OTP(o->sp_params)) {
+                slot->seed_id = o->otpgen_seed_id;
+                slot->otp = OTPGenerator_GetOTP(&o->otpgen);
+            }
+            
+            // generate nonce
+            if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+                next_nonce(o, slot->nonce);
+            }
+            
+            // add to batch
+            slot->state = SPPROTOENCODER_SLOT_STATE_WORKING;
+            slot->batch_len = 0;
+            batch_len++;
+            o->slots_started++;
+            
+            // schedule OTP warning handler
+            if (SPPROTO_HAVE_OTP(o->sp_params) && OTPGenerator_GetPosition(&o->otpgen) == o->otp_warning_count) {
+                BPending_Set(&o->handler_job);
+            }
+        } while (batch_len < SPPROTOENCODER_MAX_BATCH && o->slots_started < o->slots_used && have_otp_and_key(o));
+        
+        BTRACE2(spproto_encode_start, o, batch_len);
+        
+        // start work
+        first->batch_len = batch_len;
+        BThreadWork_Init(&first->tw, o->twd, (BThreadWork_handler_done)slot_work_handler, first, (BThreadWork_work_func)slot_work_func, first);
+    }
+}
+
+static void pipeline_maybe_output (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    if (!o->out_have || o->slots_started == 0) {
+        return;
+    }
+    
+    struct SPProtoEncoder_slot *slot = get_slot(o, 0);
+    if (slot->state != SPPROTOENCODER_SLOT_STATE_DONE) {
+        return;
+    }
+    
+    // copy encoded packet to output
+    int out_len = slot->out_len;
+    memcpy(o->out, slot->out, out_len);
+    
+    // release slot
+    slot->state = SPPROTOENCODER_SLOT_STATE_FREE;
+    o->slots_start = (o->slots_start + 1) % o->num_slots;
+    o->slots_used--;
+    o->slots_started--;
+    
+    // finish packet
+    o->out_have = 0;
+    PacketRecvInterface_Done(&o->output, out_len);
+    
+    // receive the next packet if we were out of slots
+    pipeline_maybe_receive(o);
+}
+
+static void encode_job_handler (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    DebugObject_Access(&o->d_obj);
+    
+    pipeline_maybe_encode(o);
+}
+
+static void free_buffers (SPProtoEncoder *o)
+{
+    if (o->num_slots == 1) {
+        // free plaintext buffer
+        if (SPPROTO_HAVE_KEY(o->sp_params)) {
+            free(o->buf);
+        }
+    } else {
+        // free slots
+        for (int i = 0; i < o->num_slots; i++) {
+            free(o->slots[i].buf);
+            free(o->slots[i].out);
+        }
+        BFree(o->slots);
+    }
+}
+
+static int init_aeads (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_AEAD(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        return BAead_Init(&o->aead, BAEAD_MODE_ENCRYPT, o->sp_params.aead_mode);
+    }
+    
+    // each slot gets its own context so that works can run concurrently
+    for (int i = 0; i < o->num_slots; i++) {
+        if (!BAead_Init(&o->slots[i].aead, BAEAD_MODE_ENCRYPT, o->sp_params.aead_mode)) {
+            while (i-- > 0) {
+                BAead_Free(&o->slots[i].aead);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_aeads (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_AEAD(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BAead_Free(&o->aead);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BAead_Free(&o->slots[i].aead);
+    }
+}
+
+static int init_hashes (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_HASH(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        return BHash_Init(&o->hash, o->sp_params.hash_mode);
+    }
+    
+    // likewise for hash contexts, so that concurrent works share nothing
+    for (int i = 0; i < o->num_slots; i++) {
+        if (!BHash_Init(&o->slots[i].hash, o->sp_params.hash_mode)) {
+            while (i-- > 0) {
+                BHash_Free(&o->slots[i].hash);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_hashes (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_HASH(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BHash_Free(&o->hash);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BHash_Free(&o->slots[i].hash);
+    }
+}
+
+static void init_encryptors (SPProtoEncoder *o, uint8_t *encryption_key)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
+        return;
+    }
+    
+    // cipher contexts hold state too, so each slot gets its own
+    for (int i = 0; i < o->num_slots; i++) {
+        BEncryption_Init(&o->slots[i].encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
+    }
+}
+
+static void free_encryptors (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    if (o->num_slots == 1) {
+        BEncryption_Free(&o->encryptor);
+        return;
+    }
+    
+    for (int i = 0; i < o->num_slots; i++) {
+        BEncryption_Free(&o->slots[i].encryptor);
+    }
+}
+
 int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+{
+    return SPProtoEncoder_Init2(o, input, sp_params, otp_warning_count, pg, twd, 1);
+}
+
+int SPProtoEncoder_Init2 (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd, int num_slots)
 {
     spproto_assert_security_params(sp_params);
     ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketRecvInterface_GetMTU(input)) >= 0)
@@ -250,12 +703,14 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
         ASSERT(otp_warning_count > 0)
         ASSERT(otp_warning_count <= sp_params.otp_num)
     }
+    ASSERT(num_slots >= 1)
     
     // init arguments
     o->input = input;
     o->sp_params = sp_params;
     o->otp_warning_count = otp_warning_count;
     o->twd = twd;
+    o->num_slots = num_slots;
     
     // set no handlers
     o->handler = NULL;
@@ -279,7 +734,7 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     }
     
     // have no encryption key
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
+    if (SPPROTO_HAVE_KEY(o->sp_params)) {
         o->have_encryption_key = 0;
     }
     
@@ -301,24 +756,94 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     // have no output available
     o->out_have = 0;
     
-    // allocate plaintext buffer
+    // calculate plaintext buffer size
+    int buf_size = 0;
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
-        if (!(o->buf = (uint8_t *)malloc(buf_size))) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
+    }
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        buf_size = SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu;
+    }
+    
+    if (o->num_slots == 1) {
+        // allocate plaintext buffer
+        if (SPPROTO_HAVE_KEY(o->sp_params)) {
+            if (!(o->buf = (uint8_t *)malloc(buf_size))) {
+                goto fail1;
+            }
+        }
+    } else {
+        // allocate slots
+        if (!(o->slots = (struct SPProtoEncoder_slot *)BAllocArray(o->num_slots, sizeof(o->slots[0])))) {
             goto fail1;
         }
+        
+        // allocate slot buffers
+        for (int i = 0; i < o->num_slots; i++) {
+            struct SPProtoEncoder_slot *slot = &o->slots[i];
+            slot->o = o;
+            slot->state = SPPROTOENCODER_SLOT_STATE_FREE;
+            slot->out = (uint8_t *)malloc(o->output_mtu);
+            slot->buf = (SPPROTO_HAVE_KEY(o->sp_params) ? (uint8_t *)malloc(buf_size) : NULL);
+            if (!slot->out || (SPPROTO_HAVE_KEY(o->sp_params) && !slot->buf)) {
+                free(slot->buf);
+                free(slot->out);
+                while (i-- > 0) {
+                    free(o->slots[i].buf);
+                    free(o->slots[i].out);
+                }
+                BFree(o->slots);
+                goto fail1;
+            }
+        }
+        
+        // have no packets in slots
+        o->slots_start = 0;
+        o->slots_used = 0;
+        o->slots_started = 0;
+        o->slots_receiving = 0;
+    }
+    
+    // init AEAD contexts
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        if (!init_aeads(o)) {
+            goto fail2;
+        }
+    }
+    
+    // init hash contexts
+    if (SPPROTO_HAVE_HASH(o->sp_params)) {
+        if (!init_hashes(o)) {
+            goto fail3;
+        }
     }
     
     // init handler job
     BPending_Init(&o->handler_job, pg, (BPending_handler)handler_job_hander, o);
     
+    // init encode job
+    if (o->num_slots > 1) {
+        BPending_Init(&o->encode_job, pg, (BPending_handler)encode_job_handler, o);
+    }
+    
     // have no work
     o->tw_have = 0;
     
     DebugObject_Init(&o->d_obj);
     
+    // start receiving packets in advance
+    if (o->num_slots > 1) {
+        pipeline_maybe_receive(o);
+    }
+    
     return 1;
     
+fail3:
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        free_aeads(o);
+    }
+fail2:
+    free_buffers(o);
 fail1:
     PacketRecvInterface_Free(&o->output);
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
@@ -337,20 +862,42 @@ void SPProtoEncoder_Free (SPProtoEncoder *o)
         BThreadWork_Free(&o->tw);
     }
     
+    // free encode job
+    if (o->num_slots > 1) {
+        BPending_Free(&o->encode_job);
+    }
+    
     // free handler job
     BPending_Free(&o->handler_job);
     
-    // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
+    // free slot works
+    if (o->num_slots > 1) {
+        for (int i = 0; i < o->num_slots; i++) {
+            if (o->slots[i].state == SPPROTOENCODER_SLOT_STATE_WORKING && o->slots[i].batch_len > 0) {
+                BThreadWork_Free(&o->slots[i].tw);
+            }
+        }
+    }
+    
+    // free hash contexts
+    if (SPPROTO_HAVE_HASH(o->sp_params)) {
+        free_hashes(o);
+    }
+    
+    // free AEAD contexts
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        free_aeads(o);
     }
     
+    // free buffers
+    free_buffers(o);
+    
     // free output
     PacketRecvInterface_Free(&o->output);
     
-    // free encryptor
+    // free encryptors
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+        free_encryptors(o);
     }
     
     // free otp generator
@@ -368,38 +915,59 @@ PacketRecvInterface * SPProtoEncoder_GetOutput (SPProtoEncoder *o)
 
 void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // stop existing work
     maybe_stop_work(o);
     
-    // free encryptor
-    if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // set key in AEAD contexts
+        if (o->num_slots == 1) {
+            BAead_SetKey(&o->aead, encryption_key);
+        } else {
+            for (int i = 0; i < o->num_slots; i++) {
+                BAead_SetKey(&o->slots[i].aead, encryption_key);
+            }
+        }
+        
+        // start a new nonce sequence
+        BRandom_randomize(o->aead_nonce_random, sizeof(o->aead_nonce_random));
+        o->aead_nonce_counter = 0;
+    } else {
+        // free encryptors
+        if (o->have_encryption_key) {
+            free_encryptors(o);
+        }
+        
+        // init encryptors
+        init_encryptors(o, encryption_key);
     }
     
-    // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
-    
     // have encryption key
     o->have_encryption_key = 1;
     
     // possibly continue I/O
-    maybe_encode(o);
+    if (o->num_slots > 1) {
+        pipeline_maybe_encode(o);
+    } else {
+        maybe_encode(o);
+    }
 }
 
 void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o)
 {
-    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(SPPROTO_HAVE_KEY(o->sp_params))
     DebugObject_Access(&o->d_obj);
     
     // stop existing work
     maybe_stop_work(o);
     
     if (o->have_encryption_key) {
-        // free encryptor
-        BEncryption_Free(&o->encryptor);
+        // free encryptors
+        if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+            free_encryptors(o);
+        }
         
         // have no encryption key
         o->have_encryption_key = 0;
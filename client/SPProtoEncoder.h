@@ -40,6 +40,8 @@
 #include <protocol/spproto.h>
 #include <base/DebugObject.h>
 #include <security/BEncryption.h>
+#include <security/BAead.h>
+#include <security/BHash.h>
 #include <security/OTPGenerator.h>
 #include <flow/PacketRecvInterface.h>
 #include <threadwork/BThreadWork.h>
@@ -52,13 +54,41 @@
  */
 typedef void (*SPProtoEncoder_handler) (void *user);
 
+#define SPPROTOENCODER_SLOT_STATE_FREE 1
+#define SPPROTOENCODER_SLOT_STATE_PENDING 2
+#define SPPROTOENCODER_SLOT_STATE_WORKING 3
+#define SPPROTOENCODER_SLOT_STATE_DONE 4
+
+/**
+ * Maximum number of packets encoded by a single thread work
+ * when encoding in parallel.
+ */
+#define SPPROTOENCODER_MAX_BATCH 8
+
+struct SPProtoEncoder_slot {
+    struct SPProtoEncoder_s *o;
+    int state;
+    uint8_t *buf;
+    uint8_t *out;
+    int in_len;
+    BThreadWork tw;
+    uint16_t seed_id;
+    otp_t otp;
+    uint8_t nonce[BAEAD_NONCE_SIZE];
+    BEncryption encryptor;
+    BAead aead;
+    BHash hash;
+    int out_len;
+    int batch_len;
+};
+
 /**
  * Object which encodes packets according to SPProto.
  *
  * Input is with {@link PacketRecvInterface}.
  * Output is with {@link PacketRecvInterface}.
  */
-typedef struct {
+typedef struct SPProtoEncoder_s {
     PacketRecvInterface *input;
     struct spproto_security_params sp_params;
     int otp_warning_count;
@@ -73,6 +103,10 @@ typedef struct {
     uint16_t otpgen_pending_seed_id;
     int have_encryption_key;
     BEncryption encryptor;
+    BAead aead;
+    BHash hash;
+    uint8_t aead_nonce_random[SPPROTO_AEAD_NONCE_RANDOM_LEN];
+    uint32_t aead_nonce_counter;
     int input_mtu;
     int output_mtu;
     int in_len;
@@ -85,7 +119,15 @@ typedef struct {
     BThreadWork tw;
     uint16_t tw_seed_id;
     otp_t tw_otp;
+    uint8_t tw_nonce[BAEAD_NONCE_SIZE];
     int tw_out_len;
+    int num_slots;
+    struct SPProtoEncoder_slot *slots;
+    int slots_start;
+    int slots_used;
+    int slots_started;
+    int slots_receiving;
+    BPending encode_job;
     DebugObject d_obj;
 } SPProtoEncoder;
 
@@ -107,6 +149,29 @@ typedef struct {
  */
 int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
 
+/**
+ * Initializes the object, possibly encoding multiple packets in parallel.
+ * With num_slots=1 this is equivalent to {@link SPProtoEncoder_Init}, and packets are
+ * received from the input directly into the output buffer.
+ * With num_slots>1, up to num_slots packets are received from the input in advance,
+ * without waiting for the output, and are encoded concurrently in the thread pool.
+ * Packets which are available at the input at the same time are encoded in batches
+ * of up to {@link SPPROTOENCODER_MAX_BATCH} by a single work, using
+ * {@link BEncryption_EncryptBatch} with CBC encryption.
+ * Each packet gets its own buffers, and encoded packets are copied to the output
+ * in the order they were received.
+ *
+ * @param o the object
+ * @param input input interface, as in {@link SPProtoEncoder_Init}
+ * @param sp_params SPProto security parameters
+ * @param otp_warning_count as in {@link SPProtoEncoder_Init}
+ * @param pg pending group
+ * @param twd thread work dispatcher
+ * @param num_slots maximum number of packets being encoded at once. Must be >=1.
+ * @return 1 on success, 0 on failure
+ */
+int SPProtoEncoder_Init2 (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd, int num_slots) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
@@ -126,16 +191,16 @@ PacketRecvInterface * SPProtoEncoder_GetOutput (SPProtoEncoder *o);
 
 /**
  * Sets an encryption key to use.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
- * @param encryption_key key to use
+ * @param encryption_key key to use, {@link spproto_key_size}(sp_params) bytes
  */
 void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key);
 
 /**
  * Removes an encryption key if one is configured.
- * Encryption must be enabled.
+ * Encryption or AEAD must be enabled.
  *
  * @param o the object
  */
@@ -27,6 +27,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <nss/ssl.h>
@@ -53,6 +54,10 @@
 #define LISTEN_STATE_GOTCLIENT 1
 #define LISTEN_STATE_FINISHED 2
 
+// size of buffer in which packets to the peer are coalesced into larger writes;
+// kept small, as the socket send buffer is limited for the sake of scheduling
+#define SEND_COALESCE_SIZE 4096
+
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
 static void decoder_handler_error (StreamPeerIO *pio);
@@ -338,12 +343,31 @@ int init_io (StreamPeerIO *pio, sslsocket *sock)
     StreamRecvConnector_ConnectInput(&pio->input_connector, recv_if);
     
     // init sending
-    PacketStreamSender_Init(&pio->output_pss, send_if, PACKETPROTO_ENCLEN(pio->payload_mtu), BReactor_PendingGroup(pio->reactor));
+    if (!PacketStreamSender_Init2(&pio->output_pss, send_if, PACKETPROTO_ENCLEN(pio->payload_mtu), SEND_COALESCE_SIZE, BReactor_PendingGroup(pio->reactor))) {
+        PeerLog(pio, BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail1;
+    }
     PacketPassConnector_ConnectOutput(&pio->output_connector, PacketStreamSender_GetInput(&pio->output_pss));
     
+    #ifdef BADVPN_FLOW_STATS
+    if (pio->stats_name[0]) {
+        StreamPassInterface_SetStatsName(send_if, pio->stats_name, "PacketStreamSender", "socket");
+    }
+    #endif
+    
     pio->sock = sock;
     
     return 1;
+    
+fail1:
+    StreamRecvConnector_DisconnectInput(&pio->input_connector);
+    if (pio->ssl) {
+        BSSLConnection_Free(&pio->sslcon);
+    } else {
+        BConnection_RecvAsync_Free(&sock->con);
+        BConnection_SendAsync_Free(&sock->con);
+    }
+    return 0;
 }
 
 void free_io (StreamPeerIO *pio)
@@ -615,6 +639,9 @@ int StreamPeerIO_Init (
     // set no socket
     pio->sock = NULL;
     
+    // set no stats name
+    pio->stats_name[0] = '\0';
+    
     DebugObject_Init(&pio->d_obj);
     return 1;
     
@@ -654,6 +681,24 @@ PacketPassInterface * StreamPeerIO_GetSendInput (StreamPeerIO *pio)
     return PacketCopier_GetInput(&pio->output_user_copier);
 }
 
+void StreamPeerIO_SetStatsName (StreamPeerIO *pio, const char *name)
+{
+    DebugObject_Access(&pio->d_obj);
+    
+    #ifdef BADVPN_FLOW_STATS
+    snprintf(pio->stats_name, sizeof(pio->stats_name), "%s", name);
+    
+    PacketPassInterface_SetStatsName(PacketCopier_GetInput(&pio->output_user_copier), name, NULL, "PacketCopier");
+    PacketRecvInterface_SetStatsName(PacketCopier_GetOutput(&pio->output_user_copier), name, "PacketCopier", "PacketProtoEncoder");
+    PacketRecvInterface_SetStatsName(PacketProtoEncoder_GetOutput(&pio->output_user_ppe), name, "PacketProtoEncoder", "SinglePacketBuffer");
+    PacketPassInterface_SetStatsName(PacketPassConnector_GetInput(&pio->output_connector), name, "SinglePacketBuffer", "PacketStreamSender");
+    
+    if (pio->sock) {
+        StreamPassInterface_SetStatsName((pio->ssl ? BSSLConnection_GetSendIf(&pio->sslcon) : BConnection_SendAsync_GetIf(&pio->sock->con)), name, "PacketStreamSender", "socket");
+    }
+    #endif
+}
+
 int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key)
 {
     DebugObject_Access(&pio->d_obj);
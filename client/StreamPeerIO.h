@@ -97,6 +97,9 @@ typedef struct {
     StreamRecvConnector input_connector;
     PacketProtoDecoder input_decoder;
     
+    // prefix for naming interfaces for instrumentation
+    char stats_name[FLOWSTATS_NAME_SIZE];
+    
     // connection side
     int mode;
     
@@ -189,6 +192,16 @@ void StreamPeerIO_Free (StreamPeerIO *pio);
  */
 PacketPassInterface * StreamPeerIO_GetSendInput (StreamPeerIO *pio);
 
+/**
+ * Names the interfaces of the send chain for flow instrumentation
+ * (see {@link FlowStats}), including those of connections made from now on.
+ * Does nothing unless built with BADVPN_FLOW_STATS.
+ * 
+ * @param pio the object
+ * @param name prefix for the names of the elements, e.g. "peer 3"
+ */
+void StreamPeerIO_SetStatsName (StreamPeerIO *pio, const char *name);
+
 /**
  * Starts an attempt to connect to the peer.
  * On success, the object enters connecting state.
@@ -28,9 +28,12 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdio.h>
+#include <time.h>
 
 #include <protocol/msgproto.h>
 #include <protocol/addr.h>
@@ -43,20 +46,32 @@
 #include <misc/loglevel.h>
 #include <misc/loggers_string.h>
 #include <misc/string_begins_with.h>
+#include <misc/concat_strings.h>
 #include <misc/open_standard_streams.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 #include <security/BSecurity.h>
 #include <security/BRandom.h>
 #include <system/BSignal.h>
 #include <system/BTime.h>
 #include <system/BNetwork.h>
+#include <system/BMetricsExporter.h>
+#include <flow/FlowStats.h>
 #include <nspr_support/DummyPRFileDesc.h>
 #include <nspr_support/BSSLConnection.h>
 #include <server_connection/ServerConnection.h>
 #include <tuntap/BTap.h>
 #include <threadwork/BThreadWork.h>
+#include <system/BThreadPlacement.h>
+
+#ifdef BADVPN_USE_AF_XDP
+#include <system/BXdpSocket.h>
+#endif
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
@@ -96,33 +111,65 @@ struct {
     int threads;
     int use_threads_for_ssl_handshake;
     int use_threads_for_ssl_data;
+    BThreadPlacement reactor_placement;
+    BThreadPlacement worker_placement;
+    char *avoid_irq_cpus;
+    int reactor_busy_poll_spin_us;
+    int reactor_busy_poll_kernel_us;
+    int reactor_edge_triggered;
     int ssl;
     char *nssdb;
     char *client_cert_name;
     char *server_name;
     char *server_addr;
     char *tapdev;
+    int tapdev_queues;
+    int tapdev_io_reads;
+    int tapdev_io_writes;
     int num_scopes;
     char *scopes[MAX_SCOPES];
     int num_bind_addrs;
     struct bind_addr_option bind_addrs[MAX_BIND_ADDRS];
     int transport_mode;
     int encryption_mode;
+    int aead_mode;
     int hash_mode;
     int otp_mode;
     int otp_num;
     int otp_num_warn;
     int fragmentation_latency;
+    int fragmentation_frames;
+    int peer_udp_offload;
+    int peer_pmtu_discovery;
+    int peer_crypto_pipeline;
+    #ifdef BADVPN_USE_AF_XDP
+    char *peer_xdp_interface;
+    int peer_xdp_queue;
+    #endif
     int peer_ssl;
     int peer_tcp_socket_sndbuf;
+    int peer_compression;
     int send_buffer_size;
     int send_buffer_relay_size;
+    int peer_send_rate;
+    int peer_send_burst;
+    int codel_target;
+    int codel_interval;
+    int latency_buffer_size;
+    int latency_max_size;
+    uint64_t latency_dscp_mask;
     int max_macs;
     int max_groups;
     int igmp_group_membership_interval;
     int igmp_last_member_query_time;
     int allow_peer_talk_without_ssl;
     int max_peers;
+    char *stats_file;
+    int stats_interval;
+    char *link_cache_file;
+    char *metrics_listen_addr;
+    char *metrics_statsd_addr;
+    int metrics_statsd_interval;
 } options;
 
 // bind addresses
@@ -152,24 +199,34 @@ BAddr server_addr;
 // server name to use for SSL
 char server_name[256];
 
+// metrics export addresses
+BAddr metrics_listen_addr;
+BAddr metrics_statsd_addr;
+
 // reactor
 BReactor ss;
 
 // thread work dispatcher
 BThreadWorkDispatcher twd;
 
+#ifdef BADVPN_USE_AF_XDP
+// AF_XDP socket for receiving peer UDP transport, if options.peer_xdp_interface
+BXdpSocket xdp_socket;
+#endif
+
 // client certificate if using SSL
 CERTCertificate *client_cert;
 
 // client private key if using SSL
 SECKEYPrivateKey *client_key;
 
-// device
-BTap device;
-int device_mtu;
+// SSL settings for peer chats
+PeerChatSSLModel peerchat_ssl_model;
 
-// DataProtoSource for device input (reading)
-DataProtoSource device_dpsource;
+// device queues, each with a DataProtoSource for device input (reading)
+struct device_queue device_queues[CLIENT_MAX_DEVICE_QUEUES];
+int num_device_queues;
+int device_mtu;
 
 // DPReceiveDevice for device output (writing)
 DPReceiveDevice device_output_dprd;
@@ -179,6 +236,7 @@ int data_mtu;
 
 // peers list
 LinkedList1 peers;
+PeerTable peers_table;
 int num_peers;
 
 // frame decider
@@ -205,6 +263,22 @@ int server_ready;
 // dying server flow
 struct server_flow *dying_server_flow;
 
+// timer for writing statistics, if enabled
+BTimer stats_timer;
+
+// link cache entries, if options.link_cache_file
+LinkedList1 link_cache;
+
+// metrics, and their exporter if options.metrics_listen_addr or options.metrics_statsd_addr
+BMetric metric_peers;
+BMetric metric_server_ready;
+BMetric metric_device_frames_in;
+BMetric metric_device_frames_out;
+BMetric metric_device_bytes_in;
+BMetric metric_device_bytes_out;
+int have_metrics_exporter;
+BMetricsExporter metrics_exporter;
+
 // stops event processing, causing the program to exit
 static void terminate (void);
 
@@ -249,6 +323,12 @@ static int peer_init_link (struct peer_data *peer);
 // frees link resources
 static void peer_free_link (struct peer_data *peer);
 
+// frees the link, disabling relay provider first; keeps relaying
+static void peer_cleanup_link (struct peer_data *peer);
+
+// attaches local flows to the link or the relay, whichever should be used
+static void peer_update_flows (struct peer_data *peer);
+
 // frees link, relaying, waiting relaying
 static void peer_cleanup_connections (struct peer_data *peer);
 
@@ -338,7 +418,9 @@ static struct peer_data * find_peer_by_id (peerid_t id);
 static void device_error_handler (void *unused);
 
 // DataProtoSource handler for packets from the device
-static void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len);
+static void device_dpsource_handler (struct device_queue *q, const uint8_t *frame, int frame_len);
+static int device_dpsource_classifier (void *unused, const uint8_t *frame, int frame_len);
+static void device_output_func (BTap *tap, uint8_t *frame, int frame_len);
 
 // assign relays to clients waiting for them
 static void assign_relays (void);
@@ -365,6 +447,28 @@ static void server_flow_qflow_handler_busy (struct server_flow *flow);
 static void server_flow_connect (struct server_flow *flow, PacketRecvInterface *input);
 static void server_flow_disconnect (struct server_flow *flow);
 
+// writes a file through a temporary file, replacing it at once
+static void write_file_replace (const char *file, int (*write_func) (FILE *f));
+
+// statistics export
+static void stats_timer_handler (void *unused);
+static int stats_write (FILE *f);
+static void stats_write_peer (FILE *f, struct peer_data *peer);
+static void stats_relay_flow_handler (FILE *f, peerid_t source_id, peerid_t dest_id, const struct DPRelay_flow_stats *stats);
+
+// link cache
+static void link_cache_load (void);
+static void link_cache_free (void);
+static struct link_cache_entry * link_cache_find (const char *common_name);
+static void link_cache_update (struct peer_data *peer);
+static int link_cache_write (FILE *f);
+
+// metrics export
+static void init_metrics (void);
+static void free_metrics (void);
+static int64_t metric_peers_func (void *unused);
+static int64_t metric_server_ready_func (void *unused);
+
 int main (int argc, char *argv[])
 {
     if (argc <= 0) {
@@ -458,6 +562,12 @@ int main (int argc, char *argv[])
             BLog(BLOG_ERROR, "Cannot open certificate and key");
             goto fail03;
         }
+        
+        // set up peer chat SSL once rather than for every peer
+        if (!PeerChatSSLModel_Init(&peerchat_ssl_model, client_cert, client_key)) {
+            BLog(BLOG_ERROR, "PeerChatSSLModel_Init failed");
+            goto fail04;
+        }
     }
     
     // initialize network
@@ -481,6 +591,12 @@ int main (int argc, char *argv[])
         goto fail1;
     }
     
+    // spin for events before sleeping, if asked to
+    BReactor_SetBusyPoll(&ss, options.reactor_busy_poll_spin_us, options.reactor_busy_poll_kernel_us);
+    
+    // register sockets edge-triggered, if asked to
+    BReactor_SetEdgeTriggered(&ss, options.reactor_edge_triggered);
+    
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
@@ -488,11 +604,14 @@ int main (int argc, char *argv[])
     }
     
     // init thread work dispatcher
-    if (!BThreadWorkDispatcher_Init(&twd, &ss, options.threads)) {
-        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+    if (!BThreadWorkDispatcher_Init2(&twd, &ss, options.threads, &options.worker_placement)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init2 failed");
         goto fail3;
     }
     
+    // place the reactor; only now so that the worker threads don't inherit it
+    BThreadPlacement_Apply(&options.reactor_placement, 0, "reactor");
+    
     // init BSecurity
     if (BThreadWorkDispatcher_UsingThreads(&twd)) {
         if (!BSecurity_GlobalInitThreadSafe()) {
@@ -501,6 +620,16 @@ int main (int argc, char *argv[])
         }
     }
     
+    #ifdef BADVPN_USE_AF_XDP
+    // init AF_XDP socket
+    if (options.peer_xdp_interface) {
+        if (!BXdpSocket_Init(&xdp_socket, &ss, options.peer_xdp_interface, options.peer_xdp_queue, PEER_UDP_XDP_NUM_FRAMES)) {
+            BLog(BLOG_ERROR, "BXdpSocket_Init failed");
+            goto fail5;
+        }
+    }
+    #endif
+    
     // init listeners
     int num_listeners = 0;
     if (options.transport_mode == TRANSPORT_MODE_TCP) {
@@ -514,17 +643,36 @@ int main (int argc, char *argv[])
         }
     }
     
-    // init device
-    if (!BTap_Init(&device, &ss, options.tapdev, device_error_handler, NULL, 0)) {
-        BLog(BLOG_ERROR, "BTap_Init failed");
-        goto fail8;
+    // init device queues; with more than one, each is a queue of the same
+    // multi-queue device, and the kernel spreads flows between them
+    struct BTap_init_data tap_init_data;
+    tap_init_data.dev_type = BTAP_DEV_TAP;
+    tap_init_data.init_type = BTAP_INIT_STRING;
+    tap_init_data.flags = (options.tapdev_queues > 1 ? BTAP_INIT_FLAG_MULTI_QUEUE : 0);
+    tap_init_data.recv_batch = options.tapdev_io_reads;
+    tap_init_data.send_queue = options.tapdev_io_writes;
+    tap_init_data.init.string = options.tapdev;
+    num_device_queues = 0;
+    while (num_device_queues < options.tapdev_queues) {
+        if (!BTap_Init2(&device_queues[num_device_queues].tap, &ss, tap_init_data, device_error_handler, NULL)) {
+            BLog(BLOG_ERROR, "BTap_Init2 failed");
+            goto fail9;
+        }
+        num_device_queues++;
     }
     
     // remember device MTU
-    device_mtu = BTap_GetMTU(&device);
+    device_mtu = BTap_GetMTU(&device_queues[0].tap);
     
     BLog(BLOG_INFO, "device MTU is %d", device_mtu);
     
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        BLog(BLOG_INFO, "encryption cipher implementation: %s", BEncryption_cipher_implementation(sp_params.encryption_mode));
+    }
+    if (SPPROTO_HAVE_OTP(sp_params)) {
+        BLog(BLOG_INFO, "OTP cipher implementation: %s", BEncryption_cipher_implementation(sp_params.otp_mode));
+    }
+    
     // calculate data MTU
     if (device_mtu > INT_MAX - DATAPROTO_MAX_OVERHEAD) {
         BLog(BLOG_ERROR, "Device MTU is too large");
@@ -532,24 +680,44 @@ int main (int argc, char *argv[])
     }
     data_mtu = DATAPROTO_MAX_OVERHEAD + device_mtu;
     
-    // init device input
-    if (!DataProtoSource_Init(&device_dpsource, BTap_GetOutput(&device), device_dpsource_handler, NULL, &ss)) {
-        BLog(BLOG_ERROR, "DataProtoSource_Init failed");
-        goto fail9;
+    // init device input, with a separate pipeline for each queue
+    int num_dpsources = 0;
+    while (num_dpsources < num_device_queues) {
+        struct device_queue *q = &device_queues[num_dpsources];
+        if (!DataProtoSource_Init(&q->dpsource, BTap_GetOutput(&q->tap), (DataProtoSource_handler)device_dpsource_handler, q, &ss)) {
+            BLog(BLOG_ERROR, "DataProtoSource_Init failed");
+            goto fail10;
+        }
+        num_dpsources++;
+        
+        // classify frames for the low-latency class
+        if (options.latency_buffer_size > 0) {
+            DataProtoSource_SetClassifier(&q->dpsource, device_dpsource_classifier, NULL);
+        }
     }
     
-    // init device output
-    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)BTap_Send, &device, &ss, options.send_buffer_relay_size, PEER_RELAY_FLOW_INACTIVITY_TIME)) {
+    // init device output; frames can be written to any queue, so use the first one
+    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)device_output_func, &device_queues[0].tap, &ss, options.send_buffer_relay_size, PEER_RELAY_FLOW_INACTIVITY_TIME)) {
         BLog(BLOG_ERROR, "DPReceiveDevice_Init failed");
         goto fail10;
     }
     
     // init peers list
     LinkedList1_Init(&peers);
+    PeerTable_Init(&peers_table);
     num_peers = 0;
     
+    // load link cache
+    LinkedList1_Init(&link_cache);
+    if (options.link_cache_file) {
+        link_cache_load();
+    }
+    
     // init frame decider
-    FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss);
+    if (!FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss)) {
+        BLog(BLOG_ERROR, "FrameDecider_Init failed");
+        goto fail10a;
+    }
     
     // init relays list
     LinkedList1_Init(&relays);
@@ -557,6 +725,19 @@ int main (int argc, char *argv[])
     // init need relay list
     LinkedList1_Init(&waiting_relay_peers);
     
+    // init metrics
+    init_metrics();
+    
+    // init metrics exporter
+    have_metrics_exporter = (options.metrics_listen_addr || options.metrics_statsd_addr);
+    if (have_metrics_exporter) {
+        if (!BMetricsExporter_Init(&metrics_exporter, &ss, !!options.metrics_listen_addr, metrics_listen_addr,
+                                   !!options.metrics_statsd_addr, metrics_statsd_addr, options.metrics_statsd_interval)) {
+            BLog(BLOG_ERROR, "BMetricsExporter_Init failed");
+            goto fail10b;
+        }
+    }
+    
     // start connecting to server
     if (!ServerConnection_Init(&server, &ss, &twd, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, ssl_flags(), client_cert, client_key, server_name, NULL,
                                server_handler_error, server_handler_ready, server_handler_newclient, server_handler_endclient, server_handler_message
@@ -571,10 +752,21 @@ int main (int argc, char *argv[])
     // set no dying flow
     dying_server_flow = NULL;
     
+    // start statistics timer
+    if (options.stats_file) {
+        BTimer_Init(&stats_timer, options.stats_interval, stats_timer_handler, NULL);
+        BReactor_SetTimer(&ss, &stats_timer);
+    }
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+    // stop statistics timer
+    if (options.stats_file) {
+        BReactor_RemoveTimer(&ss, &stats_timer);
+    }
+    
     if (server_ready) {
         // allow freeing server queue flows
         PacketPassFairQueue_PrepareFree(&server_queue);
@@ -600,18 +792,36 @@ int main (int argc, char *argv[])
     }
     ServerConnection_Free(&server);
 fail11:
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+    }
+fail10b:
+    free_metrics();
     FrameDecider_Free(&frame_decider);
+fail10a:
+    link_cache_free();
+    PeerTable_Free(&peers_table);
     DPReceiveDevice_Free(&device_output_dprd);
 fail10:
-    DataProtoSource_Free(&device_dpsource);
+    while (num_dpsources-- > 0) {
+        DataProtoSource_Free(&device_queues[num_dpsources].dpsource);
+    }
 fail9:
-    BTap_Free(&device);
+    while (num_device_queues-- > 0) {
+        BTap_Free(&device_queues[num_device_queues].tap);
+    }
 fail8:
     if (options.transport_mode == TRANSPORT_MODE_TCP) {
         while (num_listeners-- > 0) {
             PasswordListener_Free(&listeners[num_listeners]);
         }
     }
+    #ifdef BADVPN_USE_AF_XDP
+    if (options.peer_xdp_interface) {
+        BXdpSocket_Free(&xdp_socket);
+    }
+fail5:
+    #endif
     if (BThreadWorkDispatcher_UsingThreads(&twd)) {
         BSecurity_GlobalFreeThreadSafe();
     }
@@ -624,6 +834,8 @@ fail2:
     BReactor_Free(&ss);
 fail1:
     if (options.ssl) {
+        PeerChatSSLModel_Free(&peerchat_ssl_model);
+fail04:
         CERT_DestroyCertificate(client_cert);
         SECKEY_DestroyPrivateKey(client_key);
 fail03:
@@ -670,10 +882,19 @@ void print_help (const char *name)
         "        [--threads <integer>]\n"
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
+        "        [--reactor-cpus <cpu list>]\n"
+        "        [--reactor-sched <nice:N / fifo:P>]\n"
+        "        [--worker-cpus <cpu list>]\n"
+        "        [--worker-sched <nice:N / fifo:P>]\n"
+        "        [--avoid-irq-cpus <ifname>]\n"
+        "        [--reactor-busy-poll <spin microseconds / 0> <kernel microseconds / 0>]\n"
+        "        [--reactor-edge-triggered]\n"
         "        [--ssl --nssdb <string> --client-cert-name <string>]\n"
         "        [--server-name <string>]\n"
         "        --server-addr <addr>\n"
         "        [--tapdev <name>]\n"
+        "        [--tapdev-queues <num>]\n"
+        "        [--tapdev-io-depth <reads> <writes>]\n"
         "        [--scope <scope_name>] ...\n"
         "        [\n"
         "            --bind-addr <addr>\n"
@@ -682,23 +903,42 @@ void print_help (const char *name)
         "        ] ...\n"
         "        --transport-mode <udp/tcp>\n"
         "        (transport-mode=udp?\n"
-        "            --encryption-mode <blowfish/aes/none>\n"
-        "            --hash-mode <md5/sha1/none>\n"
+        "            --encryption-mode <blowfish/aes/aes-128-gcm/chacha20-poly1305/none>\n"
+        "            --hash-mode <md5/sha1/sha256/blake2s/none>\n"
         "            [--otp <blowfish/aes> <num> <num-warn>]\n"
         "            [--fragmentation-latency <milliseconds>]\n"
+        "            [--fragmentation-frames <num>]\n"
+        "            [--peer-udp-offload]\n"
+        "            [--peer-pmtu-discovery]\n"
+        "            [--peer-crypto-pipeline <num>]\n"
+        #ifdef BADVPN_USE_AF_XDP
+        "            [--peer-xdp-interface <ifname> [--peer-xdp-queue <num>]]\n"
+        #endif
         "        )\n"
         "        (transport-mode=tcp?\n"
         "            (ssl? [--peer-ssl])\n"
         "            [--peer-tcp-socket-sndbuf <bytes / 0>]\n"
         "        )\n"
+        "        [--peer-compression]\n"
         "        [--send-buffer-size <num-packets>]\n"
         "        [--send-buffer-relay-size <num-packets>]\n"
+        "        [--peer-send-rate <bytes-per-second>]\n"
+        "        [--peer-send-burst <bytes>]\n"
+        "        [--codel-target <ms>]\n"
+        "        [--codel-interval <ms>]\n"
+        "        [--latency-buffer-size <num-packets>]\n"
+        "        [--latency-max-size <bytes>]\n"
+        "        [--latency-dscp <dscp>] ...\n"
         "        [--max-macs <num>]\n"
         "        [--max-groups <num>]\n"
         "        [--igmp-group-membership-interval <ms>]\n"
         "        [--igmp-last-member-query-time <ms>]\n"
         "        [--allow-peer-talk-without-ssl]\n"
         "        [--max-peers <number>]\n"
+        "        [--stats-file <file> [--stats-interval <ms>]]\n"
+        "        [--link-cache-file <file>]\n"
+        "        [--metrics-listen-addr <addr>]\n"
+        "        [--metrics-statsd-addr <addr> [--metrics-statsd-interval <ms>]]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -729,31 +969,70 @@ int parse_arguments (int argc, char *argv[])
     options.threads = 0;
     options.use_threads_for_ssl_handshake = 0;
     options.use_threads_for_ssl_data = 0;
+    BThreadPlacement_Init(&options.reactor_placement);
+    BThreadPlacement_Init(&options.worker_placement);
+    options.avoid_irq_cpus = NULL;
+    options.reactor_busy_poll_spin_us = 0;
+    options.reactor_busy_poll_kernel_us = 0;
+    options.reactor_edge_triggered = 0;
     options.ssl = 0;
     options.nssdb = NULL;
     options.client_cert_name = NULL;
     options.server_name = NULL;
     options.server_addr = NULL;
     options.tapdev = NULL;
+    options.tapdev_queues = 1;
+    options.tapdev_io_reads = DEFAULT_DEVICE_IO_DEPTH;
+    options.tapdev_io_writes = DEFAULT_DEVICE_IO_DEPTH;
     options.num_scopes = 0;
     options.num_bind_addrs = 0;
     options.transport_mode = -1;
     options.encryption_mode = -1;
+    options.aead_mode = SPPROTO_AEAD_MODE_NONE;
     options.hash_mode = -1;
     options.otp_mode = SPPROTO_OTP_MODE_NONE;
     options.fragmentation_latency = PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY;
+    options.fragmentation_frames = PEER_DEFAULT_UDP_ASSEMBLER_MAX_FRAMES;
+    options.peer_udp_offload = 0;
+    #ifdef BADVPN_USE_AF_XDP
+    options.peer_xdp_interface = NULL;
+    options.peer_xdp_queue = 0;
+    #endif
+    options.peer_pmtu_discovery = 0;
+    options.peer_crypto_pipeline = 1;
     options.peer_ssl = 0;
     options.peer_tcp_socket_sndbuf = -1;
+    options.peer_compression = 0;
     options.send_buffer_size = PEER_DEFAULT_SEND_BUFFER_SIZE;
     options.send_buffer_relay_size = PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE;
+    options.peer_send_rate = 0;
+    options.peer_send_burst = 0;
+    options.codel_target = 0;
+    options.codel_interval = PEER_DEFAULT_CODEL_INTERVAL;
+    options.latency_buffer_size = 0;
+    options.latency_max_size = -1;
+    options.latency_dscp_mask = 0;
     options.max_macs = PEER_DEFAULT_MAX_MACS;
     options.max_groups = PEER_DEFAULT_MAX_GROUPS;
     options.igmp_group_membership_interval = DEFAULT_IGMP_GROUP_MEMBERSHIP_INTERVAL;
     options.igmp_last_member_query_time = DEFAULT_IGMP_LAST_MEMBER_QUERY_TIME;
     options.allow_peer_talk_without_ssl = 0;
     options.max_peers = DEFAULT_MAX_PEERS;
+    options.stats_file = NULL;
+    options.stats_interval = DEFAULT_STATS_INTERVAL;
+    options.link_cache_file = NULL;
+    options.metrics_listen_addr = NULL;
+    options.metrics_statsd_addr = NULL;
+    options.metrics_statsd_interval = BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL;
     
     int have_fragmentation_latency = 0;
+    int have_fragmentation_frames = 0;
+    int have_peer_crypto_pipeline = 0;
+    #ifdef BADVPN_USE_AF_XDP
+    int have_peer_xdp_queue = 0;
+    #endif
+    int have_stats_interval = 0;
+    int have_metrics_statsd_interval = 0;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -845,6 +1124,56 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--use-threads-for-ssl-data")) {
             options.use_threads_for_ssl_data = 1;
         }
+        else if (!strcmp(arg, "--reactor-cpus") || !strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            BThreadPlacement *placement = (arg[2] == 'r' ? &options.reactor_placement : &options.worker_placement);
+            if (!BThreadPlacement_ParseCpus(placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-sched") || !strcmp(arg, "--worker-sched")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            BThreadPlacement *placement = (arg[2] == 'r' ? &options.reactor_placement : &options.worker_placement);
+            if (!BThreadPlacement_ParseSched(placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--avoid-irq-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.avoid_irq_cpus = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-busy-poll")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_spin_us = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_kernel_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-edge-triggered")) {
+            options.reactor_edge_triggered = 1;
+        }
         else if (!strcmp(arg, "--ssl")) {
             options.ssl = 1;
         }
@@ -888,6 +1217,32 @@ int parse_arguments (int argc, char *argv[])
             options.tapdev = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--tapdev-queues")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tapdev_queues = atoi(argv[i + 1])) <= 0 || options.tapdev_queues > CLIENT_MAX_DEVICE_QUEUES) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tapdev-io-depth")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.tapdev_io_reads = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.tapdev_io_writes = atoi(argv[i + 2])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
         else if (!strcmp(arg, "--scope")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -986,6 +1341,14 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "aes")) {
                 options.encryption_mode = BENCRYPTION_CIPHER_AES;
             }
+            else if (!strcmp(arg2, "aes-128-gcm")) {
+                options.encryption_mode = SPPROTO_ENCRYPTION_MODE_NONE;
+                options.aead_mode = BAEAD_CIPHER_AES_128_GCM;
+            }
+            else if (!strcmp(arg2, "chacha20-poly1305")) {
+                options.encryption_mode = SPPROTO_ENCRYPTION_MODE_NONE;
+                options.aead_mode = BAEAD_CIPHER_CHACHA20_POLY1305;
+            }
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
@@ -1007,6 +1370,12 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "sha1")) {
                 options.hash_mode = BHASH_TYPE_SHA1;
             }
+            else if (!strcmp(arg2, "sha256")) {
+                options.hash_mode = BHASH_TYPE_SHA256;
+            }
+            else if (!strcmp(arg2, "blake2s")) {
+                options.hash_mode = BHASH_TYPE_BLAKE2S;
+            }
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
@@ -1051,6 +1420,58 @@ int parse_arguments (int argc, char *argv[])
             have_fragmentation_latency = 1;
             i++;
         }
+        else if (!strcmp(arg, "--fragmentation-frames")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.fragmentation_frames = atoi(argv[i + 1])) < PEER_UDP_ASSEMBLER_NUM_FRAMES || options.fragmentation_frames > FPA_MAX_FRAMES) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_fragmentation_frames = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-udp-offload")) {
+            options.peer_udp_offload = 1;
+        }
+        else if (!strcmp(arg, "--peer-pmtu-discovery")) {
+            options.peer_pmtu_discovery = 1;
+        }
+        #ifdef BADVPN_USE_AF_XDP
+        else if (!strcmp(arg, "--peer-xdp-interface")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.peer_xdp_interface = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-xdp-queue")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_xdp_queue = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_peer_xdp_queue = 1;
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--peer-crypto-pipeline")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_crypto_pipeline = atoi(argv[i + 1])) < 1) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_peer_crypto_pipeline = 1;
+            i++;
+        }
         else if (!strcmp(arg, "--peer-ssl")) {
             options.peer_ssl = 1;
         }
@@ -1065,6 +1486,9 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--peer-compression")) {
+            options.peer_compression = 1;
+        }
         else if (!strcmp(arg, "--send-buffer-size")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1087,6 +1511,85 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--peer-send-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_send_rate = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.codel_target = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--codel-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.codel_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-send-burst")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_send_burst = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--latency-buffer-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.latency_buffer_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--latency-max-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.latency_max_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--latency-dscp")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            int dscp = atoi(argv[i + 1]);
+            if (dscp < 0 || dscp > 63) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.latency_dscp_mask |= (uint64_t)1 << dscp;
+            i++;
+        }
         else if (!strcmp(arg, "--max-macs")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1145,6 +1648,62 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--allow-peer-talk-without-ssl")) {
             options.allow_peer_talk_without_ssl = 1;
         }
+        else if (!strcmp(arg, "--stats-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--stats-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.stats_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_stats_interval = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--link-cache-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.link_cache_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_statsd_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.metrics_statsd_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_metrics_statsd_interval = 1;
+            i++;
+        }
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
@@ -1185,6 +1744,11 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!(options.aead_mode != SPPROTO_AEAD_MODE_NONE) || (options.hash_mode == SPPROTO_HASH_MODE_NONE))) {
+        fprintf(stderr, "False: --encryption-mode <aes-128-gcm/chacha20-poly1305> => --hash-mode none\n");
+        return 0;
+    }
+    
     if (!(!(options.otp_mode != SPPROTO_OTP_MODE_NONE) || (options.transport_mode == TRANSPORT_MODE_UDP))) {
         fprintf(stderr, "False: --otp => UDP\n");
         return 0;
@@ -1195,6 +1759,48 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!have_fragmentation_frames || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --fragmentation-frames => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.peer_udp_offload || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-udp-offload => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.peer_pmtu_discovery || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-pmtu-discovery => UDP\n");
+        return 0;
+    }
+    
+    #ifdef BADVPN_USE_AF_XDP
+    if (!(!options.peer_xdp_interface || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-xdp-interface => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_peer_xdp_queue || options.peer_xdp_interface)) {
+        fprintf(stderr, "False: --peer-xdp-queue => --peer-xdp-interface\n");
+        return 0;
+    }
+    #endif
+    
+    if (!(!have_peer_crypto_pipeline || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-crypto-pipeline => UDP\n");
+        return 0;
+    }
+    
+    if ((options.latency_buffer_size > 0) != (options.latency_max_size >= 0 || options.latency_dscp_mask)) {
+        fprintf(stderr, "False: --latency-buffer-size <=> (--latency-max-size || --latency-dscp)\n");
+        return 0;
+    }
+    
+    if (!(!(options.tapdev_queues > 1) || options.tapdev)) {
+        fprintf(stderr, "False: --tapdev-queues >1 => --tapdev\n");
+        return 0;
+    }
+    
     if (!(!options.peer_ssl || (options.ssl && options.transport_mode == TRANSPORT_MODE_TCP))) {
         fprintf(stderr, "False: --peer-ssl => (--ssl && TCP)\n");
         return 0;
@@ -1205,6 +1811,21 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!have_stats_interval || options.stats_file)) {
+        fprintf(stderr, "False: --stats-interval => --stats-file\n");
+        return 0;
+    }
+    
+    if (!(!options.link_cache_file || options.ssl)) {
+        fprintf(stderr, "False: --link-cache-file => --ssl\n");
+        return 0;
+    }
+    
+    if (!(!have_metrics_statsd_interval || options.metrics_statsd_addr)) {
+        fprintf(stderr, "False: --metrics-statsd-interval => --metrics-statsd-addr\n");
+        return 0;
+    }
+    
     return 1;
 }
 
@@ -1292,6 +1913,7 @@ int process_arguments (void)
     // initialize SPProto parameters
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
         sp_params.encryption_mode = options.encryption_mode;
+        sp_params.aead_mode = options.aead_mode;
         sp_params.hash_mode = options.hash_mode;
         sp_params.otp_mode = options.otp_mode;
         if (options.otp_mode > 0) {
@@ -1299,6 +1921,28 @@ int process_arguments (void)
         }
     }
     
+    // resolve metrics addresses
+    if (options.metrics_listen_addr) {
+        if (!BAddr_Parse(&metrics_listen_addr, options.metrics_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics listen addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    if (options.metrics_statsd_addr) {
+        if (!BAddr_Parse(&metrics_statsd_addr, options.metrics_statsd_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics statsd addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    
+    // keep crypto workers off the CPUs handling the network interrupts
+    if (options.avoid_irq_cpus) {
+        if (!BThreadPlacement_AvoidIrqCpus(&options.worker_placement, options.avoid_irq_cpus)) {
+            BLog(BLOG_ERROR, "avoid IRQ CPUs: BThreadPlacement_AvoidIrqCpus failed");
+            return 0;
+        }
+    }
+    
     return 1;
 }
 
@@ -1389,6 +2033,18 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
         CERT_DestroyCertificate(nsscert);
     }
     
+    // remember which bind address last worked for the peer
+    peer->cached_addr_index = -1;
+    if (options.link_cache_file) {
+        struct link_cache_entry *entry = link_cache_find(peer->common_name);
+        if (entry && entry->bind_addr_index < num_bind_addrs) {
+            peer->cached_addr_index = entry->bind_addr_index;
+        }
+    }
+    
+    // have not bound
+    peer->bound_addr_index = -1;
+    
     // init and set init job (must be before initing server flow so we can send)
     BPending_Init(&peer->job_init, BReactor_PendingGroup(&ss), (BPending_handler)peer_job_init, peer);
     BPending_Set(&peer->job_init);
@@ -1416,7 +2072,7 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     }
     
     // init chat
-    if (!PeerChat_Init(&peer->chat, peer->id, chat_ssl_mode, ssl_flags(), client_cert, client_key, peer->cert, peer->cert_len, BReactor_PendingGroup(&ss), &twd, peer,
+    if (!PeerChat_Init(&peer->chat, peer->id, chat_ssl_mode, ssl_flags(), (options.ssl ? &peerchat_ssl_model : NULL), peer->cert, peer->cert_len, BReactor_PendingGroup(&ss), &twd, peer,
         (BLog_logfunc)peer_logfunc,
         (PeerChat_handler_error)peer_chat_handler_error,
         (PeerChat_handler_message)peer_chat_handler_message
@@ -1437,10 +2093,17 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     // set have no resetpeer
     peer->have_resetpeer = 0;
     
-    // init local flow
-    if (!DataProtoFlow_Init(&peer->local_dpflow, &device_dpsource, my_id, peer->id, options.send_buffer_size, -1, NULL, NULL)) {
-        peer_log(peer, BLOG_ERROR, "DataProtoFlow_Init failed");
-        goto fail4;
+    // init local flows
+    int num_local_dpflows = 0;
+    while (num_local_dpflows < num_device_queues) {
+        if (!DataProtoFlow_Init(&peer->local_dpflows[num_local_dpflows], &device_queues[num_local_dpflows].dpsource, my_id, peer->id, options.send_buffer_size, -1, NULL, NULL)) {
+            peer_log(peer, BLOG_ERROR, "DataProtoFlow_Init failed");
+            goto fail5;
+        }
+        if (options.codel_target > 0) {
+            DataProtoFlow_EnableCoDel(&peer->local_dpflows[num_local_dpflows], options.codel_target, options.codel_interval);
+        }
+        num_local_dpflows++;
     }
     
     // init frame decider peer
@@ -1450,11 +2113,17 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     }
     
     // init receive peer
-    DPReceivePeer_Init(&peer->receive_peer, &device_output_dprd, peer->id, &peer->decider_peer, !!(peer->flags & SCID_NEWCLIENT_FLAG_RELAY_CLIENT));
+    if (!DPReceivePeer_Init(&peer->receive_peer, &device_output_dprd, peer->id, &peer->decider_peer, !!(peer->flags & SCID_NEWCLIENT_FLAG_RELAY_CLIENT))) {
+        peer_log(peer, BLOG_ERROR, "DPReceivePeer_Init failed");
+        goto fail6;
+    }
     
     // have no link
     peer->have_link = 0;
     
+    // local flows are not attached
+    peer->flows_sink = NULL;
+    
     // have no relaying
     peer->relaying_peer = NULL;
     
@@ -1470,6 +2139,12 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     // init binding
     peer->binding = 0;
     
+    // add to peers table
+    if (!PeerTable_Add(&peers_table, peer->id, peer)) {
+        peer_log(peer, BLOG_ERROR, "PeerTable_Add failed");
+        goto fail7;
+    }
+    
     // add to peers list
     LinkedList1_Append(&peers, &peer->list_node);
     num_peers++;
@@ -1488,9 +2163,15 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     
     return;
     
+fail7:
+    BReactor_RemoveTimer(&ss, &peer->reset_timer);
+    DPReceivePeer_Free(&peer->receive_peer);
+fail6:
+    FrameDeciderPeer_Free(&peer->decider_peer);
 fail5:
-    DataProtoFlow_Free(&peer->local_dpflow);
-fail4:
+    while (num_local_dpflows-- > 0) {
+        DataProtoFlow_Free(&peer->local_dpflows[num_local_dpflows]);
+    }
     server_flow_disconnect(peer->server_flow);
     PeerChat_Free(&peer->chat);
 fail3:
@@ -1522,6 +2203,9 @@ void peer_remove (struct peer_data *peer, int exiting)
     LinkedList1_Remove(&peers, &peer->list_node);
     num_peers--;
     
+    // remove from peers table
+    PeerTable_Remove(&peers_table, peer->id);
+    
     // free reset timer
     BReactor_RemoveTimer(&ss, &peer->reset_timer);
     
@@ -1531,8 +2215,10 @@ void peer_remove (struct peer_data *peer, int exiting)
     // free frame decider
     FrameDeciderPeer_Free(&peer->decider_peer);
     
-    // free local flow
-    DataProtoFlow_Free(&peer->local_dpflow);
+    // free local flows
+    for (int i = 0; i < num_device_queues; i++) {
+        DataProtoFlow_Free(&peer->local_dpflows[i]);
+    }
     
     // free chat
     if (peer->have_chat) {
@@ -1606,9 +2292,6 @@ void peer_free_chat (struct peer_data *peer)
 int peer_init_link (struct peer_data *peer)
 {
     ASSERT(!peer->have_link)
-    ASSERT(!peer->relaying_peer)
-    ASSERT(!peer->waiting_relay)
-    
     ASSERT(!peer->is_relay)
     
     // init receive receiver
@@ -1621,8 +2304,8 @@ int peer_init_link (struct peer_data *peer)
         // init DatagramPeerIO
         if (!DatagramPeerIO_Init(
             &peer->pio.udp.pio, &ss, data_mtu, CLIENT_UDP_MTU, sp_params,
-            options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES, recv_if,
-            options.otp_num_warn, &twd, peer,
+            options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES, options.fragmentation_frames, recv_if,
+            options.peer_udp_offload, options.peer_pmtu_discovery, options.peer_crypto_pipeline, options.otp_num_warn, &twd, peer,
             (BLog_logfunc)peer_logfunc,
             (DatagramPeerIO_handler_error)peer_udp_pio_handler_error,
             (DatagramPeerIO_handler_otp_warning)peer_udp_pio_handler_seed_warning,
@@ -1632,6 +2315,13 @@ int peer_init_link (struct peer_data *peer)
             goto fail1;
         }
         
+        #ifdef BADVPN_USE_AF_XDP
+        // receive through AF_XDP as well
+        if (options.peer_xdp_interface) {
+            DatagramPeerIO_SetXdp(&peer->pio.udp.pio, &xdp_socket);
+        }
+        #endif
+        
         if (SPPROTO_HAVE_OTP(sp_params)) {
             // init send seed state
             peer->pio.udp.sendseed_nextid = 0;
@@ -1661,24 +2351,57 @@ int peer_init_link (struct peer_data *peer)
         link_if = StreamPeerIO_GetSendInput(&peer->pio.tcp.pio);
     }
     
+    // init send rate limiter; it sits below DataProtoSink so that shaping
+    // makes the sink's bounded buffers fill instead of the link's
+    if (options.peer_send_rate > 0) {
+        PacketPassRateLimiter_Init(&peer->send_limiter, link_if, &ss, options.peer_send_rate, (options.peer_send_burst > 0 ? options.peer_send_burst : options.peer_send_rate / 20));
+        link_if = PacketPassRateLimiter_GetInput(&peer->send_limiter);
+    }
+    
     // init sending
-    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, PEER_KEEPALIVE_INTERVAL, PEER_KEEPALIVE_RECEIVE_TIMER, (DataProtoSink_handler)peer_dataproto_handler, peer)) {
+    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, PEER_KEEPALIVE_INTERVAL, PEER_KEEPALIVE_RECEIVE_TIMER, options.latency_buffer_size, (options.peer_compression ? &twd : NULL), (DataProtoSink_handler)peer_dataproto_handler, peer)) {
         peer_log(peer, BLOG_ERROR, "DataProto_Init failed");
         goto fail2;
     }
     
-    // attach local flow to our DataProtoSink
-    DataProtoFlow_Attach(&peer->local_dpflow, &peer->send_dp);
+    // adapt keep-alives to the link, and detect a dead link quickly
+    DataProtoSink_EnableAdaptiveKeepalive(&peer->send_dp, PEER_KEEPALIVE_MAX_INTERVAL, PEER_KEEPALIVE_SUSPECT_TIME, PEER_KEEPALIVE_PROBES);
+    
+    #ifdef BADVPN_FLOW_STATS
+    // name the link's interfaces for instrumentation
+    char stats_name[FLOWSTATS_NAME_SIZE];
+    snprintf(stats_name, sizeof(stats_name), "peer %d", (int)peer->id);
+    if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        DatagramPeerIO_SetStatsName(&peer->pio.udp.pio, stats_name);
+    } else {
+        StreamPeerIO_SetStatsName(&peer->pio.tcp.pio, stats_name);
+    }
+    DataProtoSink_SetStatsName(&peer->send_dp, stats_name);
+    #endif
     
     // attach receive peer to our DataProtoSink
     DPReceivePeer_AttachSink(&peer->receive_peer, &peer->send_dp);
     
-    // set have link
+    // set have link, not up yet
     peer->have_link = 1;
+    peer->link_up = 0;
+    
+    // send through the link, unless we have a relay to use until it's up
+    peer_update_flows(peer);
+    
+    // try a relay at the same time, so traffic can flow as soon as either
+    // path works; the relay is dropped when the link comes up
+    if (!peer->relaying_peer && !peer->waiting_relay) {
+        peer_register_need_relay(peer);
+        assign_relays();
+    }
     
     return 1;
     
 fail2:
+    if (options.peer_send_rate > 0) {
+        PacketPassRateLimiter_Free(&peer->send_limiter);
+    }
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
         if (SPPROTO_HAVE_OTP(sp_params)) {
             BPending_Free(&peer->pio.udp.job_send_seed);
@@ -1697,20 +2420,31 @@ void peer_free_link (struct peer_data *peer)
     ASSERT(peer->have_link)
     ASSERT(!peer->is_relay)
     
-    ASSERT(!peer->relaying_peer)
-    ASSERT(!peer->waiting_relay)
-    
     // detach receive peer from our DataProtoSink
     DPReceivePeer_DetachSink(&peer->receive_peer);
     
-    // detach local flow from our DataProtoSink
-    DataProtoFlow_Detach(&peer->local_dpflow);
+    // set have no link
+    peer->have_link = 0;
+    
+    // move local flows off our DataProtoSink
+    peer_update_flows(peer);
+    ASSERT(peer->flows_sink != &peer->send_dp)
     
     // free sending
     DataProtoSink_Free(&peer->send_dp);
     
+    // free send rate limiter
+    if (options.peer_send_rate > 0) {
+        PacketPassRateLimiter_Free(&peer->send_limiter);
+    }
+    
     // free transport-specific link objects
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        struct FragmentProtoAssembler_stats stats;
+        DatagramPeerIO_GetAssemblerStats(&peer->pio.udp.pio, &stats);
+        peer_log(peer, BLOG_INFO, "reassembly: %"PRIu64" frames completed, %"PRIu64" evicted, %"PRIu64" timed out, %"PRIu64" late chunks, window %d",
+                 stats.frames_completed, stats.frames_evicted, stats.frames_timed_out, stats.chunks_late, stats.num_frames);
+        
         if (SPPROTO_HAVE_OTP(sp_params)) {
             BPending_Free(&peer->pio.udp.job_send_seed);
         }
@@ -1721,12 +2455,9 @@ void peer_free_link (struct peer_data *peer)
     
     // free receive receiver
     DPReceiveReceiver_Free(&peer->receive_receiver);
-    
-    // set have no link
-    peer->have_link = 0;
 }
 
-void peer_cleanup_connections (struct peer_data *peer)
+void peer_cleanup_link (struct peer_data *peer)
 {
     if (peer->have_link) {
         if (peer->is_relay) {
@@ -1734,7 +2465,49 @@ void peer_cleanup_connections (struct peer_data *peer)
         }
         peer_free_link(peer);
     }
+    
+    ASSERT(!peer->have_link)
+    ASSERT(!peer->is_relay)
+}
+
+void peer_update_flows (struct peer_data *peer)
+{
+    // use the link once it's up; while it's coming up, use a relay if we
+    // have one, else send through the link anyway
+    DataProtoSink *sink = NULL;
+    if (peer->have_link && (peer->link_up || !peer->relaying_peer)) {
+        sink = &peer->send_dp;
+    }
     else if (peer->relaying_peer) {
+        sink = &peer->relaying_peer->send_dp;
+    }
+    
+    if (sink == peer->flows_sink) {
+        return;
+    }
+    
+    // detach local flows
+    if (peer->flows_sink) {
+        for (int i = 0; i < num_device_queues; i++) {
+            DataProtoFlow_Detach(&peer->local_dpflows[i]);
+        }
+    }
+    
+    // attach local flows
+    if (sink) {
+        for (int i = 0; i < num_device_queues; i++) {
+            DataProtoFlow_Attach(&peer->local_dpflows[i], sink);
+        }
+    }
+    
+    peer->flows_sink = sink;
+}
+
+void peer_cleanup_connections (struct peer_data *peer)
+{
+    peer_cleanup_link(peer);
+    
+    if (peer->relaying_peer) {
         peer_free_relaying(peer);
     }
     else if (peer->waiting_relay) {
@@ -1745,11 +2518,13 @@ void peer_cleanup_connections (struct peer_data *peer)
     ASSERT(!peer->relaying_peer)
     ASSERT(!peer->waiting_relay)
     ASSERT(!peer->is_relay)
+    ASSERT(!peer->flows_sink)
 }
 
 void peer_enable_relay_provider (struct peer_data *peer)
 {
     ASSERT(peer->have_link)
+    ASSERT(peer->link_up)
     ASSERT(!peer->is_relay)
     
     ASSERT(!peer->relaying_peer)
@@ -1802,7 +2577,7 @@ void peer_disable_relay_provider (struct peer_data *peer)
 void peer_install_relaying (struct peer_data *peer, struct peer_data *relay)
 {
     ASSERT(!peer->relaying_peer)
-    ASSERT(!peer->have_link)
+    ASSERT(!peer->have_link || !peer->link_up)
     ASSERT(!peer->waiting_relay)
     ASSERT(relay->is_relay)
     
@@ -1814,18 +2589,17 @@ void peer_install_relaying (struct peer_data *peer, struct peer_data *relay)
     // add to relay's users list
     LinkedList1_Append(&relay->relay_users, &peer->relaying_list_node);
     
-    // attach local flow to relay
-    DataProtoFlow_Attach(&peer->local_dpflow, &relay->send_dp);
-    
     // set relaying
     peer->relaying_peer = relay;
+    
+    // send through the relay
+    peer_update_flows(peer);
 }
 
 void peer_free_relaying (struct peer_data *peer)
 {
     ASSERT(peer->relaying_peer)
     
-    ASSERT(!peer->have_link)
     ASSERT(!peer->waiting_relay)
     
     struct peer_data *relay = peer->relaying_peer;
@@ -1834,30 +2608,28 @@ void peer_free_relaying (struct peer_data *peer)
     
     peer_log(peer, BLOG_INFO, "uninstalling relaying through %d", (int)relay->id);
     
-    // detach local flow from relay
-    DataProtoFlow_Detach(&peer->local_dpflow);
+    // set not relaying
+    peer->relaying_peer = NULL;
+    
+    // move local flows off the relay
+    peer_update_flows(peer);
     
     // remove from relay's users list
     LinkedList1_Remove(&relay->relay_users, &peer->relaying_list_node);
-    
-    // set not relaying
-    peer->relaying_peer = NULL;
 }
 
 void peer_need_relay (struct peer_data *peer)
 {
     ASSERT(!peer->is_relay)
     
-    if (peer->waiting_relay) {
-        // already waiting for relay, do nothing
-        return;
-    }
-    
+    // give up on the link
     if (peer->have_link) {
         peer_free_link(peer);
     }
-    else if (peer->relaying_peer) {
-        peer_free_relaying(peer);
+    
+    if (peer->relaying_peer || peer->waiting_relay) {
+        // already relaying or waiting for relay, do nothing
+        return;
     }
     
     // register the peer as needing a relay
@@ -1870,7 +2642,7 @@ void peer_need_relay (struct peer_data *peer)
 void peer_register_need_relay (struct peer_data *peer)
 {
     ASSERT(!peer->waiting_relay)
-    ASSERT(!peer->have_link)
+    ASSERT(!peer->have_link || !peer->link_up)
     ASSERT(!peer->relaying_peer)
     
     ASSERT(!peer->is_relay)
@@ -1886,7 +2658,6 @@ void peer_unregister_need_relay (struct peer_data *peer)
 {
     ASSERT(peer->waiting_relay)
     
-    ASSERT(!peer->have_link)
     ASSERT(!peer->relaying_peer)
     ASSERT(!peer->is_relay)
     
@@ -1901,10 +2672,14 @@ void peer_reset (struct peer_data *peer)
 {
     peer_log(peer, BLOG_NOTICE, "resetting");
     
-    // cleanup connections
-    peer_cleanup_connections(peer);
+    // free the link, but keep traffic going through a relay while we retry
+    peer_cleanup_link(peer);
+    peer_need_relay(peer);
     
     if (peer_am_master(peer)) {
+        // the cached address did not get us a link; try addresses in order from now on
+        peer->cached_addr_index = -1;
+        
         // if we're the master, schedule retry
         BReactor_SetTimer(&ss, &peer->reset_timer);
     } else {
@@ -2056,13 +2831,13 @@ void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
     
     // read additonal parameters
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        if (SPPROTO_HAVE_KEY(sp_params)) {
             int key_len;
             if (!msg_youconnectParser_Getkey(&parser, &key, &key_len)) {
                 peer_log(peer, BLOG_WARNING, "msg_youconnect: no key");
                 return;
             }
-            if (key_len != BEncryption_cipher_key_size(sp_params.encryption_mode)) {
+            if (key_len != spproto_key_size(sp_params)) {
                 peer_log(peer, BLOG_WARNING, "msg_youconnect: wrong key size");
                 return;
             }
@@ -2295,6 +3070,9 @@ void peer_start_binding (struct peer_data *peer)
     peer->binding = 1;
     peer->binding_addrpos = 0;
     
+    // start with the address that last worked, if any, then continue in order
+    peer->binding_addrstart = (peer->cached_addr_index >= 0 ? peer->cached_addr_index : 0);
+    
     peer_bind(peer);
 }
 
@@ -2305,15 +3083,17 @@ void peer_bind (struct peer_data *peer)
     ASSERT(peer->binding_addrpos <= num_bind_addrs)
     
     while (peer->binding_addrpos < num_bind_addrs) {
+        int addr_index = (peer->binding_addrstart + peer->binding_addrpos) % num_bind_addrs;
+        
         // if there are no external addresses, skip bind address
-        if (bind_addrs[peer->binding_addrpos].num_ext_addrs == 0) {
+        if (bind_addrs[addr_index].num_ext_addrs == 0) {
             peer->binding_addrpos++;
             continue;
         }
         
         // try to bind
         int cont;
-        peer_bind_one_address(peer, peer->binding_addrpos, &cont);
+        peer_bind_one_address(peer, addr_index, &cont);
         
         // increment address counter
         peer->binding_addrpos++;
@@ -2346,7 +3126,7 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
     ASSERT(bind_addrs[addr_index].num_ext_addrs > 0)
     
     // get a fresh link
-    peer_cleanup_connections(peer);
+    peer_cleanup_link(peer);
     if (!peer_init_link(peer)) {
         peer_log(peer, BLOG_ERROR, "cannot get link");
         *cont = 0;
@@ -2373,11 +3153,11 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
             return;
         }
         
-        uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+        uint8_t key[SPPROTO_MAX_KEY_SIZE];
         
         // generate and set encryption key
-        if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-            BRandom_randomize(key, BEncryption_cipher_key_size(sp_params.encryption_mode));
+        if (SPPROTO_HAVE_KEY(sp_params)) {
+            BRandom_randomize(key, spproto_key_size(sp_params));
             DatagramPeerIO_SetEncryptionKey(&peer->pio.udp.pio, key);
         }
         
@@ -2399,13 +3179,16 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
     
     peer_log(peer, BLOG_NOTICE, "bound to address number %d", addr_index);
     
+    // remember address, so that it can be cached once the link is up
+    peer->bound_addr_index = addr_index;
+    
     *cont = 0;
 }
 
 void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key, uint64_t password)
 {
     // get a fresh link
-    peer_cleanup_connections(peer);
+    peer_cleanup_link(peer);
     if (!peer_init_link(peer)) {
         peer_log(peer, BLOG_ERROR, "cannot get link");
         peer_reset(peer);
@@ -2421,7 +3204,7 @@ void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key,
         }
         
         // set encryption key
-        if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        if (SPPROTO_HAVE_KEY(sp_params)) {
             DatagramPeerIO_SetEncryptionKey(&peer->pio.udp.pio, encryption_key);
         }
         
@@ -2517,8 +3300,8 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     
     // remember encryption key size
     int key_size = 0; // to remove warning
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-        key_size = BEncryption_cipher_key_size(sp_params.encryption_mode);
+    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_KEY(sp_params)) {
+        key_size = spproto_key_size(sp_params);
     }
     
     // calculate message length ..
@@ -2533,7 +3316,7 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     }
     
     // encryption key
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_KEY(sp_params)) {
         msg_len += msg_youconnect_SIZEkey(key_size);
     }
     
@@ -2588,7 +3371,7 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     }
     
     // write encryption key
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_KEY(sp_params)) {
         uint8_t *key_dst = msg_youconnectWriter_Addkey(&writer, key_size);
         memcpy(key_dst, enckey, key_size);
     }
@@ -2627,13 +3410,29 @@ void peer_dataproto_handler (struct peer_data *peer, int up)
 {
     ASSERT(peer->have_link)
     
+    peer->link_up = up;
+    
     if (up) {
         peer_log(peer, BLOG_INFO, "up");
         
+        // the link works, stop relaying; this moves local flows to the link
+        if (peer->relaying_peer) {
+            peer_free_relaying(peer);
+        }
+        else if (peer->waiting_relay) {
+            peer_unregister_need_relay(peer);
+        }
+        ASSERT(peer->flows_sink == &peer->send_dp)
+        
         // if it can be a relay provided, enable it
         if ((peer->flags & SCID_NEWCLIENT_FLAG_RELAY_SERVER) && !peer->is_relay) {
             peer_enable_relay_provider(peer);
         }
+        
+        // remember the bind address that got us the link
+        if (options.link_cache_file && peer->bound_addr_index >= 0) {
+            link_cache_update(peer);
+        }
     } else {
         peer_log(peer, BLOG_INFO, "down");
         
@@ -2641,19 +3440,18 @@ void peer_dataproto_handler (struct peer_data *peer, int up)
         if (peer->is_relay) {
             peer_disable_relay_provider(peer);
         }
+        
+        // fall back to a relay until the link comes back up
+        if (!peer->relaying_peer && !peer->waiting_relay) {
+            peer_register_need_relay(peer);
+            assign_relays();
+        }
     }
 }
 
 struct peer_data * find_peer_by_id (peerid_t id)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&peers); node; node = LinkedList1Node_Next(node)) {
-        struct peer_data *peer = UPPER_OBJECT(node, struct peer_data, list_node);
-        if (peer->id == id) {
-            return peer;
-        }
-    }
-    
-    return NULL;
+    return (struct peer_data *)PeerTable_Get(&peers_table, id);
 }
 
 void device_error_handler (void *unused)
@@ -2663,11 +3461,18 @@ void device_error_handler (void *unused)
     terminate();
 }
 
-void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
+void device_dpsource_handler (struct device_queue *q, const uint8_t *frame, int frame_len)
 {
     ASSERT(frame_len >= 0)
     ASSERT(frame_len <= device_mtu)
     
+    // route through the flows of the queue the frame came from, so that
+    // frames of each queue keep their order
+    int queue_index = q - device_queues;
+    
+    BMetric_Add(&metric_device_frames_in, 1);
+    BMetric_Add(&metric_device_bytes_in, frame_len);
+    
     // give frame to decider
     FrameDecider_AnalyzeAndDecide(&frame_decider, frame, frame_len);
     
@@ -2676,11 +3481,78 @@ void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
     while (decider_peer) {
         FrameDeciderPeer *next = FrameDecider_NextDestination(&frame_decider);
         struct peer_data *peer = UPPER_OBJECT(decider_peer, struct peer_data, decider_peer);
-        DataProtoFlow_Route(&peer->local_dpflow, !!next);
+        DataProtoFlow_Route(&peer->local_dpflows[queue_index], !!next);
         decider_peer = next;
     }
 }
 
+void device_output_func (BTap *tap, uint8_t *frame, int frame_len)
+{
+    ASSERT(frame_len >= 0)
+    ASSERT(frame_len <= device_mtu)
+    
+    BMetric_Add(&metric_device_frames_out, 1);
+    BMetric_Add(&metric_device_bytes_out, frame_len);
+    
+    BTap_Send(tap, frame, frame_len);
+}
+
+int device_dpsource_classifier (void *unused, const uint8_t *frame, int frame_len)
+{
+    ASSERT(frame_len >= 0)
+    ASSERT(frame_len <= device_mtu)
+    
+    // small frames are low-latency
+    if (options.latency_max_size >= 0 && frame_len <= options.latency_max_size) {
+        return 1;
+    }
+    
+    if (!options.latency_dscp_mask) {
+        return 0;
+    }
+    
+    // otherwise look at the DSCP of IP packets
+    struct ethernet_header eh;
+    if (frame_len < sizeof(eh)) {
+        return 0;
+    }
+    memcpy(&eh, frame, sizeof(eh));
+    frame += sizeof(eh);
+    frame_len -= sizeof(eh);
+    
+    int dscp;
+    switch (ntoh16(eh.type)) {
+        case ETHERTYPE_IPV4: {
+            struct ipv4_header ipv4;
+            if (frame_len < sizeof(ipv4)) {
+                return 0;
+            }
+            memcpy(&ipv4, frame, sizeof(ipv4));
+            if (IPV4_GET_VERSION(ipv4) != 4) {
+                return 0;
+            }
+            dscp = ntoh8(ipv4.ds) >> 2;
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            struct ipv6_header ipv6;
+            if (frame_len < sizeof(ipv6)) {
+                return 0;
+            }
+            memcpy(&ipv6, frame, sizeof(ipv6));
+            if ((ntoh8(ipv6.version4_tc4) >> 4) != 6) {
+                return 0;
+            }
+            dscp = ((ntoh8(ipv6.version4_tc4) & 0x0F) << 2) | (ntoh8(ipv6.tc4_fl4) >> 6);
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    return !!(options.latency_dscp_mask & ((uint64_t)1 << dscp));
+}
+
 void assign_relays (void)
 {
     LinkedList1Node *list_node;
@@ -2689,7 +3561,7 @@ void assign_relays (void)
         ASSERT(peer->waiting_relay)
         
         ASSERT(!peer->relaying_peer)
-        ASSERT(!peer->have_link)
+        ASSERT(!peer->have_link || !peer->link_up)
         
         // get a relay
         LinkedList1Node *list_node2 = LinkedList1_GetFirst(&relays);
@@ -2995,3 +3867,291 @@ void server_flow_disconnect (struct server_flow *flow)
     // set not connected
     flow->connected = 0;
 }
+
+void write_file_replace (const char *file, int (*write_func) (FILE *f))
+{
+    // build temporary file name
+    char *tmp_file = concat_strings(2, file, ".tmp");
+    if (!tmp_file) {
+        BLog(BLOG_ERROR, "%s: concat_strings failed", file);
+        return;
+    }
+    
+    // write the temporary file
+    FILE *f = fopen(tmp_file, "w");
+    if (!f) {
+        BLog(BLOG_ERROR, "failed to open %s", tmp_file);
+        goto out;
+    }
+    int res = write_func(f);
+    if (fclose(f) != 0 || !res) {
+        BLog(BLOG_ERROR, "failed to write %s", tmp_file);
+        remove(tmp_file);
+        goto out;
+    }
+    
+    // replace the file, so that readers never see a partial one
+    #ifdef BADVPN_USE_WINAPI
+    remove(file);
+    #endif
+    if (rename(tmp_file, file) != 0) {
+        BLog(BLOG_ERROR, "failed to rename %s", tmp_file);
+        remove(tmp_file);
+    }
+    
+out:
+    free(tmp_file);
+}
+
+void stats_timer_handler (void *unused)
+{
+    // restart timer
+    BReactor_SetTimer(&ss, &stats_timer);
+    
+    write_file_replace(options.stats_file, stats_write);
+    
+    #ifdef BADVPN_FLOW_STATS
+    // write flow graph next to the statistics
+    char *dot_file = concat_strings(2, options.stats_file, ".dot");
+    if (!dot_file) {
+        BLog(BLOG_ERROR, "stats: concat_strings failed");
+        return;
+    }
+    write_file_replace(dot_file, FlowStats_WriteDot);
+    free(dot_file);
+    #endif
+}
+
+int stats_write (FILE *f)
+{
+    fprintf(f, "# "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" stats v1\n");
+    fprintf(f, "time %"PRIu64"\n", (uint64_t)time(NULL));
+    
+    // write peers
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&peers); node; node = LinkedList1Node_Next(node)) {
+        struct peer_data *peer = UPPER_OBJECT(node, struct peer_data, list_node);
+        stats_write_peer(f, peer);
+    }
+    
+    // write flows we are relaying for other peers
+    DPRelayRouter_GetFlowStats(&device_output_dprd.relay_router, (DPRelayRouter_stats_handler)stats_relay_flow_handler, f);
+    
+    return !ferror(f);
+}
+
+void stats_write_peer (FILE *f, struct peer_data *peer)
+{
+    // determine how frames to the peer are sent
+    const char *link;
+    if (peer->have_link && peer->flows_sink == &peer->send_dp) {
+        link = (options.transport_mode == TRANSPORT_MODE_UDP ? "udp" : "tcp");
+    } else if (peer->relaying_peer) {
+        link = "relay";
+    } else {
+        link = "none";
+    }
+    
+    // sum the counters of the local flows of all device queues
+    struct DataProtoFlow_stats tx = {0, 0, 0};
+    for (int i = 0; i < num_device_queues; i++) {
+        struct DataProtoFlow_stats flow_stats;
+        DataProtoFlow_GetStats(&peer->local_dpflows[i], &flow_stats);
+        tx.frames_routed += flow_stats.frames_routed;
+        tx.frames_dropped += flow_stats.frames_dropped;
+        tx.frames_aqm_dropped += flow_stats.frames_aqm_dropped;
+    }
+    
+    struct DPReceivePeer_stats rx;
+    DPReceivePeer_GetStats(&peer->receive_peer, &rx);
+    
+    fprintf(f, "peer id=%d link=%s tx_frames=%"PRIu64" tx_dropped=%"PRIu64" tx_aqm_dropped=%"PRIu64" rx_packets=%"PRIu64" rx_bytes=%"PRIu64" rx_device=%"PRIu64" rx_relayed=%"PRIu64" rx_invalid=%"PRIu64,
+            (int)peer->id, link, tx.frames_routed, tx.frames_dropped, tx.frames_aqm_dropped, rx.packets, rx.bytes, rx.frames_local, rx.frames_relayed, rx.packets_invalid);
+    
+    if (peer->have_link) {
+        struct DataProtoSink_stats sink_stats;
+        DataProtoSink_GetStats(&peer->send_dp, &sink_stats);
+        fprintf(f, " up=%d tx_packets=%"PRIu64" tx_bytes=%"PRIu64, sink_stats.up, sink_stats.packets_sent, sink_stats.bytes_sent);
+        fprintf(f, " rtt=%d rtt_var=%d keepalive_interval=%d probes=%d", sink_stats.rtt, sink_stats.rtt_var, sink_stats.keepalive_interval, sink_stats.probes);
+        if (options.peer_compression) {
+            fprintf(f, " tx_compressed=%"PRIu64" tx_bytes_saved=%"PRIu64, sink_stats.packets_compressed, sink_stats.bytes_saved);
+        }
+        
+        if (options.transport_mode == TRANSPORT_MODE_UDP) {
+            struct FragmentProtoAssembler_stats frag_stats;
+            DatagramPeerIO_GetAssemblerStats(&peer->pio.udp.pio, &frag_stats);
+            struct SPProtoDecoder_stats dec_stats;
+            DatagramPeerIO_GetDecoderStats(&peer->pio.udp.pio, &dec_stats);
+            fprintf(f, " decode_ok=%"PRIu64" decode_failed=%"PRIu64" frag_completed=%"PRIu64" frag_evicted=%"PRIu64" frag_timed_out=%"PRIu64" frag_late=%"PRIu64" frag_window=%d",
+                    dec_stats.packets_decoded, dec_stats.packets_failed, frag_stats.frames_completed, frag_stats.frames_evicted, frag_stats.frames_timed_out, frag_stats.chunks_late, frag_stats.num_frames);
+        }
+    }
+    
+    fprintf(f, "\n");
+}
+
+void stats_relay_flow_handler (FILE *f, peerid_t source_id, peerid_t dest_id, const struct DPRelay_flow_stats *stats)
+{
+    fprintf(f, "relay src=%d dst=%d frames=%"PRIu64" bytes=%"PRIu64" dropped=%"PRIu64"\n",
+            (int)source_id, (int)dest_id, stats->frames, stats->bytes, stats->dropped);
+}
+
+void link_cache_load (void)
+{
+    ASSERT(options.link_cache_file)
+    
+    FILE *f = fopen(options.link_cache_file, "r");
+    if (!f) {
+        BLog(BLOG_INFO, "link cache: cannot open %s, starting empty", options.link_cache_file);
+        return;
+    }
+    
+    char line[LINK_CACHE_MAX_LINE];
+    int num_entries = 0;
+    
+    while (fgets(line, sizeof(line), f)) {
+        // strip newline; skip lines that did not fit
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') {
+            BLog(BLOG_WARNING, "link cache: line too long");
+            break;
+        }
+        line[--len] = '\0';
+        
+        // skip comments
+        if (line[0] == '#') {
+            continue;
+        }
+        
+        // parse "bind <index> <common name>"
+        int bind_addr_index;
+        int name_pos = -1;
+        if (sscanf(line, "bind %d %n", &bind_addr_index, &name_pos) != 1 || name_pos < 0 || line[name_pos] == '\0' || bind_addr_index < 0) {
+            BLog(BLOG_WARNING, "link cache: bad line, ignoring");
+            continue;
+        }
+        const char *common_name = line + name_pos;
+        
+        // ignore duplicates
+        if (link_cache_find(common_name)) {
+            continue;
+        }
+        
+        struct link_cache_entry *entry = (struct link_cache_entry *)malloc(sizeof(*entry));
+        if (!entry) {
+            BLog(BLOG_ERROR, "link cache: malloc failed");
+            break;
+        }
+        if (!(entry->common_name = strdup(common_name))) {
+            BLog(BLOG_ERROR, "link cache: strdup failed");
+            free(entry);
+            break;
+        }
+        entry->bind_addr_index = bind_addr_index;
+        LinkedList1_Append(&link_cache, &entry->list_node);
+        num_entries++;
+    }
+    
+    fclose(f);
+    
+    BLog(BLOG_INFO, "link cache: loaded %d entries", num_entries);
+}
+
+void link_cache_free (void)
+{
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&link_cache)) {
+        struct link_cache_entry *entry = UPPER_OBJECT(node, struct link_cache_entry, list_node);
+        LinkedList1_Remove(&link_cache, &entry->list_node);
+        free(entry->common_name);
+        free(entry);
+    }
+}
+
+struct link_cache_entry * link_cache_find (const char *common_name)
+{
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&link_cache); node; node = LinkedList1Node_Next(node)) {
+        struct link_cache_entry *entry = UPPER_OBJECT(node, struct link_cache_entry, list_node);
+        if (!strcmp(entry->common_name, common_name)) {
+            return entry;
+        }
+    }
+    
+    return NULL;
+}
+
+void link_cache_update (struct peer_data *peer)
+{
+    ASSERT(options.link_cache_file)
+    ASSERT(peer->bound_addr_index >= 0)
+    
+    // only peers with a name can be recognized after a restart;
+    // skip names that would not fit on a line
+    if (!peer->common_name || strchr(peer->common_name, '\n') || strlen(peer->common_name) > LINK_CACHE_MAX_LINE - 32) {
+        return;
+    }
+    
+    struct link_cache_entry *entry = link_cache_find(peer->common_name);
+    if (entry) {
+        if (entry->bind_addr_index == peer->bound_addr_index) {
+            return;
+        }
+    } else {
+        if (!(entry = (struct link_cache_entry *)malloc(sizeof(*entry)))) {
+            peer_log(peer, BLOG_ERROR, "link cache: malloc failed");
+            return;
+        }
+        if (!(entry->common_name = strdup(peer->common_name))) {
+            peer_log(peer, BLOG_ERROR, "link cache: strdup failed");
+            free(entry);
+            return;
+        }
+        LinkedList1_Append(&link_cache, &entry->list_node);
+    }
+    
+    entry->bind_addr_index = peer->bound_addr_index;
+    
+    // links come up rarely, so write the cache out right away
+    write_file_replace(options.link_cache_file, link_cache_write);
+}
+
+int link_cache_write (FILE *f)
+{
+    fprintf(f, "# "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" link cache v1\n");
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&link_cache); node; node = LinkedList1Node_Next(node)) {
+        struct link_cache_entry *entry = UPPER_OBJECT(node, struct link_cache_entry, list_node);
+        fprintf(f, "bind %d %s\n", entry->bind_addr_index, entry->common_name);
+    }
+    
+    return !ferror(f);
+}
+
+void init_metrics (void)
+{
+    BMetric_InitGaugeFunc(&metric_peers, "badvpn_client_peers", NULL, "Peers announced by the server.", metric_peers_func, NULL);
+    BMetric_InitGaugeFunc(&metric_server_ready, "badvpn_client_server_ready", NULL, "Whether the connection to the server is established.", metric_server_ready_func, NULL);
+    BMetric_InitCounter(&metric_device_frames_in, "badvpn_client_device_frames_total", "direction=\"in\"", "Frames read from or written to the TAP device.");
+    BMetric_InitCounter(&metric_device_frames_out, "badvpn_client_device_frames_total", "direction=\"out\"", "Frames read from or written to the TAP device.");
+    BMetric_InitCounter(&metric_device_bytes_in, "badvpn_client_device_bytes_total", "direction=\"in\"", "Bytes read from or written to the TAP device.");
+    BMetric_InitCounter(&metric_device_bytes_out, "badvpn_client_device_bytes_total", "direction=\"out\"", "Bytes read from or written to the TAP device.");
+}
+
+void free_metrics (void)
+{
+    BMetric_Free(&metric_device_bytes_out);
+    BMetric_Free(&metric_device_bytes_in);
+    BMetric_Free(&metric_device_frames_out);
+    BMetric_Free(&metric_device_frames_in);
+    BMetric_Free(&metric_server_ready);
+    BMetric_Free(&metric_peers);
+}
+
+int64_t metric_peers_func (void *unused)
+{
+    return num_peers;
+}
+
+int64_t metric_server_ready_func (void *unused)
+{
+    return server_ready;
+}
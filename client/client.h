@@ -32,13 +32,16 @@
 
 #include <protocol/scproto.h>
 #include <structure/LinkedList1.h>
+#include <tuntap/BTap.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/SinglePacketBuffer.h>
 #include <flow/PacketRecvConnector.h>
+#include <flowextra/PacketPassRateLimiter.h>
 #include <client/DatagramPeerIO.h>
 #include <client/StreamPeerIO.h>
 #include <client/DataProto.h>
 #include <client/DPReceive.h>
+#include <client/PeerTable.h>
 #include <client/FrameDecider.h>
 #include <client/PeerChat.h>
 #include <client/SinglePacketSource.h>
@@ -54,6 +57,17 @@
 // maximum UDP payload size
 #define CLIENT_UDP_MTU 1472
 
+// maximum number of TAP device queues
+#define CLIENT_MAX_DEVICE_QUEUES 16
+
+// default number of outstanding reads and writes on the TAP device on Windows
+// (reads are read-ahead frames elsewhere, which is off by default there)
+#ifdef BADVPN_USE_WINAPI
+#define DEFAULT_DEVICE_IO_DEPTH 16
+#else
+#define DEFAULT_DEVICE_IO_DEPTH 1
+#endif
+
 // maximum number of pending TCP PasswordListener clients
 #define TCP_MAX_PASSWORD_LISTENER_CLIENTS 50
 
@@ -67,14 +81,27 @@
 #define PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY 0
 // value related to how much out-of-order input we tolerate (see FragmentProtoAssembler num_frames argument)
 #define PEER_UDP_ASSEMBLER_NUM_FRAMES 4
+
+// number of UMEM frames of the AF_XDP socket for peer UDP transport
+#define PEER_UDP_XDP_NUM_FRAMES 4096
+// maximum number of frames the reassembly window may grow to (see FragmentProtoAssembler max_frames argument)
+#define PEER_DEFAULT_UDP_ASSEMBLER_MAX_FRAMES 64
 // socket send buffer (SO_SNDBUF) for peer TCP connections, <=0 to not set
 #define PEER_DEFAULT_TCP_SOCKET_SNDBUF 1048576
 // keep-alive packet interval for p2p communication
 #define PEER_KEEPALIVE_INTERVAL 10000
 // keep-alive receive timer for p2p communication (after how long to consider the link down)
 #define PEER_KEEPALIVE_RECEIVE_TIMER 22000
+// longest keep-alive interval while the link is idle; below common NAT mapping timeouts
+#define PEER_KEEPALIVE_MAX_INTERVAL 25000
+// time without receiving from a peer we are sending to, after which to probe the link
+#define PEER_KEEPALIVE_SUSPECT_TIME 1000
+// unanswered probes after which to consider the link down
+#define PEER_KEEPALIVE_PROBES 3
 // size of frame send buffer, in number of frames
 #define PEER_DEFAULT_SEND_BUFFER_SIZE 32
+// CoDel interval for frame send buffers, in milliseconds
+#define PEER_DEFAULT_CODEL_INTERVAL 100
 // size of frame send buffer for relayed packets, in number of frames
 #define PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE 32
 // time after an unused relay flow is freed (-1 for never)
@@ -82,6 +109,12 @@
 // retry time
 #define PEER_RETRY_TIME 5000
 
+// default interval for writing statistics (see --stats-file)
+#define DEFAULT_STATS_INTERVAL 10000
+
+// longest line in the link cache file (see --link-cache-file)
+#define LINK_CACHE_MAX_LINE 512
+
 // for how long a peer can send no Membership Reports for a group
 // before the peer and group are disassociated
 #define DEFAULT_IGMP_GROUP_MEMBERSHIP_INTERVAL 260000
@@ -98,6 +131,17 @@
 
 //#define SIMULATE_PEER_OUT_OF_BUFFER 70
 
+struct device_queue {
+    BTap tap;
+    DataProtoSource dpsource;
+};
+
+struct link_cache_entry {
+    char *common_name;
+    int bind_addr_index;
+    LinkedList1Node list_node;
+};
+
 struct server_flow {
     PacketPassFairQueueFlow qflow;
     SinglePacketBuffer encoder_buffer;
@@ -133,8 +177,8 @@ struct peer_data {
     uint8_t resetpeer_packet[sizeof(struct packetproto_header) + sizeof(struct sc_header) + sizeof(struct sc_client_resetpeer)];
     SinglePacketSource resetpeer_source;
     
-    // local flow
-    DataProtoFlow local_dpflow;
+    // local flows, one per device queue
+    DataProtoFlow local_dpflows[CLIENT_MAX_DEVICE_QUEUES];
     
     // frame decider peer
     FrameDeciderPeer decider_peer;
@@ -145,6 +189,13 @@ struct peer_data {
     // flag if link objects are initialized
     int have_link;
     
+    // flag if the link reports up, defined only if have_link
+    int link_up;
+    
+    // sink the local flows are attached to, or NULL; this is the link's
+    // sink once it is up, or the relay's while the link is coming up
+    DataProtoSink *flows_sink;
+    
     // receive receiver
     DPReceiveReceiver receive_receiver;
     
@@ -167,6 +218,7 @@ struct peer_data {
     
     // link sending
     DataProtoSink send_dp;
+    PacketPassRateLimiter send_limiter; // only with --peer-send-rate
     
     // relaying objects
     struct peer_data *relaying_peer; // peer through which we are relaying, or NULL
@@ -187,6 +239,13 @@ struct peer_data {
     // binding state
     int binding;
     int binding_addrpos;
+    int binding_addrstart;
+    
+    // bind address to try first, from the link cache, or -1
+    int cached_addr_index;
+    
+    // bind address of the current link, or -1 if we did not bind it
+    int bound_addr_index;
     
     // peers linked list node
     LinkedList1Node list_node;
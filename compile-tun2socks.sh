@@ -76,6 +76,7 @@ flow/PacketProtoFlow.c
 flow/PacketPassFairQueue.c
 flow/PacketProtoEncoder.c
 flow/PacketProtoDecoder.c
+flow/PacketProtoBatcher.c
 socksclient/BSocksClient.c
 tuntap/BTap.c
 lwip/src/core/udp.c
@@ -108,9 +109,11 @@ base/DebugObject.c
 base/BLog.c
 base/BPending.c
 flowextra/PacketPassInactivityMonitor.c
+flowextra/PacketPassRateLimiter.c
 tun2socks/SocksUdpGwClient.c
 udpgw_client/UdpGwClient.c
 socks_udp_client/SocksUdpClient.c
+dnscache/DnsCache.c
 "
 
 set -e
@@ -66,9 +66,11 @@ flow/PacketProtoFlow.c
 flow/PacketPassFairQueue.c
 flow/PacketProtoEncoder.c
 flow/PacketProtoDecoder.c
+flow/PacketProtoBatcher.c
 base/DebugObject.c
 base/BLog.c
 base/BPending.c
+dnscache/DnsCache.c
 udpgw/udpgw.c
 "
 
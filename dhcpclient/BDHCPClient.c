@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -43,6 +44,10 @@
 #include <misc/udp_proto.h>
 #include <misc/dhcp_proto.h>
 #include <misc/get_iface_info.h>
+#include <misc/ipaddr.h>
+#include <misc/strdup.h>
+#include <misc/read_file.h>
+#include <misc/write_file.h>
 #include <base/BLog.h>
 
 #include <dhcpclient/BDHCPClient.h>
@@ -63,6 +68,40 @@ static const struct sock_filter dhcp_sock_filter[] = {
     BPF_STMT(BPF_RET + BPF_K, 0)                                  // ignore
 };
 
+static int read_lease_file (const char *file, uint32_t *out_addr)
+{
+    uint8_t *data;
+    size_t len;
+    if (!read_file(file, &data, &len)) {
+        return 0;
+    }
+    
+    // strip trailing newline and spaces
+    while (len > 0 && (data[len - 1] == '\n' || data[len - 1] == ' ')) {
+        len--;
+    }
+    
+    int res = ipaddr_parse_ipv4_addr(MemRef_Make((char *)data, len), out_addr);
+    free(data);
+    return res;
+}
+
+static void write_lease_file (BDHCPClient *o)
+{
+    ASSERT(o->lease_file)
+    
+    uint32_t addr;
+    BDHCPClientCore_GetClientIP(&o->dhcp, &addr);
+    
+    char str[IPADDR_PRINT_MAX + 1];
+    ipaddr_print_addr(addr, str);
+    strcat(str, "\n");
+    
+    if (!write_file(o->lease_file, MemRef_MakeCstr(str))) {
+        BLog(BLOG_WARNING, "failed to write lease file");
+    }
+}
+
 static void dgram_handler (BDHCPClient *o, int event)
 {
     DebugObject_Access(&o->d_obj);
@@ -82,6 +121,9 @@ static void dhcp_handler (BDHCPClient *o, int event)
         case BDHCPCLIENTCORE_EVENT_UP:
             ASSERT(!o->up)
             o->up = 1;
+            if (o->lease_file) {
+                write_lease_file(o);
+            }
             o->handler(o->user, BDHCPCLIENT_EVENT_UP);
             return;
             
@@ -223,6 +265,23 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
     core_opts.vendorclassid = opts.vendorclassid;
     core_opts.clientid = opts.clientid;
     core_opts.clientid_len = opts.clientid_len;
+    core_opts.rapid_commit = opts.rapid_commit;
+    core_opts.have_cached_addr = 0;
+    core_opts.cached_addr = 0;
+    
+    // start from the address of the last lease if we have it
+    o->lease_file = NULL;
+    if (opts.lease_file) {
+        if (!(o->lease_file = b_strdup(opts.lease_file))) {
+            BLog(BLOG_ERROR, "b_strdup failed");
+            goto fail4;
+        }
+        if (read_lease_file(o->lease_file, &core_opts.cached_addr)) {
+            core_opts.have_cached_addr = 1;
+        } else {
+            BLog(BLOG_INFO, "no cached lease");
+        }
+    }
     
     // auto-generate clientid from MAC if requested
     uint8_t mac_cid[7];
@@ -239,7 +298,7 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
                               (BDHCPClientCore_handler)dhcp_handler
     )) {
         BLog(BLOG_ERROR, "BDHCPClientCore_Init failed");
-        goto fail4;
+        goto fail5;
     }
     
     // set not up
@@ -249,6 +308,8 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail5:
+    free(o->lease_file);
 fail4:
     SinglePacketBuffer_Free(&o->recv_buffer);
 fail3:
@@ -274,6 +335,9 @@ void BDHCPClient_Free (BDHCPClient *o)
     // free dhcp
     BDHCPClientCore_Free(&o->dhcp);
     
+    // free lease file name
+    free(o->lease_file);
+    
     // free receiving
     SinglePacketBuffer_Free(&o->recv_buffer);
     DHCPIpUdpDecoder_Free(&o->recv_decoder);
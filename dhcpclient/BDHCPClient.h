@@ -62,6 +62,7 @@ typedef struct {
     DHCPIpUdpDecoder recv_decoder;
     PacketCopier recv_copier;
     BDHCPClientCore dhcp;
+    char *lease_file;
     int up;
     DebugError d_err;
     DebugObject d_obj;
@@ -73,6 +74,8 @@ struct BDHCPClient_opts {
     const uint8_t *clientid;
     size_t clientid_len;
     int auto_clientid;
+    int rapid_commit;
+    const char *lease_file;
 };
 
 int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opts opts, BReactor *reactor, BRandom2 *random2, BDHCPClient_handler handler, void *user);
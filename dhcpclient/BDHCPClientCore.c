@@ -29,6 +29,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include <misc/byteorder.h>
 #include <misc/minmax.h>
@@ -43,8 +44,11 @@
 
 #define RESET_TIMEOUT 4000
 #define REQUEST_TIMEOUT 3000
+#define DISCOVER_FIRST_TIMEOUT 250
+#define REQUEST_FIRST_TIMEOUT 250
 #define RENEW_REQUEST_TIMEOUT 20000
-#define MAX_REQUESTS 4
+#define MAX_REQUESTS 6
+#define MAX_REBOOT_ATTEMPTS 3
 #define RENEW_TIMEOUT(lease) ((btime_t)500 * (lease))
 #define XID_REUSE_MAX 8
 
@@ -55,6 +59,7 @@
 #define STATE_SENT_REQUEST 3
 #define STATE_FINISHED 4
 #define STATE_RENEWING 5
+#define STATE_SENT_REBOOT 6
 
 #define IP_UDP_HEADERS_SIZE 28
 
@@ -70,6 +75,19 @@ static void report_down (BDHCPClientCore *o)
     return;
 }
 
+// retransmission timeout which starts short and doubles up to a limit,
+// so that a lost first message does not cost seconds
+static btime_t backoff_timeout (btime_t first, btime_t max, int count)
+{
+    btime_t timeout = first;
+    while (count > 0 && timeout < max) {
+        timeout *= 2;
+        count--;
+    }
+    
+    return bmin_int64(timeout, max);
+}
+
 static void send_message (
     BDHCPClientCore *o,
     int type,
@@ -124,6 +142,14 @@ static void send_message (
         out += sizeof(oh) + sizeof(opt);
     }
     
+    if (type == DHCP_MESSAGE_TYPE_DISCOVER && o->rapid_commit) {
+        // rapid commit
+        oh.type = hton8(DHCP_OPTION_RAPID_COMMIT);
+        oh.len = hton8(0);
+        memcpy(out, &oh, sizeof(oh));
+        out += sizeof(oh);
+    }
+    
     if (have_dhcp_server_identifier) {
         // DHCP server identifier
         oh.type = hton8(DHCP_OPTION_DHCP_SERVER_IDENTIFIER);
@@ -203,6 +229,15 @@ static void send_handler_done (BDHCPClientCore *o)
     DebugObject_Access(&o->d_obj);
     
     o->sending = 0;
+    
+    // send discover which goes along an INIT-REBOOT request
+    if (o->send_discover_pending) {
+        o->send_discover_pending = 0;
+        
+        if (o->state == STATE_SENT_REBOOT || o->state == STATE_SENT_DISCOVER) {
+            send_message(o, DHCP_MESSAGE_TYPE_DISCOVER, o->xid, 0, 0, 0, 0);
+        }
+    }
 }
 
 static void recv_handler_done (BDHCPClientCore *o, int data_len)
@@ -274,6 +309,8 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
     int domain_name_servers_count = 0;
     uint32_t domain_name_servers[BDHCPCLIENTCORE_MAX_DOMAIN_NAME_SERVERS];
     
+    int have_rapid_commit = 0;
+    
     while (len > 0) {
         // padding option ?
         if (*pos == 0) {
@@ -384,6 +421,14 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
                 
                 domain_name_servers_count = i;
             } break;
+            
+            case DHCP_OPTION_RAPID_COMMIT: {
+                if (opt_len != 0) {
+                    return;
+                }
+                
+                have_rapid_commit = 1;
+            } break;
         }
     }
     
@@ -404,6 +449,19 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
     }
     
     if (dhcp_message_type == DHCP_MESSAGE_TYPE_NAK) {
+        if (o->state == STATE_SENT_REBOOT) {
+            // the server of the cached address is not known, so any server
+            // may refuse it
+            BLog(BLOG_INFO, "received NAK (in sent reboot)");
+            
+            // forget cached address
+            o->have_cached_addr = 0;
+            
+            // go on with the discover which was sent along
+            o->state = STATE_SENT_DISCOVER;
+            return;
+        }
+        
         if (o->state != STATE_SENT_REQUEST && o->state != STATE_FINISHED && o->state != STATE_RENEWING) {
             return;
         }
@@ -475,7 +533,9 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
         return;
     }
     
-    if (o->state == STATE_SENT_DISCOVER && dhcp_message_type == DHCP_MESSAGE_TYPE_OFFER) {
+    int in_discover = (o->state == STATE_SENT_DISCOVER || o->state == STATE_SENT_REBOOT);
+    
+    if (in_discover && dhcp_message_type == DHCP_MESSAGE_TYPE_OFFER) {
         BLog(BLOG_INFO, "received OFFER");
         
         // remember offer
@@ -489,7 +549,7 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
         BReactor_RemoveTimer(o->reactor, &o->reset_timer);
         
         // start request timer
-        BReactor_SetTimer(o->reactor, &o->request_timer);
+        BReactor_SetTimerAfter(o->reactor, &o->request_timer, backoff_timeout(REQUEST_FIRST_TIMEOUT, REQUEST_TIMEOUT, 0));
         
         // set state
         o->state = STATE_SENT_REQUEST;
@@ -497,17 +557,47 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
         // set request count
         o->request_count = 1;
     }
-    else if (o->state == STATE_SENT_REQUEST && dhcp_message_type == DHCP_MESSAGE_TYPE_ACK) {
-        if (header.yiaddr != o->offered.yiaddr) {
-            return;
-        }
-        
-        if (dhcp_server_identifier != o->offered.dhcp_server_identifier) {
-            return;
+    else if ((o->state == STATE_SENT_REQUEST && dhcp_message_type == DHCP_MESSAGE_TYPE_ACK) ||
+             (in_discover && dhcp_message_type == DHCP_MESSAGE_TYPE_ACK && (have_rapid_commit || o->state == STATE_SENT_REBOOT))
+    ) {
+        if (o->state == STATE_SENT_REQUEST) {
+            if (header.yiaddr != o->offered.yiaddr) {
+                return;
+            }
+            
+            if (dhcp_server_identifier != o->offered.dhcp_server_identifier) {
+                return;
+            }
+            
+            BLog(BLOG_INFO, "received ACK (in sent request)");
+            
+            // stop request timer
+            BReactor_RemoveTimer(o->reactor, &o->request_timer);
+        } else {
+            if (have_rapid_commit) {
+                // two-message exchange, only if we asked for it
+                if (!o->rapid_commit) {
+                    return;
+                }
+                
+                BLog(BLOG_INFO, "received ACK (rapid commit)");
+            } else {
+                // answer to the INIT-REBOOT request
+                if (header.yiaddr != o->cached_addr) {
+                    return;
+                }
+                
+                BLog(BLOG_INFO, "received ACK (in sent reboot)");
+            }
+            
+            // remember lease
+            o->offered.yiaddr = header.yiaddr;
+            o->offered.dhcp_server_identifier = dhcp_server_identifier;
+            
+            // stop reset timer
+            BReactor_RemoveTimer(o->reactor, &o->reset_timer);
         }
         
-        BLog(BLOG_INFO, "received ACK (in sent request)");
-        
         // remember stuff
         o->acked.ip_address_lease_time = ip_address_lease_time;
         o->acked.subnet_mask = subnet_mask;
@@ -519,9 +609,6 @@ static void recv_handler_done (BDHCPClientCore *o, int data_len)
         memcpy(o->acked.domain_name_servers, domain_name_servers, domain_name_servers_count * sizeof(uint32_t));
         o->func_getsendermac(o->user, o->acked.server_mac);
         
-        // stop request timer
-        BReactor_RemoveTimer(o->reactor, &o->request_timer);
-        
         // start renew timer
         BReactor_SetTimerAfter(o->reactor, &o->renew_timer, RENEW_TIMEOUT(o->acked.ip_address_lease_time));
         
@@ -578,24 +665,43 @@ static void start_process (BDHCPClientCore *o, int force_new_xid)
     // increment counter
     o->xid_reuse_counter++;
     
-    // send discover
-    send_message(o, DHCP_MESSAGE_TYPE_DISCOVER, o->xid, 0, 0, 0, 0);
+    if (o->have_cached_addr && o->discover_count < MAX_REBOOT_ATTEMPTS) {
+        // ask for the cached address with an INIT-REBOOT request, and discover
+        // in parallel in case the address cannot be had
+        send_message(o, DHCP_MESSAGE_TYPE_REQUEST, o->xid, 1, o->cached_addr, 0, 0);
+        o->send_discover_pending = 1;
+        
+        // set state
+        o->state = STATE_SENT_REBOOT;
+    } else {
+        // send discover
+        send_message(o, DHCP_MESSAGE_TYPE_DISCOVER, o->xid, 0, 0, 0, 0);
+        
+        // set state
+        o->state = STATE_SENT_DISCOVER;
+    }
     
     // set timer
-    BReactor_SetTimer(o->reactor, &o->reset_timer);
-    
-    // set state
-    o->state = STATE_SENT_DISCOVER;
+    BReactor_SetTimerAfter(o->reactor, &o->reset_timer, backoff_timeout(DISCOVER_FIRST_TIMEOUT, RESET_TIMEOUT, o->discover_count));
 }
 
 static void reset_timer_handler (BDHCPClientCore *o)
 {
-    ASSERT(o->state == STATE_RESETTING || o->state == STATE_SENT_DISCOVER)
+    ASSERT(o->state == STATE_RESETTING || o->state == STATE_SENT_DISCOVER || o->state == STATE_SENT_REBOOT)
     DebugObject_Access(&o->d_obj);
     
     BLog(BLOG_INFO, "reset timer");
     
-    start_process(o, (o->state == STATE_RESETTING));
+    int is_reset = (o->state == STATE_RESETTING);
+    
+    // count retransmissions, or start counting again
+    if (is_reset) {
+        o->discover_count = 0;
+    } else if (o->discover_count < INT_MAX) {
+        o->discover_count++;
+    }
+    
+    start_process(o, is_reset);
 }
 
 static void request_timer_handler (BDHCPClientCore *o)
@@ -609,6 +715,7 @@ static void request_timer_handler (BDHCPClientCore *o)
     if (o->request_count == MAX_REQUESTS) {
         BLog(BLOG_INFO, "request timer, aborting");
         
+        o->discover_count = 0;
         start_process(o, 0);
         return;
     }
@@ -619,7 +726,7 @@ static void request_timer_handler (BDHCPClientCore *o)
     send_message(o, DHCP_MESSAGE_TYPE_REQUEST, o->xid, 1, o->offered.yiaddr, 1, o->offered.dhcp_server_identifier);
     
     // start request timer
-    BReactor_SetTimer(o->reactor, &o->request_timer);
+    BReactor_SetTimerAfter(o->reactor, &o->request_timer, backoff_timeout(REQUEST_FIRST_TIMEOUT, REQUEST_TIMEOUT, o->request_count));
     
     // increment request count
     o->request_count++;
@@ -670,6 +777,7 @@ static void lease_timer_handler (BDHCPClientCore *o)
     BReactor_RemoveTimer(o->reactor, &o->renew_request_timer);
     
     // start again now
+    o->discover_count = 0;
     start_process(o, 1);
     
     // report to user
@@ -702,6 +810,9 @@ int BDHCPClientCore_Init (BDHCPClientCore *o, PacketPassInterface *send_if, Pack
     o->user = user;
     o->func_getsendermac = func_getsendermac;
     o->handler = handler;
+    o->rapid_commit = !!opts.rapid_commit;
+    o->have_cached_addr = !!opts.have_cached_addr;
+    o->cached_addr = opts.cached_addr;
     
     o->hostname = NULL;
     o->vendorclassid = NULL;
@@ -763,6 +874,7 @@ int BDHCPClientCore_Init (BDHCPClientCore *o, PacketPassInterface *send_if, Pack
     
     // set not sending
     o->sending = 0;
+    o->send_discover_pending = 0;
     
     // init timers
     BTimer_Init(&o->reset_timer, RESET_TIMEOUT, (BTimer_handler)reset_timer_handler, o);
@@ -775,6 +887,7 @@ int BDHCPClientCore_Init (BDHCPClientCore *o, PacketPassInterface *send_if, Pack
     PacketRecvInterface_Receiver_Recv(o->recv_if, (uint8_t *)o->recv_buf);
     
     // start
+    o->discover_count = 0;
     start_process(o, 1);
     
     DebugObject_Init(&o->d_obj);
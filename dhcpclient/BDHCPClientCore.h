@@ -56,6 +56,9 @@ struct BDHCPClientCore_opts {
     const char *vendorclassid;
     const uint8_t *clientid;
     size_t clientid_len;
+    int rapid_commit;
+    int have_cached_addr;
+    uint32_t cached_addr;
 };
 
 typedef struct {
@@ -67,6 +70,9 @@ typedef struct {
     void *user;
     BDHCPClientCore_func_getsendermac func_getsendermac;
     BDHCPClientCore_handler handler;
+    int rapid_commit;
+    int have_cached_addr;
+    uint32_t cached_addr;
     char *hostname;
     char *vendorclassid;
     uint8_t *clientid;
@@ -74,6 +80,7 @@ typedef struct {
     char *send_buf;
     char *recv_buf;
     int sending;
+    int send_discover_pending;
     BTimer reset_timer;
     BTimer request_timer;
     BTimer renew_timer;
@@ -81,6 +88,7 @@ typedef struct {
     BTimer lease_timer;
     int state;
     int request_count;
+    int discover_count;
     uint32_t xid;
     int xid_reuse_counter;
     struct {
@@ -0,0 +1,570 @@
+/**
+ * @file DnsCache.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+#include <misc/hashfun.h>
+#include <base/BLog.h>
+
+#include <dnscache/DnsCache.h>
+
+#include <generated/blog_channel_DnsCache.h>
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_impl.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_OPT 41
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+
+// key flags
+#define KEY_FLAG_RD 1
+#define KEY_FLAG_CD 2
+#define KEY_FLAG_EDNS 4
+#define KEY_FLAG_DO 8
+
+struct dns_info {
+    int is_response;
+    int opcode;
+    int truncated;
+    int rcode;
+    int ancount;
+    int nscount;
+    int name_len;
+    int key_flags;
+    int num_ttls; // -1 if there are too many records
+    int ttl_offsets[DNSCACHE_MAX_RRS];
+    uint32_t min_ttl;
+    int have_soa;
+    uint32_t soa_ttl;
+};
+
+static uint16_t read16 (const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t read32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t ttl_value (uint32_t ttl)
+{
+    // values with the high bit set are to be treated as zero (RFC 2181)
+    return (ttl > INT32_MAX) ? 0 : ttl;
+}
+
+static int skip_name (const uint8_t *data, int data_len, int pos)
+{
+    while (1) {
+        if (pos >= data_len) {
+            return -1;
+        }
+        uint8_t c = data[pos];
+        if ((c & 0xC0) == 0xC0) {
+            // compression pointer ends the name
+            return (pos + 2 > data_len) ? -1 : pos + 2;
+        }
+        if ((c & 0xC0)) {
+            return -1;
+        }
+        pos += 1 + c;
+        if (c == 0) {
+            return pos;
+        }
+    }
+}
+
+static int parse_message (const uint8_t *data, int data_len, struct dns_info *info)
+{
+    if (data_len < DNS_HEADER_SIZE) {
+        return 0;
+    }
+    
+    info->is_response = !!(data[2] & 0x80);
+    info->opcode = (data[2] >> 3) & 0xF;
+    info->truncated = !!(data[2] & 0x02);
+    info->rcode = data[3] & 0xF;
+    info->key_flags = ((data[2] & 0x01) ? KEY_FLAG_RD : 0) | ((data[3] & 0x10) ? KEY_FLAG_CD : 0);
+    
+    int qdcount = read16(data + 4);
+    info->ancount = read16(data + 6);
+    info->nscount = read16(data + 8);
+    int arcount = read16(data + 10);
+    
+    if (qdcount != 1) {
+        return 0;
+    }
+    
+    // parse question name; it must not be compressed
+    int pos = DNS_HEADER_SIZE;
+    while (1) {
+        if (pos >= data_len) {
+            return 0;
+        }
+        uint8_t c = data[pos];
+        if ((c & 0xC0)) {
+            return 0;
+        }
+        pos += 1 + c;
+        if (pos - DNS_HEADER_SIZE > DNSCACHE_NAME_MAX) {
+            return 0;
+        }
+        if (c == 0) {
+            break;
+        }
+    }
+    info->name_len = pos - DNS_HEADER_SIZE;
+    
+    // skip question type and class
+    if (data_len - pos < 4) {
+        return 0;
+    }
+    pos += 4;
+    
+    info->num_ttls = 0;
+    info->min_ttl = UINT32_MAX;
+    info->have_soa = 0;
+    
+    // parse resource records
+    int num_rrs = info->ancount + info->nscount + arcount;
+    for (int i = 0; i < num_rrs; i++) {
+        if ((pos = skip_name(data, data_len, pos)) < 0 || data_len - pos < 10) {
+            return 0;
+        }
+        uint16_t type = read16(data + pos);
+        uint32_t ttl = ttl_value(read32(data + pos + 4));
+        int rdlength = read16(data + pos + 8);
+        int ttl_offset = pos + 4;
+        pos += 10;
+        if (data_len - pos < rdlength) {
+            return 0;
+        }
+        
+        if (type == DNS_TYPE_OPT) {
+            // the TTL field of OPT carries EDNS flags
+            if (i >= info->ancount + info->nscount) {
+                info->key_flags |= KEY_FLAG_EDNS;
+                if ((data[ttl_offset + 2] & 0x80)) {
+                    info->key_flags |= KEY_FLAG_DO;
+                }
+            }
+        } else {
+            if (info->num_ttls >= 0) {
+                if (info->num_ttls == DNSCACHE_MAX_RRS) {
+                    info->num_ttls = -1;
+                } else {
+                    info->ttl_offsets[info->num_ttls++] = ttl_offset;
+                }
+            }
+            if (ttl < info->min_ttl) {
+                info->min_ttl = ttl;
+            }
+            
+            // negative answers are cached for the lesser of SOA TTL and SOA MINIMUM (RFC 2308)
+            if (type == DNS_TYPE_SOA && i >= info->ancount && i < info->ancount + info->nscount && rdlength >= 4) {
+                uint32_t minimum = ttl_value(read32(data + pos + rdlength - 4));
+                info->soa_ttl = bmin_uint32(minimum, ttl);
+                info->have_soa = 1;
+            }
+        }
+        
+        pos += rdlength;
+    }
+    
+    return 1;
+}
+
+static int build_key (uint8_t *key, const struct dns_info *info, BAddr remote_addr, const uint8_t *data)
+{
+    int len = 0;
+    
+    key[len++] = info->key_flags;
+    key[len++] = remote_addr.type;
+    
+    switch (remote_addr.type) {
+        case BADDR_TYPE_IPV4: {
+            memcpy(key + len, &remote_addr.ipv4.ip, 4);
+            len += 4;
+            memcpy(key + len, &remote_addr.ipv4.port, 2);
+            len += 2;
+        } break;
+        case BADDR_TYPE_IPV6: {
+            memcpy(key + len, remote_addr.ipv6.ip, 16);
+            len += 16;
+            memcpy(key + len, &remote_addr.ipv6.port, 2);
+            len += 2;
+        } break;
+        default: ASSERT(0);
+    }
+    
+    // question type and class
+    memcpy(key + len, data + DNS_HEADER_SIZE + info->name_len, 4);
+    len += 4;
+    
+    // question name, lowercased; length octets are at most 63 so they are not affected
+    for (int i = 0; i < info->name_len; i++) {
+        uint8_t c = data[DNS_HEADER_SIZE + i];
+        key[len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    
+    ASSERT(len <= DNSCACHE_KEY_MAX)
+    
+    return len;
+}
+
+static DnsCacheHashRef entry_ref (struct DnsCache_entry *entry)
+{
+    DnsCacheHashRef ref = {entry, entry};
+    return ref;
+}
+
+static void free_entry (DnsCache *o, struct DnsCache_entry *entry)
+{
+    // remove from hash table
+    DnsCacheHash_Remove(&o->hash, 0, entry_ref(entry));
+    
+    // remove from entries list
+    LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    o->num_entries--;
+    
+    if (entry->resolved) {
+        BFree(entry->response);
+    } else {
+        BFree(entry->waiters);
+    }
+    
+    BFree(entry);
+}
+
+static void touch_entry (DnsCache *o, struct DnsCache_entry *entry)
+{
+    // move to the end of the entries list
+    LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+}
+
+static struct DnsCache_entry * new_entry (DnsCache *o, const uint8_t *key, int key_len, int name_len)
+{
+    ASSERT(o->num_entries <= o->max_entries)
+    
+    // evict least recently used entry if full
+    if (o->num_entries == o->max_entries) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->entries_list);
+        free_entry(o, UPPER_OBJECT(node, struct DnsCache_entry, list_node));
+    }
+    
+    struct DnsCache_entry *entry = (struct DnsCache_entry *)BAlloc(sizeof(*entry));
+    if (!entry) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    if (!(entry->waiters = (struct DnsCache_waiter *)BAllocArray(DNSCACHE_MAX_WAITERS, sizeof(entry->waiters[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    entry->hash = badvpn_hash_bin(entry->key, entry->key_len, badvpn_hash_seed());
+    entry->name_len = name_len;
+    entry->resolved = 0;
+    entry->num_waiters = 0;
+    
+    // insert to hash table
+    int res = DnsCacheHash_Insert(&o->hash, 0, entry_ref(entry), NULL);
+    ASSERT_EXECUTE(res)
+    
+    // insert to entries list
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+    o->num_entries++;
+    
+    return entry;
+    
+fail1:
+    BFree(entry);
+fail0:
+    return NULL;
+}
+
+static void add_waiter (struct DnsCache_entry *entry, BAddr local_addr, const uint8_t *data, int forwarded)
+{
+    ASSERT(!entry->resolved)
+    ASSERT(entry->num_waiters < DNSCACHE_MAX_WAITERS)
+    
+    struct DnsCache_waiter *w = &entry->waiters[entry->num_waiters++];
+    w->local_addr = local_addr;
+    w->id = read16(data);
+    w->forwarded = forwarded;
+    memcpy(w->name, data + DNS_HEADER_SIZE, entry->name_len);
+}
+
+static void send_response (DnsCache *o, BAddr local_addr, BAddr remote_addr, const uint8_t *response, int response_len,
+                           uint16_t id, const uint8_t *name, int name_len, const int *ttl_offsets, int num_ttls, uint32_t elapsed)
+{
+    ASSERT(response_len <= o->max_response_len)
+    
+    memcpy(o->buf, response, response_len);
+    
+    // use the client's transaction ID
+    o->buf[0] = id >> 8;
+    o->buf[1] = id;
+    
+    // use the client's spelling of the name, as clients may randomize its case
+    memcpy(o->buf + DNS_HEADER_SIZE, name, name_len);
+    
+    // account for the time spent in the cache
+    for (int i = 0; i < num_ttls; i++) {
+        uint32_t ttl = ttl_value(read32(o->buf + ttl_offsets[i]));
+        write32(o->buf + ttl_offsets[i], (ttl > elapsed) ? ttl - elapsed : 0);
+    }
+    
+    o->handler_send(o->user, local_addr, remote_addr, o->buf, response_len);
+}
+
+int DnsCache_Init (DnsCache *o, int max_entries, int max_response_len, DnsCache_handler_send handler_send, void *user)
+{
+    ASSERT(max_entries > 0)
+    ASSERT(max_response_len >= 0)
+    ASSERT(handler_send)
+    
+    // init arguments
+    o->max_entries = max_entries;
+    o->max_response_len = max_response_len;
+    o->handler_send = handler_send;
+    o->user = user;
+    
+    // init hash table
+    if (!DnsCacheHash_Init(&o->hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "DnsCacheHash_Init failed");
+        goto fail0;
+    }
+    
+    // allocate response buffer
+    if (!(o->buf = (uint8_t *)BAlloc(bmax_int(o->max_response_len, 1)))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    
+    // init entries list
+    LinkedList1_Init(&o->entries_list);
+    o->num_entries = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    DnsCacheHash_Free(&o->hash);
+fail0:
+    return 0;
+}
+
+void DnsCache_Free (DnsCache *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free entries
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&o->entries_list))) {
+        free_entry(o, UPPER_OBJECT(node, struct DnsCache_entry, list_node));
+    }
+    
+    // free response buffer
+    BFree(o->buf);
+    
+    // free hash table
+    DnsCacheHash_Free(&o->hash);
+}
+
+int DnsCache_SubmitQuery (DnsCache *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    
+    // only handle standard queries
+    struct dns_info info;
+    if (!parse_message(data, data_len, &info) || info.is_response || info.opcode != 0 ||
+        info.ancount != 0 || info.nscount != 0
+    ) {
+        return 0;
+    }
+    
+    uint8_t key_data[DNSCACHE_KEY_MAX];
+    struct DnsCache_key key = {key_data, build_key(key_data, &info, remote_addr, data)};
+    
+    btime_t now = btime_gettime();
+    
+    struct DnsCache_entry *entry = DnsCacheHash_Lookup(&o->hash, 0, key).ptr;
+    
+    // drop expired entries and outstanding requests which were given up
+    if (entry && entry->resolved && now >= entry->expire_time) {
+        free_entry(o, entry);
+        entry = NULL;
+    }
+    if (entry && !entry->resolved && now - entry->forward_time >= DNSCACHE_PENDING_TIMEOUT) {
+        free_entry(o, entry);
+        entry = NULL;
+    }
+    
+    if (entry && entry->resolved) {
+        BLog(BLOG_DEBUG, "hit");
+        
+        touch_entry(o, entry);
+        
+        send_response(o, local_addr, remote_addr, entry->response, entry->response_len, read16(data),
+                      data + DNS_HEADER_SIZE, entry->name_len, entry->ttl_offsets, entry->num_ttls,
+                      (now - entry->store_time) / 1000);
+        return 1;
+    }
+    
+    if (entry) {
+        touch_entry(o, entry);
+        
+        // forward again if the request has been outstanding for a while,
+        // in case the query or response was lost
+        int forward = (now - entry->forward_time >= DNSCACHE_RETRY_TIME);
+        if (forward) {
+            entry->forward_time = now;
+        }
+        
+        // a retransmission from a client which is already waiting
+        for (int i = 0; i < entry->num_waiters; i++) {
+            struct DnsCache_waiter *w = &entry->waiters[i];
+            if (BAddr_Compare(&w->local_addr, &local_addr) && w->id == read16(data)) {
+                w->forwarded |= forward;
+                return !forward;
+            }
+        }
+        
+        if (entry->num_waiters == DNSCACHE_MAX_WAITERS) {
+            return 0;
+        }
+        
+        BLog(BLOG_DEBUG, "joining outstanding request");
+        
+        add_waiter(entry, local_addr, data, forward);
+        return !forward;
+    }
+    
+    BLog(BLOG_DEBUG, "miss");
+    
+    if (!(entry = new_entry(o, key.data, key.len, info.name_len))) {
+        return 0;
+    }
+    
+    add_waiter(entry, local_addr, data, 1);
+    entry->forward_time = now;
+    
+    return 0;
+}
+
+int DnsCache_SubmitResponse (DnsCache *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    
+    struct dns_info info;
+    if (!parse_message(data, data_len, &info) || !info.is_response || info.opcode != 0) {
+        return 0;
+    }
+    
+    uint8_t key_data[DNSCACHE_KEY_MAX];
+    struct DnsCache_key key = {key_data, build_key(key_data, &info, remote_addr, data)};
+    
+    struct DnsCache_entry *entry = DnsCacheHash_Lookup(&o->hash, 0, key).ptr;
+    if (!entry || entry->resolved) {
+        return 0;
+    }
+    
+    // the response must be for a query we forwarded
+    int found = 0;
+    for (int i = 0; i < entry->num_waiters; i++) {
+        struct DnsCache_waiter *w = &entry->waiters[i];
+        if (w->forwarded && BAddr_Compare(&w->local_addr, &local_addr) && w->id == read16(data)) {
+            found = 1;
+            break;
+        }
+    }
+    if (!found || data_len > o->max_response_len) {
+        return 0;
+    }
+    
+    // answer all waiting clients
+    for (int i = 0; i < entry->num_waiters; i++) {
+        struct DnsCache_waiter *w = &entry->waiters[i];
+        send_response(o, w->local_addr, remote_addr, data, data_len, w->id, w->name, entry->name_len, NULL, 0, 0);
+    }
+    
+    // determine how long the response may be cached
+    uint32_t ttl = 0;
+    if (!info.truncated && info.num_ttls >= 0) {
+        if (info.rcode == DNS_RCODE_NOERROR && info.ancount > 0) {
+            ttl = bmin_uint32(info.min_ttl, DNSCACHE_MAX_TTL);
+        } else if ((info.rcode == DNS_RCODE_NXDOMAIN || (info.rcode == DNS_RCODE_NOERROR && info.ancount == 0)) && info.have_soa) {
+            ttl = bmin_uint32(info.soa_ttl, DNSCACHE_MAX_NEGATIVE_TTL);
+        }
+    }
+    
+    uint8_t *response;
+    if (ttl == 0 || !(response = (uint8_t *)BAlloc(bmax_int(data_len, 1)))) {
+        free_entry(o, entry);
+        return 1;
+    }
+    memcpy(response, data, data_len);
+    
+    BLog(BLOG_DEBUG, "caching response for %"PRIu32" seconds", ttl);
+    
+    // turn the entry into a cached response
+    BFree(entry->waiters);
+    entry->resolved = 1;
+    entry->response = response;
+    entry->response_len = data_len;
+    entry->store_time = btime_gettime();
+    entry->expire_time = entry->store_time + (btime_t)ttl * 1000;
+    entry->num_ttls = info.num_ttls;
+    memcpy(entry->ttl_offsets, info.ttl_offsets, info.num_ttls * sizeof(info.ttl_offsets[0]));
+    
+    return 1;
+}
@@ -0,0 +1,209 @@
+/**
+ * @file DnsCache.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * DNS response cache, used by tun2socks and udpgw.
+ * 
+ * Queries from clients are keyed by question name (case-insensitively), type,
+ * class, resolver address and the header/EDNS bits which influence the answer.
+ * Fresh cached responses are answered locally with TTLs decremented by the time
+ * spent in the cache. Identical queries which arrive while one is outstanding are
+ * not forwarded; they are answered when the first response arrives.
+ * The number of entries is bounded and the least recently used entry is evicted.
+ */
+
+#ifndef BADVPN_DNSCACHE_DNSCACHE_H
+#define BADVPN_DNSCACHE_DNSCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BTime.h>
+
+/**
+ * Maximum length of an encoded domain name.
+ */
+#define DNSCACHE_NAME_MAX 255
+
+/**
+ * Maximum length of a cache key (flags, resolver address, type, class, name).
+ */
+#define DNSCACHE_KEY_MAX (2 + 16 + 2 + 4 + DNSCACHE_NAME_MAX)
+
+/**
+ * Maximum number of resource records in a cacheable response.
+ */
+#define DNSCACHE_MAX_RRS 48
+
+/**
+ * Maximum number of queries waiting for the same outstanding request.
+ */
+#define DNSCACHE_MAX_WAITERS 16
+
+/**
+ * Upper bound for the lifetime of a positive entry, in seconds.
+ */
+#define DNSCACHE_MAX_TTL 3600
+
+/**
+ * Upper bound for the lifetime of a negative entry, in seconds.
+ */
+#define DNSCACHE_MAX_NEGATIVE_TTL 300
+
+/**
+ * Time after which a repeated query for an outstanding request is
+ * forwarded again, in milliseconds.
+ */
+#define DNSCACHE_RETRY_TIME 1000
+
+/**
+ * Time after which an outstanding request is given up, in milliseconds.
+ */
+#define DNSCACHE_PENDING_TIMEOUT 5000
+
+/**
+ * Handler called to send a DNS response to a client.
+ * 
+ * @param user as in {@link DnsCache_Init}
+ * @param local_addr address identifying the client
+ * @param remote_addr address of the resolver
+ * @param data response message
+ * @param data_len length of response
+ */
+typedef void (*DnsCache_handler_send) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+struct DnsCache_key {
+    const uint8_t *data;
+    int len;
+};
+
+struct DnsCache_entry;
+
+typedef struct DnsCache_entry *DnsCacheHash_link;
+typedef struct DnsCache_key DnsCacheHash_key;
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_decl.h>
+
+struct DnsCache_waiter {
+    BAddr local_addr;
+    uint16_t id;
+    int forwarded;
+    uint8_t name[DNSCACHE_NAME_MAX];
+};
+
+struct DnsCache_entry {
+    LinkedList1Node list_node; // node in DnsCache.entries_list
+    DnsCacheHash_link hash_next; // next in DnsCache.hash bucket
+    size_t hash;
+    uint8_t key[DNSCACHE_KEY_MAX];
+    int key_len;
+    int name_len;
+    int resolved;
+    // when not resolved:
+    struct DnsCache_waiter *waiters;
+    int num_waiters;
+    btime_t forward_time;
+    // when resolved:
+    uint8_t *response;
+    int response_len;
+    btime_t store_time;
+    btime_t expire_time;
+    int num_ttls;
+    int ttl_offsets[DNSCACHE_MAX_RRS];
+};
+
+/**
+ * DNS response cache.
+ */
+typedef struct {
+    int max_entries;
+    int max_response_len;
+    DnsCache_handler_send handler_send;
+    void *user;
+    DnsCacheHash hash;
+    LinkedList1 entries_list;
+    int num_entries;
+    uint8_t *buf;
+    DebugObject d_obj;
+} DnsCache;
+
+/**
+ * Initializes the cache.
+ * 
+ * @param o the object
+ * @param max_entries maximum number of entries, cached or outstanding. Must be >0.
+ * @param max_response_len maximum length of a response. Longer responses are not cached. Must be >=0.
+ * @param handler_send handler called to send responses to clients. It is called
+ *                     synchronously from {@link DnsCache_SubmitQuery} and
+ *                     {@link DnsCache_SubmitResponse}, and must not call back into the cache.
+ * @param user value passed to handler
+ * @return 1 on success, 0 on failure
+ */
+int DnsCache_Init (DnsCache *o, int max_entries, int max_response_len, DnsCache_handler_send handler_send, void *user) WARN_UNUSED;
+
+/**
+ * Frees the cache.
+ * 
+ * @param o the object
+ */
+void DnsCache_Free (DnsCache *o);
+
+/**
+ * Submits a query from a client.
+ * 
+ * @param o the object
+ * @param local_addr address identifying the client
+ * @param remote_addr address of the resolver
+ * @param data query message
+ * @param data_len length of query. Must be >=0.
+ * @return 1 if the query was answered from the cache or joined an outstanding
+ *         request and must not be forwarded, 0 if it must be forwarded
+ */
+int DnsCache_SubmitQuery (DnsCache *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+/**
+ * Submits a response from the resolver.
+ * 
+ * @param o the object
+ * @param local_addr address identifying the client
+ * @param remote_addr address of the resolver
+ * @param data response message
+ * @param data_len length of response. Must be >=0.
+ * @return 1 if the response answered an outstanding request and was sent to all
+ *         waiting clients, 0 if it must be delivered as usual
+ */
+int DnsCache_SubmitResponse (DnsCache *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+#endif
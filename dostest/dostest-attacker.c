@@ -31,6 +31,14 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <inttypes.h>
+
+#include <prinit.h>
+#include <prerror.h>
+#include <nss/nss.h>
+#include <nss/ssl.h>
+#include <nss/cert.h>
+#include <nss/keyhi.h>
 
 #include <misc/debug.h>
 #include <misc/version.h>
@@ -38,7 +46,9 @@
 #include <misc/open_standard_streams.h>
 #include <misc/balloc.h>
 #include <misc/loglevel.h>
+#include <misc/loghist.h>
 #include <misc/minmax.h>
+#include <misc/nsskey.h>
 #include <structure/LinkedList1.h>
 #include <base/BLog.h>
 #include <system/BAddr.h>
@@ -46,17 +56,37 @@
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BSignal.h>
+#include <system/BTime.h>
+#include <nspr_support/BSSLConnection.h>
+#include <socksclient/BSocksClient.h>
 
 #include <generated/blog_channel_dostest_attacker.h>
 
 #define PROGRAM_NAME "dostest-attacker"
 
+#define HANDSHAKE_NONE 0
+#define HANDSHAKE_SSL 1
+#define HANDSHAKE_SOCKS 2
+
+#define DEFAULT_REPORT_INTERVAL 1000
+
+#define CONNECTION_STATE_CONNECTING 1
+#define CONNECTION_STATE_HANDSHAKE 2
+#define CONNECTION_STATE_UP 3
+
 // connection structure
 struct connection {
-    int connected;
+    int state;
+    btime_t start_time;
     BConnector connector;
     BConnection con;
+    PRFileDesc bottom_prfd;
+    PRFileDesc *ssl_prfd;
+    int have_ssl;
+    BSSLConnection sslcon;
+    BSocksClient socks;
     StreamRecvInterface *recv_if;
+    BTimer hold_timer;
     uint8_t buf[512];
     LinkedList1Node connections_list_node;
 };
@@ -68,6 +98,14 @@ static struct {
     char *connect_addr;
     int max_connections;
     int max_connecting;
+    int connect_rate;
+    int hold_time;
+    int handshake;
+    char *nssdb;
+    char *client_cert_name;
+    char *server_name;
+    char *socks_dest_addr;
+    int report_interval;
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
 } options;
@@ -75,6 +113,16 @@ static struct {
 // connect address
 static BAddr connect_addr;
 
+// destination to request from the SOCKS server
+static BAddr socks_dest_addr;
+
+// SOCKS authentication
+static struct BSocksClient_auth_info socks_auth_info;
+
+// client certificate and key if using SSL
+static CERTCertificate *client_cert;
+static SECKEYPrivateKey *client_key;
+
 // reactor
 static BReactor reactor;
 
@@ -86,6 +134,27 @@ static int num_connecting;
 // timer for scheduling creation of more connections
 static BTimer make_connections_timer;
 
+// connection attempts allowed by --connect-rate, counted from rate_start_time
+static btime_t rate_start_time;
+static uint64_t rate_made;
+
+// statistics since the last report
+static struct {
+    int attempts;
+    int connect_failures;
+    int connected;
+    int handshakes;
+    int handshake_failures;
+    int closed_by_server;
+    int closed_by_us;
+    LogHist connect_latency;
+    LogHist handshake_latency;
+} stats;
+
+// timer for reports
+static BTimer report_timer;
+static btime_t last_report_time;
+
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
@@ -97,25 +166,36 @@ static void connection_logfunc (struct connection *conn);
 static void connection_log (struct connection *conn, int level, const char *fmt, ...);
 static void connection_connector_handler (struct connection *conn, int is_error);
 static void connection_connection_handler (struct connection *conn, int event);
+static void connection_sslcon_handler (struct connection *conn, int event);
+static void connection_socks_handler (struct connection *conn, int event);
+static SECStatus connection_client_auth_data_callback (struct connection *conn, PRFileDesc *fd, CERTDistNames *caNames, CERTCertificate **pRetCert, SECKEYPrivateKey **pRetKey);
+static SECStatus connection_auth_certificate_callback (struct connection *conn, PRFileDesc *fd, PRBool checkSig, PRBool isServer);
+static int connection_start_ssl (struct connection *conn);
+static void connection_up (struct connection *conn, StreamRecvInterface *recv_if);
+static void connection_closed (struct connection *conn, int by_server);
 static void connection_recv_handler_done (struct connection *conn, int data_len);
+static void connection_hold_timer_handler (struct connection *conn);
 static void make_connections_timer_handler (void *unused);
+static void report_timer_handler (void *unused);
+static void reset_stats (void);
+static uint64_t time_since_us (btime_t start);
 
 int main (int argc, char **argv)
 {
     if (argc <= 0) {
         return 1;
     }
-    
+
     // open standard streams
     open_standard_streams();
-    
+
     // parse command-line arguments
     if (!parse_arguments(argc, argv)) {
         fprintf(stderr, "Failed to parse arguments\n");
         print_help(argv[0]);
         goto fail0;
     }
-    
+
     // handle --help and --version
     if (options.help) {
         print_version();
@@ -126,10 +206,10 @@ int main (int argc, char **argv)
         print_version();
         return 0;
     }
-    
+
     // init loger
     BLog_InitStderr();
-    
+
     // configure logger channels
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         if (options.loglevels[i] >= 0) {
@@ -139,56 +219,118 @@ int main (int argc, char **argv)
             BLog_SetChannelLoglevel(i, options.loglevel);
         }
     }
-    
+
     BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
-    
+
     // initialize network
     if (!BNetwork_GlobalInit()) {
         BLog(BLOG_ERROR, "BNetwork_GlobalInit failed");
         goto fail1;
     }
-    
+
     // process arguments
     if (!process_arguments()) {
         BLog(BLOG_ERROR, "Failed to process arguments");
         goto fail1;
     }
-    
+
     // init time
     BTime_Init();
-    
+
     // init reactor
     if (!BReactor_Init(&reactor)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
-    
+
     // setup signal handler
     if (!BSignal_Init(&reactor, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
         goto fail2;
     }
-    
+
+    if (options.handshake == HANDSHAKE_SSL) {
+        // init NSPR
+        PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
+
+        // register local NSPR file types
+        if (!BSSLConnection_GlobalInit()) {
+            BLog(BLOG_ERROR, "BSSLConnection_GlobalInit failed");
+            goto fail3;
+        }
+
+        // init NSS
+        SECStatus res = (options.nssdb ? NSS_Init(options.nssdb) : NSS_NoDB_Init(NULL));
+        if (res != SECSuccess) {
+            BLog(BLOG_ERROR, "NSS_Init failed (%d)", (int)PR_GetError());
+            goto fail3;
+        }
+
+        // set cipher policy
+        if (NSS_SetDomesticPolicy() != SECSuccess) {
+            BLog(BLOG_ERROR, "NSS_SetDomesticPolicy failed (%d)", (int)PR_GetError());
+            goto fail4;
+        }
+
+        // open client certificate and private key
+        client_cert = NULL;
+        client_key = NULL;
+        if (options.client_cert_name && !open_nss_cert_and_key(options.client_cert_name, &client_cert, &client_key)) {
+            BLog(BLOG_ERROR, "Cannot open certificate and key");
+            goto fail4;
+        }
+    }
+
     // init connections list
     LinkedList1_Init(&connections_list);
     num_connections = 0;
     num_connecting = 0;
-    
+
+    // init statistics
+    reset_stats();
+
+    // init rate limiting
+    rate_start_time = btime_gettime();
+    rate_made = 0;
+
     // init make connections timer
     BTimer_Init(&make_connections_timer, 0, make_connections_timer_handler, NULL);
     BReactor_SetTimer(&reactor, &make_connections_timer);
-    
+
+    // init report timer
+    last_report_time = btime_gettime();
+    BTimer_Init(&report_timer, options.report_interval, report_timer_handler, NULL);
+    if (options.report_interval > 0) {
+        BReactor_SetTimer(&reactor, &report_timer);
+    }
+
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&reactor);
-    
+
     // free connections
     while (!LinkedList1_IsEmpty(&connections_list)) {
         struct connection *conn = UPPER_OBJECT(LinkedList1_GetFirst(&connections_list), struct connection, connections_list_node);
         connection_free(conn);
     }
+    // free report timer
+    BReactor_RemoveTimer(&reactor, &report_timer);
     // free make connections timer
     BReactor_RemoveTimer(&reactor, &make_connections_timer);
+
+    if (options.handshake == HANDSHAKE_SSL) {
+        if (client_cert) {
+            CERT_DestroyCertificate(client_cert);
+            SECKEY_DestroyPrivateKey(client_key);
+        }
+fail4:
+        SSL_ClearSessionCache();
+        ASSERT_FORCE(NSS_Shutdown() == SECSuccess)
+fail3:
+        ASSERT_FORCE(PR_Cleanup() == PR_SUCCESS)
+        PL_ArenaFinish();
+    }
+
     // free signal
     BSignal_Finish();
 fail2:
@@ -201,7 +343,7 @@ fail1:
 fail0:
     // finish debug objects
     DebugObjectGlobal_Finish();
-    
+
     return 1;
 }
 
@@ -215,6 +357,18 @@ void print_help (const char *name)
         "        --connect-addr <addr>\n"
         "        --max-connections <number>\n"
         "        --max-connecting <number>\n"
+        "        [--connect-rate <connections-per-second>]\n"
+        "        [--hold-time <milliseconds>]\n"
+        "        [--handshake <none/ssl/socks>]\n"
+        "        (handshake=ssl?\n"
+        "            [--nssdb <string>]\n"
+        "            [--client-cert-name <string>]\n"
+        "            [--server-name <string>]\n"
+        "        )\n"
+        "        (handshake=socks?\n"
+        "            --socks-dest-addr <addr>\n"
+        "        )\n"
+        "        [--report-interval <milliseconds / 0>]\n"
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
@@ -234,11 +388,19 @@ int parse_arguments (int argc, char *argv[])
     options.connect_addr = NULL;
     options.max_connections = -1;
     options.max_connecting = -1;
+    options.connect_rate = 0;
+    options.hold_time = 0;
+    options.handshake = HANDSHAKE_NONE;
+    options.nssdb = NULL;
+    options.client_cert_name = NULL;
+    options.server_name = NULL;
+    options.socks_dest_addr = NULL;
+    options.report_interval = DEFAULT_REPORT_INTERVAL;
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
     }
-    
+
     int i;
     for (i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -278,6 +440,92 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--connect-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.connect_rate = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--hold-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.hold_time = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--handshake")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            char *arg2 = argv[i + 1];
+            if (!strcmp(arg2, "none")) {
+                options.handshake = HANDSHAKE_NONE;
+            }
+            else if (!strcmp(arg2, "ssl")) {
+                options.handshake = HANDSHAKE_SSL;
+            }
+            else if (!strcmp(arg2, "socks")) {
+                options.handshake = HANDSHAKE_SOCKS;
+            }
+            else {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--nssdb")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.nssdb = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--client-cert-name")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.client_cert_name = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--server-name")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.server_name = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--socks-dest-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.socks_dest_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--report-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.report_interval = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -312,26 +560,41 @@ int parse_arguments (int argc, char *argv[])
             return 0;
         }
     }
-    
+
     if (options.help || options.version) {
         return 1;
     }
-    
+
     if (!options.connect_addr) {
         fprintf(stderr, "--connect-addr missing\n");
         return 0;
     }
-    
+
     if (options.max_connections == -1) {
         fprintf(stderr, "--max-connections missing\n");
         return 0;
     }
-    
+
     if (options.max_connecting == -1) {
         fprintf(stderr, "--max-connecting missing\n");
         return 0;
     }
-    
+
+    if (options.handshake != HANDSHAKE_SSL && (options.nssdb || options.client_cert_name || options.server_name)) {
+        fprintf(stderr, "False: --nssdb, --client-cert-name or --server-name => --handshake ssl\n");
+        return 0;
+    }
+
+    if (options.client_cert_name && !options.nssdb) {
+        fprintf(stderr, "False: --client-cert-name => --nssdb\n");
+        return 0;
+    }
+
+    if ((options.handshake == HANDSHAKE_SOCKS) != !!options.socks_dest_addr) {
+        fprintf(stderr, "False: --handshake socks <=> --socks-dest-addr\n");
+        return 0;
+    }
+
     return 1;
 }
 
@@ -342,14 +605,23 @@ int process_arguments (void)
         BLog(BLOG_ERROR, "connect addr: BAddr_Parse failed");
         return 0;
     }
-    
+
+    // resolve SOCKS destination address
+    if (options.socks_dest_addr) {
+        if (!BAddr_Parse(&socks_dest_addr, options.socks_dest_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "socks dest addr: BAddr_Parse failed");
+            return 0;
+        }
+        socks_auth_info = BSocksClient_auth_none();
+    }
+
     return 1;
 }
 
 void signal_handler (void *unused)
 {
     BLog(BLOG_NOTICE, "termination requested");
-    
+
     // exit event loop
     BReactor_Quit(&reactor, 1);
 }
@@ -362,23 +634,38 @@ int connection_new (void)
         BLog(BLOG_ERROR, "malloc failed");
         goto fail0;
     }
-    
-    // set not connected
-    conn->connected = 0;
-    
-    // init connector
-    if (!BConnector_Init(&conn->connector, connect_addr, &reactor, conn, (BConnector_handler)connection_connector_handler)) {
-        BLog(BLOG_ERROR, "BConnector_Init failed");
-        goto fail1;
+
+    // set connecting
+    conn->state = CONNECTION_STATE_CONNECTING;
+    conn->start_time = btime_gettime_us();
+    conn->have_ssl = 0;
+
+    if (options.handshake == HANDSHAKE_SOCKS) {
+        // init SOCKS client, which connects by itself
+        if (!BSocksClient_Init(&conn->socks, connect_addr, &socks_auth_info, 1, socks_dest_addr, false, (BSocksClient_handler)connection_socks_handler, conn, &reactor)) {
+            BLog(BLOG_ERROR, "BSocksClient_Init failed");
+            goto fail1;
+        }
+    } else {
+        // init connector
+        if (!BConnector_Init(&conn->connector, connect_addr, &reactor, conn, (BConnector_handler)connection_connector_handler)) {
+            BLog(BLOG_ERROR, "BConnector_Init failed");
+            goto fail1;
+        }
     }
-    
+
+    // init hold timer
+    BTimer_Init(&conn->hold_timer, options.hold_time, (BTimer_handler)connection_hold_timer_handler, conn);
+
     // add to connections list
     LinkedList1_Append(&connections_list, &conn->connections_list_node);
     num_connections++;
     num_connecting++;
-    
+
+    stats.attempts++;
+
     return 1;
-    
+
 fail1:
     free(conn);
 fail0:
@@ -390,21 +677,39 @@ void connection_free (struct connection *conn)
     // remove from connections list
     LinkedList1_Remove(&connections_list, &conn->connections_list_node);
     num_connections--;
-    if (!conn->connected) {
+    if (conn->state == CONNECTION_STATE_CONNECTING) {
         num_connecting--;
     }
-    
-    if (conn->connected) {
-        // free receive interface
-        BConnection_RecvAsync_Free(&conn->con);
-        
-        // free connection
-        BConnection_Free(&conn->con);
-    }
-    
-    // free connector
-    BConnector_Free(&conn->connector);
-    
+
+    // free hold timer
+    BReactor_RemoveTimer(&reactor, &conn->hold_timer);
+
+    if (options.handshake == HANDSHAKE_SOCKS) {
+        // free SOCKS client
+        BSocksClient_Free(&conn->socks);
+    } else {
+        if (conn->state != CONNECTION_STATE_CONNECTING) {
+            if (conn->have_ssl) {
+                // free SSL
+                BSSLConnection_ReleaseBuffers(&conn->sslcon);
+                BSSLConnection_Free(&conn->sslcon);
+                ASSERT_FORCE(PR_Close(conn->ssl_prfd) == PR_SUCCESS)
+
+                // free send interface
+                BConnection_SendAsync_Free(&conn->con);
+            }
+
+            // free receive interface
+            BConnection_RecvAsync_Free(&conn->con);
+
+            // free connection
+            BConnection_Free(&conn->con);
+        }
+
+        // free connector
+        BConnector_Free(&conn->connector);
+    }
+
     // free structure
     free(conn);
 }
@@ -424,83 +729,306 @@ void connection_log (struct connection *conn, int level, const char *fmt, ...)
 
 void connection_connector_handler (struct connection *conn, int is_error)
 {
-    ASSERT(!conn->connected)
-    
+    ASSERT(conn->state == CONNECTION_STATE_CONNECTING)
+    ASSERT(options.handshake != HANDSHAKE_SOCKS)
+
     // check for connection error
     if (is_error) {
         connection_log(conn, BLOG_INFO, "failed to connect");
+        stats.connect_failures++;
         goto fail0;
     }
-    
+
     // init connection from connector
     if (!BConnection_Init(&conn->con, BConnection_source_connector(&conn->connector), &reactor, conn, (BConnection_handler)connection_connection_handler)) {
         connection_log(conn, BLOG_INFO, "BConnection_Init failed");
+        stats.connect_failures++;
         goto fail0;
     }
-    
+
     // init receive interface
     BConnection_RecvAsync_Init(&conn->con);
-    conn->recv_if = BConnection_RecvAsync_GetIf(&conn->con);
-    StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
-    
-    // start receiving
-    StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
-    
+
     // no longer connecting
-    conn->connected = 1;
+    conn->state = CONNECTION_STATE_HANDSHAKE;
     num_connecting--;
-    
+
+    stats.connected++;
+    LogHist_Add(&stats.connect_latency, time_since_us(conn->start_time));
+
     connection_log(conn, BLOG_INFO, "connected");
-    
+
+    if (options.handshake == HANDSHAKE_SSL) {
+        // start SSL handshake
+        if (!connection_start_ssl(conn)) {
+            stats.handshake_failures++;
+            goto fail0;
+        }
+    } else {
+        connection_up(conn, BConnection_RecvAsync_GetIf(&conn->con));
+    }
+
     // schedule making connections (because of connecting limit)
     BReactor_SetTimer(&reactor, &make_connections_timer);
     return;
-    
+
 fail0:
     // free connection
     connection_free(conn);
-    
+
     // schedule making connections
     BReactor_SetTimer(&reactor, &make_connections_timer);
 }
 
+int connection_start_ssl (struct connection *conn)
+{
+    // init send interface
+    BConnection_SendAsync_Init(&conn->con);
+
+    // create bottom NSPR file descriptor
+    if (!BSSLConnection_MakeBackend(&conn->bottom_prfd, BConnection_SendAsync_GetIf(&conn->con), BConnection_RecvAsync_GetIf(&conn->con), NULL, 0)) {
+        connection_log(conn, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
+        goto fail0;
+    }
+
+    // create SSL file descriptor from the bottom NSPR file descriptor
+    if (!(conn->ssl_prfd = SSL_ImportFD(NULL, &conn->bottom_prfd))) {
+        connection_log(conn, BLOG_ERROR, "SSL_ImportFD failed");
+        ASSERT_FORCE(PR_Close(&conn->bottom_prfd) == PR_SUCCESS)
+        goto fail0;
+    }
+
+    // set client mode
+    if (SSL_ResetHandshake(conn->ssl_prfd, PR_FALSE) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_ResetHandshake failed");
+        goto fail1;
+    }
+
+    // set server name
+    if (options.server_name && SSL_SetURL(conn->ssl_prfd, options.server_name) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_SetURL failed");
+        goto fail1;
+    }
+
+    // we measure handshakes, not trust; accept any server certificate
+    if (SSL_AuthCertificateHook(conn->ssl_prfd, (SSLAuthCertificate)connection_auth_certificate_callback, conn) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_AuthCertificateHook failed");
+        goto fail1;
+    }
+
+    // set client certificate callback
+    if (client_cert && SSL_GetClientAuthDataHook(conn->ssl_prfd, (SSLGetClientAuthData)connection_client_auth_data_callback, conn) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
+        goto fail1;
+    }
+
+    // init BSSLConnection, starting the handshake
+    BSSLConnection_Init(&conn->sslcon, conn->ssl_prfd, 1, BReactor_PendingGroup(&reactor), conn, (BSSLConnection_handler)connection_sslcon_handler);
+    conn->have_ssl = 1;
+
+    return 1;
+
+fail1:
+    ASSERT_FORCE(PR_Close(conn->ssl_prfd) == PR_SUCCESS)
+fail0:
+    BConnection_SendAsync_Free(&conn->con);
+    return 0;
+}
+
 void connection_connection_handler (struct connection *conn, int event)
 {
-    ASSERT(conn->connected)
-    
+    ASSERT(conn->state != CONNECTION_STATE_CONNECTING)
+    ASSERT(options.handshake != HANDSHAKE_SOCKS)
+
     if (event == BCONNECTION_EVENT_RECVCLOSED) {
         connection_log(conn, BLOG_INFO, "connection closed");
     } else {
         connection_log(conn, BLOG_INFO, "connection error");
     }
-    
+
+    connection_closed(conn, 1);
+}
+
+void connection_sslcon_handler (struct connection *conn, int event)
+{
+    ASSERT(options.handshake == HANDSHAKE_SSL)
+    ASSERT(conn->state != CONNECTION_STATE_CONNECTING)
+
+    if (event == BSSLCONNECTION_EVENT_UP) {
+        ASSERT(conn->state == CONNECTION_STATE_HANDSHAKE)
+
+        connection_log(conn, BLOG_INFO, "SSL handshake done");
+
+        connection_up(conn, BSSLConnection_GetRecvIf(&conn->sslcon));
+        return;
+    }
+
+    connection_log(conn, BLOG_INFO, "SSL error");
+
+    connection_closed(conn, 1);
+}
+
+void connection_socks_handler (struct connection *conn, int event)
+{
+    ASSERT(options.handshake == HANDSHAKE_SOCKS)
+
+    switch (event) {
+        case BSOCKSCLIENT_EVENT_CONNECTED: {
+            ASSERT(conn->state == CONNECTION_STATE_CONNECTING)
+
+            // no longer connecting
+            conn->state = CONNECTION_STATE_HANDSHAKE;
+            num_connecting--;
+
+            stats.connected++;
+            LogHist_Add(&stats.connect_latency, time_since_us(conn->start_time));
+
+            connection_log(conn, BLOG_INFO, "connected");
+
+            // schedule making connections (because of connecting limit)
+            BReactor_SetTimer(&reactor, &make_connections_timer);
+        } break;
+
+        case BSOCKSCLIENT_EVENT_UP: {
+            ASSERT(conn->state == CONNECTION_STATE_HANDSHAKE)
+
+            connection_log(conn, BLOG_INFO, "SOCKS handshake done");
+
+            connection_up(conn, BSocksClient_GetRecvInterface(&conn->socks));
+        } break;
+
+        default: {
+            if (conn->state == CONNECTION_STATE_CONNECTING) {
+                connection_log(conn, BLOG_INFO, "failed to connect");
+                stats.connect_failures++;
+
+                // free connection
+                connection_free(conn);
+
+                // schedule making connections
+                BReactor_SetTimer(&reactor, &make_connections_timer);
+                return;
+            }
+
+            connection_log(conn, BLOG_INFO, "SOCKS error");
+
+            connection_closed(conn, 1);
+        } break;
+    }
+}
+
+SECStatus connection_client_auth_data_callback (struct connection *conn, PRFileDesc *fd, CERTDistNames *caNames, CERTCertificate **pRetCert, SECKEYPrivateKey **pRetKey)
+{
+    ASSERT(client_cert)
+
+    CERTCertificate *newcert;
+    if (!(newcert = CERT_DupCertificate(client_cert))) {
+        return SECFailure;
+    }
+
+    SECKEYPrivateKey *newkey;
+    if (!(newkey = SECKEY_CopyPrivateKey(client_key))) {
+        CERT_DestroyCertificate(newcert);
+        return SECFailure;
+    }
+
+    *pRetCert = newcert;
+    *pRetKey = newkey;
+    return SECSuccess;
+}
+
+SECStatus connection_auth_certificate_callback (struct connection *conn, PRFileDesc *fd, PRBool checkSig, PRBool isServer)
+{
+    return SECSuccess;
+}
+
+void connection_up (struct connection *conn, StreamRecvInterface *recv_if)
+{
+    ASSERT(conn->state == CONNECTION_STATE_HANDSHAKE)
+
+    // set up
+    conn->state = CONNECTION_STATE_UP;
+
+    if (options.handshake != HANDSHAKE_NONE) {
+        stats.handshakes++;
+        LogHist_Add(&stats.handshake_latency, time_since_us(conn->start_time));
+    }
+
+    // start receiving
+    conn->recv_if = recv_if;
+    StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
+    StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
+
+    // start hold timer
+    if (options.hold_time > 0) {
+        BReactor_SetTimer(&reactor, &conn->hold_timer);
+    }
+}
+
+void connection_closed (struct connection *conn, int by_server)
+{
+    ASSERT(conn->state != CONNECTION_STATE_CONNECTING)
+
+    if (by_server) {
+        if (conn->state == CONNECTION_STATE_HANDSHAKE && options.handshake != HANDSHAKE_NONE) {
+            stats.handshake_failures++;
+        } else {
+            stats.closed_by_server++;
+        }
+    } else {
+        stats.closed_by_us++;
+    }
+
     // free connection
     connection_free(conn);
-    
+
     // schedule making connections
     BReactor_SetTimer(&reactor, &make_connections_timer);
 }
 
 void connection_recv_handler_done (struct connection *conn, int data_len)
 {
-    ASSERT(conn->connected)
-    
+    ASSERT(conn->state == CONNECTION_STATE_UP)
+
     // receive more
     StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
-    
+
     connection_log(conn, BLOG_INFO, "received %d bytes", data_len);
 }
 
+void connection_hold_timer_handler (struct connection *conn)
+{
+    ASSERT(conn->state == CONNECTION_STATE_UP)
+    ASSERT(options.hold_time > 0)
+
+    connection_log(conn, BLOG_INFO, "hold time elapsed, disconnecting");
+
+    connection_closed(conn, 0);
+}
+
 void make_connections_timer_handler (void *unused)
 {
     int make_num = bmin_int(options.max_connections - num_connections, options.max_connecting - num_connecting);
-    
+
     if (make_num <= 0) {
         return;
     }
-    
+
+    // limit to the connection attempts due by now
+    if (options.connect_rate > 0) {
+        uint64_t due = (uint64_t)(btime_gettime() - rate_start_time) * options.connect_rate / 1000;
+        if (rate_made >= due) {
+            BReactor_SetTimerAfter(&reactor, &make_connections_timer, 1);
+            return;
+        }
+        if (due - rate_made < (uint64_t)make_num) {
+            make_num = due - rate_made;
+            BReactor_SetTimerAfter(&reactor, &make_connections_timer, 1);
+        }
+    }
+
     BLog(BLOG_INFO, "making %d connections", make_num);
-    
+
     for (int i = 0; i < make_num; i++) {
         if (!connection_new()) {
             // can happen if fd limit is reached
@@ -508,5 +1036,54 @@ void make_connections_timer_handler (void *unused)
             BReactor_SetTimerAfter(&reactor, &make_connections_timer, 10);
             return;
         }
+        rate_made++;
     }
 }
+
+void report_timer_handler (void *unused)
+{
+    BReactor_SetTimer(&reactor, &report_timer);
+
+    btime_t now = btime_gettime();
+    double secs = (now > last_report_time ? (now - last_report_time) / 1000.0 : 1.0);
+    last_report_time = now;
+
+    BLog(BLOG_NOTICE, "%d connections (%d connecting), attempts %.0f/s, connected %.0f/s, connect failures %.0f/s, closed by server %.0f/s, closed by us %.0f/s",
+         num_connections, num_connecting, stats.attempts / secs, stats.connected / secs, stats.connect_failures / secs,
+         stats.closed_by_server / secs, stats.closed_by_us / secs);
+
+    if (stats.connect_latency.count > 0) {
+        BLog(BLOG_NOTICE, "connect latency (us): p50 %"PRIu64" p99 %"PRIu64" max %"PRIu64,
+             LogHist_Percentile(&stats.connect_latency, 0.5), LogHist_Percentile(&stats.connect_latency, 0.99), LogHist_Percentile(&stats.connect_latency, 1.0));
+    }
+
+    if (options.handshake != HANDSHAKE_NONE) {
+        BLog(BLOG_NOTICE, "handshakes %.0f/s, handshake failures %.0f/s", stats.handshakes / secs, stats.handshake_failures / secs);
+
+        if (stats.handshake_latency.count > 0) {
+            BLog(BLOG_NOTICE, "handshake latency (us, from connect): p50 %"PRIu64" p99 %"PRIu64" max %"PRIu64,
+                 LogHist_Percentile(&stats.handshake_latency, 0.5), LogHist_Percentile(&stats.handshake_latency, 0.99), LogHist_Percentile(&stats.handshake_latency, 1.0));
+        }
+    }
+
+    reset_stats();
+}
+
+void reset_stats (void)
+{
+    stats.attempts = 0;
+    stats.connect_failures = 0;
+    stats.connected = 0;
+    stats.handshakes = 0;
+    stats.handshake_failures = 0;
+    stats.closed_by_server = 0;
+    stats.closed_by_us = 0;
+    LogHist_Init(&stats.connect_latency);
+    LogHist_Init(&stats.handshake_latency);
+}
+
+uint64_t time_since_us (btime_t start)
+{
+    btime_t now = btime_gettime_us();
+    return (now > start ? now - start : 0);
+}
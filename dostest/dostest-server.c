@@ -31,8 +31,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #ifdef BADVPN_LINUX
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #endif
@@ -43,6 +45,7 @@
 #include <misc/open_standard_streams.h>
 #include <misc/balloc.h>
 #include <misc/loglevel.h>
+#include <misc/loghist.h>
 #include <structure/LinkedList1.h>
 #include <base/BLog.h>
 #include <system/BAddr.h>
@@ -50,6 +53,10 @@
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BSignal.h>
+#include <system/BTime.h>
+#ifdef BADVPN_LINUX
+#include <system/BConnectionPipe.h>
+#endif
 #include "StreamBuffer.h"
 
 #include <generated/blog_channel_dostest_server.h>
@@ -67,11 +74,17 @@
 
 #define BUF_SIZE 1024
 
+#define DEFAULT_REPORT_INTERVAL 1000
+
 // client structure
 struct client {
     BConnection con;
     BAddr addr;
     StreamBuffer buf;
+    int spliced;
+#ifdef BADVPN_LINUX
+    BConnectionPipe pipe;
+#endif
     BTimer disconnect_timer;
     LinkedList1Node clients_list_node;
 };
@@ -85,6 +98,10 @@ static struct {
     int disconnect_time;
     int defense_prepare_clients;
     int defense_activate_clients;
+    #ifdef BADVPN_LINUX
+    int splice;
+    #endif
+    int report_interval;
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
 } options;
@@ -106,6 +123,23 @@ static int num_clients;
 static int defense_prepare;
 static int defense_activate;
 
+// statistics since the last report
+static struct {
+    int accepted;
+    int refused;
+    int closed;
+    LogHist accept_delay;
+} stats;
+
+// timer for reports
+static BTimer report_timer;
+static btime_t last_report_time;
+
+// kernel counters at the last report, and memory use at startup
+static uint64_t last_listen_overflows;
+static uint64_t last_listen_drops;
+static long start_rss;
+
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
@@ -117,7 +151,13 @@ static void client_logfunc (struct client *client);
 static void client_log (struct client *client, int level, const char *fmt, ...);
 static void client_disconnect_timer_handler (struct client *client);
 static void client_connection_handler (struct client *client, int event);
+#ifdef BADVPN_LINUX
+static void client_pipe_handler (struct client *client, int event);
+#endif
 static void update_defense (void);
+static void report_timer_handler (void *unused);
+static int read_listen_drops (uint64_t *out_overflows, uint64_t *out_drops);
+static long read_rss_kb (void);
 
 int main (int argc, char **argv)
 {
@@ -205,6 +245,23 @@ int main (int argc, char **argv)
     // update defense
     update_defense();
     
+    // init statistics
+    stats.accepted = 0;
+    stats.refused = 0;
+    stats.closed = 0;
+    LogHist_Init(&stats.accept_delay);
+    last_listen_overflows = 0;
+    last_listen_drops = 0;
+    read_listen_drops(&last_listen_overflows, &last_listen_drops);
+    start_rss = read_rss_kb();
+    
+    // init report timer
+    last_report_time = btime_gettime();
+    BTimer_Init(&report_timer, options.report_interval, report_timer_handler, NULL);
+    if (options.report_interval > 0) {
+        BReactor_SetTimer(&ss, &report_timer);
+    }
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
@@ -214,6 +271,8 @@ int main (int argc, char **argv)
         struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
         client_free(client);
     }
+    // free report timer
+    BReactor_RemoveTimer(&ss, &report_timer);
     // free listener
     BListener_Free(&listener);
 fail3:
@@ -245,6 +304,10 @@ void print_help (const char *name)
         "        --disconnect-time <milliseconds>\n"
         "        [--defense-prepare-clients <number>]\n"
         "        [--defense-activate-clients <number>]\n"
+        #ifdef BADVPN_LINUX
+        "        [--splice]\n"
+        #endif
+        "        [--report-interval <milliseconds / 0>]\n"
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
@@ -266,6 +329,10 @@ int parse_arguments (int argc, char *argv[])
     options.disconnect_time = -1;
     options.defense_prepare_clients = -1;
     options.defense_activate_clients = -1;
+    #ifdef BADVPN_LINUX
+    options.splice = 0;
+    #endif
+    options.report_interval = DEFAULT_REPORT_INTERVAL;
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
@@ -332,6 +399,22 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--splice")) {
+            options.splice = 1;
+        }
+        #endif
+        else if (!strcmp(arg, "--report-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.report_interval = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -411,7 +494,8 @@ void signal_handler (void *unused)
 void listener_handler (void *unused)
 {
     if (num_clients == options.max_clients) {
-        BLog(BLOG_ERROR, "maximum number of clients reached");
+        BLog(BLOG_INFO, "maximum number of clients reached");
+        stats.refused++;
         goto fail0;
     }
     
@@ -428,16 +512,40 @@ void listener_handler (void *unused)
         goto fail1;
     }
     
-    // init connection interfaces
-    BConnection_RecvAsync_Init(&client->con);
-    BConnection_SendAsync_Init(&client->con);
-    StreamRecvInterface *recv_if = BConnection_RecvAsync_GetIf(&client->con);
-    StreamPassInterface *send_if = BConnection_SendAsync_GetIf(&client->con);
+    // record how long the connection waited to be accepted
+    int accept_delay;
+    if (BConnection_GetAcceptDelay(&client->con, &accept_delay)) {
+        LogHist_Add(&stats.accept_delay, accept_delay);
+    }
+    stats.accepted++;
     
-    // init stream buffer (to loop received data back to the client)
-    if (!StreamBuffer_Init(&client->buf, BUF_SIZE, recv_if, send_if)) {
-        BLog(BLOG_ERROR, "StreamBuffer_Init failed");
-        goto fail2;
+    client->spliced = 0;
+#ifdef BADVPN_LINUX
+    client->spliced = options.splice;
+#endif
+    
+    if (client->spliced) {
+#ifdef BADVPN_LINUX
+        // loop received data back in the kernel
+        int fd = BConnection_ReleaseFd(&client->con);
+        if (!BConnectionPipe_Init(&client->pipe, &ss, fd, fd, (BConnectionPipe_handler)client_pipe_handler, client)) {
+            BLog(BLOG_ERROR, "BConnectionPipe_Init failed");
+            close(fd);
+            goto fail1;
+        }
+#endif
+    } else {
+        // init connection interfaces
+        BConnection_RecvAsync_Init(&client->con);
+        BConnection_SendAsync_Init(&client->con);
+        StreamRecvInterface *recv_if = BConnection_RecvAsync_GetIf(&client->con);
+        StreamPassInterface *send_if = BConnection_SendAsync_GetIf(&client->con);
+        
+        // init stream buffer (to loop received data back to the client)
+        if (!StreamBuffer_Init(&client->buf, BUF_SIZE, recv_if, send_if)) {
+            BLog(BLOG_ERROR, "StreamBuffer_Init failed");
+            goto fail2;
+        }
     }
     
     // init disconnect timer
@@ -449,7 +557,7 @@ void listener_handler (void *unused)
     num_clients++;
     
     client_log(client, BLOG_INFO, "connected");
-    BLog(BLOG_NOTICE, "%d clients", num_clients);
+    BLog(BLOG_INFO, "%d clients", num_clients);
     
     // update defense
     update_defense();
@@ -474,20 +582,29 @@ void client_free (struct client *client)
     // free disconnect timer
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
     
-    // free stream buffer
-    StreamBuffer_Free(&client->buf);
-    
-    // free connection interfaces
-    BConnection_SendAsync_Free(&client->con);
-    BConnection_RecvAsync_Free(&client->con);
-    
-    // free connection
-    BConnection_Free(&client->con);
+    if (client->spliced) {
+#ifdef BADVPN_LINUX
+        // free pipe, closing the connection
+        BConnectionPipe_Free(&client->pipe);
+#endif
+    } else {
+        // free stream buffer
+        StreamBuffer_Free(&client->buf);
+        
+        // free connection interfaces
+        BConnection_SendAsync_Free(&client->con);
+        BConnection_RecvAsync_Free(&client->con);
+        
+        // free connection
+        BConnection_Free(&client->con);
+    }
     
     // free structure
     free(client);
     
-    BLog(BLOG_NOTICE, "%d clients", num_clients);
+    stats.closed++;
+    
+    BLog(BLOG_INFO, "%d clients", num_clients);
     
     // update defense
     update_defense();
@@ -529,6 +646,22 @@ void client_connection_handler (struct client *client, int event)
     client_free(client);
 }
 
+#ifdef BADVPN_LINUX
+
+void client_pipe_handler (struct client *client, int event)
+{
+    if (event == BCONNECTIONPIPE_EVENT_FINISHED) {
+        client_log(client, BLOG_INFO, "client closed");
+    } else {
+        client_log(client, BLOG_INFO, "client error");
+    }
+    
+    // free client
+    client_free(client);
+}
+
+#endif
+
 void update_defense (void)
 {
 #ifdef BADVPN_LINUX
@@ -565,3 +698,110 @@ void update_defense (void)
     }
 #endif
 }
+
+void report_timer_handler (void *unused)
+{
+    BReactor_SetTimer(&ss, &report_timer);
+    
+    btime_t now = btime_gettime();
+    double secs = (now > last_report_time ? (now - last_report_time) / 1000.0 : 1.0);
+    last_report_time = now;
+    
+    // SYNs and connections the kernel dropped because the accept queue was full;
+    // these counters are for the whole network namespace
+    uint64_t overflows = last_listen_overflows;
+    uint64_t drops = last_listen_drops;
+    read_listen_drops(&overflows, &drops);
+    
+    int queue_len = -1;
+    int queue_max = -1;
+    BListener_GetQueueLength(&listener, &queue_len, &queue_max);
+    
+    long rss = read_rss_kb();
+    
+    BLog(BLOG_NOTICE, "%d clients, accepted %.0f/s, refused %.0f/s, closed %.0f/s, accept queue %d/%d, overflows %"PRIu64", drops %"PRIu64,
+         num_clients, stats.accepted / secs, stats.refused / secs, stats.closed / secs, queue_len, queue_max,
+         overflows - last_listen_overflows, drops - last_listen_drops);
+    
+    if (stats.accept_delay.count > 0) {
+        BLog(BLOG_NOTICE, "accept delay (ms): p50 %"PRIu64" p99 %"PRIu64" max %"PRIu64,
+             LogHist_Percentile(&stats.accept_delay, 0.5), LogHist_Percentile(&stats.accept_delay, 0.99), LogHist_Percentile(&stats.accept_delay, 1.0));
+    }
+    
+    if (rss >= 0 && start_rss >= 0) {
+        double per_client = (num_clients > 0 ? (double)(rss - start_rss) / num_clients : 0.0);
+        BLog(BLOG_NOTICE, "memory: %ld KiB, %+ld KiB since start, %.1f KiB per client", rss, rss - start_rss, per_client);
+    }
+    
+    last_listen_overflows = overflows;
+    last_listen_drops = drops;
+    stats.accepted = 0;
+    stats.refused = 0;
+    stats.closed = 0;
+    LogHist_Init(&stats.accept_delay);
+}
+
+int read_listen_drops (uint64_t *out_overflows, uint64_t *out_drops)
+{
+#ifdef BADVPN_LINUX
+    FILE *f = fopen("/proc/net/netstat", "r");
+    if (!f) {
+        return 0;
+    }
+    
+    // a line of TcpExt field names is followed by a line of their values
+    char names[4096];
+    char values[4096];
+    int found = 0;
+    while (fgets(names, sizeof(names), f)) {
+        if (strncmp(names, "TcpExt:", 7) || !fgets(values, sizeof(values), f)) {
+            continue;
+        }
+        
+        char *name_save;
+        char *value_save;
+        char *name = strtok_r(names, " \n", &name_save);
+        char *value = strtok_r(values, " \n", &value_save);
+        while (name && value) {
+            if (!strcmp(name, "ListenOverflows")) {
+                *out_overflows = strtoull(value, NULL, 10);
+                found++;
+            }
+            else if (!strcmp(name, "ListenDrops")) {
+                *out_drops = strtoull(value, NULL, 10);
+                found++;
+            }
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        break;
+    }
+    
+    fclose(f);
+    return (found == 2);
+#else
+    return 0;
+#endif
+}
+
+long read_rss_kb (void)
+{
+#ifdef BADVPN_LINUX
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return -1;
+    }
+    
+    long size;
+    long resident;
+    int res = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if (res != 2) {
+        return -1;
+    }
+    
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
@@ -28,11 +28,13 @@
  */
 
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include <misc/debug.h>
+#include <misc/balloc.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
@@ -41,11 +43,18 @@
 #include <system/BNetwork.h>
 #include <arpprobe/BArpProbe.h>
 
+struct probe {
+    char *addr_str;
+    BArpProbe arpprobe;
+};
+
 BReactor reactor;
-BArpProbe arpprobe;
+BArpProbeEngine engine;
+struct probe *probes;
+int num_probes;
 
 static void signal_handler (void *user);
-static void arpprobe_handler (void *unused, int event);
+static void arpprobe_handler (struct probe *p, int event);
 
 int main (int argc, char **argv)
 {
@@ -53,13 +62,12 @@ int main (int argc, char **argv)
         return 1;
     }
     
-    if (argc != 3) {
-        printf("Usage: %s <interface> <addr>\n", argv[0]);
+    if (argc < 3) {
+        printf("Usage: %s <interface> <addr> ...\n", argv[0]);
         goto fail0;
     }
     
     char *ifname = argv[1];
-    uint32_t addr = inet_addr(argv[2]);
     
     BTime_Init();
     
@@ -80,14 +88,34 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
-    if (!BArpProbe_Init(&arpprobe, ifname, addr, &reactor, NULL, arpprobe_handler)) {
-        DEBUG("BArpProbe_Init failed");
+    if (!BArpProbeEngine_Init(&engine, ifname, &reactor)) {
+        DEBUG("BArpProbeEngine_Init failed");
         goto fail3;
     }
     
+    if (!(probes = BAllocArray(argc - 2, sizeof(probes[0])))) {
+        DEBUG("BAllocArray failed");
+        goto fail4;
+    }
+    
+    for (num_probes = 0; num_probes < argc - 2; num_probes++) {
+        struct probe *p = &probes[num_probes];
+        p->addr_str = argv[2 + num_probes];
+        if (!BArpProbe_InitEngine(&p->arpprobe, &engine, inet_addr(p->addr_str), p, (BArpProbe_handler)arpprobe_handler)) {
+            DEBUG("BArpProbe_InitEngine failed");
+            goto fail5;
+        }
+    }
+    
     BReactor_Exec(&reactor);
     
-    BArpProbe_Free(&arpprobe);
+fail5:
+    while (num_probes > 0) {
+        BArpProbe_Free(&probes[--num_probes].arpprobe);
+    }
+    BFree(probes);
+fail4:
+    BArpProbeEngine_Free(&engine);
 fail3:
     BSignal_Finish();
 fail2:
@@ -107,19 +135,19 @@ void signal_handler (void *user)
     BReactor_Quit(&reactor, 0);
 }
 
-void arpprobe_handler (void *unused, int event)
+void arpprobe_handler (struct probe *p, int event)
 {
     switch (event) {
         case BARPPROBE_EVENT_EXIST: {
-            printf("ARPPROBE: exist\n");
+            printf("ARPPROBE: %s exist\n", p->addr_str);
         } break;
         
         case BARPPROBE_EVENT_NOEXIST: {
-            printf("ARPPROBE: noexist\n");
+            printf("ARPPROBE: %s noexist\n", p->addr_str);
         } break;
         
         case BARPPROBE_EVENT_ERROR: {
-            printf("ARPPROBE: error\n");
+            printf("ARPPROBE: %s error\n", p->addr_str);
             
             // exit reactor
             BReactor_Quit(&reactor, 0);
@@ -107,6 +107,7 @@ int main (int argc, char **argv)
     int unit_size = num_blocks * block_size;
     
     printf("unit size %d\n", unit_size);
+    printf("implementation %s\n", BEncryption_cipher_implementation(cipher));
     
     uint8_t *buf1 = (uint8_t *)BAlloc(unit_size);
     if (!buf1) {
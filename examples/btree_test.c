@@ -0,0 +1,179 @@
+/**
+ * @file btree_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/balloc.h>
+#include <misc/debug.h>
+#include <misc/compare.h>
+#include <misc/print_macros.h>
+#include <structure/BTree.h>
+
+#include "btree_test_tree.h"
+#include <structure/BTree_decl.h>
+
+#include "btree_test_tree.h"
+#include <structure/BTree_impl.h>
+
+static uint32_t rand32 (void)
+{
+    return ((uint32_t)(rand() & 0xFFFF) << 16) | (uint32_t)(rand() & 0xFFFF);
+}
+
+static uint32_t value_of (uint32_t key)
+{
+    return key * 2654435761u;
+}
+
+// brute-force reference for the bound queries; dir is 1 to search upwards
+static int64_t find_present (const uint8_t *present, size_t num_keys, int64_t start, int dir)
+{
+    for (int64_t k = start; k >= 0 && k < (int64_t)num_keys; k += dir) {
+        if (present[k]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void check_ref (MyTreeRef ref, int64_t expected)
+{
+    if (expected < 0) {
+        ASSERT_FORCE(MyTreeIsNullRef(ref))
+    } else {
+        ASSERT_FORCE(!MyTreeIsNullRef(ref))
+        ASSERT_FORCE(*MyTreeRefKey(ref) == (uint32_t)expected)
+        ASSERT_FORCE(*MyTreeRefValue(ref) == value_of(expected))
+    }
+}
+
+static void verify_order (MyTree *tree, const uint8_t *present, size_t num_keys)
+{
+    MyTree_Verify(tree, 0);
+    
+    int64_t k = find_present(present, num_keys, 0, 1);
+    for (MyTreeRef ref = MyTree_GetFirst(tree); !MyTreeIsNullRef(ref); ref = MyTree_GetNext(tree, ref)) {
+        check_ref(ref, k);
+        k = find_present(present, num_keys, k + 1, 1);
+    }
+    ASSERT_FORCE(k == -1)
+    
+    k = find_present(present, num_keys, num_keys - 1, -1);
+    for (MyTreeRef ref = MyTree_GetLast(tree); !MyTreeIsNullRef(ref); ref = MyTree_GetPrev(tree, ref)) {
+        check_ref(ref, k);
+        k = find_present(present, num_keys, k - 1, -1);
+    }
+    ASSERT_FORCE(k == -1)
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc != 5) {
+        fprintf(stderr, "Usage: %s <num_keys> <num_ops> <verify_interval> <seed>\n", (argc > 0 ? argv[0] : ""));
+        return 1;
+    }
+    
+    size_t num_keys = atoi(argv[1]);
+    size_t num_ops = atoi(argv[2]);
+    size_t verify_interval = atoi(argv[3]);
+    srand(atoi(argv[4]));
+    
+    ASSERT_FORCE(num_keys > 0)
+    
+    uint8_t *present = (uint8_t *)BAllocArray(num_keys, sizeof(present[0]));
+    ASSERT_FORCE(present)
+    for (size_t i = 0; i < num_keys; i++) {
+        present[i] = 0;
+    }
+    
+    MyTree tree;
+    MyTree_Init(&tree);
+    
+    size_t num_in_tree = 0;
+    size_t num_inserted = 0;
+    size_t num_removed = 0;
+    
+    for (size_t op = 0; op < num_ops; op++) {
+        uint32_t key = rand32() % num_keys;
+        
+        // grow during the first half, shrink during the second half
+        int insert_pct = (op < num_ops / 2 ? 60 : 30);
+        int r = rand() % 100;
+        
+        if (r < insert_pct) {
+            MyTreeRef ref;
+            int res = MyTree_Insert(&tree, 0, key, value_of(key), &ref);
+            ASSERT_FORCE(res == !present[key])
+            check_ref(ref, key);
+            if (res) {
+                present[key] = 1;
+                num_in_tree++;
+                num_inserted++;
+            }
+        }
+        else if (r < insert_pct + 10) {
+            check_ref(MyTree_LookupExact(&tree, 0, key), (present[key] ? (int64_t)key : -1));
+        }
+        else if (r < insert_pct + 20) {
+            check_ref(MyTree_GetFirstGreater(&tree, 0, key), find_present(present, num_keys, (int64_t)key + 1, 1));
+            check_ref(MyTree_GetFirstGreaterEqual(&tree, 0, key), find_present(present, num_keys, key, 1));
+            check_ref(MyTree_GetLastLesser(&tree, 0, key), find_present(present, num_keys, (int64_t)key - 1, -1));
+            check_ref(MyTree_GetLastLesserEqual(&tree, 0, key), find_present(present, num_keys, key, -1));
+        }
+        else {
+            int res = MyTree_Remove(&tree, 0, key);
+            ASSERT_FORCE(res == present[key])
+            if (res) {
+                present[key] = 0;
+                num_in_tree--;
+                num_removed++;
+            }
+        }
+        
+        ASSERT_FORCE(MyTree_Count(&tree) == num_in_tree)
+        ASSERT_FORCE(MyTree_IsEmpty(&tree) == (num_in_tree == 0))
+        
+        if (verify_interval > 0 && op % verify_interval == 0) {
+            verify_order(&tree, present, num_keys);
+        }
+    }
+    
+    verify_order(&tree, present, num_keys);
+    
+    printf("inserted %" PRIsz ", removed %" PRIsz ", remaining %" PRIsz ", height %d\n",
+           num_inserted, num_removed, num_in_tree, tree.height);
+    
+    MyTree_Free(&tree);
+    BFree(present);
+    
+    return 0;
+}
@@ -0,0 +1,6 @@
+#define BTREE_PARAM_NAME MyTree
+#define BTREE_PARAM_TYPE_KEY uint32_t
+#define BTREE_PARAM_TYPE_VALUE uint32_t
+#define BTREE_PARAM_TYPE_ARG int
+#define BTREE_PARAM_ORDER 5
+#define BTREE_PARAM_FUN_COMPARE(arg, key1, key2) B_COMPARE((key1), (key2))
@@ -0,0 +1,873 @@
+/**
+ * @file crypto_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark of the cryptographic components and the SPProto pipeline.
+ *
+ * Results are printed to standard output as tab-separated lines, one per
+ * measurement, preceded by a header line:
+ *
+ *   suite variant size threads ops ns_per_op mb_per_s
+ *
+ * "size" is the number of bytes processed by one operation (0 where this
+ * does not apply), "threads" is the number of BThreadWorkDispatcher threads
+ * (0 means computations are done in the event loop). Anything else, such as
+ * the implementation chosen for a cipher, is printed to standard error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/balign.h>
+#include <base/BLog.h>
+#include <base/DebugObject.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <security/BSecurity.h>
+#include <security/BRandom.h>
+#include <security/BEncryption.h>
+#include <security/BHash.h>
+#include <security/BAead.h>
+#include <security/OTPCalculator.h>
+#include <security/OTPGenerator.h>
+#include <security/OTPChecker.h>
+#include <threadwork/BThreadWork.h>
+#include <client/SPProtoEncoder.h>
+#include <client/SPProtoDecoder.h>
+
+#define DEFAULT_BYTES (32 * 1024 * 1024)
+#define DEFAULT_MAX_THREADS 4
+#define MIN_OPS 64
+#define BATCH_SIZE 8
+#define OTP_NUM 1000
+#define OTP_ROUNDS 16
+#define SPPROTO_OTP_WARNING 100
+
+static const int packet_sizes[] = {64, 256, 576, 1400, 4096, 9000};
+#define NUM_PACKET_SIZES (sizeof(packet_sizes) / sizeof(packet_sizes[0]))
+
+static long long num_bytes = DEFAULT_BYTES;
+static int max_threads = DEFAULT_MAX_THREADS;
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int ops_for_size (int size)
+{
+    long long ops = num_bytes / (size > 0 ? size : 1);
+    if (ops < MIN_OPS) {
+        ops = MIN_OPS;
+    }
+    if (ops > INT_MAX) {
+        ops = INT_MAX;
+    }
+    return ops;
+}
+
+static int next_threads (int threads)
+{
+    return (threads == 0 ? 1 : 2 * threads);
+}
+
+static void print_result (const char *suite, const char *variant, int size, int threads, int ops, uint64_t ns)
+{
+    double ns_per_op = (ops > 0 ? (double)ns / ops : 0.0);
+    double mb_per_s = (ns > 0 ? ((double)size * ops * 1000.0) / ns : 0.0);
+    
+    printf("%s\t%s\t%d\t%d\t%d\t%.1f\t%.2f\n", suite, variant, size, threads, ops, ns_per_op, mb_per_s);
+    fflush(stdout);
+}
+
+static const char * cipher_name (int cipher)
+{
+    switch (cipher) {
+        case BENCRYPTION_CIPHER_BLOWFISH:
+            return "blowfish";
+        case BENCRYPTION_CIPHER_AES:
+            return "aes";
+        default:
+            ASSERT(0);
+            return NULL;
+    }
+}
+
+static const char * hash_name (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_MD5:
+            return "md5";
+        case BHASH_TYPE_SHA1:
+            return "sha1";
+        case BHASH_TYPE_SHA256:
+            return "sha256";
+        case BHASH_TYPE_BLAKE2S:
+            return "blake2s";
+        case BHASH_TYPE_HMAC_SHA256:
+            return "hmac-sha256";
+        case BHASH_TYPE_BLAKE2S_KEYED:
+            return "blake2s-keyed";
+        case BHASH_TYPE_POLY1305:
+            return "poly1305";
+        default:
+            ASSERT(0);
+            return NULL;
+    }
+}
+
+static int bench_encryption (void)
+{
+    static const int ciphers[] = {BENCRYPTION_CIPHER_BLOWFISH, BENCRYPTION_CIPHER_AES};
+    
+    int ret = 0;
+    
+    int stride = balign_up(9000, BENCRYPTION_MAX_BLOCK_SIZE);
+    
+    uint8_t *bufs = (uint8_t *)BAllocArray(2 * BATCH_SIZE, stride);
+    if (!bufs) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    
+    for (size_t c = 0; c < sizeof(ciphers) / sizeof(ciphers[0]); c++) {
+        int cipher = ciphers[c];
+        int key_size = BEncryption_cipher_key_size(cipher);
+        int block_size = BEncryption_cipher_block_size(cipher);
+        
+        fprintf(stderr, "%s implementation %s\n", cipher_name(cipher), BEncryption_cipher_implementation(cipher));
+        
+        uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+        BRandom_randomize(key, key_size);
+        
+        for (int mode = BENCRYPTION_MODE_ENCRYPT; mode <= BENCRYPTION_MODE_DECRYPT; mode++) {
+            const char *mode_str = (mode == BENCRYPTION_MODE_ENCRYPT ? "enc" : "dec");
+            
+            BEncryption enc;
+            BEncryption_Init(&enc, mode, cipher, key);
+            
+            for (size_t s = 0; s < NUM_PACKET_SIZES; s++) {
+                int size = balign_up(packet_sizes[s], block_size);
+                int ops = ops_for_size(size);
+                
+                uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
+                BRandom_randomize(iv, block_size);
+                BRandom_randomize(bufs, size);
+                
+                char variant[64];
+                
+                // one buffer at a time
+                uint64_t start = now_ns();
+                for (int i = 0; i < ops; i++) {
+                    if (mode == BENCRYPTION_MODE_ENCRYPT) {
+                        BEncryption_Encrypt(&enc, bufs, bufs + stride, size, iv);
+                    } else {
+                        BEncryption_Decrypt(&enc, bufs, bufs + stride, size, iv);
+                    }
+                }
+                snprintf(variant, sizeof(variant), "%s-cbc-%s", cipher_name(cipher), mode_str);
+                print_result("encryption", variant, size, 0, ops, now_ns() - start);
+                
+                // batches of independent buffers
+                struct BEncryption_batch_item items[BATCH_SIZE];
+                uint8_t ivs[BATCH_SIZE][BENCRYPTION_MAX_BLOCK_SIZE];
+                for (int j = 0; j < BATCH_SIZE; j++) {
+                    BRandom_randomize(ivs[j], block_size);
+                    items[j].in = bufs + (size_t)2 * j * stride;
+                    items[j].out = bufs + (size_t)(2 * j + 1) * stride;
+                    items[j].len = size;
+                    items[j].iv = ivs[j];
+                }
+                
+                int batch_ops = balign_up(ops, BATCH_SIZE);
+                start = now_ns();
+                for (int i = 0; i < batch_ops; i += BATCH_SIZE) {
+                    if (mode == BENCRYPTION_MODE_ENCRYPT) {
+                        BEncryption_EncryptBatch(&enc, items, BATCH_SIZE);
+                    } else {
+                        BEncryption_DecryptBatch(&enc, items, BATCH_SIZE);
+                    }
+                }
+                snprintf(variant, sizeof(variant), "%s-cbc-%s-batch%d", cipher_name(cipher), mode_str, BATCH_SIZE);
+                print_result("encryption", variant, size, 0, batch_ops, now_ns() - start);
+            }
+            
+            BEncryption_Free(&enc);
+        }
+    }
+    
+    ret = 1;
+    
+    BFree(bufs);
+fail0:
+    return ret;
+}
+
+static int bench_aead (void)
+{
+    static const int ciphers[] = {BAEAD_CIPHER_AES_128_GCM, BAEAD_CIPHER_CHACHA20_POLY1305};
+    static const char *names[] = {"aes-128-gcm", "chacha20-poly1305"};
+    
+    int ret = 0;
+    
+    uint8_t *buf1 = (uint8_t *)BAlloc(9000);
+    if (!buf1) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    
+    uint8_t *buf2 = (uint8_t *)BAlloc(9000);
+    if (!buf2) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail1;
+    }
+    
+    for (size_t c = 0; c < sizeof(ciphers) / sizeof(ciphers[0]); c++) {
+        uint8_t key[BAEAD_MAX_KEY_SIZE];
+        BRandom_randomize(key, BAead_cipher_key_size(ciphers[c]));
+        
+        BAead enc;
+        if (!BAead_Init(&enc, BAEAD_MODE_ENCRYPT, ciphers[c])) {
+            fprintf(stderr, "BAead_Init failed\n");
+            goto fail2;
+        }
+        BAead_SetKey(&enc, key);
+        
+        BAead dec;
+        if (!BAead_Init(&dec, BAEAD_MODE_DECRYPT, ciphers[c])) {
+            fprintf(stderr, "BAead_Init failed\n");
+            BAead_Free(&enc);
+            goto fail2;
+        }
+        BAead_SetKey(&dec, key);
+        
+        for (size_t s = 0; s < NUM_PACKET_SIZES; s++) {
+            int size = packet_sizes[s];
+            int ops = ops_for_size(size);
+            
+            uint8_t nonce[BAEAD_NONCE_SIZE];
+            uint8_t tag[BAEAD_TAG_SIZE];
+            BRandom_randomize(nonce, sizeof(nonce));
+            BRandom_randomize(buf1, size);
+            
+            char variant[64];
+            
+            uint64_t start = now_ns();
+            for (int i = 0; i < ops; i++) {
+                BAead_Encrypt(&enc, nonce, buf1, buf2, size, tag);
+            }
+            snprintf(variant, sizeof(variant), "%s-enc", names[c]);
+            print_result("aead", variant, size, 0, ops, now_ns() - start);
+            
+            start = now_ns();
+            for (int i = 0; i < ops; i++) {
+                if (!BAead_Decrypt(&dec, nonce, buf2, buf1, size, tag)) {
+                    fprintf(stderr, "BAead_Decrypt failed\n");
+                    BAead_Free(&dec);
+                    BAead_Free(&enc);
+                    goto fail2;
+                }
+            }
+            snprintf(variant, sizeof(variant), "%s-dec", names[c]);
+            print_result("aead", variant, size, 0, ops, now_ns() - start);
+        }
+        
+        BAead_Free(&dec);
+        BAead_Free(&enc);
+    }
+    
+    ret = 1;
+    
+fail2:
+    BFree(buf2);
+fail1:
+    BFree(buf1);
+fail0:
+    return ret;
+}
+
+static int bench_hash (void)
+{
+    int ret = 0;
+    
+    uint8_t *buf = (uint8_t *)BAlloc(9000);
+    if (!buf) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    BRandom_randomize(buf, 9000);
+    
+    for (int type = 1; BHash_type_valid(type); type++) {
+        BHash hash;
+        if (!BHash_Init(&hash, type)) {
+            fprintf(stderr, "BHash_Init failed\n");
+            goto fail1;
+        }
+        
+        uint8_t key[BHASH_MAX_KEY_SIZE];
+        if (BHash_type_keyed(type)) {
+            BRandom_randomize(key, BHash_key_size(type));
+            BHash_SetKey(&hash, key);
+        }
+        
+        for (size_t s = 0; s < NUM_PACKET_SIZES; s++) {
+            int size = packet_sizes[s];
+            int ops = ops_for_size(size);
+            
+            uint8_t out[BHASH_MAX_SIZE];
+            
+            uint64_t start = now_ns();
+            for (int i = 0; i < ops; i++) {
+                if (BHash_type_keyed(type) && BHash_type_one_time_key(type)) {
+                    BHash_SetKey(&hash, key);
+                }
+                BHash_Start(&hash);
+                BHash_Update(&hash, buf, size);
+                BHash_Finish(&hash, out);
+            }
+            print_result("hash", hash_name(type), size, 0, ops, now_ns() - start);
+            
+            // the one-shot function looks up the implementation every time
+            if (!BHash_type_keyed(type)) {
+                char variant[64];
+                snprintf(variant, sizeof(variant), "%s-oneshot", hash_name(type));
+                
+                start = now_ns();
+                for (int i = 0; i < ops; i++) {
+                    BHash_calculate(type, buf, size, out);
+                }
+                print_result("hash", variant, size, 0, ops, now_ns() - start);
+            }
+        }
+        
+        BHash_Free(&hash);
+    }
+    
+    ret = 1;
+    
+fail1:
+    BFree(buf);
+fail0:
+    return ret;
+}
+
+// A reactor cannot be run again after BReactor_Quit, so each measurement
+// which needs the event loop gets its own reactor and work dispatcher.
+struct bench_loop {
+    BReactor reactor;
+    BThreadWorkDispatcher twd;
+};
+
+static int bench_loop_init (struct bench_loop *l, int threads)
+{
+    if (!BReactor_Init(&l->reactor)) {
+        fprintf(stderr, "BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (!BThreadWorkDispatcher_Init(&l->twd, &l->reactor, threads)) {
+        fprintf(stderr, "BThreadWorkDispatcher_Init failed\n");
+        goto fail1;
+    }
+    
+    return 1;
+    
+fail1:
+    BReactor_Free(&l->reactor);
+fail0:
+    return 0;
+}
+
+static void bench_loop_free (struct bench_loop *l)
+{
+    BThreadWorkDispatcher_Free(&l->twd);
+    BReactor_Free(&l->reactor);
+}
+
+struct otp_bench {
+    struct bench_loop loop;
+    OTPGenerator gen;
+    OTPChecker checker;
+    int rounds;
+    uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+    uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
+};
+
+static void otp_gen_handler (struct otp_bench *b)
+{
+    if (++b->rounds == OTP_ROUNDS) {
+        BReactor_Quit(&b->loop.reactor, 0);
+        return;
+    }
+    
+    OTPGenerator_SetSeed(&b->gen, b->key, b->iv);
+}
+
+static void otp_checker_handler (struct otp_bench *b)
+{
+    if (++b->rounds == OTP_ROUNDS) {
+        BReactor_Quit(&b->loop.reactor, 0);
+        return;
+    }
+    
+    OTPChecker_AddSeed(&b->checker, b->rounds, b->key, b->iv);
+}
+
+static int bench_otp_generator (int threads)
+{
+    int ret = 0;
+    
+    struct otp_bench b;
+    BRandom_randomize(b.key, sizeof(b.key));
+    BRandom_randomize(b.iv, sizeof(b.iv));
+    
+    if (!bench_loop_init(&b.loop, threads)) {
+        goto fail0;
+    }
+    
+    if (!OTPGenerator_Init(&b.gen, OTP_NUM, BENCRYPTION_CIPHER_AES, &b.loop.twd, (OTPGenerator_handler)otp_gen_handler, &b)) {
+        fprintf(stderr, "OTPGenerator_Init failed\n");
+        goto fail1;
+    }
+    
+    // time to generate the sending OTPs for a seed
+    b.rounds = 0;
+    uint64_t start = now_ns();
+    OTPGenerator_SetSeed(&b.gen, b.key, b.iv);
+    BReactor_Exec(&b.loop.reactor);
+    print_result("otp", "generator-seed", 0, threads, OTP_ROUNDS, now_ns() - start);
+    
+    ret = 1;
+    
+    OTPGenerator_Free(&b.gen);
+fail1:
+    bench_loop_free(&b.loop);
+fail0:
+    return ret;
+}
+
+static int bench_otp_checker (int threads)
+{
+    int ret = 0;
+    
+    struct otp_bench b;
+    BRandom_randomize(b.key, sizeof(b.key));
+    BRandom_randomize(b.iv, sizeof(b.iv));
+    
+    if (!bench_loop_init(&b.loop, threads)) {
+        goto fail0;
+    }
+    
+    if (!OTPChecker_Init(&b.checker, OTP_NUM, BENCRYPTION_CIPHER_AES, 2, &b.loop.twd)) {
+        fprintf(stderr, "OTPChecker_Init failed\n");
+        goto fail1;
+    }
+    OTPChecker_SetHandlers(&b.checker, (OTPChecker_handler)otp_checker_handler, &b);
+    
+    OTPCalculator calc;
+    if (!OTPCalculator_Init(&calc, OTP_NUM, BENCRYPTION_CIPHER_AES)) {
+        fprintf(stderr, "OTPCalculator_Init failed\n");
+        goto fail2;
+    }
+    
+    // time to build the receiving table for a seed
+    b.rounds = 0;
+    uint64_t start = now_ns();
+    OTPChecker_AddSeed(&b.checker, b.rounds, b.key, b.iv);
+    BReactor_Exec(&b.loop.reactor);
+    print_result("otp", "checker-seed", 0, threads, OTP_ROUNDS, now_ns() - start);
+    
+    // lookups of the valid OTPs of the last seed
+    otp_t *otps = OTPCalculator_Generate(&calc, b.key, b.iv, 1);
+    
+    int accepted = 0;
+    start = now_ns();
+    for (int i = 0; i < OTP_NUM; i++) {
+        accepted += OTPChecker_CheckOTP(&b.checker, OTP_ROUNDS - 1, otps[i]);
+    }
+    print_result("otp", "checker-check-valid", 0, threads, OTP_NUM, now_ns() - start);
+    
+    if (accepted != OTP_NUM) {
+        fprintf(stderr, "OTPChecker accepted %d of %d OTPs\n", accepted, OTP_NUM);
+        goto fail3;
+    }
+    
+    // lookups of random OTPs, which are almost certainly all invalid
+    otp_t random_otps[OTP_NUM];
+    BRandom_randomize((uint8_t *)random_otps, sizeof(random_otps));
+    
+    start = now_ns();
+    for (int i = 0; i < OTP_NUM; i++) {
+        accepted += OTPChecker_CheckOTP(&b.checker, OTP_ROUNDS - 1, random_otps[i]);
+    }
+    print_result("otp", "checker-check-random", 0, threads, OTP_NUM, now_ns() - start);
+    
+    ret = 1;
+    
+fail3:
+    OTPCalculator_Free(&calc);
+fail2:
+    OTPChecker_Free(&b.checker);
+fail1:
+    bench_loop_free(&b.loop);
+fail0:
+    return ret;
+}
+
+static int bench_otp_threads (int threads)
+{
+    return (bench_otp_generator(threads) && bench_otp_checker(threads));
+}
+
+struct spproto_bench {
+    struct bench_loop loop;
+    struct spproto_security_params params;
+    int size;
+    int ops;
+    int encoded;
+    int delivered;
+    int started;
+    uint64_t start_ns;
+    uint16_t seed_id;
+    uint8_t *link_buf;
+    PacketRecvInterface src;
+    PacketPassInterface sink;
+    SPProtoEncoder enc;
+    SPProtoDecoder dec;
+};
+
+static void spproto_logfunc (struct spproto_bench *b)
+{
+}
+
+static void spproto_new_seed (struct spproto_bench *b)
+{
+    uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+    uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
+    BRandom_randomize(key, sizeof(key));
+    BRandom_randomize(iv, sizeof(iv));
+    
+    b->seed_id++;
+    SPProtoDecoder_AddOTPSeed(&b->dec, b->seed_id, key, iv);
+    SPProtoEncoder_SetOTPSeed(&b->enc, b->seed_id, key, iv);
+}
+
+static void spproto_start (struct spproto_bench *b)
+{
+    ASSERT(!b->started)
+    
+    b->started = 1;
+    b->start_ns = now_ns();
+    PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&b->enc), b->link_buf);
+}
+
+static void spproto_otp_ready (struct spproto_bench *b)
+{
+    // start once the decoder can recognize the first seed, so that the
+    // measurement does not depend on how soon the table happens to be built
+    if (!b->started) {
+        spproto_start(b);
+    }
+}
+
+static void spproto_src_recv (struct spproto_bench *b, uint8_t *data)
+{
+    PacketRecvInterface_Done(&b->src, b->size);
+}
+
+static void spproto_sink_send (struct spproto_bench *b, uint8_t *data, int len)
+{
+    ASSERT(len == b->size)
+    
+    b->delivered++;
+    
+    PacketPassInterface_Done(&b->sink);
+}
+
+static void spproto_link_recv_done (struct spproto_bench *b, int len)
+{
+    if (++b->encoded == b->ops) {
+        BReactor_Quit(&b->loop.reactor, 0);
+        return;
+    }
+    
+    PacketPassInterface_Sender_Send(SPProtoDecoder_GetInput(&b->dec), b->link_buf, len);
+}
+
+static void spproto_link_send_done (struct spproto_bench *b)
+{
+    PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&b->enc), b->link_buf);
+}
+
+static int bench_spproto_run (int threads, struct spproto_security_params params, const char *variant, int size)
+{
+    int ret = 0;
+    
+    struct spproto_bench b;
+    b.params = params;
+    b.size = size;
+    b.ops = ops_for_size(size);
+    b.encoded = 0;
+    b.delivered = 0;
+    b.started = 0;
+    b.seed_id = 0;
+    
+    int num_slots = (threads > 0 ? 4 * threads : 1);
+    
+    int carrier_mtu = spproto_carrier_mtu_for_payload_mtu(params, size);
+    ASSERT(carrier_mtu >= 0)
+    
+    if (!(b.link_buf = (uint8_t *)BAlloc(carrier_mtu))) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    
+    if (!bench_loop_init(&b.loop, threads)) {
+        goto fail1;
+    }
+    
+    BPendingGroup *pg = BReactor_PendingGroup(&b.loop.reactor);
+    
+    PacketRecvInterface_Init(&b.src, size, (PacketRecvInterface_handler_recv)spproto_src_recv, &b, pg);
+    PacketPassInterface_Init(&b.sink, size, (PacketPassInterface_handler_send)spproto_sink_send, &b, pg);
+    
+    if (!SPProtoEncoder_Init2(&b.enc, &b.src, params, SPPROTO_OTP_WARNING, pg, &b.loop.twd, num_slots)) {
+        fprintf(stderr, "SPProtoEncoder_Init2 failed\n");
+        goto fail2;
+    }
+    
+    if (!SPProtoDecoder_Init2(&b.dec, &b.sink, params, 2, pg, &b.loop.twd, &b, (BLog_logfunc)spproto_logfunc, num_slots)) {
+        fprintf(stderr, "SPProtoDecoder_Init2 failed\n");
+        goto fail3;
+    }
+    
+    if (SPPROTO_HAVE_KEY(params)) {
+        uint8_t key[BENCRYPTION_MAX_KEY_SIZE > BAEAD_MAX_KEY_SIZE ? BENCRYPTION_MAX_KEY_SIZE : BAEAD_MAX_KEY_SIZE];
+        BRandom_randomize(key, spproto_key_size(params));
+        SPProtoEncoder_SetEncryptionKey(&b.enc, key);
+        SPProtoDecoder_SetEncryptionKey(&b.dec, key);
+    }
+    
+    PacketRecvInterface_Receiver_Init(SPProtoEncoder_GetOutput(&b.enc), (PacketRecvInterface_handler_done)spproto_link_recv_done, &b);
+    PacketPassInterface_Sender_Init(SPProtoDecoder_GetInput(&b.dec), (PacketPassInterface_handler_done)spproto_link_send_done, &b);
+    
+    if (SPPROTO_HAVE_OTP(params)) {
+        SPProtoEncoder_SetHandlers(&b.enc, (SPProtoEncoder_handler)spproto_new_seed, &b);
+        SPProtoDecoder_SetHandlers(&b.dec, (SPProtoDecoder_otp_handler)spproto_otp_ready, &b);
+        spproto_new_seed(&b);
+    } else {
+        spproto_start(&b);
+    }
+    
+    BReactor_Exec(&b.loop.reactor);
+    uint64_t ns = now_ns() - b.start_ns;
+    
+    // report per delivered packet; with OTPs, packets may still be dropped
+    // while the decoder is building the table for a later seed
+    print_result("spproto", variant, size, threads, b.delivered, ns);
+    
+    ret = 1;
+    
+    SPProtoDecoder_Free(&b.dec);
+fail3:
+    SPProtoEncoder_Free(&b.enc);
+fail2:
+    PacketPassInterface_Free(&b.sink);
+    PacketRecvInterface_Free(&b.src);
+    bench_loop_free(&b.loop);
+fail1:
+    BFree(b.link_buf);
+fail0:
+    return ret;
+}
+
+static int bench_spproto_threads (int threads)
+{
+    struct {
+        const char *variant;
+        int hash_mode;
+        int encryption_mode;
+        int otp_mode;
+        int aead_mode;
+    } configs[] = {
+        {"aes-cbc-sha1", BHASH_TYPE_SHA1, BENCRYPTION_CIPHER_AES, SPPROTO_OTP_MODE_NONE, SPPROTO_AEAD_MODE_NONE},
+        {"aes-cbc-sha1-otp", BHASH_TYPE_SHA1, BENCRYPTION_CIPHER_AES, BENCRYPTION_CIPHER_AES, SPPROTO_AEAD_MODE_NONE},
+        {"aes-cbc-sha256", BHASH_TYPE_SHA256, BENCRYPTION_CIPHER_AES, SPPROTO_OTP_MODE_NONE, SPPROTO_AEAD_MODE_NONE},
+        {"aes-128-gcm", SPPROTO_HASH_MODE_NONE, SPPROTO_ENCRYPTION_MODE_NONE, SPPROTO_OTP_MODE_NONE, BAEAD_CIPHER_AES_128_GCM},
+        {"chacha20-poly1305", SPPROTO_HASH_MODE_NONE, SPPROTO_ENCRYPTION_MODE_NONE, SPPROTO_OTP_MODE_NONE, BAEAD_CIPHER_CHACHA20_POLY1305},
+    };
+    
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        struct spproto_security_params params;
+        params.hash_mode = configs[c].hash_mode;
+        params.encryption_mode = configs[c].encryption_mode;
+        params.otp_mode = configs[c].otp_mode;
+        params.otp_num = OTP_NUM;
+        params.aead_mode = configs[c].aead_mode;
+        
+        for (size_t s = 0; s < NUM_PACKET_SIZES; s++) {
+            if (!bench_spproto_run(threads, params, configs[c].variant, packet_sizes[s])) {
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
+}
+
+static int bench_with_threads (int (*func) (int))
+{
+    for (int threads = 0; threads <= max_threads; threads = next_threads(threads)) {
+        if (!func(threads)) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void usage (char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [--bytes <num>] [--max-threads <num>] [<suite> ...]\n"
+        "    <suite> is one of (encryption, aead, hash, otp, spproto); default is all.\n"
+        "    --bytes is the approximate number of bytes processed per measurement.\n"
+        "    --max-threads is the largest BThreadWorkDispatcher thread count measured.\n",
+        name
+    );
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    int want_encryption = 0;
+    int want_aead = 0;
+    int want_hash = 0;
+    int want_otp = 0;
+    int want_spproto = 0;
+    int have_suite = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--bytes") && i + 1 < argc) {
+            num_bytes = atoll(argv[++i]);
+            if (num_bytes <= 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--max-threads") && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+            if (max_threads < 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "encryption")) {
+            want_encryption = 1;
+            have_suite = 1;
+        }
+        else if (!strcmp(arg, "aead")) {
+            want_aead = 1;
+            have_suite = 1;
+        }
+        else if (!strcmp(arg, "hash")) {
+            want_hash = 1;
+            have_suite = 1;
+        }
+        else if (!strcmp(arg, "otp")) {
+            want_otp = 1;
+            have_suite = 1;
+        }
+        else if (!strcmp(arg, "spproto")) {
+            want_spproto = 1;
+            have_suite = 1;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    
+    if (!have_suite) {
+        want_encryption = want_aead = want_hash = want_otp = want_spproto = 1;
+    }
+    
+    int ret = 1;
+    
+    BTime_Init();
+    BLog_InitStderr();
+    
+    if (!BSecurity_GlobalInitThreadSafe()) {
+        fprintf(stderr, "BSecurity_GlobalInitThreadSafe failed\n");
+        goto fail0;
+    }
+    
+    printf("suite\tvariant\tsize\tthreads\tops\tns_per_op\tmb_per_s\n");
+    
+    if (want_encryption && !bench_encryption()) {
+        goto fail1;
+    }
+    
+    if (want_aead && !bench_aead()) {
+        goto fail1;
+    }
+    
+    if (want_hash && !bench_hash()) {
+        goto fail1;
+    }
+    
+    if (want_otp && !bench_with_threads(bench_otp_threads)) {
+        goto fail1;
+    }
+    
+    if (want_spproto && !bench_with_threads(bench_spproto_threads)) {
+        goto fail1;
+    }
+    
+    ret = 0;
+    
+fail1:
+    BSecurity_GlobalFreeThreadSafe();
+fail0:
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    
+    return ret;
+}
@@ -103,8 +103,11 @@ static void timer_handler (void *user)
     reset_input();
 }
 
-int main ()
+int main (int argc, char **argv)
 {
+    // "drr" selects deficit round robin scheduling
+    int drr = (argc > 1 && !strcmp(argv[1], "drr"));
+    
     // initialize logging
     BLog_InitStdout();
     
@@ -121,7 +124,7 @@ int main ()
     TimerPacketSink_Init(&sink, &reactor, 500, OUTPUT_INTERVAL);
     
     // initialize queue
-    if (!PacketPassFairQueue_Init(&fq, TimerPacketSink_GetInput(&sink), BReactor_PendingGroup(&reactor), 1, 1)) {
+    if (!(drr ? PacketPassFairQueue_InitDRR : PacketPassFairQueue_Init)(&fq, TimerPacketSink_GetInput(&sink), BReactor_PendingGroup(&reactor), 1, 1)) {
         DEBUG("PacketPassFairQueue_Init failed");
         return 1;
     }
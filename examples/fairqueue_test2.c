@@ -28,6 +28,7 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <misc/debug.h>
 #include <system/BReactor.h>
@@ -39,8 +40,19 @@
 
 #define SINK_TIMER 0
 
-int main ()
+int main (int argc, char **argv)
 {
+    // usage: fairqueue_test2 [drr] [weight1 weight2 weight3]
+    int drr = (argc > 1 && !strcmp(argv[1], "drr"));
+    int weights[3] = {1, 1, 1};
+    for (int i = 0; i < 3 && 1 + drr + i < argc; i++) {
+        weights[i] = atoi(argv[1 + drr + i]);
+        if (weights[i] < 1 || weights[i] > FAIRQUEUE_MAX_WEIGHT) {
+            DEBUG("bad weight");
+            return 1;
+        }
+    }
+    
     // initialize logging
     BLog_InitStdout();
     
@@ -60,7 +72,7 @@ int main ()
     
     // initialize queue
     PacketPassFairQueue fq;
-    if (!PacketPassFairQueue_Init(&fq, RandomPacketSink_GetInput(&sink), BReactor_PendingGroup(&reactor), 0, 1)) {
+    if (!(drr ? PacketPassFairQueue_InitDRR : PacketPassFairQueue_Init)(&fq, RandomPacketSink_GetInput(&sink), BReactor_PendingGroup(&reactor), 0, 1)) {
         DEBUG("PacketPassFairQueue_Init failed");
         return 1;
     }
@@ -68,6 +80,7 @@ int main ()
     // initialize source 1
     PacketPassFairQueueFlow flow1;
     PacketPassFairQueueFlow_Init(&flow1, &fq);
+    PacketPassFairQueueFlow_SetWeight(&flow1, weights[0]);
     FastPacketSource source1;
     char data1[] = "data1";
     FastPacketSource_Init(&source1, PacketPassFairQueueFlow_GetInput(&flow1), (uint8_t *)data1, strlen(data1), BReactor_PendingGroup(&reactor));
@@ -75,6 +88,7 @@ int main ()
     // initialize source 2
     PacketPassFairQueueFlow flow2;
     PacketPassFairQueueFlow_Init(&flow2, &fq);
+    PacketPassFairQueueFlow_SetWeight(&flow2, weights[1]);
     FastPacketSource source2;
     char data2[] = "data2data2";
     FastPacketSource_Init(&source2, PacketPassFairQueueFlow_GetInput(&flow2), (uint8_t *)data2, strlen(data2), BReactor_PendingGroup(&reactor));
@@ -82,6 +96,7 @@ int main ()
     // initialize source 3
     PacketPassFairQueueFlow flow3;
     PacketPassFairQueueFlow_Init(&flow3, &fq);
+    PacketPassFairQueueFlow_SetWeight(&flow3, weights[2]);
     FastPacketSource source3;
     char data3[] = "data3data3data3data3data3data3data3data3data3";
     FastPacketSource_Init(&source3, PacketPassFairQueueFlow_GetInput(&flow3), (uint8_t *)data3, strlen(data3), BReactor_PendingGroup(&reactor));
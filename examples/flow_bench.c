@@ -0,0 +1,700 @@
+/**
+ * @file flow_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput and latency benchmark of flow pipelines.
+ *
+ * Each measurement builds a pipeline between one or more sources, which
+ * resubmit a packet as soon as the previous one has been accepted, and a sink
+ * which accepts every packet immediately, so the numbers reflect the cost of
+ * the flow components themselves. Every SAMPLE_INTERVAL-th packet of a source
+ * carries a timestamp which the sink uses to measure how long the packet took
+ * to pass the pipeline.
+ *
+ * Results are printed to standard output as tab-separated lines, one per
+ * measurement, preceded by a header line:
+ *
+ *   pipeline variant size flows packets ns_per_packet mpps p50_ns p99_ns p999_ns max_ns
+ *
+ * "packets" is the number of packets delivered to the sink, and the latency
+ * columns are percentiles over the sampled packets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+#include <protocol/packetproto.h>
+#include <protocol/spproto.h>
+#include <protocol/fragmentproto.h>
+#include <base/BLog.h>
+#include <base/DebugObject.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <security/BSecurity.h>
+#include <security/BRandom.h>
+#include <security/BAead.h>
+#include <threadwork/BThreadWork.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/PacketCopier.h>
+#include <flow/PacketBuffer.h>
+#include <flow/SinglePacketBuffer.h>
+#include <flow/PacketPassFairQueue.h>
+#include <flow/PacketProtoEncoder.h>
+#include <flow/PacketProtoDecoder.h>
+#include <flow/PacketStreamSender.h>
+#include <client/SPProtoEncoder.h>
+#include <client/SPProtoDecoder.h>
+#include <client/FragmentProtoDisassembler.h>
+#include <client/FragmentProtoAssembler.h>
+
+#define DEFAULT_PACKETS 1000000
+#define SAMPLE_INTERVAL 16
+#define MAX_FLOWS 64
+#define BUFFER_PACKETS 64
+#define FRAGMENT_CARRIER_MTU 576
+#define FRAGMENT_FRAMES 4
+#define SPPROTO_OTP_WARNING 100
+
+static const int packet_sizes[] = {64, 256, 576, 1400};
+#define NUM_PACKET_SIZES (sizeof(packet_sizes) / sizeof(packet_sizes[0]))
+
+static const int fairqueue_flows[] = {1, 4, MAX_FLOWS};
+#define NUM_FAIRQUEUE_FLOWS (sizeof(fairqueue_flows) / sizeof(fairqueue_flows[0]))
+
+enum {
+    PIPELINE_DIRECT,
+    PIPELINE_BUFFER,
+    PIPELINE_FAIRQUEUE,
+    PIPELINE_FAIRQUEUE_DRR,
+    PIPELINE_PACKETPROTO,
+    PIPELINE_SPPROTO,
+    PIPELINE_FRAGMENT
+};
+
+struct bench;
+
+struct bench_source {
+    struct bench *b;
+    PacketPassInterface *output;
+    uint8_t *buf;
+    int seq;
+};
+
+// joins the output of PacketStreamSender to the input of PacketProtoDecoder,
+// standing in for a stream socket
+struct stream_loop {
+    StreamPassInterface input;
+    StreamRecvInterface output;
+    uint8_t *in_data;
+    int in_len;
+    uint8_t *out_data;
+    int out_avail;
+};
+
+struct bench {
+    int pipeline;
+    int size;
+    int num_flows;
+    struct spproto_security_params sp_params;
+    BReactor reactor;
+    BThreadWorkDispatcher twd;
+    struct bench_source sources[MAX_FLOWS];
+    PacketPassInterface *inputs[MAX_FLOWS];
+    PacketPassInterface sink;
+    int num_packets;
+    int delivered;
+    int stopping;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t *samples;
+    int samples_cap;
+    int num_samples;
+    
+    // pipeline elements, only those of the current pipeline are initialized
+    PacketCopier copier;
+    PacketBuffer buffer;
+    SinglePacketBuffer spbuffer;
+    PacketPassFairQueue queue;
+    PacketPassFairQueueFlow flows[MAX_FLOWS];
+    PacketProtoEncoder pp_encoder;
+    PacketStreamSender pp_sender;
+    struct stream_loop pp_loop;
+    PacketProtoDecoder pp_decoder;
+    SPProtoEncoder sp_encoder;
+    SPProtoDecoder sp_decoder;
+    FragmentProtoDisassembler disassembler;
+    FragmentProtoAssembler assembler;
+};
+
+static int num_packets_opt = DEFAULT_PACKETS;
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int compare_u64 (const void *v1, const void *v2)
+{
+    uint64_t a = *(const uint64_t *)v1;
+    uint64_t b = *(const uint64_t *)v2;
+    return (a > b) - (a < b);
+}
+
+static uint64_t percentile (uint64_t *sorted, int count, double q)
+{
+    if (count == 0) {
+        return 0;
+    }
+    
+    return sorted[(int)(q * (count - 1))];
+}
+
+static void print_result (struct bench *b, const char *pipeline, const char *variant)
+{
+    uint64_t ns = b->end_ns - b->start_ns;
+    double ns_per_packet = (b->delivered > 0 ? (double)ns / b->delivered : 0.0);
+    double mpps = (ns > 0 ? (b->delivered * 1000.0) / ns : 0.0);
+    
+    qsort(b->samples, b->num_samples, sizeof(b->samples[0]), compare_u64);
+    
+    printf("%s\t%s\t%d\t%d\t%d\t%.1f\t%.3f\t%llu\t%llu\t%llu\t%llu\n", pipeline, variant, b->size, b->num_flows, b->delivered, ns_per_packet, mpps,
+           (unsigned long long)percentile(b->samples, b->num_samples, 0.5),
+           (unsigned long long)percentile(b->samples, b->num_samples, 0.99),
+           (unsigned long long)percentile(b->samples, b->num_samples, 0.999),
+           (unsigned long long)percentile(b->samples, b->num_samples, 1.0));
+    fflush(stdout);
+}
+
+static void source_send (struct bench_source *s)
+{
+    // the first bytes of the payload carry the submit time of sampled packets
+    uint64_t stamp = (s->seq % SAMPLE_INTERVAL == 0 ? now_ns() : 0);
+    memcpy(s->buf, &stamp, sizeof(stamp));
+    s->seq++;
+    
+    PacketPassInterface_Sender_Send(s->output, s->buf, s->b->size);
+}
+
+static void source_handler_done (struct bench_source *s)
+{
+    if (s->b->stopping) {
+        return;
+    }
+    
+    source_send(s);
+}
+
+static void sink_handler_send (struct bench *b, uint8_t *data, int data_len)
+{
+    ASSERT(data_len == b->size)
+    
+    uint64_t stamp;
+    memcpy(&stamp, data, sizeof(stamp));
+    if (stamp != 0 && b->num_samples < b->samples_cap) {
+        b->samples[b->num_samples++] = now_ns() - stamp;
+    }
+    
+    PacketPassInterface_Done(&b->sink);
+    
+    if (++b->delivered == b->num_packets) {
+        b->end_ns = now_ns();
+        b->stopping = 1;
+        BReactor_Quit(&b->reactor, 0);
+    }
+}
+
+static void stream_loop_transfer (struct stream_loop *o)
+{
+    if (!o->in_data || !o->out_data) {
+        return;
+    }
+    
+    int amount = bmin_int(o->in_len, o->out_avail);
+    memcpy(o->out_data, o->in_data, amount);
+    
+    o->in_data = NULL;
+    o->out_data = NULL;
+    
+    StreamPassInterface_Done(&o->input, amount);
+    StreamRecvInterface_Done(&o->output, amount);
+}
+
+static void stream_loop_handler_send (struct stream_loop *o, uint8_t *data, int data_len)
+{
+    ASSERT(!o->in_data)
+    
+    o->in_data = data;
+    o->in_len = data_len;
+    
+    stream_loop_transfer(o);
+}
+
+static void stream_loop_handler_recv (struct stream_loop *o, uint8_t *data, int data_avail)
+{
+    ASSERT(!o->out_data)
+    
+    o->out_data = data;
+    o->out_avail = data_avail;
+    
+    stream_loop_transfer(o);
+}
+
+static void stream_loop_init (struct stream_loop *o, BPendingGroup *pg)
+{
+    StreamPassInterface_Init(&o->input, (StreamPassInterface_handler_send)stream_loop_handler_send, o, pg);
+    StreamRecvInterface_Init(&o->output, (StreamRecvInterface_handler_recv)stream_loop_handler_recv, o, pg);
+    o->in_data = NULL;
+    o->out_data = NULL;
+}
+
+static void stream_loop_free (struct stream_loop *o)
+{
+    StreamRecvInterface_Free(&o->output);
+    StreamPassInterface_Free(&o->input);
+}
+
+static void decoder_handler_error (struct bench *b)
+{
+    fprintf(stderr, "PacketProtoDecoder error\n");
+    b->stopping = 1;
+    BReactor_Quit(&b->reactor, 0);
+}
+
+static void logfunc (struct bench *b)
+{
+}
+
+static int pipeline_init (struct bench *b)
+{
+    BPendingGroup *pg = BReactor_PendingGroup(&b->reactor);
+    
+    switch (b->pipeline) {
+        case PIPELINE_DIRECT: {
+            b->inputs[0] = &b->sink;
+        } break;
+        
+        case PIPELINE_BUFFER: {
+            PacketCopier_Init(&b->copier, b->size, pg);
+            
+            if (!PacketBuffer_Init(&b->buffer, PacketCopier_GetOutput(&b->copier), &b->sink, BUFFER_PACKETS, pg)) {
+                fprintf(stderr, "PacketBuffer_Init failed\n");
+                PacketCopier_Free(&b->copier);
+                return 0;
+            }
+            
+            b->inputs[0] = PacketCopier_GetInput(&b->copier);
+        } break;
+        
+        case PIPELINE_FAIRQUEUE:
+        case PIPELINE_FAIRQUEUE_DRR: {
+            int res = (b->pipeline == PIPELINE_FAIRQUEUE ?
+                PacketPassFairQueue_Init(&b->queue, &b->sink, pg, 0, 1) :
+                PacketPassFairQueue_InitDRR(&b->queue, &b->sink, pg, 0, 1));
+            if (!res) {
+                fprintf(stderr, "PacketPassFairQueue_Init failed\n");
+                return 0;
+            }
+            
+            for (int i = 0; i < b->num_flows; i++) {
+                PacketPassFairQueueFlow_Init(&b->flows[i], &b->queue);
+                b->inputs[i] = PacketPassFairQueueFlow_GetInput(&b->flows[i]);
+            }
+        } break;
+        
+        case PIPELINE_PACKETPROTO: {
+            PacketCopier_Init(&b->copier, b->size, pg);
+            PacketProtoEncoder_Init(&b->pp_encoder, PacketCopier_GetOutput(&b->copier), pg);
+            stream_loop_init(&b->pp_loop, pg);
+            PacketStreamSender_Init(&b->pp_sender, &b->pp_loop.input, PACKETPROTO_ENCLEN(b->size), pg);
+            
+            if (!SinglePacketBuffer_Init(&b->spbuffer, PacketProtoEncoder_GetOutput(&b->pp_encoder), PacketStreamSender_GetInput(&b->pp_sender), pg)) {
+                fprintf(stderr, "SinglePacketBuffer_Init failed\n");
+                goto pp_fail0;
+            }
+            
+            if (!PacketProtoDecoder_Init(&b->pp_decoder, &b->pp_loop.output, &b->sink, pg, b, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
+                fprintf(stderr, "PacketProtoDecoder_Init failed\n");
+                goto pp_fail1;
+            }
+            
+            b->inputs[0] = PacketCopier_GetInput(&b->copier);
+            break;
+            
+        pp_fail1:
+            SinglePacketBuffer_Free(&b->spbuffer);
+        pp_fail0:
+            PacketStreamSender_Free(&b->pp_sender);
+            stream_loop_free(&b->pp_loop);
+            PacketProtoEncoder_Free(&b->pp_encoder);
+            PacketCopier_Free(&b->copier);
+            return 0;
+        }
+        
+        case PIPELINE_SPPROTO: {
+            PacketCopier_Init(&b->copier, b->size, pg);
+            
+            if (!SPProtoEncoder_Init2(&b->sp_encoder, PacketCopier_GetOutput(&b->copier), b->sp_params, SPPROTO_OTP_WARNING, pg, &b->twd, 1)) {
+                fprintf(stderr, "SPProtoEncoder_Init2 failed\n");
+                goto sp_fail0;
+            }
+            
+            if (!SPProtoDecoder_Init2(&b->sp_decoder, &b->sink, b->sp_params, 2, pg, &b->twd, b, (BLog_logfunc)logfunc, 1)) {
+                fprintf(stderr, "SPProtoDecoder_Init2 failed\n");
+                goto sp_fail1;
+            }
+            
+            if (!SinglePacketBuffer_Init(&b->spbuffer, SPProtoEncoder_GetOutput(&b->sp_encoder), SPProtoDecoder_GetInput(&b->sp_decoder), pg)) {
+                fprintf(stderr, "SinglePacketBuffer_Init failed\n");
+                goto sp_fail2;
+            }
+            
+            if (SPPROTO_HAVE_KEY(b->sp_params)) {
+                uint8_t key[BAEAD_MAX_KEY_SIZE];
+                ASSERT(spproto_key_size(b->sp_params) <= sizeof(key))
+                BRandom_randomize(key, spproto_key_size(b->sp_params));
+                SPProtoEncoder_SetEncryptionKey(&b->sp_encoder, key);
+                SPProtoDecoder_SetEncryptionKey(&b->sp_decoder, key);
+            }
+            
+            b->inputs[0] = PacketCopier_GetInput(&b->copier);
+            break;
+            
+        sp_fail2:
+            SPProtoDecoder_Free(&b->sp_decoder);
+        sp_fail1:
+            SPProtoEncoder_Free(&b->sp_encoder);
+        sp_fail0:
+            PacketCopier_Free(&b->copier);
+            return 0;
+        }
+        
+        case PIPELINE_FRAGMENT: {
+            FragmentProtoDisassembler_Init(&b->disassembler, &b->reactor, b->size, FRAGMENT_CARRIER_MTU, -1, -1);
+            
+            if (!FragmentProtoAssembler_Init(&b->assembler, FRAGMENT_CARRIER_MTU, &b->sink, FRAGMENT_FRAMES, FRAGMENT_FRAMES,
+                                             fragmentproto_max_chunks_for_frame(FRAGMENT_CARRIER_MTU, b->size), pg, b, (BLog_logfunc)logfunc)) {
+                fprintf(stderr, "FragmentProtoAssembler_Init failed\n");
+                goto fr_fail0;
+            }
+            
+            if (!SinglePacketBuffer_Init(&b->spbuffer, FragmentProtoDisassembler_GetOutput(&b->disassembler), FragmentProtoAssembler_GetInput(&b->assembler), pg)) {
+                fprintf(stderr, "SinglePacketBuffer_Init failed\n");
+                goto fr_fail1;
+            }
+            
+            b->inputs[0] = FragmentProtoDisassembler_GetInput(&b->disassembler);
+            break;
+            
+        fr_fail1:
+            FragmentProtoAssembler_Free(&b->assembler);
+        fr_fail0:
+            FragmentProtoDisassembler_Free(&b->disassembler);
+            return 0;
+        }
+        
+        default:
+            ASSERT(0);
+    }
+    
+    return 1;
+}
+
+static void pipeline_free (struct bench *b)
+{
+    switch (b->pipeline) {
+        case PIPELINE_DIRECT:
+            break;
+        
+        case PIPELINE_BUFFER: {
+            PacketBuffer_Free(&b->buffer);
+            PacketCopier_Free(&b->copier);
+        } break;
+        
+        case PIPELINE_FAIRQUEUE:
+        case PIPELINE_FAIRQUEUE_DRR: {
+            // flows may still be busy
+            PacketPassFairQueue_PrepareFree(&b->queue);
+            for (int i = 0; i < b->num_flows; i++) {
+                PacketPassFairQueueFlow_Free(&b->flows[i]);
+            }
+            PacketPassFairQueue_Free(&b->queue);
+        } break;
+        
+        case PIPELINE_PACKETPROTO: {
+            PacketProtoDecoder_Free(&b->pp_decoder);
+            SinglePacketBuffer_Free(&b->spbuffer);
+            PacketStreamSender_Free(&b->pp_sender);
+            stream_loop_free(&b->pp_loop);
+            PacketProtoEncoder_Free(&b->pp_encoder);
+            PacketCopier_Free(&b->copier);
+        } break;
+        
+        case PIPELINE_SPPROTO: {
+            SinglePacketBuffer_Free(&b->spbuffer);
+            SPProtoDecoder_Free(&b->sp_decoder);
+            SPProtoEncoder_Free(&b->sp_encoder);
+            PacketCopier_Free(&b->copier);
+        } break;
+        
+        case PIPELINE_FRAGMENT: {
+            SinglePacketBuffer_Free(&b->spbuffer);
+            FragmentProtoAssembler_Free(&b->assembler);
+            FragmentProtoDisassembler_Free(&b->disassembler);
+        } break;
+        
+        default:
+            ASSERT(0);
+    }
+}
+
+static int bench_run (int pipeline, const char *name, const char *variant, int size, int num_flows, struct spproto_security_params sp_params)
+{
+    ASSERT(num_flows > 0)
+    ASSERT(num_flows <= MAX_FLOWS)
+    ASSERT(size >= sizeof(uint64_t))
+    
+    int ret = 0;
+    
+    struct bench *b = (struct bench *)BAlloc(sizeof(*b));
+    if (!b) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    
+    b->pipeline = pipeline;
+    b->size = size;
+    b->num_flows = num_flows;
+    b->sp_params = sp_params;
+    b->num_packets = num_packets_opt;
+    b->delivered = 0;
+    b->stopping = 0;
+    b->num_samples = 0;
+    b->samples_cap = num_packets_opt / SAMPLE_INTERVAL + num_flows;
+    
+    if (!(b->samples = (uint64_t *)BAllocArray(b->samples_cap, sizeof(b->samples[0])))) {
+        fprintf(stderr, "BAllocArray failed\n");
+        goto fail1;
+    }
+    
+    if (!BReactor_Init(&b->reactor)) {
+        fprintf(stderr, "BReactor_Init failed\n");
+        goto fail2;
+    }
+    
+    if (!BThreadWorkDispatcher_Init(&b->twd, &b->reactor, 0)) {
+        fprintf(stderr, "BThreadWorkDispatcher_Init failed\n");
+        goto fail3;
+    }
+    
+    PacketPassInterface_Init(&b->sink, size, (PacketPassInterface_handler_send)sink_handler_send, b, BReactor_PendingGroup(&b->reactor));
+    
+    if (!pipeline_init(b)) {
+        goto fail4;
+    }
+    
+    int num_sources = 0;
+    for (; num_sources < num_flows; num_sources++) {
+        struct bench_source *s = &b->sources[num_sources];
+        if (!(s->buf = (uint8_t *)BAlloc(size))) {
+            fprintf(stderr, "BAlloc failed\n");
+            goto fail5;
+        }
+        memset(s->buf, 0, size);
+        s->b = b;
+        s->output = b->inputs[num_sources];
+        s->seq = 0;
+        PacketPassInterface_Sender_Init(s->output, (PacketPassInterface_handler_done)source_handler_done, s);
+    }
+    
+    b->start_ns = now_ns();
+    
+    for (int i = 0; i < num_flows; i++) {
+        source_send(&b->sources[i]);
+    }
+    
+    BReactor_Exec(&b->reactor);
+    
+    if (b->delivered == b->num_packets) {
+        print_result(b, name, variant);
+        ret = 1;
+    }
+    
+fail5:
+    while (num_sources-- > 0) {
+        BFree(b->sources[num_sources].buf);
+    }
+    pipeline_free(b);
+fail4:
+    PacketPassInterface_Free(&b->sink);
+    BThreadWorkDispatcher_Free(&b->twd);
+fail3:
+    BReactor_Free(&b->reactor);
+fail2:
+    BFree(b->samples);
+fail1:
+    BFree(b);
+fail0:
+    return ret;
+}
+
+static struct spproto_security_params spproto_params (int aead_mode)
+{
+    struct spproto_security_params params;
+    params.hash_mode = SPPROTO_HASH_MODE_NONE;
+    params.encryption_mode = SPPROTO_ENCRYPTION_MODE_NONE;
+    params.otp_mode = SPPROTO_OTP_MODE_NONE;
+    params.otp_num = 0;
+    params.aead_mode = aead_mode;
+    return params;
+}
+
+static int bench_pipeline (const char *name)
+{
+    struct spproto_security_params none = spproto_params(SPPROTO_AEAD_MODE_NONE);
+    
+    for (size_t s = 0; s < NUM_PACKET_SIZES; s++) {
+        int size = packet_sizes[s];
+        int res = 1;
+        
+        if (!strcmp(name, "direct")) {
+            res = bench_run(PIPELINE_DIRECT, name, "-", size, 1, none);
+        }
+        else if (!strcmp(name, "buffer")) {
+            res = bench_run(PIPELINE_BUFFER, name, "-", size, 1, none);
+        }
+        else if (!strcmp(name, "fairqueue")) {
+            for (size_t f = 0; res && f < NUM_FAIRQUEUE_FLOWS; f++) {
+                res = bench_run(PIPELINE_FAIRQUEUE, name, "sfq", size, fairqueue_flows[f], none) &&
+                      bench_run(PIPELINE_FAIRQUEUE_DRR, name, "drr", size, fairqueue_flows[f], none);
+            }
+        }
+        else if (!strcmp(name, "packetproto")) {
+            res = bench_run(PIPELINE_PACKETPROTO, name, "-", size, 1, none);
+        }
+        else if (!strcmp(name, "spproto")) {
+            res = bench_run(PIPELINE_SPPROTO, name, "none", size, 1, none) &&
+                  bench_run(PIPELINE_SPPROTO, name, "aes-128-gcm", size, 1, spproto_params(BAEAD_CIPHER_AES_128_GCM));
+        }
+        else if (!strcmp(name, "fragment")) {
+            res = bench_run(PIPELINE_FRAGMENT, name, "-", size, 1, none);
+        }
+        else {
+            ASSERT(0);
+        }
+        
+        if (!res) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static const char *pipeline_names[] = {"direct", "buffer", "fairqueue", "packetproto", "spproto", "fragment"};
+#define NUM_PIPELINES (sizeof(pipeline_names) / sizeof(pipeline_names[0]))
+
+static void usage (char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [--packets <num>] [pipeline ...]\n"
+        "Pipelines: direct buffer fairqueue packetproto spproto fragment (default: all)\n",
+        name
+    );
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    int want[NUM_PIPELINES] = {0};
+    int have_pipeline = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--packets") && i + 1 < argc) {
+            num_packets_opt = atoi(argv[++i]);
+            if (num_packets_opt <= 0) {
+                usage(argv[0]);
+            }
+            continue;
+        }
+        
+        size_t p;
+        for (p = 0; p < NUM_PIPELINES; p++) {
+            if (!strcmp(arg, pipeline_names[p])) {
+                break;
+            }
+        }
+        if (p == NUM_PIPELINES) {
+            usage(argv[0]);
+        }
+        
+        want[p] = 1;
+        have_pipeline = 1;
+    }
+    
+    int ret = 1;
+    
+    BTime_Init();
+    BLog_InitStderr();
+    
+    if (!BSecurity_GlobalInitThreadSafe()) {
+        fprintf(stderr, "BSecurity_GlobalInitThreadSafe failed\n");
+        goto fail0;
+    }
+    
+    printf("pipeline\tvariant\tsize\tflows\tpackets\tns_per_packet\tmpps\tp50_ns\tp99_ns\tp999_ns\tmax_ns\n");
+    
+    for (size_t p = 0; p < NUM_PIPELINES; p++) {
+        if ((want[p] || !have_pipeline) && !bench_pipeline(pipeline_names[p])) {
+            goto fail1;
+        }
+    }
+    
+    ret = 0;
+    
+fail1:
+    BSecurity_GlobalFreeThreadSafe();
+fail0:
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    
+    return ret;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file ohash_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/balloc.h>
+#include <misc/debug.h>
+#include <misc/print_macros.h>
+#include <structure/OHash.h>
+
+typedef size_t entry_index;
+typedef uint32_t entry_key;
+
+struct entry {
+    entry_key key;
+    int in_hash;
+};
+
+typedef struct entry *entry_ptr;
+
+static size_t key_hash (entry_key key)
+{
+    // weak on purpose, so that hash fragments collide within groups
+    return (size_t)key * 2654435761u;
+}
+
+#include "ohash_test_hash.h"
+#include <structure/OHash_decl.h>
+
+#include "ohash_test_hash.h"
+#include <structure/OHash_impl.h>
+
+static uint32_t rand32 (void)
+{
+    return ((uint32_t)(rand() & 0xFFFF) << 16) | (uint32_t)(rand() & 0xFFFF);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc != 5) {
+        fprintf(stderr, "Usage: %s <num_keys> <num_ops> <verify_interval> <seed>\n", (argc > 0 ? argv[0] : ""));
+        return 1;
+    }
+    
+    size_t num_keys = atoi(argv[1]);
+    size_t num_ops = atoi(argv[2]);
+    size_t verify_interval = atoi(argv[3]);
+    srand(atoi(argv[4]));
+    
+    ASSERT_FORCE(num_keys > 0)
+    
+    // entry i has key i, so presence of a key can be checked directly
+    struct entry *entries = (struct entry *)BAllocArray(num_keys, sizeof(entries[0]));
+    ASSERT_FORCE(entries)
+    for (size_t i = 0; i < num_keys; i++) {
+        entries[i].key = i;
+        entries[i].in_hash = 0;
+    }
+    
+    MyHash hash;
+    ASSERT_FORCE(MyHash_Init(&hash, 0))
+    
+    struct entry *arg = entries;
+    size_t num_in_hash = 0;
+    size_t num_inserted = 0;
+    size_t num_removed = 0;
+    
+    for (size_t op = 0; op < num_ops; op++) {
+        entry_key key = rand32() % num_keys;
+        struct entry *e = &entries[key];
+        
+        // grow during the first half, shrink during the second half
+        int insert_pct = (op < num_ops / 2 ? 60 : 30);
+        int r = rand() % 100;
+        
+        if (r < insert_pct) {
+            MyHashRef ref = {e, key};
+            MyHashRef existing;
+            int res = MyHash_Insert(&hash, arg, ref, &existing);
+            if (e->in_hash) {
+                ASSERT_FORCE(!res)
+                ASSERT_FORCE(existing.ptr == e)
+            } else {
+                ASSERT_FORCE(res)
+                e->in_hash = 1;
+                num_in_hash++;
+                num_inserted++;
+            }
+        }
+        else if (r < insert_pct + 20) {
+            MyHashRef ref = MyHash_Lookup(&hash, arg, key);
+            if (e->in_hash) {
+                ASSERT_FORCE(!MyHashIsNullRef(ref))
+                ASSERT_FORCE(ref.ptr == e)
+            } else {
+                ASSERT_FORCE(MyHashIsNullRef(ref))
+            }
+        }
+        else {
+            if (e->in_hash) {
+                MyHashRef ref = MyHash_Lookup(&hash, arg, key);
+                ASSERT_FORCE(ref.ptr == e)
+                MyHash_Remove(&hash, arg, ref);
+                e->in_hash = 0;
+                num_in_hash--;
+                num_removed++;
+            }
+        }
+        
+        ASSERT_FORCE(MyHash_Count(&hash) == num_in_hash)
+        
+        if (verify_interval > 0 && op % verify_interval == 0) {
+            MyHash_Verify(&hash, arg);
+        }
+    }
+    
+    MyHash_Verify(&hash, arg);
+    
+    for (size_t i = 0; i < num_keys; i++) {
+        MyHashRef ref = MyHash_Lookup(&hash, arg, entries[i].key);
+        ASSERT_FORCE(MyHashIsNullRef(ref) == !entries[i].in_hash)
+    }
+    
+    printf("inserted %" PRIsz ", removed %" PRIsz ", remaining %" PRIsz ", groups %" PRIsz "\n",
+           num_inserted, num_removed, num_in_hash, hash.num_groups);
+    
+    MyHash_Free(&hash);
+    BFree(entries);
+    
+    return 0;
+}
@@ -0,0 +1,11 @@
+#define OHASH_PARAM_NAME MyHash
+#define OHASH_PARAM_ENTRY struct entry
+#define OHASH_PARAM_LINK entry_index
+#define OHASH_PARAM_KEY entry_key
+#define OHASH_PARAM_ARG entry_ptr
+#define OHASH_PARAM_NULL ((entry_index)-1)
+#define OHASH_PARAM_DEREF(arg, link) (&(arg)[(link)])
+#define OHASH_PARAM_ENTRYHASH(arg, entry) key_hash((entry).ptr->key)
+#define OHASH_PARAM_KEYHASH(arg, key) key_hash(key)
+#define OHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->key == (entry2).ptr->key)
+#define OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->key)
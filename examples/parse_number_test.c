@@ -97,6 +97,22 @@ static void test_value (uintmax_t x)
     ASSERT_FORCE(!strcmp(str2, str));
 }
 
+static void test_hex_value (uintmax_t x, int leading_zeros)
+{
+    char str[60];
+    sprintf(str, "%0*" PRIxMAX, leading_zeros + 1, x);
+    uintmax_t y;
+    int res = parse_unsigned_hex_integer(MemRef_MakeCstr(str), &y);
+    ASSERT_FORCE(res);
+    ASSERT_FORCE(y == x);
+    
+    // one more nonzero digit overflows
+    if (x > UINTMAX_MAX / 16) {
+        sprintf(str, "%" PRIXMAX "1", x);
+        ASSERT_FORCE(!parse_unsigned_hex_integer(MemRef_MakeCstr(str), &y));
+    }
+}
+
 static void test_value_range (uintmax_t start, uintmax_t count)
 {
     uintmax_t i = start;
@@ -119,6 +135,25 @@ int main ()
         }
     }
     
+    for (int i = 0; i < 1000000; i++) {
+        uintmax_t x = ((uintmax_t)rand() << 40) ^ ((uintmax_t)rand() << 20) ^ (uintmax_t)rand();
+        test_hex_value(x >> (rand() % 64), rand() % 30);
+    }
+    test_hex_value(UINTMAX_MAX, 0);
+    ASSERT_FORCE(!parse_unsigned_hex_integer(MemRef_MakeCstr("g"), &(uintmax_t){0}));
+    ASSERT_FORCE(!parse_unsigned_hex_integer(MemRef_MakeCstr(""), &(uintmax_t){0}));
+    
+    // representation sizes change at powers of ten and are estimated from powers of two
+    uintmax_t p = 1;
+    for (int k = 1; k < 20; k++) {
+        p *= 10;
+        test_value_range(p - 1, 3);
+    }
+    for (int b = 3; b < 64; b++) {
+        test_value_range(((uintmax_t)1 << b) - 2, 4);
+    }
+    test_value(UINTMAX_MAX);
+    
     test_value_range(UINTMAX_C(0), 5000000);
     test_value_range(UINTMAX_C(100000000), 5000000);
     test_value_range(UINTMAX_C(258239003), 5000000);
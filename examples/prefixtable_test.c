@@ -0,0 +1,281 @@
+/**
+ * @file prefixtable_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <misc/balloc.h>
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <misc/ipaddr6.h>
+#include <misc/print_macros.h>
+#include <structure/PrefixTable.h>
+
+#define MAX_PREFIXES 4096
+
+struct prefix {
+    int ipv6;
+    uint8_t addr[16];
+    int len;
+    int present;
+};
+
+static struct prefix prefixes[MAX_PREFIXES];
+static size_t num_prefixes;
+
+static uint32_t rand32 (void)
+{
+    return ((uint32_t)(rand() & 0xFFFF) << 16) | (uint32_t)(rand() & 0xFFFF);
+}
+
+// addresses are drawn from a small space so that prefixes overlap a lot
+static void random_addr (int ipv6, uint8_t *addr)
+{
+    memset(addr, 0, 16);
+    int len = (ipv6 ? 16 : 4);
+    for (int i = 0; i < len; i++) {
+        addr[i] = (rand() % 4 == 0 ? rand32() : (i % 3));
+    }
+}
+
+static int matches (const struct prefix *p, const uint8_t *addr)
+{
+    for (int i = 0; i < p->len; i++) {
+        int b1 = (p->addr[i / 8] >> (7 - i % 8)) & 1;
+        int b2 = (addr[i / 8] >> (7 - i % 8)) & 1;
+        if (b1 != b2) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *value_of (size_t i)
+{
+    return &prefixes[i];
+}
+
+static void *reference_lookup (int ipv6, const uint8_t *addr)
+{
+    struct prefix *best = NULL;
+    for (size_t i = 0; i < num_prefixes; i++) {
+        struct prefix *p = &prefixes[i];
+        if (p->present && p->ipv6 == ipv6 && matches(p, addr) && (!best || p->len > best->len)) {
+            best = p;
+        }
+    }
+    return best;
+}
+
+static uint32_t addr4 (const uint8_t *addr)
+{
+    uint32_t a;
+    memcpy(&a, addr, 4);
+    return a;
+}
+
+static struct ipv6_addr addr6 (const uint8_t *addr)
+{
+    struct ipv6_addr a;
+    memcpy(a.bytes, addr, 16);
+    return a;
+}
+
+static int insert (PrefixTable *table, size_t i)
+{
+    struct prefix *p = &prefixes[i];
+    void *existing;
+    if (p->ipv6) {
+        return PrefixTable_Insert6(table, addr6(p->addr), p->len, value_of(i), &existing);
+    } else {
+        return PrefixTable_Insert4(table, addr4(p->addr), p->len, value_of(i), &existing);
+    }
+}
+
+static void *get_exact (PrefixTable *table, const struct prefix *p)
+{
+    if (p->ipv6) {
+        return PrefixTable_GetExact6(table, addr6(p->addr), p->len);
+    } else {
+        return PrefixTable_GetExact4(table, addr4(p->addr), p->len);
+    }
+}
+
+static void remove_prefix (PrefixTable *table, size_t i)
+{
+    struct prefix *p = &prefixes[i];
+    if (p->ipv6) {
+        ASSERT_FORCE(PrefixTable_Remove6(table, addr6(p->addr), p->len))
+    } else {
+        ASSERT_FORCE(PrefixTable_Remove4(table, addr4(p->addr), p->len))
+    }
+    p->present = 0;
+}
+
+static void check_lookups (PrefixTable *table, int num)
+{
+    for (int k = 0; k < num; k++) {
+        uint8_t addr[16];
+        int ipv6 = rand() % 2;
+        
+        // half of the addresses are inside some prefix
+        if (num_prefixes > 0 && rand() % 2) {
+            struct prefix *p = &prefixes[rand() % num_prefixes];
+            ipv6 = p->ipv6;
+            random_addr(ipv6, addr);
+            for (int i = 0; i < p->len; i++) {
+                int b = (p->addr[i / 8] >> (7 - i % 8)) & 1;
+                addr[i / 8] = (addr[i / 8] & ~(1 << (7 - i % 8))) | (b << (7 - i % 8));
+            }
+        } else {
+            random_addr(ipv6, addr);
+        }
+        
+        void *expected = reference_lookup(ipv6, addr);
+        void *result;
+        if (ipv6) {
+            struct ipv6_addr a = addr6(addr);
+            result = PrefixTable_Lookup6(table, &a);
+        } else {
+            result = PrefixTable_Lookup4(table, addr4(addr));
+        }
+        ASSERT_FORCE(result == expected)
+        
+        BIPAddr ipaddr;
+        if (ipv6) {
+            BIPAddr_InitIPv6(&ipaddr, addr);
+        } else {
+            BIPAddr_InitIPv4(&ipaddr, addr4(addr));
+        }
+        ASSERT_FORCE(PrefixTable_LookupIPAddr(table, &ipaddr) == expected)
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <num_prefixes> <num_ops> <seed>\n", (argc > 0 ? argv[0] : ""));
+        return 1;
+    }
+    
+    num_prefixes = atoi(argv[1]);
+    size_t num_ops = atoi(argv[2]);
+    srand(atoi(argv[3]));
+    
+    ASSERT_FORCE(num_prefixes > 0)
+    ASSERT_FORCE(num_prefixes <= MAX_PREFIXES)
+    
+    // generate distinct prefixes
+    for (size_t i = 0; i < num_prefixes; i++) {
+        struct prefix *p = &prefixes[i];
+        int dup;
+        do {
+            p->ipv6 = rand() % 2;
+            random_addr(p->ipv6, p->addr);
+            p->len = rand() % ((p->ipv6 ? 128 : 32) + 1);
+            for (int b = p->len; b < 128; b++) {
+                p->addr[b / 8] &= ~(1 << (7 - b % 8));
+            }
+            p->present = 0;
+            dup = 0;
+            for (size_t j = 0; j < i; j++) {
+                if (prefixes[j].ipv6 == p->ipv6 && prefixes[j].len == p->len && !memcmp(prefixes[j].addr, p->addr, 16)) {
+                    dup = 1;
+                }
+            }
+        } while (dup);
+    }
+    
+    PrefixTable table;
+    PrefixTable_Init(&table);
+    
+    // incremental updates
+    size_t count = 0;
+    for (size_t op = 0; op < num_ops; op++) {
+        size_t i = rand() % num_prefixes;
+        struct prefix *p = &prefixes[i];
+        
+        if (!p->present) {
+            ASSERT_FORCE(insert(&table, i))
+            p->present = 1;
+            count++;
+        } else if (rand() % 2) {
+            ASSERT_FORCE(!insert(&table, i))
+        } else {
+            remove_prefix(&table, i);
+            count--;
+        }
+        
+        ASSERT_FORCE(PrefixTable_Count(&table) == count)
+        ASSERT_FORCE(get_exact(&table, p) == (p->present ? value_of(i) : NULL))
+        
+        check_lookups(&table, 8);
+    }
+    
+    // bulk changes
+    PrefixTable_BeginBulk(&table);
+    for (size_t i = 0; i < num_prefixes; i++) {
+        if (prefixes[i].present && rand() % 2) {
+            remove_prefix(&table, i);
+            count--;
+        }
+        else if (!prefixes[i].present && rand() % 2) {
+            ASSERT_FORCE(insert(&table, i))
+            prefixes[i].present = 1;
+            count++;
+        }
+    }
+    ASSERT_FORCE(PrefixTable_EndBulk(&table))
+    ASSERT_FORCE(PrefixTable_Count(&table) == count)
+    
+    check_lookups(&table, 10000);
+    
+    // lookup rate over random addresses
+    size_t num_lookups = 10000000;
+    uint32_t x = rand32() | 1;
+    uintptr_t sum = 0;
+    clock_t start = clock();
+    for (size_t k = 0; k < num_lookups; k++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sum += (uintptr_t)PrefixTable_Lookup4(&table, x);
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("prefixes %" PRIsz ", IPv4 lookups %.1f M/s (%d)\n", count, (secs > 0 ? num_lookups / secs / 1e6 : 0.0), (int)(sum & 1));
+    
+    PrefixTable_Free(&table);
+    
+    return 0;
+}
@@ -36,6 +36,7 @@
 
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
+#include <system/BTime.h>
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BUnixSignal.h>
@@ -84,6 +85,9 @@ int main ()
     
     BLog_InitStdout();
     
+    // init time
+    BTime_Init();
+    
     // init network
     if (!BNetwork_GlobalInit()) {
         fprintf(stderr, "BNetwork_GlobalInit failed\n");
@@ -0,0 +1,687 @@
+/**
+ * @file structure_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of the structure/ containers.
+ *
+ * The associative containers (CAvl, SAvl, BAVL, BTree, CHash, OHash) are measured
+ * with the key types used by the programs: 16-bit peer IDs (as in the
+ * server), MAC addresses (as in the client's frame decider), BAddr
+ * addresses with a mix of IPv4 and IPv6, the same addresses as the compact
+ * BFlowAddr used by the UDP flow tables in udpgw and tun2socks, and
+ * short strings (as in NCD). Each measurement inserts "size" entries, looks
+ * up "--lookups" keys, iterates in order (trees only) and removes all
+ * entries. IndexedList and Vector are measured separately with positional
+ * operations.
+ *
+ * The access pattern selects the insertion order and the lookup sequence:
+ * "sequential" inserts keys in ascending order and looks them up in the
+ * same order, "random" uses a random permutation and uniformly random
+ * lookups, and "zipf" inserts in random order and draws lookups from a
+ * Zipf distribution (s=1) over the entries, modelling a few busy flows.
+ *
+ * Results are printed to standard output as tab-separated lines, one per
+ * measurement, preceded by a header line:
+ *
+ *   structure key size pattern op count ns_per_op misses_per_op
+ *
+ * "misses_per_op" is the hardware cache miss count per operation from
+ * perf_event_open(), or "-" where that is not available.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef BADVPN_LINUX
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/merge.h>
+#include <misc/hashfun.h>
+#include <misc/byteorder.h>
+#include <structure/BAVL.h>
+#include <structure/CAvl.h>
+#include <structure/SAvl.h>
+#include <structure/CHash.h>
+#include <structure/OHash.h>
+#include <structure/BTree.h>
+#include <structure/IndexedList.h>
+#include <structure/Vector.h>
+#include <system/BAddr.h>
+#include <system/BFlowAddr.h>
+
+#define DEFAULT_LOOKUPS 1000000
+#define MAX_SIZES 16
+#define MAX_SIZE 10000000
+#define PEERID_MAX_SIZE 65536
+
+enum {
+    SB_PATTERN_SEQUENTIAL,
+    SB_PATTERN_RANDOM,
+    SB_PATTERN_ZIPF
+};
+
+static const char *pattern_names[] = {"sequential", "random", "zipf"};
+#define NUM_PATTERNS (sizeof(pattern_names) / sizeof(pattern_names[0]))
+
+static const char *structure_names[] = {"cavl", "savl", "bavl", "btree", "chash", "ohash", "indexedlist", "vector"};
+#define NUM_STRUCTURES (sizeof(structure_names) / sizeof(structure_names[0]))
+
+struct sb_run {
+    size_t n;
+    int pattern;
+    size_t *order;
+    size_t *lookups;
+    size_t num_lookups;
+};
+
+struct sb_meas {
+    uint64_t start_ns;
+};
+
+static size_t num_lookups_opt = DEFAULT_LOOKUPS;
+static int want_structure[NUM_STRUCTURES];
+static int have_structure;
+static uint64_t hash_seed;
+static uint64_t rng_state = UINT64_C(0x853C49E6748FEA9B);
+static int perf_fd = -1;
+static volatile uintptr_t sb_sink;
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static uint64_t rng_next (void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static size_t rng_below (size_t n)
+{
+    return (size_t)(rng_next() % n);
+}
+
+// bijective on 64-bit values, so distinct indices give distinct keys
+static uint64_t scramble64 (uint64_t x)
+{
+    x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return x ^ (x >> 31);
+}
+
+static int sb_want_structure (const char *name)
+{
+    if (!have_structure) {
+        return 1;
+    }
+    
+    for (size_t i = 0; i < NUM_STRUCTURES; i++) {
+        if (!strcmp(structure_names[i], name)) {
+            return want_structure[i];
+        }
+    }
+    
+    return 0;
+}
+
+static void perf_init (void)
+{
+#ifdef BADVPN_LINUX
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    
+    perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void perf_free (void)
+{
+#ifdef BADVPN_LINUX
+    if (perf_fd >= 0) {
+        close(perf_fd);
+    }
+#endif
+}
+
+static void sb_meas_start (struct sb_meas *m)
+{
+#ifdef BADVPN_LINUX
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    m->start_ns = now_ns();
+}
+
+static void sb_meas_report (struct sb_meas *m, const struct sb_run *r, const char *structure, const char *key, const char *op, size_t count)
+{
+    uint64_t elapsed = now_ns() - m->start_ns;
+    
+    int have_misses = 0;
+    uint64_t misses = 0;
+#ifdef BADVPN_LINUX
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        have_misses = (read(perf_fd, &misses, sizeof(misses)) == sizeof(misses));
+    }
+#endif
+    
+    printf("%s\t%s\t%zu\t%s\t%s\t%zu\t", structure, key, r->n, pattern_names[r->pattern], op, count);
+    
+    if (count == 0) {
+        printf("-\t-\n");
+        return;
+    }
+    
+    printf("%.2f\t", (double)elapsed / count);
+    
+    if (have_misses) {
+        printf("%.3f\n", (double)misses / count);
+    } else {
+        printf("-\n");
+    }
+    
+    fflush(stdout);
+}
+
+// peer IDs
+
+typedef uint16_t sb_peerid;
+
+static void peerid_gen (sb_peerid *k, size_t i, int scramble)
+{
+    ASSERT(i < PEERID_MAX_SIZE)
+    
+    // multiplying by an odd constant permutes the 16-bit values
+    *k = (scramble ? (sb_peerid)(i * 40503u) : (sb_peerid)i);
+}
+
+static int peerid_compare (const sb_peerid *k1, const sb_peerid *k2)
+{
+    return (*k1 > *k2) - (*k1 < *k2);
+}
+
+static size_t peerid_hash (const sb_peerid *k)
+{
+    // the server hashes peer IDs by identity
+    return *k;
+}
+
+// MAC addresses
+
+typedef struct {
+    uint8_t b[6];
+} sb_mac;
+
+static void mac_gen (sb_mac *k, size_t i, int scramble)
+{
+    uint64_t v = i;
+    if (scramble) {
+        // permutation of the 48-bit values
+        v = (v * UINT64_C(0x9E3779B97F4B)) & UINT64_C(0xFFFFFFFFFFFF);
+        v ^= v >> 24;
+    }
+    
+    for (int j = 0; j < 6; j++) {
+        k->b[j] = v >> (8 * (5 - j));
+    }
+}
+
+static int mac_compare (const sb_mac *k1, const sb_mac *k2)
+{
+    int c = memcmp(k1->b, k2->b, sizeof(k1->b));
+    return (c > 0) - (c < 0);
+}
+
+static size_t mac_hash (const sb_mac *k)
+{
+    return badvpn_hash_6(k->b, hash_seed);
+}
+
+// addresses, alternating IPv4 and IPv6
+
+static void addr_gen (BAddr *k, size_t i, int scramble)
+{
+    uint64_t v = i / 2;
+    
+    if (i % 2 == 0) {
+        uint32_t ip = (scramble ? (uint32_t)(v * 2654435761u) : (uint32_t)v);
+        BAddr_InitIPv4(k, hton32(ip), hton16(5353));
+    } else {
+        uint64_t lo = (scramble ? scramble64(v) : v);
+        uint8_t ip[16] = {0x20, 0x01, 0x0d, 0xb8};
+        for (int j = 0; j < 8; j++) {
+            ip[8 + j] = lo >> (8 * (7 - j));
+        }
+        BAddr_InitIPv6(k, ip, hton16(5353));
+    }
+}
+
+static int addr_compare (const BAddr *k1, const BAddr *k2)
+{
+    return BAddr_CompareOrder((BAddr *)k1, (BAddr *)k2);
+}
+
+static size_t addr_hash (const BAddr *k)
+{
+    return BAddr_Hash((BAddr *)k);
+}
+
+// compact flow addresses
+
+static void flowaddr_gen (BFlowAddr *k, size_t i, int scramble)
+{
+    BAddr addr;
+    addr_gen(&addr, i, scramble);
+    *k = BFlowAddr_FromBAddr(&addr);
+}
+
+static int flowaddr_compare (const BFlowAddr *k1, const BFlowAddr *k2)
+{
+    return BFlowAddr_CompareOrder(k1, k2);
+}
+
+static size_t flowaddr_hash (const BFlowAddr *k)
+{
+    return BFlowAddr_Hash(k);
+}
+
+// strings
+
+typedef struct {
+    char s[32];
+} sb_str;
+
+static void str_gen (sb_str *k, size_t i, int scramble)
+{
+    uint64_t v = (scramble ? scramble64(i) : i);
+    snprintf(k->s, sizeof(k->s), "host-%016llx.lan", (unsigned long long)v);
+}
+
+static int str_compare (const sb_str *k1, const sb_str *k2)
+{
+    int c = strcmp(k1->s, k2->s);
+    return (c > 0) - (c < 0);
+}
+
+static size_t str_hash (const sb_str *k)
+{
+    return badvpn_hash_str(k->s, hash_seed);
+}
+
+#define SB_NAME Peerid
+#define SB_FUN peerid
+#define SB_KEY_T sb_peerid
+#define SB_KEY_NAME "peerid"
+#include "structure_bench_impl.h"
+
+#define SB_NAME Mac
+#define SB_FUN mac
+#define SB_KEY_T sb_mac
+#define SB_KEY_NAME "mac"
+#include "structure_bench_impl.h"
+
+#define SB_NAME Addr
+#define SB_FUN addr
+#define SB_KEY_T BAddr
+#define SB_KEY_NAME "addr"
+#include "structure_bench_impl.h"
+
+#define SB_NAME FlowAddr
+#define SB_FUN flowaddr
+#define SB_KEY_T BFlowAddr
+#define SB_KEY_NAME "flowaddr"
+#include "structure_bench_impl.h"
+
+#define SB_NAME Str
+#define SB_FUN str
+#define SB_KEY_T sb_str
+#define SB_KEY_NAME "str"
+#include "structure_bench_impl.h"
+
+#define VECTOR_NAME SbVector
+#define VECTOR_ELEM_TYPE uint64_t
+#include <structure/Vector_decl.h>
+
+#define VECTOR_NAME SbVector
+#define VECTOR_ELEM_TYPE uint64_t
+#include <structure/Vector_impl.h>
+
+static void bench_indexedlist (const struct sb_run *r)
+{
+    size_t n = r->n;
+    
+    IndexedListNode *nodes = (IndexedListNode *)BAllocArray(n, sizeof(nodes[0]));
+    ASSERT_FORCE(nodes)
+    
+    IndexedList list;
+    IndexedList_Init(&list);
+    
+    struct sb_meas m;
+    uintptr_t sum = 0;
+    
+    // appending for the sequential pattern, inserting at random positions otherwise
+    sb_meas_start(&m);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t index = (r->pattern == SB_PATTERN_SEQUENTIAL ? i : r->order[i] % (i + 1));
+        IndexedList_InsertAt(&list, &nodes[i], index);
+    }
+    sb_meas_report(&m, r, "indexedlist", "index", "insert", n);
+    
+    sb_meas_start(&m);
+    for (size_t i = 0; i < r->num_lookups; i++) {
+        sum += (uintptr_t)IndexedList_GetAt(&list, r->lookups[i]);
+    }
+    sb_meas_report(&m, r, "indexedlist", "index", "lookup", r->num_lookups);
+    
+    sb_meas_start(&m);
+    for (IndexedListNode *node = IndexedList_GetFirst(&list); node; node = IndexedList_GetNext(&list, node)) {
+        sum += (uintptr_t)node;
+    }
+    sb_meas_report(&m, r, "indexedlist", "index", "iterate", n);
+    
+    sb_meas_start(&m);
+    for (size_t i = 0; i < n; i++) {
+        IndexedList_Remove(&list, &nodes[r->order[i]]);
+    }
+    sb_meas_report(&m, r, "indexedlist", "index", "delete", n);
+    
+    ASSERT_FORCE(IndexedList_Count(&list) == 0)
+    
+    sb_sink += sum;
+    
+    BFree(nodes);
+}
+
+static void bench_vector (const struct sb_run *r)
+{
+    size_t n = r->n;
+    
+    SbVector vec;
+    ASSERT_FORCE(SbVector_Init(&vec, 0))
+    
+    struct sb_meas m;
+    uint64_t sum = 0;
+    
+    // growing from empty, so that reallocation is included
+    sb_meas_start(&m);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t *elem = SbVector_Push(&vec, NULL);
+        ASSERT_FORCE(elem)
+        *elem = i;
+    }
+    sb_meas_report(&m, r, "vector", "index", "insert", n);
+    
+    sb_meas_start(&m);
+    for (size_t i = 0; i < r->num_lookups; i++) {
+        sum += *SbVector_Get(&vec, r->lookups[i]);
+    }
+    sb_meas_report(&m, r, "vector", "index", "lookup", r->num_lookups);
+    
+    sb_meas_start(&m);
+    for (size_t i = 0; i < SbVector_Count(&vec); i++) {
+        sum += *SbVector_Get(&vec, i);
+    }
+    sb_meas_report(&m, r, "vector", "index", "iterate", n);
+    
+    sb_meas_start(&m);
+    for (size_t i = 0; i < n; i++) {
+        sum += *SbVector_Pop(&vec, NULL);
+    }
+    sb_meas_report(&m, r, "vector", "index", "delete", n);
+    
+    sb_sink += sum;
+    
+    SbVector_Free(&vec);
+}
+
+static void make_lookups (struct sb_run *r, double *zipf_cdf)
+{
+    size_t n = r->n;
+    
+    switch (r->pattern) {
+        case SB_PATTERN_SEQUENTIAL: {
+            for (size_t i = 0; i < r->num_lookups; i++) {
+                r->lookups[i] = i % n;
+            }
+        } break;
+        
+        case SB_PATTERN_RANDOM: {
+            for (size_t i = 0; i < r->num_lookups; i++) {
+                r->lookups[i] = rng_below(n);
+            }
+        } break;
+        
+        case SB_PATTERN_ZIPF: {
+            // cumulative weights 1/k, normalized below
+            double total = 0.0;
+            for (size_t k = 0; k < n; k++) {
+                total += 1.0 / (double)(k + 1);
+                zipf_cdf[k] = total;
+            }
+            
+            // ranks map to entries through the insertion permutation,
+            // so the popular keys are spread over the key space
+            for (size_t i = 0; i < r->num_lookups; i++) {
+                double u = (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0) * total;
+                size_t lo = 0;
+                size_t hi = n - 1;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (zipf_cdf[mid] < u) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                r->lookups[i] = r->order[lo];
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+static int bench_size (size_t n)
+{
+    int ret = 0;
+    
+    struct sb_run r;
+    r.n = n;
+    r.num_lookups = num_lookups_opt;
+    
+    r.order = (size_t *)BAllocArray(n, sizeof(r.order[0]));
+    if (!r.order) {
+        fprintf(stderr, "allocation failed\n");
+        goto fail0;
+    }
+    
+    r.lookups = (size_t *)BAllocArray(r.num_lookups, sizeof(r.lookups[0]));
+    if (!r.lookups) {
+        fprintf(stderr, "allocation failed\n");
+        goto fail1;
+    }
+    
+    double *zipf_cdf = (double *)BAllocArray(n, sizeof(zipf_cdf[0]));
+    if (!zipf_cdf) {
+        fprintf(stderr, "allocation failed\n");
+        goto fail2;
+    }
+    
+    for (size_t p = 0; p < NUM_PATTERNS; p++) {
+        r.pattern = p;
+        
+        for (size_t i = 0; i < n; i++) {
+            r.order[i] = i;
+        }
+        if (p != SB_PATTERN_SEQUENTIAL) {
+            for (size_t i = n - 1; i > 0; i--) {
+                size_t j = rng_below(i + 1);
+                size_t t = r.order[i];
+                r.order[i] = r.order[j];
+                r.order[j] = t;
+            }
+        }
+        
+        make_lookups(&r, zipf_cdf);
+        
+        if (n <= PEERID_MAX_SIZE) {
+            peerid_bench(&r);
+        }
+        mac_bench(&r);
+        addr_bench(&r);
+        flowaddr_bench(&r);
+        str_bench(&r);
+        
+        if (sb_want_structure("indexedlist")) {
+            bench_indexedlist(&r);
+        }
+        if (sb_want_structure("vector")) {
+            bench_vector(&r);
+        }
+    }
+    
+    ret = 1;
+    
+    BFree(zipf_cdf);
+fail2:
+    BFree(r.lookups);
+fail1:
+    BFree(r.order);
+fail0:
+    return ret;
+}
+
+static void usage (char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [--sizes <n,...>] [--lookups <num>] [structure ...]\n"
+        "Structures: cavl savl bavl btree chash ohash indexedlist vector (default: all)\n"
+        "Sizes are between 1 and %d (default: 10,1000,100000,1000000)\n",
+        name, MAX_SIZE
+    );
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    size_t sizes[MAX_SIZES] = {10, 1000, 100000, 1000000};
+    size_t num_sizes = 4;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--sizes") && i + 1 < argc) {
+            num_sizes = 0;
+            char *s = argv[++i];
+            while (*s) {
+                if (num_sizes == MAX_SIZES) {
+                    usage(argv[0]);
+                }
+                char *end;
+                unsigned long long v = strtoull(s, &end, 10);
+                if (end == s || v == 0 || v > MAX_SIZE || (*end && *end != ',')) {
+                    usage(argv[0]);
+                }
+                sizes[num_sizes++] = v;
+                s = (*end ? end + 1 : end);
+            }
+            if (num_sizes == 0) {
+                usage(argv[0]);
+            }
+            continue;
+        }
+        if (!strcmp(arg, "--lookups") && i + 1 < argc) {
+            long long v = atoll(argv[++i]);
+            if (v <= 0) {
+                usage(argv[0]);
+            }
+            num_lookups_opt = v;
+            continue;
+        }
+        
+        size_t s;
+        for (s = 0; s < NUM_STRUCTURES; s++) {
+            if (!strcmp(arg, structure_names[s])) {
+                break;
+            }
+        }
+        if (s == NUM_STRUCTURES) {
+            usage(argv[0]);
+        }
+        
+        want_structure[s] = 1;
+        have_structure = 1;
+    }
+    
+    int ret = 1;
+    
+    hash_seed = badvpn_hash_seed();
+    perf_init();
+    
+    printf("structure\tkey\tsize\tpattern\top\tcount\tns_per_op\tmisses_per_op\n");
+    
+    for (size_t i = 0; i < num_sizes; i++) {
+        if (!bench_size(sizes[i])) {
+            goto fail0;
+        }
+    }
+    
+    ret = 0;
+    
+fail0:
+    perf_free();
+    
+    return ret;
+}
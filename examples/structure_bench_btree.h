@@ -0,0 +1,6 @@
+#define BTREE_PARAM_NAME MERGE(SbBTree, SB_NAME)
+#define BTREE_PARAM_TYPE_KEY SB_KEY_T
+#define BTREE_PARAM_TYPE_VALUE size_t
+#define BTREE_PARAM_TYPE_ARG int
+#define BTREE_PARAM_ORDER 16
+#define BTREE_PARAM_FUN_COMPARE(arg, key1, key2) MERGE(SB_FUN, _compare)(&(key1), &(key2))
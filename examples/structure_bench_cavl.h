@@ -0,0 +1,16 @@
+#define CAVL_PARAM_NAME MERGE(SbCAvl, SB_NAME)
+#define CAVL_PARAM_FEATURE_COUNTS 0
+#define CAVL_PARAM_FEATURE_KEYS_ARE_INDICES 0
+#define CAVL_PARAM_FEATURE_NOKEYS 0
+#define CAVL_PARAM_FEATURE_ASSOC 0
+#define CAVL_PARAM_TYPE_ENTRY struct MERGE(SbEntry, SB_NAME)
+#define CAVL_PARAM_TYPE_LINK size_t
+#define CAVL_PARAM_TYPE_KEY const SB_KEY_T *
+#define CAVL_PARAM_TYPE_ARG MERGE(SbEntryPtr, SB_NAME)
+#define CAVL_PARAM_VALUE_NULL ((size_t)-1)
+#define CAVL_PARAM_FUN_DEREF(arg, link) (&(arg)[(link)])
+#define CAVL_PARAM_FUN_COMPARE_ENTRIES(arg, entry1, entry2) MERGE(SB_FUN, _compare)(&(entry1).ptr->key, &(entry2).ptr->key)
+#define CAVL_PARAM_FUN_COMPARE_KEY_ENTRY(arg, key1, entry2) MERGE(SB_FUN, _compare)((key1), &(entry2).ptr->key)
+#define CAVL_PARAM_MEMBER_CHILD node.cavl.child
+#define CAVL_PARAM_MEMBER_BALANCE node.cavl.balance
+#define CAVL_PARAM_MEMBER_PARENT node.cavl.parent
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME MERGE(SbCHash, SB_NAME)
+#define CHASH_PARAM_ENTRY struct MERGE(SbEntry, SB_NAME)
+#define CHASH_PARAM_LINK size_t
+#define CHASH_PARAM_KEY const SB_KEY_T *
+#define CHASH_PARAM_ARG MERGE(SbEntryPtr, SB_NAME)
+#define CHASH_PARAM_NULL ((size_t)-1)
+#define CHASH_PARAM_DEREF(arg, link) (&(arg)[(link)])
+#define CHASH_PARAM_ENTRYHASH(arg, entry) MERGE(SB_FUN, _hash)(&(entry).ptr->key)
+#define CHASH_PARAM_KEYHASH(arg, key) MERGE(SB_FUN, _hash)(key)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 0
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (MERGE(SB_FUN, _compare)(&(entry1).ptr->key, &(entry2).ptr->key) == 0)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (MERGE(SB_FUN, _compare)((key1), &(entry2).ptr->key) == 0)
+#define CHASH_PARAM_ENTRY_NEXT node.chash_next
@@ -0,0 +1,290 @@
+// Benchmark body for one key type. Inputs:
+// SB_NAME - suffix for type names
+// SB_FUN - prefix of the key functions (_gen, _compare, _hash)
+// SB_KEY_T - key type
+
+#define SB_ENTRY struct MERGE(SbEntry, SB_NAME)
+#define SB_CAVL(x) MERGE(MERGE(SbCAvl, SB_NAME), x)
+#define SB_SAVL(x) MERGE(MERGE(SbSAvl, SB_NAME), x)
+#define SB_CHASH(x) MERGE(MERGE(SbCHash, SB_NAME), x)
+#define SB_OHASH(x) MERGE(MERGE(SbOHash, SB_NAME), x)
+#define SB_BTREE(x) MERGE(MERGE(SbBTree, SB_NAME), x)
+#define SB_F(x) MERGE(SB_FUN, x)
+
+SB_ENTRY;
+typedef SB_ENTRY *MERGE(SbEntryPtr, SB_NAME);
+
+#include "structure_bench_savl.h"
+#include <structure/SAvl_decl.h>
+
+SB_ENTRY {
+    SB_KEY_T key;
+    union {
+        struct {
+            size_t child[2];
+            size_t parent;
+            int8_t balance;
+        } cavl;
+        SB_SAVL(Node) savl;
+        BAVLNode bavl;
+        size_t chash_next;
+    } node;
+};
+
+#include "structure_bench_savl.h"
+#include <structure/SAvl_impl.h>
+
+#include "structure_bench_cavl.h"
+#include <structure/CAvl_decl.h>
+
+#include "structure_bench_cavl.h"
+#include <structure/CAvl_impl.h>
+
+#include "structure_bench_chash.h"
+#include <structure/CHash_decl.h>
+
+#include "structure_bench_chash.h"
+#include <structure/CHash_impl.h>
+
+#include "structure_bench_ohash.h"
+#include <structure/OHash_decl.h>
+
+#include "structure_bench_ohash.h"
+#include <structure/OHash_impl.h>
+
+#include "structure_bench_btree.h"
+#include <structure/BTree_decl.h>
+
+#include "structure_bench_btree.h"
+#include <structure/BTree_impl.h>
+
+static int SB_F(_bavl_comparator) (void *user, void *val1, void *val2)
+{
+    return SB_F(_compare)((const SB_KEY_T *)val1, (const SB_KEY_T *)val2);
+}
+
+static void SB_F(_bench) (const struct sb_run *r)
+{
+    size_t n = r->n;
+    int scramble = (r->pattern != SB_PATTERN_SEQUENTIAL);
+    
+    SB_ENTRY *entries = (SB_ENTRY *)BAllocArray(n, sizeof(entries[0]));
+    ASSERT_FORCE(entries)
+    
+    for (size_t i = 0; i < n; i++) {
+        SB_F(_gen)(&entries[i].key, i, scramble);
+    }
+    
+    struct sb_meas m;
+    uintptr_t sum = 0;
+    
+    if (sb_want_structure("cavl")) {
+        SB_CAVL() tree;
+        SB_CAVL(_Init)(&tree);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_CAVL(Ref) ref = {&entries[idx], idx};
+            ASSERT_FORCE(SB_CAVL(_Insert)(&tree, entries, ref, NULL))
+        }
+        sb_meas_report(&m, r, "cavl", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            SB_CAVL(Ref) ref = SB_CAVL(_LookupExact)(&tree, entries, &entries[r->lookups[i]].key);
+            sum += ref.link;
+        }
+        sb_meas_report(&m, r, "cavl", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (SB_CAVL(Ref) ref = SB_CAVL(_GetFirst)(&tree, entries); !SB_CAVL(IsNullRef)(ref); ref = SB_CAVL(_GetNext)(&tree, entries, ref)) {
+            sum += ref.link;
+        }
+        sb_meas_report(&m, r, "cavl", SB_KEY_NAME, "iterate", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_CAVL(Ref) ref = {&entries[idx], idx};
+            SB_CAVL(_Remove)(&tree, entries, ref);
+        }
+        sb_meas_report(&m, r, "cavl", SB_KEY_NAME, "delete", n);
+        
+        ASSERT_FORCE(SB_CAVL(_IsEmpty)(&tree))
+    }
+    
+    if (sb_want_structure("savl")) {
+        SB_SAVL() tree;
+        SB_SAVL(_Init)(&tree);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_FORCE(SB_SAVL(_Insert)(&tree, 0, &entries[r->order[i]], NULL))
+        }
+        sb_meas_report(&m, r, "savl", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            sum += (uintptr_t)SB_SAVL(_LookupExact)(&tree, 0, &entries[r->lookups[i]].key);
+        }
+        sb_meas_report(&m, r, "savl", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (SB_ENTRY *e = SB_SAVL(_GetFirst)(&tree, 0); e; e = SB_SAVL(_GetNext)(&tree, 0, e)) {
+            sum += (uintptr_t)e;
+        }
+        sb_meas_report(&m, r, "savl", SB_KEY_NAME, "iterate", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            SB_SAVL(_Remove)(&tree, 0, &entries[r->order[i]]);
+        }
+        sb_meas_report(&m, r, "savl", SB_KEY_NAME, "delete", n);
+        
+        ASSERT_FORCE(SB_SAVL(_IsEmpty)(&tree))
+    }
+    
+    if (sb_want_structure("bavl")) {
+        BAVL tree;
+        BAVL_Init(&tree, (int)(offsetof(SB_ENTRY, key) - offsetof(SB_ENTRY, node.bavl)), SB_F(_bavl_comparator), NULL);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_FORCE(BAVL_Insert(&tree, &entries[r->order[i]].node.bavl, NULL))
+        }
+        sb_meas_report(&m, r, "bavl", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            sum += (uintptr_t)BAVL_LookupExact(&tree, &entries[r->lookups[i]].key);
+        }
+        sb_meas_report(&m, r, "bavl", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (BAVLNode *node = BAVL_GetFirst(&tree); node; node = BAVL_GetNext(&tree, node)) {
+            sum += (uintptr_t)node;
+        }
+        sb_meas_report(&m, r, "bavl", SB_KEY_NAME, "iterate", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            BAVL_Remove(&tree, &entries[r->order[i]].node.bavl);
+        }
+        sb_meas_report(&m, r, "bavl", SB_KEY_NAME, "delete", n);
+        
+        ASSERT_FORCE(BAVL_IsEmpty(&tree))
+    }
+    
+    if (sb_want_structure("btree")) {
+        SB_BTREE() tree;
+        SB_BTREE(_Init)(&tree);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            ASSERT_FORCE(SB_BTREE(_Insert)(&tree, 0, entries[idx].key, idx, NULL))
+        }
+        sb_meas_report(&m, r, "btree", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            SB_BTREE(Ref) ref = SB_BTREE(_LookupExact)(&tree, 0, entries[r->lookups[i]].key);
+            sum += *SB_BTREE(RefValue)(ref);
+        }
+        sb_meas_report(&m, r, "btree", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (SB_BTREE(Ref) ref = SB_BTREE(_GetFirst)(&tree); !SB_BTREE(IsNullRef)(ref); ref = SB_BTREE(_GetNext)(&tree, ref)) {
+            sum += *SB_BTREE(RefValue)(ref);
+        }
+        sb_meas_report(&m, r, "btree", SB_KEY_NAME, "iterate", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_FORCE(SB_BTREE(_Remove)(&tree, 0, entries[r->order[i]].key))
+        }
+        sb_meas_report(&m, r, "btree", SB_KEY_NAME, "delete", n);
+        
+        ASSERT_FORCE(SB_BTREE(_IsEmpty)(&tree))
+        SB_BTREE(_Free)(&tree);
+    }
+    
+    if (sb_want_structure("chash")) {
+        SB_CHASH() hash;
+        ASSERT_FORCE(SB_CHASH(_Init)(&hash, n))
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_CHASH(Ref) ref = {&entries[idx], idx};
+            ASSERT_FORCE(SB_CHASH(_Insert)(&hash, entries, ref, NULL))
+        }
+        sb_meas_report(&m, r, "chash", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            SB_CHASH(Ref) ref = SB_CHASH(_Lookup)(&hash, entries, &entries[r->lookups[i]].key);
+            sum += ref.link;
+        }
+        sb_meas_report(&m, r, "chash", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_CHASH(Ref) ref = {&entries[idx], idx};
+            SB_CHASH(_Remove)(&hash, entries, ref);
+        }
+        sb_meas_report(&m, r, "chash", SB_KEY_NAME, "delete", n);
+        
+        SB_CHASH(_Free)(&hash);
+    }
+    
+    if (sb_want_structure("ohash")) {
+        SB_OHASH() hash;
+        ASSERT_FORCE(SB_OHASH(_Init)(&hash, n))
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_OHASH(Ref) ref = {&entries[idx], idx};
+            ASSERT_FORCE(SB_OHASH(_Insert)(&hash, entries, ref, NULL))
+        }
+        sb_meas_report(&m, r, "ohash", SB_KEY_NAME, "insert", n);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < r->num_lookups; i++) {
+            SB_OHASH(Ref) ref = SB_OHASH(_Lookup)(&hash, entries, &entries[r->lookups[i]].key);
+            sum += ref.link;
+        }
+        sb_meas_report(&m, r, "ohash", SB_KEY_NAME, "lookup", r->num_lookups);
+        
+        sb_meas_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            size_t idx = r->order[i];
+            SB_OHASH(Ref) ref = {&entries[idx], idx};
+            SB_OHASH(_Remove)(&hash, entries, ref);
+        }
+        sb_meas_report(&m, r, "ohash", SB_KEY_NAME, "delete", n);
+        
+        ASSERT_FORCE(SB_OHASH(_Count)(&hash) == 0)
+        SB_OHASH(_Free)(&hash);
+    }
+    
+    sb_sink += sum;
+    
+    BFree(entries);
+}
+
+#undef SB_ENTRY
+#undef SB_CAVL
+#undef SB_SAVL
+#undef SB_CHASH
+#undef SB_OHASH
+#undef SB_BTREE
+#undef SB_F
+
+#undef SB_NAME
+#undef SB_FUN
+#undef SB_KEY_T
+#undef SB_KEY_NAME
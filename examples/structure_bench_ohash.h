@@ -0,0 +1,11 @@
+#define OHASH_PARAM_NAME MERGE(SbOHash, SB_NAME)
+#define OHASH_PARAM_ENTRY struct MERGE(SbEntry, SB_NAME)
+#define OHASH_PARAM_LINK size_t
+#define OHASH_PARAM_KEY const SB_KEY_T *
+#define OHASH_PARAM_ARG MERGE(SbEntryPtr, SB_NAME)
+#define OHASH_PARAM_NULL ((size_t)-1)
+#define OHASH_PARAM_DEREF(arg, link) (&(arg)[(link)])
+#define OHASH_PARAM_ENTRYHASH(arg, entry) MERGE(SB_FUN, _hash)(&(entry).ptr->key)
+#define OHASH_PARAM_KEYHASH(arg, key) MERGE(SB_FUN, _hash)(key)
+#define OHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (MERGE(SB_FUN, _compare)(&(entry1).ptr->key, &(entry2).ptr->key) == 0)
+#define OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (MERGE(SB_FUN, _compare)((key1), &(entry2).ptr->key) == 0)
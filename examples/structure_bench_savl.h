@@ -0,0 +1,9 @@
+#define SAVL_PARAM_NAME MERGE(SbSAvl, SB_NAME)
+#define SAVL_PARAM_FEATURE_COUNTS 0
+#define SAVL_PARAM_FEATURE_NOKEYS 0
+#define SAVL_PARAM_TYPE_ENTRY struct MERGE(SbEntry, SB_NAME)
+#define SAVL_PARAM_TYPE_KEY const SB_KEY_T *
+#define SAVL_PARAM_TYPE_ARG int
+#define SAVL_PARAM_FUN_COMPARE_ENTRIES(arg, entry1, entry2) MERGE(SB_FUN, _compare)(&(entry1)->key, &(entry2)->key)
+#define SAVL_PARAM_FUN_COMPARE_KEY_ENTRY(arg, key1, entry2) MERGE(SB_FUN, _compare)((key1), &(entry2)->key)
+#define SAVL_PARAM_MEMBER_NODE node.savl
@@ -0,0 +1,1490 @@
+/**
+ * @file tun2socks_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * End-to-end load generator for tun2socks and udpgw, used by
+ * scripts/tun2socks_bench.sh.
+ *
+ * The program has three roles:
+ *
+ * - "server" runs on the far side of the SOCKS server and udpgw. It accepts
+ *   TCP connections whose first byte selects what to do ('B': receive zeros
+ *   until a 0xff byte and acknowledge the byte count, 'C': answer one byte,
+ *   'H': hold the connection until EOF), echoes UDP datagrams on the same port and answers
+ *   DNS queries for A records.
+ * - "socks-server" is a minimal SOCKS5 server (no authentication, CONNECT
+ *   only) for when no other SOCKS server is at hand.
+ * - "client" runs one workload through tun2socks and prints its result as a
+ *   single-line JSON object on standard output.
+ *
+ * Client workloads:
+ *
+ *   tcp-bulk      --conns connections send for --duration seconds
+ *   tcp-connrate  --conns threads open, use and close connections back to back
+ *   tcp-hold      --conns connections are opened and held idle
+ *   udp           --conns flows send --size byte datagrams at --rate per flow
+ *                 and measure the echo
+ *   dns           --conns threads send queries, each from a new socket
+ *
+ * With --watch <name>:<pid>, the CPU time used by the process during the
+ * workload and its resident memory are reported as well, from which CPU
+ * seconds per Gbit and resident memory per 1000 held connections are derived.
+ *
+ * Latencies are measured on the client and are therefore round trips.
+ * Servers use a thread per connection; they are meant to be faster than the
+ * code under test, not to scale to large numbers of connections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 5201
+#define DEFAULT_DNS_PORT 53
+#define DEFAULT_DURATION 10
+#define DEFAULT_UDP_SIZE 64
+#define DEFAULT_UDP_RATE 10000
+#define DEFAULT_BULK_SIZE 65536
+#define MAX_WATCHES 4
+#define MAX_THREADS 4096
+#define THREAD_STACK_SIZE (256 * 1024)
+#define IO_BUFFER_SIZE 65536
+#define SOCKET_TIMEOUT 10
+#define UDP_DRAIN_MS 1000
+#define DNS_TIMEOUT_MS 1000
+#define HOLD_SETTLE_MS 1000
+#define DNS_ANSWER_ADDR "192.0.2.1"
+#define BULK_END_MARKER 0xff
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_MAX_LOG 40
+#define LATENCY_NUM_BUCKETS ((LATENCY_MAX_LOG - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+// latency histogram in microseconds, log-linear like the flooder's
+struct hist {
+    uint64_t count;
+    uint64_t buckets[LATENCY_NUM_BUCKETS];
+};
+
+struct watch {
+    const char *name;
+    int pid;
+    double cpu_start;
+    double cpu_end;
+    long rss_start;
+    long rss_end;
+};
+
+struct result {
+    double elapsed;
+    uint64_t bytes;
+    uint64_t ops;
+    uint64_t sent;
+    uint64_t errors;
+    struct hist hist;
+};
+
+struct worker {
+    pthread_t thread;
+    int index;
+    int fd;
+    struct result res;
+};
+
+static struct {
+    const char *workload;
+    const char *label;
+    struct sockaddr_storage target;
+    socklen_t target_len;
+    int port;
+    int dns_port;
+    int duration;
+    int conns;
+    int size;
+    int rate;
+    struct watch watches[MAX_WATCHES];
+    int num_watches;
+} options;
+
+static uint64_t deadline_ns;
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ns (uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+static int latency_bucket (uint64_t v)
+{
+    if (v < (1 << LATENCY_SUB_BITS)) {
+        return v;
+    }
+
+    int log = LATENCY_SUB_BITS;
+    while (log < LATENCY_MAX_LOG && (v >> (log + 1)) > 0) {
+        log++;
+    }
+    if ((v >> (log + 1)) > 0) {
+        return LATENCY_NUM_BUCKETS - 1;
+    }
+
+    int sub = (v >> (log - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+    return ((log - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub;
+}
+
+static uint64_t latency_bucket_value (int bucket)
+{
+    if (bucket < (1 << LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+
+    int log = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << LATENCY_SUB_BITS) - 1);
+    return (((uint64_t)1 << LATENCY_SUB_BITS) + sub) << (log - LATENCY_SUB_BITS);
+}
+
+static void hist_add (struct hist *h, uint64_t latency_ns)
+{
+    h->count++;
+    h->buckets[latency_bucket(latency_ns / 1000)]++;
+}
+
+static void hist_merge (struct hist *h, const struct hist *other)
+{
+    h->count += other->count;
+    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        h->buckets[i] += other->buckets[i];
+    }
+}
+
+static uint64_t hist_percentile (const struct hist *h, double fraction)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(fraction * h->count);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        sum += h->buckets[i];
+        if (sum >= target) {
+            return latency_bucket_value(i);
+        }
+    }
+
+    return latency_bucket_value(LATENCY_NUM_BUCKETS - 1);
+}
+
+static void result_merge (struct result *r, const struct result *other)
+{
+    r->bytes += other->bytes;
+    r->ops += other->ops;
+    r->sent += other->sent;
+    r->errors += other->errors;
+    hist_merge(&r->hist, &other->hist);
+}
+
+static int read_full (int fd, void *data, size_t len)
+{
+    uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int write_full (int fd, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// reads and discards until EOF, returns the number of bytes read or -1 on error
+static int64_t drain (int fd)
+{
+    uint8_t buf[IO_BUFFER_SIZE];
+    int64_t total = 0;
+
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return total;
+        }
+        total += n;
+    }
+}
+
+static void set_timeouts (int fd, int seconds)
+{
+    struct timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int start_thread (void *(*func) (void *), void *arg, pthread_t *out)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    if (!out) {
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    }
+
+    int res = pthread_create(out ? out : &thread, &attr, func, arg);
+    pthread_attr_destroy(&attr);
+
+    if (res != 0) {
+        fprintf(stderr, "pthread_create failed: %s\n", strerror(res));
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parse_addr (const char *str, int default_port, struct sockaddr_storage *out, socklen_t *out_len)
+{
+    char host[256];
+    int port = default_port;
+
+    // [addr]:port, addr:port or addr
+    const char *colon = strrchr(str, ':');
+    if (str[0] == '[') {
+        const char *end = strchr(str, ']');
+        if (!end || (size_t)(end - str - 1) >= sizeof(host)) {
+            return 0;
+        }
+        memcpy(host, str + 1, end - str - 1);
+        host[end - str - 1] = '\0';
+        if (end[1] == ':') {
+            port = atoi(end + 2);
+        }
+    }
+    else if (colon && strchr(str, ':') == colon) {
+        if ((size_t)(colon - str) >= sizeof(host)) {
+            return 0;
+        }
+        memcpy(host, str, colon - str);
+        host[colon - str] = '\0';
+        port = atoi(colon + 1);
+    }
+    else {
+        if (strlen(str) >= sizeof(host)) {
+            return 0;
+        }
+        strcpy(host, str);
+    }
+
+    if (port <= 0 || port > 65535) {
+        return 0;
+    }
+
+    memset(out, 0, sizeof(*out));
+
+    struct sockaddr_in *sin = (struct sockaddr_in *)out;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)out;
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        *out_len = sizeof(*sin);
+        return 1;
+    }
+    if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        *out_len = sizeof(*sin6);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void addr_set_port (struct sockaddr_storage *addr, int port)
+{
+    if (addr->ss_family == AF_INET) {
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+    } else {
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+    }
+}
+
+static int open_listener (struct sockaddr_storage *addr, socklen_t addr_len, int type)
+{
+    int fd = socket(addr->ss_family, type, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd, (struct sockaddr *)addr, addr_len) < 0) {
+        perror("bind");
+        goto fail;
+    }
+
+    if (type == SOCK_STREAM && listen(fd, 4096) < 0) {
+        perror("listen");
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+static void raise_fd_limit (void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// server
+
+static void * server_tcp_thread (void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    uint8_t cmd;
+
+    if (!read_full(fd, &cmd, 1)) {
+        goto out;
+    }
+
+    switch (cmd) {
+        case 'B': {
+            // zeros up to an end marker; tun2socks does not pass on half-closes
+            uint8_t buf[IO_BUFFER_SIZE];
+            uint64_t total = 0;
+            while (1) {
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    goto out;
+                }
+                uint8_t *end = memchr(buf, BULK_END_MARKER, n);
+                if (end) {
+                    total += end - buf;
+                    break;
+                }
+                total += n;
+            }
+            write_full(fd, &total, sizeof(total));
+            drain(fd);
+        } break;
+
+        case 'C': {
+            if (write_full(fd, &cmd, 1)) {
+                drain(fd);
+            }
+        } break;
+
+        case 'H': {
+            drain(fd);
+        } break;
+    }
+
+out:
+    close(fd);
+    return NULL;
+}
+
+static void * server_udp_thread (void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    uint8_t buf[65536];
+
+    while (1) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len);
+        if (n < 0) {
+            continue;
+        }
+        sendto(fd, buf, n, 0, (struct sockaddr *)&addr, addr_len);
+    }
+
+    return NULL;
+}
+
+static void * server_dns_thread (void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    uint8_t buf[1024];
+
+    struct in_addr answer;
+    inet_pton(AF_INET, DNS_ANSWER_ADDR, &answer);
+
+    while (1) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf) - 16, 0, (struct sockaddr *)&addr, &addr_len);
+
+        // only queries with one question
+        if (n < 12 || (buf[2] & 0x80) || buf[4] != 0 || buf[5] != 1) {
+            continue;
+        }
+
+        // skip the name, type and class
+        ssize_t pos = 12;
+        while (pos < n && buf[pos] != 0) {
+            pos += 1 + buf[pos];
+        }
+        pos += 1 + 4;
+        if (pos > n) {
+            continue;
+        }
+
+        // answer: pointer to the question name, A, IN, TTL 60
+        static const uint8_t rr[] = {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4};
+        memcpy(buf + pos, rr, sizeof(rr));
+        memcpy(buf + pos + sizeof(rr), &answer, 4);
+
+        buf[2] = 0x81;
+        buf[3] = 0x80;
+        buf[6] = 0;
+        buf[7] = 1;
+        memset(buf + 8, 0, 4);
+
+        sendto(fd, buf, pos + sizeof(rr) + 4, 0, (struct sockaddr *)&addr, addr_len);
+    }
+
+    return NULL;
+}
+
+static int run_server (const char *addr_str)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    if (!parse_addr(addr_str, options.port, &addr, &addr_len)) {
+        fprintf(stderr, "bad address: %s\n", addr_str);
+        return 0;
+    }
+
+    raise_fd_limit();
+
+    int listen_fd = open_listener(&addr, addr_len, SOCK_STREAM);
+    if (listen_fd < 0) {
+        return 0;
+    }
+
+    int udp_fd = open_listener(&addr, addr_len, SOCK_DGRAM);
+    if (udp_fd < 0 || !start_thread(server_udp_thread, (void *)(intptr_t)udp_fd, NULL)) {
+        return 0;
+    }
+
+    if (options.dns_port > 0) {
+        addr_set_port(&addr, options.dns_port);
+        int dns_fd = open_listener(&addr, addr_len, SOCK_DGRAM);
+        if (dns_fd < 0 || !start_thread(server_dns_thread, (void *)(intptr_t)dns_fd, NULL)) {
+            return 0;
+        }
+    }
+
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                sleep_ns(10000000);
+            }
+            continue;
+        }
+
+        if (!start_thread(server_tcp_thread, (void *)(intptr_t)fd, NULL)) {
+            close(fd);
+        }
+    }
+}
+
+// SOCKS server
+
+static int socks_reply (int fd, uint8_t code)
+{
+    uint8_t reply[10] = {5, code, 0, 1, 0, 0, 0, 0, 0, 0};
+    return write_full(fd, reply, sizeof(reply));
+}
+
+static int socks_connect (int fd)
+{
+    uint8_t buf[262];
+
+    // method selection, only "no authentication"
+    if (!read_full(fd, buf, 2) || buf[0] != 5 || !read_full(fd, buf + 2, buf[1])) {
+        return -1;
+    }
+    if (!memchr(buf + 2, 0, buf[1])) {
+        uint8_t reply[2] = {5, 0xff};
+        write_full(fd, reply, sizeof(reply));
+        return -1;
+    }
+    uint8_t reply[2] = {5, 0};
+    if (!write_full(fd, reply, sizeof(reply))) {
+        return -1;
+    }
+
+    // request
+    if (!read_full(fd, buf, 4) || buf[0] != 5) {
+        return -1;
+    }
+    if (buf[1] != 1) {
+        socks_reply(fd, 7);
+        return -1;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    uint8_t port[2];
+
+    switch (buf[3]) {
+        case 1: {
+            struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+            if (!read_full(fd, &sin->sin_addr, 4) || !read_full(fd, port, 2)) {
+                return -1;
+            }
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_port, port, 2);
+            addr_len = sizeof(*sin);
+        } break;
+
+        case 4: {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+            if (!read_full(fd, &sin6->sin6_addr, 16) || !read_full(fd, port, 2)) {
+                return -1;
+            }
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_port, port, 2);
+            addr_len = sizeof(*sin6);
+        } break;
+
+        case 3: {
+            uint8_t len;
+            char name[256];
+            if (!read_full(fd, &len, 1) || !read_full(fd, name, len) || !read_full(fd, port, 2)) {
+                return -1;
+            }
+            name[len] = '\0';
+
+            struct addrinfo hints;
+            struct addrinfo *ai;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(name, NULL, &hints, &ai) != 0) {
+                socks_reply(fd, 4);
+                return -1;
+            }
+            memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+            addr_len = ai->ai_addrlen;
+            freeaddrinfo(ai);
+            addr_set_port(&addr, (port[0] << 8) | port[1]);
+        } break;
+
+        default:
+            socks_reply(fd, 8);
+            return -1;
+    }
+
+    int out = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (out < 0) {
+        socks_reply(fd, 1);
+        return -1;
+    }
+
+    if (connect(out, (struct sockaddr *)&addr, addr_len) < 0) {
+        socks_reply(fd, (errno == ECONNREFUSED ? 5 : 4));
+        close(out);
+        return -1;
+    }
+
+    if (!socks_reply(fd, 0)) {
+        close(out);
+        return -1;
+    }
+
+    return out;
+}
+
+static void socks_relay (int a, int b)
+{
+    uint8_t buf[IO_BUFFER_SIZE];
+    int fds[2] = {a, b};
+    int open[2] = {1, 1};
+
+    while (open[0] || open[1]) {
+        struct pollfd pfds[2];
+        for (int i = 0; i < 2; i++) {
+            pfds[i].fd = fds[i];
+            pfds[i].events = (open[i] ? POLLIN : 0);
+            pfds[i].revents = 0;
+        }
+
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            if (!open[i] || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            ssize_t n = read(fds[i], buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return;
+            }
+            if (n == 0) {
+                // pass on the half-close
+                open[i] = 0;
+                shutdown(fds[!i], SHUT_WR);
+                continue;
+            }
+            if (!write_full(fds[!i], buf, n)) {
+                return;
+            }
+        }
+    }
+}
+
+static void * socks_thread (void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+
+    int out = socks_connect(fd);
+    if (out >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(out, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        socks_relay(fd, out);
+        close(out);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static int run_socks_server (const char *addr_str)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    if (!parse_addr(addr_str, 1080, &addr, &addr_len)) {
+        fprintf(stderr, "bad address: %s\n", addr_str);
+        return 0;
+    }
+
+    raise_fd_limit();
+
+    int listen_fd = open_listener(&addr, addr_len, SOCK_STREAM);
+    if (listen_fd < 0) {
+        return 0;
+    }
+
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                sleep_ns(10000000);
+            }
+            continue;
+        }
+
+        if (!start_thread(socks_thread, (void *)(intptr_t)fd, NULL)) {
+            close(fd);
+        }
+    }
+}
+
+// client
+
+static int watch_sample (struct watch *w, double *cpu, long *rss)
+{
+    char path[64];
+    char buf[1024];
+
+    // utime and stime are fields 14 and 15, counting from the pid
+    snprintf(path, sizeof(path), "/proc/%d/stat", w->pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    char *p = strrchr(buf, ')');
+    unsigned long utime;
+    unsigned long stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return 0;
+    }
+    *cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    snprintf(path, sizeof(path), "/proc/%d/status", w->pid);
+    if (!(f = fopen(path, "r"))) {
+        return 0;
+    }
+    *rss = -1;
+    while (fgets(buf, sizeof(buf), f)) {
+        if (sscanf(buf, "VmRSS: %ld", rss) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+
+    return (*rss >= 0);
+}
+
+static int watches_start (void)
+{
+    for (int i = 0; i < options.num_watches; i++) {
+        struct watch *w = &options.watches[i];
+        if (!watch_sample(w, &w->cpu_start, &w->rss_start)) {
+            fprintf(stderr, "cannot read /proc of %s (%d)\n", w->name, w->pid);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int watches_end (void)
+{
+    for (int i = 0; i < options.num_watches; i++) {
+        struct watch *w = &options.watches[i];
+        if (!watch_sample(w, &w->cpu_end, &w->rss_end)) {
+            fprintf(stderr, "cannot read /proc of %s (%d)\n", w->name, w->pid);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int connect_target (int port)
+{
+    struct sockaddr_storage addr = options.target;
+    addr_set_port(&addr, port);
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    set_timeouts(fd, SOCKET_TIMEOUT);
+
+    if (connect(fd, (struct sockaddr *)&addr, options.target_len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int open_udp (int port)
+{
+    struct sockaddr_storage addr = options.target;
+    addr_set_port(&addr, port);
+
+    int fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, options.target_len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void * tcp_bulk_thread (void *arg)
+{
+    struct worker *w = arg;
+
+    uint8_t *buf = calloc(1, options.size);
+    if (!buf) {
+        w->res.errors++;
+        return NULL;
+    }
+
+    int fd = connect_target(options.port);
+    if (fd < 0) {
+        w->res.errors++;
+        goto out;
+    }
+
+    uint8_t cmd = 'B';
+    if (!write_full(fd, &cmd, 1)) {
+        w->res.errors++;
+        goto out_close;
+    }
+
+    while (now_ns() < deadline_ns) {
+        if (!write_full(fd, buf, options.size)) {
+            w->res.errors++;
+            goto out_close;
+        }
+    }
+
+    // count what the server received
+    uint64_t ack;
+    uint8_t end = BULK_END_MARKER;
+    if (!write_full(fd, &end, 1) || !read_full(fd, &ack, sizeof(ack))) {
+        w->res.errors++;
+        goto out_close;
+    }
+    w->res.bytes += ack;
+    w->res.ops++;
+
+out_close:
+    close(fd);
+out:
+    free(buf);
+    return NULL;
+}
+
+static void * tcp_connrate_thread (void *arg)
+{
+    struct worker *w = arg;
+
+    while (now_ns() < deadline_ns) {
+        uint64_t start = now_ns();
+
+        int fd = connect_target(options.port);
+        if (fd < 0) {
+            w->res.errors++;
+            sleep_ns(1000000);
+            continue;
+        }
+
+        uint8_t cmd = 'C';
+        uint8_t reply;
+        if (!write_full(fd, &cmd, 1) || !read_full(fd, &reply, 1)) {
+            w->res.errors++;
+            close(fd);
+            continue;
+        }
+
+        close(fd);
+
+        hist_add(&w->res.hist, now_ns() - start);
+        w->res.ops++;
+    }
+
+    return NULL;
+}
+
+static void * udp_recv_thread (void *arg)
+{
+    struct worker *w = arg;
+    uint8_t buf[65536];
+
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint64_t end = deadline_ns + (uint64_t)UDP_DRAIN_MS * 1000000;
+
+    while (now_ns() < end) {
+        ssize_t n = recv(w->fd, buf, sizeof(buf), 0);
+        if (n < 16) {
+            continue;
+        }
+
+        uint64_t ts;
+        memcpy(&ts, buf + 8, 8);
+        hist_add(&w->res.hist, now_ns() - ts);
+        w->res.ops++;
+        w->res.bytes += n;
+    }
+
+    return NULL;
+}
+
+static void * udp_send_thread (void *arg)
+{
+    struct worker *w = arg;
+
+    uint8_t *buf = calloc(1, options.size);
+    if (!buf) {
+        w->res.errors++;
+        return NULL;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t seq = 0;
+
+    while (1) {
+        uint64_t now = now_ns();
+        if (now >= deadline_ns) {
+            break;
+        }
+
+        // open loop: datagram seq is due at start + seq / rate
+        uint64_t due = start + seq * 1000000000 / options.rate;
+        if (now < due) {
+            sleep_ns(due - now);
+            continue;
+        }
+
+        memcpy(buf, &seq, 8);
+        memcpy(buf + 8, &due, 8);
+
+        if (send(w->fd, buf, options.size, 0) < 0) {
+            w->res.errors++;
+        }
+        seq++;
+    }
+
+    w->res.sent = seq;
+
+    free(buf);
+    return NULL;
+}
+
+static int dns_build_query (uint8_t *buf, uint16_t id, int thread, uint64_t n)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "q%" PRIu64 "-t%d.bench.example", n, thread);
+
+    memset(buf, 0, 12);
+    buf[0] = id >> 8;
+    buf[1] = id;
+    buf[2] = 0x01; // RD
+    buf[5] = 1; // QDCOUNT
+
+    int pos = 12;
+    char *label = name;
+    while (*label) {
+        char *dot = strchr(label, '.');
+        int len = (dot ? dot - label : (int)strlen(label));
+        buf[pos++] = len;
+        memcpy(buf + pos, label, len);
+        pos += len;
+        label += len + (dot ? 1 : 0);
+    }
+    buf[pos++] = 0;
+
+    // QTYPE A, QCLASS IN
+    buf[pos++] = 0;
+    buf[pos++] = 1;
+    buf[pos++] = 0;
+    buf[pos++] = 1;
+
+    return pos;
+}
+
+static void * dns_thread (void *arg)
+{
+    struct worker *w = arg;
+    uint8_t query[512];
+    uint8_t reply[512];
+    uint64_t n = 0;
+
+    while (now_ns() < deadline_ns) {
+        // a new socket every time, so every query is a new flow for udpgw
+        int fd = open_udp(options.dns_port);
+        if (fd < 0) {
+            w->res.errors++;
+            sleep_ns(1000000);
+            continue;
+        }
+
+        uint16_t id = (uint16_t)(n * 7919 + w->index);
+        int len = dns_build_query(query, id, w->index, n++);
+
+        uint64_t start = now_ns();
+        w->res.sent++;
+
+        if (send(fd, query, len, 0) < 0) {
+            w->res.errors++;
+            close(fd);
+            continue;
+        }
+
+        // wait for the answer to our query
+        while (1) {
+            uint64_t elapsed_ms = (now_ns() - start) / 1000000;
+            if (elapsed_ms >= DNS_TIMEOUT_MS) {
+                break;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, DNS_TIMEOUT_MS - elapsed_ms) <= 0) {
+                continue;
+            }
+
+            ssize_t rlen = recv(fd, reply, sizeof(reply), 0);
+            if (rlen >= 12 && reply[0] == (uint8_t)(id >> 8) && reply[1] == (uint8_t)id && (reply[2] & 0x80)) {
+                hist_add(&w->res.hist, now_ns() - start);
+                w->res.ops++;
+                break;
+            }
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int run_workers (void *(*func) (void *), struct worker *workers, int num, struct result *res)
+{
+    int started;
+    for (started = 0; started < num; started++) {
+        if (!start_thread(func, &workers[started], &workers[started].thread)) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        result_merge(res, &workers[i].res);
+    }
+
+    return (started == num);
+}
+
+static int client_tcp_bulk (struct worker *workers, struct result *res)
+{
+    return run_workers(tcp_bulk_thread, workers, options.conns, res);
+}
+
+static int client_tcp_connrate (struct worker *workers, struct result *res)
+{
+    return run_workers(tcp_connrate_thread, workers, options.conns, res);
+}
+
+static int client_dns (struct worker *workers, struct result *res)
+{
+    return run_workers(dns_thread, workers, options.conns, res);
+}
+
+static int client_udp (struct worker *workers, struct result *res)
+{
+    struct worker *senders = calloc(options.conns, sizeof(senders[0]));
+    if (!senders) {
+        return 0;
+    }
+
+    int ret = 0;
+    int opened;
+    for (opened = 0; opened < options.conns; opened++) {
+        if ((workers[opened].fd = open_udp(options.port)) < 0) {
+            perror("socket");
+            goto out;
+        }
+        senders[opened] = workers[opened];
+    }
+
+    // receivers run a little longer to collect late echoes
+    pthread_t recv_threads[MAX_THREADS];
+    int num_recv;
+    for (num_recv = 0; num_recv < options.conns; num_recv++) {
+        if (!start_thread(udp_recv_thread, &workers[num_recv], &recv_threads[num_recv])) {
+            break;
+        }
+    }
+
+    ret = (num_recv == options.conns) && run_workers(udp_send_thread, senders, options.conns, res);
+
+    for (int i = 0; i < num_recv; i++) {
+        pthread_join(recv_threads[i], NULL);
+        result_merge(res, &workers[i].res);
+    }
+
+out:
+    while (opened-- > 0) {
+        close(workers[opened].fd);
+    }
+    free(senders);
+    return ret;
+}
+
+static int client_tcp_hold (struct result *res)
+{
+    int *fds = calloc(options.conns, sizeof(fds[0]));
+    if (!fds) {
+        return 0;
+    }
+
+    int held = 0;
+    for (int i = 0; i < options.conns; i++) {
+        int fd = connect_target(options.port);
+        uint8_t cmd = 'H';
+        if (fd < 0 || !write_full(fd, &cmd, 1)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            res->errors++;
+            continue;
+        }
+        fds[held++] = fd;
+    }
+    res->ops = held;
+
+    // let the processes under test finish setting up the connections
+    sleep_ns((uint64_t)HOLD_SETTLE_MS * 1000000);
+
+    int ret = watches_end();
+
+    while (held-- > 0) {
+        close(fds[held]);
+    }
+    free(fds);
+
+    return ret;
+}
+
+static void print_result (const struct result *res)
+{
+    const char *wl = options.workload;
+    double secs = (res->elapsed > 0 ? res->elapsed : 1);
+    double gbits = res->bytes * 8 / 1e9;
+
+    printf("{\"workload\": \"%s\"", wl);
+    if (options.label) {
+        printf(", \"label\": \"%s\"", options.label);
+    }
+    printf(", \"duration_s\": %.3f, \"conns\": %d", res->elapsed, options.conns);
+
+    if (!strcmp(wl, "tcp-bulk")) {
+        printf(", \"bytes\": %" PRIu64 ", \"gbit_s\": %.3f", res->bytes, gbits / secs);
+    }
+    else if (!strcmp(wl, "tcp-connrate")) {
+        printf(", \"connections\": %" PRIu64 ", \"conns_per_s\": %.1f", res->ops, res->ops / secs);
+    }
+    else if (!strcmp(wl, "tcp-hold")) {
+        printf(", \"connections\": %" PRIu64, res->ops);
+    }
+    else if (!strcmp(wl, "udp")) {
+        double loss = (res->sent > 0 && res->sent > res->ops ? 100.0 * (res->sent - res->ops) / res->sent : 0);
+        printf(", \"size\": %d, \"rate\": %d, \"packets_sent\": %" PRIu64 ", \"packets_received\": %" PRIu64 ", \"loss_percent\": %.3f, \"pps\": %.1f, \"gbit_s\": %.3f",
+               options.size, options.rate, res->sent, res->ops, loss, res->ops / secs, gbits / secs);
+    }
+    else if (!strcmp(wl, "dns")) {
+        printf(", \"queries\": %" PRIu64 ", \"answered\": %" PRIu64 ", \"qps\": %.1f", res->sent, res->ops, res->ops / secs);
+    }
+
+    if (res->hist.count > 0) {
+        printf(", \"p50_latency_us\": %" PRIu64 ", \"p99_latency_us\": %" PRIu64 ", \"max_latency_us\": %" PRIu64,
+               hist_percentile(&res->hist, 0.5), hist_percentile(&res->hist, 0.99), hist_percentile(&res->hist, 1.0));
+    }
+
+    printf(", \"errors\": %" PRIu64, res->errors);
+
+    if (options.num_watches > 0) {
+        printf(", \"processes\": {");
+        for (int i = 0; i < options.num_watches; i++) {
+            const struct watch *w = &options.watches[i];
+            double cpu = w->cpu_end - w->cpu_start;
+            printf("%s\"%s\": {\"cpu_s\": %.2f, \"cpu_percent\": %.1f, \"rss_kb\": %ld", (i > 0 ? ", " : ""), w->name, cpu, 100 * cpu / secs, w->rss_end);
+            if (res->bytes > 0) {
+                printf(", \"cpu_s_per_gbit\": %.4f", cpu / gbits);
+            }
+            if (!strcmp(wl, "tcp-hold") && res->ops > 0) {
+                printf(", \"rss_kb_per_1k_conns\": %.1f", (double)(w->rss_end - w->rss_start) * 1000 / res->ops);
+            }
+            printf("}");
+        }
+        printf("}");
+    }
+
+    printf("}\n");
+}
+
+static int run_client (void)
+{
+    const char *wl = options.workload;
+
+    // per-workload defaults
+    if (options.conns <= 0) {
+        options.conns = (!strcmp(wl, "tcp-bulk") ? 4 : !strcmp(wl, "tcp-hold") ? 1000 : !strcmp(wl, "udp") ? 4 : 16);
+    }
+    if (options.size <= 0) {
+        options.size = (!strcmp(wl, "udp") ? DEFAULT_UDP_SIZE : DEFAULT_BULK_SIZE);
+    }
+    if (!strcmp(wl, "udp") && options.size < 16) {
+        fprintf(stderr, "--size: at least 16 for udp\n");
+        return 0;
+    }
+    if (strcmp(wl, "tcp-hold") && options.conns > MAX_THREADS) {
+        fprintf(stderr, "--conns: at most %d\n", MAX_THREADS);
+        return 0;
+    }
+
+    raise_fd_limit();
+
+    struct worker *workers = calloc(options.conns, sizeof(workers[0]));
+    if (!workers) {
+        return 0;
+    }
+    for (int i = 0; i < options.conns; i++) {
+        workers[i].index = i;
+    }
+
+    struct result res;
+    memset(&res, 0, sizeof(res));
+
+    int ret = 0;
+
+    if (!watches_start()) {
+        goto out;
+    }
+
+    uint64_t start = now_ns();
+    deadline_ns = start + (uint64_t)options.duration * 1000000000;
+
+    int ok;
+    if (!strcmp(wl, "tcp-bulk")) {
+        ok = client_tcp_bulk(workers, &res);
+    }
+    else if (!strcmp(wl, "tcp-connrate")) {
+        ok = client_tcp_connrate(workers, &res);
+    }
+    else if (!strcmp(wl, "tcp-hold")) {
+        ok = client_tcp_hold(&res);
+    }
+    else if (!strcmp(wl, "udp")) {
+        ok = client_udp(workers, &res);
+    }
+    else if (!strcmp(wl, "dns")) {
+        ok = client_dns(workers, &res);
+    }
+    else {
+        fprintf(stderr, "unknown workload: %s\n", wl);
+        goto out;
+    }
+
+    if (!ok) {
+        goto out;
+    }
+
+    // tcp-hold samples the processes while the connections are held
+    if (strcmp(wl, "tcp-hold") && !watches_end()) {
+        goto out;
+    }
+
+    // the udp receivers drain for a while after the deadline, don't count that
+    uint64_t end = now_ns();
+    if (!strcmp(wl, "udp") || !strcmp(wl, "tcp-connrate") || !strcmp(wl, "dns")) {
+        end = (end < deadline_ns ? end : deadline_ns);
+    }
+    res.elapsed = (end - start) / 1e9;
+
+    print_result(&res);
+
+    ret = 1;
+
+out:
+    free(workers);
+    return ret;
+}
+
+static void usage (char *name)
+{
+    fprintf(stderr,
+        "Usage:\n"
+        "    %s server [--dns-port <port / 0>] <addr>[:<port>]\n"
+        "    %s socks-server <addr>[:<port>]\n"
+        "    %s client <workload> [--port <port>] [--dns-port <port>] [--duration <seconds>]\n"
+        "        [--conns <number>] [--size <bytes>] [--rate <packets-per-second>]\n"
+        "        [--watch <name>:<pid>] ... [--label <string>] <addr>\n"
+        "Workloads: tcp-bulk tcp-connrate tcp-hold udp dns\n",
+        name, name, name
+    );
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    const char *role = argv[1];
+    int i = 2;
+
+    options.port = DEFAULT_PORT;
+    options.dns_port = DEFAULT_DNS_PORT;
+    options.duration = DEFAULT_DURATION;
+    options.rate = DEFAULT_UDP_RATE;
+
+    if (!strcmp(role, "client")) {
+        if (i >= argc) {
+            usage(argv[0]);
+        }
+        options.workload = argv[i++];
+    }
+
+    const char *addr = NULL;
+
+    for (; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--port") && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--dns-port") && i + 1 < argc) {
+            options.dns_port = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--duration") && i + 1 < argc) {
+            options.duration = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--conns") && i + 1 < argc) {
+            options.conns = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--size") && i + 1 < argc) {
+            options.size = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--rate") && i + 1 < argc) {
+            options.rate = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--label") && i + 1 < argc) {
+            options.label = argv[++i];
+        }
+        else if (!strcmp(arg, "--watch") && i + 1 < argc) {
+            char *spec = argv[++i];
+            char *colon = strchr(spec, ':');
+            if (!colon || options.num_watches == MAX_WATCHES) {
+                usage(argv[0]);
+            }
+            *colon = '\0';
+            options.watches[options.num_watches].name = spec;
+            options.watches[options.num_watches].pid = atoi(colon + 1);
+            options.num_watches++;
+        }
+        else if (arg[0] != '-' && !addr) {
+            addr = arg;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (!addr || options.port <= 0 || options.port > 65535 || options.dns_port < 0 || options.dns_port > 65535 ||
+        options.duration <= 0 || options.rate <= 0 || options.conns < 0 || options.size < 0) {
+        usage(argv[0]);
+    }
+
+    if (!strcmp(role, "server")) {
+        return !run_server(addr);
+    }
+
+    if (!strcmp(role, "socks-server")) {
+        return !run_socks_server(addr);
+    }
+
+    if (!strcmp(role, "client")) {
+        if (!parse_addr(addr, options.port, &options.target, &options.target_len)) {
+            fprintf(stderr, "bad address: %s\n", addr);
+            return 1;
+        }
+        return !run_client();
+    }
+
+    usage(argv[0]);
+    return 1;
+}
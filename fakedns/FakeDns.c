@@ -0,0 +1,343 @@
+/**
+ * @file FakeDns.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/ipaddr.h>
+#include <misc/hashfun.h>
+#include <base/BLog.h>
+
+#include <fakedns/FakeDns.h>
+
+#include <generated/blog_channel_FakeDns.h>
+
+#include "FakeDns_name_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "FakeDns_addr_hash.h"
+#include <structure/CHash_impl.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_NAME_MAX 255
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+
+// header, question and at most one A record
+#define RESPONSE_MAX (DNS_HEADER_SIZE + DNS_NAME_MAX + 4 + 16)
+
+static uint16_t read16 (const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static void write16 (uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void write32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int name_char_ok (uint8_t c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+// Parses the question name at the start of the question section into text form,
+// lowercased. Only names which can be sent as a hostname are accepted.
+static int parse_name (const uint8_t *data, int data_len, char *out_name, int *out_name_len, int *out_wire_len)
+{
+    int pos = DNS_HEADER_SIZE;
+    int len = 0;
+    
+    while (1) {
+        if (pos >= data_len) {
+            return 0;
+        }
+        uint8_t c = data[pos++];
+        if (c == 0) {
+            break;
+        }
+        if (c > 63 || data_len - pos < c || pos - DNS_HEADER_SIZE + c > DNS_NAME_MAX) {
+            return 0;
+        }
+        if (len > 0) {
+            out_name[len++] = '.';
+        }
+        for (int i = 0; i < c; i++) {
+            uint8_t ch = data[pos + i];
+            if (!name_char_ok(ch)) {
+                return 0;
+            }
+            out_name[len++] = (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+        }
+        pos += c;
+    }
+    
+    // the root name can not be a destination
+    if (len == 0) {
+        return 0;
+    }
+    
+    ASSERT(len <= FAKEDNS_NAME_MAX)
+    
+    *out_name_len = len;
+    *out_wire_len = pos - DNS_HEADER_SIZE;
+    return 1;
+}
+
+static uint32_t pool_addr_at (FakeDns *o, int index)
+{
+    // skip the network address of the pool
+    return hton32(ntoh32(o->pool_addr) + 1 + index);
+}
+
+static FakeDnsNameHashRef name_ref (struct FakeDns_entry *entry)
+{
+    FakeDnsNameHashRef ref = {entry, entry};
+    return ref;
+}
+
+static FakeDnsAddrHashRef addr_ref (struct FakeDns_entry *entry)
+{
+    FakeDnsAddrHashRef ref = {entry, entry};
+    return ref;
+}
+
+static void touch_entry (FakeDns *o, struct FakeDns_entry *entry)
+{
+    // move to the end of the entries list
+    LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+}
+
+static struct FakeDns_entry * map_name (FakeDns *o, const char *name, int name_len)
+{
+    struct FakeDns_name key = {name, name_len};
+    struct FakeDns_entry *entry = FakeDnsNameHash_Lookup(&o->name_hash, 0, key).ptr;
+    if (entry) {
+        touch_entry(o, entry);
+        return entry;
+    }
+    
+    if (o->num_entries < o->max_entries) {
+        // take the next unused address
+        if (!(entry = (struct FakeDns_entry *)BAlloc(sizeof(*entry)))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            return NULL;
+        }
+        entry->addr = pool_addr_at(o, o->num_entries);
+        o->num_entries++;
+        
+        int res = FakeDnsAddrHash_Insert(&o->addr_hash, 0, addr_ref(entry), NULL);
+        ASSERT_EXECUTE(res)
+    } else {
+        // recycle the least recently used mapping, keeping its address
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->entries_list);
+        entry = UPPER_OBJECT(node, struct FakeDns_entry, list_node);
+        
+        BLog(BLOG_DEBUG, "recycling address of %.*s", entry->name_len, entry->name);
+        
+        FakeDnsNameHash_Remove(&o->name_hash, 0, name_ref(entry));
+        LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    }
+    
+    memcpy(entry->name, name, name_len);
+    entry->name_len = name_len;
+    entry->name_hash = badvpn_hash_bin((const uint8_t *)entry->name, entry->name_len, badvpn_hash_seed());
+    
+    int res = FakeDnsNameHash_Insert(&o->name_hash, 0, name_ref(entry), NULL);
+    ASSERT_EXECUTE(res)
+    
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+    
+    return entry;
+}
+
+int FakeDns_Init (FakeDns *o, uint32_t pool_addr, int pool_prefix, int max_entries, uint32_t ttl,
+                  FakeDns_handler_send handler_send, void *user)
+{
+    ASSERT(pool_prefix >= 0)
+    ASSERT(pool_prefix <= 30)
+    ASSERT(max_entries > 0)
+    ASSERT(handler_send)
+    
+    // init arguments
+    o->pool_addr = pool_addr & ipaddr_ipv4_mask_from_prefix(pool_prefix);
+    o->pool_prefix = pool_prefix;
+    o->ttl = ttl;
+    o->handler_send = handler_send;
+    o->user = user;
+    
+    // there can not be more mappings than addresses
+    uint64_t pool_size = ((uint64_t)1 << (32 - pool_prefix)) - 2;
+    o->max_entries = (pool_size < (uint64_t)max_entries) ? (int)pool_size : max_entries;
+    
+    // init hash tables
+    if (!FakeDnsNameHash_Init(&o->name_hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "FakeDnsNameHash_Init failed");
+        goto fail0;
+    }
+    if (!FakeDnsAddrHash_Init(&o->addr_hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "FakeDnsAddrHash_Init failed");
+        goto fail1;
+    }
+    
+    // init entries list
+    LinkedList1_Init(&o->entries_list);
+    o->num_entries = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    FakeDnsNameHash_Free(&o->name_hash);
+fail0:
+    return 0;
+}
+
+void FakeDns_Free (FakeDns *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free entries
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&o->entries_list))) {
+        struct FakeDns_entry *entry = UPPER_OBJECT(node, struct FakeDns_entry, list_node);
+        LinkedList1_Remove(&o->entries_list, &entry->list_node);
+        BFree(entry);
+    }
+    
+    // free hash tables
+    FakeDnsAddrHash_Free(&o->addr_hash);
+    FakeDnsNameHash_Free(&o->name_hash);
+}
+
+int FakeDns_SubmitQuery (FakeDns *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    
+    // only handle standard queries with a single question
+    if (data_len < DNS_HEADER_SIZE || (data[2] & 0x80) || ((data[2] >> 3) & 0xF) != 0 ||
+        read16(data + 4) != 1 || read16(data + 6) != 0 || read16(data + 8) != 0
+    ) {
+        return 0;
+    }
+    
+    char name[FAKEDNS_NAME_MAX];
+    int name_len;
+    int wire_len;
+    if (!parse_name(data, data_len, name, &name_len, &wire_len)) {
+        return 0;
+    }
+    
+    int qpos = DNS_HEADER_SIZE + wire_len;
+    if (data_len - qpos < 4) {
+        return 0;
+    }
+    uint16_t qtype = read16(data + qpos);
+    uint16_t qclass = read16(data + qpos + 2);
+    if (qclass != DNS_CLASS_IN || (qtype != DNS_TYPE_A && qtype != DNS_TYPE_AAAA)) {
+        return 0;
+    }
+    
+    // map the name for A queries; AAAA queries get no addresses so that the fake
+    // IPv4 address is used
+    struct FakeDns_entry *entry = NULL;
+    if (qtype == DNS_TYPE_A && !(entry = map_name(o, name, name_len))) {
+        return 0;
+    }
+    
+    uint8_t buf[RESPONSE_MAX];
+    
+    // header: response, recursion desired as in the query, recursion available, no error
+    memcpy(buf, data, 2);
+    buf[2] = 0x80 | (data[2] & 0x01);
+    buf[3] = 0x80;
+    write16(buf + 4, 1);
+    write16(buf + 6, (entry ? 1 : 0));
+    write16(buf + 8, 0);
+    write16(buf + 10, 0);
+    
+    // question as sent
+    memcpy(buf + DNS_HEADER_SIZE, data + DNS_HEADER_SIZE, wire_len + 4);
+    int len = qpos + 4;
+    
+    // answer, with the name pointing to the question
+    if (entry) {
+        write16(buf + len, 0xC000 | DNS_HEADER_SIZE);
+        write16(buf + len + 2, DNS_TYPE_A);
+        write16(buf + len + 4, DNS_CLASS_IN);
+        write32(buf + len + 6, o->ttl);
+        write16(buf + len + 10, 4);
+        memcpy(buf + len + 12, &entry->addr, 4);
+        len += 16;
+    }
+    
+    ASSERT(len <= RESPONSE_MAX)
+    
+    BLog(BLOG_DEBUG, "answered %s query for %.*s", (entry ? "A" : "AAAA"), name_len, name);
+    
+    o->handler_send(o->user, local_addr, remote_addr, buf, len);
+    return 1;
+}
+
+int FakeDns_IsFakeAddr (FakeDns *o, uint32_t addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return ipaddr_ipv4_addrs_in_network(addr, o->pool_addr, o->pool_prefix);
+}
+
+int FakeDns_LookupAddr (FakeDns *o, uint32_t addr, const char **out_name, int *out_name_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct FakeDns_entry *entry = FakeDnsAddrHash_Lookup(&o->addr_hash, 0, addr).ptr;
+    if (!entry) {
+        return 0;
+    }
+    
+    touch_entry(o, entry);
+    
+    *out_name = entry->name;
+    *out_name_len = entry->name_len;
+    return 1;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file FakeDns.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Fake-IP DNS responder, used by tun2socks.
+ * 
+ * A and AAAA queries are answered locally without contacting a resolver. Each
+ * name queried for an A record is given an address from a reserved IPv4 pool,
+ * and the mapping is kept in both directions, so that a connection to the
+ * address can later be made to the name instead. AAAA queries for such names
+ * get an empty answer, making clients use the fake IPv4 address. Other queries,
+ * and names which can not be passed on as a hostname, are left to be forwarded.
+ * The number of mappings is bounded; when the pool or the table is full, the
+ * least recently used mapping is recycled.
+ */
+
+#ifndef BADVPN_FAKEDNS_FAKEDNS_H
+#define BADVPN_FAKEDNS_FAKEDNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+
+/**
+ * Maximum length of a name in text form, without the trailing dot.
+ */
+#define FAKEDNS_NAME_MAX 253
+
+/**
+ * Handler called to send a DNS response to a client.
+ * 
+ * @param user as in {@link FakeDns_Init}
+ * @param local_addr address identifying the client
+ * @param remote_addr address of the resolver the query was sent to
+ * @param data response message
+ * @param data_len length of response
+ */
+typedef void (*FakeDns_handler_send) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+struct FakeDns_name {
+    const char *data;
+    int len;
+};
+
+struct FakeDns_entry;
+
+typedef struct FakeDns_entry *FakeDnsNameHash_link;
+typedef struct FakeDns_name FakeDnsNameHash_key;
+typedef struct FakeDns_entry *FakeDnsAddrHash_link;
+typedef uint32_t FakeDnsAddrHash_key;
+
+#include "FakeDns_name_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "FakeDns_addr_hash.h"
+#include <structure/CHash_decl.h>
+
+struct FakeDns_entry {
+    LinkedList1Node list_node; // node in FakeDns.entries_list
+    FakeDnsNameHash_link name_hash_next; // next in FakeDns.name_hash bucket
+    FakeDnsAddrHash_link addr_hash_next; // next in FakeDns.addr_hash bucket
+    size_t name_hash;
+    uint32_t addr;
+    int name_len;
+    char name[FAKEDNS_NAME_MAX];
+};
+
+/**
+ * Fake-IP DNS responder.
+ */
+typedef struct {
+    uint32_t pool_addr;
+    int pool_prefix;
+    int max_entries;
+    uint32_t ttl;
+    FakeDns_handler_send handler_send;
+    void *user;
+    FakeDnsNameHash name_hash;
+    FakeDnsAddrHash addr_hash;
+    LinkedList1 entries_list;
+    int num_entries;
+    DebugObject d_obj;
+} FakeDns;
+
+/**
+ * Initializes the responder.
+ * 
+ * @param o the object
+ * @param pool_addr network address of the pool, in network byte order
+ * @param pool_prefix prefix length of the pool. Must be >=0 and <=30. The network
+ *                    and broadcast addresses of the pool are not handed out.
+ * @param max_entries maximum number of mappings. Must be >0. It is reduced to the
+ *                    number of addresses in the pool if that is smaller.
+ * @param ttl TTL of the answers, in seconds
+ * @param handler_send handler called to send responses to clients. It is called
+ *                     synchronously from {@link FakeDns_SubmitQuery}.
+ * @param user value passed to handler
+ * @return 1 on success, 0 on failure
+ */
+int FakeDns_Init (FakeDns *o, uint32_t pool_addr, int pool_prefix, int max_entries, uint32_t ttl,
+                  FakeDns_handler_send handler_send, void *user) WARN_UNUSED;
+
+/**
+ * Frees the responder.
+ * 
+ * @param o the object
+ */
+void FakeDns_Free (FakeDns *o);
+
+/**
+ * Submits a query from a client.
+ * 
+ * @param o the object
+ * @param local_addr address identifying the client
+ * @param remote_addr address of the resolver
+ * @param data query message
+ * @param data_len length of query. Must be >=0.
+ * @return 1 if the query was answered and must not be forwarded, 0 if it must be forwarded
+ */
+int FakeDns_SubmitQuery (FakeDns *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+/**
+ * Checks whether an address belongs to the pool.
+ * 
+ * @param o the object
+ * @param addr IPv4 address in network byte order
+ * @return 1 if the address is in the pool, 0 if not
+ */
+int FakeDns_IsFakeAddr (FakeDns *o, uint32_t addr);
+
+/**
+ * Looks up the name an address from the pool was given to.
+ * 
+ * The mapping becomes the most recently used one.
+ * 
+ * @param o the object
+ * @param addr IPv4 address in network byte order
+ * @param out_name on success, receives a pointer to the name, without the trailing dot
+ *                 and not null-terminated. It is valid until the next call to
+ *                 {@link FakeDns_SubmitQuery} or {@link FakeDns_Free}.
+ * @param out_name_len on success, receives the length of the name
+ * @return 1 if the address is mapped, 0 if not
+ */
+int FakeDns_LookupAddr (FakeDns *o, uint32_t addr, const char **out_name, int *out_name_len);
+
+#endif
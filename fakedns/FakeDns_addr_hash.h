@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME FakeDnsAddrHash
+#define CHASH_PARAM_ENTRY struct FakeDns_entry
+#define CHASH_PARAM_LINK FakeDnsAddrHash_link
+#define CHASH_PARAM_KEY FakeDnsAddrHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((FakeDnsAddrHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) badvpn_hash_4((const uint8_t *)&(entry).ptr->addr, badvpn_hash_seed())
+#define CHASH_PARAM_KEYHASH(arg, key) badvpn_hash_4((const uint8_t *)&(key), badvpn_hash_seed())
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->addr == (entry2).ptr->addr)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->addr)
+#define CHASH_PARAM_ENTRY_NEXT addr_hash_next
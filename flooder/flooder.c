@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <inttypes.h>
 
 #include <protocol/addr.h>
 #include <protocol/scproto.h>
@@ -40,16 +42,23 @@
 #include <misc/byteorder.h>
 #include <misc/loggers_string.h>
 #include <misc/open_standard_streams.h>
+#include <misc/balloc.h>
+#include <misc/compare.h>
+#include <misc/offset.h>
+#include <structure/LinkedList1.h>
+#include <structure/SAvl.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
 #include <system/BNetwork.h>
+#include <system/BTime.h>
 #include <flow/SinglePacketBuffer.h>
 #include <flow/PacketProtoEncoder.h>
 #include <nspr_support/BSSLConnection.h>
 #include <server_connection/ServerConnection.h>
 
 #ifndef BADVPN_USE_WINAPI
+#include <system/BReactorGroup.h>
 #include <base/BLog_syslog.h>
 #endif
 
@@ -78,8 +87,103 @@ struct {
     char *server_addr;
     peerid_t floods[MAX_FLOODS];
     int num_floods;
+    int flood_announced;
+    int num_peers;
+    int threads;
+    struct {
+        int size;
+        int weight;
+    } packet_sizes[MAX_PACKET_SIZES];
+    int num_packet_sizes;
+    int rate;
+    int duration;
+    int report_interval;
 } options;
 
+// counters of a worker, or their sum over all workers
+struct flood_stats {
+    uint64_t sent_packets;
+    uint64_t sent_bytes;
+    uint64_t recv_packets;
+    uint64_t recv_bytes;
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t invalid;
+    uint64_t latency[LATENCY_NUM_BUCKETS];
+};
+
+#include "flooder_remotes_tree.h"
+#include <structure/SAvl_decl.h>
+
+// another peer known to a simulated peer
+struct remote {
+    peerid_t id;
+    int is_static;
+    int is_dest;
+    uint64_t tx_seq;
+    int rx_started;
+    uint64_t rx_next;
+    RemotesTreeNode tree_node;
+    LinkedList1Node dests_node;
+};
+
+struct worker;
+
+// simulated peer, a client of the server
+struct peer {
+    struct worker *w;
+    int index;
+    int alive;
+    ServerConnection server;
+    int server_ready;
+    peerid_t my_id;
+    PacketRecvInterface source;
+    PacketProtoEncoder encoder;
+    SinglePacketBuffer buffer;
+    uint8_t *source_data;
+    RemotesTree remotes;
+    LinkedList1 dests;
+    LinkedList1Node *next_dest;
+    int64_t pace_start;
+    uint64_t paced_packets;
+};
+
+// message between the main thread and a worker
+struct message {
+    struct worker *w;
+    void (*handler) (struct worker *w);
+    #ifndef BADVPN_USE_WINAPI
+    BReactorGroupMessage gmsg;
+    #else
+    BPending job;
+    #endif
+};
+
+// group of simulated peers running in one reactor
+struct worker {
+    int index;
+    BReactor *reactor;
+    #ifndef BADVPN_USE_WINAPI
+    BReactorGroupMember *member;
+    #endif
+    struct peer *peers;
+    int num_peers;
+    uint64_t rng;
+    BTimer pacing_timer;
+    int failure_reported;
+    struct flood_stats stats; // used in the worker's thread
+    struct flood_stats snapshot; // copy of stats for the main thread, written before replying
+    struct message start_msg;
+    struct message stop_msg;
+    struct message stopped_msg;
+    struct message report_msg;
+    struct message report_reply_msg;
+    struct message failed_msg;
+};
+
+#include "flooder_remotes_tree.h"
+#include <structure/SAvl_impl.h>
+
 // server address we connect to
 BAddr server_addr;
 
@@ -89,31 +193,43 @@ char server_name[256];
 // reactor
 BReactor ss;
 
+#ifndef BADVPN_USE_WINAPI
+// reactors of the workers; the first member is ss
+BReactorGroup group;
+#endif
+
 // client certificate if using SSL
 CERTCertificate *client_cert;
 
 // client private key if using SSL
 SECKEYPrivateKey *client_key;
 
-// server connection
-ServerConnection server;
+// total weight of the packet size distribution
+int packet_sizes_weight;
+
+// workers
+struct worker *workers;
+int num_workers;
 
-// whether server is ready
-int server_ready;
+// number of workers which have not stopped yet
+int num_running_workers;
 
-// my ID, defined only after server_ready
-peerid_t my_id;
+// whether we are stopping the workers
+int stopping;
 
-// flooding output
-PacketRecvInterface flood_source;
-PacketProtoEncoder flood_encoder;
-SinglePacketBuffer flood_buffer;
+// number of workers we are waiting for a report from
+int reports_pending;
 
-// whether we were asked for a packet and blocked
-int flood_blocking;
+// timers for progress reports and the end of the test
+BTimer report_timer;
+BTimer duration_timer;
 
-// index of next peer to send packet too
-int flood_next;
+// time the test started and the time of the last report, in microseconds
+int64_t start_time;
+int64_t last_report_time;
+
+// counters at the last report
+struct flood_stats last_report_stats;
 
 /**
  * Cleans up everything that can be cleaned up from inside the event loop.
@@ -149,30 +265,69 @@ static int resolve_arguments (void);
  */
 static void signal_handler (void *unused);
 
-static void server_handler_error (void *user);
-static void server_handler_ready (void *user, peerid_t param_my_id, uint32_t ext_ip);
-static void server_handler_newclient (void *user, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len);
-static void server_handler_endclient (void *user, peerid_t peer_id);
-static void server_handler_message (void *user, peerid_t peer_id, uint8_t *data, int data_len);
+static int init_workers (void);
+static void free_workers (void);
+static void message_init (struct message *m, struct worker *w, void (*handler) (struct worker *w));
+static void message_free (struct message *m);
+static void message_post (struct message *m, int to_main);
+#ifndef BADVPN_USE_WINAPI
+static void message_group_handler (BReactorGroupMessage *gmsg);
+#else
+static void message_job_handler (struct message *m);
+#endif
+static void report_timer_handler (void *unused);
+static void duration_timer_handler (void *unused);
+static void post_stops (void);
+static void sum_snapshots (struct flood_stats *out);
+static void print_report (const char *name, const struct flood_stats *cur, const struct flood_stats *prev, int64_t interval);
+static uint64_t latency_percentile (const uint64_t *hist, uint64_t count, double fraction);
+static int latency_bucket (int64_t latency);
+static uint64_t latency_bucket_value (int bucket);
+
+// handlers in the main thread
+static void main_report_reply_handler (struct worker *w);
+static void main_stopped_handler (struct worker *w);
+static void main_failed_handler (struct worker *w);
+
+// handlers in the worker's thread
+static void worker_start_handler (struct worker *w);
+static void worker_stop_handler (struct worker *w);
+static void worker_report_handler (struct worker *w);
+static void worker_report_failure (struct worker *w);
+static void worker_pacing_timer_handler (struct worker *w);
+static int worker_pick_packet_size (struct worker *w);
 
-static void flood_source_handler_recv (void *user, uint8_t *data);
+static void peer_start (struct peer *p);
+static void peer_free (struct peer *p);
+static struct remote * peer_get_remote (struct peer *p, peerid_t id);
+static void peer_remove_remote (struct peer *p, struct remote *r);
+static void peer_add_dest (struct peer *p, struct remote *r);
+static void peer_maybe_send (struct peer *p);
+
+static void server_handler_error (struct peer *p);
+static void server_handler_ready (struct peer *p, peerid_t param_my_id, uint32_t ext_ip);
+static void server_handler_newclient (struct peer *p, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len);
+static void server_handler_endclient (struct peer *p, peerid_t peer_id);
+static void server_handler_message (struct peer *p, peerid_t peer_id, uint8_t *data, int data_len);
+
+static void flood_source_handler_recv (struct peer *p, uint8_t *data);
 
 int main (int argc, char *argv[])
 {
     if (argc <= 0) {
         return 1;
     }
-    
+
     // open standard streams
     open_standard_streams();
-    
+
     // parse command-line arguments
     if (!parse_arguments(argc, argv)) {
         fprintf(stderr, "Failed to parse arguments\n");
         print_help(argv[0]);
         goto fail0;
     }
-    
+
     // handle --help and --version
     if (options.help) {
         print_version();
@@ -183,7 +338,7 @@ int main (int argc, char *argv[])
         print_version();
         return 0;
     }
-    
+
     // initialize logger
     switch (options.logger) {
         case LOGGER_STDOUT:
@@ -200,7 +355,7 @@ int main (int argc, char *argv[])
         default:
             ASSERT(0);
     }
-    
+
     // configure logger channels
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         if (options.loglevels[i] >= 0) {
@@ -210,96 +365,118 @@ int main (int argc, char *argv[])
             BLog_SetChannelLoglevel(i, options.loglevel);
         }
     }
-    
+
     BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
-    
+
     // initialize network
     if (!BNetwork_GlobalInit()) {
         BLog(BLOG_ERROR, "BNetwork_GlobalInit failed");
         goto fail1;
     }
-    
+
     // init time
     BTime_Init();
-    
+
     // resolve addresses
     if (!resolve_arguments()) {
         BLog(BLOG_ERROR, "Failed to resolve arguments");
         goto fail1;
     }
-    
+
     // init reactor
     if (!BReactor_Init(&ss)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
-    
+
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
         goto fail1a;
     }
-    
+
     if (options.ssl) {
         // init NSPR
         PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
-        
+
         // register local NSPR file types
         if (!BSSLConnection_GlobalInit()) {
             BLog(BLOG_ERROR, "BSSLConnection_GlobalInit failed");
             goto fail3;
         }
-        
+
         // init NSS
         if (NSS_Init(options.nssdb) != SECSuccess) {
             BLog(BLOG_ERROR, "NSS_Init failed (%d)", (int)PR_GetError());
             goto fail2;
         }
-        
+
         // set cipher policy
         if (NSS_SetDomesticPolicy() != SECSuccess) {
             BLog(BLOG_ERROR, "NSS_SetDomesticPolicy failed (%d)", (int)PR_GetError());
             goto fail3;
         }
-        
+
         // init server cache
         if (SSL_ConfigServerSessionIDCache(0, 0, 0, NULL) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_ConfigServerSessionIDCache failed (%d)", (int)PR_GetError());
             goto fail3;
         }
-        
+
         // open server certificate and private key
         if (!open_nss_cert_and_key(options.client_cert_name, &client_cert, &client_key)) {
             BLog(BLOG_ERROR, "Cannot open certificate and key");
             goto fail4;
         }
     }
-    
-    // start connecting to server
-    if (!ServerConnection_Init(
-        &server, &ss, NULL, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, 0, client_cert, client_key, server_name, NULL,
-        server_handler_error, server_handler_ready, server_handler_newclient, server_handler_endclient, server_handler_message
-    )) {
-        BLog(BLOG_ERROR, "ServerConnection_Init failed");
+
+    #ifndef BADVPN_USE_WINAPI
+    // start worker threads; after BSignal_Init so they inherit the blocked signals
+    if (!BReactorGroup_Init(&group, &ss, 1 + options.threads, NULL, 0)) {
+        BLog(BLOG_ERROR, "BReactorGroup_Init failed");
         goto fail5;
     }
-    
-    // set server not ready
-    server_ready = 0;
-    
+    #endif
+
+    // init workers
+    if (!init_workers()) {
+        goto fail6;
+    }
+
+    // start workers
+    num_running_workers = num_workers;
+    stopping = 0;
+    reports_pending = 0;
+    for (int i = 0; i < num_workers; i++) {
+        message_post(&workers[i].start_msg, 0);
+    }
+
+    // start timers
+    start_time = btime_gettime_us();
+    last_report_time = start_time;
+    memset(&last_report_stats, 0, sizeof(last_report_stats));
+    BTimer_Init(&report_timer, options.report_interval, report_timer_handler, NULL);
+    if (options.report_interval > 0) {
+        BReactor_SetTimer(&ss, &report_timer);
+    }
+    BTimer_Init(&duration_timer, (btime_t)options.duration * 1000, duration_timer_handler, NULL);
+    if (options.duration > 0) {
+        BReactor_SetTimer(&ss, &duration_timer);
+    }
+
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
-    
-    if (server_ready) {
-        ServerConnection_ReleaseBuffers(&server);
-        SinglePacketBuffer_Free(&flood_buffer);
-        PacketProtoEncoder_Free(&flood_encoder);
-        PacketRecvInterface_Free(&flood_source);
-    }
-    
-    ServerConnection_Free(&server);
+
+    BReactor_RemoveTimer(&ss, &duration_timer);
+    BReactor_RemoveTimer(&ss, &report_timer);
+
+    free_workers();
+fail6:
+    #ifndef BADVPN_USE_WINAPI
+    BReactorGroup_Free(&group);
 fail5:
+    #endif
     if (options.ssl) {
         CERT_DestroyCertificate(client_cert);
         SECKEY_DestroyPrivateKey(client_key);
@@ -312,7 +489,7 @@ fail2:
         ASSERT_FORCE(PR_Cleanup() == PR_SUCCESS)
         PL_ArenaFinish();
     }
-    
+
     BSignal_Finish();
 fail1a:
     BReactor_Free(&ss);
@@ -321,16 +498,24 @@ fail1:
     BLog_Free();
 fail0:
     DebugObjectGlobal_Finish();
-    
+
     return 1;
 }
 
 void terminate (void)
 {
+    if (stopping) {
+        return;
+    }
+
     BLog(BLOG_NOTICE, "tearing down");
-    
-    // exit event loop
-    BReactor_Quit(&ss, 0);
+
+    // stop the workers; their replies end the event loop. If a report is
+    // being collected, wait for it, since the workers overwrite their snapshots.
+    stopping = 1;
+    if (reports_pending == 0) {
+        post_stops();
+    }
 }
 
 void print_help (const char *name)
@@ -353,6 +538,15 @@ void print_help (const char *name)
         "        [--server-name <string>]\n"
         "        --server-addr <addr>\n"
         "        [--flood-id <id>] ...\n"
+        "        [--flood-announced]\n"
+        "        [--peers <number>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--threads <number / 0>]\n"
+        #endif
+        "        [--packet-size <bytes>[:<weight>]] ...\n"
+        "        [--rate <packets-per-second / 0>]\n"
+        "        [--duration <seconds / 0>]\n"
+        "        [--report-interval <ms / 0>]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -368,7 +562,7 @@ int parse_arguments (int argc, char *argv[])
     if (argc <= 0) {
         return 0;
     }
-    
+
     options.help = 0;
     options.version = 0;
     options.logger = LOGGER_STDOUT;
@@ -386,7 +580,14 @@ int parse_arguments (int argc, char *argv[])
     options.server_name = NULL;
     options.server_addr = NULL;
     options.num_floods = 0;
-    
+    options.flood_announced = 0;
+    options.num_peers = 1;
+    options.threads = 0;
+    options.num_packet_sizes = 0;
+    options.rate = 0;
+    options.duration = 0;
+    options.report_interval = DEFAULT_REPORT_INTERVAL;
+
     int i;
     for (i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -511,31 +712,120 @@ int parse_arguments (int argc, char *argv[])
             options.num_floods++;
             i++;
         }
+        else if (!strcmp(arg, "--flood-announced")) {
+            options.flood_announced = 1;
+        }
+        else if (!strcmp(arg, "--peers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.num_peers = atoi(argv[i + 1])) <= 0 || options.num_peers > MAX_PEERS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.threads = atoi(argv[i + 1])) < 0 || options.threads > MAX_THREADS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--packet-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_packet_sizes == MAX_PACKET_SIZES) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            char *arg2 = argv[i + 1];
+            char *colon = strchr(arg2, ':');
+            int size = atoi(arg2);
+            int weight = (colon ? atoi(colon + 1) : 1);
+            if (size < FLOOD_HEADER_SIZE || size > SC_MAX_MSGLEN || weight <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.packet_sizes[options.num_packet_sizes].size = size;
+            options.packet_sizes[options.num_packet_sizes].weight = weight;
+            options.num_packet_sizes++;
+            i++;
+        }
+        else if (!strcmp(arg, "--rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.rate = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--duration")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.duration = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--report-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.report_interval = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
         }
     }
-    
+
     if (options.help || options.version) {
         return 1;
     }
-    
+
     if (options.ssl != !!options.nssdb) {
         fprintf(stderr, "False: --ssl <=> --nssdb\n");
         return 0;
     }
-    
+
     if (options.ssl != !!options.client_cert_name) {
         fprintf(stderr, "False: --ssl <=> --client-cert-name\n");
         return 0;
     }
-    
+
     if (!options.server_addr) {
         fprintf(stderr, "False: --server-addr\n");
         return 0;
     }
-    
+
+    // by default, send packets of the maximum size
+    if (options.num_packet_sizes == 0) {
+        options.packet_sizes[0].size = SC_MAX_MSGLEN;
+        options.packet_sizes[0].weight = 1;
+        options.num_packet_sizes = 1;
+    }
+
     return 1;
 }
 
@@ -551,7 +841,7 @@ int resolve_arguments (void)
         BLog(BLOG_ERROR, "server addr: not supported");
         return 0;
     }
-    
+
     // override server name if requested
     if (options.server_name) {
         if (strlen(options.server_name) >= sizeof(server_name)) {
@@ -560,112 +850,740 @@ int resolve_arguments (void)
         }
         strcpy(server_name, options.server_name);
     }
-    
+
+    // sum weights of packet sizes
+    packet_sizes_weight = 0;
+    for (int i = 0; i < options.num_packet_sizes; i++) {
+        if (options.packet_sizes[i].weight > INT_MAX - packet_sizes_weight) {
+            BLog(BLOG_ERROR, "packet size: weights too large");
+            return 0;
+        }
+        packet_sizes_weight += options.packet_sizes[i].weight;
+    }
+
     return 1;
 }
 
 void signal_handler (void *unused)
 {
     BLog(BLOG_NOTICE, "termination requested");
-    
+
     terminate();
 }
 
-void server_handler_error (void *user)
+int init_workers (void)
+{
+    // without threads, a single worker runs in the main reactor
+    num_workers = (options.threads > 0 ? options.threads : 1);
+
+    if (!(workers = (struct worker *)BAllocArray(num_workers, sizeof(workers[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+
+    int i;
+    for (i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+        w->index = i;
+
+        #ifndef BADVPN_USE_WINAPI
+        w->member = BReactorGroup_GetMember(&group, (options.threads > 0 ? 1 + i : 0));
+        w->reactor = BReactorGroupMember_Reactor(w->member);
+        #else
+        w->reactor = &ss;
+        #endif
+
+        // peers are distributed round-robin
+        w->num_peers = (options.num_peers - i + num_workers - 1) / num_workers;
+        if (!(w->peers = (struct peer *)BAllocArray(w->num_peers, sizeof(w->peers[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail1;
+        }
+        for (int j = 0; j < w->num_peers; j++) {
+            w->peers[j].w = w;
+            w->peers[j].index = i + j * num_workers;
+            w->peers[j].alive = 0;
+        }
+
+        w->rng = ((uint64_t)btime_gettime_us() ^ ((uint64_t)(i + 1) * UINT64_C(0x9E3779B97F4A7C15))) | 1;
+        w->failure_reported = 0;
+        memset(&w->stats, 0, sizeof(w->stats));
+        memset(&w->snapshot, 0, sizeof(w->snapshot));
+
+        message_init(&w->start_msg, w, worker_start_handler);
+        message_init(&w->stop_msg, w, worker_stop_handler);
+        message_init(&w->stopped_msg, w, main_stopped_handler);
+        message_init(&w->report_msg, w, worker_report_handler);
+        message_init(&w->report_reply_msg, w, main_report_reply_handler);
+        message_init(&w->failed_msg, w, main_failed_handler);
+    }
+
+    return 1;
+
+fail1:
+    while (i-- > 0) {
+        BFree(workers[i].peers);
+    }
+    BFree(workers);
+fail0:
+    return 0;
+}
+
+void free_workers (void)
+{
+    for (int i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+        message_free(&w->failed_msg);
+        message_free(&w->report_reply_msg);
+        message_free(&w->report_msg);
+        message_free(&w->stopped_msg);
+        message_free(&w->stop_msg);
+        message_free(&w->start_msg);
+        BFree(w->peers);
+    }
+    BFree(workers);
+}
+
+void message_init (struct message *m, struct worker *w, void (*handler) (struct worker *w))
+{
+    m->w = w;
+    m->handler = handler;
+    #ifdef BADVPN_USE_WINAPI
+    BPending_Init(&m->job, BReactor_PendingGroup(&ss), (BPending_handler)message_job_handler, m);
+    #endif
+}
+
+void message_free (struct message *m)
+{
+    #ifdef BADVPN_USE_WINAPI
+    BPending_Free(&m->job);
+    #endif
+}
+
+void message_post (struct message *m, int to_main)
+{
+    #ifndef BADVPN_USE_WINAPI
+    BReactorGroupMember *member = (to_main ? BReactorGroup_GetMember(&group, 0) : m->w->member);
+    BReactorGroupMember_Post(member, &m->gmsg, message_group_handler);
+    #else
+    BPending_Set(&m->job);
+    #endif
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void message_group_handler (BReactorGroupMessage *gmsg)
+{
+    struct message *m = UPPER_OBJECT(gmsg, struct message, gmsg);
+
+    m->handler(m->w);
+}
+
+#else
+
+void message_job_handler (struct message *m)
+{
+    m->handler(m->w);
+}
+
+#endif
+
+void report_timer_handler (void *unused)
+{
+    BReactor_SetTimer(&ss, &report_timer);
+
+    // collect snapshots unless the previous collection is still going on
+    if (stopping || reports_pending > 0) {
+        return;
+    }
+
+    reports_pending = num_workers;
+    for (int i = 0; i < num_workers; i++) {
+        message_post(&workers[i].report_msg, 0);
+    }
+}
+
+void duration_timer_handler (void *unused)
+{
+    BLog(BLOG_NOTICE, "test duration elapsed");
+
+    terminate();
+}
+
+void post_stops (void)
+{
+    ASSERT(stopping)
+    ASSERT(reports_pending == 0)
+
+    for (int i = 0; i < num_workers; i++) {
+        message_post(&workers[i].stop_msg, 0);
+    }
+}
+
+void sum_snapshots (struct flood_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    for (int i = 0; i < num_workers; i++) {
+        struct flood_stats *s = &workers[i].snapshot;
+        out->sent_packets += s->sent_packets;
+        out->sent_bytes += s->sent_bytes;
+        out->recv_packets += s->recv_packets;
+        out->recv_bytes += s->recv_bytes;
+        out->lost += s->lost;
+        out->reordered += s->reordered;
+        out->invalid += s->invalid;
+        for (int j = 0; j < LATENCY_NUM_BUCKETS; j++) {
+            out->latency[j] += s->latency[j];
+        }
+    }
+}
+
+void print_report (const char *name, const struct flood_stats *cur, const struct flood_stats *prev, int64_t interval)
+{
+    double secs = (interval > 0 ? interval / 1000000.0 : 1.0);
+
+    uint64_t sent = cur->sent_packets - prev->sent_packets;
+    uint64_t sent_bytes = cur->sent_bytes - prev->sent_bytes;
+    uint64_t recv = cur->recv_packets - prev->recv_packets;
+    uint64_t recv_bytes = cur->recv_bytes - prev->recv_bytes;
+    int64_t lost = (int64_t)(cur->lost - prev->lost);
+    uint64_t reordered = cur->reordered - prev->reordered;
+    uint64_t invalid = cur->invalid - prev->invalid;
+
+    // loss relative to the packets which were sent to us
+    double loss_percent = (recv + lost > 0 ? 100.0 * lost / (double)((int64_t)recv + lost) : 0.0);
+
+    BLog(BLOG_NOTICE, "%s (%.3f s): sent %"PRIu64" (%.0f/s, %.2f Mbit/s), received %"PRIu64" (%.0f/s, %.2f Mbit/s), lost %"PRId64" (%.3f%%), reordered %"PRIu64", invalid %"PRIu64,
+         name, secs, sent, sent / secs, sent_bytes * 8 / secs / 1000000.0, recv, recv / secs, recv_bytes * 8 / secs / 1000000.0, lost, loss_percent, reordered, invalid);
+
+    if (recv == 0) {
+        return;
+    }
+
+    uint64_t hist[LATENCY_NUM_BUCKETS];
+    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        hist[i] = cur->latency[i] - prev->latency[i];
+    }
+
+    BLog(BLOG_NOTICE, "%s latency (us): p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64" p99.9 %"PRIu64" max %"PRIu64,
+         name, latency_percentile(hist, recv, 0.5), latency_percentile(hist, recv, 0.9), latency_percentile(hist, recv, 0.99),
+         latency_percentile(hist, recv, 0.999), latency_percentile(hist, recv, 1.0));
+}
+
+uint64_t latency_percentile (const uint64_t *hist, uint64_t count, double fraction)
+{
+    ASSERT(count > 0)
+
+    uint64_t target = (uint64_t)(fraction * count);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum >= target) {
+            return latency_bucket_value(i);
+        }
+    }
+
+    return latency_bucket_value(LATENCY_NUM_BUCKETS - 1);
+}
+
+int latency_bucket (int64_t latency)
+{
+    // latencies below zero come from clocks which are not in sync
+    if (latency < 0) {
+        latency = 0;
+    }
+
+    uint64_t v = latency;
+    if (v < (1 << LATENCY_SUB_BITS)) {
+        return v;
+    }
+
+    int log = LATENCY_SUB_BITS;
+    while (log < LATENCY_MAX_LOG && (v >> (log + 1)) > 0) {
+        log++;
+    }
+    if ((v >> (log + 1)) > 0) {
+        return LATENCY_NUM_BUCKETS - 1;
+    }
+
+    int sub = (v >> (log - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+    return ((log - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub;
+}
+
+uint64_t latency_bucket_value (int bucket)
+{
+    // lower bound of the bucket
+    if (bucket < (1 << LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+
+    int log = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << LATENCY_SUB_BITS) - 1);
+    return (((uint64_t)1 << LATENCY_SUB_BITS) + sub) << (log - LATENCY_SUB_BITS);
+}
+
+void main_report_reply_handler (struct worker *w)
+{
+    ASSERT(reports_pending > 0)
+
+    reports_pending--;
+    if (reports_pending > 0) {
+        return;
+    }
+
+    // all workers replied, report the interval
+    struct flood_stats cur;
+    sum_snapshots(&cur);
+    int64_t now = btime_gettime_us();
+    print_report("interval", &cur, &last_report_stats, now - last_report_time);
+    last_report_stats = cur;
+    last_report_time = now;
+
+    // stopping was requested while we were waiting
+    if (stopping) {
+        post_stops();
+    }
+}
+
+void main_stopped_handler (struct worker *w)
+{
+    ASSERT(stopping)
+    ASSERT(num_running_workers > 0)
+
+    num_running_workers--;
+    if (num_running_workers > 0) {
+        return;
+    }
+
+    // all workers stopped, report the totals
+    struct flood_stats cur;
+    struct flood_stats zero;
+    sum_snapshots(&cur);
+    memset(&zero, 0, sizeof(zero));
+    print_report("total", &cur, &zero, btime_gettime_us() - start_time);
+
+    // exit event loop
+    BReactor_Quit(&ss, 0);
+}
+
+void main_failed_handler (struct worker *w)
 {
-    BLog(BLOG_ERROR, "server connection failed, exiting");
-    
+    BLog(BLOG_ERROR, "a peer of worker %d failed, exiting", w->index);
+
     terminate();
 }
 
-void server_handler_ready (void *user, peerid_t param_my_id, uint32_t ext_ip)
+void worker_start_handler (struct worker *w)
+{
+    BTimer_Init(&w->pacing_timer, PACING_INTERVAL, (BTimer_handler)worker_pacing_timer_handler, w);
+    if (options.rate > 0) {
+        BReactor_SetTimer(w->reactor, &w->pacing_timer);
+    }
+
+    for (int i = 0; i < w->num_peers; i++) {
+        peer_start(&w->peers[i]);
+    }
+}
+
+void worker_stop_handler (struct worker *w)
+{
+    BReactor_RemoveTimer(w->reactor, &w->pacing_timer);
+
+    for (int i = 0; i < w->num_peers; i++) {
+        peer_free(&w->peers[i]);
+    }
+
+    w->snapshot = w->stats;
+    message_post(&w->stopped_msg, 1);
+}
+
+void worker_report_handler (struct worker *w)
+{
+    w->snapshot = w->stats;
+    message_post(&w->report_reply_msg, 1);
+}
+
+void worker_report_failure (struct worker *w)
+{
+    if (w->failure_reported) {
+        return;
+    }
+
+    w->failure_reported = 1;
+    message_post(&w->failed_msg, 1);
+}
+
+void worker_pacing_timer_handler (struct worker *w)
+{
+    BReactor_SetTimer(w->reactor, &w->pacing_timer);
+
+    for (int i = 0; i < w->num_peers; i++) {
+        struct peer *p = &w->peers[i];
+        if (p->alive && p->server_ready) {
+            peer_maybe_send(p);
+        }
+    }
+}
+
+int worker_pick_packet_size (struct worker *w)
+{
+    if (options.num_packet_sizes == 1) {
+        return options.packet_sizes[0].size;
+    }
+
+    // xorshift64*
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    uint64_t r = (w->rng * UINT64_C(2685821657736338717)) % packet_sizes_weight;
+
+    int i = 0;
+    while (r >= (uint64_t)options.packet_sizes[i].weight) {
+        r -= options.packet_sizes[i].weight;
+        i++;
+    }
+
+    return options.packet_sizes[i].size;
+}
+
+void peer_start (struct peer *p)
+{
+    ASSERT(!p->alive)
+
+    // init remotes
+    RemotesTree_Init(&p->remotes);
+    LinkedList1_Init(&p->dests);
+    p->next_dest = NULL;
+
+    // start connecting to server
+    if (!ServerConnection_Init(
+        &p->server, p->w->reactor, NULL, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, 0, client_cert, client_key, server_name, p,
+        (ServerConnection_handler_error)server_handler_error, (ServerConnection_handler_ready)server_handler_ready,
+        (ServerConnection_handler_newclient)server_handler_newclient, (ServerConnection_handler_endclient)server_handler_endclient,
+        (ServerConnection_handler_message)server_handler_message
+    )) {
+        BLog(BLOG_ERROR, "peer %d: ServerConnection_Init failed", p->index);
+        worker_report_failure(p->w);
+        return;
+    }
+
+    // set server not ready
+    p->server_ready = 0;
+
+    p->alive = 1;
+}
+
+void peer_free (struct peer *p)
+{
+    if (!p->alive) {
+        return;
+    }
+
+    if (p->server_ready) {
+        ServerConnection_ReleaseBuffers(&p->server);
+        SinglePacketBuffer_Free(&p->buffer);
+        PacketProtoEncoder_Free(&p->encoder);
+        PacketRecvInterface_Free(&p->source);
+    }
+
+    ServerConnection_Free(&p->server);
+
+    // free remotes
+    struct remote *r;
+    while (r = RemotesTree_GetFirst(&p->remotes, 0)) {
+        peer_remove_remote(p, r);
+    }
+
+    p->alive = 0;
+}
+
+struct remote * peer_get_remote (struct peer *p, peerid_t id)
+{
+    struct remote *r = RemotesTree_LookupExact(&p->remotes, 0, id);
+    if (r) {
+        return r;
+    }
+
+    if (!(r = (struct remote *)malloc(sizeof(*r)))) {
+        BLog(BLOG_ERROR, "peer %d: failed to allocate remote", p->index);
+        return NULL;
+    }
+
+    r->id = id;
+    r->is_static = 0;
+    r->is_dest = 0;
+    r->tx_seq = 0;
+    r->rx_started = 0;
+    r->rx_next = 0;
+    ASSERT_EXECUTE(RemotesTree_Insert(&p->remotes, 0, r, NULL))
+
+    return r;
+}
+
+void peer_remove_remote (struct peer *p, struct remote *r)
+{
+    if (r->is_dest) {
+        if (p->next_dest == &r->dests_node) {
+            p->next_dest = LinkedList1Node_Next(&r->dests_node);
+        }
+        LinkedList1_Remove(&p->dests, &r->dests_node);
+        if (!p->next_dest) {
+            p->next_dest = LinkedList1_GetFirst(&p->dests);
+        }
+    }
+
+    RemotesTree_Remove(&p->remotes, 0, r);
+    free(r);
+}
+
+void peer_add_dest (struct peer *p, struct remote *r)
+{
+    if (r->is_dest) {
+        return;
+    }
+
+    r->is_dest = 1;
+    LinkedList1_Append(&p->dests, &r->dests_node);
+    if (!p->next_dest) {
+        p->next_dest = &r->dests_node;
+    }
+
+    // we may have been waiting for a destination
+    peer_maybe_send(p);
+}
+
+void peer_maybe_send (struct peer *p)
 {
-    ASSERT(!server_ready)
-    
+    ASSERT(p->alive)
+    ASSERT(p->server_ready)
+
+    // wait until the buffer asks for a packet and we have someone to send it to
+    if (!p->source_data || !p->next_dest) {
+        return;
+    }
+
+    int64_t timestamp;
+
+    if (options.rate > 0) {
+        // open loop: packet k is due at pace_start + k / rate, whether or not
+        // earlier packets could be sent in time
+        int64_t now = btime_gettime_us();
+        uint64_t due = (uint64_t)(now - p->pace_start) * options.rate / 1000000;
+        if (p->paced_packets >= due) {
+            return;
+        }
+
+        // stamp with the time the packet was due, so that queueing in front
+        // of the server connection counts as latency
+        timestamp = p->pace_start + (int64_t)(p->paced_packets * 1000000 / options.rate);
+        p->paced_packets++;
+    } else {
+        timestamp = btime_gettime_us();
+    }
+
+    // pick destination, round-robin
+    struct remote *r = UPPER_OBJECT(p->next_dest, struct remote, dests_node);
+    p->next_dest = LinkedList1Node_Next(p->next_dest);
+    if (!p->next_dest) {
+        p->next_dest = LinkedList1_GetFirst(&p->dests);
+    }
+
+    int size = worker_pick_packet_size(p->w);
+    ASSERT(size >= FLOOD_HEADER_SIZE)
+    ASSERT(size <= SC_MAX_MSGLEN)
+
+    uint8_t *data = p->source_data;
+    p->source_data = NULL;
+
+    struct sc_header header;
+    header.type = SCID_OUTMSG;
+    memcpy(data, &header, sizeof(header));
+
+    struct sc_client_outmsg omsg;
+    omsg.clientid = htol16(r->id);
+    memcpy(data + sizeof(header), &omsg, sizeof(omsg));
+
+    // write magic, sequence number and timestamp, zero the rest
+    uint8_t *payload = data + sizeof(header) + sizeof(omsg);
+    uint32_t magic = htol32(FLOOD_MAGIC);
+    uint64_t seq = htol64(r->tx_seq);
+    uint64_t ts = htol64((uint64_t)timestamp);
+    memcpy(payload, &magic, 4);
+    memcpy(payload + 4, &seq, 8);
+    memcpy(payload + 12, &ts, 8);
+    memset(payload + FLOOD_HEADER_SIZE, 0, size - FLOOD_HEADER_SIZE);
+    r->tx_seq++;
+
+    p->w->stats.sent_packets++;
+    p->w->stats.sent_bytes += size;
+
+    PacketRecvInterface_Done(&p->source, sizeof(header) + sizeof(omsg) + size);
+}
+
+void server_handler_error (struct peer *p)
+{
+    ASSERT(p->alive)
+
+    BLog(BLOG_ERROR, "peer %d: server connection failed", p->index);
+
+    // the server connection must be freed right away
+    peer_free(p);
+
+    worker_report_failure(p->w);
+}
+
+void server_handler_ready (struct peer *p, peerid_t param_my_id, uint32_t ext_ip)
+{
+    ASSERT(p->alive)
+    ASSERT(!p->server_ready)
+
     // remember our ID
-    my_id = param_my_id;
-    
+    p->my_id = param_my_id;
+
     // init flooding
-    
+
     // init source
-    PacketRecvInterface_Init(&flood_source, SC_MAX_ENC, flood_source_handler_recv, NULL, BReactor_PendingGroup(&ss));
-    
+    PacketRecvInterface_Init(&p->source, SC_MAX_ENC, (PacketRecvInterface_handler_recv)flood_source_handler_recv, p, BReactor_PendingGroup(p->w->reactor));
+
     // init encoder
-    PacketProtoEncoder_Init(&flood_encoder, &flood_source, BReactor_PendingGroup(&ss));
-    
+    PacketProtoEncoder_Init(&p->encoder, &p->source, BReactor_PendingGroup(p->w->reactor));
+
     // init buffer
-    if (!SinglePacketBuffer_Init(&flood_buffer, PacketProtoEncoder_GetOutput(&flood_encoder), ServerConnection_GetSendInterface(&server), BReactor_PendingGroup(&ss))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed, exiting");
+    if (!SinglePacketBuffer_Init(&p->buffer, PacketProtoEncoder_GetOutput(&p->encoder), ServerConnection_GetSendInterface(&p->server), BReactor_PendingGroup(p->w->reactor))) {
+        BLog(BLOG_ERROR, "peer %d: SinglePacketBuffer_Init failed", p->index);
         goto fail1;
     }
-    
-    // set not blocking
-    flood_blocking = 0;
-    
+
+    // set no packet requested
+    p->source_data = NULL;
+
+    // start pacing
+    p->pace_start = btime_gettime_us();
+    p->paced_packets = 0;
+
     // set server ready
-    server_ready = 1;
-    
-    BLog(BLOG_INFO, "server: ready, my ID is %d", (int)my_id);
-    
+    p->server_ready = 1;
+
+    BLog(BLOG_INFO, "peer %d: server: ready, my ID is %d", p->index, (int)p->my_id);
+
+    // add destinations given on the command line
+    for (int i = 0; i < options.num_floods; i++) {
+        struct remote *r = peer_get_remote(p, options.floods[i]);
+        if (r) {
+            r->is_static = 1;
+            peer_add_dest(p, r);
+        }
+    }
+
     return;
-    
+
 fail1:
-    PacketProtoEncoder_Free(&flood_encoder);
-    PacketRecvInterface_Free(&flood_source);
-    terminate();
+    PacketProtoEncoder_Free(&p->encoder);
+    PacketRecvInterface_Free(&p->source);
+    worker_report_failure(p->w);
 }
 
-void server_handler_newclient (void *user, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len)
+void server_handler_newclient (struct peer *p, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len)
 {
-    ASSERT(server_ready)
-    
-    BLog(BLOG_INFO, "newclient %d", (int)peer_id);
+    ASSERT(p->alive)
+
+    BLog(BLOG_INFO, "peer %d: newclient %d", p->index, (int)peer_id);
+
+    if (!p->server_ready) {
+        return;
+    }
+
+    struct remote *r = peer_get_remote(p, peer_id);
+    if (!r) {
+        return;
+    }
+
+    // the peer starts over
+    r->tx_seq = 0;
+    r->rx_started = 0;
+
+    if (options.flood_announced) {
+        peer_add_dest(p, r);
+    }
 }
 
-void server_handler_endclient (void *user, peerid_t peer_id)
+void server_handler_endclient (struct peer *p, peerid_t peer_id)
 {
-    ASSERT(server_ready)
-    
-    BLog(BLOG_INFO, "endclient %d", (int)peer_id);
+    ASSERT(p->alive)
+
+    BLog(BLOG_INFO, "peer %d: endclient %d", p->index, (int)peer_id);
+
+    if (!p->server_ready) {
+        return;
+    }
+
+    struct remote *r = RemotesTree_LookupExact(&p->remotes, 0, peer_id);
+    if (r && !r->is_static) {
+        peer_remove_remote(p, r);
+    }
 }
 
-void server_handler_message (void *user, peerid_t peer_id, uint8_t *data, int data_len)
+void server_handler_message (struct peer *p, peerid_t peer_id, uint8_t *data, int data_len)
 {
-    ASSERT(server_ready)
+    ASSERT(p->alive)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= SC_MAX_MSGLEN)
-    
-    BLog(BLOG_INFO, "message from %d", (int)peer_id);
-}
 
-void flood_source_handler_recv (void *user, uint8_t *data)
-{
-    ASSERT(server_ready)
-    ASSERT(!flood_blocking)
-    if (options.num_floods > 0) {
-        ASSERT(flood_next >= 0)
-        ASSERT(flood_next < options.num_floods)
+    struct flood_stats *stats = &p->w->stats;
+
+    // check the packet is ours
+    uint32_t magic;
+    if (data_len < FLOOD_HEADER_SIZE || (memcpy(&magic, data, 4), ltoh32(magic) != FLOOD_MAGIC)) {
+        stats->invalid++;
+        return;
     }
-    
-    if (options.num_floods == 0) {
-        flood_blocking = 1;
+    struct remote *r = RemotesTree_LookupExact(&p->remotes, 0, peer_id);
+    if (!r) {
+        stats->invalid++;
         return;
     }
-    
-    peerid_t peer_id = options.floods[flood_next];
-    flood_next = (flood_next + 1) % options.num_floods;
-    
-    BLog(BLOG_INFO, "message to %d", (int)peer_id);
-    
-    struct sc_header header;
-    header.type = SCID_OUTMSG;
-    memcpy(data, &header, sizeof(header));
-    
-    struct sc_client_outmsg omsg;
-    omsg.clientid = htol16(peer_id);
-    memcpy(data + sizeof(header), &omsg, sizeof(omsg));
-    
-    memset(data + sizeof(struct sc_header) + sizeof(struct sc_client_outmsg), 0, SC_MAX_MSGLEN);
-    
-    PacketRecvInterface_Done(&flood_source, sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + SC_MAX_MSGLEN);
+
+    uint64_t seq;
+    uint64_t ts;
+    memcpy(&seq, data + 4, 8);
+    memcpy(&ts, data + 12, 8);
+    seq = ltoh64(seq);
+    ts = ltoh64(ts);
+
+    stats->recv_packets++;
+    stats->recv_bytes += data_len;
+
+    // a gap in sequence numbers is loss, until the missing packets show up late
+    if (!r->rx_started) {
+        r->rx_started = 1;
+        r->rx_next = seq + 1;
+    }
+    else if (seq >= r->rx_next) {
+        stats->lost += seq - r->rx_next;
+        r->rx_next = seq + 1;
+    }
+    else {
+        stats->reordered++;
+        if (stats->lost > 0) {
+            stats->lost--;
+        }
+    }
+
+    stats->latency[latency_bucket(btime_gettime_us() - (int64_t)ts)]++;
+}
+
+void flood_source_handler_recv (struct peer *p, uint8_t *data)
+{
+    ASSERT(p->alive)
+    ASSERT(p->server_ready)
+    ASSERT(!p->source_data)
+
+    // remember the packet and fill it when we can
+    p->source_data = data;
+    peer_maybe_send(p);
 }
@@ -35,3 +35,29 @@
 
 // maximum number of peers to flood
 #define MAX_FLOODS 64
+
+// maximum number of simulated peers
+#define MAX_PEERS 4096
+
+// maximum number of worker threads
+#define MAX_THREADS 63
+
+// maximum number of entries in the packet size distribution
+#define MAX_PACKET_SIZES 16
+
+// default interval of progress reports in milliseconds
+#define DEFAULT_REPORT_INTERVAL 1000
+
+// interval of the pacing timer in milliseconds, when sending at a fixed rate
+#define PACING_INTERVAL 1
+
+// magic number at the start of every flood packet
+#define FLOOD_MAGIC 0x444f4c46
+
+// size of the flood packet header: magic, sequence number and timestamp
+#define FLOOD_HEADER_SIZE 20
+
+// latency histogram: 2^LATENCY_SUB_BITS buckets for each power of two of microseconds
+#define LATENCY_SUB_BITS 3
+#define LATENCY_MAX_LOG 40
+#define LATENCY_NUM_BUCKETS ((LATENCY_MAX_LOG - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
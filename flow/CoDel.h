@@ -0,0 +1,200 @@
+/**
+ * @file CoDel.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * CoDel active queue management decisions, for use by packet buffers.
+ */
+
+#ifndef BADVPN_FLOW_CODEL_H
+#define BADVPN_FLOW_CODEL_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+/**
+ * CoDel (RFC 8289) drop state of a single queue.
+ * 
+ * The queue timestamps packets when they are enqueued, and asks
+ * {@link CoDel_ShouldDrop} about each packet it is about to dequeue.
+ * Packets are dropped once the sojourn time has stayed above the target
+ * for a whole interval, and then at a rate increasing with the square
+ * root of the number of drops until the sojourn time goes below the
+ * target again. Combined with a fair queue over per-flow buffers, this
+ * gives FQ-CoDel-like behavior.
+ * 
+ * All times are in nanoseconds.
+ */
+struct CoDel {
+    uint64_t target;
+    uint64_t interval;
+    uint64_t first_above_time;
+    uint64_t drop_next;
+    uint32_t count;
+    uint32_t lastcount;
+    int dropping;
+    uint64_t drops;
+};
+
+/**
+ * Initializes the state.
+ * 
+ * @param o the object
+ * @param target acceptable standing queue delay. Must be >0.
+ * @param interval time the delay must stay above the target before dropping
+ *                 starts; should be about a worst-case round trip time. Must be >0.
+ */
+static void CoDel_Init (struct CoDel *o, uint64_t target, uint64_t interval);
+
+/**
+ * Decides whether to drop the packet at the head of the queue.
+ * If it returns 1, the queue should drop the packet and ask again about
+ * the next one.
+ * 
+ * @param o the object
+ * @param now current time
+ * @param enqueue_time time the packet was enqueued
+ * @param last whether this is the only packet in the queue. The last packet
+ *             is never dropped, so that the output is not left idle.
+ * @return 1 to drop the packet, 0 to send it
+ */
+static int CoDel_ShouldDrop (struct CoDel *o, uint64_t now, uint64_t enqueue_time, int last);
+
+/**
+ * Returns the number of packets dropped so far.
+ * 
+ * @param o the object
+ * @return number of drops
+ */
+static uint64_t CoDel_GetDrops (struct CoDel *o);
+
+static uint32_t CoDel__isqrt (uint64_t x)
+{
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    
+    while (bit > x) {
+        bit >>= 2;
+    }
+    
+    while (bit != 0) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    
+    return r;
+}
+
+static uint64_t CoDel__control_law (struct CoDel *o, uint64_t t)
+{
+    ASSERT(o->count > 0)
+    
+    // t + interval / sqrt(count), with sqrt(count) in 1/256 units
+    return t + (o->interval << 8) / CoDel__isqrt((uint64_t)o->count << 16);
+}
+
+static int CoDel__ok_to_drop (struct CoDel *o, uint64_t now, uint64_t enqueue_time, int last)
+{
+    if (last || now - enqueue_time < o->target) {
+        o->first_above_time = 0;
+        return 0;
+    }
+    
+    if (o->first_above_time == 0) {
+        o->first_above_time = now + o->interval;
+        return 0;
+    }
+    
+    return (now >= o->first_above_time);
+}
+
+void CoDel_Init (struct CoDel *o, uint64_t target, uint64_t interval)
+{
+    ASSERT(target > 0)
+    ASSERT(interval > 0)
+    
+    o->target = target;
+    o->interval = interval;
+    o->first_above_time = 0;
+    o->drop_next = 0;
+    o->count = 0;
+    o->lastcount = 0;
+    o->dropping = 0;
+    o->drops = 0;
+}
+
+int CoDel_ShouldDrop (struct CoDel *o, uint64_t now, uint64_t enqueue_time, int last)
+{
+    ASSERT(now >= enqueue_time)
+    
+    int ok_to_drop = CoDel__ok_to_drop(o, now, enqueue_time, last);
+    
+    if (o->dropping) {
+        if (!ok_to_drop) {
+            // sojourn time below target, leave dropping state
+            o->dropping = 0;
+            return 0;
+        }
+        
+        if (now < o->drop_next) {
+            return 0;
+        }
+        
+        o->count++;
+        o->drop_next = CoDel__control_law(o, o->drop_next);
+        o->drops++;
+        return 1;
+    }
+    
+    if (!ok_to_drop) {
+        return 0;
+    }
+    
+    // enter dropping state; if we were dropping recently, resume at
+    // about the drop rate we left off at
+    o->dropping = 1;
+    uint32_t delta = o->count - o->lastcount;
+    o->count = ((delta > 1 && (int64_t)(now - o->drop_next) < (int64_t)(16 * o->interval)) ? delta : 1);
+    o->lastcount = o->count;
+    o->drop_next = CoDel__control_law(o, now);
+    o->drops++;
+    return 1;
+}
+
+uint64_t CoDel_GetDrops (struct CoDel *o)
+{
+    return o->drops;
+}
+
+#endif
@@ -0,0 +1,333 @@
+/**
+ * @file FlowStats.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef BADVPN_USE_WINAPI
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if BADVPN_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include "FlowStats.h"
+
+#include <generated/blog_channel_FlowStats.h>
+
+// named interfaces, from all threads
+static LinkedList1 flowstats_list;
+static int flowstats_num;
+#if BADVPN_THREAD_SAFE
+static pthread_mutex_t flowstats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void list_lock (void)
+{
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_lock(&flowstats_mutex) == 0)
+    #endif
+}
+
+static void list_unlock (void)
+{
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_unlock(&flowstats_mutex) == 0)
+    #endif
+}
+
+static void clear_counters (FlowStats *o)
+{
+    o->ops = 0;
+    o->packets = 0;
+    o->bytes = 0;
+    o->since_ns = FlowStats_Now();
+    o->busy_ns = 0;
+    o->max_busy_ns = 0;
+    o->max_in_flight = 0;
+}
+
+static void copy_name (char *dest, const char *src)
+{
+    snprintf(dest, FLOWSTATS_NAME_SIZE, "%s", src);
+}
+
+#ifdef BADVPN_FLOW_STATS
+
+static const char *kind_names[] = {"packet-pass", "packet-recv", "stream-pass"};
+
+static void format_node (char *dest, size_t size, const char *prefix, const char *name)
+{
+    if (!name[0]) {
+        snprintf(dest, size, "%s%s?", prefix, (prefix[0] ? " " : ""));
+    } else {
+        snprintf(dest, size, "%s%s%s", prefix, (prefix[0] ? " " : ""), name);
+    }
+}
+
+static int waiting_permille (FlowStats *o, uint64_t now)
+{
+    uint64_t elapsed = now - o->since_ns;
+    if (elapsed == 0) {
+        return 0;
+    }
+    
+    uint64_t permille = o->busy_ns / (elapsed / 1000 + 1);
+    return (permille > 1000 ? 1000 : permille);
+}
+
+static int compare_busy (const void *v1, const void *v2)
+{
+    FlowStats *o1 = *(FlowStats * const *)v1;
+    FlowStats *o2 = *(FlowStats * const *)v2;
+    
+    return (o1->busy_ns < o2->busy_ns) - (o1->busy_ns > o2->busy_ns);
+}
+
+// returns named interfaces sorted by waiting time; call with the list locked
+static FlowStats ** collect_sorted (void)
+{
+    FlowStats **arr = BAllocArray(flowstats_num, sizeof(arr[0]));
+    if (!arr) {
+        return NULL;
+    }
+    
+    int i = 0;
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&flowstats_list); n; n = LinkedList1Node_Next(n)) {
+        arr[i++] = UPPER_OBJECT(n, FlowStats, list_node);
+    }
+    ASSERT(i == flowstats_num)
+    
+    qsort(arr, flowstats_num, sizeof(arr[0]), compare_busy);
+    
+    return arr;
+}
+
+static void dot_write_id (FILE *f, const char *prefix, const char *name)
+{
+    char node[2 * FLOWSTATS_NAME_SIZE];
+    format_node(node, sizeof(node), prefix, name);
+    
+    fputc('"', f);
+    for (const char *c = node; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', f);
+        }
+        fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+#endif
+
+void FlowStats_Init (FlowStats *o, int kind)
+{
+    ASSERT(kind == FLOWSTATS_KIND_PACKETPASS || kind == FLOWSTATS_KIND_PACKETRECV || kind == FLOWSTATS_KIND_STREAMPASS)
+    
+    o->kind = kind;
+    o->registered = 0;
+    o->from_prefix[0] = '\0';
+    o->from[0] = '\0';
+    o->to_prefix[0] = '\0';
+    o->to[0] = '\0';
+    o->op_start_ns = 0;
+    o->op_in_flight = 0;
+}
+
+void FlowStats_Free (FlowStats *o)
+{
+    if (o->registered) {
+        list_lock();
+        LinkedList1_Remove(&flowstats_list, &o->list_node);
+        flowstats_num--;
+        list_unlock();
+    }
+}
+
+void FlowStats_SetName (FlowStats *o, const char *prefix, const char *from, const char *to)
+{
+    list_lock();
+    
+    if (from) {
+        copy_name(o->from_prefix, (prefix ? prefix : ""));
+        copy_name(o->from, from);
+    }
+    if (to) {
+        copy_name(o->to_prefix, (prefix ? prefix : ""));
+        copy_name(o->to, to);
+    }
+    
+    if (!o->registered) {
+        clear_counters(o);
+        LinkedList1_Append(&flowstats_list, &o->list_node);
+        flowstats_num++;
+        o->registered = 1;
+    }
+    
+    list_unlock();
+}
+
+uint64_t FlowStats_Now (void)
+{
+    #ifdef BADVPN_USE_WINAPI
+    
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+    ASSERT_FORCE(QueryPerformanceCounter(&count))
+    ASSERT_FORCE(QueryPerformanceFrequency(&freq))
+    return (uint64_t)((double)count.QuadPart * (1000000000.0 / (double)freq.QuadPart));
+    
+    #else
+    
+    struct timespec ts;
+    ASSERT_FORCE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    
+    #endif
+}
+
+int FlowStats_Log (int level, int reset)
+{
+    #ifndef BADVPN_FLOW_STATS
+    return 0;
+    #else
+    
+    list_lock();
+    
+    FlowStats **arr = collect_sorted();
+    if (!arr) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        list_unlock();
+        return 1;
+    }
+    
+    uint64_t now = FlowStats_Now();
+    
+    BLog(level, "%d named interfaces, by time spent waiting:", flowstats_num);
+    
+    for (int i = 0; i < flowstats_num; i++) {
+        FlowStats *o = arr[i];
+        
+        char from[2 * FLOWSTATS_NAME_SIZE];
+        char to[2 * FLOWSTATS_NAME_SIZE];
+        format_node(from, sizeof(from), o->from_prefix, o->from);
+        format_node(to, sizeof(to), o->to_prefix, o->to);
+        
+        int permille = waiting_permille(o, now);
+        
+        BLog(level, "  %s -> %s (%s): ops=%"PRIu64" packets=%"PRIu64" bytes=%"PRIu64" waiting=%"PRIu64"us (%d.%d%%) max_wait=%"PRIu64"us max_in_flight=%d",
+             from, to, kind_names[o->kind], o->ops, o->packets, o->bytes, o->busy_ns / 1000, permille / 10, permille % 10, o->max_busy_ns / 1000, o->max_in_flight);
+        
+        if (reset) {
+            clear_counters(o);
+        }
+    }
+    
+    BFree(arr);
+    
+    list_unlock();
+    
+    return 1;
+    
+    #endif
+}
+
+int FlowStats_WriteDot (FILE *f)
+{
+    #ifndef BADVPN_FLOW_STATS
+    return 0;
+    #else
+    
+    list_lock();
+    
+    FlowStats **arr = collect_sorted();
+    if (!arr) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        list_unlock();
+        return 0;
+    }
+    
+    uint64_t now = FlowStats_Now();
+    
+    fprintf(f, "digraph flow {\n");
+    fprintf(f, "  rankdir=LR;\n");
+    fprintf(f, "  node [shape=box];\n");
+    
+    // group elements by prefix
+    for (int i = 0; i < flowstats_num; i++) {
+        for (int side = 0; side < 2; side++) {
+            const char *prefix = (side == 0 ? arr[i]->from_prefix : arr[i]->to_prefix);
+            const char *name = (side == 0 ? arr[i]->from : arr[i]->to);
+            if (!prefix[0]) {
+                continue;
+            }
+            
+            fprintf(f, "  subgraph ");
+            dot_write_id(f, "cluster", prefix);
+            fprintf(f, " { label=");
+            dot_write_id(f, "", prefix);
+            fprintf(f, "; ");
+            dot_write_id(f, prefix, name);
+            fprintf(f, "; }\n");
+        }
+    }
+    
+    for (int i = 0; i < flowstats_num; i++) {
+        FlowStats *o = arr[i];
+        int permille = waiting_permille(o, now);
+        
+        fprintf(f, "  ");
+        dot_write_id(f, o->from_prefix, o->from);
+        fprintf(f, " -> ");
+        dot_write_id(f, o->to_prefix, o->to);
+        fprintf(f, " [label=\"%s\\nops %"PRIu64"\\npackets %"PRIu64"\\nbytes %"PRIu64"\\nwaiting %d.%d%%\\nmax wait %"PRIu64"us\\nmax in flight %d\"%s];\n",
+                kind_names[o->kind], o->ops, o->packets, o->bytes, permille / 10, permille % 10, o->max_busy_ns / 1000, o->max_in_flight,
+                (permille > 500 ? ", color=red, fontcolor=red" : ""));
+    }
+    
+    fprintf(f, "}\n");
+    
+    BFree(arr);
+    
+    list_unlock();
+    
+    return !ferror(f);
+    
+    #endif
+}
@@ -0,0 +1,187 @@
+/**
+ * @file BReactorStats.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Optional instrumentation of flow interfaces ({@link PacketPassInterface},
+ * {@link PacketRecvInterface} and {@link StreamPassInterface}), compiled in
+ * with BADVPN_FLOW_STATS. Each interface which has been given a name records
+ * operations, packets, bytes, the time the side starting operations spent
+ * waiting for them to finish, and the most packets (bytes for streams) handed
+ * over in one operation. Named interfaces are edges between named elements,
+ * pointing in the direction of data, and can be dumped as a Graphviz graph.
+ * A pass edge which spends most of its time waiting points at the element
+ * applying backpressure; a recv edge which does points at the element
+ * starving its receiver.
+ */
+
+#ifndef BADVPN_FLOW_FLOWSTATS_H
+#define BADVPN_FLOW_FLOWSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <structure/LinkedList1.h>
+
+#define FLOWSTATS_KIND_PACKETPASS 0
+#define FLOWSTATS_KIND_PACKETRECV 1
+#define FLOWSTATS_KIND_STREAMPASS 2
+
+#define FLOWSTATS_NAME_SIZE 48
+
+typedef struct {
+    int kind;
+    int registered;
+    char from_prefix[FLOWSTATS_NAME_SIZE];
+    char from[FLOWSTATS_NAME_SIZE];
+    char to_prefix[FLOWSTATS_NAME_SIZE];
+    char to[FLOWSTATS_NAME_SIZE];
+    uint64_t ops;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t since_ns;
+    uint64_t busy_ns;
+    uint64_t max_busy_ns;
+    int max_in_flight;
+    uint64_t op_start_ns;
+    int op_in_flight;
+    LinkedList1Node list_node;
+} FlowStats;
+
+/**
+ * Initializes the record. It is not recorded into until it is named.
+ * 
+ * @param o the object
+ * @param kind one of FLOWSTATS_KIND_*
+ */
+void FlowStats_Init (FlowStats *o, int kind);
+
+/**
+ * Frees the record, removing it from the global list if it was named.
+ * 
+ * @param o the object
+ */
+void FlowStats_Free (FlowStats *o);
+
+/**
+ * Names the sending and/or the receiving element of the interface, and starts
+ * recording. Names are copied, and truncated if too long. Elements with the
+ * same prefix (e.g. "peer 3") are grouped together when dumped.
+ * 
+ * @param o the object
+ * @param prefix prefix of the names, or NULL for none
+ * @param from name of the element data comes from, or NULL to keep it
+ * @param to name of the element data goes to, or NULL to keep it
+ */
+void FlowStats_SetName (FlowStats *o, const char *prefix, const char *from, const char *to);
+
+/**
+ * Records the start of an operation.
+ * 
+ * @param o the object
+ * @param in_flight packets (bytes for streams) handed over by the operation
+ * @param bytes bytes handed over, if known at this point
+ */
+static void FlowStats_Start (FlowStats *o, int in_flight, int bytes);
+
+/**
+ * Records the end of an operation, when the side which started it is told
+ * it's done.
+ * 
+ * @param o the object
+ * @param bytes bytes transferred, if only known at this point
+ */
+static void FlowStats_Finish (FlowStats *o, int bytes);
+
+/**
+ * Returns a monotonic time in nanoseconds.
+ * 
+ * @return current time in nanoseconds
+ */
+uint64_t FlowStats_Now (void);
+
+/**
+ * Logs all named interfaces using the FlowStats log channel, ordered by the
+ * time their senders spent waiting. Counters of interfaces used by other
+ * threads are read while they may be changing, so they may be slightly off.
+ * 
+ * @param level log level
+ * @param reset whether to clear the counters afterwards
+ * @return 1 if data was logged, 0 if instrumentation is not compiled in
+ */
+int FlowStats_Log (int level, int reset);
+
+/**
+ * Writes all named interfaces as a Graphviz digraph, one edge per interface
+ * labelled with its counters. Edges whose senders spent more than half of
+ * the time waiting are drawn red.
+ * 
+ * @param f file to write to
+ * @return 1 on success, 0 if writing failed or instrumentation is not compiled in
+ */
+int FlowStats_WriteDot (FILE *f);
+
+void FlowStats_Start (FlowStats *o, int in_flight, int bytes)
+{
+    if (!o->registered) {
+        return;
+    }
+    
+    o->op_start_ns = FlowStats_Now();
+    o->op_in_flight = in_flight;
+    o->bytes += bytes;
+    
+    if (in_flight > o->max_in_flight) {
+        o->max_in_flight = in_flight;
+    }
+}
+
+void FlowStats_Finish (FlowStats *o, int bytes)
+{
+    // nothing to do if the operation started before we were named
+    if (!o->registered || o->op_start_ns == 0) {
+        return;
+    }
+    
+    uint64_t busy = FlowStats_Now() - o->op_start_ns;
+    
+    o->ops++;
+    o->bytes += bytes;
+    o->busy_ns += busy;
+    if (busy > o->max_busy_ns) {
+        o->max_busy_ns = busy;
+    }
+    
+    if (o->kind != FLOWSTATS_KIND_STREAMPASS) {
+        o->packets += o->op_in_flight;
+    }
+    
+    o->op_start_ns = 0;
+}
+
+#endif
@@ -32,11 +32,33 @@
 #include <misc/debug.h>
 #include <misc/balloc.h>
 
+#include <flow/FlowStats.h>
+
 #include <flow/PacketBuffer.h>
 
 static void input_handler_done (PacketBuffer *buf, int in_len);
 static void output_handler_done (PacketBuffer *buf);
 
+static void codel_consume (PacketBuffer *buf)
+{
+    ASSERT(buf->codel_count > 0)
+    
+    buf->codel_start = (buf->codel_start + 1) % buf->buf.size;
+    buf->codel_count--;
+}
+
+static void codel_drop_packets (PacketBuffer *buf)
+{
+    ASSERT(buf->codel_enabled)
+    
+    uint64_t now = FlowStats_Now();
+    
+    while (buf->buf.output_avail >= 0 && CoDel_ShouldDrop(&buf->codel, now, buf->codel_times[buf->codel_start], buf->codel_count == 1)) {
+        ChunkBuffer2_ConsumePacket(&buf->buf);
+        codel_consume(buf);
+    }
+}
+
 void input_handler_done (PacketBuffer *buf, int in_len)
 {
     ASSERT(in_len >= 0)
@@ -49,6 +71,14 @@ void input_handler_done (PacketBuffer *buf, int in_len)
     // submit packet to buffer
     ChunkBuffer2_SubmitPacket(&buf->buf, in_len);
     
+    // timestamp packet for CoDel; a packet takes at least one block,
+    // so there can't be more packets than blocks
+    if (buf->codel_enabled) {
+        ASSERT(buf->codel_count < buf->buf.size)
+        buf->codel_times[(buf->codel_start + buf->codel_count) % buf->buf.size] = FlowStats_Now();
+        buf->codel_count++;
+    }
+    
     // if there is space, schedule receive
     if (buf->buf.input_avail >= buf->input_mtu) {
         PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
@@ -70,6 +100,12 @@ void output_handler_done (PacketBuffer *buf)
     // remove packet from buffer
     ChunkBuffer2_ConsumePacket(&buf->buf);
     
+    // drop packets which have been waiting too long
+    if (buf->codel_enabled) {
+        codel_consume(buf);
+        codel_drop_packets(buf);
+    }
+    
     // if buffer was full and there is space, schedule receive
     if (was_full && buf->buf.input_avail >= buf->input_mtu) {
         PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
@@ -89,6 +125,7 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
     // init arguments
     buf->input = input;
     buf->output = output;
+    buf->arena = BPendingGroup_Arena(pg);
     
     // init input
     PacketRecvInterface_Receiver_Init(buf->input, (PacketRecvInterface_handler_done)input_handler_done, buf);
@@ -104,13 +141,16 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
     if (num_blocks < 0) {
         goto fail0;
     }
-    if (!(buf->buf_data = (struct ChunkBuffer2_block *)BAllocArray(num_blocks, sizeof(buf->buf_data[0])))) {
+    if (!(buf->buf_data = (struct ChunkBuffer2_block *)BArena_AllocArray(buf->arena, num_blocks, sizeof(buf->buf_data[0])))) {
         goto fail0;
     }
     
     // init buffer
     ChunkBuffer2_Init(&buf->buf, buf->buf_data, num_blocks, buf->input_mtu);
     
+    // set CoDel disabled
+    buf->codel_enabled = 0;
+    
     // schedule receive
     PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
     
@@ -126,6 +166,39 @@ void PacketBuffer_Free (PacketBuffer *buf)
 {
     DebugObject_Free(&buf->d_obj);
     
+    // free CoDel timestamps
+    if (buf->codel_enabled) {
+        BArena_Release(buf->arena, buf->codel_times, (size_t)buf->buf.size * sizeof(buf->codel_times[0]));
+    }
+    
     // free buffer
-    BFree(buf->buf_data);
+    BArena_Release(buf->arena, buf->buf_data, (size_t)buf->buf.size * sizeof(buf->buf_data[0]));
+}
+
+int PacketBuffer_EnableCoDel (PacketBuffer *buf, int target, int interval)
+{
+    ASSERT(target > 0)
+    ASSERT(interval > 0)
+    ASSERT(!buf->codel_enabled)
+    ASSERT(buf->buf.output_avail < 0)
+    DebugObject_Access(&buf->d_obj);
+    
+    // allocate timestamps, one per block
+    if (!(buf->codel_times = (uint64_t *)BArena_AllocArray(buf->arena, buf->buf.size, sizeof(buf->codel_times[0])))) {
+        return 0;
+    }
+    
+    buf->codel_enabled = 1;
+    CoDel_Init(&buf->codel, (uint64_t)target * 1000000, (uint64_t)interval * 1000000);
+    buf->codel_start = 0;
+    buf->codel_count = 0;
+    
+    return 1;
+}
+
+uint64_t PacketBuffer_GetCoDelDrops (PacketBuffer *buf)
+{
+    DebugObject_Access(&buf->d_obj);
+    
+    return (buf->codel_enabled ? CoDel_GetDrops(&buf->codel) : 0);
 }
@@ -41,6 +41,7 @@
 #include <structure/ChunkBuffer2.h>
 #include <flow/PacketRecvInterface.h>
 #include <flow/PacketPassInterface.h>
+#include <flow/CoDel.h>
 
 /**
  * Packet buffer with {@link PacketRecvInterface} input and {@link PacketPassInterface} output.
@@ -50,8 +51,14 @@ typedef struct {
     PacketRecvInterface *input;
     int input_mtu;
     PacketPassInterface *output;
+    BArena *arena;
     struct ChunkBuffer2_block *buf_data;
     ChunkBuffer2 buf;
+    int codel_enabled;
+    struct CoDel codel;
+    uint64_t *codel_times;
+    int codel_start;
+    int codel_count;
 } PacketBuffer;
 
 /**
@@ -62,7 +69,7 @@ typedef struct {
  * @param input input interface
  * @param output output interface
  * @param num_packets minimum number of packets the buffer must hold. Must be >0.
- * @param pg pending group
+ * @param pg pending group. The buffer is allocated from its arena, if any.
  * @return 1 on success, 0 on failure
  */
 int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg) WARN_UNUSED;
@@ -74,4 +81,26 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
  */
 void PacketBuffer_Free (PacketBuffer *buf);
 
+/**
+ * Enables CoDel active queue management (see {@link CoDel}).
+ * Packets are timestamped when received into the buffer, and packets which
+ * have been waiting too long are dropped instead of being sent.
+ * Must be called right after {@link PacketBuffer_Init}, before returning to
+ * the event loop.
+ *
+ * @param buf the object
+ * @param target target queue delay in milliseconds. Must be >0.
+ * @param interval CoDel interval in milliseconds. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int PacketBuffer_EnableCoDel (PacketBuffer *buf, int target, int interval) WARN_UNUSED;
+
+/**
+ * Returns the number of packets dropped by CoDel.
+ *
+ * @param buf the object
+ * @return number of dropped packets, 0 if CoDel is not enabled
+ */
+uint64_t PacketBuffer_GetCoDelDrops (PacketBuffer *buf);
+
 #endif
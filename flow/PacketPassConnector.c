@@ -33,6 +33,18 @@
 
 #include <flow/PacketPassConnector.h>
 
+static void send_input (PacketPassConnector *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->output)
+    
+    if (o->in_num_packets > 0) {
+        PacketPassInterface_Sender_SendBatch(o->output, o->in_packets, o->in_num_packets);
+    } else {
+        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+    }
+}
+
 static void input_handler_send (PacketPassConnector *o, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
@@ -43,10 +55,28 @@ static void input_handler_send (PacketPassConnector *o, uint8_t *data, int data_
     // remember input packet
     o->in_len = data_len;
     o->in = data;
+    o->in_num_packets = 0;
     
     if (o->output) {
         // schedule send
-        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+        send_input(o);
+    }
+}
+
+static void input_handler_send_batch (PacketPassConnector *o, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    ASSERT(num_packets > 0)
+    ASSERT(o->in_len == -1)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember input packets
+    o->in_len = 0;
+    o->in_packets = packets;
+    o->in_num_packets = num_packets;
+    
+    if (o->output) {
+        // schedule send
+        send_input(o);
     }
 }
 
@@ -72,6 +102,7 @@ void PacketPassConnector_Init (PacketPassConnector *o, int mtu, BPendingGroup *p
     
     // init input
     PacketPassInterface_Init(&o->input, o->input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    PacketPassInterface_EnableBatch(&o->input, (PacketPassInterface_handler_send_batch)input_handler_send_batch);
     
     // have no input packet
     o->in_len = -1;
@@ -111,7 +142,7 @@ void PacketPassConnector_ConnectOutput (PacketPassConnector *o, PacketPassInterf
     
     // if we have an input packet, schedule send
     if (o->in_len >= 0) {
-        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+        send_input(o);
     }
 }
 
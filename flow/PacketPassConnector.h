@@ -49,6 +49,8 @@ typedef struct {
     int input_mtu;
     int in_len;
     uint8_t *in;
+    struct PacketPassInterface_packet *in_packets;
+    int in_num_packets;
     PacketPassInterface *output;
     DebugObject d_obj;
 } PacketPassConnector;
@@ -33,6 +33,7 @@
 #include <misc/offset.h>
 #include <misc/minmax.h>
 #include <misc/compare.h>
+#include <misc/usdt.h>
 
 #include <flow/PacketPassFairQueue.h>
 
@@ -115,25 +116,72 @@ static void increment_sent_flow (PacketPassFairQueueFlow *flow, uint64_t amount)
     flow->time += amount;
 }
 
+static int queue_is_empty (PacketPassFairQueue *m)
+{
+    if (m->drr) {
+        return LinkedList1_IsEmpty(&m->queued_list);
+    }
+    
+    return PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree);
+}
+
+static PacketPassFairQueueFlow * drr_next_flow (PacketPassFairQueue *m)
+{
+    ASSERT(m->drr)
+    
+    // give flows their quantum in turn until the first one can send; as the
+    // quantum covers the largest packet, this ends within one round unless
+    // flows are sending batches
+    while (1) {
+        PacketPassFairQueueFlow *qflow = UPPER_OBJECT(LinkedList1_GetFirst(&m->queued_list), PacketPassFairQueueFlow, queued.list_node);
+        ASSERT(qflow->is_queued)
+        
+        int64_t cost = qflow->queued.cost;
+        if (qflow->deficit >= cost) {
+            qflow->deficit -= cost;
+            return qflow;
+        }
+        
+        qflow->deficit += m->quantum * qflow->weight;
+        
+        LinkedList1_Remove(&m->queued_list, &qflow->queued.list_node);
+        LinkedList1_Append(&m->queued_list, &qflow->queued.list_node);
+    }
+}
+
 static void schedule (PacketPassFairQueue *m)
 {
     ASSERT(!m->sending_flow)
     ASSERT(!m->previous_flow)
     ASSERT(!m->freeing)
-    ASSERT(!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(!queue_is_empty(m))
     
-    // get first queued flow
-    PacketPassFairQueueFlow *qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
-    ASSERT(qflow->is_queued)
+    PacketPassFairQueueFlow *qflow;
     
-    // remove flow from queue
-    PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    if (m->drr) {
+        // get flow whose turn it is, and remove it from queue
+        qflow = drr_next_flow(m);
+        LinkedList1_Remove(&m->queued_list, &qflow->queued.list_node);
+    } else {
+        // get first queued flow
+        qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
+        ASSERT(qflow->is_queued)
+        
+        // remove flow from queue
+        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    }
     qflow->is_queued = 0;
     
+    BTRACE2(fairqueue_schedule, m, qflow);
+    
     // schedule send
-    PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    if (qflow->queued.num_packets > 0) {
+        PacketPassInterface_Sender_SendBatch(m->output, qflow->queued.packets, qflow->queued.num_packets);
+    } else {
+        PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    }
     m->sending_flow = qflow;
-    m->sending_len = qflow->queued.data_len;
+    m->sending_cost = qflow->queued.cost;
 }
 
 static void schedule_job_handler (PacketPassFairQueue *m)
@@ -145,38 +193,76 @@ static void schedule_job_handler (PacketPassFairQueue *m)
     // remove previous flow
     m->previous_flow = NULL;
     
-    if (!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree)) {
+    if (!queue_is_empty(m)) {
         schedule(m);
     }
 }
 
-static void input_handler_send (PacketPassFairQueueFlow *flow, uint8_t *data, int data_len)
+static void queue_flow (PacketPassFairQueueFlow *flow)
 {
     PacketPassFairQueue *m = flow->m;
     
     ASSERT(flow != m->sending_flow)
     ASSERT(!flow->is_queued)
     ASSERT(!m->freeing)
-    DebugObject_Access(&flow->d_obj);
     
-    if (flow == m->previous_flow) {
-        // remove from previous flow
-        m->previous_flow = NULL;
+    // queue flow
+    flow->is_queued = 1;
+    
+    if (m->drr) {
+        if (flow == m->previous_flow) {
+            // remove from previous flow, and continue its turn
+            m->previous_flow = NULL;
+            LinkedList1_Prepend(&m->queued_list, &flow->queued.list_node);
+        } else {
+            // a flow which wasn't queued keeps no deficit
+            flow->deficit = 0;
+            LinkedList1_Append(&m->queued_list, &flow->queued.list_node);
+        }
     } else {
-        // raise time
-        flow->time = bmax_uint64(flow->time, get_current_time(m));
+        if (flow == m->previous_flow) {
+            // remove from previous flow
+            m->previous_flow = NULL;
+        } else {
+            // raise time
+            flow->time = bmax_uint64(flow->time, get_current_time(m));
+        }
+        
+        int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
+        ASSERT_EXECUTE(res)
     }
     
-    // queue flow
+    if (!m->sending_flow && !BPending_IsSet(&m->schedule_job)) {
+        schedule(m);
+    }
+}
+
+static void input_handler_send (PacketPassFairQueueFlow *flow, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packet
     flow->queued.data = data;
     flow->queued.data_len = data_len;
-    int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
-    ASSERT_EXECUTE(res)
-    flow->is_queued = 1;
+    flow->queued.num_packets = 0;
+    flow->queued.cost = (uint64_t)flow->m->packet_weight + data_len;
     
-    if (!m->sending_flow && !BPending_IsSet(&m->schedule_job)) {
-        schedule(m);
+    queue_flow(flow);
+}
+
+static void input_handler_send_batch (PacketPassFairQueueFlow *flow, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packets; the batch costs as much as its packets would
+    flow->queued.packets = packets;
+    flow->queued.num_packets = num_packets;
+    flow->queued.cost = 0;
+    for (int i = 0; i < num_packets; i++) {
+        flow->queued.cost += (uint64_t)flow->m->packet_weight + packets[i].len;
     }
+    
+    queue_flow(flow);
 }
 
 static void output_handler_done (PacketPassFairQueue *m)
@@ -195,8 +281,11 @@ static void output_handler_done (PacketPassFairQueue *m)
     // remember this flow so the schedule job can remove its time if it didn's send
     m->previous_flow = flow;
     
-    // update flow time by packet size
-    increment_sent_flow(flow, (uint64_t)m->packet_weight + m->sending_len);
+    // update flow time by packet size, scaled down by weight; with DRR, the
+    // deficit was already charged
+    if (!m->drr) {
+        increment_sent_flow(flow, bmin_uint64((m->sending_cost + flow->weight - 1) / flow->weight, FAIRQUEUE_MAX_TIME));
+    }
     
     // schedule schedule
     BPending_Set(&m->schedule_job);
@@ -216,7 +305,7 @@ static void output_handler_done (PacketPassFairQueue *m)
     }
 }
 
-int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight)
+static int init_queue (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight, int drr)
 {
     ASSERT(packet_weight > 0)
     ASSERT(use_cancel == 0 || use_cancel == 1)
@@ -227,6 +316,10 @@ int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *outpu
     m->pg = pg;
     m->use_cancel = use_cancel;
     m->packet_weight = packet_weight;
+    m->drr = drr;
+    
+    // the quantum covers the largest packet
+    m->quantum = (int64_t)PacketPassInterface_GetMTU(output) + packet_weight;
     
     // make sure that (output MTU + packet_weight <= FAIRQUEUE_MAX_TIME)
     if (!(
@@ -248,6 +341,9 @@ int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *outpu
     // init queued tree
     PacketPassFairQueue__Tree_Init(&m->queued_tree);
     
+    // init queued list
+    LinkedList1_Init(&m->queued_list);
+    
     // init flows list
     LinkedList1_Init(&m->flows_list);
     
@@ -265,10 +361,20 @@ fail0:
     return 0;
 }
 
+int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight)
+{
+    return init_queue(m, output, pg, use_cancel, packet_weight, 0);
+}
+
+int PacketPassFairQueue_InitDRR (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight)
+{
+    return init_queue(m, output, pg, use_cancel, packet_weight, 1);
+}
+
 void PacketPassFairQueue_Free (PacketPassFairQueue *m)
 {
     ASSERT(LinkedList1_IsEmpty(&m->flows_list))
-    ASSERT(PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(queue_is_empty(m))
     ASSERT(!m->previous_flow)
     ASSERT(!m->sending_flow)
     DebugCounter_Free(&m->d_ctr);
@@ -306,10 +412,17 @@ void PacketPassFairQueueFlow_Init (PacketPassFairQueueFlow *flow, PacketPassFair
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    PacketPassInterface_EnableBatch(&flow->input, (PacketPassInterface_handler_send_batch)input_handler_send_batch);
+    
+    // set weight
+    flow->weight = 1;
     
     // set time
     flow->time = 0;
     
+    // set no deficit
+    flow->deficit = 0;
+    
     // add to flows list
     LinkedList1_Append(&m->flows_list, &flow->list_node);
     
@@ -340,7 +453,11 @@ void PacketPassFairQueueFlow_Free (PacketPassFairQueueFlow *flow)
     
     // remove from queue
     if (flow->is_queued) {
-        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        if (m->drr) {
+            LinkedList1_Remove(&m->queued_list, &flow->queued.list_node);
+        } else {
+            PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        }
     }
     
     // remove from flows list
@@ -397,6 +514,15 @@ void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, Pack
     flow->user = user;
 }
 
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight)
+{
+    ASSERT(weight >= 1)
+    ASSERT(weight <= FAIRQUEUE_MAX_WEIGHT)
+    DebugObject_Access(&flow->d_obj);
+    
+    flow->weight = weight;
+}
+
 PacketPassInterface * PacketPassFairQueueFlow_GetInput (PacketPassFairQueueFlow *flow)
 {
     DebugObject_Access(&flow->d_obj);
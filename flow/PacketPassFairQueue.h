@@ -47,6 +47,9 @@
 // reduce this to test time overflow handling
 #define FAIRQUEUE_MAX_TIME UINT64_MAX
 
+// maximum weight of a flow
+#define FAIRQUEUE_MAX_WEIGHT 65535
+
 typedef void (*PacketPassFairQueue_handler_busy) (void *user);
 
 struct PacketPassFairQueueFlow_s;
@@ -59,13 +62,21 @@ typedef struct PacketPassFairQueueFlow_s {
     PacketPassFairQueue_handler_busy handler_busy;
     void *user;
     PacketPassInterface input;
+    int weight;
     uint64_t time;
+    int64_t deficit;
     LinkedList1Node list_node;
     int is_queued;
     struct {
-        PacketPassFairQueue__TreeNode tree_node;
+        union {
+            PacketPassFairQueue__TreeNode tree_node;
+            LinkedList1Node list_node;
+        };
         uint8_t *data;
         int data_len;
+        struct PacketPassInterface_packet *packets;
+        int num_packets;
+        uint64_t cost;
     } queued;
     DebugObject d_obj;
 } PacketPassFairQueueFlow;
@@ -78,10 +89,13 @@ typedef struct PacketPassFairQueue_s {
     BPendingGroup *pg;
     int use_cancel;
     int packet_weight;
+    int drr;
+    int64_t quantum;
     struct PacketPassFairQueueFlow_s *sending_flow;
-    int sending_len;
+    uint64_t sending_cost;
     struct PacketPassFairQueueFlow_s *previous_flow;
     PacketPassFairQueue__Tree queued_tree;
+    LinkedList1 queued_list;
     LinkedList1 flows_list;
     int freeing;
     BPending schedule_job;
@@ -103,6 +117,19 @@ typedef struct PacketPassFairQueue_s {
  */
 int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight) WARN_UNUSED;
 
+/**
+ * Initializes the queue to use deficit round robin scheduling.
+ * Instead of keeping queued flows ordered by virtual time, which costs
+ * O(log n) per packet, queued flows take turns in a list. In each turn a flow
+ * may send packets worth its quantum (output MTU + packet_weight, times the
+ * weight of the flow), plus what it didn't use in previous turns while it
+ * stayed queued. Scheduling is O(1) per packet.
+ * Arguments are as in {@link PacketPassFairQueue_Init}.
+ *
+ * @return 1 on success, 0 on failure
+ */
+int PacketPassFairQueue_InitDRR (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight) WARN_UNUSED;
+
 /**
  * Frees the queue.
  * All flows must have been freed.
@@ -193,8 +220,19 @@ void PacketPassFairQueueFlow_RequestCancel (PacketPassFairQueueFlow *flow);
  */
 void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, PacketPassFairQueue_handler_busy handler, void *user);
 
+/**
+ * Sets the weight of the flow. A flow with twice the weight gets twice the
+ * share of the output when flows compete. The initial weight is 1.
+ *
+ * @param flow the object
+ * @param weight weight of the flow. Must be >=1 and <=FAIRQUEUE_MAX_WEIGHT.
+ */
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight);
+
 /**
  * Returns the input interface of the flow.
+ * The input accepts batches of packets, which are passed to the output as
+ * one operation and are charged to the flow as a whole.
  *
  * @param flow the object
  * @return input interface
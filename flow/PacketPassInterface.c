@@ -38,6 +38,10 @@ void _PacketPassInterface_job_operation (PacketPassInterface *i)
     i->state = PPI_STATE_BUSY;
     
     // call handler
+    if (i->job_operation_num_packets > 0 && i->handler_operation_batch) {
+        i->handler_operation_batch(i->user_provider, i->job_operation_packets, i->job_operation_num_packets);
+        return;
+    }
     i->handler_operation(i->user_provider, i->job_operation_data, i->job_operation_len);
     return;
 }
@@ -62,6 +66,10 @@ void _PacketPassInterface_job_done (PacketPassInterface *i)
     // set state
     i->state = PPI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Finish(&i->stats, 0);
+    #endif
+    
     // call handler
     i->handler_done(i->user_user);
     return;
@@ -40,14 +40,25 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowStats.h>
 
 #define PPI_STATE_NONE 1
 #define PPI_STATE_OPERATION_PENDING 2
 #define PPI_STATE_BUSY 3
 #define PPI_STATE_DONE_PENDING 4
 
+/**
+ * One packet of a batch, see {@link PacketPassInterface_Sender_SendBatch}.
+ */
+struct PacketPassInterface_packet {
+    uint8_t *data;
+    int len;
+};
+
 typedef void (*PacketPassInterface_handler_send) (void *user, uint8_t *data, int data_len);
 
+typedef void (*PacketPassInterface_handler_send_batch) (void *user, struct PacketPassInterface_packet *packets, int num_packets);
+
 typedef void (*PacketPassInterface_handler_requestcancel) (void *user);
 
 typedef void (*PacketPassInterface_handler_done) (void *user);
@@ -56,6 +67,7 @@ typedef struct {
     // provider data
     int mtu;
     PacketPassInterface_handler_send handler_operation;
+    PacketPassInterface_handler_send_batch handler_operation_batch;
     PacketPassInterface_handler_requestcancel handler_requestcancel;
     void *user_provider;
     
@@ -67,6 +79,9 @@ typedef struct {
     BPending job_operation;
     uint8_t *job_operation_data;
     int job_operation_len;
+    struct PacketPassInterface_packet *job_operation_packets;
+    int job_operation_num_packets;
+    int job_operation_pos;
     
     // requestcancel job
     BPending job_requestcancel;
@@ -78,6 +93,10 @@ typedef struct {
     int state;
     int cancel_requested;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats stats;
+    #endif
+    
     DebugObject d_obj;
 } PacketPassInterface;
 
@@ -87,6 +106,14 @@ static void PacketPassInterface_Free (PacketPassInterface *i);
 
 static void PacketPassInterface_EnableCancel (PacketPassInterface *i, PacketPassInterface_handler_requestcancel handler_requestcancel);
 
+/**
+ * Lets the provider accept batches of packets. May only be called right after
+ * {@link PacketPassInterface_Init}, before the sender is set up. The handler
+ * is called instead of the normal one for {@link PacketPassInterface_Sender_SendBatch},
+ * and one {@link PacketPassInterface_Done} accepts the whole batch.
+ */
+static void PacketPassInterface_EnableBatch (PacketPassInterface *i, PacketPassInterface_handler_send_batch handler_operation_batch);
+
 static void PacketPassInterface_Done (PacketPassInterface *i);
 
 static int PacketPassInterface_GetMTU (PacketPassInterface *i);
@@ -99,6 +126,36 @@ static void PacketPassInterface_Sender_RequestCancel (PacketPassInterface *i);
 
 static int PacketPassInterface_HasCancel (PacketPassInterface *i);
 
+/**
+ * Returns whether the provider accepts batches of packets directly.
+ */
+static int PacketPassInterface_HasBatch (PacketPassInterface *i);
+
+/**
+ * Sends several packets as one operation; the done handler is called once
+ * they have all been accepted.
+ * If the provider doesn't accept batches (see {@link PacketPassInterface_HasBatch}),
+ * the interface passes the packets to it one by one, without involving the
+ * sender in between. If cancel is requested, packets not yet passed are dropped.
+ * The array and the packets must stay valid until the done handler is called.
+ * 
+ * @param i the object
+ * @param packets packets to send; each must have 0<=len<=MTU
+ * @param num_packets number of packets, must be >0
+ */
+static void PacketPassInterface_Sender_SendBatch (PacketPassInterface *i, struct PacketPassInterface_packet *packets, int num_packets);
+
+/**
+ * Names the elements on the two sides of the interface for instrumentation
+ * (see {@link FlowStats}). Does nothing unless built with BADVPN_FLOW_STATS.
+ * 
+ * @param i the object
+ * @param prefix prefix of the names, or NULL for none
+ * @param from name of the element data comes from, or NULL to keep it
+ * @param to name of the element data goes to, or NULL to keep it
+ */
+static void PacketPassInterface_SetStatsName (PacketPassInterface *i, const char *prefix, const char *from, const char *to);
+
 void _PacketPassInterface_job_operation (PacketPassInterface *i);
 void _PacketPassInterface_job_requestcancel (PacketPassInterface *i);
 void _PacketPassInterface_job_done (PacketPassInterface *i);
@@ -110,6 +167,7 @@ void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterf
     // init arguments
     i->mtu = mtu;
     i->handler_operation = handler_operation;
+    i->handler_operation_batch = NULL;
     i->handler_requestcancel = NULL;
     i->user_provider = user;
     
@@ -124,6 +182,10 @@ void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterf
     // set state
     i->state = PPI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Init(&i->stats, FLOWSTATS_KIND_PACKETPASS);
+    #endif
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -131,6 +193,10 @@ void PacketPassInterface_Free (PacketPassInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Free(&i->stats);
+    #endif
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_requestcancel);
@@ -146,6 +212,17 @@ void PacketPassInterface_EnableCancel (PacketPassInterface *i, PacketPassInterfa
     i->handler_requestcancel = handler_requestcancel;
 }
 
+void PacketPassInterface_EnableBatch (PacketPassInterface *i, PacketPassInterface_handler_send_batch handler_operation_batch)
+{
+    ASSERT(handler_operation_batch)
+    ASSERT(!i->handler_operation_batch)
+    ASSERT(!i->handler_done)
+    ASSERT(i->state == PPI_STATE_NONE)
+    DebugObject_Access(&i->d_obj);
+    
+    i->handler_operation_batch = handler_operation_batch;
+}
+
 void PacketPassInterface_Done (PacketPassInterface *i)
 {
     ASSERT(i->state == PPI_STATE_BUSY)
@@ -154,6 +231,16 @@ void PacketPassInterface_Done (PacketPassInterface *i)
     // unset requestcancel job
     BPending_Unset(&i->job_requestcancel);
     
+    // pass the next packet of a batch the provider takes one by one
+    if (i->job_operation_pos + 1 < i->job_operation_num_packets && !i->handler_operation_batch && !i->cancel_requested) {
+        i->job_operation_pos++;
+        i->job_operation_data = i->job_operation_packets[i->job_operation_pos].data;
+        i->job_operation_len = i->job_operation_packets[i->job_operation_pos].len;
+        BPending_Set(&i->job_operation);
+        i->state = PPI_STATE_OPERATION_PENDING;
+        return;
+    }
+    
     // schedule done
     BPending_Set(&i->job_done);
     
@@ -190,8 +277,14 @@ void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int
     // schedule operation
     i->job_operation_data = data;
     i->job_operation_len = data_len;
+    i->job_operation_num_packets = 0;
+    i->job_operation_pos = 0;
     BPending_Set(&i->job_operation);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Start(&i->stats, 1, data_len);
+    #endif
+    
     // set state
     i->state = PPI_STATE_OPERATION_PENDING;
     i->cancel_requested = 0;
@@ -233,4 +326,56 @@ int PacketPassInterface_HasCancel (PacketPassInterface *i)
     return !!i->handler_requestcancel;
 }
 
+int PacketPassInterface_HasBatch (PacketPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return !!i->handler_operation_batch;
+}
+
+void PacketPassInterface_Sender_SendBatch (PacketPassInterface *i, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    ASSERT(packets)
+    ASSERT(num_packets > 0)
+    ASSERT(i->state == PPI_STATE_NONE)
+    ASSERT(i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+    for (int j = 0; j < num_packets; j++) {
+        ASSERT(packets[j].len >= 0)
+        ASSERT(packets[j].len <= i->mtu)
+        ASSERT(!(packets[j].len > 0) || packets[j].data)
+    }
+    
+    // schedule operation, starting with the first packet if the provider
+    // takes them one by one
+    i->job_operation_packets = packets;
+    i->job_operation_num_packets = num_packets;
+    i->job_operation_pos = 0;
+    i->job_operation_data = packets[0].data;
+    i->job_operation_len = packets[0].len;
+    BPending_Set(&i->job_operation);
+    
+    #ifdef BADVPN_FLOW_STATS
+    int bytes = 0;
+    for (int j = 0; j < num_packets; j++) {
+        bytes += packets[j].len;
+    }
+    FlowStats_Start(&i->stats, num_packets, bytes);
+    #endif
+    
+    // set state
+    i->state = PPI_STATE_OPERATION_PENDING;
+    i->cancel_requested = 0;
+}
+
+void PacketPassInterface_SetStatsName (PacketPassInterface *i, const char *prefix, const char *from, const char *to)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_SetName(&i->stats, prefix, from, to);
+    #endif
+}
+
 #endif
@@ -99,6 +99,29 @@ static void input_handler_send (PacketPassPriorityQueueFlow *flow, uint8_t *data
     }
 }
 
+static void input_handler_requestcancel (PacketPassPriorityQueueFlow *flow)
+{
+    PacketPassPriorityQueue *m = flow->m;
+    
+    ASSERT(flow->is_queued || flow == m->sending_flow)
+    ASSERT(m->use_cancel)
+    ASSERT(!m->freeing)
+    DebugObject_Access(&flow->d_obj);
+    
+    // if the packet is being sent, cancel sending
+    if (flow == m->sending_flow) {
+        PacketPassInterface_Sender_RequestCancel(m->output);
+        return;
+    }
+    
+    // packet was not sent yet, remove flow from queue
+    PacketPassPriorityQueue__Tree_Remove(&m->queued_tree, 0, flow);
+    flow->is_queued = 0;
+    
+    // finish flow packet
+    PacketPassInterface_Done(&flow->input);
+}
+
 static void output_handler_done (PacketPassPriorityQueue *m)
 {
     ASSERT(m->sending_flow)
@@ -198,6 +221,9 @@ void PacketPassPriorityQueueFlow_Init (PacketPassPriorityQueueFlow *flow, Packet
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    if (m->use_cancel) {
+        PacketPassInterface_EnableCancel(&flow->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
     
     // is not queued
     flow->is_queued = 0;
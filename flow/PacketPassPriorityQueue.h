@@ -86,7 +86,9 @@ typedef struct PacketPassPriorityQueue_s {
  * @param output output interface
  * @param pg pending group
  * @param use_cancel whether cancel functionality is required. Must be 0 or 1.
- *                   If 1, output must support cancel functionality.
+ *                   If 1, output must support cancel functionality, and flow
+ *                   inputs support it too; cancelling a packet which is still
+ *                   queued drops it without sending.
  */
 void PacketPassPriorityQueue_Init (PacketPassPriorityQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel);
 
@@ -0,0 +1,253 @@
+/**
+ * @file PacketProtoBatcher.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <protocol/packetproto.h>
+
+#include <flow/PacketProtoBatcher.h>
+
+static int batch_offset (PacketProtoBatcher *o)
+{
+    return sizeof(struct packetproto_header) + o->prefix_len;
+}
+
+static void send_batch (PacketProtoBatcher *o)
+{
+    ASSERT(o->buf_count > 0)
+    ASSERT(!o->buf_sending)
+    ASSERT(!o->in_sending)
+    
+    // set sending batch
+    o->buf_sending = 1;
+    
+    // a single packet goes out as it is
+    if (o->buf_count == 1) {
+        PacketPassInterface_Sender_Send(o->output, o->buf + batch_offset(o), o->buf_used);
+        return;
+    }
+    
+    // write header
+    struct packetproto_header header;
+    header.len = htol16(o->prefix_len + o->buf_used);
+    memcpy(o->buf, &header, sizeof(header));
+    
+    // send batch
+    PacketPassInterface_Sender_Send(o->output, o->buf, batch_offset(o) + o->buf_used);
+}
+
+static void process_input (PacketProtoBatcher *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(!o->in_sending)
+    
+    // wait until the output is done with the batch
+    if (o->buf_sending) {
+        return;
+    }
+    
+    // if the packet fits, copy it and accept it right away
+    if (o->enabled && o->in_len <= o->batch_size - batch_offset(o) - o->buf_used) {
+        memcpy(o->buf + batch_offset(o) + o->buf_used, o->in, o->in_len);
+        o->buf_used += o->in_len;
+        o->buf_count++;
+        o->in_len = -1;
+        
+        // send once the input has nothing more for us; this job was set
+        // before the input is informed, so it runs after the input's job.
+        // While held, the batch is only sent when full or released.
+        if (!o->held) {
+            BPending_Set(&o->flush_job);
+        }
+        
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // doesn't fit; send the batch first
+    if (o->buf_count > 0) {
+        BPending_Unset(&o->flush_job);
+        send_batch(o);
+        return;
+    }
+    
+    // pass the packet on unchanged
+    o->in_sending = 1;
+    PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+}
+
+static void input_handler_send (PacketProtoBatcher *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->in_len == -1)
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // set input packet
+    o->in_len = data_len;
+    o->in = data;
+    
+    process_input(o);
+}
+
+static void output_handler_done (PacketProtoBatcher *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // finish a packet which was passed on
+    if (o->in_sending) {
+        ASSERT(o->in_len >= 0)
+        o->in_sending = 0;
+        o->in_len = -1;
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    ASSERT(o->buf_sending)
+    
+    // batch is empty again
+    o->buf_sending = 0;
+    o->buf_used = 0;
+    o->buf_count = 0;
+    
+    // continue with a packet which was waiting
+    if (o->in_len >= 0) {
+        process_input(o);
+    }
+}
+
+static void flush_job_handler (PacketProtoBatcher *o)
+{
+    ASSERT(o->buf_count > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    send_batch(o);
+}
+
+int PacketProtoBatcher_Init (PacketProtoBatcher *o, PacketPassInterface *output, int mtu, const uint8_t *prefix, int prefix_len, int batch_size, BPendingGroup *pg)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(prefix_len >= 0)
+    ASSERT(batch_size > sizeof(struct packetproto_header) + prefix_len)
+    ASSERT(batch_size - sizeof(struct packetproto_header) <= PACKETPROTO_MAXPAYLOAD)
+    ASSERT(PacketPassInterface_GetMTU(output) >= mtu)
+    ASSERT(PacketPassInterface_GetMTU(output) >= batch_size)
+    
+    // init arguments
+    o->output = output;
+    o->prefix = prefix;
+    o->prefix_len = prefix_len;
+    o->batch_size = batch_size;
+    o->arena = BPendingGroup_Arena(pg);
+    
+    // allocate buffer
+    if (!(o->buf = (uint8_t *)BArena_Alloc(o->arena, o->batch_size))) {
+        goto fail0;
+    }
+    
+    // write prefix
+    memcpy(o->buf + sizeof(struct packetproto_header), o->prefix, o->prefix_len);
+    
+    // init input
+    PacketPassInterface_Init(&o->input, mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init flush job
+    BPending_Init(&o->flush_job, pg, (BPending_handler)flush_job_handler, o);
+    
+    // set batching disabled, and not held
+    o->enabled = 0;
+    o->held = 0;
+    
+    // batch is empty
+    o->buf_used = 0;
+    o->buf_count = 0;
+    o->buf_sending = 0;
+    
+    // have no input packet
+    o->in_len = -1;
+    o->in_sending = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void PacketProtoBatcher_Free (PacketProtoBatcher *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free flush job
+    BPending_Free(&o->flush_job);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free buffer
+    BArena_Release(o->arena, o->buf, o->batch_size);
+}
+
+void PacketProtoBatcher_Enable (PacketProtoBatcher *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->enabled = 1;
+}
+
+void PacketProtoBatcher_Hold (PacketProtoBatcher *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->held = 1;
+}
+
+void PacketProtoBatcher_Release (PacketProtoBatcher *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->held = 0;
+    
+    // send what was collected meanwhile, unless a batch is still being sent
+    if (o->buf_count > 0 && !o->buf_sending) {
+        BPending_Set(&o->flush_job);
+    }
+}
+
+PacketPassInterface * PacketProtoBatcher_GetInput (PacketProtoBatcher *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file PacketProtoBatcher.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which combines PacketProto-encoded packets into larger PacketProto
+ * packets.
+ */
+
+#ifndef BADVPN_FLOW_PACKETPROTOBATCHER_H
+#define BADVPN_FLOW_PACKETPROTOBATCHER_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * Object which combines PacketProto-encoded packets into larger PacketProto
+ * packets.
+ * 
+ * Input packets must be PacketProto-encoded (header included). A batch is a
+ * PacketProto packet whose payload is a fixed prefix followed by the
+ * concatenated input packets, headers included. Input packets are copied into
+ * the batch and accepted right away while it has room. The batch is sent once
+ * the input has nothing more to pass on right away, or when the next packet
+ * doesn't fit. A batch holding a single packet is sent as just that packet, and
+ * packets which don't fit into an empty batch are passed on unchanged.
+ * 
+ * Batching starts disabled, and packets are passed on unchanged until
+ * {@link PacketProtoBatcher_Enable} is called.
+ */
+typedef struct {
+    PacketPassInterface input;
+    PacketPassInterface *output;
+    const uint8_t *prefix;
+    int prefix_len;
+    int batch_size;
+    int enabled;
+    int held;
+    BArena *arena;
+    uint8_t *buf;
+    int buf_used;
+    int buf_count;
+    int buf_sending;
+    int in_len;
+    uint8_t *in;
+    int in_sending;
+    BPending flush_job;
+    DebugObject d_obj;
+} PacketProtoBatcher;
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param output output interface. Its MTU must be >=batch_size and >=mtu.
+ * @param mtu input MTU. Must be >=0.
+ * @param prefix data placed before the packets in each batch. Must remain
+ *               valid until the object is freed.
+ * @param prefix_len length of prefix. Must be >=0.
+ * @param batch_size maximum length of a batch, including its PacketProto
+ *                   header and the prefix. Must be larger than both.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoBatcher_Init (PacketProtoBatcher *o, PacketPassInterface *output, int mtu, const uint8_t *prefix, int prefix_len, int batch_size, BPendingGroup *pg) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void PacketProtoBatcher_Free (PacketProtoBatcher *o);
+
+/**
+ * Enables batching.
+ * 
+ * @param o the object
+ */
+void PacketProtoBatcher_Enable (PacketProtoBatcher *o);
+
+/**
+ * Holds back batches until {@link PacketProtoBatcher_Release} is called.
+ * While held, a batch is only sent once the next packet doesn't fit. This
+ * lets a user collect packets which are produced from separate jobs.
+ * 
+ * @param o the object
+ */
+void PacketProtoBatcher_Hold (PacketProtoBatcher *o);
+
+/**
+ * Stops holding back batches, sending the current one.
+ * 
+ * @param o the object
+ */
+void PacketProtoBatcher_Release (PacketProtoBatcher *o);
+
+/**
+ * Returns the input interface.
+ * Its MTU will be as in {@link PacketProtoBatcher_Init}.
+ * 
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketProtoBatcher_GetInput (PacketProtoBatcher *o);
+
+#endif
@@ -39,63 +39,119 @@
 
 #include <generated/blog_channel_PacketProtoDecoder.h>
 
+static void make_contiguous (PacketProtoDecoder *enc, int len);
+static int parse_packet (PacketProtoDecoder *enc, uint8_t **out_data, int *out_len);
+static void start_recv (PacketProtoDecoder *enc);
 static void process_data (PacketProtoDecoder *enc);
 static void input_handler_done (PacketProtoDecoder *enc, int data_len);
 static void output_handler_done (PacketProtoDecoder *enc);
 
+// makes len bytes at buf_start readable in one piece, by continuing any part
+// which wraps around into the space past the end of the ring
+void make_contiguous (PacketProtoDecoder *enc, int len)
+{
+    ASSERT(len <= enc->buf_used)
+    
+    int over = enc->buf_start + len - enc->buf_size;
+    if (over > 0) {
+        memcpy(enc->buf + enc->buf_size, enc->buf, over);
+    }
+}
+
+// returns 1 and hands out a packet from the buffer, 0 if there is no whole packet yet, -1 on error
+int parse_packet (PacketProtoDecoder *enc, uint8_t **out_data, int *out_len)
+{
+    // check if header was received
+    if (enc->buf_used < sizeof(struct packetproto_header)) {
+        return 0;
+    }
+    make_contiguous(enc, sizeof(struct packetproto_header));
+    struct packetproto_header header;
+    memcpy(&header, enc->buf + enc->buf_start, sizeof(header));
+    int data_len = ltoh16(header.len);
+    
+    // check data length
+    if (data_len > enc->output_mtu) {
+        return -1;
+    }
+    
+    // check if whole packet was received
+    int enc_len = sizeof(struct packetproto_header) + data_len;
+    if (enc->buf_used < enc_len) {
+        return 0;
+    }
+    make_contiguous(enc, enc_len);
+    
+    *out_data = enc->buf + enc->buf_start + sizeof(struct packetproto_header);
+    *out_len = data_len;
+    
+    // update buffer; the packet stays in use until the output is done
+    enc->buf_start = (enc->buf_start + enc_len) % enc->buf_size;
+    enc->buf_used -= enc_len;
+    enc->buf_out += enc_len;
+    
+    return 1;
+}
+
+void start_recv (PacketProtoDecoder *enc)
+{
+    ASSERT(!enc->recv_pending)
+    
+    // receive into free space following the data, up to the end of the ring
+    int space = enc->buf_size - enc->buf_out - enc->buf_used;
+    if (space == 0) {
+        return;
+    }
+    int pos = (enc->buf_start + enc->buf_used) % enc->buf_size;
+    
+    enc->recv_pending = 1;
+    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf + pos, bmin_int(space, enc->buf_size - pos));
+}
+
 void process_data (PacketProtoDecoder *enc)
 {
-    int was_error = 0;
+    ASSERT(enc->buf_out == 0)
     
-    do {
-        uint8_t *data = enc->buf + enc->buf_start;
-        int left = enc->buf_used;
-        
-        // check if header was received
-        if (left < sizeof(struct packetproto_header)) {
-            break;
-        }
-        struct packetproto_header header;
-        memcpy(&header, data, sizeof(header));
-        data += sizeof(struct packetproto_header);
-        left -= sizeof(struct packetproto_header);
-        int data_len = ltoh16(header.len);
-        
-        // check data length
-        if (data_len > enc->output_mtu) {
-            BLog(BLOG_NOTICE, "error: packet too large");
-            was_error = 1;
-            break;
+    uint8_t *data;
+    int data_len;
+    int res = parse_packet(enc, &data, &data_len);
+    
+    if (res > 0) {
+        if (!enc->output_batch) {
+            // submit packet
+            PacketPassInterface_Sender_Send(enc->output, data, data_len);
+        } else {
+            // submit all whole packets at once. An error is left for the next round.
+            int num_packets = 0;
+            do {
+                enc->batch[num_packets].data = data;
+                enc->batch[num_packets].len = data_len;
+                num_packets++;
+            } while (num_packets < PACKETPROTODECODER_MAX_BATCH && parse_packet(enc, &data, &data_len) > 0);
+            
+            PacketPassInterface_Sender_SendBatch(enc->output, enc->batch, num_packets);
         }
         
-        // check if whole packet was received
-        if (left < data_len) {
-            break;
+        // keep receiving into the remaining space while the output works
+        if (!enc->recv_pending) {
+            start_recv(enc);
         }
-        
-        // update buffer
-        enc->buf_start += sizeof(struct packetproto_header) + data_len;
-        enc->buf_used -= sizeof(struct packetproto_header) + data_len;
-        
-        // submit packet
-        PacketPassInterface_Sender_Send(enc->output, data, data_len);
         return;
-    } while (0);
+    }
+    
+    int was_error = (res < 0);
     
     if (was_error) {
-        // reset buffer
-        enc->buf_start = 0;
-        enc->buf_used = 0;
-    } else {
-        // if we reached the end of the buffer, wrap around to allow more data to be received
-        if (enc->buf_start + enc->buf_used == enc->buf_size) {
-            memmove(enc->buf, enc->buf + enc->buf_start, enc->buf_used);
-            enc->buf_start = 0;
-        }
+        BLog(BLOG_NOTICE, "error: packet too large");
+        
+        // drop buffered data
+        PacketProtoDecoder_Reset(enc);
     }
     
     // receive data
-    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf + (enc->buf_start + enc->buf_used), enc->buf_size - (enc->buf_start + enc->buf_used));
+    if (!enc->recv_pending) {
+        start_recv(enc);
+    }
     
     // if we had error, report it
     if (was_error) {
@@ -106,13 +162,21 @@ void process_data (PacketProtoDecoder *enc)
 
 static void input_handler_done (PacketProtoDecoder *enc, int data_len)
 {
+    ASSERT(enc->recv_pending)
     ASSERT(data_len > 0)
-    ASSERT(data_len <= enc->buf_size - (enc->buf_start + enc->buf_used))
+    ASSERT(data_len <= enc->buf_size - enc->buf_out - enc->buf_used)
     DebugObject_Access(&enc->d_obj);
     
     // update buffer
+    enc->recv_pending = 0;
     enc->buf_used += data_len;
     
+    // wait for the output if it's busy, but keep receiving
+    if (enc->buf_out > 0) {
+        start_recv(enc);
+        return;
+    }
+    
     // process data
     process_data(enc);
     return;
@@ -120,8 +184,12 @@ static void input_handler_done (PacketProtoDecoder *enc, int data_len)
 
 void output_handler_done (PacketProtoDecoder *enc)
 {
+    ASSERT(enc->buf_out > 0)
     DebugObject_Access(&enc->d_obj);
     
+    // packets are no longer used
+    enc->buf_out = 0;
+    
     // process data
     process_data(enc);
     return;
@@ -129,6 +197,13 @@ void output_handler_done (PacketProtoDecoder *enc)
 
 int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error)
 {
+    return PacketProtoDecoder_Init2(enc, input, output, 0, pg, user, handler_error);
+}
+
+int PacketProtoDecoder_Init2 (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, int buf_size, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error)
+{
+    ASSERT(buf_size >= 0)
+    
     // init arguments
     enc->input = input;
     enc->output = output;
@@ -144,18 +219,23 @@ int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input
     // set output MTU, limit by maximum payload size
     enc->output_mtu = bmin_int(PacketPassInterface_GetMTU(enc->output), PACKETPROTO_MAXPAYLOAD);
     
-    // init buffer state
-    enc->buf_size = PACKETPROTO_ENCLEN(enc->output_mtu);
+    // pass packets in batches if the output takes them directly
+    enc->output_batch = PacketPassInterface_HasBatch(enc->output);
+    
+    // init buffer state; the ring holds at least one packet
+    enc->buf_size = bmax_int(buf_size, PACKETPROTO_ENCLEN(enc->output_mtu));
     enc->buf_start = 0;
     enc->buf_used = 0;
+    enc->buf_out = 0;
     
-    // allocate buffer
-    if (!(enc->buf = (uint8_t *)malloc(enc->buf_size))) {
+    // allocate buffer, with room past the end for a packet which wraps around
+    if (!(enc->buf = (uint8_t *)malloc(enc->buf_size + PACKETPROTO_ENCLEN(enc->output_mtu)))) {
         goto fail0;
     }
     
     // start receiving
-    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf, enc->buf_size);
+    enc->recv_pending = 0;
+    start_recv(enc);
     
     DebugObject_Init(&enc->d_obj);
     
@@ -177,6 +257,7 @@ void PacketProtoDecoder_Reset (PacketProtoDecoder *enc)
 {
     DebugObject_Access(&enc->d_obj);
     
-    enc->buf_start += enc->buf_used;
+    // skip buffered data; receiving continues where it was
+    enc->buf_start = (enc->buf_start + enc->buf_used) % enc->buf_size;
     enc->buf_used = 0;
 }
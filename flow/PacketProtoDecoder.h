@@ -42,6 +42,8 @@
 #include <flow/StreamRecvInterface.h>
 #include <flow/PacketPassInterface.h>
 
+#define PACKETPROTODECODER_MAX_BATCH 32
+
 /**
  * Handler called when a protocol error occurs.
  * When an error occurs, the decoder is reset to the initial state.
@@ -56,9 +58,13 @@ typedef struct {
     void *user;
     PacketProtoDecoder_handler_error handler_error;
     int output_mtu;
+    int output_batch;
+    struct PacketPassInterface_packet batch[PACKETPROTODECODER_MAX_BATCH];
     int buf_size;
     int buf_start;
     int buf_used;
+    int buf_out;
+    int recv_pending;
     uint8_t *buf;
     DebugObject d_obj;
 } PacketProtoDecoder;
@@ -77,6 +83,19 @@ typedef struct {
  */
 int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error) WARN_UNUSED;
 
+/**
+ * Initializes the object, with a receive buffer of the given size.
+ * Data is received into a ring buffer, which keeps being filled while the
+ * output is processing packets; with a larger buffer, more packets can be
+ * received per read. Arguments other than buf_size are as in
+ * {@link PacketProtoDecoder_Init}.
+ *
+ * @param buf_size size of the ring buffer. It is raised as needed to hold
+ *                 a packet of the largest size.
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoDecoder_Init2 (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, int buf_size, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
@@ -80,3 +80,17 @@ BufferWriter * PacketProtoFlow_GetInput (PacketProtoFlow *o)
     
     return &o->ainput;
 }
+
+int PacketProtoFlow_EnableCoDel (PacketProtoFlow *o, int target, int interval)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return PacketBuffer_EnableCoDel(&o->buffer, target, interval);
+}
+
+uint64_t PacketProtoFlow_GetCoDelDrops (PacketProtoFlow *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return PacketBuffer_GetCoDelDrops(&o->buffer);
+}
@@ -80,4 +80,21 @@ void PacketProtoFlow_Free (PacketProtoFlow *o);
  */
 BufferWriter * PacketProtoFlow_GetInput (PacketProtoFlow *o);
 
+/**
+ * Enables CoDel active queue management on the buffer.
+ * See {@link PacketBuffer_EnableCoDel}.
+ * @param o the object
+ * @param target target queue delay in milliseconds. Must be >0.
+ * @param interval CoDel interval in milliseconds. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoFlow_EnableCoDel (PacketProtoFlow *o, int target, int interval) WARN_UNUSED;
+
+/**
+ * Returns the number of packets dropped by CoDel.
+ * @param o the object
+ * @return number of dropped packets, 0 if CoDel is not enabled
+ */
+uint64_t PacketProtoFlow_GetCoDelDrops (PacketProtoFlow *o);
+
 #endif
@@ -50,6 +50,10 @@ void _PacketRecvInterface_job_done (PacketRecvInterface *i)
     // set state
     i->state = PRI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Finish(&i->stats, i->job_done_len);
+    #endif
+    
     // call handler
     i->handler_done(i->user_user, i->job_done_len);
     return;
@@ -40,6 +40,7 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowStats.h>
 
 #define PRI_STATE_NONE 1
 #define PRI_STATE_OPERATION_PENDING 2
@@ -71,6 +72,10 @@ typedef struct {
     // state
     int state;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats stats;
+    #endif
+    
     DebugObject d_obj;
 } PacketRecvInterface;
 
@@ -86,6 +91,17 @@ static void PacketRecvInterface_Receiver_Init (PacketRecvInterface *i, PacketRec
 
 static void PacketRecvInterface_Receiver_Recv (PacketRecvInterface *i, uint8_t *data);
 
+/**
+ * Names the elements on the two sides of the interface for instrumentation
+ * (see {@link FlowStats}). Does nothing unless built with BADVPN_FLOW_STATS.
+ * 
+ * @param i the object
+ * @param prefix prefix of the names, or NULL for none
+ * @param from name of the element data comes from, or NULL to keep it
+ * @param to name of the element data goes to, or NULL to keep it
+ */
+static void PacketRecvInterface_SetStatsName (PacketRecvInterface *i, const char *prefix, const char *from, const char *to);
+
 void _PacketRecvInterface_job_operation (PacketRecvInterface *i);
 void _PacketRecvInterface_job_done (PacketRecvInterface *i);
 
@@ -108,6 +124,10 @@ void PacketRecvInterface_Init (PacketRecvInterface *i, int mtu, PacketRecvInterf
     // set state
     i->state = PRI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Init(&i->stats, FLOWSTATS_KIND_PACKETRECV);
+    #endif
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -115,6 +135,10 @@ void PacketRecvInterface_Free (PacketRecvInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Free(&i->stats);
+    #endif
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_operation);
@@ -163,8 +187,21 @@ void PacketRecvInterface_Receiver_Recv (PacketRecvInterface *i, uint8_t *data)
     i->job_operation_data = data;
     BPending_Set(&i->job_operation);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Start(&i->stats, 1, 0);
+    #endif
+    
     // set state
     i->state = PRI_STATE_OPERATION_PENDING;
 }
 
+void PacketRecvInterface_SetStatsName (PacketRecvInterface *i, const char *prefix, const char *from, const char *to)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_SetName(&i->stats, prefix, from, to);
+    #endif
+}
+
 #endif
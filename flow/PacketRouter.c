@@ -48,6 +48,9 @@ static void next_job_handler (PacketRouter *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    // finish routing a shared packet, in case the user hasn't
+    RouteBufferSource_FinishShared(&o->rbs);
+    
     // receive
     PacketRecvInterface_Receiver_Recv(o->input, RouteBufferSource_Pointer(&o->rbs) + o->recv_offset);
 }
@@ -122,6 +125,26 @@ int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, uint8_t *
     return 1;
 }
 
+int PacketRouter_RouteShared (PacketRouter *o, int len, RouteBuffer *output, int prefix_len)
+{
+    ASSERT(prefix_len >= 0)
+    ASSERT(len >= prefix_len)
+    ASSERT(len <= o->mtu)
+    ASSERT(RouteBuffer_GetMTU(output) == o->mtu)
+    ASSERT(BPending_IsSet(&o->next_job))
+    DebugObject_Access(&o->d_obj);
+    
+    return RouteBufferSource_RouteShared(&o->rbs, len, output, prefix_len);
+}
+
+void PacketRouter_FinishShared (PacketRouter *o)
+{
+    ASSERT(BPending_IsSet(&o->next_job))
+    DebugObject_Access(&o->d_obj);
+    
+    RouteBufferSource_FinishShared(&o->rbs);
+}
+
 void PacketRouter_AssertRoute (PacketRouter *o)
 {
     ASSERT(BPending_IsSet(&o->next_job))
@@ -116,6 +116,33 @@ void PacketRouter_Free (PacketRouter *o);
  */
 int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, uint8_t **next_buf, int copy_offset, int copy_len);
 
+/**
+ * Routes the current packet to the given buffer by reference, without copying
+ * anything but the first prefix_len bytes.
+ * Must be called from the job context of the {@link PacketRouter_handler} handler.
+ * The buffer pointer provided to the handler remains valid; the user may
+ * rewrite the first prefix_len bytes and route the packet further with this function.
+ * See {@link RouteBufferSource_RouteShared}.
+ * 
+ * @param o the object
+ * @param len total packet length. Must be >=prefix_len and <=mtu.
+ * @param output buffer to route to. Its MTU must be the same as of this object.
+ * @param prefix_len number of bytes at the beginning of the packet which are
+ *                   specific to this buffer. Must be >=0.
+ * @return 1 on success, 0 on failure (buffer full)
+ */
+int PacketRouter_RouteShared (PacketRouter *o, int len, RouteBuffer *output, int prefix_len);
+
+/**
+ * Finishes routing the current packet with {@link PacketRouter_RouteShared}.
+ * Must be called from the job context of the {@link PacketRouter_handler} handler.
+ * After this, the buffer pointer provided to the handler is no longer valid.
+ * If not called, this is done automatically before the next packet is received.
+ * 
+ * @param o the object
+ */
+void PacketRouter_FinishShared (PacketRouter *o);
+
 /**
  * Asserts that {@link PacketRouter_Route} can be called.
  * 
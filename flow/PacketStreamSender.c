@@ -28,23 +28,137 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <misc/debug.h>
+#include <misc/balloc.h>
 
 #include <flow/PacketStreamSender.h>
 
+static void buffer_input (PacketStreamSender *s);
+
+// moves on to the next packet of an input batch, returns 0 if there is none
+static int next_input (PacketStreamSender *s)
+{
+    ASSERT(s->in_len >= 0)
+    ASSERT(s->batch_left >= 0)
+    
+    if (s->batch_left == 0) {
+        return 0;
+    }
+    
+    s->in_len = s->batch->len;
+    s->in = s->batch->data;
+    s->in_used = 0;
+    s->batch++;
+    s->batch_left--;
+    
+    return 1;
+}
+
 static void send_data (PacketStreamSender *s)
 {
     ASSERT(s->in_len >= 0)
+    ASSERT(!s->buf_sending)
+    
+    // skip finished packets
+    while (s->in_used == s->in_len) {
+        if (!next_input(s)) {
+            // finish input
+            s->in_len = -1;
+            PacketPassInterface_Done(&s->input);
+            return;
+        }
+        
+        // coalesce the next packet
+        if (s->buf_size > 0) {
+            buffer_input(s);
+            return;
+        }
+    }
+    
+    // send more data
+    StreamPassInterface_Sender_Send(s->output, s->in + s->in_used, s->in_len - s->in_used);
+}
+
+static void send_buf (PacketStreamSender *s)
+{
+    ASSERT(s->buf_size > 0)
+    ASSERT(!s->buf_sending)
+    ASSERT(s->buf_used > 0)
+    
+    // set sending buffer
+    s->buf_sending = 1;
+    
+    // send buffered data
+    StreamPassInterface_Sender_Send(s->output, s->buf, s->buf_used);
+}
+
+static void send_buf_and_input (PacketStreamSender *s)
+{
+    ASSERT(s->buf_size > 0)
+    ASSERT(!s->buf_sending)
+    ASSERT(s->buf_used > 0)
+    ASSERT(s->in_len > 0)
+    ASSERT(s->in_used == 0)
+    
+    // set sending buffer, followed by the input packet
+    s->buf_sending = 1;
+    s->vec_sending = 1;
+    
+    // send buffered data and the packet together, without copying the packet
+    struct StreamPassInterface_vec vec[2];
+    vec[0].data = s->buf;
+    vec[0].len = s->buf_used;
+    vec[1].data = s->in;
+    vec[1].len = s->in_len;
+    StreamPassInterface_Sender_SendVec(s->output, vec, 2);
+}
+
+static void buffer_input (PacketStreamSender *s)
+{
+    ASSERT(s->buf_size > 0)
+    ASSERT(s->in_len >= 0)
+    ASSERT(s->in_used == 0)
     
-    if (s->in_used < s->in_len) {
-        // send more data
-        StreamPassInterface_Sender_Send(s->output, s->in + s->in_used, s->in_len - s->in_used);
-    } else {
-        // finish input packet
+    // while packets fit, copy them and accept them right away
+    while (s->in_len <= s->buf_size - s->buf_used) {
+        memcpy(s->buf + s->buf_used, s->in, s->in_len);
+        s->buf_used += s->in_len;
+        
+        if (next_input(s)) {
+            continue;
+        }
         s->in_len = -1;
+        
+        // send once the input has nothing more for us; this job was set
+        // before the input is informed, so it runs after the input's job
+        if (!s->buf_sending) {
+            BPending_Set(&s->flush_job);
+        }
+        
         PacketPassInterface_Done(&s->input);
+        return;
+    }
+    
+    // doesn't fit; wait until the output is done with the buffer
+    if (s->buf_sending) {
+        return;
+    }
+    
+    // send buffered data first, or along with the packet if the output can
+    if (s->buf_used > 0) {
+        BPending_Unset(&s->flush_job);
+        if (StreamPassInterface_HasVec(s->output)) {
+            send_buf_and_input(s);
+        } else {
+            send_buf(s);
+        }
+        return;
     }
+    
+    // packet is larger than the buffer, send it directly
+    send_data(s);
 }
 
 static void input_handler_send (PacketStreamSender *s, uint8_t *data, int data_len)
@@ -57,6 +171,36 @@ static void input_handler_send (PacketStreamSender *s, uint8_t *data, int data_l
     s->in_len = data_len;
     s->in = data;
     s->in_used = 0;
+    s->batch_left = 0;
+    
+    // coalesce
+    if (s->buf_size > 0) {
+        buffer_input(s);
+        return;
+    }
+    
+    // send
+    send_data(s);
+}
+
+static void input_handler_send_batch (PacketStreamSender *s, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    ASSERT(s->in_len == -1)
+    ASSERT(num_packets > 0)
+    DebugObject_Access(&s->d_obj);
+    
+    // set first input packet, remember the rest
+    s->in_len = packets[0].len;
+    s->in = packets[0].data;
+    s->in_used = 0;
+    s->batch = packets + 1;
+    s->batch_left = num_packets - 1;
+    
+    // coalesce
+    if (s->buf_size > 0) {
+        buffer_input(s);
+        return;
+    }
     
     // send
     send_data(s);
@@ -64,11 +208,54 @@ static void input_handler_send (PacketStreamSender *s, uint8_t *data, int data_l
 
 static void output_handler_done (PacketStreamSender *s, int data_len)
 {
-    ASSERT(s->in_len >= 0)
     ASSERT(data_len > 0)
-    ASSERT(data_len <= s->in_len - s->in_used)
     DebugObject_Access(&s->d_obj);
     
+    if (s->buf_sending) {
+        int buf_sent = data_len;
+        
+        // anything past the buffer came from the input packet
+        if (s->vec_sending) {
+            ASSERT(s->in_len >= 0)
+            ASSERT(data_len <= s->buf_used + s->in_len)
+            s->vec_sending = 0;
+            if (buf_sent > s->buf_used) {
+                s->in_used = buf_sent - s->buf_used;
+                buf_sent = s->buf_used;
+            }
+        }
+        
+        ASSERT(buf_sent <= s->buf_used)
+        
+        // set not sending buffer
+        s->buf_sending = 0;
+        
+        // move unsent and newly buffered data to the start
+        s->buf_used -= buf_sent;
+        memmove(s->buf, s->buf + buf_sent, s->buf_used);
+        
+        // send the rest
+        if (s->buf_used > 0) {
+            send_buf(s);
+            return;
+        }
+        
+        // continue a packet which is being sent directly
+        if (s->in_len >= 0 && s->in_used > 0) {
+            send_data(s);
+            return;
+        }
+        
+        // buffer a packet which was waiting for room
+        if (s->in_len >= 0) {
+            buffer_input(s);
+        }
+        return;
+    }
+    
+    ASSERT(s->in_len >= 0)
+    ASSERT(data_len <= s->in_len - s->in_used)
+    
     // update number of bytes sent
     s->in_used += data_len;
     
@@ -76,31 +263,84 @@ static void output_handler_done (PacketStreamSender *s, int data_len)
     send_data(s);
 }
 
-void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg)
+static void flush_job_handler (PacketStreamSender *s)
 {
-    ASSERT(mtu >= 0)
+    ASSERT(s->buf_size > 0)
+    ASSERT(!s->buf_sending)
+    ASSERT(s->buf_used > 0)
+    DebugObject_Access(&s->d_obj);
     
+    send_buf(s);
+}
+
+static void init_common (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg)
+{
     // init arguments
     s->output = output;
     
     // init input
     PacketPassInterface_Init(&s->input, mtu, (PacketPassInterface_handler_send)input_handler_send, s, pg);
+    PacketPassInterface_EnableBatch(&s->input, (PacketPassInterface_handler_send_batch)input_handler_send_batch);
     
     // init output
     StreamPassInterface_Sender_Init(s->output, (StreamPassInterface_handler_done)output_handler_done, s);
     
+    // init flush job
+    BPending_Init(&s->flush_job, pg, (BPending_handler)flush_job_handler, s);
+    
     // have no input packet
     s->in_len = -1;
     
+    // buffer is empty
+    s->buf_used = 0;
+    s->buf_sending = 0;
+    s->vec_sending = 0;
+    
     DebugObject_Init(&s->d_obj);
 }
 
+void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg)
+{
+    ASSERT(mtu >= 0)
+    
+    // no coalescing
+    s->buf_size = 0;
+    s->buf = NULL;
+    
+    init_common(s, output, mtu, pg);
+}
+
+int PacketStreamSender_Init2 (PacketStreamSender *s, StreamPassInterface *output, int mtu, int buf_size, BPendingGroup *pg)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(buf_size >= 0)
+    
+    // allocate buffer
+    s->buf_size = buf_size;
+    s->arena = BPendingGroup_Arena(pg);
+    s->buf = NULL;
+    if (s->buf_size > 0 && !(s->buf = (uint8_t *)BArena_Alloc(s->arena, s->buf_size))) {
+        return 0;
+    }
+    
+    init_common(s, output, mtu, pg);
+    return 1;
+}
+
 void PacketStreamSender_Free (PacketStreamSender *s)
 {
     DebugObject_Free(&s->d_obj);
     
+    // free flush job
+    BPending_Free(&s->flush_job);
+    
     // free input
     PacketPassInterface_Free(&s->input);
+    
+    // free buffer
+    if (s->buf) {
+        BArena_Release(s->arena, s->buf, s->buf_size);
+    }
 }
 
 PacketPassInterface * PacketStreamSender_GetInput (PacketStreamSender *s)
@@ -30,6 +30,8 @@
  * 
  * Object which forwards packets obtained with {@link PacketPassInterface}
  * as a stream with {@link StreamPassInterface} (i.e. it concatenates them).
+ * Optionally, packets can be coalesced in a buffer so that several of them
+ * go out with a single send.
  */
 
 #ifndef BADVPN_FLOW_PACKETSTREAMSENDER_H
@@ -37,7 +39,9 @@
 
 #include <stdint.h>
 
+#include <misc/debug.h>
 #include <base/DebugObject.h>
+#include <base/BPending.h>
 #include <flow/PacketPassInterface.h>
 #include <flow/StreamPassInterface.h>
 
@@ -52,6 +56,15 @@ typedef struct {
     int in_len;
     uint8_t *in;
     int in_used;
+    struct PacketPassInterface_packet *batch;
+    int batch_left;
+    int buf_size;
+    BArena *arena;
+    uint8_t *buf;
+    int buf_used;
+    int buf_sending;
+    int vec_sending;
+    BPending flush_job;
 } PacketStreamSender;
 
 /**
@@ -64,6 +77,26 @@ typedef struct {
  */
 void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg);
 
+/**
+ * Initializes the object, optionally with coalescing.
+ * 
+ * With buf_size>0, input packets which fit into the remaining space of a buffer
+ * of buf_size bytes are copied there and accepted immediately. The buffer is
+ * sent once the input has nothing more to pass on right away, or when the next
+ * packet doesn't fit. Packets larger than the buffer are sent directly, after
+ * the buffer has been sent. If the output accepts vectored sends
+ * ({@link StreamPassInterface_HasVec}), a packet which doesn't fit goes out
+ * together with the buffered data in one send, without being copied.
+ *
+ * @param s the object
+ * @param output output interface
+ * @param mtu input MTU. Must be >=0.
+ * @param buf_size size of coalescing buffer. Must be >=0; 0 disables coalescing.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketStreamSender_Init2 (PacketStreamSender *s, StreamPassInterface *output, int mtu, int buf_size, BPendingGroup *pg) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
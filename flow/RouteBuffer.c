@@ -33,6 +33,8 @@
 
 #include <misc/offset.h>
 
+#include <flow/FlowStats.h>
+
 #include <flow/RouteBuffer.h>
 
 static struct RouteBuffer_packet * alloc_packet (int mtu)
@@ -47,9 +49,27 @@ static struct RouteBuffer_packet * alloc_packet (int mtu)
         return NULL;
     }
     
+    // set not shared
+    p->shared = NULL;
+    p->refcnt = 0;
+    p->locked = 0;
+    
     return p;
 }
 
+static void unref_shared (struct RouteBuffer_packet *s)
+{
+    ASSERT(s->refcnt > 0)
+    
+    s->refcnt--;
+    
+    // free the packet if it's no longer referenced, unless it's still
+    // the current packet of a source
+    if (s->refcnt == 0 && !s->locked) {
+        free(s);
+    }
+}
+
 static int alloc_free_packet (RouteBuffer *o)
 {
     struct RouteBuffer_packet *p = alloc_packet(o->mtu);
@@ -87,6 +107,16 @@ static void release_used_packet (RouteBuffer *o)
     // remove from used packets list
     LinkedList1_Remove(&o->packets_used, &p->node);
     
+    // release shared packet
+    if (p->shared) {
+        if (o->sending_shared) {
+            p->shared->locked = 0;
+            o->sending_shared = 0;
+        }
+        unref_shared(p->shared);
+        p->shared = NULL;
+    }
+    
     // add to free packets list
     LinkedList1_Append(&o->packets_free, &p->node);
 }
@@ -97,9 +127,45 @@ static void send_used_packet (RouteBuffer *o)
     
     // get packet
     struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
+    uint8_t *data = (uint8_t *)(p + 1);
+    
+    if (p->shared) {
+        struct RouteBuffer_packet *s = p->shared;
+        
+        if (!s->locked) {
+            // send the shared packet directly, with our prefix in front
+            memcpy((uint8_t *)(s + 1), data, p->prefix_len);
+            s->locked = 1;
+            o->sending_shared = 1;
+            data = (uint8_t *)(s + 1);
+        } else {
+            // shared packet is in use, copy it into our own packet
+            memcpy(data + p->prefix_len, (uint8_t *)(s + 1) + p->prefix_len, p->len - p->prefix_len);
+            unref_shared(s);
+            p->shared = NULL;
+        }
+    }
     
     // send
-    PacketPassInterface_Sender_Send(o->output, (uint8_t *)(p + 1), p->len);
+    PacketPassInterface_Sender_Send(o->output, data, p->len);
+}
+
+static void codel_drop_packets (RouteBuffer *o)
+{
+    ASSERT(o->codel_enabled)
+    
+    uint64_t now = FlowStats_Now();
+    
+    while (!LinkedList1_IsEmpty(&o->packets_used)) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->packets_used);
+        struct RouteBuffer_packet *p = UPPER_OBJECT(node, struct RouteBuffer_packet, node);
+        
+        if (!CoDel_ShouldDrop(&o->codel, now, p->time, !LinkedList1Node_Next(node))) {
+            break;
+        }
+        
+        release_used_packet(o);
+    }
 }
 
 static void output_handler_done (RouteBuffer *o)
@@ -110,6 +176,11 @@ static void output_handler_done (RouteBuffer *o)
     // release packet
     release_used_packet(o);
     
+    // drop packets which have been waiting too long
+    if (o->codel_enabled) {
+        codel_drop_packets(o);
+    }
+    
     // send next packet if there is one
     if (!LinkedList1_IsEmpty(&o->packets_used)) {
         send_used_packet(o);
@@ -135,6 +206,12 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
     // init used packets list
     LinkedList1_Init(&o->packets_used);
     
+    // set not sending a shared packet
+    o->sending_shared = 0;
+    
+    // set CoDel disabled
+    o->codel_enabled = 0;
+    
     // allocate packets
     for (int i = 0; i < buf_size; i++) {
         if (!alloc_free_packet(o)) {
@@ -164,6 +241,25 @@ void RouteBuffer_Free (RouteBuffer *o)
     free_free_packets(o);
 }
 
+void RouteBuffer_EnableCoDel (RouteBuffer *o, int target, int interval)
+{
+    ASSERT(target > 0)
+    ASSERT(interval > 0)
+    ASSERT(!o->codel_enabled)
+    ASSERT(LinkedList1_IsEmpty(&o->packets_used))
+    DebugObject_Access(&o->d_obj);
+    
+    o->codel_enabled = 1;
+    CoDel_Init(&o->codel, (uint64_t)target * 1000000, (uint64_t)interval * 1000000);
+}
+
+uint64_t RouteBuffer_GetCoDelDrops (RouteBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return (o->codel_enabled ? CoDel_GetDrops(&o->codel) : 0);
+}
+
 int RouteBuffer_GetMTU (RouteBuffer *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -183,10 +279,17 @@ int RouteBufferSource_Init (RouteBufferSource *o, int mtu)
         goto fail0;
     }
     
+    // allocate spare packet
+    if (!(o->spare_packet = alloc_packet(o->mtu))) {
+        goto fail1;
+    }
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail1:
+    free(o->current_packet);
 fail0:
     return 0;
 }
@@ -195,8 +298,16 @@ void RouteBufferSource_Free (RouteBufferSource *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // free current packet
-    free(o->current_packet);
+    // free spare packet
+    if (o->spare_packet) {
+        free(o->spare_packet);
+    }
+    
+    // free current packet, or leave it to the buffers referencing it
+    o->current_packet->locked = 0;
+    if (o->current_packet->refcnt == 0) {
+        free(o->current_packet);
+    }
 }
 
 uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o)
@@ -215,6 +326,7 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     ASSERT(copy_offset <= o->mtu)
     ASSERT(copy_len >= 0)
     ASSERT(copy_len <= o->mtu - copy_offset)
+    ASSERT(o->current_packet->refcnt == 0)
     DebugObject_Access(&b->d_obj);
     DebugObject_Access(&o->d_obj);
     
@@ -230,6 +342,11 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     // set packet length
     p->len = len;
     
+    // timestamp packet for CoDel
+    if (b->codel_enabled) {
+        p->time = FlowStats_Now();
+    }
+    
     // append packet to used packets list
     LinkedList1_Append(&b->packets_used, &p->node);
     
@@ -254,3 +371,82 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     
     return 1;
 }
+
+int RouteBufferSource_RouteShared (RouteBufferSource *o, int len, RouteBuffer *b, int prefix_len)
+{
+    ASSERT(prefix_len >= 0)
+    ASSERT(len >= prefix_len)
+    ASSERT(len <= o->mtu)
+    ASSERT(b->mtu == o->mtu)
+    DebugObject_Access(&b->d_obj);
+    DebugObject_Access(&o->d_obj);
+    
+    struct RouteBuffer_packet *s = o->current_packet;
+    
+    // make sure there will be a new current packet when routing is finished,
+    // or copy the packet instead
+    if (s->refcnt == 0 && !o->spare_packet && !(o->spare_packet = alloc_packet(o->mtu))) {
+        return RouteBufferSource_Route(o, len, b, prefix_len, len - prefix_len);
+    }
+    
+    // check if there's space in the buffer
+    if (LinkedList1_IsEmpty(&b->packets_free)) {
+        return 0;
+    }
+    
+    int was_empty = LinkedList1_IsEmpty(&b->packets_used);
+    
+    // get a free packet
+    struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetLast(&b->packets_free), struct RouteBuffer_packet, node);
+    
+    // remove it from free packets list
+    LinkedList1_Remove(&b->packets_free, &p->node);
+    
+    // make it reference the current packet, copying only the prefix
+    p->len = len;
+    p->shared = s;
+    p->prefix_len = prefix_len;
+    memcpy((uint8_t *)(p + 1), (uint8_t *)(s + 1), prefix_len);
+    
+    // timestamp packet for CoDel
+    if (b->codel_enabled) {
+        p->time = FlowStats_Now();
+    }
+    
+    // reference the current packet; it stays locked until routing is finished
+    s->refcnt++;
+    s->locked = 1;
+    
+    // append packet to used packets list
+    LinkedList1_Append(&b->packets_used, &p->node);
+    
+    // start sending if required. This copies the packet since it's locked.
+    if (was_empty) {
+        send_used_packet(b);
+    }
+    
+    return 1;
+}
+
+void RouteBufferSource_FinishShared (RouteBufferSource *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct RouteBuffer_packet *s = o->current_packet;
+    
+    // unlock packet so buffers can send it
+    s->locked = 0;
+    
+    if (s->refcnt == 0) {
+        return;
+    }
+    
+    ASSERT(o->spare_packet)
+    
+    // the buffers now own the packet, continue with the spare one
+    o->current_packet = o->spare_packet;
+    
+    // allocate a new spare packet. If this fails, it will be retried
+    // when needed.
+    o->spare_packet = alloc_packet(o->mtu);
+}
@@ -38,22 +38,36 @@
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <flow/PacketPassInterface.h>
+#include <flow/CoDel.h>
 
 struct RouteBuffer_packet {
     LinkedList1Node node;
     int len;
+    uint64_t time;
+    struct RouteBuffer_packet *shared;
+    int prefix_len;
+    int refcnt;
+    int locked;
 };
 
 /**
  * Packet buffer for zero-copy packet routing.
  * 
  * Packets are buffered using {@link RouteBufferSource} objects.
+ * A buffered packet either owns its data, or references the data of a packet
+ * shared between multiple buffers (see {@link RouteBufferSource_RouteShared}),
+ * in which case the buffer only holds a copy of the packet's prefix. A shared
+ * packet is sent out directly, with the prefix written in front of it, unless
+ * another buffer is currently sending it; then its data is copied.
  */
 typedef struct {
     int mtu;
     PacketPassInterface *output;
     LinkedList1 packets_free;
     LinkedList1 packets_used;
+    int sending_shared;
+    int codel_enabled;
+    struct CoDel codel;
     DebugObject d_obj;
 } RouteBuffer;
 
@@ -66,6 +80,7 @@ typedef struct {
 typedef struct {
     int mtu;
     struct RouteBuffer_packet *current_packet;
+    struct RouteBuffer_packet *spare_packet;
     DebugObject d_obj;
 } RouteBufferSource;
 
@@ -86,6 +101,26 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
  */
 void RouteBuffer_Free (RouteBuffer *o);
 
+/**
+ * Enables CoDel active queue management (see {@link CoDel}).
+ * Packets are timestamped when routed to the buffer, and packets which
+ * have been waiting too long are dropped instead of being sent.
+ * Must be called before any packets are routed to the buffer.
+ * 
+ * @param o the object
+ * @param target target queue delay in milliseconds. Must be >0.
+ * @param interval CoDel interval in milliseconds. Must be >0.
+ */
+void RouteBuffer_EnableCoDel (RouteBuffer *o, int target, int interval);
+
+/**
+ * Returns the number of packets dropped by CoDel.
+ * 
+ * @param o the object
+ * @return number of dropped packets, 0 if CoDel is not enabled
+ */
+uint64_t RouteBuffer_GetCoDelDrops (RouteBuffer *o);
+
 /**
  * Retuns the buffer's MTU (mtu argument to {@link RouteBuffer_Init}).
  * 
@@ -136,4 +171,35 @@ uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o);
  */
 int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len);
 
+/**
+ * Routes the current packet to a given buffer by reference, so that the same
+ * packet can be routed to more buffers without copying it.
+ * Only the first prefix_len bytes (e.g. a per-destination header) are copied
+ * to the buffer. The current packet remains current, and the pointer returned
+ * from {@link RouteBufferSource_Pointer} remains valid; the user may rewrite
+ * the prefix before routing the packet further, but not the rest of the packet.
+ * Once the user is done routing the packet, {@link RouteBufferSource_FinishShared}
+ * must be called before the current packet is written again.
+ * If memory for a new current packet cannot be allocated, this falls back to
+ * copying, as {@link RouteBufferSource_Route} would.
+ * 
+ * @param o the object
+ * @param len length of the packet. Must be >=prefix_len and <=MTU.
+ * @param b buffer to route to. Its MTU must equal this object's MTU.
+ * @param prefix_len number of bytes at the beginning of the packet which are
+ *                   specific to this buffer. Must be >=0.
+ * @return 1 on success, 0 on failure
+ */
+int RouteBufferSource_RouteShared (RouteBufferSource *o, int len, RouteBuffer *b, int prefix_len);
+
+/**
+ * Finishes routing the current packet with {@link RouteBufferSource_RouteShared}.
+ * If the packet has been routed to any buffer, the buffers take over the packet,
+ * and a new current packet is provided. Otherwise this does nothing.
+ * The contents of the new current packet are undefined.
+ * 
+ * @param o the object
+ */
+void RouteBufferSource_FinishShared (RouteBufferSource *o);
+
 #endif
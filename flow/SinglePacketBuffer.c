@@ -55,6 +55,7 @@ int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input,
     // init arguments
     o->input = input;
     o->output = output;
+    o->arena = BPendingGroup_Arena(pg);
     
     // init input
     PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
@@ -63,7 +64,7 @@ int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input,
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
     // init buffer
-    if (!(o->buf = (uint8_t *)BAlloc(PacketRecvInterface_GetMTU(o->input)))) {
+    if (!(o->buf = (uint8_t *)BArena_Alloc(o->arena, PacketRecvInterface_GetMTU(o->input)))) {
         goto fail1;
     }
     
@@ -83,5 +84,5 @@ void SinglePacketBuffer_Free (SinglePacketBuffer *o)
     DebugObject_Free(&o->d_obj);
     
     // free buffer
-    BFree(o->buf);
+    BArena_Release(o->arena, o->buf, PacketRecvInterface_GetMTU(o->input));
 }
@@ -50,6 +50,7 @@ typedef struct {
     DebugObject d_obj;
     PacketRecvInterface *input;
     PacketPassInterface *output;
+    BArena *arena;
     uint8_t *buf;
 } SinglePacketBuffer;
 
@@ -38,6 +38,10 @@ void _StreamPassInterface_job_operation (StreamPassInterface *i)
     i->state = SPI_STATE_BUSY;
     
     // call handler
+    if (i->job_operation_vec_count > 0) {
+        i->handler_operation_vec(i->user_provider, i->job_operation_vec, i->job_operation_vec_count);
+        return;
+    }
     i->handler_operation(i->user_provider, i->job_operation_data, i->job_operation_len);
     return;
 }
@@ -50,6 +54,10 @@ void _StreamPassInterface_job_done (StreamPassInterface *i)
     // set state
     i->state = SPI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Finish(&i->stats, i->job_done_len);
+    #endif
+    
     // call handler
     i->handler_done(i->user_user, i->job_done_len);
     return;
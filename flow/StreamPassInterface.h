@@ -41,23 +41,38 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowStats.h>
 
 #define SPI_STATE_NONE 1
 #define SPI_STATE_OPERATION_PENDING 2
 #define SPI_STATE_BUSY 3
 #define SPI_STATE_DONE_PENDING 4
 
+#define STREAMPASSINTERFACE_MAX_VEC 8
+
+/**
+ * One piece of a vectored send, see {@link StreamPassInterface_Sender_SendVec}.
+ */
+struct StreamPassInterface_vec {
+    uint8_t *data;
+    int len;
+};
+
 typedef void (*StreamPassInterface_handler_send) (void *user, uint8_t *data, int data_len);
 
+typedef void (*StreamPassInterface_handler_send_vec) (void *user, struct StreamPassInterface_vec *vec, int vec_count);
+
 typedef void (*StreamPassInterface_handler_done) (void *user, int data_len);
 
 typedef struct {
     // provider data
     StreamPassInterface_handler_send handler_operation;
+    StreamPassInterface_handler_send_vec handler_operation_vec;
     void *user_provider;
     
     // user data
@@ -68,6 +83,8 @@ typedef struct {
     BPending job_operation;
     uint8_t *job_operation_data;
     int job_operation_len;
+    struct StreamPassInterface_vec job_operation_vec[STREAMPASSINTERFACE_MAX_VEC];
+    int job_operation_vec_count;
     
     // done job
     BPending job_done;
@@ -76,6 +93,10 @@ typedef struct {
     // state
     int state;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats stats;
+    #endif
+    
     DebugObject d_obj;
 } StreamPassInterface;
 
@@ -83,12 +104,49 @@ static void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterfac
 
 static void StreamPassInterface_Free (StreamPassInterface *i);
 
+/**
+ * Lets the provider accept vectored sends. May only be called right after
+ * {@link StreamPassInterface_Init}, before the sender is set up. The handler
+ * is called instead of the normal one for {@link StreamPassInterface_Sender_SendVec},
+ * and the provider reports the total number of bytes it accepted, counting
+ * from the start of the first piece, with {@link StreamPassInterface_Done}.
+ */
+static void StreamPassInterface_EnableVec (StreamPassInterface *i, StreamPassInterface_handler_send_vec handler_operation_vec);
+
 static void StreamPassInterface_Done (StreamPassInterface *i, int data_len);
 
 static void StreamPassInterface_Sender_Init (StreamPassInterface *i, StreamPassInterface_handler_done handler_done, void *user);
 
 static void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int data_len);
 
+/**
+ * Returns whether the provider accepts vectored sends.
+ */
+static int StreamPassInterface_HasVec (StreamPassInterface *i);
+
+/**
+ * Sends data gathered from several buffers, as if they were contiguous.
+ * The provider must accept vectored sends (see {@link StreamPassInterface_HasVec}).
+ * The vector itself is copied, but the buffers it points to must stay valid
+ * until the done handler is called.
+ * 
+ * @param i the object
+ * @param vec pieces to send; each must have len>0
+ * @param vec_count number of pieces, 1 to STREAMPASSINTERFACE_MAX_VEC
+ */
+static void StreamPassInterface_Sender_SendVec (StreamPassInterface *i, const struct StreamPassInterface_vec *vec, int vec_count);
+
+/**
+ * Names the elements on the two sides of the interface for instrumentation
+ * (see {@link FlowStats}). Does nothing unless built with BADVPN_FLOW_STATS.
+ * 
+ * @param i the object
+ * @param prefix prefix of the names, or NULL for none
+ * @param from name of the element data comes from, or NULL to keep it
+ * @param to name of the element data goes to, or NULL to keep it
+ */
+static void StreamPassInterface_SetStatsName (StreamPassInterface *i, const char *prefix, const char *from, const char *to);
+
 void _StreamPassInterface_job_operation (StreamPassInterface *i);
 void _StreamPassInterface_job_done (StreamPassInterface *i);
 
@@ -96,6 +154,7 @@ void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterface_handl
 {
     // init arguments
     i->handler_operation = handler_operation;
+    i->handler_operation_vec = NULL;
     i->user_provider = user;
     
     // set no user
@@ -108,6 +167,10 @@ void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterface_handl
     // set state
     i->state = SPI_STATE_NONE;
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Init(&i->stats, FLOWSTATS_KIND_STREAMPASS);
+    #endif
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -115,11 +178,26 @@ void StreamPassInterface_Free (StreamPassInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Free(&i->stats);
+    #endif
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_operation);
 }
 
+void StreamPassInterface_EnableVec (StreamPassInterface *i, StreamPassInterface_handler_send_vec handler_operation_vec)
+{
+    ASSERT(handler_operation_vec)
+    ASSERT(!i->handler_operation_vec)
+    ASSERT(!i->handler_done)
+    ASSERT(i->state == SPI_STATE_NONE)
+    DebugObject_Access(&i->d_obj);
+    
+    i->handler_operation_vec = handler_operation_vec;
+}
+
 void StreamPassInterface_Done (StreamPassInterface *i, int data_len)
 {
     ASSERT(i->state == SPI_STATE_BUSY)
@@ -156,10 +234,63 @@ void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int
     // schedule operation
     i->job_operation_data = data;
     i->job_operation_len = data_len;
+    i->job_operation_vec_count = 0;
     BPending_Set(&i->job_operation);
     
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Start(&i->stats, data_len, 0);
+    #endif
+    
     // set state
     i->state = SPI_STATE_OPERATION_PENDING;
 }
 
+int StreamPassInterface_HasVec (StreamPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return !!i->handler_operation_vec;
+}
+
+void StreamPassInterface_Sender_SendVec (StreamPassInterface *i, const struct StreamPassInterface_vec *vec, int vec_count)
+{
+    ASSERT(vec_count > 0)
+    ASSERT(vec_count <= STREAMPASSINTERFACE_MAX_VEC)
+    ASSERT(i->handler_operation_vec)
+    ASSERT(i->state == SPI_STATE_NONE)
+    ASSERT(i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+    // remember pieces and total length
+    int total = 0;
+    for (int j = 0; j < vec_count; j++) {
+        ASSERT(vec[j].data)
+        ASSERT(vec[j].len > 0)
+        ASSERT(vec[j].len <= INT_MAX - total)
+        i->job_operation_vec[j] = vec[j];
+        total += vec[j].len;
+    }
+    i->job_operation_vec_count = vec_count;
+    i->job_operation_len = total;
+    
+    // schedule operation
+    BPending_Set(&i->job_operation);
+    
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_Start(&i->stats, total, 0);
+    #endif
+    
+    // set state
+    i->state = SPI_STATE_OPERATION_PENDING;
+}
+
+void StreamPassInterface_SetStatsName (StreamPassInterface *i, const char *prefix, const char *from, const char *to)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    #ifdef BADVPN_FLOW_STATS
+    FlowStats_SetName(&i->stats, prefix, from, to);
+    #endif
+}
+
 #endif
@@ -29,6 +29,23 @@
 
 #include "PacketPassInactivityMonitor.h"
 
+static void set_timer (PacketPassInactivityMonitor *o, btime_t time)
+{
+    // round up to the next slot
+    btime_t slot = o->interval / PACKETPASSINACTIVITYMONITOR_SLOTS;
+    if (slot > 1) {
+        btime_t rem = time % slot;
+        if (rem < 0) {
+            rem += slot;
+        }
+        if (rem > 0) {
+            time += slot - rem;
+        }
+    }
+    
+    BReactor_SetTimerAbsolute(o->reactor, &o->timer, time);
+}
+
 static void input_handler_send (PacketPassInactivityMonitor *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
@@ -36,8 +53,8 @@ static void input_handler_send (PacketPassInactivityMonitor *o, uint8_t *data, i
     // schedule send
     PacketPassInterface_Sender_Send(o->output, data, data_len);
     
-    // stop timer
-    BReactor_RemoveTimer(o->reactor, &o->timer);
+    // output busy; the timer is left running and checks this when it expires
+    o->busy = 1;
 }
 
 static void input_handler_requestcancel (PacketPassInactivityMonitor *o)
@@ -52,8 +69,9 @@ static void output_handler_done (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    // output no longer busy, restart timer
-    BReactor_SetTimer(o->reactor, &o->timer);
+    // output no longer busy, remember when
+    o->busy = 0;
+    o->last_time = BReactor_GetTime(o->reactor);
     
     // call done
     PacketPassInterface_Done(&o->input);
@@ -63,8 +81,27 @@ static void timer_handler (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    btime_t now = BReactor_GetTime(o->reactor);
+    
+    if (!o->forced) {
+        // still sending, check again after another interval
+        if (o->busy) {
+            set_timer(o, now + o->interval);
+            return;
+        }
+        
+        // there was activity since the timer was set, wait for the real deadline
+        btime_t deadline = o->last_time + o->interval;
+        if (deadline > now) {
+            set_timer(o, deadline);
+            return;
+        }
+    }
+    
     // restart timer
-    BReactor_SetTimer(o->reactor, &o->timer);
+    o->forced = 0;
+    o->last_time = now;
+    set_timer(o, now + o->interval);
     
     // call handler
     if (o->handler) {
@@ -80,6 +117,7 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     o->reactor = reactor;
     o->handler = handler;
     o->user = user;
+    o->interval = interval;
     
     // init input
     PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(o->reactor));
@@ -92,7 +130,10 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     
     // init timer
     BTimer_Init(&o->timer, interval, (BTimer_handler)timer_handler, o);
-    BReactor_SetTimer(o->reactor, &o->timer);
+    o->last_time = BReactor_GetTime(o->reactor);
+    o->busy = 0;
+    o->forced = 0;
+    set_timer(o, o->last_time + o->interval);
     
     DebugObject_Init(&o->d_obj);
 }
@@ -123,9 +164,23 @@ void PacketPassInactivityMonitor_SetHandler (PacketPassInactivityMonitor *o, Pac
     o->user = user;
 }
 
+void PacketPassInactivityMonitor_SetInterval (PacketPassInactivityMonitor *o, btime_t interval)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->interval = interval;
+    
+    // a forced report is already due; otherwise move the timer to the new
+    // deadline, the timer handler takes care of a packet being sent
+    if (!o->forced) {
+        set_timer(o, o->last_time + o->interval);
+    }
+}
+
 void PacketPassInactivityMonitor_Force (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    o->forced = 1;
     BReactor_SetTimerAfter(o->reactor, &o->timer, 0);
 }
@@ -38,6 +38,14 @@
 #include <system/BReactor.h>
 #include <flow/PacketPassInterface.h>
 
+/**
+ * Expiry times are rounded up to slots of this fraction of the interval.
+ * Monitors with the same interval (e.g. the keepalives of all peers) then
+ * expire together in one reactor iteration instead of being spread across
+ * the interval, at the cost of reporting up to interval/SLOTS late.
+ */
+#define PACKETPASSINACTIVITYMONITOR_SLOTS 16
+
 /**
  * Handler function invoked when inactivity is detected.
  * It is guaranteed that the interfaces are in not sending state.
@@ -51,19 +59,31 @@ typedef void (*PacketPassInactivityMonitor_handler) (void *user);
  * It reports inactivity to a user provided handler function.
  *
  * The object behaves like that:
- * ("timer set" means started with the given timeout whether if was running or not,
- * "timer unset" means stopped if it was running)
- *     - There is a timer.
- *     - The timer is set when the object is initialized.
- *     - When the input calls Send, the call is passed on to the output.
- *       If the output accepted the packet, the timer is set. If the output
- *       blocked the packet, the timer is unset.
- *     - When the output calls Done, the timer is set, and the call is
+ * ("deadline set" means moved to one interval from now, "deadline unset"
+ * means there is no deadline while a packet is being sent)
+ *     - There is a deadline.
+ *     - The deadline is set when the object is initialized.
+ *     - When the input calls Send, the call is passed on to the output,
+ *       and the deadline is unset.
+ *     - When the output calls Done, the deadline is set, and the call is
  *       passed on to the input.
- *     - When the input calls Cancel, the timer is set, and the call is
- *       passed on to the output.
- *     - When the timer expires, the timer is set, ant the user's handler
- *       function is invoked.
+ *     - When the input calls Cancel, the call is passed on to the output.
+ *     - When the deadline passes, the deadline is set, and the user's
+ *       handler function is invoked.
+ *
+ * The deadline is tracked lazily. Send and Done only store a flag and the
+ * reactor's cached time (see {@link BReactor_GetTime}); they never touch
+ * the reactor's timers. A single timer runs all the time, and when it
+ * expires before the deadline (because there was activity since it was
+ * set) it is moved forward to the deadline. A busy flow thus costs one
+ * timer update per interval instead of two per packet. Expiry is rounded
+ * up to slots, see {@link PACKETPASSINACTIVITYMONITOR_SLOTS}.
+ *
+ * The monitor reads the reactor's cached time (see {@link BReactor_GetTime}),
+ * which is sampled when the reactor iteration starts. The time taken for a
+ * Done may thus be behind the actual time by as much as the iteration had
+ * already been running, and inactivity may be reported early by at most the
+ * duration of the iteration in which the last Done happened.
  */
 typedef struct {
     DebugObject d_obj;
@@ -73,6 +93,10 @@ typedef struct {
     void *user;
     PacketPassInterface input;
     BTimer timer;
+    btime_t interval;
+    btime_t last_time; // time of the last Done, or of the last report
+    int busy; // a packet is being sent
+    int forced; // the next expiry reports regardless of activity
 } PacketPassInactivityMonitor;
 
 /**
@@ -114,6 +138,16 @@ PacketPassInterface * PacketPassInactivityMonitor_GetInput (PacketPassInactivity
  */
 void PacketPassInactivityMonitor_SetHandler (PacketPassInactivityMonitor *o, PacketPassInactivityMonitor_handler handler, void *user);
 
+/**
+ * Changes the interval.
+ * The current deadline becomes one new interval after the last activity (or
+ * report); if that has already passed, inactivity is reported right away.
+ *
+ * @param o the object
+ * @param interval timer value in milliseconds
+ */
+void PacketPassInactivityMonitor_SetInterval (PacketPassInactivityMonitor *o, btime_t interval);
+
 /**
  * Sets the timer to expire immediately in order to force an inactivity report.
  * 
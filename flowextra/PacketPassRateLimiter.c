@@ -0,0 +1,217 @@
+/**
+ * @file PacketPassRateLimiter.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/debug.h>
+#include <misc/minmax.h>
+#include <system/BTime.h>
+
+#include "PacketPassRateLimiter.h"
+
+// credit is kept in thousandths of a byte, so that a rate in bytes per
+// second adds exactly "rate" units per millisecond
+#define CREDIT_SCALE 1000
+
+static uint64_t credit_max (PacketPassRateLimiter *o)
+{
+    return (uint64_t)o->burst * CREDIT_SCALE;
+}
+
+static void refill (PacketPassRateLimiter *o)
+{
+    btime_t now = btime_gettime();
+    
+    if (now > o->credit_time) {
+        uint64_t add = (uint64_t)(now - o->credit_time) * o->rate;
+        o->credit = bmin_uint64(credit_max(o), o->credit + add);
+    }
+    
+    o->credit_time = now;
+}
+
+static void try_send (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(!BTimer_IsRunning(&o->timer))
+    
+    if (o->rate > 0) {
+        refill(o);
+        
+        uint64_t cost = (uint64_t)o->in_len * CREDIT_SCALE;
+        
+        if (o->credit < cost) {
+            // wait until the bucket holds enough, rounding up
+            btime_t wait = (cost - o->credit + o->rate - 1) / o->rate;
+            BReactor_SetTimerAfter(o->reactor, &o->timer, wait);
+            return;
+        }
+        
+        o->credit -= cost;
+    }
+    
+    // pass packet on
+    PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+}
+
+static void set_rate (PacketPassRateLimiter *o, int rate, int burst)
+{
+    o->rate = (rate > 0 ? rate : 0);
+    o->burst = bmax_int(burst, PacketPassInterface_GetMTU(o->output));
+}
+
+static void input_handler_send (PacketPassRateLimiter *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->in_len == -1)
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember packet
+    o->in = data;
+    o->in_len = data_len;
+    
+    try_send(o);
+    
+    if (BTimer_IsRunning(&o->timer)) {
+        o->packets_delayed++;
+    }
+}
+
+static void input_handler_requestcancel (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // if the packet is still waiting for credit, drop it here
+    if (BTimer_IsRunning(&o->timer)) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+        o->in_len = -1;
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // request cancel
+    PacketPassInterface_Sender_RequestCancel(o->output);
+}
+
+static void output_handler_done (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(!BTimer_IsRunning(&o->timer))
+    DebugObject_Access(&o->d_obj);
+    
+    // set no packet
+    o->in_len = -1;
+    
+    // call done
+    PacketPassInterface_Done(&o->input);
+}
+
+static void timer_handler (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    try_send(o);
+}
+
+void PacketPassRateLimiter_Init (PacketPassRateLimiter *o, PacketPassInterface *output, BReactor *reactor, int rate, int burst)
+{
+    // init arguments
+    o->output = output;
+    o->reactor = reactor;
+    set_rate(o, rate, burst);
+    
+    // start with a full bucket
+    o->credit = credit_max(o);
+    o->credit_time = btime_gettime();
+    
+    // init input
+    PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(o->reactor));
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init timer
+    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
+    
+    // set no packet
+    o->in_len = -1;
+    
+    o->packets_delayed = 0;
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void PacketPassRateLimiter_Free (PacketPassRateLimiter *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &o->timer);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+}
+
+PacketPassInterface * PacketPassRateLimiter_GetInput (PacketPassRateLimiter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+void PacketPassRateLimiter_SetRate (PacketPassRateLimiter *o, int rate, int burst)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // account credit earned at the old rate
+    if (o->rate > 0) {
+        refill(o);
+    } else {
+        o->credit_time = btime_gettime();
+    }
+    
+    set_rate(o, rate, burst);
+    o->credit = bmin_uint64(o->credit, credit_max(o));
+    
+    // reconsider a waiting packet
+    if (BTimer_IsRunning(&o->timer)) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+        try_send(o);
+    }
+}
+
+uint64_t PacketPassRateLimiter_GetDelayedPackets (PacketPassRateLimiter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->packets_delayed;
+}
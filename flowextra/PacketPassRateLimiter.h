@@ -0,0 +1,119 @@
+/**
+ * @file PacketPassRateLimiter.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A {@link PacketPassInterface} layer which limits the rate of packets
+ * passing through with a token bucket.
+ */
+
+#ifndef BADVPN_PACKETPASSRATELIMITER_H
+#define BADVPN_PACKETPASSRATELIMITER_H
+
+#include <stdint.h>
+
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * A {@link PacketPassInterface} layer which limits the rate of packets
+ * passing through with a token bucket.
+ * 
+ * The bucket fills at the configured rate up to the burst size. A packet
+ * is passed on to the output once the bucket holds at least as many bytes
+ * as the packet is long, and the packet's length is taken from the bucket.
+ * Until then the packet is held using a timer, and the input is blocked.
+ * The object itself never buffers more than the one packet being sent, so
+ * while shaping, the backlog stays in whatever bounded buffers are in front
+ * of it instead of growing without limit further down the chain.
+ */
+typedef struct {
+    PacketPassInterface *output;
+    BReactor *reactor;
+    int rate;
+    int burst;
+    uint64_t credit;
+    btime_t credit_time;
+    PacketPassInterface input;
+    BTimer timer;
+    uint8_t *in;
+    int in_len;
+    uint64_t packets_delayed;
+    DebugObject d_obj;
+} PacketPassRateLimiter;
+
+/**
+ * Initializes the object.
+ * The bucket starts out full.
+ *
+ * @param o the object
+ * @param output output interface
+ * @param reactor reactor we live in
+ * @param rate rate limit in bytes per second, or <=0 for no limit
+ * @param burst bucket size in bytes. Values lower than the MTU of the output
+ *              are raised to the MTU, so that any packet can pass.
+ */
+void PacketPassRateLimiter_Init (PacketPassRateLimiter *o, PacketPassInterface *output, BReactor *reactor, int rate, int burst);
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void PacketPassRateLimiter_Free (PacketPassRateLimiter *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be the same as of the output interface.
+ * The interface supports cancel functionality if the output interface supports it.
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketPassRateLimiter_GetInput (PacketPassRateLimiter *o);
+
+/**
+ * Changes the rate limit.
+ * A packet waiting for the bucket to fill is reconsidered with the new limit.
+ *
+ * @param o the object
+ * @param rate rate limit in bytes per second, or <=0 for no limit
+ * @param burst bucket size in bytes, as in {@link PacketPassRateLimiter_Init}
+ */
+void PacketPassRateLimiter_SetRate (PacketPassRateLimiter *o, int rate, int burst);
+
+/**
+ * Returns the number of packets which had to wait for the bucket to fill.
+ *
+ * @param o the object
+ * @return number of delayed packets
+ */
+uint64_t PacketPassRateLimiter_GetDelayedPackets (PacketPassRateLimiter *o);
+
+#endif
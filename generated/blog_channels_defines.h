@@ -146,4 +146,23 @@
 #define BLOG_CHANNEL_ncd_load_module 145
 #define BLOG_CHANNEL_ncd_basic_functions 146
 #define BLOG_CHANNEL_ncd_objref 147
-#define BLOG_NUM_CHANNELS 148
+#define BLOG_CHANNEL_BReactorGroup 148
+#define BLOG_CHANNEL_BReactorStats 149
+#define BLOG_CHANNEL_BConnectionPipe 150
+#define BLOG_CHANNEL_BShardConnection 151
+#define BLOG_CHANNEL_DnsCache 152
+#define BLOG_CHANNEL_BThreadPacketRing 153
+#define BLOG_CHANNEL_FlowStats 154
+#define BLOG_CHANNEL_DirectUdpClient 155
+#define BLOG_CHANNEL_NCDProgramImage 156
+#define BLOG_CHANNEL_NCDValBinary 157
+#define BLOG_CHANNEL_BLogAsync 158
+#define BLOG_CHANNEL_BMetricsExporter 159
+#define BLOG_CHANNEL_FakeDns 160
+#define BLOG_CHANNEL_BResolver 161
+#define BLOG_CHANNEL_BArena 162
+#define BLOG_CHANNEL_BThreadPlacement 163
+#define BLOG_CHANNEL_BXdpSocket 164
+#define BLOG_CHANNEL_BListenerHandoff 165
+#define BLOG_CHANNEL_BControlServer 166
+#define BLOG_NUM_CHANNELS 167
@@ -146,3 +146,22 @@
 {"ncd_load_module", 4},
 {"ncd_basic_functions", 4},
 {"ncd_objref", 4},
+{"BReactorGroup", 4},
+{"BReactorStats", 4},
+{"BConnectionPipe", 4},
+{"BShardConnection", 4},
+{"DnsCache", 4},
+{"BThreadPacketRing", 4},
+{"FlowStats", 4},
+{"DirectUdpClient", 4},
+{"NCDProgramImage", 4},
+{"NCDValBinary", 4},
+{"BLogAsync", 4},
+{"BMetricsExporter", 4},
+{"FakeDns", 4},
+{"BResolver", 4},
+{"BArena", 4},
+{"BThreadPlacement", 4},
+{"BXdpSocket", 4},
+{"BListenerHandoff", 4},
+{"BControlServer", 4},
@@ -38,15 +38,19 @@ typedef struct {
     int type_start;
     int type_span;
     int type_pos;
+    int type_off;
     int ip_port_start;
     int ip_port_span;
     int ip_port_pos;
+    int ip_port_off;
     int ipv4_addr_start;
     int ipv4_addr_span;
     int ipv4_addr_pos;
+    int ipv4_addr_off;
     int ipv6_addr_start;
     int ipv6_addr_span;
     int ipv6_addr_pos;
+    int ipv6_addr_off;
 } addrParser;
 
 static int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len);
@@ -189,15 +193,19 @@ int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len)
     o->type_start = o->buf_len;
     o->type_span = 0;
     o->type_pos = 0;
+    o->type_off = 0;
     o->ip_port_start = o->buf_len;
     o->ip_port_span = 0;
     o->ip_port_pos = 0;
+    o->ip_port_off = 0;
     o->ipv4_addr_start = o->buf_len;
     o->ipv4_addr_span = 0;
     o->ipv4_addr_pos = 0;
+    o->ipv4_addr_off = 0;
     o->ipv6_addr_start = o->buf_len;
     o->ipv6_addr_span = 0;
     o->ipv6_addr_pos = 0;
+    o->ipv6_addr_off = 0;
 
     int type_count = 0;
     int ip_port_count = 0;
@@ -235,6 +243,7 @@ int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len)
                         }
                         o->type_span = pos - o->type_start;
                         type_count++;
+                        o->type_off = pos - sizeof(struct BProto_uint8_s);
                         break;
                     default:
                         return 0;
@@ -307,6 +316,7 @@ int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len)
                         }
                         o->ip_port_span = pos - o->ip_port_start;
                         ip_port_count++;
+                        o->ip_port_off = pos - payload_len;
                         break;
                     case 3:
                         if (!(type == BPROTO_TYPE_CONSTDATA)) {
@@ -320,6 +330,7 @@ int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len)
                         }
                         o->ipv4_addr_span = pos - o->ipv4_addr_start;
                         ipv4_addr_count++;
+                        o->ipv4_addr_off = pos - payload_len;
                         break;
                     case 4:
                         if (!(type == BPROTO_TYPE_CONSTDATA)) {
@@ -333,6 +344,7 @@ int addrParser_Init (addrParser *o, uint8_t *buf, int buf_len)
                         }
                         o->ipv6_addr_span = pos - o->ipv6_addr_start;
                         ipv6_addr_count++;
+                        o->ipv6_addr_off = pos - payload_len;
                         break;
                     default:
                         return 0;
@@ -374,68 +386,18 @@ int addrParser_GotEverything (addrParser *o)
 
 int addrParser_Gettype (addrParser *o, uint8_t *v)
 {
-    ASSERT(o->type_pos >= 0)
-    ASSERT(o->type_pos <= o->type_span)
+    ASSERT(o->type_pos == 0 || o->type_pos == o->type_span)
 
-    int left = o->type_span - o->type_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->type_start + o->type_pos, sizeof(header));
-        o->type_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                struct BProto_uint8_s val;
-                memcpy(&val, o->buf + o->type_start + o->type_pos, sizeof(val));
-                o->type_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-
-                if (id == 1) {
-                    *v = ltoh8(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->type_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->type_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->type_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->type_start + o->type_pos, sizeof(val));
-                o->type_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->type_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->type_pos == o->type_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint8_s val;
+    memcpy(&val, o->buf + o->type_off, sizeof(val));
+    o->type_pos = o->type_span;
+
+    *v = ltoh8(val.v);
+    return 1;
 }
 
 void addrParser_Resettype (addrParser *o)
@@ -450,67 +412,16 @@ void addrParser_Forwardtype (addrParser *o)
 
 int addrParser_Getip_port (addrParser *o, uint8_t **data)
 {
-    ASSERT(o->ip_port_pos >= 0)
-    ASSERT(o->ip_port_pos <= o->ip_port_span)
+    ASSERT(o->ip_port_pos == 0 || o->ip_port_pos == o->ip_port_span)
 
-    int left = o->ip_port_span - o->ip_port_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->ip_port_start + o->ip_port_pos, sizeof(header));
-        o->ip_port_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->ip_port_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->ip_port_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->ip_port_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->ip_port_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->ip_port_start + o->ip_port_pos, sizeof(val));
-                o->ip_port_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->ip_port_start + o->ip_port_pos;
-                o->ip_port_pos += payload_len;
-                left -= payload_len;
-
-                if (type == BPROTO_TYPE_CONSTDATA && id == 2) {
-                    *data = payload;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->ip_port_pos == o->ip_port_span) {
+        return 0;
     }
 
-    return 0;
+    o->ip_port_pos = o->ip_port_span;
+
+    *data = o->buf + o->ip_port_off;
+    return 1;
 }
 
 void addrParser_Resetip_port (addrParser *o)
@@ -525,67 +436,16 @@ void addrParser_Forwardip_port (addrParser *o)
 
 int addrParser_Getipv4_addr (addrParser *o, uint8_t **data)
 {
-    ASSERT(o->ipv4_addr_pos >= 0)
-    ASSERT(o->ipv4_addr_pos <= o->ipv4_addr_span)
+    ASSERT(o->ipv4_addr_pos == 0 || o->ipv4_addr_pos == o->ipv4_addr_span)
 
-    int left = o->ipv4_addr_span - o->ipv4_addr_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->ipv4_addr_start + o->ipv4_addr_pos, sizeof(header));
-        o->ipv4_addr_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->ipv4_addr_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->ipv4_addr_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->ipv4_addr_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->ipv4_addr_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->ipv4_addr_start + o->ipv4_addr_pos, sizeof(val));
-                o->ipv4_addr_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->ipv4_addr_start + o->ipv4_addr_pos;
-                o->ipv4_addr_pos += payload_len;
-                left -= payload_len;
-
-                if (type == BPROTO_TYPE_CONSTDATA && id == 3) {
-                    *data = payload;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->ipv4_addr_pos == o->ipv4_addr_span) {
+        return 0;
     }
 
-    return 0;
+    o->ipv4_addr_pos = o->ipv4_addr_span;
+
+    *data = o->buf + o->ipv4_addr_off;
+    return 1;
 }
 
 void addrParser_Resetipv4_addr (addrParser *o)
@@ -600,67 +460,16 @@ void addrParser_Forwardipv4_addr (addrParser *o)
 
 int addrParser_Getipv6_addr (addrParser *o, uint8_t **data)
 {
-    ASSERT(o->ipv6_addr_pos >= 0)
-    ASSERT(o->ipv6_addr_pos <= o->ipv6_addr_span)
+    ASSERT(o->ipv6_addr_pos == 0 || o->ipv6_addr_pos == o->ipv6_addr_span)
 
-    int left = o->ipv6_addr_span - o->ipv6_addr_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->ipv6_addr_start + o->ipv6_addr_pos, sizeof(header));
-        o->ipv6_addr_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->ipv6_addr_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->ipv6_addr_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->ipv6_addr_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->ipv6_addr_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->ipv6_addr_start + o->ipv6_addr_pos, sizeof(val));
-                o->ipv6_addr_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->ipv6_addr_start + o->ipv6_addr_pos;
-                o->ipv6_addr_pos += payload_len;
-                left -= payload_len;
-
-                if (type == BPROTO_TYPE_CONSTDATA && id == 4) {
-                    *data = payload;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->ipv6_addr_pos == o->ipv6_addr_span) {
+        return 0;
     }
 
-    return 0;
+    o->ipv6_addr_pos = o->ipv6_addr_span;
+
+    *data = o->buf + o->ipv6_addr_off;
+    return 1;
 }
 
 void addrParser_Resetipv6_addr (addrParser *o)
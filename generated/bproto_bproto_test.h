@@ -47,9 +47,11 @@ typedef struct {
     int a_start;
     int a_span;
     int a_pos;
+    int a_off;
     int b_start;
     int b_span;
     int b_pos;
+    int b_off;
     int c_start;
     int c_span;
     int c_pos;
@@ -59,12 +61,16 @@ typedef struct {
     int e_start;
     int e_span;
     int e_pos;
+    int e_off;
     int f_start;
     int f_span;
     int f_pos;
+    int f_off;
+    int f_len;
     int g_start;
     int g_span;
     int g_pos;
+    int g_off;
 } msg1Parser;
 
 static int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len);
@@ -277,9 +283,11 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
     o->a_start = o->buf_len;
     o->a_span = 0;
     o->a_pos = 0;
+    o->a_off = 0;
     o->b_start = o->buf_len;
     o->b_span = 0;
     o->b_pos = 0;
+    o->b_off = 0;
     o->c_start = o->buf_len;
     o->c_span = 0;
     o->c_pos = 0;
@@ -289,12 +297,16 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
     o->e_start = o->buf_len;
     o->e_span = 0;
     o->e_pos = 0;
+    o->e_off = 0;
     o->f_start = o->buf_len;
     o->f_span = 0;
     o->f_pos = 0;
+    o->f_off = 0;
+    o->f_len = 0;
     o->g_start = o->buf_len;
     o->g_span = 0;
     o->g_pos = 0;
+    o->g_off = 0;
 
     int a_count = 0;
     int b_count = 0;
@@ -335,6 +347,7 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
                         }
                         o->e_span = pos - o->e_start;
                         e_count++;
+                        o->e_off = pos - sizeof(struct BProto_uint8_s);
                         break;
                     default:
                         return 0;
@@ -354,6 +367,7 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
                         }
                         o->a_span = pos - o->a_start;
                         a_count++;
+                        o->a_off = pos - sizeof(struct BProto_uint16_s);
                         break;
                     case 8:
                         if (o->d_start == o->buf_len) {
@@ -380,6 +394,7 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
                         }
                         o->b_span = pos - o->b_start;
                         b_count++;
+                        o->b_off = pos - sizeof(struct BProto_uint32_s);
                         break;
                     default:
                         return 0;
@@ -432,6 +447,8 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
                         }
                         o->f_span = pos - o->f_start;
                         f_count++;
+                        o->f_off = pos - payload_len;
+                        o->f_len = payload_len;
                         break;
                     case 11:
                         if (!(type == BPROTO_TYPE_CONSTDATA)) {
@@ -445,6 +462,7 @@ int msg1Parser_Init (msg1Parser *o, uint8_t *buf, int buf_len)
                         }
                         o->g_span = pos - o->g_start;
                         g_count++;
+                        o->g_off = pos - payload_len;
                         break;
                     default:
                         return 0;
@@ -498,68 +516,18 @@ int msg1Parser_GotEverything (msg1Parser *o)
 
 int msg1Parser_Geta (msg1Parser *o, uint16_t *v)
 {
-    ASSERT(o->a_pos >= 0)
-    ASSERT(o->a_pos <= o->a_span)
+    ASSERT(o->a_pos == 0 || o->a_pos == o->a_span)
 
-    int left = o->a_span - o->a_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->a_start + o->a_pos, sizeof(header));
-        o->a_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->a_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                struct BProto_uint16_s val;
-                memcpy(&val, o->buf + o->a_start + o->a_pos, sizeof(val));
-                o->a_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-
-                if (id == 5) {
-                    *v = ltoh16(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->a_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->a_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->a_start + o->a_pos, sizeof(val));
-                o->a_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->a_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->a_pos == o->a_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint16_s val;
+    memcpy(&val, o->buf + o->a_off, sizeof(val));
+    o->a_pos = o->a_span;
+
+    *v = ltoh16(val.v);
+    return 1;
 }
 
 void msg1Parser_Reseta (msg1Parser *o)
@@ -574,68 +542,18 @@ void msg1Parser_Forwarda (msg1Parser *o)
 
 int msg1Parser_Getb (msg1Parser *o, uint32_t *v)
 {
-    ASSERT(o->b_pos >= 0)
-    ASSERT(o->b_pos <= o->b_span)
+    ASSERT(o->b_pos == 0 || o->b_pos == o->b_span)
 
-    int left = o->b_span - o->b_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->b_start + o->b_pos, sizeof(header));
-        o->b_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->b_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->b_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                struct BProto_uint32_s val;
-                memcpy(&val, o->buf + o->b_start + o->b_pos, sizeof(val));
-                o->b_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-
-                if (id == 6) {
-                    *v = ltoh32(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->b_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->b_start + o->b_pos, sizeof(val));
-                o->b_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->b_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->b_pos == o->b_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint32_s val;
+    memcpy(&val, o->buf + o->b_off, sizeof(val));
+    o->b_pos = o->b_span;
+
+    *v = ltoh32(val.v);
+    return 1;
 }
 
 void msg1Parser_Resetb (msg1Parser *o)
@@ -802,68 +720,18 @@ void msg1Parser_Forwardd (msg1Parser *o)
 
 int msg1Parser_Gete (msg1Parser *o, uint8_t *v)
 {
-    ASSERT(o->e_pos >= 0)
-    ASSERT(o->e_pos <= o->e_span)
+    ASSERT(o->e_pos == 0 || o->e_pos == o->e_span)
 
-    int left = o->e_span - o->e_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->e_start + o->e_pos, sizeof(header));
-        o->e_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                struct BProto_uint8_s val;
-                memcpy(&val, o->buf + o->e_start + o->e_pos, sizeof(val));
-                o->e_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-
-                if (id == 9) {
-                    *v = ltoh8(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->e_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->e_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->e_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->e_start + o->e_pos, sizeof(val));
-                o->e_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->e_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->e_pos == o->e_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint8_s val;
+    memcpy(&val, o->buf + o->e_off, sizeof(val));
+    o->e_pos = o->e_span;
+
+    *v = ltoh8(val.v);
+    return 1;
 }
 
 void msg1Parser_Resete (msg1Parser *o)
@@ -878,68 +746,17 @@ void msg1Parser_Forwarde (msg1Parser *o)
 
 int msg1Parser_Getf (msg1Parser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->f_pos >= 0)
-    ASSERT(o->f_pos <= o->f_span)
-
-    int left = o->f_span - o->f_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->f_start + o->f_pos, sizeof(header));
-        o->f_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->f_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->f_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->f_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->f_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->f_start + o->f_pos, sizeof(val));
-                o->f_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->f_start + o->f_pos;
-                o->f_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->f_pos == 0 || o->f_pos == o->f_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 10) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->f_pos == o->f_span) {
+        return 0;
     }
 
-    return 0;
+    o->f_pos = o->f_span;
+
+    *data = o->buf + o->f_off;
+    *data_len = o->f_len;
+    return 1;
 }
 
 void msg1Parser_Resetf (msg1Parser *o)
@@ -954,67 +771,16 @@ void msg1Parser_Forwardf (msg1Parser *o)
 
 int msg1Parser_Getg (msg1Parser *o, uint8_t **data)
 {
-    ASSERT(o->g_pos >= 0)
-    ASSERT(o->g_pos <= o->g_span)
-
-    int left = o->g_span - o->g_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->g_start + o->g_pos, sizeof(header));
-        o->g_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
+    ASSERT(o->g_pos == 0 || o->g_pos == o->g_span)
 
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->g_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->g_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->g_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->g_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->g_start + o->g_pos, sizeof(val));
-                o->g_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->g_start + o->g_pos;
-                o->g_pos += payload_len;
-                left -= payload_len;
-
-                if (type == BPROTO_TYPE_CONSTDATA && id == 11) {
-                    *data = payload;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->g_pos == o->g_span) {
+        return 0;
     }
 
-    return 0;
+    o->g_pos = o->g_span;
+
+    *data = o->buf + o->g_off;
+    return 1;
 }
 
 void msg1Parser_Resetg (msg1Parser *o)
@@ -32,9 +32,12 @@ typedef struct {
     int type_start;
     int type_span;
     int type_pos;
+    int type_off;
     int payload_start;
     int payload_span;
     int payload_pos;
+    int payload_off;
+    int payload_len;
 } msgParser;
 
 static int msgParser_Init (msgParser *o, uint8_t *buf, int buf_len);
@@ -117,9 +120,12 @@ int msgParser_Init (msgParser *o, uint8_t *buf, int buf_len)
     o->type_start = o->buf_len;
     o->type_span = 0;
     o->type_pos = 0;
+    o->type_off = 0;
     o->payload_start = o->buf_len;
     o->payload_span = 0;
     o->payload_pos = 0;
+    o->payload_off = 0;
+    o->payload_len = 0;
 
     int type_count = 0;
     int payload_count = 0;
@@ -167,6 +173,7 @@ int msgParser_Init (msgParser *o, uint8_t *buf, int buf_len)
                         }
                         o->type_span = pos - o->type_start;
                         type_count++;
+                        o->type_off = pos - sizeof(struct BProto_uint16_s);
                         break;
                     default:
                         return 0;
@@ -224,6 +231,8 @@ int msgParser_Init (msgParser *o, uint8_t *buf, int buf_len)
                         }
                         o->payload_span = pos - o->payload_start;
                         payload_count++;
+                        o->payload_off = pos - payload_len;
+                        o->payload_len = payload_len;
                         break;
                     default:
                         return 0;
@@ -255,68 +264,18 @@ int msgParser_GotEverything (msgParser *o)
 
 int msgParser_Gettype (msgParser *o, uint16_t *v)
 {
-    ASSERT(o->type_pos >= 0)
-    ASSERT(o->type_pos <= o->type_span)
+    ASSERT(o->type_pos == 0 || o->type_pos == o->type_span)
 
-    int left = o->type_span - o->type_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->type_start + o->type_pos, sizeof(header));
-        o->type_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->type_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                struct BProto_uint16_s val;
-                memcpy(&val, o->buf + o->type_start + o->type_pos, sizeof(val));
-                o->type_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-
-                if (id == 1) {
-                    *v = ltoh16(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->type_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->type_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->type_start + o->type_pos, sizeof(val));
-                o->type_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->type_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->type_pos == o->type_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint16_s val;
+    memcpy(&val, o->buf + o->type_off, sizeof(val));
+    o->type_pos = o->type_span;
+
+    *v = ltoh16(val.v);
+    return 1;
 }
 
 void msgParser_Resettype (msgParser *o)
@@ -331,68 +290,17 @@ void msgParser_Forwardtype (msgParser *o)
 
 int msgParser_Getpayload (msgParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->payload_pos >= 0)
-    ASSERT(o->payload_pos <= o->payload_span)
-
-    int left = o->payload_span - o->payload_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->payload_start + o->payload_pos, sizeof(header));
-        o->payload_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->payload_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->payload_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->payload_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->payload_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->payload_start + o->payload_pos, sizeof(val));
-                o->payload_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->payload_start + o->payload_pos;
-                o->payload_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->payload_pos == 0 || o->payload_pos == o->payload_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 2) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->payload_pos == o->payload_span) {
+        return 0;
     }
 
-    return 0;
+    o->payload_pos = o->payload_span;
+
+    *data = o->buf + o->payload_off;
+    *data_len = o->payload_len;
+    return 1;
 }
 
 void msgParser_Resetpayload (msgParser *o)
@@ -432,9 +340,12 @@ typedef struct {
     int key_start;
     int key_span;
     int key_pos;
+    int key_off;
+    int key_len;
     int password_start;
     int password_span;
     int password_pos;
+    int password_off;
 } msg_youconnectParser;
 
 static int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_len);
@@ -550,9 +461,12 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
     o->key_start = o->buf_len;
     o->key_span = 0;
     o->key_pos = 0;
+    o->key_off = 0;
+    o->key_len = 0;
     o->password_start = o->buf_len;
     o->password_span = 0;
     o->password_pos = 0;
+    o->password_off = 0;
 
     int addr_count = 0;
     int key_count = 0;
@@ -625,6 +539,7 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
                         }
                         o->password_span = pos - o->password_start;
                         password_count++;
+                        o->password_off = pos - sizeof(struct BProto_uint64_s);
                         break;
                     default:
                         return 0;
@@ -668,6 +583,8 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
                         }
                         o->key_span = pos - o->key_start;
                         key_count++;
+                        o->key_off = pos - payload_len;
+                        o->key_len = payload_len;
                         break;
                     default:
                         return 0;
@@ -780,68 +697,17 @@ void msg_youconnectParser_Forwardaddr (msg_youconnectParser *o)
 
 int msg_youconnectParser_Getkey (msg_youconnectParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->key_pos >= 0)
-    ASSERT(o->key_pos <= o->key_span)
-
-    int left = o->key_span - o->key_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->key_start + o->key_pos, sizeof(header));
-        o->key_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->key_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->key_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->key_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->key_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->key_start + o->key_pos, sizeof(val));
-                o->key_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->key_start + o->key_pos;
-                o->key_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->key_pos == 0 || o->key_pos == o->key_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 2) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->key_pos == o->key_span) {
+        return 0;
     }
 
-    return 0;
+    o->key_pos = o->key_span;
+
+    *data = o->buf + o->key_off;
+    *data_len = o->key_len;
+    return 1;
 }
 
 void msg_youconnectParser_Resetkey (msg_youconnectParser *o)
@@ -856,68 +722,18 @@ void msg_youconnectParser_Forwardkey (msg_youconnectParser *o)
 
 int msg_youconnectParser_Getpassword (msg_youconnectParser *o, uint64_t *v)
 {
-    ASSERT(o->password_pos >= 0)
-    ASSERT(o->password_pos <= o->password_span)
-
-    int left = o->password_span - o->password_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->password_start + o->password_pos, sizeof(header));
-        o->password_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->password_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->password_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->password_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                struct BProto_uint64_s val;
-                memcpy(&val, o->buf + o->password_start + o->password_pos, sizeof(val));
-                o->password_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
+    ASSERT(o->password_pos == 0 || o->password_pos == o->password_span)
 
-                if (id == 3) {
-                    *v = ltoh64(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->password_start + o->password_pos, sizeof(val));
-                o->password_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->password_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->password_pos == o->password_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint64_s val;
+    memcpy(&val, o->buf + o->password_off, sizeof(val));
+    o->password_pos = o->password_span;
+
+    *v = ltoh64(val.v);
+    return 1;
 }
 
 void msg_youconnectParser_Resetpassword (msg_youconnectParser *o)
@@ -951,9 +767,13 @@ typedef struct {
     int name_start;
     int name_span;
     int name_pos;
+    int name_off;
+    int name_len;
     int addr_start;
     int addr_span;
     int addr_pos;
+    int addr_off;
+    int addr_len;
 } msg_youconnect_addrParser;
 
 static int msg_youconnect_addrParser_Init (msg_youconnect_addrParser *o, uint8_t *buf, int buf_len);
@@ -1041,9 +861,13 @@ int msg_youconnect_addrParser_Init (msg_youconnect_addrParser *o, uint8_t *buf,
     o->name_start = o->buf_len;
     o->name_span = 0;
     o->name_pos = 0;
+    o->name_off = 0;
+    o->name_len = 0;
     o->addr_start = o->buf_len;
     o->addr_span = 0;
     o->addr_pos = 0;
+    o->addr_off = 0;
+    o->addr_len = 0;
 
     int name_count = 0;
     int addr_count = 0;
@@ -1141,6 +965,8 @@ int msg_youconnect_addrParser_Init (msg_youconnect_addrParser *o, uint8_t *buf,
                         }
                         o->name_span = pos - o->name_start;
                         name_count++;
+                        o->name_off = pos - payload_len;
+                        o->name_len = payload_len;
                         break;
                     case 2:
                         if (!(type == BPROTO_TYPE_DATA)) {
@@ -1151,6 +977,8 @@ int msg_youconnect_addrParser_Init (msg_youconnect_addrParser *o, uint8_t *buf,
                         }
                         o->addr_span = pos - o->addr_start;
                         addr_count++;
+                        o->addr_off = pos - payload_len;
+                        o->addr_len = payload_len;
                         break;
                     default:
                         return 0;
@@ -1182,68 +1010,17 @@ int msg_youconnect_addrParser_GotEverything (msg_youconnect_addrParser *o)
 
 int msg_youconnect_addrParser_Getname (msg_youconnect_addrParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->name_pos >= 0)
-    ASSERT(o->name_pos <= o->name_span)
-
-    int left = o->name_span - o->name_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->name_start + o->name_pos, sizeof(header));
-        o->name_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->name_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->name_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->name_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->name_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->name_start + o->name_pos, sizeof(val));
-                o->name_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->name_start + o->name_pos;
-                o->name_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->name_pos == 0 || o->name_pos == o->name_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 1) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->name_pos == o->name_span) {
+        return 0;
     }
 
-    return 0;
+    o->name_pos = o->name_span;
+
+    *data = o->buf + o->name_off;
+    *data_len = o->name_len;
+    return 1;
 }
 
 void msg_youconnect_addrParser_Resetname (msg_youconnect_addrParser *o)
@@ -1258,68 +1035,17 @@ void msg_youconnect_addrParser_Forwardname (msg_youconnect_addrParser *o)
 
 int msg_youconnect_addrParser_Getaddr (msg_youconnect_addrParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->addr_pos >= 0)
-    ASSERT(o->addr_pos <= o->addr_span)
-
-    int left = o->addr_span - o->addr_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->addr_start + o->addr_pos, sizeof(header));
-        o->addr_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->addr_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->addr_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->addr_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->addr_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->addr_start + o->addr_pos, sizeof(val));
-                o->addr_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->addr_start + o->addr_pos;
-                o->addr_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->addr_pos == 0 || o->addr_pos == o->addr_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 2) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->addr_pos == o->addr_span) {
+        return 0;
     }
 
-    return 0;
+    o->addr_pos = o->addr_span;
+
+    *data = o->buf + o->addr_off;
+    *data_len = o->addr_len;
+    return 1;
 }
 
 void msg_youconnect_addrParser_Resetaddr (msg_youconnect_addrParser *o)
@@ -1356,12 +1082,17 @@ typedef struct {
     int seed_id_start;
     int seed_id_span;
     int seed_id_pos;
+    int seed_id_off;
     int key_start;
     int key_span;
     int key_pos;
+    int key_off;
+    int key_len;
     int iv_start;
     int iv_span;
     int iv_pos;
+    int iv_off;
+    int iv_len;
 } msg_seedParser;
 
 static int msg_seedParser_Init (msg_seedParser *o, uint8_t *buf, int buf_len);
@@ -1474,12 +1205,17 @@ int msg_seedParser_Init (msg_seedParser *o, uint8_t *buf, int buf_len)
     o->seed_id_start = o->buf_len;
     o->seed_id_span = 0;
     o->seed_id_pos = 0;
+    o->seed_id_off = 0;
     o->key_start = o->buf_len;
     o->key_span = 0;
     o->key_pos = 0;
+    o->key_off = 0;
+    o->key_len = 0;
     o->iv_start = o->buf_len;
     o->iv_span = 0;
     o->iv_pos = 0;
+    o->iv_off = 0;
+    o->iv_len = 0;
 
     int seed_id_count = 0;
     int key_count = 0;
@@ -1528,6 +1264,7 @@ int msg_seedParser_Init (msg_seedParser *o, uint8_t *buf, int buf_len)
                         }
                         o->seed_id_span = pos - o->seed_id_start;
                         seed_id_count++;
+                        o->seed_id_off = pos - sizeof(struct BProto_uint16_s);
                         break;
                     default:
                         return 0;
@@ -1585,6 +1322,8 @@ int msg_seedParser_Init (msg_seedParser *o, uint8_t *buf, int buf_len)
                         }
                         o->key_span = pos - o->key_start;
                         key_count++;
+                        o->key_off = pos - payload_len;
+                        o->key_len = payload_len;
                         break;
                     case 3:
                         if (!(type == BPROTO_TYPE_DATA)) {
@@ -1595,6 +1334,8 @@ int msg_seedParser_Init (msg_seedParser *o, uint8_t *buf, int buf_len)
                         }
                         o->iv_span = pos - o->iv_start;
                         iv_count++;
+                        o->iv_off = pos - payload_len;
+                        o->iv_len = payload_len;
                         break;
                     default:
                         return 0;
@@ -1631,68 +1372,18 @@ int msg_seedParser_GotEverything (msg_seedParser *o)
 
 int msg_seedParser_Getseed_id (msg_seedParser *o, uint16_t *v)
 {
-    ASSERT(o->seed_id_pos >= 0)
-    ASSERT(o->seed_id_pos <= o->seed_id_span)
-
-    int left = o->seed_id_span - o->seed_id_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(header));
-        o->seed_id_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->seed_id_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                struct BProto_uint16_s val;
-                memcpy(&val, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(val));
-                o->seed_id_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
+    ASSERT(o->seed_id_pos == 0 || o->seed_id_pos == o->seed_id_span)
 
-                if (id == 1) {
-                    *v = ltoh16(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->seed_id_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->seed_id_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(val));
-                o->seed_id_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->seed_id_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->seed_id_pos == o->seed_id_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint16_s val;
+    memcpy(&val, o->buf + o->seed_id_off, sizeof(val));
+    o->seed_id_pos = o->seed_id_span;
+
+    *v = ltoh16(val.v);
+    return 1;
 }
 
 void msg_seedParser_Resetseed_id (msg_seedParser *o)
@@ -1707,68 +1398,17 @@ void msg_seedParser_Forwardseed_id (msg_seedParser *o)
 
 int msg_seedParser_Getkey (msg_seedParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->key_pos >= 0)
-    ASSERT(o->key_pos <= o->key_span)
-
-    int left = o->key_span - o->key_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->key_start + o->key_pos, sizeof(header));
-        o->key_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->key_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->key_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->key_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->key_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->key_start + o->key_pos, sizeof(val));
-                o->key_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->key_start + o->key_pos;
-                o->key_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->key_pos == 0 || o->key_pos == o->key_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 2) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->key_pos == o->key_span) {
+        return 0;
     }
 
-    return 0;
+    o->key_pos = o->key_span;
+
+    *data = o->buf + o->key_off;
+    *data_len = o->key_len;
+    return 1;
 }
 
 void msg_seedParser_Resetkey (msg_seedParser *o)
@@ -1783,68 +1423,17 @@ void msg_seedParser_Forwardkey (msg_seedParser *o)
 
 int msg_seedParser_Getiv (msg_seedParser *o, uint8_t **data, int *data_len)
 {
-    ASSERT(o->iv_pos >= 0)
-    ASSERT(o->iv_pos <= o->iv_span)
-
-    int left = o->iv_span - o->iv_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->iv_start + o->iv_pos, sizeof(header));
-        o->iv_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->iv_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                o->iv_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->iv_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->iv_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->iv_start + o->iv_pos, sizeof(val));
-                o->iv_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                uint8_t *payload = o->buf + o->iv_start + o->iv_pos;
-                o->iv_pos += payload_len;
-                left -= payload_len;
+    ASSERT(o->iv_pos == 0 || o->iv_pos == o->iv_span)
 
-                if (type == BPROTO_TYPE_DATA && id == 3) {
-                    *data = payload;
-                    *data_len = payload_len;
-                    return 1;
-                }
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->iv_pos == o->iv_span) {
+        return 0;
     }
 
-    return 0;
+    o->iv_pos = o->iv_span;
+
+    *data = o->buf + o->iv_off;
+    *data_len = o->iv_len;
+    return 1;
 }
 
 void msg_seedParser_Resetiv (msg_seedParser *o)
@@ -1875,6 +1464,7 @@ typedef struct {
     int seed_id_start;
     int seed_id_span;
     int seed_id_pos;
+    int seed_id_off;
 } msg_confirmseedParser;
 
 static int msg_confirmseedParser_Init (msg_confirmseedParser *o, uint8_t *buf, int buf_len);
@@ -1927,6 +1517,7 @@ int msg_confirmseedParser_Init (msg_confirmseedParser *o, uint8_t *buf, int buf_
     o->seed_id_start = o->buf_len;
     o->seed_id_span = 0;
     o->seed_id_pos = 0;
+    o->seed_id_off = 0;
 
     int seed_id_count = 0;
 
@@ -1973,6 +1564,7 @@ int msg_confirmseedParser_Init (msg_confirmseedParser *o, uint8_t *buf, int buf_
                         }
                         o->seed_id_span = pos - o->seed_id_start;
                         seed_id_count++;
+                        o->seed_id_off = pos - sizeof(struct BProto_uint16_s);
                         break;
                     default:
                         return 0;
@@ -2046,68 +1638,18 @@ int msg_confirmseedParser_GotEverything (msg_confirmseedParser *o)
 
 int msg_confirmseedParser_Getseed_id (msg_confirmseedParser *o, uint16_t *v)
 {
-    ASSERT(o->seed_id_pos >= 0)
-    ASSERT(o->seed_id_pos <= o->seed_id_span)
-
-    int left = o->seed_id_span - o->seed_id_pos;
-
-    while (left > 0) {
-        ASSERT(left >= sizeof(struct BProto_header_s))
-        struct BProto_header_s header;
-        memcpy(&header, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(header));
-        o->seed_id_pos += sizeof(struct BProto_header_s);
-        left -= sizeof(struct BProto_header_s);
-        uint16_t type = ltoh16(header.type);
-        uint16_t id = ltoh16(header.id);
-
-        switch (type) {
-            case BPROTO_TYPE_UINT8: {
-                ASSERT(left >= sizeof(struct BProto_uint8_s))
-                o->seed_id_pos += sizeof(struct BProto_uint8_s);
-                left -= sizeof(struct BProto_uint8_s);
-            } break;
-            case BPROTO_TYPE_UINT16: {
-                ASSERT(left >= sizeof(struct BProto_uint16_s))
-                struct BProto_uint16_s val;
-                memcpy(&val, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(val));
-                o->seed_id_pos += sizeof(struct BProto_uint16_s);
-                left -= sizeof(struct BProto_uint16_s);
+    ASSERT(o->seed_id_pos == 0 || o->seed_id_pos == o->seed_id_span)
 
-                if (id == 1) {
-                    *v = ltoh16(val.v);
-                    return 1;
-                }
-            } break;
-            case BPROTO_TYPE_UINT32: {
-                ASSERT(left >= sizeof(struct BProto_uint32_s))
-                o->seed_id_pos += sizeof(struct BProto_uint32_s);
-                left -= sizeof(struct BProto_uint32_s);
-            } break;
-            case BPROTO_TYPE_UINT64: {
-                ASSERT(left >= sizeof(struct BProto_uint64_s))
-                o->seed_id_pos += sizeof(struct BProto_uint64_s);
-                left -= sizeof(struct BProto_uint64_s);
-            } break;
-            case BPROTO_TYPE_DATA:
-            case BPROTO_TYPE_CONSTDATA:
-            {
-                ASSERT(left >= sizeof(struct BProto_data_header_s))
-                struct BProto_data_header_s val;
-                memcpy(&val, o->buf + o->seed_id_start + o->seed_id_pos, sizeof(val));
-                o->seed_id_pos += sizeof(struct BProto_data_header_s);
-                left -= sizeof(struct BProto_data_header_s);
-
-                uint32_t payload_len = ltoh32(val.len);
-                ASSERT(left >= payload_len)
-                o->seed_id_pos += payload_len;
-                left -= payload_len;
-            } break;
-            default:
-                ASSERT(0);
-        }
+    if (o->seed_id_pos == o->seed_id_span) {
+        return 0;
     }
 
-    return 0;
+    struct BProto_uint16_s val;
+    memcpy(&val, o->buf + o->seed_id_off, sizeof(val));
+    o->seed_id_pos = o->seed_id_span;
+
+    *v = ltoh16(val.v);
+    return 1;
 }
 
 void msg_confirmseedParser_Resetseed_id (msg_confirmseedParser *o)
@@ -40,6 +40,7 @@
 #include <misc/packed.h>
 #include <misc/print_macros.h>
 #include <misc/byteorder.h>
+#include <misc/ipchecksum.h>
 #include <base/BLog.h>
 
 #define PACK_STRUCT_BEGIN B_START_PACKED
@@ -49,6 +50,8 @@
 #define LWIP_PLATFORM_DIAG(x) { if (BLog_WouldLog(BLOG_CHANNEL_lwip, BLOG_INFO)) { BLog_Begin(); BLog_Append x; BLog_Finish(BLOG_CHANNEL_lwip, BLOG_INFO); } }
 #define LWIP_PLATFORM_ASSERT(x) { fprintf(stderr, "%s: lwip assertion failure: %s\n", __FUNCTION__, (x)); abort(); }
 
+#define LWIP_CHKSUM(dataptr, len) ipchecksum_fold(ipchecksum_add(0, (dataptr), (len)))
+
 #define lwip_htons(x) hton16(x)
 #define lwip_htonl(x) hton32(x)
 
@@ -30,8 +30,12 @@
 #ifndef LWIP_CUSTOM_LWIPOPTS_H
 #define LWIP_CUSTOM_LWIPOPTS_H
 
+#include <lwip/custom/mempools.h>
+
 #define NO_SYS 1
 #define LWIP_TIMERS 0
+// tun2socks runs the timers only while some connection or fragment needs them
+#define LWIP_TIMERS_ON_DEMAND 1
 #define MEM_ALIGNMENT 4
 
 #define LWIP_ARP 0
@@ -62,11 +66,34 @@
 #define MEMP_NUM_TCP_PCB_LISTEN 16
 #define MEMP_NUM_TCP_PCB 1024
 #define TCP_MSS 1460
-#define TCP_SND_BUF 16384
+
+// TCP_WND and TCP_SND_BUF are the largest windows a connection can get; tun2socks
+// starts connections with smaller ones and opens them up at runtime
+#define LWIP_WND_SCALE 1
+#define TCP_RCV_SCALE 7
+#define TCP_WND (4 * 1024 * 1024)
+#define TCP_SND_BUF (4 * 1024 * 1024)
 #define TCP_SND_QUEUELEN (4 * (TCP_SND_BUF)/(TCP_MSS))
+#define TCP_SNDLOWAT (16 * TCP_MSS)
+
+// selective acknowledgements in both directions, and loss recovery counters
+// which tun2socks reports per connection
+#define LWIP_TCP_SACK_OUT 1
+#define LWIP_TCP_SACK_IN 1
+#define LWIP_TCP_PCB_STATS 1
 
+// bound connections still in the handshake, see --tcp-max-pending
+#define TCP_LISTEN_BACKLOG 1
+
+// pools and heap go through mem_clib_malloc, which serves pooled objects
+// from fixed-size pools sized at runtime, see mempools.h
 #define MEM_LIBC_MALLOC 1
 #define MEMP_MEM_MALLOC 1
+#define mem_clib_malloc lwip_mempools_malloc
+#define mem_clib_free lwip_mempools_mfree
+#define mem_clib_calloc lwip_mempools_calloc
+
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
 
 #define LWIP_PERF 0
 #define SYS_LIGHTWEIGHT_PROT 0
@@ -0,0 +1,314 @@
+/**
+ * @file sys.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/balign.h>
+#include <misc/maxalign.h>
+#include <base/BLog.h>
+
+#include <lwip/memp.h>
+#include <lwip/priv/memp_priv.h>
+
+#include <lwip/custom/mempools.h>
+
+#ifdef BADVPN_LINUX
+#include <sys/mman.h>
+#endif
+
+#include <generated/blog_channel_lwip.h>
+
+// huge pages are assumed to be this large when rounding up the arena size
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+// allocations outside the pools are preceded by their size, in a header
+// which keeps the memory after it aligned for any type
+#define HEAP_HEADER_SIZE balign_up(sizeof(size_t), BMAX_ALIGN)
+
+struct pool {
+    size_t alloc_size;
+    size_t elem_size;
+    char *start;
+    char *end;
+    void *free_list;
+    struct lwip_mempools_stats stats;
+};
+
+static const memp_t pool_types[LWIP_MEMPOOLS_NUM] = {MEMP_PBUF_POOL, MEMP_TCP_SEG, MEMP_TCP_PCB};
+static const char *pool_names[LWIP_MEMPOOLS_NUM] = {"pbuf", "tcp_seg", "tcp_pcb"};
+
+static int initialized;
+static struct pool pools[LWIP_MEMPOOLS_NUM];
+static char *arena;
+static size_t arena_size;
+static int arena_mmapped;
+static size_t heap_bytes;
+
+static struct pool * find_pool_for_size (size_t size)
+{
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        if (pools[i].start != pools[i].end && pools[i].alloc_size == size) {
+            return &pools[i];
+        }
+    }
+    
+    return NULL;
+}
+
+static struct pool * find_pool_for_ptr (char *ptr)
+{
+    if (!(ptr >= arena && ptr < arena + arena_size)) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        if (ptr >= pools[i].start && ptr < pools[i].end) {
+            return &pools[i];
+        }
+    }
+    
+    return NULL;
+}
+
+static int alloc_arena (int hugepages)
+{
+    arena_mmapped = 0;
+    
+    if (arena_size == 0) {
+        arena = NULL;
+        return 1;
+    }
+    
+    if (hugepages) {
+#ifdef BADVPN_LINUX
+        size_t size = arena_size;
+        if (!BSizeAlign(&size, HUGEPAGE_SIZE)) {
+            return 0;
+        }
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            arena = (char *)mem;
+            arena_size = size;
+            arena_mmapped = 1;
+            return 1;
+        }
+        BLog(BLOG_WARNING, "huge pages not available for memory pools, using normal memory");
+#else
+        BLog(BLOG_WARNING, "huge pages not supported on this platform, using normal memory");
+#endif
+    }
+    
+    if (!(arena = (char *)BAlloc(arena_size))) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+int lwip_mempools_init (const int nums[LWIP_MEMPOOLS_NUM], int hugepages)
+{
+    ASSERT(!initialized)
+    
+    // compute element sizes and the arena layout
+    arena_size = 0;
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        ASSERT(nums[i] >= 0)
+        struct pool *p = &pools[i];
+        
+        // this is what memp_malloc asks mem_malloc for with MEMP_MEM_MALLOC
+        p->alloc_size = MEMP_SIZE + MEMP_ALIGN_SIZE(memp_pools[pool_types[i]]->size);
+        
+        // free elements hold the free list link, and are aligned for any type
+        p->elem_size = balign_up(p->alloc_size < sizeof(void *) ? sizeof(void *) : p->alloc_size, BMAX_ALIGN);
+        
+        size_t size = p->elem_size;
+        if (!BSizeAlign(&arena_size, BMAX_ALIGN) || (nums[i] > 0 && size > SIZE_MAX / nums[i]) || !BSizeAdd(&arena_size, size * nums[i])) {
+            BLog(BLOG_ERROR, "memory pools too large");
+            return 0;
+        }
+    }
+    
+    // allocate arena
+    if (!alloc_arena(hugepages)) {
+        BLog(BLOG_ERROR, "failed to allocate memory pools");
+        return 0;
+    }
+    
+    // carve the pools from the arena, first element at the head of the free list
+    size_t offset = 0;
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        struct pool *p = &pools[i];
+        offset = balign_up(offset, BMAX_ALIGN);
+        p->start = arena + offset;
+        p->end = p->start + p->elem_size * nums[i];
+        offset += p->elem_size * nums[i];
+        
+        p->free_list = NULL;
+        for (int j = nums[i] - 1; j >= 0; j--) {
+            char *elem = p->start + p->elem_size * j;
+            *(void **)elem = p->free_list;
+            p->free_list = elem;
+        }
+        
+        memset(&p->stats, 0, sizeof(p->stats));
+        p->stats.elem_size = p->elem_size;
+        p->stats.num = nums[i];
+    }
+    
+    initialized = 1;
+    
+    return 1;
+}
+
+void lwip_mempools_free (void)
+{
+    ASSERT(initialized)
+    
+    initialized = 0;
+    
+    // free arena
+#ifdef BADVPN_LINUX
+    if (arena_mmapped) {
+        munmap(arena, arena_size);
+    } else
+#endif
+    {
+        BFree(arena);
+    }
+    
+    arena = NULL;
+    arena_size = 0;
+    memset(pools, 0, sizeof(pools));
+}
+
+void lwip_mempools_get_stats (int pool, struct lwip_mempools_stats *stats)
+{
+    ASSERT(pool >= 0)
+    ASSERT(pool < LWIP_MEMPOOLS_NUM)
+    
+    *stats = pools[pool].stats;
+}
+
+size_t lwip_mempools_bytes_used (void)
+{
+    size_t bytes = heap_bytes;
+    
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        bytes += pools[i].stats.used * pools[i].elem_size;
+    }
+    
+    return bytes;
+}
+
+const char * lwip_mempools_name (int pool)
+{
+    ASSERT(pool >= 0)
+    ASSERT(pool < LWIP_MEMPOOLS_NUM)
+    
+    return pool_names[pool];
+}
+
+void * lwip_mempools_malloc (size_t size)
+{
+    struct pool *p;
+    if (initialized && (p = find_pool_for_size(size))) {
+        // take element from free list
+        if (p->free_list) {
+            void *elem = p->free_list;
+            p->free_list = *(void **)elem;
+            
+            p->stats.used++;
+            if (p->stats.used > p->stats.max_used) {
+                p->stats.max_used = p->stats.used;
+            }
+            
+            return elem;
+        }
+        
+        // pool exhausted, fall back to malloc
+        p->stats.fallbacks++;
+    }
+    
+    if (size > SIZE_MAX - HEAP_HEADER_SIZE) {
+        return NULL;
+    }
+    
+    char *mem = (char *)malloc(HEAP_HEADER_SIZE + size);
+    if (!mem) {
+        return NULL;
+    }
+    
+    *(size_t *)mem = size;
+    heap_bytes += size;
+    
+    return mem + HEAP_HEADER_SIZE;
+}
+
+void * lwip_mempools_calloc (size_t count, size_t size)
+{
+    if (count > 0 && size > SIZE_MAX / count) {
+        return NULL;
+    }
+    
+    void *mem = lwip_mempools_malloc(count * size);
+    if (!mem) {
+        return NULL;
+    }
+    
+    memset(mem, 0, count * size);
+    
+    return mem;
+}
+
+void lwip_mempools_mfree (void *ptr)
+{
+    ASSERT(ptr)
+    
+    struct pool *p;
+    if (initialized && (p = find_pool_for_ptr((char *)ptr))) {
+        ASSERT(((char *)ptr - p->start) % p->elem_size == 0)
+        ASSERT(p->stats.used > 0)
+        
+        // put element on free list
+        *(void **)ptr = p->free_list;
+        p->free_list = ptr;
+        
+        p->stats.used--;
+        return;
+    }
+    
+    char *mem = (char *)ptr - HEAP_HEADER_SIZE;
+    ASSERT(*(size_t *)mem <= heap_bytes)
+    heap_bytes -= *(size_t *)mem;
+    
+    free(mem);
+}
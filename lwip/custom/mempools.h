@@ -0,0 +1,137 @@
+/**
+ * @file mempools.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Fixed-size memory pools for lwIP, sized at runtime.
+ * 
+ * lwIP is built with MEM_LIBC_MALLOC and MEMP_MEM_MALLOC, and lwipopts.h
+ * routes its allocations to {@link lwip_mempools_malloc} and
+ * {@link lwip_mempools_mfree}. Allocations of the size of a pooled element
+ * (PBUF_POOL pbufs, TCP segments and TCP PCBs) are served from free lists
+ * in a single preallocated arena, so these objects are recycled instead of
+ * going through malloc and free. Anything else, and any allocation while the
+ * matching pool is exhausted or before {@link lwip_mempools_init}, falls back
+ * to malloc.
+ * 
+ * The memory lwIP holds, in the pools and outside of them, is counted, for
+ * programs which budget their memory; see {@link lwip_mempools_bytes_used}.
+ */
+
+#ifndef LWIP_CUSTOM_MEMPOOLS_H
+#define LWIP_CUSTOM_MEMPOOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LWIP_MEMPOOLS_PBUF 0
+#define LWIP_MEMPOOLS_TCP_SEG 1
+#define LWIP_MEMPOOLS_TCP_PCB 2
+#define LWIP_MEMPOOLS_NUM 3
+
+struct lwip_mempools_stats {
+    size_t elem_size;
+    int num;
+    int used;
+    int max_used;
+    uint64_t fallbacks;
+};
+
+/**
+ * Allocates the pools.
+ * Must be called before lwip_init(), and not again before
+ * {@link lwip_mempools_free}.
+ * 
+ * @param nums number of elements in each pool, indexed by LWIP_MEMPOOLS_*.
+ *             Each must be >=0; a pool with zero elements is not used.
+ * @param hugepages whether to try to back the arena with huge pages. If huge
+ *                  pages are not available, a warning is logged and normal
+ *                  memory is used.
+ * @return 1 on success, 0 on failure
+ */
+int lwip_mempools_init (const int nums[LWIP_MEMPOOLS_NUM], int hugepages);
+
+/**
+ * Frees the pools.
+ * Must only be called when lwIP will not be used any more, since objects
+ * lwIP still holds in the pools are released with them.
+ */
+void lwip_mempools_free (void);
+
+/**
+ * Returns the statistics of a pool.
+ * 
+ * @param pool pool index, one of LWIP_MEMPOOLS_*
+ * @param stats returns the statistics. If the pools are not initialized,
+ *              all values are zero.
+ */
+void lwip_mempools_get_stats (int pool, struct lwip_mempools_stats *stats);
+
+/**
+ * Returns how many bytes lwIP currently holds: the elements of the pools
+ * in use, and the memory allocated outside of the pools.
+ * 
+ * @return number of bytes
+ */
+size_t lwip_mempools_bytes_used (void);
+
+/**
+ * Returns the name of a pool, for logging.
+ * 
+ * @param pool pool index, one of LWIP_MEMPOOLS_*
+ * @return name of the pool
+ */
+const char * lwip_mempools_name (int pool);
+
+/**
+ * Allocates memory for lwIP. Used as mem_clib_malloc.
+ * 
+ * @param size number of bytes
+ * @return memory aligned for any type, or NULL on failure
+ */
+void * lwip_mempools_malloc (size_t size);
+
+/**
+ * Allocates zeroed memory for lwIP. Used as mem_clib_calloc, so that this
+ * memory is counted and can be freed with {@link lwip_mempools_mfree}.
+ * 
+ * @param count number of elements
+ * @param size size of an element, in bytes
+ * @return zeroed memory aligned for any type, or NULL on failure
+ */
+void * lwip_mempools_calloc (size_t count, size_t size);
+
+/**
+ * Frees memory from {@link lwip_mempools_malloc} or {@link lwip_mempools_calloc}.
+ * Used as mem_clib_free.
+ * 
+ * @param ptr memory to free. Must not be NULL.
+ */
+void lwip_mempools_mfree (void *ptr);
+
+#endif
@@ -118,6 +118,18 @@ static u16_t ip_reass_pbufcount;
 static void ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev);
 static int ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev);
 
+#if LWIP_TIMERS_ON_DEMAND
+/**
+ * Returns whether ip_reass_tmr() needs to be called, i.e. whether any
+ * datagram is waiting for more fragments.
+ */
+u8_t
+ip_reass_tmr_needed(void)
+{
+  return reassdatagrams != NULL;
+}
+#endif /* LWIP_TIMERS_ON_DEMAND */
+
 /**
  * Reassembly timer base function
  * for both NO_SYS == 0 and 1 (!).
@@ -109,6 +109,18 @@ static void ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr);
 static void ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed);
 #endif /* IP_REASS_FREE_OLDEST */
 
+#if LWIP_TIMERS_ON_DEMAND
+/**
+ * Returns whether ip6_reass_tmr() needs to be called, i.e. whether any
+ * datagram is waiting for more fragments.
+ */
+u8_t
+ip6_reass_tmr_needed(void)
+{
+  return reassdatagrams != NULL;
+}
+#endif /* LWIP_TIMERS_ON_DEMAND */
+
 void
 ip6_reass_tmr(void)
 {
@@ -166,6 +166,71 @@ tcp_tmr(void)
   }
 }
 
+#if LWIP_TIMERS_ON_DEMAND
+/** Whether tcp_tmr() has anything to do for an active pcb. */
+static u8_t
+tcp_pcb_tmr_needed(const struct tcp_pcb *pcb)
+{
+  switch (pcb->state) {
+    case ESTABLISHED:
+    case CLOSE_WAIT:
+      break;
+    case FIN_WAIT_2:
+      /* only a fully closed pcb times out in FIN-WAIT-2 */
+      if (pcb->flags & TF_RXCLOSED) {
+        return 1;
+      }
+      break;
+    default:
+      /* handshake and closing timeouts */
+      return 1;
+  }
+  /* retransmission and persist timers, delayed ACK, pending FIN */
+  if (pcb->unacked != NULL || pcb->persist_backoff > 0 ||
+      (pcb->flags & (TF_ACK_DELAY | TF_CLOSEPEND))) {
+    return 1;
+  }
+  if (pcb->refused_data != NULL) {
+    return 1;
+  }
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL) {
+    return 1;
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+  if (ip_get_option(pcb, SOF_KEEPALIVE)) {
+    return 1;
+  }
+#if LWIP_CALLBACK_API
+  return pcb->poll != NULL;
+#else /* LWIP_CALLBACK_API */
+  return 1;
+#endif /* LWIP_CALLBACK_API */
+}
+
+/**
+ * Returns whether tcp_tmr() needs to be called, i.e. whether any pcb has a
+ * timer running or is waiting for a timeout. Idle established connections
+ * don't need it; while tcp_tmr() isn't called, tcp_ticks stands still, which
+ * only delays the inactivity timeouts of pcbs that are waiting for nothing.
+ */
+u8_t
+tcp_tmr_needed(void)
+{
+  struct tcp_pcb *pcb;
+
+  if (tcp_tw_pcbs != NULL) {
+    return 1;
+  }
+  for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+    if (tcp_pcb_tmr_needed(pcb)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* LWIP_TIMERS_ON_DEMAND */
+
 #if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
 /** Called when a listen pcb is closed. Iterates one pcb list and removes the
  * closed listener pcb from pcb->listener if matching.
@@ -371,6 +436,9 @@ tcp_close_shutdown_fin(struct tcp_pcb *pcb)
   } else if (err == ERR_MEM) {
     /* Mark this pcb for closing. Closing is retried from tcp_tmr. */
     tcp_set_flags(pcb, TF_CLOSEPEND);
+#if LWIP_TIMERS_ON_DEMAND
+    tcp_timer_needed();
+#endif /* LWIP_TIMERS_ON_DEMAND */
     /* We have to return ERR_OK from here to indicate to the callers that this
        pcb should not be used any more as it will be freed soon via tcp_tmr.
        This is OK here since sending FIN does not guarantee a time frime for
@@ -81,6 +81,12 @@ static u8_t flags;
 static u8_t recv_flags;
 static struct pbuf *recv_data;
 
+#if LWIP_TCP_SACK_IN
+/* SACK blocks of the segment being processed (at most 4 fit in the options) */
+static struct tcp_sack_range sack_blocks[4];
+static u8_t num_sack_blocks;
+#endif /* LWIP_TCP_SACK_IN */
+
 struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
@@ -101,6 +107,11 @@ static void tcp_remove_sacks_gt(struct tcp_pcb *pcb, u32_t seq);
 #endif /* TCP_OOSEQ_BYTES_LIMIT || TCP_OOSEQ_PBUFS_LIMIT */
 #endif /* LWIP_TCP_SACK_OUT */
 
+#if LWIP_TCP_SACK_IN
+static u32_t tcp_sack_update(struct tcp_pcb *pcb);
+static void tcp_sack_recover(struct tcp_pcb *pcb, u32_t sacked);
+#endif /* LWIP_TCP_SACK_IN */
+
 /**
  * The initial input processing of TCP. It verifies the TCP header, demultiplexes
  * the segment between the PCBs and passes it on to tcp_process(), which implements
@@ -1115,6 +1126,9 @@ tcp_receive(struct tcp_pcb *pcb)
   s16_t m;
   u32_t right_wnd_edge;
   int found_dupack = 0;
+#if LWIP_TCP_SACK_IN
+  u32_t sacked = 0;
+#endif /* LWIP_TCP_SACK_IN */
 
   LWIP_ASSERT("tcp_receive: wrong state", pcb->state >= ESTABLISHED);
 
@@ -1145,6 +1159,13 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif /* TCP_WND_DEBUG */
     }
 
+#if LWIP_TCP_SACK_IN
+    /* Mark segments which the remote host has selectively acknowledged. */
+    if (pcb->flags & TF_SACK) {
+      sacked = tcp_sack_update(pcb);
+    }
+#endif /* LWIP_TCP_SACK_IN */
+
     /* (From Stevens TCP/IP Illustrated Vol II, p970.) Its only a
      * duplicate ack if:
      * 1) It doesn't ACK new data
@@ -1196,6 +1217,11 @@ tcp_receive(struct tcp_pcb *pcb)
       if (!found_dupack) {
         pcb->dupacks = 0;
       }
+#if LWIP_TCP_SACK_IN
+      if (pcb->flags & TF_SACK) {
+        tcp_sack_recover(pcb, sacked);
+      }
+#endif /* LWIP_TCP_SACK_IN */
     } else if (TCP_SEQ_BETWEEN(ackno, pcb->lastack + 1, pcb->snd_nxt)) {
       /* We come here when the ACK acknowledges new data. */
       tcpwnd_size_t acked;
@@ -1204,9 +1230,22 @@ tcp_receive(struct tcp_pcb *pcb)
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        tcp_clear_flags(pcb, TF_INFR);
-        pcb->cwnd = pcb->ssthresh;
-        pcb->bytes_acked = 0;
+#if LWIP_TCP_SACK_IN
+        if ((pcb->flags & TF_SACK) && TCP_SEQ_LT(ackno, pcb->recover)) {
+          /* Partial ACK (RFC 6582): stay in fast recovery and deflate the
+             congestion window by the amount of new data acknowledged. */
+          tcpwnd_size_t partial = (tcpwnd_size_t)(ackno - pcb->lastack);
+          pcb->cwnd = (pcb->cwnd > partial) ? (tcpwnd_size_t)(pcb->cwnd - partial) : 0;
+          if (partial >= pcb->mss || pcb->cwnd < pcb->mss) {
+            TCP_WND_INC(pcb->cwnd, pcb->mss);
+          }
+        } else
+#endif /* LWIP_TCP_SACK_IN */
+        {
+          tcp_clear_flags(pcb, TF_INFR);
+          pcb->cwnd = pcb->ssthresh;
+          pcb->bytes_acked = 0;
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -1224,7 +1263,7 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
+      if (pcb->state >= ESTABLISHED && !(pcb->flags & TF_INFR)) {
         if (pcb->cwnd < pcb->ssthresh) {
           tcpwnd_size_t increase;
           /* limit to 1 SMSS segment during period following RTO */
@@ -1300,6 +1339,19 @@ tcp_receive(struct tcp_pcb *pcb)
           tcp_clear_flags(pcb, TF_RTO);
         }
       }
+#if LWIP_TCP_SACK_IN
+      if (pcb->flags & TF_SACK) {
+        if (pcb->flags & TF_INFR) {
+          /* After a partial ACK, the segment now at the left edge is missing too. */
+          struct tcp_seg *seg = pcb->unacked;
+          if (seg != NULL && !(seg->flags & (TF_SEG_SACKED | TF_SEG_REXMIT_LOST)) &&
+              tcp_rexmit(pcb) == ERR_OK) {
+            seg->flags |= TF_SEG_REXMIT_LOST;
+          }
+        }
+        tcp_sack_recover(pcb, tcp_sack_update(pcb));
+      }
+#endif /* LWIP_TCP_SACK_IN */
       /* End of ACK for new data processing. */
     } else {
       /* Out of sequence ACK, didn't really ack anything */
@@ -1884,6 +1936,11 @@ tcp_parseopt(struct tcp_pcb *pcb)
 #if LWIP_TCP_TIMESTAMPS
   u32_t tsval;
 #endif
+#if LWIP_TCP_SACK_IN
+  u8_t i;
+
+  num_sack_blocks = 0;
+#endif
 
   /* Parse the TCP MSS option, if present. */
   if (tcphdr_optlen != 0) {
@@ -1977,6 +2034,33 @@ tcp_parseopt(struct tcp_pcb *pcb)
           }
           break;
 #endif /* LWIP_TCP_SACK_OUT */
+#if LWIP_TCP_SACK_IN
+        case LWIP_TCP_OPT_SACK:
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: SACK\n"));
+          data = tcp_get_next_optbyte();
+          if (data < 10 || ((data - 2) % 8) != 0 || (tcp_optidx - 2 + data) > tcphdr_optlen) {
+            /* Bad length */
+            LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+            return;
+          }
+          /* TCP SACK option with valid length, store the blocks */
+          for (data = (u8_t)((data - 2) / 8); data > 0; data--) {
+            u32_t left = 0;
+            u32_t right = 0;
+            for (i = 0; i < 4; i++) {
+              left = (left << 8) | tcp_get_next_optbyte();
+            }
+            for (i = 0; i < 4; i++) {
+              right = (right << 8) | tcp_get_next_optbyte();
+            }
+            if (num_sack_blocks < LWIP_ARRAYSIZE(sack_blocks)) {
+              sack_blocks[num_sack_blocks].left = left;
+              sack_blocks[num_sack_blocks].right = right;
+              num_sack_blocks++;
+            }
+          }
+          break;
+#endif /* LWIP_TCP_SACK_IN */
         default:
           LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: other\n"));
           data = tcp_get_next_optbyte();
@@ -1994,6 +2078,64 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_SACK_IN
+/**
+ * Called by tcp_receive() to mark unacked segments covered by the SACK blocks
+ * of the incoming segment.
+ *
+ * @param pcb the tcp_pcb for which a segment arrived
+ * @return the number of SACKed bytes on the unacked queue
+ */
+static u32_t
+tcp_sack_update(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  u32_t sacked = 0;
+  u8_t i;
+
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (!(seg->flags & TF_SEG_SACKED) && seg->len > 0) {
+      u32_t left = lwip_ntohl(seg->tcphdr->seqno);
+      u32_t right = left + seg->len;
+      for (i = 0; i < num_sack_blocks; i++) {
+        /* D-SACKs and blocks outside of the sent data never cover a segment here */
+        if (TCP_SEQ_LEQ(sack_blocks[i].left, left) && TCP_SEQ_LEQ(right, sack_blocks[i].right) &&
+            TCP_SEQ_LEQ(sack_blocks[i].right, pcb->snd_nxt)) {
+          seg->flags |= TF_SEG_SACKED;
+          break;
+        }
+      }
+    }
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked += seg->len;
+    }
+  }
+
+  return sacked;
+}
+
+/**
+ * Called by tcp_receive() after processing an ACK which did not end fast
+ * recovery. Enters fast recovery when SACK shows the first unacked segment
+ * to be lost, before three duplicate ACKs have arrived, and retransmits lost
+ * segments during fast recovery.
+ *
+ * @param pcb the tcp_pcb for which a segment arrived
+ * @param sacked the number of SACKed bytes on the unacked queue
+ */
+static void
+tcp_sack_recover(struct tcp_pcb *pcb, u32_t sacked)
+{
+  if (pcb->flags & TF_INFR) {
+    tcp_rexmit_sack_lost(pcb);
+  } else if (sacked > 2U * pcb->mss) {
+    /* The first unacked segment is never SACKed (it would be acked), and
+       enough data above it is SACKed to consider it lost (RFC 6675). */
+    tcp_rexmit_fast(pcb);
+  }
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 void
 tcp_trigger_input_pcb_close(void)
 {
@@ -1123,6 +1123,11 @@ tcp_output(struct tcp_pcb *pcb)
     return ERR_OK;
   }
 
+#if LWIP_TIMERS_ON_DEMAND
+  /* sending may start the retransmission or persist timer */
+  tcp_timer_needed();
+#endif /* LWIP_TIMERS_ON_DEMAND */
+
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
   seg = pcb->unsent;
@@ -1221,7 +1226,16 @@ tcp_output(struct tcp_pcb *pcb)
       TCPH_SET_FLAG(seg->tcphdr, TCP_ACK);
     }
 
-    err = tcp_output_segment(seg, pcb, netif);
+#if LWIP_TCP_SACK_IN
+    if (seg->flags & TF_SEG_SACKED) {
+      /* the remote host already has this segment (queued again by an RTO),
+         so only move it back to the unacked queue */
+      err = ERR_OK;
+    } else
+#endif /* LWIP_TCP_SACK_IN */
+    {
+      err = tcp_output_segment(seg, pcb, netif);
+    }
     if (err != ERR_OK) {
       /* segment could not be sent, for whatever reason */
       tcp_set_flags(pcb, TF_NAGLEMEMERR);
@@ -1235,6 +1249,15 @@ tcp_output(struct tcp_pcb *pcb)
       tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
     }
     snd_nxt = lwip_ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+#if LWIP_TCP_PCB_STATS
+    if (TCP_TCPLEN(seg) > 0 && TCP_SEQ_LEQ(snd_nxt, pcb->snd_nxt)
+#if LWIP_TCP_SACK_IN
+        && !(seg->flags & TF_SEG_SACKED)
+#endif /* LWIP_TCP_SACK_IN */
+       ) {
+      pcb->stats.rexmit_segs++;
+    }
+#endif /* LWIP_TCP_PCB_STATS */
     if (TCP_SEQ_LT(pcb->snd_nxt, snd_nxt)) {
       pcb->snd_nxt = snd_nxt;
     }
@@ -1576,6 +1599,21 @@ tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
   pcb->rto_end = lwip_ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
   /* Don't take any RTT measurements after retransmitting. */
   pcb->rttest = 0;
+#if LWIP_TCP_SACK_IN
+  /* The timeout ends fast recovery (RFC 6675, section 5.1). If the previous
+     timeout made no progress either, the receiver may have discarded data it
+     SACKed, so send everything again. */
+  tcp_clear_flags(pcb, TF_INFR);
+  for (seg = pcb->unsent; seg != NULL; seg = seg->next) {
+    seg->flags &= (u8_t)~TF_SEG_REXMIT_LOST;
+    if (pcb->nrtx > 0) {
+      seg->flags &= (u8_t)~TF_SEG_SACKED;
+    }
+  }
+#endif /* LWIP_TCP_SACK_IN */
+#if LWIP_TCP_PCB_STATS
+  pcb->stats.rtos++;
+#endif /* LWIP_TCP_PCB_STATS */
 
   return ERR_OK;
 }
@@ -1613,6 +1651,33 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
   }
 }
 
+/**
+ * Insert a segment taken off the unacked queue into the unsent queue,
+ * keeping the unsent queue sorted.
+ *
+ * @param pcb the tcp_pcb the segment belongs to
+ * @param seg the segment to requeue
+ */
+static void
+tcp_rexmit_requeue(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct tcp_seg **cur_seg;
+
+  cur_seg = &(pcb->unsent);
+  while (*cur_seg &&
+         TCP_SEQ_LT(lwip_ntohl((*cur_seg)->tcphdr->seqno), lwip_ntohl(seg->tcphdr->seqno))) {
+    cur_seg = &((*cur_seg)->next );
+  }
+  seg->next = *cur_seg;
+  *cur_seg = seg;
+#if TCP_OVERSIZE
+  if (seg->next == NULL) {
+    /* the retransmitted segment is last in unsent, so reset unsent_oversize */
+    pcb->unsent_oversize = 0;
+  }
+#endif /* TCP_OVERSIZE */
+}
+
 /**
  * Requeue the first unacked segment for retransmission
  *
@@ -1624,7 +1689,6 @@ err_t
 tcp_rexmit(struct tcp_pcb *pcb)
 {
   struct tcp_seg *seg;
-  struct tcp_seg **cur_seg;
 
   if (pcb->unacked == NULL) {
     return ERR_VAL;
@@ -1640,22 +1704,8 @@ tcp_rexmit(struct tcp_pcb *pcb)
   }
 
   /* Move the first unacked segment to the unsent queue */
-  /* Keep the unsent queue sorted. */
   pcb->unacked = seg->next;
-
-  cur_seg = &(pcb->unsent);
-  while (*cur_seg &&
-         TCP_SEQ_LT(lwip_ntohl((*cur_seg)->tcphdr->seqno), lwip_ntohl(seg->tcphdr->seqno))) {
-    cur_seg = &((*cur_seg)->next );
-  }
-  seg->next = *cur_seg;
-  *cur_seg = seg;
-#if TCP_OVERSIZE
-  if (seg->next == NULL) {
-    /* the retransmitted segment is last in unsent, so reset unsent_oversize */
-    pcb->unsent_oversize = 0;
-  }
-#endif /* TCP_OVERSIZE */
+  tcp_rexmit_requeue(pcb, seg);
 
   if (pcb->nrtx < 0xFF) {
     ++pcb->nrtx;
@@ -1680,6 +1730,10 @@ tcp_rexmit(struct tcp_pcb *pcb)
 void
 tcp_rexmit_fast(struct tcp_pcb *pcb)
 {
+#if LWIP_TCP_SACK_IN
+  struct tcp_seg *seg;
+#endif /* LWIP_TCP_SACK_IN */
+
   if (pcb->unacked != NULL && !(pcb->flags & TF_INFR)) {
     /* This is fast retransmit. Retransmit the first unacked segment. */
     LWIP_DEBUGF(TCP_FR_DEBUG,
@@ -1687,7 +1741,21 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  "), fast retransmit %"U32_F"\n",
                  (u16_t)pcb->dupacks, pcb->lastack,
                  lwip_ntohl(pcb->unacked->tcphdr->seqno)));
+#if LWIP_TCP_SACK_IN
+    /* marks from an earlier recovery do not apply to this one */
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      seg->flags &= (u8_t)~TF_SEG_REXMIT_LOST;
+    }
+    seg = pcb->unacked;
+#endif /* LWIP_TCP_SACK_IN */
     if (tcp_rexmit(pcb) == ERR_OK) {
+#if LWIP_TCP_SACK_IN
+      seg->flags |= TF_SEG_REXMIT_LOST;
+      pcb->recover = pcb->snd_nxt;
+#endif /* LWIP_TCP_SACK_IN */
+#if LWIP_TCP_PCB_STATS
+      pcb->stats.fast_recoveries++;
+#endif /* LWIP_TCP_PCB_STATS */
       /* Set ssthresh to half of the minimum of the current
        * cwnd and the advertised window */
       pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
@@ -1706,9 +1774,73 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
 
       /* Reset the retransmission timer to prevent immediate rto retransmissions */
       pcb->rtime = 0;
+
+#if LWIP_TCP_SACK_IN
+      /* SACK may already show more holes */
+      tcp_rexmit_sack_lost(pcb);
+#endif /* LWIP_TCP_SACK_IN */
+    }
+  }
+}
+
+#if LWIP_TCP_SACK_IN
+/**
+ * Requeue the unacked segments which SACK information shows to be lost,
+ * each at most once per fast recovery.
+ *
+ * A segment is considered lost when more than (DupThresh - 1) * SMSS bytes
+ * above it have been SACKed (IsLost() of RFC 6675, with DupThresh 3).
+ *
+ * Called by tcp_receive() during fast recovery.
+ *
+ * @param pcb the tcp_pcb for which to retransmit lost segments
+ * @return the number of segments requeued
+ */
+u16_t
+tcp_rexmit_sack_lost(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  struct tcp_seg **cur_seg;
+  u32_t sacked_above = 0;
+  u16_t num = 0;
+
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above += seg->len;
     }
   }
+
+  cur_seg = &(pcb->unacked);
+  while (*cur_seg != NULL) {
+    seg = *cur_seg;
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above -= seg->len;
+    } else {
+      if (sacked_above <= 2U * pcb->mss) {
+        /* SACKed data above the remaining segments only gets smaller */
+        break;
+      }
+      if (!(seg->flags & TF_SEG_REXMIT_LOST) && !tcp_output_segment_busy(seg)) {
+        /* Move the segment to the unsent queue */
+        *cur_seg = seg->next;
+        seg->flags |= TF_SEG_REXMIT_LOST;
+        tcp_rexmit_requeue(pcb, seg);
+        MIB2_STATS_INC(mib2.tcpretranssegs);
+        num++;
+        continue;
+      }
+    }
+    cur_seg = &(seg->next);
+  }
+
+  if (num > 0) {
+    /* Don't take any rtt measurements after retransmitting. */
+    pcb->rttest = 0;
+  }
+
+  return num;
 }
+#endif /* LWIP_TCP_SACK_IN */
 
 
 /**
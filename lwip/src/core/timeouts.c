@@ -425,7 +425,7 @@ again:
 
 #endif /* NO_SYS */
 
-#else /* LWIP_TIMERS && !LWIP_TIMERS_CUSTOM */
+#elif !LWIP_TIMERS_ON_DEMAND /* LWIP_TIMERS && !LWIP_TIMERS_CUSTOM */
 /* Satisfy the TCP code which calls this function */
 void
 tcp_timer_needed(void)
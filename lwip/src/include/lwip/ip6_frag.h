@@ -113,6 +113,9 @@ struct ip6_reassdata {
 
 #define ip6_reass_init() /* Compatibility define */
 void ip6_reass_tmr(void);
+#if LWIP_TIMERS_ON_DEMAND
+u8_t ip6_reass_tmr_needed(void);
+#endif /* LWIP_TIMERS_ON_DEMAND */
 struct pbuf *ip6_reass(struct pbuf *p);
 
 #endif /* LWIP_IPV6 && LWIP_IPV6_REASS */
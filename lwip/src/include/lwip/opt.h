@@ -120,6 +120,18 @@
 #if !defined LWIP_TIMERS_CUSTOM || defined __DOXYGEN__
 #define LWIP_TIMERS_CUSTOM              0
 #endif
+
+/**
+ * LWIP_TIMERS_ON_DEMAND==1: the application calls the protocol timers only
+ * while they have something to do (NO_SYS without LWIP_TIMERS). It must
+ * provide tcp_timer_needed(), which TCP calls when a PCB may have started
+ * needing tcp_tmr(), start the timers when it passes a packet to a netif's
+ * input function, and may stop them when tcp_tmr_needed(),
+ * ip_reass_tmr_needed() and ip6_reass_tmr_needed() all return 0.
+ */
+#if !defined LWIP_TIMERS_ON_DEMAND || defined __DOXYGEN__
+#define LWIP_TIMERS_ON_DEMAND           0
+#endif
 /**
  * @}
  */
@@ -1241,6 +1253,25 @@
 #define LWIP_TCP_MAX_SACK_NUM           4
 #endif
 
+/**
+ * LWIP_TCP_SACK_IN==1: TCP will use selective acknowledgements received from
+ * the remote host for loss recovery. SACKed segments are not retransmitted, and
+ * during fast recovery every segment which RFC 6675 considers lost is
+ * retransmitted, not only the first unacknowledged one. Partial ACKs keep the
+ * connection in fast recovery. Requires LWIP_TCP_SACK_OUT, which negotiates SACK.
+ */
+#if !defined LWIP_TCP_SACK_IN || defined __DOXYGEN__
+#define LWIP_TCP_SACK_IN                0
+#endif
+
+/**
+ * LWIP_TCP_PCB_STATS==1: each tcp_pcb counts its retransmitted segments,
+ * fast recoveries and retransmission timeouts (see struct tcp_pcb_stats).
+ */
+#if !defined LWIP_TCP_PCB_STATS || defined __DOXYGEN__
+#define LWIP_TCP_PCB_STATS              0
+#endif
+
 /**
  * TCP_MSS: TCP Maximum segment size. (default is 536, a conservative default,
  * you might want to increase this.)
@@ -66,6 +66,10 @@ void             tcp_tmr     (void);  /* Must be called every
    intervals (instead of calling tcp_tmr()). */
 void             tcp_slowtmr (void);
 void             tcp_fasttmr (void);
+#if LWIP_TIMERS_ON_DEMAND
+/* Whether tcp_tmr() has anything to do (see LWIP_TIMERS_ON_DEMAND). */
+u8_t             tcp_tmr_needed (void);
+#endif /* LWIP_TIMERS_ON_DEMAND */
 
 /* Call this from a netif driver (watch out for threading issues!) that has
    returned a memory error on transmit and now has free buffers to send more.
@@ -84,6 +88,9 @@ err_t            tcp_rexmit_rto_prepare(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto_commit(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
 void             tcp_rexmit_fast (struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK_IN
+u16_t            tcp_rexmit_sack_lost (struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK_IN */
 u32_t            tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb);
 err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
 
@@ -267,6 +274,10 @@ struct tcp_seg {
                                                checksummed into 'chksum' */
 #define TF_SEG_OPTS_WND_SCALE   (u8_t)0x08U /* Include WND SCALE option */
 #define TF_SEG_OPTS_SACK_PERM   (u8_t)0x10U /* Include SACK Permitted option */
+#if LWIP_TCP_SACK_IN
+#define TF_SEG_SACKED           (u8_t)0x20U /* Selectively acknowledged by the remote host. */
+#define TF_SEG_REXMIT_LOST      (u8_t)0x40U /* Retransmitted as lost in the current fast recovery. */
+#endif /* LWIP_TCP_SACK_IN */
   struct tcp_hdr *tcphdr;  /* the TCP header */
 };
 
@@ -275,6 +286,7 @@ struct tcp_seg {
 #define LWIP_TCP_OPT_MSS        2
 #define LWIP_TCP_OPT_WS         3
 #define LWIP_TCP_OPT_SACK_PERM  4
+#define LWIP_TCP_OPT_SACK       5
 #define LWIP_TCP_OPT_TS         8
 
 #define LWIP_TCP_OPT_LEN_MSS    4
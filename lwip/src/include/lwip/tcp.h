@@ -163,6 +163,18 @@ struct tcp_sack_range {
 };
 #endif /* LWIP_TCP_SACK_OUT */
 
+#if LWIP_TCP_PCB_STATS
+/** Loss recovery counters of a tcp_pcb. */
+struct tcp_pcb_stats {
+  /** Number of segments sent again. */
+  u32_t rexmit_segs;
+  /** Number of times fast retransmit / fast recovery was entered. */
+  u32_t fast_recoveries;
+  /** Number of retransmission timeouts. */
+  u32_t rtos;
+};
+#endif /* LWIP_TCP_PCB_STATS */
+
 typedef u16_t tcpflags_t;
 
 /**
@@ -275,6 +287,15 @@ struct tcp_pcb {
   /* first byte following last rto byte */
   u32_t rto_end;
 
+#if LWIP_TCP_SACK_IN
+  /* snd_nxt when fast recovery was entered; recovery ends when this is acked */
+  u32_t recover;
+#endif /* LWIP_TCP_SACK_IN */
+
+#if LWIP_TCP_PCB_STATS
+  struct tcp_pcb_stats stats;
+#endif /* LWIP_TCP_PCB_STATS */
+
   /* sender variables */
   u32_t snd_nxt;   /* next new seqno to be sent */
   u32_t snd_wl1, snd_wl2; /* Sequence and acknowledgement numbers of last
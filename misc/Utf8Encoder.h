@@ -67,7 +67,7 @@ int Utf8Encoder_EncodeCharacter (uint32_t ch, uint8_t *out)
         return 3;
     }
     
-    if (ch < UINT32_C(0x10FFFF)) {
+    if (ch <= UINT32_C(0x10FFFF)) {
         out[0] = (0xF0 | (ch >> 18));
         out[1] = (0x80 | ((ch >> 12) & 0x3F));
         out[2] = (0x80 | ((ch >> 6) & 0x3F));
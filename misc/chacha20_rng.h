@@ -0,0 +1,166 @@
+/**
+ * @file chacha20_rng.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Buffered random number generator based on the ChaCha20 block function.
+ * 
+ * Keystream is generated a buffer at a time. The first bytes of every buffer
+ * replace the key before anything is handed out, and bytes are erased from the
+ * buffer as they are returned, so a later compromise of the state does not
+ * reveal earlier output. The generator must be seeded from a system RNG, and
+ * should be reseeded when {@link chacha20_rng_needs_seed} says so.
+ */
+
+#ifndef BADVPN_MISC_CHACHA20_RNG_H
+#define BADVPN_MISC_CHACHA20_RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define CHACHA20_RNG_SEED_SIZE 32
+#define CHACHA20_RNG_BLOCK_SIZE 64
+#define CHACHA20_RNG_BUF_SIZE (16 * CHACHA20_RNG_BLOCK_SIZE)
+#define CHACHA20_RNG_RESEED_BYTES ((uint64_t)1 << 24)
+
+struct chacha20_rng {
+    uint32_t key[8];
+    uint8_t buf[CHACHA20_RNG_BUF_SIZE];
+    size_t pos;
+    uint64_t output_since_seed;
+};
+
+#define CHACHA20_RNG_ROTL(_x, _n) (((_x) << (_n)) | ((_x) >> (32 - (_n))))
+
+#define CHACHA20_RNG_QR(_a, _b, _c, _d) \
+    _a += _b; _d ^= _a; _d = CHACHA20_RNG_ROTL(_d, 16); \
+    _c += _d; _b ^= _c; _b = CHACHA20_RNG_ROTL(_b, 12); \
+    _a += _b; _d ^= _a; _d = CHACHA20_RNG_ROTL(_d, 8); \
+    _c += _d; _b ^= _c; _b = CHACHA20_RNG_ROTL(_b, 7);
+
+static void chacha20_rng__block (const uint32_t *key, uint32_t counter, uint8_t *out)
+{
+    uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, 0, 0, 0
+    };
+    
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    
+    for (int i = 0; i < 10; i++) {
+        CHACHA20_RNG_QR(x[0], x[4], x[8], x[12])
+        CHACHA20_RNG_QR(x[1], x[5], x[9], x[13])
+        CHACHA20_RNG_QR(x[2], x[6], x[10], x[14])
+        CHACHA20_RNG_QR(x[3], x[7], x[11], x[15])
+        CHACHA20_RNG_QR(x[0], x[5], x[10], x[15])
+        CHACHA20_RNG_QR(x[1], x[6], x[11], x[12])
+        CHACHA20_RNG_QR(x[2], x[7], x[8], x[13])
+        CHACHA20_RNG_QR(x[3], x[4], x[9], x[14])
+    }
+    
+    // byte order of the output does not matter for a generator
+    for (int i = 0; i < 16; i++) {
+        x[i] += in[i];
+    }
+    memcpy(out, x, sizeof(x));
+}
+
+static void chacha20_rng__refill (struct chacha20_rng *r)
+{
+    for (int i = 0; i < CHACHA20_RNG_BUF_SIZE / CHACHA20_RNG_BLOCK_SIZE; i++) {
+        chacha20_rng__block(r->key, i, r->buf + i * CHACHA20_RNG_BLOCK_SIZE);
+    }
+    
+    // take the next key from the start of the buffer and erase it there
+    memcpy(r->key, r->buf, sizeof(r->key));
+    memset(r->buf, 0, sizeof(r->key));
+    r->pos = sizeof(r->key);
+}
+
+/**
+ * Seeds the generator, replacing its state.
+ * This doubles as initialization.
+ * 
+ * @param r the generator
+ * @param seed CHACHA20_RNG_SEED_SIZE bytes from a system RNG
+ */
+static void chacha20_rng_seed (struct chacha20_rng *r, const uint8_t *seed)
+{
+    memcpy(r->key, seed, sizeof(r->key));
+    memset(r->buf, 0, sizeof(r->buf));
+    r->pos = CHACHA20_RNG_BUF_SIZE;
+    r->output_since_seed = 0;
+}
+
+/**
+ * Checks if the generator has produced enough output since it was seeded
+ * that it should be seeded again.
+ * 
+ * @param r the generator
+ * @return 1 if it should be reseeded, 0 if not
+ */
+static int chacha20_rng_needs_seed (struct chacha20_rng *r)
+{
+    return (r->output_since_seed >= CHACHA20_RNG_RESEED_BYTES);
+}
+
+/**
+ * Generates random bytes.
+ * 
+ * @param r the generator. Must have been seeded.
+ * @param out output buffer
+ * @param len number of bytes to generate
+ */
+static void chacha20_rng_generate (struct chacha20_rng *r, uint8_t *out, size_t len)
+{
+    r->output_since_seed += len;
+    
+    while (len > 0) {
+        if (r->pos == CHACHA20_RNG_BUF_SIZE) {
+            chacha20_rng__refill(r);
+        }
+        
+        size_t n = CHACHA20_RNG_BUF_SIZE - r->pos;
+        if (n > len) {
+            n = len;
+        }
+        
+        memcpy(out, r->buf + r->pos, n);
+        memset(r->buf + r->pos, 0, n);
+        r->pos += n;
+        out += n;
+        len -= n;
+    }
+}
+
+#endif
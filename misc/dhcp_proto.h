@@ -62,6 +62,7 @@
 #define DHCP_OPTION_REBINDING_TIME_VALUE 59
 #define DHCP_OPTION_VENDOR_CLASS_IDENTIFIER 60
 #define DHCP_OPTION_CLIENT_IDENTIFIER 61
+#define DHCP_OPTION_RAPID_COMMIT 80
 
 #define DHCP_MESSAGE_TYPE_DISCOVER 1
 #define DHCP_MESSAGE_TYPE_OFFER 2
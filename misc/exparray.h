@@ -29,6 +29,10 @@
  * @section DESCRIPTION
  * 
  * Dynamic array which grows exponentionally on demand.
+ * 
+ * The array can start out in a caller-provided buffer (ExpArray_init_buf),
+ * in which case it only moves to the heap when it outgrows that buffer.
+ * Such an array must be released with ExpArray_free, not by freeing v.
  */
 
 #ifndef BADVPN_MISC_EXPARRAY_H
@@ -37,6 +41,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
 
 #include <misc/debug.h>
 
@@ -44,6 +49,7 @@ struct ExpArray {
     size_t esize;
     size_t size;
     void *v;
+    void *heap_v;
 };
 
 static int ExpArray_init (struct ExpArray *o, size_t esize, size_t size)
@@ -62,9 +68,30 @@ static int ExpArray_init (struct ExpArray *o, size_t esize, size_t size)
         return 0;
     }
     
+    o->heap_v = o->v;
+    
     return 1;
 }
 
+static void ExpArray_init_buf (struct ExpArray *o, size_t esize, void *buf, size_t size)
+{
+    ASSERT(esize > 0)
+    ASSERT(size > 0)
+    ASSERT(buf)
+    
+    o->esize = esize;
+    o->size = size;
+    o->v = buf;
+    o->heap_v = NULL;
+}
+
+static void ExpArray_free (struct ExpArray *o)
+{
+    if (o->heap_v) {
+        free(o->heap_v);
+    }
+}
+
 static int ExpArray_resize (struct ExpArray *o, size_t size)
 {
     ASSERT(size > 0)
@@ -87,13 +114,22 @@ static int ExpArray_resize (struct ExpArray *o, size_t size)
         return 0;
     }
     
-    void *newarr = realloc(o->v, newsize * o->esize);
-    if (!newarr) {
-        return 0;
+    void *newarr;
+    if (!o->heap_v) {
+        // spill out of the caller's buffer
+        if (!(newarr = malloc(newsize * o->esize))) {
+            return 0;
+        }
+        memcpy(newarr, o->v, o->size * o->esize);
+    } else {
+        if (!(newarr = realloc(o->heap_v, newsize * o->esize))) {
+            return 0;
+        }
     }
     
     o->size = newsize;
     o->v = newarr;
+    o->heap_v = newarr;
     
     return 1;
 }
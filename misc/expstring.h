@@ -43,7 +43,9 @@ typedef struct {
 } ExpString;
 
 static int ExpString_Init (ExpString *c);
+static void ExpString_InitBuf (ExpString *c, char *buf, size_t size);
 static void ExpString_Free (ExpString *c);
+static void ExpString_Reset (ExpString *c);
 static int ExpString_Append (ExpString *c, const char *str);
 static int ExpString_AppendChar (ExpString *c, char ch);
 static int ExpString_AppendByte (ExpString *c, uint8_t x);
@@ -66,9 +68,34 @@ int ExpString_Init (ExpString *c)
     return 1;
 }
 
+/**
+ * Initializes the string in a caller-provided buffer, typically on the stack.
+ * The string moves to the heap only once it outgrows the buffer.
+ * The buffer must outlive the string, and the pointer from {@link ExpString_Get}
+ * must not be taken over by the caller; it is only valid until {@link ExpString_Free}.
+ */
+void ExpString_InitBuf (ExpString *c, char *buf, size_t size)
+{
+    ASSERT(size > 0)
+    
+    ExpArray_init_buf(&c->arr, 1, buf, size);
+    
+    c->n = 0;
+    ((char *)c->arr.v)[c->n] = '\0';
+}
+
 void ExpString_Free (ExpString *c)
 {
-    free(c->arr.v);
+    ExpArray_free(&c->arr);
+}
+
+/**
+ * Empties the string, keeping the memory already allocated for reuse.
+ */
+void ExpString_Reset (ExpString *c)
+{
+    c->n = 0;
+    ((char *)c->arr.v)[c->n] = '\0';
 }
 
 int ExpString_Append (ExpString *c, const char *str)
@@ -32,6 +32,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef BADVPN_LINUX
+#include <sys/auxv.h>
+#endif
 
 static size_t badvpn_djb2_hash (const uint8_t *str)
 {
@@ -57,4 +63,188 @@ static size_t badvpn_djb2_hash_bin (const uint8_t *str, size_t str_len)
     return hash;
 }
 
+// Seeded word-at-a-time hash (wyhash construction). Unlike djb2, it is fast on
+// long keys and, with a secret seed, resistant to collision flooding.
+
+#define BADVPN_HASH_S0 UINT64_C(0xa0761d6478bd642f)
+#define BADVPN_HASH_S1 UINT64_C(0xe7037ed1a0b428db)
+#define BADVPN_HASH_S2 UINT64_C(0x8ebc6af09c88c6e3)
+#define BADVPN_HASH_S3 UINT64_C(0x589965cc75374cc3)
+
+static uint64_t badvpn_hash_mix (uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+static uint64_t badvpn_hash_r8 (const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t badvpn_hash_r4 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t badvpn_hash_finish (uint64_t a, uint64_t b, uint64_t seed, size_t len)
+{
+    a ^= BADVPN_HASH_S1;
+    b ^= seed;
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+#else
+    uint64_t m = badvpn_hash_mix(a, b);
+    a ^= m;
+    b ^= m >> 1;
+#endif
+    return badvpn_hash_mix(a ^ BADVPN_HASH_S0 ^ len, b ^ BADVPN_HASH_S1);
+}
+
+/**
+ * Returns the per-process hash seed. It is random for each process where
+ * the platform provides that (Linux), and the same in all threads and
+ * translation units of the process.
+ */
+static uint64_t badvpn_hash_seed (void)
+{
+    static uint64_t seed;
+    static int have_seed;
+    
+    if (!have_seed) {
+        uint64_t a = (uint64_t)(uintptr_t)&free;
+        uint64_t b = 0;
+#ifdef BADVPN_LINUX
+        const uint8_t *rnd = (const uint8_t *)getauxval(AT_RANDOM);
+        if (rnd) {
+            a ^= badvpn_hash_r8(rnd);
+            b ^= badvpn_hash_r8(rnd + 8);
+        }
+#endif
+        seed = badvpn_hash_mix(a ^ BADVPN_HASH_S2, b ^ BADVPN_HASH_S3);
+        have_seed = 1;
+    }
+    
+    return seed;
+}
+
+/**
+ * Hashes a binary string with a given seed.
+ */
+static uint64_t badvpn_hash_bin (const uint8_t *p, size_t len, uint64_t seed)
+{
+    seed ^= badvpn_hash_mix(seed ^ BADVPN_HASH_S0, BADVPN_HASH_S1);
+    
+    uint64_t a, b;
+    
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t off = (len >> 3) << 2;
+            a = (badvpn_hash_r4(p) << 32) | badvpn_hash_r4(p + off);
+            b = (badvpn_hash_r4(p + len - 4) << 32) | badvpn_hash_r4(p + len - 4 - off);
+        }
+        else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = badvpn_hash_mix(badvpn_hash_r8(p) ^ BADVPN_HASH_S1, badvpn_hash_r8(p + 8) ^ seed);
+                see1 = badvpn_hash_mix(badvpn_hash_r8(p + 16) ^ BADVPN_HASH_S2, badvpn_hash_r8(p + 24) ^ see1);
+                see2 = badvpn_hash_mix(badvpn_hash_r8(p + 32) ^ BADVPN_HASH_S3, badvpn_hash_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        
+        while (i > 16) {
+            seed = badvpn_hash_mix(badvpn_hash_r8(p) ^ BADVPN_HASH_S1, badvpn_hash_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        
+        a = badvpn_hash_r8(p + i - 16);
+        b = badvpn_hash_r8(p + i - 8);
+    }
+    
+    return badvpn_hash_finish(a, b, seed, len);
+}
+
+/**
+ * Hashes a null-terminated string with a given seed.
+ */
+static uint64_t badvpn_hash_str (const char *str, uint64_t seed)
+{
+    return badvpn_hash_bin((const uint8_t *)str, strlen(str), seed);
+}
+
+// Fixed-size variants, equal to badvpn_hash_bin with the corresponding length.
+
+/**
+ * Hashes 4 bytes (e.g. an IPv4 address).
+ */
+static uint64_t badvpn_hash_4 (const uint8_t *p, uint64_t seed)
+{
+    seed ^= badvpn_hash_mix(seed ^ BADVPN_HASH_S0, BADVPN_HASH_S1);
+    uint64_t a = (badvpn_hash_r4(p) << 32) | badvpn_hash_r4(p);
+    return badvpn_hash_finish(a, a, seed, 4);
+}
+
+/**
+ * Hashes 6 bytes (e.g. an IPv4 address and port, or a MAC address).
+ */
+static uint64_t badvpn_hash_6 (const uint8_t *p, uint64_t seed)
+{
+    seed ^= badvpn_hash_mix(seed ^ BADVPN_HASH_S0, BADVPN_HASH_S1);
+    uint64_t a = (badvpn_hash_r4(p) << 32) | badvpn_hash_r4(p);
+    uint64_t b = (badvpn_hash_r4(p + 2) << 32) | badvpn_hash_r4(p + 2);
+    return badvpn_hash_finish(a, b, seed, 6);
+}
+
+/**
+ * Hashes 16 bytes (e.g. an IPv6 address).
+ */
+static uint64_t badvpn_hash_16 (const uint8_t *p, uint64_t seed)
+{
+    seed ^= badvpn_hash_mix(seed ^ BADVPN_HASH_S0, BADVPN_HASH_S1);
+    uint64_t a = (badvpn_hash_r4(p) << 32) | badvpn_hash_r4(p + 8);
+    uint64_t b = (badvpn_hash_r4(p + 12) << 32) | badvpn_hash_r4(p + 4);
+    return badvpn_hash_finish(a, b, seed, 16);
+}
+
+/**
+ * Hashes 18 bytes (e.g. an IPv6 address and port).
+ */
+static uint64_t badvpn_hash_18 (const uint8_t *p, uint64_t seed)
+{
+    seed ^= badvpn_hash_mix(seed ^ BADVPN_HASH_S0, BADVPN_HASH_S1);
+    seed = badvpn_hash_mix(badvpn_hash_r8(p) ^ BADVPN_HASH_S1, badvpn_hash_r8(p + 8) ^ seed);
+    return badvpn_hash_finish(badvpn_hash_r8(p + 2), badvpn_hash_r8(p + 10), seed, 18);
+}
+
 #endif
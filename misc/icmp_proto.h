@@ -0,0 +1,124 @@
+/**
+ * @file icmp_proto.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Definitions for ICMP and ICMPv6 echo messages.
+ */
+
+#ifndef BADVPN_MISC_ICMP_PROTO_H
+#define BADVPN_MISC_ICMP_PROTO_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <misc/packed.h>
+#include <misc/ipv6_proto.h>
+#include <misc/ipchecksum.h>
+
+#define ICMP_TYPE_ECHO_REPLY 0
+#define ICMP_TYPE_ECHO_REQUEST 8
+#define ICMPV6_TYPE_ECHO_REQUEST 128
+#define ICMPV6_TYPE_ECHO_REPLY 129
+
+B_START_PACKED
+struct icmp_echo_header {
+    uint8_t type;
+    uint8_t code;
+    uint16_t checksum;
+    uint16_t identifier;
+    uint16_t sequence;
+} B_PACKED;
+B_END_PACKED
+
+static uint16_t icmp_checksum (const struct icmp_echo_header *header, const uint8_t *payload, uint16_t payload_len)
+{
+    uint64_t t = 0;
+    
+    t = ipchecksum_add(t, header, sizeof(*header));
+    t = ipchecksum_add(t, payload, payload_len);
+    
+    return ipchecksum_finish(t);
+}
+
+static uint16_t icmp_ip6_checksum (const struct icmp_echo_header *header, const uint8_t *payload, uint16_t payload_len, const uint8_t *source_addr, const uint8_t *dest_addr)
+{
+    uint64_t t = 0;
+    
+    t = ipchecksum_add(t, source_addr, 16);
+    t = ipchecksum_add(t, dest_addr, 16);
+    
+    uint32_t x[2];
+    x[0] = hton32(sizeof(*header) + payload_len);
+    x[1] = hton32(IPV6_NEXT_ICMPV6);
+    t = ipchecksum_add(t, x, sizeof(x));
+    
+    t = ipchecksum_add(t, header, sizeof(*header));
+    t = ipchecksum_add(t, payload, payload_len);
+    
+    return ipchecksum_finish(t);
+}
+
+/**
+ * Parses an ICMP or ICMPv6 echo message.
+ * The checksum is not verified.
+ * 
+ * @param data message, starting with the ICMP header
+ * @param data_len length of message
+ * @param type expected message type
+ * @param out_header returns the echo header
+ * @param out_payload returns the echo data
+ * @param out_payload_len returns the length of echo data
+ * @return 1 if this is an echo message of the given type, 0 if not
+ */
+static int icmp_echo_check (const uint8_t *data, int data_len, uint8_t type, struct icmp_echo_header *out_header, uint8_t **out_payload, int *out_payload_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(out_header)
+    ASSERT(out_payload)
+    ASSERT(out_payload_len)
+    
+    // parse echo header
+    if (data_len < sizeof(struct icmp_echo_header)) {
+        return 0;
+    }
+    memcpy(out_header, data, sizeof(*out_header));
+    
+    // check type and code
+    if (ntoh8(out_header->type) != type || ntoh8(out_header->code) != 0) {
+        return 0;
+    }
+    
+    *out_payload = (uint8_t *)data + sizeof(*out_header);
+    *out_payload_len = data_len - sizeof(*out_header);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * @file ipchecksum.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Internet checksum (RFC 1071) shared by the IPv4, UDP and TCP helpers and lwIP.
+ * 
+ * Sums are accumulated over 16-bit words as they lie in memory, so the folded
+ * result is already in network byte order and can be stored into a header
+ * as-is. The bulk of the data is summed with AVX2, SSE2 or NEON when the
+ * compiler targets them, otherwise with 32-bit words in a 64-bit accumulator.
+ */
+
+#ifndef BADVPN_MISC_IPCHECKSUM_H
+#define BADVPN_MISC_IPCHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+
+#if defined(__AVX2__)
+#define IPCHECKSUM_USE_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IPCHECKSUM_USE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define IPCHECKSUM_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// ones' complement addition of 64-bit partial sums (end-around carry)
+static uint64_t ipchecksum__add64 (uint64_t a, uint64_t b)
+{
+    a += b;
+    return a + (a < b);
+}
+
+/**
+ * Adds data to a partial checksum.
+ * Only the last chunk of a checksummed range may have an odd length; its last
+ * byte is summed as if followed by a zero byte.
+ * 
+ * @param sum partial sum so far (0 to start)
+ * @param data data to add. May be unaligned.
+ * @param len length of data
+ * @return new partial sum, to be passed to {@link ipchecksum_fold} or
+ *         {@link ipchecksum_finish}
+ */
+static uint64_t ipchecksum_add (uint64_t sum, const void *data, size_t len)
+{
+    ASSERT(len == 0 || data)
+    
+    const uint8_t *p = (const uint8_t *)data;
+    
+#if defined(IPCHECKSUM_USE_AVX2)
+    if (len >= 32) {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i acc = zero;
+        while (len >= 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+            acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+            p += 32;
+            len -= 32;
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int i = 0; i < 4; i++) {
+            sum = ipchecksum__add64(sum, lanes[i]);
+        }
+    }
+#elif defined(IPCHECKSUM_USE_SSE2)
+    if (len >= 16) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        while (len >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+            p += 16;
+            len -= 16;
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum = ipchecksum__add64(sum, lanes[0]);
+        sum = ipchecksum__add64(sum, lanes[1]);
+    }
+#elif defined(IPCHECKSUM_USE_NEON)
+    if (len >= 16) {
+        uint64x2_t acc = vdupq_n_u64(0);
+        while (len >= 16) {
+            acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(p)));
+            p += 16;
+            len -= 16;
+        }
+        sum = ipchecksum__add64(sum, vgetq_lane_u64(acc, 0));
+        sum = ipchecksum__add64(sum, vgetq_lane_u64(acc, 1));
+    }
+#endif
+    
+    // 32-bit words; a 64-bit accumulator can't overflow for any packet
+    uint64_t t = 0;
+    while (len >= 16) {
+        uint32_t w[4];
+        memcpy(w, p, sizeof(w));
+        t += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        t += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, p, sizeof(w));
+        t += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        uint8_t b[2] = {p[0], 0};
+        uint16_t w;
+        memcpy(&w, b, sizeof(w));
+        t += w;
+    }
+    
+    return ipchecksum__add64(sum, t);
+}
+
+/**
+ * Folds a partial sum to 16 bits, without complementing it.
+ * This is the form lwIP's LWIP_CHKSUM and checksum offload (the pseudo-header
+ * sum) want.
+ */
+static uint16_t ipchecksum_fold (uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    
+    uint32_t s = sum;
+    s = (s & 0xFFFF) + (s >> 16);
+    s = (s & 0xFFFF) + (s >> 16);
+    
+    return s;
+}
+
+/**
+ * Folds and complements a partial sum, giving the checksum to store into a
+ * header (in network byte order).
+ */
+static uint16_t ipchecksum_finish (uint64_t sum)
+{
+    return (uint16_t)~ipchecksum_fold(sum);
+}
+
+/**
+ * Computes the checksum of a header after a 16-bit field changed, without
+ * summing the whole header again (RFC 1624).
+ * All values are in network byte order, as they appear in the header.
+ * 
+ * @param checksum checksum before the change
+ * @param old_value previous value of the field
+ * @param new_value new value of the field
+ * @return new checksum
+ */
+static uint16_t ipchecksum_update16 (uint16_t checksum, uint16_t old_value, uint16_t new_value)
+{
+    uint64_t sum = (uint16_t)~checksum;
+    sum += (uint16_t)~old_value;
+    sum += new_value;
+    
+    return ipchecksum_finish(sum);
+}
+
+/**
+ * Like {@link ipchecksum_update16}, for a 32-bit field at an even offset
+ * (e.g. an IPv4 address).
+ */
+static uint16_t ipchecksum_update32 (uint16_t checksum, uint32_t old_value, uint32_t new_value)
+{
+    uint64_t sum = (uint16_t)~checksum;
+    sum += (uint32_t)~old_value;
+    sum += new_value;
+    
+    return ipchecksum_finish(sum);
+}
+
+#endif
@@ -41,7 +41,9 @@
 #include <misc/byteorder.h>
 #include <misc/packed.h>
 #include <misc/read_write_int.h>
+#include <misc/ipchecksum.h>
 
+#define IPV4_PROTOCOL_ICMP 1
 #define IPV4_PROTOCOL_IGMP 2
 #define IPV4_PROTOCOL_UDP 17
 
@@ -74,21 +76,10 @@ static uint16_t ipv4_checksum (const struct ipv4_header *header, const char *ext
     ASSERT(extra_len % 2 == 0)
     ASSERT(extra_len == 0 || extra)
     
-    uint32_t t = 0;
+    uint64_t t = ipchecksum_add(0, header, sizeof(*header));
+    t = ipchecksum_add(t, extra, extra_len);
     
-    for (uint16_t i = 0; i < sizeof(*header) / 2; i++) {
-        t += badvpn_read_be16((const char *)header + 2 * i);
-    }
-    
-    for (uint16_t i = 0; i < extra_len / 2; i++) {
-        t += badvpn_read_be16((const char *)extra + 2 * i);
-    }
-    
-    while (t >> 16) {
-        t = (t & 0xFFFF) + (t >> 16);
-    }
-    
-    return hton16(~t);
+    return ipchecksum_finish(t);
 }
 
 static int ipv4_check (uint8_t *data, int data_len, struct ipv4_header *out_header, uint8_t **out_payload, int *out_payload_len)
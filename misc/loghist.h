@@ -0,0 +1,119 @@
+/**
+ * @file loghist.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Log-linear histogram for latency measurements, with percentiles.
+ * 
+ * Values below 2^LOGHIST_SUB_BITS have a bucket each; above that, every power
+ * of two is split into 2^LOGHIST_SUB_BITS buckets, so values are resolved to
+ * within 12.5%. Percentiles are reported as the lower bound of their bucket.
+ */
+
+#ifndef BADVPN_MISC_LOGHIST_H
+#define BADVPN_MISC_LOGHIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LOGHIST_SUB_BITS 3
+#define LOGHIST_MAX_LOG 40
+#define LOGHIST_NUM_BUCKETS ((LOGHIST_MAX_LOG - LOGHIST_SUB_BITS + 1) << LOGHIST_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t buckets[LOGHIST_NUM_BUCKETS];
+} LogHist;
+
+static void LogHist_Init (LogHist *o)
+{
+    memset(o, 0, sizeof(*o));
+}
+
+static int LogHist__Bucket (uint64_t v)
+{
+    if (v < (1 << LOGHIST_SUB_BITS)) {
+        return v;
+    }
+    
+    int log = LOGHIST_SUB_BITS;
+    while (log < LOGHIST_MAX_LOG && (v >> (log + 1)) > 0) {
+        log++;
+    }
+    if ((v >> (log + 1)) > 0) {
+        return LOGHIST_NUM_BUCKETS - 1;
+    }
+    
+    int sub = (v >> (log - LOGHIST_SUB_BITS)) & ((1 << LOGHIST_SUB_BITS) - 1);
+    return ((log - LOGHIST_SUB_BITS + 1) << LOGHIST_SUB_BITS) + sub;
+}
+
+static uint64_t LogHist__BucketValue (int bucket)
+{
+    if (bucket < (1 << LOGHIST_SUB_BITS)) {
+        return bucket;
+    }
+    
+    int log = (bucket >> LOGHIST_SUB_BITS) + LOGHIST_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << LOGHIST_SUB_BITS) - 1);
+    return (((uint64_t)1 << LOGHIST_SUB_BITS) + sub) << (log - LOGHIST_SUB_BITS);
+}
+
+static void LogHist_Add (LogHist *o, uint64_t value)
+{
+    o->count++;
+    o->buckets[LogHist__Bucket(value)]++;
+}
+
+/**
+ * Returns the value below which the given fraction of values lie,
+ * or 0 if the histogram is empty.
+ */
+static uint64_t LogHist_Percentile (const LogHist *o, double fraction)
+{
+    if (o->count == 0) {
+        return 0;
+    }
+    
+    uint64_t target = fraction * o->count;
+    if (target < 1) {
+        target = 1;
+    }
+    
+    uint64_t sum = 0;
+    for (int i = 0; i < LOGHIST_NUM_BUCKETS; i++) {
+        sum += o->buckets[i];
+        if (sum >= target) {
+            return LogHist__BucketValue(i);
+        }
+    }
+    
+    return LogHist__BucketValue(LOGHIST_NUM_BUCKETS - 1);
+}
+
+#endif
@@ -0,0 +1,303 @@
+/**
+ * @file lz4.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compressor and decompressor for single blocks in the LZ4 block format.
+ * 
+ * A block is a sequence of (literals, match) pairs; each starts with a token
+ * holding the literal length and the match length minus 4, with 15 meaning
+ * that more length bytes follow, and the match is given by a little-endian
+ * 16-bit offset back into the output. The last sequence has literals only.
+ * As in the reference implementation, matches end at least 5 bytes before the
+ * end and do not start in the last 12 bytes, so blocks produced here can be
+ * decoded by any LZ4 decoder.
+ * 
+ * The compressor is meant for packet-sized inputs (at most
+ * LZ4_MAX_INPUT_SIZE bytes): it uses a small hash table of 16-bit positions
+ * and does one greedy pass, skipping ahead faster the longer no match is
+ * found, so that incompressible data costs little. Entries left over from
+ * previous inputs are only candidates that are verified against the data,
+ * so the table does not have to be cleared between calls.
+ * 
+ * The decompressor checks all lengths and offsets against the input and
+ * output buffers and fails on any malformed block.
+ */
+
+#ifndef BADVPN_MISC_LZ4_H
+#define BADVPN_MISC_LZ4_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+
+#define LZ4_MAX_INPUT_SIZE 65535
+#define LZ4_MINMATCH 4
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_HASH_LOG 11
+#define LZ4_SKIP_TRIGGER 6
+
+/**
+ * Returns the largest size of a compressed block for an input of the given size.
+ */
+#define LZ4_COMPRESS_BOUND(_len) ((_len) + (_len) / 255 + 16)
+
+struct lz4_state {
+    uint16_t table[1 << LZ4_HASH_LOG];
+};
+
+/**
+ * Initializes the state of the compressor.
+ */
+static void lz4_state_init (struct lz4_state *st)
+{
+    memset(st->table, 0, sizeof(st->table));
+}
+
+static uint32_t lz4__read32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int lz4__hash (uint32_t seq)
+{
+    return (seq * UINT32_C(2654435761)) >> (32 - LZ4_HASH_LOG);
+}
+
+static uint8_t * lz4__write_length (uint8_t *op, int len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/**
+ * Compresses a block.
+ * 
+ * @param st compressor state, initialized with {@link lz4_state_init}
+ * @param src input data
+ * @param src_len size of input. Must be >=0 and <=LZ4_MAX_INPUT_SIZE.
+ * @param dst output buffer
+ * @param dst_cap size of output buffer. Must be >=0.
+ * @return size of the compressed block, or 0 if it would not fit into dst_cap bytes
+ *         (also for an empty input)
+ */
+static int lz4_compress (struct lz4_state *st, const uint8_t *src, int src_len, uint8_t *dst, int dst_cap)
+{
+    ASSERT(src_len >= 0)
+    ASSERT(src_len <= LZ4_MAX_INPUT_SIZE)
+    ASSERT(dst_cap >= 0)
+    
+    if (src_len == 0) {
+        return 0;
+    }
+    
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+    int anchor = 0;
+    
+    if (src_len > LZ4_MFLIMIT) {
+        int match_limit = src_len - LZ4_LASTLITERALS;
+        int ip_limit = src_len - LZ4_MFLIMIT;
+        int ip = 1;
+        int misses = 1 << LZ4_SKIP_TRIGGER;
+        
+        st->table[lz4__hash(lz4__read32(src))] = 0;
+        
+        while (ip < ip_limit) {
+            // look up and replace the last position with the same hash
+            uint32_t seq = lz4__read32(src + ip);
+            int h = lz4__hash(seq);
+            int ref = st->table[h];
+            st->table[h] = ip;
+            
+            if (ref >= ip || lz4__read32(src + ref) != seq) {
+                ip += misses++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1 << LZ4_SKIP_TRIGGER;
+            
+            // extend the match backwards over pending literals
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            
+            // extend the match forwards
+            int len = LZ4_MINMATCH;
+            while (ip + len < match_limit && src[ip + len] == src[ref + len]) {
+                len++;
+            }
+            
+            int lit = ip - anchor;
+            int ml = len - LZ4_MINMATCH;
+            
+            // check space for token, literals, offset and lengths
+            if (oend - op < 1 + lit + lit / 255 + 1 + 2 + ml / 255 + 1) {
+                return 0;
+            }
+            
+            uint8_t *token = op++;
+            *token = ((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15);
+            if (lit >= 15) {
+                op = lz4__write_length(op, lit - 15);
+            }
+            memcpy(op, src + anchor, lit);
+            op += lit;
+            
+            int offset = ip - ref;
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+            if (ml >= 15) {
+                op = lz4__write_length(op, ml - 15);
+            }
+            
+            ip += len;
+            anchor = ip;
+            
+            // remember a position inside the match
+            if (ip < ip_limit) {
+                st->table[lz4__hash(lz4__read32(src + ip - 2))] = ip - 2;
+            }
+        }
+    }
+    
+    // last literals
+    int lit = src_len - anchor;
+    if (oend - op < 1 + lit + lit / 255 + 1) {
+        return 0;
+    }
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15) {
+        op = lz4__write_length(op, lit - 15);
+    }
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    
+    return op - dst;
+}
+
+/**
+ * Decompresses a block.
+ * 
+ * @param src compressed block
+ * @param src_len size of compressed block. Must be >=0.
+ * @param dst output buffer
+ * @param dst_cap size of output buffer. Must be >=0.
+ * @return size of the decompressed data, or -1 if the block is malformed
+ *         or does not fit into dst_cap bytes
+ */
+static int lz4_decompress (const uint8_t *src, int src_len, uint8_t *dst, int dst_cap)
+{
+    ASSERT(src_len >= 0)
+    ASSERT(dst_cap >= 0)
+    
+    int ip = 0;
+    int op = 0;
+    
+    while (1) {
+        if (ip >= src_len) {
+            return -1;
+        }
+        int token = src[ip++];
+        
+        // literals
+        int lit = token >> 4;
+        if (lit == 15) {
+            int b;
+            do {
+                if (ip >= src_len) {
+                    return -1;
+                }
+                b = src[ip++];
+                lit += b;
+                if (lit > dst_cap) {
+                    return -1;
+                }
+            } while (b == 255);
+        }
+        if (lit > src_len - ip || lit > dst_cap - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        
+        // the last sequence has no match
+        if (ip == src_len) {
+            return op;
+        }
+        
+        // match
+        if (src_len - ip < 2) {
+            return -1;
+        }
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        int ml = token & 15;
+        if (ml == 15) {
+            int b;
+            do {
+                if (ip >= src_len) {
+                    return -1;
+                }
+                b = src[ip++];
+                ml += b;
+                if (ml > dst_cap) {
+                    return -1;
+                }
+            } while (b == 255);
+        }
+        ml += LZ4_MINMATCH;
+        if (ml > dst_cap - op) {
+            return -1;
+        }
+        
+        // the match may overlap the data it produces
+        if (offset >= ml) {
+            memcpy(dst + op, dst + op - offset, ml);
+        } else {
+            for (int i = 0; i < ml; i++) {
+                dst[op + i] = dst[op - offset + i];
+            }
+        }
+        op += ml;
+    }
+}
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * @file mempressure.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Memory pressure levels for a byte budget, for programs which account the
+ * memory they hold in buffers and degrade gracefully as it runs out.
+ * 
+ * The level rises as soon as the accounted memory reaches the threshold of a
+ * higher level. It falls one level at a time, once the memory is
+ * MEMPRESSURE_HYSTERESIS percent of the limit below the threshold of the
+ * current level, and only on updates which allow it; programs allow it from a
+ * periodic timer, so that the level does not follow short bursts of buffered
+ * packets down and up again.
+ */
+
+#ifndef BADVPN_MISC_MEMPRESSURE_H
+#define BADVPN_MISC_MEMPRESSURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// nothing to do
+#define MEMPRESSURE_LEVEL_NONE 0
+// stop growing buffers and shrink flow control windows
+#define MEMPRESSURE_LEVEL_SHRINK 1
+// additionally stop admitting new flows
+#define MEMPRESSURE_LEVEL_NO_ADMIT 2
+// additionally evict idle flows
+#define MEMPRESSURE_LEVEL_EVICT 3
+
+// thresholds of the levels above MEMPRESSURE_LEVEL_NONE, in percent of the limit
+#define MEMPRESSURE_SHRINK_PERCENT 60
+#define MEMPRESSURE_NO_ADMIT_PERCENT 80
+#define MEMPRESSURE_EVICT_PERCENT 95
+#define MEMPRESSURE_HYSTERESIS 5
+
+typedef struct {
+    size_t limit;
+    size_t used;
+    int level;
+} MemPressure;
+
+/**
+ * Initializes the tracker.
+ * 
+ * @param limit byte budget, or 0 to never report pressure
+ */
+static void MemPressure_Init (MemPressure *o, size_t limit)
+{
+    o->limit = limit;
+    o->used = 0;
+    o->level = MEMPRESSURE_LEVEL_NONE;
+}
+
+static size_t MemPressure__Threshold (const MemPressure *o, int level, int percent_offset)
+{
+    static const int percents[] = {0, MEMPRESSURE_SHRINK_PERCENT, MEMPRESSURE_NO_ADMIT_PERCENT, MEMPRESSURE_EVICT_PERCENT};
+    
+    return (uint64_t)o->limit * (percents[level] + percent_offset) / 100;
+}
+
+/**
+ * Updates the accounted memory.
+ * 
+ * @param used number of bytes accounted
+ * @param may_fall whether the level may fall by one
+ * @return 1 if the level changed, 0 if not
+ */
+static int MemPressure_Update (MemPressure *o, size_t used, int may_fall)
+{
+    o->used = used;
+    
+    if (o->limit == 0) {
+        return 0;
+    }
+    
+    int old_level = o->level;
+    
+    while (o->level < MEMPRESSURE_LEVEL_EVICT && used >= MemPressure__Threshold(o, o->level + 1, 0)) {
+        o->level++;
+    }
+    if (may_fall && o->level == old_level && o->level > MEMPRESSURE_LEVEL_NONE &&
+        used < MemPressure__Threshold(o, o->level, -MEMPRESSURE_HYSTERESIS)
+    ) {
+        o->level--;
+    }
+    
+    return (o->level != old_level);
+}
+
+/**
+ * Returns the current level, one of MEMPRESSURE_LEVEL_*.
+ */
+static int MemPressure_Level (const MemPressure *o)
+{
+    return o->level;
+}
+
+/**
+ * Returns the name of a level, for logging.
+ */
+static const char * MemPressure_LevelName (int level)
+{
+    static const char *names[] = {"none", "shrink", "no-admit", "evict"};
+    
+    return names[level];
+}
+
+#endif
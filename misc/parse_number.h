@@ -29,6 +29,11 @@
  * @section DESCRIPTION
  * 
  * Numeric string parsing.
+ * 
+ * Decimal strings are parsed eight digits at a time within a 64-bit word,
+ * and decimal representations are generated two digits at a time from a
+ * table, since NCD converts numbers to and from strings for every arithmetic
+ * operation.
  */
 
 #ifndef BADVPN_MISC_PARSE_NUMBER_H
@@ -41,6 +46,7 @@
 
 #include <misc/memref.h>
 #include <misc/debug.h>
+#include <misc/byteorder.h>
 
 // public parsing functions
 static int decode_decimal_digit (char c);
@@ -62,6 +68,24 @@ static const char parse_number__uintmax_max_str[] = "18446744073709551615";
 // make sure UINTMAX_MAX is what we think it is
 static const char parse_number__uintmax_max_str_assert[(UINTMAX_MAX == UINTMAX_C(18446744073709551615)) ? 1 : -1];
 
+// 10^1 - 10^19, the smallest numbers with 2 - 20 decimal digits
+static const uintmax_t parse_number__pow10[] = {
+    UINTMAX_C(10), UINTMAX_C(100), UINTMAX_C(1000), UINTMAX_C(10000), UINTMAX_C(100000),
+    UINTMAX_C(1000000), UINTMAX_C(10000000), UINTMAX_C(100000000), UINTMAX_C(1000000000),
+    UINTMAX_C(10000000000), UINTMAX_C(100000000000), UINTMAX_C(1000000000000),
+    UINTMAX_C(10000000000000), UINTMAX_C(100000000000000), UINTMAX_C(1000000000000000),
+    UINTMAX_C(10000000000000000), UINTMAX_C(100000000000000000), UINTMAX_C(1000000000000000000),
+    UINTMAX_C(10000000000000000000)
+};
+
+// decimal representations of 0 - 99, two characters each
+static const char parse_number__digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
 static int decode_decimal_digit (char c)
 {
     switch (c) {
@@ -104,10 +128,47 @@ static int decode_hex_digit (char c)
     return -1;
 }
 
+// parses exactly 8 decimal digits, the first one being the most significant
+static int parse__8digits (const char *str, uint32_t *out)
+{
+    uint64_t w;
+    memcpy(&w, str, sizeof(w));
+    w = ltoh64(w);
+    
+    // all bytes must be in '0' - '9': the high nibble is 3 and adding 6
+    // does not carry out of the low nibble
+    if ((w & UINT64_C(0xF0F0F0F0F0F0F0F0)) != UINT64_C(0x3030303030303030) ||
+        ((w + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) != UINT64_C(0x3030303030303030)) {
+        return 0;
+    }
+    w -= UINT64_C(0x3030303030303030);
+    
+    // combine adjacent digits into 2-digit values, then those into 4-digit
+    // values and finally the two 4-digit values
+    w = (w * 10) + (w >> 8);
+    w = (((w & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x000F424000000064)) +
+         (((w >> 16) & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x0000271000000001))) >> 32;
+    
+    *out = w;
+    return 1;
+}
+
 static int parse__no_overflow (const char *str, size_t str_len, uintmax_t *out)
 {
     uintmax_t n = 0;
     
+    while (str_len >= 8) {
+        uint32_t digits;
+        if (!parse__8digits(str, &digits)) {
+            return 0;
+        }
+        
+        n = UINTMAX_C(100000000) * n + digits;
+        
+        str += 8;
+        str_len -= 8;
+    }
+    
     while (str_len > 0) {
         if (*str < '0' || *str > '9') {
             return 0;
@@ -154,21 +215,24 @@ int parse_unsigned_hex_integer (MemRef str, uintmax_t *out)
         return 0;
     }
     
+    // remove leading zeros
+    while (str.len > 0 && *str.ptr == '0') {
+        str.ptr++;
+        str.len--;
+    }
+    
+    // detect overflow; after this, digits can be shifted in unchecked
+    if (str.len > 2 * sizeof(uintmax_t)) {
+        return 0;
+    }
+    
     while (str.len > 0) {
         int digit = decode_hex_digit(*str.ptr);
         if (digit < 0) {
             return 0;
         }
         
-        if (n > UINTMAX_MAX / 16) {
-            return 0;
-        }
-        n *= 16;
-        
-        if (digit > UINTMAX_MAX - n) {
-            return 0;
-        }
-        n += digit;
+        n = (n << 4) | digit;
         
         str.ptr++;
         str.len--;
@@ -197,14 +261,24 @@ int parse_signmag_integer (MemRef str, int *out_sign, uintmax_t *out_mag)
 
 int compute_decimal_repr_size (uintmax_t x)
 {
-    int size = 0;
+#ifdef __GNUC__
+    // x is below 10^t (1233 / 4096 is just above log10(2)) and has either
+    // t or t + 1 digits
+    int bits = 64 - __builtin_clzll((unsigned long long)x | 1);
+    int t = (bits * 1233) >> 12;
+    if (t == 0) {
+        return 1;
+    }
+    return t + (x >= parse_number__pow10[t - 1]);
+#else
+    int size = 1;
     
-    do {
+    while (size <= 19 && x >= parse_number__pow10[size - 1]) {
         size++;
-        x /= 10;
-    } while (x > 0);
+    }
     
     return size;
+#endif
 }
 
 void generate_decimal_repr (uintmax_t x, char *out, int repr_size)
@@ -214,10 +288,34 @@ void generate_decimal_repr (uintmax_t x, char *out, int repr_size)
     
     out += repr_size;
     
-    do {
-        *(--out) = '0' + (x % 10);
-        x /= 10;
-    } while (x > 0);
+    // split off 8 digits at a time so the rest can be done in 32 bits
+    while (x >= UINTMAX_C(100000000)) {
+        uint32_t low = x % UINTMAX_C(100000000);
+        x /= UINTMAX_C(100000000);
+        for (int j = 0; j < 4; j++) {
+            int i = 2 * (low % 100);
+            low /= 100;
+            *(--out) = parse_number__digit_pairs[i + 1];
+            *(--out) = parse_number__digit_pairs[i];
+        }
+    }
+    
+    uint32_t y = x;
+    
+    while (y >= 100) {
+        int i = 2 * (y % 100);
+        y /= 100;
+        *(--out) = parse_number__digit_pairs[i + 1];
+        *(--out) = parse_number__digit_pairs[i];
+    }
+    
+    if (y >= 10) {
+        int i = 2 * y;
+        *(--out) = parse_number__digit_pairs[i + 1];
+        *(--out) = parse_number__digit_pairs[i];
+    } else {
+        *(--out) = '0' + y;
+    }
 }
 
 int generate_decimal_repr_string (uintmax_t x, char *out)
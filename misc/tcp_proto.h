@@ -0,0 +1,111 @@
+/**
+ * @file tcp_proto.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Definitions for the TCP protocol.
+ */
+
+#ifndef BADVPN_MISC_TCP_PROTO_H
+#define BADVPN_MISC_TCP_PROTO_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <misc/packed.h>
+#include <misc/read_write_int.h>
+#include <misc/ipchecksum.h>
+
+#define IPV4_PROTOCOL_TCP 6
+#define IPV6_NEXT_TCP 6
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_ACK 0x10
+#define TCP_FLAG_URG 0x20
+#define TCP_FLAG_ECE 0x40
+#define TCP_FLAG_CWR 0x80
+
+B_START_PACKED
+struct tcp_header {
+    uint16_t source_port;
+    uint16_t dest_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t offset4_reserved4;
+    uint8_t flags;
+    uint16_t window;
+    uint16_t checksum;
+    uint16_t urgent_pointer;
+} B_PACKED;
+B_END_PACKED
+
+#define TCP_GET_HEADER_LENGTH(_header) ((((_header).offset4_reserved4&0xF0)>>4)*4)
+
+/**
+ * Computes the sum of the IPv4 pseudo-header of a TCP segment, not complemented.
+ * This is what goes into the checksum field when computing the checksum is left
+ * to someone else (checksum offload).
+ */
+static uint16_t tcp_pseudo_checksum (uint16_t tcp_length, uint32_t source_addr, uint32_t dest_addr)
+{
+    uint64_t t = 0;
+    
+    t = ipchecksum_add(t, &source_addr, sizeof(source_addr));
+    t = ipchecksum_add(t, &dest_addr, sizeof(dest_addr));
+    
+    uint16_t x[2];
+    x[0] = hton16(IPV4_PROTOCOL_TCP);
+    x[1] = hton16(tcp_length);
+    t = ipchecksum_add(t, x, sizeof(x));
+    
+    return ipchecksum_fold(t);
+}
+
+/**
+ * Like {@link tcp_pseudo_checksum}, for the IPv6 pseudo-header.
+ */
+static uint16_t tcp_ip6_pseudo_checksum (uint16_t tcp_length, const uint8_t *source_addr, const uint8_t *dest_addr)
+{
+    uint64_t t = 0;
+    
+    t = ipchecksum_add(t, source_addr, 16);
+    t = ipchecksum_add(t, dest_addr, 16);
+    
+    uint16_t x[2];
+    x[0] = hton16(IPV6_NEXT_TCP);
+    x[1] = hton16(tcp_length);
+    t = ipchecksum_add(t, x, sizeof(x));
+    
+    return ipchecksum_fold(t);
+}
+
+#endif
@@ -41,6 +41,7 @@
 #include <misc/ipv4_proto.h>
 #include <misc/ipv6_proto.h>
 #include <misc/read_write_int.h>
+#include <misc/ipchecksum.h>
 
 B_START_PACKED
 struct udp_header {
@@ -51,92 +52,52 @@ struct udp_header {
 } B_PACKED;
 B_END_PACKED
 
-static uint32_t udp_checksum_summer (const char *data, uint16_t len)
+static uint16_t udp_checksum__finish (uint64_t t)
 {
-    ASSERT(len % 2 == 0)
+    uint16_t x = ipchecksum_finish(t);
     
-    uint32_t t = 0;
-    
-    for (uint16_t i = 0; i < len / 2; i++) {
-        t += badvpn_read_be16(data + 2 * i);
+    // zero means no checksum
+    if (x == 0) {
+        x = UINT16_MAX;
     }
     
-    return t;
+    return x;
 }
 
 static uint16_t udp_checksum (const struct udp_header *header, const uint8_t *payload, uint16_t payload_len, uint32_t source_addr, uint32_t dest_addr)
 {
-    uint32_t t = 0;
-    
-    t += udp_checksum_summer((char *)&source_addr, sizeof(source_addr));
-    t += udp_checksum_summer((char *)&dest_addr, sizeof(dest_addr));
-    
-    uint16_t x;
-    x = hton16(IPV4_PROTOCOL_UDP);
-    t += udp_checksum_summer((char *)&x, sizeof(x));
-    x = hton16(sizeof(*header) + payload_len);
-    t += udp_checksum_summer((char *)&x, sizeof(x));
-    
-    t += udp_checksum_summer((const char *)header, sizeof(*header));
+    uint64_t t = 0;
     
-    if (payload_len % 2 == 0) {
-        t += udp_checksum_summer((const char *)payload, payload_len);
-    } else {
-        t += udp_checksum_summer((const char *)payload, payload_len - 1);
-        
-        x = hton16(((uint16_t)payload[payload_len - 1]) << 8);
-        t += udp_checksum_summer((char *)&x, sizeof(x));
-    }
-    
-    while (t >> 16) {
-        t = (t & 0xFFFF) + (t >> 16);
-    }
+    t = ipchecksum_add(t, &source_addr, sizeof(source_addr));
+    t = ipchecksum_add(t, &dest_addr, sizeof(dest_addr));
     
-    t = ~t;
+    uint16_t x[2];
+    x[0] = hton16(IPV4_PROTOCOL_UDP);
+    x[1] = hton16(sizeof(*header) + payload_len);
+    t = ipchecksum_add(t, x, sizeof(x));
     
-    if (t == 0) {
-        t = UINT16_MAX;
-    }
+    t = ipchecksum_add(t, header, sizeof(*header));
+    t = ipchecksum_add(t, payload, payload_len);
     
-    return hton16(t);
+    return udp_checksum__finish(t);
 }
 
 static uint16_t udp_ip6_checksum (const struct udp_header *header, const uint8_t *payload, uint16_t payload_len, const uint8_t *source_addr, const uint8_t *dest_addr)
 {
-    uint32_t t = 0;
+    uint64_t t = 0;
     
-    t += udp_checksum_summer((const char *)source_addr, 16);
-    t += udp_checksum_summer((const char *)dest_addr, 16);
+    t = ipchecksum_add(t, source_addr, 16);
+    t = ipchecksum_add(t, dest_addr, 16);
     
-    uint32_t x;
-    x = hton32(sizeof(*header) + payload_len);
-    t += udp_checksum_summer((char *)&x, sizeof(x));
-    x = hton32(IPV6_NEXT_UDP);
-    t += udp_checksum_summer((char *)&x, sizeof(x));
+    uint32_t x[2];
+    x[0] = hton32(sizeof(*header) + payload_len);
+    x[1] = hton32(IPV6_NEXT_UDP);
+    t = ipchecksum_add(t, x, sizeof(x));
     
-    t += udp_checksum_summer((const char *)header, sizeof(*header));
-    
-    if (payload_len % 2 == 0) {
-        t += udp_checksum_summer((const char *)payload, payload_len);
-    } else {
-        t += udp_checksum_summer((const char *)payload, payload_len - 1);
-        
-        uint16_t y;
-        y = hton16(((uint16_t)payload[payload_len - 1]) << 8);
-        t += udp_checksum_summer((char *)&y, sizeof(y));
-    }
-    
-    while (t >> 16) {
-        t = (t & 0xFFFF) + (t >> 16);
-    }
-    
-    t = ~t;
-    
-    if (t == 0) {
-        t = UINT16_MAX;
-    }
+    t = ipchecksum_add(t, header, sizeof(*header));
+    t = ipchecksum_add(t, payload, payload_len);
     
-    return hton16(t);
+    return udp_checksum__finish(t);
 }
 
 static int udp_check (const uint8_t *data, int data_len, struct udp_header *out_header, uint8_t **out_payload, int *out_payload_len)
@@ -30,6 +30,10 @@
 #ifndef BADVPN_UNICODE_FUNCS_H
 #define BADVPN_UNICODE_FUNCS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <misc/expstring.h>
 #include <misc/bsize.h>
 #include <misc/Utf8Encoder.h>
@@ -37,6 +41,36 @@
 #include <misc/Utf16Encoder.h>
 #include <misc/Utf16Decoder.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UNICODE_FUNCS_USE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define UNICODE_FUNCS_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+ * Returns the length of the longest prefix of data made of ASCII bytes (0x00 - 0x7F).
+ * Scans 16 bytes per step with SSE2 or NEON, otherwise 8 bytes per step.
+ * 
+ * @param data data to scan
+ * @param data_len size of data in bytes
+ * @return length of the ASCII prefix, 0 - data_len
+ */
+static size_t unicode_ascii_prefix_len (const uint8_t *data, size_t data_len);
+
+/**
+ * Checks whether data is well-formed UTF-8: no overlong forms, surrogates,
+ * characters above 0x10FFFF or truncated sequences. Null characters are allowed.
+ * The result agrees with the out_is_error result of
+ * {@link unicode_decode_utf8_to_utf16}, without producing any output.
+ * 
+ * @param data UTF-8 data
+ * @param data_len size of data in bytes
+ * @return 1 if valid, 0 if not
+ */
+static int unicode_utf8_is_valid (const uint8_t *data, size_t data_len);
+
 /**
  * Decodes UTF-16 data as bytes into an allocated null-terminated UTF-8 string.
  * 
@@ -66,6 +100,190 @@ static char * unicode_decode_utf16_to_utf8 (const uint8_t *data, size_t data_len
  */
 static void unicode_decode_utf8_to_utf16 (const uint8_t *data, size_t data_len, uint8_t *out, size_t out_avail, bsize_t *out_len, int *out_is_error);
 
+static size_t unicode_ascii_prefix_len (const uint8_t *data, size_t data_len)
+{
+    ASSERT(data_len == 0 || data)
+    
+    size_t i = 0;
+    
+#if defined(UNICODE_FUNCS_USE_SSE2)
+    while (data_len - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        i += 16;
+    }
+#elif defined(UNICODE_FUNCS_USE_NEON)
+    while (data_len - i >= 16) {
+        if (vmaxvq_u8(vld1q_u8(data + i)) >= 0x80) {
+            break;
+        }
+        i += 16;
+    }
+#endif
+    
+    while (data_len - i >= 8) {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        if ((w & UINT64_C(0x8080808080808080)) != 0) {
+            break;
+        }
+        i += 8;
+    }
+    
+    while (i < data_len && data[i] < 0x80) {
+        i++;
+    }
+    
+    return i;
+}
+
+static int unicode_utf8_is_valid (const uint8_t *data, size_t data_len)
+{
+    ASSERT(data_len == 0 || data)
+    
+    size_t i = 0;
+    
+    while (i < data_len) {
+        uint8_t b = data[i];
+        
+        // skip a run of ASCII
+        if (b < 0x80) {
+            i += unicode_ascii_prefix_len(data + i, data_len - i);
+            continue;
+        }
+        
+        // determine the number of continuation bytes and the allowed range
+        // of the first one, which excludes overlong forms, surrogates and
+        // characters above 0x10FFFF
+        size_t cont;
+        uint8_t lo = 0x80;
+        uint8_t hi = 0xBF;
+        if (b >= 0xC2 && b <= 0xDF) {
+            cont = 1;
+        }
+        else if (b == 0xE0) {
+            cont = 2;
+            lo = 0xA0;
+        }
+        else if (b == 0xED) {
+            cont = 2;
+            hi = 0x9F;
+        }
+        else if (b >= 0xE1 && b <= 0xEF) {
+            cont = 2;
+        }
+        else if (b == 0xF0) {
+            cont = 3;
+            lo = 0x90;
+        }
+        else if (b == 0xF4) {
+            cont = 3;
+            hi = 0x8F;
+        }
+        else if (b >= 0xF1 && b <= 0xF3) {
+            cont = 3;
+        }
+        else {
+            return 0;
+        }
+        
+        if (data_len - i - 1 < cont) {
+            return 0;
+        }
+        
+        if (data[i + 1] < lo || data[i + 1] > hi) {
+            return 0;
+        }
+        for (size_t j = 2; j <= cont; j++) {
+            if ((data[i + j] & 0xC0) != 0x80) {
+                return 0;
+            }
+        }
+        
+        i += 1 + cont;
+    }
+    
+    return 1;
+}
+
+// Converts ASCII bytes to big endian UTF-16.
+static void unicode__widen_ascii (const uint8_t *data, size_t len, uint8_t *out)
+{
+#if defined(UNICODE_FUNCS_USE_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    while (len >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)data);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(zero, v));
+        data += 16;
+        out += 32;
+        len -= 16;
+    }
+#elif defined(UNICODE_FUNCS_USE_NEON)
+    while (len >= 16) {
+        uint8x16x2_t v;
+        v.val[0] = vdupq_n_u8(0);
+        v.val[1] = vld1q_u8(data);
+        vst2q_u8(out, v);
+        data += 16;
+        out += 32;
+        len -= 16;
+    }
+#endif
+    
+    while (len > 0) {
+        *(out++) = 0;
+        *(out++) = *(data++);
+        len--;
+    }
+}
+
+// Converts a prefix of big endian UTF-16 data made of non-null ASCII
+// characters to ASCII bytes. Returns the number of 16-bit values converted.
+static size_t unicode__narrow_ascii (const uint8_t *data, size_t num_units, uint8_t *out)
+{
+    size_t i = 0;
+    
+#if defined(UNICODE_FUNCS_USE_SSE2)
+    // as little endian 16-bit lanes, the high byte of a value is the low
+    // byte of a lane
+    __m128i zero = _mm_setzero_si128();
+    __m128i nonascii = _mm_set1_epi16(0x80FF);
+    while (num_units - i >= 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        __m128i ok = _mm_andnot_si128(_mm_cmpeq_epi16(v, zero), _mm_cmpeq_epi16(_mm_and_si128(v, nonascii), zero));
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+            break;
+        }
+        __m128i chars = _mm_packus_epi16(_mm_srli_epi16(v, 8), zero);
+        _mm_storel_epi64((__m128i *)(out + i), chars);
+        i += 8;
+    }
+#elif defined(UNICODE_FUNCS_USE_NEON)
+    while (num_units - i >= 16) {
+        uint8x16x2_t v = vld2q_u8(data + 2 * i);
+        if (vmaxvq_u8(v.val[0]) != 0 || vmaxvq_u8(v.val[1]) >= 0x80 || vminvq_u8(v.val[1]) == 0) {
+            break;
+        }
+        vst1q_u8(out + i, v.val[1]);
+        i += 16;
+    }
+#endif
+    
+    while (i < num_units) {
+        uint8_t x = data[2 * i];
+        uint8_t y = data[2 * i + 1];
+        if (x != 0 || y == 0 || y >= 0x80) {
+            break;
+        }
+        out[i++] = y;
+    }
+    
+    return i;
+}
+
 static char * unicode_decode_utf16_to_utf8 (const uint8_t *data, size_t data_len, int *out_is_error)
 {
     // will build the resulting UTF-8 string by appending to ExpString
@@ -85,6 +303,41 @@ static char * unicode_decode_utf16_to_utf8 (const uint8_t *data, size_t data_len
     int error = 0;
     
     while (i_in < data_len) {
+        // between characters, copy a run of non-null ASCII characters in bulk
+        if (!decoder.cont && data_len - i_in >= 2 && data[i_in] == 0 && data[i_in + 1] != 0 && data[i_in + 1] < 0x80) {
+            size_t num_units = (data_len - i_in) / 2;
+            size_t run = 0;
+            
+            while (run < num_units) {
+                uint8_t chunk[256];
+                size_t chunk_units = num_units - run;
+                if (chunk_units > sizeof(chunk)) {
+                    chunk_units = sizeof(chunk);
+                }
+                size_t n = unicode__narrow_ascii(data + i_in + 2 * run, chunk_units, chunk);
+                if (!ExpString_AppendBinary(&str, chunk, n)) {
+                    goto fail1;
+                }
+                run += n;
+                if (n < chunk_units) {
+                    break;
+                }
+            }
+            
+            // everything before a character was matched unless something
+            // failed to decode, and then this character mismatches too
+            if (!error) {
+                if (i_ch != i_in) {
+                    error = 1;
+                } else {
+                    i_ch += 2 * run;
+                }
+            }
+            
+            i_in += 2 * run;
+            continue;
+        }
+        
         // read two input bytes from the input position
         uint8_t x = data[i_in++];
         if (i_in == data_len) {
@@ -141,7 +394,7 @@ static char * unicode_decode_utf16_to_utf8 (const uint8_t *data, size_t data_len
         
         // append the resulting UTF-8 bytes to the result string
         enc[enc_n] = 0;
-        if (!ExpString_Append(&str, enc)) {
+        if (!ExpString_Append(&str, (char *)enc)) {
             goto fail1;
         }
     }
@@ -175,6 +428,37 @@ static void unicode_decode_utf8_to_utf16 (const uint8_t *data, size_t data_len,
     int error = 0;
     
     while (i_in < data_len) {
+        // between characters, convert a run of ASCII in bulk
+        if (decoder.bytes == 0 && data[i_in] < 0x80) {
+            size_t run = unicode_ascii_prefix_len(data + i_in, data_len - i_in);
+            
+            // everything before a character was matched unless something
+            // failed to decode, and then this character mismatches too
+            if (!error) {
+                if (i_ch != i_in) {
+                    error = 1;
+                } else {
+                    i_ch += run;
+                }
+            }
+            
+            len = bsize_add(len, bsize_add(bsize_fromsize(run), bsize_fromsize(run)));
+            
+            size_t n = (run < out_avail / 2) ? run : out_avail / 2;
+            unicode__widen_ascii(data + i_in, n, out);
+            out += 2 * n;
+            out_avail -= 2 * n;
+            
+            // a character that only partly fits gets its first byte written
+            if (n < run && out_avail > 0) {
+                *(out++) = 0;
+                out_avail--;
+            }
+            
+            i_in += run;
+            continue;
+        }
+        
         uint8_t x = data[i_in++];
         
         uint32_t ch;
@@ -196,7 +480,7 @@ static void unicode_decode_utf8_to_utf16 (const uint8_t *data, size_t data_len,
             }
         }
         
-        uint16_t enc[2];
+        uint16_t enc[2] = {0, 0};
         int enc_n = Utf16Encoder_EncodeCharacter(ch, enc);
         ASSERT(enc_n > 0)
         
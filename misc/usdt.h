@@ -0,0 +1,81 @@
+/**
+ * @file usdt.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Static tracepoints (USDT probes) for tracing tools such as bpftrace and
+ * SystemTap.
+ * 
+ * When built with BADVPN_USE_USDT, the macros expand to the probes of
+ * sys/sdt.h under the provider "badvpn"; a probe which is not attached is a
+ * single nop instruction, and its arguments are only evaluated into registers.
+ * Otherwise the macros expand to nothing. Arguments must be integers or
+ * pointers. The first argument of a probe is the object it belongs to.
+ *
+ * Probes:
+ * - btap_recv(tap, bytes), btap_send(tap, bytes): frame read from / written
+ *   to a TUN/TAP device.
+ * - bdatagram_recv(dgram, bytes), bdatagram_send(dgram, num_packets):
+ *   datagram received / datagrams passed to the kernel.
+ * - bconnection_recv(con, bytes), bconnection_send(con, bytes): stream data
+ *   read from / written to a socket.
+ * - fairqueue_schedule(queue, flow): PacketPassFairQueue picked a flow to send.
+ * - spproto_encode_start(encoder, num_packets), spproto_encode_done(encoder,
+ *   num_packets): SPProto encoding work started / finished.
+ * - threadwork_queue(work), threadwork_start(work), threadwork_complete(work):
+ *   BThreadWork submitted, started running, result delivered to the reactor.
+ * - socks_state(client, state), socks_error(client, event): BSocksClient
+ *   handshake progress (states as in BSocksClient.c) and failures.
+ *
+ * Example:
+ *
+ *   bpftrace -e 'usdt:./badvpn-tun2socks:badvpn:btap_recv { @[comm] = count(); }'
+ */
+
+#ifndef BADVPN_MISC_USDT_H
+#define BADVPN_MISC_USDT_H
+
+#ifdef BADVPN_USE_USDT
+
+#include <sys/sdt.h>
+
+#define BTRACE0(name) DTRACE_PROBE(badvpn, name)
+#define BTRACE1(name, a1) DTRACE_PROBE1(badvpn, name, a1)
+#define BTRACE2(name, a1, a2) DTRACE_PROBE2(badvpn, name, a1, a2)
+#define BTRACE3(name, a1, a2, a3) DTRACE_PROBE3(badvpn, name, a1, a2, a3)
+
+#else
+
+#define BTRACE0(name)
+#define BTRACE1(name, a1)
+#define BTRACE2(name, a1, a2)
+#define BTRACE3(name, a1, a2, a3)
+
+#endif
+
+#endif
@@ -31,13 +31,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <misc/string_begins_with.h>
+#include <misc/parse_number.h>
+#include <misc/balloc.h>
 #include <base/BLog.h>
 #include <base/DebugObject.h>
+#include <base/BPending.h>
 #include <system/BNetwork.h>
 #include <system/BReactor.h>
 #include <system/BAddr.h>
+#include <system/BConnection.h>
 #include <ncd/NCDValParser.h>
 #include <ncd/NCDValGenerator.h>
 #include <ncd/extra/NCDRequestClient.h>
@@ -51,6 +58,25 @@ static void request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef re
 static void request_handler_finished (void *user, int is_error);
 static int write_all (int fd, const uint8_t *data, size_t len);
 static int make_connect_addr (const char *str, struct BConnection_addr *out_addr);
+static int batch_init (void);
+static void batch_free (void);
+static void batch_process_input (void);
+static int batch_start_request (char *line, size_t line_len);
+static void batch_input_job_handler (void *unused);
+static void batch_input_handler_done (void *unused, int data_len);
+static void batch_input_connection_handler (void *unused, int event);
+static void batch_request_handler_sent (void *user);
+static void batch_request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef reply_value);
+static void batch_request_handler_finished (void *user, int is_error);
+
+#define DEFAULT_MAX_INFLIGHT 64
+#define BATCH_INPUT_BUF_SIZE 32768
+
+struct batch_slot {
+    NCDRequestClientRequest request;
+    uint64_t line_number;
+    int next_free;
+};
 
 NCDStringIndex string_index;
 NCDValMem request_mem;
@@ -60,17 +86,67 @@ NCDRequestClient client;
 NCDRequestClientRequest request;
 int have_request;
 
+// batch mode state
+int batch;
+int max_inflight;
+struct batch_slot *slots;
+int first_free_slot;
+int num_inflight;
+int batch_exitcode;
+int batch_started;
+char batch_input_buf[BATCH_INPUT_BUF_SIZE];
+size_t batch_input_start;
+size_t batch_input_len;
+uint64_t batch_line_number;
+int batch_input_is_file;
+int batch_input_receiving;
+int batch_input_closed;
+BConnection batch_input_con;
+BPending batch_input_job;
+
 int main (int argc, char *argv[])
 {
     int res = 1;
     
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s < unix:<socket_path> / tcp:<address>:<port> > <request_payload>\n", (argc > 0 ? argv[0] : ""));
+    int binary = 0;
+    int argi = 1;
+    
+    batch = 0;
+    max_inflight = DEFAULT_MAX_INFLIGHT;
+    
+    while (argi < argc && string_begins_with(argv[argi], "--")) {
+        if (!strcmp(argv[argi], "--binary")) {
+            binary = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--batch")) {
+            batch = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--max-inflight") && argi + 1 < argc) {
+            uintmax_t n;
+            if (!parse_unsigned_integer(MemRef_MakeCstr(argv[argi + 1]), &n) || n < 1 || n > 65536) {
+                fprintf(stderr, "--max-inflight: wrong argument\n");
+                goto fail0;
+            }
+            max_inflight = n;
+            argi += 2;
+        }
+        else {
+            break;
+        }
+    }
+    
+    if (argc - argi != (batch ? 1 : 2)) {
+        fprintf(stderr, "Usage: %s [--binary] < unix:<socket_path> / tcp:<address>:<port> > <request_payload>\n", (argc > 0 ? argv[0] : ""));
+        fprintf(stderr, "       %s [--binary] --batch [--max-inflight <num>] < unix:<socket_path> / tcp:<address>:<port> >\n", (argc > 0 ? argv[0] : ""));
+        fprintf(stderr, "In batch mode, request payloads are read from standard input, one per line.\n");
+        fprintf(stderr, "Every output line starts with the input line number: \"<n> reply <value>\", \"<n> done\" or \"<n> error\".\n");
         goto fail0;
     }
     
-    char *connect_address = argv[1];
-    char *request_payload_string = argv[2];
+    char *connect_address = argv[argi];
+    char *request_payload_string = (batch ? NULL : argv[argi + 1]);
     
     BLog_InitStderr();
     
@@ -83,8 +159,8 @@ int main (int argc, char *argv[])
     
     NCDValMem_Init(&request_mem, &string_index);
     
-    if (!NCDValParser_Parse(MemRef_MakeCstr(request_payload_string), &request_mem, &request_value)) {
-        BLog(BLOG_ERROR, "BReactor_Init failed");
+    if (!batch && !NCDValParser_Parse(MemRef_MakeCstr(request_payload_string), &request_mem, &request_value)) {
+        BLog(BLOG_ERROR, "NCDValParser_Parse failed");
         goto fail1;
     }
     
@@ -103,15 +179,19 @@ int main (int argc, char *argv[])
         goto fail2;
     }
     
-    if (!NCDRequestClient_Init(&client, addr, &reactor, &string_index, NULL, client_handler_error, client_handler_connected)) {
+    if (!NCDRequestClient_Init(&client, addr, &reactor, &string_index, binary, NULL, client_handler_error, client_handler_connected)) {
         BLog(BLOG_ERROR, "NCDRequestClient_Init failed");
         goto fail2;
     }
     
     have_request = 0;
+    batch_started = 0;
     
     res = BReactor_Exec(&reactor);
     
+    if (batch_started) {
+        batch_free();
+    }
     if (have_request) {
         NCDRequestClientRequest_Free(&request);
     }
@@ -162,6 +242,18 @@ static void client_handler_error (void *user)
 static void client_handler_connected (void *user)
 {
     ASSERT(!have_request)
+    ASSERT(!batch_started)
+    
+    if (batch) {
+        if (!batch_init()) {
+            BReactor_Quit(&reactor, 1);
+            return;
+        }
+        
+        batch_started = 1;
+        batch_process_input();
+        return;
+    }
     
     if (!NCDRequestClientRequest_Init(&request, &client, request_value, NULL, request_handler_sent, request_handler_reply, request_handler_finished)) {
         BLog(BLOG_ERROR, "NCDRequestClientRequest_Init failed");
@@ -230,3 +322,273 @@ static int write_all (int fd, const uint8_t *data, size_t len)
     
     return 1;
 }
+
+static int batch_init (void)
+{
+    slots = BAllocArray(max_inflight, sizeof(slots[0]));
+    if (!slots) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // chain all slots into the free list
+    for (int i = 0; i < max_inflight; i++) {
+        slots[i].next_free = (i + 1 < max_inflight ? i + 1 : -1);
+    }
+    first_free_slot = 0;
+    num_inflight = 0;
+    batch_exitcode = 0;
+    
+    batch_input_start = 0;
+    batch_input_len = 0;
+    batch_line_number = 0;
+    batch_input_receiving = 0;
+    batch_input_closed = 0;
+    
+    // regular files cannot be polled, but reading them never blocks
+    struct stat st;
+    batch_input_is_file = (fstat(0, &st) == 0 && S_ISREG(st.st_mode));
+    
+    if (!batch_input_is_file) {
+        if (!BConnection_Init(&batch_input_con, BConnection_source_pipe(0, 0), &reactor, NULL, batch_input_connection_handler)) {
+            BLog(BLOG_ERROR, "BConnection_Init failed");
+            goto fail1;
+        }
+        BConnection_RecvAsync_Init(&batch_input_con);
+        StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&batch_input_con), batch_input_handler_done, NULL);
+    }
+    
+    BPending_Init(&batch_input_job, BReactor_PendingGroup(&reactor), batch_input_job_handler, NULL);
+    
+    return 1;
+    
+fail1:
+    BFree(slots);
+fail0:
+    return 0;
+}
+
+static void batch_free (void)
+{
+    // free requests still in flight
+    for (int i = 0; i < max_inflight; i++) {
+        if (slots[i].next_free == -2) {
+            NCDRequestClientRequest_Free(&slots[i].request);
+        }
+    }
+    
+    BPending_Free(&batch_input_job);
+    
+    if (!batch_input_is_file && !batch_input_closed) {
+        BConnection_RecvAsync_Free(&batch_input_con);
+        BConnection_Free(&batch_input_con);
+    }
+    
+    BFree(slots);
+}
+
+static void batch_process_input (void)
+{
+    ASSERT(batch_started)
+    ASSERT(!batch_input_receiving)
+    
+    while (first_free_slot >= 0) {
+        // start a request for each complete line
+        char *begin = batch_input_buf + batch_input_start;
+        size_t avail = batch_input_len - batch_input_start;
+        char *nl = memchr(begin, '\n', avail);
+        
+        if (nl || (batch_input_closed && avail > 0)) {
+            size_t line_len = (nl ? (size_t)(nl - begin) : avail);
+            batch_input_start += line_len + (nl ? 1 : 0);
+            batch_line_number++;
+            
+            if (!batch_start_request(begin, line_len)) {
+                BReactor_Quit(&reactor, 1);
+                return;
+            }
+            continue;
+        }
+        
+        if (batch_input_closed) {
+            // all requests have been sent, wait for them to finish
+            if (num_inflight == 0) {
+                BReactor_Quit(&reactor, batch_exitcode);
+            }
+            return;
+        }
+        
+        // move the partial line to the beginning of the buffer
+        memmove(batch_input_buf, begin, avail);
+        batch_input_start = 0;
+        batch_input_len = avail;
+        
+        if (batch_input_len == BATCH_INPUT_BUF_SIZE) {
+            BLog(BLOG_ERROR, "line %" PRIu64 " is too long", batch_line_number + 1);
+            BReactor_Quit(&reactor, 1);
+            return;
+        }
+        
+        if (!batch_input_is_file) {
+            // wait for more input
+            StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&batch_input_con), (uint8_t *)batch_input_buf + batch_input_len, BATCH_INPUT_BUF_SIZE - batch_input_len);
+            batch_input_receiving = 1;
+            return;
+        }
+        
+        ssize_t res = read(0, batch_input_buf + batch_input_len, BATCH_INPUT_BUF_SIZE - batch_input_len);
+        if (res < 0) {
+            BLog(BLOG_ERROR, "read failed");
+            BReactor_Quit(&reactor, 1);
+            return;
+        }
+        if (res == 0) {
+            batch_input_closed = 1;
+        }
+        batch_input_len += res;
+    }
+}
+
+static int batch_start_request (char *line, size_t line_len)
+{
+    ASSERT(first_free_slot >= 0)
+    
+    // strip trailing whitespace, skip empty lines
+    while (line_len > 0 && (line[line_len - 1] == '\r' || line[line_len - 1] == ' ' || line[line_len - 1] == '\t')) {
+        line_len--;
+    }
+    if (line_len == 0) {
+        return 1;
+    }
+    
+    NCDValMem_Free(&request_mem);
+    NCDValMem_Init(&request_mem, &string_index);
+    
+    if (!NCDValParser_Parse(MemRef_Make(line, line_len), &request_mem, &request_value)) {
+        BLog(BLOG_ERROR, "line %" PRIu64 ": failed to parse request payload", batch_line_number);
+        batch_exitcode = 1;
+        char out[48];
+        snprintf(out, sizeof(out), "%" PRIu64 " error\n", batch_line_number);
+        return write_all(1, (uint8_t *)out, strlen(out));
+    }
+    
+    struct batch_slot *slot = &slots[first_free_slot];
+    
+    if (!NCDRequestClientRequest_Init(&slot->request, &client, request_value, slot, batch_request_handler_sent, batch_request_handler_reply, batch_request_handler_finished)) {
+        BLog(BLOG_ERROR, "NCDRequestClientRequest_Init failed");
+        return 0;
+    }
+    
+    // the request has been serialized, the payload is no longer needed
+    first_free_slot = slot->next_free;
+    slot->next_free = -2;
+    slot->line_number = batch_line_number;
+    num_inflight++;
+    
+    return 1;
+}
+
+static void batch_input_job_handler (void *unused)
+{
+    ASSERT(batch_started)
+    
+    if (!batch_input_receiving) {
+        batch_process_input();
+    }
+}
+
+static void batch_input_handler_done (void *unused, int data_len)
+{
+    ASSERT(batch_input_receiving)
+    ASSERT(data_len > 0)
+    
+    batch_input_receiving = 0;
+    batch_input_len += data_len;
+    
+    batch_process_input();
+}
+
+static void batch_input_connection_handler (void *unused, int event)
+{
+    ASSERT(!batch_input_is_file)
+    ASSERT(!batch_input_closed)
+    
+    if (event != BCONNECTION_EVENT_RECVCLOSED) {
+        BLog(BLOG_ERROR, "stdin error");
+        BReactor_Quit(&reactor, 1);
+        return;
+    }
+    
+    BConnection_RecvAsync_Free(&batch_input_con);
+    BConnection_Free(&batch_input_con);
+    
+    batch_input_receiving = 0;
+    batch_input_closed = 1;
+    
+    batch_process_input();
+}
+
+static void batch_request_handler_sent (void *user)
+{
+}
+
+static void batch_request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef reply_value)
+{
+    struct batch_slot *slot = user;
+    ASSERT(slot->next_free == -2)
+    
+    char *str = NCDValGenerator_Generate(reply_value);
+    if (!str) {
+        BLog(BLOG_ERROR, "NCDValGenerator_Generate failed");
+        goto fail0;
+    }
+    
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%" PRIu64 " reply ", slot->line_number);
+    
+    if (!write_all(1, (uint8_t *)prefix, strlen(prefix)) ||
+        !write_all(1, (uint8_t *)str, strlen(str)) ||
+        !write_all(1, (const uint8_t *)"\n", 1)
+    ) {
+        goto fail1;
+    }
+    
+    free(str);
+    NCDValMem_Free(&reply_mem);
+    return;
+    
+fail1:
+    free(str);
+fail0:
+    NCDValMem_Free(&reply_mem);
+    BReactor_Quit(&reactor, 1);
+}
+
+static void batch_request_handler_finished (void *user, int is_error)
+{
+    struct batch_slot *slot = user;
+    ASSERT(slot->next_free == -2)
+    ASSERT(num_inflight > 0)
+    
+    char out[48];
+    snprintf(out, sizeof(out), "%" PRIu64 " %s\n", slot->line_number, (is_error ? "error" : "done"));
+    
+    if (is_error) {
+        BLog(BLOG_ERROR, "line %" PRIu64 ": request error", slot->line_number);
+        batch_exitcode = 1;
+    }
+    
+    // release the slot
+    NCDRequestClientRequest_Free(&slot->request);
+    slot->next_free = first_free_slot;
+    first_free_slot = slot - slots;
+    num_inflight--;
+    
+    if (!write_all(1, (uint8_t *)out, strlen(out))) {
+        BReactor_Quit(&reactor, 1);
+        return;
+    }
+    
+    // start more requests outside of the client's handler
+    BPending_Set(&batch_input_job);
+}
@@ -35,6 +35,7 @@
 #include <misc/read_file.h>
 #include <misc/strdup.h>
 #include <misc/concat_strings.h>
+#include <misc/hashfun.h>
 #include <base/BLog.h>
 #include <ncd/NCDConfigParser.h>
 
@@ -50,8 +51,21 @@ struct guard {
     struct guard *next;
 };
 
+// contents of a file which has include guards; once such a file has been
+// processed, any file with the same contents is guarded and need not be parsed
+struct guarded_content {
+    uint64_t hash;
+    uint8_t *data;
+    size_t len;
+    struct guarded_content *next;
+};
+
 struct build_state {
     struct guard *top_guard;
+    struct guarded_content *guarded_contents;
+    uint64_t hash_seed;
+    NCDBuildProgram_file_handler file_handler;
+    void *user;
 };
 
 static int add_guard (struct guard **first, const char *id_data, size_t id_length)
@@ -114,6 +128,27 @@ static int guard_exists (struct guard *top_guard, const char *id_data, size_t id
     return 0;
 }
 
+static int guarded_content_exists (struct build_state *st, uint64_t hash, const uint8_t *data, size_t len)
+{
+    for (struct guarded_content *gc = st->guarded_contents; gc; gc = gc->next) {
+        if (gc->hash == hash && gc->len == len && !memcmp(gc->data, data, len)) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static void free_guarded_contents (struct guarded_content *gc)
+{
+    while (gc) {
+        struct guarded_content *next_gc = gc->next;
+        free(gc->data);
+        free(gc);
+        gc = next_gc;
+    }
+}
+
 static char * make_dir_path (const char *file_path)
 {
     int found_slash = 0;
@@ -202,14 +237,42 @@ static int process_file (struct build_state *st, int depth, const char *file_pat
         goto fail1;
     }
     
+    if (st->file_handler && !st->file_handler(st->user, file_path, data, len)) {
+        BLog(BLOG_ERROR, "file '%s': file handler failed", file_path);
+        free(data);
+        goto fail1;
+    }
+    
+    // the same guarded file is typically included from many places
+    uint64_t hash = badvpn_hash_bin(data, len, st->hash_seed);
+    if (guarded_content_exists(st, hash, data, len)) {
+        free(data);
+        free(dir_path);
+        *out_guarded = 1;
+        return 1;
+    }
+    
     NCDProgram program;
     res = NCDConfigParser_Parse((char *)data, len, &program);
-    free(data);
     if (!res) {
         BLog(BLOG_ERROR, "file '%s': failed to parse", file_path);
+        free(data);
         goto fail1;
     }
     
+    // remember the contents if the file has include guards (without memory,
+    // the file is just parsed again next time)
+    struct guarded_content *gc;
+    if (NCDProgram_ContainsElemType(&program, NCDPROGRAMELEM_INCLUDE_GUARD) && (gc = malloc(sizeof(*gc)))) {
+        gc->hash = hash;
+        gc->data = data;
+        gc->len = len;
+        gc->next = st->guarded_contents;
+        st->guarded_contents = gc;
+    } else {
+        free(data);
+    }
+    
     struct guard *our_guards = NULL;
     
     NCDProgramElem *elem = NCDProgram_FirstElem(&program);
@@ -299,12 +362,21 @@ fail0:
 }
 
 int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program)
+{
+    return NCDBuildProgram_Build2(file_path, NULL, NULL, out_program);
+}
+
+int NCDBuildProgram_Build2 (const char *file_path, NCDBuildProgram_file_handler file_handler, void *user, NCDProgram *out_program)
 {
     ASSERT(file_path)
     ASSERT(out_program)
     
     struct build_state st;
     st.top_guard = NULL;
+    st.guarded_contents = NULL;
+    st.hash_seed = badvpn_hash_seed();
+    st.file_handler = file_handler;
+    st.user = user;
     
     int guarded;
     int res = process_file(&st, 0, file_path, out_program, &guarded);
@@ -312,6 +384,7 @@ int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program)
     ASSERT(!res || !guarded)
     
     free_guards(st.top_guard);
+    free_guarded_contents(st.guarded_contents);
     
     return res;
 }
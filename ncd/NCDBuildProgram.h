@@ -30,6 +30,9 @@
 #ifndef NCD_BUILD_PROGRAM_H
 #define NCD_BUILD_PROGRAM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <misc/debug.h>
 #include <ncd/NCDAst.h>
 
@@ -46,4 +49,30 @@
  */
 int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program) WARN_UNUSED;
 
+/**
+ * Handler called by {@link NCDBuildProgram_Build2} for every file read, before
+ * it is parsed.
+ * 
+ * @param user as in {@link NCDBuildProgram_Build2}
+ * @param file_path path of the file, as it was opened
+ * @param data contents of the file
+ * @param len length of the contents
+ * @return 1 to continue, 0 to fail the build
+ */
+typedef int (*NCDBuildProgram_file_handler) (void *user, const char *file_path, const uint8_t *data, size_t len);
+
+/**
+ * Like {@link NCDBuildProgram_Build}, but reports every file read to the
+ * given handler. This allows the caller to record what the program was
+ * built from.
+ * 
+ * @param file_path path to the main file of the program
+ * @param file_handler handler to report files to, or NULL
+ * @param user argument to file_handler
+ * @param out_program on success, *out_program will contain the resulting program.
+ *                    On failure, *out_program will be unchanged.
+ * @return 1 on success, 0 on failure
+ */
+int NCDBuildProgram_Build2 (const char *file_path, NCDBuildProgram_file_handler file_handler, void *user, NCDProgram *out_program) WARN_UNUSED;
+
 #endif
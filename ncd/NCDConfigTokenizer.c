@@ -57,7 +57,83 @@ static int is_space_char (char c)
     return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
 }
 
-static int string_equals (char *str, int str_len, char *needle)
+// returns the length of the keyword at the start of str, or 0; keywords are
+// matched as prefixes, so that e.g. "elsewhere" is "else" followed by "where"
+static size_t keyword_begins (const char *str, size_t left, int *out_token)
+{
+    size_t l;
+    
+    switch (*str) {
+        case 'I':
+            if (l = data_begins_with(str, left, "If")) {
+                *out_token = NCD_TOKEN_IF;
+                return l;
+            }
+            if (l = data_begins_with(str, left, "Interrupt")) {
+                *out_token = NCD_TOKEN_INTERRUPT;
+                return l;
+            }
+            break;
+        case 'E':
+            if (l = data_begins_with(str, left, "Elif")) {
+                *out_token = NCD_TOKEN_ELIF;
+                return l;
+            }
+            if (l = data_begins_with(str, left, "Else")) {
+                *out_token = NCD_TOKEN_ELSE;
+                return l;
+            }
+            break;
+        case 'e':
+            if (l = data_begins_with(str, left, "elif")) {
+                *out_token = NCD_TOKEN_ELIF;
+                return l;
+            }
+            if (l = data_begins_with(str, left, "else")) {
+                *out_token = NCD_TOKEN_ELSE;
+                return l;
+            }
+            break;
+        case 'F':
+            if (l = data_begins_with(str, left, "Foreach")) {
+                *out_token = NCD_TOKEN_FOREACH;
+                return l;
+            }
+            break;
+        case 'A':
+            if (l = data_begins_with(str, left, "As")) {
+                *out_token = NCD_TOKEN_AS;
+                return l;
+            }
+            break;
+        case 'B':
+            if (l = data_begins_with(str, left, "Block")) {
+                *out_token = NCD_TOKEN_BLOCK;
+                return l;
+            }
+            break;
+        case 'D':
+            if (l = data_begins_with(str, left, "Do")) {
+                *out_token = NCD_TOKEN_DO;
+                return l;
+            }
+            break;
+        case 'i':
+            if (l = data_begins_with(str, left, "include_guard")) {
+                *out_token = NCD_TOKEN_INCLUDE_GUARD;
+                return l;
+            }
+            if (l = data_begins_with(str, left, "include")) {
+                *out_token = NCD_TOKEN_INCLUDE;
+                return l;
+            }
+            break;
+    }
+    
+    return 0;
+}
+
+static int name_equals (const char *str, size_t str_len, const char *needle)
 {
     return (str_len == strlen(needle) && !memcmp(str, needle, str_len));
 }
@@ -77,87 +153,35 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
         void *token_val = NULL;
         size_t token_len = 0;
         
-        if (*str == '#') {
-            l = 1;
-            while (l < left && str[l] != '\n') {
-                l++;
-            }
-            token = 0;
-        }
-        else if (l = data_begins_with(str, left, "{")) {
-            token = NCD_TOKEN_CURLY_OPEN;
-        }
-        else if (l = data_begins_with(str, left, "}")) {
-            token = NCD_TOKEN_CURLY_CLOSE;
-        }
-        else if (l = data_begins_with(str, left, "(")) {
-            token = NCD_TOKEN_ROUND_OPEN;
-        }
-        else if (l = data_begins_with(str, left, ")")) {
-            token = NCD_TOKEN_ROUND_CLOSE;
+        switch (*str) {
+            case '{': token = NCD_TOKEN_CURLY_OPEN; break;
+            case '}': token = NCD_TOKEN_CURLY_CLOSE; break;
+            case '(': token = NCD_TOKEN_ROUND_OPEN; break;
+            case ')': token = NCD_TOKEN_ROUND_CLOSE; break;
+            case ';': token = NCD_TOKEN_SEMICOLON; break;
+            case '.': token = NCD_TOKEN_DOT; break;
+            case ',': token = NCD_TOKEN_COMMA; break;
+            case ':': token = NCD_TOKEN_COLON; break;
+            case '[': token = NCD_TOKEN_BRACKET_OPEN; break;
+            case ']': token = NCD_TOKEN_BRACKET_CLOSE; break;
+            case '@': token = NCD_TOKEN_AT; break;
+            case '^': token = NCD_TOKEN_CARET; break;
+            default: token = 0; break;
         }
-        else if (l = data_begins_with(str, left, ";")) {
-            token = NCD_TOKEN_SEMICOLON;
-        }
-        else if (l = data_begins_with(str, left, ".")) {
-            token = NCD_TOKEN_DOT;
-        }
-        else if (l = data_begins_with(str, left, ",")) {
-            token = NCD_TOKEN_COMMA;
-        }
-        else if (l = data_begins_with(str, left, ":")) {
-            token = NCD_TOKEN_COLON;
-        }
-        else if (l = data_begins_with(str, left, "[")) {
-            token = NCD_TOKEN_BRACKET_OPEN;
-        }
-        else if (l = data_begins_with(str, left, "]")) {
-            token = NCD_TOKEN_BRACKET_CLOSE;
-        }
-        else if (l = data_begins_with(str, left, "@")) {
-            token = NCD_TOKEN_AT;
+        
+        if (token) {
+            l = 1;
         }
-        else if (l = data_begins_with(str, left, "^")) {
-            token = NCD_TOKEN_CARET;
+        else if (*str == '#') {
+            // skip to the end of the line
+            const char *nl = memchr(str + 1, '\n', left - 1);
+            l = nl ? (size_t)(nl - str) : left;
         }
         else if (l = data_begins_with(str, left, "->")) {
             token = NCD_TOKEN_ARROW;
         }
-        else if (l = data_begins_with(str, left, "If")) {
-            token = NCD_TOKEN_IF;
-        }
-        else if (l = data_begins_with(str, left, "Elif")) {
-            token = NCD_TOKEN_ELIF;
-        }
-        else if (l = data_begins_with(str, left, "elif")) {
-            token = NCD_TOKEN_ELIF;
-        }
-        else if (l = data_begins_with(str, left, "Else")) {
-            token = NCD_TOKEN_ELSE;
-        }
-        else if (l = data_begins_with(str, left, "else")) {
-            token = NCD_TOKEN_ELSE;
-        }
-        else if (l = data_begins_with(str, left, "Foreach")) {
-            token = NCD_TOKEN_FOREACH;
-        }
-        else if (l = data_begins_with(str, left, "As")) {
-            token = NCD_TOKEN_AS;
-        }
-        else if (l = data_begins_with(str, left, "Block")) {
-            token = NCD_TOKEN_BLOCK;
-        }
-        else if (l = data_begins_with(str, left, "Do")) {
-            token = NCD_TOKEN_DO;
-        }
-        else if (l = data_begins_with(str, left, "Interrupt")) {
-            token = NCD_TOKEN_INTERRUPT;
-        }
-        else if (l = data_begins_with(str, left, "include_guard")) {
-            token = NCD_TOKEN_INCLUDE_GUARD;
-        }
-        else if (l = data_begins_with(str, left, "include")) {
-            token = NCD_TOKEN_INCLUDE;
+        else if (l = keyword_begins(str, left, &token)) {
+            // token was set by keyword_begins
         }
         else if (is_name_first_char(*str)) {
             l = 1;
@@ -165,28 +189,26 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
                 l++;
             }
             
-            // allocate buffer
-            bsize_t bufsize = bsize_add(bsize_fromsize(l), bsize_fromint(1));
-            char *buf;
-            if (bufsize.is_overflow || !(buf = malloc(bufsize.value))) {
-                BLog(BLOG_ERROR, "malloc failed");
-                error = 1;
-                goto out;
-            }
-            
-            // copy and terminate
-            memcpy(buf, str, l);
-            buf[l] = '\0';
-            
-            if (!strcmp(buf, "process")) {
+            if (name_equals(str, l, "process")) {
                 token = NCD_TOKEN_PROCESS;
-                free(buf);
             }
-            else if (!strcmp(buf, "template")) {
+            else if (name_equals(str, l, "template")) {
                 token = NCD_TOKEN_TEMPLATE;
-                free(buf);
             }
             else {
+                // allocate buffer
+                bsize_t bufsize = bsize_add(bsize_fromsize(l), bsize_fromint(1));
+                char *buf;
+                if (bufsize.is_overflow || !(buf = malloc(bufsize.value))) {
+                    BLog(BLOG_ERROR, "malloc failed");
+                    error = 1;
+                    goto out;
+                }
+                
+                // copy and terminate
+                memcpy(buf, str, l);
+                buf[l] = '\0';
+                
                 token = NCD_TOKEN_NAME;
                 token_val = buf;
                 token_len = l;
@@ -205,73 +227,83 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
             
             // decode string
             while (l < left) {
-                uint8_t dec_ch;
-                
-                // get character
-                if (str[l] == '\\') {
-                    if (left - l < 2) {
-                        BLog(BLOG_ERROR, "escape character found in string but nothing follows");
+                // append a run of plain characters at once
+                size_t run_end = l;
+                while (run_end < left && str[run_end] != '"' && str[run_end] != '\\') {
+                    run_end++;
+                }
+                if (run_end > l) {
+                    if (!ExpString_AppendBinary(&estr, (const uint8_t *)str + l, run_end - l)) {
+                        BLog(BLOG_ERROR, "ExpString_AppendBinary failed");
                         goto string_fail1;
                     }
+                    l = run_end;
+                    continue;
+                }
+                
+                // end of string
+                if (str[l] == '"') {
+                    break;
+                }
+                
+                // escape sequence
+                uint8_t dec_ch;
+                
+                if (left - l < 2) {
+                    BLog(BLOG_ERROR, "escape character found in string but nothing follows");
+                    goto string_fail1;
+                }
+                
+                size_t extra = 0;
+                
+                switch (str[l + 1]) {
+                    case '\'':
+                    case '\"':
+                    case '\\':
+                    case '\?':
+                        dec_ch = str[l + 1]; break;
                     
-                    size_t extra = 0;
+                    case 'a':
+                        dec_ch = '\a'; break;
+                    case 'b':
+                        dec_ch = '\b'; break;
+                    case 'f':
+                        dec_ch = '\f'; break;
+                    case 'n':
+                        dec_ch = '\n'; break;
+                    case 'r':
+                        dec_ch = '\r'; break;
+                    case 't':
+                        dec_ch = '\t'; break;
+                    case 'v':
+                        dec_ch = '\v'; break;
                     
-                    switch (str[l + 1]) {
-                        case '\'':
-                        case '\"':
-                        case '\\':
-                        case '\?':
-                            dec_ch = str[l + 1]; break;
-                        
-                        case 'a':
-                            dec_ch = '\a'; break;
-                        case 'b':
-                            dec_ch = '\b'; break;
-                        case 'f':
-                            dec_ch = '\f'; break;
-                        case 'n':
-                            dec_ch = '\n'; break;
-                        case 'r':
-                            dec_ch = '\r'; break;
-                        case 't':
-                            dec_ch = '\t'; break;
-                        case 'v':
-                            dec_ch = '\v'; break;
-                        
-                        case '0':
-                            dec_ch = 0; break;
-                        
-                        case 'x': {
-                            if (left - l < 4) {
-                                BLog(BLOG_ERROR, "hexadecimal escape found in string but too little characters follow");
-                                goto string_fail1;
-                            }
-                            
-                            uintmax_t hex_val;
-                            if (!parse_unsigned_hex_integer(MemRef_Make(&str[l + 2], 2), &hex_val)) {
-                                BLog(BLOG_ERROR, "hexadecimal escape found in string but two hex characters don't follow");
-                                goto string_fail1;
-                            }
-                            
-                            dec_ch = hex_val;
-                            extra = 2;
-                        } break;
+                    case '0':
+                        dec_ch = 0; break;
+                    
+                    case 'x': {
+                        if (left - l < 4) {
+                            BLog(BLOG_ERROR, "hexadecimal escape found in string but too little characters follow");
+                            goto string_fail1;
+                        }
                         
-                        default:
-                            BLog(BLOG_ERROR, "bad escape sequence in string");
+                        uintmax_t hex_val;
+                        if (!parse_unsigned_hex_integer(MemRef_Make(&str[l + 2], 2), &hex_val)) {
+                            BLog(BLOG_ERROR, "hexadecimal escape found in string but two hex characters don't follow");
                             goto string_fail1;
-                    }
+                        }
+                        
+                        dec_ch = hex_val;
+                        extra = 2;
+                    } break;
                     
-                    l += 2 + extra;
-                }
-                else if (str[l] == '"') {
-                    break;
-                }
-                else {
-                    dec_ch = str[l];
-                    l++;
+                    default:
+                        BLog(BLOG_ERROR, "bad escape sequence in string");
+                        goto string_fail1;
                 }
                 
+                l += 2 + extra;
+                
                 // append character to string
                 if (!ExpString_AppendByte(&estr, dec_ch)) {
                     BLog(BLOG_ERROR, "ExpString_AppendChar failed");
@@ -299,8 +331,12 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
             error = 1;
         } while (0);
         else if (is_space_char(*str)) {
+            // skip the whole run of whitespace
             token = 0;
             l = 1;
+            while (l < left && is_space_char(str[l])) {
+                l++;
+            }
         }
         else {
             BLog(BLOG_ERROR, "unrecognized character");
@@ -322,14 +358,15 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
         }
         
         // update line/char counters
-        for (size_t i = 0; i < l; i++) {
-            if (str[i] == '\n') {
-                line++;
-                line_char = 1;
-            } else {
-                line_char++;
-            }
-        }
+        const char *p = str;
+        const char *end = str + l;
+        const char *nl;
+        while ((nl = memchr(p, '\n', end - p))) {
+            line++;
+            line_char = 1;
+            p = nl + 1;
+        }
+        line_char += end - p;
         
         str += l;
         left -= l;
@@ -55,20 +55,33 @@ struct NCDEvaluator__eval_context {
     NCDEvaluator_EvalFuncs const *funcs;
 };
 
-static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDValue *value);
+struct NCDEvaluator__compile_context {
+    NCDEvaluator *eval;
+    NCDEvaluator_func_resolve_var func_resolve_var;
+    void *user;
+};
+
+static int expr_init (struct NCDEvaluator__Expr *o, struct NCDEvaluator__compile_context const *context, NCDValue *value);
 static void expr_free (struct NCDEvaluator__Expr *o);
 static int expr_eval (struct NCDEvaluator__Expr *o, struct NCDEvaluator__eval_context const *context, NCDValMem *out_newmem, NCDValRef *out_val);
-static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem, NCDValRef *out);
+static int expr_eval_into (struct NCDEvaluator__Expr *o, struct NCDEvaluator__eval_context const *context, NCDValMem *mem, NCDValRef *out_val);
+static int expr_is_constant (struct NCDEvaluator__Expr *o);
+static int add_expr_recurser (struct NCDEvaluator__compile_context const *context, NCDValue *value, NCDValMem *mem, NCDValRef *out);
+static int fold_call (NCDEvaluator *o, size_t index, NCDValMem *mem, NCDValRef *out);
+static int fold_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int slot, NCDValMem *mem, NCDValRef *out);
+static int fold_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
 static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, NCDValRef *out);
 
-static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDValue *value)
+static NCDEvaluator_EvalFuncs const fold_eval_funcs = {NULL, fold_eval_var, fold_eval_call};
+
+static int expr_init (struct NCDEvaluator__Expr *o, struct NCDEvaluator__compile_context const *context, NCDValue *value)
 {
     ASSERT((NCDValue_Type(value), 1))
     
-    NCDValMem_Init(&o->mem, eval->string_index);
+    NCDValMem_Init(&o->mem, context->eval->string_index);
     
     NCDValRef ref;
-    if (!add_expr_recurser(eval, value, &o->mem, &ref)) {
+    if (!add_expr_recurser(context, value, &o->mem, &ref)) {
         goto fail1;
     }
     
@@ -81,6 +94,9 @@ static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDValue
         }
     }
     
+    // the template lives as long as the program, release the slack
+    NCDValMem_Compact(&o->mem);
+    
     return 1;
     
 fail1:
@@ -128,8 +144,45 @@ fail0:
     return 0;
 }
 
-static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem, NCDValRef *out)
+static int expr_eval_into (struct NCDEvaluator__Expr *o, struct NCDEvaluator__eval_context const *context, NCDValMem *mem, NCDValRef *out_val)
 {
+    if (!NCDVal_IsSafeRefPlaceholder(o->ref)) {
+        if (!NCDValMem_CopyFrom(mem, &o->mem)) {
+            BLog(BLOG_ERROR, "NCDValMem_CopyFrom failed");
+            goto fail0;
+        }
+        
+        if (!NCDValReplaceProg_Execute(o->prog, mem, replace_placeholders_callback, (void *)context)) {
+            goto fail_clear;
+        }
+        
+        *out_val = NCDVal_FromSafe(mem, o->ref);
+    } else {
+        NCDValRef ref;
+        if (!replace_placeholders_callback((void *)context, NCDVal_GetSafeRefPlaceholderId(o->ref), mem, &ref) || NCDVal_IsInvalid(ref)) {
+            goto fail_clear;
+        }
+        
+        *out_val = ref;
+    }
+    
+    return 1;
+    
+fail_clear:
+    NCDValMem_Clear(mem);
+fail0:
+    return 0;
+}
+
+static int expr_is_constant (struct NCDEvaluator__Expr *o)
+{
+    return !NCDVal_IsSafeRefPlaceholder(o->ref) && o->prog.num_instrs == 0;
+}
+
+static int add_expr_recurser (struct NCDEvaluator__compile_context const *context, NCDValue *value, NCDValMem *mem, NCDValRef *out)
+{
+    NCDEvaluator *o = context->eval;
+    
     switch (NCDValue_Type(value)) {
         case NCDVALUE_STRING: {
             const char *str = NCDValue_StringValue(value);
@@ -155,7 +208,7 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
             
             for (NCDValue *e = NCDValue_ListFirst(value); e; e = NCDValue_ListNext(value, e)) {
                 NCDValRef vval;
-                if (!add_expr_recurser(o, e, mem, &vval)) {
+                if (!add_expr_recurser(context, e, mem, &vval)) {
                     goto fail;
                 }
                 
@@ -177,8 +230,8 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
                 
                 NCDValRef vkey;
                 NCDValRef vval;
-                if (!add_expr_recurser(o, ekey, mem, &vkey) ||
-                    !add_expr_recurser(o, eval, mem, &vval)
+                if (!add_expr_recurser(context, ekey, mem, &vkey) ||
+                    !add_expr_recurser(context, eval, mem, &vval)
                 ) {
                     goto fail;
                 }
@@ -203,6 +256,9 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
                 goto fail_var0;
             }
             
+            // resolve the variable once here instead of at every evaluation
+            var.slot = context->func_resolve_var(context->user, var.varnames, var.num_names);
+            
             size_t index;
             struct NCDEvaluator__Var *varptr = NCDEvaluator__VarVec_Push(&o->vars, &index);
             if (!varptr) {
@@ -256,7 +312,7 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
             call.num_args = 0;
             
             for (NCDValue *e = NCDValue_ListFirst(arg); e; e = NCDValue_ListNext(arg, e)) {
-                if (!expr_init(&call.args[call.num_args], o, e)) {
+                if (!expr_init(&call.args[call.num_args], context, e)) {
                     goto fail_invoc1;
                 }
                 call.num_args++;
@@ -276,6 +332,16 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
             
             *callptr = call;
             
+            // replace the call with its result if it can be computed now
+            if (fold_call(o, index, mem, out)) {
+                NCDEvaluator__CallVec_Pop(&o->calls, NULL);
+                while (call.num_args-- > 0) {
+                    expr_free(&call.args[call.num_args]);
+                }
+                BFree(call.args);
+                break;
+            }
+            
             *out = NCDVal_NewPlaceholder(mem, ((int)index << 1) | 1);
             break;
             
@@ -302,6 +368,59 @@ fail:
     return 0;
 }
 
+static int fold_call (NCDEvaluator *o, size_t index, NCDValMem *mem, NCDValRef *out)
+{
+    ASSERT(index == o->calls.count - 1)
+    
+    if (!o->func_fold_call) {
+        return 0;
+    }
+    
+    struct NCDEvaluator__Call *call = NCDEvaluator__CallVec_Get(&o->calls, index);
+    
+    for (size_t i = 0; i < call->num_args; i++) {
+        if (!expr_is_constant(&call->args[i])) {
+            return 0;
+        }
+    }
+    
+    // the arguments contain no placeholders, so evaluating them never
+    // calls back into fold_eval_funcs
+    struct NCDEvaluator__eval_context context;
+    context.eval = o;
+    context.funcs = &fold_eval_funcs;
+    
+    NCDEvaluatorArgs args;
+    args.context = &context;
+    args.call_index = index;
+    
+    NCDValMem temp_mem;
+    NCDValMem_Init(&temp_mem, o->string_index);
+    
+    int res = 0;
+    
+    NCDValRef temp_ref;
+    if (o->func_fold_call(o->fold_user, call->func_name_id, args, &temp_mem, &temp_ref)) {
+        *out = NCDVal_NewCopy(mem, temp_ref);
+        res = !NCDVal_IsInvalid(*out);
+    }
+    
+    NCDValMem_Free(&temp_mem);
+    return res;
+}
+
+static int fold_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int slot, NCDValMem *mem, NCDValRef *out)
+{
+    ASSERT(0)
+    return 0;
+}
+
+static int fold_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out)
+{
+    ASSERT(0)
+    return 0;
+}
+
 static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, NCDValRef *out)
 {
     struct NCDEvaluator__eval_context const *context = arg;
@@ -319,7 +438,7 @@ static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, N
         case 0: {
             struct NCDEvaluator__Var *var = NCDEvaluator__VarVec_Get(&o->vars, index);
             
-            res = context->funcs->func_eval_var(context->funcs->user, var->varnames, var->num_names, mem, out);
+            res = context->funcs->func_eval_var(context->funcs->user, var->varnames, var->num_names, var->slot, mem, out);
         } break;
         
         case 1: {
@@ -342,9 +461,11 @@ static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, N
     return res;
 }
 
-int NCDEvaluator_Init (NCDEvaluator *o, NCDStringIndex *string_index)
+int NCDEvaluator_Init (NCDEvaluator *o, NCDStringIndex *string_index, NCDEvaluator_func_fold_call func_fold_call, void *fold_user)
 {
     o->string_index = string_index;
+    o->func_fold_call = func_fold_call;
+    o->fold_user = fold_user;
     
     if (!NCDEvaluator__VarVec_Init(&o->vars, NCDEVALUATOR_DEFAULT_VARARRAY_CAPACITY)) {
         BLog(BLOG_ERROR, "NCDEvaluator__VarVec_Init failed");
@@ -382,9 +503,16 @@ void NCDEvaluator_Free (NCDEvaluator *o)
     NCDEvaluator__VarVec_Free(&o->vars);
 }
 
-int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value)
+int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value, NCDEvaluator_func_resolve_var func_resolve_var, void *user)
 {
-    return expr_init(&o->expr, eval, value);
+    ASSERT(func_resolve_var)
+    
+    struct NCDEvaluator__compile_context context;
+    context.eval = eval;
+    context.func_resolve_var = func_resolve_var;
+    context.user = user;
+    
+    return expr_init(&o->expr, &context, value);
 }
 
 void NCDEvaluatorExpr_Free (NCDEvaluatorExpr *o)
@@ -405,6 +533,19 @@ int NCDEvaluatorExpr_Eval (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator
     return expr_eval(&o->expr, &context, out_newmem, out_val);
 }
 
+int NCDEvaluatorExpr_EvalInto (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_EvalFuncs const *funcs, NCDValMem *mem, NCDValRef *out_val)
+{
+    ASSERT(funcs)
+    ASSERT(mem)
+    ASSERT(out_val)
+    
+    struct NCDEvaluator__eval_context context;
+    context.eval = eval;
+    context.funcs = funcs;
+    
+    return expr_eval_into(&o->expr, &context, mem, out_val);
+}
+
 size_t NCDEvaluatorArgs_Count (NCDEvaluatorArgs *o)
 {
     struct NCDEvaluator__Call *call = NCDEvaluator__CallVec_Get(&o->context->eval->calls, o->call_index);
@@ -47,6 +47,7 @@ struct NCDEvaluator__Expr {
 struct NCDEvaluator__Var {
     NCD_string_id_t *varnames;
     size_t num_names;
+    int slot;
 };
 
 #include "NCDEvaluator_var_vec.h"
@@ -63,8 +64,17 @@ struct NCDEvaluator__Call {
 
 struct NCDEvaluator__eval_context;
 
+typedef struct {
+    struct NCDEvaluator__eval_context const *context;
+    int call_index;
+} NCDEvaluatorArgs;
+
+typedef int (*NCDEvaluator_func_fold_call) (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
+
 typedef struct {
     NCDStringIndex *string_index;
+    NCDEvaluator_func_fold_call func_fold_call;
+    void *fold_user;
     NCDEvaluator__VarVec vars;
     NCDEvaluator__CallVec calls;
 } NCDEvaluator;
@@ -73,22 +83,20 @@ typedef struct {
     struct NCDEvaluator__Expr expr;
 } NCDEvaluatorExpr;
 
-typedef struct {
-    struct NCDEvaluator__eval_context const *context;
-    int call_index;
-} NCDEvaluatorArgs;
+typedef int (*NCDEvaluator_func_resolve_var) (void *user, NCD_string_id_t const *varnames, size_t num_names);
 
 typedef struct {
     void *user;
-    int (*func_eval_var) (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out);
+    int (*func_eval_var) (void *user, NCD_string_id_t const *varnames, size_t num_names, int slot, NCDValMem *mem, NCDValRef *out);
     int (*func_eval_call) (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
 } NCDEvaluator_EvalFuncs;
 
-int NCDEvaluator_Init (NCDEvaluator *o, NCDStringIndex *string_index) WARN_UNUSED;
+int NCDEvaluator_Init (NCDEvaluator *o, NCDStringIndex *string_index, NCDEvaluator_func_fold_call func_fold_call, void *fold_user) WARN_UNUSED;
 void NCDEvaluator_Free (NCDEvaluator *o);
-int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value) WARN_UNUSED;
+int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value, NCDEvaluator_func_resolve_var func_resolve_var, void *user) WARN_UNUSED;
 void NCDEvaluatorExpr_Free (NCDEvaluatorExpr *o);
 int NCDEvaluatorExpr_Eval (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_EvalFuncs const *funcs, NCDValMem *out_newmem, NCDValRef *out_val) WARN_UNUSED;
+int NCDEvaluatorExpr_EvalInto (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_EvalFuncs const *funcs, NCDValMem *mem, NCDValRef *out_val) WARN_UNUSED;
 size_t NCDEvaluatorArgs_Count (NCDEvaluatorArgs *o);
 int NCDEvaluatorArgs_EvalArg (NCDEvaluatorArgs *o, size_t index, NCDValMem *mem, NCDValRef *out_ref) WARN_UNUSED;
 int NCDEvaluatorArgs_EvalArgNewMem (NCDEvaluatorArgs *o, size_t index, NCDValMem *out_newmem, NCDValRef *out_ref) WARN_UNUSED;
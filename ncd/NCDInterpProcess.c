@@ -47,6 +47,7 @@ struct NCDInterpProcess__stmt {
     NCD_string_id_t cmdname;
     NCD_string_id_t *objnames;
     size_t num_objnames;
+    int obj_slot;
     union {
         const struct NCDInterpModule *simple_module;
         int method_name_id;
@@ -57,6 +58,43 @@ struct NCDInterpProcess__stmt {
     int hash_next;
 };
 
+static int find_statement (NCDInterpProcess *o, int from_index, NCD_string_id_t name)
+{
+    ASSERT(from_index >= 0)
+    ASSERT(from_index <= o->num_stmts)
+    
+    if (o->num_hash_buckets == 0) {
+        return -1;
+    }
+    
+    size_t bucket_idx = name % o->num_hash_buckets;
+    int stmt_idx = o->hash_buckets[bucket_idx];
+    ASSERT(stmt_idx >= -1)
+    ASSERT(stmt_idx < o->num_stmts)
+    
+    while (stmt_idx >= 0) {
+        if (stmt_idx < from_index && o->stmts[stmt_idx].name == name) {
+            return stmt_idx;
+        }
+        
+        stmt_idx = o->stmts[stmt_idx].hash_next;
+        ASSERT(stmt_idx >= -1)
+        ASSERT(stmt_idx < o->num_stmts)
+    }
+    
+    return -1;
+}
+
+static int resolve_var_func (void *user, NCD_string_id_t const *varnames, size_t num_names)
+{
+    NCDInterpProcess *o = user;
+    ASSERT(num_names > 0)
+    
+    // the statement being compiled is the last one, and the names it can
+    // see are those of the statements before it
+    return find_statement(o, o->num_stmts, varnames[0]);
+}
+
 static int compute_prealloc (NCDInterpProcess *o)
 {
     int size = 0;
@@ -120,6 +158,10 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
     o->prealloc_size = -1;
     o->is_template = NCDProcess_IsTemplate(process);
     o->cache = NULL;
+    o->cache_count = 0;
+    o->cache_max = 0;
+    memset(&o->cache_stats, 0, sizeof(o->cache_stats));
+    o->profile = NULL;
     
     for (NCDStatement *s = NCDBlock_FirstStatement(block); s; s = NCDBlock_NextStatement(block, s)) {
         ASSERT(NCDStatement_Type(s) == NCDSTATEMENT_REG)
@@ -128,6 +170,7 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
         e->name = -1;
         e->objnames = NULL;
         e->num_objnames = 0;
+        e->obj_slot = -1;
         e->alloc_size = 0;
         
         if (NCDStatement_Name(s)) {
@@ -144,7 +187,7 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
             goto loop_fail0;
         }
         
-        if (!NCDEvaluatorExpr_Init(&e->arg_expr, eval, NCDStatement_RegArgs(s))) {
+        if (!NCDEvaluatorExpr_Init(&e->arg_expr, eval, NCDStatement_RegArgs(s), resolve_var_func, o)) {
             BLog(BLOG_ERROR, "NCDEvaluatorExpr_Init failed");
             goto loop_fail0;
         }
@@ -155,6 +198,8 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
                 goto loop_fail1;
             }
             
+            e->obj_slot = find_statement(o, o->num_stmts, e->objnames[0]);
+            
             e->binding.method_name_id = NCDModuleIndex_GetMethodNameId(module_index, NCDStatement_RegCmdName(s));
             if (e->binding.method_name_id == -1) {
                 BLog(BLOG_ERROR, "NCDModuleIndex_GetMethodNameId failed");
@@ -211,6 +256,10 @@ void NCDInterpProcess_Free (NCDInterpProcess *o)
         NCDEvaluatorExpr_Free(&e->arg_expr);
     }
     
+    ASSERT(o->cache_count == 0)
+    
+    BFree(o->cache);
+    BFree(o->profile);
     free(o->name);
     BFree(o->hash_buckets);
     BFree(o->stmts);
@@ -222,22 +271,7 @@ int NCDInterpProcess_FindStatement (NCDInterpProcess *o, int from_index, NCD_str
     ASSERT(from_index >= 0)
     ASSERT(from_index <= o->num_stmts)
     
-    size_t bucket_idx = name % o->num_hash_buckets;
-    int stmt_idx = o->hash_buckets[bucket_idx];
-    ASSERT(stmt_idx >= -1)
-    ASSERT(stmt_idx < o->num_stmts)
-    
-    while (stmt_idx >= 0) {
-        if (stmt_idx < from_index && o->stmts[stmt_idx].name == name) {
-            return stmt_idx;
-        }
-        
-        stmt_idx = o->stmts[stmt_idx].hash_next;
-        ASSERT(stmt_idx >= -1)
-        ASSERT(stmt_idx < o->num_stmts)
-    }
-    
-    return -1;
+    return find_statement(o, from_index, name);
 }
 
 const char * NCDInterpProcess_StatementCmdName (NCDInterpProcess *o, int i, NCDStringIndex *string_index)
@@ -250,6 +284,20 @@ const char * NCDInterpProcess_StatementCmdName (NCDInterpProcess *o, int i, NCDS
     return NCDStringIndex_Value(string_index, o->stmts[i].cmdname).ptr;
 }
 
+const char * NCDInterpProcess_StatementName (NCDInterpProcess *o, int i, NCDStringIndex *string_index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    ASSERT(string_index)
+    
+    if (o->stmts[i].name < 0) {
+        return NULL;
+    }
+    
+    return NCDStringIndex_Value(string_index, o->stmts[i].name).ptr;
+}
+
 void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_string_id_t **out_objnames, size_t *out_num_objnames)
 {
     DebugObject_Access(&o->d_obj);
@@ -262,6 +310,16 @@ void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_s
     *out_num_objnames = o->stmts[i].num_objnames;
 }
 
+int NCDInterpProcess_StatementObjSlot (NCDInterpProcess *o, int i)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    ASSERT(o->stmts[i].objnames)
+    
+    return o->stmts[i].obj_slot;
+}
+
 const struct NCDInterpModule * NCDInterpProcess_StatementGetSimpleModule (NCDInterpProcess *o, int i, NCDStringIndex *string_index, NCDModuleIndex *module_index)
 {
     DebugObject_Access(&o->d_obj);
@@ -312,6 +370,7 @@ void NCDInterpProcess_StatementBumpAllocSize (NCDInterpProcess *o, int i, int al
     if (alloc_size > o->stmts[i].alloc_size) {
         o->stmts[i].alloc_size = alloc_size;
         o->prealloc_size = -1;
+        o->cache_stats.num_prealloc_bumps++;
     }
 }
 
@@ -368,16 +427,52 @@ int NCDInterpProcess_NumStatements (NCDInterpProcess *o)
     return o->num_stmts;
 }
 
+int NCDInterpProcess_SetCacheMax (NCDInterpProcess *o, int cache_max)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(cache_max >= 0)
+    ASSERT(o->cache_count == 0)
+    
+    void **cache = NULL;
+    if (cache_max > 0 && !(cache = BAllocArray(cache_max, sizeof(cache[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
+    
+    BFree(o->cache);
+    o->cache = cache;
+    o->cache_max = cache_max;
+    
+    return 1;
+}
+
+int NCDInterpProcess_CacheMax (NCDInterpProcess *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->cache_max;
+}
+
+int NCDInterpProcess_CacheCount (NCDInterpProcess *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->cache_count;
+}
+
 int NCDInterpProcess_CachePush (NCDInterpProcess *o, void *elem)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(elem)
+    ASSERT(o->cache_count >= 0)
+    ASSERT(o->cache_count <= o->cache_max)
     
-    if (o->cache) {
+    if (o->cache_count == o->cache_max) {
+        o->cache_stats.num_drops++;
         return 0;
     }
     
-    o->cache = elem;
+    o->cache[o->cache_count++] = elem;
     
     return 1;
 }
@@ -385,9 +480,51 @@ int NCDInterpProcess_CachePush (NCDInterpProcess *o, void *elem)
 void * NCDInterpProcess_CachePull (NCDInterpProcess *o)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->cache_count >= 0)
+    ASSERT(o->cache_count <= o->cache_max)
     
-    void *elem = o->cache;
-    o->cache = NULL;
+    o->cache_stats.num_pulls++;
+    
+    if (o->cache_count == 0) {
+        return NULL;
+    }
+    
+    o->cache_stats.num_hits++;
+    
+    return o->cache[--o->cache_count];
+}
+
+const struct NCDInterpProcess_cache_stats * NCDInterpProcess_CacheStats (NCDInterpProcess *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->cache_stats;
+}
+
+int NCDInterpProcess_EnableProfile (NCDInterpProcess *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->profile)
+    
+    if (!(o->profile = BAllocArray(o->num_stmts, sizeof(o->profile[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
+    
+    memset(o->profile, 0, o->num_stmts * sizeof(o->profile[0]));
+    
+    return 1;
+}
+
+struct NCDInterpProcess_profile * NCDInterpProcess_StatementProfile (NCDInterpProcess *o, int i)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    
+    if (!o->profile) {
+        return NULL;
+    }
     
-    return elem;
+    return &o->profile[i];
 }
@@ -31,6 +31,7 @@
 #define BADVPN_NCDINTERPPROCESS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -43,6 +44,31 @@
 
 struct NCDInterpProcess__stmt;
 
+/**
+ * Profiling counters of a statement, accumulated over all processes
+ * created from the same process or template.
+ */
+struct NCDInterpProcess_profile {
+    uint64_t num_inits;
+    uint64_t num_downs;
+    uint64_t num_dies;
+    uint64_t num_errors;
+    uint64_t init_ns;
+    uint64_t die_ns;
+    uint64_t up_wait_ns;
+};
+
+/**
+ * Counters of the cache of freed process structures of a process or
+ * template, and of the growth of its preallocated statement memory.
+ */
+struct NCDInterpProcess_cache_stats {
+    uint64_t num_pulls;
+    uint64_t num_hits;
+    uint64_t num_drops;
+    uint64_t num_prealloc_bumps;
+};
+
 /**
  * A data structure which contains information about a process or
  * template, suitable for efficient interpretation. These structures
@@ -60,7 +86,11 @@ typedef struct {
     int is_template;
     int *hash_buckets;
     size_t num_hash_buckets;
-    void *cache;
+    void **cache;
+    int cache_count;
+    int cache_max;
+    struct NCDInterpProcess_cache_stats cache_stats;
+    struct NCDInterpProcess_profile *profile;
     DebugObject d_obj;
 } NCDInterpProcess;
 
@@ -68,7 +98,9 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
 void NCDInterpProcess_Free (NCDInterpProcess *o);
 int NCDInterpProcess_FindStatement (NCDInterpProcess *o, int from_index, NCD_string_id_t name);
 const char * NCDInterpProcess_StatementCmdName (NCDInterpProcess *o, int i, NCDStringIndex *string_index);
+const char * NCDInterpProcess_StatementName (NCDInterpProcess *o, int i, NCDStringIndex *string_index);
 void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_string_id_t **out_objnames, size_t *out_num_objnames);
+int NCDInterpProcess_StatementObjSlot (NCDInterpProcess *o, int i);
 const struct NCDInterpModule * NCDInterpProcess_StatementGetSimpleModule (NCDInterpProcess *o, int i, NCDStringIndex *string_index, NCDModuleIndex *module_index);
 const struct NCDInterpModule * NCDInterpProcess_StatementGetMethodModule (NCDInterpProcess *o, int i, NCD_string_id_t obj_type, NCDModuleIndex *module_index);
 NCDEvaluatorExpr * NCDInterpProcess_GetStatementArgsExpr (NCDInterpProcess *o, int i);
@@ -79,7 +111,13 @@ int NCDInterpProcess_StatementPreallocOffset (NCDInterpProcess *o, int i);
 const char * NCDInterpProcess_Name (NCDInterpProcess *o);
 int NCDInterpProcess_IsTemplate (NCDInterpProcess *o);
 int NCDInterpProcess_NumStatements (NCDInterpProcess *o);
+int NCDInterpProcess_SetCacheMax (NCDInterpProcess *o, int cache_max) WARN_UNUSED;
+int NCDInterpProcess_CacheMax (NCDInterpProcess *o);
+int NCDInterpProcess_CacheCount (NCDInterpProcess *o);
 int NCDInterpProcess_CachePush (NCDInterpProcess *o, void *elem) WARN_UNUSED;
 void * NCDInterpProcess_CachePull (NCDInterpProcess *o);
+const struct NCDInterpProcess_cache_stats * NCDInterpProcess_CacheStats (NCDInterpProcess *o);
+int NCDInterpProcess_EnableProfile (NCDInterpProcess *o) WARN_UNUSED;
+struct NCDInterpProcess_profile * NCDInterpProcess_StatementProfile (NCDInterpProcess *o, int i);
 
 #endif
@@ -138,3 +138,19 @@ NCDInterpProcess * NCDInterpProg_FindProcess (NCDInterpProg *o, NCD_string_id_t
     
     return &ref.ptr->iprocess;
 }
+
+int NCDInterpProg_NumProcesses (NCDInterpProg *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_procs;
+}
+
+NCDInterpProcess * NCDInterpProg_GetProcess (NCDInterpProg *o, int i)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_procs)
+    
+    return &o->procs[i].iprocess;
+}
@@ -59,5 +59,7 @@ typedef struct {
 int NCDInterpProg_Init (NCDInterpProg *o, NCDProgram *prog, NCDStringIndex *string_index, NCDEvaluator *eval, NCDModuleIndex *module_index) WARN_UNUSED;
 void NCDInterpProg_Free (NCDInterpProg *o);
 NCDInterpProcess * NCDInterpProg_FindProcess (NCDInterpProg *o, NCD_string_id_t name);
+int NCDInterpProg_NumProcesses (NCDInterpProg *o);
+NCDInterpProcess * NCDInterpProg_GetProcess (NCDInterpProg *o, int i);
 
 #endif
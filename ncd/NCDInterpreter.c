@@ -28,14 +28,21 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
 
 #include <misc/offset.h>
 #include <misc/balloc.h>
 #include <misc/expstring.h>
+#include <misc/hashfun.h>
+#include <misc/write_file.h>
+#include <misc/concat_strings.h>
+#include <misc/version.h>
 #include <base/BLog.h>
 #include <ncd/NCDSugar.h>
 #include <ncd/modules/modules.h>
@@ -57,6 +64,7 @@
 struct statement {
     NCDModuleInst inst;
     NCDValMem args_mem;
+    uint64_t prof_wait_start;
     int mem_size;
     int i;
 };
@@ -80,15 +88,26 @@ struct process {
     struct statement statements[];
 };
 
+struct profile_entry {
+    NCDInterpProcess *iprocess;
+    int i;
+    uint64_t total_ns;
+};
+
 struct func_call_context {
     struct statement *ps;
     NCDEvaluatorArgs *args;
 };
 
 static void start_terminate (NCDInterpreter *interp, int exit_code);
-static char * implode_id_strings (NCDInterpreter *interp, const NCD_string_id_t *names, size_t num_names, char del);
+static int implode_id_strings (NCDInterpreter *interp, const NCD_string_id_t *names, size_t num_names, char del, ExpString *str);
+static int setup_process_caches (NCDInterpreter *interp);
 static void clear_process_cache (NCDInterpreter *interp);
+static int write_cache_stats (NCDInterpreter *interp, const char *file);
+static uint64_t profile_now (void);
+static int compare_profile_entries (const void *v1, const void *v2);
 static struct process * process_allocate (NCDInterpreter *interp, NCDInterpProcess *iprocess);
+static struct process * process_allocate_new (NCDInterpreter *interp, NCDInterpProcess *iprocess);
 static void process_release (struct process *p, int no_push);
 static void process_assert_statements_cleared (struct process *p);
 static int process_new (NCDInterpreter *interp, NCDInterpProcess *iprocess, NCDModuleProcess *module_process);
@@ -103,19 +122,23 @@ static void process_work_job_handler_working (struct process *p);
 static void process_work_job_handler_up (struct process *p);
 static void process_work_job_handler_waiting (struct process *p);
 static void process_work_job_handler_terminating (struct process *p);
-static int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out);
+static int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int slot, NCDValMem *mem, NCDValRef *out);
 static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
+static int eval_func_fold_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
 static void process_advance (struct process *p);
 static void process_wait_timer_handler (BSmallTimer *timer);
+static int process_get_object (struct process *p, int slot, NCD_string_id_t name, NCDObject *out_object);
 static int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object);
-static int process_resolve_object_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object);
-static int process_resolve_variable_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value);
+static int process_resolve_object_expr (struct process *p, int pos, int slot, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object);
+static int process_resolve_variable_expr (struct process *p, int pos, int slot, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value);
 static void statement_logfunc (struct statement *ps);
 static void statement_log (struct statement *ps, int level, const char *fmt, ...);
 static struct process * statement_process (struct statement *ps);
 static int statement_mem_is_allocated (struct statement *ps);
 static int statement_mem_size (struct statement *ps);
 static int statement_allocate_memory (struct statement *ps, int alloc_size);
+static struct NCDInterpProcess_profile * statement_profile (struct statement *ps);
+static void statement_die (struct statement *ps);
 static void statement_instance_func_event (NCDModuleInst *inst, int event);
 static int statement_instance_func_getobj (NCDModuleInst *inst, NCD_string_id_t objname, NCDObject *out_object);
 static int statement_instance_func_initprocess (void *vinterp, NCDModuleProcess *mp, NCD_string_id_t template_name);
@@ -128,6 +151,8 @@ static void process_moduleprocess_func_event (struct process *p, int event);
 static int process_moduleprocess_func_getobj (struct process *p, NCD_string_id_t name, NCDObject *out_object);
 static void function_logfunc (void *user);
 static int function_eval_arg (void *user, size_t index, NCDValMem *mem, NCDValRef *out);
+static void fold_function_logfunc (void *user);
+static int fold_function_eval_arg (void *user, size_t index, NCDValMem *mem, NCDValRef *out);
 
 #define STATEMENT_LOG(ps, channel, ...) if (BLog_WouldLog(BLOG_CURRENT_CHANNEL, channel)) statement_log(ps, channel, __VA_ARGS__)
 
@@ -137,6 +162,8 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
     ASSERT(!NCDProgram_ContainsElemType(&program, NCDPROGRAMELEM_INCLUDE_GUARD));
     ASSERT(params.handler_finished);
     ASSERT(params.num_extra_args >= 0);
+    ASSERT(params.process_cache_size >= 0);
+    ASSERT(params.num_cache_confs >= 0);
     ASSERT(params.reactor);
 #ifndef BADVPN_NO_PROCESS
     ASSERT(params.manager);
@@ -184,10 +211,11 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
 #endif
     o->module_iparams.string_index = &o->string_index;
     
-    // add module groups to index and allocate string id's for base_type's
+    // register module groups with the index; each is added, with its global
+    // init and string id's, when the program first refers to it
     for (const struct NCDModuleGroup **g = ncd_modules; *g; g++) {
-        if (!NCDModuleIndex_AddGroup(&o->mindex, *g, &o->module_iparams, &o->string_index)) {
-            BLog(BLOG_ERROR, "NCDModuleIndex_AddGroup failed");
+        if (!NCDModuleIndex_AddLazyGroup(&o->mindex, *g, &o->module_iparams)) {
+            BLog(BLOG_ERROR, "NCDModuleIndex_AddLazyGroup failed");
             goto fail3;
         }
     }
@@ -198,8 +226,14 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
         goto fail3;
     }
     
+    // init parameters for evaluating calls to pure functions with
+    // constant arguments when the program is compiled
+    o->fold_call_shared.logfunc = fold_function_logfunc;
+    o->fold_call_shared.func_eval_arg = fold_function_eval_arg;
+    o->fold_call_shared.iparams = &o->module_iparams;
+    
     // init expression evaluator
-    if (!NCDEvaluator_Init(&o->evaluator, &o->string_index)) {
+    if (!NCDEvaluator_Init(&o->evaluator, &o->string_index, eval_func_fold_call, o)) {
         BLog(BLOG_ERROR, "NCDEvaluator_Init failed");
         goto fail3;
     }
@@ -225,9 +259,25 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
     o->module_call_shared.func_eval_arg = function_eval_arg;
     o->module_call_shared.iparams = &o->module_iparams;
     
+    // enable profiling
+    if (o->params.profile) {
+        for (int i = 0; i < NCDInterpProg_NumProcesses(&o->iprogram); i++) {
+            if (!NCDInterpProcess_EnableProfile(NCDInterpProg_GetProcess(&o->iprogram, i))) {
+                BLog(BLOG_ERROR, "NCDInterpProcess_EnableProfile failed");
+                goto fail6;
+            }
+        }
+    }
+    
     // init processes list
     LinkedList1_Init(&o->processes);
     
+    // size process caches and allocate into them
+    if (!setup_process_caches(o)) {
+        clear_process_cache(o);
+        goto fail6;
+    }
+    
     // init processes
     for (NCDProgramElem *elem = NCDProgram_FirstElem(&o->program); elem; elem = NCDProgram_NextElem(&o->program, elem)) {
         ASSERT(NCDProgramElem_Type(elem) == NCDPROGRAMELEM_PROCESS)
@@ -266,6 +316,7 @@ fail7:;
     }
     // clear process cache (process_free() above may push to cache)
     clear_process_cache(o);
+fail6:
     // free interp program
     NCDInterpProg_Free(&o->iprogram);
 fail5:
@@ -324,6 +375,220 @@ void NCDInterpreter_RequestShutdown (NCDInterpreter *o, int exit_code)
     start_terminate(o, exit_code);
 }
 
+uint64_t NCDInterpreter_ModuleAbiId (void)
+{
+    uint64_t id = badvpn_hash_str(GLOBAL_VERSION, 0);
+    
+    for (const struct NCDModuleGroup **g = ncd_modules; *g; g++) {
+        if ((*g)->modules) {
+            for (const struct NCDModule *m = (*g)->modules; m->type; m++) {
+                id = badvpn_hash_str(m->type, id);
+            }
+        }
+        if ((*g)->functions) {
+            for (const struct NCDModuleFunction *f = (*g)->functions; f->func_name; f++) {
+                id = badvpn_hash_str(f->func_name, id);
+            }
+        }
+    }
+    
+    return id;
+}
+
+int NCDInterpreter_WriteProfile (NCDInterpreter *o, const char *file)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->params.profile)
+    ASSERT(file)
+    
+    int res = 0;
+    
+    // count statements
+    size_t num_entries = 0;
+    for (int j = 0; j < NCDInterpProg_NumProcesses(&o->iprogram); j++) {
+        num_entries += NCDInterpProcess_NumStatements(NCDInterpProg_GetProcess(&o->iprogram, j));
+    }
+    
+    // collect statements
+    struct profile_entry *entries = BAllocArray(num_entries, sizeof(entries[0]));
+    if (!entries) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    size_t k = 0;
+    for (int j = 0; j < NCDInterpProg_NumProcesses(&o->iprogram); j++) {
+        NCDInterpProcess *iprocess = NCDInterpProg_GetProcess(&o->iprogram, j);
+        for (int i = 0; i < NCDInterpProcess_NumStatements(iprocess); i++) {
+            struct NCDInterpProcess_profile *prof = NCDInterpProcess_StatementProfile(iprocess, i);
+            entries[k].iprocess = iprocess;
+            entries[k].i = i;
+            entries[k].total_ns = prof->init_ns + prof->die_ns;
+            k++;
+        }
+    }
+    ASSERT(k == num_entries)
+    
+    qsort(entries, num_entries, sizeof(entries[0]), compare_profile_entries);
+    
+    ExpString report;
+    if (!ExpString_Init(&report)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail1;
+    }
+    
+    ExpString folded;
+    if (!ExpString_Init(&folded)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail2;
+    }
+    
+    if (!ExpString_Append(&report, "# time_ms up_wait_ms inits dies downs errors statement\n")) {
+        BLog(BLOG_ERROR, "ExpString_Append failed");
+        goto fail3;
+    }
+    
+    for (k = 0; k < num_entries; k++) {
+        struct profile_entry *e = &entries[k];
+        struct NCDInterpProcess_profile *prof = NCDInterpProcess_StatementProfile(e->iprocess, e->i);
+        
+        if (prof->num_inits == 0) {
+            continue;
+        }
+        
+        const char *proc_name = NCDInterpProcess_Name(e->iprocess);
+        const char *cmd_name = NCDInterpProcess_StatementCmdName(e->iprocess, e->i, &o->string_index);
+        const char *name = NCDInterpProcess_StatementName(e->iprocess, e->i, &o->string_index);
+        
+        char buf[512];
+        snprintf(buf, sizeof(buf), "%"PRIu64".%03"PRIu64" %"PRIu64".%03"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %s:%d:%s%s%s\n",
+                 e->total_ns / 1000000, e->total_ns / 1000 % 1000, prof->up_wait_ns / 1000000, prof->up_wait_ns / 1000 % 1000,
+                 prof->num_inits, prof->num_dies, prof->num_downs, prof->num_errors,
+                 proc_name, e->i, cmd_name, (name ? " " : ""), (name ? name : ""));
+        if (!ExpString_Append(&report, buf)) {
+            BLog(BLOG_ERROR, "ExpString_Append failed");
+            goto fail3;
+        }
+        
+        uint64_t us[2] = {prof->init_ns / 1000, prof->die_ns / 1000};
+        const char *phase[2] = {"init", "die"};
+        for (int m = 0; m < 2; m++) {
+            if (us[m] == 0) {
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "%s;%d:%s%s%s;%s %"PRIu64"\n",
+                     proc_name, e->i, cmd_name, (name ? " " : ""), (name ? name : ""), phase[m], us[m]);
+            if (!ExpString_Append(&folded, buf)) {
+                BLog(BLOG_ERROR, "ExpString_Append failed");
+                goto fail3;
+            }
+        }
+    }
+    
+    if (!write_file(file, ExpString_GetMr(&report))) {
+        BLog(BLOG_ERROR, "failed to write profile to '%s'", file);
+        goto fail3;
+    }
+    
+    char *folded_file = concat_strings(2, file, ".folded");
+    if (!folded_file) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto fail3;
+    }
+    
+    if (!write_file(folded_file, ExpString_GetMr(&folded))) {
+        BLog(BLOG_ERROR, "failed to write profile to '%s'", folded_file);
+        goto fail4;
+    }
+    
+    char *cache_file = concat_strings(2, file, ".cache");
+    if (!cache_file) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto fail4;
+    }
+    
+    if (!write_cache_stats(o, cache_file)) {
+        BLog(BLOG_ERROR, "failed to write profile to '%s'", cache_file);
+        goto fail5;
+    }
+    
+    res = 1;
+    
+fail5:
+    free(cache_file);
+fail4:
+    free(folded_file);
+fail3:
+    ExpString_Free(&folded);
+fail2:
+    ExpString_Free(&report);
+fail1:
+    BFree(entries);
+fail0:
+    return res;
+}
+
+int write_cache_stats (NCDInterpreter *interp, const char *file)
+{
+    int res = 0;
+    
+    ExpString str;
+    if (!ExpString_Init(&str)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    
+    if (!ExpString_Append(&str, "# hits misses drops cached cache_max prealloc_bytes prealloc_bumps process\n")) {
+        BLog(BLOG_ERROR, "ExpString_Append failed");
+        goto fail1;
+    }
+    
+    for (int j = 0; j < NCDInterpProg_NumProcesses(&interp->iprogram); j++) {
+        NCDInterpProcess *iprocess = NCDInterpProg_GetProcess(&interp->iprogram, j);
+        const struct NCDInterpProcess_cache_stats *stats = NCDInterpProcess_CacheStats(iprocess);
+        
+        if (stats->num_pulls == 0) {
+            continue;
+        }
+        
+        char buf[512];
+        snprintf(buf, sizeof(buf), "%"PRIu64" %"PRIu64" %"PRIu64" %d %d %d %"PRIu64" %s\n",
+                 stats->num_hits, stats->num_pulls - stats->num_hits, stats->num_drops,
+                 NCDInterpProcess_CacheCount(iprocess), NCDInterpProcess_CacheMax(iprocess),
+                 NCDInterpProcess_PreallocSize(iprocess), stats->num_prealloc_bumps, NCDInterpProcess_Name(iprocess));
+        if (!ExpString_Append(&str, buf)) {
+            BLog(BLOG_ERROR, "ExpString_Append failed");
+            goto fail1;
+        }
+    }
+    
+    if (!write_file(file, ExpString_GetMr(&str))) {
+        goto fail1;
+    }
+    
+    res = 1;
+    
+fail1:
+    ExpString_Free(&str);
+fail0:
+    return res;
+}
+
+uint64_t profile_now (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int compare_profile_entries (const void *v1, const void *v2)
+{
+    const struct profile_entry *e1 = v1;
+    const struct profile_entry *e2 = v2;
+    
+    return (e1->total_ns < e2->total_ns) - (e1->total_ns > e2->total_ns);
+}
+
 void start_terminate (NCDInterpreter *interp, int exit_code)
 {
     // remember exit code
@@ -353,34 +618,94 @@ void start_terminate (NCDInterpreter *interp, int exit_code)
     }
 }
 
-char * implode_id_strings (NCDInterpreter *interp, const NCD_string_id_t *names, size_t num_names, char del)
+int implode_id_strings (NCDInterpreter *interp, const NCD_string_id_t *names, size_t num_names, char del, ExpString *str)
 {
-    ExpString str;
-    if (!ExpString_Init(&str)) {
-        goto fail0;
-    }
-    
     int is_first = 1;
     
     while (num_names > 0) {
-        if (!is_first && !ExpString_AppendChar(&str, del)) {
-            goto fail1;
+        if (!is_first && !ExpString_AppendChar(str, del)) {
+            return 0;
         }
         const char *name_str = NCDStringIndex_Value(&interp->string_index, *names).ptr;
-        if (!ExpString_Append(&str, name_str)) {
-            goto fail1;
+        if (!ExpString_Append(str, name_str)) {
+            return 0;
         }
         names++;
         num_names--;
         is_first = 0;
     }
     
-    return ExpString_Get(&str);
+    return 1;
+}
+
+int setup_process_caches (NCDInterpreter *interp)
+{
+    // apply the default size
+    for (int i = 0; i < NCDInterpProg_NumProcesses(&interp->iprogram); i++) {
+        if (!NCDInterpProcess_SetCacheMax(NCDInterpProg_GetProcess(&interp->iprogram, i), interp->params.process_cache_size)) {
+            BLog(BLOG_ERROR, "NCDInterpProcess_SetCacheMax failed");
+            return 0;
+        }
+    }
     
-fail1:
-    ExpString_Free(&str);
-fail0:
-    return NULL;
+    // apply overrides
+    for (int j = 0; j < interp->params.num_cache_confs; j++) {
+        const struct NCDInterpreter_cache_conf *conf = &interp->params.cache_confs[j];
+        ASSERT(conf->cache_max >= 0)
+        ASSERT(conf->cache_warm >= 0)
+        ASSERT(conf->cache_warm <= conf->cache_max)
+        
+        NCD_string_id_t name_id = NCDStringIndex_Lookup(&interp->string_index, conf->name);
+        NCDInterpProcess *iprocess = (name_id >= 0 ? NCDInterpProg_FindProcess(&interp->iprogram, name_id) : NULL);
+        if (!iprocess) {
+            BLog(BLOG_ERROR, "process cache: no process or template named %s", conf->name);
+            return 0;
+        }
+        
+        // drop structures allocated for an earlier setting of the same name
+        struct process *p;
+        while (NCDInterpProcess_CacheCount(iprocess) > 0) {
+            p = NCDInterpProcess_CachePull(iprocess);
+            process_release(p, 1);
+        }
+        
+        if (!NCDInterpProcess_SetCacheMax(iprocess, conf->cache_max)) {
+            BLog(BLOG_ERROR, "NCDInterpProcess_SetCacheMax failed");
+            return 0;
+        }
+        
+        // Size statement memory for the modules known in advance. Structures
+        // with too little of it would allocate for their statements and then
+        // be freed instead of returning to the cache.
+        if (conf->cache_warm > 0) {
+            for (int i = 0; i < NCDInterpProcess_NumStatements(iprocess); i++) {
+                const NCD_string_id_t *objnames;
+                size_t num_objnames;
+                NCDInterpProcess_StatementObjNames(iprocess, i, &objnames, &num_objnames);
+                if (num_objnames > 0) {
+                    continue;
+                }
+                const struct NCDInterpModule *module = NCDInterpProcess_StatementGetSimpleModule(iprocess, i, &interp->string_index, &interp->mindex);
+                if (module) {
+                    NCDInterpProcess_StatementBumpAllocSize(iprocess, i, module->module.alloc_size);
+                }
+            }
+        }
+        
+        // allocate structures into the cache, so that the first processes
+        // created from the template do not allocate
+        while (NCDInterpProcess_CacheCount(iprocess) < conf->cache_warm) {
+            if (!(p = process_allocate_new(interp, iprocess))) {
+                return 0;
+            }
+            if (!NCDInterpProcess_CachePush(iprocess, p)) {
+                process_release(p, 1);
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
 }
 
 void clear_process_cache (NCDInterpreter *interp)
@@ -403,12 +728,28 @@ struct process * process_allocate (NCDInterpreter *interp, NCDInterpProcess *ipr
 {
     ASSERT(iprocess)
     
-    // try to pull from cache
+    // try to pull from cache, else allocate
     struct process *p = NCDInterpProcess_CachePull(iprocess);
-    if (p) {
-        goto allocated;
+    if (!p && !(p = process_allocate_new(interp, iprocess))) {
+        return NULL;
     }
     
+    ASSERT(p->interp == interp)
+    ASSERT(p->reactor == interp->params.reactor)
+    ASSERT(p->iprocess == iprocess)
+    ASSERT(p->ap == 0)
+    ASSERT(p->fp == 0)
+    ASSERT(p->num_statements == NCDInterpProcess_NumStatements(iprocess))
+    ASSERT(p->error == 0)
+    process_assert_statements_cleared(p);
+    ASSERT(!BSmallPending_IsSet(&p->work_job))
+    ASSERT(!BSmallTimer_IsRunning(&p->wait_timer))
+    
+    return p;
+}
+
+struct process * process_allocate_new (NCDInterpreter *interp, NCDInterpProcess *iprocess)
+{
     // get number of statements
     int num_statements = NCDInterpProcess_NumStatements(iprocess);
     
@@ -418,6 +759,8 @@ struct process * process_allocate (NCDInterpreter *interp, NCDInterpProcess *ipr
         goto fail0;
     }
     
+    struct process *p;
+    
     // start with size of process structure
     size_t alloc_size = sizeof(struct process);
     
@@ -464,6 +807,7 @@ struct process * process_allocate (NCDInterpreter *interp, NCDInterpProcess *ipr
         ps->inst.istate = SSTATE_FORGOTTEN;
         ps->mem_size = NCDInterpProcess_StatementPreallocSize(iprocess, i);
         ps->inst.mem = mem + NCDInterpProcess_StatementPreallocOffset(iprocess, i);
+        NCDValMem_Init(&ps->args_mem, &interp->string_index);
     }
     
     // init timer
@@ -472,18 +816,6 @@ struct process * process_allocate (NCDInterpreter *interp, NCDInterpProcess *ipr
     // init work job
     BSmallPending_Init(&p->work_job, BReactor_PendingGroup(p->reactor), NULL, NULL);
     
-allocated:
-    ASSERT(p->interp == interp)
-    ASSERT(p->reactor == interp->params.reactor)
-    ASSERT(p->iprocess == iprocess)
-    ASSERT(p->ap == 0)
-    ASSERT(p->fp == 0)
-    ASSERT(p->num_statements == NCDInterpProcess_NumStatements(iprocess))
-    ASSERT(p->error == 0)
-    process_assert_statements_cleared(p);
-    ASSERT(!BSmallPending_IsSet(&p->work_job))
-    ASSERT(!BSmallTimer_IsRunning(&p->wait_timer))
-    
     return p;
     
 fail0:
@@ -510,6 +842,11 @@ void process_release (struct process *p, int no_push)
     // free work job
     BSmallPending_Free(&p->work_job, BReactor_PendingGroup(p->reactor));
     
+    // free arguments memory, kept across statement re-initializations
+    for (int i = 0; i < p->num_statements; i++) {
+        NCDValMem_Free(&p->statements[i].args_mem);
+    }
+    
     // free statement memory
     if (p->have_alloc) {
         for (int i = 0; i < p->num_statements; i++) {
@@ -668,7 +1005,7 @@ void process_work_job_handler_working (struct process *p)
         ps->inst.istate = SSTATE_DYING;
         
         // order it to die
-        NCDModuleInst_Die(&ps->inst);
+        statement_die(ps);
         return;
     }
     
@@ -798,11 +1135,18 @@ again:
     }
     
     // optimize for statements which can be destroyed immediately
+    struct NCDInterpProcess_profile *prof = statement_profile(ps);
+    uint64_t prof_start = (prof ? profile_now() : 0);
     if (NCDModuleInst_TryFree(&ps->inst)) {
         STATEMENT_LOG(ps, BLOG_INFO, "died");
         
-        // free arguments memory
-        NCDValMem_Free(&ps->args_mem);
+        if (prof) {
+            prof->die_ns += profile_now() - prof_start;
+            prof->num_dies++;
+        }
+        
+        // clear arguments memory
+        NCDValMem_Clear(&ps->args_mem);
         
         // set statement state FORGOTTEN
         ps->inst.istate = SSTATE_FORGOTTEN;
@@ -819,11 +1163,11 @@ again:
     ps->inst.istate = SSTATE_DYING;
     
     // order it to die
-    NCDModuleInst_Die(&ps->inst);
+    statement_die(ps);
     return;
 }
 
-int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out)
+int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int slot, NCDValMem *mem, NCDValRef *out)
 {
     struct process *p = user;
     ASSERT(varnames)
@@ -831,7 +1175,9 @@ int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_
     ASSERT(mem)
     ASSERT(out)
     
-    return process_resolve_variable_expr(p, p->ap, varnames, num_names, mem, out);
+    // slot was resolved by NCDInterpProcess from the position of the statement
+    // the expression belongs to, which is where we're evaluating it
+    return process_resolve_variable_expr(p, p->ap, slot, varnames, num_names, mem, out);
 }
 
 static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out)
@@ -852,6 +1198,20 @@ static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEva
     return NCDCall_DoIt(&p->interp->module_call_shared, &context, ifunc, NCDEvaluatorArgs_Count(&args), mem, out);
 }
 
+int eval_func_fold_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out)
+{
+    NCDInterpreter *interp = user;
+    
+    // functions from groups loaded later are not known yet, and
+    // are simply called at runtime
+    struct NCDInterpFunction const *ifunc = NCDModuleIndex_FindFunction(&interp->mindex, func_name_id);
+    if (!ifunc || !(ifunc->function.flags & NCDMODULEFUNCTION_FLAG_PURE)) {
+        return 0;
+    }
+    
+    return NCDCall_DoIt(&interp->fold_call_shared, &args, ifunc, NCDEvaluatorArgs_Count(&args), mem, out);
+}
+
 void process_advance (struct process *p)
 {
     process_assert_pointers(p);
@@ -889,7 +1249,8 @@ void process_advance (struct process *p)
     } else {
         // get object
         NCDObject object;
-        if (!process_resolve_object_expr(p, p->ap, objnames, num_objnames, &object)) {
+        int obj_slot = NCDInterpProcess_StatementObjSlot(p->iprocess, p->ap);
+        if (!process_resolve_object_expr(p, p->ap, obj_slot, objnames, num_objnames, &object)) {
             goto fail0;
         }
         
@@ -920,7 +1281,7 @@ void process_advance (struct process *p)
     // evaluate arguments
     NCDValRef args;
     NCDEvaluator_EvalFuncs funcs = {p, eval_func_eval_var, eval_func_eval_call};
-    if (!NCDEvaluatorExpr_Eval(expr, &p->interp->evaluator, &funcs, &ps->args_mem, &args)) {
+    if (!NCDEvaluatorExpr_EvalInto(expr, &p->interp->evaluator, &funcs, &ps->args_mem, &args)) {
         STATEMENT_LOG(ps, BLOG_ERROR, "failed to evaluate arguments");
         goto fail0;
     }
@@ -943,11 +1304,22 @@ void process_advance (struct process *p)
     process_assert_pointers(p);
     
     // initialize module instance
-    NCDModuleInst_Init(&ps->inst, module, method_context, args, &p->interp->module_params);
+    struct NCDInterpProcess_profile *prof = statement_profile(ps);
+    if (prof) {
+        // the module may go up from within NCDModuleInst_Init(), so the
+        // up wait starts before it
+        uint64_t prof_start = profile_now();
+        ps->prof_wait_start = prof_start;
+        NCDModuleInst_Init(&ps->inst, module, method_context, args, &p->interp->module_params);
+        prof->init_ns += profile_now() - prof_start;
+        prof->num_inits++;
+    } else {
+        NCDModuleInst_Init(&ps->inst, module, method_context, args, &p->interp->module_params);
+    }
     return;
     
 fail1:
-    NCDValMem_Free(&ps->args_mem);
+    NCDValMem_Clear(&ps->args_mem);
 fail0:
     // set error
     p->error = 1;
@@ -974,19 +1346,17 @@ void process_wait_timer_handler (BSmallTimer *timer)
     process_advance(p);
 }
 
-int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object)
+int process_get_object (struct process *p, int slot, NCD_string_id_t name, NCDObject *out_object)
 {
-    ASSERT(pos >= 0)
-    ASSERT(pos <= p->num_statements)
+    ASSERT(slot >= -1)
+    ASSERT(slot < p->num_statements)
     ASSERT(out_object)
     
-    int i = NCDInterpProcess_FindStatement(p->iprocess, pos, name);
-    if (i >= 0) {
-        struct statement *ps = &p->statements[i];
-        ASSERT(i < p->num_statements)
+    if (slot >= 0) {
+        struct statement *ps = &p->statements[slot];
         
         if (ps->inst.istate == SSTATE_FORGOTTEN) {
-            process_log(p, BLOG_ERROR, "statement (%d) is uninitialized", i);
+            process_log(p, BLOG_ERROR, "statement (%d) is uninitialized", slot);
             return 0;
         }
         
@@ -1001,16 +1371,30 @@ int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDOb
     return 0;
 }
 
-int process_resolve_object_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object)
+int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object)
+{
+    ASSERT(pos >= 0)
+    ASSERT(pos <= p->num_statements)
+    ASSERT(out_object)
+    
+    int slot = NCDInterpProcess_FindStatement(p->iprocess, pos, name);
+    
+    return process_get_object(p, slot, name, out_object);
+}
+
+int process_resolve_object_expr (struct process *p, int pos, int slot, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object)
 {
     ASSERT(pos >= 0)
     ASSERT(pos <= p->num_statements)
+    ASSERT(slot >= -1)
+    ASSERT(slot < pos)
     ASSERT(names)
     ASSERT(num_names > 0)
     ASSERT(out_object)
+    ASSERT(slot == NCDInterpProcess_FindStatement(p->iprocess, pos, names[0]))
     
     NCDObject object;
-    if (!process_find_object(p, pos, names[0], &object)) {
+    if (!process_get_object(p, slot, names[0], &object)) {
         goto fail;
     }
     
@@ -1021,23 +1405,31 @@ int process_resolve_object_expr (struct process *p, int pos, const NCD_string_id
     return 1;
     
 fail:;
-    char *name = implode_id_strings(p->interp, names, num_names, '.');
-    process_log(p, BLOG_ERROR, "failed to resolve object (%s) from position %zu", (name ? name : ""), pos);
-    free(name);
+    char buf[128];
+    ExpString name;
+    ExpString_InitBuf(&name, buf, sizeof(buf));
+    if (!implode_id_strings(p->interp, names, num_names, '.', &name)) {
+        ExpString_Reset(&name);
+    }
+    process_log(p, BLOG_ERROR, "failed to resolve object (%s) from position %zu", ExpString_Get(&name), pos);
+    ExpString_Free(&name);
     return 0;
 }
 
-int process_resolve_variable_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value)
+int process_resolve_variable_expr (struct process *p, int pos, int slot, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value)
 {
     ASSERT(pos >= 0)
     ASSERT(pos <= p->num_statements)
+    ASSERT(slot >= -1)
+    ASSERT(slot < pos)
     ASSERT(names)
     ASSERT(num_names > 0)
     ASSERT(mem)
     ASSERT(out_value)
+    ASSERT(slot == NCDInterpProcess_FindStatement(p->iprocess, pos, names[0]))
     
     NCDObject object;
-    if (!process_find_object(p, pos, names[0], &object)) {
+    if (!process_get_object(p, slot, names[0], &object)) {
         goto fail;
     }
     
@@ -1048,9 +1440,14 @@ int process_resolve_variable_expr (struct process *p, int pos, const NCD_string_
     return 1;
     
 fail:;
-    char *name = implode_id_strings(p->interp, names, num_names, '.');
-    process_log(p, BLOG_ERROR, "failed to resolve variable (%s) from position %zu", (name ? name : ""), pos);
-    free(name);
+    char buf[128];
+    ExpString name;
+    ExpString_InitBuf(&name, buf, sizeof(buf));
+    if (!implode_id_strings(p->interp, names, num_names, '.', &name)) {
+        ExpString_Reset(&name);
+    }
+    process_log(p, BLOG_ERROR, "failed to resolve variable (%s) from position %zu", ExpString_Get(&name), pos);
+    ExpString_Free(&name);
     return 0;
 }
 
@@ -1117,6 +1514,26 @@ int statement_allocate_memory (struct statement *ps, int alloc_size)
     return 1;
 }
 
+struct NCDInterpProcess_profile * statement_profile (struct statement *ps)
+{
+    return NCDInterpProcess_StatementProfile(statement_process(ps)->iprocess, ps->i);
+}
+
+void statement_die (struct statement *ps)
+{
+    ASSERT(ps->inst.istate == SSTATE_DYING)
+    
+    struct NCDInterpProcess_profile *prof = statement_profile(ps);
+    if (!prof) {
+        NCDModuleInst_Die(&ps->inst);
+        return;
+    }
+    
+    uint64_t prof_start = profile_now();
+    NCDModuleInst_Die(&ps->inst);
+    prof->die_ns += profile_now() - prof_start;
+}
+
 void statement_instance_func_event (NCDModuleInst *inst, int event)
 {
     struct statement *ps = UPPER_OBJECT(inst, struct statement, inst);
@@ -1125,6 +1542,29 @@ void statement_instance_func_event (NCDModuleInst *inst, int event)
     struct process *p = statement_process(ps);
     process_assert_pointers(p);
     
+    struct NCDInterpProcess_profile *prof = statement_profile(ps);
+    if (prof) {
+        switch (event) {
+            case NCDMODULE_EVENT_UP:
+                prof->up_wait_ns += profile_now() - ps->prof_wait_start;
+                break;
+            case NCDMODULE_EVENT_DOWN:
+                ps->prof_wait_start = profile_now();
+                prof->num_downs++;
+                break;
+            case NCDMODULE_EVENT_DOWNUP:
+                prof->num_downs++;
+                break;
+            case NCDMODULE_EVENT_DEAD:
+                prof->num_dies++;
+                break;
+            case NCDMODULE_EVENT_DEADERROR:
+                prof->num_dies++;
+                prof->num_errors++;
+                break;
+        }
+    }
+    
     // schedule work
     BSmallPending_Set(&p->work_job, BReactor_PendingGroup(p->reactor));
     
@@ -1180,8 +1620,8 @@ void statement_instance_func_event (NCDModuleInst *inst, int event)
             // free instance
             NCDModuleInst_Free(&ps->inst);
             
-            // free arguments memory
-            NCDValMem_Free(&ps->args_mem);
+            // clear arguments memory
+            NCDValMem_Clear(&ps->args_mem);
             
             // set state FORGOTTEN
             ps->inst.istate = SSTATE_FORGOTTEN;
@@ -1203,8 +1643,8 @@ void statement_instance_func_event (NCDModuleInst *inst, int event)
             // free instance
             NCDModuleInst_Free(&ps->inst);
             
-            // free arguments memory
-            NCDValMem_Free(&ps->args_mem);
+            // clear arguments memory
+            NCDValMem_Clear(&ps->args_mem);
             
             // set state FORGOTTEN
             ps->inst.istate = SSTATE_FORGOTTEN;
@@ -1386,3 +1826,15 @@ int function_eval_arg (void *user, size_t index, NCDValMem *mem, NCDValRef *out)
     
     return NCDEvaluatorArgs_EvalArg(context->args, index, mem, out);
 }
+
+void fold_function_logfunc (void *user)
+{
+    BLog_Append("func_fold: ");
+}
+
+int fold_function_eval_arg (void *user, size_t index, NCDValMem *mem, NCDValRef *out)
+{
+    NCDEvaluatorArgs *args = user;
+    
+    return NCDEvaluatorArgs_EvalArg(args, index, mem, out);
+}
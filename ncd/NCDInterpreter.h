@@ -31,6 +31,7 @@
 #define BADVPN_NCD_INTERPRETER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -63,6 +64,20 @@
  */
 typedef void (*NCDInterpreter_handler_finished) (void *user, int exit_code);
 
+/**
+ * Cache settings for one process or template, overriding the default
+ * (see process_cache_size in struct {@link NCDInterpreter_params}).
+ */
+struct NCDInterpreter_cache_conf {
+    // name of the process or template
+    const char *name;
+    // maximum number of freed process structures to keep for reuse
+    int cache_max;
+    // number of process structures to allocate into the cache at startup;
+    // must not exceed cache_max
+    int cache_warm;
+};
+
 struct NCDInterpreter_params {
     // callbacks
     NCDInterpreter_handler_finished handler_finished;
@@ -72,6 +87,13 @@ struct NCDInterpreter_params {
     btime_t retry_time;
     char **extra_args;
     int num_extra_args;
+    int profile;
+    
+    // maximum number of freed process structures kept for reuse,
+    // per process or template, unless overridden in cache_confs
+    int process_cache_size;
+    const struct NCDInterpreter_cache_conf *cache_confs;
+    int num_cache_confs;
     
     // possibly shared resources
     BReactor *reactor;
@@ -113,6 +135,7 @@ typedef struct {
     struct NCDModuleInst_params module_params;
     struct NCDModuleInst_iparams module_iparams;
     struct NCDCall_interp_shared module_call_shared;
+    struct NCDCall_interp_shared fold_call_shared;
     
     // processes
     LinkedList1 processes;
@@ -154,4 +177,32 @@ void NCDInterpreter_Free (NCDInterpreter *o);
  */
 void NCDInterpreter_RequestShutdown (NCDInterpreter *o, int exit_code);
 
+/**
+ * Returns an identifier of this interpreter build and the set of modules
+ * and functions built into it. Program images (see {@link NCDProgramImage_Build})
+ * are tagged with this and are not used by a different build.
+ * 
+ * @return module ABI identifier
+ */
+uint64_t NCDInterpreter_ModuleAbiId (void);
+
+/**
+ * Writes the statement profile collected so far to a file.
+ * Profiling must have been enabled with the profile member of
+ * struct {@link NCDInterpreter_params}.
+ * 
+ * The report lists statements sorted by the total time spent in their
+ * init and die handlers. Additionally, the same data is written to
+ * a file named file + ".folded", in the folded stack format accepted
+ * by flamegraph tools, and the process cache counters of each process
+ * and template (hits, misses, structures dropped because the cache was
+ * full, and growths of preallocated statement memory) are written to
+ * a file named file + ".cache".
+ * 
+ * @param o the interpreter
+ * @param file path of the report file
+ * @return 1 on success, 0 on failure
+ */
+int NCDInterpreter_WriteProfile (NCDInterpreter *o, const char *file) WARN_UNUSED;
+
 #endif
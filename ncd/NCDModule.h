@@ -1192,6 +1192,8 @@ struct NCDCall_interp_shared {
     struct NCDModuleInst_iparams const *iparams;
 };
 
+#define NCDMODULEFUNCTION_FLAG_PURE (1 << 0)
+
 /**
  * This structure is initialized statically by a function
  * implementation to describe the function and provide
@@ -1211,6 +1213,18 @@ struct NCDModuleFunction {
      * Callback for evaluating the function.
      */
     void (*func_eval) (NCDCall call);
+    
+    /**
+     * Various flags.
+     * 
+     * - NCDMODULEFUNCTION_FLAG_PURE
+     *   Whether the result depends only on the argument values and evaluation
+     *   has no side effects. The interpreter may then evaluate calls whose
+     *   arguments are all constant once, when the program is loaded, and use
+     *   the result in place of the call. Such an evaluation logs messages
+     *   without a statement context.
+     */
+    int flags;
 };
 
 /**
@@ -36,6 +36,7 @@
 #include <misc/hashfun.h>
 #include <misc/compare.h>
 #include <misc/substring.h>
+#include <misc/concat_strings.h>
 #include <base/BLog.h>
 
 #include "NCDModuleIndex.h"
@@ -45,11 +46,42 @@
 #include "NCDModuleIndex_mhash.h"
 #include <structure/CHash_impl.h>
 
+#include "NCDModuleIndex_lhash.h"
+#include <structure/CHash_impl.h>
+
 #include "NCDModuleIndex_func_vec.h"
 #include <structure/Vector_impl.h>
 
-#include "NCDModuleIndex_fhash.h"
-#include <structure/CHash_impl.h>
+static int grow_func_table (NCDModuleIndex *o, NCD_string_id_t func_name_id)
+{
+    ASSERT(func_name_id >= 0)
+    
+    if (func_name_id < o->func_table_size) {
+        return 1;
+    }
+    
+    size_t new_size = (o->func_table_size > 0) ? o->func_table_size : NCDMODULEINDEX_FUNCTIONS_TABLE_INITIAL_SIZE;
+    while (new_size <= func_name_id) {
+        if (new_size > SIZE_MAX / 2) {
+            return 0;
+        }
+        new_size *= 2;
+    }
+    
+    int *new_table = BReallocArray(o->func_table, new_size, sizeof(new_table[0]));
+    if (!new_table) {
+        return 0;
+    }
+    
+    for (size_t i = o->func_table_size; i < new_size; i++) {
+        new_table[i] = -1;
+    }
+    
+    o->func_table = new_table;
+    o->func_table_size = new_size;
+    
+    return 1;
+}
 
 static int string_pointer_comparator (void *user, void *v1, void *v2)
 {
@@ -81,6 +113,51 @@ static struct NCDModuleIndex_base_type * find_base_type (NCDModuleIndex *o, cons
 }
 #endif
 
+static struct NCDModuleIndex__Func * find_function (NCDModuleIndex *o, NCD_string_id_t func_name_id)
+{
+    ASSERT(func_name_id >= 0)
+    
+    // string IDs are dense, so they index the table directly
+    if (func_name_id >= o->func_table_size || o->func_table[func_name_id] < 0) {
+        return NULL;
+    }
+    
+    return NCDModuleIndex__FuncVec_Get(&o->func_vec, o->func_table[func_name_id]);
+}
+
+static const char * find_method_suffix (const char *type)
+{
+    // the method name is what follows the last "::"; the key includes the "::"
+    // so it cannot be confused with module types and functions
+    const char *suffix = NULL;
+    for (const char *p = strstr(type, "::"); p; p = strstr(p + 1, "::")) {
+        suffix = p;
+    }
+    
+    return suffix;
+}
+
+static void load_lazy_groups (NCDModuleIndex *o, const char *name)
+{
+    NCDModuleIndex__LHashRef ref = NCDModuleIndex__LHash_Lookup(&o->lazy_hash, 0, name);
+    
+    while (ref.link) {
+        struct NCDModuleIndex_lazy_group *lg = ref.link->lgroup;
+        ref = NCDModuleIndex__LHash_GetNextEqual(&o->lazy_hash, 0, ref);
+        
+        if (lg->loaded) {
+            continue;
+        }
+        
+        // don't retry if adding fails
+        lg->loaded = 1;
+        
+        if (!NCDModuleIndex_AddGroup(o, lg->group, lg->iparams, o->string_index)) {
+            BLog(BLOG_ERROR, "failed to add module group for %s", name);
+        }
+    }
+}
+
 static int add_method (const char *type, const struct NCDInterpModule *module, NCDMethodIndex *method_index, int *out_method_id)
 {
     ASSERT(type)
@@ -144,12 +221,21 @@ int NCDModuleIndex_Init (NCDModuleIndex *o, NCDStringIndex *string_index)
         goto fail2;
     }
     
-    // init functions hash
-    if (!NCDModuleIndex__FuncHash_Init(&o->func_hash, NCDMODULEINDEX_FUNCTIONS_HASH_SIZE)) {
-        BLog(BLOG_ERROR, "NCDModuleIndex__FuncHash_Init failed");
+    // init functions table, indexed by function name string ID
+    o->func_table = NULL;
+    o->func_table_size = 0;
+    
+    // init lazy names hash
+    if (!NCDModuleIndex__LHash_Init(&o->lazy_hash, NCDMODULEINDEX_LAZY_HASH_SIZE)) {
+        BLog(BLOG_ERROR, "NCDModuleIndex__LHash_Init failed");
         goto fail3;
     }
     
+    // init lazy groups list
+    LinkedList0_Init(&o->lazy_groups_list);
+    
+    o->string_index = string_index;
+    
     DebugObject_Init(&o->d_obj);
     return 1;
     
@@ -189,8 +275,18 @@ void NCDModuleIndex_Free (NCDModuleIndex *o)
     }
 #endif
     
-    // free functions hash
-    NCDModuleIndex__FuncHash_Free(&o->func_hash);
+    // free lazy groups
+    while (ln = LinkedList0_GetFirst(&o->lazy_groups_list)) {
+        struct NCDModuleIndex_lazy_group *lg = UPPER_OBJECT(ln, struct NCDModuleIndex_lazy_group, lazy_groups_list_node);
+        LinkedList0_Remove(&o->lazy_groups_list, &lg->lazy_groups_list_node);
+        BFree(lg);
+    }
+    
+    // free lazy names hash
+    NCDModuleIndex__LHash_Free(&o->lazy_hash);
+    
+    // free functions table
+    BFree(o->func_table);
     
     // free functions vector
     NCDModuleIndex__FuncVec_Free(&o->func_vec);
@@ -352,12 +448,16 @@ int NCDModuleIndex_AddGroup (NCDModuleIndex *o, const struct NCDModuleGroup *gro
                 goto fail4;
             }
             
-            NCDModuleIndex__FuncHashRef lookup_ref = NCDModuleIndex__FuncHash_Lookup(&o->func_hash, o, func_name_id);
-            if (lookup_ref.link >= 0) {
+            if (find_function(o, func_name_id)) {
                 BLog(BLOG_ERROR, "Function already exists: %s", mfunc->func_name);
                 goto fail4;
             }
             
+            if (!grow_func_table(o, func_name_id)) {
+                BLog(BLOG_ERROR, "grow_func_table failed");
+                goto fail4;
+            }
+            
             size_t func_index;
             struct NCDModuleIndex__Func *func = NCDModuleIndex__FuncVec_Push(&o->func_vec, &func_index);
             if (!func) {
@@ -369,9 +469,7 @@ int NCDModuleIndex_AddGroup (NCDModuleIndex *o, const struct NCDModuleGroup *gro
             func->ifunc.func_name_id = func_name_id;
             func->ifunc.group = &ig->igroup;
             
-            NCDModuleIndex__FuncHashRef ref = {func, func_index};
-            int res = NCDModuleIndex__FuncHash_Insert(&o->func_hash, o, ref, NULL);
-            ASSERT_EXECUTE(res)
+            o->func_table[func_name_id] = func_index;
         }
     }
     
@@ -381,8 +479,8 @@ fail4:
     while (NCDModuleIndex__FuncVec_Count(&o->func_vec) > prev_func_count) {
         size_t func_index;
         struct NCDModuleIndex__Func *func = NCDModuleIndex__FuncVec_Pop(&o->func_vec, &func_index);
-        NCDModuleIndex__FuncHashRef ref = {func, func_index};
-        NCDModuleIndex__FuncHash_Remove(&o->func_hash, o, ref);
+        ASSERT(o->func_table[func->ifunc.func_name_id] == func_index)
+        o->func_table[func->ifunc.func_name_id] = -1;
     }
 fail3:
     while (num_inited_modules-- > 0) {
@@ -415,6 +513,68 @@ fail0:
     return 0;
 }
 
+int NCDModuleIndex_AddLazyGroup (NCDModuleIndex *o, const struct NCDModuleGroup *group, const struct NCDModuleInst_iparams *iparams)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(group)
+    ASSERT(iparams)
+    
+    // count names: module types, method names and functions
+    size_t num_names = 0;
+    if (group->modules) {
+        for (const struct NCDModule *nm = group->modules; nm->type; nm++) {
+            num_names += 1 + !!find_method_suffix(nm->type);
+        }
+    }
+    if (group->functions) {
+        for (const struct NCDModuleFunction *mfunc = group->functions; mfunc->func_name; mfunc++) {
+            num_names++;
+        }
+    }
+    
+    // allocate lazy group
+    bsize_t size = bsize_add(bsize_fromsize(sizeof(struct NCDModuleIndex_lazy_group)), bsize_mul(bsize_fromsize(num_names), bsize_fromsize(sizeof(struct NCDModuleIndex_lazy_name))));
+    struct NCDModuleIndex_lazy_group *lg = BAllocSize(size);
+    if (!lg) {
+        BLog(BLOG_ERROR, "BAllocSize failed");
+        return 0;
+    }
+    
+    lg->group = group;
+    lg->iparams = iparams;
+    lg->loaded = 0;
+    
+    // collect names
+    size_t j = 0;
+    if (group->modules) {
+        for (const struct NCDModule *nm = group->modules; nm->type; nm++) {
+            lg->names[j++].name = nm->type;
+            const char *method_suffix = find_method_suffix(nm->type);
+            if (method_suffix) {
+                lg->names[j++].name = method_suffix;
+            }
+        }
+    }
+    if (group->functions) {
+        for (const struct NCDModuleFunction *mfunc = group->functions; mfunc->func_name; mfunc++) {
+            lg->names[j++].name = mfunc->func_name;
+        }
+    }
+    ASSERT(j == num_names)
+    
+    // insert names to hash
+    for (j = 0; j < num_names; j++) {
+        lg->names[j].lgroup = lg;
+        NCDModuleIndex__LHashRef ref = {&lg->names[j], &lg->names[j]};
+        NCDModuleIndex__LHash_InsertMulti(&o->lazy_hash, 0, ref);
+    }
+    
+    // insert to lazy groups list
+    LinkedList0_Prepend(&o->lazy_groups_list, &lg->lazy_groups_list_node);
+    
+    return 1;
+}
+
 const struct NCDInterpModule * NCDModuleIndex_FindModule (NCDModuleIndex *o, const char *type)
 {
     DebugObject_Access(&o->d_obj);
@@ -422,7 +582,12 @@ const struct NCDInterpModule * NCDModuleIndex_FindModule (NCDModuleIndex *o, con
     
     struct NCDModuleIndex_module *m = find_module(o, type);
     if (!m) {
-        return NULL;
+        // add the group providing it, if not yet added
+        load_lazy_groups(o, type);
+        
+        if (!(m = find_module(o, type))) {
+            return NULL;
+        }
     }
     
     return &m->imodule;
@@ -433,6 +598,15 @@ int NCDModuleIndex_GetMethodNameId (NCDModuleIndex *o, const char *method_name)
     DebugObject_Access(&o->d_obj);
     ASSERT(method_name)
     
+    // add groups implementing this method for any type
+    char *key = concat_strings(2, "::", method_name);
+    if (!key) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        return -1;
+    }
+    load_lazy_groups(o, key);
+    BFree(key);
+    
     return NCDMethodIndex_GetMethodNameId(&o->method_index, method_name);
 }
 
@@ -446,11 +620,17 @@ const struct NCDInterpModule * NCDModuleIndex_GetMethodModule (NCDModuleIndex *o
 const struct NCDInterpFunction * NCDModuleIndex_FindFunction (NCDModuleIndex *o, NCD_string_id_t func_name_id)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(func_name_id >= 0)
     
-    NCDModuleIndex__FuncHashRef lookup_ref = NCDModuleIndex__FuncHash_Lookup(&o->func_hash, o, func_name_id);
-    if (lookup_ref.link < 0) {
-        return NULL;
+    struct NCDModuleIndex__Func *func = find_function(o, func_name_id);
+    if (!func) {
+        // add the group providing it, if not yet added
+        load_lazy_groups(o, NCDStringIndex_Value(o->string_index, func_name_id).ptr);
+        
+        if (!(func = find_function(o, func_name_id))) {
+            return NULL;
+        }
     }
     
-    return &lookup_ref.ptr->ifunc;
+    return &func->ifunc;
 }
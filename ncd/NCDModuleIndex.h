@@ -41,8 +41,9 @@
 #include <ncd/NCDMethodIndex.h>
 
 #define NCDMODULEINDEX_MODULES_HASH_SIZE 512
+#define NCDMODULEINDEX_LAZY_HASH_SIZE 1024
 #define NCDMODULEINDEX_FUNCTIONS_VEC_INITIAL_SIZE 32
-#define NCDMODULEINDEX_FUNCTIONS_HASH_SIZE 64
+#define NCDMODULEINDEX_FUNCTIONS_TABLE_INITIAL_SIZE 256
 
 struct NCDModuleIndex_module {
     struct NCDInterpModule imodule;
@@ -64,25 +65,43 @@ struct NCDModuleIndex_group {
     struct NCDModuleIndex_module modules[];
 };
 
+struct NCDModuleIndex_lazy_group;
+
+struct NCDModuleIndex_lazy_name {
+    const char *name;
+    struct NCDModuleIndex_lazy_group *lgroup;
+    struct NCDModuleIndex_lazy_name *hash_next;
+};
+
+struct NCDModuleIndex_lazy_group {
+    LinkedList0Node lazy_groups_list_node;
+    const struct NCDModuleGroup *group;
+    const struct NCDModuleInst_iparams *iparams;
+    int loaded;
+    struct NCDModuleIndex_lazy_name names[];
+};
+
 struct NCDModuleIndex__Func {
     struct NCDInterpFunction ifunc;
-    int hash_next;
 };
 
 typedef struct NCDModuleIndex_module *NCDModuleIndex__mhash_link;
 typedef const char *NCDModuleIndex__mhash_key;
 
+typedef struct NCDModuleIndex_lazy_name *NCDModuleIndex__lhash_link;
+typedef const char *NCDModuleIndex__lhash_key;
+
 typedef struct NCDModuleIndex_s NCDModuleIndex;
 
 #include "NCDModuleIndex_mhash.h"
 #include <structure/CHash_decl.h>
 
+#include "NCDModuleIndex_lhash.h"
+#include <structure/CHash_decl.h>
+
 #include "NCDModuleIndex_func_vec.h"
 #include <structure/Vector_decl.h>
 
-#include "NCDModuleIndex_fhash.h"
-#include <structure/CHash_decl.h>
-
 struct NCDModuleIndex_s {
     NCDModuleIndex__MHash modules_hash;
 #ifndef NDEBUG
@@ -91,13 +110,29 @@ struct NCDModuleIndex_s {
     LinkedList0 groups_list;
     NCDMethodIndex method_index;
     NCDModuleIndex__FuncVec func_vec;
-    NCDModuleIndex__FuncHash func_hash;
+    int *func_table;
+    size_t func_table_size;
+    NCDModuleIndex__LHash lazy_hash;
+    LinkedList0 lazy_groups_list;
+    NCDStringIndex *string_index;
     DebugObject d_obj;
 };
 
 int NCDModuleIndex_Init (NCDModuleIndex *o, NCDStringIndex *string_index) WARN_UNUSED;
 void NCDModuleIndex_Free (NCDModuleIndex *o);
 int NCDModuleIndex_AddGroup (NCDModuleIndex *o, const struct NCDModuleGroup *group, const struct NCDModuleInst_iparams *iparams, NCDStringIndex *string_index) WARN_UNUSED;
+
+/**
+ * Registers a module group to be added with {@link NCDModuleIndex_AddGroup} only
+ * when something refers to it: a lookup of one of its module types or functions,
+ * or a method name one of its modules implements. Its global init function runs
+ * then too. Failure to add the group is logged and then looks like the names
+ * do not exist.
+ * 
+ * @return 1 on success, 0 on failure
+ */
+int NCDModuleIndex_AddLazyGroup (NCDModuleIndex *o, const struct NCDModuleGroup *group, const struct NCDModuleInst_iparams *iparams) WARN_UNUSED;
+
 const struct NCDInterpModule * NCDModuleIndex_FindModule (NCDModuleIndex *o, const char *type);
 int NCDModuleIndex_GetMethodNameId (NCDModuleIndex *o, const char *method_name);
 const struct NCDInterpModule * NCDModuleIndex_GetMethodModule (NCDModuleIndex *o, NCD_string_id_t obj_type, int method_name_id);
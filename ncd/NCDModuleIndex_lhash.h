@@ -0,0 +1,12 @@
+#define CHASH_PARAM_NAME NCDModuleIndex__LHash
+#define CHASH_PARAM_ENTRY struct NCDModuleIndex_lazy_name
+#define CHASH_PARAM_LINK NCDModuleIndex__lhash_link
+#define CHASH_PARAM_KEY NCDModuleIndex__lhash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((NCDModuleIndex__lhash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) (badvpn_hash_str((entry).ptr->name, badvpn_hash_seed()))
+#define CHASH_PARAM_KEYHASH(arg, key) (badvpn_hash_str((key), badvpn_hash_seed()))
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (!strcmp((entry1).ptr->name, (entry2).ptr->name))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (!strcmp((key1), (entry2).ptr->name))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
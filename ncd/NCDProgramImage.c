@@ -0,0 +1,759 @@
+/**
+ * @file NCDProgramImage.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/expstring.h>
+#include <misc/hashfun.h>
+#include <misc/read_file.h>
+#include <misc/write_file.h>
+#include <misc/read_write_int.h>
+#include <misc/concat_strings.h>
+#include <base/BLog.h>
+#include <ncd/NCDBuildProgram.h>
+#include <ncd/NCDSugar.h>
+
+#include "NCDProgramImage.h"
+
+#include <generated/blog_channel_NCDProgramImage.h>
+
+#define IMAGE_MAGIC "NCDPIMG\n"
+#define IMAGE_MAGIC_LEN 8
+#define NULL_STRING UINT32_MAX
+#define MAX_VALUE_DEPTH 1000
+
+/*
+ * Image layout (all integers little endian):
+ * 
+ *   magic, u32 format version, u64 module ABI id
+ *   u32 number of files, then for each file: string path, u64 length, u64 hash
+ *   program
+ *   u64 hash of everything before it
+ * 
+ * A string is a u32 length followed by the data and a null terminator, or just
+ * NULL_STRING for a missing string. Since the AST can only be built by prepending
+ * elements to programs, blocks and maps, these are stored in reverse order.
+ */
+
+struct reader {
+    const uint8_t *data;
+    size_t len;
+};
+
+struct files_state {
+    ExpString files;
+    size_t num_files;
+};
+
+static int write_u8 (ExpString *s, uint8_t x)
+{
+    return ExpString_AppendByte(s, x);
+}
+
+static int write_u32 (ExpString *s, uint32_t x)
+{
+    char b[4];
+    badvpn_write_le32(x, b);
+    return ExpString_AppendBinary(s, (const uint8_t *)b, sizeof(b));
+}
+
+static int write_u64 (ExpString *s, uint64_t x)
+{
+    char b[8];
+    badvpn_write_le64(x, b);
+    return ExpString_AppendBinary(s, (const uint8_t *)b, sizeof(b));
+}
+
+static int write_count (ExpString *s, size_t count)
+{
+    if (count > UINT32_MAX) {
+        return 0;
+    }
+    
+    return write_u32(s, count);
+}
+
+static int write_string (ExpString *s, const char *str, size_t len)
+{
+    if (!str) {
+        return write_u32(s, NULL_STRING);
+    }
+    
+    if (len >= NULL_STRING) {
+        return 0;
+    }
+    
+    return write_u32(s, len) && ExpString_AppendBinary(s, (const uint8_t *)str, len) && ExpString_AppendByte(s, 0);
+}
+
+static int write_name (ExpString *s, const char *str)
+{
+    return write_string(s, str, (str ? strlen(str) : 0));
+}
+
+static int write_value (ExpString *s, NCDValue *v)
+{
+    int type = NCDValue_Type(v);
+    
+    if (!write_u8(s, type)) {
+        return 0;
+    }
+    
+    switch (type) {
+        case NCDVALUE_STRING: {
+            return write_string(s, NCDValue_StringValue(v), NCDValue_StringLength(v));
+        } break;
+        
+        case NCDVALUE_LIST: {
+            if (!write_count(s, NCDValue_ListCount(v))) {
+                return 0;
+            }
+            
+            for (NCDValue *e = NCDValue_ListFirst(v); e; e = NCDValue_ListNext(v, e)) {
+                if (!write_value(s, e)) {
+                    return 0;
+                }
+            }
+            
+            return 1;
+        } break;
+        
+        case NCDVALUE_MAP: {
+            size_t count = NCDValue_MapCount(v);
+            if (!write_count(s, count)) {
+                return 0;
+            }
+            
+            NCDValue **keys = BAllocArray(count, sizeof(keys[0]));
+            if (!keys) {
+                return 0;
+            }
+            
+            size_t i = 0;
+            for (NCDValue *ekey = NCDValue_MapFirstKey(v); ekey; ekey = NCDValue_MapNextKey(v, ekey)) {
+                keys[i++] = ekey;
+            }
+            ASSERT(i == count)
+            
+            int res = 1;
+            while (res && i > 0) {
+                i--;
+                res = write_value(s, keys[i]) && write_value(s, NCDValue_MapKeyValue(v, keys[i]));
+            }
+            
+            BFree(keys);
+            return res;
+        } break;
+        
+        case NCDVALUE_VAR: {
+            return write_name(s, NCDValue_VarName(v));
+        } break;
+        
+        case NCDVALUE_INVOC: {
+            return write_value(s, NCDValue_InvocFunc(v)) && write_value(s, NCDValue_InvocArg(v));
+        } break;
+        
+        default:
+            ASSERT(0);
+            return 0;
+    }
+}
+
+static int write_block (ExpString *s, NCDBlock *block)
+{
+    size_t count = NCDBlock_NumStatements(block);
+    if (!write_count(s, count)) {
+        return 0;
+    }
+    
+    NCDStatement **stmts = BAllocArray(count, sizeof(stmts[0]));
+    if (!stmts) {
+        return 0;
+    }
+    
+    size_t i = 0;
+    for (NCDStatement *st = NCDBlock_FirstStatement(block); st; st = NCDBlock_NextStatement(block, st)) {
+        stmts[i++] = st;
+    }
+    ASSERT(i == count)
+    
+    int res = 1;
+    while (res && i > 0) {
+        NCDStatement *st = stmts[--i];
+        
+        // desugared programs only contain regular statements
+        if (NCDStatement_Type(st) != NCDSTATEMENT_REG) {
+            res = 0;
+            break;
+        }
+        
+        res = write_name(s, NCDStatement_Name(st)) &&
+              write_name(s, NCDStatement_RegObjName(st)) &&
+              write_name(s, NCDStatement_RegCmdName(st)) &&
+              write_value(s, NCDStatement_RegArgs(st));
+    }
+    
+    BFree(stmts);
+    return res;
+}
+
+static int write_program (ExpString *s, NCDProgram *prog)
+{
+    size_t count = NCDProgram_NumElems(prog);
+    if (!write_count(s, count)) {
+        return 0;
+    }
+    
+    NCDProgramElem **elems = BAllocArray(count, sizeof(elems[0]));
+    if (!elems) {
+        return 0;
+    }
+    
+    size_t i = 0;
+    for (NCDProgramElem *elem = NCDProgram_FirstElem(prog); elem; elem = NCDProgram_NextElem(prog, elem)) {
+        elems[i++] = elem;
+    }
+    ASSERT(i == count)
+    
+    int res = 1;
+    while (res && i > 0) {
+        NCDProgramElem *elem = elems[--i];
+        ASSERT(NCDProgramElem_Type(elem) == NCDPROGRAMELEM_PROCESS)
+        NCDProcess *proc = NCDProgramElem_Process(elem);
+        
+        res = write_u8(s, NCDProcess_IsTemplate(proc)) &&
+              write_name(s, NCDProcess_Name(proc)) &&
+              write_block(s, NCDProcess_Block(proc));
+    }
+    
+    BFree(elems);
+    return res;
+}
+
+static int read_bytes (struct reader *r, size_t n, const uint8_t **out)
+{
+    if (n > r->len) {
+        return 0;
+    }
+    
+    *out = r->data;
+    r->data += n;
+    r->len -= n;
+    
+    return 1;
+}
+
+static int read_u8 (struct reader *r, uint8_t *out)
+{
+    const uint8_t *p;
+    if (!read_bytes(r, 1, &p)) {
+        return 0;
+    }
+    
+    *out = *p;
+    return 1;
+}
+
+static int read_u32 (struct reader *r, uint32_t *out)
+{
+    const uint8_t *p;
+    if (!read_bytes(r, 4, &p)) {
+        return 0;
+    }
+    
+    *out = badvpn_read_le32((const char *)p);
+    return 1;
+}
+
+static int read_u64 (struct reader *r, uint64_t *out)
+{
+    const uint8_t *p;
+    if (!read_bytes(r, 8, &p)) {
+        return 0;
+    }
+    
+    *out = badvpn_read_le64((const char *)p);
+    return 1;
+}
+
+static int read_string (struct reader *r, int allow_null, const char **out_str, size_t *out_len)
+{
+    uint32_t len;
+    if (!read_u32(r, &len)) {
+        return 0;
+    }
+    
+    if (len == NULL_STRING) {
+        *out_str = NULL;
+        *out_len = 0;
+        return allow_null;
+    }
+    
+    const uint8_t *p;
+    if (!read_bytes(r, (size_t)len + 1, &p) || p[len] != '\0') {
+        return 0;
+    }
+    
+    *out_str = (const char *)p;
+    *out_len = len;
+    return 1;
+}
+
+static int read_name (struct reader *r, int allow_null, const char **out_str)
+{
+    size_t len;
+    if (!read_string(r, allow_null, out_str, &len)) {
+        return 0;
+    }
+    
+    return (!*out_str || strlen(*out_str) == len);
+}
+
+static int read_value (struct reader *r, int depth, NCDValue *out)
+{
+    if (depth > MAX_VALUE_DEPTH) {
+        return 0;
+    }
+    
+    uint8_t type;
+    if (!read_u8(r, &type)) {
+        return 0;
+    }
+    
+    switch (type) {
+        case NCDVALUE_STRING: {
+            const char *str;
+            size_t len;
+            if (!read_string(r, 0, &str, &len)) {
+                return 0;
+            }
+            
+            return NCDValue_InitStringBin(out, (const uint8_t *)str, len);
+        } break;
+        
+        case NCDVALUE_LIST: {
+            uint32_t count;
+            if (!read_u32(r, &count)) {
+                return 0;
+            }
+            
+            NCDValue_InitList(out);
+            
+            for (uint32_t i = 0; i < count; i++) {
+                NCDValue e;
+                if (!read_value(r, depth + 1, &e)) {
+                    goto fail_list;
+                }
+                
+                if (!NCDValue_ListAppend(out, e)) {
+                    NCDValue_Free(&e);
+                    goto fail_list;
+                }
+            }
+            
+            return 1;
+            
+        fail_list:
+            NCDValue_Free(out);
+            return 0;
+        } break;
+        
+        case NCDVALUE_MAP: {
+            uint32_t count;
+            if (!read_u32(r, &count)) {
+                return 0;
+            }
+            
+            NCDValue_InitMap(out);
+            
+            for (uint32_t i = 0; i < count; i++) {
+                NCDValue key;
+                if (!read_value(r, depth + 1, &key)) {
+                    goto fail_map;
+                }
+                
+                NCDValue val;
+                if (!read_value(r, depth + 1, &val)) {
+                    NCDValue_Free(&key);
+                    goto fail_map;
+                }
+                
+                if (!NCDValue_MapPrepend(out, key, val)) {
+                    NCDValue_Free(&key);
+                    NCDValue_Free(&val);
+                    goto fail_map;
+                }
+            }
+            
+            return 1;
+            
+        fail_map:
+            NCDValue_Free(out);
+            return 0;
+        } break;
+        
+        case NCDVALUE_VAR: {
+            const char *name;
+            if (!read_name(r, 0, &name)) {
+                return 0;
+            }
+            
+            return NCDValue_InitVar(out, name);
+        } break;
+        
+        case NCDVALUE_INVOC: {
+            NCDValue func;
+            if (!read_value(r, depth + 1, &func)) {
+                return 0;
+            }
+            
+            NCDValue arg;
+            if (!read_value(r, depth + 1, &arg)) {
+                NCDValue_Free(&func);
+                return 0;
+            }
+            
+            if (!NCDValue_InitInvoc(out, func, arg)) {
+                NCDValue_Free(&func);
+                NCDValue_Free(&arg);
+                return 0;
+            }
+            
+            return 1;
+        } break;
+        
+        default:
+            return 0;
+    }
+}
+
+static int read_block (struct reader *r, NCDBlock *out)
+{
+    uint32_t count;
+    if (!read_u32(r, &count)) {
+        return 0;
+    }
+    
+    NCDBlock_Init(out);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const char *name;
+        const char *objname;
+        const char *cmdname;
+        if (!read_name(r, 1, &name) || !read_name(r, 1, &objname) || !read_name(r, 0, &cmdname)) {
+            goto fail;
+        }
+        
+        NCDValue args;
+        if (!read_value(r, 0, &args)) {
+            goto fail;
+        }
+        
+        if (NCDValue_Type(&args) != NCDVALUE_LIST) {
+            NCDValue_Free(&args);
+            goto fail;
+        }
+        
+        NCDStatement st;
+        if (!NCDStatement_InitReg(&st, name, objname, cmdname, args)) {
+            NCDValue_Free(&args);
+            goto fail;
+        }
+        
+        if (!NCDBlock_PrependStatement(out, st)) {
+            NCDStatement_Free(&st);
+            goto fail;
+        }
+    }
+    
+    return 1;
+    
+fail:
+    NCDBlock_Free(out);
+    return 0;
+}
+
+static int read_program (struct reader *r, NCDProgram *out)
+{
+    uint32_t count;
+    if (!read_u32(r, &count)) {
+        return 0;
+    }
+    
+    NCDProgram_Init(out);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t is_template;
+        const char *name;
+        if (!read_u8(r, &is_template) || is_template > 1 || !read_name(r, 0, &name)) {
+            goto fail;
+        }
+        
+        NCDBlock block;
+        if (!read_block(r, &block)) {
+            goto fail;
+        }
+        
+        NCDProcess proc;
+        if (!NCDProcess_Init(&proc, is_template, name, block)) {
+            NCDBlock_Free(&block);
+            goto fail;
+        }
+        
+        NCDProgramElem elem;
+        NCDProgramElem_InitProcess(&elem, proc);
+        
+        if (!NCDProgram_PrependElem(out, elem)) {
+            NCDProgramElem_Free(&elem);
+            goto fail;
+        }
+    }
+    
+    return 1;
+    
+fail:
+    NCDProgram_Free(out);
+    return 0;
+}
+
+static int check_file (const char *image_path, const char *path, uint64_t len, uint64_t hash)
+{
+    uint8_t *data;
+    size_t data_len;
+    if (!read_file(path, &data, &data_len)) {
+        BLog(BLOG_INFO, "image '%s': file '%s' cannot be read", image_path, path);
+        return 0;
+    }
+    
+    int res = (data_len == len && badvpn_hash_bin(data, data_len, 0) == hash);
+    free(data);
+    
+    if (!res) {
+        BLog(BLOG_INFO, "image '%s': file '%s' has changed", image_path, path);
+    }
+    
+    return res;
+}
+
+static int parse_image (const char *file_path, const char *image_path, uint64_t abi_id, const uint8_t *data, size_t len, NCDProgram *out_program)
+{
+    if (len < 8 || badvpn_read_le64((const char *)data + len - 8) != badvpn_hash_bin(data, len - 8, 0)) {
+        BLog(BLOG_WARNING, "image '%s': corrupt", image_path);
+        return 0;
+    }
+    
+    struct reader r;
+    r.data = data;
+    r.len = len - 8;
+    
+    const uint8_t *magic;
+    uint32_t version;
+    uint64_t image_abi_id;
+    if (!read_bytes(&r, IMAGE_MAGIC_LEN, &magic) || memcmp(magic, IMAGE_MAGIC, IMAGE_MAGIC_LEN) ||
+        !read_u32(&r, &version) || version != NCDPROGRAMIMAGE_FORMAT_VERSION ||
+        !read_u64(&r, &image_abi_id)
+    ) {
+        BLog(BLOG_INFO, "image '%s': unknown format", image_path);
+        return 0;
+    }
+    
+    if (image_abi_id != abi_id) {
+        BLog(BLOG_INFO, "image '%s': made for a different module ABI", image_path);
+        return 0;
+    }
+    
+    uint32_t num_files;
+    if (!read_u32(&r, &num_files) || num_files == 0) {
+        goto fail_format;
+    }
+    
+    for (uint32_t i = 0; i < num_files; i++) {
+        const char *path;
+        uint64_t file_len;
+        uint64_t file_hash;
+        if (!read_name(&r, 0, &path) || !read_u64(&r, &file_len) || !read_u64(&r, &file_hash)) {
+            goto fail_format;
+        }
+        
+        // the first file is the main file
+        if (i == 0 && strcmp(path, file_path)) {
+            BLog(BLOG_INFO, "image '%s': made from a different file '%s'", image_path, path);
+            return 0;
+        }
+        
+        if (!check_file(image_path, path, file_len, file_hash)) {
+            return 0;
+        }
+    }
+    
+    NCDProgram program;
+    if (!read_program(&r, &program)) {
+        goto fail_format;
+    }
+    
+    if (r.len != 0) {
+        NCDProgram_Free(&program);
+        goto fail_format;
+    }
+    
+    *out_program = program;
+    return 1;
+    
+fail_format:
+    BLog(BLOG_WARNING, "image '%s': bad format", image_path);
+    return 0;
+}
+
+static int load_image (const char *file_path, const char *image_path, uint64_t abi_id, NCDProgram *out_program)
+{
+    uint8_t *data;
+    size_t len;
+    if (!read_file(image_path, &data, &len)) {
+        BLog(BLOG_INFO, "image '%s': cannot be read", image_path);
+        return 0;
+    }
+    
+    int res = parse_image(file_path, image_path, abi_id, data, len, out_program);
+    free(data);
+    
+    return res;
+}
+
+static void save_image (const char *image_path, uint64_t abi_id, struct files_state *fs, NCDProgram *program)
+{
+    ExpString s;
+    if (!ExpString_Init(&s)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    
+    if (!ExpString_AppendBinary(&s, (const uint8_t *)IMAGE_MAGIC, IMAGE_MAGIC_LEN) ||
+        !write_u32(&s, NCDPROGRAMIMAGE_FORMAT_VERSION) ||
+        !write_u64(&s, abi_id) ||
+        !write_count(&s, fs->num_files) ||
+        !ExpString_AppendBinaryMr(&s, ExpString_GetMr(&fs->files)) ||
+        !write_program(&s, program) ||
+        !write_u64(&s, badvpn_hash_bin((const uint8_t *)ExpString_Get(&s), ExpString_Length(&s), 0))
+    ) {
+        BLog(BLOG_ERROR, "image '%s': failed to serialize program", image_path);
+        goto fail1;
+    }
+    
+    char *tmp_path = concat_strings(2, image_path, ".tmp");
+    if (!tmp_path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto fail1;
+    }
+    
+    // write to a temporary file and rename it so a partial image is never seen
+    if (!write_file(tmp_path, ExpString_GetMr(&s))) {
+        BLog(BLOG_WARNING, "image '%s': failed to write '%s'", image_path, tmp_path);
+        remove(tmp_path);
+        goto fail2;
+    }
+    
+    if (rename(tmp_path, image_path) < 0) {
+        BLog(BLOG_WARNING, "image '%s': failed to rename '%s'", image_path, tmp_path);
+        remove(tmp_path);
+        goto fail2;
+    }
+    
+    BLog(BLOG_INFO, "image '%s': written", image_path);
+    
+fail2:
+    free(tmp_path);
+fail1:
+    ExpString_Free(&s);
+fail0:
+    return;
+}
+
+static int record_file (void *user, const char *file_path, const uint8_t *data, size_t len)
+{
+    struct files_state *fs = user;
+    
+    if (!write_name(&fs->files, file_path) ||
+        !write_u64(&fs->files, len) ||
+        !write_u64(&fs->files, badvpn_hash_bin(data, len, 0))
+    ) {
+        return 0;
+    }
+    
+    fs->num_files++;
+    
+    return 1;
+}
+
+int NCDProgramImage_Build (const char *file_path, const char *image_path, uint64_t abi_id, NCDProgram *out_program)
+{
+    ASSERT(file_path)
+    ASSERT(image_path)
+    ASSERT(out_program)
+    
+    if (load_image(file_path, image_path, abi_id, out_program)) {
+        BLog(BLOG_INFO, "image '%s': loaded", image_path);
+        return 1;
+    }
+    
+    struct files_state fs;
+    if (!ExpString_Init(&fs.files)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    fs.num_files = 0;
+    
+    NCDProgram program;
+    if (!NCDBuildProgram_Build2(file_path, record_file, &fs, &program)) {
+        goto fail1;
+    }
+    
+    if (!NCDSugar_Desugar(&program)) {
+        BLog(BLOG_ERROR, "NCDSugar_Desugar failed");
+        NCDProgram_Free(&program);
+        goto fail1;
+    }
+    
+    save_image(image_path, abi_id, &fs, &program);
+    
+    ExpString_Free(&fs.files);
+    
+    *out_program = program;
+    return 1;
+    
+fail1:
+    ExpString_Free(&fs.files);
+fail0:
+    return 0;
+}
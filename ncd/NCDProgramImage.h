@@ -0,0 +1,65 @@
+/**
+ * @file NCDProgramImage.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Binary images of built and desugared NCD programs, used to skip reading,
+ * tokenizing, parsing, include processing and desugaring on startup.
+ * 
+ * An image records the path, length and hash of every file the program was
+ * built from, as well as the module ABI identifier of the interpreter it was
+ * made for. It is only used if all of these still match.
+ */
+
+#ifndef BADVPN_NCDPROGRAMIMAGE_H
+#define BADVPN_NCDPROGRAMIMAGE_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <ncd/NCDAst.h>
+
+#define NCDPROGRAMIMAGE_FORMAT_VERSION 1
+
+/**
+ * Builds a desugared NCD program, as {@link NCDBuildProgram_Build} followed
+ * by {@link NCDSugar_Desugar} would, but loads it from the image at image_path
+ * if the image is valid for the given sources and abi_id. Otherwise the
+ * program is built from source and the image is (re)written. Failure to
+ * write the image is logged but does not fail the build.
+ * 
+ * @param file_path path to the main file of the program
+ * @param image_path path of the image file
+ * @param abi_id module ABI identifier, see {@link NCDInterpreter_ModuleAbiId}
+ * @param out_program on success, *out_program will contain the resulting program.
+ *                    On failure, *out_program will be unchanged.
+ * @return 1 on success, 0 on failure
+ */
+int NCDProgramImage_Build (const char *file_path, const char *image_path, uint64_t abi_id, NCDProgram *out_program) WARN_UNUSED;
+
+#endif
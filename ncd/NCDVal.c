@@ -53,6 +53,7 @@
 #define STOREDSTRING_TYPE (NCDVAL_STRING | (0 << 3))
 #define IDSTRING_TYPE (NCDVAL_STRING | (1 << 3))
 #define EXTERNALSTRING_TYPE (NCDVAL_STRING | (2 << 3))
+#define LINK_TYPE 5
 
 #define NCDVAL_INSTR_PLACEHOLDER 0
 #define NCDVAL_INSTR_REINSERT 1
@@ -96,6 +97,13 @@ struct NCDVal__externalstring {
     struct NCDVal__ref ref;
 };
 
+struct NCDVal__link {
+    int type;
+    NCDVal__idx target_idx;
+    NCDValMem *target_mem;
+    struct NCDVal__ref ref;
+};
+
 typedef struct NCDVal__mapelem NCDVal__maptree_entry;
 typedef NCDValMem *NCDVal__maptree_arg;
 
@@ -134,7 +142,8 @@ static int make_type (int internal_type, int depth)
            internal_type == NCDVAL_MAP ||
            internal_type == STOREDSTRING_TYPE ||
            internal_type == IDSTRING_TYPE ||
-           internal_type == EXTERNALSTRING_TYPE)
+           internal_type == EXTERNALSTRING_TYPE ||
+           internal_type == LINK_TYPE)
     ASSERT(depth >= 0)
     ASSERT(depth <= NCDVAL_MAX_DEPTH)
     
@@ -168,12 +177,54 @@ static int bump_depth (int *type_ptr, int elem_depth)
     return 1;
 }
 
+static char * buffer_base (NCDValMem *o)
+{
+    return (o->size == NCDVAL_FASTBUF_SIZE) ? o->fastbuf : o->allocd_buf;
+}
+
 static void * buffer_at (NCDValMem *o, NCDVal__idx idx)
 {
     ASSERT(idx >= 0)
     ASSERT(idx < o->used)
     
-    return ((o->size == NCDVAL_FASTBUF_SIZE) ? o->fastbuf : o->allocd_buf) + idx;
+    return buffer_base(o) + idx;
+}
+
+static int buffer_reserve (NCDValMem *o, NCDVal__idx min_size)
+{
+    ASSERT(min_size >= 0)
+    
+    if (min_size <= o->size) {
+        return 1;
+    }
+    
+    NCDVal__idx newsize = (o->size == NCDVAL_FASTBUF_SIZE) ? NCDVAL_FIRST_SIZE : o->size;
+    while (newsize < min_size) {
+        if (newsize > NCDVAL_MAXIDX / 2) {
+            return 0;
+        }
+        newsize *= 2;
+    }
+    
+    char *newbuf;
+    
+    if (o->size == NCDVAL_FASTBUF_SIZE) {
+        newbuf = malloc(newsize);
+        if (!newbuf) {
+            return 0;
+        }
+        memcpy(newbuf, o->fastbuf, o->used);
+    } else {
+        newbuf = realloc(o->allocd_buf, newsize);
+        if (!newbuf) {
+            return 0;
+        }
+    }
+    
+    o->size = newsize;
+    o->allocd_buf = newbuf;
+    
+    return 1;
 }
 
 static NCDVal__idx buffer_allocate (NCDValMem *o, NCDVal__idx alloc_size, NCDVal__idx align)
@@ -187,31 +238,12 @@ static NCDVal__idx buffer_allocate (NCDValMem *o, NCDVal__idx alloc_size, NCDVal
     NCDVal__idx aligned_alloc_size = align_extra + alloc_size;
     
     if (aligned_alloc_size > o->size - o->used) {
-        NCDVal__idx newsize = (o->size == NCDVAL_FASTBUF_SIZE) ? NCDVAL_FIRST_SIZE : o->size;
-        while (aligned_alloc_size > newsize - o->used) {
-            if (newsize > NCDVAL_MAXIDX / 2) {
-                return -1;
-            }
-            newsize *= 2;
+        if (aligned_alloc_size > NCDVAL_MAXIDX - o->used) {
+            return -1;
         }
-        
-        char *newbuf;
-        
-        if (o->size == NCDVAL_FASTBUF_SIZE) {
-            newbuf = malloc(newsize);
-            if (!newbuf) {
-                return -1;
-            }
-            memcpy(newbuf, o->fastbuf, o->used);
-        } else {
-            newbuf = realloc(o->allocd_buf, newsize);
-            if (!newbuf) {
-                return -1;
-            }
+        if (!buffer_reserve(o, o->used + aligned_alloc_size)) {
+            return -1;
         }
-        
-        o->size = newsize;
-        o->allocd_buf = newbuf;
     }
     
     NCDVal__idx idx = o->used + align_extra;
@@ -232,7 +264,7 @@ static void assert_mem (NCDValMem *mem)
 {
     ASSERT(mem)
     ASSERT(mem->string_index)
-    ASSERT(mem->size == NCDVAL_FASTBUF_SIZE || mem->size >= NCDVAL_FIRST_SIZE)
+    ASSERT(mem->size >= NCDVAL_FASTBUF_SIZE)
     ASSERT(mem->used >= 0)
     ASSERT(mem->used <= mem->size)
 }
@@ -241,7 +273,7 @@ static void assert_external (NCDValMem *mem, const void *e_buf, size_t e_len)
 {
 #ifndef NDEBUG
     const char *e_cbuf = e_buf;
-    char *buf = (mem->size == NCDVAL_FASTBUF_SIZE) ? mem->fastbuf : mem->allocd_buf;
+    char *buf = buffer_base(mem);
     ASSERT(e_cbuf >= buf + mem->size || e_cbuf + e_len <= buf)
 #endif
 }
@@ -297,6 +329,17 @@ static void assert_val_only (NCDValMem *mem, NCDVal__idx idx)
             ASSERT(!exs_e->ref.target || exs_e->ref.next >= -1)
             ASSERT(!exs_e->ref.target || exs_e->ref.next < mem->used)
         } break;
+        case LINK_TYPE: {
+            ASSERT(idx + sizeof(struct NCDVal__link) <= mem->used)
+            struct NCDVal__link *link_e = buffer_at(mem, idx);
+            ASSERT(link_e->target_mem != mem)
+            ASSERT(link_e->target_mem->string_index == mem->string_index)
+            ASSERT(link_e->ref.target)
+            ASSERT(link_e->ref.next >= -1)
+            ASSERT(link_e->ref.next < mem->used)
+            assert_val_only(link_e->target_mem, link_e->target_idx);
+            ASSERT(get_internal_type(*(int *)buffer_at(link_e->target_mem, link_e->target_idx)) != LINK_TYPE)
+        } break;
         default: ASSERT(0);
     }
 #endif
@@ -308,6 +351,21 @@ static void assert_val (NCDValRef val)
     assert_val_only(val.mem, val.idx);
 }
 
+static int is_link (NCDValRef val)
+{
+    return val.idx >= 0 && get_internal_type(*(int *)buffer_at(val.mem, val.idx)) == LINK_TYPE;
+}
+
+static NCDValRef follow_link (NCDValRef val)
+{
+    if (!is_link(val)) {
+        return val;
+    }
+    
+    struct NCDVal__link *link_e = buffer_at(val.mem, val.idx);
+    return make_ref(link_e->target_mem, link_e->target_idx);
+}
+
 static NCDValMapElem make_map_elem (NCDVal__idx elemidx)
 {
     ASSERT(elemidx >= 0 || elemidx == -1)
@@ -369,6 +427,41 @@ static void register_ref (NCDValMem *o, NCDVal__idx refidx, struct NCDVal__ref *
 #include "NCDVal_maptree.h"
 #include <structure/CAvl_impl.h>
 
+static void deref_refs (NCDValMem *o)
+{
+    NCDVal__idx refidx = o->first_ref;
+    while (refidx != -1) {
+        struct NCDVal__ref *ref = buffer_at(o, refidx);
+        ASSERT(ref->target)
+        BRefTarget_Deref(ref->target);
+        refidx = ref->next;
+    }
+}
+
+static int ref_copied_refs (NCDValMem *o)
+{
+    NCDVal__idx refidx = o->first_ref;
+    while (refidx != -1) {
+        struct NCDVal__ref *ref = buffer_at(o, refidx);
+        ASSERT(ref->target)
+        if (!BRefTarget_Ref(ref->target)) {
+            goto fail;
+        }
+        refidx = ref->next;
+    }
+    
+    return 1;
+    
+fail:;
+    NCDVal__idx undo_refidx = o->first_ref;
+    while (undo_refidx != refidx) {
+        struct NCDVal__ref *ref = buffer_at(o, undo_refidx);
+        BRefTarget_Deref(ref->target);
+        undo_refidx = ref->next;
+    }
+    return 0;
+}
+
 void NCDValMem_Init (NCDValMem *o, NCDStringIndex *string_index)
 {
     ASSERT(string_index)
@@ -383,13 +476,7 @@ void NCDValMem_Free (NCDValMem *o)
 {
     assert_mem(o);
     
-    NCDVal__idx refidx = o->first_ref;
-    while (refidx != -1) {
-        struct NCDVal__ref *ref = buffer_at(o, refidx);
-        ASSERT(ref->target)
-        BRefTarget_Deref(ref->target);
-        refidx = ref->next;
-    }
+    deref_refs(o);
     
     if (o->size != NCDVAL_FASTBUF_SIZE) {
         BFree(o->allocd_buf);
@@ -415,25 +502,13 @@ int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other)
         memcpy(o->allocd_buf, other->allocd_buf, other->used);
     }
     
-    NCDVal__idx refidx = o->first_ref;
-    while (refidx != -1) {
-        struct NCDVal__ref *ref = buffer_at(o, refidx);
-        ASSERT(ref->target)
-        if (!BRefTarget_Ref(ref->target)) {
-            goto fail1;
-        }
-        refidx = ref->next;
+    if (!ref_copied_refs(o)) {
+        goto fail1;
     }
     
     return 1;
     
-fail1:;
-    NCDVal__idx undo_refidx = o->first_ref;
-    while (undo_refidx != refidx) {
-        struct NCDVal__ref *ref = buffer_at(o, undo_refidx);
-        BRefTarget_Deref(ref->target);
-        undo_refidx = ref->next;
-    }
+fail1:
     if (other->size != NCDVAL_FASTBUF_SIZE) {
         BFree(o->allocd_buf);
     }
@@ -441,6 +516,66 @@ fail0:
     return 0;
 }
 
+void NCDValMem_Clear (NCDValMem *o)
+{
+    assert_mem(o);
+    
+    deref_refs(o);
+    
+    o->used = 0;
+    o->first_ref = -1;
+}
+
+int NCDValMem_CopyFrom (NCDValMem *o, NCDValMem *other)
+{
+    assert_mem(o);
+    assert_mem(other);
+    ASSERT(o != other)
+    ASSERT(o->string_index == other->string_index)
+    ASSERT(o->used == 0)
+    ASSERT(o->first_ref == -1)
+    
+    if (!buffer_reserve(o, other->used)) {
+        return 0;
+    }
+    
+    memcpy(buffer_base(o), buffer_base(other), other->used);
+    o->used = other->used;
+    o->first_ref = other->first_ref;
+    
+    if (!ref_copied_refs(o)) {
+        o->used = 0;
+        o->first_ref = -1;
+        return 0;
+    }
+    
+    return 1;
+}
+
+void NCDValMem_Compact (NCDValMem *o)
+{
+    assert_mem(o);
+    
+    if (o->size == NCDVAL_FASTBUF_SIZE || o->used == o->size) {
+        return;
+    }
+    
+    if (o->used <= NCDVAL_FASTBUF_SIZE) {
+        // move back to the embedded buffer
+        char *buf = o->allocd_buf;
+        memcpy(o->fastbuf, buf, o->used);
+        BFree(buf);
+        o->size = NCDVAL_FASTBUF_SIZE;
+    } else {
+        // shrink the allocated buffer; keep the old one if that fails
+        char *newbuf = realloc(o->allocd_buf, o->used);
+        if (newbuf) {
+            o->allocd_buf = newbuf;
+            o->size = o->used;
+        }
+    }
+}
+
 NCDStringIndex * NCDValMem_StringIndex (NCDValMem *o)
 {
     assert_mem(o);
@@ -475,6 +610,8 @@ int NCDVal_Type (NCDValRef val)
         return NCDVAL_PLACEHOLDER;
     }
     
+    val = follow_link(val);
+    
     int *type_ptr = buffer_at(val.mem, val.idx);
     
     return get_external_type(*type_ptr);
@@ -609,6 +746,12 @@ NCDValRef NCDVal_NewCopy (NCDValMem *mem, NCDValRef val)
             return NCDVal_NewExternalString(mem, exs_e->data, exs_e->length, exs_e->ref.target);
         } break;
         
+        case LINK_TYPE: {
+            struct NCDVal__link *link_e = ptr;
+            
+            return NCDVal_NewShared(mem, make_ref(link_e->target_mem, link_e->target_idx), link_e->ref.target);
+        } break;
+        
         default: ASSERT(0);
     }
     
@@ -756,6 +899,8 @@ int NCDVal_IsStoredString (NCDValRef val)
 {
     assert_val(val);
     
+    val = follow_link(val);
+    
     return !(val.idx < -1) && get_internal_type(*(int *)buffer_at(val.mem, val.idx)) == STOREDSTRING_TYPE;
 }
 
@@ -763,6 +908,8 @@ int NCDVal_IsIdString (NCDValRef val)
 {
     assert_val(val);
     
+    val = follow_link(val);
+    
     return !(val.idx < -1) && get_internal_type(*(int *)buffer_at(val.mem, val.idx)) == IDSTRING_TYPE;
 }
 
@@ -770,6 +917,8 @@ int NCDVal_IsExternalString (NCDValRef val)
 {
     assert_val(val);
     
+    val = follow_link(val);
+    
     return !(val.idx < -1) && get_internal_type(*(int *)buffer_at(val.mem, val.idx)) == EXTERNALSTRING_TYPE;
 }
 
@@ -905,10 +1054,53 @@ fail:
     return NCDVal_NewInvalid();
 }
 
+NCDValRef NCDVal_NewShared (NCDValMem *mem, NCDValRef val, BRefTarget *ref_target)
+{
+    assert_mem(mem);
+    assert_val(val);
+    ASSERT(!NCDVal_IsPlaceholder(val))
+    ASSERT(ref_target)
+    
+    // never link to a link, point to its target directly
+    if (is_link(val)) {
+        struct NCDVal__link *link_e = buffer_at(val.mem, val.idx);
+        ref_target = link_e->ref.target;
+        val = make_ref(link_e->target_mem, link_e->target_idx);
+    }
+    
+    ASSERT(val.mem != mem)
+    ASSERT(val.mem->string_index == mem->string_index)
+    
+    NCDVal__idx size = sizeof(struct NCDVal__link);
+    NCDVal__idx idx = buffer_allocate(mem, size, __alignof(struct NCDVal__link));
+    if (idx < 0) {
+        goto fail;
+    }
+    
+    if (!BRefTarget_Ref(ref_target)) {
+        goto fail;
+    }
+    
+    struct NCDVal__link *link_e = buffer_at(mem, idx);
+    link_e->type = make_type(LINK_TYPE, get_val_depth(val));
+    link_e->target_idx = val.idx;
+    link_e->target_mem = val.mem;
+    link_e->ref.target = ref_target;
+    
+    register_ref(mem, idx + offsetof(struct NCDVal__link, ref), &link_e->ref);
+    
+    return make_ref(mem, idx);
+    
+fail:
+    return NCDVal_NewInvalid();
+}
+
 const char * NCDVal_StringData (NCDValRef string)
 {
     ASSERT(NCDVal_IsString(string))
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -938,6 +1130,8 @@ size_t NCDVal_StringLength (NCDValRef string)
 {
     ASSERT(NCDVal_IsString(string))
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -966,6 +1160,8 @@ MemRef NCDVal_StringMemRef (NCDValRef string)
 {
     ASSERT(NCDVal_IsString(string))
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -996,6 +1192,8 @@ int NCDVal_StringNullTerminate (NCDValRef string, NCDValNullTermString *out)
     ASSERT(NCDVal_IsString(string))
     ASSERT(out)
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -1051,6 +1249,8 @@ NCD_string_id_t NCDVal_IdStringId (NCDValRef idstring)
 {
     ASSERT(NCDVal_IsIdString(idstring))
     
+    idstring = follow_link(idstring);
+    
     struct NCDVal__idstring *ids_e = buffer_at(idstring.mem, idstring.idx);
     return ids_e->string_id;
 }
@@ -1059,6 +1259,8 @@ BRefTarget * NCDVal_ExternalStringTarget (NCDValRef externalstring)
 {
     ASSERT(NCDVal_IsExternalString(externalstring))
     
+    externalstring = follow_link(externalstring);
+    
     struct NCDVal__externalstring *exs_e = buffer_at(externalstring.mem, externalstring.idx);
     return exs_e->ref.target;
 }
@@ -1067,6 +1269,8 @@ int NCDVal_StringHasNulls (NCDValRef string)
 {
     ASSERT(NCDVal_IsString(string))
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -1101,6 +1305,8 @@ int NCDVal_StringEqualsId (NCDValRef string, NCD_string_id_t string_id)
     ASSERT(NCDVal_IsString(string))
     ASSERT(string_id >= 0)
     
+    string = follow_link(string);
+    
     void *ptr = buffer_at(string.mem, string.idx);
     
     switch (get_internal_type(*(int *)ptr)) {
@@ -1191,6 +1397,7 @@ int NCDVal_ListAppend (NCDValRef list, NCDValRef elem)
 {
     ASSERT(NCDVal_IsList(list))
     ASSERT(NCDVal_ListCount(list) < NCDVal_ListMaxCount(list))
+    ASSERT(!is_link(list))
     ASSERT(elem.mem == list.mem)
     assert_val_only(list.mem, elem.idx);
     
@@ -1211,6 +1418,8 @@ size_t NCDVal_ListCount (NCDValRef list)
 {
     ASSERT(NCDVal_IsList(list))
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     return list_e->count;
@@ -1220,6 +1429,8 @@ size_t NCDVal_ListMaxCount (NCDValRef list)
 {
     ASSERT(NCDVal_IsList(list))
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     return list_e->maxcount;
@@ -1230,6 +1441,8 @@ NCDValRef NCDVal_ListGet (NCDValRef list, size_t pos)
     ASSERT(NCDVal_IsList(list))
     ASSERT(pos < NCDVal_ListCount(list))
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     ASSERT(pos < list_e->count)
@@ -1243,6 +1456,8 @@ int NCDVal_ListRead (NCDValRef list, int num, ...)
     ASSERT(NCDVal_IsList(list))
     ASSERT(num >= 0)
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     if (num != list_e->count) {
@@ -1268,6 +1483,8 @@ int NCDVal_ListReadStart (NCDValRef list, int start, int num, ...)
     ASSERT(start <= NCDVal_ListCount(list))
     ASSERT(num >= 0)
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     if (num != list_e->count - start) {
@@ -1292,6 +1509,8 @@ int NCDVal_ListReadHead (NCDValRef list, int num, ...)
     ASSERT(NCDVal_IsList(list))
     ASSERT(num >= 0)
     
+    list = follow_link(list);
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     if (num > list_e->count) {
@@ -1348,6 +1567,7 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
 {
     ASSERT(NCDVal_IsMap(map))
     ASSERT(NCDVal_MapCount(map) < NCDVal_MapMaxCount(map))
+    ASSERT(!is_link(map))
     ASSERT(key.mem == map.mem)
     ASSERT(val.mem == map.mem)
     assert_val_only(map.mem, key.idx);
@@ -1391,6 +1611,8 @@ size_t NCDVal_MapCount (NCDValRef map)
 {
     ASSERT(NCDVal_IsMap(map))
     
+    map = follow_link(map);
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     return map_e->count;
@@ -1400,6 +1622,8 @@ size_t NCDVal_MapMaxCount (NCDValRef map)
 {
     ASSERT(NCDVal_IsMap(map))
     
+    map = follow_link(map);
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     return map_e->maxcount;
@@ -1416,6 +1640,8 @@ NCDValMapElem NCDVal_MapFirst (NCDValRef map)
 {
     ASSERT(NCDVal_IsMap(map))
     
+    map = follow_link(map);
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     if (map_e->count == 0) {
@@ -1430,6 +1656,7 @@ NCDValMapElem NCDVal_MapFirst (NCDValRef map)
 
 NCDValMapElem NCDVal_MapNext (NCDValRef map, NCDValMapElem me)
 {
+    map = follow_link(map);
     assert_map_elem(map, me);
     
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
@@ -1452,6 +1679,8 @@ NCDValMapElem NCDVal_MapOrderedFirst (NCDValRef map)
 {
     ASSERT(NCDVal_IsMap(map))
     
+    map = follow_link(map);
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     NCDVal__MapTreeRef ref = NCDVal__MapTree_GetFirst(&map_e->tree, map.mem);
@@ -1462,6 +1691,7 @@ NCDValMapElem NCDVal_MapOrderedFirst (NCDValRef map)
 
 NCDValMapElem NCDVal_MapOrderedNext (NCDValRef map, NCDValMapElem me)
 {
+    map = follow_link(map);
     assert_map_elem(map, me);
     
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
@@ -1474,6 +1704,7 @@ NCDValMapElem NCDVal_MapOrderedNext (NCDValRef map, NCDValMapElem me)
 
 NCDValRef NCDVal_MapElemKey (NCDValRef map, NCDValMapElem me)
 {
+    map = follow_link(map);
     assert_map_elem(map, me);
     
     struct NCDVal__mapelem *me_e = buffer_at(map.mem, me.elemidx);
@@ -1483,6 +1714,7 @@ NCDValRef NCDVal_MapElemKey (NCDValRef map, NCDValMapElem me)
 
 NCDValRef NCDVal_MapElemVal (NCDValRef map, NCDValMapElem me)
 {
+    map = follow_link(map);
     assert_map_elem(map, me);
     
     struct NCDVal__mapelem *me_e = buffer_at(map.mem, me.elemidx);
@@ -1495,6 +1727,8 @@ NCDValMapElem NCDVal_MapFindKey (NCDValRef map, NCDValRef key)
     ASSERT(NCDVal_IsMap(map))
     assert_val(key);
     
+    map = follow_link(map);
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     NCDVal__MapTreeRef ref = NCDVal__MapTree_LookupExact(&map_e->tree, map.mem, key);
@@ -1545,7 +1779,8 @@ static void replaceprog_build_recurser (NCDValMem *mem, NCDVal__idx idx, size_t
     switch (get_internal_type(*((int *)(ptr)))) {
         case STOREDSTRING_TYPE:
         case IDSTRING_TYPE:
-        case EXTERNALSTRING_TYPE: {
+        case EXTERNALSTRING_TYPE:
+        case LINK_TYPE: {
         } break;
         
         case NCDVAL_LIST: {
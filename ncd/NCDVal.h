@@ -83,6 +83,31 @@ void NCDValMem_Free (NCDValMem *o);
  */
 int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other) WARN_UNUSED;
 
+/**
+ * Removes all values from a value memory object, but keeps its buffer
+ * so that it can be refilled without allocating memory again.
+ * Any {@link NCDValRef} object pointing to the values must no longer be used.
+ */
+void NCDValMem_Clear (NCDValMem *o);
+
+/**
+ * Like {@link NCDValMem_InitCopy}, but copies into an existing empty memory
+ * object, reusing its buffer if it is large enough.
+ * Both memory objects must use the same string index.
+ * Returns 1 on success and 0 on failure. On failure the memory object
+ * remains empty.
+ */
+int NCDValMem_CopyFrom (NCDValMem *o, NCDValMem *other) WARN_UNUSED;
+
+/**
+ * Shrinks the buffer of a value memory object to the space actually used.
+ * This is intended for memory objects which will not grow any more but
+ * will live for a long time. Existing value references remain valid, but
+ * any pointers into value data (e.g. from {@link NCDVal_StringData})
+ * are invalidated.
+ */
+void NCDValMem_Compact (NCDValMem *o);
+
 /**
  * Get the string index of a value memory object.
  */
@@ -146,9 +171,32 @@ int NCDVal_PlaceholderId (NCDValRef val);
  * object (including 'mem').
  * Returns a reference to the copied value. On out of memory, returns
  * an invalid reference.
+ * Shared values (see {@link NCDVal_NewShared}) are not copied deeply; the
+ * copy shares the same target.
  */
 NCDValRef NCDVal_NewCopy (NCDValMem *mem, NCDValRef val);
 
+/**
+ * Builds a shared value, which stands for a value residing in another memory
+ * object, without copying it. This takes O(1) time regardless of the size
+ * of the value.
+ *
+ * The shared value behaves like the target value in all functions operating
+ * on values, except that it cannot be modified (lists and maps cannot be
+ * appended/inserted into). References to elements of a shared list or map
+ * point into the target's memory object.
+ *
+ * The target's memory object must use the same string index as 'mem', and must
+ * not be modified, moved or freed as long as 'ref_target' is referenced.
+ * A reference to 'ref_target' is taken for as long as the shared value
+ * exists (in 'mem' or in any copy of it). If 'val' is itself a shared value,
+ * the new value shares its target directly and 'ref_target' is ignored.
+ *
+ * Returns a reference to the new value. On failure, returns an invalid
+ * reference.
+ */
+NCDValRef NCDVal_NewShared (NCDValMem *mem, NCDValRef val, BRefTarget *ref_target);
+
 /**
  * Compares two values, both of which must not be invalid references.
  * Returns -1, 0 or 1.
@@ -0,0 +1,256 @@
+/**
+ * @file NCDValBinary.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+
+#include "NCDValBinary.h"
+
+#include <generated/blog_channel_NCDValBinary.h>
+
+#define HEADER_LEN 5
+#define MAX_DEPTH 32
+
+struct decoder {
+    const uint8_t *data;
+    size_t left;
+    NCDValMem *mem;
+};
+
+static int append_header (ExpString *str, uint8_t tag, size_t len)
+{
+    if (len > UINT32_MAX) {
+        BLog(BLOG_ERROR, "value too long");
+        return 0;
+    }
+    
+    uint8_t header[HEADER_LEN];
+    header[0] = tag;
+    uint32_t len_le = htol32(len);
+    memcpy(header + 1, &len_le, sizeof(len_le));
+    
+    if (!ExpString_AppendBinary(str, header, sizeof(header))) {
+        BLog(BLOG_ERROR, "ExpString_AppendBinary failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int encode_val (NCDValRef value, ExpString *str)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    switch (NCDVal_Type(value)) {
+        case NCDVAL_STRING: {
+            MemRef contents = NCDVal_StringMemRef(value);
+            
+            if (!append_header(str, NCDVALBINARY_TAG_STRING, contents.len)) {
+                return 0;
+            }
+            
+            if (!ExpString_AppendBinaryMr(str, contents)) {
+                BLog(BLOG_ERROR, "ExpString_AppendBinaryMr failed");
+                return 0;
+            }
+        } break;
+        
+        case NCDVAL_LIST: {
+            size_t count = NCDVal_ListCount(value);
+            
+            if (!append_header(str, NCDVALBINARY_TAG_LIST, count)) {
+                return 0;
+            }
+            
+            for (size_t i = 0; i < count; i++) {
+                if (!encode_val(NCDVal_ListGet(value, i), str)) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        case NCDVAL_MAP: {
+            if (!append_header(str, NCDVALBINARY_TAG_MAP, NCDVal_MapCount(value))) {
+                return 0;
+            }
+            
+            for (NCDValMapElem e = NCDVal_MapOrderedFirst(value); !NCDVal_MapElemInvalid(e); e = NCDVal_MapOrderedNext(value, e)) {
+                if (!encode_val(NCDVal_MapElemKey(value, e), str) ||
+                    !encode_val(NCDVal_MapElemVal(value, e), str)
+                ) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+    
+    return 1;
+}
+
+static int decode_val (struct decoder *d, int depth, NCDValRef *out)
+{
+    if (depth > MAX_DEPTH) {
+        BLog(BLOG_ERROR, "depth limit exceeded");
+        return 0;
+    }
+    
+    if (d->left < HEADER_LEN) {
+        BLog(BLOG_ERROR, "truncated value header");
+        return 0;
+    }
+    
+    uint8_t tag = d->data[0];
+    uint32_t len_le;
+    memcpy(&len_le, d->data + 1, sizeof(len_le));
+    size_t len = ltoh32(len_le);
+    
+    d->data += HEADER_LEN;
+    d->left -= HEADER_LEN;
+    
+    switch (tag) {
+        case NCDVALBINARY_TAG_STRING: {
+            if (len > d->left) {
+                BLog(BLOG_ERROR, "truncated string");
+                return 0;
+            }
+            
+            *out = NCDVal_NewStringBin(d->mem, d->data, len);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewStringBin failed");
+                return 0;
+            }
+            
+            d->data += len;
+            d->left -= len;
+        } break;
+        
+        case NCDVALBINARY_TAG_LIST: {
+            // each element takes at least a header; this bounds the
+            // preallocation by the size of the input
+            if (len > d->left / HEADER_LEN) {
+                BLog(BLOG_ERROR, "truncated list");
+                return 0;
+            }
+            
+            *out = NCDVal_NewList(d->mem, len);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewList failed");
+                return 0;
+            }
+            
+            for (size_t i = 0; i < len; i++) {
+                NCDValRef elem;
+                if (!decode_val(d, depth + 1, &elem)) {
+                    return 0;
+                }
+                
+                if (!NCDVal_ListAppend(*out, elem)) {
+                    BLog(BLOG_ERROR, "depth limit exceeded");
+                    return 0;
+                }
+            }
+        } break;
+        
+        case NCDVALBINARY_TAG_MAP: {
+            if (len > d->left / (2 * HEADER_LEN)) {
+                BLog(BLOG_ERROR, "truncated map");
+                return 0;
+            }
+            
+            *out = NCDVal_NewMap(d->mem, len);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewMap failed");
+                return 0;
+            }
+            
+            for (size_t i = 0; i < len; i++) {
+                NCDValRef key;
+                NCDValRef val;
+                if (!decode_val(d, depth + 1, &key) || !decode_val(d, depth + 1, &val)) {
+                    return 0;
+                }
+                
+                int inserted;
+                if (!NCDVal_MapInsert(*out, key, val, &inserted)) {
+                    BLog(BLOG_ERROR, "depth limit exceeded");
+                    return 0;
+                }
+                if (!inserted) {
+                    BLog(BLOG_ERROR, "duplicate key in map");
+                    return 0;
+                }
+            }
+        } break;
+        
+        default:
+            BLog(BLOG_ERROR, "bad value tag");
+            return 0;
+    }
+    
+    return 1;
+}
+
+int NCDValBinary_AppendEncode (NCDValRef value, ExpString *str)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    ASSERT(str)
+    
+    return encode_val(value, str);
+}
+
+int NCDValBinary_Decode (MemRef data, NCDValMem *mem, NCDValRef *out_value)
+{
+    ASSERT(data.len == 0 || data.ptr)
+    ASSERT(mem)
+    ASSERT(out_value)
+    
+    struct decoder d;
+    d.data = (const uint8_t *)data.ptr;
+    d.left = data.len;
+    d.mem = mem;
+    
+    NCDValRef value;
+    if (!decode_val(&d, 0, &value)) {
+        return 0;
+    }
+    
+    if (d.left > 0) {
+        BLog(BLOG_ERROR, "trailing data after value");
+        return 0;
+    }
+    
+    *out_value = value;
+    return 1;
+}
@@ -29,7 +29,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <inttypes.h>
 
 #include <misc/debug.h>
 #include <misc/expstring.h>
@@ -39,127 +38,242 @@
 
 #include <generated/blog_channel_NCDValGenerator.h>
 
-static int generate_val (NCDValRef value, ExpString *out_str)
+#define FRAME_STATE_START 1
+#define FRAME_STATE_BODY 2
+#define FRAME_STATE_SEPARATOR 3
+#define FRAME_STATE_KEY 4
+#define FRAME_STATE_COLON 5
+#define FRAME_STATE_VALUE 6
+
+#define READ_CHUNK_SIZE 4096
+
+static void push_frame (NCDValGeneratorStream *o, NCDValRef val)
 {
-    ASSERT(!NCDVal_IsInvalid(value))
+    ASSERT(o->depth < NCDVALGENERATOR_MAX_FRAMES)
+    
+    struct NCDValGenerator__frame *f = &o->frames[o->depth++];
+    f->val = val;
+    f->pos = 0;
+    f->state = FRAME_STATE_START;
+}
+
+static void set_piece (NCDValGeneratorStream *o, const char *str)
+{
+    o->piece_len = strlen(str);
+    ASSERT(o->piece_len <= (int)sizeof(o->piece))
+    memcpy(o->piece, str, o->piece_len);
+    o->piece_pos = 0;
+}
+
+// Advances the generator by one step. Small output is placed into the
+// piece buffer; runs of plain string characters are copied to buf directly.
+static size_t step (NCDValGeneratorStream *o, char *buf, size_t buf_len)
+{
+    ASSERT(o->depth > 0)
+    ASSERT(o->piece_pos == o->piece_len)
     
-    switch (NCDVal_Type(value)) {
+    struct NCDValGenerator__frame *f = &o->frames[o->depth - 1];
+    
+    switch (NCDVal_Type(f->val)) {
         case NCDVAL_STRING: {
-            if (!ExpString_AppendChar(out_str, '"')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
+            if (f->state == FRAME_STATE_START) {
+                set_piece(o, "\"");
+                f->state = FRAME_STATE_BODY;
+                return 0;
             }
             
-            MEMREF_LOOP_CHARS(NCDVal_StringMemRef(value), char_pos, ch, {
-                if (ch == '\0') {
-                    char buf[5];
-                    snprintf(buf, sizeof(buf), "\\x%02"PRIx8, (uint8_t)ch);
-                    
-                    if (!ExpString_Append(out_str, buf)) {
-                        BLog(BLOG_ERROR, "ExpString_Append failed");
-                        goto fail;
-                    }
-                    
-                    goto next_char;
-                }
-                
-                if (ch == '"' || ch == '\\') {
-                    if (!ExpString_AppendChar(out_str, '\\')) {
-                        BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                        goto fail;
-                    }
-                }
-                
-                if (!ExpString_AppendChar(out_str, ch)) {
-                    BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                    goto fail;
-                }
-            next_char:;
-            })
+            MemRef contents = NCDVal_StringMemRef(f->val);
             
-            if (!ExpString_AppendChar(out_str, '"')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
+            if (f->pos == contents.len) {
+                set_piece(o, "\"");
+                o->depth--;
+                return 0;
             }
-        } break;
-        
-        case NCDVAL_LIST: {
-            size_t count = NCDVal_ListCount(value);
             
-            if (!ExpString_AppendChar(out_str, '{')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
+            char ch = contents.ptr[f->pos];
+            
+            if (ch == '\0') {
+                set_piece(o, "\\x00");
+                f->pos++;
+                return 0;
             }
             
-            for (size_t i = 0; i < count; i++) {
-                if (i > 0) {
-                    if (!ExpString_Append(out_str, ", ")) {
-                        BLog(BLOG_ERROR, "ExpString_Append failed");
-                        goto fail;
-                    }
-                }
-                
-                if (!generate_val(NCDVal_ListGet(value, i), out_str)) {
-                    goto fail;
-                }
+            if (ch == '"' || ch == '\\') {
+                char esc[3] = {'\\', ch, '\0'};
+                set_piece(o, esc);
+                f->pos++;
+                return 0;
             }
             
-            if (!ExpString_AppendChar(out_str, '}')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
+            size_t len = 0;
+            while (len < buf_len && f->pos + len < contents.len) {
+                ch = contents.ptr[f->pos + len];
+                if (ch == '\0' || ch == '"' || ch == '\\') {
+                    break;
+                }
+                len++;
             }
+            
+            memcpy(buf, contents.ptr + f->pos, len);
+            f->pos += len;
+            return len;
         } break;
         
-        case NCDVAL_MAP: {
-            if (!ExpString_AppendChar(out_str, '[')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
-            }
-            
-            int is_first = 1;
+        case NCDVAL_LIST: {
+            size_t count = NCDVal_ListCount(f->val);
             
-            for (NCDValMapElem e = NCDVal_MapOrderedFirst(value); !NCDVal_MapElemInvalid(e); e = NCDVal_MapOrderedNext(value, e)) {
-                NCDValRef ekey = NCDVal_MapElemKey(value, e);
-                NCDValRef eval = NCDVal_MapElemVal(value, e);
+            switch (f->state) {
+                case FRAME_STATE_START: {
+                    set_piece(o, "{");
+                    f->state = FRAME_STATE_VALUE;
+                } break;
+                
+                case FRAME_STATE_SEPARATOR: {
+                    set_piece(o, ", ");
+                    f->state = FRAME_STATE_VALUE;
+                } break;
                 
-                if (!is_first) {
-                    if (!ExpString_Append(out_str, ", ")) {
-                        BLog(BLOG_ERROR, "ExpString_Append failed");
-                        goto fail;
+                case FRAME_STATE_VALUE: {
+                    if (f->pos == count) {
+                        set_piece(o, "}");
+                        o->depth--;
+                        break;
                     }
-                }
+                    
+                    NCDValRef elem = NCDVal_ListGet(f->val, f->pos);
+                    f->pos++;
+                    f->state = (f->pos < count) ? FRAME_STATE_SEPARATOR : FRAME_STATE_VALUE;
+                    push_frame(o, elem);
+                } break;
                 
-                if (!generate_val(ekey, out_str)) {
-                    goto fail;
-                }
+                default: ASSERT(0);
+            }
+        } break;
+        
+        case NCDVAL_MAP: {
+            switch (f->state) {
+                case FRAME_STATE_START: {
+                    set_piece(o, "[");
+                    f->elem = NCDVal_MapOrderedFirst(f->val);
+                    f->state = FRAME_STATE_KEY;
+                } break;
                 
-                if (!ExpString_AppendChar(out_str, ':')) {
-                    BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                    goto fail;
-                }
+                case FRAME_STATE_SEPARATOR: {
+                    set_piece(o, ", ");
+                    f->state = FRAME_STATE_KEY;
+                } break;
                 
-                if (!generate_val(eval, out_str)) {
-                    goto fail;
-                }
+                case FRAME_STATE_KEY: {
+                    if (NCDVal_MapElemInvalid(f->elem)) {
+                        set_piece(o, "]");
+                        o->depth--;
+                        break;
+                    }
+                    
+                    f->state = FRAME_STATE_COLON;
+                    push_frame(o, NCDVal_MapElemKey(f->val, f->elem));
+                } break;
                 
-                is_first = 0;
-            }
-            
-            if (!ExpString_AppendChar(out_str, ']')) {
-                BLog(BLOG_ERROR, "ExpString_AppendChar failed");
-                goto fail;
+                case FRAME_STATE_COLON: {
+                    set_piece(o, ":");
+                    f->state = FRAME_STATE_VALUE;
+                } break;
+                
+                case FRAME_STATE_VALUE: {
+                    NCDValRef val = NCDVal_MapElemVal(f->val, f->elem);
+                    f->elem = NCDVal_MapOrderedNext(f->val, f->elem);
+                    f->state = NCDVal_MapElemInvalid(f->elem) ? FRAME_STATE_KEY : FRAME_STATE_SEPARATOR;
+                    push_frame(o, val);
+                } break;
+                
+                default: ASSERT(0);
             }
         } break;
         
         default: ASSERT(0);
     }
     
-    return 1;
-    
-fail:
     return 0;
 }
 
+void NCDValGeneratorStream_Init (NCDValGeneratorStream *o, NCDValRef value)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    o->depth = 0;
+    o->piece_pos = 0;
+    o->piece_len = 0;
+    push_frame(o, value);
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void NCDValGeneratorStream_Free (NCDValGeneratorStream *o)
+{
+    DebugObject_Free(&o->d_obj);
+}
+
+size_t NCDValGeneratorStream_Read (NCDValGeneratorStream *o, char *buf, size_t buf_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(buf_len == 0 || buf)
+    
+    size_t done = 0;
+    
+    while (done < buf_len) {
+        if (o->piece_pos < o->piece_len) {
+            size_t amount = o->piece_len - o->piece_pos;
+            if (amount > buf_len - done) {
+                amount = buf_len - done;
+            }
+            memcpy(buf + done, o->piece + o->piece_pos, amount);
+            o->piece_pos += amount;
+            done += amount;
+            continue;
+        }
+        
+        if (o->depth == 0) {
+            break;
+        }
+        
+        done += step(o, buf + done, buf_len - done);
+    }
+    
+    return done;
+}
+
+int NCDValGeneratorStream_IsDone (NCDValGeneratorStream *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return (o->depth == 0 && o->piece_pos == o->piece_len);
+}
+
+static int generate_val (NCDValRef value, ExpString *out_str)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    NCDValGeneratorStream stream;
+    NCDValGeneratorStream_Init(&stream, value);
+    
+    int res = 0;
+    
+    while (!NCDValGeneratorStream_IsDone(&stream)) {
+        char buf[READ_CHUNK_SIZE];
+        size_t len = NCDValGeneratorStream_Read(&stream, buf, sizeof(buf));
+        
+        if (!ExpString_AppendBinary(out_str, (const uint8_t *)buf, len)) {
+            BLog(BLOG_ERROR, "ExpString_AppendBinary failed");
+            goto out;
+        }
+    }
+    
+    res = 1;
+    
+out:
+    NCDValGeneratorStream_Free(&stream);
+    return res;
+}
 char * NCDValGenerator_Generate (NCDValRef value)
 {
     ASSERT(!NCDVal_IsInvalid(value))
@@ -30,11 +30,54 @@
 #ifndef BADVPN_NCDVALUEGENERATOR_H
 #define BADVPN_NCDVALUEGENERATOR_H
 
+#include <stddef.h>
+
 #include <misc/debug.h>
 #include <misc/expstring.h>
+#include <base/DebugObject.h>
 #include <ncd/NCDVal.h>
 
+// one more than the maximum depth of a value, for the strings at the bottom
+#define NCDVALGENERATOR_MAX_FRAMES 33
+
+struct NCDValGenerator__frame {
+    NCDValRef val;
+    size_t pos;
+    NCDValMapElem elem;
+    int state;
+};
+
+/**
+ * Pull-style generator, producing the textual representation of a value
+ * piece by piece into buffers supplied by the caller. The value must not
+ * be modified while it is being generated.
+ */
+typedef struct {
+    int depth;
+    int piece_pos;
+    int piece_len;
+    char piece[4];
+    struct NCDValGenerator__frame frames[NCDVALGENERATOR_MAX_FRAMES];
+    DebugObject d_obj;
+} NCDValGeneratorStream;
+
 char * NCDValGenerator_Generate (NCDValRef value);
 int NCDValGenerator_AppendGenerate (NCDValRef value, ExpString *str) WARN_UNUSED;
 
+void NCDValGeneratorStream_Init (NCDValGeneratorStream *o, NCDValRef value);
+void NCDValGeneratorStream_Free (NCDValGeneratorStream *o);
+
+/**
+ * Produces the next part of the text into a buffer.
+ * 
+ * @return number of bytes written, which is less than buf_len only if the
+ *         end of the text was reached
+ */
+size_t NCDValGeneratorStream_Read (NCDValGeneratorStream *o, char *buf, size_t buf_len);
+
+/**
+ * Returns whether all of the text has been produced.
+ */
+int NCDValGeneratorStream_IsDone (NCDValGeneratorStream *o);
+
 #endif
@@ -55,13 +55,13 @@ struct value {
 #define ERROR_FLAG_DUPLICATE_KEY (1 << 3)
 #define ERROR_FLAG_DEPTH         (1 << 4)
 
-struct parser_state {
-    NCDValCons cons;
-    NCDValRef value;
-    int cons_error;
-    int error_flags;
-    void *parser;
-};
+#define SCAN_STATE_NORMAL 1
+#define SCAN_STATE_STRING 2
+#define SCAN_STATE_STRING_ESCAPE 3
+#define SCAN_STATE_COMMENT 4
+
+// the parser state is the stream object itself
+#define parser_state NCDValParserStream_s
 
 static void free_token (struct token o)
 {
@@ -103,6 +103,17 @@ static int tokenizer_output (void *user, int token, char *value, size_t value_le
     struct parser_state *state = user;
     ASSERT(!state->error_flags)
     
+    // the tokenizer counts from the start of the chunk
+    if (line == 1) {
+        line_char += state->line_char - 1;
+    }
+    line += state->line - 1;
+    
+    // the end of a chunk is not the end of input
+    if (token == NCD_EOF && state->feeding) {
+        return 1;
+    }
+    
     if (token == NCD_ERROR) {
         state->error_flags |= ERROR_FLAG_TOKENIZATION;
         goto fail;
@@ -183,43 +194,242 @@ fail:
     return 0;
 }
 
-int NCDValParser_Parse (MemRef str, NCDValMem *mem, NCDValRef *out_value)
+static int is_boundary_char (char ch)
 {
-    ASSERT(str.len == 0 || str.ptr)
-    ASSERT(mem)
-    ASSERT(out_value)
+    switch (ch) {
+        case '{': case '}': case '[': case ']': case ',': case ':':
+        case ' ': case '\t': case '\n': case '\r':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Advances the scanner over data, returning the length of the longest
+// prefix which ends at a token boundary (and so can be tokenized alone).
+static size_t scan (NCDValParserStream *o, const char *data, size_t len)
+{
+    size_t safe_len = 0;
     
-    int ret = 0;
+    for (size_t i = 0; i < len; i++) {
+        char ch = data[i];
+        
+        switch (o->scan_state) {
+            case SCAN_STATE_NORMAL: {
+                if (ch == '"') {
+                    o->scan_state = SCAN_STATE_STRING;
+                }
+                else if (ch == '#') {
+                    o->scan_state = SCAN_STATE_COMMENT;
+                }
+                else if (is_boundary_char(ch)) {
+                    safe_len = i + 1;
+                }
+            } break;
+            
+            case SCAN_STATE_STRING: {
+                if (ch == '\\') {
+                    o->scan_state = SCAN_STATE_STRING_ESCAPE;
+                }
+                else if (ch == '"') {
+                    o->scan_state = SCAN_STATE_NORMAL;
+                    safe_len = i + 1;
+                }
+            } break;
+            
+            case SCAN_STATE_STRING_ESCAPE: {
+                o->scan_state = SCAN_STATE_STRING;
+            } break;
+            
+            case SCAN_STATE_COMMENT: {
+                if (ch == '\n') {
+                    o->scan_state = SCAN_STATE_NORMAL;
+                    safe_len = i + 1;
+                }
+            } break;
+            
+            default: ASSERT(0);
+        }
+    }
+    
+    return safe_len;
+}
+
+static void tokenize (NCDValParserStream *o, MemRef data, int feeding)
+{
+    o->feeding = feeding;
+    
+    NCDConfigTokenizer_Tokenize(data, tokenizer_output, o);
+    
+    // update position for the next chunk
+    MEMREF_LOOP_CHARS(data, char_pos, ch, {
+        if (ch == '\n') {
+            o->line++;
+            o->line_char = 1;
+        } else {
+            o->line_char++;
+        }
+    })
+}
+
+static int append_pending (NCDValParserStream *o, const char *data, size_t len)
+{
+    if (len > o->pending_cap - o->pending_len) {
+        size_t new_cap = (o->pending_cap > 0) ? o->pending_cap : 64;
+        while (new_cap - o->pending_len < len) {
+            if (new_cap > SIZE_MAX / 2) {
+                return 0;
+            }
+            new_cap *= 2;
+        }
+        
+        char *new_pending = realloc(o->pending, new_cap);
+        if (!new_pending) {
+            return 0;
+        }
+        
+        o->pending = new_pending;
+        o->pending_cap = new_cap;
+    }
     
-    struct parser_state state;
-    state.value = NCDVal_NewInvalid();
-    state.error_flags = 0;
+    memcpy(o->pending + o->pending_len, data, len);
+    o->pending_len += len;
     
-    if (!NCDValCons_Init(&state.cons, mem)) {
+    return 1;
+}
+
+int NCDValParserStream_Init (NCDValParserStream *o, NCDValMem *mem)
+{
+    ASSERT(mem)
+    
+    o->value = NCDVal_NewInvalid();
+    o->error_flags = 0;
+    o->pending = NULL;
+    o->pending_len = 0;
+    o->pending_cap = 0;
+    o->scan_state = SCAN_STATE_NORMAL;
+    o->feeding = 0;
+    o->line = 1;
+    o->line_char = 1;
+    
+    if (!NCDValCons_Init(&o->cons, mem)) {
         BLog(BLOG_ERROR, "NCDValCons_Init failed");
         goto fail0;
     }
     
-    if (!(state.parser = ParseAlloc(malloc))) {
+    if (!(o->parser = ParseAlloc(malloc))) {
         BLog(BLOG_ERROR, "ParseAlloc failed");
         goto fail1;
     }
     
-    NCDConfigTokenizer_Tokenize(str, tokenizer_output, &state);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    NCDValCons_Free(&o->cons);
+fail0:
+    return 0;
+}
+
+void NCDValParserStream_Free (NCDValParserStream *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    free(o->pending);
+    ParseFree(o->parser, free);
+    NCDValCons_Free(&o->cons);
+}
+
+int NCDValParserStream_Feed (NCDValParserStream *o, MemRef data)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data.len == 0 || data.ptr)
+    ASSERT(!o->error_flags)
+    
+    if (o->pending_len == 0) {
+        // tokenize complete tokens right from the input, and keep only the rest
+        size_t safe_len = scan(o, data.ptr, data.len);
+        
+        if (safe_len > 0) {
+            tokenize(o, MemRef_Make(data.ptr, safe_len), 1);
+            if (o->error_flags) {
+                return 0;
+            }
+        }
+        
+        if (!append_pending(o, data.ptr + safe_len, data.len - safe_len)) {
+            BLog(BLOG_ERROR, "out of memory for pending input");
+            o->error_flags |= ERROR_FLAG_MEMORY;
+            return 0;
+        }
+    } else {
+        // scan the new data as a continuation of the pending data
+        size_t old_len = o->pending_len;
+        
+        if (!append_pending(o, data.ptr, data.len)) {
+            BLog(BLOG_ERROR, "out of memory for pending input");
+            o->error_flags |= ERROR_FLAG_MEMORY;
+            return 0;
+        }
+        
+        size_t safe_len = scan(o, data.ptr, data.len);
+        
+        if (safe_len > 0) {
+            safe_len += old_len;
+            
+            tokenize(o, MemRef_Make(o->pending, safe_len), 1);
+            if (o->error_flags) {
+                return 0;
+            }
+            
+            memmove(o->pending, o->pending + safe_len, o->pending_len - safe_len);
+            o->pending_len -= safe_len;
+        }
+    }
+    
+    return 1;
+}
+
+int NCDValParserStream_Finish (NCDValParserStream *o, NCDValRef *out_value)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->error_flags)
+    ASSERT(out_value)
+    
+    tokenize(o, MemRef_Make(o->pending, o->pending_len), 0);
+    o->pending_len = 0;
+    
+    if (o->error_flags) {
+        return 0;
+    }
+    
+    ASSERT(!NCDVal_IsInvalid(o->value))
+    
+    *out_value = o->value;
+    return 1;
+}
+
+int NCDValParser_Parse (MemRef str, NCDValMem *mem, NCDValRef *out_value)
+{
+    ASSERT(str.len == 0 || str.ptr)
+    ASSERT(mem)
+    ASSERT(out_value)
+    
+    int ret = 0;
     
-    ParseFree(state.parser, free);
+    NCDValParserStream stream;
+    if (!NCDValParserStream_Init(&stream, mem)) {
+        goto fail0;
+    }
     
-    if (state.error_flags) {
+    if (!NCDValParserStream_Feed(&stream, str) || !NCDValParserStream_Finish(&stream, out_value)) {
         goto fail1;
     }
     
-    ASSERT(!NCDVal_IsInvalid(state.value))
-    
-    *out_value = state.value;
     ret = 1;
     
 fail1:
-    NCDValCons_Free(&state.cons);
+    NCDValParserStream_Free(&stream);
 fail0:
     return ret;
 }
@@ -34,7 +34,32 @@
 
 #include <misc/debug.h>
 #include <misc/memref.h>
+#include <base/DebugObject.h>
 #include <ncd/NCDVal.h>
+#include <ncd/NCDValCons.h>
+
+/**
+ * Incremental parser for NCD value strings. The input is fed in chunks
+ * of arbitrary size; complete tokens are handed to the parser as soon as
+ * they are available, so only an incomplete trailing token is buffered.
+ */
+typedef struct NCDValParserStream_s {
+    NCDValCons cons;
+    NCDValRef value;
+    int cons_error;
+    int error_flags;
+    void *parser;
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    size_t scan_pos;
+    size_t safe_len;
+    int scan_state;
+    int feeding;
+    size_t line;
+    size_t line_char;
+    DebugObject d_obj;
+} NCDValParserStream;
 
 /**
  * Parses an NCD value string into {@link NCDVal} compact representation.
@@ -48,4 +73,37 @@
  */
 int NCDValParser_Parse (MemRef str, NCDValMem *mem, NCDValRef *out_value) WARN_UNUSED;
 
+/**
+ * Initializes an incremental parser.
+ * 
+ * @param o the object
+ * @param mem value memory object which the result will be stored in
+ * @return 1 on success, 0 on failure
+ */
+int NCDValParserStream_Init (NCDValParserStream *o, NCDValMem *mem) WARN_UNUSED;
+
+/**
+ * Frees the parser. Values already built in the memory object remain
+ * there.
+ */
+void NCDValParserStream_Free (NCDValParserStream *o);
+
+/**
+ * Feeds the next chunk of input. After a failure, the parser may only
+ * be freed.
+ * 
+ * @return 1 on success, 0 on failure
+ */
+int NCDValParserStream_Feed (NCDValParserStream *o, MemRef data) WARN_UNUSED;
+
+/**
+ * Signals the end of input and retrieves the parsed value. After this,
+ * the parser may only be freed.
+ * 
+ * @param out_value on success, the value reference of the result will be
+ *                  written here
+ * @return 1 on success, 0 on failure
+ */
+int NCDValParserStream_Finish (NCDValParserStream *o, NCDValRef *out_value) WARN_UNUSED;
+
 #endif
@@ -109,6 +109,10 @@ void emncd_start (const char *program_text, int loglevel)
     params.retry_time = 5000;
     params.extra_args = NULL;
     params.num_extra_args = 0;
+    params.profile = 0;
+    params.process_cache_size = 1;
+    params.cache_confs = NULL;
+    params.num_cache_confs = 0;
     params.reactor = &reactor;
     
     if (!NCDInterpreter_Init(&interpreter, program, params)) {
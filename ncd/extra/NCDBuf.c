@@ -40,12 +40,33 @@ static void ref_target_func_release (BRefTarget *ref_target)
     
     if (store) {
         LinkedList0_Remove(&store->used_bufs_list, &o->list_node);
+        
+        // buffers of an old size are not reused
+        if (o->size != store->buf_size) {
+            BFree(o);
+            return;
+        }
+        
         LinkedList0_Prepend(&store->free_bufs_list, &o->list_node);
     } else {
         BFree(o);
     }
 }
 
+static void free_free_bufs (NCDBufStore *o)
+{
+    LinkedList0Node *ln = LinkedList0_GetFirst(&o->free_bufs_list);
+    while (ln) {
+        LinkedList0Node *next_ln = LinkedList0Node_Next(ln);
+        NCDBuf *buf = UPPER_OBJECT(ln, NCDBuf, list_node);
+        ASSERT(buf->store == o)
+        BFree(buf);
+        ln = next_ln;
+    }
+    
+    LinkedList0_Init(&o->free_bufs_list);
+}
+
 void NCDBufStore_Init (NCDBufStore *o, size_t buf_size)
 {
     o->buf_size = buf_size;
@@ -59,9 +80,7 @@ void NCDBufStore_Free (NCDBufStore *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    LinkedList0Node *ln;
-    
-    ln = LinkedList0_GetFirst(&o->used_bufs_list);
+    LinkedList0Node *ln = LinkedList0_GetFirst(&o->used_bufs_list);
     while (ln) {
         NCDBuf *buf = UPPER_OBJECT(ln, NCDBuf, list_node);
         ASSERT(buf->store == o)
@@ -69,14 +88,7 @@ void NCDBufStore_Free (NCDBufStore *o)
         ln = LinkedList0Node_Next(ln);
     }
     
-    ln = LinkedList0_GetFirst(&o->free_bufs_list);
-    while (ln) {
-        LinkedList0Node *next_ln = LinkedList0Node_Next(ln);
-        NCDBuf *buf = UPPER_OBJECT(ln, NCDBuf, list_node);
-        ASSERT(buf->store == o)
-        BFree(buf);
-        ln = next_ln;
-    }
+    free_free_bufs(o);
 }
 
 size_t NCDBufStore_BufSize (NCDBufStore *o)
@@ -86,6 +98,21 @@ size_t NCDBufStore_BufSize (NCDBufStore *o)
     return o->buf_size;
 }
 
+void NCDBufStore_SetBufSize (NCDBufStore *o, size_t buf_size)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (buf_size == o->buf_size) {
+        return;
+    }
+    
+    // drop cached buffers of the old size; buffers still in use
+    // are freed when released
+    free_free_bufs(o);
+    
+    o->buf_size = buf_size;
+}
+
 NCDBuf * NCDBufStore_GetBuf (NCDBufStore *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -104,6 +131,7 @@ NCDBuf * NCDBufStore_GetBuf (NCDBufStore *o)
             return NULL;
         }
         buf->store = o;
+        buf->size = o->buf_size;
     }
     
     LinkedList0_Prepend(&o->used_bufs_list, &buf->list_node);
@@ -45,6 +45,7 @@ typedef struct {
 
 typedef struct {
     NCDBufStore *store;
+    size_t size;
     LinkedList0Node list_node;
     BRefTarget ref_target;
     char data[];
@@ -53,6 +54,7 @@ typedef struct {
 void NCDBufStore_Init (NCDBufStore *o, size_t buf_size);
 void NCDBufStore_Free (NCDBufStore *o);
 size_t NCDBufStore_BufSize (NCDBufStore *o);
+void NCDBufStore_SetBufSize (NCDBufStore *o, size_t buf_size);
 NCDBuf * NCDBufStore_GetBuf (NCDBufStore *o);
 
 BRefTarget * NCDBuf_RefTarget (NCDBuf *o);
@@ -40,6 +40,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <linux/if_tun.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
 #include <pwd.h>
   
 #include <misc/debug.h>
@@ -49,11 +54,20 @@
 
 #include <generated/blog_channel_NCDIfConfig.h>
 
-#define IP_CMD "ip"
 #define MODPROBE_CMD "modprobe"
 #define RESOLVCONF_FILE "/etc/resolv.conf"
 #define RESOLVCONF_TEMP_FILE "/etc/resolv.conf-ncd-temp"
 #define TUN_DEVNODE "/dev/net/tun"
+#define NL_MAX_BATCH 16
+
+struct nl_msg {
+    struct nlmsghdr nlh;
+    char data[256];
+};
+
+// rtnetlink socket shared by all operations, opened on first use
+static int nl_fd = -1;
+static uint32_t nl_seq;
 
 static int run_command (const char *cmd)
 {
@@ -111,30 +125,218 @@ fail0:
     return flags;
 }
 
-int NCDIfConfig_set_up (const char *ifname)
+static int nl_open (void)
+{
+    if (nl_fd >= 0) {
+        return 1;
+    }
+    
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        BLog(BLOG_ERROR, "netlink socket failed");
+        return 0;
+    }
+    
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        BLog(BLOG_ERROR, "netlink bind failed");
+        close(fd);
+        return 0;
+    }
+    
+    nl_fd = fd;
+    return 1;
+}
+
+static void nl_close (void)
+{
+    if (nl_fd >= 0) {
+        close(nl_fd);
+        nl_fd = -1;
+    }
+}
+
+static void nl_msg_init (struct nl_msg *m, uint16_t type, uint16_t flags, const void *payload, size_t payload_len)
+{
+    ASSERT(NLMSG_SPACE(payload_len) <= sizeof(*m))
+    
+    memset(m, 0, sizeof(*m));
+    m->nlh.nlmsg_len = NLMSG_LENGTH(payload_len);
+    m->nlh.nlmsg_type = type;
+    m->nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    memcpy(NLMSG_DATA(&m->nlh), payload, payload_len);
+}
+
+static void nl_msg_add_attr (struct nl_msg *m, int type, const void *data, size_t len)
+{
+    size_t offset = NLMSG_ALIGN(m->nlh.nlmsg_len);
+    ASSERT(offset + RTA_SPACE(len) <= sizeof(*m))
+    
+    struct rtattr *rta = (struct rtattr *)((char *)m + offset);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    m->nlh.nlmsg_len = offset + RTA_ALIGN(rta->rta_len);
+}
+
+static int nl_transact (struct nl_msg **msgs, size_t num_msgs)
+{
+    ASSERT(num_msgs > 0)
+    ASSERT(num_msgs <= NL_MAX_BATCH)
+    
+    if (!nl_open()) {
+        return 0;
+    }
+    
+    // number the requests and submit them together
+    uint32_t first_seq = nl_seq + 1;
+    struct iovec iov[NL_MAX_BATCH];
+    for (size_t j = 0; j < num_msgs; j++) {
+        msgs[j]->nlh.nlmsg_seq = ++nl_seq;
+        iov[j].iov_base = msgs[j];
+        iov[j].iov_len = msgs[j]->nlh.nlmsg_len;
+    }
+    
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &sa;
+    mh.msg_namelen = sizeof(sa);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = num_msgs;
+    
+    if (sendmsg(nl_fd, &mh, 0) < 0) {
+        BLog(BLOG_ERROR, "netlink sendmsg failed");
+        goto fail;
+    }
+    
+    // collect one ack for each request
+    int res = 1;
+    size_t acks_left = num_msgs;
+    while (acks_left > 0) {
+        union {
+            struct nlmsghdr nlh;
+            char buf[8192];
+        } rbuf;
+        
+        ssize_t len = recv(nl_fd, &rbuf, sizeof(rbuf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BLog(BLOG_ERROR, "netlink recv failed");
+            goto fail;
+        }
+        
+        int left = len;
+        for (struct nlmsghdr *nh = &rbuf.nlh; NLMSG_OK(nh, left); nh = NLMSG_NEXT(nh, left)) {
+            // ignore anything not answering this batch
+            if (nh->nlmsg_type != NLMSG_ERROR || nh->nlmsg_seq - first_seq >= num_msgs) {
+                continue;
+            }
+            
+            if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                BLog(BLOG_ERROR, "netlink ack too short");
+                goto fail;
+            }
+            
+            struct nlmsgerr *err = NLMSG_DATA(nh);
+            if (err->error != 0) {
+                BLog(BLOG_ERROR, "netlink request failed: %s", strerror(-err->error));
+                res = 0;
+            }
+            
+            acks_left--;
+        }
+    }
+    
+    return res;
+    
+fail:
+    // drop the socket so that stray replies cannot confuse later requests
+    nl_close();
+    return 0;
+}
+
+static int nl_transact1 (struct nl_msg *m)
+{
+    return nl_transact(&m, 1);
+}
+
+static int get_ifindex (const char *ifname)
 {
     if (strlen(ifname) >= IFNAMSIZ) {
         BLog(BLOG_ERROR, "ifname too long");
         return 0;
     }
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" link set %s up", ifname);
+    unsigned int index = if_nametoindex(ifname);
+    if (index == 0 || index > INT_MAX) {
+        BLog(BLOG_ERROR, "unknown interface %s", ifname);
+        return 0;
+    }
     
-    return !run_command(cmd);
+    return index;
+}
+
+static int set_link_flags (const char *ifname, unsigned int flags)
+{
+    int index = get_ifindex(ifname);
+    if (!index) {
+        return 0;
+    }
+    
+    BLog(BLOG_INFO, "link %s %s", ifname, (flags & IFF_UP) ? "up" : "down");
+    
+    struct ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = index;
+    ifi.ifi_flags = flags;
+    ifi.ifi_change = IFF_UP;
+    
+    struct nl_msg m;
+    nl_msg_init(&m, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+    
+    return nl_transact1(&m);
+}
+
+int NCDIfConfig_set_up (const char *ifname)
+{
+    return set_link_flags(ifname, IFF_UP);
 }
 
 int NCDIfConfig_set_down (const char *ifname)
 {
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    return set_link_flags(ifname, 0);
+}
+
+static int addr_msg (int add, const char *ifname, int family, const void *addr, size_t addr_len, int prefix)
+{
+    int index = get_ifindex(ifname);
+    if (!index) {
         return 0;
     }
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" link set %s down", ifname);
+    struct ifaddrmsg ifa;
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = family;
+    ifa.ifa_prefixlen = prefix;
+    ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa.ifa_index = index;
     
-    return !run_command(cmd);
+    struct nl_msg m;
+    nl_msg_init(&m, (add ? RTM_NEWADDR : RTM_DELADDR), (add ? NLM_F_CREATE | NLM_F_EXCL : 0), &ifa, sizeof(ifa));
+    nl_msg_add_attr(&m, IFA_LOCAL, addr, addr_len);
+    nl_msg_add_attr(&m, IFA_ADDRESS, addr, addr_len);
+    
+    return nl_transact1(&m);
 }
 
 int NCDIfConfig_add_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
@@ -142,17 +344,10 @@ int NCDIfConfig_add_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
     ASSERT(ifaddr.prefix >= 0)
     ASSERT(ifaddr.prefix <= 32)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     uint8_t *addr = (uint8_t *)&ifaddr.addr;
+    BLog(BLOG_INFO, "addr add %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr add %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
-    
-    return !run_command(cmd);
+    return addr_msg(1, ifname, AF_INET, &ifaddr.addr, sizeof(ifaddr.addr), ifaddr.prefix);
 }
 
 int NCDIfConfig_remove_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
@@ -160,17 +355,10 @@ int NCDIfConfig_remove_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
     ASSERT(ifaddr.prefix >= 0)
     ASSERT(ifaddr.prefix <= 32)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     uint8_t *addr = (uint8_t *)&ifaddr.addr;
+    BLog(BLOG_INFO, "addr del %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr del %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
-    
-    return !run_command(cmd);
+    return addr_msg(0, ifname, AF_INET, &ifaddr.addr, sizeof(ifaddr.addr), ifaddr.prefix);
 }
 
 int NCDIfConfig_add_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
@@ -178,18 +366,11 @@ int NCDIfConfig_add_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
     ASSERT(ifaddr.prefix >= 0)
     ASSERT(ifaddr.prefix <= 128)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     char addr_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(ifaddr.addr, addr_str);
+    BLog(BLOG_INFO, "addr add %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
     
-    char cmd[40 + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr add %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
-    
-    return !run_command(cmd);
+    return addr_msg(1, ifname, AF_INET6, ifaddr.addr.bytes, sizeof(ifaddr.addr.bytes), ifaddr.prefix);
 }
 
 int NCDIfConfig_remove_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
@@ -197,18 +378,52 @@ int NCDIfConfig_remove_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
     ASSERT(ifaddr.prefix >= 0)
     ASSERT(ifaddr.prefix <= 128)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    char addr_str[IPADDR6_PRINT_MAX];
+    ipaddr6_print_addr(ifaddr.addr, addr_str);
+    BLog(BLOG_INFO, "addr del %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
+    
+    return addr_msg(0, ifname, AF_INET6, ifaddr.addr.bytes, sizeof(ifaddr.addr.bytes), ifaddr.prefix);
+}
+
+static int route_msg (int add, int family, const void *dest, size_t addr_len, int prefix, const void *gateway, int metric, const char *ifname, int type)
+{
+    ASSERT(type == RTN_UNICAST || type == RTN_BLACKHOLE)
+    ASSERT(type == RTN_UNICAST || (!gateway && !ifname))
+    
+    int index = 0;
+    if (ifname && !(index = get_ifindex(ifname))) {
         return 0;
     }
     
-    char addr_str[IPADDR6_PRINT_MAX];
-    ipaddr6_print_addr(ifaddr.addr, addr_str);
+    // same defaults as "ip route"
+    struct rtmsg rt;
+    memset(&rt, 0, sizeof(rt));
+    rt.rtm_family = family;
+    rt.rtm_dst_len = prefix;
+    rt.rtm_table = RT_TABLE_MAIN;
+    rt.rtm_type = type;
+    if (add) {
+        rt.rtm_protocol = RTPROT_BOOT;
+        rt.rtm_scope = (type == RTN_UNICAST && !gateway) ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+    } else {
+        rt.rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    
+    uint32_t priority = metric;
     
-    char cmd[40 + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr del %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
+    struct nl_msg m;
+    nl_msg_init(&m, (add ? RTM_NEWROUTE : RTM_DELROUTE), (add ? NLM_F_CREATE | NLM_F_EXCL : 0), &rt, sizeof(rt));
+    nl_msg_add_attr(&m, RTA_DST, dest, addr_len);
+    if (gateway) {
+        nl_msg_add_attr(&m, RTA_GATEWAY, gateway, addr_len);
+    }
+    nl_msg_add_attr(&m, RTA_PRIORITY, &priority, sizeof(priority));
+    if (ifname) {
+        uint32_t oif = index;
+        nl_msg_add_attr(&m, RTA_OIF, &oif, sizeof(oif));
+    }
     
-    return !run_command(cmd);
+    return nl_transact1(&m);
 }
 
 static int route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *ifname)
@@ -217,11 +432,6 @@ static int route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, const uint32
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 32)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     uint8_t *d_addr = (uint8_t *)&dest.addr;
     
     char gwstr[30];
@@ -232,11 +442,10 @@ static int route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, const uint32
         gwstr[0] = '\0';
     }
     
-    char cmd[120 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" route %s %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d%s metric %d dev %s",
-            cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, gwstr, metric, ifname);
+    BLog(BLOG_INFO, "route %s %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d%s metric %d dev %s",
+         cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, gwstr, metric, ifname);
     
-    return !run_command(cmd);
+    return route_msg(!strcmp(cmdtype, "add"), AF_INET, &dest.addr, sizeof(dest.addr), dest.prefix, gateway, metric, ifname, RTN_UNICAST);
 }
 
 int NCDIfConfig_add_ipv4_route (struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *device)
@@ -255,11 +464,6 @@ static int route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, const struc
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 128)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     char dest_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(dest.addr, dest_str);
     
@@ -271,11 +475,9 @@ static int route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, const struc
         gwstr[0] = '\0';
     }
     
-    char cmd[70 + IPADDR6_PRINT_MAX + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" route %s %s/%d%s metric %d dev %s",
-            cmdtype, dest_str, dest.prefix, gwstr, metric, ifname);
+    BLog(BLOG_INFO, "route %s %s/%d%s metric %d dev %s", cmdtype, dest_str, dest.prefix, gwstr, metric, ifname);
     
-    return !run_command(cmd);
+    return route_msg(!strcmp(cmdtype, "add"), AF_INET6, dest.addr.bytes, sizeof(dest.addr.bytes), dest.prefix, (gateway ? gateway->bytes : NULL), metric, ifname, RTN_UNICAST);
 }
 
 int NCDIfConfig_add_ipv6_route (struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *device)
@@ -295,12 +497,10 @@ static int blackhole_route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, in
     ASSERT(dest.prefix <= 32)
     
     uint8_t *d_addr = (uint8_t *)&dest.addr;
+    BLog(BLOG_INFO, "route %s blackhole %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d metric %d",
+         cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, metric);
     
-    char cmd[120];
-    sprintf(cmd, IP_CMD" route %s blackhole %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d metric %d",
-            cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, metric);
-    
-    return !run_command(cmd);
+    return route_msg(!strcmp(cmdtype, "add"), AF_INET, &dest.addr, sizeof(dest.addr), dest.prefix, NULL, metric, NULL, RTN_BLACKHOLE);
 }
 
 int NCDIfConfig_add_ipv4_blackhole_route (struct ipv4_ifaddr dest, int metric)
@@ -321,12 +521,9 @@ static int blackhole_route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, i
     
     char dest_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(dest.addr, dest_str);
+    BLog(BLOG_INFO, "route %s blackhole %s/%d metric %d", cmdtype, dest_str, dest.prefix, metric);
     
-    char cmd[70 + IPADDR6_PRINT_MAX];
-    sprintf(cmd, IP_CMD" route %s blackhole %s/%d metric %d",
-            cmdtype, dest_str, dest.prefix, metric);
-    
-    return !run_command(cmd);
+    return route_msg(!strcmp(cmdtype, "add"), AF_INET6, dest.addr.bytes, sizeof(dest.addr.bytes), dest.prefix, NULL, metric, NULL, RTN_BLACKHOLE);
 }
 
 int NCDIfConfig_add_ipv6_blackhole_route (struct ipv6_ifaddr dest, int metric)
@@ -38,6 +38,7 @@
 #include <linux/rtnetlink.h>
 #include <asm/types.h>
 #include <asm/types.h>
+#include <errno.h>
 
 #include <misc/debug.h>
 #include <misc/nonblocking.h>
@@ -49,35 +50,54 @@
 
 #define IFA_RTA(r) ((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ifaddrmsg))))
 
-static int send_wilddump_request (NCDInterfaceMonitor *o, int fd, uint32_t seq, int family, int type);
+static int send_dump_request (NCDInterfaceMonitor *o, int fd, uint32_t seq, int family, int type);
 static int get_attr (int type, struct rtattr *rta, int rta_len, void **out_attr, int *out_attr_len);
 static void report_error (NCDInterfaceMonitor *o);
 static int send_next_dump_request (NCDInterfaceMonitor *o);
 static void netlink_fd_handler (NCDInterfaceMonitor *o, int events);
-static void process_buffer (NCDInterfaceMonitor *o);
+static void collect_events (NCDInterfaceMonitor *o);
 static void more_job_handler (NCDInterfaceMonitor *o);
 
-static int send_wilddump_request (NCDInterfaceMonitor *o, int fd, uint32_t seq, int family, int type)
+static int send_dump_request (NCDInterfaceMonitor *o, int fd, uint32_t seq, int family, int type)
 {
-    struct {
-        struct nlmsghdr nlh;
-        struct rtgenmsg g;
+    union {
+        struct {
+            struct nlmsghdr nlh;
+            struct ifinfomsg ifi;
+        } link;
+        struct {
+            struct nlmsghdr nlh;
+            struct ifaddrmsg ifa;
+        } addr;
     } req;
     
     memset(&req, 0, sizeof(req));
-    req.nlh.nlmsg_len = sizeof(req);
-    req.nlh.nlmsg_type = type;
-    req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
-    req.nlh.nlmsg_pid = 0;
-    req.nlh.nlmsg_seq = seq;
-    req.g.rtgen_family = family;
-    
-    int res = write(fd, &req, sizeof(req));
+    
+    int len;
+    if (type == RTM_GETLINK) {
+        // ask for our interface only, rather than dumping all of them
+        len = sizeof(req.link);
+        req.link.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK;
+        req.link.ifi.ifi_family = family;
+        req.link.ifi.ifi_index = o->ifindex;
+    } else {
+        // the index filters the dump if the kernel does strict checking
+        len = sizeof(req.addr);
+        req.addr.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
+        req.addr.ifa.ifa_family = family;
+        req.addr.ifa.ifa_index = o->ifindex;
+    }
+    req.link.nlh.nlmsg_len = len;
+    req.link.nlh.nlmsg_type = type;
+    req.link.nlh.nlmsg_pid = 0;
+    req.link.nlh.nlmsg_seq = seq;
+    
+    int res = write(fd, &req, len);
     if (res < 0) {
         BLog(BLOG_ERROR, "write failed");
         return 0;
     }
-    if (res != sizeof(req)) {
+    if (res != len) {
         BLog(BLOG_ERROR, "write short");
         return 0;
     }
@@ -112,181 +132,265 @@ static int send_next_dump_request (NCDInterfaceMonitor *o)
     
     if (o->dump_queue & NCDIFMONITOR_WATCH_LINK) {
         o->dump_queue &= ~NCDIFMONITOR_WATCH_LINK;
-        return send_wilddump_request(o, o->netlink_fd, o->dump_seq, 0, RTM_GETLINK);
+        return send_dump_request(o, o->netlink_fd, o->dump_seq, 0, RTM_GETLINK);
     }
     else if (o->dump_queue & NCDIFMONITOR_WATCH_IPV4_ADDR) {
         o->dump_queue &= ~NCDIFMONITOR_WATCH_IPV4_ADDR;
-        return send_wilddump_request(o, o->netlink_fd, o->dump_seq, AF_INET, RTM_GETADDR);
+        return send_dump_request(o, o->netlink_fd, o->dump_seq, AF_INET, RTM_GETADDR);
     }
     else if (o->dump_queue & NCDIFMONITOR_WATCH_IPV6_ADDR) {
         o->dump_queue &= ~NCDIFMONITOR_WATCH_IPV6_ADDR;
-        return send_wilddump_request(o, o->netlink_fd, o->dump_seq, AF_INET6, RTM_GETADDR);
+        return send_dump_request(o, o->netlink_fd, o->dump_seq, AF_INET6, RTM_GETADDR);
     }
     
     ASSERT(0)
     return 0;
 }
 
-void netlink_fd_handler (NCDInterfaceMonitor *o, int events)
+static int same_subject (const struct NCDInterfaceMonitor_event *e1, const struct NCDInterfaceMonitor_event *e2)
 {
-    DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_bfd)
-    
-    // handler fd error
-    if (o->buf_left >= 0) {
-        BLog(BLOG_ERROR, "file descriptor error");
-        goto fail;
+    switch (e1->event) {
+        case NCDIFMONITOR_EVENT_LINK_UP:
+        case NCDIFMONITOR_EVENT_LINK_DOWN:
+            return (e2->event == NCDIFMONITOR_EVENT_LINK_UP || e2->event == NCDIFMONITOR_EVENT_LINK_DOWN);
+        
+        case NCDIFMONITOR_EVENT_IPV4_ADDR_ADDED:
+        case NCDIFMONITOR_EVENT_IPV4_ADDR_REMOVED:
+            return (
+                (e2->event == NCDIFMONITOR_EVENT_IPV4_ADDR_ADDED || e2->event == NCDIFMONITOR_EVENT_IPV4_ADDR_REMOVED) &&
+                e1->u.ipv4_addr.addr.addr == e2->u.ipv4_addr.addr.addr &&
+                e1->u.ipv4_addr.addr.prefix == e2->u.ipv4_addr.addr.prefix
+            );
+        
+        case NCDIFMONITOR_EVENT_IPV6_ADDR_ADDED:
+        case NCDIFMONITOR_EVENT_IPV6_ADDR_REMOVED:
+            return (
+                (e2->event == NCDIFMONITOR_EVENT_IPV6_ADDR_ADDED || e2->event == NCDIFMONITOR_EVENT_IPV6_ADDR_REMOVED) &&
+                !memcmp(e1->u.ipv6_addr.addr.addr.bytes, e2->u.ipv6_addr.addr.addr.bytes, 16) &&
+                e1->u.ipv6_addr.addr.prefix == e2->u.ipv6_addr.addr.prefix
+            );
     }
     
-    // read from netlink fd
-    int len = read(o->netlink_fd, o->buf.buf, sizeof(o->buf));
-    if (len < 0) {
-        BLog(BLOG_ERROR, "read failed");
-        goto fail;
-    }
+    ASSERT(0)
+    return 0;
+}
+
+static int queue_event (NCDInterfaceMonitor *o, struct NCDInterfaceMonitor_event ev)
+{
+    ASSERT(!o->dispatching)
     
-    // stop receiving fd events
-    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    // replace a queued update of the same thing
+    for (int j = 0; j < o->num_queued; j++) {
+        if (same_subject(&o->queue[j], &ev)) {
+            o->queue[j] = ev;
+            return 1;
+        }
+    }
     
-    // set buffer
-    o->buf_nh = &o->buf.nlh;
-    o->buf_left = len;
+    if (o->num_queued == NCDIFMONITOR_MAX_QUEUED) {
+        return 0;
+    }
     
-    // process buffer
-    process_buffer(o);
-    return;
+    o->queue[o->num_queued++] = ev;
+    return 1;
+}
+
+// Returns -1 on error, 0 if the message is not relevant, 1 if *ev was set.
+static int parse_message (NCDInterfaceMonitor *o, struct nlmsghdr *buf, struct NCDInterfaceMonitor_event *ev)
+{
+    void *pl = NLMSG_DATA(buf);
+    int pl_len = NLMSG_PAYLOAD(buf, 0);
+    
+    switch (buf->nlmsg_type) {
+        case RTM_NEWLINK: { // not RTM_DELLINK! who knows what these mean...
+            if (pl_len < sizeof(struct ifinfomsg)) {
+                BLog(BLOG_ERROR, "ifinfomsg too short");
+                return -1;
+            }
+            struct ifinfomsg *msg = pl;
+            
+            if (msg->ifi_index == o->ifindex && (o->watch_events & NCDIFMONITOR_WATCH_LINK)) {
+                ev->event = (buf->nlmsg_type == RTM_NEWLINK && (msg->ifi_flags & IFF_RUNNING)) ? NCDIFMONITOR_EVENT_LINK_UP : NCDIFMONITOR_EVENT_LINK_DOWN;
+                return 1;
+            }
+        } break;
+        
+        case RTM_NEWADDR:
+        case RTM_DELADDR: {
+            if (pl_len < sizeof(struct ifaddrmsg)) {
+                BLog(BLOG_ERROR, "ifaddrmsg too short");
+                return -1;
+            }
+            struct ifaddrmsg *msg = pl;
+            
+            void *addr;
+            int addr_len;
+            if (!get_attr(IFA_ADDRESS, IFA_RTA(msg), buf->nlmsg_len - NLMSG_LENGTH(sizeof(*msg)), &addr, &addr_len)) {
+                break;
+            }
+            
+            if (msg->ifa_index == o->ifindex && msg->ifa_family == AF_INET && (o->watch_events & NCDIFMONITOR_WATCH_IPV4_ADDR)) {
+                if (addr_len != 4 || msg->ifa_prefixlen > 32) {
+                    BLog(BLOG_ERROR, "bad ipv4 ifaddrmsg");
+                    return -1;
+                }
+                
+                ev->event = (buf->nlmsg_type == RTM_NEWADDR) ? NCDIFMONITOR_EVENT_IPV4_ADDR_ADDED : NCDIFMONITOR_EVENT_IPV4_ADDR_REMOVED;
+                ev->u.ipv4_addr.addr.addr = ((struct in_addr *)addr)->s_addr;
+                ev->u.ipv4_addr.addr.prefix = msg->ifa_prefixlen;
+                return 1;
+            }
+            
+            if (msg->ifa_index == o->ifindex && msg->ifa_family == AF_INET6 && (o->watch_events & NCDIFMONITOR_WATCH_IPV6_ADDR)) {
+                if (addr_len != 16 || msg->ifa_prefixlen > 128) {
+                    BLog(BLOG_ERROR, "bad ipv6 ifaddrmsg");
+                    return -1;
+                }
+                
+                ev->event = (buf->nlmsg_type == RTM_NEWADDR) ? NCDIFMONITOR_EVENT_IPV6_ADDR_ADDED : NCDIFMONITOR_EVENT_IPV6_ADDR_REMOVED;
+                memcpy(ev->u.ipv6_addr.addr.addr.bytes, ((struct in6_addr *)addr)->s6_addr, 16);
+                ev->u.ipv6_addr.addr.prefix = msg->ifa_prefixlen;
+                ev->u.ipv6_addr.addr_flags = 0;
+                ev->u.ipv6_addr.scope = msg->ifa_scope;
+                if (!(msg->ifa_flags & IFA_F_PERMANENT)) {
+                    ev->u.ipv6_addr.addr_flags |= NCDIFMONITOR_ADDR_FLAG_DYNAMIC;
+                }
+                return 1;
+            }
+        } break;
+    }
     
-fail:
-    report_error(o);
+    return 0;
 }
 
-void process_buffer (NCDInterfaceMonitor *o)
+// Returns -1 on error, 0 if the queue is full, 1 if the buffer was consumed.
+static int parse_buffer (NCDInterfaceMonitor *o)
 {
     ASSERT(o->buf_left >= 0)
-    ASSERT(o->have_bfd)
-    
-    int done = 0;
     
     for (; NLMSG_OK(o->buf_nh, o->buf_left); o->buf_nh = NLMSG_NEXT(o->buf_nh, o->buf_left)) {
-        if (o->buf_nh->nlmsg_type == NLMSG_DONE) {
-            done = 1;
+        struct nlmsghdr *buf = o->buf_nh;
+        
+        // end of a dump, or the ack of a link request
+        if (buf->nlmsg_type == NLMSG_DONE || (buf->nlmsg_type == NLMSG_ERROR && o->event_netlink_fd >= 0 && buf->nlmsg_seq == o->dump_seq)) {
+            o->dump_done = 1;
             break;
         }
         
-        struct nlmsghdr *buf = o->buf_nh;
-        void *pl = NLMSG_DATA(buf);
-        int pl_len = NLMSG_PAYLOAD(buf, 0);
-        
         struct NCDInterfaceMonitor_event ev;
-        
-        switch (buf->nlmsg_type) {
-            case RTM_NEWLINK: { // not RTM_DELLINK! who knows what these mean...
-                if (pl_len < sizeof(struct ifinfomsg)) {
-                    BLog(BLOG_ERROR, "ifinfomsg too short");
-                    goto fail;
-                }
-                struct ifinfomsg *msg = pl;
-                
-                if (msg->ifi_index == o->ifindex && (o->watch_events & NCDIFMONITOR_WATCH_LINK)) {
-                    ev.event = (buf->nlmsg_type == RTM_NEWLINK && (msg->ifi_flags & IFF_RUNNING)) ? NCDIFMONITOR_EVENT_LINK_UP : NCDIFMONITOR_EVENT_LINK_DOWN;
-                    goto dispatch;
-                }
-            } break;
-            
-            case RTM_NEWADDR:
-            case RTM_DELADDR: {
-                if (pl_len < sizeof(struct ifaddrmsg)) {
-                    BLog(BLOG_ERROR, "ifaddrmsg too short");
-                    goto fail;
-                }
-                struct ifaddrmsg *msg = pl;
-                
-                void *addr;
-                int addr_len;
-                if (!get_attr(IFA_ADDRESS, IFA_RTA(msg), buf->nlmsg_len - NLMSG_LENGTH(sizeof(*msg)), &addr, &addr_len)) {
-                    break;
-                }
-                
-                if (msg->ifa_index == o->ifindex && msg->ifa_family == AF_INET && (o->watch_events & NCDIFMONITOR_WATCH_IPV4_ADDR)) {
-                    if (addr_len != 4 || msg->ifa_prefixlen > 32) {
-                        BLog(BLOG_ERROR, "bad ipv4 ifaddrmsg");
-                        goto fail;
-                    }
-                    
-                    ev.event = (buf->nlmsg_type == RTM_NEWADDR) ? NCDIFMONITOR_EVENT_IPV4_ADDR_ADDED : NCDIFMONITOR_EVENT_IPV4_ADDR_REMOVED;
-                    ev.u.ipv4_addr.addr.addr = ((struct in_addr *)addr)->s_addr;
-                    ev.u.ipv4_addr.addr.prefix = msg->ifa_prefixlen;
-                    goto dispatch;
-                }
-                
-                if (msg->ifa_index == o->ifindex && msg->ifa_family == AF_INET6 && (o->watch_events & NCDIFMONITOR_WATCH_IPV6_ADDR)) {
-                    if (addr_len != 16 || msg->ifa_prefixlen > 128) {
-                        BLog(BLOG_ERROR, "bad ipv6 ifaddrmsg");
-                        goto fail;
-                    }
-                    
-                    ev.event = (buf->nlmsg_type == RTM_NEWADDR) ? NCDIFMONITOR_EVENT_IPV6_ADDR_ADDED : NCDIFMONITOR_EVENT_IPV6_ADDR_REMOVED;
-                    memcpy(ev.u.ipv6_addr.addr.addr.bytes, ((struct in6_addr *)addr)->s6_addr, 16);
-                    ev.u.ipv6_addr.addr.prefix = msg->ifa_prefixlen;
-                    ev.u.ipv6_addr.addr_flags = 0;
-                    ev.u.ipv6_addr.scope = msg->ifa_scope;
-                    if (!(msg->ifa_flags & IFA_F_PERMANENT)) {
-                        ev.u.ipv6_addr.addr_flags |= NCDIFMONITOR_ADDR_FLAG_DYNAMIC;
-                    }
-                    goto dispatch;
-                }
-            } break;
+        int res = parse_message(o, buf, &ev);
+        if (res < 0) {
+            return -1;
         }
         
-        continue;
+        // keep the message for the next batch if the queue is full
+        if (res > 0 && !queue_event(o, ev)) {
+            return 0;
+        }
+    }
+    
+    // set no buffer
+    o->buf_left = -1;
+    
+    return 1;
+}
+
+static int finish_dump (NCDInterfaceMonitor *o)
+{
+    ASSERT(o->dump_done)
+    
+    o->dump_done = 0;
+    
+    if (o->dump_queue) {
+        // increment dump request sequence number
+        o->dump_seq++;
         
-    dispatch:
-        // move to next message
-        o->buf_nh = NLMSG_NEXT(o->buf_nh, o->buf_left);
+        // send next dump request
+        if (!send_next_dump_request(o)) {
+            return 0;
+        }
+    }
+    else if (o->event_netlink_fd >= 0) {
+        // stop watching dump fd
+        BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+        o->have_bfd = 0;
         
-        // schedule more job
-        BPending_Set(&o->more_job);
+        // close dump fd, make event fd current
+        close(o->netlink_fd);
+        o->netlink_fd = o->event_netlink_fd;
+        o->event_netlink_fd = -1;
         
-        // dispatch event
-        o->handler(o->user, ev);
+        // start watching event fd
+        BFileDescriptor_Init(&o->bfd, o->netlink_fd, (BFileDescriptor_handler)netlink_fd_handler, o);
+        if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+            BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+            return 0;
+        }
+        o->have_bfd = 1;
+    }
+    
+    return 1;
+}
+
+void netlink_fd_handler (NCDInterfaceMonitor *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_bfd)
+    
+    // handler fd error
+    if (o->dispatching) {
+        BLog(BLOG_ERROR, "file descriptor error");
+        report_error(o);
         return;
     }
     
-    if (done) {
-        if (o->dump_queue) {
-            // increment dump request sequence number
-            o->dump_seq++;
-            
-            // send next dump request
-            if (!send_next_dump_request(o)) {
-                goto fail;
+    // stop receiving fd events
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    
+    collect_events(o);
+}
+
+void collect_events (NCDInterfaceMonitor *o)
+{
+    ASSERT(!o->dispatching)
+    ASSERT(o->have_bfd)
+    
+    o->num_queued = 0;
+    o->queue_pos = 0;
+    
+    // read all messages which are ready, or until the queue fills up
+    while (1) {
+        if (o->buf_left < 0) {
+            if (o->dump_done) {
+                break;
             }
-        }
-        else if (o->event_netlink_fd >= 0) {
-            // stop watching dump fd
-            BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
-            o->have_bfd = 0;
             
-            // close dump fd, make event fd current
-            close(o->netlink_fd);
-            o->netlink_fd = o->event_netlink_fd;
-            o->event_netlink_fd = -1;
-            
-            // start watching event fd
-            BFileDescriptor_Init(&o->bfd, o->netlink_fd, (BFileDescriptor_handler)netlink_fd_handler, o);
-            if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-                BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+            int len = recv(o->netlink_fd, o->buf.buf, sizeof(o->buf), MSG_DONTWAIT);
+            if (len < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                BLog(BLOG_ERROR, "read failed");
                 goto fail;
             }
-            o->have_bfd = 1;
+            
+            // set buffer
+            o->buf_nh = &o->buf.nlh;
+            o->buf_left = len;
+        }
+        
+        int res = parse_buffer(o);
+        if (res < 0) {
+            goto fail;
+        }
+        if (res == 0) {
+            break;
         }
     }
     
-    // set no buffer
-    o->buf_left = -1;
-    
-    // continue receiving fd events
-    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    // dispatch the events
+    o->dispatching = 1;
+    BPending_Set(&o->more_job);
     return;
     
 fail:
@@ -296,11 +400,34 @@ fail:
 void more_job_handler (NCDInterfaceMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->buf_left >= 0)
+    ASSERT(o->dispatching)
     
-    // process buffer
-    process_buffer(o);
-    return;
+    if (o->queue_pos < o->num_queued) {
+        struct NCDInterfaceMonitor_event ev = o->queue[o->queue_pos++];
+        
+        // schedule more job
+        BPending_Set(&o->more_job);
+        
+        // dispatch event
+        o->handler(o->user, ev);
+        return;
+    }
+    
+    o->dispatching = 0;
+    
+    if (o->dump_done && !finish_dump(o)) {
+        report_error(o);
+        return;
+    }
+    
+    // continue with messages left over from a full queue
+    if (o->buf_left >= 0) {
+        collect_events(o);
+        return;
+    }
+    
+    // continue receiving fd events
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
 }
 
 int NCDInterfaceMonitor_Init (NCDInterfaceMonitor *o, int ifindex, int watch_events, BReactor *reactor, void *user,
@@ -330,6 +457,11 @@ int NCDInterfaceMonitor_Init (NCDInterfaceMonitor *o, int ifindex, int watch_eve
         BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
         goto fail1;
     }
+#ifdef NETLINK_GET_STRICT_CHK
+    // have the kernel filter address dumps by interface, if supported
+    int one = 1;
+    setsockopt(o->netlink_fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+#endif
     
     // init event netlink fd
     if ((o->event_netlink_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
@@ -359,6 +491,7 @@ int NCDInterfaceMonitor_Init (NCDInterfaceMonitor *o, int ifindex, int watch_eve
     // set dump state
     o->dump_queue = watch_events;
     o->dump_seq = 0;
+    o->dump_done = 0;
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->netlink_fd, (BFileDescriptor_handler)netlink_fd_handler, o);
@@ -371,6 +504,9 @@ int NCDInterfaceMonitor_Init (NCDInterfaceMonitor *o, int ifindex, int watch_eve
     // set nothing in buffer
     o->buf_left = -1;
     
+    // set not dispatching
+    o->dispatching = 0;
+    
     // init more job
     BPending_Init(&o->more_job, BReactor_PendingGroup(reactor), (BPending_handler)more_job_handler, o);
     
@@ -425,7 +561,7 @@ void NCDInterfaceMonitor_Pause (NCDInterfaceMonitor *o)
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->have_bfd)
     
-    if (o->buf_left >= 0) {
+    if (o->dispatching) {
         BPending_Unset(&o->more_job);
     } else {
         BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
@@ -438,7 +574,7 @@ void NCDInterfaceMonitor_Continue (NCDInterfaceMonitor *o)
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->have_bfd)
     
-    if (o->buf_left >= 0) {
+    if (o->dispatching) {
         BPending_Set(&o->more_job);
     } else {
         BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
@@ -55,6 +55,8 @@
 
 #define NCDIFMONITOR_ADDR_FLAG_DYNAMIC (1 << 0)
 
+#define NCDIFMONITOR_MAX_QUEUED 32
+
 struct NCDInterfaceMonitor_event {
     int event;
     union {
@@ -74,6 +76,9 @@ struct NCDInterfaceMonitor_event {
  * Note that the event reporter does not keep any interface state, and as such may
  * report redundant events. You should therefore handle events in an idempotent
  * fashion.
+ * Messages which are ready on the netlink socket are read together, and updates of
+ * the link state or of the same address are coalesced so that only the last one is
+ * reported.
  * 
  * @param event.event event type. One of:
  *        - NCDIFMONITOR_EVENT_LINK_UP, NCDIFMONITOR_EVENT_LINK_DOWN,
@@ -108,14 +113,19 @@ typedef struct {
     int event_netlink_fd;
     int dump_queue;
     uint32_t dump_seq;
+    int dump_done;
     BFileDescriptor bfd;
     int have_bfd;
     union {
-        uint8_t buf[4096];
+        uint8_t buf[16384];
         struct nlmsghdr nlh;
     } buf;
     struct nlmsghdr *buf_nh;
     int buf_left;
+    struct NCDInterfaceMonitor_event queue[NCDIFMONITOR_MAX_QUEUED];
+    int num_queued;
+    int queue_pos;
+    int dispatching;
     BPending more_job;
     DebugError d_err;
     DebugObject d_obj;
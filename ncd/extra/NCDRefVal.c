@@ -0,0 +1,117 @@
+/**
+ * @file NCDRefVal.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "NCDRefVal.h"
+
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/debug.h>
+
+static void ref_target_func_release (BRefTarget *ref_target)
+{
+    NCDRefVal *o = UPPER_OBJECT(ref_target, NCDRefVal, ref_target);
+    NCDValMem_Free(&o->mem);
+    BFree(o);
+}
+
+NCDRefVal * NCDRefVal_New (NCDStringIndex *string_index, NCDValRef value)
+{
+    ASSERT(string_index)
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    NCDRefVal *o = BAlloc(sizeof(*o));
+    if (!o) {
+        goto fail0;
+    }
+    
+    NCDValMem_Init(&o->mem, string_index);
+    
+    NCDValRef copy = NCDVal_NewCopy(&o->mem, value);
+    if (NCDVal_IsInvalid(copy)) {
+        goto fail1;
+    }
+    o->value = NCDVal_ToSafe(copy);
+    
+    // the value is never modified, release the slack
+    NCDValMem_Compact(&o->mem);
+    
+    BRefTarget_Init(&o->ref_target, ref_target_func_release);
+    
+    return o;
+    
+fail1:
+    NCDValMem_Free(&o->mem);
+    BFree(o);
+fail0:
+    return NULL;
+}
+
+NCDRefVal * NCDRefVal_NewFromMem (NCDValMem *mem, NCDValRef value)
+{
+    ASSERT(mem)
+    ASSERT(value.mem == mem)
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    NCDRefVal *o = BAlloc(sizeof(*o));
+    if (!o) {
+        return NULL;
+    }
+    
+    o->mem = *mem;
+    o->value = NCDVal_ToSafe(value);
+    
+    // the value is never modified, release the slack
+    NCDValMem_Compact(&o->mem);
+    
+    BRefTarget_Init(&o->ref_target, ref_target_func_release);
+    
+    return o;
+}
+
+NCDValRef NCDRefVal_Value (NCDRefVal *o)
+{
+    return NCDVal_FromSafe(&o->mem, o->value);
+}
+
+BRefTarget * NCDRefVal_RefTarget (NCDRefVal *o)
+{
+    return &o->ref_target;
+}
+
+NCDValRef NCDRefVal_NewShared (NCDRefVal *o, NCDValMem *mem)
+{
+    NCDValRef value = NCDRefVal_Value(o);
+    
+    if (NCDVal_IsString(value)) {
+        return NCDVal_NewCopy(mem, value);
+    }
+    
+    return NCDVal_NewShared(mem, value, &o->ref_target);
+}
@@ -0,0 +1,78 @@
+/**
+ * @file NCDRefVal.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef NCD_NCDREFVAL_H
+#define NCD_NCDREFVAL_H
+
+#include <misc/BRefTarget.h>
+#include <ncd/NCDVal.h>
+
+/**
+ * Reference counted holder of an immutable value.
+ * Other memory objects can refer to the held value in O(1) using
+ * {@link NCDRefVal_NewShared}, instead of copying it.
+ */
+typedef struct {
+    BRefTarget ref_target;
+    NCDValMem mem;
+    NCDValSafeRef value;
+} NCDRefVal;
+
+/**
+ * Creates a holder with a copy of the given value.
+ * The holder starts with a single reference, which is released using
+ * {@link BRefTarget_Deref} on {@link NCDRefVal_RefTarget}.
+ * Returns NULL on failure.
+ */
+NCDRefVal * NCDRefVal_New (NCDStringIndex *string_index, NCDValRef value);
+
+/**
+ * Like {@link NCDRefVal_New}, but takes over the memory object the value was
+ * built in instead of copying the value. On success, the memory object belongs
+ * to the holder and must not be used or freed by the caller; on failure, it
+ * is left to the caller.
+ * Returns NULL on failure.
+ */
+NCDRefVal * NCDRefVal_NewFromMem (NCDValMem *mem, NCDValRef value);
+
+/**
+ * Returns the held value. It must not be modified.
+ */
+NCDValRef NCDRefVal_Value (NCDRefVal *o);
+
+BRefTarget * NCDRefVal_RefTarget (NCDRefVal *o);
+
+/**
+ * Puts the held value into a memory object. Lists and maps are shared
+ * with {@link NCDVal_NewShared}, strings are copied.
+ */
+NCDValRef NCDRefVal_NewShared (NCDRefVal *o, NCDValMem *mem);
+
+#endif
@@ -212,7 +212,8 @@ static void recv_if_handler_send (NCDRequestClient *o, uint8_t *data, int data_l
     }
     
     switch (type) {
-        case REQUESTPROTO_TYPE_SERVER_REPLY: {
+        case REQUESTPROTO_TYPE_SERVER_REPLY:
+        case REQUESTPROTO_TYPE_SERVER_REPLY_BINARY: {
             switch (o->state) {
                 case RSTATE_READY: {
                     // init memory
@@ -220,8 +221,12 @@ static void recv_if_handler_send (NCDRequestClient *o, uint8_t *data, int data_l
                     NCDValMem_Init(&mem, o->string_index);
                     
                     // parse payload
+                    MemRef payload_mr = MemRef_Make((char *)payload, payload_len);
                     NCDValRef payload_value;
-                    if (!NCDValParser_Parse(MemRef_Make((char *)payload, payload_len), &mem, &payload_value)) {
+                    int res = (type == REQUESTPROTO_TYPE_SERVER_REPLY_BINARY) ?
+                        NCDValBinary_Decode(payload_mr, &mem, &payload_value) :
+                        NCDValParser_Parse(payload_mr, &mem, &payload_value);
+                    if (!res) {
                         BLog(BLOG_ERROR, "failed to parse reply payload");
                         NCDValMem_Free(&mem);
                         goto fail;
@@ -306,7 +311,8 @@ static int get_free_request_id (NCDRequestClient *o, uint32_t *out)
     
     do {
         if (!find_req(o, o->next_request_id)) {
-            *out = o->next_request_id;
+            // move on so that consecutive requests don't probe the IDs still in flight
+            *out = o->next_request_id++;
             return 1;
         }
         o->next_request_id++;
@@ -328,9 +334,18 @@ static int build_requestproto_packet (uint32_t request_id, uint32_t type, NCDVal
         goto fail1;
     }
     
-    if (!NCDVal_IsInvalid(payload_value) && !NCDValGenerator_AppendGenerate(payload_value, &str)) {
-        BLog(BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
-        goto fail1;
+    if (!NCDVal_IsInvalid(payload_value)) {
+        if (type == REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY) {
+            if (!NCDValBinary_AppendEncode(payload_value, &str)) {
+                BLog(BLOG_ERROR, "NCDValBinary_AppendEncode failed");
+                goto fail1;
+            }
+        } else {
+            if (!NCDValGenerator_AppendGenerate(payload_value, &str)) {
+                BLog(BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
+                goto fail1;
+            }
+        }
     }
     
     size_t len = ExpString_Length(&str);
@@ -468,7 +483,7 @@ static void req_qflow_send_iface_handler_done (struct NCDRequestClient_req *req)
 }
 
 int NCDRequestClient_Init (NCDRequestClient *o, struct BConnection_addr addr, BReactor *reactor, NCDStringIndex *string_index,
-                           void *user,
+                           int binary, void *user,
                            NCDRequestClient_handler_error handler_error,
                            NCDRequestClient_handler_connected handler_connected)
 {
@@ -478,6 +493,7 @@ int NCDRequestClient_Init (NCDRequestClient *o, struct BConnection_addr addr, BR
     // init arguments
     o->reactor = reactor;
     o->string_index = string_index;
+    o->binary = binary;
     o->user = user;
     o->handler_error = handler_error;
     o->handler_connected = handler_connected;
@@ -583,7 +599,8 @@ int NCDRequestClientRequest_Init (NCDRequestClientRequest *o, NCDRequestClient *
     req->client = client;
     
     // build request
-    if (!build_requestproto_packet(req->request_id, REQUESTPROTO_TYPE_CLIENT_REQUEST, payload_value, &req->request_data, &req->request_len)) {
+    uint32_t type = client->binary ? REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY : REQUESTPROTO_TYPE_CLIENT_REQUEST;
+    if (!build_requestproto_packet(req->request_id, type, payload_value, &req->request_data, &req->request_len)) {
         BLog(BLOG_ERROR, "failed to build request");
         goto fail2;
     }
@@ -44,6 +44,7 @@
 #include <flow/PacketPassFifoQueue.h>
 #include <ncd/NCDValGenerator.h>
 #include <ncd/NCDValParser.h>
+#include <ncd/NCDValBinary.h>
 
 struct NCDRequestClient_req;
 
@@ -56,6 +57,7 @@ typedef void (*NCDRequestClientRequest_handler_finished) (void *user, int is_err
 typedef struct {
     BReactor *reactor;
     NCDStringIndex *string_index;
+    int binary;
     void *user;
     NCDRequestClient_handler_error handler_error;
     NCDRequestClient_handler_connected handler_connected;
@@ -98,7 +100,7 @@ struct NCDRequestClient_req {
 };
 
 int NCDRequestClient_Init (NCDRequestClient *o, struct BConnection_addr addr, BReactor *reactor, NCDStringIndex *string_index,
-                           void *user,
+                           int binary, void *user,
                            NCDRequestClient_handler_error handler_error,
                            NCDRequestClient_handler_connected handler_connected) WARN_UNUSED;
 void NCDRequestClient_Free (NCDRequestClient *o);
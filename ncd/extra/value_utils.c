@@ -35,6 +35,7 @@
 #include <misc/parse_number.h>
 #include <misc/strdup.h>
 #include <misc/balloc.h>
+#include <misc/hashfun.h>
 #include <system/BTime.h>
 #include <ncd/NCDVal.h>
 #include <ncd/NCDStringIndex.h>
@@ -116,6 +117,37 @@ NCD_string_id_t ncd_get_string_id (NCDValRef string)
     return NCDStringIndex_GetBinMr(NCDValMem_StringIndex(string.mem), NCDVal_StringMemRef(string));
 }
 
+size_t ncd_value_hash (NCDValRef val)
+{
+    switch (NCDVal_Type(val)) {
+        case NCDVAL_STRING: {
+            MemRef str = NCDVal_StringMemRef(val);
+            return badvpn_djb2_hash_bin((const uint8_t *)str.ptr, str.len);
+        } break;
+        
+        case NCDVAL_LIST: {
+            size_t hash = 1;
+            size_t count = NCDVal_ListCount(val);
+            for (size_t j = 0; j < count; j++) {
+                hash = 31 * hash + ncd_value_hash(NCDVal_ListGet(val, j));
+            }
+            return hash;
+        } break;
+        
+        case NCDVAL_MAP: {
+            // entries come in arbitrary order, so combine them commutatively
+            size_t hash = 2;
+            for (NCDValMapElem me = NCDVal_MapFirst(val); !NCDVal_MapElemInvalid(me); me = NCDVal_MapNext(val, me)) {
+                hash += 31 * ncd_value_hash(NCDVal_MapElemKey(val, me)) + ncd_value_hash(NCDVal_MapElemVal(val, me));
+            }
+            return hash;
+        } break;
+        
+        default:
+            return 0;
+    }
+}
+
 NCDValRef ncd_make_uintmax (NCDValMem *mem, uintmax_t value)
 {
     ASSERT(mem)
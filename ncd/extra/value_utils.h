@@ -44,6 +44,7 @@ int ncd_read_boolean (NCDValRef val, int *out) WARN_UNUSED;
 int ncd_read_uintmax (NCDValRef string, uintmax_t *out) WARN_UNUSED;
 int ncd_read_time (NCDValRef string, btime_t *out) WARN_UNUSED;
 NCD_string_id_t ncd_get_string_id (NCDValRef string);
+size_t ncd_value_hash (NCDValRef val);
 NCDValRef ncd_make_uintmax (NCDValMem *mem, uintmax_t value);
 char * ncd_strdup (NCDValRef stringnonulls);
 int ncd_eval_func_args_ext (NCDCall const *call, size_t start, size_t count, NCDValMem *mem, NCDValRef *out) WARN_UNUSED;
@@ -235,11 +235,10 @@ static int concat_recurser (ExpString *estr, NCDValRef arg, NCDCall const *call)
 
 static void concat_eval (NCDCall call)
 {
+    // the result is copied out, so build short strings on the stack
+    char buf[128];
     ExpString estr;
-    if (!ExpString_Init(&estr)) {
-        FunctionLog(&call, BLOG_ERROR, "ExpString_Init failed");
-        goto fail0;
-    }
+    ExpString_InitBuf(&estr, buf, sizeof(buf));
     size_t count = NCDCall_ArgCount(&call);
     for (size_t i = 0; i < count; i++) {
         NCDValRef arg = NCDCall_EvalArg(&call, i, NCDCall_ResMem(&call));
@@ -253,8 +252,6 @@ static void concat_eval (NCDCall call)
     NCDCall_SetResult(&call, NCDVal_NewStringBinMr(NCDCall_ResMem(&call), ExpString_GetMr(&estr)));
 fail1:
     ExpString_Free(&estr);
-fail0:
-    return;
 }
 
 static void concatlist_eval (NCDCall call)
@@ -389,12 +386,16 @@ static void encode_value_eval (NCDCall call)
     if (NCDVal_IsInvalid(arg)) {
         return;
     }
-    char *str = NCDValGenerator_Generate(arg);
-    if (!str) {
-        return FunctionLog(&call, BLOG_ERROR, "encode_value: NCDValGenerator_Generate failed");
+    char buf[128];
+    ExpString str;
+    ExpString_InitBuf(&str, buf, sizeof(buf));
+    if (!NCDValGenerator_AppendGenerate(arg, &str)) {
+        FunctionLog(&call, BLOG_ERROR, "encode_value: NCDValGenerator_AppendGenerate failed");
+        goto fail;
     }
-    NCDCall_SetResult(&call, NCDVal_NewString(NCDCall_ResMem(&call), str));
-    free(str);
+    NCDCall_SetResult(&call, NCDVal_NewStringBinMr(NCDCall_ResMem(&call), ExpString_GetMr(&str)));
+fail:
+    ExpString_Free(&str);
 }
 
 static void decode_value_eval (NCDCall call)
@@ -531,11 +532,9 @@ static void struct_encode_eval (NCDCall call)
         FunctionLog(&call, BLOG_ERROR, "struct_encode: argument must be a list");
         goto fail0;
     }
+    char buf[128];
     ExpString estr;
-    if (!ExpString_Init(&estr)) {
-        FunctionLog(&call, BLOG_ERROR, "ExpString_Init failed");
-        goto fail0;
-    }
+    ExpString_InitBuf(&estr, buf, sizeof(buf));
     size_t count = NCDVal_ListCount(arg);
     for (size_t i = 0; i < count; i++) {
         NCDValRef elem = NCDVal_ListGet(arg, i);
@@ -697,112 +696,148 @@ static struct NCDModuleFunction const functions[] = {
         .func_eval = error_eval
     }, {
         .func_name = "identity",
-        .func_eval = identity_eval
+        .func_eval = identity_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "if",
-        .func_eval = if_eval
+        .func_eval = if_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "ifel",
-        .func_eval = ifel_eval
+        .func_eval = ifel_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "bool",
-        .func_eval = bool_eval
+        .func_eval = bool_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "not",
-        .func_eval = not_eval
+        .func_eval = not_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "and",
-        .func_eval = and_eval
+        .func_eval = and_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "or",
-        .func_eval = or_eval
+        .func_eval = or_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "imp",
-        .func_eval = imp_eval
+        .func_eval = imp_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_lesser",
-        .func_eval = value_compare_lesser_eval
+        .func_eval = value_compare_lesser_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_greater",
-        .func_eval = value_compare_greater_eval
+        .func_eval = value_compare_greater_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_lesser_equal",
-        .func_eval = value_compare_lesser_equal_eval
+        .func_eval = value_compare_lesser_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_greater_equal",
-        .func_eval = value_compare_greater_equal_eval
+        .func_eval = value_compare_greater_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_equal",
-        .func_eval = value_compare_equal_eval
+        .func_eval = value_compare_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "val_different",
-        .func_eval = value_compare_different_eval
+        .func_eval = value_compare_different_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "concat",
-        .func_eval = concat_eval
+        .func_eval = concat_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "concatlist",
-        .func_eval = concatlist_eval
+        .func_eval = concatlist_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_lesser",
-        .func_eval = integer_compare_lesser_eval
+        .func_eval = integer_compare_lesser_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_greater",
-        .func_eval = integer_compare_greater_eval
+        .func_eval = integer_compare_greater_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_lesser_equal",
-        .func_eval = integer_compare_lesser_equal_eval
+        .func_eval = integer_compare_lesser_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_greater_equal",
-        .func_eval = integer_compare_greater_equal_eval
+        .func_eval = integer_compare_greater_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_equal",
-        .func_eval = integer_compare_equal_eval
+        .func_eval = integer_compare_equal_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_different",
-        .func_eval = integer_compare_different_eval
+        .func_eval = integer_compare_different_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_add",
-        .func_eval = integer_operator_add_eval
+        .func_eval = integer_operator_add_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_subtract",
-        .func_eval = integer_operator_subtract_eval
+        .func_eval = integer_operator_subtract_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_multiply",
-        .func_eval = integer_operator_multiply_eval
+        .func_eval = integer_operator_multiply_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_divide",
-        .func_eval = integer_operator_divide_eval
+        .func_eval = integer_operator_divide_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_modulo",
-        .func_eval = integer_operator_modulo_eval
+        .func_eval = integer_operator_modulo_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_min",
-        .func_eval = integer_operator_min_eval
+        .func_eval = integer_operator_min_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "num_max",
-        .func_eval = integer_operator_max_eval
+        .func_eval = integer_operator_max_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "encode_value",
-        .func_eval = encode_value_eval
+        .func_eval = encode_value_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "decode_value",
-        .func_eval = decode_value_eval
+        .func_eval = decode_value_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "tolower",
-        .func_eval = perchar_tolower_eval
+        .func_eval = perchar_tolower_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "toupper",
-        .func_eval = perchar_toupper_eval
+        .func_eval = perchar_toupper_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "struct_encode",
-        .func_eval = struct_encode_eval
+        .func_eval = struct_encode_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "struct_decode",
-        .func_eval = struct_decode_eval
+        .func_eval = struct_decode_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "checksum",
-        .func_eval = checksum_eval
+        .func_eval = checksum_eval,
+        .flags = NCDMODULEFUNCTION_FLAG_PURE
     }, {
         .func_name = "clock_get_ms",
         .func_eval = clock_get_ms_eval
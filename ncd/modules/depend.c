@@ -62,6 +62,7 @@
 #include <misc/balloc.h>
 #include <structure/LinkedList1.h>
 #include <structure/LinkedList3.h>
+#include <ncd/modules/depend_index.h>
 
 #include <ncd/module_common.h>
 
@@ -69,14 +70,13 @@
 
 struct provide {
     NCDModuleInst *i;
-    MemRef name;
+    struct depend_index_entry *entry;
     int is_queued;
     union {
         struct {
             LinkedList3Node queued_node; // node in list which begins with provide.queued_provides_firstnode
         };
         struct {
-            LinkedList1Node provides_node; // node in provides
             LinkedList1 depends;
             LinkedList3Node queued_provides_firstnode;
             int dying;
@@ -86,40 +86,25 @@ struct provide {
 
 struct depend {
     NCDModuleInst *i;
-    MemRef name;
+    struct depend_index_entry *entry;
     struct provide *p;
-    LinkedList1Node node;
+    LinkedList1Node node; // node in provide.depends, or in entry.watchers if there is no provide
 };
 
 struct global {
-    LinkedList1 provides;
-    LinkedList1 free_depends;
+    depend_index index;
 };
 
-static struct provide * find_provide (struct global *g, MemRef name)
-{
-    for (LinkedList1Node *n = LinkedList1_GetFirst(&g->provides); n; n = LinkedList1Node_Next(n)) {
-        struct provide *p = UPPER_OBJECT(n, struct provide, provides_node);
-        ASSERT(!p->is_queued)
-        
-        if (MemRef_Equal(p->name, name)) {
-            return p;
-        }
-    }
-    
-    return NULL;
-}
-
 static void provide_promote (struct provide *o)
 {
-    struct global *g = ModuleGlobal(o->i);
-    ASSERT(!find_provide(g, o->name))
+    struct depend_index_entry *e = o->entry;
+    ASSERT(!e->provide)
     
     // set not queued
     o->is_queued = 0;
     
-    // insert to provides list
-    LinkedList1_Append(&g->provides, &o->provides_node);
+    // set as the provide for the name
+    e->provide = o;
     
     // init depends list
     LinkedList1_Init(&o->depends);
@@ -128,19 +113,14 @@ static void provide_promote (struct provide *o)
     o->dying = 0;
     
     // attach free depends with this name
-    LinkedList1Node *n = LinkedList1_GetFirst(&g->free_depends);
-    while (n) {
-        LinkedList1Node *next = LinkedList1Node_Next(n);
+    LinkedList1Node *n;
+    while (n = LinkedList1_GetFirst(&e->watchers)) {
         struct depend *d = UPPER_OBJECT(n, struct depend, node);
         ASSERT(!d->p)
-        
-        if (!MemRef_Equal(d->name, o->name)) {
-            n = next;
-            continue;
-        }
+        ASSERT(d->entry == e)
         
         // remove from free depends list
-        LinkedList1_Remove(&g->free_depends, &d->node);
+        LinkedList1_Remove(&e->watchers, &d->node);
         
         // insert to provide's list
         LinkedList1_Append(&o->depends, &d->node);
@@ -150,8 +130,6 @@ static void provide_promote (struct provide *o)
         
         // signal up
         NCDModuleInst_Backend_Up(d->i);
-        
-        n = next;
     }
 }
 
@@ -167,20 +145,25 @@ static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCD
     // set group state pointer
     group->group_state = g;
     
-    // init provides list
-    LinkedList1_Init(&g->provides);
-    
-    // init free depends list
-    LinkedList1_Init(&g->free_depends);
+    // init name index
+    if (!depend_index_init(&g->index, params->string_index)) {
+        BLog(BLOG_ERROR, "depend_index_init failed");
+        goto fail1;
+    }
     
     return 1;
+    
+fail1:
+    BFree(g);
+    return 0;
 }
 
 static void func_globalfree (struct NCDInterpModuleGroup *group)
 {
     struct global *g = group->group_state;
-    ASSERT(LinkedList1_IsEmpty(&g->free_depends))
-    ASSERT(LinkedList1_IsEmpty(&g->provides))
+    
+    // free name index
+    depend_index_free(&g->index);
     
     // free global state structure
     BFree(g);
@@ -202,15 +185,20 @@ static void provide_func_new_templ (void *vo, NCDModuleInst *i, const struct NCD
         ModuleLog(o->i, BLOG_ERROR, "wrong type");
         goto fail0;
     }
-    o->name = NCDVal_StringMemRef(name_arg);
     
     // signal up.
     // This comes above provide_promote(), so that effects on related depend statements are
     // computed before this process advances, avoiding problems like failed variable resolutions.
     NCDModuleInst_Backend_Up(o->i);
     
+    // get index entry for the name
+    if (!(o->entry = depend_index_get(&g->index, name_arg))) {
+        ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+        goto fail0;
+    }
+    
     // check for existing provide with this name
-    struct provide *ep = find_provide(g, o->name);
+    struct provide *ep = o->entry->provide;
     if (ep) {
         ASSERT(!ep->is_queued)
         
@@ -257,8 +245,9 @@ static void provide_free (struct provide *o)
         // remove from existing provide's queued provides list
         LinkedList3Node_Free(&o->queued_node);
     } else {
-        // remove from provides list
-        LinkedList1_Remove(&g->provides, &o->provides_node);
+        // unset as the provide for the name
+        ASSERT(o->entry->provide == o)
+        o->entry->provide = NULL;
         
         // if we have provides queued, promote the first one
         if (LinkedList3Node_Next(&o->queued_provides_firstnode)) {
@@ -274,6 +263,9 @@ static void provide_free (struct provide *o)
             // promote provide
             provide_promote(qp);
         }
+        
+        // free the index entry if nothing uses it
+        depend_index_release(&g->index, o->entry);
     }
     
     NCDModuleInst_Backend_Dead(o->i);
@@ -319,10 +311,15 @@ static void depend_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
         ModuleLog(o->i, BLOG_ERROR, "wrong type");
         goto fail0;
     }
-    o->name = NCDVal_StringMemRef(name_arg);
+    
+    // get index entry for the name
+    if (!(o->entry = depend_index_get(&g->index, name_arg))) {
+        ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+        goto fail0;
+    }
     
     // find a provide with our name
-    struct provide *p = find_provide(g, o->name);
+    struct provide *p = o->entry->provide;
     ASSERT(!p || !p->is_queued)
     
     if (p && !p->dying) {
@@ -336,7 +333,7 @@ static void depend_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
         NCDModuleInst_Backend_Up(o->i);
     } else {
         // insert to free depends list
-        LinkedList1_Append(&g->free_depends, &o->node);
+        LinkedList1_Append(&o->entry->watchers, &o->node);
         
         // set no provide
         o->p = NULL;
@@ -363,7 +360,10 @@ static void depend_free (struct depend *o)
         }
     } else {
         // remove free depends list
-        LinkedList1_Remove(&g->free_depends, &o->node);
+        LinkedList1_Remove(&o->entry->watchers, &o->node);
+        
+        // free the index entry if nothing uses it
+        depend_index_release(&g->index, o->entry);
     }
     
     NCDModuleInst_Backend_Dead(o->i);
@@ -379,7 +379,6 @@ static void depend_func_die (void *vo)
 static void depend_func_clean (void *vo)
 {
     struct depend *o = vo;
-    struct global *g = ModuleGlobal(o->i);
     ASSERT(!o->p || !o->p->is_queued)
     
     if (!(o->p && o->p->dying)) {
@@ -392,7 +391,8 @@ static void depend_func_clean (void *vo)
     LinkedList1_Remove(&p->depends, &o->node);
     
     // insert to free depends list
-    LinkedList1_Append(&g->free_depends, &o->node);
+    ASSERT(p->entry == o->entry)
+    LinkedList1_Append(&o->entry->watchers, &o->node);
     
     // set no provide
     o->p = NULL;
@@ -0,0 +1,116 @@
+/**
+ * @file depend_index.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/balloc.h>
+#include <ncd/extra/value_utils.h>
+
+#include <ncd/modules/depend_index.h>
+
+#include "depend_index_hash.h"
+#include <structure/OHash_impl.h>
+
+#define DEPEND_INDEX_INITIAL_CAPACITY 16
+
+int depend_index_init (depend_index *o, NCDStringIndex *string_index)
+{
+    o->string_index = string_index;
+    
+    // init hash table
+    return depend_index__Hash_Init(&o->hash, DEPEND_INDEX_INITIAL_CAPACITY);
+}
+
+void depend_index_free (depend_index *o)
+{
+    ASSERT(depend_index__Hash_Count(&o->hash) == 0)
+    
+    // free hash table
+    depend_index__Hash_Free(&o->hash);
+}
+
+struct depend_index_entry * depend_index_find (depend_index *o, NCDValRef name)
+{
+    return depend_index__Hash_Lookup(&o->hash, 0, name).ptr;
+}
+
+struct depend_index_entry * depend_index_get (depend_index *o, NCDValRef name)
+{
+    struct depend_index_entry *e = depend_index_find(o, name);
+    if (e) {
+        return e;
+    }
+    
+    // allocate entry
+    if (!(e = BAlloc(sizeof(*e)))) {
+        goto fail0;
+    }
+    
+    // copy name
+    NCDValMem_Init(&e->mem, o->string_index);
+    e->name = NCDVal_NewCopy(&e->mem, name);
+    if (NCDVal_IsInvalid(e->name)) {
+        goto fail1;
+    }
+    e->name_hash = ncd_value_hash(e->name);
+    
+    // set no provide and no watchers
+    e->provide = NULL;
+    LinkedList1_Init(&e->watchers);
+    
+    // insert to hash table
+    depend_index__HashRef ref = {e, e};
+    if (!depend_index__Hash_Insert(&o->hash, 0, ref, NULL)) {
+        goto fail1;
+    }
+    
+    return e;
+    
+fail1:
+    NCDValMem_Free(&e->mem);
+    BFree(e);
+fail0:
+    return NULL;
+}
+
+void depend_index_release (depend_index *o, struct depend_index_entry *e)
+{
+    if (e->provide || !LinkedList1_IsEmpty(&e->watchers)) {
+        return;
+    }
+    
+    // remove from hash table
+    depend_index__HashRef ref = {e, e};
+    depend_index__Hash_Remove(&o->hash, 0, ref);
+    
+    // free name
+    NCDValMem_Free(&e->mem);
+    
+    // free entry
+    BFree(e);
+}
@@ -0,0 +1,76 @@
+/**
+ * @file depend_index.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_NCD_MODULES_DEPEND_INDEX_H
+#define BADVPN_NCD_MODULES_DEPEND_INDEX_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <structure/LinkedList1.h>
+#include <structure/OHash.h>
+#include <ncd/NCDVal.h>
+#include <ncd/NCDStringIndex.h>
+
+/*
+ * Index of dependency names for the depend modules. An entry holds a copy of
+ * the name, the provide currently bound to it, and a list of watchers, which
+ * are depends waiting for or interested in the name. An entry exists while it
+ * has a provide or watchers; whoever clears the last of these calls
+ * depend_index_release. depend_index_get returns the existing entry for the
+ * name or creates one, returning NULL on allocation failure.
+ */
+
+struct depend_index_entry;
+typedef struct depend_index_entry *depend_index__hashlink;
+
+#include "depend_index_hash.h"
+#include <structure/OHash_decl.h>
+
+typedef struct {
+    NCDStringIndex *string_index;
+    depend_index__Hash hash;
+} depend_index;
+
+struct depend_index_entry {
+    NCDValMem mem;
+    NCDValRef name;
+    size_t name_hash;
+    void *provide;
+    LinkedList1 watchers;
+};
+
+int depend_index_init (depend_index *o, NCDStringIndex *string_index) WARN_UNUSED;
+void depend_index_free (depend_index *o);
+struct depend_index_entry * depend_index_find (depend_index *o, NCDValRef name);
+struct depend_index_entry * depend_index_get (depend_index *o, NCDValRef name);
+void depend_index_release (depend_index *o, struct depend_index_entry *e);
+
+#endif
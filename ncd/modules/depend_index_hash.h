@@ -0,0 +1,11 @@
+#define OHASH_PARAM_NAME depend_index__Hash
+#define OHASH_PARAM_ENTRY struct depend_index_entry
+#define OHASH_PARAM_LINK depend_index__hashlink
+#define OHASH_PARAM_KEY NCDValRef
+#define OHASH_PARAM_ARG int
+#define OHASH_PARAM_NULL ((depend_index__hashlink)NULL)
+#define OHASH_PARAM_DEREF(arg, link) (link)
+#define OHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->name_hash)
+#define OHASH_PARAM_KEYHASH(arg, key) ncd_value_hash((key))
+#define OHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (NCDVal_Compare((entry1).ptr->name, (entry2).ptr->name) == 0)
+#define OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (NCDVal_Compare((key1), (entry2).ptr->name) == 0)
@@ -88,6 +88,7 @@
 #include <misc/balloc.h>
 #include <misc/BRefTarget.h>
 #include <structure/LinkedList1.h>
+#include <ncd/modules/depend_index.h>
 
 #include <ncd/module_common.h>
 
@@ -95,8 +96,7 @@
 
 struct scope {
     BRefTarget ref_target;
-    LinkedList1 provides_list;
-    LinkedList1 depends_list;
+    depend_index index;
 };
 
 struct scope_instance {
@@ -107,42 +107,75 @@ struct scope_instance {
 struct provide {
     NCDModuleInst *i;
     struct scope *scope;
-    NCDValRef name;
-    LinkedList1Node provides_list_node;
+    struct depend_index_entry *entry;
     LinkedList1 depends_list;
     int dying;
 };
 
+struct depend_watch {
+    struct depend *depend;
+    struct depend_index_entry *entry;
+    LinkedList1Node watchers_node;
+};
+
 struct depend {
     NCDModuleInst *i;
     struct scope *scope;
-    NCDValRef names;
-    LinkedList1Node depends_list_node;
+    struct depend_watch *watches;
+    size_t num_watches;
     struct provide *provide;
     LinkedList1Node provide_depends_list_node;
     int provide_collapsing;
 };
 
-static struct provide * find_provide (struct scope *o, NCDValRef name)
+static void depend_unwatch_names (struct depend *o, depend_index *index)
 {
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->provides_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct provide *provide = UPPER_OBJECT(ln, struct provide, provides_list_node);
-        ASSERT(provide->scope == o)
-        if (NCDVal_Compare(provide->name, name) == 0) {
-            return provide;
+    for (size_t j = 0; j < o->num_watches; j++) {
+        struct depend_watch *w = &o->watches[j];
+        
+        // remove from entry's watchers list
+        LinkedList1_Remove(&w->entry->watchers, &w->watchers_node);
+        
+        // free the index entry if nothing uses it
+        depend_index_release(index, w->entry);
+    }
+    
+    // free watches
+    BFree(o->watches);
+}
+
+static int depend_watch_names (struct depend *o, depend_index *index, NCDValRef names)
+{
+    size_t count = NCDVal_ListCount(names);
+    
+    // allocate watches
+    o->watches = NULL;
+    if (count > 0 && !(o->watches = BAllocArray(count, sizeof(o->watches[0])))) {
+        ModuleLog(o->i, BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
+    
+    // watch each name, so that provides of these names find us directly
+    for (o->num_watches = 0; o->num_watches < count; o->num_watches++) {
+        struct depend_watch *w = &o->watches[o->num_watches];
+        
+        if (!(w->entry = depend_index_get(index, NCDVal_ListGet(names, o->num_watches)))) {
+            ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+            depend_unwatch_names(o, index);
+            return 0;
         }
+        
+        w->depend = o;
+        LinkedList1_Append(&w->entry->watchers, &w->watchers_node);
     }
     
-    return NULL;
+    return 1;
 }
 
 static struct provide * depend_find_best_provide (struct depend *o)
 {
-    size_t count = NCDVal_ListCount(o->names);
-    
-    for (size_t j = 0; j < count; j++) {
-        NCDValRef name = NCDVal_ListGet(o->names, j);
-        struct provide *provide = find_provide(o->scope, name);
+    for (size_t j = 0; j < o->num_watches; j++) {
+        struct provide *provide = o->watches[j].entry->provide;
         if (provide && !provide->dying) {
             return provide;
         }
@@ -191,8 +224,9 @@ static void depend_update (struct depend *o)
 static void scope_ref_target_func_release (BRefTarget *ref_target)
 {
     struct scope *o = UPPER_OBJECT(ref_target, struct scope, ref_target);
-    ASSERT(LinkedList1_IsEmpty(&o->provides_list))
-    ASSERT(LinkedList1_IsEmpty(&o->depends_list))
+    
+    // free name index
+    depend_index_free(&o->index);
     
     BFree(o);
 }
@@ -218,17 +252,21 @@ static void scope_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIn
         goto fail0;
     }
     
+    // init name index
+    if (!depend_index_init(&o->scope->index, i->params->iparams->string_index)) {
+        ModuleLog(i, BLOG_ERROR, "depend_index_init failed");
+        goto fail1;
+    }
+    
     // init reference target
     BRefTarget_Init(&o->scope->ref_target, scope_ref_target_func_release);
     
-    // init provide and depend lists
-    LinkedList1_Init(&o->scope->provides_list);
-    LinkedList1_Init(&o->scope->depends_list);
-    
     // go up
     NCDModuleInst_Backend_Up(i);
     return;
     
+fail1:
+    BFree(o->scope);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -256,11 +294,14 @@ static void provide_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
         goto fail0;
     }
     
-    // remember name
-    o->name = name_arg;
+    // get index entry for the name
+    if (!(o->entry = depend_index_get(&o->scope->index, name_arg))) {
+        ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+        goto fail0;
+    }
     
     // check for existing provide with this name
-    if (find_provide(o->scope, o->name)) {
+    if (o->entry->provide) {
         ModuleLog(o->i, BLOG_ERROR, "a provide with this name already exists");
         goto fail0;
     }
@@ -268,11 +309,11 @@ static void provide_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     // grab scope reference
     if (!BRefTarget_Ref(&o->scope->ref_target)) {
         ModuleLog(o->i, BLOG_ERROR, "BRefTarget_Ref failed");
-        goto fail0;
+        goto fail1;
     }
     
-    // insert to provides list
-    LinkedList1_Append(&o->scope->provides_list, &o->provides_list_node);
+    // set as the provide for the name
+    o->entry->provide = o;
     
     // init depends list
     LinkedList1_Init(&o->depends_list);
@@ -285,14 +326,16 @@ static void provide_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     // computed before this process advances, avoiding problems like failed variable resolutions.
     NCDModuleInst_Backend_Up(o->i);
     
-    // update depends
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->scope->depends_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct depend *depend = UPPER_OBJECT(ln, struct depend, depends_list_node);
-        depend_update(depend);
+    // update depends interested in this name
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->entry->watchers); ln; ln = LinkedList1Node_Next(ln)) {
+        struct depend_watch *w = UPPER_OBJECT(ln, struct depend_watch, watchers_node);
+        depend_update(w->depend);
     }
     
     return;
     
+fail1:
+    depend_index_release(&o->scope->index, o->entry);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -301,8 +344,12 @@ static void provide_free (struct provide *o)
 {
     ASSERT(LinkedList1_IsEmpty(&o->depends_list))
     
-    // remove from provides list
-    LinkedList1_Remove(&o->scope->provides_list, &o->provides_list_node);
+    // unset as the provide for the name
+    ASSERT(o->entry->provide == o)
+    o->entry->provide = NULL;
+    
+    // free the index entry if nothing uses it
+    depend_index_release(&o->scope->index, o->entry);
     
     // release scope reference
     BRefTarget_Deref(&o->scope->ref_target);
@@ -351,17 +398,16 @@ static void depend_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
         goto fail0;
     }
     
-    // remember names
-    o->names = names_arg;
-    
     // grab scope reference
     if (!BRefTarget_Ref(&o->scope->ref_target)) {
         ModuleLog(o->i, BLOG_ERROR, "BRefTarget_Ref failed");
         goto fail0;
     }
     
-    // insert to depends list
-    LinkedList1_Append(&o->scope->depends_list, &o->depends_list_node);
+    // watch names
+    if (!depend_watch_names(o, &o->scope->index, names_arg)) {
+        goto fail1;
+    }
     
     // set no provide
     o->provide = NULL;
@@ -370,6 +416,8 @@ static void depend_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
     depend_update(o);
     return;
     
+fail1:
+    BRefTarget_Deref(&o->scope->ref_target);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -388,8 +436,8 @@ static void depend_func_die (void *vo)
         }
     }
     
-    // remove from depends list
-    LinkedList1_Remove(&o->scope->depends_list, &o->depends_list_node);
+    // stop watching names
+    depend_unwatch_names(o, &o->scope->index);
     
     // release scope reference
     BRefTarget_Deref(&o->scope->ref_target);
@@ -28,15 +28,47 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <misc/offset.h>
 #include <misc/debug.h>
 #include <misc/balloc.h>
 
+#include <ncd/extra/value_utils.h>
+
 #include <ncd/modules/event_template.h>
 
 #define TemplateLog(o, ...) NCDModuleInst_Backend_Log((o)->i, (o)->blog_channel, __VA_ARGS__)
 
+static struct event_template_event * take_free_event (event_template *o)
+{
+    ASSERT(o->num_free > 0)
+    
+    // get event
+    struct event_template_event *e = UPPER_OBJECT(LinkedList1_GetFirst(&o->free_list), struct event_template_event, events_list_node);
+    
+    // remove from free list
+    LinkedList1_Remove(&o->free_list, &e->events_list_node);
+    o->num_free--;
+    
+    return e;
+}
+
+static void release_event (event_template *o, struct event_template_event *e)
+{
+    LinkedList1_Append(&o->free_list, &e->events_list_node);
+    o->num_free++;
+}
+
+static int should_pause (event_template *o)
+{
+    if (o->debounce > 0) {
+        return (o->num_free < o->maxevents);
+    }
+    
+    return o->enabled;
+}
+
 static void enable_event (event_template *o)
 {
     ASSERT(!LinkedList1_IsEmpty(&o->events_list))
@@ -52,7 +84,7 @@ static void enable_event (event_template *o)
     o->enabled_map = e->map;
     
     // append to free list
-    LinkedList1_Append(&o->free_list, &e->events_list_node);
+    release_event(o, e);
     
     // set enabled
     o->enabled = 1;
@@ -61,41 +93,134 @@ static void enable_event (event_template *o)
     NCDModuleInst_Backend_Up(o->i);
 }
 
-void event_template_new (event_template *o, NCDModuleInst *i, int blog_channel, int maxevents, void *user,
-                         event_template_func_free func_free)
+static int event_has_key (event_template *o, struct event_template_event *e, const char *key)
+{
+    const char *e_key = BStringMap_Get(&e->map, o->key_name);
+    
+    return (e_key && !strcmp(e_key, key));
+}
+
+static void hold_event (event_template *o, BStringMap map)
+{
+    ASSERT(o->debounce > 0)
+    
+    const char *key = (o->key_name ? BStringMap_Get(&map, o->key_name) : NULL);
+    const char *type = BStringMap_Get(&map, "event_type");
+    
+    // look for a held event for the same object with the same type
+    struct event_template_event *match = NULL;
+    if (key && type) {
+        for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->pending_list); ln; ln = LinkedList1Node_Next(ln)) {
+            struct event_template_event *e = UPPER_OBJECT(ln, struct event_template_event, events_list_node);
+            const char *e_type = BStringMap_Get(&e->map, "event_type");
+            if (event_has_key(o, e, key) && e_type && !strcmp(e_type, type)) {
+                match = e;
+                break;
+            }
+        }
+    }
+    
+    if (match) {
+        // the object went back to the state of the match; drop the events since
+        LinkedList1Node *ln = LinkedList1Node_Next(&match->events_list_node);
+        while (ln) {
+            LinkedList1Node *next = LinkedList1Node_Next(ln);
+            struct event_template_event *e = UPPER_OBJECT(ln, struct event_template_event, events_list_node);
+            if (event_has_key(o, e, key)) {
+                BStringMap_Free(&e->map);
+                LinkedList1_Remove(&o->pending_list, &e->events_list_node);
+                release_event(o, e);
+            }
+            ln = next;
+        }
+        
+        // replace the match, keeping its place
+        BStringMap_Free(&match->map);
+        match->map = map;
+        return;
+    }
+    
+    // hold the event
+    struct event_template_event *e = take_free_event(o);
+    e->map = map;
+    LinkedList1_Append(&o->pending_list, &e->events_list_node);
+    
+    // start the window with the first held event
+    if (!BTimer_IsRunning(&o->debounce_timer)) {
+        BReactor_SetTimer(o->i->params->iparams->reactor, &o->debounce_timer);
+    }
+}
+
+static void debounce_timer_handler (void *vo)
+{
+    event_template *o = vo;
+    ASSERT(o->debounce > 0)
+    ASSERT(!LinkedList1_IsEmpty(&o->pending_list))
+    
+    // move held events to the events list
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&o->pending_list)) {
+        LinkedList1_Remove(&o->pending_list, ln);
+        LinkedList1_Append(&o->events_list, ln);
+    }
+    
+    // enable if not already
+    if (!o->enabled) {
+        enable_event(o);
+    }
+}
+
+int event_template_new (event_template *o, NCDModuleInst *i, int blog_channel, int maxevents, btime_t debounce,
+                        const char *key_name, void *user, event_template_func_free func_free)
 {
     ASSERT(maxevents > 0)
+    ASSERT(debounce >= 0)
     
     // init arguments
     o->i = i;
     o->blog_channel = blog_channel;
+    o->maxevents = maxevents;
+    o->debounce = debounce;
+    o->key_name = key_name;
     o->user = user;
     o->func_free = func_free;
     
+    // with debouncing, make room for held events
+    int num_events = maxevents;
+    if (debounce > 0) {
+        num_events += EVENT_TEMPLATE_DEBOUNCE_SLOTS;
+    }
+    
     // allocate events array
-    if (!(o->events = BAllocArray(maxevents, sizeof(o->events[0])))) {
+    if (!(o->events = BAllocArray(num_events, sizeof(o->events[0])))) {
         TemplateLog(o, BLOG_ERROR, "BAllocArray failed");
         goto fail0;
     }
     
     // init events lists
     LinkedList1_Init(&o->events_list);
+    LinkedList1_Init(&o->pending_list);
     LinkedList1_Init(&o->free_list);
-    for (int j = 0; j < maxevents; j++) {
+    for (int j = 0; j < num_events; j++) {
         LinkedList1_Append(&o->free_list, &o->events[j].events_list_node);
     }
+    o->num_free = num_events;
     
-    // set not enabled
+    // init debounce timer
+    BTimer_Init(&o->debounce_timer, debounce, debounce_timer_handler, o);
+    
+    // set not paused and not enabled
+    o->paused = 0;
     o->enabled = 0;
     
-    return;
+    return 1;
     
 fail0:
     o->func_free(o->user, 1);
-    return;
+    return 0;
 }
 
-void event_template_die (event_template *o)
+static void template_free (event_template *o, int is_error)
 {
     // free enabled map
     if (o->enabled) {
@@ -110,13 +235,34 @@ void event_template_die (event_template *o)
         list_node = LinkedList1Node_Next(list_node);
     }
     
+    // free held event maps
+    list_node = LinkedList1_GetFirst(&o->pending_list);
+    while (list_node) {
+        struct event_template_event *e = UPPER_OBJECT(list_node, struct event_template_event, events_list_node);
+        BStringMap_Free(&e->map);
+        list_node = LinkedList1Node_Next(list_node);
+    }
+    
+    // free debounce timer
+    BReactor_RemoveTimer(o->i->params->iparams->reactor, &o->debounce_timer);
+    
     // free events array
     BFree(o->events);
     
-    o->func_free(o->user, 0);
+    o->func_free(o->user, is_error);
     return;
 }
 
+void event_template_die (event_template *o)
+{
+    template_free(o, 0);
+}
+
+void event_template_die_error (event_template *o)
+{
+    template_free(o, 1);
+}
+
 int event_template_getvar (event_template *o, const char *name, NCDValMem *mem, NCDValRef *out)
 {
     ASSERT(o->enabled)
@@ -131,32 +277,38 @@ int event_template_getvar (event_template *o, const char *name, NCDValMem *mem,
     return 1;
 }
 
-void event_template_queue (event_template *o, BStringMap map, int *out_was_empty)
+void event_template_queue (event_template *o, BStringMap map, int *out_pause)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->free_list))
-    
-    // get event
-    struct event_template_event *e = UPPER_OBJECT(LinkedList1_GetFirst(&o->free_list), struct event_template_event, events_list_node);
-    
-    // remove from free list
-    LinkedList1_Remove(&o->free_list, &e->events_list_node);
-    
-    // set map
-    e->map = map;
+    ASSERT(o->num_free > 0)
     
-    // insert to events list
-    LinkedList1_Append(&o->events_list, &e->events_list_node);
-    
-    // enable if not already
-    if (!o->enabled) {
-        enable_event(o);
-        *out_was_empty = 1;
+    if (o->debounce > 0) {
+        // hold until the window ends
+        hold_event(o, map);
     } else {
-        *out_was_empty = 0;
+        // get event
+        struct event_template_event *e = take_free_event(o);
+        
+        // set map
+        e->map = map;
+        
+        // insert to events list
+        LinkedList1_Append(&o->events_list, &e->events_list_node);
+        
+        // enable if not already
+        if (!o->enabled) {
+            enable_event(o);
+        }
+    }
+    
+    // pause the source if needed
+    *out_pause = 0;
+    if (!o->paused && should_pause(o)) {
+        o->paused = 1;
+        *out_pause = 1;
     }
 }
 
-void event_template_dequeue (event_template *o, int *out_is_empty)
+void event_template_dequeue (event_template *o, int *out_resume)
 {
     ASSERT(o->enabled)
     
@@ -172,9 +324,13 @@ void event_template_dequeue (event_template *o, int *out_is_empty)
     // enable if there are more events
     if (!LinkedList1_IsEmpty(&o->events_list)) {
         enable_event(o);
-        *out_is_empty = 0;
-    } else {
-        *out_is_empty = 1;
+    }
+    
+    // resume the source if possible
+    *out_resume = 0;
+    if (o->paused && !should_pause(o)) {
+        o->paused = 0;
+        *out_resume = 1;
     }
 }
 
@@ -182,3 +338,35 @@ int event_template_is_enabled (event_template *o)
 {
     return o->enabled;
 }
+
+int event_template_read_options (NCDModuleInst *i, int blog_channel, NCDValRef options_arg, btime_t *out_debounce)
+{
+    *out_debounce = 0;
+    
+    if (NCDVal_IsInvalid(options_arg)) {
+        return 1;
+    }
+    
+    if (!NCDVal_IsMap(options_arg)) {
+        NCDModuleInst_Backend_Log(i, blog_channel, BLOG_ERROR, "options argument is not a map");
+        return 0;
+    }
+    
+    int num_recognized = 0;
+    NCDValRef value;
+    
+    if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options_arg, "debounce"))) {
+        if (!ncd_read_time(value, out_debounce)) {
+            NCDModuleInst_Backend_Log(i, blog_channel, BLOG_ERROR, "wrong debounce");
+            return 0;
+        }
+        num_recognized++;
+    }
+    
+    if (NCDVal_MapCount(options_arg) > num_recognized) {
+        NCDModuleInst_Backend_Log(i, blog_channel, BLOG_ERROR, "unrecognized options present");
+        return 0;
+    }
+    
+    return 1;
+}
@@ -30,10 +30,15 @@
 #ifndef BADVPN_NCD_MODULES_EVENT_TEMPLATE_H
 #define BADVPN_NCD_MODULES_EVENT_TEMPLATE_H
 
+#include <misc/debug.h>
 #include <structure/LinkedList1.h>
 #include <stringmap/BStringMap.h>
+#include <system/BReactor.h>
 #include <ncd/NCDModule.h>
 
+// number of events which can wait for the debounce window to end, in addition to maxevents
+#define EVENT_TEMPLATE_DEBOUNCE_SLOTS 32
+
 typedef void (*event_template_func_free) (void *user, int is_error);
 
 typedef struct {
@@ -41,11 +46,18 @@ typedef struct {
     int blog_channel;
     void *user;
     event_template_func_free func_free;
+    int maxevents;
+    btime_t debounce;
+    const char *key_name;
     struct event_template_event *events;
     LinkedList1 events_list;
+    LinkedList1 pending_list;
     LinkedList1 free_list;
+    int num_free;
+    int paused;
     int enabled;
     BStringMap enabled_map;
+    BTimer debounce_timer;
 } event_template;
 
 struct event_template_event {
@@ -53,12 +65,34 @@ struct event_template_event {
     LinkedList1Node events_list_node;
 };
 
-void event_template_new (event_template *o, NCDModuleInst *i, int blog_channel, int maxevents, void *user,
-                         event_template_func_free func_free);
+/*
+ * maxevents is the most events the user queues between being told to pause and
+ * pausing. The user pauses its event source when queue reports *out_pause, and
+ * continues it when dequeue reports *out_resume.
+ * 
+ * With a nonzero debounce time, events are held back until a window of that many
+ * milliseconds, starting at the first held event, ends, and are then reported in
+ * order. Within the window, an event whose key_name and "event_type" values match
+ * an earlier held event replaces it and drops the held events for that key after it,
+ * so that a flapping object is reported at most twice per window, ending in its
+ * final state. The source is only paused when the held events fill up.
+ * 
+ * Returns 0 if initialization failed, in which case func_free was called.
+ */
+int event_template_new (event_template *o, NCDModuleInst *i, int blog_channel, int maxevents, btime_t debounce,
+                        const char *key_name, void *user, event_template_func_free func_free);
 void event_template_die (event_template *o);
+void event_template_die_error (event_template *o);
 int event_template_getvar (event_template *o, const char *name, NCDValMem *mem, NCDValRef *out);
-void event_template_queue (event_template *o, BStringMap map, int *out_was_empty);
-void event_template_dequeue (event_template *o, int *out_is_empty);
+void event_template_queue (event_template *o, BStringMap map, int *out_pause);
+void event_template_dequeue (event_template *o, int *out_resume);
 int event_template_is_enabled (event_template *o);
 
+/*
+ * Reads the options map which event template users take as their last argument.
+ * Recognized options are "debounce" (milliseconds, default 0). An invalid options_arg
+ * means no options were given.
+ */
+int event_template_read_options (NCDModuleInst *i, int blog_channel, NCDValRef options_arg, btime_t *out_debounce) WARN_UNUSED;
+
 #endif
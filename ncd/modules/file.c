@@ -30,18 +30,23 @@
  * 
  * File I/O module.
  * 
+ * The file operations are performed on worker threads, so they do not block the
+ * interpreter. Statements go up once the operation has completed. If a statement
+ * is asked to die while its operation is still running, the interpreter waits for
+ * the operation to finish.
+ * 
  * Synopsis:
- *   file_read(string filename)
+ *   file_read(string filename [, string mode])
  * 
  * Variables:
  *   string (empty) - file contents
  * 
  * Description:
  *   Reads the contents of a file. Reports an error if something goes wrong.
- *   WARNING: this uses fopen/fread/fclose, blocking the entire interpreter while
- *            the file is being read. For this reason, you should only use this
- *            to read small local files which will be read quickly, and especially
- *            not files on network mounts.
+ *   'mode' may be "read" (default) or "mmap". With "mmap", a non-empty regular file
+ *   is mapped into memory instead of being read into an allocated buffer, and the
+ *   contents are shared with the values obtained from this statement rather than
+ *   copied. The file should then not be truncated while the statement exists.
  * 
  * Synopsis:
  *   file_write(string filename, string contents)
@@ -54,10 +59,6 @@
  *            fails, the file may remain in an inconsistent state indefinitely.
  *            If this is a problem, you should write the new contents to a temporary
  *            file and rename this temporary file to the live file.
- *   WARNING: this uses fopen/fwrite/fclose, blocking the entire interpreter while
- *            the file is being written. For this reason, you should only use this
- *            to write small local files which will be written quickly, and especially
- *            not files on network mounts.
  * 
  * Synopsis:
  *   file_stat(string filename)
@@ -67,7 +68,6 @@
  *   Retrieves information about a file.
  *   file_stat() follows symlinks; file_lstat() does not and allows retrieving information
  *   about a symlink.
- *   WARNING: this blocks the interpreter
  * 
  * Variables:
  *   succeeded - whether the stat operation succeeded (true/false). If false, all other
@@ -81,28 +81,222 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <misc/read_file.h>
 #include <misc/write_file.h>
 #include <misc/parse_number.h>
+#include <misc/offset.h>
+#include <misc/BRefTarget.h>
+#include <threadwork/BThreadWork.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_file.h>
 
+#ifdef BADVPN_EMSCRIPTEN
+#define FILE_NUM_THREADS 0
+#else
+#define FILE_NUM_THREADS 2
+#endif
+
+#define STATE_WORKING 1
+#define STATE_DONE 2
+
+struct global {
+    BReactor *reactor;
+    int have_twd;
+    BThreadWorkDispatcher twd;
+};
+
+struct file_data {
+    BRefTarget ref_target;
+    uint8_t *data;
+    size_t len;
+    int mapped;
+};
+
 struct read_instance {
     NCDModuleInst *i;
-    uint8_t *file_data;
-    size_t file_len;
+    int state;
+    BThreadWork work;
+    NCDValNullTermString filename_nts;
+    int use_mmap;
+    int succeeded;
+    struct file_data *fdata;
+};
+
+struct write_instance {
+    NCDModuleInst *i;
+    int state;
+    BThreadWork work;
+    NCDValNullTermString filename_nts;
+    MemRef contents;
+    int succeeded;
 };
 
 struct stat_instance {
     NCDModuleInst *i;
+    int state;
+    BThreadWork work;
+    NCDValNullTermString filename_nts;
+    int is_lstat;
     int succeeded;
     struct stat result;
 };
 
+static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCDModuleInst_iparams *params)
+{
+    // allocate global state structure
+    struct global *g = BAlloc(sizeof(*g));
+    if (!g) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // set group state pointer
+    group->group_state = g;
+    
+    // remember reactor, the dispatcher is only started when needed
+    g->reactor = params->reactor;
+    g->have_twd = 0;
+    
+    return 1;
+}
+
+static void func_globalfree (struct NCDInterpModuleGroup *group)
+{
+    struct global *g = group->group_state;
+    
+    // free work dispatcher
+    if (g->have_twd) {
+        BThreadWorkDispatcher_Free(&g->twd);
+    }
+    
+    // free global state structure
+    BFree(g);
+}
+
+static BThreadWorkDispatcher * get_dispatcher (NCDModuleInst *i)
+{
+    struct global *g = ModuleGlobal(i);
+    
+    if (!g->have_twd) {
+        if (!BThreadWorkDispatcher_Init(&g->twd, g->reactor, FILE_NUM_THREADS)) {
+            ModuleLog(i, BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+            return NULL;
+        }
+        g->have_twd = 1;
+    }
+    
+    return &g->twd;
+}
+
+static void file_data_free (struct file_data *fd)
+{
+    if (fd->mapped) {
+        munmap(fd->data, fd->len);
+    } else {
+        free(fd->data);
+    }
+    
+    BFree(fd);
+}
+
+static void file_data_ref_target_func_release (BRefTarget *ref_target)
+{
+    struct file_data *fd = UPPER_OBJECT(ref_target, struct file_data, ref_target);
+    
+    file_data_free(fd);
+}
+
+static int map_file (const char *filename, struct file_data *fd)
+{
+    int file = open(filename, O_RDONLY);
+    if (file < 0) {
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(file, &st) < 0) {
+        goto fail;
+    }
+    
+    // only map non-empty regular files which fit into memory
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+        close(file);
+        return 0;
+    }
+    
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (addr == MAP_FAILED) {
+        goto fail;
+    }
+    
+    close(file);
+    
+    fd->data = addr;
+    fd->len = st.st_size;
+    fd->mapped = 1;
+    
+    return 1;
+    
+fail:
+    close(file);
+    return -1;
+}
+
+static void read_work_func (void *vo)
+{
+    struct read_instance *o = vo;
+    
+    o->succeeded = 0;
+    
+    if (o->use_mmap) {
+        int res = map_file(o->filename_nts.data, o->fdata);
+        if (res < 0) {
+            return;
+        }
+        if (res > 0) {
+            o->succeeded = 1;
+            return;
+        }
+    }
+    
+    o->fdata->mapped = 0;
+    o->succeeded = read_file(o->filename_nts.data, &o->fdata->data, &o->fdata->len);
+}
+
+static void read_work_handler_done (void *vo)
+{
+    struct read_instance *o = vo;
+    ASSERT(o->state == STATE_WORKING)
+    
+    // free work
+    BThreadWork_Free(&o->work);
+    
+    // free filename
+    NCDValNullTermString_Free(&o->filename_nts);
+    
+    if (!o->succeeded) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to read file");
+        BFree(o->fdata);
+        NCDModuleInst_Backend_DeadError(o->i);
+        return;
+    }
+    
+    // init reference target for sharing the contents
+    BRefTarget_Init(&o->fdata->ref_target, file_data_ref_target_func_release);
+    
+    // set state done
+    o->state = STATE_DONE;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+}
+
 static void read_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct read_instance *o = vo;
@@ -110,34 +304,57 @@ static void read_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIns
     
     // read arguments
     NCDValRef filename_arg;
-    if (!NCDVal_ListRead(params->args, 1, &filename_arg)) {
+    NCDValRef mode_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &filename_arg) &&
+        !NCDVal_ListRead(params->args, 2, &filename_arg, &mode_arg)
+    ) {
         ModuleLog(i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
-    if (!NCDVal_IsStringNoNulls(filename_arg)) {
+    if (!NCDVal_IsStringNoNulls(filename_arg) || (!NCDVal_IsInvalid(mode_arg) && !NCDVal_IsString(mode_arg))) {
         ModuleLog(i, BLOG_ERROR, "wrong type");
         goto fail0;
     }
     
-    // get null terminated name
-    NCDValNullTermString filename_nts;
-    if (!NCDVal_StringNullTerminate(filename_arg, &filename_nts)) {
-        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+    // parse mode
+    o->use_mmap = 0;
+    if (!NCDVal_IsInvalid(mode_arg)) {
+        if (NCDVal_StringEquals(mode_arg, "mmap")) {
+            o->use_mmap = 1;
+        }
+        else if (!NCDVal_StringEquals(mode_arg, "read")) {
+            ModuleLog(i, BLOG_ERROR, "unknown mode");
+            goto fail0;
+        }
+    }
+    
+    // get work dispatcher
+    BThreadWorkDispatcher *twd = get_dispatcher(i);
+    if (!twd) {
         goto fail0;
     }
     
-    // read file
-    int res = read_file(filename_nts.data, &o->file_data, &o->file_len);
-    NCDValNullTermString_Free(&filename_nts);
-    if (!res) {
-        ModuleLog(i, BLOG_ERROR, "failed to read file");
+    // allocate file data
+    if (!(o->fdata = BAlloc(sizeof(*o->fdata)))) {
+        ModuleLog(i, BLOG_ERROR, "BAlloc failed");
         goto fail0;
     }
     
-    // signal up
-    NCDModuleInst_Backend_Up(i);
+    // get null terminated name
+    if (!NCDVal_StringNullTerminate(filename_arg, &o->filename_nts)) {
+        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+        goto fail1;
+    }
+    
+    // start reading
+    BThreadWork_Init(&o->work, twd, read_work_handler_done, o, read_work_func, o);
+    
+    // set state working
+    o->state = STATE_WORKING;
     return;
     
+fail1:
+    BFree(o->fdata);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -146,8 +363,23 @@ static void read_func_die (void *vo)
 {
     struct read_instance *o = vo;
     
-    // free data
-    free(o->file_data);
+    if (o->state == STATE_WORKING) {
+        // wait for or cancel the work
+        BThreadWork_Free(&o->work);
+        
+        // free filename
+        NCDValNullTermString_Free(&o->filename_nts);
+        
+        // free any data which was read
+        if (o->succeeded) {
+            file_data_free(o->fdata);
+        } else {
+            BFree(o->fdata);
+        }
+    } else {
+        // release data, values obtained from us may still reference it
+        BRefTarget_Deref(&o->fdata->ref_target);
+    }
     
     NCDModuleInst_Backend_Dead(o->i);
 }
@@ -155,17 +387,52 @@ static void read_func_die (void *vo)
 static int read_func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out)
 {
     struct read_instance *o = vo;
+    ASSERT(o->state == STATE_DONE)
     
     if (name == NCD_STRING_EMPTY) {
-        *out = NCDVal_NewStringBin(mem, o->file_data, o->file_len);
+        *out = NCDVal_NewExternalString(mem, (const char *)o->fdata->data, o->fdata->len, &o->fdata->ref_target);
         return 1;
     }
     
     return 0;
 }
 
-static void write_func_new (void *unused, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+static void write_work_func (void *vo)
 {
+    struct write_instance *o = vo;
+    
+    o->succeeded = write_file(o->filename_nts.data, o->contents);
+}
+
+static void write_work_handler_done (void *vo)
+{
+    struct write_instance *o = vo;
+    ASSERT(o->state == STATE_WORKING)
+    
+    // free work
+    BThreadWork_Free(&o->work);
+    
+    // free filename
+    NCDValNullTermString_Free(&o->filename_nts);
+    
+    if (!o->succeeded) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to write file");
+        NCDModuleInst_Backend_DeadError(o->i);
+        return;
+    }
+    
+    // set state done
+    o->state = STATE_DONE;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+}
+
+static void write_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct write_instance *o = vo;
+    o->i = i;
+    
     // read arguments
     NCDValRef filename_arg;
     NCDValRef contents_arg;
@@ -178,33 +445,84 @@ static void write_func_new (void *unused, NCDModuleInst *i, const struct NCDModu
         goto fail0;
     }
     
-    // get null terminated name
-    NCDValNullTermString filename_nts;
-    if (!NCDVal_StringNullTerminate(filename_arg, &filename_nts)) {
-        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+    // the arguments stay unchanged while we exist
+    o->contents = NCDVal_StringMemRef(contents_arg);
+    
+    // get work dispatcher
+    BThreadWorkDispatcher *twd = get_dispatcher(i);
+    if (!twd) {
         goto fail0;
     }
     
-    // write file
-    int res = write_file(filename_nts.data, NCDVal_StringMemRef(contents_arg));
-    NCDValNullTermString_Free(&filename_nts);
-    if (!res) {
-        ModuleLog(i, BLOG_ERROR, "failed to write file");
+    // get null terminated name
+    if (!NCDVal_StringNullTerminate(filename_arg, &o->filename_nts)) {
+        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
         goto fail0;
     }
     
-    // signal up
-    NCDModuleInst_Backend_Up(i);
+    // start writing
+    BThreadWork_Init(&o->work, twd, write_work_handler_done, o, write_work_func, o);
+    
+    // set state working
+    o->state = STATE_WORKING;
     return;
     
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
 
+static void write_func_die (void *vo)
+{
+    struct write_instance *o = vo;
+    
+    if (o->state == STATE_WORKING) {
+        // wait for or cancel the work
+        BThreadWork_Free(&o->work);
+        
+        // free filename
+        NCDValNullTermString_Free(&o->filename_nts);
+    }
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void stat_work_func (void *vo)
+{
+    struct stat_instance *o = vo;
+    
+    int res;
+    if (o->is_lstat) {
+        res = lstat(o->filename_nts.data, &o->result);
+    } else {
+        res = stat(o->filename_nts.data, &o->result);
+    }
+    
+    o->succeeded = (res == 0);
+}
+
+static void stat_work_handler_done (void *vo)
+{
+    struct stat_instance *o = vo;
+    ASSERT(o->state == STATE_WORKING)
+    
+    // free work
+    BThreadWork_Free(&o->work);
+    
+    // free filename
+    NCDValNullTermString_Free(&o->filename_nts);
+    
+    // set state done
+    o->state = STATE_DONE;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+}
+
 static void stat_func_new_common (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, int is_lstat)
 {
     struct stat_instance *o = vo;
     o->i = i;
+    o->is_lstat = is_lstat;
     
     NCDValRef filename_arg;
     if (!NCDVal_ListRead(params->args, 1, &filename_arg)) {
@@ -219,32 +537,28 @@ static void stat_func_new_common (void *vo, NCDModuleInst *i, const struct NCDMo
     o->succeeded = 0;
     
     if (!NCDVal_IsStringNoNulls(filename_arg)) {
-        goto out;
+        o->state = STATE_DONE;
+        NCDModuleInst_Backend_Up(i);
+        return;
     }
     
-    // null terminate filename
-    NCDValNullTermString filename_nts;
-    if (!NCDVal_StringNullTerminate(filename_arg, &filename_nts)) {
-        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+    // get work dispatcher
+    BThreadWorkDispatcher *twd = get_dispatcher(i);
+    if (!twd) {
         goto fail0;
     }
     
-    int res;
-    if (is_lstat) {
-        res = lstat(filename_nts.data, &o->result);
-    } else {
-        res = stat(filename_nts.data, &o->result);
-    }
-    NCDValNullTermString_Free(&filename_nts);
-    
-    if (res < 0) {
-        goto out;
+    // null terminate filename
+    if (!NCDVal_StringNullTerminate(filename_arg, &o->filename_nts)) {
+        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+        goto fail0;
     }
     
-    o->succeeded = 1;
+    // start stat
+    BThreadWork_Init(&o->work, twd, stat_work_handler_done, o, stat_work_func, o);
     
-out:
-    NCDModuleInst_Backend_Up(i);
+    // set state working
+    o->state = STATE_WORKING;
     return;
     
 fail0:
@@ -261,9 +575,25 @@ static void lstat_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIn
     stat_func_new_common(vo, i, params, 1);
 }
 
+static void stat_func_die (void *vo)
+{
+    struct stat_instance *o = vo;
+    
+    if (o->state == STATE_WORKING) {
+        // wait for or cancel the work
+        BThreadWork_Free(&o->work);
+        
+        // free filename
+        NCDValNullTermString_Free(&o->filename_nts);
+    }
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
 static int stat_func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out)
 {
     struct stat_instance *o = vo;
+    ASSERT(o->state == STATE_DONE)
     
     if (name == NCD_STRING_SUCCEEDED) {
         *out = ncd_make_boolean(mem, o->succeeded);
@@ -321,15 +651,19 @@ static struct NCDModule modules[] = {
         .alloc_size = sizeof(struct read_instance)
     }, {
         .type = "file_write",
-        .func_new2 = write_func_new
+        .func_new2 = write_func_new,
+        .func_die = write_func_die,
+        .alloc_size = sizeof(struct write_instance)
     }, {
         .type = "file_stat",
         .func_new2 = stat_func_new,
+        .func_die = stat_func_die,
         .func_getvar2 = stat_func_getvar2,
         .alloc_size = sizeof(struct stat_instance)
     }, {
         .type = "file_lstat",
         .func_new2 = lstat_func_new,
+        .func_die = stat_func_die,
         .func_getvar2 = stat_func_getvar2,
         .alloc_size = sizeof(struct stat_instance)
     }, {
@@ -338,5 +672,7 @@ static struct NCDModule modules[] = {
 };
 
 const struct NCDModuleGroup ncdmodule_file = {
+    .func_globalinit = func_globalinit,
+    .func_globalfree = func_globalfree,
     .modules = modules
 };
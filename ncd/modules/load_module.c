@@ -258,7 +258,7 @@ static void func_new (void *unused, NCDModuleInst *i, const struct NCDModuleInst
         }
         
         // load it as a dynamic library
-        mod->lib_handle = dlopen(module_path, RTLD_NOW);
+        mod->lib_handle = dlopen(module_path, RTLD_LAZY);
         BFree(module_path);
         if (!mod->lib_handle) {
             ModuleLog(i, BLOG_ERROR, "dlopen failed");
@@ -74,6 +74,7 @@
 #include <misc/debug.h>
 #include <misc/balloc.h>
 #include <structure/LinkedList1.h>
+#include <ncd/modules/depend_index.h>
 
 #include <ncd/module_common.h>
 
@@ -81,47 +82,78 @@
 
 struct provide {
     NCDModuleInst *i;
-    NCDValRef name;
-    LinkedList1Node provides_list_node;
+    struct depend_index_entry *entry;
     LinkedList1 depends_list;
     int dying;
 };
 
+struct depend_watch {
+    struct depend *depend;
+    struct depend_index_entry *entry;
+    LinkedList1Node watchers_node;
+};
+
 struct depend {
     NCDModuleInst *i;
-    NCDValRef names;
-    LinkedList1Node depends_list_node;
+    struct depend_watch *watches;
+    size_t num_watches;
     struct provide *provide;
     LinkedList1Node provide_depends_list_node;
     int provide_collapsing;
 };
 
 struct global {
-    LinkedList1 provides_list;
-    LinkedList1 depends_list;
+    depend_index index;
 };
 
-static struct provide * find_provide (struct global *g, NCDValRef name)
+static void depend_unwatch_names (struct depend *o, depend_index *index)
 {
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&g->provides_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct provide *provide = UPPER_OBJECT(ln, struct provide, provides_list_node);
-        if (NCDVal_Compare(provide->name, name) == 0) {
-            return provide;
-        }
+    for (size_t j = 0; j < o->num_watches; j++) {
+        struct depend_watch *w = &o->watches[j];
+        
+        // remove from entry's watchers list
+        LinkedList1_Remove(&w->entry->watchers, &w->watchers_node);
+        
+        // free the index entry if nothing uses it
+        depend_index_release(index, w->entry);
     }
     
-    return NULL;
+    // free watches
+    BFree(o->watches);
 }
 
-static struct provide * depend_find_best_provide (struct depend *o)
+static int depend_watch_names (struct depend *o, depend_index *index, NCDValRef names)
 {
-    struct global *g = ModuleGlobal(o->i);
+    size_t count = NCDVal_ListCount(names);
     
-    size_t count = NCDVal_ListCount(o->names);
+    // allocate watches
+    o->watches = NULL;
+    if (count > 0 && !(o->watches = BAllocArray(count, sizeof(o->watches[0])))) {
+        ModuleLog(o->i, BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
     
-    for (size_t j = 0; j < count; j++) {
-        NCDValRef name = NCDVal_ListGet(o->names, j);
-        struct provide *provide = find_provide(g, name);
+    // watch each name, so that provides of these names find us directly
+    for (o->num_watches = 0; o->num_watches < count; o->num_watches++) {
+        struct depend_watch *w = &o->watches[o->num_watches];
+        
+        if (!(w->entry = depend_index_get(index, NCDVal_ListGet(names, o->num_watches)))) {
+            ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+            depend_unwatch_names(o, index);
+            return 0;
+        }
+        
+        w->depend = o;
+        LinkedList1_Append(&w->entry->watchers, &w->watchers_node);
+    }
+    
+    return 1;
+}
+
+static struct provide * depend_find_best_provide (struct depend *o)
+{
+    for (size_t j = 0; j < o->num_watches; j++) {
+        struct provide *provide = o->watches[j].entry->provide;
         if (provide && !provide->dying) {
             return provide;
         }
@@ -179,20 +211,25 @@ static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCD
     // set group state pointer
     group->group_state = g;
     
-    // init provides list
-    LinkedList1_Init(&g->provides_list);
-    
-    // init depends list
-    LinkedList1_Init(&g->depends_list);
+    // init name index
+    if (!depend_index_init(&g->index, params->string_index)) {
+        BLog(BLOG_ERROR, "depend_index_init failed");
+        goto fail1;
+    }
     
     return 1;
+    
+fail1:
+    BFree(g);
+    return 0;
 }
 
 static void func_globalfree (struct NCDInterpModuleGroup *group)
 {
     struct global *g = group->group_state;
-    ASSERT(LinkedList1_IsEmpty(&g->depends_list))
-    ASSERT(LinkedList1_IsEmpty(&g->provides_list))
+    
+    // free name index
+    depend_index_free(&g->index);
     
     // free global state structure
     BFree(g);
@@ -211,17 +248,20 @@ static void provide_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
         goto fail0;
     }
     
-    // remember name
-    o->name = name_arg;
+    // get index entry for the name
+    if (!(o->entry = depend_index_get(&g->index, name_arg))) {
+        ModuleLog(o->i, BLOG_ERROR, "depend_index_get failed");
+        goto fail0;
+    }
     
     // check for existing provide with this name
-    if (find_provide(g, o->name)) {
+    if (o->entry->provide) {
         ModuleLog(o->i, BLOG_ERROR, "a provide with this name already exists");
         goto fail0;
     }
     
-    // insert to provides list
-    LinkedList1_Append(&g->provides_list, &o->provides_list_node);
+    // set as the provide for the name
+    o->entry->provide = o;
     
     // init depends list
     LinkedList1_Init(&o->depends_list);
@@ -234,10 +274,10 @@ static void provide_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     // computed before this process advances, avoiding problems like failed variable resolutions.
     NCDModuleInst_Backend_Up(o->i);
     
-    // update depends
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&g->depends_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct depend *depend = UPPER_OBJECT(ln, struct depend, depends_list_node);
-        depend_update(depend);
+    // update depends interested in this name
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->entry->watchers); ln; ln = LinkedList1Node_Next(ln)) {
+        struct depend_watch *w = UPPER_OBJECT(ln, struct depend_watch, watchers_node);
+        depend_update(w->depend);
     }
     
     return;
@@ -251,8 +291,12 @@ static void provide_free (struct provide *o)
     struct global *g = ModuleGlobal(o->i);
     ASSERT(LinkedList1_IsEmpty(&o->depends_list))
     
-    // remove from provides list
-    LinkedList1_Remove(&g->provides_list, &o->provides_list_node);
+    // unset as the provide for the name
+    ASSERT(o->entry->provide == o)
+    o->entry->provide = NULL;
+    
+    // free the index entry if nothing uses it
+    depend_index_release(&g->index, o->entry);
     
     NCDModuleInst_Backend_Dead(o->i);
 }
@@ -298,11 +342,10 @@ static void depend_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
         goto fail0;
     }
     
-    // remember names
-    o->names = names_arg;
-    
-    // insert to depends list
-    LinkedList1_Append(&g->depends_list, &o->depends_list_node);
+    // watch names
+    if (!depend_watch_names(o, &g->index, names_arg)) {
+        goto fail0;
+    }
     
     // set no provide
     o->provide = NULL;
@@ -330,8 +373,8 @@ static void depend_func_die (void *vo)
         }
     }
     
-    // remove from depends list
-    LinkedList1_Remove(&g->depends_list, &o->depends_list_node);
+    // stop watching names
+    depend_unwatch_names(o, &g->index);
     
     NCDModuleInst_Backend_Dead(o->i);
 }
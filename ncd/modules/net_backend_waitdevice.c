@@ -132,7 +132,7 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     o->ifname = NCDVal_StringMemRef(arg);
     
     // init client
-    NCDUdevClient_Init(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler);
+    NCDUdevClient_InitFilter(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler, "SUBSYSTEM", "net");
     
     // compile regex
     if (regcomp(&o->reg, DEVPATH_REGEX, REG_EXTENDED)) {
@@ -173,27 +173,25 @@ static int set_servers (struct global *g)
     struct dns_sort_entry temp;
     BInsertionSort(sort_entries, num_entries, sizeof(sort_entries[0]), dns_sort_comparator, &temp);
     
+    char buf[512];
     ExpString estr;
-    if (!ExpString_Init(&estr)) {
-        goto fail1;
-    }
+    ExpString_InitBuf(&estr, buf, sizeof(buf));
     
     for (size_t i = 0; i < num_entries; i++) {
         if (!ExpString_Append(&estr, sort_entries[i].line)) {
-            goto fail2;
+            goto fail1;
         }
     }
     
     // set servers
     if (!NCDIfConfig_set_resolv_conf(ExpString_Get(&estr), ExpString_Length(&estr))) {
-        goto fail2;
+        goto fail1;
     }
     
     ret = 1;
     
-fail2:
-    ExpString_Free(&estr);
 fail1:
+    ExpString_Free(&estr);
     BFree(sort_entries);
 fail0:
     return ret;
@@ -90,6 +90,32 @@
  *   deinit: ebtables -t table -X chain
  * 
  * Synopsis:
+ *   net.iptables.transaction()
+ *   net.ip6tables.transaction()
+ * Description:
+ *   Collects rules given to its append() and insert() methods, so that commit() can apply
+ *   them all with a single "iptables-restore --noflush" (or ip6tables-restore) run instead
+ *   of one iptables process per rule.
+ * 
+ * Synopsis:
+ *   net.iptables.transaction::append(string table, string chain, string arg1 ...)
+ *   net.iptables.transaction::insert(string table, string chain, string arg1 ...)
+ * Description:
+ *   Adds a rule to the transaction and goes up immediately. The rule is not applied
+ *   until commit(), and must be added before commit() is called. Like the plain append
+ *   and insert commands, these may also be called with a single list argument.
+ * 
+ * Synopsis:
+ *   net.iptables.transaction::commit()
+ * Description:
+ *   init:   applies all rules of the transaction with one iptables-restore run, using
+ *           -A or -I for each rule, in order
+ *   deinit: deletes the rules applied in init with one iptables-restore run, using -D
+ *           for each rule, in reverse order
+ *   The commit owns the applied rules; they are removed when the commit goes down,
+ *   regardless of when the rule statements themselves go down.
+ * 
+ * Synopsis:
  *   net.iptables.lock()
  * Description:
  *   Use at the beginning of a block of custom iptables/ebtables commands to make sure
@@ -110,10 +136,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdio.h>
 
 #include <misc/debug.h>
 #include <misc/find_program.h>
 #include <misc/balloc.h>
+#include <misc/expstring.h>
+#include <misc/offset.h>
+#include <structure/LinkedList1.h>
 #include <ncd/modules/command_template.h>
 
 #include <ncd/module_common.h>
@@ -150,7 +180,45 @@ struct unlock_instance {
     struct lock_instance *lock;
 };
 
+struct commit_instance;
+
+struct transaction_instance {
+    NCDModuleInst *i;
+    const char *prog;
+    LinkedList1 rules_list;
+    struct commit_instance *commit;
+};
+
+struct rule_instance {
+    NCDModuleInst *i;
+    struct transaction_instance *trans;
+    LinkedList1Node rules_list_node; // if trans
+    NCDValRef args;
+    const char *type;
+};
+
+#define COMMIT_STATE_ADDING_LOCK 1
+#define COMMIT_STATE_ADDING 2
+#define COMMIT_STATE_ADDING_NEED_DELETE 3
+#define COMMIT_STATE_DONE 4
+#define COMMIT_STATE_DELETING_LOCK 5
+#define COMMIT_STATE_DELETING 6
+
+struct commit_instance {
+    NCDModuleInst *i;
+    struct transaction_instance *trans;
+    int empty;
+    char *exec; // if !empty
+    ExpString do_script; // if !empty
+    ExpString undo_script; // if !empty
+    BEventLockJob lock_job; // if !empty
+    int state;
+    BProcess process;
+};
+
 static void unlock_free (struct unlock_instance *o);
+static void commit_free (struct commit_instance *o, int is_error);
+static void commit_process_handler (struct commit_instance *o, int normally, uint8_t normally_exit_status);
 
 static int build_append_or_insert_cmdline (NCDModuleInst *i, NCDValRef args, const char *prog, int remove, char **exec, CmdLine *cl, const char *type)
 {
@@ -406,6 +474,155 @@ static int build_ebtables_newchain_cmdline (NCDModuleInst *i, NCDValRef args, in
     return build_newchain_cmdline(i, args, "ebtables", remove, exec, cl);
 }
 
+static int restore_arg_is_plain (MemRef arg)
+{
+    if (arg.len == 0) {
+        return 0;
+    }
+    
+    for (size_t j = 0; j < arg.len; j++) {
+        char c = arg.ptr[j];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("_-.,:/!+=@%", c))) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static int append_restore_arg (ExpString *s, MemRef arg)
+{
+    if (!ExpString_AppendChar(s, ' ')) {
+        return 0;
+    }
+    
+    if (restore_arg_is_plain(arg)) {
+        return ExpString_AppendBinaryMr(s, arg);
+    }
+    
+    // quote the argument, escaping quotes and backslashes
+    if (!ExpString_AppendChar(s, '"')) {
+        return 0;
+    }
+    for (size_t j = 0; j < arg.len; j++) {
+        if ((arg.ptr[j] == '"' || arg.ptr[j] == '\\') && !ExpString_AppendChar(s, '\\')) {
+            return 0;
+        }
+        if (!ExpString_AppendChar(s, arg.ptr[j])) {
+            return 0;
+        }
+    }
+    return ExpString_AppendChar(s, '"');
+}
+
+static int append_restore_rule (ExpString *s, MemRef *cur_table, NCDValRef args, const char *type)
+{
+    MemRef table = NCDVal_StringMemRef(NCDVal_ListGet(args, 0));
+    
+    // start a new table section if needed
+    if (!cur_table->ptr || !MemRef_Equal(*cur_table, table)) {
+        if (cur_table->ptr && !ExpString_Append(s, "COMMIT\n")) {
+            return 0;
+        }
+        if (!ExpString_AppendChar(s, '*') || !ExpString_AppendBinaryMr(s, table) || !ExpString_AppendChar(s, '\n')) {
+            return 0;
+        }
+        *cur_table = table;
+    }
+    
+    if (!ExpString_Append(s, type)) {
+        return 0;
+    }
+    
+    size_t count = NCDVal_ListCount(args);
+    for (size_t j = 1; j < count; j++) {
+        if (!append_restore_arg(s, NCDVal_StringMemRef(NCDVal_ListGet(args, j)))) {
+            return 0;
+        }
+    }
+    
+    return ExpString_AppendChar(s, '\n');
+}
+
+static int build_restore_scripts (struct transaction_instance *t, ExpString *do_script, ExpString *undo_script)
+{
+    if (!ExpString_Init(do_script)) {
+        goto fail0;
+    }
+    
+    if (!ExpString_Init(undo_script)) {
+        goto fail1;
+    }
+    
+    // add rules in order
+    MemRef cur_table = MemRef_Make(NULL, 0);
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&t->rules_list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct rule_instance *r = UPPER_OBJECT(ln, struct rule_instance, rules_list_node);
+        if (!append_restore_rule(do_script, &cur_table, r->args, r->type)) {
+            goto fail2;
+        }
+    }
+    if (!ExpString_Append(do_script, "COMMIT\n")) {
+        goto fail2;
+    }
+    
+    // delete rules in reverse order
+    cur_table = MemRef_Make(NULL, 0);
+    for (LinkedList1Node *ln = LinkedList1_GetLast(&t->rules_list); ln; ln = LinkedList1Node_Prev(ln)) {
+        struct rule_instance *r = UPPER_OBJECT(ln, struct rule_instance, rules_list_node);
+        if (!append_restore_rule(undo_script, &cur_table, r->args, "-D")) {
+            goto fail2;
+        }
+    }
+    if (!ExpString_Append(undo_script, "COMMIT\n")) {
+        goto fail2;
+    }
+    
+    return 1;
+    
+fail2:
+    ExpString_Free(undo_script);
+fail1:
+    ExpString_Free(do_script);
+fail0:
+    return 0;
+}
+
+static int write_script_fd (ExpString *script)
+{
+    char path[] = "/tmp/badvpn-ncd-iptables-XXXXXX";
+    
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        goto fail0;
+    }
+    
+    // the file is only reached through the fd
+    unlink(path);
+    
+    const char *data = ExpString_Get(script);
+    size_t len = ExpString_Length(script);
+    while (len > 0) {
+        ssize_t res = write(fd, data, len);
+        if (res < 0) {
+            goto fail1;
+        }
+        data += res;
+        len -= res;
+    }
+    
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        goto fail1;
+    }
+    
+    return fd;
+    
+fail1:
+    close(fd);
+fail0:
+    return -1;
+}
+
 static void lock_job_handler (struct lock_instance *o)
 {
     ASSERT(o->state == LOCK_STATE_LOCKING || o->state == LOCK_STATE_RELOCKING)
@@ -655,6 +872,366 @@ static void unlock_free (struct unlock_instance *o)
     NCDModuleInst_Backend_Dead(o->i);
 }
 
+static int start_restore (struct commit_instance *o, ExpString *script)
+{
+    // write script to a file which becomes the program's stdin
+    int fd = write_script_fd(script);
+    if (fd < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to write rules file");
+        goto fail0;
+    }
+    
+    // build cmdline
+    CmdLine cl;
+    if (!CmdLine_Init(&cl)) {
+        ModuleLog(o->i, BLOG_ERROR, "CmdLine_Init failed");
+        goto fail1;
+    }
+    if (!CmdLine_AppendMulti(&cl, 2, o->exec, "--noflush") || !CmdLine_Finish(&cl)) {
+        ModuleLog(o->i, BLOG_ERROR, "CmdLine_Append failed");
+        goto fail2;
+    }
+    
+    int fds[] = {fd, -1};
+    int fds_map[] = {0};
+    
+    struct BProcess_params p_params;
+    p_params.username = NULL;
+    p_params.fds = fds;
+    p_params.fds_map = fds_map;
+    p_params.do_setsid = 0;
+    
+    // start process
+    if (!BProcess_Init2(&o->process, o->i->params->iparams->manager, (BProcess_handler)commit_process_handler, o, o->exec, CmdLine_Get(&cl), p_params)) {
+        ModuleLog(o->i, BLOG_ERROR, "BProcess_Init2 failed");
+        goto fail2;
+    }
+    
+    CmdLine_Free(&cl);
+    close(fd);
+    return 1;
+    
+fail2:
+    CmdLine_Free(&cl);
+fail1:
+    close(fd);
+fail0:
+    return 0;
+}
+
+static void commit_lock_handler (struct commit_instance *o)
+{
+    ASSERT(o->state == COMMIT_STATE_ADDING_LOCK || o->state == COMMIT_STATE_DELETING_LOCK)
+    
+    if (o->state == COMMIT_STATE_ADDING_LOCK) {
+        if (!start_restore(o, &o->do_script)) {
+            commit_free(o, 1);
+            return;
+        }
+        
+        // set state
+        o->state = COMMIT_STATE_ADDING;
+    } else {
+        if (!start_restore(o, &o->undo_script)) {
+            commit_free(o, 1);
+            return;
+        }
+        
+        // set state
+        o->state = COMMIT_STATE_DELETING;
+    }
+}
+
+static void commit_process_handler (struct commit_instance *o, int normally, uint8_t normally_exit_status)
+{
+    ASSERT(o->state == COMMIT_STATE_ADDING || o->state == COMMIT_STATE_ADDING_NEED_DELETE || o->state == COMMIT_STATE_DELETING)
+    
+    // release lock
+    BEventLockJob_Release(&o->lock_job);
+    
+    // free process
+    BProcess_Free(&o->process);
+    
+    if (!normally || normally_exit_status != 0) {
+        ModuleLog(o->i, BLOG_ERROR, "%s failed", o->exec);
+        commit_free(o, 1);
+        return;
+    }
+    
+    switch (o->state) {
+        case COMMIT_STATE_ADDING: {
+            // set state
+            o->state = COMMIT_STATE_DONE;
+            
+            // signal up
+            NCDModuleInst_Backend_Up(o->i);
+        } break;
+        
+        case COMMIT_STATE_ADDING_NEED_DELETE: {
+            // wait for lock
+            BEventLockJob_Wait(&o->lock_job);
+            
+            // set state
+            o->state = COMMIT_STATE_DELETING_LOCK;
+        } break;
+        
+        case COMMIT_STATE_DELETING: {
+            commit_free(o, 0);
+            return;
+        } break;
+    }
+}
+
+static void transaction_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, const char *prog)
+{
+    struct transaction_instance *o = vo;
+    o->i = i;
+    o->prog = prog;
+    
+    // check arguments
+    if (!NCDVal_ListRead(params->args, 0)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    
+    // init rules list
+    LinkedList1_Init(&o->rules_list);
+    
+    // set no commit
+    o->commit = NULL;
+    
+    // go up
+    NCDModuleInst_Backend_Up(i);
+    return;
+    
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void transaction_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    transaction_func_new(vo, i, params, "iptables-restore");
+}
+
+static void transaction_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    transaction_func_new(vo, i, params, "ip6tables-restore");
+}
+
+static void transaction_func_die (void *vo)
+{
+    struct transaction_instance *o = vo;
+    
+    // detach rules
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&o->rules_list)) {
+        struct rule_instance *r = UPPER_OBJECT(ln, struct rule_instance, rules_list_node);
+        ASSERT(r->trans == o)
+        LinkedList1_Remove(&o->rules_list, &r->rules_list_node);
+        r->trans = NULL;
+    }
+    
+    // detach commit; it keeps its own copy of the rules
+    if (o->commit) {
+        ASSERT(o->commit->trans == o)
+        o->commit->trans = NULL;
+    }
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void rule_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, const char *type)
+{
+    struct rule_instance *o = vo;
+    o->i = i;
+    o->type = type;
+    
+    struct transaction_instance *trans = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
+    
+    // rules can only be added before the commit
+    if (trans->commit) {
+        ModuleLog(i, BLOG_ERROR, "transaction already committed");
+        goto fail0;
+    }
+    
+    NCDValRef args = params->args;
+    if (NCDVal_ListRead(args, 1, &args) && !NCDVal_IsList(args)) {
+        ModuleLog(i, BLOG_ERROR, "in one-argument form a list is expected");
+        goto fail0;
+    }
+    
+    // check arguments
+    size_t count = NCDVal_ListCount(args);
+    if (count < 2) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    for (size_t j = 0; j < count; j++) {
+        NCDValRef arg = NCDVal_ListGet(args, j);
+        if (!NCDVal_IsStringNoNulls(arg)) {
+            ModuleLog(i, BLOG_ERROR, "wrong type");
+            goto fail0;
+        }
+        MemRef arg_mr = NCDVal_StringMemRef(arg);
+        if (memchr(arg_mr.ptr, '\n', arg_mr.len) || (j == 0 && !restore_arg_is_plain(arg_mr))) {
+            ModuleLog(i, BLOG_ERROR, "bad argument");
+            goto fail0;
+        }
+    }
+    o->args = args;
+    
+    // add to transaction
+    o->trans = trans;
+    LinkedList1_Append(&trans->rules_list, &o->rules_list_node);
+    
+    // go up
+    NCDModuleInst_Backend_Up(i);
+    return;
+    
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void rule_append_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    rule_func_new(vo, i, params, "-A");
+}
+
+static void rule_insert_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    rule_func_new(vo, i, params, "-I");
+}
+
+static void rule_func_die (void *vo)
+{
+    struct rule_instance *o = vo;
+    
+    // remove from transaction
+    if (o->trans) {
+        LinkedList1_Remove(&o->trans->rules_list, &o->rules_list_node);
+    }
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void commit_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct global *g = ModuleGlobal(i);
+    struct commit_instance *o = vo;
+    o->i = i;
+    
+    struct transaction_instance *trans = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
+    
+    // check arguments
+    if (!NCDVal_ListRead(params->args, 0)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    
+    if (trans->commit) {
+        ModuleLog(i, BLOG_ERROR, "transaction already committed");
+        goto fail0;
+    }
+    
+    // nothing to do without rules
+    o->empty = LinkedList1_IsEmpty(&trans->rules_list);
+    
+    if (!o->empty) {
+        // find program
+        if (!(o->exec = badvpn_find_program(trans->prog))) {
+            ModuleLog(i, BLOG_ERROR, "failed to find program: %s", trans->prog);
+            goto fail0;
+        }
+        
+        // build scripts
+        if (!build_restore_scripts(trans, &o->do_script, &o->undo_script)) {
+            ModuleLog(i, BLOG_ERROR, "build_restore_scripts failed");
+            goto fail1;
+        }
+        
+        // wait for lock
+        BEventLockJob_Init(&o->lock_job, &g->iptables_lock, (BEventLock_handler)commit_lock_handler, o);
+        BEventLockJob_Wait(&o->lock_job);
+        
+        // set state
+        o->state = COMMIT_STATE_ADDING_LOCK;
+    } else {
+        // set state
+        o->state = COMMIT_STATE_DONE;
+        
+        // go up
+        NCDModuleInst_Backend_Up(i);
+    }
+    
+    // set commit in transaction
+    o->trans = trans;
+    trans->commit = o;
+    return;
+    
+fail1:
+    free(o->exec);
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void commit_free (struct commit_instance *o, int is_error)
+{
+    // detach from transaction
+    if (o->trans) {
+        ASSERT(o->trans->commit == o)
+        o->trans->commit = NULL;
+    }
+    
+    if (!o->empty) {
+        // free lock job
+        BEventLockJob_Free(&o->lock_job);
+        
+        // free scripts
+        ExpString_Free(&o->undo_script);
+        ExpString_Free(&o->do_script);
+        
+        // free program
+        free(o->exec);
+    }
+    
+    if (is_error) {
+        NCDModuleInst_Backend_DeadError(o->i);
+    } else {
+        NCDModuleInst_Backend_Dead(o->i);
+    }
+}
+
+static void commit_func_die (void *vo)
+{
+    struct commit_instance *o = vo;
+    ASSERT(o->state == COMMIT_STATE_ADDING_LOCK || o->state == COMMIT_STATE_ADDING || o->state == COMMIT_STATE_DONE)
+    
+    switch (o->state) {
+        case COMMIT_STATE_ADDING_LOCK: {
+            commit_free(o, 0);
+            return;
+        } break;
+        
+        case COMMIT_STATE_ADDING: {
+            // set state
+            o->state = COMMIT_STATE_ADDING_NEED_DELETE;
+        } break;
+        
+        case COMMIT_STATE_DONE: {
+            if (o->empty) {
+                commit_free(o, 0);
+                return;
+            }
+            
+            // wait for lock
+            BEventLockJob_Wait(&o->lock_job);
+            
+            // set state
+            o->state = COMMIT_STATE_DELETING_LOCK;
+        } break;
+    }
+}
+
 static struct NCDModule modules[] = {
     {
         .type = "net.iptables.append",
@@ -726,6 +1303,46 @@ static struct NCDModule modules[] = {
         .func_new2 = unlock_func_new,
         .func_die = unlock_func_die,
         .alloc_size = sizeof(struct unlock_instance)
+    }, {
+        .type = "net.iptables.transaction",
+        .func_new2 = transaction_iptables_func_new,
+        .func_die = transaction_func_die,
+        .alloc_size = sizeof(struct transaction_instance)
+    }, {
+        .type = "net.iptables.transaction::append",
+        .func_new2 = rule_append_func_new,
+        .func_die = rule_func_die,
+        .alloc_size = sizeof(struct rule_instance)
+    }, {
+        .type = "net.iptables.transaction::insert",
+        .func_new2 = rule_insert_func_new,
+        .func_die = rule_func_die,
+        .alloc_size = sizeof(struct rule_instance)
+    }, {
+        .type = "net.iptables.transaction::commit",
+        .func_new2 = commit_func_new,
+        .func_die = commit_func_die,
+        .alloc_size = sizeof(struct commit_instance)
+    }, {
+        .type = "net.ip6tables.transaction",
+        .func_new2 = transaction_ip6tables_func_new,
+        .func_die = transaction_func_die,
+        .alloc_size = sizeof(struct transaction_instance)
+    }, {
+        .type = "net.ip6tables.transaction::append",
+        .func_new2 = rule_append_func_new,
+        .func_die = rule_func_die,
+        .alloc_size = sizeof(struct rule_instance)
+    }, {
+        .type = "net.ip6tables.transaction::insert",
+        .func_new2 = rule_insert_func_new,
+        .func_die = rule_func_die,
+        .alloc_size = sizeof(struct rule_instance)
+    }, {
+        .type = "net.ip6tables.transaction::commit",
+        .func_new2 = commit_func_new,
+        .func_die = commit_func_die,
+        .alloc_size = sizeof(struct commit_instance)
     }, {
         .type = NULL
     }
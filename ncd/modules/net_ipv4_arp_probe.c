@@ -40,13 +40,20 @@
  *   determines that presence has changed, toggles itself DOWN then
  *   UP to expose the new determination.
  * 
+ *   All probes on the same interface share one packet socket.
+ * 
  * Variables:
  *   exists - "true" if the host exists, "false" if not
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <misc/ipaddr.h>
+#include <misc/balloc.h>
+#include <misc/strdup.h>
+#include <misc/offset.h>
+#include <structure/LinkedList1.h>
 #include <arpprobe/BArpProbe.h>
 
 #include <ncd/module_common.h>
@@ -57,14 +64,87 @@
 #define STATE_EXIST 2
 #define STATE_NOEXIST 3
 
+struct global {
+    LinkedList1 engines_list;
+};
+
+struct engine {
+    LinkedList1Node engines_list_node;
+    char *ifname;
+    BArpProbeEngine engine;
+};
+
 struct instance {
     NCDModuleInst *i;
+    struct engine *engine;
     BArpProbe arpprobe;
     int state;
 };
 
 static void instance_free (struct instance *o, int is_error);
 
+static struct engine * engine_get (struct global *g, const char *ifname, BReactor *reactor)
+{
+    // look for a working engine on the interface
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&g->engines_list); n; n = LinkedList1Node_Next(n)) {
+        struct engine *e = UPPER_OBJECT(n, struct engine, engines_list_node);
+        if (!strcmp(e->ifname, ifname) && !BArpProbeEngine_HasFailed(&e->engine)) {
+            return e;
+        }
+    }
+    
+    // allocate engine
+    struct engine *e = BAlloc(sizeof(*e));
+    if (!e) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // copy interface name
+    if (!(e->ifname = b_strdup(ifname))) {
+        BLog(BLOG_ERROR, "b_strdup failed");
+        goto fail1;
+    }
+    
+    // init engine
+    if (!BArpProbeEngine_Init(&e->engine, ifname, reactor)) {
+        BLog(BLOG_ERROR, "BArpProbeEngine_Init failed");
+        goto fail2;
+    }
+    
+    // insert to engines list
+    LinkedList1_Append(&g->engines_list, &e->engines_list_node);
+    
+    return e;
+    
+fail2:
+    free(e->ifname);
+fail1:
+    BFree(e);
+fail0:
+    return NULL;
+}
+
+static void engine_release (struct global *g, struct engine *e)
+{
+    // keep engine while other probes use it
+    if (BArpProbeEngine_GetNumProbes(&e->engine) > 0) {
+        return;
+    }
+    
+    // remove from engines list
+    LinkedList1_Remove(&g->engines_list, &e->engines_list_node);
+    
+    // free engine
+    BArpProbeEngine_Free(&e->engine);
+    
+    // free interface name
+    free(e->ifname);
+    
+    // free structure
+    BFree(e);
+}
+
 static void arpprobe_handler (struct instance *o, int event)
 {
     switch (event) {
@@ -145,18 +225,26 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // init arpprobe
-    int res = BArpProbe_Init(&o->arpprobe, ifname_nts.data, addr, i->params->iparams->reactor, o, (BArpProbe_handler)arpprobe_handler);
+    // get engine for the interface
+    o->engine = engine_get(ModuleGlobal(i), ifname_nts.data, i->params->iparams->reactor);
     NCDValNullTermString_Free(&ifname_nts);
-    if (!res) {
-        ModuleLog(o->i, BLOG_ERROR, "BArpProbe_Init failed");
+    if (!o->engine) {
+        ModuleLog(o->i, BLOG_ERROR, "engine_get failed");
         goto fail0;
     }
     
+    // init arpprobe
+    if (!BArpProbe_InitEngine(&o->arpprobe, &o->engine->engine, addr, o, (BArpProbe_handler)arpprobe_handler)) {
+        ModuleLog(o->i, BLOG_ERROR, "BArpProbe_InitEngine failed");
+        goto fail1;
+    }
+    
     // set state unknown
     o->state = STATE_UNKNOWN;
     return;
     
+fail1:
+    engine_release(ModuleGlobal(i), o->engine);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -166,6 +254,9 @@ static void instance_free (struct instance *o, int is_error)
     // free arpprobe
     BArpProbe_Free(&o->arpprobe);
     
+    // release engine
+    engine_release(ModuleGlobal(o->i), o->engine);
+    
     if (is_error) {
         NCDModuleInst_Backend_DeadError(o->i);
     } else {
@@ -193,6 +284,33 @@ static int func_getvar (void *vo, const char *name, NCDValMem *mem, NCDValRef *o
     return 0;
 }
 
+static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCDModuleInst_iparams *params)
+{
+    // allocate global state structure
+    struct global *g = BAlloc(sizeof(*g));
+    if (!g) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // set group state pointer
+    group->group_state = g;
+    
+    // init engines list
+    LinkedList1_Init(&g->engines_list);
+    
+    return 1;
+}
+
+static void func_globalfree (struct NCDInterpModuleGroup *group)
+{
+    struct global *g = group->group_state;
+    ASSERT(LinkedList1_IsEmpty(&g->engines_list))
+    
+    // free global state structure
+    BFree(g);
+}
+
 static struct NCDModule modules[] = {
     {
         .type = "net.ipv4.arp_probe",
@@ -206,5 +324,7 @@ static struct NCDModule modules[] = {
 };
 
 const struct NCDModuleGroup ncdmodule_net_ipv4_arp_probe = {
+    .func_globalinit = func_globalinit,
+    .func_globalfree = func_globalfree,
     .modules = modules
 };
@@ -42,6 +42,10 @@
  *   - "hostname", (string value): send this hostname to the DHCP server
  *   - "vendorclassid", (string value): send this vendor class identifier
  *   - "auto_clientid": send a client identifier generated from the MAC address
+ *   - "rapid_commit": ask the server for a two-message exchange (RFC 4039)
+ *   - "lease_file", (string value): remember the leased address in this file, and
+ *     first ask for it with an INIT-REBOOT request the next time, while
+ *     discovering in parallel
  * 
  * Variables:
  *   string addr - assigned IP address ("A.B.C.D")
@@ -116,6 +120,7 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     
     NCDValNullTermString hostname_nts = NCDValNullTermString_NewDummy();
     NCDValNullTermString vendorclassid_nts = NCDValNullTermString_NewDummy();
+    NCDValNullTermString lease_file_nts = NCDValNullTermString_NewDummy();
     
     struct BDHCPClient_opts opts = {};
     
@@ -130,8 +135,9 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
             goto fail1;
         }
         
-        if (NCDVal_StringEquals(opt, "hostname") || NCDVal_StringEquals(opt, "vendorclassid")) {
+        if (NCDVal_StringEquals(opt, "hostname") || NCDVal_StringEquals(opt, "vendorclassid") || NCDVal_StringEquals(opt, "lease_file")) {
             int is_hostname = NCDVal_StringEquals(opt, "hostname");
+            int is_lease_file = NCDVal_StringEquals(opt, "lease_file");
             
             // read value
             if (j == count) {
@@ -150,12 +156,14 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
                 ModuleLog(o->i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
                 goto fail1;
             }
-            NCDValNullTermString *nts_ptr = (is_hostname ? &hostname_nts : &vendorclassid_nts);
+            NCDValNullTermString *nts_ptr = (is_hostname ? &hostname_nts : is_lease_file ? &lease_file_nts : &vendorclassid_nts);
             NCDValNullTermString_Free(nts_ptr);
             *nts_ptr = nts;
             
             if (is_hostname) {
                 opts.hostname = nts.data;
+            } else if (is_lease_file) {
+                opts.lease_file = nts.data;
             } else {
                 opts.vendorclassid = nts.data;
             }
@@ -165,6 +173,9 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         else if (NCDVal_StringEquals(opt, "auto_clientid")) {
             opts.auto_clientid = 1;
         }
+        else if (NCDVal_StringEquals(opt, "rapid_commit")) {
+            opts.rapid_commit = 1;
+        }
         else {
             ModuleLog(o->i, BLOG_ERROR, "unknown option name");
             goto fail1;
@@ -192,11 +203,13 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     // free options nts's
     NCDValNullTermString_Free(&hostname_nts);
     NCDValNullTermString_Free(&vendorclassid_nts);
+    NCDValNullTermString_Free(&lease_file_nts);
     return;
     
 fail1:
     NCDValNullTermString_Free(&hostname_nts);
     NCDValNullTermString_Free(&vendorclassid_nts);
+    NCDValNullTermString_Free(&lease_file_nts);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -30,10 +30,15 @@
  * 
  * Network interface watcher.
  * 
- * Synopsis: net.watch_interfaces()
+ * Synopsis: net.watch_interfaces([map options])
  * Description: reports network interface events. Transitions up when an event is detected, and
  *   goes down waiting for the next event when net.watch_interfaces::nextevent() is called.
  *   On startup, "added" events are reported for existing interfaces.
+ * Arguments:
+ *   options - map of options:
+ *     "debounce" - if nonzero, events are held for this many milliseconds from the first
+ *       one, and an interface going back to an earlier state within this time is reported
+ *       only in its final state. Default 0.
  * Variables:
  *   string event_type - what happened with the interface: "added" or "removed". This may not be
  *     consistent across events.
@@ -167,11 +172,11 @@ fail1:
 static void queue_event (struct instance *o, BStringMap map)
 {
     // pass event to template
-    int was_empty;
-    event_template_queue(&o->templ, map, &was_empty);
+    int pause;
+    event_template_queue(&o->templ, map, &pause);
     
-    // if event queue was empty, stop receiving udev events
-    if (was_empty) {
+    // if template is busy, stop receiving udev events
+    if (pause) {
         NCDUdevClient_Pause(&o->client);
     }
 }
@@ -247,11 +252,11 @@ static void next_event (struct instance *o)
     ASSERT(event_template_is_enabled(&o->templ))
     
     // order template to finish the current event
-    int is_empty;
-    event_template_dequeue(&o->templ, &is_empty);
+    int resume;
+    event_template_dequeue(&o->templ, &resume);
     
-    // if template has no events, continue udev events
-    if (is_empty) {
+    // if template can take events again, continue udev events
+    if (resume) {
         NCDUdevClient_Continue(&o->client);
     }
 }
@@ -349,13 +354,20 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     o->i = i;
     
     // check arguments
-    if (!NCDVal_ListRead(params->args, 0)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 0) && !NCDVal_ListRead(params->args, 1, &options_arg)) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
     
+    // read options
+    btime_t debounce;
+    if (!event_template_read_options(o->i, BLOG_CURRENT_CHANNEL, options_arg, &debounce)) {
+        goto fail0;
+    }
+    
     // init client
-    NCDUdevClient_Init(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler);
+    NCDUdevClient_InitFilter(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler, "SUBSYSTEM", "net");
     
     // init devices list
     LinkedList1_Init(&o->devices_list);
@@ -374,7 +386,7 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail3;
     }
     
-    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, o, (event_template_func_free)templ_func_free);
+    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, debounce, "devname", o, (event_template_func_free)templ_func_free);
     return;
     
 fail3:
@@ -66,6 +66,22 @@
  *   If the process does exist and is not already being terminated, termination of the
  *   process is requested, and the immediate effects of the termination request happen
  *   before the immediate effects of the stop() statement going up.
+ * 
+ * Synopsis:
+ *   process_manager::sync(list/map collection, string template_name, list args)
+ * 
+ * Description:
+ *   Makes the set of processes managed by sync() follow 'collection'. For a list,
+ *   there is one process for each distinct element, named by the element, with arguments
+ *   'args' followed by the element. For a map, there is one process for each key, named
+ *   by the key, with arguments 'args' followed by the key and the value.
+ *   Processes for new names are started, processes started by an earlier sync() whose
+ *   names are no longer in 'collection' are stopped, and processes whose template or
+ *   arguments changed are restarted. Processes whose template and arguments are unchanged
+ *   are left alone, so a changing collection only affects the processes of the elements
+ *   that were added, removed or changed. A process with the same name started by start()
+ *   is taken over by sync(). As with start() and stop(), the immediate effects happen
+ *   before the immediate effects of the sync() statement going up.
  */
 
 #include <stdlib.h>
@@ -76,6 +92,7 @@
 #include <misc/strdup.h>
 #include <misc/balloc.h>
 #include <structure/LinkedList1.h>
+#include <structure/SAvl.h>
 
 #include <ncd/module_common.h>
 
@@ -88,15 +105,25 @@
 #define PROCESS_STATE_RESTARTING 3
 #define PROCESS_STATE_RETRYING 4
 
+struct process;
+
+#include "process_manager_tree.h"
+#include <structure/SAvl_decl.h>
+
 struct instance {
     NCDModuleInst *i;
     LinkedList1 processes_list;
+    ProcessTree processes_tree; // named processes
+    int sync_gen;
     int dying;
 };
 
 struct process {
     struct instance *manager;
     LinkedList1Node processes_list_node;
+    ProcessTreeNode tree_node; // if named
+    int synced;
+    int sync_gen;
     BSmallTimer retry_timer; // running if state=retrying
     int state;
     NCD_string_id_t template_name;
@@ -104,13 +131,22 @@ struct process {
     NCDValSafeRef current_name;
     NCDValSafeRef current_args;
     NCDValMem next_mem; // next_* if state=restarting
+    NCD_string_id_t next_template_name;
     NCDValSafeRef next_name;
     NCDValSafeRef next_args;
     NCDModuleProcess module_process; // if state!=retrying
 };
 
+static NCDValRef process_name (struct process *p)
+{
+    return NCDVal_FromSafe(&p->current_mem, p->current_name);
+}
+
+#include "process_manager_tree.h"
+#include <structure/SAvl_impl.h>
+
 static struct process * find_process (struct instance *o, NCDValRef name);
-static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args);
+static struct process * process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args);
 static void process_free (struct process *p);
 static void process_try (struct process *p);
 static void process_retry_timer_handler (BSmallTimer *retry_timer);
@@ -125,20 +161,13 @@ static struct process * find_process (struct instance *o, NCDValRef name)
 {
     ASSERT(!NCDVal_IsInvalid(name))
     
-    LinkedList1Node *n = LinkedList1_GetFirst(&o->processes_list);
-    while (n) {
-        struct process *p = UPPER_OBJECT(n, struct process, processes_list_node);
-        ASSERT(p->manager == o)
-        if (!NCDVal_IsInvalid(NCDVal_FromSafe(&p->current_mem, p->current_name)) && NCDVal_Compare(NCDVal_FromSafe(&p->current_mem, p->current_name), name) == 0) {
-            return p;
-        }
-        n = LinkedList1Node_Next(n);
-    }
+    struct process *p = ProcessTree_LookupExact(&o->processes_tree, 0, name);
+    ASSERT(!p || p->manager == o)
     
-    return NULL;
+    return p;
 }
 
-static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args)
+static struct process * process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args)
 {
     ASSERT(!o->dying)
     ASSERT(NCDVal_IsInvalid(NCDVal_FromSafe(mem, name)) || !find_process(o, NCDVal_FromSafe(mem, name)))
@@ -178,21 +207,36 @@ static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name,
     p->current_name = name;
     p->current_args = args;
     
+    // insert to processes tree
+    if (!NCDVal_IsInvalid(process_name(p))) {
+        int res = ProcessTree_Insert(&o->processes_tree, 0, p, NULL);
+        ASSERT_EXECUTE(res)
+    }
+    
+    // not managed by sync() unless it says so
+    p->synced = 0;
+    p->sync_gen = 0;
+    
     // try starting it
     process_try(p);
-    return 1;
+    return p;
     
 fail1:
     LinkedList1_Remove(&o->processes_list, &p->processes_list_node);
     BFree(p);
 fail0:
-    return 0;
+    return NULL;
 }
 
 static void process_free (struct process *p)
 {
     struct instance *o = p->manager;
     
+    // remove from processes tree
+    if (!NCDVal_IsInvalid(process_name(p))) {
+        ProcessTree_Remove(&o->processes_tree, 0, p);
+    }
+    
     // free current mem
     NCDValMem_Free(&p->current_mem);
     
@@ -276,6 +320,7 @@ void process_module_process_handler_event (NCDModuleProcess *module_process, int
                 NCDValMem_Free(&p->current_mem);
                 
                 // move next mem/values over current mem/values
+                p->template_name = p->next_template_name;
                 p->current_mem = p->next_mem;
                 p->current_name = p->next_name;
                 p->current_args = p->next_args;
@@ -360,6 +405,13 @@ static int process_restart (struct process *p, NCDValMem *mem, NCDValSafeRef nam
     ASSERT(NCDVal_IsString(NCDVal_FromSafe(mem, template_name)))
     ASSERT(NCDVal_IsList(NCDVal_FromSafe(mem, args)))
     
+    // get template name
+    p->next_template_name = ncd_get_string_id(NCDVal_FromSafe(mem, template_name));
+    if (p->next_template_name < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "ncd_get_string_id failed");
+        goto fail0;
+    }
+    
     // copy mem to next mem
     if (!NCDValMem_InitCopy(&p->next_mem, mem)) {
         ModuleLog(o->i, BLOG_ERROR, "NCDValMem_InitCopy failed");
@@ -392,6 +444,12 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     // init processes list
     LinkedList1_Init(&o->processes_list);
     
+    // init processes tree
+    ProcessTree_Init(&o->processes_tree);
+    
+    // no sync() yet
+    o->sync_gen = 0;
+    
     // set not dying
     o->dying = 0;
     
@@ -510,6 +568,161 @@ fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
 
+static int sync_process (struct instance *mo, NCDModuleInst *i, NCDValRef name, NCDValRef val, NCD_string_id_t template_id, NCDValRef template_name, NCDValRef args)
+{
+    ASSERT(!mo->dying)
+    
+    // skip duplicate names
+    struct process *p = find_process(mo, name);
+    if (p && p->synced && p->sync_gen == mo->sync_gen) {
+        return 1;
+    }
+    
+    int res = 0;
+    
+    // build name, template name and arguments of the process
+    NCDValMem mem;
+    NCDValMem_Init(&mem, i->params->iparams->string_index);
+    
+    NCDValRef m_name = NCDVal_NewCopy(&mem, name);
+    NCDValRef m_template_name = NCDVal_NewCopy(&mem, template_name);
+    NCDValRef m_args = NCDVal_NewList(&mem, NCDVal_ListCount(args) + (NCDVal_IsInvalid(val) ? 1 : 2));
+    if (NCDVal_IsInvalid(m_name) || NCDVal_IsInvalid(m_template_name) || NCDVal_IsInvalid(m_args)) {
+        goto fail_copy;
+    }
+    for (size_t j = 0; j < NCDVal_ListCount(args); j++) {
+        NCDValRef arg = NCDVal_NewCopy(&mem, NCDVal_ListGet(args, j));
+        if (NCDVal_IsInvalid(arg) || !NCDVal_ListAppend(m_args, arg)) {
+            goto fail_copy;
+        }
+    }
+    NCDValRef m_elem = NCDVal_NewCopy(&mem, name);
+    if (NCDVal_IsInvalid(m_elem) || !NCDVal_ListAppend(m_args, m_elem)) {
+        goto fail_copy;
+    }
+    if (!NCDVal_IsInvalid(val)) {
+        NCDValRef m_val = NCDVal_NewCopy(&mem, val);
+        if (NCDVal_IsInvalid(m_val) || !NCDVal_ListAppend(m_args, m_val)) {
+            goto fail_copy;
+        }
+    }
+    
+    if (p) {
+        // leave the process alone if it would be started the same way
+        if (p->state == PROCESS_STATE_RUNNING || p->state == PROCESS_STATE_RETRYING) {
+            if (p->template_name == template_id && NCDVal_Compare(NCDVal_FromSafe(&p->current_mem, p->current_args), m_args) == 0) {
+                goto done;
+            }
+        }
+        else if (p->state == PROCESS_STATE_RESTARTING) {
+            if (p->next_template_name == template_id && NCDVal_Compare(NCDVal_FromSafe(&p->next_mem, p->next_args), m_args) == 0) {
+                goto done;
+            }
+        }
+        
+        if (p->state == PROCESS_STATE_RETRYING) {
+            // not running, replace it
+            process_free(p);
+            p = NULL;
+        } else {
+            // stop it if needed, and restart it after it terminates
+            process_stop(p);
+            if (!process_restart(p, &mem, NCDVal_ToSafe(m_name), NCDVal_ToSafe(m_template_name), NCDVal_ToSafe(m_args))) {
+                ModuleLog(i, BLOG_ERROR, "failed to restart process");
+                goto out;
+            }
+        }
+    }
+    
+    if (!p) {
+        if (!(p = process_new(mo, &mem, NCDVal_ToSafe(m_name), NCDVal_ToSafe(m_template_name), NCDVal_ToSafe(m_args)))) {
+            ModuleLog(i, BLOG_ERROR, "failed to create process");
+            goto out;
+        }
+    }
+    
+done:
+    // mark as present in this sync()
+    p->synced = 1;
+    p->sync_gen = mo->sync_gen;
+    res = 1;
+    goto out;
+    
+fail_copy:
+    ModuleLog(i, BLOG_ERROR, "failed to build process arguments");
+out:
+    NCDValMem_Free(&mem);
+    return res;
+}
+
+static void sync_func_new (void *unused, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    // check arguments
+    NCDValRef collection_arg;
+    NCDValRef template_name_arg;
+    NCDValRef args_arg;
+    if (!NCDVal_ListRead(params->args, 3, &collection_arg, &template_name_arg, &args_arg)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    if ((!NCDVal_IsList(collection_arg) && !NCDVal_IsMap(collection_arg)) || !NCDVal_IsString(template_name_arg) || !NCDVal_IsList(args_arg)) {
+        ModuleLog(i, BLOG_ERROR, "wrong type");
+        goto fail0;
+    }
+    
+    // signal up.
+    // Do it before changing processes so that they start changing before our own process continues.
+    NCDModuleInst_Backend_Up(i);
+    
+    // get method object
+    struct instance *mo = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
+    
+    if (mo->dying) {
+        return;
+    }
+    
+    // get template name
+    NCD_string_id_t template_id = ncd_get_string_id(template_name_arg);
+    if (template_id < 0) {
+        ModuleLog(i, BLOG_ERROR, "ncd_get_string_id failed");
+        goto fail0;
+    }
+    
+    // start a new sync generation
+    mo->sync_gen++;
+    
+    // start or restart processes for the elements
+    if (NCDVal_IsList(collection_arg)) {
+        for (size_t j = 0; j < NCDVal_ListCount(collection_arg); j++) {
+            if (!sync_process(mo, i, NCDVal_ListGet(collection_arg, j), NCDVal_NewInvalid(), template_id, template_name_arg, args_arg)) {
+                goto fail0;
+            }
+        }
+    } else {
+        for (NCDValMapElem e = NCDVal_MapFirst(collection_arg); !NCDVal_MapElemInvalid(e); e = NCDVal_MapNext(collection_arg, e)) {
+            if (!sync_process(mo, i, NCDVal_MapElemKey(collection_arg, e), NCDVal_MapElemVal(collection_arg, e), template_id, template_name_arg, args_arg)) {
+                goto fail0;
+            }
+        }
+    }
+    
+    // stop synced processes which are no longer in the collection
+    LinkedList1Node *n = LinkedList1_GetFirst(&mo->processes_list);
+    while (n) {
+        LinkedList1Node *next = LinkedList1Node_Next(n);
+        struct process *p = UPPER_OBJECT(n, struct process, processes_list_node);
+        if (p->synced && p->sync_gen != mo->sync_gen && p->state != PROCESS_STATE_STOPPING) {
+            process_stop(p);
+        }
+        n = next;
+    }
+    
+    return;
+    
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
 static struct NCDModule modules[] = {
     {
         .type = "process_manager",
@@ -522,6 +735,9 @@ static struct NCDModule modules[] = {
     }, {
         .type = "process_manager::stop",
         .func_new2 = stop_func_new
+    }, {
+        .type = "process_manager::sync",
+        .func_new2 = sync_func_new
     }, {
         .type = NULL
     }
@@ -62,6 +62,10 @@
  *   from the end of the just-replaced portion until no more regular expressions match.
  *   If multiple regular expressions match at the least position, the one that appears
  *   first in the 'regex' argument wins.
+ * 
+ * Compiled regular expressions are kept in an interpreter-wide cache of the
+ * REGEX_CACHE_SIZE most recently used patterns, so statements which are
+ * re-initialized with the same patterns don't recompile them.
  */
 
 #include <stdlib.h>
@@ -74,12 +78,31 @@
 #include <misc/expstring.h>
 #include <misc/debug.h>
 #include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/hashfun.h>
+#include <structure/LinkedList1.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_regex_match.h>
 
 #define MAX_MATCHES 64
+#define REGEX_CACHE_SIZE 64
+
+struct global {
+    LinkedList1 lru_list; // least recently used first
+    int num_entries;
+};
+
+struct regex_entry {
+    LinkedList1Node lru_list_node;
+    size_t hash;
+    int cflags;
+    int refcnt;
+    regex_t preg;
+    size_t pattern_len;
+    char pattern[];
+};
 
 struct instance {
     NCDModuleInst *i;
@@ -94,6 +117,126 @@ struct replace_instance {
     MemRef output;
 };
 
+static void free_entry (struct global *g, struct regex_entry *e)
+{
+    ASSERT(e->refcnt == 0)
+    
+    LinkedList1_Remove(&g->lru_list, &e->lru_list_node);
+    g->num_entries--;
+    
+    regfree(&e->preg);
+    BFree(e);
+}
+
+static void trim_cache (struct global *g)
+{
+    // evict unused entries, least recently used first
+    LinkedList1Node *ln = LinkedList1_GetFirst(&g->lru_list);
+    while (ln && g->num_entries > REGEX_CACHE_SIZE) {
+        struct regex_entry *e = UPPER_OBJECT(ln, struct regex_entry, lru_list_node);
+        ln = LinkedList1Node_Next(ln);
+        
+        if (e->refcnt == 0) {
+            free_entry(g, e);
+        }
+    }
+}
+
+static struct regex_entry * regex_get (NCDModuleInst *i, MemRef pattern, int cflags)
+{
+    struct global *g = ModuleGlobal(i);
+    size_t hash = badvpn_djb2_hash_bin((const uint8_t *)pattern.ptr, pattern.len);
+    
+    // look for a cached entry
+    for (LinkedList1Node *ln = LinkedList1_GetLast(&g->lru_list); ln; ln = LinkedList1Node_Prev(ln)) {
+        struct regex_entry *e = UPPER_OBJECT(ln, struct regex_entry, lru_list_node);
+        if (e->hash == hash && e->cflags == cflags && MemRef_Equal(MemRef_Make(e->pattern, e->pattern_len), pattern)) {
+            // mark most recently used
+            LinkedList1_Remove(&g->lru_list, &e->lru_list_node);
+            LinkedList1_Append(&g->lru_list, &e->lru_list_node);
+            
+            e->refcnt++;
+            return e;
+        }
+    }
+    
+    // allocate entry
+    bsize_t size = bsize_add(bsize_fromsize(sizeof(struct regex_entry)), bsize_add(bsize_fromsize(pattern.len), bsize_fromsize(1)));
+    struct regex_entry *e = BAllocSize(size);
+    if (!e) {
+        ModuleLog(i, BLOG_ERROR, "BAllocSize failed");
+        return NULL;
+    }
+    
+    // copy pattern, null terminated
+    memcpy(e->pattern, pattern.ptr, pattern.len);
+    e->pattern[pattern.len] = '\0';
+    e->pattern_len = pattern.len;
+    e->hash = hash;
+    e->cflags = cflags;
+    
+    // compile regex
+    int ret = regcomp(&e->preg, e->pattern, cflags);
+    if (ret != 0) {
+        ModuleLog(i, BLOG_ERROR, "regcomp failed (error=%d)", ret);
+        BFree(e);
+        return NULL;
+    }
+    
+    // insert as most recently used
+    e->refcnt = 1;
+    LinkedList1_Append(&g->lru_list, &e->lru_list_node);
+    g->num_entries++;
+    
+    trim_cache(g);
+    
+    return e;
+}
+
+static void regex_release (NCDModuleInst *i, struct regex_entry *e)
+{
+    struct global *g = ModuleGlobal(i);
+    ASSERT(e->refcnt > 0)
+    
+    e->refcnt--;
+    
+    trim_cache(g);
+}
+
+static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCDModuleInst_iparams *params)
+{
+    // allocate global state structure
+    struct global *g = BAlloc(sizeof(*g));
+    if (!g) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // set group state pointer
+    group->group_state = g;
+    
+    // init cache
+    LinkedList1_Init(&g->lru_list);
+    g->num_entries = 0;
+    
+    return 1;
+}
+
+static void func_globalfree (struct NCDInterpModuleGroup *group)
+{
+    struct global *g = group->group_state;
+    
+    // free cache
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&g->lru_list)) {
+        free_entry(g, UPPER_OBJECT(ln, struct regex_entry, lru_list_node));
+    }
+    ASSERT(g->num_entries == 0)
+    
+    // free global state structure
+    BFree(g);
+}
+
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct instance *o = vo;
@@ -118,29 +261,19 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // null terminate regex
-    NCDValNullTermString regex_nts;
-    if (!NCDVal_StringNullTerminate(regex_arg, &regex_nts)) {
-        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
-        goto fail0;
-    }
-    
-    // compile regex
-    regex_t preg;
-    int ret = regcomp(&preg, regex_nts.data, REG_EXTENDED);
-    NCDValNullTermString_Free(&regex_nts);
-    if (ret != 0) {
-        ModuleLog(o->i, BLOG_ERROR, "regcomp failed (error=%d)", ret);
+    // get compiled regex
+    struct regex_entry *re = regex_get(i, NCDVal_StringMemRef(regex_arg), REG_EXTENDED);
+    if (!re) {
         goto fail0;
     }
     
     // execute match
     o->matches[0].rm_so = 0;
     o->matches[0].rm_eo = o->input.len;
-    o->succeeded = (regexec(&preg, o->input.ptr, MAX_MATCHES, o->matches, REG_STARTEND) == 0);
+    o->succeeded = (regexec(&re->preg, o->input.ptr, MAX_MATCHES, o->matches, REG_STARTEND) == 0);
     
-    // free regex
-    regfree(&preg);
+    // release regex
+    regex_release(i, re);
     
     // signal up
     NCDModuleInst_Backend_Up(o->i);
@@ -205,7 +338,7 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     size_t num_regex = NCDVal_ListCount(regex_arg);
     
     // allocate array for compiled regex's
-    regex_t *regs = BAllocArray(num_regex, sizeof(regs[0]));
+    struct regex_entry **regs = BAllocArray(num_regex, sizeof(regs[0]));
     if (!regs) {
         ModuleLog(i, BLOG_ERROR, "BAllocArray failed");
         goto fail1;
@@ -222,17 +355,8 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
             goto fail2;
         }
         
-        // null terminate regex
-        NCDValNullTermString regex_nts;
-        if (!NCDVal_StringNullTerminate(regex, &regex_nts)) {
-            ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
-            goto fail2;
-        }
-        
-        int res = regcomp(&regs[num_done_regex], regex_nts.data, REG_EXTENDED);
-        NCDValNullTermString_Free(&regex_nts);
-        if (res != 0) {
-            ModuleLog(i, BLOG_ERROR, "regcomp failed for pair %zu (error=%d)", num_done_regex, res);
+        if (!(regs[num_done_regex] = regex_get(i, NCDVal_StringMemRef(regex), REG_EXTENDED))) {
+            ModuleLog(i, BLOG_ERROR, "failed to compile regex for pair %zu", num_done_regex);
             goto fail2;
         }
         
@@ -260,7 +384,7 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
             regmatch_t this_match;
             this_match.rm_so = 0;
             this_match.rm_eo = in.len - in_pos;
-            if (regexec(&regs[j], in.ptr + in_pos, 1, &this_match, REG_STARTEND) == 0 && (!have_match || this_match.rm_so < match.rm_so)) {
+            if (regexec(&regs[j]->preg, in.ptr + in_pos, 1, &this_match, REG_STARTEND) == 0 && (!have_match || this_match.rm_so < match.rm_so)) {
                 have_match = 1;
                 match_regex = j;
                 match = this_match;
@@ -295,9 +419,9 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     // set output
     o->output = ExpString_GetMr(&out);
     
-    // free compiled regex's
+    // release compiled regex's
     while (num_done_regex-- > 0) {
-        regfree(&regs[num_done_regex]);
+        regex_release(i, regs[num_done_regex]);
     }
     
     // free array
@@ -311,7 +435,7 @@ fail3:
     ExpString_Free(&out);
 fail2:
     while (num_done_regex-- > 0) {
-        regfree(&regs[num_done_regex]);
+        regex_release(i, regs[num_done_regex]);
     }
     BFree(regs);
 fail1:
@@ -358,5 +482,7 @@ static struct NCDModule modules[] = {
 };
 
 const struct NCDModuleGroup ncdmodule_regex_match = {
+    .func_globalinit = func_globalinit,
+    .func_globalfree = func_globalfree,
     .modules = modules
 };
@@ -33,8 +33,13 @@
  * 
  * Options:
  *   "read_size" - the maximum number of bytes that can be read by a single
- *     read() call. Must be greater than zero. Greater values may improve
- *     performance, but will increase memory usage. Default: 8192.
+ *     read() call. Must be greater than zero. The read buffer starts small
+ *     (4096 bytes) and doubles whenever a read fills it, up to this limit;
+ *     it shrinks again when reads stay small. Default: 65536.
+ *   "write_buffer" - the number of bytes of written data which may be
+ *     buffered by the socket. A write() whose data fits into the remaining
+ *     buffer space is copied and goes up right away, without waiting for the
+ *     data to be sent. Default: 0 (write() always waits).
  * 
  * Variables:
  *   string is_error - "true" if there was an error with the connection,
@@ -85,12 +90,19 @@
  *   WARNING: if a read() is terminated while it is still in progress, i.e.
  *   has not gone up yet, then the connection is automatically closed, as
  *   if close() was called.
+ *   The returned string refers to the receive buffer directly, without
+ *   copying; the buffer is reused once the string is no longer referenced.
  * 
  * Synopsis:
  *   sys.socket::write(string data)
  * 
  * Description:
- *   Sends data to the connection.
+ *   Sends data to the connection. Several write() calls may be in progress
+ *   at the same time (e.g. from different processes); the data is sent in
+ *   the order of the calls, and pending writes are gathered into a single
+ *   system call. If the "write_buffer" option allows, the data is copied
+ *   and write() goes up immediately, otherwise it goes up once the data
+ *   has been sent.
  *   WARNING: this may block if the operating system's internal send buffer
  *   is full. Be careful not to enter a deadlock where both ends of the
  *   connection are trying to send data to the other, but neither is trying
@@ -104,7 +116,8 @@
  * 
  * Description:
  *   Closes the connection. After this, any further read(), write() or close()
- *   will trigger an error with the interpreter. For client sockets created
+ *   will trigger an error with the interpreter. If there is written data
+ *   which has not been sent yet, the connection is closed once it has been. For client sockets created
  *   via sys.listen(), this will immediately trigger termination of the client
  *   process.
  * 
@@ -113,8 +126,13 @@
  * 
  * Options:
  *   "read_size" - the maximum number of bytes that can be read by a single
- *     read() call. Must be greater than zero. Greater values may improve
- *     performance, but will increase memory usage. Default: 8192.
+ *     read() call. Must be greater than zero. The read buffer starts small
+ *     (4096 bytes) and doubles whenever a read fills it, up to this limit;
+ *     it shrinks again when reads stay small. Default: 65536.
+ *   "write_buffer" - the number of bytes of written data which may be
+ *     buffered by the socket. A write() whose data fits into the remaining
+ *     buffer space is copied and goes up right away, without waiting for the
+ *     data to be sent. Default: 0 (write() always waits).
  * 
  * Variables:
  *   string is_error - "true" if listening failed to inittialize, "false" if
@@ -141,6 +159,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <sys/types.h>
@@ -150,6 +169,7 @@
 #include <misc/offset.h>
 #include <misc/debug.h>
 #include <structure/LinkedList0.h>
+#include <structure/LinkedList1.h>
 #include <system/BConnection.h>
 #include <system/BConnectionGeneric.h>
 #include <ncd/extra/address_utils.h>
@@ -167,14 +187,27 @@
 #define CONNECTION_STATE_ERROR 3
 #define CONNECTION_STATE_ABORTED 4
 
-#define DEFAULT_READ_BUF_SIZE 8192
+#define DEFAULT_READ_BUF_SIZE 65536
+#define MIN_READ_BUF_SIZE 4096
+#define READ_SHRINK_COUNT 8
+
+struct socket_options {
+    size_t read_size;
+    size_t write_buffer;
+};
+
+struct send_chunk {
+    LinkedList1Node queue_node;
+    struct write_instance *wr;
+    MemRef data;
+};
 
 struct connection {
     union {
         struct {
             NCDModuleInst *i;
             BConnector connector;
-            size_t read_buf_size;
+            struct socket_options opts;
         } connect;
         struct {
             struct listen_instance *listen_inst;
@@ -187,10 +220,16 @@ struct connection {
     unsigned int type:2;
     unsigned int state:3;
     unsigned int recv_closed:1;
+    unsigned int send_busy:1;
+    unsigned int closing:1;
     BConnection connection;
     NCDBufStore store;
+    size_t read_max;
+    int small_reads;
+    size_t write_buffer;
+    size_t buffered_len;
+    LinkedList1 send_queue;
     struct read_instance *read_inst;
-    struct write_instance *write_inst;
 };
 
 struct read_instance {
@@ -203,14 +242,14 @@ struct read_instance {
 struct write_instance {
     NCDModuleInst *i;
     struct connection *con_inst;
-    MemRef data;
+    struct send_chunk chunk;
 };
 
 struct listen_instance {
     NCDModuleInst *i;
     unsigned int have_error:1;
     unsigned int dying:1;
-    size_t read_buf_size;
+    struct socket_options opts;
     NCDValRef client_template;
     NCDValRef client_template_args;
     BListener listener;
@@ -223,9 +262,11 @@ static const char *strings[] = {
     "_socket", "sys.socket", "client_addr", NULL
 };
 
-static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size);
+static int parse_options (NCDModuleInst *i, NCDValRef options, struct socket_options *out);
 static void connection_log (struct connection *o, int level, const char *fmt, ...);
+static void connection_init_io (struct connection *o, const struct socket_options *opts);
 static void connection_free_connection (struct connection *o);
+static void connection_send_next (struct connection *o);
 static void connection_error (struct connection *o);
 static void connection_abort (struct connection *o);
 static void connection_connector_handler (void *user, int is_error);
@@ -239,11 +280,12 @@ static int connection_process_socket_obj_func_getvar (const NCDObject *obj, NCD_
 static int connection_process_caller_obj_func_getobj (const NCDObject *obj, NCD_string_id_t name, NCDObject *out_object);
 static void listen_listener_handler (void *user);
 
-static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size)
+static int parse_options (NCDModuleInst *i, NCDValRef options, struct socket_options *out)
 {
-    ASSERT(out_read_size)
+    ASSERT(out)
     
-    *out_read_size = DEFAULT_READ_BUF_SIZE;
+    out->read_size = DEFAULT_READ_BUF_SIZE;
+    out->write_buffer = 0;
     
     if (!NCDVal_IsInvalid(options)) {
         if (!NCDVal_IsMap(options)) {
@@ -261,7 +303,17 @@ static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_
                 return 0;
             }
             num_recognized++;
-            *out_read_size = read_size;
+            out->read_size = read_size;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "write_buffer"))) {
+            uintmax_t write_buffer;
+            if (!ncd_read_uintmax(value, &write_buffer) || write_buffer > SIZE_MAX) {
+                ModuleLog(i, BLOG_ERROR, "wrong write_buffer");
+                return 0;
+            }
+            num_recognized++;
+            out->write_buffer = write_buffer;
         }
         
         if (NCDVal_MapCount(options) > num_recognized) {
@@ -301,6 +353,25 @@ static void connection_log (struct connection *o, int level, const char *fmt, ..
     va_end(vl);
 }
 
+static void connection_init_io (struct connection *o, const struct socket_options *opts)
+{
+    // init store, starting with small reads
+    o->read_max = opts->read_size;
+    o->small_reads = 0;
+    NCDBufStore_Init(&o->store, (o->read_max < MIN_READ_BUF_SIZE) ? o->read_max : MIN_READ_BUF_SIZE);
+    
+    // init send queue
+    o->write_buffer = opts->write_buffer;
+    o->buffered_len = 0;
+    LinkedList1_Init(&o->send_queue);
+    
+    // set not reading, not sending, recv not closed, not closing
+    o->read_inst = NULL;
+    o->send_busy = 0;
+    o->recv_closed = 0;
+    o->closing = 0;
+}
+
 static void connection_free_connection (struct connection *o)
 {
     // disconnect read instance
@@ -309,12 +380,6 @@ static void connection_free_connection (struct connection *o)
         o->read_inst->con_inst = NULL;
     }
     
-    // disconnect write instance
-    if (o->write_inst) {
-        ASSERT(o->write_inst->con_inst == o)
-        o->write_inst->con_inst = NULL;
-    }
-    
     // free connection interfaces
     BConnection_RecvAsync_Free(&o->connection);
     BConnection_SendAsync_Free(&o->connection);
@@ -322,10 +387,68 @@ static void connection_free_connection (struct connection *o)
     // free connection
     BConnection_Free(&o->connection);
     
+    // disconnect queued write instances and free buffered data
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&o->send_queue)) {
+        struct send_chunk *chunk = UPPER_OBJECT(ln, struct send_chunk, queue_node);
+        LinkedList1_Remove(&o->send_queue, &chunk->queue_node);
+        
+        if (chunk->wr) {
+            ASSERT(chunk->wr->con_inst == o)
+            chunk->wr->con_inst = NULL;
+        } else {
+            free(chunk);
+        }
+    }
+    
     // free store
     NCDBufStore_Free(&o->store);
 }
 
+static void connection_send_next (struct connection *o)
+{
+    ASSERT(o->state == CONNECTION_STATE_ESTABLISHED)
+    ASSERT(!o->send_busy)
+    
+    StreamPassInterface *send_if = BConnection_SendAsync_GetIf(&o->connection);
+    int max_count = StreamPassInterface_HasVec(send_if) ? STREAMPASSINTERFACE_MAX_VEC : 1;
+    
+    // gather the data at the head of the queue
+    struct StreamPassInterface_vec vec[STREAMPASSINTERFACE_MAX_VEC];
+    int count = 0;
+    size_t total = 0;
+    
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->send_queue); ln && count < max_count; ln = LinkedList1Node_Next(ln)) {
+        struct send_chunk *chunk = UPPER_OBJECT(ln, struct send_chunk, queue_node);
+        ASSERT(chunk->data.len > 0)
+        
+        size_t len = chunk->data.len;
+        if (len > INT_MAX - total) {
+            len = INT_MAX - total;
+        }
+        if (len == 0) {
+            break;
+        }
+        
+        vec[count].data = (uint8_t *)chunk->data.ptr;
+        vec[count].len = len;
+        count++;
+        total += len;
+    }
+    
+    if (count == 0) {
+        return;
+    }
+    
+    o->send_busy = 1;
+    
+    if (count == 1) {
+        StreamPassInterface_Sender_Send(send_if, vec[0].data, vec[0].len);
+    } else {
+        StreamPassInterface_Sender_SendVec(send_if, vec, count);
+    }
+}
+
 static void connection_error (struct connection *o)
 {
     ASSERT(o->state == CONNECTION_STATE_CONNECTING ||
@@ -412,13 +535,8 @@ static void connection_complete_establish (struct connection *o)
     StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&o->connection), connection_send_handler_done, o);
     StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&o->connection), connection_recv_handler_done, o);
     
-    // init store
-    NCDBufStore_Init(&o->store, o->connect.read_buf_size);
-    
-    // set not reading, not writing, recv not closed
-    o->read_inst = NULL;
-    o->write_inst = NULL;
-    o->recv_closed = 0;
+    // init buffers and queues
+    connection_init_io(o, &o->connect.opts);
     
     // set state
     o->state = CONNECTION_STATE_ESTABLISHED;
@@ -459,27 +577,50 @@ static void connection_send_handler_done (void *user, int data_len)
 {
     struct connection *o = user;
     ASSERT(o->state == CONNECTION_STATE_ESTABLISHED)
-    ASSERT(o->write_inst)
-    ASSERT(o->write_inst->con_inst == o)
+    ASSERT(o->send_busy)
     ASSERT(data_len > 0)
-    ASSERT(data_len <= o->write_inst->data.len)
     
-    struct write_instance *wr = o->write_inst;
+    o->send_busy = 0;
     
-    // update send state
-    wr->data = MemRef_SubFrom(wr->data, data_len);
+    // consume sent data from the head of the queue
+    size_t left = data_len;
+    while (left > 0) {
+        LinkedList1Node *ln = LinkedList1_GetFirst(&o->send_queue);
+        ASSERT(ln)
+        struct send_chunk *chunk = UPPER_OBJECT(ln, struct send_chunk, queue_node);
+        
+        size_t amount = (left < chunk->data.len) ? left : chunk->data.len;
+        chunk->data = MemRef_SubFrom(chunk->data, amount);
+        left -= amount;
+        
+        if (!chunk->wr) {
+            ASSERT(o->buffered_len >= amount)
+            o->buffered_len -= amount;
+        }
+        
+        if (chunk->data.len > 0) {
+            break;
+        }
+        
+        LinkedList1_Remove(&o->send_queue, &chunk->queue_node);
+        
+        if (chunk->wr) {
+            // finish write operation
+            ASSERT(chunk->wr->con_inst == o)
+            chunk->wr->con_inst = NULL;
+            NCDModuleInst_Backend_Up(chunk->wr->i);
+        } else {
+            free(chunk);
+        }
+    }
     
-    // if there's more to send, send again
-    if (wr->data.len > 0) {
-        size_t to_send = (wr->data.len > INT_MAX) ? INT_MAX : wr->data.len;
-        StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&o->connection), (uint8_t *)wr->data.ptr, to_send);
+    // if close() was waiting for the data to go out, close now
+    if (o->closing && LinkedList1_IsEmpty(&o->send_queue)) {
+        connection_abort(o);
         return;
     }
     
-    // finish write operation
-    wr->con_inst = NULL;
-    NCDModuleInst_Backend_Up(wr->i);
-    o->write_inst = NULL;
+    connection_send_next(o);
 }
 
 static void connection_recv_handler_done (void *user, int data_len)
@@ -494,6 +635,23 @@ static void connection_recv_handler_done (void *user, int data_len)
     
     struct read_instance *re = o->read_inst;
     
+    // adapt the size of further reads: grow when a read fills the
+    // buffer, shrink after a number of reads using a small part of it
+    size_t buf_size = NCDBufStore_BufSize(&o->store);
+    if (data_len == buf_size && buf_size < o->read_max) {
+        o->small_reads = 0;
+        NCDBufStore_SetBufSize(&o->store, (buf_size > o->read_max / 2) ? o->read_max : 2 * buf_size);
+    }
+    else if (data_len <= buf_size / 4 && buf_size > MIN_READ_BUF_SIZE) {
+        if (++o->small_reads >= READ_SHRINK_COUNT) {
+            o->small_reads = 0;
+            NCDBufStore_SetBufSize(&o->store, (buf_size / 2 < MIN_READ_BUF_SIZE) ? MIN_READ_BUF_SIZE : buf_size / 2);
+        }
+    }
+    else {
+        o->small_reads = 0;
+    }
+    
     // finish read operation
     re->con_inst = NULL;
     re->read_size = data_len;
@@ -626,13 +784,8 @@ static void listen_listener_handler (void *user)
     // insert to clients list
     LinkedList0_Prepend(&o->clients_list, &con->listen.clients_list_node);
     
-    // init store
-    NCDBufStore_Init(&con->store, o->read_buf_size);
-    
-    // set not reading, not writing, recv not closed
-    con->read_inst = NULL;
-    con->write_inst = NULL;
-    con->recv_closed = 0;
+    // init buffers and queues
+    connection_init_io(con, &o->opts);
     
     // set state
     con->state = CONNECTION_STATE_ESTABLISHED;
@@ -682,7 +835,7 @@ static void connect_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     }
     
     // parse options
-    if (!parse_options(i, options_arg, &o->connect.read_buf_size)) {
+    if (!parse_options(i, options_arg, &o->connect.opts)) {
         goto fail0;
     }
     
@@ -789,7 +942,7 @@ static void read_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIns
     struct connection *con_inst = params->method_user;
     
     // check connection state
-    if (con_inst->state != CONNECTION_STATE_ESTABLISHED) {
+    if (con_inst->state != CONNECTION_STATE_ESTABLISHED || con_inst->closing) {
         ModuleLog(i, BLOG_ERROR, "connection is not established");
         goto fail0;
     }
@@ -886,36 +1039,52 @@ static void write_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIn
     struct connection *con_inst = params->method_user;
     
     // check connection state
-    if (con_inst->state != CONNECTION_STATE_ESTABLISHED) {
+    if (con_inst->state != CONNECTION_STATE_ESTABLISHED || con_inst->closing) {
         ModuleLog(i, BLOG_ERROR, "connection is not established");
         goto fail0;
     }
     
-    // check if there's already a write in progress
-    if (con_inst->write_inst) {
-        ModuleLog(i, BLOG_ERROR, "write is already in progress");
-        goto fail0;
-    }
-    
-    // set send state
-    o->data = NCDVal_StringMemRef(data_arg);
+    MemRef data = NCDVal_StringMemRef(data_arg);
     
     // if there's nothing to send, go up immediately
-    if (o->data.len == 0) {
+    if (data.len == 0) {
         o->con_inst = NULL;
         NCDModuleInst_Backend_Up(i);
         return;
     }
     
-    // set connection
-    o->con_inst = con_inst;
-    
-    // register write operation in connection
-    con_inst->write_inst = o;
+    if (data.len <= con_inst->write_buffer - con_inst->buffered_len) {
+        // copy the data into the write buffer
+        struct send_chunk *chunk = malloc(sizeof(*chunk) + data.len);
+        if (!chunk) {
+            ModuleLog(i, BLOG_ERROR, "malloc failed");
+            goto fail0;
+        }
+        memcpy(chunk + 1, data.ptr, data.len);
+        chunk->wr = NULL;
+        chunk->data = MemRef_Make((const char *)(chunk + 1), data.len);
+        
+        // queue it
+        LinkedList1_Append(&con_inst->send_queue, &chunk->queue_node);
+        con_inst->buffered_len += data.len;
+        
+        // go up without waiting
+        o->con_inst = NULL;
+        NCDModuleInst_Backend_Up(i);
+    } else {
+        // queue the data in place
+        o->chunk.wr = o;
+        o->chunk.data = data;
+        LinkedList1_Append(&con_inst->send_queue, &o->chunk.queue_node);
+        
+        // set connection
+        o->con_inst = con_inst;
+    }
     
-    // send
-    size_t to_send = (o->data.len > INT_MAX) ? INT_MAX : o->data.len;
-    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&con_inst->connection), (uint8_t *)o->data.ptr, to_send);
+    // start sending if idle
+    if (!con_inst->send_busy) {
+        connection_send_next(con_inst);
+    }
     return;
     
 fail0:
@@ -929,7 +1098,6 @@ static void write_func_die (void *vo)
     // if we're sending, abort connection
     if (o->con_inst) {
         ASSERT(o->con_inst->state == CONNECTION_STATE_ESTABLISHED)
-        ASSERT(o->con_inst->write_inst == o)
         connection_abort(o->con_inst);
     }
     
@@ -948,7 +1116,7 @@ static void close_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIn
     struct connection *con_inst = params->method_user;
     
     // check connection state
-    if (con_inst->state != CONNECTION_STATE_ESTABLISHED) {
+    if (con_inst->state != CONNECTION_STATE_ESTABLISHED || con_inst->closing) {
         ModuleLog(i, BLOG_ERROR, "connection is not established");
         goto fail0;
     }
@@ -956,6 +1124,12 @@ static void close_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIn
     // go up
     NCDModuleInst_Backend_Up(i);
     
+    // if there is data still to be sent, close once it has been
+    if (!LinkedList1_IsEmpty(&con_inst->send_queue)) {
+        con_inst->closing = 1;
+        return;
+    }
+    
     // abort
     connection_abort(con_inst);
     return;
@@ -986,7 +1160,7 @@ static void listen_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
     }
     
     // parse options
-    if (!parse_options(i, options_arg, &o->read_buf_size)) {
+    if (!parse_options(i, options_arg, &o->opts)) {
         goto fail0;
     }
     
@@ -30,10 +30,19 @@
  * 
  * Linux event device module.
  * 
- * Synopsis: sys.evdev(string device)
+ * Synopsis: sys.evdev(string device [, map options])
  * Description: reports input events from a Linux event device. Transitions up when an event is
  *   detected, and goes down waiting for the next event when sys.evdev::nextevent() is called.
- * Variables:
+ *   Events are read from the device in batches.
+ * Options:
+ *   "frames" - if "true", report whole frames, i.e. the events up to and including a
+ *     SYN_REPORT, rather than single events. Events between a SYN_DROPPED and the next
+ *     SYN_REPORT are discarded, as they do not make a complete frame. Default false.
+ *   "coalesce" - if "true", when more complete frames have been read by the time a frame is
+ *     reported, merge them into one: for each EV_ABS code (except multi-touch ABS_MT_* codes)
+ *     only the latest value is kept, and EV_REL values with the same code are summed. Other
+ *     events are kept in order. Requires "frames". Default false.
+ * Variables (without "frames"):
  *   string type - symbolic event type (e.g. EV_KEY, EV_REL, EV_ABS), corresponding to
  *     (struct input_event).type, or "unknown"
  *   string value - event value (signed integer), equal to (struct input_event).value
@@ -41,6 +50,10 @@
  *     (struct input_event).code
  *   string code - symbolic event code (e.g. KEY_ESC. KEY_1, KEY_2, BTN_LEFT), corrresponding
  *     to (struct input_event).code, or "unknown"
+ * Variables (with "frames"):
+ *   list events - events of the frame, without the terminating SYN_REPORT, each a map with
+ *     the keys "type", "value", "code_numeric" and "code", as the variables above
+ *   string num_frames - number of frames merged into this one, 1 unless coalescing
  * 
  * Synopsis: sys.evdev::nextevent()
  * Description: makes the evdev module transition down in order to report the next event.
@@ -58,6 +71,7 @@
 
 #include <misc/nonblocking.h>
 #include <misc/debug.h>
+#include <base/BPending.h>
 
 #include <ncd/module_common.h>
 
@@ -65,20 +79,36 @@
 
 #include "linux_input_names.h"
 
+// number of events read from the device at once
+#define EVDEV_READ_BATCH 64
+
+// maximum number of events in a reported frame; longer frames are reported in parts
+#define EVDEV_MAX_FRAME_EVENTS 256
+
 struct instance {
     NCDModuleInst *i;
     int evdev_fd;
     BFileDescriptor bfd;
+    BPending buffer_job;
+    int frames;
+    int coalesce;
     int processing;
+    int dropping;
+    int buf_start;
+    int buf_end;
+    struct input_event buf[EVDEV_READ_BATCH];
     struct input_event event;
+    int frame_len;
+    int frame_count;
+    struct input_event frame[EVDEV_MAX_FRAME_EVENTS];
 };
 
 static void instance_free (struct instance *o, int is_error);
 
-enum {STRING_VALUE, STRING_CODE_NUMERIC, STRING_CODE};
+enum {STRING_VALUE, STRING_CODE_NUMERIC, STRING_CODE, STRING_EVENTS, STRING_NUM_FRAMES};
 
 static const char *strings[] = {
-    "value", "code_numeric", "code", NULL
+    "value", "code_numeric", "code", "events", "num_frames", NULL
 };
 
 #define MAKE_LOOKUP_FUNC(_name_) \
@@ -102,46 +132,246 @@ MAKE_LOOKUP_FUNC(rep)
 MAKE_LOOKUP_FUNC(snd)
 MAKE_LOOKUP_FUNC(ffstatus)
 
+static const char * evdev_code_to_str (const struct input_event *ev)
+{
+    #define MAKE_CASE(_evname_, _name_) \
+        case _evname_: \
+            return evdev_##_name_##_to_str(ev->code);
+    
+    switch (ev->type) {
+        #ifdef EV_KEY
+        MAKE_CASE(EV_KEY, key)
+        #endif
+        #ifdef EV_SYN
+        MAKE_CASE(EV_SYN, syn)
+        #endif
+        #ifdef EV_REL
+        MAKE_CASE(EV_REL, rel)
+        #endif
+        #ifdef EV_ABS
+        MAKE_CASE(EV_ABS, abs)
+        #endif
+        #ifdef EV_SW
+        MAKE_CASE(EV_SW, sw)
+        #endif
+        #ifdef EV_MSC
+        MAKE_CASE(EV_MSC, msc)
+        #endif
+        #ifdef EV_LED
+        MAKE_CASE(EV_LED, led)
+        #endif
+        #ifdef EV_REP
+        MAKE_CASE(EV_REP, rep)
+        #endif
+        #ifdef EV_SND
+        MAKE_CASE(EV_SND, snd)
+        #endif
+        #ifdef EV_FF_STATUS
+        MAKE_CASE(EV_FF_STATUS, ffstatus)
+        #endif
+    }
+    
+    #undef MAKE_CASE
+    
+    return "unknown";
+}
+
+static NCDValRef make_value (NCDValMem *mem, int32_t value)
+{
+    char str[50];
+    snprintf(str, sizeof(str), "%"PRIi32, value);
+    return NCDVal_NewString(mem, str);
+}
+
+static int can_coalesce (const struct input_event *ev)
+{
+    if (ev->type == EV_REL) {
+        return 1;
+    }
+    
+    // multi-touch events depend on the preceding ABS_MT_SLOT
+    #ifdef ABS_MT_SLOT
+    if (ev->type == EV_ABS && ev->code < ABS_MT_SLOT) {
+        return 1;
+    }
+    #else
+    if (ev->type == EV_ABS) {
+        return 1;
+    }
+    #endif
+    
+    return 0;
+}
+
+static int buffer_has_frame (struct instance *o)
+{
+    // look for a complete frame, which events were not dropped from
+    for (int j = o->buf_start; j < o->buf_end; j++) {
+        if (o->buf[j].type == EV_SYN && o->buf[j].code == SYN_DROPPED) {
+            return 0;
+        }
+        if (o->buf[j].type == EV_SYN && o->buf[j].code == SYN_REPORT) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+// Adds an event to the frame being collected. Returns 1 if the frame is complete,
+// 2 if it is full and the event was not consumed, and 0 otherwise.
+static int frame_add (struct instance *o, const struct input_event *ev)
+{
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+        // the device dropped events; discard until the next report
+        ModuleLog(o->i, BLOG_WARNING, "events dropped by device");
+        o->dropping = 1;
+        return 0;
+    }
+    
+    if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        if (o->dropping) {
+            o->dropping = 0;
+            o->frame_len = 0;
+            o->frame_count = 0;
+            return 0;
+        }
+        if (o->frame_len == 0) {
+            return 0;
+        }
+        o->frame_count++;
+        return 1;
+    }
+    
+    if (o->dropping) {
+        return 0;
+    }
+    
+    // merge with an event of the same code
+    if (o->coalesce && can_coalesce(ev)) {
+        for (int j = 0; j < o->frame_len; j++) {
+            struct input_event *fev = &o->frame[j];
+            if (fev->type == ev->type && fev->code == ev->code) {
+                fev->value = (ev->type == EV_REL ? fev->value + ev->value : ev->value);
+                fev->time = ev->time;
+                return 0;
+            }
+        }
+    }
+    
+    if (o->frame_len == EVDEV_MAX_FRAME_EVENTS) {
+        o->frame_count++;
+        return 2;
+    }
+    
+    o->frame[o->frame_len++] = *ev;
+    
+    return 0;
+}
+
+static void report (struct instance *o)
+{
+    ASSERT(!o->processing)
+    
+    // set processing
+    o->processing = 1;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+}
+
+static void process_buffer (struct instance *o)
+{
+    ASSERT(!o->processing)
+    
+    while (o->buf_start < o->buf_end) {
+        struct input_event *ev = &o->buf[o->buf_start++];
+        
+        if (!o->frames) {
+            o->event = *ev;
+            report(o);
+            return;
+        }
+        
+        int res = frame_add(o, ev);
+        if (res == 0) {
+            continue;
+        }
+        
+        if (res == 2) {
+            // frame is full, report it and retry the event with the next one
+            o->buf_start--;
+            report(o);
+            return;
+        }
+        
+        // keep merging frames which have already been read
+        if (o->coalesce && buffer_has_frame(o)) {
+            continue;
+        }
+        
+        report(o);
+        return;
+    }
+    
+    // start reading
+    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+}
+
 static void device_handler (struct instance *o, int events)
 {
-    if (o->processing) {
+    if (o->processing || o->buf_start < o->buf_end) {
         ModuleLog(o->i, BLOG_ERROR, "device error");
         instance_free(o, 1);
         return;
     }
     
-    int res = read(o->evdev_fd, &o->event, sizeof(o->event));
+    int res = read(o->evdev_fd, o->buf, sizeof(o->buf));
     if (res < 0) {
         ModuleLog(o->i, BLOG_ERROR, "read failed");
         instance_free(o, 1);
         return;
     }
-    if (res != sizeof(o->event)) {
+    if (res == 0 || res % sizeof(o->buf[0]) != 0) {
         ModuleLog(o->i, BLOG_ERROR, "read wrong");
         instance_free(o, 1);
         return;
     }
     
+    o->buf_start = 0;
+    o->buf_end = res / sizeof(o->buf[0]);
+    
     // stop reading
     BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, 0);
     
-    // set processing
-    o->processing = 1;
+    process_buffer(o);
+}
+
+static void buffer_job_handler (struct instance *o)
+{
+    ASSERT(!o->processing)
     
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
+    process_buffer(o);
 }
 
 static void device_nextevent (struct instance *o)
 {
     ASSERT(o->processing)
     
-    // start reading
-    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
-    
     // set not processing
     o->processing = 0;
     
+    // start a new frame
+    o->frame_len = 0;
+    o->frame_count = 0;
+    
+    // continue with buffered events, or start reading
+    if (o->buf_start < o->buf_end) {
+        BPending_Set(&o->buffer_job);
+    } else {
+        BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+    }
+    
     // signal down
     NCDModuleInst_Backend_Down(o->i);
 }
@@ -153,7 +383,10 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     
     // check arguments
     NCDValRef device_arg;
-    if (!NCDVal_ListRead(params->args, 1, &device_arg)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &device_arg) &&
+        !NCDVal_ListRead(params->args, 2, &device_arg, &options_arg)
+    ) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
@@ -162,6 +395,45 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
+    // read options
+    o->frames = 0;
+    o->coalesce = 0;
+    if (!NCDVal_IsInvalid(options_arg)) {
+        if (!NCDVal_IsMap(options_arg)) {
+            ModuleLog(o->i, BLOG_ERROR, "options argument is not a map");
+            goto fail0;
+        }
+        
+        int num_recognized = 0;
+        NCDValRef value;
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options_arg, "frames"))) {
+            if (!ncd_read_boolean(value, &o->frames)) {
+                ModuleLog(o->i, BLOG_ERROR, "wrong frames");
+                goto fail0;
+            }
+            num_recognized++;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options_arg, "coalesce"))) {
+            if (!ncd_read_boolean(value, &o->coalesce)) {
+                ModuleLog(o->i, BLOG_ERROR, "wrong coalesce");
+                goto fail0;
+            }
+            num_recognized++;
+        }
+        
+        if (NCDVal_MapCount(options_arg) > num_recognized) {
+            ModuleLog(o->i, BLOG_ERROR, "unrecognized options present");
+            goto fail0;
+        }
+        
+        if (o->coalesce && !o->frames) {
+            ModuleLog(o->i, BLOG_ERROR, "coalesce requires frames");
+            goto fail0;
+        }
+    }
+    
     // null terminate device
     NCDValNullTermString device_nts;
     if (!NCDVal_StringNullTerminate(device_arg, &device_nts)) {
@@ -191,8 +463,16 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     }
     BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
     
-    // set not processing
+    // init buffer job
+    BPending_Init(&o->buffer_job, BReactor_PendingGroup(o->i->params->iparams->reactor), (BPending_handler)buffer_job_handler, o);
+    
+    // set not processing, nothing buffered, empty frame
     o->processing = 0;
+    o->dropping = 0;
+    o->buf_start = 0;
+    o->buf_end = 0;
+    o->frame_len = 0;
+    o->frame_count = 0;
     return;
     
 fail1:
@@ -205,6 +485,9 @@ fail0:
 
 void instance_free (struct instance *o, int is_error)
 {
+    // free buffer job
+    BPending_Free(&o->buffer_job);
+    
     // free BFileDescriptor
     BReactor_RemoveFileDescriptor(o->i->params->iparams->reactor, &o->bfd);
     
@@ -227,20 +510,79 @@ static void func_die (void *vo)
     instance_free(o, 0);
 }
 
+static NCDValRef make_frame_event (struct instance *o, NCDValMem *mem, const struct input_event *ev)
+{
+    NCDValRef map = NCDVal_NewMap(mem, 4);
+    if (NCDVal_IsInvalid(map)) {
+        goto fail;
+    }
+    
+    NCDValRef keys[4] = {
+        NCDVal_NewIdString(mem, NCD_STRING_TYPE),
+        NCDVal_NewIdString(mem, ModuleString(o->i, STRING_VALUE)),
+        NCDVal_NewIdString(mem, ModuleString(o->i, STRING_CODE_NUMERIC)),
+        NCDVal_NewIdString(mem, ModuleString(o->i, STRING_CODE))
+    };
+    NCDValRef vals[4] = {
+        NCDVal_NewString(mem, evdev_type_to_str(ev->type)),
+        make_value(mem, ev->value),
+        ncd_make_uintmax(mem, ev->code),
+        NCDVal_NewString(mem, evdev_code_to_str(ev))
+    };
+    
+    for (int j = 0; j < 4; j++) {
+        if (NCDVal_IsInvalid(keys[j]) || NCDVal_IsInvalid(vals[j])) {
+            goto fail;
+        }
+        int inserted;
+        if (!NCDVal_MapInsert(map, keys[j], vals[j], &inserted)) {
+            goto fail;
+        }
+        ASSERT_EXECUTE(inserted)
+    }
+    
+    return map;
+    
+fail:
+    return NCDVal_NewInvalid();
+}
+
 static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out)
 {
     struct instance *o = vo;
     ASSERT(o->processing)
     
+    if (o->frames) {
+        if (name == ModuleString(o->i, STRING_EVENTS)) {
+            *out = NCDVal_NewList(mem, o->frame_len);
+            if (NCDVal_IsInvalid(*out)) {
+                return 1;
+            }
+            for (int j = 0; j < o->frame_len; j++) {
+                NCDValRef ev = make_frame_event(o, mem, &o->frame[j]);
+                if (NCDVal_IsInvalid(ev) || !NCDVal_ListAppend(*out, ev)) {
+                    *out = NCDVal_NewInvalid();
+                    return 1;
+                }
+            }
+            return 1;
+        }
+        
+        if (name == ModuleString(o->i, STRING_NUM_FRAMES)) {
+            *out = ncd_make_uintmax(mem, o->frame_count);
+            return 1;
+        }
+        
+        return 0;
+    }
+    
     if (name == NCD_STRING_TYPE) {
         *out = NCDVal_NewString(mem, evdev_type_to_str(o->event.type));
         return 1;
     }
     
     if (name == ModuleString(o->i, STRING_VALUE)) {
-        char str[50];
-        snprintf(str, sizeof(str), "%"PRIi32, o->event.value);
-        *out = NCDVal_NewString(mem, str);
+        *out = make_value(mem, o->event.value);
         return 1;
     }
     
@@ -250,47 +592,7 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
     }
     
     if (name == ModuleString(o->i, STRING_CODE)) {
-        const char *str = "unknown";
-        
-        #define MAKE_CASE(_evname_, _name_) \
-            case _evname_: \
-                str = evdev_##_name_##_to_str(o->event.code); \
-                break;
-        
-        switch (o->event.type) {
-            #ifdef EV_KEY
-            MAKE_CASE(EV_KEY, key)
-            #endif
-            #ifdef EV_SYN
-            MAKE_CASE(EV_SYN, syn)
-            #endif
-            #ifdef EV_REL
-            MAKE_CASE(EV_REL, rel)
-            #endif
-            #ifdef EV_ABS
-            MAKE_CASE(EV_ABS, abs)
-            #endif
-            #ifdef EV_SW
-            MAKE_CASE(EV_SW, sw)
-            #endif
-            #ifdef EV_MSC
-            MAKE_CASE(EV_MSC, msc)
-            #endif
-            #ifdef EV_LED
-            MAKE_CASE(EV_LED, led)
-            #endif
-            #ifdef EV_REP
-            MAKE_CASE(EV_REP, rep)
-            #endif
-            #ifdef EV_SND
-            MAKE_CASE(EV_SND, snd)
-            #endif
-            #ifdef EV_FF_STATUS
-            MAKE_CASE(EV_FF_STATUS, ffstatus)
-            #endif
-        }
-        
-        *out = NCDVal_NewString(mem, str);
+        *out = NCDVal_NewString(mem, evdev_code_to_str(&o->event));
         return 1;
     }
     
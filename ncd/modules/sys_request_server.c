@@ -43,7 +43,11 @@
  *   _request->reply(data); replies are values too. Finally, _request->finish()
  *   should be called to indicate that no further replies will be sent. Calling
  *   finish() will immediately initiate termination of the handler process.
- *   Requests can be sent to NCD using the badvpn-ncd-request program.
+ *   Requests can be sent to NCD using the badvpn-ncd-request program; with
+ *   --batch, it keeps many requests in flight over a single connection.
+ *   Each request is sent either in the textual value format or in the compact
+ *   binary format (NCDValBinary), as chosen by the client; replies to it are
+ *   encoded in the same format.
  * 
  *   The listen address should be in the same format as for the socket module.
  *   In particular, it must be in one of the following forms:
@@ -86,6 +90,7 @@
 #include <flow/PacketPassFifoQueue.h>
 #include <ncd/NCDValParser.h>
 #include <ncd/NCDValGenerator.h>
+#include <ncd/NCDValBinary.h>
 #include <ncd/extra/address_utils.h>
 
 #include <ncd/module_common.h>
@@ -129,6 +134,7 @@ struct connection {
 struct request {
     struct connection *con;
     uint32_t request_id;
+    int binary;
     LinkedList0Node requests_list_node;
     NCDValMem request_data_mem;
     NCDValRef request_data;
@@ -153,7 +159,7 @@ static void connection_terminate (struct connection *c);
 static void connection_con_handler (struct connection *c, int event);
 static void connection_recv_decoder_handler_error (struct connection *c);
 static void connection_recv_if_handler_send (struct connection *c, uint8_t *data, int data_len);
-static int request_init (struct connection *c, uint32_t request_id, const uint8_t *data, int data_len);
+static int request_init (struct connection *c, uint32_t request_id, int binary, const uint8_t *data, int data_len);
 static void request_free (struct request *r);
 static struct request * find_request (struct connection *c, uint32_t request_id);
 static void request_process_handler_event (NCDModuleProcess *process, int event);
@@ -161,7 +167,7 @@ static int request_process_func_getspecialobj (NCDModuleProcess *process, NCD_st
 static int request_process_caller_obj_func_getobj (const NCDObject *obj, NCD_string_id_t name, NCDObject *out_object);
 static int request_process_request_obj_func_getvar (const NCDObject *obj, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out_value);
 static void request_terminate (struct request *r);
-static struct reply * reply_init (struct connection *c, uint32_t request_id, NCDValRef reply_data);
+static struct reply * reply_init (struct connection *c, uint32_t request_id, int binary, NCDValRef reply_data);
 static void reply_start (struct reply *r, uint32_t type);
 static void reply_free (struct reply *r);
 static void reply_send_qflow_if_handler_done (struct reply *r);
@@ -327,13 +333,16 @@ static void connection_recv_if_handler_send (struct connection *c, uint8_t *data
     uint32_t type = ltoh32(header.type);
     
     switch (type) {
-        case REQUESTPROTO_TYPE_CLIENT_REQUEST: {
+        case REQUESTPROTO_TYPE_CLIENT_REQUEST:
+        case REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY: {
             if (find_request(c, request_id)) {
                 ModuleLog(o->i, BLOG_ERROR, "request with the same ID already exists");
                 goto fail;
             }
             
-            if (!request_init(c, request_id, data + sizeof(header), data_len - sizeof(header))) {
+            int binary = (type == REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY);
+            
+            if (!request_init(c, request_id, binary, data + sizeof(header), data_len - sizeof(header))) {
                 goto fail;
             }
         } break;
@@ -361,7 +370,7 @@ fail:
     connection_terminate(c);
 }
 
-static int request_init (struct connection *c, uint32_t request_id, const uint8_t *data, int data_len)
+static int request_init (struct connection *c, uint32_t request_id, int binary, const uint8_t *data, int data_len)
 {
     struct instance *o = c->inst;
     ASSERT(c->state == CONNECTION_STATE_RUNNING)
@@ -377,17 +386,27 @@ static int request_init (struct connection *c, uint32_t request_id, const uint8_
     
     r->con = c;
     r->request_id = request_id;
+    r->binary = binary;
     
     LinkedList0_Prepend(&c->requests_list, &r->requests_list_node);
     
     NCDValMem_Init(&r->request_data_mem, o->i->params->iparams->string_index);
     
-    if (!NCDValParser_Parse(MemRef_Make((const char *)data, data_len), &r->request_data_mem, &r->request_data)) {
-        ModuleLog(o->i, BLOG_ERROR, "NCDValParser_Parse failed");
-        goto fail1;
+    MemRef payload = MemRef_Make((const char *)data, data_len);
+    
+    if (binary) {
+        if (!NCDValBinary_Decode(payload, &r->request_data_mem, &r->request_data)) {
+            ModuleLog(o->i, BLOG_ERROR, "NCDValBinary_Decode failed");
+            goto fail1;
+        }
+    } else {
+        if (!NCDValParser_Parse(payload, &r->request_data_mem, &r->request_data)) {
+            ModuleLog(o->i, BLOG_ERROR, "NCDValParser_Parse failed");
+            goto fail1;
+        }
     }
     
-    if (!(r->end_reply = reply_init(c, request_id, NCDVal_NewInvalid()))) {
+    if (!(r->end_reply = reply_init(c, request_id, binary, NCDVal_NewInvalid()))) {
         goto fail1;
     }
     
@@ -528,7 +547,7 @@ static void request_terminate (struct request *r)
     r->terminating = 1;
 }
 
-static struct reply * reply_init (struct connection *c, uint32_t request_id, NCDValRef reply_data)
+static struct reply * reply_init (struct connection *c, uint32_t request_id, int binary, NCDValRef reply_data)
 {
     struct instance *o = c->inst;
     ASSERT(c->state == CONNECTION_STATE_RUNNING)
@@ -560,9 +579,18 @@ static struct reply * reply_init (struct connection *c, uint32_t request_id, NCD
         goto fail2;
     }
     
-    if (!NCDVal_IsInvalid(reply_data) && !NCDValGenerator_AppendGenerate(reply_data, &str)) {
-        ModuleLog(o->i, BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
-        goto fail2;
+    if (!NCDVal_IsInvalid(reply_data)) {
+        if (binary) {
+            if (!NCDValBinary_AppendEncode(reply_data, &str)) {
+                ModuleLog(o->i, BLOG_ERROR, "NCDValBinary_AppendEncode failed");
+                goto fail2;
+            }
+        } else {
+            if (!NCDValGenerator_AppendGenerate(reply_data, &str)) {
+                ModuleLog(o->i, BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
+                goto fail2;
+            }
+        }
     }
     
     size_t len = ExpString_Length(&str);
@@ -727,13 +755,13 @@ static void reply_func_new (void *unused, NCDModuleInst *i, const struct NCDModu
         goto fail;
     }
     
-    struct reply *rpl = reply_init(c, r->request_id, reply_data);
+    struct reply *rpl = reply_init(c, r->request_id, r->binary, reply_data);
     if (!rpl) {
         ModuleLog(i, BLOG_ERROR, "failed to submit reply");
         goto fail;
     }
     
-    reply_start(rpl, REQUESTPROTO_TYPE_SERVER_REPLY);
+    reply_start(rpl, r->binary ? REQUESTPROTO_TYPE_SERVER_REPLY_BINARY : REQUESTPROTO_TYPE_SERVER_REPLY);
     return;
     
 fail:
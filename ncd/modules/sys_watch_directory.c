@@ -30,10 +30,15 @@
  * 
  * Directory watcher.
  * 
- * Synopsis: sys.watch_directory(string dir)
+ * Synopsis: sys.watch_directory(string dir [, map options])
  * Description: reports directory entry events. Transitions up when an event is detected, and
  *   goes down waiting for the next event when sys.watch_directory::nextevent() is called.
  *   The directory is first scanned and "added" events are reported for all files.
+ * Arguments:
+ *   options - map of options:
+ *     "debounce" - if nonzero, events are held for this many milliseconds from the first
+ *       one; repeated "changed" events for a file, and a file going back to an earlier
+ *       state, are reported only in the final state. Default 0.
  * Variables:
  *   string event_type - what happened with the file: "added", "removed" or "changed"
  *   string filename - name of the file in the directory the event refers to
@@ -53,6 +58,7 @@
 
 #include <misc/nonblocking.h>
 #include <misc/concat_strings.h>
+#include <ncd/modules/event_template.h>
 
 #include <ncd/module_common.h>
 
@@ -67,29 +73,75 @@ struct instance {
     int inotify_fd;
     BFileDescriptor bfd;
     struct inotify_event events[MAX_INOTIFY_EVENTS];
-    int events_count;
-    int events_index;
-    int processing;
-    const char *processing_file;
-    const char *processing_type;
+    int paused;
+    event_template templ;
 };
 
-static void instance_free (struct instance *o, int is_error);
+static void templ_func_free (struct instance *o, int is_error);
 
-static void next_dir_event (struct instance *o)
+static int queue_event (struct instance *o, const char *type, const char *filename)
 {
-    ASSERT(!o->processing)
-    ASSERT(o->dir_handle)
+    // init map
+    BStringMap map;
+    BStringMap_Init(&map);
+    
+    // set type
+    if (!BStringMap_Set(&map, "event_type", type)) {
+        ModuleLog(o->i, BLOG_ERROR, "BStringMap_Set failed");
+        goto fail1;
+    }
+    
+    // set filename
+    if (!BStringMap_Set(&map, "filename", filename)) {
+        ModuleLog(o->i, BLOG_ERROR, "BStringMap_Set failed");
+        goto fail1;
+    }
+    
+    // set filepath
+    char *filepath = concat_strings(3, o->dir_nts.data, "/", filename);
+    if (!filepath) {
+        ModuleLog(o->i, BLOG_ERROR, "concat_strings failed");
+        goto fail1;
+    }
+    int res = BStringMap_Set(&map, "filepath", filepath);
+    free(filepath);
+    if (!res) {
+        ModuleLog(o->i, BLOG_ERROR, "BStringMap_Set failed");
+        goto fail1;
+    }
+    
+    // pass event to template
+    int pause;
+    event_template_queue(&o->templ, map, &pause);
+    
+    // if template is busy, stop producing events
+    if (pause) {
+        o->paused = 1;
+        if (!o->dir_handle) {
+            BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, 0);
+        }
+    }
     
-    struct dirent *entry;
+    return 1;
     
-    do {
+fail1:
+    BStringMap_Free(&map);
+    return 0;
+}
+
+static void scan_dir (struct instance *o)
+{
+    ASSERT(!o->paused)
+    ASSERT(o->dir_handle)
+    
+    while (!o->paused) {
         // get next entry
         errno = 0;
-        if (!(entry = readdir(o->dir_handle))) {
+        struct dirent *entry = readdir(o->dir_handle);
+        if (!entry) {
             if (errno != 0) {
                 ModuleLog(o->i, BLOG_ERROR, "readdir failed");
-                instance_free(o, 1);
+                event_template_die_error(&o->templ);
                 return;
             }
             
@@ -97,7 +149,7 @@ static void next_dir_event (struct instance *o)
             if (closedir(o->dir_handle) < 0) {
                 ModuleLog(o->i, BLOG_ERROR, "closedir failed");
                 o->dir_handle = NULL;
-                instance_free(o, 1);
+                event_template_die_error(&o->templ);
                 return;
             }
             
@@ -108,30 +160,20 @@ static void next_dir_event (struct instance *o)
             BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
             return;
         }
-    } while (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."));
-    
-    // set event
-    o->processing_file = entry->d_name;
-    o->processing_type = "added";
-    o->processing = 1;
-    
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
-}
-
-static void assert_inotify_event (struct instance *o)
-{
-    ASSERT(o->events_index < o->events_count)
-    ASSERT(o->events[o->events_index].len % sizeof(o->events[0]) == 0)
-    ASSERT(o->events[o->events_index].len / sizeof(o->events[0]) <= o->events_count - (o->events_index + 1))
+        
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        
+        // report the entry
+        if (!queue_event(o, "added", entry->d_name)) {
+            ModuleLog(o->i, BLOG_ERROR, "failed to report %s", entry->d_name);
+        }
+    }
 }
 
-static const char * translate_inotify_event (struct instance *o)
+static const char * translate_inotify_event (struct inotify_event *event)
 {
-    assert_inotify_event(o);
-    
-    struct inotify_event *event = &o->events[o->events_index];
-    
     if (strlen(event->name) > 0) {
         if ((event->mask & (IN_CREATE | IN_MOVED_TO))) {
             return "added";
@@ -147,47 +189,11 @@ static const char * translate_inotify_event (struct instance *o)
     return NULL;
 }
 
-static void skip_inotify_event (struct instance *o)
-{
-    assert_inotify_event(o);
-    
-    o->events_index += 1 + o->events[o->events_index].len / sizeof(o->events[0]);
-}
-
-static void next_inotify_event (struct instance *o)
-{
-    ASSERT(!o->processing)
-    ASSERT(!o->dir_handle)
-    
-    // skip any bad events
-    while (o->events_index < o->events_count && !translate_inotify_event(o)) {
-        ModuleLog(o->i, BLOG_ERROR, "unknown inotify event");
-        skip_inotify_event(o);
-    }
-    
-    if (o->events_index == o->events_count) {
-        // wait for more events
-        BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
-        return;
-    }
-    
-    // set event
-    o->processing_file = o->events[o->events_index].name;
-    o->processing_type = translate_inotify_event(o);
-    o->processing = 1;
-    
-    // consume this event
-    skip_inotify_event(o);
-    
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
-}
-
 static void inotify_fd_handler (struct instance *o, int events)
 {
-    if (o->processing) {
+    if (o->paused) {
         ModuleLog(o->i, BLOG_ERROR, "file descriptor error");
-        instance_free(o, 1);
+        event_template_die_error(&o->templ);
         return;
     }
     
@@ -196,40 +202,51 @@ static void inotify_fd_handler (struct instance *o, int events)
     int res = read(o->inotify_fd, o->events, sizeof(o->events));
     if (res < 0) {
         ModuleLog(o->i, BLOG_ERROR, "read failed");
-        instance_free(o, 1);
+        event_template_die_error(&o->templ);
         return;
     }
     
-    // stop waiting for inotify events
-    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, 0);
-    
     ASSERT(res <= sizeof(o->events))
     ASSERT(res % sizeof(o->events[0]) == 0)
     
-    // setup buffer state
-    o->events_count = res / sizeof(o->events[0]);
-    o->events_index = 0;
-    
-    // process inotify events
-    next_inotify_event(o);
+    // pass the events to the template; at most MAX_INOTIFY_EVENTS fit in the buffer
+    int count = res / sizeof(o->events[0]);
+    int index = 0;
+    while (index < count) {
+        struct inotify_event *event = &o->events[index];
+        ASSERT(event->len % sizeof(o->events[0]) == 0)
+        ASSERT(event->len / sizeof(o->events[0]) <= count - (index + 1))
+        
+        const char *type = translate_inotify_event(event);
+        if (!type) {
+            ModuleLog(o->i, BLOG_ERROR, "unknown inotify event");
+        }
+        else if (!queue_event(o, type, event->name)) {
+            ModuleLog(o->i, BLOG_ERROR, "failed to report %s", event->name);
+        }
+        
+        index += 1 + event->len / sizeof(o->events[0]);
+    }
 }
 
 static void next_event (struct instance *o)
 {
-    ASSERT(o->processing)
-    
-    // set not processing
-    o->processing = 0;
+    ASSERT(event_template_is_enabled(&o->templ))
     
-    // signal down
-    NCDModuleInst_Backend_Down(o->i);
+    // order template to finish the current event
+    int resume;
+    event_template_dequeue(&o->templ, &resume);
     
-    if (o->dir_handle) {
-        next_dir_event(o);
-        return;
-    } else {
-        next_inotify_event(o);
-        return;
+    // if template can take events again, continue producing them
+    if (resume) {
+        ASSERT(o->paused)
+        o->paused = 0;
+        
+        if (o->dir_handle) {
+            scan_dir(o);
+        } else {
+            BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+        }
     }
 }
 
@@ -240,7 +257,10 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     
     // check arguments
     NCDValRef dir_arg;
-    if (!NCDVal_ListRead(params->args, 1, &dir_arg)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &dir_arg) &&
+        !NCDVal_ListRead(params->args, 2, &dir_arg, &options_arg)
+    ) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
@@ -249,6 +269,12 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
+    // read options
+    btime_t debounce;
+    if (!event_template_read_options(o->i, BLOG_CURRENT_CHANNEL, options_arg, &debounce)) {
+        goto fail0;
+    }
+    
     // null terminate dir
     if (!NCDVal_StringNullTerminate(dir_arg, &o->dir_nts)) {
         ModuleLog(o->i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
@@ -286,11 +312,16 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail3;
     }
     
-    // set not processing
-    o->processing = 0;
+    // set not paused
+    o->paused = 0;
     
-    // read first directory entry
-    next_dir_event(o);
+    // init template; a whole inotify buffer may be queued at once
+    if (!event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, MAX_INOTIFY_EVENTS, debounce, "filename", o, (event_template_func_free)templ_func_free)) {
+        return;
+    }
+    
+    // report directory entries
+    scan_dir(o);
     return;
     
 fail3:
@@ -305,7 +336,7 @@ fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
 
-void instance_free (struct instance *o, int is_error)
+static void templ_func_free (struct instance *o, int is_error)
 {
     // close directory
     if (o->dir_handle) {
@@ -335,42 +366,13 @@ void instance_free (struct instance *o, int is_error)
 static void func_die (void *vo)
 {
     struct instance *o = vo;
-    instance_free(o, 0);
+    event_template_die(&o->templ);
 }
 
 static int func_getvar (void *vo, const char *name, NCDValMem *mem, NCDValRef *out)
 {
     struct instance *o = vo;
-    ASSERT(o->processing)
-    
-    if (!strcmp(name, "event_type")) {
-        *out = NCDVal_NewString(mem, o->processing_type);
-        return 1;
-    }
-    
-    if (!strcmp(name, "filename")) {
-        *out = NCDVal_NewString(mem, o->processing_file);
-        return 1;
-    }
-    
-    if (!strcmp(name, "filepath")) {
-        char *str = concat_strings(3, o->dir_nts.data, "/", o->processing_file);
-        if (!str) {
-            ModuleLog(o->i, BLOG_ERROR, "concat_strings failed");
-            goto fail;
-        }
-        
-        *out = NCDVal_NewString(mem, str);
-        
-        free(str);
-        return 1;
-    }
-    
-    return 0;
-    
-fail:
-    *out = NCDVal_NewInvalid();
-    return 1;
+    return event_template_getvar(&o->templ, name, mem, out);
 }
 
 static void nextevent_func_new (void *unused, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
@@ -385,7 +387,7 @@ static void nextevent_func_new (void *unused, NCDModuleInst *i, const struct NCD
     struct instance *mo = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
     
     // make sure we are currently reporting an event
-    if (!mo->processing) {
+    if (!event_template_is_enabled(&mo->templ)) {
         ModuleLog(i, BLOG_ERROR, "not reporting an event");
         goto fail0;
     }
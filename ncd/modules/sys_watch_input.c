@@ -30,12 +30,14 @@
  * 
  * Input device watcher.
  * 
- * Synopsis: sys.watch_input(string devnode_type)
+ * Synopsis: sys.watch_input(string devnode_type [, map options])
  * Description: reports input device events. Transitions up when an event is detected, and
  *   goes down waiting for the next event when sys.watch_input::nextevent() is called.
  *   On startup, "added" events are reported for existing input devices.
  * Arguments:
  *   string devnode_type - device node type, for example "event", "mouse" or "js".
+ *   options - map of options:
+ *     "debounce" - like in net.watch_interfaces, by devname. Default 0.
  * Variables:
  *   string event_type - what happened with the input device: "added" or "removed"
  *   string devname - device node path
@@ -186,11 +188,11 @@ static int devname_is_type (const char *devname, MemRef devname_type)
 static void queue_event (struct instance *o, BStringMap map)
 {
     // pass event to template
-    int was_empty;
-    event_template_queue(&o->templ, map, &was_empty);
+    int pause;
+    event_template_queue(&o->templ, map, &pause);
     
-    // if event queue was empty, stop receiving udev events
-    if (was_empty) {
+    // if template is busy, stop receiving udev events
+    if (pause) {
         NCDUdevClient_Pause(&o->client);
     }
 }
@@ -263,11 +265,11 @@ static void next_event (struct instance *o)
     ASSERT(event_template_is_enabled(&o->templ))
     
     // order template to finish the current event
-    int is_empty;
-    event_template_dequeue(&o->templ, &is_empty);
+    int resume;
+    event_template_dequeue(&o->templ, &resume);
     
-    // if template has no events, continue udev events
-    if (is_empty) {
+    // if template can take events again, continue udev events
+    if (resume) {
         NCDUdevClient_Continue(&o->client);
     }
 }
@@ -348,7 +350,10 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     
     // check arguments
     NCDValRef devnode_type_arg;
-    if (!NCDVal_ListRead(params->args, 1, &devnode_type_arg)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &devnode_type_arg) &&
+        !NCDVal_ListRead(params->args, 2, &devnode_type_arg, &options_arg)
+    ) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
@@ -356,15 +361,21 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         ModuleLog(o->i, BLOG_ERROR, "wrong type");
         goto fail0;
     }
+    
+    // read options
+    btime_t debounce;
+    if (!event_template_read_options(o->i, BLOG_CURRENT_CHANNEL, options_arg, &debounce)) {
+        goto fail0;
+    }
     o->devnode_type = NCDVal_StringMemRef(devnode_type_arg);
     
     // init client
-    NCDUdevClient_Init(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler);
+    NCDUdevClient_InitFilter(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler, "SUBSYSTEM", "input");
     
     // init devices list
     LinkedList1_Init(&o->devices_list);
     
-    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, o, (event_template_func_free)templ_func_free);
+    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, debounce, "devname", o, (event_template_func_free)templ_func_free);
     return;
     
 fail0:
@@ -30,10 +30,13 @@
  * 
  * USB device watcher.
  * 
- * Synopsis: sys.watch_usb()
+ * Synopsis: sys.watch_usb([map options])
  * Description: reports USB device events. Transitions up when an event is detected, and
  *   goes down waiting for the next event when ->nextevent() is called.
  *   On startup, "added" events are reported for existing USB devices.
+ * Arguments:
+ *   options - map of options:
+ *     "debounce" - like in net.watch_interfaces, by devname. Default 0.
  * 
  * Variables:
  *   string event_type - what happened with the USB device: "added" or "removed"
@@ -168,11 +171,11 @@ fail1:
 static void queue_event (struct instance *o, BStringMap map)
 {
     // pass event to template
-    int was_empty;
-    event_template_queue(&o->templ, map, &was_empty);
+    int pause;
+    event_template_queue(&o->templ, map, &pause);
     
-    // if event queue was empty, stop receiving udev events
-    if (was_empty) {
+    // if template is busy, stop receiving udev events
+    if (pause) {
         NCDUdevClient_Pause(&o->client);
     }
 }
@@ -248,11 +251,11 @@ static void next_event (struct instance *o)
     ASSERT(event_template_is_enabled(&o->templ))
     
     // order template to finish the current event
-    int is_empty;
-    event_template_dequeue(&o->templ, &is_empty);
+    int resume;
+    event_template_dequeue(&o->templ, &resume);
     
-    // if template has no events, continue udev events
-    if (is_empty) {
+    // if template can take events again, continue udev events
+    if (resume) {
         NCDUdevClient_Continue(&o->client);
     }
 }
@@ -322,18 +325,25 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     o->i = i;
     
     // check arguments
-    if (!NCDVal_ListRead(params->args, 0)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 0) && !NCDVal_ListRead(params->args, 1, &options_arg)) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
     
+    // read options
+    btime_t debounce;
+    if (!event_template_read_options(o->i, BLOG_CURRENT_CHANNEL, options_arg, &debounce)) {
+        goto fail0;
+    }
+    
     // init client
-    NCDUdevClient_Init(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler);
+    NCDUdevClient_InitFilter(&o->client, o->i->params->iparams->umanager, o, (NCDUdevClient_handler)client_handler, "SUBSYSTEM", "usb");
     
     // init devices list
     LinkedList1_Init(&o->devices_list);
     
-    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, o, (event_template_func_free)templ_func_free);
+    event_template_new(&o->templ, o->i, BLOG_CURRENT_CHANNEL, 3, debounce, "devname", o, (event_template_func_free)templ_func_free);
     return;
     
 fail0:
@@ -46,6 +46,10 @@
  *   Value objects allow examining and manipulating values.
  *   These value objects are actually references to internal value structures, which
  *   may be shared between value objects.
+ *   Reading a list or map value object does not copy it: readers share a snapshot
+ *   of it, which is rebuilt on the first read after the list or map (or anything
+ *   inside it) is modified. String keys of large maps are also hashed, so lookups
+ *   by string key don't compare keys along a tree path.
  * 
  *   value(value) constructs a new value object from the given value.
  * 
@@ -159,11 +163,14 @@
 #include <misc/offset.h>
 #include <misc/debug.h>
 #include <misc/balloc.h>
+#include <misc/hashfun.h>
 #include <structure/LinkedList0.h>
 #include <structure/IndexedList.h>
 #include <structure/SAvl.h>
+#include <structure/CHash.h>
 #include <ncd/NCDStringIndex.h>
 #include <ncd/extra/NCDRefString.h>
+#include <ncd/extra/NCDRefVal.h>
 
 #include <ncd/module_common.h>
 
@@ -173,11 +180,19 @@
 #define IDSTRING_TYPE (NCDVAL_STRING | (1 << 3))
 #define EXTERNALSTRING_TYPE (NCDVAL_STRING | (2 << 3))
 
+// string keys of maps with at least this many entries are also hashed
+#define MAPHASH_MIN_ENTRIES 8
+
 struct value;
 
+typedef struct value *MapHash_link;
+
 #include "value_maptree.h"
 #include <structure/SAvl_decl.h>
 
+#include "value_maphash.h"
+#include <structure/CHash_decl.h>
+
 struct valref {
     struct value *v;
     LinkedList0Node refs_list_node;
@@ -204,9 +219,14 @@ struct value {
             NCDValMem key_mem;
             NCDValRef key;
             MapTreeNode maptree_node;
+            MapHash_link maphash_next;
+            size_t key_hash;
         } map_parent;
     };
     
+    // snapshot of a list or map shared with readers, NULL if none
+    NCDRefVal *snapshot;
+    
     int type;
     union {
         struct {
@@ -228,6 +248,8 @@ struct value {
         } list;
         struct {
             MapTree map_tree;
+            int have_hash;
+            MapHash hash;
         } map;
     };
 };
@@ -235,6 +257,7 @@ struct value {
 static const char * get_type_str (int type);
 static void value_cleanup (struct value *v);
 static void value_delete (struct value *v);
+static void value_modified (struct value *v);
 static struct value * value_init_storedstring (NCDModuleInst *i, MemRef str);
 static struct value * value_init_idstring (NCDModuleInst *i, NCD_string_id_t id, NCDStringIndex *string_index);
 static struct value * value_init_externalstring (NCDModuleInst *i, MemRef data, BRefTarget *ref_target);
@@ -276,6 +299,9 @@ static const char *strings[] = {
 #include "value_maptree.h"
 #include <structure/SAvl_impl.h>
 
+#include "value_maphash.h"
+#include <structure/CHash_impl.h>
+
 static const char * get_type_str (int type)
 {
     switch (type) {
@@ -298,6 +324,11 @@ static void value_cleanup (struct value *v)
         return;
     }
     
+    if (v->snapshot) {
+        BRefTarget_Deref(NCDRefVal_RefTarget(v->snapshot));
+        v->snapshot = NULL;
+    }
+    
     switch (v->type) {
         case STOREDSTRING_TYPE: {
             BRefTarget_Deref(NCDRefString_RefTarget(v->storedstring.rstr));
@@ -326,6 +357,9 @@ static void value_cleanup (struct value *v)
                 value_map_remove(v, ev);
                 value_cleanup(ev);
             }
+            if (v->map.have_hash) {
+                MapHash_Free(&v->map.hash);
+            }
         } break;
         
         default: ASSERT(0);
@@ -355,6 +389,11 @@ static void value_delete (struct value *v)
         valref_break(r);
     }
     
+    if (v->snapshot) {
+        BRefTarget_Deref(NCDRefVal_RefTarget(v->snapshot));
+        v->snapshot = NULL;
+    }
+    
     switch (v->type) {
         case STOREDSTRING_TYPE: {
             BRefTarget_Deref(NCDRefString_RefTarget(v->storedstring.rstr));
@@ -381,6 +420,9 @@ static void value_delete (struct value *v)
                 struct value *ev = value_map_at(v, 0);
                 value_delete(ev);
             }
+            if (v->map.have_hash) {
+                MapHash_Free(&v->map.hash);
+            }
         } break;
         
         default: ASSERT(0);
@@ -389,6 +431,17 @@ static void value_delete (struct value *v)
     free(v);
 }
 
+static void value_modified (struct value *v)
+{
+    // the snapshots of this value and of everything containing it are stale
+    for (; v; v = v->parent) {
+        if (v->snapshot) {
+            BRefTarget_Deref(NCDRefVal_RefTarget(v->snapshot));
+            v->snapshot = NULL;
+        }
+    }
+}
+
 static struct value * value_init_storedstring (NCDModuleInst *i, MemRef str)
 {
     struct value *v = malloc(sizeof(*v));
@@ -399,6 +452,7 @@ static struct value * value_init_storedstring (NCDModuleInst *i, MemRef str)
     
     LinkedList0_Init(&v->refs_list);
     v->parent = NULL;
+    v->snapshot = NULL;
     v->type = STOREDSTRING_TYPE;
     
     char *buf;
@@ -432,6 +486,7 @@ static struct value * value_init_idstring (NCDModuleInst *i, NCD_string_id_t id,
     
     LinkedList0_Init(&v->refs_list);
     v->parent = NULL;
+    v->snapshot = NULL;
     v->type = IDSTRING_TYPE;
     
     v->idstring.id = id;
@@ -460,6 +515,7 @@ static struct value * value_init_externalstring (NCDModuleInst *i, MemRef data,
     
     LinkedList0_Init(&v->refs_list);
     v->parent = NULL;
+    v->snapshot = NULL;
     v->type = EXTERNALSTRING_TYPE;
     
     v->externalstring.data = data.ptr;
@@ -544,6 +600,7 @@ static struct value * value_init_list (NCDModuleInst *i)
     
     LinkedList0_Init(&v->refs_list);
     v->parent = NULL;
+    v->snapshot = NULL;
     v->type = NCDVAL_LIST;
     
     IndexedList_Init(&v->list.list_contents_il);
@@ -597,6 +654,8 @@ static int value_list_insert (NCDModuleInst *i, struct value *list, struct value
     IndexedList_InsertAt(&list->list.list_contents_il, &v->list_parent.list_contents_il_node, index);
     v->parent = list;
     
+    value_modified(list);
+    
     return 1;
 }
 
@@ -607,6 +666,8 @@ static void value_list_remove (struct value *list, struct value *v)
     
     IndexedList_Remove(&list->list.list_contents_il, &v->list_parent.list_contents_il_node);
     v->parent = NULL;
+    
+    value_modified(list);
 }
 
 static struct value * value_init_map (NCDModuleInst *i)
@@ -619,9 +680,11 @@ static struct value * value_init_map (NCDModuleInst *i)
     
     LinkedList0_Init(&v->refs_list);
     v->parent = NULL;
+    v->snapshot = NULL;
     v->type = NCDVAL_MAP;
     
     MapTree_Init(&v->map.map_tree);
+    v->map.have_hash = 0;
     
     return v;
 }
@@ -645,12 +708,55 @@ static struct value * value_map_at (struct value *map, size_t index)
     return e;
 }
 
+static MapHashRef value_maphash_ref (struct value *v)
+{
+    MapHashRef ref = {v, v};
+    return ref;
+}
+
+static void value_map_hash_add (struct value *map, struct value *v)
+{
+    ASSERT(map->map.have_hash)
+    
+    if (!NCDVal_IsString(v->map_parent.key)) {
+        return;
+    }
+    
+    int res = MapHash_Insert(&map->map.hash, 0, value_maphash_ref(v), NULL);
+    ASSERT_EXECUTE(res)
+    
+    // if growing fails, lookups still work with longer chains
+    if (value_map_len(map) > map->map.hash.num_buckets) {
+        MapHash_MultiplyBuckets(&map->map.hash, 0, 1);
+    }
+}
+
+static void value_map_build_hash (struct value *map)
+{
+    ASSERT(!map->map.have_hash)
+    
+    // the hash only speeds up lookups; without memory, the tree is used
+    if (!MapHash_Init(&map->map.hash, 2 * value_map_len(map))) {
+        return;
+    }
+    map->map.have_hash = 1;
+    
+    for (struct value *e = MapTree_GetFirst(&map->map.map_tree, 0); e; e = MapTree_GetNext(&map->map.map_tree, 0, e)) {
+        value_map_hash_add(map, e);
+    }
+}
+
 static struct value * value_map_find (struct value *map, NCDValRef key)
 {
     ASSERT(map->type == NCDVAL_MAP)
     ASSERT(NCDVal_Type(key))
     
-    struct value *e = MapTree_LookupExact(&map->map.map_tree, 0, key);
+    struct value *e;
+    if (map->map.have_hash && NCDVal_IsString(key)) {
+        e = MapHash_Lookup(&map->map.hash, 0, NCDVal_StringMemRef(key)).ptr;
+    } else {
+        e = MapTree_LookupExact(&map->map.map_tree, 0, key);
+    }
     ASSERT(!e || e->parent == map)
     
     return e;
@@ -674,6 +780,20 @@ static int value_map_insert (struct value *map, struct value *v, NCDValMem mem,
     ASSERT_EXECUTE(res)
     v->parent = map;
     
+    if (NCDVal_IsString(v->map_parent.key)) {
+        MemRef key_str = NCDVal_StringMemRef(v->map_parent.key);
+        v->map_parent.key_hash = badvpn_hash_bin((const uint8_t *)key_str.ptr, key_str.len, badvpn_hash_seed());
+    }
+    
+    if (map->map.have_hash) {
+        value_map_hash_add(map, v);
+    }
+    else if (value_map_len(map) >= MAPHASH_MIN_ENTRIES) {
+        value_map_build_hash(map);
+    }
+    
+    value_modified(map);
+    
     return 1;
 }
 
@@ -683,8 +803,13 @@ static void value_map_remove (struct value *map, struct value *v)
     ASSERT(v->parent == map)
     
     MapTree_Remove(&map->map.map_tree, 0, v);
+    if (map->map.have_hash && NCDVal_IsString(v->map_parent.key)) {
+        MapHash_Remove(&map->map.hash, 0, value_maphash_ref(v));
+    }
     NCDValMem_Free(&v->map_parent.key_mem);
     v->parent = NULL;
+    
+    value_modified(map);
 }
 
 static void value_map_remove2 (struct value *map, struct value *v, NCDValMem *out_mem, NCDValSafeRef *out_key)
@@ -695,9 +820,14 @@ static void value_map_remove2 (struct value *map, struct value *v, NCDValMem *ou
     ASSERT(out_key)
     
     MapTree_Remove(&map->map.map_tree, 0, v);
+    if (map->map.have_hash && NCDVal_IsString(v->map_parent.key)) {
+        MapHash_Remove(&map->map.hash, 0, value_maphash_ref(v));
+    }
     *out_mem = v->map_parent.key_mem;
     *out_key = NCDVal_ToSafe(v->map_parent.key);
     v->parent = NULL;
+    
+    value_modified(map);
 }
 
 static struct value * value_init_fromvalue (NCDModuleInst *i, NCDValRef value)
@@ -790,6 +920,12 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
     ASSERT(mem)
     ASSERT(out_value)
     
+    // share an existing snapshot
+    if (v->snapshot) {
+        *out_value = NCDRefVal_NewShared(v->snapshot, mem);
+        return !NCDVal_IsInvalid(*out_value);
+    }
+    
     switch (v->type) {
         case STOREDSTRING_TYPE: {
             *out_value = NCDVal_NewExternalString(mem, NCDRefString_GetBuf(v->storedstring.rstr), v->storedstring.length, NCDRefString_RefTarget(v->storedstring.rstr));
@@ -818,9 +954,12 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
                 goto fail;
             }
             
-            for (size_t index = 0; index < value_list_len(v); index++) {
+            IndexedList *il = &v->list.list_contents_il;
+            for (IndexedListNode *iln = IndexedList_GetFirst(il); iln; iln = IndexedList_GetNext(il, iln)) {
+                struct value *ev = UPPER_OBJECT(iln, struct value, list_parent.list_contents_il_node);
+                
                 NCDValRef eval;
-                if (!value_to_value(i, value_list_at(v, index), mem, &eval)) {
+                if (!value_to_value(i, ev, mem, &eval)) {
                     goto fail;
                 }
                 
@@ -836,9 +975,7 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
                 goto fail;
             }
             
-            for (size_t index = 0; index < value_map_len(v); index++) {
-                struct value *ev = value_map_at(v, index);
-                
+            for (struct value *ev = MapTree_GetFirst(&v->map.map_tree, 0); ev; ev = MapTree_GetNext(&v->map.map_tree, 0, ev)) {
                 NCDValRef key = NCDVal_NewCopy(mem, ev->map_parent.key);
                 if (NCDVal_IsInvalid(key)) {
                     goto fail;
@@ -866,6 +1003,32 @@ fail:
     return 0;
 }
 
+static int value_make_snapshot (NCDModuleInst *i, struct value *v)
+{
+    ASSERT(v->type == NCDVAL_LIST || v->type == NCDVAL_MAP)
+    ASSERT(!v->snapshot)
+    
+    NCDValMem mem;
+    NCDValMem_Init(&mem, i->params->iparams->string_index);
+    
+    NCDValRef val;
+    if (!value_to_value(i, v, &mem, &val)) {
+        ModuleLog(i, BLOG_ERROR, "value_to_value failed");
+        goto fail;
+    }
+    
+    if (!(v->snapshot = NCDRefVal_NewFromMem(&mem, val))) {
+        ModuleLog(i, BLOG_ERROR, "NCDRefVal_NewFromMem failed");
+        goto fail;
+    }
+    
+    return 1;
+    
+fail:
+    NCDValMem_Free(&mem);
+    return 0;
+}
+
 static struct value * value_get (NCDModuleInst *i, struct value *v, NCDValRef where, int no_error)
 {
     ASSERT((NCDVal_Type(where), 1))
@@ -1127,6 +1290,7 @@ static int value_append (NCDModuleInst *i, struct value *v, NCDValRef data)
                 char *existing_buf = (char *)NCDRefString_GetBuf(v->storedstring.rstr);
                 NCDVal_StringCopyOut(data, 0, append_length, existing_buf + v_str.len);
                 v->storedstring.length = new_length;
+                value_modified(v);
             } else {
                 // only allocate power-of-two sizez
                 size_t new_size = 16;
@@ -1149,6 +1313,7 @@ static int value_append (NCDModuleInst *i, struct value *v, NCDValRef data)
                 NCDVal_StringCopyOut(data, 0, append_length, new_buf + v_str.len);
                 
                 value_string_set_rstr(v, new_rstr, new_length, new_size);
+                value_modified(v);
             }
         } break;
         
@@ -1284,9 +1449,7 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
             goto fail;
         }
         
-        for (size_t j = 0; j < value_map_len(v); j++) {
-            struct value *ev = value_map_at(v, j);
-            
+        for (struct value *ev = MapTree_GetFirst(&v->map.map_tree, 0); ev; ev = MapTree_GetNext(&v->map.map_tree, 0, ev)) {
             NCDValRef key = NCDVal_NewCopy(mem, ev->map_parent.key);
             if (NCDVal_IsInvalid(key)) {
                 goto fail;
@@ -1298,6 +1461,9 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
         }
     }
     else if (name == NCD_STRING_EMPTY) {
+        if ((v->type == NCDVAL_LIST || v->type == NCDVAL_MAP) && !v->snapshot && !value_make_snapshot(o->i, v)) {
+            return 0;
+        }
         if (!value_to_value(o->i, v, mem, out)) {
             return 0;
         }
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME MapHash
+#define CHASH_PARAM_ENTRY struct value
+#define CHASH_PARAM_LINK MapHash_link
+#define CHASH_PARAM_KEY MemRef
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((MapHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->map_parent.key_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) badvpn_hash_bin((const uint8_t *)(key).ptr, (key).len, badvpn_hash_seed())
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) MemRef_Equal(NCDVal_StringMemRef((entry1).ptr->map_parent.key), NCDVal_StringMemRef((entry2).ptr->map_parent.key))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) MemRef_Equal((key1), NCDVal_StringMemRef((entry2).ptr->map_parent.key))
+#define CHASH_PARAM_ENTRY_NEXT map_parent.maphash_next
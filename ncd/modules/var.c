@@ -40,14 +40,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <ncd/extra/NCDRefVal.h>
+
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_var.h>
 
 struct instance {
     NCDModuleInst *i;
-    NCDValMem mem;
-    NCDValRef value;
+    NCDRefVal *value;
 };
 
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
@@ -62,21 +63,17 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // init mem
-    NCDValMem_Init(&o->mem, i->params->iparams->string_index);
-    
     // copy value
-    o->value = NCDVal_NewCopy(&o->mem, value_arg);
-    if (NCDVal_IsInvalid(o->value)) {
-        goto fail1;
+    o->value = NCDRefVal_New(i->params->iparams->string_index, value_arg);
+    if (!o->value) {
+        ModuleLog(o->i, BLOG_ERROR, "NCDRefVal_New failed");
+        goto fail0;
     }
     
     // signal up
     NCDModuleInst_Backend_Up(o->i);
     return;
     
-fail1:
-    NCDValMem_Free(&o->mem);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -85,8 +82,8 @@ static void func_die (void *vo)
 {
     struct instance *o = vo;
     
-    // free mem
-    NCDValMem_Free(&o->mem);
+    // release value
+    BRefTarget_Deref(NCDRefVal_RefTarget(o->value));
     
     NCDModuleInst_Backend_Dead(o->i);
 }
@@ -96,7 +93,7 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
     struct instance *o = vo;
     
     if (name == NCD_STRING_EMPTY) {
-        *out = NCDVal_NewCopy(mem, o->value);
+        *out = NCDRefVal_NewShared(o->value, mem);
         return 1;
     }
     
@@ -115,27 +112,21 @@ static void set_func_new (void *unused, NCDModuleInst *i, const struct NCDModule
     // get method object
     struct instance *mo = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
     
-    // allocate new mem
-    NCDValMem mem;
-    NCDValMem_Init(&mem, i->params->iparams->string_index);
-    
     // copy value
-    NCDValRef copy = NCDVal_NewCopy(&mem, value_arg);
-    if (NCDVal_IsInvalid(copy)) {
-        goto fail1;
+    NCDRefVal *value = NCDRefVal_New(i->params->iparams->string_index, value_arg);
+    if (!value) {
+        ModuleLog(i, BLOG_ERROR, "NCDRefVal_New failed");
+        goto fail0;
     }
     
-    // replace value in var
-    NCDValMem_Free(&mo->mem);
-    mo->mem = mem;
-    mo->value = NCDVal_Moved(&mo->mem, copy);
+    // replace value in var; anyone still sharing the old value keeps it alive
+    BRefTarget_Deref(NCDRefVal_RefTarget(mo->value));
+    mo->value = value;
     
     // signal up
     NCDModuleInst_Backend_Up(i);
     return;
     
-fail1:
-    NCDValMem_Free(&mem);
 fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
@@ -39,16 +39,23 @@
 #include <base/BLog.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
+#include <system/BUnixSignal.h>
 #include <system/BProcess.h>
+#include <system/BMetricsExporter.h>
 #include <udevmonitor/NCDUdevManager.h>
 #include <random/BRandom2.h>
 #include <ncd/NCDInterpreter.h>
 #include <ncd/NCDBuildProgram.h>
+#include <ncd/NCDProgramImage.h>
 
 #ifdef BADVPN_USE_SYSLOG
 #include <base/BLog_syslog.h>
 #endif
 
+#ifdef BADVPN_USE_BLOG_ASYNC
+#include <base/BLog_async.h>
+#endif
+
 #include "ncd.h"
 
 #include <generated/blog_channel_ncd.h>
@@ -68,11 +75,22 @@ static struct {
 #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
+#ifdef BADVPN_USE_BLOG_ASYNC
+    int log_async;
+#endif
     char *config_file;
+    char *program_image;
     int syntax_only;
     int retry_time;
     int signal_exit_code;
     int no_udev;
+    char *profile_file;
+    int process_cache_size;
+    struct NCDInterpreter_cache_conf process_cache_confs[MAX_PROCESS_CACHE_CONFS];
+    int num_process_cache_confs;
+    char *metrics_listen_addr;
+    char *metrics_statsd_addr;
+    int metrics_statsd_interval;
     char **extra_args;
     int num_extra_args;
 } options;
@@ -92,11 +110,21 @@ static BRandom2 random2;
 // interpreter
 static NCDInterpreter interpreter;
 
+// profile dump signal
+static BUnixSignal profile_signal;
+
+// metrics exporter, if options.metrics_listen_addr or options.metrics_statsd_addr
+static int have_metrics_exporter;
+static BMetricsExporter metrics_exporter;
+
 // forward declarations of functions
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static void signal_handler (void *unused);
+static void profile_signal_handler (void *unused, int signo);
+static void write_profile (void);
+static int init_metrics_exporter (void);
 static void interpreter_handler_finished (void *user, int exit_code);
 
 int main (int argc, char **argv)
@@ -160,6 +188,13 @@ int main (int argc, char **argv)
         }
     }
     
+#ifdef BADVPN_USE_BLOG_ASYNC
+    // make logging asynchronous
+    if (options.log_async && !BLog_StartAsync()) {
+        BLog(BLOG_WARNING, "failed to start asynchronous logging");
+    }
+#endif
+    
     BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
     
     // initialize network
@@ -200,9 +235,16 @@ int main (int argc, char **argv)
     
     // build program
     NCDProgram program;
-    if (!NCDBuildProgram_Build(options.config_file, &program)) {
-        BLog(BLOG_ERROR, "failed to build program");
-        goto fail5;
+    if (options.program_image) {
+        if (!NCDProgramImage_Build(options.config_file, options.program_image, NCDInterpreter_ModuleAbiId(), &program)) {
+            BLog(BLOG_ERROR, "failed to build program");
+            goto fail5;
+        }
+    } else {
+        if (!NCDBuildProgram_Build(options.config_file, &program)) {
+            BLog(BLOG_ERROR, "failed to build program");
+            goto fail5;
+        }
     }
     
     // setup interpreter parameters
@@ -212,6 +254,10 @@ int main (int argc, char **argv)
     params.retry_time = options.retry_time;
     params.extra_args = options.extra_args;
     params.num_extra_args = options.num_extra_args;
+    params.profile = !!options.profile_file;
+    params.process_cache_size = options.process_cache_size;
+    params.cache_confs = options.process_cache_confs;
+    params.num_cache_confs = options.num_process_cache_confs;
     params.reactor = &reactor;
     params.manager = &manager;
     params.umanager = &umanager;
@@ -228,11 +274,43 @@ int main (int argc, char **argv)
         goto fail6;
     }
     
+    // init metrics exporter
+    have_metrics_exporter = (options.metrics_listen_addr || options.metrics_statsd_addr);
+    if (have_metrics_exporter) {
+        if (!init_metrics_exporter()) {
+            goto fail6;
+        }
+    }
+    
+    // dump the profile on SIGUSR1
+    if (options.profile_file) {
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGUSR1);
+        if (!BUnixSignal_Init(&profile_signal, &reactor, sigs, profile_signal_handler, NULL)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            goto fail7;
+        }
+    }
+    
     BLog(BLOG_NOTICE, "entering event loop");
     
     // enter event loop
     main_exit_code = BReactor_Exec(&reactor);
     
+    if (options.profile_file) {
+        // write the final profile
+        write_profile();
+        
+        // free profile signal
+        BUnixSignal_Free(&profile_signal, 0);
+    }
+    
+fail7:
+    // free metrics exporter
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+    }
 fail6:
     // free interpreter
     NCDInterpreter_Free(&interpreter);
@@ -276,11 +354,20 @@ void print_help (const char *name)
         "        )\n"
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
+#ifdef BADVPN_USE_BLOG_ASYNC
+        "        [--log-async]\n"
+#endif
         "        [--retry-time <ms>]\n"
         "        [--no-udev]\n"
         "        [--config-file <ncd_program_file>]\n"
+        "        [--program-image <file>]\n"
         "        [--syntax-only]\n"
         "        [--signal-exit-code <number>]\n"
+        "        [--profile <file>]\n"
+        "        [--process-cache-size <num>]\n"
+        "        [--process-cache <process_name> <max> <warm>] ...\n"
+        "        [--metrics-listen-addr <addr>]\n"
+        "        [--metrics-statsd-addr <addr> [--metrics-statsd-interval <ms>]]\n"
         "        [-- program_args...]\n"
         "        [<ncd_program_file> program_args...]\n" ,
         name
@@ -309,14 +396,26 @@ int parse_arguments (int argc, char *argv[])
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
     }
+#ifdef BADVPN_USE_BLOG_ASYNC
+    options.log_async = 0;
+#endif
     options.config_file = NULL;
+    options.program_image = NULL;
     options.syntax_only = 0;
     options.retry_time = DEFAULT_RETRY_TIME;
     options.signal_exit_code = DEFAULT_SIGNAL_EXIT_CODE;
     options.no_udev = 0;
+    options.profile_file = NULL;
+    options.process_cache_size = DEFAULT_PROCESS_CACHE_SIZE;
+    options.num_process_cache_confs = 0;
+    options.metrics_listen_addr = NULL;
+    options.metrics_statsd_addr = NULL;
+    options.metrics_statsd_interval = BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL;
     options.extra_args = NULL;
     options.num_extra_args = 0;
     
+    int have_metrics_statsd_interval = 0;
+    
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
         if (!strcmp(arg, "--help")) {
@@ -365,6 +464,11 @@ int parse_arguments (int argc, char *argv[])
             options.logger_syslog_ident = argv[i + 1];
             i++;
         }
+#endif
+#ifdef BADVPN_USE_BLOG_ASYNC
+        else if (!strcmp(arg, "--log-async")) {
+            options.log_async = 1;
+        }
 #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
@@ -403,6 +507,14 @@ int parse_arguments (int argc, char *argv[])
             options.config_file = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--program-image")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.program_image = argv[i + 1];
+            i++;
+        }
         else if (!strcmp(arg, "--syntax-only")) {
             options.syntax_only = 1;
         }
@@ -428,6 +540,75 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--profile")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.profile_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--process-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.process_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--process-cache")) {
+            if (3 >= argc - i) {
+                fprintf(stderr, "%s: requires three arguments\n", arg);
+                return 0;
+            }
+            if (options.num_process_cache_confs == MAX_PROCESS_CACHE_CONFS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            struct NCDInterpreter_cache_conf *conf = &options.process_cache_confs[options.num_process_cache_confs];
+            conf->name = argv[i + 1];
+            if ((conf->cache_max = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong max argument\n", arg);
+                return 0;
+            }
+            if ((conf->cache_warm = atoi(argv[i + 3])) < 0 || conf->cache_warm > conf->cache_max) {
+                fprintf(stderr, "%s: wrong warm argument\n", arg);
+                return 0;
+            }
+            options.num_process_cache_confs++;
+            i += 3;
+        }
+        else if (!strcmp(arg, "--metrics-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_statsd_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.metrics_statsd_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_metrics_statsd_interval = 1;
+            i++;
+        }
         else if (!strcmp(arg, "--no-udev")) {
             options.no_udev = 1;
         }
@@ -461,6 +642,11 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (have_metrics_statsd_interval && !options.metrics_statsd_addr) {
+        fprintf(stderr, "--metrics-statsd-interval requires --metrics-statsd-addr\n");
+        return 0;
+    }
+    
     return 1;
 }
 
@@ -471,6 +657,50 @@ void signal_handler (void *unused)
     NCDInterpreter_RequestShutdown(&interpreter, options.signal_exit_code);
 }
 
+void profile_signal_handler (void *unused, int signo)
+{
+    write_profile();
+}
+
+void write_profile (void)
+{
+    ASSERT(options.profile_file)
+    
+    if (!NCDInterpreter_WriteProfile(&interpreter, options.profile_file)) {
+        BLog(BLOG_ERROR, "failed to write profile");
+        return;
+    }
+    
+    BLog(BLOG_NOTICE, "profile written to %s", options.profile_file);
+}
+
+int init_metrics_exporter (void)
+{
+    ASSERT(options.metrics_listen_addr || options.metrics_statsd_addr)
+    
+    BAddr listen_addr;
+    BAddr_InitNone(&listen_addr);
+    if (options.metrics_listen_addr && !BAddr_Parse(&listen_addr, options.metrics_listen_addr, NULL, 0)) {
+        BLog(BLOG_ERROR, "metrics listen addr: BAddr_Parse failed");
+        return 0;
+    }
+    
+    BAddr statsd_addr;
+    BAddr_InitNone(&statsd_addr);
+    if (options.metrics_statsd_addr && !BAddr_Parse(&statsd_addr, options.metrics_statsd_addr, NULL, 0)) {
+        BLog(BLOG_ERROR, "metrics statsd addr: BAddr_Parse failed");
+        return 0;
+    }
+    
+    if (!BMetricsExporter_Init(&metrics_exporter, &reactor, !!options.metrics_listen_addr, listen_addr,
+                               !!options.metrics_statsd_addr, statsd_addr, options.metrics_statsd_interval)) {
+        BLog(BLOG_ERROR, "BMetricsExporter_Init failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
 void interpreter_handler_finished (void *user, int exit_code)
 {
     BReactor_Quit(&reactor, exit_code);
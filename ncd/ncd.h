@@ -38,3 +38,9 @@
 
 // default loglevel
 #define DEFAULT_LOGLEVEL BLOG_WARNING
+
+// default number of freed process structures kept for reuse, per process or template
+#define DEFAULT_PROCESS_CACHE_SIZE 1
+
+// maximum number of --process-cache options
+#define MAX_PROCESS_CACHE_CONFS 64
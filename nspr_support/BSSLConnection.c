@@ -53,7 +53,11 @@ static void connection_try_io (BSSLConnection *o);
 static void connection_threadwork_func_work (void *user);
 static void connection_threadwork_handler_done (void *user);
 static void connection_recv_job_handler (BSSLConnection *o);
+static void connection_flush_job_handler (BSSLConnection *o);
 static void connection_try_handshake (BSSLConnection *o);
+static void connection_take_send (BSSLConnection *o, uint8_t *data, int data_len);
+static void connection_start_flush (BSSLConnection *o);
+static void connection_sent (BSSLConnection *o, int amount);
 static void connection_try_send (BSSLConnection *o);
 static void connection_try_recv (BSSLConnection *o);
 static void connection_send_if_handler_send (BSSLConnection *o, uint8_t *data, int data_len);
@@ -451,8 +455,18 @@ static void connection_init_up (BSSLConnection *o)
     // init recv job
     BPending_Init(&o->recv_job, o->pg, (BPending_handler)connection_recv_job_handler, o);
     
+    // init flush job
+    BPending_Init(&o->flush_job, o->pg, (BPending_handler)connection_flush_job_handler, o);
+    
     // set no send data
     o->send_len = -1;
+    o->send_from_buf = 0;
+    
+    // set coalescing buffer empty
+    o->buf_len = 0;
+    
+    // set no waiting user send
+    o->user_len = -1;
     
     // set no recv data
     o->recv_avail = -1;
@@ -579,16 +593,17 @@ static void connection_threadwork_handler_done (void *user)
             ASSERT(result > 0)
             ASSERT(result <= o->send_len)
             
-            // set no send data
-            o->send_len = -1;
+            // account for the written data
+            connection_sent(o, result);
             
-            // don't forget about receiving
-            if (o->recv_avail > 0) {
+            if (o->send_len > 0) {
+                // continue with the rest of the coalescing buffer or the waiting send
+                backend_threadwork_start(o->backend, THREADWORK_STATE_WRITE);
+            }
+            else if (o->recv_avail > 0) {
+                // don't forget about receiving
                 backend_threadwork_start(o->backend, THREADWORK_STATE_READ);
             }
-            
-            // finish send operation
-            StreamPassInterface_Done(&o->send_if, result);
         } break;
         
         case THREADWORK_STATE_READ: {
@@ -654,6 +669,18 @@ static void connection_recv_job_handler (BSSLConnection *o)
     return;
 }
 
+static void connection_flush_job_handler (BSSLConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->have_error)
+    ASSERT(o->up)
+    ASSERT(o->buf_len > 0)
+    ASSERT(o->send_len == -1)
+    
+    // the sender has nothing more for us right now, write what was collected
+    connection_start_flush(o);
+}
+
 static void connection_try_handshake (BSSLConnection *o)
 {
     ASSERT(!o->have_error)
@@ -687,6 +714,87 @@ static void connection_try_handshake (BSSLConnection *o)
     return;
 }
 
+static void connection_take_send (BSSLConnection *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->send_len == -1)
+    ASSERT(o->user_len == -1)
+    ASSERT(data_len > 0)
+    
+    if (data_len <= BSSLCONNECTION_COALESCE_SIZE - o->buf_len) {
+        // append to coalescing buffer
+        memcpy(o->backend->coalesce_buf + o->buf_len, data, data_len);
+        o->buf_len += data_len;
+        
+        // set flush job before accepting the data; the job is then above the
+        // sender's done job, so anything the sender passes us in response is
+        // collected before the buffer is written
+        BPending_Set(&o->flush_job);
+        
+        // accept data
+        StreamPassInterface_Done(&o->send_if, data_len);
+        return;
+    }
+    
+    ASSERT(o->buf_len == 0)
+    
+    // too large to be worth copying, write it directly
+    o->send_data = data;
+    o->send_len = data_len;
+    o->send_from_buf = 0;
+}
+
+static void connection_start_flush (BSSLConnection *o)
+{
+    ASSERT(o->send_len == -1)
+    ASSERT(o->buf_len > 0)
+    
+    // unset flush job
+    BPending_Unset(&o->flush_job);
+    
+    // write coalescing buffer
+    o->send_data = o->backend->coalesce_buf;
+    o->send_len = o->buf_len;
+    o->send_from_buf = 1;
+    
+    connection_try_send(o);
+}
+
+static void connection_sent (BSSLConnection *o, int amount)
+{
+    ASSERT(o->send_len > 0)
+    ASSERT(amount > 0)
+    ASSERT(amount <= o->send_len)
+    
+    if (!o->send_from_buf) {
+        // set no send data
+        o->send_len = -1;
+        
+        // finish direct send
+        StreamPassInterface_Done(&o->send_if, amount);
+        return;
+    }
+    
+    if (amount < o->send_len) {
+        // rest of the buffer remains to be written
+        o->send_data += amount;
+        o->send_len -= amount;
+        return;
+    }
+    
+    // set no send data, buffer is empty
+    o->send_len = -1;
+    o->send_from_buf = 0;
+    o->buf_len = 0;
+    
+    // take the send which was waiting for the buffer to drain
+    if (o->user_len > 0) {
+        uint8_t *data = o->user_data;
+        int data_len = o->user_len;
+        o->user_len = -1;
+        connection_take_send(o, data, data_len);
+    }
+}
+
 static void connection_try_send (BSSLConnection *o)
 {
     ASSERT(!o->have_error)
@@ -701,26 +809,25 @@ static void connection_try_send (BSSLConnection *o)
         return;
     }
     
-    // send
-    PRInt32 res = PR_Write(o->prfd, o->send_data, o->send_len);
-    if (res < 0) {
-        PRErrorCode error = PR_GetError();
-        if (error == PR_WOULD_BLOCK_ERROR) {
+    do {
+        // send
+        PRInt32 res = PR_Write(o->prfd, o->send_data, o->send_len);
+        if (res < 0) {
+            PRErrorCode error = PR_GetError();
+            if (error == PR_WOULD_BLOCK_ERROR) {
+                return;
+            }
+            BLog(BLOG_ERROR, "PR_Write failed (%"PRIi32")", error);
+            connection_report_error(o);
             return;
         }
-        BLog(BLOG_ERROR, "PR_Write failed (%"PRIi32")", error);
-        connection_report_error(o);
-        return;
-    }
-    
-    ASSERT(res > 0)
-    ASSERT(res <= o->send_len)
-    
-    // set no send data
-    o->send_len = -1;
-    
-    // done
-    StreamPassInterface_Done(&o->send_if, res);
+        
+        ASSERT(res > 0)
+        ASSERT(res <= o->send_len)
+        
+        // account for the written data
+        connection_sent(o, res);
+    } while (o->send_len > 0);
 }
 
 static void connection_try_recv (BSSLConnection *o)
@@ -773,7 +880,8 @@ static void connection_send_if_handler_send (BSSLConnection *o, uint8_t *data, i
     DebugObject_Access(&o->d_obj);
     ASSERT(!o->have_error)
     ASSERT(o->up)
-    ASSERT(o->send_len == -1)
+    ASSERT(o->send_len == -1 || o->send_from_buf)
+    ASSERT(o->user_len == -1)
     ASSERT(data_len > 0)
     
 #ifndef NDEBUG
@@ -786,12 +894,29 @@ static void connection_send_if_handler_send (BSSLConnection *o, uint8_t *data, i
         data_len = INT32_MAX;
     }
     
-    // set send data
-    o->send_data = data;
-    o->send_len = data_len;
+    if (o->send_len > 0) {
+        // coalescing buffer is being written, wait for it to drain
+        ASSERT(o->send_from_buf)
+        o->user_data = data;
+        o->user_len = data_len;
+        return;
+    }
+    
+    if (o->buf_len > 0 && data_len > BSSLCONNECTION_COALESCE_SIZE - o->buf_len) {
+        // doesn't fit, write what was collected and then come back for this
+        o->user_data = data;
+        o->user_len = data_len;
+        connection_start_flush(o);
+        return;
+    }
+    
+    // collect or send data
+    connection_take_send(o, data, data_len);
     
     // start sending
-    connection_try_send(o);
+    if (o->send_len > 0) {
+        connection_try_send(o);
+    }
 }
 
 static void connection_recv_if_handler_recv (BSSLConnection *o, uint8_t *data, int data_len)
@@ -972,6 +1097,9 @@ void BSSLConnection_Free (BSSLConnection *o)
     ASSERT(o->backend->threadwork_state == THREADWORK_STATE_NONE)
     
     if (o->up) {
+        // free flush job
+        BPending_Free(&o->flush_job);
+        
         // free recv job
         BPending_Free(&o->recv_job);
         
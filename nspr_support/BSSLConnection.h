@@ -45,7 +45,15 @@
 #define BSSLCONNECTION_EVENT_UP 1
 #define BSSLCONNECTION_EVENT_ERROR 2
 
-#define BSSLCONNECTION_BUF_SIZE 4096
+// large enough for a complete TLS record (header, 2^14 bytes of plaintext and
+// the maximum expansion), so a full record moves through the backend in one
+// socket operation rather than several
+#define BSSLCONNECTION_BUF_SIZE (5 + 16384 + 2048)
+
+// sends are collected up to this many bytes (the maximum TLS record plaintext)
+// and passed to PR_Write together, so a stream of small packets doesn't produce
+// one record per packet
+#define BSSLCONNECTION_COALESCE_SIZE 16384
 
 #define BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE (1 << 0)
 #define BSSLCONNECTION_FLAG_THREADWORK_IO (1 << 1)
@@ -66,8 +74,13 @@ typedef struct {
     StreamPassInterface send_if;
     StreamRecvInterface recv_if;
     BPending recv_job;
+    BPending flush_job;
     const uint8_t *send_data;
     int send_len;
+    int send_from_buf;
+    int buf_len;
+    uint8_t *user_data;
+    int user_len;
     uint8_t *recv_data;
     int recv_avail;
 #ifndef NDEBUG
@@ -92,6 +105,7 @@ struct BSSLConnection_backend {
     int recv_busy;
     int recv_pos;
     int recv_len;
+    uint8_t coalesce_buf[BSSLCONNECTION_COALESCE_SIZE];
     int threadwork_state;
     int threadwork_want_recv;
     int threadwork_want_send;
@@ -44,6 +44,40 @@
 
 #include <generated/blog_channel_BPredicate.h>
 
+#define OP_CONST 0
+#define OP_ERROR 1
+#define OP_NOT 2
+#define OP_JUMP_IF_FALSE 3
+#define OP_JUMP_IF_TRUE 4
+#define OP_PUSH 5
+#define OP_CALL 6
+
+struct program_insn {
+    int op;
+    int arg;
+};
+
+struct program_call {
+    BPredicateFunction *func;
+    char *strings[PREDICATE_MAX_ARGS];
+    int num_bools;
+};
+
+struct program {
+    struct program_insn *code;
+    int code_len;
+    int code_cap;
+    struct program_call *calls;
+    int num_calls;
+    int calls_cap;
+    char **strings;
+    int num_strings;
+    int strings_cap;
+    int *stack;
+    int stack_depth;
+    int max_stack_depth;
+};
+
 static int eval_predicate_node (BPredicate *p, struct predicate_node *root);
 
 void yyerror (YYLTYPE *yylloc, yyscan_t scanner, struct predicate_node **result, char *str)
@@ -179,6 +213,316 @@ int eval_predicate_node (BPredicate *p, struct predicate_node *root)
     }
 }
 
+static int grow_array (void **array, int *cap, int len, size_t elem_size)
+{
+    if (len < *cap) {
+        return 1;
+    }
+    
+    int new_cap = (*cap > 0 ? 2 * *cap : 8);
+    void *new_array = BAllocArray(new_cap, elem_size);
+    if (!new_array) {
+        return 0;
+    }
+    if (*array) {
+        memcpy(new_array, *array, len * elem_size);
+        BFree(*array);
+    }
+    
+    *array = new_array;
+    *cap = new_cap;
+    return 1;
+}
+
+static int emit (struct program *prog, int op, int arg)
+{
+    if (!grow_array((void **)&prog->code, &prog->code_cap, prog->code_len, sizeof(prog->code[0]))) {
+        return 0;
+    }
+    
+    prog->code[prog->code_len].op = op;
+    prog->code[prog->code_len].arg = arg;
+    prog->code_len++;
+    
+    return 1;
+}
+
+static char * intern_string (struct program *prog, char *str)
+{
+    for (int i = 0; i < prog->num_strings; i++) {
+        if (!strcmp(prog->strings[i], str)) {
+            return prog->strings[i];
+        }
+    }
+    
+    if (!grow_array((void **)&prog->strings, &prog->strings_cap, prog->num_strings, sizeof(prog->strings[0]))) {
+        return NULL;
+    }
+    
+    // strings are owned by the tree, which outlives the program
+    prog->strings[prog->num_strings++] = str;
+    
+    return str;
+}
+
+// returns whether the code from start is a single constant or error instruction
+static int is_single (struct program *prog, int start, int op)
+{
+    return (prog->code_len == start + 1 && prog->code[start].op == op);
+}
+
+static int compile_node (BPredicate *p, struct program *prog, struct predicate_node *node);
+
+static int compile_logic (BPredicate *p, struct program *prog, struct predicate_node *op1, struct predicate_node *op2, int short_value)
+{
+    int start = prog->code_len;
+    
+    if (!compile_node(p, prog, op1)) {
+        return 0;
+    }
+    
+    // a constant first operand decides at compile time; an error or a
+    // short-circuiting constant is the whole result
+    if (is_single(prog, start, OP_ERROR) || (is_single(prog, start, OP_CONST) && prog->code[start].arg == short_value)) {
+        return 1;
+    }
+    if (is_single(prog, start, OP_CONST)) {
+        prog->code_len = start;
+        return compile_node(p, prog, op2);
+    }
+    
+    int jump = prog->code_len;
+    if (!emit(prog, (short_value ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE), 0)) {
+        return 0;
+    }
+    
+    if (!compile_node(p, prog, op2)) {
+        return 0;
+    }
+    
+    prog->code[jump].arg = prog->code_len;
+    
+    return 1;
+}
+
+static int compile_function (BPredicate *p, struct program *prog, struct predicate_node *node)
+{
+    // resolve function
+    BAVLNode *tree_node;
+    if (!(tree_node = BAVL_LookupExact(&p->functions_tree, node->function.name))) {
+        BLog(BLOG_WARNING, "unknown function");
+        return emit(prog, OP_ERROR, 0);
+    }
+    BPredicateFunction *func = UPPER_OBJECT(tree_node, BPredicateFunction, tree_node);
+    
+    // check arguments
+    struct arguments_node *arg = node->function.args;
+    for (int i = 0; i < func->num_args; i++) {
+        if (!arg) {
+            BLog(BLOG_WARNING, "not enough arguments");
+            return emit(prog, OP_ERROR, 0);
+        }
+        int expected = (func->args[i] == PREDICATE_TYPE_BOOL ? ARGUMENT_PREDICATE : ARGUMENT_STRING);
+        if (arg->arg.type != expected) {
+            BLog(BLOG_WARNING, (expected == ARGUMENT_PREDICATE ? "expecting predicate argument" : "expecting string argument"));
+            return emit(prog, OP_ERROR, 0);
+        }
+        arg = arg->next;
+    }
+    if (arg) {
+        BLog(BLOG_WARNING, "too many arguments");
+        return emit(prog, OP_ERROR, 0);
+    }
+    
+    // allocate call
+    if (!grow_array((void **)&prog->calls, &prog->calls_cap, prog->num_calls, sizeof(prog->calls[0]))) {
+        return 0;
+    }
+    int start = prog->code_len;
+    int start_depth = prog->stack_depth;
+    int call_index = prog->num_calls++;
+    prog->calls[call_index].func = func;
+    prog->calls[call_index].num_bools = 0;
+    
+    // compile boolean arguments pushing their values, and intern strings
+    arg = node->function.args;
+    for (int i = 0; i < func->num_args; i++) {
+        if (arg->arg.type == ARGUMENT_PREDICATE) {
+            int arg_start = prog->code_len;
+            if (!compile_node(p, prog, arg->arg.predicate)) {
+                return 0;
+            }
+            // an argument that is always an error makes the call one
+            if (is_single(prog, arg_start, OP_ERROR)) {
+                prog->code_len = start;
+                prog->stack_depth = start_depth;
+                prog->num_calls = call_index;
+                return emit(prog, OP_ERROR, 0);
+            }
+            if (!emit(prog, OP_PUSH, 0)) {
+                return 0;
+            }
+            prog->calls[call_index].strings[i] = NULL;
+            prog->calls[call_index].num_bools++;
+            if (++prog->stack_depth > prog->max_stack_depth) {
+                prog->max_stack_depth = prog->stack_depth;
+            }
+        } else {
+            if (!(prog->calls[call_index].strings[i] = intern_string(prog, arg->arg.string))) {
+                return 0;
+            }
+        }
+        arg = arg->next;
+    }
+    
+    prog->stack_depth -= prog->calls[call_index].num_bools;
+    
+    return emit(prog, OP_CALL, call_index);
+}
+
+int compile_node (BPredicate *p, struct program *prog, struct predicate_node *node)
+{
+    ASSERT(node)
+    
+    switch (node->type) {
+        case NODE_CONSTANT:
+            return emit(prog, OP_CONST, node->constant.val);
+        
+        case NODE_NEG: {
+            int start = prog->code_len;
+            if (!compile_node(p, prog, node->neg.op)) {
+                return 0;
+            }
+            if (is_single(prog, start, OP_CONST)) {
+                prog->code[start].arg = !prog->code[start].arg;
+                return 1;
+            }
+            if (is_single(prog, start, OP_ERROR)) {
+                return 1;
+            }
+            return emit(prog, OP_NOT, 0);
+        }
+        
+        case NODE_CONJUNCT:
+            return compile_logic(p, prog, node->conjunct.op1, node->conjunct.op2, 0);
+        
+        case NODE_DISJUNCT:
+            return compile_logic(p, prog, node->disjunct.op1, node->disjunct.op2, 1);
+        
+        case NODE_FUNCTION:
+            return compile_function(p, prog, node);
+        
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+static void free_program (struct program *prog)
+{
+    BFree(prog->stack);
+    BFree(prog->strings);
+    BFree(prog->calls);
+    BFree(prog->code);
+    free(prog);
+}
+
+static struct program * compile_program (BPredicate *p)
+{
+    struct program *prog = (struct program *)malloc(sizeof(*prog));
+    if (!prog) {
+        return NULL;
+    }
+    memset(prog, 0, sizeof(*prog));
+    
+    if (!compile_node(p, prog, (struct predicate_node *)p->root)) {
+        goto fail;
+    }
+    
+    if (!(prog->stack = (int *)BAllocArray(prog->max_stack_depth + 1, sizeof(prog->stack[0])))) {
+        goto fail;
+    }
+    
+    return prog;
+    
+fail:
+    free_program(prog);
+    return NULL;
+}
+
+static int run_program (BPredicate *p, struct program *prog)
+{
+    int acc = 0;
+    int sp = 0;
+    
+    for (int pc = 0; pc < prog->code_len; pc++) {
+        struct program_insn *insn = &prog->code[pc];
+        
+        switch (insn->op) {
+            case OP_CONST:
+                acc = insn->arg;
+                break;
+            
+            case OP_ERROR:
+                return -1;
+            
+            case OP_NOT:
+                acc = !acc;
+                break;
+            
+            case OP_JUMP_IF_FALSE:
+                if (!acc) {
+                    pc = insn->arg - 1;
+                }
+                break;
+            
+            case OP_JUMP_IF_TRUE:
+                if (acc) {
+                    pc = insn->arg - 1;
+                }
+                break;
+            
+            case OP_PUSH:
+                prog->stack[sp++] = acc;
+                break;
+            
+            case OP_CALL: {
+                struct program_call *call = &prog->calls[insn->arg];
+                BPredicateFunction *func = call->func;
+                
+                // boolean arguments are on the stack in order
+                sp -= call->num_bools;
+                int *bools = &prog->stack[sp];
+                void *args[PREDICATE_MAX_ARGS];
+                for (int i = 0; i < func->num_args; i++) {
+                    args[i] = (call->strings[i] ? (void *)call->strings[i] : (void *)bools++);
+                }
+                
+                #ifndef NDEBUG
+                p->in_function = 1;
+                #endif
+                int res = func->callback(func->user, args);
+                #ifndef NDEBUG
+                p->in_function = 0;
+                #endif
+                if (res != 0 && res != 1) {
+                    BLog(BLOG_WARNING, "callback returned non-boolean");
+                    return -1;
+                }
+                
+                acc = res;
+            } break;
+            
+            default:
+                ASSERT(0);
+        }
+    }
+    
+    ASSERT(sp == 0)
+    
+    return acc;
+}
+
 int BPredicate_Init (BPredicate *p, char *str)
 {
     // initialize input buffer object
@@ -207,6 +551,11 @@ int BPredicate_Init (BPredicate *p, char *str)
     // init tree
     p->root = root;
     
+    // compile on first evaluation, when functions are known
+    p->program = NULL;
+    p->functions_version = 0;
+    p->program_version = 0;
+    
     // init functions tree
     BAVL_Init(&p->functions_tree, OFFSET_DIFF(BPredicateFunction, name, tree_node), (BAVL_comparator)string_comparator, NULL);
     
@@ -229,6 +578,11 @@ void BPredicate_Free (BPredicate *p)
     // free debug object
     DebugObject_Free(&p->d_obj);
     
+    // free program
+    if (p->program) {
+        free_program((struct program *)p->program);
+    }
+    
     // free tree
     free_predicate_node((struct predicate_node *)p->root);
 }
@@ -237,6 +591,21 @@ int BPredicate_Eval (BPredicate *p)
 {
     ASSERT(!p->in_function)
     
+    // recompile if functions changed
+    if (p->program && p->program_version != p->functions_version) {
+        free_program((struct program *)p->program);
+        p->program = NULL;
+    }
+    if (!p->program) {
+        p->program = compile_program(p);
+        p->program_version = p->functions_version;
+    }
+    
+    if (p->program) {
+        return run_program(p, (struct program *)p->program);
+    }
+    
+    // couldn't compile, walk the tree
     if (!eval_predicate_node(p, (struct predicate_node *)p->root)) {
         return -1;
     }
@@ -266,6 +635,9 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
     // add to tree
     ASSERT_EXECUTE(BAVL_Insert(&p->functions_tree, &o->tree_node, NULL))
     
+    // program must be rebuilt
+    p->functions_version++;
+    
     // init debug object
     DebugObject_Init(&o->d_obj);
 }
@@ -281,4 +653,7 @@ void BPredicateFunction_Free (BPredicateFunction *o)
     
     // remove from tree
     BAVL_Remove(&p->functions_tree, &o->tree_node);
+    
+    // program must be rebuilt
+    p->functions_version++;
 }
@@ -72,6 +72,11 @@
  *     Then the handler function is called. If it returns anything other
  *     than 1 and 0, the function evaluates to error. Otherwise it evaluates
  *     to what the handler function returned.
+ * 
+ * Before evaluating, the expression is compiled into a flat program, with
+ * functions resolved, arguments checked, constant sub-expressions folded and
+ * equal string arguments merged, so a handler sees the same pointer for equal
+ * strings. The program is rebuilt when functions are registered or removed.
  */
 
 #ifndef BADVPN_PREDICATE_BPREDICATE_H
@@ -106,6 +111,9 @@ typedef int (*BPredicate_callback) (void *user, void **args);
 typedef struct {
     DebugObject d_obj;
     void *root;
+    void *program;
+    int functions_version;
+    int program_version;
     BAVL functions_tree;
     #ifndef NDEBUG
     int in_function;
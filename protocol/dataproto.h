@@ -36,6 +36,17 @@
  *   - the header (struct {@link dataproto_header})
  *   - between zero and DATAPROTO_MAX_PEER_IDS destination peer IDs (struct {@link dataproto_peer_id})
  *   - the payload, e.g. Ethernet frame
+ * 
+ * If the DATAPROTO_FLAGS_COMPRESSED flag is set, the payload is a block in the
+ * LZ4 block format (see misc/lz4.h) which decompresses to the actual payload.
+ * A peer only sends compressed packets after receiving a packet with the
+ * DATAPROTO_FLAGS_ACCEPTS_COMPRESSION flag from the other peer. Peers which do
+ * not know about compression never set that flag and ignore it when received.
+ * 
+ * Packets without destination peer IDs are keep-alives. Their payload is
+ * either empty or a struct {@link dataproto_keepalive}, which lets the peers
+ * measure the round-trip time and stretch the keep-alive interval while idle.
+ * Peers which don't know about it send empty keep-alives and ignore the payload.
  */
 
 #ifndef BADVPN_PROTOCOL_DATAPROTO_H
@@ -49,6 +60,9 @@
 #define DATAPROTO_MAX_PEER_IDS 1
 
 #define DATAPROTO_FLAGS_RECEIVING_KEEPALIVES 1
+#define DATAPROTO_FLAGS_ACCEPTS_COMPRESSION 2
+#define DATAPROTO_FLAGS_COMPRESSED 4
+#define DATAPROTO_FLAGS_PROBE 8
 
 /**
  * DataProto header.
@@ -60,6 +74,14 @@ struct dataproto_header {
      *   - DATAPROTO_FLAGS_RECEIVING_KEEPALIVES
      *     Indicates that when the peer sent this packet, it has received at least
      *     one packet from the other peer in the last keep-alive tolerance time.
+     *   - DATAPROTO_FLAGS_ACCEPTS_COMPRESSION
+     *     Indicates that the sender decompresses packets with the
+     *     DATAPROTO_FLAGS_COMPRESSED flag, and the other peer may send them.
+     *   - DATAPROTO_FLAGS_COMPRESSED
+     *     Indicates that the payload of this packet is LZ4-compressed.
+     *   - DATAPROTO_FLAGS_PROBE
+     *     Set in keep-alives; asks the receiver to send a keep-alive back
+     *     right away, because the sender suspects the link is down.
      */
     uint8_t flags;
     
@@ -86,6 +108,38 @@ struct dataproto_peer_id {
 } B_PACKED;
 B_END_PACKED
 
+/**
+ * Payload of keep-alives.
+ */
+B_START_PACKED
+struct dataproto_keepalive {
+    /**
+     * Sender's clock in milliseconds when the keep-alive was sent.
+     * Never zero.
+     */
+    uint32_t timestamp;
+    
+    /**
+     * Timestamp of the last keep-alive received from the other peer,
+     * or zero if none was received.
+     */
+    uint32_t echo_timestamp;
+    
+    /**
+     * Milliseconds between receiving the keep-alive with echo_timestamp and
+     * sending this one, so that the other peer can subtract it from the
+     * round-trip time.
+     */
+    uint32_t echo_delay;
+    
+    /**
+     * Milliseconds until the sender sends the next keep-alive, if it has
+     * nothing else to send. The other peer scales its receive tolerance by it.
+     */
+    uint32_t interval;
+} B_PACKED;
+B_END_PACKED
+
 #define DATAPROTO_MAX_OVERHEAD (sizeof(struct dataproto_header) + DATAPROTO_MAX_PEER_IDS * sizeof(struct dataproto_peer_id))
 
 #endif
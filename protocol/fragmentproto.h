@@ -37,6 +37,16 @@
  * Each chunk consists of:
  *   - the chunk header (struct {@link fragmentproto_chunk_header})
  *   - the chunk payload, i.e. part of the frame specified in the header
+ * 
+ * Besides frame chunks, there are control chunks used for path MTU discovery,
+ * identified by the is_last field:
+ *   - FRAGMENTPROTO_CHUNK_PROBE is a probe. It is the only chunk of its packet, and
+ *     its payload is padding which brings the packet to the size being probed.
+ *     The frame_id field is the probe identifier and chunk_start is zero.
+ *   - FRAGMENTPROTO_CHUNK_PROBE_ACK acknowledges a received probe. The frame_id
+ *     field is the identifier of the probe, chunk_start is the length of the probe
+ *     packet, and chunk_len is zero. It may share a packet with frame chunks.
+ * Receivers which do not know control chunks discard packets containing them.
  */
 
 #ifndef BADVPN_PROTOCOL_FRAGMENTPROTO_H
@@ -49,6 +59,9 @@
 
 typedef uint16_t fragmentproto_frameid;
 
+#define FRAGMENTPROTO_CHUNK_PROBE 2
+#define FRAGMENTPROTO_CHUNK_PROBE_ACK 3
+
 /**
  * FragmentProto chunk header.
  */
@@ -74,6 +87,7 @@ struct fragmentproto_chunk_header {
     /**
      * Whether this is the last chunk of the frame, i.e.
      * the total length of the frame is chunk_start + chunk_len.
+     * For control chunks, FRAGMENTPROTO_CHUNK_PROBE or FRAGMENTPROTO_CHUNK_PROBE_ACK.
      */
     uint8_t is_last;
 } B_PACKED;
@@ -40,6 +40,11 @@
 #define REQUESTPROTO_TYPE_SERVER_FINISHED 4
 #define REQUESTPROTO_TYPE_SERVER_ERROR 5
 
+// Like CLIENT_REQUEST, but the payload is encoded with NCDValBinary, and
+// the server answers with SERVER_REPLY_BINARY instead of SERVER_REPLY.
+#define REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY 6
+#define REQUESTPROTO_TYPE_SERVER_REPLY_BINARY 7
+
 B_START_PACKED
 struct requestproto_header {
     uint32_t request_id;
@@ -79,16 +79,25 @@
  *   the same certificate they used when connecting to the server, and each peer
  *   must byte-compare the other's certificate agains the one provided to it by
  *   by the server in the relevent "newclient" message.
+ * 
+ * Since version 30, either side may combine packets into "batch" packets
+ * (type SCID_BATCH), whose payload is a sequence of PacketProto-encoded SCProto
+ * packets, headers included. The server only sends batches to clients using
+ * version 30 or newer, and clients only send them after receiving the
+ * "serverhello" packet. Batches do not nest.
  */
 
 #ifndef BADVPN_PROTOCOL_SCPROTO_H
 #define BADVPN_PROTOCOL_SCPROTO_H
 
 #include <stdint.h>
+#include <string.h>
 
+#include <misc/byteorder.h>
 #include <misc/packed.h>
 
-#define SC_VERSION 29
+#define SC_VERSION 30
+#define SC_OLDVERSION_NOBATCH 29
 #define SC_OLDVERSION_NOSSL 27
 #define SC_OLDVERSION_BROKENCERT 26
 
@@ -121,6 +130,7 @@ typedef uint16_t peerid_t;
 #define SCID_INMSG 6
 #define SCID_RESETPEER 7
 #define SCID_ACCEPTPEER 8
+#define SCID_BATCH 9
 
 /**
  * "clienthello" client packet payload.
@@ -263,4 +273,16 @@ struct sc_client_acceptpeer {
 } B_PACKED;
 B_END_PACKED
 
+static int sc_is_batch (const uint8_t *data, int data_len)
+{
+    if (data_len < sizeof(struct sc_header)) {
+        return 0;
+    }
+    
+    struct sc_header header;
+    memcpy(&header, data, sizeof(header));
+    
+    return (ltoh8(header.type) == SCID_BATCH);
+}
+
 #endif
@@ -40,6 +40,9 @@
  *   - One-time passwords. Adds a password to each packet
  *     for the receiver to recognize. Protects agains replaying
  *     packets and crafting new packets.
+ *   - Authenticated encryption (AEAD). Encrypts packets and
+ *     authenticates them in a single pass, replacing both
+ *     encryption and hashes.
  * 
  * A SPProto plaintext packet contains the following, in order:
  *   - if OTPs are used, a struct {@link spproto_otpdata} which contains
@@ -52,6 +55,15 @@
  *     bytes as needed to align to block size,
  *   - the padded plaintext is encrypted, and
  *   - the initialization vector (IV) is prepended.
+ * 
+ * If AEAD is used (in which case encryption and hashes are not):
+ *   - the plaintext is encrypted without padding,
+ *   - the nonce is prepended, and
+ *   - the authentication tag is appended.
+ * The nonce consists of 8 random bytes chosen by the sender, followed by
+ * a 32-bit big-endian counter. The sender chooses new random bytes whenever
+ * it gets a new key or the counter wraps around. Because the random part is
+ * 64 bits long, senders in both directions can share the same key.
  */
 
 #ifndef BADVPN_PROTOCOL_SPPROTO_H
@@ -65,11 +77,18 @@
 #include <misc/packed.h>
 #include <security/BHash.h>
 #include <security/BEncryption.h>
+#include <security/BAead.h>
 #include <security/OTPCalculator.h>
 
 #define SPPROTO_HASH_MODE_NONE 0
 #define SPPROTO_ENCRYPTION_MODE_NONE 0
 #define SPPROTO_OTP_MODE_NONE 0
+#define SPPROTO_AEAD_MODE_NONE 0
+
+#define SPPROTO_AEAD_NONCE_RANDOM_LEN 8
+#define SPPROTO_AEAD_NONCE_COUNTER_LEN 4
+
+#define SPPROTO_MAX_KEY_SIZE (BENCRYPTION_MAX_KEY_SIZE > BAEAD_MAX_KEY_SIZE ? BENCRYPTION_MAX_KEY_SIZE : BAEAD_MAX_KEY_SIZE)
 
 /**
  * Stores security parameters for SPProto.
@@ -78,7 +97,7 @@ struct spproto_security_params {
     /**
      * Hash mode.
      * Either SPPROTO_HASH_MODE_NONE for no hashes, or a valid bhash
-     * hash mode.
+     * hash mode which is not keyed.
      */
     int hash_mode;
     
@@ -101,6 +120,15 @@ struct spproto_security_params {
      * OTPs generated from a single seed.
      */
     int otp_num;
+    
+    /**
+     * AEAD mode.
+     * Either SPPROTO_AEAD_MODE_NONE for no AEAD, or a valid
+     * {@link BAead} cipher. If not SPPROTO_AEAD_MODE_NONE, hash_mode
+     * and encryption_mode must be SPPROTO_HASH_MODE_NONE and
+     * SPPROTO_ENCRYPTION_MODE_NONE.
+     */
+    int aead_mode;
 };
 
 #define SPPROTO_HAVE_HASH(_params) ((_params).hash_mode != SPPROTO_HASH_MODE_NONE)
@@ -114,6 +142,10 @@ struct spproto_security_params {
 
 #define SPPROTO_HAVE_OTP(_params) ((_params).otp_mode != SPPROTO_OTP_MODE_NONE)
 
+#define SPPROTO_HAVE_AEAD(_params) ((_params).aead_mode != SPPROTO_AEAD_MODE_NONE)
+
+#define SPPROTO_HAVE_KEY(_params) (SPPROTO_HAVE_ENCRYPTION(_params) || SPPROTO_HAVE_AEAD(_params))
+
 B_START_PACKED
 struct spproto_otpdata {
     uint16_t seed_id;
@@ -135,9 +167,31 @@ B_END_PACKED
 static void spproto_assert_security_params (struct spproto_security_params params)
 {
     ASSERT(params.hash_mode == SPPROTO_HASH_MODE_NONE || BHash_type_valid(params.hash_mode))
+    ASSERT(params.hash_mode == SPPROTO_HASH_MODE_NONE || !BHash_type_keyed(params.hash_mode))
     ASSERT(params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE || BEncryption_cipher_valid(params.encryption_mode))
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || BEncryption_cipher_valid(params.otp_mode))
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || params.otp_num > 0)
+    ASSERT(params.aead_mode == SPPROTO_AEAD_MODE_NONE || BAead_cipher_valid(params.aead_mode))
+    ASSERT(params.aead_mode == SPPROTO_AEAD_MODE_NONE || (params.hash_mode == SPPROTO_HASH_MODE_NONE && params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE))
+}
+
+/**
+ * Returns the size of the key given to the encoder and decoder.
+ * Encryption or AEAD must be enabled.
+ * 
+ * @param params security parameters
+ * @return key size in bytes
+ */
+static int spproto_key_size (struct spproto_security_params params)
+{
+    spproto_assert_security_params(params);
+    ASSERT(SPPROTO_HAVE_KEY(params))
+    
+    if (SPPROTO_HAVE_AEAD(params)) {
+        return BAead_cipher_key_size(params.aead_mode);
+    } else {
+        return BEncryption_cipher_key_size(params.encryption_mode);
+    }
 }
 
 /**
@@ -154,7 +208,9 @@ static int spproto_payload_mtu_for_carrier_mtu (struct spproto_security_params p
     spproto_assert_security_params(params);
     ASSERT(carrier_mtu >= 0)
     
-    if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
+    if (SPPROTO_HAVE_AEAD(params)) {
+        return (carrier_mtu - BAEAD_NONCE_SIZE - SPPROTO_HEADER_LEN(params) - BAEAD_TAG_SIZE);
+    } else if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
         return (carrier_mtu - SPPROTO_HEADER_LEN(params));
     } else {
         int block_size = BEncryption_cipher_block_size(params.encryption_mode);
@@ -175,7 +231,13 @@ static int spproto_carrier_mtu_for_payload_mtu (struct spproto_security_params p
     spproto_assert_security_params(params);
     ASSERT(payload_mtu >= 0)
     
-    if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
+    if (SPPROTO_HAVE_AEAD(params)) {
+        if (payload_mtu > INT_MAX - (BAEAD_NONCE_SIZE + SPPROTO_HEADER_LEN(params) + BAEAD_TAG_SIZE)) {
+            return -1;
+        }
+        
+        return (BAEAD_NONCE_SIZE + SPPROTO_HEADER_LEN(params) + payload_mtu + BAEAD_TAG_SIZE);
+    } else if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
         if (payload_mtu > INT_MAX - SPPROTO_HEADER_LEN(params)) {
             return -1;
         }
@@ -30,14 +30,52 @@
 #define BADVPN_PROTOCOL_UDPGW_PROTO_H
 
 #include <stdint.h>
+#include <string.h>
 
 #include <misc/bsize.h>
+#include <misc/byteorder.h>
 #include <misc/packed.h>
 
 #define UDPGW_CLIENT_FLAG_KEEPALIVE (1 << 0)
+// from the client: the conid is for a new address, replacing any old one;
+// from the server, without an address or payload: the server has no connection
+// for the conid, and the next message for it must carry the address
 #define UDPGW_CLIENT_FLAG_REBIND (1 << 1)
 #define UDPGW_CLIENT_FLAG_DNS (1 << 2)
 #define UDPGW_CLIENT_FLAG_IPV6 (1 << 3)
+// on a keepalive, offers (client) or acknowledges (server) batching; otherwise
+// the header is followed by PacketProto-encoded messages
+#define UDPGW_CLIENT_FLAG_BATCH (1 << 4)
+// no address; the message is for the address last sent in full for the conid
+#define UDPGW_CLIENT_FLAG_COMPACT (1 << 5)
+// on a keepalive over the stream, asks for (client) or offers (server, followed
+// by struct udpgw_datagram_offer) the datagram transport
+#define UDPGW_CLIENT_FLAG_DATAGRAM (1 << 6)
+// on a keepalive, asks for (client) or acknowledges (server) ICMP echo relay;
+// otherwise the message is an ICMP (or ICMPv6) echo request or reply instead of
+// a UDP payload, the address port carries the client's echo identifier, and the
+// server sends the request from its own ICMP socket, under its own identifier
+#define UDPGW_CLIENT_FLAG_ICMP (1 << 7)
+
+// maximum length of a batch, including its PacketProto header
+#define UDPGW_BATCH_MTU 8192
+
+// Datagram transport: once the server has offered it over the stream, the
+// client may also exchange messages with it as UDP datagrams, each a
+// struct udpgw_datagram_header followed by one message. The token from the
+// offer identifies and authenticates the client, and the server echoes it.
+// The client probes the path with keepalive datagrams, which the server
+// answers, and only sends over it while answers arrive; the server replies
+// over the transport the client last sent data over.
+
+// interval of the client's keepalive datagrams
+#define UDPGW_DATAGRAM_PROBE_INTERVAL 2000
+
+// the client considers the path down after this long without a datagram
+#define UDPGW_DATAGRAM_CLIENT_TIMEOUT 6000
+
+// the server stops replying over datagrams after this long without one
+#define UDPGW_DATAGRAM_SERVER_TIMEOUT 8000
 
 B_START_PACKED
 struct udpgw_header {
@@ -46,6 +84,21 @@ struct udpgw_header {
 } B_PACKED;
 B_END_PACKED
 
+B_START_PACKED
+struct udpgw_datagram_offer {
+    // opaque
+    uint64_t token;
+    // network byte order
+    uint16_t port;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct udpgw_datagram_header {
+    uint64_t token;
+} B_PACKED;
+B_END_PACKED
+
 B_START_PACKED
 struct udpgw_addr_ipv4 {
     uint32_t addr_ip;
@@ -81,4 +134,17 @@ static int udpgw_compute_mtu (int dgram_mtu)
     return s;
 }
 
+static int udpgw_is_batch (const uint8_t *data, int data_len)
+{
+    if (data_len < sizeof(struct udpgw_header)) {
+        return 0;
+    }
+    
+    struct udpgw_header header;
+    memcpy(&header, data, sizeof(header));
+    
+    // a keepalive with the batch flag negotiates batching
+    return (ltoh8(header.flags) & (UDPGW_CLIENT_FLAG_BATCH|UDPGW_CLIENT_FLAG_KEEPALIVE)) == UDPGW_CLIENT_FLAG_BATCH;
+}
+
 #endif
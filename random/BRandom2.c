@@ -31,9 +31,63 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+
+#ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #include <pthread.h>
+#endif
 
 #include "BRandom2.h"
 
+static volatile unsigned int fork_generation = 0;
+
+#ifdef BADVPN_THREADWORK_USE_PTHREAD
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void atfork_child (void)
+{
+    // the child must not repeat the parent's output
+    fork_generation++;
+}
+
+static void register_atfork (void)
+{
+    ASSERT_FORCE(pthread_atfork(NULL, NULL, atfork_child) == 0)
+}
+
+#endif
+
+static int read_urandom (BRandom2 *o, void *out, size_t len)
+{
+    ssize_t res = read(o->urandom_fd, out, len);
+    if (res < 0 || res != len) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int seed_rng (BRandom2 *o)
+{
+    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    ASSERT_FORCE(pthread_once(&atfork_once, register_atfork) == 0)
+    #endif
+    
+    uint8_t seed[CHACHA20_RNG_SEED_SIZE];
+    if (!read_urandom(o, seed, sizeof(seed))) {
+        return 0;
+    }
+    
+    chacha20_rng_seed(&o->rng, seed);
+    memset(seed, 0, sizeof(seed));
+    
+    o->rng_fork_generation = fork_generation;
+    o->rng_seeded = 1;
+    
+    return 1;
+}
+
 static int do_init (BRandom2 *o)
 {
     if (o->initialized) {
@@ -55,6 +109,7 @@ int BRandom2_Init (BRandom2 *o, int flags)
     ASSERT((flags & ~(BRANDOM2_INIT_LAZY)) == 0)
     
     o->initialized = 0;
+    o->rng_seeded = 0;
     
     if (!(flags & BRANDOM2_INIT_LAZY) && !do_init(o)) {
         return 0;
@@ -81,10 +136,17 @@ int BRandom2_GenBytes (BRandom2 *o, void *out, size_t len)
         return 0;
     }
     
-    ssize_t res = read(o->urandom_fd, out, len);
-    if (res < 0 || res != len) {
-        return 0;
+    if (len > BRANDOM2_BUFFERED_MAX) {
+        return read_urandom(o, out, len);
+    }
+    
+    if (!o->rng_seeded || o->rng_fork_generation != fork_generation || chacha20_rng_needs_seed(&o->rng)) {
+        if (!seed_rng(o)) {
+            return 0;
+        }
     }
     
+    chacha20_rng_generate(&o->rng, out, len);
+    
     return 1;
 }
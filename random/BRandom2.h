@@ -33,13 +33,20 @@
 #include <stddef.h>
 
 #include <misc/debug.h>
+#include <misc/chacha20_rng.h>
 #include <base/DebugObject.h>
 
 #define BRANDOM2_INIT_LAZY (1 << 0)
 
+// requests up to this size are served from a generator seeded from /dev/urandom
+#define BRANDOM2_BUFFERED_MAX 256
+
 typedef struct {
     int initialized;
     int urandom_fd;
+    int rng_seeded;
+    unsigned int rng_fork_generation;
+    struct chacha20_rng rng;
     DebugObject d_obj;
 } BRandom2;
 
@@ -0,0 +1,163 @@
+/**
+ * @file BNameConnector.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <base/BLog.h>
+
+#include <resolver/BNameConnector.h>
+
+#include <generated/blog_channel_BResolver.h>
+
+#define STATE_RESOLVING 1
+#define STATE_CONNECTING 2
+#define STATE_CONNECTED 3
+#define STATE_FAILED 4
+
+static void query_handler (BNameConnector *o, int is_error);
+static void connector_handler (BNameConnector *o, int is_error);
+static void try_next_addr (BNameConnector *o);
+static BAddr current_addr (BNameConnector *o);
+
+void query_handler (BNameConnector *o, int is_error)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_RESOLVING)
+    
+    if (is_error) {
+        o->state = STATE_FAILED;
+        DEBUGERROR(&o->d_err, o->handler(o->user, 1));
+        return;
+    }
+    
+    // start with the first address
+    o->state = STATE_CONNECTING;
+    o->addr_index = -1;
+    try_next_addr(o);
+}
+
+void connector_handler (BNameConnector *o, int is_error)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTING)
+    
+    if (!is_error) {
+        o->state = STATE_CONNECTED;
+        o->handler(o->user, 0);
+        return;
+    }
+    
+    char addr_str[BADDR_MAX_PRINT_LEN];
+    BAddr addr = current_addr(o);
+    BAddr_Print(&addr, addr_str);
+    BLog(BLOG_INFO, "connection to %s failed", addr_str);
+    
+    // fall back to the next address
+    BConnector_Free(&o->connector);
+    try_next_addr(o);
+}
+
+void try_next_addr (BNameConnector *o)
+{
+    ASSERT(o->state == STATE_CONNECTING)
+    
+    while (++o->addr_index < BResolverQuery_GetNumAddrs(&o->query)) {
+        BAddr addr = current_addr(o);
+        struct BLisCon_from from = (o->fast_open ? BLisCon_from_addr_fastopen(addr) : BLisCon_from_addr(addr));
+        if (BConnector_InitFrom(&o->connector, from, o->reactor, o, (BConnector_handler)connector_handler)) {
+            return;
+        }
+        BLog(BLOG_ERROR, "BConnector_InitFrom failed");
+    }
+    
+    o->state = STATE_FAILED;
+    DEBUGERROR(&o->d_err, o->handler(o->user, 1));
+}
+
+BAddr current_addr (BNameConnector *o)
+{
+    BAddr addr = BResolverQuery_GetAddr(&o->query, o->addr_index);
+    BAddr_SetPort(&addr, o->port);
+    return addr;
+}
+
+int BNameConnector_Init (BNameConnector *o, BResolver *resolver, const char *name, uint16_t port, int fast_open,
+                         BReactor *reactor, void *user, BNameConnector_handler handler)
+{
+    ASSERT(name)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->port = port;
+    o->fast_open = fast_open;
+    o->handler = handler;
+    o->user = user;
+    
+    // start resolving
+    if (!BResolverQuery_Init(&o->query, resolver, name, (BResolverQuery_handler)query_handler, o)) {
+        BLog(BLOG_ERROR, "BResolverQuery_Init failed");
+        return 0;
+    }
+    
+    // set state
+    o->state = STATE_RESOLVING;
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void BNameConnector_Free (BNameConnector *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free connector
+    if (o->state == STATE_CONNECTING || o->state == STATE_CONNECTED) {
+        BConnector_Free(&o->connector);
+    }
+    
+    // free query
+    BResolverQuery_Free(&o->query);
+}
+
+BConnector * BNameConnector_GetConnector (BNameConnector *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTED)
+    
+    return &o->connector;
+}
+
+BAddr BNameConnector_GetAddr (BNameConnector *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTED)
+    
+    return current_addr(o);
+}
@@ -0,0 +1,114 @@
+/**
+ * @file BNameConnector.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which connects to a host given by name, using {@link BResolver}.
+ * 
+ * The addresses the name resolves to are tried in turn until a connection
+ * succeeds, so a host with several addresses is reached as long as one of
+ * them accepts connections.
+ */
+
+#ifndef BADVPN_RESOLVER_BNAMECONNECTOR_H
+#define BADVPN_RESOLVER_BNAMECONNECTOR_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <system/BConnection.h>
+#include <resolver/BResolver.h>
+
+/**
+ * Handler called when the connection attempt is done.
+ * If it failed, the object must be freed from the job closure of the handler.
+ * 
+ * @param user as in {@link BNameConnector_Init}
+ * @param is_error whether the connection attempt succeeded (0) or failed (1)
+ */
+typedef void (*BNameConnector_handler) (void *user, int is_error);
+
+typedef struct {
+    BReactor *reactor;
+    uint16_t port;
+    int fast_open;
+    BNameConnector_handler handler;
+    void *user;
+    int state;
+    int addr_index;
+    BResolverQuery query;
+    BConnector connector;
+    DebugError d_err;
+    DebugObject d_obj;
+} BNameConnector;
+
+/**
+ * Initializes the object and starts resolving the name.
+ * 
+ * @param o the object
+ * @param resolver resolver to use
+ * @param name null-terminated name of the host, or a numeric address
+ * @param port port to connect to, in network byte order
+ * @param fast_open whether to use TCP Fast Open, as in {@link BLisCon_from_addr_fastopen}
+ * @param reactor reactor we live in
+ * @param user argument to handler
+ * @param handler handler called when the connection attempt is done
+ * @return 1 on success, 0 on failure
+ */
+int BNameConnector_Init (BNameConnector *o, BResolver *resolver, const char *name, uint16_t port, int fast_open,
+                         BReactor *reactor, void *user, BNameConnector_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void BNameConnector_Free (BNameConnector *o);
+
+/**
+ * Returns the connector which has connected, to initialize a {@link BConnection}
+ * from with {@link BConnection_source_connector}.
+ * Must only be called after the handler has reported success.
+ * 
+ * @param o the object
+ * @return the connector
+ */
+BConnector * BNameConnector_GetConnector (BNameConnector *o);
+
+/**
+ * Returns the address which was connected to.
+ * Must only be called after the handler has reported success.
+ * 
+ * @param o the object
+ * @return the address
+ */
+BAddr BNameConnector_GetAddr (BNameConnector *o);
+
+#endif
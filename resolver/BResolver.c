@@ -0,0 +1,345 @@
+/**
+ * @file BResolver.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+#include <misc/hashfun.h>
+#include <base/BLog.h>
+
+#include <resolver/BResolver.h>
+
+#include <generated/blog_channel_BResolver.h>
+
+#include "BResolver_hash.h"
+#include <structure/CHash_impl.h>
+
+static BResolverHashRef entry_ref (struct BResolver_entry *entry)
+{
+    BResolverHashRef ref = {entry, entry};
+    return ref;
+}
+
+static void entry_work_func (struct BResolver_entry *entry)
+{
+    // this may run in another thread; only the name and the results are touched
+    
+    entry->num_addrs = 0;
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo *addrs;
+    if (getaddrinfo(entry->name, NULL, &hints, &addrs) != 0) {
+        return;
+    }
+    
+    for (struct addrinfo *ai = addrs; ai && entry->num_addrs < BRESOLVER_MAX_ADDRS; ai = ai->ai_next) {
+        BAddr *addr = &entry->addrs[entry->num_addrs];
+        switch (ai->ai_family) {
+            case AF_INET:
+                BAddr_InitIPv4(addr, ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr, 0);
+                break;
+            case AF_INET6:
+                BAddr_InitIPv6(addr, ((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr.s6_addr, 0);
+                break;
+            default:
+                continue;
+        }
+        entry->num_addrs++;
+    }
+    
+    freeaddrinfo(addrs);
+}
+
+static void query_set_result (BResolverQuery *q, struct BResolver_entry *entry)
+{
+    ASSERT(!entry->resolving)
+    
+    q->num_addrs = entry->num_addrs;
+    memcpy(q->addrs, entry->addrs, entry->num_addrs * sizeof(entry->addrs[0]));
+    
+    // report from a job
+    BPending_Set(&q->job);
+}
+
+static void entry_work_handler (struct BResolver_entry *entry)
+{
+    BResolver *o = entry->r;
+    ASSERT(entry->resolving)
+    
+    // free work
+    BThreadWork_Free(&entry->work);
+    entry->resolving = 0;
+    
+    if (entry->num_addrs > 0) {
+        BLog(BLOG_DEBUG, "resolved %s to %d addresses", entry->name, entry->num_addrs);
+        entry->expire_time = btime_gettime() + o->cache_time;
+    } else {
+        BLog(BLOG_NOTICE, "failed to resolve %s", entry->name);
+        entry->expire_time = btime_gettime() + bmin_int64(o->cache_time, BRESOLVER_NEGATIVE_CACHE_TIME);
+    }
+    
+    // give the result to the waiting queries
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&entry->queries_list))) {
+        BResolverQuery *q = UPPER_OBJECT(node, BResolverQuery, queries_list_node);
+        LinkedList1_Remove(&entry->queries_list, &q->queries_list_node);
+        q->entry = NULL;
+        query_set_result(q, entry);
+    }
+}
+
+static void free_entry (BResolver *o, struct BResolver_entry *entry)
+{
+    ASSERT(LinkedList1_IsEmpty(&entry->queries_list))
+    
+    // wait for the resolution, if any
+    if (entry->resolving) {
+        BThreadWork_Free(&entry->work);
+    }
+    
+    // remove from hash table
+    BResolverHash_Remove(&o->hash, 0, entry_ref(entry));
+    
+    // remove from entries list
+    LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    o->num_entries--;
+    
+    BFree(entry);
+}
+
+static void touch_entry (BResolver *o, struct BResolver_entry *entry)
+{
+    // move to the end of the entries list
+    LinkedList1_Remove(&o->entries_list, &entry->list_node);
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+}
+
+static struct BResolver_entry * new_entry (BResolver *o, const char *name, int name_len)
+{
+    ASSERT(o->num_entries <= o->max_entries)
+    
+    // evict the least recently used name which is not being resolved if full;
+    // resolutions can't be aborted without blocking
+    if (o->num_entries == o->max_entries) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->entries_list);
+        while (node && UPPER_OBJECT(node, struct BResolver_entry, list_node)->resolving) {
+            node = LinkedList1Node_Next(node);
+        }
+        if (!node) {
+            BLog(BLOG_ERROR, "too many names being resolved");
+            return NULL;
+        }
+        free_entry(o, UPPER_OBJECT(node, struct BResolver_entry, list_node));
+    }
+    
+    struct BResolver_entry *entry = (struct BResolver_entry *)BAlloc(sizeof(*entry));
+    if (!entry) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return NULL;
+    }
+    
+    entry->r = o;
+    memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+    entry->name_len = name_len;
+    entry->hash = badvpn_hash_bin((const uint8_t *)entry->name, entry->name_len, badvpn_hash_seed());
+    entry->resolving = 1;
+    entry->num_addrs = 0;
+    LinkedList1_Init(&entry->queries_list);
+    
+    // insert to hash table
+    int res = BResolverHash_Insert(&o->hash, 0, entry_ref(entry), NULL);
+    ASSERT_EXECUTE(res)
+    
+    // insert to entries list
+    LinkedList1_Append(&o->entries_list, &entry->list_node);
+    o->num_entries++;
+    
+    // start resolving
+    BThreadWork_Init(&entry->work, &o->twd, (BThreadWork_handler_done)entry_work_handler, entry,
+                     (BThreadWork_work_func)entry_work_func, entry);
+    
+    return entry;
+}
+
+static void query_job_handler (BResolverQuery *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->entry)
+    
+    o->handler(o->user, (o->num_addrs == 0));
+}
+
+int BResolver_Init (BResolver *o, BReactor *reactor, int num_threads, int max_entries, btime_t cache_time)
+{
+    ASSERT(max_entries > 0)
+    ASSERT(cache_time >= 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->max_entries = max_entries;
+    o->cache_time = cache_time;
+    
+    // init work dispatcher
+    if (!BThreadWorkDispatcher_Init(&o->twd, o->reactor, num_threads)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+        goto fail0;
+    }
+    
+    // init hash table
+    if (!BResolverHash_Init(&o->hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "BResolverHash_Init failed");
+        goto fail1;
+    }
+    
+    // init entries list
+    LinkedList1_Init(&o->entries_list);
+    o->num_entries = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_ctr);
+    return 1;
+    
+fail1:
+    BThreadWorkDispatcher_Free(&o->twd);
+fail0:
+    return 0;
+}
+
+void BResolver_Free (BResolver *o)
+{
+    DebugCounter_Free(&o->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // free entries
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&o->entries_list))) {
+        free_entry(o, UPPER_OBJECT(node, struct BResolver_entry, list_node));
+    }
+    
+    // free hash table
+    BResolverHash_Free(&o->hash);
+    
+    // free work dispatcher
+    BThreadWorkDispatcher_Free(&o->twd);
+}
+
+int BResolverQuery_Init (BResolverQuery *o, BResolver *r, const char *name, BResolverQuery_handler handler, void *user)
+{
+    DebugObject_Access(&r->d_obj);
+    ASSERT(name)
+    ASSERT(handler)
+    
+    // init arguments
+    o->r = r;
+    o->handler = handler;
+    o->user = user;
+    
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > BRESOLVER_NAME_MAX) {
+        BLog(BLOG_ERROR, "invalid name length");
+        goto fail0;
+    }
+    
+    // init job
+    BPending_Init(&o->job, BReactor_PendingGroup(r->reactor), (BPending_handler)query_job_handler, o);
+    
+    struct BResolver_name key = {name, name_len};
+    struct BResolver_entry *entry = BResolverHash_Lookup(&r->hash, 0, key).ptr;
+    
+    // drop an expired result
+    if (entry && !entry->resolving && btime_gettime() >= entry->expire_time) {
+        free_entry(r, entry);
+        entry = NULL;
+    }
+    
+    if (entry) {
+        touch_entry(r, entry);
+    } else if (!(entry = new_entry(r, name, name_len))) {
+        goto fail1;
+    }
+    
+    if (entry->resolving) {
+        // wait for the resolution
+        o->entry = entry;
+        LinkedList1_Append(&entry->queries_list, &o->queries_list_node);
+    } else {
+        // use the cached result
+        o->entry = NULL;
+        query_set_result(o, entry);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&r->d_ctr);
+    return 1;
+    
+fail1:
+    BPending_Free(&o->job);
+fail0:
+    return 0;
+}
+
+void BResolverQuery_Free (BResolverQuery *o)
+{
+    DebugCounter_Decrement(&o->r->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // stop waiting; the resolution goes on and its result is cached
+    if (o->entry) {
+        LinkedList1_Remove(&o->entry->queries_list, &o->queries_list_node);
+    }
+    
+    // free job
+    BPending_Free(&o->job);
+}
+
+int BResolverQuery_GetNumAddrs (BResolverQuery *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->entry)
+    ASSERT(o->num_addrs > 0)
+    
+    return o->num_addrs;
+}
+
+BAddr BResolverQuery_GetAddr (BResolverQuery *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->entry)
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_addrs)
+    
+    return o->addrs[index];
+}
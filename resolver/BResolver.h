@@ -0,0 +1,204 @@
+/**
+ * @file BResolver.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Asynchronous hostname resolution with a cache.
+ * 
+ * Names are resolved with getaddrinfo in the threads of a
+ * {@link BThreadWorkDispatcher}, so the event loop is not blocked. Results,
+ * including failures, are cached; since getaddrinfo does not report record
+ * TTLs, positive results are kept for a fixed time and failures for at most
+ * BRESOLVER_NEGATIVE_CACHE_TIME. Queries for a name which is being resolved
+ * wait for that resolution instead of starting another one. The number of
+ * cached names is bounded and the least recently used one is evicted.
+ */
+
+#ifndef BADVPN_RESOLVER_BRESOLVER_H
+#define BADVPN_RESOLVER_BRESOLVER_H
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BReactor.h>
+#include <base/BPending.h>
+#include <system/BTime.h>
+#include <threadwork/BThreadWork.h>
+
+/**
+ * Maximum length of a name.
+ */
+#define BRESOLVER_NAME_MAX 255
+
+/**
+ * Maximum number of addresses kept for a name.
+ */
+#define BRESOLVER_MAX_ADDRS 8
+
+/**
+ * Upper bound for the time a failed resolution is cached, in milliseconds.
+ */
+#define BRESOLVER_NEGATIVE_CACHE_TIME 5000
+
+/**
+ * Handler called when a {@link BResolverQuery} is done.
+ * 
+ * @param user as in {@link BResolverQuery_Init}
+ * @param is_error 0 if the name was resolved to at least one address, 1 if not
+ */
+typedef void (*BResolverQuery_handler) (void *user, int is_error);
+
+struct BResolver_name {
+    const char *data;
+    int len;
+};
+
+struct BResolver_entry;
+
+typedef struct BResolver_entry *BResolverHash_link;
+typedef struct BResolver_name BResolverHash_key;
+
+#include "BResolver_hash.h"
+#include <structure/CHash_decl.h>
+
+/**
+ * Resolver with a cache.
+ */
+typedef struct {
+    BReactor *reactor;
+    int max_entries;
+    btime_t cache_time;
+    BThreadWorkDispatcher twd;
+    BResolverHash hash;
+    LinkedList1 entries_list;
+    int num_entries;
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} BResolver;
+
+struct BResolver_entry {
+    BResolver *r;
+    LinkedList1Node list_node; // node in BResolver.entries_list
+    BResolverHash_link hash_next; // next in BResolver.hash bucket
+    size_t hash;
+    char name[BRESOLVER_NAME_MAX + 1];
+    int name_len;
+    int resolving;
+    BThreadWork work;
+    LinkedList1 queries_list;
+    btime_t expire_time;
+    // written by the work function while resolving
+    int num_addrs;
+    BAddr addrs[BRESOLVER_MAX_ADDRS];
+};
+
+/**
+ * Resolution of a name.
+ */
+typedef struct {
+    BResolver *r;
+    BResolverQuery_handler handler;
+    void *user;
+    struct BResolver_entry *entry;
+    LinkedList1Node queries_list_node;
+    BPending job;
+    int num_addrs;
+    BAddr addrs[BRESOLVER_MAX_ADDRS];
+    DebugObject d_obj;
+} BResolverQuery;
+
+/**
+ * Initializes the resolver.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param num_threads number of resolver threads, as num_threads_hint in
+ *                    {@link BThreadWorkDispatcher_Init}. With 0, names are resolved
+ *                    in the event loop, blocking it.
+ * @param max_entries maximum number of cached names. Must be >0.
+ * @param cache_time how long a resolved name is cached, in milliseconds. Must be >=0.
+ * @return 1 on success, 0 on failure
+ */
+int BResolver_Init (BResolver *o, BReactor *reactor, int num_threads, int max_entries, btime_t cache_time) WARN_UNUSED;
+
+/**
+ * Frees the resolver.
+ * There must be no {@link BResolverQuery}'s with this resolver. If a name is
+ * still being resolved, this waits for the resolution to finish.
+ * 
+ * @param o the object
+ */
+void BResolver_Free (BResolver *o);
+
+/**
+ * Starts resolving a name.
+ * 
+ * The handler is always called from a job, even if the result was cached.
+ * Freeing a query which is waiting does not abort the resolution, whose result
+ * is still cached.
+ * 
+ * @param o the object
+ * @param r resolver
+ * @param name null-terminated name to resolve, or a numeric address
+ * @param handler handler called when the query is done
+ * @param user argument to handler
+ * @return 1 on success, 0 on failure
+ */
+int BResolverQuery_Init (BResolverQuery *o, BResolver *r, const char *name, BResolverQuery_handler handler, void *user) WARN_UNUSED;
+
+/**
+ * Frees the query.
+ * 
+ * @param o the object
+ */
+void BResolverQuery_Free (BResolverQuery *o);
+
+/**
+ * Returns the number of addresses the name was resolved to.
+ * Must only be called after the handler has reported success.
+ * 
+ * @param o the object
+ * @return number of addresses, >0
+ */
+int BResolverQuery_GetNumAddrs (BResolverQuery *o);
+
+/**
+ * Returns an address the name was resolved to, in the order returned by the
+ * system resolver. The port of the address is 0.
+ * Must only be called after the handler has reported success.
+ * 
+ * @param o the object
+ * @param index index of the address, less than {@link BResolverQuery_GetNumAddrs}
+ * @return the address, of type BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6
+ */
+BAddr BResolverQuery_GetAddr (BResolverQuery *o, int index);
+
+#endif
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME BResolverHash
+#define CHASH_PARAM_ENTRY struct BResolver_entry
+#define CHASH_PARAM_LINK BResolverHash_link
+#define CHASH_PARAM_KEY BResolverHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((BResolverHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) badvpn_hash_bin((const uint8_t *)(key).data, (key).len, badvpn_hash_seed())
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->name_len == (entry2).ptr->name_len && !memcmp((entry1).ptr->name, (entry2).ptr->name, (entry1).ptr->name_len))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).len == (entry2).ptr->name_len && !memcmp((key1).data, (entry2).ptr->name, (key1).len))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -0,0 +1,181 @@
+#!/bin/sh
+
+# End-to-end benchmark of tun2socks and udpgw in network namespaces.
+#
+#   app namespace:  tun2socks on a TUN device, the load generator client
+#   srv namespace:  SOCKS server, udpgw, and the target server on 198.18.0.1
+#
+# The app namespace routes 198.18.0.0/15 into the TUN device, so all client
+# traffic passes tun2socks; TCP goes out through the SOCKS server and UDP
+# through udpgw. Each workload prints one JSON object (see
+# examples/tun2socks_bench.c); the objects are collected with some
+# information about the build and host into the output file, which can be
+# kept next to a change to compare against its base.
+
+BUILD=""
+OUTPUT="tun2socks-bench.json"
+DURATION=10
+WORKLOADS="tcp-bulk tcp-connrate tcp-hold udp dns"
+SOCKS_SERVER=""
+TUN2SOCKS_ARGS=""
+UDPGW_ARGS=""
+PREFIX="t2sb"
+
+usage () {
+    echo "Runs end-to-end benchmarks of tun2socks and udpgw (needs root)"
+    echo "Usage: $0 -b <build dir> [-o <output.json>] [-d <seconds>] [-w <workloads>]"
+    echo "    [-s <socks server command>] [-t <extra tun2socks args>] [-u <extra udpgw args>]"
+    echo "Workloads: ${WORKLOADS}"
+    echo "The SOCKS server command runs in the server namespace and must listen on"
+    echo "10.213.0.2:1080; by default the built-in one of tun2socks_bench is used."
+    exit 1
+}
+
+while getopts "b:o:d:w:s:t:u:h" opt; do
+    case "${opt}" in
+        b) BUILD="${OPTARG}" ;;
+        o) OUTPUT="${OPTARG}" ;;
+        d) DURATION="${OPTARG}" ;;
+        w) WORKLOADS="${OPTARG}" ;;
+        s) SOCKS_SERVER="${OPTARG}" ;;
+        t) TUN2SOCKS_ARGS="${OPTARG}" ;;
+        u) UDPGW_ARGS="${OPTARG}" ;;
+        *) usage ;;
+    esac
+done
+
+[ -n "${BUILD}" ] || usage
+
+BENCH="${BUILD}/examples/tun2socks_bench"
+TUN2SOCKS="${BUILD}/tun2socks/badvpn-tun2socks"
+UDPGW="${BUILD}/udpgw/badvpn-udpgw"
+
+for f in "${BENCH}" "${TUN2SOCKS}" "${UDPGW}"; do
+    if [ ! -x "${f}" ]; then
+        echo "missing ${f}" >&2
+        exit 1
+    fi
+done
+
+if [ "$(id -u)" != "0" ]; then
+    echo "must be run as root" >&2
+    exit 1
+fi
+
+APP="${PREFIX}-app"
+SRV="${PREFIX}-srv"
+TMP="$(mktemp -d)"
+PIDS=""
+
+cleanup () {
+    set +e
+    for pid in ${PIDS}; do
+        kill "${pid}" 2>/dev/null
+    done
+    wait 2>/dev/null
+    ip netns del "${APP}" 2>/dev/null
+    ip netns del "${SRV}" 2>/dev/null
+    rm -rf "${TMP}"
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+set -e
+
+# namespaces joined by a veth pair
+ip netns add "${APP}"
+ip netns add "${SRV}"
+ip link add "${PREFIX}0" type veth peer name "${PREFIX}1"
+ip link set "${PREFIX}0" netns "${APP}"
+ip link set "${PREFIX}1" netns "${SRV}"
+ip -n "${APP}" link set lo up
+ip -n "${SRV}" link set lo up
+ip -n "${APP}" addr add 10.213.0.1/30 dev "${PREFIX}0"
+ip -n "${SRV}" addr add 10.213.0.2/30 dev "${PREFIX}1"
+ip -n "${APP}" link set "${PREFIX}0" up
+ip -n "${SRV}" link set "${PREFIX}1" up
+ip -n "${SRV}" addr add 198.18.0.1/32 dev lo
+
+# TUN device of tun2socks, carrying the benchmark traffic
+ip netns exec "${APP}" ip tuntap add dev "${PREFIX}tun" mode tun
+ip -n "${APP}" addr add 10.213.1.1/30 dev "${PREFIX}tun"
+ip -n "${APP}" link set "${PREFIX}tun" up
+ip -n "${APP}" route add 198.18.0.0/15 dev "${PREFIX}tun"
+
+# connection-rate runs go through many local ports
+ip netns exec "${APP}" sysctl -q -w net.ipv4.ip_local_port_range="1024 65535"
+ip netns exec "${APP}" sysctl -q -w net.ipv4.tcp_tw_reuse=1
+ip netns exec "${SRV}" sysctl -q -w net.ipv4.ip_local_port_range="1024 65535"
+ip netns exec "${SRV}" sysctl -q -w net.ipv4.tcp_tw_reuse=1
+
+ulimit -n 65536 2>/dev/null || true
+
+start () {
+    name="$1"
+    ns="$2"
+    shift 2
+    ip netns exec "${ns}" "$@" >"${TMP}/${name}.log" 2>&1 &
+    LAST_PID=$!
+    PIDS="${PIDS} ${LAST_PID}"
+}
+
+start server "${SRV}" "${BENCH}" server 198.18.0.1
+if [ -n "${SOCKS_SERVER}" ]; then
+    start socks "${SRV}" sh -c "${SOCKS_SERVER}"
+else
+    start socks "${SRV}" "${BENCH}" socks-server 10.213.0.2:1080
+fi
+# shellcheck disable=SC2086
+start udpgw "${SRV}" "${UDPGW}" --listen-addr 10.213.0.2:7300 --loglevel warning \
+    --max-clients 64 --max-connections-for-client 65536 ${UDPGW_ARGS}
+UDPGW_PID="${LAST_PID}"
+# shellcheck disable=SC2086
+start tun2socks "${APP}" "${TUN2SOCKS}" --tundev "${PREFIX}tun" --netif-ipaddr 10.213.1.2 \
+    --netif-netmask 255.255.255.252 --socks-server-addr 10.213.0.2:1080 \
+    --udpgw-remote-server-addr 10.213.0.2:7300 --loglevel warning ${TUN2SOCKS_ARGS}
+TUN2SOCKS_PID="${LAST_PID}"
+
+sleep 1
+
+for pid in ${PIDS}; do
+    if ! kill -0 "${pid}" 2>/dev/null; then
+        echo "a server failed to start, logs:" >&2
+        cat "${TMP}"/*.log >&2
+        exit 1
+    fi
+done
+
+set +e
+
+for w in ${WORKLOADS}; do
+    echo "running ${w}" >&2
+    if ! ip netns exec "${APP}" "${BENCH}" client "${w}" --duration "${DURATION}" \
+        --watch "tun2socks:${TUN2SOCKS_PID}" --watch "udpgw:${UDPGW_PID}" \
+        198.18.0.1 >>"${TMP}/results"; then
+        echo "workload ${w} failed" >&2
+        exit 1
+    fi
+    tail -n 1 "${TMP}/results" >&2
+
+    # let connections from the previous workload wind down
+    sleep 2
+done
+
+REVISION="$(git -C "$(dirname "$0")" describe --always --dirty 2>/dev/null || echo unknown)"
+
+{
+    echo "{"
+    echo "  \"revision\": \"${REVISION}\","
+    echo "  \"date\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+    echo "  \"kernel\": \"$(uname -r)\","
+    echo "  \"cpus\": $(nproc),"
+    echo "  \"tun2socks_args\": \"${TUN2SOCKS_ARGS}\","
+    echo "  \"udpgw_args\": \"${UDPGW_ARGS}\","
+    echo "  \"results\": ["
+    sed -e 's/^/    /' -e '$!s/$/,/' "${TMP}/results"
+    echo "  ]"
+    echo "}"
+} >"${OUTPUT}"
+
+echo "results written to ${OUTPUT}" >&2
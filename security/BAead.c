@@ -0,0 +1,169 @@
+/**
+ * @file BAead.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Authenticated encryption with associated data (AEAD) abstraction.
+ */
+
+#include <security/BAead.h>
+
+static const EVP_CIPHER * get_evp_cipher (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES_128_GCM:
+            return EVP_aes_128_gcm();
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+int BAead_cipher_valid (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES_128_GCM:
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int BAead_cipher_key_size (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES_128_GCM:
+            return BAEAD_CIPHER_AES_128_GCM_KEY_SIZE;
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return BAEAD_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+int BAead_Init (BAead *o, int mode, int cipher)
+{
+    ASSERT(mode == BAEAD_MODE_ENCRYPT || mode == BAEAD_MODE_DECRYPT)
+    ASSERT(BAead_cipher_valid(cipher))
+    
+    o->mode = mode;
+    o->cipher = cipher;
+    
+    // allocate context
+    if (!(o->ctx = EVP_CIPHER_CTX_new())) {
+        goto fail0;
+    }
+    
+    // set cipher; the key and nonce are set later
+    if (!EVP_CipherInit_ex(o->ctx, get_evp_cipher(o->cipher), NULL, NULL, NULL, (o->mode == BAEAD_MODE_ENCRYPT))) {
+        goto fail1;
+    }
+    
+    // set nonce length
+    if (!EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_SET_IVLEN, BAEAD_NONCE_SIZE, NULL)) {
+        goto fail1;
+    }
+    
+    // have no key
+    o->have_key = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    EVP_CIPHER_CTX_free(o->ctx);
+fail0:
+    return 0;
+}
+
+void BAead_Free (BAead *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free context
+    EVP_CIPHER_CTX_free(o->ctx);
+}
+
+void BAead_SetKey (BAead *o, uint8_t *key)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set key, keeping the cipher and nonce length
+    ASSERT_FORCE(EVP_CipherInit_ex(o->ctx, NULL, NULL, key, NULL, -1))
+    
+    o->have_key = 1;
+}
+
+void BAead_Encrypt (BAead *o, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, uint8_t *tag)
+{
+    ASSERT(o->mode == BAEAD_MODE_ENCRYPT)
+    ASSERT(o->have_key)
+    ASSERT(len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    int out_len;
+    
+    // set nonce; the key schedule is kept
+    ASSERT_FORCE(EVP_EncryptInit_ex(o->ctx, NULL, NULL, NULL, nonce))
+    
+    // encrypt
+    ASSERT_FORCE(EVP_EncryptUpdate(o->ctx, out, &out_len, in, len))
+    ASSERT(out_len == len)
+    ASSERT_FORCE(EVP_EncryptFinal_ex(o->ctx, out + out_len, &out_len))
+    ASSERT(out_len == 0)
+    
+    // get tag
+    ASSERT_FORCE(EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_GET_TAG, BAEAD_TAG_SIZE, tag))
+}
+
+int BAead_Decrypt (BAead *o, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, uint8_t *tag)
+{
+    ASSERT(o->mode == BAEAD_MODE_DECRYPT)
+    ASSERT(o->have_key)
+    ASSERT(len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    int out_len;
+    
+    // set nonce; the key schedule is kept
+    ASSERT_FORCE(EVP_DecryptInit_ex(o->ctx, NULL, NULL, NULL, nonce))
+    
+    // decrypt
+    ASSERT_FORCE(EVP_DecryptUpdate(o->ctx, out, &out_len, in, len))
+    ASSERT(out_len == len)
+    
+    // set expected tag
+    ASSERT_FORCE(EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_SET_TAG, BAEAD_TAG_SIZE, tag))
+    
+    // verify tag
+    return (EVP_DecryptFinal_ex(o->ctx, out + out_len, &out_len) > 0);
+}
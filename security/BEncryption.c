@@ -27,12 +27,143 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
+#if (defined(__aarch64__) || defined(__arm__)) && defined(BADVPN_LINUX)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include <misc/minmax.h>
 #include <base/BLog.h>
 
 #include <security/BEncryption.h>
 
 #include <generated/blog_channel_BEncryption.h>
 
+// number of buffers whose blocks are encrypted together in a batch
+#define BATCH_WIDTH 8
+
+#define HW_AES_NONE 0
+#define HW_AES_AESNI 1
+#define HW_AES_ARMV8_CE 2
+
+static int detect_hw_aes (void)
+{
+    #if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES)) {
+        return HW_AES_AESNI;
+    }
+    #endif
+    
+    #if defined(__aarch64__) && defined(BADVPN_LINUX) && defined(HWCAP_AES)
+    if (getauxval(AT_HWCAP) & HWCAP_AES) {
+        return HW_AES_ARMV8_CE;
+    }
+    #endif
+    
+    #if defined(__arm__) && defined(BADVPN_LINUX) && defined(HWCAP2_AES)
+    if (getauxval(AT_HWCAP2) & HWCAP2_AES) {
+        return HW_AES_ARMV8_CE;
+    }
+    #endif
+    
+    return HW_AES_NONE;
+}
+
+static EVP_CIPHER_CTX * init_evp (const EVP_CIPHER *evp_cipher, uint8_t *key, int encrypt)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    ASSERT_FORCE(ctx)
+    
+    ASSERT_FORCE(EVP_CipherInit_ex(ctx, evp_cipher, NULL, key, NULL, encrypt))
+    
+    // we only ever pass whole blocks
+    ASSERT_FORCE(EVP_CIPHER_CTX_set_padding(ctx, 0))
+    
+    return ctx;
+}
+
+static void do_evp (EVP_CIPHER_CTX *ctx, uint8_t *in, uint8_t *out, int len, uint8_t *iv, int encrypt)
+{
+    ASSERT(len % BENCRYPTION_CIPHER_AES_BLOCK_SIZE == 0)
+    
+    if (len == 0) {
+        return;
+    }
+    
+    // the next IV is the last ciphertext block; when decrypting, save it
+    // before it can be overwritten
+    uint8_t next_iv[BENCRYPTION_CIPHER_AES_BLOCK_SIZE];
+    if (!encrypt) {
+        memcpy(next_iv, in + len - sizeof(next_iv), sizeof(next_iv));
+    }
+    
+    // set IV, keeping the key schedule
+    ASSERT_FORCE(EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1))
+    
+    int out_len;
+    ASSERT_FORCE(EVP_CipherUpdate(ctx, out, &out_len, in, len))
+    ASSERT(out_len == len)
+    
+    if (encrypt) {
+        memcpy(next_iv, out + len - sizeof(next_iv), sizeof(next_iv));
+    }
+    
+    memcpy(iv, next_iv, sizeof(next_iv));
+}
+
+static void encrypt_evp_interleaved (EVP_CIPHER_CTX *ecb_ctx, struct BEncryption_batch_item *items, int num_items)
+{
+    ASSERT(num_items >= 0)
+    ASSERT(num_items <= BATCH_WIDTH)
+    
+    uint8_t blocks[BATCH_WIDTH][BENCRYPTION_CIPHER_AES_BLOCK_SIZE];
+    int block_item[BATCH_WIDTH];
+    
+    // encrypt the n-th block of all buffers with one ECB call; CBC chaining is
+    // done here, with the IV holding the previous ciphertext block
+    for (int pos = 0;; pos += BENCRYPTION_CIPHER_AES_BLOCK_SIZE) {
+        int num_blocks = 0;
+        
+        for (int i = 0; i < num_items; i++) {
+            struct BEncryption_batch_item *item = &items[i];
+            ASSERT(item->len % BENCRYPTION_CIPHER_AES_BLOCK_SIZE == 0)
+            
+            if (pos >= item->len) {
+                continue;
+            }
+            
+            uint64_t in_words[2];
+            uint64_t iv_words[2];
+            memcpy(in_words, item->in + pos, sizeof(in_words));
+            memcpy(iv_words, item->iv, sizeof(iv_words));
+            in_words[0] ^= iv_words[0];
+            in_words[1] ^= iv_words[1];
+            memcpy(blocks[num_blocks], in_words, sizeof(in_words));
+            block_item[num_blocks] = i;
+            num_blocks++;
+        }
+        
+        if (num_blocks == 0) {
+            break;
+        }
+        
+        int out_len;
+        ASSERT_FORCE(EVP_EncryptUpdate(ecb_ctx, (uint8_t *)blocks, &out_len, (uint8_t *)blocks, num_blocks * BENCRYPTION_CIPHER_AES_BLOCK_SIZE))
+        ASSERT(out_len == num_blocks * BENCRYPTION_CIPHER_AES_BLOCK_SIZE)
+        
+        for (int k = 0; k < num_blocks; k++) {
+            struct BEncryption_batch_item *item = &items[block_item[k]];
+            memcpy(item->out + pos, blocks[k], BENCRYPTION_CIPHER_AES_BLOCK_SIZE);
+            memcpy(item->iv, blocks[k], BENCRYPTION_CIPHER_AES_BLOCK_SIZE);
+        }
+    }
+}
+
 int BEncryption_cipher_valid (int cipher)
 {
     switch (cipher) {
@@ -70,6 +201,30 @@ int BEncryption_cipher_key_size (int cipher)
     }
 }
 
+const char * BEncryption_cipher_implementation (int cipher)
+{
+    switch (cipher) {
+        case BENCRYPTION_CIPHER_BLOWFISH:
+            return "OpenSSL BF, software";
+        case BENCRYPTION_CIPHER_AES:
+            switch (detect_hw_aes()) {
+                case HW_AES_AESNI:
+                    return "OpenSSL EVP, AES-NI";
+                case HW_AES_ARMV8_CE:
+                    return "OpenSSL EVP, ARMv8 crypto extensions";
+                default:
+                    #ifdef BADVPN_USE_CRYPTODEV
+                    return "cryptodev if /dev/crypto is available, else OpenSSL EVP, software";
+                    #else
+                    return "OpenSSL EVP, software";
+                    #endif
+            }
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
 void BEncryption_Init (BEncryption *enc, int mode, int cipher, uint8_t *key)
 {
     ASSERT(!(mode&~(BENCRYPTION_MODE_ENCRYPT|BENCRYPTION_MODE_DECRYPT)))
@@ -80,6 +235,11 @@ void BEncryption_Init (BEncryption *enc, int mode, int cipher, uint8_t *key)
     
     #ifdef BADVPN_USE_CRYPTODEV
     
+    // a syscall per operation is slower than AES instructions
+    if (detect_hw_aes() != HW_AES_NONE) {
+        goto fail1;
+    }
+    
     switch (enc->cipher) {
         case BENCRYPTION_CIPHER_AES:
             enc->cryptodev.cipher = CRYPTO_AES_CBC;
@@ -123,20 +283,20 @@ fail1:
     
     #endif
     
-    int res;
-    
     switch (enc->cipher) {
         case BENCRYPTION_CIPHER_BLOWFISH:
             BF_set_key(&enc->blowfish, BENCRYPTION_CIPHER_BLOWFISH_KEY_SIZE, key);
             break;
         case BENCRYPTION_CIPHER_AES:
+            enc->evp.encrypt = NULL;
+            enc->evp.encrypt_ecb = NULL;
+            enc->evp.decrypt = NULL;
             if (enc->mode&BENCRYPTION_MODE_ENCRYPT) {
-                res = AES_set_encrypt_key(key, 128, &enc->aes.encrypt);
-                ASSERT_EXECUTE(res >= 0)
+                enc->evp.encrypt = init_evp(EVP_aes_128_cbc(), key, 1);
+                enc->evp.encrypt_ecb = init_evp(EVP_aes_128_ecb(), key, 1);
             }
             if (enc->mode&BENCRYPTION_MODE_DECRYPT) {
-                res = AES_set_decrypt_key(key, 128, &enc->aes.decrypt);
-                ASSERT_EXECUTE(res >= 0)
+                enc->evp.decrypt = init_evp(EVP_aes_128_cbc(), key, 0);
             }
             break;
         default:
@@ -162,9 +322,20 @@ void BEncryption_Free (BEncryption *enc)
         ASSERT_FORCE(ioctl(enc->cryptodev.cfd, CIOCFSESSION, &enc->cryptodev.ses) == 0)
         ASSERT_FORCE(close(enc->cryptodev.cfd) == 0)
         ASSERT_FORCE(close(enc->cryptodev.fd) == 0)
+        return;
     }
     
     #endif
+    
+    if (enc->cipher == BENCRYPTION_CIPHER_AES) {
+        if (enc->evp.encrypt) {
+            EVP_CIPHER_CTX_free(enc->evp.encrypt);
+            EVP_CIPHER_CTX_free(enc->evp.encrypt_ecb);
+        }
+        if (enc->evp.decrypt) {
+            EVP_CIPHER_CTX_free(enc->evp.decrypt);
+        }
+    }
 }
 
 void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len, uint8_t *iv)
@@ -196,7 +367,7 @@ void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
             BF_cbc_encrypt(in, out, len, &enc->blowfish, iv, BF_ENCRYPT);
             break;
         case BENCRYPTION_CIPHER_AES:
-            AES_cbc_encrypt(in, out, len, &enc->aes.encrypt, iv, AES_ENCRYPT);
+            do_evp(enc->evp.encrypt, in, out, len, iv, 1);
             break;
         default:
             ASSERT(0);
@@ -232,9 +403,44 @@ void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
             BF_cbc_encrypt(in, out, len, &enc->blowfish, iv, BF_DECRYPT);
             break;
         case BENCRYPTION_CIPHER_AES:
-            AES_cbc_encrypt(in, out, len, &enc->aes.decrypt, iv, AES_DECRYPT);
+            do_evp(enc->evp.decrypt, in, out, len, iv, 0);
             break;
         default:
             ASSERT(0);
     }
 }
+
+void BEncryption_EncryptBatch (BEncryption *enc, struct BEncryption_batch_item *items, int num_items)
+{
+    ASSERT(enc->mode&BENCRYPTION_MODE_ENCRYPT)
+    ASSERT(num_items >= 0)
+    
+    int interleave = (enc->cipher == BENCRYPTION_CIPHER_AES);
+    #ifdef BADVPN_USE_CRYPTODEV
+    interleave = interleave && !enc->use_cryptodev;
+    #endif
+    
+    if (!interleave) {
+        for (int i = 0; i < num_items; i++) {
+            BEncryption_Encrypt(enc, items[i].in, items[i].out, items[i].len, items[i].iv);
+        }
+        return;
+    }
+    
+    for (int i = 0; i < num_items; i += BATCH_WIDTH) {
+        int n = bmin_int(BATCH_WIDTH, num_items - i);
+        encrypt_evp_interleaved(enc->evp.encrypt_ecb, items + i, n);
+    }
+}
+
+void BEncryption_DecryptBatch (BEncryption *enc, struct BEncryption_batch_item *items, int num_items)
+{
+    ASSERT(enc->mode&BENCRYPTION_MODE_DECRYPT)
+    ASSERT(num_items >= 0)
+    
+    // CBC decryption has no chaining dependency, so one buffer already
+    // keeps the hardware busy
+    for (int i = 0; i < num_items; i++) {
+        BEncryption_Decrypt(enc, items[i].in, items[i].out, items[i].len, items[i].iv);
+    }
+}
@@ -29,6 +29,10 @@
  * @section DESCRIPTION
  * 
  * Block cipher encryption abstraction.
+ * 
+ * AES goes through the OpenSSL EVP interface, which uses AES-NI or the ARMv8
+ * crypto extensions when the CPU has them. Blowfish uses the OpenSSL BF
+ * functions directly, as it is not available through EVP by default.
  */
 
 #ifndef BADVPN_SECURITY_BENCRYPTION_H
@@ -49,7 +53,7 @@
 #endif
 
 #include <openssl/blowfish.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -70,8 +74,21 @@
 
 // NOTE: update the maximums above when adding a cipher!
 
+/**
+ * One buffer in a batch encryption or decryption.
+ * Arguments have the same meaning as in {@link BEncryption_Encrypt} and
+ * {@link BEncryption_Decrypt}.
+ */
+struct BEncryption_batch_item {
+    uint8_t *in;
+    uint8_t *out;
+    int len;
+    uint8_t *iv;
+};
+
 /**
  * Block cipher encryption abstraction.
+ * An object may be used from any thread, but only from one thread at a time.
  */
 typedef struct {
     DebugObject d_obj;
@@ -83,9 +100,10 @@ typedef struct {
     union {
         BF_KEY blowfish;
         struct {
-            AES_KEY encrypt;
-            AES_KEY decrypt;
-        } aes;
+            EVP_CIPHER_CTX *encrypt;
+            EVP_CIPHER_CTX *encrypt_ecb;
+            EVP_CIPHER_CTX *decrypt;
+        } evp;
         #ifdef BADVPN_USE_CRYPTODEV
         struct {
             int fd;
@@ -121,6 +139,15 @@ int BEncryption_cipher_block_size (int cipher);
  */
 int BEncryption_cipher_key_size (int cipher);
 
+/**
+ * Returns a description of the implementation used for a cipher,
+ * for example whether hardware acceleration was detected.
+ * 
+ * @param cipher cipher number. Must be valid.
+ * @return static string
+ */
+const char * BEncryption_cipher_implementation (int cipher);
+
 /**
  * Initializes the object.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if this object
@@ -172,4 +199,30 @@ void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
  */
 void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len, uint8_t *iv);
 
+/**
+ * Encrypts multiple independent buffers.
+ * Equivalent to calling {@link BEncryption_Encrypt} on each item, but with AES,
+ * blocks of different buffers are interleaved, which hides the latency of CBC
+ * encryption where the hardware can process several blocks at once.
+ * The object must have been initialized with mode including
+ * BENCRYPTION_MODE_ENCRYPT.
+ * 
+ * @param enc the object
+ * @param items buffers to encrypt. Buffers of different items must not overlap.
+ * @param num_items number of items. Must be >=0.
+ */
+void BEncryption_EncryptBatch (BEncryption *enc, struct BEncryption_batch_item *items, int num_items);
+
+/**
+ * Decrypts multiple independent buffers.
+ * Equivalent to calling {@link BEncryption_Decrypt} on each item.
+ * The object must have been initialized with mode including
+ * BENCRYPTION_MODE_DECRYPT.
+ * 
+ * @param enc the object
+ * @param items buffers to decrypt
+ * @param num_items number of items. Must be >=0.
+ */
+void BEncryption_DecryptBatch (BEncryption *enc, struct BEncryption_batch_item *items, int num_items);
+
 #endif
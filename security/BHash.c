@@ -27,13 +27,71 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
+#include <openssl/core_names.h>
+
 #include <security/BHash.h>
 
+static const EVP_MD * get_evp_md (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_MD5:
+            return EVP_md5();
+        case BHASH_TYPE_SHA1:
+            return EVP_sha1();
+        case BHASH_TYPE_SHA256:
+            return EVP_sha256();
+        case BHASH_TYPE_BLAKE2S:
+            return EVP_blake2s256();
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+static const char * get_md_name (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_MD5:
+            return OSSL_DIGEST_NAME_MD5;
+        case BHASH_TYPE_SHA1:
+            return OSSL_DIGEST_NAME_SHA1;
+        case BHASH_TYPE_SHA256:
+            return OSSL_DIGEST_NAME_SHA2_256;
+        case BHASH_TYPE_BLAKE2S:
+            return "BLAKE2S-256";
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+static const char * get_mac_name (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_HMAC_SHA256:
+            return OSSL_MAC_NAME_HMAC;
+        case BHASH_TYPE_BLAKE2S_KEYED:
+            return OSSL_MAC_NAME_BLAKE2SMAC;
+        case BHASH_TYPE_POLY1305:
+            return OSSL_MAC_NAME_POLY1305;
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
 int BHash_type_valid (int type)
 {
     switch (type) {
         case BHASH_TYPE_MD5:
         case BHASH_TYPE_SHA1:
+        case BHASH_TYPE_SHA256:
+        case BHASH_TYPE_BLAKE2S:
+        case BHASH_TYPE_HMAC_SHA256:
+        case BHASH_TYPE_BLAKE2S_KEYED:
+        case BHASH_TYPE_POLY1305:
             return 1;
         default:
             return 0;
@@ -47,23 +105,199 @@ int BHash_size (int type)
             return BHASH_TYPE_MD5_SIZE;
         case BHASH_TYPE_SHA1:
             return BHASH_TYPE_SHA1_SIZE;
+        case BHASH_TYPE_SHA256:
+            return BHASH_TYPE_SHA256_SIZE;
+        case BHASH_TYPE_BLAKE2S:
+            return BHASH_TYPE_BLAKE2S_SIZE;
+        case BHASH_TYPE_HMAC_SHA256:
+            return BHASH_TYPE_HMAC_SHA256_SIZE;
+        case BHASH_TYPE_BLAKE2S_KEYED:
+            return BHASH_TYPE_BLAKE2S_KEYED_SIZE;
+        case BHASH_TYPE_POLY1305:
+            return BHASH_TYPE_POLY1305_SIZE;
         default:
             ASSERT(0)
             return 0;
     }
 }
 
-void BHash_calculate (int type, uint8_t *data, int data_len, uint8_t *out)
+int BHash_type_keyed (int type)
 {
     switch (type) {
         case BHASH_TYPE_MD5:
-            MD5(data, data_len, out);
-            break;
         case BHASH_TYPE_SHA1:
-            SHA1(data, data_len, out);
-            break;
+        case BHASH_TYPE_SHA256:
+        case BHASH_TYPE_BLAKE2S:
+            return 0;
+        case BHASH_TYPE_HMAC_SHA256:
+        case BHASH_TYPE_BLAKE2S_KEYED:
+        case BHASH_TYPE_POLY1305:
+            return 1;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+int BHash_key_size (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_HMAC_SHA256:
+            return BHASH_TYPE_HMAC_SHA256_KEY_SIZE;
+        case BHASH_TYPE_BLAKE2S_KEYED:
+            return BHASH_TYPE_BLAKE2S_KEYED_KEY_SIZE;
+        case BHASH_TYPE_POLY1305:
+            return BHASH_TYPE_POLY1305_KEY_SIZE;
         default:
             ASSERT(0)
-            ;
+            return 0;
+    }
+}
+
+int BHash_type_one_time_key (int type)
+{
+    ASSERT(BHash_type_keyed(type))
+    
+    return (type == BHASH_TYPE_POLY1305);
+}
+
+void BHash_calculate (int type, uint8_t *data, int data_len, uint8_t *out)
+{
+    ASSERT(!BHash_type_keyed(type))
+    
+    ASSERT_FORCE(EVP_Digest(data, data_len, out, NULL, get_evp_md(type), NULL))
+}
+
+int BHash_Init (BHash *o, int type)
+{
+    ASSERT(BHash_type_valid(type))
+    
+    o->type = type;
+    o->keyed = BHash_type_keyed(type);
+    o->md = NULL;
+    o->md_ctx = NULL;
+    o->mac_ctx = NULL;
+    
+    if (!o->keyed) {
+        // fetch the implementation once; with EVP_md5() and the like, it would
+        // be looked up in the library's shared store, under a lock, every time
+        // a hash is started
+        if (!(o->md = EVP_MD_fetch(NULL, get_md_name(type), NULL))) {
+            goto fail0;
+        }
+        
+        if (!(o->md_ctx = EVP_MD_CTX_new())) {
+            EVP_MD_free(o->md);
+            goto fail0;
+        }
+    } else {
+        EVP_MAC *mac = EVP_MAC_fetch(NULL, get_mac_name(type), NULL);
+        if (!mac) {
+            goto fail0;
+        }
+        
+        o->mac_ctx = EVP_MAC_CTX_new(mac);
+        EVP_MAC_free(mac);
+        if (!o->mac_ctx) {
+            goto fail0;
+        }
+        
+        if (type == BHASH_TYPE_HMAC_SHA256) {
+            OSSL_PARAM params[] = {
+                OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+                OSSL_PARAM_construct_end()
+            };
+            if (!EVP_MAC_CTX_set_params(o->mac_ctx, params)) {
+                goto fail1;
+            }
+        }
+    }
+    
+    o->have_key = 0;
+    o->key_started = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    EVP_MAC_CTX_free(o->mac_ctx);
+fail0:
+    return 0;
+}
+
+void BHash_Free (BHash *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    if (o->keyed) {
+        EVP_MAC_CTX_free(o->mac_ctx);
+    } else {
+        EVP_MD_CTX_free(o->md_ctx);
+        EVP_MD_free(o->md);
+    }
+}
+
+void BHash_SetKey (BHash *o, uint8_t *key)
+{
+    ASSERT(o->keyed)
+    DebugObject_Access(&o->d_obj);
+    
+    // this also starts a message, which BHash_Start will use
+    ASSERT_FORCE(EVP_MAC_init(o->mac_ctx, key, BHash_key_size(o->type), NULL))
+    
+    o->have_key = 1;
+    o->key_started = 1;
+}
+
+void BHash_Start (BHash *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->keyed) {
+        ASSERT_FORCE(EVP_DigestInit_ex(o->md_ctx, o->md, NULL))
+        return;
+    }
+    
+    ASSERT(o->have_key)
+    ASSERT(o->key_started || !BHash_type_one_time_key(o->type))
+    
+    if (o->key_started) {
+        o->key_started = 0;
+        return;
+    }
+    
+    // restart with the precomputed key state
+    ASSERT_FORCE(EVP_MAC_init(o->mac_ctx, NULL, 0, NULL))
+}
+
+void BHash_Update (BHash *o, const uint8_t *data, int len)
+{
+    ASSERT(len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->keyed) {
+        ASSERT_FORCE(EVP_DigestUpdate(o->md_ctx, data, len))
+    } else {
+        ASSERT_FORCE(EVP_MAC_update(o->mac_ctx, data, len))
+    }
+}
+
+void BHash_Finish (BHash *o, uint8_t *out)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->keyed) {
+        unsigned int out_len;
+        ASSERT_FORCE(EVP_DigestFinal_ex(o->md_ctx, out, &out_len))
+        ASSERT(out_len == BHash_size(o->type))
+    } else {
+        size_t out_len;
+        ASSERT_FORCE(EVP_MAC_final(o->mac_ctx, out, &out_len, BHash_size(o->type)))
+        ASSERT(out_len == BHash_size(o->type))
+        
+        // a one-time key must not be used again
+        if (BHash_type_one_time_key(o->type)) {
+            o->have_key = 0;
+        }
     }
 }
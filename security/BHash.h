@@ -29,6 +29,9 @@
  * @section DESCRIPTION
  * 
  * Cryptographic hash funtions abstraction.
+ * 
+ * Besides one-shot unkeyed hashes ({@link BHash_calculate}), a {@link BHash}
+ * object computes hashes incrementally, and also supports keyed MACs.
  */
 
 #ifndef BADVPN_SECURITY_BHASH_H
@@ -36,10 +39,10 @@
 
 #include <stdint.h>
 
-#include <openssl/md5.h>
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 
 #include <misc/debug.h>
+#include <base/DebugObject.h>
 
 #define BHASH_TYPE_MD5 1
 #define BHASH_TYPE_MD5_SIZE 16
@@ -47,7 +50,43 @@
 #define BHASH_TYPE_SHA1 2
 #define BHASH_TYPE_SHA1_SIZE 20
 
-#define BHASH_MAX_SIZE 20
+#define BHASH_TYPE_SHA256 3
+#define BHASH_TYPE_SHA256_SIZE 32
+
+#define BHASH_TYPE_BLAKE2S 4
+#define BHASH_TYPE_BLAKE2S_SIZE 32
+
+#define BHASH_TYPE_HMAC_SHA256 5
+#define BHASH_TYPE_HMAC_SHA256_SIZE 32
+#define BHASH_TYPE_HMAC_SHA256_KEY_SIZE 32
+
+#define BHASH_TYPE_BLAKE2S_KEYED 6
+#define BHASH_TYPE_BLAKE2S_KEYED_SIZE 32
+#define BHASH_TYPE_BLAKE2S_KEYED_KEY_SIZE 32
+
+#define BHASH_TYPE_POLY1305 7
+#define BHASH_TYPE_POLY1305_SIZE 16
+#define BHASH_TYPE_POLY1305_KEY_SIZE 32
+
+#define BHASH_MAX_SIZE 32
+#define BHASH_MAX_KEY_SIZE 32
+
+// NOTE: update the maximums above when adding a hash!
+
+/**
+ * Incremental hash or MAC calculation.
+ * An object may be used from any thread, but only from one thread at a time.
+ */
+typedef struct {
+    int type;
+    int keyed;
+    int have_key;
+    int key_started;
+    EVP_MD *md;
+    EVP_MD_CTX *md_ctx;
+    EVP_MAC_CTX *mac_ctx;
+    DebugObject d_obj;
+} BHash;
 
 /**
  * Checks if the given hash type number is valid.
@@ -65,16 +104,103 @@ int BHash_type_valid (int type);
  */
 int BHash_size (int type);
 
+/**
+ * Checks if a hash type is a keyed MAC.
+ * 
+ * @param type hash type number. Must be valid.
+ * @return 1 if keyed, 0 if not
+ */
+int BHash_type_keyed (int type);
+
+/**
+ * Returns the key size of a keyed MAC.
+ * 
+ * @param type hash type number. Must be valid and keyed.
+ * @return key size in bytes
+ */
+int BHash_key_size (int type);
+
+/**
+ * Checks if a keyed MAC needs a new key for every message.
+ * This is the case for Poly1305.
+ * 
+ * @param type hash type number. Must be valid and keyed.
+ * @return 1 if a key may only be used once, 0 if not
+ */
+int BHash_type_one_time_key (int type);
+
 /**
  * Calculates a hash.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if this is
  * being called from a non-main thread.
+ * The implementation is looked up in the library's shared state on every
+ * call; where hashes are calculated often, especially from several threads,
+ * use a {@link BHash} object instead.
  * 
- * @param type hash type number. Must be valid.
+ * @param type hash type number. Must be valid and not keyed.
  * @param data data to calculate the hash of
  * @param data_len length of data
  * @param out the hash will be written here. Must not overlap with data.
  */
 void BHash_calculate (int type, uint8_t *data, int data_len, uint8_t *out);
 
+/**
+ * Initializes the object.
+ * For keyed types, {@link BHash_SetKey} must be called before starting a hash.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if this object
+ * will be used from a non-main thread.
+ * 
+ * @param o the object
+ * @param type hash type number. Must be valid.
+ * @return 1 on success, 0 on failure
+ */
+int BHash_Init (BHash *o, int type) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void BHash_Free (BHash *o);
+
+/**
+ * Sets the key of a keyed MAC, replacing any previous key.
+ * The key schedule (for HMAC, the inner and outer states) is computed here
+ * and reused by every following {@link BHash_Start}, except for types
+ * with one-time keys, where this must be called before every message.
+ * 
+ * @param o the object. Its type must be keyed.
+ * @param key key, {@link BHash_key_size}(type) bytes
+ */
+void BHash_SetKey (BHash *o, uint8_t *key);
+
+/**
+ * Starts calculating a new hash, discarding any unfinished one.
+ * For keyed types, a key must have been set. For types with one-time keys,
+ * the key must have been set since the previous {@link BHash_Finish}.
+ * 
+ * @param o the object
+ */
+void BHash_Start (BHash *o);
+
+/**
+ * Adds data to the hash being calculated.
+ * {@link BHash_Start} must have been called.
+ * 
+ * @param o the object
+ * @param data data to add
+ * @param len length of data. Must be >=0.
+ */
+void BHash_Update (BHash *o, const uint8_t *data, int len);
+
+/**
+ * Finishes calculating the hash.
+ * {@link BHash_Start} must have been called. Afterwards, {@link BHash_Start}
+ * must be called again before adding more data.
+ * 
+ * @param o the object
+ * @param out the hash will be written here, {@link BHash_size}(type) bytes
+ */
+void BHash_Finish (BHash *o, uint8_t *out);
+
 #endif
@@ -27,16 +27,84 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
+#ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #include <pthread.h>
+#endif
+
 #include <openssl/rand.h>
 
 #include <misc/debug.h>
+#include <misc/chacha20_rng.h>
 
 #include <security/BRandom.h>
 
+#ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #define THREAD_LOCAL __thread
+#else
+    #define THREAD_LOCAL
+#endif
+
+struct thread_rng {
+    int seeded;
+    unsigned int fork_generation;
+    struct chacha20_rng rng;
+};
+
+static THREAD_LOCAL struct thread_rng thread_rng;
+
+static volatile unsigned int fork_generation = 0;
+
+#ifdef BADVPN_THREADWORK_USE_PTHREAD
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void atfork_child (void)
+{
+    // the child must not repeat the parent's output
+    fork_generation++;
+}
+
+static void register_atfork (void)
+{
+    ASSERT_FORCE(pthread_atfork(NULL, NULL, atfork_child) == 0)
+}
+
+#endif
+
+static void seed_thread_rng (struct thread_rng *t)
+{
+    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    ASSERT_FORCE(pthread_once(&atfork_once, register_atfork) == 0)
+    #endif
+    
+    uint8_t seed[CHACHA20_RNG_SEED_SIZE];
+    ASSERT_FORCE(RAND_bytes(seed, sizeof(seed)) == 1)
+    
+    chacha20_rng_seed(&t->rng, seed);
+    memset(seed, 0, sizeof(seed));
+    
+    t->fork_generation = fork_generation;
+    t->seeded = 1;
+}
+
 void BRandom_randomize (uint8_t *buf, int len)
 {
     ASSERT(len >= 0)
     
     DEBUG_ZERO_MEMORY(buf, len)
-    ASSERT_FORCE(RAND_bytes(buf, len) == 1)
+    
+    if (len > BRANDOM_BUFFERED_MAX) {
+        ASSERT_FORCE(RAND_bytes(buf, len) == 1)
+        return;
+    }
+    
+    struct thread_rng *t = &thread_rng;
+    
+    if (!t->seeded || t->fork_generation != fork_generation || chacha20_rng_needs_seed(&t->rng)) {
+        seed_thread_rng(t);
+    }
+    
+    chacha20_rng_generate(&t->rng, buf, len);
 }
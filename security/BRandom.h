@@ -29,6 +29,11 @@
  * @section DESCRIPTION
  * 
  * Random data generation function.
+ * 
+ * Small requests, such as IVs and nonces, are served from a per-thread
+ * buffered ChaCha20 generator, which is seeded from the OpenSSL RNG and
+ * reseeded periodically and after fork. Large requests go to the OpenSSL
+ * RNG directly.
  */
 
 #ifndef BADVPN_SECURITY_BRANDOM_H
@@ -36,8 +41,12 @@
 
 #include <stdint.h>
 
+#define BRANDOM_BUFFERED_MAX 256
+
 /**
  * Generates random data.
+ * Requests of up to BRANDOM_BUFFERED_MAX bytes are served from the calling
+ * thread's buffered generator, without locking.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if this is
  * being called from a non-main thread.
  * 
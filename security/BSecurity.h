@@ -29,6 +29,13 @@
  * @section DESCRIPTION
  * 
  * Initialization of OpenSSL for security functions.
+ * 
+ * OpenSSL 1.1 and newer lock internally, and the locking callbacks installed
+ * here have no effect. What threads still share in the library is its store
+ * of algorithm implementations, which is locked on every lookup; the security
+ * objects ({@link BEncryption}, {@link BAead}, {@link BHash}) look up their
+ * algorithms when initialized, so that an object used by one thread at a time
+ * does not touch shared state when processing data.
  */
 
 #ifndef BADVPN_SECURITY_BSECURITY_H
@@ -33,27 +33,29 @@
 
 #include <security/OTPChecker.h>
 
-static void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_table *t);
-static void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp);
-static void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_table *t, OTPCalculator *calc, uint8_t *key, uint8_t *iv);
+static void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_entry *entries);
+static void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_entry *entries, otp_t otp);
+static void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_entry *entries, OTPCalculator *calc, uint8_t *key, uint8_t *iv);
 static int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp);
+static void start_work (OTPChecker *mc, uint16_t seed_id, uint8_t *key, uint8_t *iv);
 
-void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_table *t)
+void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_entry *entries)
 {
     for (int i = 0; i < mc->num_entries; i++) {
-        t->entries[i].avail = -1;
+        entries[i].avail = -1;
     }
 }
 
-void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp)
+void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_entry *entries, otp_t otp)
 {
-    // calculate starting index
-    int start_index = otp % mc->num_entries;
+    // OTPs are cipher output, so their low bits are already uniformly distributed;
+    // the number of entries is a power of two, so they can be used directly
+    int mask = mc->num_entries - 1;
+    int index = otp & mask;
     
     // try indexes starting with the base position
     for (int i = 0; i < mc->num_entries; i++) {
-        int index = bmodadd_int(start_index, i, mc->num_entries);
-        struct OTPChecker_entry *entry = &t->entries[index];
+        struct OTPChecker_entry *entry = &entries[index];
         
         // if we find a free index, use it
         if (entry->avail < 0) {
@@ -68,34 +70,35 @@ void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t
             entry->avail++;
             return;
         }
+        
+        index = (index + 1) & mask;
     }
     
     // will never add more macs than we can hold
     ASSERT(0)
 }
 
-void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_table *t, OTPCalculator *calc, uint8_t *key, uint8_t *iv)
+void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_entry *entries, OTPCalculator *calc, uint8_t *key, uint8_t *iv)
 {
     // calculate values
     otp_t *otps = OTPCalculator_Generate(calc, key, iv, 0);
     
     // empty table
-    OTPChecker_Table_Empty(mc ,t);
+    OTPChecker_Table_Empty(mc, entries);
     
     // add calculated values to table
     for (int i = 0; i < mc->num_otps; i++) {
-        OTPChecker_Table_AddOTP(mc, t, otps[i]);
+        OTPChecker_Table_AddOTP(mc, entries, otps[i]);
     }
 }
 
 int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp)
 {
-    // calculate starting index
-    int start_index = otp % mc->num_entries;
+    int mask = mc->num_entries - 1;
+    int index = otp & mask;
     
     // try indexes starting with the base position
     for (int i = 0; i < mc->num_entries; i++) {
-        int index = bmodadd_int(start_index, i, mc->num_entries);
         struct OTPChecker_entry *entry = &t->entries[index];
         
         // if we find an empty entry, there is no such mac
@@ -111,6 +114,8 @@ int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t
             }
             return 0;
         }
+        
+        index = (index + 1) & mask;
     }
     
     // there are always empty slots
@@ -120,8 +125,8 @@ int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t
 
 static void work_func (OTPChecker *mc)
 {
-    struct OTPChecker_table *table = &mc->tables[mc->next_table];
-    OTPChecker_Table_Generate(mc, table, &mc->calc, mc->tw_key, mc->tw_iv);
+    // generate into the spare table, which nobody else touches
+    OTPChecker_Table_Generate(mc, mc->gen_entries, &mc->calc, mc->tw_key, mc->tw_iv);
 }
 
 static void work_done_handler (OTPChecker *mc)
@@ -133,21 +138,61 @@ static void work_done_handler (OTPChecker *mc)
     BThreadWork_Free(&mc->tw);
     mc->tw_have = 0;
     
-    // update next table number
-    mc->next_table = bmodadd_int(mc->next_table, 1, mc->num_tables);
+    int installed = 0;
+    
+    if (!mc->tw_obsolete) {
+        // swap the generated table in place of the oldest one
+        struct OTPChecker_table *table = &mc->tables[mc->next_table];
+        struct OTPChecker_entry *old_entries = table->entries;
+        table->entries = mc->gen_entries;
+        table->id = mc->tw_seed_id;
+        mc->gen_entries = old_entries;
+        
+        // update next table number
+        mc->next_table = bmodadd_int(mc->next_table, 1, mc->num_tables);
+        
+        // update number of used tables if not all are used yet
+        if (mc->tables_used < mc->num_tables) {
+            mc->tables_used++;
+        }
+        
+        installed = 1;
+    }
     
-    // update number of used tables if not all are used yet
-    if (mc->tables_used < mc->num_tables) {
-        mc->tables_used++;
+    // generate for a seed that was added while we were working
+    if (mc->next_have) {
+        mc->next_have = 0;
+        start_work(mc, mc->next_seed_id, mc->next_key, mc->next_iv);
     }
     
     // call handler
-    if (mc->handler) {
+    if (installed && mc->handler) {
         mc->handler(mc->user);
         return;
     }
 }
 
+static void start_work (OTPChecker *mc, uint16_t seed_id, uint8_t *key, uint8_t *iv)
+{
+    ASSERT(!mc->tw_have)
+    
+    // remember seed ID
+    mc->tw_seed_id = seed_id;
+    
+    // copy key and IV
+    memcpy(mc->tw_key, key, BEncryption_cipher_key_size(mc->cipher));
+    memcpy(mc->tw_iv, iv, BEncryption_cipher_block_size(mc->cipher));
+    
+    // result is wanted
+    mc->tw_obsolete = 0;
+    
+    // start work
+    BThreadWork_Init(&mc->tw, mc->twd, (BThreadWork_handler_done)work_done_handler, mc, (BThreadWork_work_func)work_func, mc);
+    
+    // set have work
+    mc->tw_have = 1;
+}
+
 int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, BThreadWorkDispatcher *twd)
 {
     ASSERT(num_otps > 0)
@@ -163,11 +208,14 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
     // set no handlers
     mc->handler = NULL;
     
-    // set number of entries
-    if (mc->num_otps > INT_MAX / 2) {
+    // set number of entries, a power of two at least twice the number of OTPs
+    if (mc->num_otps > INT_MAX / 4) {
         goto fail0;
     }
-    mc->num_entries = 2 * mc->num_otps;
+    mc->num_entries = 1;
+    while (mc->num_entries < 2 * mc->num_otps) {
+        mc->num_entries *= 2;
+    }
     
     // set no tables used
     mc->tables_used = 0;
@@ -183,8 +231,8 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
         goto fail1;
     }
     
-    // allocate entries
-    if (!(mc->entries = (struct OTPChecker_entry *)BAllocArray2(mc->num_tables, mc->num_entries, sizeof(mc->entries[0])))) {
+    // allocate entries, with one spare table for generation
+    if (!(mc->entries = (struct OTPChecker_entry *)BAllocArray2(mc->num_tables + 1, mc->num_entries, sizeof(mc->entries[0])))) {
         goto fail2;
     }
     
@@ -192,12 +240,18 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
     for (int i = 0; i < mc->num_tables; i++) {
         struct OTPChecker_table *table = &mc->tables[i];
         table->entries = mc->entries + (size_t)i * mc->num_entries;
-        OTPChecker_Table_Empty(mc, table);
+        OTPChecker_Table_Empty(mc, table->entries);
     }
     
+    // set spare table
+    mc->gen_entries = mc->entries + (size_t)mc->num_tables * mc->num_entries;
+    
     // have no work
     mc->tw_have = 0;
     
+    // have no seed waiting for generation
+    mc->next_have = 0;
+    
     DebugObject_Init(&mc->d_obj);
     return 1;
     
@@ -234,33 +288,40 @@ void OTPChecker_AddSeed (OTPChecker *mc, uint16_t seed_id, uint8_t *key, uint8_t
     ASSERT(mc->next_table < mc->num_tables)
     DebugObject_Access(&mc->d_obj);
     
-    // free existing work
-    if (mc->tw_have) {
+    // without threads, the work has not started yet and can be freed cheaply
+    if (mc->tw_have && !BThreadWorkDispatcher_UsingThreads(mc->twd)) {
         BThreadWork_Free(&mc->tw);
+        mc->tw_have = 0;
+        mc->next_have = 0;
     }
     
-    // set table's seed ID
-    mc->tables[mc->next_table].id = seed_id;
-    
-    // copy key and IV
-    memcpy(mc->tw_key, key, BEncryption_cipher_key_size(mc->cipher));
-    memcpy(mc->tw_iv, iv, BEncryption_cipher_block_size(mc->cipher));
-    
-    // start work
-    BThreadWork_Init(&mc->tw, mc->twd, (BThreadWork_handler_done)work_done_handler, mc, (BThreadWork_work_func)work_func, mc);
+    if (mc->tw_have) {
+        // don't wait for the running work; discard its result and
+        // generate for this seed when it is done
+        mc->tw_obsolete = 1;
+        mc->next_have = 1;
+        mc->next_seed_id = seed_id;
+        memcpy(mc->next_key, key, BEncryption_cipher_key_size(mc->cipher));
+        memcpy(mc->next_iv, iv, BEncryption_cipher_block_size(mc->cipher));
+        return;
+    }
     
-    // set have work
-    mc->tw_have = 1;
+    start_work(mc, seed_id, key, iv);
 }
 
 void OTPChecker_RemoveSeeds (OTPChecker *mc)
 {
     DebugObject_Access(&mc->d_obj);
     
-    // free existing work
+    // free existing work, or discard its result if it may be running
     if (mc->tw_have) {
-        BThreadWork_Free(&mc->tw);
-        mc->tw_have = 0;
+        if (!BThreadWorkDispatcher_UsingThreads(mc->twd)) {
+            BThreadWork_Free(&mc->tw);
+            mc->tw_have = 0;
+        } else {
+            mc->tw_obsolete = 1;
+        }
+        mc->next_have = 0;
     }
     
     mc->tables_used = 0;
@@ -274,11 +335,6 @@ int OTPChecker_CheckOTP (OTPChecker *mc, uint16_t seed_id, otp_t otp)
     // try tables in reverse order
     for (int i = 1; i <= mc->tables_used; i++) {
         int table_index = bmodadd_int(mc->next_table, mc->num_tables - i, mc->num_tables);
-        if (table_index == mc->next_table && mc->tw_have) {
-            // ignore table that is being generated
-            continue;
-        }
-        
         struct OTPChecker_table *table = &mc->tables[table_index];
         if (table->id == seed_id) {
             return OTPChecker_Table_CheckOTP(mc, table, otp);
@@ -29,6 +29,11 @@
  * @section DESCRIPTION
  * 
  * Object that checks OTPs agains known seeds.
+ * 
+ * Each seed has a table of its OTPs, which is an open-addressing hash table
+ * with linear probing. Tables for new seeds are generated with
+ * {@link BThreadWork} into a spare table, which is swapped in when done, so
+ * that adding a seed never waits for generation on the reactor thread.
  */
 
 #ifndef BADVPN_SECURITY_OTPCHECKER_H
@@ -77,10 +82,17 @@ typedef struct {
     OTPCalculator calc;
     struct OTPChecker_table *tables;
     struct OTPChecker_entry *entries;
+    struct OTPChecker_entry *gen_entries;
     int tw_have;
     BThreadWork tw;
+    uint16_t tw_seed_id;
     uint8_t tw_key[BENCRYPTION_MAX_KEY_SIZE];
     uint8_t tw_iv[BENCRYPTION_MAX_BLOCK_SIZE];
+    int tw_obsolete;
+    int next_have;
+    uint16_t next_seed_id;
+    uint8_t next_key[BENCRYPTION_MAX_KEY_SIZE];
+    uint8_t next_iv[BENCRYPTION_MAX_BLOCK_SIZE];
     DebugObject d_obj;
 } OTPChecker;
 
@@ -109,7 +121,9 @@ void OTPChecker_Free (OTPChecker *mc);
 /**
  * Starts generating OTPs to recognize for a seed.
  * OTPs for this seed will not be recognized until the {@link OTPChecker_handler} handler is called.
- * If OTPs are still being generated for a previous seed, it will be forgotten.
+ * If OTPs are still being generated for a previous seed, it will be forgotten; its
+ * generation is left to finish in the background and its result discarded.
+ * Until the new table is ready, the oldest seed's OTPs are still recognized.
  *
  * @param mc the object
  * @param seed_id seed identifier
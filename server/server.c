@@ -28,6 +28,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
@@ -53,20 +54,25 @@
 #include <misc/loglevel.h>
 #include <misc/loggers_string.h>
 #include <misc/open_standard_streams.h>
-#include <misc/compare.h>
 #include <misc/bsize.h>
+#include <misc/balloc.h>
 #include <predicate/BPredicate.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BArena.h>
 #include <system/BSignal.h>
 #include <system/BTime.h>
 #include <system/BNetwork.h>
 #include <security/BRandom.h>
 #include <nspr_support/DummyPRFileDesc.h>
 #include <threadwork/BThreadWork.h>
+#include <system/BMetricsExporter.h>
+#include <system/BThreadPlacement.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <system/BListenerHandoff.h>
 #endif
 
 #include <server/server.h>
@@ -93,18 +99,42 @@ struct {
     int ssl;
     char *nssdb;
     char *server_cert_name;
+    int ssl_session_cache_size;
+    int ssl_session_timeout;
     char *listen_addrs[MAX_LISTEN_ADDRS];
     int num_listen_addrs;
+    #ifndef BADVPN_USE_WINAPI
+    char *handoff_socket;
+    int handoff_drain_timeout;
+    #endif
     char *comm_predicate;
     char *relay_predicate;
     int client_socket_sndbuf;
+    int client_zerocopy_threshold;
+    int io_threads;
+    int buffer_arena;
+    BThreadPlacement reactor_placement;
+    BThreadPlacement worker_placement;
+    char *avoid_irq_cpus;
+    int reactor_busy_poll_spin_us;
+    int reactor_busy_poll_kernel_us;
+    int reactor_edge_triggered;
     int max_clients;
+    int codel_target;
+    int codel_interval;
+    char *metrics_listen_addr;
+    char *metrics_statsd_addr;
+    int metrics_statsd_interval;
 } options;
 
 // listen addresses
 BAddr listen_addrs[MAX_LISTEN_ADDRS];
 int num_listen_addrs;
 
+// metrics export addresses
+BAddr metrics_listen_addr;
+BAddr metrics_statsd_addr;
+
 // communication predicate
 BPredicate comm_predicate;
 
@@ -138,6 +168,17 @@ BIPAddr relay_predicate_raddr;
 // i/o system
 BReactor ss;
 
+// arena for buffers of objects in ss, if enabled
+BArena ss_arena;
+
+#ifndef BADVPN_USE_WINAPI
+// reactors of I/O threads, if using I/O threads; the first member is ss
+BReactorGroup io_group;
+
+// index of I/O thread to get the next client, minus one
+int io_next;
+#endif
+
 // thread work dispatcher
 BThreadWorkDispatcher twd;
 
@@ -155,17 +196,63 @@ PRFileDesc *model_prfd;
 BListener listeners[MAX_LISTEN_ADDRS];
 int num_listeners;
 
+#ifndef BADVPN_USE_WINAPI
+// handoff socket serving a new server, if options.handoff_socket, until the
+// listeners have been handed over; then the remaining clients are drained,
+// until they are gone or the timer expires
+int have_handoff;
+BListenerHandoff handoff;
+int draining;
+BTimer drain_timer;
+#endif
+
 // number of connected clients
 int clients_num;
 
-// ID assigned to last connected client
-peerid_t clients_nextid;
-
 // clients list
 LinkedList1 clients;
 
-// clients tree (by ID)
-BAVL clients_tree;
+// clients by ID, indexed directly, CLIENT_ID_RANGE entries
+struct client_data **clients_table;
+
+// clients waiting to be paired with other clients; the first one is being
+// paired with published clients starting at publish_cursor
+LinkedList1 publish_queue;
+LinkedList1 published;
+LinkedList1Node *publish_cursor;
+BTimer publish_timer;
+
+// predicate identities, hashed by name and address
+LinkedList1 *ident_buckets;
+uint32_t ident_buckets_mask;
+uint64_t ident_next_serial;
+
+// predicate result caches, direct mapped by pair of identity serials
+struct predicate_cache_entry comm_predicate_cache[PREDICATE_CACHE_SIZE];
+struct predicate_cache_entry relay_predicate_cache[PREDICATE_CACHE_SIZE];
+
+// IDs not in use, a ring starting at free_ids_start holding
+// CLIENT_ID_RANGE - clients_num entries; released IDs go to the back, so an
+// ID is reused only after at least CLIENT_ID_RANGE - max_clients others
+peerid_t *free_ids;
+int free_ids_start;
+
+// header of batches of control packets sent to clients
+struct sc_header batch_prefix = {SCID_BATCH};
+
+// clients whose control batcher is held; released from a zero-delay timer,
+// after the jobs of the current event loop iteration have run
+LinkedList1 control_held_list;
+BTimer control_release_timer;
+
+// metrics, and their exporter if options.metrics_listen_addr or options.metrics_statsd_addr
+BMetric metric_clients;
+BMetric metric_clients_refused;
+BMetric metric_messages;
+BMetric metric_message_bytes;
+BMetric metric_flow_resets;
+int have_metrics_exporter;
+BMetricsExporter metrics_exporter;
 
 // prints help text to standard output
 static void print_help (const char *name);
@@ -184,9 +271,21 @@ static int ssl_flags (void);
 // handler for program termination request
 static void signal_handler (void *unused);
 
+static void init_metrics (void);
+static void free_metrics (void);
+static int64_t metric_clients_func (void *unused);
+
 // listener handler, accepts new clients
 static void listener_handler (BListener *listener);
 
+#ifndef BADVPN_USE_WINAPI
+// handoff handler, passes the listeners to a new server and starts draining
+static void handoff_handler (void *unused);
+
+// drain timer handler, exits after draining for too long
+static void drain_timer_handler (void *unused);
+#endif
+
 // frees resources used by a client
 static void client_dealloc (struct client_data *client);
 
@@ -195,6 +294,13 @@ static int client_compute_buffer_size (struct client_data *client);
 // initializes the I/O porition of the client
 static int client_init_io (struct client_data *client);
 
+// returns the client's socket interfaces, wherever the socket is served
+static StreamPassInterface * client_conn_send_if (struct client_data *client);
+static StreamRecvInterface * client_conn_recv_if (struct client_data *client);
+
+// frees the client's socket
+static void client_free_conn (struct client_data *client);
+
 // deallocates the I/O portion of the client. Must have no outgoing flows.
 static void client_dealloc_io (struct client_data *client);
 
@@ -237,6 +343,15 @@ static int client_send_endclient (struct client_data *client, peerid_t end_id);
 // handler for packets received from the client
 static void client_input_handler_send (struct client_data *client, uint8_t *data, int data_len);
 
+// handler for packets received from the client, when the decoder has several at once
+static void client_input_handler_send_batch (struct client_data *client, struct PacketPassInterface_packet *packets, int num_packets);
+
+// processes a packet from the client, unpacking batches
+static void client_process_input (struct client_data *client, uint8_t *data, int data_len);
+
+// processes a single packet from the client
+static void client_process_packet (struct client_data *client, uint8_t *data, int data_len);
+
 // processes hello packets from clients
 static void process_packet_hello (struct client_data *client, uint8_t *data, int data_len);
 
@@ -284,6 +399,29 @@ static peerid_t new_client_id (void);
 // finds a client by its ID
 static struct client_data * find_client_by_id (peerid_t id);
 
+// queues a client which completed initialization for pairing with other clients
+static void client_publish (struct client_data *client);
+
+// takes a client out of the publish queue or published list
+static void client_unpublish (struct client_data *client);
+
+// pairs queued clients with published clients, a budget at a time
+static void publish_timer_handler (void *unused);
+
+// releases held control batchers
+static void control_release_timer_handler (void *unused);
+
+// pairs a client being published with a published client
+static int publish_pair (struct client_data *client, struct client_data *client2);
+
+// predicate identity management
+static int client_acquire_ident (struct client_data *client);
+static void client_release_ident (struct client_data *client);
+static uint32_t ident_hash (const char *name, BIPAddr *addr);
+
+// looks up and updates a predicate result cache
+static struct predicate_cache_entry * predicate_cache_get (struct predicate_cache_entry *cache, struct client_data *client1, struct client_data *client2);
+
 // checks if two clients are allowed to communicate. May depend on the order
 // of the clients.
 static int clients_allowed (struct client_data *client1, struct client_data *client2);
@@ -316,7 +454,6 @@ static int relay_predicate_func_paddr_cb (void *user, void **args);
 static int relay_predicate_func_raddr_cb (void *user, void **args);
 
 // comparator for peerid_t used in AVL tree
-static int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2);
 
 static struct peer_know * create_know (struct client_data *from, struct client_data *to, int relay_server, int relay_client);
 static void remove_know (struct peer_know *k);
@@ -329,6 +466,13 @@ static int launch_pair (struct peer_flow *flow_to);
 // find flow from a client to some client
 static struct peer_flow * find_flow (struct client_data *client, peerid_t dest_id);
 
+// flow map operations
+static uint32_t peer_flow_map_hash (struct peer_flow_map *m, peerid_t id);
+static void peer_flow_map_init (struct peer_flow_map *m);
+static void peer_flow_map_free (struct peer_flow_map *m);
+static int peer_flow_map_insert (struct peer_flow_map *m, struct peer_flow *flow);
+static void peer_flow_map_remove (struct peer_flow_map *m, struct peer_flow *flow);
+
 int main (int argc, char *argv[])
 {
     if (argc <= 0) {
@@ -409,8 +553,8 @@ int main (int argc, char *argv[])
             goto fail02;
         }
         
-        // initialize server cache
-        if (SSL_ConfigServerSessionIDCache(0, 0, 0, NULL) != SECSuccess) {
+        // initialize server cache, so reconnecting clients can resume their sessions
+        if (SSL_ConfigServerSessionIDCache(options.ssl_session_cache_size, 0, options.ssl_session_timeout, NULL) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_ConfigServerSessionIDCache failed (%d)", (int)PR_GetError());
             goto fail02;
         }
@@ -434,6 +578,13 @@ int main (int argc, char *argv[])
             BLog(BLOG_ERROR, "SSL_ConfigSecureServer failed");
             goto fail05;
         }
+        
+        // issue session tickets, letting clients resume even after their
+        // sessions were evicted from the cache
+        if (SSL_OptionSet(model_prfd, SSL_ENABLE_SESSION_TICKETS, PR_TRUE) != SECSuccess) {
+            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_ENABLE_SESSION_TICKETS) failed");
+            goto fail05;
+        }
     }
     
     // initialize network
@@ -489,9 +640,21 @@ int main (int argc, char *argv[])
         goto fail3;
     }
     
+    // spin for events before sleeping, if asked to
+    BReactor_SetBusyPoll(&ss, options.reactor_busy_poll_spin_us, options.reactor_busy_poll_kernel_us);
+    
+    // register sockets edge-triggered, if asked to
+    BReactor_SetEdgeTriggered(&ss, options.reactor_edge_triggered);
+    
+    // allocate buffers of the reactor's objects from an arena
+    if (options.buffer_arena) {
+        BArena_Init(&ss_arena, options.buffer_arena);
+        BPendingGroup_SetArena(BReactor_PendingGroup(&ss), &ss_arena);
+    }
+    
     // init thread work dispatcher
-    if (!BThreadWorkDispatcher_Init(&twd, &ss, options.threads)) {
-        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+    if (!BThreadWorkDispatcher_Init2(&twd, &ss, options.threads, &options.worker_placement)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init2 failed");
         goto fail3a;
     }
     
@@ -501,32 +664,151 @@ int main (int argc, char *argv[])
         goto fail4;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // start I/O threads; after BSignal_Init so they inherit the blocked signals
+    if (options.io_threads > 0) {
+        if (!BReactorGroup_Init(&io_group, &ss, 1 + options.io_threads, &options.reactor_placement, options.buffer_arena)) {
+            BLog(BLOG_ERROR, "BReactorGroup_Init failed");
+            goto fail5;
+        }
+        io_next = 0;
+    }
+    #endif
+    
+    // place the main reactor; only now so that the threads above don't inherit it
+    BThreadPlacement_Apply(&options.reactor_placement, 0, "reactor");
+    
     // initialize number of clients
     clients_num = 0;
     
-    // first client ID will be zero
-    clients_nextid = 0;
-    
     // initialize clients linked list
     LinkedList1_Init(&clients);
     
-    // initialize clients tree
-    BAVL_Init(&clients_tree, OFFSET_DIFF(struct client_data, id, tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    // allocate clients table
+    if (!(clients_table = (struct client_data **)BAllocArray(CLIENT_ID_RANGE, sizeof(clients_table[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail6;
+    }
+    for (int i = 0; i < CLIENT_ID_RANGE; i++) {
+        clients_table[i] = NULL;
+    }
+    
+    // allocate free IDs, first client ID will be zero
+    if (!(free_ids = (peerid_t *)BAllocArray(CLIENT_ID_RANGE, sizeof(free_ids[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail7;
+    }
+    for (int i = 0; i < CLIENT_ID_RANGE; i++) {
+        free_ids[i] = i;
+    }
+    free_ids_start = 0;
+    
+    // init publishing
+    LinkedList1_Init(&publish_queue);
+    LinkedList1_Init(&published);
+    publish_cursor = NULL;
+    BTimer_Init(&publish_timer, 0, (BTimer_handler)publish_timer_handler, NULL);
+    
+    // init releasing of control batchers
+    LinkedList1_Init(&control_held_list);
+    BTimer_Init(&control_release_timer, 0, (BTimer_handler)control_release_timer_handler, NULL);
+    
+    // init predicate identities and caches
+    ident_buckets = NULL;
+    if (options.comm_predicate || options.relay_predicate) {
+        size_t num_buckets = 1;
+        while (num_buckets < options.max_clients) {
+            num_buckets *= 2;
+        }
+        if (!(ident_buckets = (LinkedList1 *)BAllocArray(num_buckets, sizeof(ident_buckets[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail8;
+        }
+        for (size_t i = 0; i < num_buckets; i++) {
+            LinkedList1_Init(&ident_buckets[i]);
+        }
+        ident_buckets_mask = num_buckets - 1;
+    }
+    ident_next_serial = 1;
+    memset(comm_predicate_cache, 0, sizeof(comm_predicate_cache));
+    memset(relay_predicate_cache, 0, sizeof(relay_predicate_cache));
     
     // initialize listeners
     num_listeners = 0;
+    
+    #ifndef BADVPN_USE_WINAPI
+    // take over the listeners of a running server, which then stops
+    // accepting and drains its clients
+    int handoff_fds[BLISTENERHANDOFF_MAX_FDS];
+    int handoff_num_fds = 0;
+    if (options.handoff_socket) {
+        if (!BListenerHandoff_Receive(options.handoff_socket, handoff_fds, &handoff_num_fds)) {
+            BLog(BLOG_ERROR, "BListenerHandoff_Receive failed");
+            goto fail10;
+        }
+    }
+    #endif
+    
     while (num_listeners < num_listen_addrs) {
-        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
-            BLog(BLOG_ERROR, "BListener_Init failed");
+        struct BLisCon_from from = BLisCon_from_addr(listen_addrs[num_listeners]);
+        #ifndef BADVPN_USE_WINAPI
+        int fd = BListenerHandoff_TakeAddr(handoff_fds, &handoff_num_fds, listen_addrs[num_listeners]);
+        if (fd >= 0) {
+            from = BLisCon_from_fd(fd, NULL);
+        }
+        #endif
+        if (!BListener_InitFrom(&listeners[num_listeners], from, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "BListener_InitFrom failed");
             goto fail10;
         }
         num_listeners++;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // close sockets handed over which are no longer listened on
+    if (handoff_num_fds > 0) {
+        BLog(BLOG_WARNING, "closing %d handed over sockets not listened on", handoff_num_fds);
+        BListenerHandoff_CloseFds(handoff_fds, handoff_num_fds);
+        handoff_num_fds = 0;
+    }
+    #endif
+    
+    // init metrics
+    init_metrics();
+    
+    // init metrics exporter
+    have_metrics_exporter = (options.metrics_listen_addr || options.metrics_statsd_addr);
+    if (have_metrics_exporter) {
+        if (!BMetricsExporter_Init(&metrics_exporter, &ss, !!options.metrics_listen_addr, metrics_listen_addr,
+                                   !!options.metrics_statsd_addr, metrics_statsd_addr, options.metrics_statsd_interval)) {
+            BLog(BLOG_ERROR, "BMetricsExporter_Init failed");
+            goto fail11;
+        }
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // serve the handoff socket, for the next server to take over
+    have_handoff = 0;
+    draining = 0;
+    BTimer_Init(&drain_timer, options.handoff_drain_timeout, drain_timer_handler, NULL);
+    if (options.handoff_socket) {
+        if (!BListenerHandoff_Init(&handoff, options.handoff_socket, &ss, NULL, handoff_handler)) {
+            BLog(BLOG_ERROR, "BListenerHandoff_Init failed");
+            goto fail12;
+        }
+        have_handoff = 1;
+    }
+    #endif
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+    #ifndef BADVPN_USE_WINAPI
+    // freeing the clients below is not the end of draining
+    draining = 0;
+    #endif
+    
     // free clients
     LinkedList1Node *node;
     while (node = LinkedList1_GetFirst(&clients)) {
@@ -562,16 +844,51 @@ int main (int argc, char *argv[])
         // deallocate client
         client_dealloc(client);
     }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // free handoff
+    BReactor_RemoveTimer(&ss, &drain_timer);
+    if (have_handoff) {
+        BListenerHandoff_Free(&handoff);
+    }
+fail12:
+    #endif
+    // free metrics exporter
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+    }
+fail11:
+    // free metrics
+    free_metrics();
 fail10:
     while (num_listeners > 0) {
         num_listeners--;
         BListener_Free(&listeners[num_listeners]);
     }
-    
+    #ifndef BADVPN_USE_WINAPI
+    BListenerHandoff_CloseFds(handoff_fds, handoff_num_fds);
+    #endif
+    BFree(ident_buckets);
+    BReactor_RemoveTimer(&ss, &control_release_timer);
+    BReactor_RemoveTimer(&ss, &publish_timer);
+fail8:
+    BFree(free_ids);
+fail7:
+    BFree(clients_table);
+fail6:
+    #ifndef BADVPN_USE_WINAPI
+    if (options.io_threads > 0) {
+        BReactorGroup_Free(&io_group);
+    }
+fail5:
+    #endif
     BSignal_Finish();
 fail4:
     BThreadWorkDispatcher_Free(&twd);
 fail3a:
+    if (options.buffer_arena) {
+        BArena_Free(&ss_arena);
+    }
     BReactor_Free(&ss);
 fail3:
     if (options.relay_predicate) {
@@ -632,11 +949,32 @@ void print_help (const char *name)
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
         "        [--listen-addr <addr>] ...\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--handoff-socket <socket path> [--handoff-drain-timeout <ms / 0>]]\n"
+        #endif
         "        [--ssl --nssdb <string> --server-cert-name <string>]\n"
+        "        [--ssl-session-cache-size <entries / 0>]\n"
+        "        [--ssl-session-timeout <seconds / 0>]\n"
         "        [--comm-predicate <string>]\n"
         "        [--relay-predicate <string>]\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--client-zerocopy-threshold <bytes / 0>]\n"
+        "        [--io-threads <number / 0>]\n"
+        #endif
+        "        [--buffer-arena <normal/thp/hugetlb>]\n"
+        "        [--reactor-cpus <cpu list>]\n"
+        "        [--reactor-sched <nice:N / fifo:P>]\n"
+        "        [--worker-cpus <cpu list>]\n"
+        "        [--worker-sched <nice:N / fifo:P>]\n"
+        "        [--avoid-irq-cpus <ifname>]\n"
+        "        [--reactor-busy-poll <spin microseconds / 0> <kernel microseconds / 0>]\n"
+        "        [--reactor-edge-triggered]\n"
         "        [--max-clients <number>]\n"
+        "        [--codel-target <ms>]\n"
+        "        [--codel-interval <ms>]\n"
+        "        [--metrics-listen-addr <addr>]\n"
+        "        [--metrics-statsd-addr <addr> [--metrics-statsd-interval <ms>]]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -666,11 +1004,36 @@ int parse_arguments (int argc, char *argv[])
     options.ssl = 0;
     options.nssdb = NULL;
     options.server_cert_name = NULL;
+    options.ssl_session_cache_size = 0;
+    options.ssl_session_timeout = 0;
     options.num_listen_addrs = 0;
+    #ifndef BADVPN_USE_WINAPI
+    options.handoff_socket = NULL;
+    options.handoff_drain_timeout = DEFAULT_HANDOFF_DRAIN_TIMEOUT;
+    #endif
     options.comm_predicate = NULL;
     options.relay_predicate = NULL;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SNDBUF;
+    options.client_zerocopy_threshold = 0;
+    options.io_threads = 0;
+    options.buffer_arena = 0;
+    BThreadPlacement_Init(&options.reactor_placement);
+    BThreadPlacement_Init(&options.worker_placement);
+    options.avoid_irq_cpus = NULL;
+    options.reactor_busy_poll_spin_us = 0;
+    options.reactor_busy_poll_kernel_us = 0;
+    options.reactor_edge_triggered = 0;
     options.max_clients = DEFAULT_MAX_CLIENTS;
+    options.codel_target = 0;
+    options.codel_interval = CLIENT_DEFAULT_CODEL_INTERVAL;
+    options.metrics_listen_addr = NULL;
+    options.metrics_statsd_addr = NULL;
+    options.metrics_statsd_interval = BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL;
+    
+    int have_metrics_statsd_interval = 0;
+    #ifndef BADVPN_USE_WINAPI
+    int have_handoff_drain_timeout = 0;
+    #endif
     
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -780,6 +1143,28 @@ int parse_arguments (int argc, char *argv[])
             options.server_cert_name = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--ssl-session-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.ssl_session_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--ssl-session-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.ssl_session_timeout = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--listen-addr")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -793,6 +1178,28 @@ int parse_arguments (int argc, char *argv[])
             options.num_listen_addrs++;
             i++;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--handoff-socket")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.handoff_socket = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--handoff-drain-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.handoff_drain_timeout = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_handoff_drain_timeout = 1;
+            i++;
+        }
+        #endif
         else if (!strcmp(arg, "--comm-predicate")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -820,15 +1227,150 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--client-zerocopy-threshold")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_zerocopy_threshold = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--io-threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.io_threads = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--buffer-arena")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BArena_ParsePages(argv[i + 1], &options.buffer_arena)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-cpus") || !strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            BThreadPlacement *placement = (arg[2] == 'r' ? &options.reactor_placement : &options.worker_placement);
+            if (!BThreadPlacement_ParseCpus(placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-sched") || !strcmp(arg, "--worker-sched")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            BThreadPlacement *placement = (arg[2] == 'r' ? &options.reactor_placement : &options.worker_placement);
+            if (!BThreadPlacement_ParseSched(placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--avoid-irq-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.avoid_irq_cpus = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-busy-poll")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_spin_us = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_kernel_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-edge-triggered")) {
+            options.reactor_edge_triggered = 1;
+        }
         else if (!strcmp(arg, "--max-clients")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.max_clients = atoi(argv[i + 1])) <= 0) {
+            if ((options.max_clients = atoi(argv[i + 1])) <= 0 || options.max_clients > CLIENT_ID_RANGE) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.codel_target = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--codel-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.codel_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_statsd_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.metrics_statsd_interval = atoi(argv[i + 1])) <= 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
+            have_metrics_statsd_interval = 1;
             i++;
         }
         else {
@@ -851,6 +1393,30 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if ((options.ssl_session_cache_size > 0 || options.ssl_session_timeout > 0) && !options.ssl) {
+        fprintf(stderr, "--ssl-session-cache-size and --ssl-session-timeout require --ssl\n");
+        return 0;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.io_threads > 0 && options.client_zerocopy_threshold > 0) {
+        fprintf(stderr, "--io-threads and --client-zerocopy-threshold cannot be used together\n");
+        return 0;
+    }
+    #endif
+    
+    if (have_metrics_statsd_interval && !options.metrics_statsd_addr) {
+        fprintf(stderr, "--metrics-statsd-interval requires --metrics-statsd-addr\n");
+        return 0;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (have_handoff_drain_timeout && !options.handoff_socket) {
+        fprintf(stderr, "--handoff-drain-timeout requires --handoff-socket\n");
+        return 0;
+    }
+    #endif
+    
     return 1;
 }
 
@@ -866,6 +1432,28 @@ int process_arguments (void)
         num_listen_addrs++;
     }
     
+    // resolve metrics addresses
+    if (options.metrics_listen_addr) {
+        if (!BAddr_Parse(&metrics_listen_addr, options.metrics_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics listen addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    if (options.metrics_statsd_addr) {
+        if (!BAddr_Parse(&metrics_statsd_addr, options.metrics_statsd_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics statsd addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    
+    // keep crypto workers off the CPUs handling the network interrupts
+    if (options.avoid_irq_cpus) {
+        if (!BThreadPlacement_AvoidIrqCpus(&options.worker_placement, options.avoid_irq_cpus)) {
+            BLog(BLOG_ERROR, "avoid IRQ CPUs: BThreadPlacement_AvoidIrqCpus failed");
+            return 0;
+        }
+    }
+    
     return 1;
 }
 
@@ -889,10 +1477,98 @@ void signal_handler (void *unused)
     BReactor_Quit(&ss, 0);
 }
 
+void init_metrics (void)
+{
+    BMetric_InitGaugeFunc(&metric_clients, "badvpn_server_clients", NULL, "Connected clients.", metric_clients_func, NULL);
+    BMetric_InitCounter(&metric_clients_refused, "badvpn_server_clients_refused_total", NULL, "Connections refused because of --max-clients.");
+    BMetric_InitCounter(&metric_messages, "badvpn_server_messages_total", NULL, "Messages relayed between clients.");
+    BMetric_InitCounter(&metric_message_bytes, "badvpn_server_message_bytes_total", NULL, "Payload bytes of messages relayed between clients.");
+    BMetric_InitCounter(&metric_flow_resets, "badvpn_server_flow_resets_total", NULL, "Peer flows reset because their buffer was full.");
+}
+
+void free_metrics (void)
+{
+    BMetric_Free(&metric_flow_resets);
+    BMetric_Free(&metric_message_bytes);
+    BMetric_Free(&metric_messages);
+    BMetric_Free(&metric_clients_refused);
+    BMetric_Free(&metric_clients);
+}
+
+int64_t metric_clients_func (void *unused)
+{
+    return clients_num;
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void handoff_handler (void *unused)
+{
+    ASSERT(have_handoff)
+    ASSERT(!draining)
+    
+    // pass the listening sockets
+    int fds[MAX_LISTEN_ADDRS];
+    for (int i = 0; i < num_listeners; i++) {
+        fds[i] = BListener_GetFd(&listeners[i]);
+    }
+    if (!BListenerHandoff_Send(&handoff, fds, num_listeners)) {
+        BLog(BLOG_ERROR, "handoff: BListenerHandoff_Send failed");
+        
+        // the new server gives up; wait for another one
+        BListenerHandoff_Free(&handoff);
+        if (!BListenerHandoff_Init(&handoff, options.handoff_socket, &ss, NULL, handoff_handler)) {
+            BLog(BLOG_ERROR, "handoff: BListenerHandoff_Init failed");
+            have_handoff = 0;
+        }
+        return;
+    }
+    
+    // stop accepting clients
+    while (num_listeners > 0) {
+        num_listeners--;
+        BListener_Free(&listeners[num_listeners]);
+    }
+    
+    // release the metrics address
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+        have_metrics_exporter = 0;
+    }
+    
+    // let the new server bind what it needs
+    BListenerHandoff_Free(&handoff);
+    have_handoff = 0;
+    
+    // drain clients
+    draining = 1;
+    if (clients_num == 0) {
+        BLog(BLOG_NOTICE, "handoff: no clients, exiting");
+        BReactor_Quit(&ss, 0);
+        return;
+    }
+    BLog(BLOG_NOTICE, "handoff: draining %d clients", clients_num);
+    if (options.handoff_drain_timeout > 0) {
+        BReactor_SetTimer(&ss, &drain_timer);
+    }
+}
+
+void drain_timer_handler (void *unused)
+{
+    ASSERT(draining)
+    
+    BLog(BLOG_NOTICE, "handoff: drain timeout, exiting with %d clients", clients_num);
+    
+    BReactor_Quit(&ss, 0);
+}
+
+#endif
+
 void listener_handler (BListener *listener)
 {
     if (clients_num == options.max_clients) {
         BLog(BLOG_WARNING, "too many clients for new client");
+        BMetric_Add(&metric_clients_refused, 1);
         goto fail0;
     }
     
@@ -916,6 +1592,29 @@ void listener_handler (BListener *listener)
         }
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // send large writes without copying
+    if (options.client_zerocopy_threshold > 0) {
+        if (!BConnection_SetZeroCopy(&client->con, options.client_zerocopy_threshold)) {
+            BLog(BLOG_WARNING, "BConnection_SetZeroCopy failed");
+        }
+    }
+    #endif
+    
+    #ifndef BADVPN_USE_WINAPI
+    // hand the socket to an I/O thread; the rest of the client stays here
+    if (options.io_threads > 0) {
+        int fd = BConnection_ReleaseFd(&client->con);
+        BReactorGroupMember *shard = BReactorGroup_GetMember(&io_group, 1 + io_next);
+        io_next = (io_next + 1) % options.io_threads;
+        
+        if (!BShardConnection_Init(&client->shardcon, fd, BReactorGroup_GetMember(&io_group, 0), shard, client, (BConnection_handler)client_connection_handler)) {
+            BLog(BLOG_ERROR, "BShardConnection_Init failed");
+            goto fail1;
+        }
+    }
+    #endif
+    
     // assign ID
     client->id = new_client_id();
     
@@ -925,12 +1624,14 @@ void listener_handler (BListener *listener)
     // now client_log() works
     
     // init connection interfaces
-    BConnection_SendAsync_Init(&client->con);
-    BConnection_RecvAsync_Init(&client->con);
+    if (!options.io_threads) {
+        BConnection_SendAsync_Init(&client->con);
+        BConnection_RecvAsync_Init(&client->con);
+    }
     
     if (options.ssl) {
         // create bottom NSPR file descriptor
-        if (!BSSLConnection_MakeBackend(&client->bottom_prfd, BConnection_SendAsync_GetIf(&client->con), BConnection_RecvAsync_GetIf(&client->con), &twd, ssl_flags())) {
+        if (!BSSLConnection_MakeBackend(&client->bottom_prfd, client_conn_send_if(client), client_conn_recv_if(client), &twd, ssl_flags())) {
             client_log(client, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
             goto fail2;
         }
@@ -971,18 +1672,24 @@ void listener_handler (BListener *listener)
     BTimer_Init(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT, (BTimer_handler)client_disconnect_timer_handler, client);
     BReactor_SetTimer(&ss, &client->disconnect_timer);
     
-    // link in
+    // link in, taking the ID from the free IDs
+    ASSERT(free_ids[free_ids_start] == client->id)
+    free_ids_start = (free_ids_start + 1) % CLIENT_ID_RANGE;
+    clients_table[client->id] = client;
     clients_num++;
     LinkedList1_Append(&clients, &client->list_node);
-    ASSERT_EXECUTE(BAVL_Insert(&clients_tree, &client->tree_node, NULL))
     
     // init knowledge lists
     LinkedList1_Init(&client->know_out_list);
     LinkedList1_Init(&client->know_in_list);
     
-    // initialize peer flows from us list and tree (flows for sending messages to other clients)
+    // initialize peer flows from us list and map (flows for sending messages to other clients)
     LinkedList1_Init(&client->peer_out_flows_list);
-    BAVL_Init(&client->peer_out_flows_tree, OFFSET_DIFF(struct peer_flow, dest_client_id, src_tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    peer_flow_map_init(&client->peer_out_flows_map);
+    
+    // no predicate identity, not published
+    client->ident = NULL;
+    client->publish_state = PUBLISHSTATE_NONE;
     
     // init dying
     client->dying = 0;
@@ -1000,9 +1707,7 @@ fail3:
         ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
     }
 fail2:
-    BConnection_RecvAsync_Free(&client->con);
-    BConnection_SendAsync_Free(&client->con);
-    BConnection_Free(&client->con);
+    client_free_conn(client);
 fail1:
     free(client);
 fail0:
@@ -1020,27 +1725,86 @@ void client_dealloc (struct client_data *client)
         client_dealloc_io(client);
     }
     
+    // stop publishing
+    client_unpublish(client);
+    
+    // release predicate identity
+    if (client->ident) {
+        client_release_ident(client);
+    }
+    
     // free dying
     BPending_Free(&client->dying_job);
     
-    // link out
-    BAVL_Remove(&clients_tree, &client->tree_node);
+    // free flow map
+    peer_flow_map_free(&client->peer_out_flows_map);
+    
+    // link out, releasing the ID to the back of the free IDs
     LinkedList1_Remove(&clients, &client->list_node);
+    clients_table[client->id] = NULL;
+    free_ids[(free_ids_start + (CLIENT_ID_RANGE - clients_num)) % CLIENT_ID_RANGE] = client->id;
     clients_num--;
     
+    #ifndef BADVPN_USE_WINAPI
+    // done draining once the last client is gone
+    if (draining && clients_num == 0) {
+        BLog(BLOG_NOTICE, "handoff: all clients gone, exiting");
+        BReactor_Quit(&ss, 0);
+    }
+    #endif
+    
     // stop disconnect timer
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
     
-    // free SSL
-    if (options.ssl) {
-        BSSLConnection_Free(&client->sslcon);
-        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    // free SSL
+    if (options.ssl) {
+        BSSLConnection_Free(&client->sslcon);
+        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    }
+    
+    // free common name
+    if (client->common_name) {
+        PORT_Free(client->common_name);
+    }
+    
+    // free connection
+    client_free_conn(client);
+    
+    // free memory
+    free(client);
+}
+
+StreamPassInterface * client_conn_send_if (struct client_data *client)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.io_threads > 0) {
+        return BShardConnection_GetSendIf(&client->shardcon);
+    }
+    #endif
+    
+    return BConnection_SendAsync_GetIf(&client->con);
+}
+
+StreamRecvInterface * client_conn_recv_if (struct client_data *client)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.io_threads > 0) {
+        return BShardConnection_GetRecvIf(&client->shardcon);
     }
+    #endif
     
-    // free common name
-    if (client->common_name) {
-        PORT_Free(client->common_name);
+    return BConnection_RecvAsync_GetIf(&client->con);
+}
+
+void client_free_conn (struct client_data *client)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.io_threads > 0) {
+        // the I/O thread closes the socket
+        BShardConnection_Free(&client->shardcon);
+        return;
     }
+    #endif
     
     // free connection interfaces
     BConnection_RecvAsync_Free(&client->con);
@@ -1048,9 +1812,6 @@ void client_dealloc (struct client_data *client)
     
     // free connection
     BConnection_Free(&client->con);
-    
-    // free memory
-    free(client);
 }
 
 int client_compute_buffer_size (struct client_data *client)
@@ -1066,26 +1827,32 @@ int client_compute_buffer_size (struct client_data *client)
 
 int client_init_io (struct client_data *client)
 {
-    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
-    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : BConnection_RecvAsync_GetIf(&client->con));
+    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : client_conn_send_if(client));
+    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : client_conn_recv_if(client));
     
     // init input
     
     // init interface
     PacketPassInterface_Init(&client->input_interface, SC_MAX_ENC, (PacketPassInterface_handler_send)client_input_handler_send, client, BReactor_PendingGroup(&ss));
     
+    // take all packets decoded from one read at once
+    PacketPassInterface_EnableBatch(&client->input_interface, (PacketPassInterface_handler_send_batch)client_input_handler_send_batch);
+    
     // init decoder
-    if (!PacketProtoDecoder_Init(&client->input_decoder, recv_if, &client->input_interface, BReactor_PendingGroup(&ss), client,
+    if (!PacketProtoDecoder_Init2(&client->input_decoder, recv_if, &client->input_interface, CLIENT_RECV_BUFFER_SIZE, BReactor_PendingGroup(&ss), client,
         (PacketProtoDecoder_handler_error)client_decoder_handler_error
     )) {
-        client_log(client, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        client_log(client, BLOG_ERROR, "PacketProtoDecoder_Init2 failed");
         goto fail1;
     }
     
     // init output common
     
     // init sender
-    PacketStreamSender_Init(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(&ss));
+    if (!PacketStreamSender_Init2(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), CLIENT_SEND_COALESCE_SIZE, BReactor_PendingGroup(&ss))) {
+        client_log(client, BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail1a;
+    }
     
     // init queue
     PacketPassPriorityQueue_Init(&client->output_priorityqueue, PacketStreamSender_GetInput(&client->output_sender), BReactor_PendingGroup(&ss), 0);
@@ -1095,16 +1862,27 @@ int client_init_io (struct client_data *client)
     // init queue flow
     PacketPassPriorityQueueFlow_Init(&client->output_control_qflow, &client->output_priorityqueue, -1);
     
+    // init batcher; enabled once the client's version is known to support batches
+    if (!PacketProtoBatcher_Init(
+        &client->output_control_batcher, PacketPassPriorityQueueFlow_GetInput(&client->output_control_qflow),
+        PACKETPROTO_ENCLEN(SC_MAX_ENC), (uint8_t *)&batch_prefix, sizeof(batch_prefix), PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(&ss)
+    )) {
+        client_log(client, BLOG_ERROR, "PacketProtoBatcher_Init failed");
+        goto fail2;
+    }
+    
     // init PacketProtoFlow
     if (!PacketProtoFlow_Init(
         &client->output_control_oflow, SC_MAX_ENC, client_compute_buffer_size(client),
-        PacketPassPriorityQueueFlow_GetInput(&client->output_control_qflow), BReactor_PendingGroup(&ss)
+        PacketProtoBatcher_GetInput(&client->output_control_batcher), BReactor_PendingGroup(&ss)
     )) {
         client_log(client, BLOG_ERROR, "PacketProtoFlow_Init failed");
-        goto fail2;
+        goto fail2a;
     }
     client->output_control_input = PacketProtoFlow_GetInput(&client->output_control_oflow);
     client->output_control_packet_len = -1;
+    client->output_control_batching = 0;
+    client->output_control_held = 0;
     
     // init output peers flow
     
@@ -1126,12 +1904,15 @@ int client_init_io (struct client_data *client)
 fail3:
     PacketPassPriorityQueueFlow_Free(&client->output_peers_qflow);
     PacketProtoFlow_Free(&client->output_control_oflow);
+fail2a:
+    PacketProtoBatcher_Free(&client->output_control_batcher);
 fail2:
     PacketPassPriorityQueueFlow_Free(&client->output_control_qflow);
     // free output common
     PacketPassPriorityQueue_Free(&client->output_priorityqueue);
     PacketStreamSender_Free(&client->output_sender);
     // free input
+fail1a:
     PacketProtoDecoder_Free(&client->input_decoder);
 fail1:
     PacketPassInterface_Free(&client->input_interface);
@@ -1164,7 +1945,11 @@ void client_dealloc_io (struct client_data *client)
     PacketPassPriorityQueueFlow_Free(&client->output_peers_qflow);
     
     // free output control flow
+    if (client->output_control_held) {
+        LinkedList1_Remove(&control_held_list, &client->output_control_held_node);
+    }
     PacketProtoFlow_Free(&client->output_control_oflow);
+    PacketProtoBatcher_Free(&client->output_control_batcher);
     PacketPassPriorityQueueFlow_Free(&client->output_control_qflow);
     
     // free output common
@@ -1185,6 +1970,9 @@ void client_remove (struct client_data *client)
     // set dying to prevent sending this client anything
     client->dying = 1;
     
+    // stop pairing it with other clients
+    client_unpublish(client);
+    
     // free I/O now, removing incoming flows
     if (client->initstatus >= INITSTATUS_WAITHELLO) {
         client_dealloc_io(client);
@@ -1422,6 +2210,17 @@ void client_end_control_packet (struct client_data *client, uint8_t type)
     BufferWriter_EndPacket(client->output_control_input, sizeof(struct sc_header) + client->output_control_packet_len);
     
     client->output_control_packet_len = -1;
+    
+    // control packets are mostly sent from separate jobs (e.g. informing of
+    // many peers); collect those of this event loop iteration into batches
+    if (client->output_control_batching && !client->output_control_held) {
+        PacketProtoBatcher_Hold(&client->output_control_batcher);
+        client->output_control_held = 1;
+        LinkedList1_Append(&control_held_list, &client->output_control_held_node);
+        if (!BTimer_IsRunning(&control_release_timer)) {
+            BReactor_SetTimerAfter(&ss, &control_release_timer, 0);
+        }
+    }
 }
 
 int client_send_newclient (struct client_data *client, struct client_data *nc, int relay_server, int relay_client)
@@ -1492,9 +2291,87 @@ void client_input_handler_send (struct client_data *client, uint8_t *data, int d
     // accept packet
     PacketPassInterface_Done(&client->input_interface);
     
+    client_process_input(client, data, data_len);
+}
+
+void client_input_handler_send_batch (struct client_data *client, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    ASSERT(num_packets > 0)
+    ASSERT(INITSTATUS_HASLINK(client->initstatus))
+    ASSERT(!client->dying)
+    
+    // accept packets
+    PacketPassInterface_Done(&client->input_interface);
+    
+    for (int i = 0; i < num_packets; i++) {
+        client_process_input(client, packets[i].data, packets[i].len);
+        
+        // removing the client frees the decoder along with the packets
+        if (client->dying) {
+            return;
+        }
+    }
+}
+
+void client_process_input (struct client_data *client, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= SC_MAX_ENC)
+    ASSERT(INITSTATUS_HASLINK(client->initstatus))
+    ASSERT(!client->dying)
+    
     // restart disconnect timer
     BReactor_SetTimer(&ss, &client->disconnect_timer);
     
+    // a batch carries PacketProto-encoded packets after its header
+    if (sc_is_batch(data, data_len)) {
+        if (client->initstatus != INITSTATUS_COMPLETE || client->version <= SC_OLDVERSION_NOBATCH) {
+            client_log(client, BLOG_NOTICE, "batch: not expected");
+            client_remove(client);
+            return;
+        }
+        
+        data += sizeof(struct sc_header);
+        data_len -= sizeof(struct sc_header);
+        
+        while (data_len > 0) {
+            struct packetproto_header pp;
+            if (data_len < sizeof(pp)) {
+                client_log(client, BLOG_NOTICE, "batch: missing packet header");
+                client_remove(client);
+                return;
+            }
+            memcpy(&pp, data, sizeof(pp));
+            data += sizeof(pp);
+            data_len -= sizeof(pp);
+            int len = ltoh16(pp.len);
+            if (len > data_len) {
+                client_log(client, BLOG_NOTICE, "batch: packet too long");
+                client_remove(client);
+                return;
+            }
+            
+            client_process_packet(client, data, len);
+            if (client->dying) {
+                return;
+            }
+            
+            data += len;
+            data_len -= len;
+        }
+        return;
+    }
+    
+    client_process_packet(client, data, data_len);
+}
+
+void client_process_packet (struct client_data *client, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= SC_MAX_ENC)
+    ASSERT(INITSTATUS_HASLINK(client->initstatus))
+    ASSERT(!client->dying)
+    
     // parse header
     if (data_len < sizeof(struct sc_header)) {
         client_log(client, BLOG_NOTICE, "packet too short");
@@ -1554,6 +2431,7 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     
     switch (client->version) {
         case SC_VERSION:
+        case SC_OLDVERSION_NOBATCH:
         case SC_OLDVERSION_NOSSL:
         case SC_OLDVERSION_BROKENCERT:
             break;
@@ -1568,35 +2446,10 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     // set client state to complete
     client->initstatus = INITSTATUS_COMPLETE;
     
-    // publish client
-    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&clients); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, list_node);
-        if (client2 == client || client2->initstatus != INITSTATUS_COMPLETE || client2->dying || !clients_allowed(client, client2)) {
-            continue;
-        }
-        
-        // create flow from client to client2
-        struct peer_flow *flow_to = peer_flow_create(client, client2);
-        if (!flow_to) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // create flow from client2 to client
-        struct peer_flow *flow_from = peer_flow_create(client2, client);
-        if (!flow_from) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // set opposite flow pointers
-        flow_to->opposite = flow_from;
-        flow_from->opposite = flow_to;
-        
-        // launch pair
-        if (!launch_pair(flow_to)) {
-            return;
-        }
+    // get predicate identity
+    if ((options.comm_predicate || options.relay_predicate) && !client_acquire_ident(client)) {
+        client_log(client, BLOG_ERROR, "failed to allocate predicate identity");
+        goto fail;
     }
     
     // send hello
@@ -1611,6 +2464,15 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     memcpy(pack, &omsg, sizeof(omsg));
     client_end_control_packet(client, SCID_SERVERHELLO);
     
+    // coalesce further control packets if the client can take batches
+    if (client->version > SC_OLDVERSION_NOBATCH) {
+        PacketProtoBatcher_Enable(&client->output_control_batcher);
+        client->output_control_batching = 1;
+    }
+    
+    // pair with other clients, spread over event loop iterations
+    client_publish(client);
+    
     return;
     
 fail:
@@ -1679,6 +2541,7 @@ void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_
     if (!peer_flow_start_packet(flow, &pack, sizeof(omsg) + payload_size)) {
         // out of buffer, reset these two clients
         client_log(client, BLOG_WARNING, "out of buffer; resetting to %d", (int)flow->dest_client->id);
+        BMetric_Add(&metric_flow_resets, 1);
         peer_flow_start_reset(flow);
         return;
     }
@@ -1686,6 +2549,9 @@ void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_
     memcpy(pack, &omsg, sizeof(omsg));
     memcpy((char *)pack + sizeof(omsg), payload, payload_size);
     peer_flow_end_packet(flow, SCID_INMSG);
+    
+    BMetric_Add(&metric_messages, 1);
+    BMetric_Add(&metric_message_bytes, payload_size);
 }
 
 void process_packet_resetpeer (struct client_data *client, uint8_t *data, int data_len)
@@ -1800,9 +2666,14 @@ struct peer_flow * peer_flow_create (struct client_data *src_client, struct clie
     flow->dest_client = dest_client;
     flow->dest_client_id = dest_client->id;
     
-    // add to source list and tree
+    // add to source map
+    if (!peer_flow_map_insert(&flow->src_client->peer_out_flows_map, flow)) {
+        BLog(BLOG_ERROR, "peer_flow_map_insert failed");
+        goto fail1;
+    }
+    
+    // add to source list
     LinkedList1_Append(&flow->src_client->peer_out_flows_list, &flow->src_list_node);
-    ASSERT_EXECUTE(BAVL_Insert(&flow->src_client->peer_out_flows_tree, &flow->src_tree_node, NULL))
     
     // add to destination client list
     LinkedList1_Append(&flow->dest_client->output_peers_flows, &flow->dest_list_node);
@@ -1815,6 +2686,8 @@ struct peer_flow * peer_flow_create (struct client_data *src_client, struct clie
     
     return flow;
     
+fail1:
+    free(flow);
 fail0:
     return NULL;
 }
@@ -1834,9 +2707,9 @@ void peer_flow_dealloc (struct peer_flow *flow)
     // remove from destination client list
     LinkedList1_Remove(&flow->dest_client->output_peers_flows, &flow->dest_list_node);
     
-    // remove from source list and hash table
+    // remove from source list and map
     if (flow->src_client) {
-        BAVL_Remove(&flow->src_client->peer_out_flows_tree, &flow->src_tree_node);
+        peer_flow_map_remove(&flow->src_client->peer_out_flows_map, flow);
         LinkedList1_Remove(&flow->src_client->peer_out_flows_list, &flow->src_list_node);
     }
     
@@ -1859,6 +2732,13 @@ int peer_flow_init_io (struct peer_flow *flow)
         BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
         goto fail1;
     }
+    
+    // drop packets which have been waiting too long
+    if (options.codel_target > 0 && !PacketProtoFlow_EnableCoDel(&flow->oflow, options.codel_target, options.codel_interval)) {
+        BLog(BLOG_ERROR, "PacketProtoFlow_EnableCoDel failed");
+        goto fail2;
+    }
+    
     flow->input = PacketProtoFlow_GetInput(&flow->oflow);
     
     // set no packet
@@ -1869,6 +2749,8 @@ int peer_flow_init_io (struct peer_flow *flow)
     
     return 1;
     
+fail2:
+    PacketProtoFlow_Free(&flow->oflow);
 fail1:
     PacketPassFairQueueFlow_Free(&flow->qflow);
     return 0;
@@ -1879,6 +2761,12 @@ void peer_flow_free_io (struct peer_flow *flow)
     ASSERT(flow->have_io)
     PacketPassFairQueueFlow_AssertFree(&flow->qflow);
     
+    // report CoDel drops
+    uint64_t codel_drops = PacketProtoFlow_GetCoDelDrops(&flow->oflow);
+    if (codel_drops > 0) {
+        client_log(flow->dest_client, BLOG_INFO, "CoDel dropped %"PRIu64" packets of a flow to this client", codel_drops);
+    }
+    
     // free PacketProtoFlow
     PacketProtoFlow_Free(&flow->oflow);
     
@@ -1900,8 +2788,8 @@ void peer_flow_disconnect (struct peer_flow *flow)
     // stop reset timer
     BReactor_RemoveTimer(&ss, &flow->reset_timer);
     
-    // remove from source list and hash table
-    BAVL_Remove(&flow->src_client->peer_out_flows_tree, &flow->src_tree_node);
+    // remove from source list and map
+    peer_flow_map_remove(&flow->src_client->peer_out_flows_map, flow);
     LinkedList1_Remove(&flow->src_client->peer_out_flows_list, &flow->src_list_node);
     
     // set no source
@@ -2076,25 +2964,249 @@ peerid_t new_client_id (void)
 {
     ASSERT(clients_num < options.max_clients)
     
-    for (int i = 0; i < options.max_clients; i++) {
-        peerid_t id = clients_nextid++;
-        if (!find_client_by_id(id)) {
-            return id;
+    // the ID is taken from the free IDs when the client is linked in
+    peerid_t id = free_ids[free_ids_start];
+    ASSERT(!find_client_by_id(id))
+    
+    return id;
+}
+
+struct client_data * find_client_by_id (peerid_t id)
+{
+    ASSERT(id < CLIENT_ID_RANGE)
+    
+    return clients_table[id];
+}
+
+void client_publish (struct client_data *client)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    ASSERT(client->publish_state == PUBLISHSTATE_NONE)
+    
+    // start pairing if nobody else is being paired
+    if (LinkedList1_IsEmpty(&publish_queue)) {
+        publish_cursor = LinkedList1_GetFirst(&published);
+        BReactor_SetTimerAfter(&ss, &publish_timer, 0);
+    }
+    
+    LinkedList1_Append(&publish_queue, &client->publish_node);
+    client->publish_state = PUBLISHSTATE_QUEUED;
+}
+
+void client_unpublish (struct client_data *client)
+{
+    switch (client->publish_state) {
+        case PUBLISHSTATE_QUEUED: {
+            // if it was being paired, start over with the next one
+            int was_first = (LinkedList1_GetFirst(&publish_queue) == &client->publish_node);
+            LinkedList1_Remove(&publish_queue, &client->publish_node);
+            if (was_first) {
+                publish_cursor = LinkedList1_GetFirst(&published);
+                if (LinkedList1_IsEmpty(&publish_queue)) {
+                    BReactor_RemoveTimer(&ss, &publish_timer);
+                }
+            }
+        } break;
+        
+        case PUBLISHSTATE_PUBLISHED: {
+            // don't leave the cursor on it
+            if (publish_cursor == &client->publish_node) {
+                publish_cursor = LinkedList1Node_Next(publish_cursor);
+            }
+            LinkedList1_Remove(&published, &client->publish_node);
+        } break;
+    }
+    
+    client->publish_state = PUBLISHSTATE_NONE;
+}
+
+void control_release_timer_handler (void *unused)
+{
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&control_held_list))) {
+        struct client_data *client = UPPER_OBJECT(node, struct client_data, output_control_held_node);
+        ASSERT(client->output_control_held)
+        
+        LinkedList1_Remove(&control_held_list, &client->output_control_held_node);
+        client->output_control_held = 0;
+        PacketProtoBatcher_Release(&client->output_control_batcher);
+    }
+}
+
+void publish_timer_handler (void *unused)
+{
+    int budget = PUBLISH_BUDGET_PAIRS;
+    
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&publish_queue))) {
+        struct client_data *client = UPPER_OBJECT(node, struct client_data, publish_node);
+        ASSERT(client->publish_state == PUBLISHSTATE_QUEUED)
+        
+        // paired with everyone? then it is published, continue with the next one
+        if (!publish_cursor) {
+            LinkedList1_Remove(&publish_queue, &client->publish_node);
+            LinkedList1_Append(&published, &client->publish_node);
+            client->publish_state = PUBLISHSTATE_PUBLISHED;
+            publish_cursor = LinkedList1_GetFirst(&published);
+            continue;
+        }
+        
+        // let other events through when out of budget
+        if (budget == 0) {
+            BReactor_SetTimerAfter(&ss, &publish_timer, 0);
+            return;
+        }
+        budget--;
+        
+        struct client_data *client2 = UPPER_OBJECT(publish_cursor, struct client_data, publish_node);
+        publish_cursor = LinkedList1Node_Next(publish_cursor);
+        
+        if (!clients_allowed(client, client2)) {
+            continue;
+        }
+        
+        // on failure the client was removed, taking it out of the queue
+        publish_pair(client, client2);
+    }
+}
+
+int publish_pair (struct client_data *client, struct client_data *client2)
+{
+    ASSERT(client->publish_state == PUBLISHSTATE_QUEUED)
+    ASSERT(client2->publish_state == PUBLISHSTATE_PUBLISHED)
+    
+    // create flow from client to client2
+    struct peer_flow *flow_to = peer_flow_create(client, client2);
+    if (!flow_to) {
+        client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
+        goto fail;
+    }
+    
+    // create flow from client2 to client
+    struct peer_flow *flow_from = peer_flow_create(client2, client);
+    if (!flow_from) {
+        client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
+        goto fail;
+    }
+    
+    // set opposite flow pointers
+    flow_to->opposite = flow_from;
+    flow_from->opposite = flow_to;
+    
+    // launch pair
+    return launch_pair(flow_to);
+    
+fail:
+    client_remove(client);
+    return 0;
+}
+
+int client_acquire_ident (struct client_data *client)
+{
+    ASSERT(ident_buckets)
+    ASSERT(!client->ident)
+    
+    const char *name = (client->common_name ? client->common_name : "");
+    BIPAddr addr;
+    BAddr_GetIPAddr(&client->addr, &addr);
+    
+    // look for an identity to share
+    LinkedList1 *bucket = &ident_buckets[ident_hash(name, &addr) & ident_buckets_mask];
+    for (LinkedList1Node *node = LinkedList1_GetFirst(bucket); node; node = LinkedList1Node_Next(node)) {
+        struct client_ident *ident = UPPER_OBJECT(node, struct client_ident, bucket_node);
+        if (!strcmp(ident->name, name) && BIPAddr_Compare(&ident->addr, &addr)) {
+            ident->refs++;
+            client->ident = ident;
+            return 1;
         }
     }
     
-    ASSERT(0)
-    return 42;
+    // allocate a new one
+    struct client_ident *ident = (struct client_ident *)malloc(sizeof(*ident));
+    if (!ident) {
+        goto fail0;
+    }
+    if (!(ident->name = strdup(name))) {
+        goto fail1;
+    }
+    ident->addr = addr;
+    ident->serial = ident_next_serial++;
+    ident->refs = 1;
+    LinkedList1_Append(bucket, &ident->bucket_node);
+    
+    client->ident = ident;
+    return 1;
+    
+fail1:
+    free(ident);
+fail0:
+    return 0;
 }
 
-struct client_data * find_client_by_id (peerid_t id)
+void client_release_ident (struct client_data *client)
 {
-    BAVLNode *node;
-    if (!(node = BAVL_LookupExact(&clients_tree, &id))) {
-        return NULL;
+    struct client_ident *ident = client->ident;
+    ASSERT(ident)
+    ASSERT(ident->refs > 0)
+    
+    client->ident = NULL;
+    
+    if (--ident->refs > 0) {
+        return;
+    }
+    
+    // serials are never reused, so cached results for it are just never hit again
+    LinkedList1_Remove(&ident_buckets[ident_hash(ident->name, &ident->addr) & ident_buckets_mask], &ident->bucket_node);
+    free(ident->name);
+    free(ident);
+}
+
+uint32_t ident_hash (const char *name, BIPAddr *addr)
+{
+    // FNV-1a
+    uint32_t h = UINT32_C(2166136261);
+    for (const char *c = name; *c; c++) {
+        h = (h ^ (uint8_t)*c) * UINT32_C(16777619);
+    }
+    
+    const uint8_t *bytes = NULL;
+    size_t len = 0;
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4:
+            bytes = (const uint8_t *)&addr->ipv4;
+            len = sizeof(addr->ipv4);
+            break;
+        case BADDR_TYPE_IPV6:
+            bytes = addr->ipv6;
+            len = sizeof(addr->ipv6);
+            break;
+    }
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * UINT32_C(16777619);
+    }
+    
+    return h;
+}
+
+struct predicate_cache_entry * predicate_cache_get (struct predicate_cache_entry *cache, struct client_data *client1, struct client_data *client2)
+{
+    ASSERT(client1->ident)
+    ASSERT(client2->ident)
+    
+    uint64_t s1 = client1->ident->serial;
+    uint64_t s2 = client2->ident->serial;
+    uint32_t i = (uint32_t)((s1 * UINT64_C(0x9E3779B97F4A7C15) + s2) >> 32) % PREDICATE_CACHE_SIZE;
+    
+    // take over the entry; the caller fills in the result if it's not ours
+    struct predicate_cache_entry *e = &cache[i];
+    if (e->serial1 != s1 || e->serial2 != s2) {
+        e->serial1 = s1;
+        e->serial2 = s2;
+        e->result = -1;
     }
     
-    return UPPER_OBJECT(node, struct client_data, tree_node);
+    return e;
 }
 
 int clients_allowed (struct client_data *client1, struct client_data *client2)
@@ -2108,6 +3220,12 @@ int clients_allowed (struct client_data *client1, struct client_data *client2)
         return 1;
     }
     
+    // use cached result
+    struct predicate_cache_entry *e = predicate_cache_get(comm_predicate_cache, client1, client2);
+    if (e->result >= 0) {
+        return e->result;
+    }
+    
     // set values to compare against
     comm_predicate_p1name = (client1->common_name ? client1->common_name : "");
     comm_predicate_p2name = (client2->common_name ? client2->common_name : "");
@@ -2117,9 +3235,10 @@ int clients_allowed (struct client_data *client1, struct client_data *client2)
     // evaluate predicate
     int res = BPredicate_Eval(&comm_predicate);
     if (res < 0) {
-        return 0;
+        res = 0;
     }
     
+    e->result = res;
     return res;
 }
 
@@ -2169,6 +3288,12 @@ int relay_allowed (struct client_data *client, struct client_data *relay)
         return 0;
     }
     
+    // use cached result
+    struct predicate_cache_entry *e = predicate_cache_get(relay_predicate_cache, client, relay);
+    if (e->result >= 0) {
+        return e->result;
+    }
+    
     // set values to compare against
     relay_predicate_pname = (client->common_name ? client->common_name : "");
     relay_predicate_rname = (relay->common_name ? relay->common_name : "");
@@ -2178,9 +3303,10 @@ int relay_allowed (struct client_data *client, struct client_data *relay)
     // evaluate predicate
     int res = BPredicate_Eval(&relay_predicate);
     if (res < 0) {
-        return 0;
+        res = 0;
     }
     
+    e->result = res;
     return res;
 }
 
@@ -2224,11 +3350,6 @@ int relay_predicate_func_raddr_cb (void *user, void **args)
     return BIPAddr_Compare(&addr, &relay_predicate_raddr);
 }
 
-int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2)
-{
-    return B_COMPARE(*p1, *p2);
-}
-
 struct peer_know * create_know (struct client_data *from, struct client_data *to, int relay_server, int relay_client)
 {
     ASSERT(from->initstatus == INITSTATUS_COMPLETE)
@@ -2380,15 +3501,127 @@ struct peer_flow * find_flow (struct client_data *client, peerid_t dest_id)
     ASSERT(client->initstatus == INITSTATUS_COMPLETE)
     ASSERT(!client->dying)
     
-    BAVLNode *node = BAVL_LookupExact(&client->peer_out_flows_tree, &dest_id);
-    if (!node) {
+    struct peer_flow_map *m = &client->peer_out_flows_map;
+    if (!m->slots) {
         return NULL;
     }
-    struct peer_flow *flow = UPPER_OBJECT(node, struct peer_flow, src_tree_node);
     
-    ASSERT(flow->dest_client->id == dest_id)
-    ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!flow->dest_client->dying)
+    uint32_t mask = ((uint32_t)1 << m->order) - 1;
+    uint32_t i = peer_flow_map_hash(m, dest_id);
     
-    return flow;
+    struct peer_flow *flow;
+    while ((flow = m->slots[i])) {
+        if (flow->dest_client_id == dest_id) {
+            ASSERT(flow->dest_client->id == dest_id)
+            ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
+            ASSERT(!flow->dest_client->dying)
+            return flow;
+        }
+        i = (i + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+uint32_t peer_flow_map_hash (struct peer_flow_map *m, peerid_t id)
+{
+    ASSERT(m->order > 0)
+    
+    // Fibonacci hashing, taking the high bits of the product
+    return ((uint32_t)id * UINT32_C(2654435761)) >> (32 - m->order);
+}
+
+void peer_flow_map_init (struct peer_flow_map *m)
+{
+    // slots are allocated with the first flow
+    m->slots = NULL;
+    m->order = 0;
+    m->count = 0;
+}
+
+void peer_flow_map_free (struct peer_flow_map *m)
+{
+    ASSERT(m->count == 0)
+    
+    BFree(m->slots);
+}
+
+int peer_flow_map_insert (struct peer_flow_map *m, struct peer_flow *flow)
+{
+    // grow if this would make us more than half full
+    if (!m->slots || 2 * (m->count + 1) > ((size_t)1 << m->order)) {
+        int new_order = (m->slots ? m->order + 1 : PEER_FLOW_MAP_MIN_ORDER);
+        size_t new_size = (size_t)1 << new_order;
+        
+        struct peer_flow **new_slots = (struct peer_flow **)BAllocArray(new_size, sizeof(new_slots[0]));
+        if (!new_slots) {
+            return 0;
+        }
+        for (size_t j = 0; j < new_size; j++) {
+            new_slots[j] = NULL;
+        }
+        
+        struct peer_flow **old_slots = m->slots;
+        size_t old_size = (old_slots ? (size_t)1 << m->order : 0);
+        m->slots = new_slots;
+        m->order = new_order;
+        
+        // rehash existing flows
+        for (size_t j = 0; j < old_size; j++) {
+            struct peer_flow *f = old_slots[j];
+            if (f) {
+                uint32_t i = peer_flow_map_hash(m, f->dest_client_id);
+                while (m->slots[i]) {
+                    i = (i + 1) & (new_size - 1);
+                }
+                m->slots[i] = f;
+            }
+        }
+        
+        BFree(old_slots);
+    }
+    
+    uint32_t mask = ((uint32_t)1 << m->order) - 1;
+    uint32_t i = peer_flow_map_hash(m, flow->dest_client_id);
+    while (m->slots[i]) {
+        ASSERT(m->slots[i]->dest_client_id != flow->dest_client_id)
+        i = (i + 1) & mask;
+    }
+    
+    m->slots[i] = flow;
+    m->count++;
+    
+    return 1;
+}
+
+void peer_flow_map_remove (struct peer_flow_map *m, struct peer_flow *flow)
+{
+    ASSERT(m->count > 0)
+    
+    uint32_t mask = ((uint32_t)1 << m->order) - 1;
+    
+    // find the flow
+    uint32_t i = peer_flow_map_hash(m, flow->dest_client_id);
+    while (m->slots[i] != flow) {
+        ASSERT(m->slots[i])
+        i = (i + 1) & mask;
+    }
+    
+    // remove it, moving back later entries of the cluster which
+    // would otherwise become unreachable
+    m->slots[i] = NULL;
+    m->count--;
+    
+    uint32_t j = (i + 1) & mask;
+    struct peer_flow *f;
+    while ((f = m->slots[j])) {
+        uint32_t h = peer_flow_map_hash(m, f->dest_client_id);
+        // move unless h lies cyclically in (i, j]
+        if (((j - h) & mask) >= ((j - i) & mask)) {
+            m->slots[i] = f;
+            m->slots[j] = NULL;
+            i = j;
+        }
+        j = (j + 1) & mask;
+    }
 }
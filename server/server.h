@@ -31,14 +31,17 @@
 
 #include <protocol/scproto.h>
 #include <structure/LinkedList1.h>
-#include <structure/BAVL.h>
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketStreamSender.h>
 #include <flow/PacketPassPriorityQueue.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketProtoFlow.h>
+#include <flow/PacketProtoBatcher.h>
 #include <system/BReactor.h>
 #include <system/BConnection.h>
+#ifndef BADVPN_USE_WINAPI
+#include <system/BShardConnection.h>
+#endif
 #include <nspr_support/BSSLConnection.h>
 
 // name of the program
@@ -46,22 +49,43 @@
 
 // maxiumum number of connected clients. Must be <=2^16.
 #define DEFAULT_MAX_CLIENTS 30
+// number of client IDs (the range of peerid_t); IDs are handed out from all of
+// them so that a freed ID is not given to another client soon
+#define CLIENT_ID_RANGE 65536
 // client output control flow buffer size in packets
 // it must hold: initdata, newclient's, endclient's (if other peers die when informing them)
 // make it big enough to hold the initial packet burst (initdata, newclient's),
 #define CLIENT_CONTROL_BUFFER_MIN_PACKETS (1 + 2*(MAX_CLIENTS - 1))
 // size of client-to-client buffers in packets
 #define CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS 10
+// CoDel interval for client-to-client buffers, in milliseconds
+#define CLIENT_DEFAULT_CODEL_INTERVAL 100
 // after how long of not hearing anything from the client we disconnect it
 #define CLIENT_NO_DATA_TIME_LIMIT 30000
+// size of buffer into which data from a client is received
+#define CLIENT_RECV_BUFFER_SIZE 16384
+// size of buffer in which packets to a client are coalesced into larger writes
+#define CLIENT_SEND_COALESCE_SIZE 8192
 // SO_SNDBFUF socket option for clients
 #define CLIENT_DEFAULT_SOCKET_SNDBUF 16384
 // reset time when a buffer runs out or when we get the resetpeer message
 #define CLIENT_RESET_TIME 30000
+// initial number of slots in a client's flow map is 2^this
+#define PEER_FLOW_MAP_MIN_ORDER 3
+// how many existing clients a new client is paired with before
+// letting other events through
+#define PUBLISH_BUDGET_PAIRS 256
+// number of entries in each of the predicate result caches
+#define PREDICATE_CACHE_SIZE 4096
 
 // maxiumum listen addresses
 #define MAX_LISTEN_ADDRS 16
 
+// with --handoff-socket, how long the old server keeps relaying among its
+// clients after handing over its listeners, by default; its clients cannot
+// talk to those of the new server, so they are made to reconnect soon
+#define DEFAULT_HANDOFF_DRAIN_TIMEOUT 10000
+
 //#define SIMULATE_OUT_OF_CONTROL_BUFFER 20
 //#define SIMULATE_OUT_OF_FLOW_BUFFER 100
 
@@ -75,8 +99,24 @@
 
 #define INITSTATUS_HASLINK(status) ((status) == INITSTATUS_WAITHELLO || (status) == INITSTATUS_COMPLETE)
 
+// not yet paired with other clients
+#define PUBLISHSTATE_NONE 0
+// waiting in the publish queue, or being paired with published clients
+#define PUBLISHSTATE_QUEUED 1
+// paired with all other published clients
+#define PUBLISHSTATE_PUBLISHED 2
+
 struct client_data;
 struct peer_know;
+struct peer_flow;
+
+// open addressing hash table of flows by destination ID, with linear probing;
+// kept at most half full
+struct peer_flow_map {
+    struct peer_flow **slots;
+    int order;
+    int count;
+};
 
 struct peer_flow {
     // source client
@@ -84,8 +124,6 @@ struct peer_flow {
     // destination client
     struct client_data *dest_client;
     peerid_t dest_client_id;
-    // node in source client hash table (by destination), only when src_client != NULL
-    BAVLNode src_tree_node;
     // node in source client list, only when src_client != NULL
     LinkedList1Node src_list_node;
     // node in destination client list
@@ -107,6 +145,22 @@ struct peer_flow {
     int resetting;
 };
 
+// what the predicates know about a client; clients with the same name and
+// address share one, so predicate results can be cached per pair of these
+struct client_ident {
+    char *name;
+    BIPAddr addr;
+    uint64_t serial;
+    int refs;
+    LinkedList1Node bucket_node;
+};
+
+struct predicate_cache_entry {
+    uint64_t serial1;
+    uint64_t serial2;
+    int result;
+};
+
 struct peer_know {
     struct client_data *from;
     struct client_data *to;
@@ -123,6 +177,11 @@ struct client_data {
     BConnection con;
     BAddr addr;
     
+    #ifndef BADVPN_USE_WINAPI
+    // socket moved to an I/O thread, if using I/O threads
+    BShardConnection shardcon;
+    #endif
+    
     // SSL connection, if using SSL
     PRFileDesc bottom_prfd;
     PRFileDesc *ssl_prfd;
@@ -149,16 +208,21 @@ struct client_data {
     
     // node in clients linked list
     LinkedList1Node list_node;
-    // node in clients tree (by ID)
-    BAVLNode tree_node;
     
     // knowledge lists
     LinkedList1 know_out_list;
     LinkedList1 know_in_list;
     
-    // flows from us
+    // predicate identity, if using predicates and initialization is complete
+    struct client_ident *ident;
+    
+    // publishing state, node in publish queue or published list
+    int publish_state;
+    LinkedList1Node publish_node;
+    
+    // flows from us; in the map only when src_client != NULL
     LinkedList1 peer_out_flows_list;
-    BAVL peer_out_flows_tree;
+    struct peer_flow_map peer_out_flows_map;
     
     // whether it's being removed
     int dying;
@@ -174,11 +238,18 @@ struct client_data {
     
     // output control flow
     PacketPassPriorityQueueFlow output_control_qflow;
+    PacketProtoBatcher output_control_batcher;
     PacketProtoFlow output_control_oflow;
     BufferWriter *output_control_input;
     int output_control_packet_len;
     uint8_t *output_control_packet;
     
+    // whether control packets are batched, and whether the batcher is held
+    // until the end of the event loop iteration (in control_held_list)
+    int output_control_batching;
+    int output_control_held;
+    LinkedList1Node output_control_held_node;
+    
     // output peers flow
     PacketPassPriorityQueueFlow output_peers_qflow;
     PacketPassFairQueue output_peers_fairqueue;
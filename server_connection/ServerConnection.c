@@ -33,6 +33,8 @@
 
 #include <misc/debug.h>
 #include <misc/strdup.h>
+#include <misc/byteorder.h>
+#include <protocol/packetproto.h>
 #include <base/BLog.h>
 
 #include <server_connection/ServerConnection.h>
@@ -51,14 +53,18 @@ static void connection_handler (ServerConnection *o, int event);
 static void sslcon_handler (ServerConnection *o, int event);
 static void decoder_handler_error (ServerConnection *o);
 static void input_handler_send (ServerConnection *o, uint8_t *data, int data_len);
-static void packet_hello (ServerConnection *o, uint8_t *data, int data_len);
-static void packet_newclient (ServerConnection *o, uint8_t *data, int data_len);
-static void packet_endclient (ServerConnection *o, uint8_t *data, int data_len);
-static void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len);
+static void process_input (ServerConnection *o);
+static int process_packet (ServerConnection *o, uint8_t *data, int data_len);
+static int packet_hello (ServerConnection *o, uint8_t *data, int data_len);
+static int packet_newclient (ServerConnection *o, uint8_t *data, int data_len);
+static int packet_endclient (ServerConnection *o, uint8_t *data, int data_len);
+static int packet_inmsg (ServerConnection *o, uint8_t *data, int data_len);
 static int start_packet (ServerConnection *o, void **data, int len);
 static void end_packet (ServerConnection *o, uint8_t type);
 static void newclient_job_handler (ServerConnection *o);
 
+static const struct sc_header batch_prefix = {SCID_BATCH};
+
 void report_error (ServerConnection *o)
 {
     DEBUGERROR(&o->d_err, o->handler_error(o->user))
@@ -117,6 +123,13 @@ void connector_handler (ServerConnection *o, int is_error)
             goto fail1;
         }
         
+        // accept session tickets; with the server name set, sessions are
+        // resumed when reconnecting to the same server
+        if (SSL_OptionSet(o->ssl_prfd, SSL_ENABLE_SESSION_TICKETS, PR_TRUE) != SECSuccess) {
+            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_ENABLE_SESSION_TICKETS) failed");
+            goto fail1;
+        }
+        
         // set client certificate callback
         if (SSL_GetClientAuthDataHook(o->ssl_prfd, (SSLGetClientAuthData)client_auth_data_callback, o) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
@@ -150,7 +163,10 @@ void connector_handler (ServerConnection *o, int is_error)
     // init output common
     
     // init sender
-    PacketStreamSender_Init(&o->output_sender, send_iface, PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(o->reactor));
+    if (!PacketStreamSender_Init2(&o->output_sender, send_iface, PACKETPROTO_ENCLEN(SC_MAX_ENC), SERVERCONNECTION_SEND_COALESCE_SIZE, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail2a;
+    }
     
     // init keepalives
     if (!KeepaliveIO_Init(&o->output_keepaliveio, o->reactor, PacketStreamSender_GetInput(&o->output_sender), PacketProtoEncoder_GetOutput(&o->output_ka_encoder), o->keepalive_interval)) {
@@ -166,10 +182,16 @@ void connector_handler (ServerConnection *o, int is_error)
     // init queue flow
     PacketPassPriorityQueueFlow_Init(&o->output_local_qflow, &o->output_queue, 0);
     
+    // init batcher; enabled once the server has accepted our version
+    if (!PacketProtoBatcher_Init(&o->output_local_batcher, PacketPassPriorityQueueFlow_GetInput(&o->output_local_qflow), PACKETPROTO_ENCLEN(SC_MAX_ENC), (const uint8_t *)&batch_prefix, sizeof(batch_prefix), PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketProtoBatcher_Init failed");
+        goto fail4;
+    }
+    
     // init PacketProtoFlow
-    if (!PacketProtoFlow_Init(&o->output_local_oflow, SC_MAX_ENC, o->buffer_size, PacketPassPriorityQueueFlow_GetInput(&o->output_local_qflow), BReactor_PendingGroup(o->reactor))) {
+    if (!PacketProtoFlow_Init(&o->output_local_oflow, SC_MAX_ENC, o->buffer_size, PacketProtoBatcher_GetInput(&o->output_local_batcher), BReactor_PendingGroup(o->reactor))) {
         BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
-        goto fail4;
+        goto fail5;
     }
     o->output_local_if = PacketProtoFlow_GetInput(&o->output_local_oflow);
     
@@ -184,12 +206,15 @@ void connector_handler (ServerConnection *o, int is_error)
     
     return;
     
+fail5:
+    PacketProtoBatcher_Free(&o->output_local_batcher);
 fail4:
     PacketPassPriorityQueueFlow_Free(&o->output_local_qflow);
     PacketPassPriorityQueue_Free(&o->output_queue);
     KeepaliveIO_Free(&o->output_keepaliveio);
 fail3:
     PacketStreamSender_Free(&o->output_sender);
+fail2a:
     PacketProtoEncoder_Free(&o->output_ka_encoder);
     SCKeepaliveSource_Free(&o->output_ka_zero);
     BPending_Free(&o->start_job);
@@ -300,14 +325,88 @@ void input_handler_send (ServerConnection *o, uint8_t *data, int data_len)
     ASSERT(data_len <= SC_MAX_ENC)
     DebugObject_Access(&o->d_obj);
     
+    // a batch carries PacketProto-encoded packets after its header
+    o->input_batch = sc_is_batch(data, data_len);
+    if (o->input_batch) {
+        data += sizeof(struct sc_header);
+        data_len -= sizeof(struct sc_header);
+    }
+    
+    // a single packet needs at least a header
+    if (!o->input_batch && data_len < sizeof(struct sc_header)) {
+        BLog(BLOG_ERROR, "packet too short (no sc header)");
+        report_error(o);
+        return;
+    }
+    
+    o->input_data = data;
+    o->input_data_len = data_len;
+    
+    // send the replies to a batch together
+    if (o->input_batch) {
+        PacketProtoBatcher_Hold(&o->output_local_batcher);
+    }
+    
+    process_input(o);
+    return;
+}
+
+void process_input (ServerConnection *o)
+{
+    ASSERT(!BPending_IsSet(&o->newclient_job))
+    
+    while (o->input_data_len > 0) {
+        uint8_t *data;
+        int data_len;
+        
+        if (o->input_batch) {
+            struct packetproto_header pp;
+            if (o->input_data_len < sizeof(pp)) {
+                BLog(BLOG_ERROR, "batch: missing packet header");
+                report_error(o);
+                return;
+            }
+            memcpy(&pp, o->input_data, sizeof(pp));
+            data_len = ltoh16(pp.len);
+            if (data_len > o->input_data_len - (int)sizeof(pp)) {
+                BLog(BLOG_ERROR, "batch: packet too long");
+                report_error(o);
+                return;
+            }
+            data = o->input_data + sizeof(pp);
+            o->input_data += sizeof(pp) + data_len;
+            o->input_data_len -= sizeof(pp) + data_len;
+        } else {
+            data = o->input_data;
+            data_len = o->input_data_len;
+            o->input_data_len = 0;
+        }
+        
+        if (!process_packet(o, data, data_len)) {
+            return;
+        }
+        
+        // continue after the new client has been reported
+        if (BPending_IsSet(&o->newclient_job)) {
+            return;
+        }
+    }
+    
+    if (o->input_batch) {
+        PacketProtoBatcher_Release(&o->output_local_batcher);
+    }
+    
     // accept packet
     PacketPassInterface_Done(&o->input_interface);
-    
+}
+
+int process_packet (ServerConnection *o, uint8_t *data, int data_len)
+{
     // parse header
     if (data_len < sizeof(struct sc_header)) {
         BLog(BLOG_ERROR, "packet too short (no sc header)");
         report_error(o);
-        return;
+        return 0;
     }
     struct sc_header header;
     memcpy(&header, data, sizeof(header));
@@ -318,36 +417,32 @@ void input_handler_send (ServerConnection *o, uint8_t *data, int data_len)
     // call appropriate handler based on packet type
     switch (type) {
         case SCID_SERVERHELLO:
-            packet_hello(o, data, data_len);
-            return;
+            return packet_hello(o, data, data_len);
         case SCID_NEWCLIENT:
-            packet_newclient(o, data, data_len);
-            return;
+            return packet_newclient(o, data, data_len);
         case SCID_ENDCLIENT:
-            packet_endclient(o, data, data_len);
-            return;
+            return packet_endclient(o, data, data_len);
         case SCID_INMSG:
-            packet_inmsg(o, data, data_len);
-            return;
+            return packet_inmsg(o, data, data_len);
         default:
             BLog(BLOG_ERROR, "unknown packet type %d", (int)type);
             report_error(o);
-            return;
+            return 0;
     }
 }
 
-void packet_hello (ServerConnection *o, uint8_t *data, int data_len)
+int packet_hello (ServerConnection *o, uint8_t *data, int data_len)
 {
     if (o->state != STATE_WAITINIT) {
         BLog(BLOG_ERROR, "hello: not expected");
         report_error(o);
-        return;
+        return 0;
     }
     
     if (data_len != sizeof(struct sc_server_hello)) {
         BLog(BLOG_ERROR, "hello: invalid length");
         report_error(o);
-        return;
+        return 0;
     }
     struct sc_server_hello msg;
     memcpy(&msg, data, sizeof(msg));
@@ -356,23 +451,26 @@ void packet_hello (ServerConnection *o, uint8_t *data, int data_len)
     // change state
     o->state = STATE_COMPLETE;
     
+    // the server takes batches, as it accepted our version
+    PacketProtoBatcher_Enable(&o->output_local_batcher);
+    
     // report
     o->handler_ready(o->user, id, msg.clientAddr);
-    return;
+    return 1;
 }
 
-void packet_newclient (ServerConnection *o, uint8_t *data, int data_len)
+int packet_newclient (ServerConnection *o, uint8_t *data, int data_len)
 {
     if (o->state != STATE_COMPLETE) {
         BLog(BLOG_ERROR, "newclient: not expected");
         report_error(o);
-        return;
+        return 0;
     }
     
     if (data_len < sizeof(struct sc_server_newclient) || data_len > sizeof(struct sc_server_newclient) + SCID_NEWCLIENT_MAX_CERT_LEN) {
         BLog(BLOG_ERROR, "newclient: invalid length");
         report_error(o);
-        return;
+        return 0;
     }
     
     struct sc_server_newclient msg;
@@ -390,25 +488,27 @@ void packet_newclient (ServerConnection *o, uint8_t *data, int data_len)
     if (!start_packet(o, &packet, sizeof(omsg))) {
         BLog(BLOG_ERROR, "newclient: out of buffer for acceptpeer");
         report_error(o);
-        return;
+        return 0;
     }
     omsg.clientid = htol16(id);
     memcpy(packet, &omsg, sizeof(omsg));
     end_packet(o, SCID_ACCEPTPEER);
+    
+    return 1;
 }
 
-void packet_endclient (ServerConnection *o, uint8_t *data, int data_len)
+int packet_endclient (ServerConnection *o, uint8_t *data, int data_len)
 {
     if (o->state != STATE_COMPLETE) {
         BLog(BLOG_ERROR, "endclient: not expected");
         report_error(o);
-        return;
+        return 0;
     }
     
     if (data_len != sizeof(struct sc_server_endclient)) {
         BLog(BLOG_ERROR, "endclient: invalid length");
         report_error(o);
-        return;
+        return 0;
     }
     
     struct sc_server_endclient msg;
@@ -417,27 +517,27 @@ void packet_endclient (ServerConnection *o, uint8_t *data, int data_len)
     
     // report
     o->handler_endclient(o->user, id);
-    return;
+    return 1;
 }
 
-void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len)
+int packet_inmsg (ServerConnection *o, uint8_t *data, int data_len)
 {
     if (o->state != STATE_COMPLETE) {
         BLog(BLOG_ERROR, "inmsg: not expected");
         report_error(o);
-        return;
+        return 0;
     }
     
     if (data_len < sizeof(struct sc_server_inmsg)) {
         BLog(BLOG_ERROR, "inmsg: missing header");
         report_error(o);
-        return;
+        return 0;
     }
     
     if (data_len > sizeof(struct sc_server_inmsg) + SC_MAX_MSGLEN) {
         BLog(BLOG_ERROR, "inmsg: too long");
         report_error(o);
-        return;
+        return 0;
     }
     
     struct sc_server_inmsg msg;
@@ -448,7 +548,7 @@ void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len)
     
     // report
     o->handler_message(o->user, peer_id, payload, payload_len);
-    return;
+    return 1;
 }
 
 int start_packet (ServerConnection *o, void **data, int len)
@@ -587,6 +687,7 @@ void ServerConnection_Free (ServerConnection *o)
         
         // free output local flow
         PacketProtoFlow_Free(&o->output_local_oflow);
+        PacketProtoBatcher_Free(&o->output_local_batcher);
         PacketPassPriorityQueueFlow_Free(&o->output_local_qflow);
         
         // free output common
@@ -665,5 +766,8 @@ void newclient_job_handler (ServerConnection *o)
     
     // report new client
     o->handler_newclient(o->user, id, flags, cert_data, cert_len);
+    
+    // continue with the rest of the input packet
+    process_input(o);
     return;
 }
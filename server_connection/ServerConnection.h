@@ -57,10 +57,14 @@
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketPassPriorityQueue.h>
 #include <flow/PacketProtoFlow.h>
+#include <flow/PacketProtoBatcher.h>
 #include <flowextra/KeepaliveIO.h>
 #include <nspr_support/BSSLConnection.h>
 #include <server_connection/SCKeepaliveSource.h>
 
+// size of buffer in which packets to the server are coalesced into larger writes
+#define SERVERCONNECTION_SEND_COALESCE_SIZE 4096
+
 /**
  * Handler function invoked when an error occurs.
  * The object must be freed from withing this function.
@@ -177,6 +181,12 @@ typedef struct {
     PacketProtoDecoder input_decoder;
     PacketPassInterface input_interface;
     
+    // rest of the input packet being processed; the packets of a batch are
+    // processed one by one, pausing while a new client is being reported
+    int input_batch;
+    uint8_t *input_data;
+    int input_data_len;
+    
     // keepalive output branch
     SCKeepaliveSource output_ka_zero;
     PacketProtoEncoder output_ka_encoder;
@@ -191,6 +201,7 @@ typedef struct {
     uint8_t *output_local_packet;
     BufferWriter *output_local_if;
     PacketProtoFlow output_local_oflow;
+    PacketProtoBatcher output_local_batcher;
     PacketPassPriorityQueueFlow output_local_qflow;
     
     // output user flow
@@ -33,7 +33,6 @@
 #include <misc/balloc.h>
 #include <misc/offset.h>
 #include <misc/byteorder.h>
-#include <misc/compare.h>
 #include <misc/socks_proto.h>
 #include <misc/debug.h>
 #include <misc/bsize.h>
@@ -44,9 +43,33 @@
 
 #include <generated/blog_channel_SocksUdpClient.h>
 
+static size_t flow_hash (BFlowAddr *local_addr, BFlowAddr *remote_addr)
+{
+    return BFlowAddr_HashPair(local_addr, remote_addr);
+}
+
+static size_t session_hash (struct SocksUdpClient_connection *con, BFlowAddr *remote_addr)
+{
+    return ((size_t)(uintptr_t)con * 31) ^ BFlowAddr_Hash(remote_addr);
+}
+
+#include "SocksUdpClient_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "SocksUdpClient_flow_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "SocksUdpClient_session_hash.h"
+#include <structure/CHash_impl.h>
+
 static const int DnsPort = 53;
 
-static int addr_comparator (void *unused, BAddr *v1, BAddr *v2);
+// number of datagrams sent or received per system call
+#define SOCKSUDPCLIENT_IO_BATCH 8
+
+// number of connection structures allocated at once
+#define SOCKSUDPCLIENT_POOL_SLAB_SIZE 16
+
 static struct SocksUdpClient_connection * find_connection (SocksUdpClient *o, BAddr addr);
 static void socks_state_handler (struct SocksUdpClient_connection *con, int event);
 static void datagram_state_handler (struct SocksUdpClient_connection *con, int event);
@@ -60,22 +83,20 @@ static void connection_free (struct SocksUdpClient_connection *con);
 static void connection_send (struct SocksUdpClient_connection *con,
     BAddr remote_addr, const uint8_t *data, int data_len);
 static void first_job_handler (struct SocksUdpClient_connection *con);
+static struct SocksUdpClient_binding * binding_init (SocksUdpClient *o,
+    struct SocksUdpClient_connection *con, BAddr local_addr, BAddr remote_addr,
+    const uint8_t *data, int data_len);
+static void binding_free (struct SocksUdpClient_binding *b);
+static struct SocksUdpClient_connection * find_shared_connection (SocksUdpClient *o,
+    BFlowAddr *remote_addr);
+static void submit_shared (SocksUdpClient *o,
+    BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 static int compute_socks_mtu (int udp_mtu);
 static int get_dns_id (BAddr *remote_addr, const uint8_t *data, int data_len);
 
-int addr_comparator (void *unused, BAddr *v1, BAddr *v2)
-{
-    return BAddr_CompareOrder(v1, v2);
-}
-
 struct SocksUdpClient_connection * find_connection (SocksUdpClient *o, BAddr addr)
 {
-    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree, &addr);
-    if (!tree_node) {
-        return NULL;
-    }
-    
-    return UPPER_OBJECT(tree_node, struct SocksUdpClient_connection, connections_tree_node);
+    return SocksUdpClientHash_Lookup(&o->connections_hash, 0, &addr).ptr;
 }
 
 void socks_state_handler (struct SocksUdpClient_connection *con, int event)
@@ -242,6 +263,31 @@ void recv_if_handler_send (
         return;
     }
     
+    if (o->shared) {
+        // find the flow this reply belongs to
+        BFlowAddr remote_key = BFlowAddr_FromBAddr(&remote_addr);
+        struct SocksUdpClient_session_key key = {con, &remote_key};
+        struct SocksUdpClient_binding *b =
+            SocksUdpClientSessionHash_Lookup(&o->bindings_by_session, 0, key).ptr;
+        if (!b) {
+            BLog(BLOG_INFO, "Dropping packet from a remote address with no flow.");
+            return;
+        }
+        
+        // move binding to the end of the list
+        LinkedList1_Remove(&o->bindings_list, &b->list_node);
+        LinkedList1_Append(&o->bindings_list, &b->list_node);
+        
+        // pass packet to user
+        o->handler_received(o->user, BFlowAddr_ToBAddr(&b->local_addr), remote_addr, data, data_len);
+        
+        // Forget a flow which was only used for a single DNS query once it is answered.
+        if (b->dns_id >= 0 && get_dns_id(&remote_addr, data, data_len) == b->dns_id) {
+            binding_free(b);
+        }
+        return;
+    }
+    
     // pass packet to user
     SocksUdpClient *client = con->client;
     client->handler_received(client->user, con->local_addr, remote_addr, data, data_len);
@@ -282,9 +328,9 @@ struct SocksUdpClient_connection * connection_init (
     
     // allocate structure
     struct SocksUdpClient_connection *con =
-        (struct SocksUdpClient_connection *)BAlloc(sizeof(*con));
+        (struct SocksUdpClient_connection *)BObjectPool_Alloc(&o->connections_pool);
     if (!con) {
-        BLog(BLOG_ERROR, "BAlloc connection failed");
+        BLog(BLOG_ERROR, "BObjectPool_Alloc connection failed");
         goto fail0;
     }
     
@@ -302,8 +348,12 @@ struct SocksUdpClient_connection * connection_init (
     con->first_data_len = first_data_len;
     con->first_remote_addr = first_remote_addr;
     
-    // Get the DNS transaction ID from the packet, if any.
-    con->dns_id = get_dns_id(&first_remote_addr, first_data, first_data_len);
+    // Get the DNS transaction ID from the packet, if any. In shared mode this is
+    // tracked per binding.
+    con->dns_id = o->shared ? -1 : get_dns_id(&first_remote_addr, first_data, first_data_len);
+    
+    // init bindings list
+    LinkedList1_Init(&con->bindings_list);
     
     BPendingGroup *pg = BReactor_PendingGroup(o->reactor);
     
@@ -317,8 +367,10 @@ struct SocksUdpClient_connection * connection_init (
     // so we need to put first_job on the stack first.
     BPending_Set(&con->first_job);
     
-    // Create a datagram socket
-    if (!BDatagram_Init(&con->socket, con->local_addr.type, o->reactor, con,
+    // Create a datagram socket. A shared connection is not tied to any local address,
+    // so use the address family of the SOCKS server which it is bound next to.
+    int socket_family = o->shared ? o->server_addr.type : con->local_addr.type;
+    if (!BDatagram_Init(&con->socket, socket_family, o->reactor, con,
                         (BDatagram_handler)datagram_state_handler))
     {
         BLog(BLOG_ERROR, "Failed to create a UDP socket");
@@ -341,7 +393,10 @@ struct SocksUdpClient_connection * connection_init (
     // sized packets (o->udp_mtu) including the SOCKS-UDP header.
 
     // Send pipeline: send_writer -> send_buffer -> send_monitor -> send_if -> socket.
-    BDatagram_SendAsync_Init(&con->socket, o->socks_mtu);
+    if (!BDatagram_SendAsync_Init2(&con->socket, o->socks_mtu, SOCKSUDPCLIENT_IO_BATCH)) {
+        BLog(BLOG_ERROR, "BDatagram_SendAsync_Init2 failed");
+        goto fail3a;
+    }
     PacketPassInactivityMonitor_Init(&con->send_monitor,
         BDatagram_SendAsync_GetIf(&con->socket), o->reactor, o->keepalive_time,
         (PacketPassInactivityMonitor_handler)send_monitor_handler, con);
@@ -354,7 +409,10 @@ struct SocksUdpClient_connection * connection_init (
     }
     
     // Receive pipeline: socket -> recv_buffer -> recv_if
-    BDatagram_RecvAsync_Init(&con->socket, o->socks_mtu);
+    if (!BDatagram_RecvAsync_Init2(&con->socket, o->socks_mtu, SOCKSUDPCLIENT_IO_BATCH)) {
+        BLog(BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
+        goto fail4a;
+    }
     PacketPassInterface_Init(&con->recv_if, o->socks_mtu,
         (PacketPassInterface_handler_send)recv_if_handler_send, con, pg);
     if (!SinglePacketBuffer_Init(&con->recv_buffer,
@@ -364,10 +422,18 @@ struct SocksUdpClient_connection * connection_init (
         goto fail5;
     }
     
-    // Insert to connections tree, it must succeed because of the assert.
-    int inserted = BAVL_Insert(&o->connections_tree, &con->connections_tree_node, NULL);
-    ASSERT(inserted)
-    B_USE(inserted)
+    // Insert to connections hash table, it must succeed because of the assert.
+    // Shared connections are found through their bindings instead.
+    if (!o->shared) {
+        con->hash = BAddr_Hash(&con->local_addr);
+        SocksUdpClientHashRef ref = {con, con};
+        int inserted = SocksUdpClientHash_Insert(&o->connections_hash, 0, ref, NULL);
+        ASSERT(inserted)
+        B_USE(inserted)
+    }
+    
+    // insert to connections list as most recently used
+    LinkedList1_Append(&o->connections_list, &con->connections_list_node);
     
     // increment number of connections
     o->num_connections++;
@@ -377,11 +443,13 @@ struct SocksUdpClient_connection * connection_init (
 fail5:
     PacketPassInterface_Free(&con->recv_if);
     BDatagram_RecvAsync_Free(&con->socket);
+fail4a:
     PacketBuffer_Free(&con->send_buffer);
 fail4:
     BufferWriter_Free(&con->send_writer);
     PacketPassInactivityMonitor_Free(&con->send_monitor);
     BDatagram_SendAsync_Free(&con->socket);
+fail3a:
     BSocksClient_Free(&con->socks);
 fail3:
     BDatagram_Free(&con->socket);
@@ -389,7 +457,7 @@ fail2:
     BPending_Free(&con->first_job);
     BFree(con->first_data);
 fail1:
-    BFree(con);
+    BObjectPool_Release(&o->connections_pool, con);
 fail0:
     return NULL;
 }
@@ -402,8 +470,20 @@ void connection_free (struct SocksUdpClient_connection *con)
     ASSERT(o->num_connections > 0)
     o->num_connections--;
     
-    // remove from connections tree
-    BAVL_Remove(&o->connections_tree, &con->connections_tree_node);
+    // remove from connections list
+    LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+    
+    // free bindings using this connection
+    while (!LinkedList1_IsEmpty(&con->bindings_list)) {
+        binding_free(UPPER_OBJECT(LinkedList1_GetFirst(&con->bindings_list),
+            struct SocksUdpClient_binding, con_list_node));
+    }
+    
+    // remove from connections hash table
+    if (!o->shared) {
+        SocksUdpClientHashRef ref = {con, con};
+        SocksUdpClientHash_Remove(&o->connections_hash, 0, ref);
+    }
     
     // Free UDP receive pipeline components
     SinglePacketBuffer_Free(&con->recv_buffer);
@@ -429,7 +509,7 @@ void connection_free (struct SocksUdpClient_connection *con)
     BFree(con->first_data);
 
     // Free structure
-    BFree(con);
+    BObjectPool_Release(&o->connections_pool, con);
 }
 
 void connection_send (struct SocksUdpClient_connection *con,
@@ -531,6 +611,143 @@ void first_job_handler (struct SocksUdpClient_connection *con)
     con->first_data_len = 0;
 }
 
+struct SocksUdpClient_binding * binding_init (SocksUdpClient *o,
+    struct SocksUdpClient_connection *con, BAddr local_addr, BAddr remote_addr,
+    const uint8_t *data, int data_len)
+{
+    ASSERT(o->shared)
+    ASSERT(o->num_bindings < o->max_connections)
+    
+    // allocate structure
+    struct SocksUdpClient_binding *b =
+        (struct SocksUdpClient_binding *)BAlloc(sizeof(*b));
+    if (!b) {
+        BLog(BLOG_ERROR, "BAlloc binding failed");
+        return NULL;
+    }
+    
+    b->con = con;
+    b->local_addr = BFlowAddr_FromBAddr(&local_addr);
+    b->remote_addr = BFlowAddr_FromBAddr(&remote_addr);
+    b->dns_id = get_dns_id(&remote_addr, data, data_len);
+    
+    // insert to hash tables
+    b->flow_hash = flow_hash(&b->local_addr, &b->remote_addr);
+    b->session_hash = session_hash(con, &b->remote_addr);
+    SocksUdpClientFlowHashRef flow_ref = {b, b};
+    int inserted = SocksUdpClientFlowHash_Insert(&o->bindings_by_flow, 0, flow_ref, NULL);
+    ASSERT(inserted)
+    SocksUdpClientSessionHashRef session_ref = {b, b};
+    inserted = SocksUdpClientSessionHash_Insert(&o->bindings_by_session, 0, session_ref, NULL);
+    ASSERT(inserted)
+    B_USE(inserted)
+    
+    // insert to lists
+    LinkedList1_Append(&o->bindings_list, &b->list_node);
+    LinkedList1_Append(&con->bindings_list, &b->con_list_node);
+    o->num_bindings++;
+    
+    return b;
+}
+
+void binding_free (struct SocksUdpClient_binding *b)
+{
+    SocksUdpClient *o = b->con->client;
+    ASSERT(o->shared)
+    ASSERT(o->num_bindings > 0)
+    
+    // remove from lists
+    o->num_bindings--;
+    LinkedList1_Remove(&b->con->bindings_list, &b->con_list_node);
+    LinkedList1_Remove(&o->bindings_list, &b->list_node);
+    
+    // remove from hash tables
+    SocksUdpClientSessionHashRef session_ref = {b, b};
+    SocksUdpClientSessionHash_Remove(&o->bindings_by_session, 0, session_ref);
+    SocksUdpClientFlowHashRef flow_ref = {b, b};
+    SocksUdpClientFlowHash_Remove(&o->bindings_by_flow, 0, flow_ref);
+    
+    BFree(b);
+}
+
+struct SocksUdpClient_connection * find_shared_connection (SocksUdpClient *o,
+    BFlowAddr *remote_addr)
+{
+    ASSERT(o->shared)
+    
+    // Prefer recently used connections, so that the rest go idle and get closed.
+    for (LinkedList1Node *node = LinkedList1_GetLast(&o->connections_list); node;
+         node = LinkedList1Node_Prev(node))
+    {
+        struct SocksUdpClient_connection *con =
+            UPPER_OBJECT(node, struct SocksUdpClient_connection, connections_list_node);
+        struct SocksUdpClient_session_key key = {con, remote_addr};
+        if (!SocksUdpClientSessionHash_Lookup(&o->bindings_by_session, 0, key).ptr) {
+            return con;
+        }
+    }
+    
+    return NULL;
+}
+
+void submit_shared (SocksUdpClient *o,
+    BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    ASSERT(o->shared)
+    
+    // lookup binding
+    BFlowAddr local_key = BFlowAddr_FromBAddr(&local_addr);
+    BFlowAddr remote_key = BFlowAddr_FromBAddr(&remote_addr);
+    struct SocksUdpClient_flow_key key = {&local_key, &remote_key};
+    struct SocksUdpClient_binding *b =
+        SocksUdpClientFlowHash_Lookup(&o->bindings_by_flow, 0, key).ptr;
+    
+    if (b) {
+        if (b->dns_id >= 0 && get_dns_id(&remote_addr, data, data_len) != b->dns_id) {
+            b->dns_id = -1;
+        }
+        
+        // move binding to the end of the list
+        LinkedList1_Remove(&o->bindings_list, &b->list_node);
+        LinkedList1_Append(&o->bindings_list, &b->list_node);
+    } else {
+        // forget the least recently used flow to make room
+        if (o->num_bindings >= o->max_connections) {
+            BLog(BLOG_INFO, "Reached max number of flows, forgetting least recently used.");
+            binding_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->bindings_list),
+                struct SocksUdpClient_binding, list_node));
+        }
+        
+        // Use an existing connection if one is free for this remote address,
+        // otherwise open a new one, which will send this packet first.
+        struct SocksUdpClient_connection *con = find_shared_connection(o, &remote_key);
+        if (!con) {
+            if (o->num_connections >= o->max_connections) {
+                BLog(BLOG_WARNING, "Dropping UDP packet, reached max number of connections.");
+                return;
+            }
+            if (!(con = connection_init(o, local_addr, remote_addr, data, data_len))) {
+                return;
+            }
+            if (!binding_init(o, con, local_addr, remote_addr, data, data_len)) {
+                connection_free(con);
+            }
+            return;
+        }
+        
+        if (!(b = binding_init(o, con, local_addr, remote_addr, data, data_len))) {
+            return;
+        }
+    }
+    
+    // move connection to the end of the list
+    LinkedList1_Remove(&o->connections_list, &b->con->connections_list_node);
+    LinkedList1_Append(&o->connections_list, &b->con->connections_list_node);
+    
+    // send packet
+    connection_send(b->con, remote_addr, data, data_len);
+}
+
 int compute_socks_mtu (int udp_mtu)
 {
     bsize_t bs = bsize_add(
@@ -555,7 +772,7 @@ int get_dns_id (BAddr *remote_addr, const uint8_t *data, int data_len)
 }
 
 int SocksUdpClient_Init (SocksUdpClient *o, int udp_mtu, int max_connections,
-    int send_buf_size, btime_t keepalive_time, BAddr server_addr,
+    int send_buf_size, btime_t keepalive_time, int shared, BAddr server_addr,
     const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
     BReactor *reactor, void *user, SocksUdpClient_handler_received handler_received)
 {
@@ -572,6 +789,7 @@ int SocksUdpClient_Init (SocksUdpClient *o, int udp_mtu, int max_connections,
     o->send_buf_size = send_buf_size;
     o->udp_mtu = udp_mtu;
     o->keepalive_time = keepalive_time;
+    o->shared = !!shared;
     o->reactor = reactor;
     o->user = user;
     o->handler_received = handler_received;
@@ -583,14 +801,42 @@ int SocksUdpClient_Init (SocksUdpClient *o, int udp_mtu, int max_connections,
         goto fail0;
     }
     
-    // init connections tree
-    BAVL_Init(&o->connections_tree,
-        OFFSET_DIFF(struct SocksUdpClient_connection, local_addr, connections_tree_node),
-        (BAVL_comparator)addr_comparator, NULL);
+    // init connections hash table, sized for max_connections
+    if (!SocksUdpClientHash_Init(&o->connections_hash, max_connections)) {
+        BLog(BLOG_ERROR, "SocksUdpClientHash_Init failed");
+        goto fail0;
+    }
+    
+    // init connections list
+    LinkedList1_Init(&o->connections_list);
+    
+    if (o->shared) {
+        // init bindings hash tables
+        if (!SocksUdpClientFlowHash_Init(&o->bindings_by_flow, max_connections)) {
+            BLog(BLOG_ERROR, "SocksUdpClientFlowHash_Init failed");
+            goto fail1;
+        }
+        if (!SocksUdpClientSessionHash_Init(&o->bindings_by_session, max_connections)) {
+            BLog(BLOG_ERROR, "SocksUdpClientSessionHash_Init failed");
+            goto fail2;
+        }
+        
+        // init bindings list
+        LinkedList1_Init(&o->bindings_list);
+        o->num_bindings = 0;
+    }
+    
+    // init connections pool
+    BObjectPool_Init(&o->connections_pool, sizeof(struct SocksUdpClient_connection),
+        SOCKSUDPCLIENT_POOL_SLAB_SIZE, max_connections);
     
     DebugObject_Init(&o->d_obj);
     return 1;
 
+fail2:
+    SocksUdpClientFlowHash_Free(&o->bindings_by_flow);
+fail1:
+    SocksUdpClientHash_Free(&o->connections_hash);
 fail0:
     return 0;
 }
@@ -600,12 +846,25 @@ void SocksUdpClient_Free (SocksUdpClient *o)
     DebugObject_Free(&o->d_obj);
 
     // free connections
-    while (!BAVL_IsEmpty(&o->connections_tree)) {
-        BAVLNode *node = BAVL_GetFirst(&o->connections_tree);
+    while (!LinkedList1_IsEmpty(&o->connections_list)) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->connections_list);
         struct SocksUdpClient_connection *con =
-            UPPER_OBJECT(node, struct SocksUdpClient_connection, connections_tree_node);
+            UPPER_OBJECT(node, struct SocksUdpClient_connection, connections_list_node);
         connection_free(con);
     }
+    
+    // free connections pool
+    BObjectPool_Free(&o->connections_pool);
+    
+    // free bindings hash tables
+    if (o->shared) {
+        ASSERT(LinkedList1_IsEmpty(&o->bindings_list))
+        SocksUdpClientSessionHash_Free(&o->bindings_by_session);
+        SocksUdpClientFlowHash_Free(&o->bindings_by_flow);
+    }
+    
+    // free connections hash table
+    SocksUdpClientHash_Free(&o->connections_hash);
 }
 
 void SocksUdpClient_SubmitPacket (SocksUdpClient *o,
@@ -617,17 +876,27 @@ void SocksUdpClient_SubmitPacket (SocksUdpClient *o,
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->udp_mtu)
     
+    if (o->shared) {
+        submit_shared(o, local_addr, remote_addr, data, data_len);
+        return;
+    }
+    
     // lookup connection
     struct SocksUdpClient_connection *con = find_connection(o, local_addr);
     if (!con) {
         if (o->num_connections >= o->max_connections) {
-            // Drop the packet.
-            BLog(BLOG_WARNING, "Dropping UDP packet, reached max number of connections.");
-            return;
+            // Close the least recently used connection to make room.
+            BLog(BLOG_INFO, "Reached max number of connections, closing least recently used.");
+            connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list),
+                struct SocksUdpClient_connection, connections_list_node));
         }
         // create new connection and enqueue the packet
         connection_init(o, local_addr, remote_addr, data, data_len);
     } else {
+        // move connection to the end of the list
+        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+        
         // send packet
         connection_send(con, remote_addr, data, data_len);
     }
@@ -39,8 +39,11 @@
 #include <flow/PacketPassInterface.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
 #include <socksclient/BSocksClient.h>
-#include <structure/BAVL.h>
+#include <structure/CHash.h>
+#include <structure/LinkedList1.h>
+#include <structure/BObjectPool.h>
 #include <system/BAddr.h>
+#include <system/BFlowAddr.h>
 #include <system/BDatagram.h>
 #include <system/BReactor.h>
 #include <system/BTime.h>
@@ -48,6 +51,35 @@
 typedef void (*SocksUdpClient_handler_received) (
     void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
+struct SocksUdpClient_connection;
+struct SocksUdpClient_binding;
+
+struct SocksUdpClient_flow_key {
+    BFlowAddr *local_addr;
+    BFlowAddr *remote_addr;
+};
+
+struct SocksUdpClient_session_key {
+    struct SocksUdpClient_connection *con;
+    BFlowAddr *remote_addr;
+};
+
+typedef struct SocksUdpClient_connection *SocksUdpClientHash_link;
+typedef BAddr *SocksUdpClientHash_key;
+typedef struct SocksUdpClient_binding *SocksUdpClientFlowHash_link;
+typedef struct SocksUdpClient_flow_key SocksUdpClientFlowHash_key;
+typedef struct SocksUdpClient_binding *SocksUdpClientSessionHash_link;
+typedef struct SocksUdpClient_session_key SocksUdpClientSessionHash_key;
+
+#include "SocksUdpClient_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "SocksUdpClient_flow_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "SocksUdpClient_session_hash.h"
+#include <structure/CHash_decl.h>
+
 typedef struct {
     BAddr server_addr;
     const struct BSocksClient_auth_info *auth_info;
@@ -58,10 +90,18 @@ typedef struct {
     int udp_mtu;
     int socks_mtu;
     btime_t keepalive_time;
+    int shared;
     BReactor *reactor;
     void *user;
     SocksUdpClient_handler_received handler_received;
-    BAVL connections_tree;  // By local_addr
+    SocksUdpClientHash connections_hash;  // By local_addr, if not shared
+    LinkedList1 connections_list;  // Least recently used first
+    BObjectPool connections_pool;
+    // if shared:
+    SocksUdpClientFlowHash bindings_by_flow;  // By (local_addr, remote_addr)
+    SocksUdpClientSessionHash bindings_by_session;  // By (connection, remote_addr)
+    LinkedList1 bindings_list;  // Least recently used first
+    int num_bindings;
     DebugObject d_obj;
 } SocksUdpClient;
 
@@ -86,7 +126,27 @@ struct SocksUdpClient_connection {
     // close ephemeral DNS query connections once a response is received.
     int dns_id;
     BPending first_job;
-    BAVLNode connections_tree_node;
+    size_t hash;  // BAddr_Hash of local_addr
+    SocksUdpClientHash_link hash_next;
+    LinkedList1Node connections_list_node;
+    LinkedList1 bindings_list;  // Bindings using this connection, if shared
+};
+
+// In shared mode, routes one (local_addr, remote_addr) flow over a connection.
+// A connection carries at most one binding per remote_addr so that replies,
+// which only identify the remote address, can be demultiplexed.
+struct SocksUdpClient_binding {
+    struct SocksUdpClient_connection *con;
+    BFlowAddr local_addr;
+    BFlowAddr remote_addr;
+    // As SocksUdpClient_connection.dns_id, but for this flow.
+    int dns_id;
+    size_t flow_hash;
+    SocksUdpClientFlowHash_link flow_hash_next;
+    size_t session_hash;
+    SocksUdpClientSessionHash_link session_hash_next;
+    LinkedList1Node list_node;  // In SocksUdpClient.bindings_list
+    LinkedList1Node con_list_node;  // In SocksUdpClient_connection.bindings_list
 };
 
 /**
@@ -96,9 +156,15 @@ struct SocksUdpClient_connection {
  * 
  * @param o the object
  * @param udp_mtu the maximum size of packets that will be sent through the tunnel
- * @param max_connections how many local ports to track before dropping packets
+ * @param max_connections how many local ports to track before evicting the least
+ *        recently used one
  * @param send_buf_size maximum number of buffered outgoing packets per connection
  * @param keepalive_time how long to track an idle local port before forgetting it
+ * @param shared If nonzero, flows from all local ports share UDP ASSOCIATE sessions
+ *        instead of each local port getting its own. Replies are demultiplexed by
+ *        their source address; a new session is only opened when every existing
+ *        one already carries a flow to the same remote address. max_connections
+ *        then limits the number of tracked (local, remote) flows.
  * @param server_addr SOCKS5 server address
  * @param auth_info List of authentication info for BSocksClient. The pointer must remain
  *        valid while this object exists, the data is not copied.
@@ -109,7 +175,7 @@ struct SocksUdpClient_connection {
  * @return 1 on success, 0 on failure
  */
 int SocksUdpClient_Init (SocksUdpClient *o, int udp_mtu, int max_connections,
-    int send_buf_size, btime_t keepalive_time, BAddr server_addr,
+    int send_buf_size, btime_t keepalive_time, int shared, BAddr server_addr,
     const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
     BReactor *reactor, void *user, SocksUdpClient_handler_received handler_received);
 
@@ -124,9 +190,9 @@ void SocksUdpClient_Free (SocksUdpClient *o);
  * Submit a packet to be sent through the proxy.
  *
  * This will reuse an existing connection for packets from local_addr, or create one if
- * there is none. If the number of live connections exceeds max_connections, or if the
- * number of buffered packets from this port exceeds a limit, packets will be dropped
- * silently.
+ * there is none. If there are already max_connections connections, the least recently
+ * used one is closed to make room. If the number of buffered packets from this port
+ * exceeds a limit, packets will be dropped silently.
  * 
  * As a resource optimization, if a connection has only been used to send one DNS query,
  * then the connection will be closed and freed once the reply is received.
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME SocksUdpClientFlowHash
+#define CHASH_PARAM_ENTRY struct SocksUdpClient_binding
+#define CHASH_PARAM_LINK SocksUdpClientFlowHash_link
+#define CHASH_PARAM_KEY SocksUdpClientFlowHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((SocksUdpClientFlowHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->flow_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) flow_hash((key).local_addr, (key).remote_addr)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (BFlowAddr_Equal(&(entry1).ptr->local_addr, &(entry2).ptr->local_addr) & BFlowAddr_Equal(&(entry1).ptr->remote_addr, &(entry2).ptr->remote_addr))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (BFlowAddr_Equal((key1).local_addr, &(entry2).ptr->local_addr) & BFlowAddr_Equal((key1).remote_addr, &(entry2).ptr->remote_addr))
+#define CHASH_PARAM_ENTRY_NEXT flow_hash_next
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME SocksUdpClientHash
+#define CHASH_PARAM_ENTRY struct SocksUdpClient_connection
+#define CHASH_PARAM_LINK SocksUdpClientHash_link
+#define CHASH_PARAM_KEY SocksUdpClientHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((SocksUdpClientHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) BAddr_Hash((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) BAddr_Compare(&(entry1).ptr->local_addr, &(entry2).ptr->local_addr)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) BAddr_Compare((key1), &(entry2).ptr->local_addr)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
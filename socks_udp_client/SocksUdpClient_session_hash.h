@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME SocksUdpClientSessionHash
+#define CHASH_PARAM_ENTRY struct SocksUdpClient_binding
+#define CHASH_PARAM_LINK SocksUdpClientSessionHash_link
+#define CHASH_PARAM_KEY SocksUdpClientSessionHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((SocksUdpClientSessionHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->session_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) session_hash((key).con, (key).remote_addr)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (((entry1).ptr->con == (entry2).ptr->con) & BFlowAddr_Equal(&(entry1).ptr->remote_addr, &(entry2).ptr->remote_addr))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (((key1).con == (entry2).ptr->con) & BFlowAddr_Equal((key1).remote_addr, &(entry2).ptr->remote_addr))
+#define CHASH_PARAM_ENTRY_NEXT session_hash_next
@@ -31,6 +31,8 @@
 
 #include <misc/byteorder.h>
 #include <misc/balloc.h>
+#include <misc/minmax.h>
+#include <misc/usdt.h>
 #include <base/BLog.h>
 
 #include <socksclient/BSocksClient.h>
@@ -47,8 +49,18 @@
 #define STATE_SENT_REQUEST 8
 #define STATE_RECEIVED_REPLY_HEADER 9
 #define STATE_UP 10
+#define STATE_READY 11
+#define STATE_RESTART_FAILED 12
+
+// space for the largest reply; a deferred request is written after it
+#define REPLY_MAX_SIZE (sizeof(struct socks_reply_header) + sizeof(struct socks_addr_ipv6))
+
+// largest request, with a domain name of maximum length
+#define REQUEST_MAX_SIZE (sizeof(struct socks_request_header) + 1 + BSOCKSCLIENT_DEST_NAME_MAX + 2)
 
 static void report_error (BSocksClient *o, int error);
+static int init_connector (BSocksClient *o);
+static void free_connector (BSocksClient *o);
 static void init_control_io (BSocksClient *o);
 static void free_control_io (BSocksClient *o);
 static void init_up_io (BSocksClient *o);
@@ -62,12 +74,43 @@ static void continue_job_handler (BSocksClient *o);
 static void recv_handler_done (BSocksClient *o, int data_len);
 static void send_handler_done (BSocksClient *o);
 static void auth_finished (BSocksClient *p);
+static void go_up (BSocksClient *o);
+static void try_send_early (BSocksClient *o);
+static void restart_unpipelined (BSocksClient *o);
+static int password_size (const struct BSocksClient_auth_info *ai, bsize_t *out_size);
+static void write_password (const struct BSocksClient_auth_info *ai, char *dest);
+static int request_size (BSocksClient *o, bsize_t *out_size);
+static void write_request (BSocksClient *o, char *dest);
+static int init_object (BSocksClient *o,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor);
 
 void report_error (BSocksClient *o, int error)
 {
+    BTRACE2(socks_error, o, error);
+    
     DEBUGERROR(&o->d_err, o->handler(o->user, error))
 }
 
+int init_connector (BSocksClient *o)
+{
+    if (o->resolver) {
+        return BNameConnector_Init(&o->name_connector, o->resolver, o->server_name, o->server_port, o->fast_open,
+                                   o->reactor, o, (BNameConnector_handler)connector_handler);
+    }
+    
+    return BConnector_InitFrom(&o->connector, o->server_from, o->reactor, o, (BConnector_handler)connector_handler);
+}
+
+void free_connector (BSocksClient *o)
+{
+    if (o->resolver) {
+        BNameConnector_Free(&o->name_connector);
+    } else {
+        BConnector_Free(&o->connector);
+    }
+}
+
 void init_control_io (BSocksClient *o)
 {
     // init receiving
@@ -158,7 +201,8 @@ void connector_handler (BSocksClient* o, int is_error)
     }
     
     // init connection
-    if (!BConnection_Init(&o->con, BConnection_source_connector(&o->connector), o->reactor, o, (BConnection_handler)connection_handler)) {
+    BConnector *connector = (o->resolver ? BNameConnector_GetConnector(&o->name_connector) : &o->connector);
+    if (!BConnection_Init(&o->con, BConnection_source_connector(connector), o->reactor, o, (BConnection_handler)connection_handler)) {
         BLog(BLOG_ERROR, "BConnection_Init failed");
         goto fail0;
     }
@@ -171,7 +215,13 @@ void connector_handler (BSocksClient* o, int is_error)
     // go to STATE_CONNECTED_HANDLER and set the continue job in order to continue
     // in continue_job_handler
     o->state = STATE_CONNECTED_HANDLER;
+    BTRACE2(socks_state, o, o->state);
     BPending_Set(&o->continue_job);
+    
+    // the user has already seen the connected event if we are redoing the handshake
+    if (o->restarted) {
+        return;
+    }
 
     // call the handler with the connected event
     o->handler(o->user, BSOCKSCLIENT_EVENT_CONNECTED);
@@ -207,14 +257,45 @@ void continue_job_handler (BSocksClient *o)
         goto fail0;
     }
 
-    // allocate buffer for sending hello
-    bsize_t size = bsize_add(
+    // with pipelining, offer only the preferred method
+    size_t first_method = (o->pipelined ? o->num_auth_info - 1 : 0);
+    size_t num_methods = o->num_auth_info - first_method;
+    const struct BSocksClient_auth_info *ai = &o->auth_info[first_method];
+    
+    // compute size of hello
+    bsize_t hello_size = bsize_add(
         bsize_fromsize(sizeof(struct socks_client_hello_header)), 
         bsize_mul(
-            bsize_fromsize(o->num_auth_info),
+            bsize_fromsize(num_methods),
             bsize_fromsize(sizeof(struct socks_client_hello_method))
         )
     );
+    
+    // with pipelining, the password packet and the request follow the hello
+    bsize_t pw_size = bsize_fromsize(0);
+    bsize_t req_size = bsize_fromsize(0);
+    o->pipelined_method = -1;
+    o->pipelined_request = 0;
+    if (o->pipelined) {
+        o->pipelined_method = ai->auth_type;
+        
+        if (ai->auth_type == SOCKS_METHOD_USERNAME_PASSWORD && !password_size(ai, &pw_size)) {
+            BLog(BLOG_NOTICE, "invalid username/password length");
+            goto fail0;
+        }
+        
+        // a deferred request is sent later
+        if (o->udp || !BAddr_IsInvalid(&o->dest_addr)) {
+            if (!request_size(o, &req_size)) {
+                BLog(BLOG_ERROR, "Invalid dest_addr address type.");
+                goto fail0;
+            }
+            o->pipelined_request = 1;
+        }
+    }
+    
+    // allocate buffer for sending
+    bsize_t size = bsize_add(hello_size, bsize_add(pw_size, req_size));
     if (!reserve_buffer(o, size)) {
         goto fail0;
     }
@@ -222,21 +303,30 @@ void continue_job_handler (BSocksClient *o)
     // write hello header
     struct socks_client_hello_header header;
     header.ver = hton8(SOCKS_VERSION);
-    header.nmethods = hton8(o->num_auth_info);
+    header.nmethods = hton8(num_methods);
     memcpy(o->buffer, &header, sizeof(header));
     
     // write hello methods
-    for (size_t i = 0; i < o->num_auth_info; i++) {
+    for (size_t i = 0; i < num_methods; i++) {
         struct socks_client_hello_method method;
-        method.method = hton8(o->auth_info[i].auth_type);
+        method.method = hton8(o->auth_info[first_method + i].auth_type);
         memcpy(o->buffer + sizeof(header) + i * sizeof(method), &method, sizeof(method));
     }
     
+    // write pipelined password packet and request
+    if (o->pipelined_method == SOCKS_METHOD_USERNAME_PASSWORD) {
+        write_password(ai, o->buffer + hello_size.value);
+    }
+    if (o->pipelined_request) {
+        write_request(o, o->buffer + hello_size.value + pw_size.value);
+    }
+    
     // send
     PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
     
     // set state
     o->state = STATE_SENDING_HELLO;
+    BTRACE2(socks_state, o, o->state);
 
     return;
 
@@ -259,6 +349,13 @@ void recv_handler_done (BSocksClient *o, int data_len)
     }
     
     switch (o->state) {
+        case STATE_READY:
+        case STATE_SENDING_REQUEST: {
+            // only possible with a deferred request, whose reply is received early
+            BLog(BLOG_NOTICE, "reply received before request was sent");
+            goto fail;
+        } break;
+        
         case STATE_SENT_HELLO: {
             BLog(BLOG_DEBUG, "received hello");
             
@@ -270,6 +367,13 @@ void recv_handler_done (BSocksClient *o, int data_len)
                 goto fail;
             }
             
+            // if the server didn't take the method we pipelined for, what we sent
+            // after the hello is garbage to it, so start over without pipelining
+            if (o->pipelined_method >= 0 && ntoh8(imsg.method) != o->pipelined_method) {
+                restart_unpipelined(o);
+                return;
+            }
+            
             size_t auth_index;
             for (auth_index = 0; auth_index < o->num_auth_info; auth_index++) {
                 if (o->auth_info[auth_index].auth_type == ntoh8(imsg.method)) {
@@ -294,28 +398,33 @@ void recv_handler_done (BSocksClient *o, int data_len)
                 case SOCKS_METHOD_USERNAME_PASSWORD: {
                     BLog(BLOG_DEBUG, "password authentication");
                     
-                    if (ai->password.username_len == 0 || ai->password.username_len > 255 ||
-                        ai->password.password_len == 0 || ai->password.password_len > 255
-                    ) {
-                        BLog(BLOG_NOTICE, "invalid username/password length");
-                        goto fail;
+                    // with pipelining the password packet was already sent
+                    if (o->pipelined_method >= 0) {
+                        // allocate buffer for receiving reply
+                        if (!reserve_buffer(o, bsize_fromsize(2))) {
+                            goto fail;
+                        }
+                        
+                        // receive reply
+                        start_receive(o, (uint8_t *)o->buffer, 2);
+                        
+                        // set state
+                        o->state = STATE_SENT_PASSWORD;
+                        break;
                     }
                     
                     // allocate password packet
-                    bsize_t size = bsize_fromsize(1 + 1 + ai->password.username_len + 1 + ai->password.password_len);
+                    bsize_t size;
+                    if (!password_size(ai, &size)) {
+                        BLog(BLOG_NOTICE, "invalid username/password length");
+                        goto fail;
+                    }
                     if (!reserve_buffer(o, size)) {
                         goto fail;
                     }
                     
                     // write password packet
-                    char *ptr = o->buffer;
-                    *ptr++ = 1;
-                    *ptr++ = ai->password.username_len;
-                    memcpy(ptr, ai->password.username, ai->password.username_len);
-                    ptr += ai->password.username_len;
-                    *ptr++ = ai->password.password_len;
-                    memcpy(ptr, ai->password.password, ai->password.password_len);
-                    ptr += ai->password.password_len;
+                    write_password(ai, o->buffer);
                     
                     // start sending
                     PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
@@ -407,23 +516,18 @@ void recv_handler_done (BSocksClient *o, int data_len)
                 default: ASSERT(0);
             }
             
-            // free buffer
-            BFree(o->buffer);
-            o->buffer = NULL;
-            
-            // free control I/O
-            free_control_io(o);
-            
-            // init up I/O
-            // Initializing this is not needed for UDP ASSOCIATE but it doesn't hurt.
-            // We anyway don't allow the user to use these interfaces in that case.
-            init_up_io(o);
+            // by now the server has answered, so this is known
+            if (o->fast_open) {
+                BLog(BLOG_DEBUG, "fast open %s", (BConnection_FastOpenAccepted(&o->con) ? "accepted" : "not accepted"));
+            }
             
-            // set state
-            o->state = STATE_UP;
+            // finish writing early data before going up
+            if (o->early_sending) {
+                o->early_up_pending = 1;
+                return;
+            }
             
-            // call handler
-            o->handler(o->user, BSOCKSCLIENT_EVENT_UP);
+            go_up(o);
             return;
         } break;
         
@@ -442,6 +546,19 @@ void send_handler_done (BSocksClient *o)
     DebugObject_Access(&o->d_obj);
     ASSERT(o->buffer)
     
+    if (o->early_sending) {
+        BLog(BLOG_DEBUG, "sent early data");
+        
+        o->early_sending = 0;
+        o->early_sent = o->early_len;
+        
+        // go up if the reply arrived meanwhile
+        if (o->early_up_pending) {
+            go_up(o);
+        }
+        return;
+    }
+    
     switch (o->state) {
         case STATE_SENDING_HELLO: {
             BLog(BLOG_DEBUG, "sent hello");
@@ -457,11 +574,21 @@ void send_handler_done (BSocksClient *o)
             
             // set state
             o->state = STATE_SENT_HELLO;
+            
+            // with a pipelined request, early data can follow right away
+            try_send_early(o);
         } break;
         
         case STATE_SENDING_REQUEST: {
             BLog(BLOG_DEBUG, "sent request");
             
+            // with a deferred request, the reply header is already being received
+            if (o->request_deferred) {
+                o->state = STATE_SENT_REQUEST;
+                try_send_early(o);
+                break;
+            }
+            
             // allocate buffer for receiving reply
             bsize_t size = bsize_add(
                 bsize_fromsize(sizeof(struct socks_reply_header)),
@@ -476,6 +603,9 @@ void send_handler_done (BSocksClient *o)
             
             // set state
             o->state = STATE_SENT_REQUEST;
+            
+            // send early data
+            try_send_early(o);
         } break;
         
         case STATE_SENDING_PASSWORD: {
@@ -506,8 +636,191 @@ fail:
 
 void auth_finished (BSocksClient *o)
 {
+    // with pipelining the request was already sent, receive the reply
+    if (o->pipelined_request) {
+        // allocate buffer for receiving reply
+        bsize_t size = bsize_fromsize(REPLY_MAX_SIZE);
+        if (!reserve_buffer(o, size)) {
+            report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+            return;
+        }
+        
+        // receive reply header
+        start_receive(o, (uint8_t *)o->buffer, sizeof(struct socks_reply_header));
+        
+        // set state
+        o->state = STATE_SENT_REQUEST;
+        
+        // send early data
+        try_send_early(o);
+        return;
+    }
+    
+    // defer the CONNECT if we don't know the destination yet
+    if (!o->udp && BAddr_IsInvalid(&o->dest_addr)) {
+        BLog(BLOG_DEBUG, "request deferred");
+        
+        // allocate buffer for the reply followed by the request
+        bsize_t size = bsize_fromsize(REPLY_MAX_SIZE + REQUEST_MAX_SIZE);
+        if (!reserve_buffer(o, size)) {
+            report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+            return;
+        }
+        
+        // Start receiving the reply header now. Nothing should arrive before the request
+        // is sent, but this notices the server closing the connection while we wait.
+        start_receive(o, (uint8_t *)o->buffer, sizeof(struct socks_reply_header));
+        
+        // set state
+        o->request_deferred = 1;
+        o->state = STATE_READY;
+        BTRACE2(socks_state, o, o->state);
+        
+        // call handler
+        o->handler(o->user, BSOCKSCLIENT_EVENT_READY);
+        return;
+    }
+    
     // allocate request buffer
+    bsize_t size;
+    if (!request_size(o, &size)) {
+        BLog(BLOG_ERROR, "Invalid dest_addr address type.");
+        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+        return;
+    }
+    if (!reserve_buffer(o, size)) {
+        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+        return;
+    }
+    
+    // write request
+    write_request(o, o->buffer);
+    
+    // send request
+    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
+    
+    // set state
+    o->state = STATE_SENDING_REQUEST;
+    BTRACE2(socks_state, o, o->state);
+}
+
+void go_up (BSocksClient *o)
+{
+    ASSERT(o->state == STATE_RECEIVED_REPLY_HEADER)
+    ASSERT(!o->early_sending)
+    
+    // free buffer
+    BFree(o->buffer);
+    o->buffer = NULL;
+    
+    // free control I/O
+    free_control_io(o);
+    
+    // init up I/O
+    // Initializing this is not needed for UDP ASSOCIATE but it doesn't hurt.
+    // We anyway don't allow the user to use these interfaces in that case.
+    init_up_io(o);
+    
+    // set state
+    o->state = STATE_UP;
+    BTRACE2(socks_state, o, o->state);
+    
+    // call handler
+    o->handler(o->user, BSOCKSCLIENT_EVENT_UP);
+}
+
+void try_send_early (BSocksClient *o)
+{
+    // the sender must be idle and the server must be past the request
+    int request_sent = (o->state == STATE_SENT_REQUEST || o->state == STATE_RECEIVED_REPLY_HEADER ||
+        (o->pipelined_request && (o->state == STATE_SENT_HELLO || o->state == STATE_SENT_PASSWORD)));
+    
+    if (o->early_sending || o->early_sent == o->early_len || !request_sent || o->early_up_pending) {
+        return;
+    }
+    
+    // send what we haven't yet
+    o->early_sending = 1;
+    PacketPassInterface_Sender_Send(o->control.send_if, o->early_buf + o->early_sent, o->early_len - o->early_sent);
+}
+
+void restart_unpipelined (BSocksClient *o)
+{
+    BLog(BLOG_NOTICE, "server did not select the pipelined method, retrying without pipelining");
+    
+    // free connection
+    free_control_io(o);
+    BConnection_Free(&o->con);
+    
+    // free connector
+    free_connector(o);
+    
+    // don't pipeline again
+    o->pipelined = false;
+    o->pipelined_method = -1;
+    o->pipelined_request = 0;
+    o->restarted = 1;
+    
+    // whatever early data was written is lost with the connection
+    o->early_sending = 0;
+    o->early_sent = 0;
+    
+    // connect again
+    if (!init_connector(o)) {
+        BLog(BLOG_ERROR, "failed to init connector");
+        o->state = STATE_RESTART_FAILED;
+        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+        return;
+    }
+    
+    // set state
+    o->state = STATE_CONNECTING;
+    BTRACE2(socks_state, o, o->state);
+}
+
+int password_size (const struct BSocksClient_auth_info *ai, bsize_t *out_size)
+{
+    ASSERT(ai->auth_type == SOCKS_METHOD_USERNAME_PASSWORD)
+    
+    if (ai->password.username_len == 0 || ai->password.username_len > 255 ||
+        ai->password.password_len == 0 || ai->password.password_len > 255
+    ) {
+        return 0;
+    }
+    
+    *out_size = bsize_fromsize(1 + 1 + ai->password.username_len + 1 + ai->password.password_len);
+    return 1;
+}
+
+void write_password (const struct BSocksClient_auth_info *ai, char *dest)
+{
+    ASSERT(ai->auth_type == SOCKS_METHOD_USERNAME_PASSWORD)
+    
+    char *ptr = dest;
+    *ptr++ = 1;
+    *ptr++ = ai->password.username_len;
+    memcpy(ptr, ai->password.username, ai->password.username_len);
+    ptr += ai->password.username_len;
+    *ptr++ = ai->password.password_len;
+    memcpy(ptr, ai->password.password, ai->password.password_len);
+}
+
+int request_size (BSocksClient *o, bsize_t *out_size)
+{
+    // report an overflow if the address type is invalid
+    *out_size = bsize_overflow();
+    
     bsize_t size = bsize_fromsize(sizeof(struct socks_request_header));
+    
+    // a domain name takes the place of the address, the port is that of dest_addr
+    if (o->dest_name) {
+        if (o->dest_addr.type != BADDR_TYPE_IPV4 && o->dest_addr.type != BADDR_TYPE_IPV6) {
+            return 0;
+        }
+        *out_size = bsize_add(size, bsize_fromsize(1 + o->dest_name_len + 2));
+        return 1;
+    }
+    
     switch (o->dest_addr.type) {
         case BADDR_TYPE_IPV4:
             size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv4)));
@@ -516,45 +829,51 @@ void auth_finished (BSocksClient *o)
             size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv6)));
             break;
         default:
-            BLog(BLOG_ERROR, "Invalid dest_addr address type.");
-            report_error(o, BSOCKSCLIENT_EVENT_ERROR);
-            return;
-    }
-    if (!reserve_buffer(o, size)) {
-        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
-        return;
+            return 0;
     }
     
-    // write request
+    *out_size = size;
+    return 1;
+}
+
+void write_request (BSocksClient *o, char *dest)
+{
     struct socks_request_header header;
     header.ver = hton8(SOCKS_VERSION);
     header.cmd = hton8(o->udp ? SOCKS_CMD_UDP_ASSOCIATE : SOCKS_CMD_CONNECT);
     header.rsv = hton8(0);
+    
+    if (o->dest_name) {
+        header.atyp = hton8(SOCKS_ATYP_DOMAINNAME);
+        uint16_t port = (o->dest_addr.type == BADDR_TYPE_IPV4 ? o->dest_addr.ipv4.port : o->dest_addr.ipv6.port);
+        char *ptr = dest + sizeof(header);
+        *ptr++ = o->dest_name_len;
+        memcpy(ptr, o->dest_name, o->dest_name_len);
+        ptr += o->dest_name_len;
+        memcpy(ptr, &port, sizeof(port));
+        memcpy(dest, &header, sizeof(header));
+        return;
+    }
+    
     switch (o->dest_addr.type) {
         case BADDR_TYPE_IPV4: {
             header.atyp = hton8(SOCKS_ATYP_IPV4);
             struct socks_addr_ipv4 addr;
             addr.addr = o->dest_addr.ipv4.ip;
             addr.port = o->dest_addr.ipv4.port;
-            memcpy(o->buffer + sizeof(header), &addr, sizeof(addr));
+            memcpy(dest + sizeof(header), &addr, sizeof(addr));
         } break;
         case BADDR_TYPE_IPV6: {
             header.atyp = hton8(SOCKS_ATYP_IPV6);
             struct socks_addr_ipv6 addr;
             memcpy(addr.addr, o->dest_addr.ipv6.ip, sizeof(o->dest_addr.ipv6.ip));
             addr.port = o->dest_addr.ipv6.port;
-            memcpy(o->buffer + sizeof(header), &addr, sizeof(addr));
+            memcpy(dest + sizeof(header), &addr, sizeof(addr));
         } break;
         default:
             ASSERT(0);
     }
-    memcpy(o->buffer, &header, sizeof(header));
-    
-    // send request
-    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
-    
-    // set state
-    o->state = STATE_SENDING_REQUEST;
+    memcpy(dest, &header, sizeof(header));
 }
 
 struct BSocksClient_auth_info BSocksClient_auth_none (void)
@@ -580,6 +899,15 @@ int BSocksClient_Init (BSocksClient *o, BAddr server_addr,
     bool udp, BSocksClient_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(!BAddr_IsInvalid(&server_addr))
+    
+    return BSocksClient_InitFrom(o, BLisCon_from_addr(server_addr), auth_info, num_auth_info, dest_addr,
+                                 udp, handler, user, reactor);
+}
+
+int init_object (BSocksClient *o,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor)
+{
 #ifndef NDEBUG
     for (size_t i = 0; i < num_auth_info; i++) {
         ASSERT(auth_info[i].auth_type == SOCKS_METHOD_NO_AUTHENTICATION_REQUIRED ||
@@ -591,6 +919,8 @@ int BSocksClient_Init (BSocksClient *o, BAddr server_addr,
     o->auth_info = auth_info;
     o->num_auth_info = num_auth_info;
     o->dest_addr = dest_addr;
+    o->dest_name = NULL;
+    o->dest_name_len = 0;
     o->udp = udp;
     o->handler = handler;
     o->user = user;
@@ -598,19 +928,36 @@ int BSocksClient_Init (BSocksClient *o, BAddr server_addr,
     
     // set no buffer
     o->buffer = NULL;
+    
+    // request is not deferred until we find out otherwise
+    o->request_deferred = 0;
+    
+    // don't pipeline unless asked to
+    o->pipelined = false;
+    o->pipelined_method = -1;
+    o->pipelined_request = 0;
+    o->restarted = 0;
+    
+    // have no early data
+    o->early_buf = NULL;
+    o->early_len = 0;
+    o->early_sent = 0;
+    o->early_sending = 0;
+    o->early_up_pending = 0;
 
     // init continue_job
     BPending_Init(&o->continue_job, BReactor_PendingGroup(o->reactor),
         (BPending_handler)continue_job_handler, o);
     
     // init connector
-    if (!BConnector_Init(&o->connector, server_addr, o->reactor, o, (BConnector_handler)connector_handler)) {
-        BLog(BLOG_ERROR, "BConnector_Init failed");
+    if (!init_connector(o)) {
+        BLog(BLOG_ERROR, "failed to init connector");
         goto fail0;
     }
     
     // set state
     o->state = STATE_CONNECTING;
+    BTRACE2(socks_state, o, o->state);
     
     DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
     DebugObject_Init(&o->d_obj);
@@ -621,34 +968,95 @@ fail0:
     return 0;
 }
 
+int BSocksClient_InitFrom (BSocksClient *o, struct BLisCon_from server_from,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor)
+{
+    // connect to the given address
+    o->server_from = server_from;
+    o->resolver = NULL;
+    o->server_name = NULL;
+    o->fast_open = (server_from.type == BLISCON_FROM_ADDR && server_from.u.from_addr.fast_open);
+    
+    return init_object(o, auth_info, num_auth_info, dest_addr, udp, handler, user, reactor);
+}
+
+int BSocksClient_InitName (BSocksClient *o, BResolver *resolver, const char *server_name,
+    uint16_t server_port, int fast_open,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor)
+{
+    ASSERT(resolver)
+    ASSERT(server_name)
+    
+    // connect by name; the name is kept for reconnecting
+    o->resolver = resolver;
+    o->server_port = server_port;
+    o->fast_open = !!fast_open;
+    if (!(o->server_name = (char *)BAlloc(strlen(server_name) + 1))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    strcpy(o->server_name, server_name);
+    
+    if (!init_object(o, auth_info, num_auth_info, dest_addr, udp, handler, user, reactor)) {
+        goto fail1;
+    }
+    
+    return 1;
+    
+fail1:
+    BFree(o->server_name);
+fail0:
+    return 0;
+}
+
 void BSocksClient_Free (BSocksClient *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
     
-    if (o->state != STATE_CONNECTING) {
-        if (o->state == STATE_UP) {
-            // free up I/O
-            free_up_io(o);
-        } else {
-            // free control I/O
-            free_control_io(o);
+    // a failed restart left neither a connection nor a connector
+    if (o->state != STATE_RESTART_FAILED) {
+        if (o->state != STATE_CONNECTING) {
+            if (o->state == STATE_UP) {
+                // free up I/O
+                free_up_io(o);
+            } else {
+                // free control I/O
+                free_control_io(o);
+            }
+            
+            // free connection
+            BConnection_Free(&o->con);
         }
         
-        // free connection
-        BConnection_Free(&o->con);
+        // free connector
+        free_connector(o);
     }
     
-    // free connector
-    BConnector_Free(&o->connector);
-    
     // free continue job
     BPending_Free(&o->continue_job);
 
+    // free early data buffer
+    if (o->early_buf) {
+        BFree(o->early_buf);
+    }
+    
     // free buffer
     if (o->buffer) {
         BFree(o->buffer);
     }
+    
+    // free destination name
+    if (o->dest_name) {
+        BFree(o->dest_name);
+    }
+    
+    // free server name
+    if (o->server_name) {
+        BFree(o->server_name);
+    }
 }
 
 int BSocksClient_GetLocalAddr (BSocksClient *o, BAddr *local_addr)
@@ -667,6 +1075,104 @@ void BSocksClient_SetDestAddr (BSocksClient *o, BAddr dest_addr)
     o->dest_addr = dest_addr;
 }
 
+int BSocksClient_SetDestName (BSocksClient *o, const char *name, size_t name_len)
+{
+    ASSERT(o->state == STATE_CONNECTING || o->state == STATE_CONNECTED_HANDLER ||
+           (o->state == STATE_READY && o->request_deferred))
+    ASSERT(!o->udp)
+    ASSERT(name)
+    DebugObject_Access(&o->d_obj);
+    
+    if (name_len == 0 || name_len > BSOCKSCLIENT_DEST_NAME_MAX) {
+        BLog(BLOG_ERROR, "invalid destination name length");
+        return 0;
+    }
+    
+    char *copy = (char *)BAlloc(name_len);
+    if (!copy) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    memcpy(copy, name, name_len);
+    
+    if (o->dest_name) {
+        BFree(o->dest_name);
+    }
+    o->dest_name = copy;
+    o->dest_name_len = name_len;
+    
+    return 1;
+}
+
+void BSocksClient_SetPipelined (BSocksClient *o, bool pipelined)
+{
+    ASSERT(o->state == STATE_CONNECTING || o->state == STATE_CONNECTED_HANDLER)
+    DebugObject_Access(&o->d_obj);
+    
+    o->pipelined = pipelined;
+}
+
+int BSocksClient_SendEarlyData (BSocksClient *o, const uint8_t *data, int data_len)
+{
+    ASSERT(o->state != STATE_UP)
+    ASSERT(!o->udp)
+    ASSERT(data_len > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // can't append while a part is being written
+    if (o->early_sending) {
+        return 0;
+    }
+    
+    // allocate buffer
+    if (!o->early_buf && !(o->early_buf = (uint8_t *)BAlloc(BSOCKSCLIENT_EARLY_DATA_MAX))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // take as much as fits
+    int amount = bmin_int(data_len, BSOCKSCLIENT_EARLY_DATA_MAX - o->early_len);
+    memcpy(o->early_buf + o->early_len, data, amount);
+    o->early_len += amount;
+    
+    // send it if the request is out
+    try_send_early(o);
+    
+    return amount;
+}
+
+void BSocksClient_Connect (BSocksClient *o, BAddr dest_addr)
+{
+    ASSERT(o->state == STATE_READY)
+    ASSERT(dest_addr.type == BADDR_TYPE_IPV4 || dest_addr.type == BADDR_TYPE_IPV6)
+    DebugObject_Access(&o->d_obj);
+    
+    o->dest_addr = dest_addr;
+    
+    bsize_t size;
+    ASSERT_EXECUTE(request_size(o, &size))
+    
+    // write request after the reply space, which is being received into
+    char *request = o->buffer + REPLY_MAX_SIZE;
+    write_request(o, request);
+    
+    // send request
+    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)request, size.value);
+    
+    // set state
+    o->state = STATE_SENDING_REQUEST;
+    BTRACE2(socks_state, o, o->state);
+}
+
+void BSocksClient_SetHandler (BSocksClient *o, BSocksClient_handler handler, void *user)
+{
+    ASSERT(handler)
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler = handler;
+    o->user = user;
+}
+
 BAddr BSocksClient_GetBindAddr (BSocksClient *o)
 {
     ASSERT(o->state == STATE_UP)
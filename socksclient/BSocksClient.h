@@ -45,12 +45,19 @@
 #include <base/DebugObject.h>
 #include <base/BPending.h>
 #include <system/BConnection.h>
+#include <resolver/BNameConnector.h>
 #include <flow/PacketStreamSender.h>
 
 #define BSOCKSCLIENT_EVENT_ERROR 1
 #define BSOCKSCLIENT_EVENT_UP 2
 #define BSOCKSCLIENT_EVENT_ERROR_CLOSED 3
 #define BSOCKSCLIENT_EVENT_CONNECTED 4
+#define BSOCKSCLIENT_EVENT_READY 5
+
+#define BSOCKSCLIENT_EARLY_DATA_MAX 8192
+
+// maximum length of a domain name sent as DST.ADDR
+#define BSOCKSCLIENT_DEST_NAME_MAX 255
 
 /**
  * Handler for events generated by the SOCKS client.
@@ -67,6 +74,10 @@
  *   and the SOCKS protocol is about to begin. The local address of the TCP connection is
  *   now available via @ref BSocksClient_GetLocalAddr. The job closure of this callback
  *   is the last chance to call @ref BSocksClient_SetDestAddr.
+ * - BSOCKSCLIENT_EVENT_READY: Only reported when the CONNECT was deferred (see
+ *   @ref BSocksClient_Init). Authentication has completed and the object waits for
+ *   @ref BSocksClient_Connect. BSOCKSCLIENT_EVENT_ERROR may still follow, e.g. if
+ *   the server closes the idle connection.
  *   
  * @param user as in {@link BSocksClient_Init}
  * @param event See above.
@@ -89,7 +100,15 @@ typedef struct {
     const struct BSocksClient_auth_info *auth_info;
     size_t num_auth_info;
     BAddr dest_addr;
+    char *dest_name;
+    size_t dest_name_len;
     bool udp;
+    int fast_open;
+    bool pipelined;
+    struct BLisCon_from server_from;
+    BResolver *resolver;
+    char *server_name;
+    uint16_t server_port;
     BAddr bind_addr;
     BSocksClient_handler handler;
     void *user;
@@ -97,8 +116,18 @@ typedef struct {
     int state;
     char *buffer;
     BConnector connector;
+    BNameConnector name_connector;
     BConnection con;
     BPending continue_job;
+    int request_deferred;
+    int pipelined_method;
+    int pipelined_request;
+    int restarted;
+    uint8_t *early_buf;
+    int early_len;
+    int early_sent;
+    int early_sending;
+    int early_up_pending;
     union {
         struct {
             PacketPassInterface *send_if;
@@ -137,6 +166,9 @@ struct BSocksClient_auth_info BSocksClient_auth_password (const char *username,
  *        It is also possible to specify it later from the BSOCKSCLIENT_EVENT_CONNECTED
  *        event callback using @ref BSocksClient_SetDestAddr; this is necessary for UDP
  *        if the local TCP connection address must be known to bind the UDP socket.
+ *        For CONNECT, if the address is still BADDR_TYPE_NONE once authentication has
+ *        completed, the request is deferred: the object reports BSOCKSCLIENT_EVENT_READY
+ *        and sends the request when @ref BSocksClient_Connect is called.
  * @param udp false to perform a CONNECT, true to perform a UDP ASSOCIATE
  * @param handler handler for up and error events
  * @param user value passed to handler
@@ -147,6 +179,31 @@ int BSocksClient_Init (BSocksClient *o, BAddr server_addr,
     const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
     bool udp, BSocksClient_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
 
+/**
+ * Like {@link BSocksClient_Init}, but takes the SOCKS server as a {@link BLisCon_from},
+ * e.g. one from {@link BLisCon_from_addr_fastopen} to send the greeting in the
+ * SYN with TCP Fast Open.
+ */
+int BSocksClient_InitFrom (BSocksClient *o, struct BLisCon_from server_from,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Like {@link BSocksClient_Init}, but takes the SOCKS server as a host name, which
+ * is resolved with a {@link BResolver} without blocking. The addresses of the name
+ * are tried in turn until one accepts the connection (see {@link BNameConnector}).
+ * 
+ * @param resolver resolver to use. It must outlive this object.
+ * @param server_name null-terminated name of the SOCKS server, or a numeric address.
+ *        It is copied.
+ * @param server_port port of the SOCKS server, in network byte order
+ * @param fast_open whether to use TCP Fast Open, as in {@link BLisCon_from_addr_fastopen}
+ */
+int BSocksClient_InitName (BSocksClient *o, BResolver *resolver, const char *server_name,
+    uint16_t server_port, int fast_open,
+    const struct BSocksClient_auth_info *auth_info, size_t num_auth_info, BAddr dest_addr,
+    bool udp, BSocksClient_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
+
 /**
  * Frees the object.
  * 
@@ -176,6 +233,92 @@ int BSocksClient_GetLocalAddr (BSocksClient *o, BAddr *local_addr);
  */
 void BSocksClient_SetDestAddr (BSocksClient *o, BAddr dest_addr);
 
+/**
+ * Send a domain name as DST.ADDR of the CONNECT request instead of the address.
+ * 
+ * The port is still taken from the destination address, which must be an IPv4 or
+ * IPv6 address by the time the request is sent. The name is copied. This may be
+ * called whenever @ref BSocksClient_SetDestAddr may be, and also after the
+ * BSOCKSCLIENT_EVENT_READY event, before @ref BSocksClient_Connect. It must not be
+ * used in UDP ASSOCIATE mode.
+ * 
+ * @param o the object
+ * @param name domain name, not null-terminated
+ * @param name_len length of the name, 1 to BSOCKSCLIENT_DEST_NAME_MAX
+ * @return 1 on success, 0 on failure
+ */
+int BSocksClient_SetDestName (BSocksClient *o, const char *name, size_t name_len);
+
+/**
+ * Enable or disable pipelining of the handshake.
+ * 
+ * With pipelining, only a single authentication method is offered (the last one
+ * in the list passed to @ref BSocksClient_Init, which should be the preferred one),
+ * and the greeting, the username/password authentication (if that is the method)
+ * and the request are written together. The replies are then parsed in sequence,
+ * so the handshake completes in one round trip instead of up to three. A deferred
+ * request is not included and is sent later as usual.
+ * 
+ * If the server does not select the offered method, the connection is closed and
+ * the handshake is redone without pipelining, offering all methods. Servers which
+ * read the greeting and then discard the rest of what they received are not
+ * compatible with pipelining.
+ * 
+ * The last chance to call this function is in the job closure of the
+ * BSOCKSCLIENT_EVENT_CONNECTED event, this must not be called after that.
+ * 
+ * @param o the object
+ * @param pipelined whether to pipeline the handshake
+ */
+void BSocksClient_SetPipelined (BSocksClient *o, bool pipelined);
+
+/**
+ * Offer application data to be sent right after the CONNECT request, without
+ * waiting for the reply.
+ * 
+ * The data is copied. It is written as soon as the request has been sent, so it
+ * reaches the server together with or right behind the request. This is only safe
+ * with servers which buffer data received before they reply. Up to
+ * BSOCKSCLIENT_EARLY_DATA_MAX bytes are accepted in total, and none while an earlier
+ * part is being written. Accepted data belongs to the object; data that is not
+ * accepted should be sent through @ref BSocksClient_GetSendInterface once up.
+ * BSOCKSCLIENT_EVENT_UP is only reported after all accepted data has been written.
+ * 
+ * This may be called any time before BSOCKSCLIENT_EVENT_UP, but not if the object
+ * was initialized in UDP ASSOCIATE mode.
+ * 
+ * @param o the object
+ * @param data data to send
+ * @param data_len number of bytes in data, >0
+ * @return number of bytes accepted, possibly 0
+ */
+int BSocksClient_SendEarlyData (BSocksClient *o, const uint8_t *data, int data_len);
+
+/**
+ * Send the deferred CONNECT request.
+ * 
+ * This may only be called after the BSOCKSCLIENT_EVENT_READY event was reported,
+ * and only once. The object then continues as usual, reporting BSOCKSCLIENT_EVENT_UP
+ * or BSOCKSCLIENT_EVENT_ERROR.
+ * 
+ * @param o the object
+ * @param dest_addr DST.ADDR to send. Must be of type BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6.
+ */
+void BSocksClient_Connect (BSocksClient *o, BAddr dest_addr);
+
+/**
+ * Change the handler and its user argument.
+ * 
+ * This allows handing over an object that was set up by someone else, e.g. a
+ * connection that was authenticated in advance and is waiting in
+ * BSOCKSCLIENT_EVENT_READY state.
+ * 
+ * @param o the object
+ * @param handler new handler
+ * @param user new value passed to the handler
+ */
+void BSocksClient_SetHandler (BSocksClient *o, BSocksClient_handler handler, void *user);
+
 /**
  * Return the BND.ADDR that the SOCKS server reported.
  * 
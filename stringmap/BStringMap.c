@@ -32,21 +32,113 @@
 
 #include <misc/offset.h>
 #include <misc/compare.h>
+#include <misc/hashfun.h>
+#include <misc/balloc.h>
 
 #include <stringmap/BStringMap.h>
 
+#include "BStringMap_hash.h"
+#include <structure/CHash_impl.h>
+
+#define INITIAL_HASH_BUCKETS 16
+
 static int string_comparator (void *unused, char **str1, char **str2)
 {
     int c = strcmp(*str1, *str2);
     return B_COMPARE(c, 0);
 }
 
+static BStringMap_hash_key make_key (const char *key)
+{
+    size_t len = strlen(key);
+    BStringMap_hash_key hkey = {key, len, badvpn_hash_bin((const uint8_t *)key, len, badvpn_hash_seed())};
+    return hkey;
+}
+
+static struct BStringMap_entry * lookup (const BStringMap *o, BStringMap_hash_key hkey)
+{
+    if (!o->have_hash) {
+        return NULL;
+    }
+    
+    return BStringMap__Hash_Lookup(&o->hash, 0, hkey).ptr;
+}
+
 static void free_entry (BStringMap *o, struct BStringMap_entry *e)
 {
+    BStringMap__HashRef ref = {e, e};
+    BStringMap__Hash_Remove(&o->hash, 0, ref);
     BAVL_Remove(&o->tree, &e->tree_node);
-    free(e->value);
-    free(e->key);
-    free(e);
+    o->count--;
+    BFree(e);
+}
+
+static int reserve (BStringMap *o, size_t count)
+{
+    // init hash table
+    if (!o->have_hash) {
+        size_t num_buckets = INITIAL_HASH_BUCKETS;
+        while (num_buckets < count && num_buckets <= SIZE_MAX / 2) {
+            num_buckets *= 2;
+        }
+        if (!BStringMap__Hash_Init(&o->hash, num_buckets)) {
+            return 0;
+        }
+        o->have_hash = 1;
+        return 1;
+    }
+    
+    // grow hash table; if this fails, lookups just get slower
+    if (count > o->hash.num_buckets) {
+        BStringMap__Hash_MultiplyBuckets(&o->hash, 0, 1);
+    }
+    
+    return 1;
+}
+
+static int set_entry (BStringMap *o, BStringMap_hash_key hkey, const char *value)
+{
+    // the value is already there, keep the entry
+    struct BStringMap_entry *ex_e = lookup(o, hkey);
+    if (ex_e && !strcmp(ex_e->value, value)) {
+        return 1;
+    }
+    
+    if (!reserve(o, o->count + 1)) {
+        goto fail0;
+    }
+    
+    // alloc entry with key and value
+    size_t value_len = strlen(value);
+    bsize_t size = bsize_add(bsize_add(bsize_fromsize(sizeof(struct BStringMap_entry)), bsize_fromsize(hkey.len)), bsize_add(bsize_fromsize(value_len), bsize_fromsize(2)));
+    struct BStringMap_entry *e = BAllocSize(size);
+    if (!e) {
+        goto fail0;
+    }
+    
+    // set key and value
+    e->key = (char *)(e + 1);
+    memcpy(e->key, hkey.str, hkey.len + 1);
+    e->value = e->key + hkey.len + 1;
+    memcpy(e->value, value, value_len + 1);
+    e->key_len = hkey.len;
+    e->hash = hkey.hash;
+    
+    // remove existing entry
+    if (ex_e) {
+        free_entry(o, ex_e);
+    }
+    
+    // insert to tree and hash table
+    ASSERT_EXECUTE(BAVL_Insert(&o->tree, &e->tree_node, NULL))
+    BStringMap__HashRef ref = {e, e};
+    ASSERT_EXECUTE(BStringMap__Hash_Insert(&o->hash, 0, ref, NULL))
+    o->count++;
+    
+    return 1;
+    
+fail0:
+    return 0;
 }
 
 void BStringMap_Init (BStringMap *o)
@@ -54,6 +146,10 @@ void BStringMap_Init (BStringMap *o)
     // init tree
     BAVL_Init(&o->tree, OFFSET_DIFF(struct BStringMap_entry, key, tree_node), (BAVL_comparator)string_comparator, NULL);
     
+    // hash table is allocated on first insertion
+    o->have_hash = 0;
+    o->count = 0;
+    
     DebugObject_Init(&o->d_obj);
 }
 
@@ -61,12 +157,17 @@ int BStringMap_InitCopy (BStringMap *o, const BStringMap *src)
 {
     BStringMap_Init(o);
     
-    const char *key = BStringMap_First(src);
-    while (key) {
-        if (!BStringMap_Set(o, key, BStringMap_Get(src, key))) {
+    // size hash table for all entries at once
+    if (src->count > 0 && !reserve(o, src->count)) {
+        goto fail1;
+    }
+    
+    for (BAVLNode *tree_node = BAVL_GetFirst(&src->tree); tree_node; tree_node = BAVL_GetNext(&src->tree, tree_node)) {
+        struct BStringMap_entry *e = UPPER_OBJECT(tree_node, struct BStringMap_entry, tree_node);
+        BStringMap_hash_key hkey = {e->key, e->key_len, e->hash};
+        if (!set_entry(o, hkey, e->value)) {
             goto fail1;
         }
-        key = BStringMap_Next(src, key);
     }
     
     return 1;
@@ -86,6 +187,11 @@ void BStringMap_Free (BStringMap *o)
         struct BStringMap_entry *e = UPPER_OBJECT(tree_node, struct BStringMap_entry, tree_node);
         free_entry(o, e);
     }
+    
+    // free hash table
+    if (o->have_hash) {
+        BStringMap__Hash_Free(&o->hash);
+    }
 }
 
 const char * BStringMap_Get (const BStringMap *o, const char *key)
@@ -94,11 +200,10 @@ const char * BStringMap_Get (const BStringMap *o, const char *key)
     ASSERT(key)
     
     // lookup
-    BAVLNode *tree_node = BAVL_LookupExact(&o->tree, &key);
-    if (!tree_node) {
+    struct BStringMap_entry *e = lookup(o, make_key(key));
+    if (!e) {
         return NULL;
     }
-    struct BStringMap_entry *e = UPPER_OBJECT(tree_node, struct BStringMap_entry, tree_node);
     
     return e->value;
 }
@@ -109,43 +214,7 @@ int BStringMap_Set (BStringMap *o, const char *key, const char *value)
     ASSERT(key)
     ASSERT(value)
     
-    // alloc entry
-    struct BStringMap_entry *e = malloc(sizeof(*e));
-    if (!e) {
-        goto fail0;
-    }
-    
-    // alloc and set key
-    if (!(e->key = malloc(strlen(key) + 1))) {
-        goto fail1;
-    }
-    strcpy(e->key, key);
-    
-    // alloc and set value
-    if (!(e->value = malloc(strlen(value) + 1))) {
-        goto fail2;
-    }
-    strcpy(e->value, value);
-    
-    // try inserting to tree
-    BAVLNode *ex_tree_node;
-    if (!BAVL_Insert(&o->tree, &e->tree_node, &ex_tree_node)) {
-        // remove existing entry
-        struct BStringMap_entry *ex_e = UPPER_OBJECT(ex_tree_node, struct BStringMap_entry, tree_node);
-        free_entry(o, ex_e);
-        
-        // insert new node
-        ASSERT_EXECUTE(BAVL_Insert(&o->tree, &e->tree_node, NULL))
-    }
-    
-    return 1;
-    
-fail2:
-    free(e->key);
-fail1:
-    free(e);
-fail0:
-    return 0;
+    return set_entry(o, make_key(key), value);
 }
 
 void BStringMap_Unset (BStringMap *o, const char *key)
@@ -154,11 +223,10 @@ void BStringMap_Unset (BStringMap *o, const char *key)
     ASSERT(key)
     
     // lookup
-    BAVLNode *tree_node = BAVL_LookupExact(&o->tree, &key);
-    if (!tree_node) {
+    struct BStringMap_entry *e = lookup(o, make_key(key));
+    if (!e) {
         return;
     }
-    struct BStringMap_entry *e = UPPER_OBJECT(tree_node, struct BStringMap_entry, tree_node);
     
     // remove
     free_entry(o, e);
@@ -182,10 +250,10 @@ const char * BStringMap_Next (const BStringMap *o, const char *key)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(key)
-    ASSERT(BAVL_LookupExact(&o->tree, &key))
     
     // get entry
-    struct BStringMap_entry *e = UPPER_OBJECT(BAVL_LookupExact(&o->tree, &key), struct BStringMap_entry, tree_node);
+    struct BStringMap_entry *e = lookup(o, make_key(key));
+    ASSERT(e)
     
     // get next
     BAVLNode *tree_node = BAVL_GetNext(&o->tree, &e->tree_node);
@@ -30,18 +30,44 @@
 #ifndef BADVPN_STRINGMAP_BSTRINGMAP_H
 #define BADVPN_STRINGMAP_BSTRINGMAP_H
 
+#include <stddef.h>
+
 #include <misc/debug.h>
 #include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 
+/**
+ * An entry of the map. The key and value strings are stored in the
+ * same allocation, right after the structure.
+ */
 struct BStringMap_entry {
     char *key;
     char *value;
+    size_t key_len;
+    size_t hash;
+    struct BStringMap_entry *hash_next;
     BAVLNode tree_node;
 };
 
+typedef struct { const char *str; size_t len; size_t hash; } BStringMap_hash_key;
+
+#include "BStringMap_hash.h"
+#include <structure/CHash_decl.h>
+
+/**
+ * Map from strings to strings.
+ * 
+ * Lookups go through a hash table; the entries are also kept in a tree,
+ * which gives {@link BStringMap_First} and {@link BStringMap_Next} their
+ * sorted order. The hash table is allocated on the first
+ * {@link BStringMap_Set}, so initialization cannot fail.
+ */
 typedef struct {
     BAVL tree;
+    BStringMap__Hash hash;
+    int have_hash;
+    size_t count;
     DebugObject d_obj;
 } BStringMap;
 
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME BStringMap__Hash
+#define CHASH_PARAM_ENTRY struct BStringMap_entry
+#define CHASH_PARAM_LINK struct BStringMap_entry *
+#define CHASH_PARAM_KEY BStringMap_hash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct BStringMap_entry *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) ((key).hash)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->key_len == (entry2).ptr->key_len && !memcmp((entry1).ptr->key, (entry2).ptr->key, (entry1).ptr->key_len))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).len == (entry2).ptr->key_len && !memcmp((key1).str, (entry2).ptr->key, (key1).len))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -0,0 +1,299 @@
+/**
+ * @file BObjectPool.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Pool of fixed-size objects allocated in slabs.
+ */
+
+#ifndef BADVPN_STRUCTURE_BOBJECTPOOL_H
+#define BADVPN_STRUCTURE_BOBJECTPOOL_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/balign.h>
+#include <misc/bsize.h>
+#include <misc/maxalign.h>
+#include <base/DebugObject.h>
+#include <base/BArena.h>
+
+/**
+ * Pool of fixed-size objects.
+ * 
+ * Objects are carved from slabs holding a fixed number of objects each.
+ * Released objects go to a free list and are reused before a new slab is
+ * allocated. Slabs are only freed together with the pool, so the memory of
+ * the pool stays at its high-water mark.
+ * 
+ * A pool is not thread-safe; a program with multiple threads should use
+ * a pool per thread.
+ */
+typedef struct {
+    BArena *arena;
+    size_t obj_size;
+    int slab_objs;
+    int max_objs;
+    void *free_list;
+    void *slabs;
+    int num_objs;
+    int num_used;
+    int max_used;
+    DebugObject d_obj;
+} BObjectPool;
+
+/**
+ * Initializes the pool.
+ * No memory is allocated until the first object is allocated.
+ * 
+ * @param o the object
+ * @param obj_size size of objects. Must be >0.
+ * @param slab_objs number of objects allocated at once. Must be >0.
+ * @param max_objs maximum number of objects in use at the same time,
+ *                 or -1 for no limit
+ */
+static void BObjectPool_Init (BObjectPool *o, size_t obj_size, int slab_objs, int max_objs);
+
+/**
+ * Initializes the pool, allocating slabs from an arena.
+ * 
+ * @param o the object
+ * @param obj_size size of objects. Must be >0.
+ * @param slab_objs number of objects allocated at once. Must be >0.
+ * @param max_objs maximum number of objects in use at the same time,
+ *                 or -1 for no limit
+ * @param arena arena to allocate slabs from, or NULL to use {@link BAlloc}.
+ *              It must outlive the pool.
+ */
+static void BObjectPool_InitArena (BObjectPool *o, size_t obj_size, int slab_objs, int max_objs, BArena *arena);
+
+/**
+ * Frees the pool.
+ * There must be no objects in use.
+ * 
+ * @param o the object
+ */
+static void BObjectPool_Free (BObjectPool *o);
+
+/**
+ * Allocates an object.
+ * 
+ * @param o the object
+ * @return pointer to the object, aligned for any type, or NULL if the
+ *         limit was reached or memory could not be allocated
+ */
+static void * BObjectPool_Alloc (BObjectPool *o);
+
+/**
+ * Releases an object.
+ * 
+ * @param o the object
+ * @param obj object obtained from {@link BObjectPool_Alloc} on this pool
+ */
+static void BObjectPool_Release (BObjectPool *o, void *obj);
+
+/**
+ * Returns the number of objects in use.
+ * 
+ * @param o the object
+ * @return number of objects in use
+ */
+static int BObjectPool_NumUsed (BObjectPool *o);
+
+/**
+ * Returns the maximum number of objects which were in use at the same time.
+ * 
+ * @param o the object
+ * @return high-water mark of objects in use
+ */
+static int BObjectPool_MaxUsed (BObjectPool *o);
+
+/**
+ * Returns the number of objects in allocated slabs, used or not.
+ * 
+ * @param o the object
+ * @return number of allocated objects
+ */
+static int BObjectPool_NumAllocated (BObjectPool *o);
+
+struct _BObjectPool_slab {
+    void *next;
+    size_t size;
+};
+
+static size_t _BObjectPool_header_size (void)
+{
+    return balign_up(sizeof(struct _BObjectPool_slab), BMAX_ALIGN);
+}
+
+static int _BObjectPool_add_slab (BObjectPool *o)
+{
+    int num = o->slab_objs;
+    if (o->max_objs >= 0 && num > o->max_objs - o->num_objs) {
+        num = o->max_objs - o->num_objs;
+    }
+    ASSERT(num > 0)
+    
+    // allocate slab: link to the next slab followed by objects
+    bsize_t size = bsize_add(bsize_fromsize(_BObjectPool_header_size()), bsize_mul(bsize_fromint(num), bsize_fromsize(o->obj_size)));
+    if (size.is_overflow) {
+        return 0;
+    }
+    char *slab = (char *)BArena_Alloc(o->arena, size.value);
+    if (!slab) {
+        return 0;
+    }
+    
+    // link slab, remembering its size for releasing it
+    struct _BObjectPool_slab *header = (struct _BObjectPool_slab *)slab;
+    header->next = o->slabs;
+    header->size = size.value;
+    o->slabs = slab;
+    
+    // put objects on free list, first object at the head
+    char *objs = slab + _BObjectPool_header_size();
+    for (int i = num - 1; i >= 0; i--) {
+        char *obj = objs + (size_t)i * o->obj_size;
+        *(void **)obj = o->free_list;
+        o->free_list = obj;
+    }
+    
+    o->num_objs += num;
+    
+    return 1;
+}
+
+void BObjectPool_Init (BObjectPool *o, size_t obj_size, int slab_objs, int max_objs)
+{
+    BObjectPool_InitArena(o, obj_size, slab_objs, max_objs, NULL);
+}
+
+void BObjectPool_InitArena (BObjectPool *o, size_t obj_size, int slab_objs, int max_objs, BArena *arena)
+{
+    ASSERT(obj_size > 0)
+    ASSERT(slab_objs > 0)
+    ASSERT(max_objs >= -1)
+    
+    // objects hold the free list link while unused, and are aligned for any type
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+    ASSERT_FORCE(!balign_up_overflows(obj_size, BMAX_ALIGN))
+    
+    o->arena = arena;
+    o->obj_size = balign_up(obj_size, BMAX_ALIGN);
+    o->slab_objs = slab_objs;
+    o->max_objs = max_objs;
+    o->free_list = NULL;
+    o->slabs = NULL;
+    o->num_objs = 0;
+    o->num_used = 0;
+    o->max_used = 0;
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void BObjectPool_Free (BObjectPool *o)
+{
+    DebugObject_Free(&o->d_obj);
+    ASSERT(o->num_used == 0)
+    
+    // free slabs
+    while (o->slabs) {
+        struct _BObjectPool_slab *header = (struct _BObjectPool_slab *)o->slabs;
+        o->slabs = header->next;
+        BArena_Release(o->arena, header, header->size);
+    }
+}
+
+void * BObjectPool_Alloc (BObjectPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // check limit
+    if (o->max_objs >= 0 && o->num_used == o->max_objs) {
+        return NULL;
+    }
+    
+    // allocate a new slab if there are no free objects
+    if (!o->free_list && !_BObjectPool_add_slab(o)) {
+        return NULL;
+    }
+    
+    ASSERT(o->free_list)
+    
+    // take object from free list
+    void *obj = o->free_list;
+    o->free_list = *(void **)obj;
+    
+    // update counters
+    o->num_used++;
+    if (o->num_used > o->max_used) {
+        o->max_used = o->num_used;
+    }
+    
+    return obj;
+}
+
+void BObjectPool_Release (BObjectPool *o, void *obj)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(obj)
+    ASSERT(o->num_used > 0)
+    
+    // put object on free list
+    *(void **)obj = o->free_list;
+    o->free_list = obj;
+    
+    // update counters
+    o->num_used--;
+}
+
+int BObjectPool_NumUsed (BObjectPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_used;
+}
+
+int BObjectPool_MaxUsed (BObjectPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->max_used;
+}
+
+int BObjectPool_NumAllocated (BObjectPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_objs;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file BTree_decl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BTree_header.h"
+
+typedef struct BTree__leaf_tag BTree__Leaf;
+
+struct BTree__leaf_tag {
+    int count;
+    BTreeKey keys[BTREE_PARAM_ORDER];
+    BTreeValue values[BTREE_PARAM_ORDER];
+    BTree__Leaf *prev;
+    BTree__Leaf *next;
+};
+
+typedef struct {
+    int count;
+    BTreeKey keys[BTREE_PARAM_ORDER];
+    // children[i] has keys below keys[i] and not below keys[i - 1]
+    void *children[BTREE_PARAM_ORDER + 1];
+} BTree__Inner;
+
+typedef struct {
+    void *root;
+    int height;
+    size_t count;
+} BTree;
+
+typedef struct {
+    BTree__Leaf *leaf;
+    int index;
+} BTreeRef;
+
+static BTreeRef BTreeNullRef (void);
+static int BTreeIsNullRef (BTreeRef ref);
+static BTreeKey * BTreeRefKey (BTreeRef ref);
+static BTreeValue * BTreeRefValue (BTreeRef ref);
+
+static void BTree_Init (BTree *o);
+static void BTree_Free (BTree *o);
+static int BTree_Insert (BTree *o, BTreeArg arg, BTreeKey key, BTreeValue value, BTreeRef *out_ref);
+static int BTree_Remove (BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_LookupExact (const BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_GetFirstGreater (const BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_GetLastLesser (const BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_GetFirstGreaterEqual (const BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_GetLastLesserEqual (const BTree *o, BTreeArg arg, BTreeKey key);
+static BTreeRef BTree_GetFirst (const BTree *o);
+static BTreeRef BTree_GetLast (const BTree *o);
+static BTreeRef BTree_GetNext (const BTree *o, BTreeRef ref);
+static BTreeRef BTree_GetPrev (const BTree *o, BTreeRef ref);
+static int BTree_IsEmpty (const BTree *o);
+static size_t BTree_Count (const BTree *o);
+static void BTree_Verify (const BTree *o, BTreeArg arg);
+
+#include "BTree_footer.h"
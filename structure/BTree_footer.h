@@ -0,0 +1,88 @@
+/**
+ * @file BTree_footer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// preprocessor inputs
+#undef BTREE_PARAM_NAME
+#undef BTREE_PARAM_TYPE_KEY
+#undef BTREE_PARAM_TYPE_VALUE
+#undef BTREE_PARAM_TYPE_ARG
+#undef BTREE_PARAM_ORDER
+#undef BTREE_PARAM_FUN_COMPARE
+
+// types
+#undef BTree
+#undef BTreeKey
+#undef BTreeValue
+#undef BTreeArg
+#undef BTreeRef
+#undef BTree__Leaf
+#undef BTree__Inner
+#undef BTree__leaf_tag
+
+// non-object public functions
+#undef BTreeNullRef
+#undef BTreeIsNullRef
+#undef BTreeRefKey
+#undef BTreeRefValue
+
+// public functions
+#undef BTree_Init
+#undef BTree_Free
+#undef BTree_Insert
+#undef BTree_Remove
+#undef BTree_LookupExact
+#undef BTree_GetFirstGreater
+#undef BTree_GetLastLesser
+#undef BTree_GetFirstGreaterEqual
+#undef BTree_GetLastLesserEqual
+#undef BTree_GetFirst
+#undef BTree_GetLast
+#undef BTree_GetNext
+#undef BTree_GetPrev
+#undef BTree_IsEmpty
+#undef BTree_Count
+#undef BTree_Verify
+
+// private things
+#undef BTree_MIN_KEYS
+#undef BTree_compare
+#undef BTree_lower_bound
+#undef BTree_upper_bound
+#undef BTree_find_leaf
+#undef BTree_make_ref
+#undef BTree_descend
+#undef BTree_split_leaf
+#undef BTree_split_inner
+#undef BTree_inner_insert_at
+#undef BTree_inner_remove_at
+#undef BTree_rebalance_leaf
+#undef BTree_rebalance_inner
+#undef BTree_free_node
+#undef BTree_verify_node
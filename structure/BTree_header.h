@@ -0,0 +1,97 @@
+/**
+ * @file BTree_header.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Preprocessor inputs:
+// BTREE_PARAM_NAME - name of this data structure
+// BTREE_PARAM_TYPE_KEY - type of key; keys are copied into nodes
+// BTREE_PARAM_TYPE_VALUE - type of value stored with each key
+// BTREE_PARAM_TYPE_ARG - type of argument pass through to comparisons
+// BTREE_PARAM_ORDER - maximum number of keys in a node; must be at least 4
+// BTREE_PARAM_FUN_COMPARE(arg, key1, key2) - compares two keys, given as lvalues;
+//   returns -1/0/1
+
+#ifndef BADVPN_BTREE_H
+#error BTree.h has not been included
+#endif
+
+#if BTREE_PARAM_ORDER < 4
+#error BTREE_PARAM_ORDER must be at least 4
+#endif
+
+// types
+#define BTree BTREE_PARAM_NAME
+#define BTreeKey BTREE_PARAM_TYPE_KEY
+#define BTreeValue BTREE_PARAM_TYPE_VALUE
+#define BTreeArg BTREE_PARAM_TYPE_ARG
+#define BTreeRef MERGE(BTree, Ref)
+#define BTree__Leaf MERGE(BTree, __Leaf)
+#define BTree__Inner MERGE(BTree, __Inner)
+#define BTree__leaf_tag MERGE(BTree, __leaf_tag)
+
+// non-object public functions
+#define BTreeNullRef MERGE(BTree, NullRef)
+#define BTreeIsNullRef MERGE(BTree, IsNullRef)
+#define BTreeRefKey MERGE(BTree, RefKey)
+#define BTreeRefValue MERGE(BTree, RefValue)
+
+// public functions
+#define BTree_Init MERGE(BTree, _Init)
+#define BTree_Free MERGE(BTree, _Free)
+#define BTree_Insert MERGE(BTree, _Insert)
+#define BTree_Remove MERGE(BTree, _Remove)
+#define BTree_LookupExact MERGE(BTree, _LookupExact)
+#define BTree_GetFirstGreater MERGE(BTree, _GetFirstGreater)
+#define BTree_GetLastLesser MERGE(BTree, _GetLastLesser)
+#define BTree_GetFirstGreaterEqual MERGE(BTree, _GetFirstGreaterEqual)
+#define BTree_GetLastLesserEqual MERGE(BTree, _GetLastLesserEqual)
+#define BTree_GetFirst MERGE(BTree, _GetFirst)
+#define BTree_GetLast MERGE(BTree, _GetLast)
+#define BTree_GetNext MERGE(BTree, _GetNext)
+#define BTree_GetPrev MERGE(BTree, _GetPrev)
+#define BTree_IsEmpty MERGE(BTree, _IsEmpty)
+#define BTree_Count MERGE(BTree, _Count)
+#define BTree_Verify MERGE(BTree, _Verify)
+
+// private things
+#define BTree_MIN_KEYS (BTREE_PARAM_ORDER / 2)
+#define BTree_compare(arg, key1, key2) BTREE_PARAM_FUN_COMPARE((arg), (key1), (key2))
+#define BTree_lower_bound MERGE(BTree, __lower_bound)
+#define BTree_upper_bound MERGE(BTree, __upper_bound)
+#define BTree_find_leaf MERGE(BTree, __find_leaf)
+#define BTree_make_ref MERGE(BTree, __make_ref)
+#define BTree_descend MERGE(BTree, __descend)
+#define BTree_split_leaf MERGE(BTree, __split_leaf)
+#define BTree_split_inner MERGE(BTree, __split_inner)
+#define BTree_inner_insert_at MERGE(BTree, __inner_insert_at)
+#define BTree_inner_remove_at MERGE(BTree, __inner_remove_at)
+#define BTree_rebalance_leaf MERGE(BTree, __rebalance_leaf)
+#define BTree_rebalance_inner MERGE(BTree, __rebalance_inner)
+#define BTree_free_node MERGE(BTree, __free_node)
+#define BTree_verify_node MERGE(BTree, __verify_node)
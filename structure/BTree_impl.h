@@ -0,0 +1,739 @@
+/**
+ * @file BTree_impl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BTree_header.h"
+
+static int BTree_lower_bound (BTreeArg arg, BTreeKey *keys, int count, BTreeKey *key)
+{
+    int lo = 0;
+    int hi = count;
+    
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (BTree_compare(arg, keys[mid], *key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
+static int BTree_upper_bound (BTreeArg arg, BTreeKey *keys, int count, BTreeKey *key)
+{
+    int lo = 0;
+    int hi = count;
+    
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (BTree_compare(arg, keys[mid], *key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
+// descends to the leaf which would contain the key; with upper=0, keys equal
+// to a separator lead left, which is what searches for lesser keys need
+static BTree__Leaf * BTree_find_leaf (const BTree *o, BTreeArg arg, BTreeKey *key, int upper)
+{
+    ASSERT(o->root)
+    
+    void *node = o->root;
+    
+    for (int level = o->height - 1; level > 0; level--) {
+        BTree__Inner *inner = (BTree__Inner *)node;
+        int i = (upper ? BTree_upper_bound(arg, inner->keys, inner->count, key) : BTree_lower_bound(arg, inner->keys, inner->count, key));
+        node = inner->children[i];
+    }
+    
+    return (BTree__Leaf *)node;
+}
+
+// makes a reference from a position which may be one past either end of the leaf
+static BTreeRef BTree_make_ref (BTree__Leaf *leaf, int index)
+{
+    ASSERT(index >= -1)
+    ASSERT(index <= leaf->count)
+    
+    if (index == leaf->count) {
+        leaf = leaf->next;
+        index = 0;
+    }
+    else if (index < 0) {
+        leaf = leaf->prev;
+        index = (leaf ? leaf->count - 1 : 0);
+    }
+    
+    if (!leaf) {
+        return BTreeNullRef();
+    }
+    
+    BTreeRef ref = {leaf, index};
+    return ref;
+}
+
+// descends to the leaf for insertion or removal, recording the path;
+// path[level] is the inner node at that level and path_index[level] the
+// child taken, with leaves at level 0
+static BTree__Leaf * BTree_descend (const BTree *o, BTreeArg arg, BTreeKey *key, BTree__Inner **path, int *path_index)
+{
+    ASSERT(o->root)
+    
+    void *node = o->root;
+    
+    for (int level = o->height - 1; level > 0; level--) {
+        BTree__Inner *inner = (BTree__Inner *)node;
+        int i = BTree_upper_bound(arg, inner->keys, inner->count, key);
+        path[level] = inner;
+        path_index[level] = i;
+        node = inner->children[i];
+    }
+    
+    return (BTree__Leaf *)node;
+}
+
+static BTreeRef BTree_split_leaf (BTree__Leaf *leaf, BTree__Leaf *right, int pos, BTreeKey *key, BTreeValue *value)
+{
+    ASSERT(leaf->count == BTREE_PARAM_ORDER)
+    ASSERT(pos >= 0)
+    ASSERT(pos <= leaf->count)
+    
+    BTreeKey keys[BTREE_PARAM_ORDER + 1];
+    BTreeValue values[BTREE_PARAM_ORDER + 1];
+    
+    memcpy(keys, leaf->keys, pos * sizeof(keys[0]));
+    memcpy(values, leaf->values, pos * sizeof(values[0]));
+    keys[pos] = *key;
+    values[pos] = *value;
+    memcpy(keys + pos + 1, leaf->keys + pos, (BTREE_PARAM_ORDER - pos) * sizeof(keys[0]));
+    memcpy(values + pos + 1, leaf->values + pos, (BTREE_PARAM_ORDER - pos) * sizeof(values[0]));
+    
+    int left_count = (BTREE_PARAM_ORDER + 1) / 2;
+    int right_count = BTREE_PARAM_ORDER + 1 - left_count;
+    
+    memcpy(leaf->keys, keys, left_count * sizeof(keys[0]));
+    memcpy(leaf->values, values, left_count * sizeof(values[0]));
+    leaf->count = left_count;
+    
+    memcpy(right->keys, keys + left_count, right_count * sizeof(keys[0]));
+    memcpy(right->values, values + left_count, right_count * sizeof(values[0]));
+    right->count = right_count;
+    
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) {
+        leaf->next->prev = right;
+    }
+    leaf->next = right;
+    
+    BTreeRef ref;
+    if (pos < left_count) {
+        ref.leaf = leaf;
+        ref.index = pos;
+    } else {
+        ref.leaf = right;
+        ref.index = pos - left_count;
+    }
+    
+    return ref;
+}
+
+static void BTree_inner_insert_at (BTree__Inner *inner, int i, BTreeKey *key, void *child)
+{
+    ASSERT(inner->count < BTREE_PARAM_ORDER)
+    ASSERT(i >= 0)
+    ASSERT(i <= inner->count)
+    
+    memmove(inner->keys + i + 1, inner->keys + i, (inner->count - i) * sizeof(inner->keys[0]));
+    memmove(inner->children + i + 2, inner->children + i + 1, (inner->count - i) * sizeof(inner->children[0]));
+    inner->keys[i] = *key;
+    inner->children[i + 1] = child;
+    inner->count++;
+}
+
+// inserts key and child (following the key) at i into a full inner node,
+// moving the upper half into right; returns the key separating them in *key
+// and right in *child
+static void BTree_split_inner (BTree__Inner *inner, BTree__Inner *right, int i, BTreeKey *key, void **child)
+{
+    ASSERT(inner->count == BTREE_PARAM_ORDER)
+    ASSERT(i >= 0)
+    ASSERT(i <= inner->count)
+    
+    BTreeKey keys[BTREE_PARAM_ORDER + 1];
+    void *children[BTREE_PARAM_ORDER + 2];
+    
+    memcpy(keys, inner->keys, i * sizeof(keys[0]));
+    keys[i] = *key;
+    memcpy(keys + i + 1, inner->keys + i, (BTREE_PARAM_ORDER - i) * sizeof(keys[0]));
+    
+    memcpy(children, inner->children, (i + 1) * sizeof(children[0]));
+    children[i + 1] = *child;
+    memcpy(children + i + 2, inner->children + i + 1, (BTREE_PARAM_ORDER - i) * sizeof(children[0]));
+    
+    int left_count = BTREE_PARAM_ORDER / 2;
+    int right_count = BTREE_PARAM_ORDER - left_count;
+    
+    memcpy(inner->keys, keys, left_count * sizeof(keys[0]));
+    memcpy(inner->children, children, (left_count + 1) * sizeof(children[0]));
+    inner->count = left_count;
+    
+    memcpy(right->keys, keys + left_count + 1, right_count * sizeof(keys[0]));
+    memcpy(right->children, children + left_count + 1, (right_count + 1) * sizeof(children[0]));
+    right->count = right_count;
+    
+    *key = keys[left_count];
+    *child = right;
+}
+
+static void BTree_inner_remove_at (BTree__Inner *inner, int i)
+{
+    ASSERT(i >= 0)
+    ASSERT(i < inner->count)
+    
+    // removes keys[i] and children[i + 1]
+    memmove(inner->keys + i, inner->keys + i + 1, (inner->count - i - 1) * sizeof(inner->keys[0]));
+    memmove(inner->children + i + 1, inner->children + i + 2, (inner->count - i - 1) * sizeof(inner->children[0]));
+    inner->count--;
+}
+
+static void BTree_rebalance_leaf (BTree__Inner *parent, int i)
+{
+    BTree__Leaf *node = (BTree__Leaf *)parent->children[i];
+    ASSERT(node->count == BTree_MIN_KEYS - 1)
+    
+    // borrow from the left sibling
+    if (i > 0) {
+        BTree__Leaf *left = (BTree__Leaf *)parent->children[i - 1];
+        if (left->count > BTree_MIN_KEYS) {
+            memmove(node->keys + 1, node->keys, node->count * sizeof(node->keys[0]));
+            memmove(node->values + 1, node->values, node->count * sizeof(node->values[0]));
+            node->keys[0] = left->keys[left->count - 1];
+            node->values[0] = left->values[left->count - 1];
+            node->count++;
+            left->count--;
+            parent->keys[i - 1] = node->keys[0];
+            return;
+        }
+    }
+    
+    // borrow from the right sibling
+    if (i < parent->count) {
+        BTree__Leaf *right = (BTree__Leaf *)parent->children[i + 1];
+        if (right->count > BTree_MIN_KEYS) {
+            node->keys[node->count] = right->keys[0];
+            node->values[node->count] = right->values[0];
+            node->count++;
+            memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(right->keys[0]));
+            memmove(right->values, right->values + 1, (right->count - 1) * sizeof(right->values[0]));
+            right->count--;
+            parent->keys[i] = right->keys[0];
+            return;
+        }
+    }
+    
+    // merge with a sibling
+    int j = (i > 0 ? i - 1 : i);
+    BTree__Leaf *left = (BTree__Leaf *)parent->children[j];
+    BTree__Leaf *right = (BTree__Leaf *)parent->children[j + 1];
+    ASSERT(left->count + right->count <= BTREE_PARAM_ORDER)
+    
+    memcpy(left->keys + left->count, right->keys, right->count * sizeof(left->keys[0]));
+    memcpy(left->values + left->count, right->values, right->count * sizeof(left->values[0]));
+    left->count += right->count;
+    
+    left->next = right->next;
+    if (right->next) {
+        right->next->prev = left;
+    }
+    
+    BFree(right);
+    BTree_inner_remove_at(parent, j);
+}
+
+static void BTree_rebalance_inner (BTree__Inner *parent, int i)
+{
+    BTree__Inner *node = (BTree__Inner *)parent->children[i];
+    ASSERT(node->count == BTree_MIN_KEYS - 1)
+    
+    // borrow from the left sibling, rotating through the parent
+    if (i > 0) {
+        BTree__Inner *left = (BTree__Inner *)parent->children[i - 1];
+        if (left->count > BTree_MIN_KEYS) {
+            memmove(node->keys + 1, node->keys, node->count * sizeof(node->keys[0]));
+            memmove(node->children + 1, node->children, (node->count + 1) * sizeof(node->children[0]));
+            node->keys[0] = parent->keys[i - 1];
+            node->children[0] = left->children[left->count];
+            node->count++;
+            parent->keys[i - 1] = left->keys[left->count - 1];
+            left->count--;
+            return;
+        }
+    }
+    
+    // borrow from the right sibling, rotating through the parent
+    if (i < parent->count) {
+        BTree__Inner *right = (BTree__Inner *)parent->children[i + 1];
+        if (right->count > BTree_MIN_KEYS) {
+            node->keys[node->count] = parent->keys[i];
+            node->children[node->count + 1] = right->children[0];
+            node->count++;
+            parent->keys[i] = right->keys[0];
+            memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(right->keys[0]));
+            memmove(right->children, right->children + 1, right->count * sizeof(right->children[0]));
+            right->count--;
+            return;
+        }
+    }
+    
+    // merge with a sibling, pulling down the separator
+    int j = (i > 0 ? i - 1 : i);
+    BTree__Inner *left = (BTree__Inner *)parent->children[j];
+    BTree__Inner *right = (BTree__Inner *)parent->children[j + 1];
+    ASSERT(left->count + 1 + right->count <= BTREE_PARAM_ORDER)
+    
+    left->keys[left->count] = parent->keys[j];
+    memcpy(left->keys + left->count + 1, right->keys, right->count * sizeof(left->keys[0]));
+    memcpy(left->children + left->count + 1, right->children, (right->count + 1) * sizeof(left->children[0]));
+    left->count += 1 + right->count;
+    
+    BFree(right);
+    BTree_inner_remove_at(parent, j);
+}
+
+static void BTree_free_node (void *node, int level)
+{
+    if (level > 0) {
+        BTree__Inner *inner = (BTree__Inner *)node;
+        for (int i = 0; i <= inner->count; i++) {
+            BTree_free_node(inner->children[i], level - 1);
+        }
+    }
+    
+    BFree(node);
+}
+
+static size_t BTree_verify_node (const BTree *o, BTreeArg arg, void *node, int level, BTreeKey *lower, BTreeKey *upper, BTree__Leaf **last_leaf)
+{
+    int is_root = (node == o->root);
+    
+    if (level == 0) {
+        BTree__Leaf *leaf = (BTree__Leaf *)node;
+        
+        ASSERT_FORCE(leaf->count >= (is_root ? 1 : BTree_MIN_KEYS))
+        ASSERT_FORCE(leaf->count <= BTREE_PARAM_ORDER)
+        
+        for (int i = 0; i < leaf->count; i++) {
+            ASSERT_FORCE(i == 0 || BTree_compare(arg, leaf->keys[i - 1], leaf->keys[i]) < 0)
+            ASSERT_FORCE(!lower || BTree_compare(arg, *lower, leaf->keys[i]) <= 0)
+            ASSERT_FORCE(!upper || BTree_compare(arg, leaf->keys[i], *upper) < 0)
+        }
+        
+        ASSERT_FORCE(leaf->prev == *last_leaf)
+        ASSERT_FORCE(!*last_leaf || (*last_leaf)->next == leaf)
+        *last_leaf = leaf;
+        
+        return leaf->count;
+    }
+    
+    BTree__Inner *inner = (BTree__Inner *)node;
+    
+    ASSERT_FORCE(inner->count >= (is_root ? 1 : BTree_MIN_KEYS))
+    ASSERT_FORCE(inner->count <= BTREE_PARAM_ORDER)
+    
+    size_t count = 0;
+    
+    for (int i = 0; i <= inner->count; i++) {
+        if (i < inner->count) {
+            ASSERT_FORCE(i == 0 || BTree_compare(arg, inner->keys[i - 1], inner->keys[i]) < 0)
+            ASSERT_FORCE(!lower || BTree_compare(arg, *lower, inner->keys[i]) <= 0)
+            ASSERT_FORCE(!upper || BTree_compare(arg, inner->keys[i], *upper) < 0)
+        }
+        
+        BTreeKey *child_lower = (i > 0 ? &inner->keys[i - 1] : lower);
+        BTreeKey *child_upper = (i < inner->count ? &inner->keys[i] : upper);
+        count += BTree_verify_node(o, arg, inner->children[i], level - 1, child_lower, child_upper, last_leaf);
+    }
+    
+    return count;
+}
+
+static BTreeRef BTreeNullRef (void)
+{
+    BTreeRef ref = {NULL, 0};
+    return ref;
+}
+
+static int BTreeIsNullRef (BTreeRef ref)
+{
+    return !ref.leaf;
+}
+
+static BTreeKey * BTreeRefKey (BTreeRef ref)
+{
+    ASSERT(ref.leaf)
+    ASSERT(ref.index >= 0)
+    ASSERT(ref.index < ref.leaf->count)
+    
+    return &ref.leaf->keys[ref.index];
+}
+
+static BTreeValue * BTreeRefValue (BTreeRef ref)
+{
+    ASSERT(ref.leaf)
+    ASSERT(ref.index >= 0)
+    ASSERT(ref.index < ref.leaf->count)
+    
+    return &ref.leaf->values[ref.index];
+}
+
+static void BTree_Init (BTree *o)
+{
+    o->root = NULL;
+    o->height = 0;
+    o->count = 0;
+}
+
+static void BTree_Free (BTree *o)
+{
+    if (o->root) {
+        BTree_free_node(o->root, o->height - 1);
+    }
+}
+
+static int BTree_Insert (BTree *o, BTreeArg arg, BTreeKey key, BTreeValue value, BTreeRef *out_ref)
+{
+    if (!o->root) {
+        BTree__Leaf *leaf = (BTree__Leaf *)BAlloc(sizeof(*leaf));
+        if (!leaf) {
+            goto fail;
+        }
+        
+        leaf->count = 1;
+        leaf->keys[0] = key;
+        leaf->values[0] = value;
+        leaf->prev = NULL;
+        leaf->next = NULL;
+        
+        o->root = leaf;
+        o->height = 1;
+        o->count = 1;
+        
+        if (out_ref) {
+            out_ref->leaf = leaf;
+            out_ref->index = 0;
+        }
+        return 1;
+    }
+    
+    BTree__Inner *path[BTREE_MAX_HEIGHT];
+    int path_index[BTREE_MAX_HEIGHT];
+    
+    BTree__Leaf *leaf = BTree_descend(o, arg, &key, path, path_index);
+    
+    int pos = BTree_lower_bound(arg, leaf->keys, leaf->count, &key);
+    if (pos < leaf->count && BTree_compare(arg, leaf->keys[pos], key) == 0) {
+        if (out_ref) {
+            out_ref->leaf = leaf;
+            out_ref->index = pos;
+        }
+        return 0;
+    }
+    
+    if (leaf->count < BTREE_PARAM_ORDER) {
+        memmove(leaf->keys + pos + 1, leaf->keys + pos, (leaf->count - pos) * sizeof(leaf->keys[0]));
+        memmove(leaf->values + pos + 1, leaf->values + pos, (leaf->count - pos) * sizeof(leaf->values[0]));
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        leaf->count++;
+        o->count++;
+        
+        if (out_ref) {
+            out_ref->leaf = leaf;
+            out_ref->index = pos;
+        }
+        return 1;
+    }
+    
+    // count the nodes that will split and allocate all new nodes up front,
+    // so that an allocation failure leaves the tree unchanged
+    int num_splits = 1;
+    while (num_splits < o->height && path[num_splits]->count == BTREE_PARAM_ORDER) {
+        num_splits++;
+    }
+    int new_root = (num_splits == o->height);
+    
+    if (new_root && o->height == BTREE_MAX_HEIGHT) {
+        goto fail;
+    }
+    
+    void *new_nodes[BTREE_MAX_HEIGHT + 1];
+    int num_new = num_splits + new_root;
+    
+    for (int k = 0; k < num_new; k++) {
+        new_nodes[k] = BAlloc(k == 0 ? sizeof(BTree__Leaf) : sizeof(BTree__Inner));
+        if (!new_nodes[k]) {
+            while (k-- > 0) {
+                BFree(new_nodes[k]);
+            }
+            goto fail;
+        }
+    }
+    
+    BTreeRef ref = BTree_split_leaf(leaf, (BTree__Leaf *)new_nodes[0], pos, &key, &value);
+    
+    BTreeKey up_key = ((BTree__Leaf *)new_nodes[0])->keys[0];
+    void *up_child = new_nodes[0];
+    
+    for (int level = 1; level < num_splits; level++) {
+        BTree_split_inner(path[level], (BTree__Inner *)new_nodes[level], path_index[level], &up_key, &up_child);
+    }
+    
+    if (!new_root) {
+        BTree_inner_insert_at(path[num_splits], path_index[num_splits], &up_key, up_child);
+    } else {
+        BTree__Inner *root = (BTree__Inner *)new_nodes[num_splits];
+        root->count = 1;
+        root->keys[0] = up_key;
+        root->children[0] = o->root;
+        root->children[1] = up_child;
+        o->root = root;
+        o->height++;
+    }
+    
+    o->count++;
+    
+    if (out_ref) {
+        *out_ref = ref;
+    }
+    return 1;
+    
+fail:
+    if (out_ref) {
+        *out_ref = BTreeNullRef();
+    }
+    return 0;
+}
+
+static int BTree_Remove (BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return 0;
+    }
+    
+    BTree__Inner *path[BTREE_MAX_HEIGHT];
+    int path_index[BTREE_MAX_HEIGHT];
+    
+    BTree__Leaf *leaf = BTree_descend(o, arg, &key, path, path_index);
+    
+    int pos = BTree_lower_bound(arg, leaf->keys, leaf->count, &key);
+    if (!(pos < leaf->count && BTree_compare(arg, leaf->keys[pos], key) == 0)) {
+        return 0;
+    }
+    
+    memmove(leaf->keys + pos, leaf->keys + pos + 1, (leaf->count - pos - 1) * sizeof(leaf->keys[0]));
+    memmove(leaf->values + pos, leaf->values + pos + 1, (leaf->count - pos - 1) * sizeof(leaf->values[0]));
+    leaf->count--;
+    o->count--;
+    
+    // fix underflows bottom-up; merging removes a key from the parent
+    int count = leaf->count;
+    for (int level = 0; level + 1 < o->height && count < BTree_MIN_KEYS; level++) {
+        BTree__Inner *parent = path[level + 1];
+        if (level == 0) {
+            BTree_rebalance_leaf(parent, path_index[level + 1]);
+        } else {
+            BTree_rebalance_inner(parent, path_index[level + 1]);
+        }
+        count = parent->count;
+    }
+    
+    // shrink the tree from the root
+    if (o->height == 1) {
+        BTree__Leaf *root = (BTree__Leaf *)o->root;
+        if (root->count == 0) {
+            BFree(root);
+            o->root = NULL;
+            o->height = 0;
+        }
+    } else {
+        BTree__Inner *root = (BTree__Inner *)o->root;
+        if (root->count == 0) {
+            o->root = root->children[0];
+            o->height--;
+            BFree(root);
+        }
+    }
+    
+    return 1;
+}
+
+static BTreeRef BTree_LookupExact (const BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    BTree__Leaf *leaf = BTree_find_leaf(o, arg, &key, 1);
+    
+    int pos = BTree_lower_bound(arg, leaf->keys, leaf->count, &key);
+    if (!(pos < leaf->count && BTree_compare(arg, leaf->keys[pos], key) == 0)) {
+        return BTreeNullRef();
+    }
+    
+    BTreeRef ref = {leaf, pos};
+    return ref;
+}
+
+static BTreeRef BTree_GetFirstGreater (const BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    BTree__Leaf *leaf = BTree_find_leaf(o, arg, &key, 1);
+    
+    return BTree_make_ref(leaf, BTree_upper_bound(arg, leaf->keys, leaf->count, &key));
+}
+
+static BTreeRef BTree_GetLastLesser (const BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    BTree__Leaf *leaf = BTree_find_leaf(o, arg, &key, 0);
+    
+    return BTree_make_ref(leaf, BTree_lower_bound(arg, leaf->keys, leaf->count, &key) - 1);
+}
+
+static BTreeRef BTree_GetFirstGreaterEqual (const BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    BTree__Leaf *leaf = BTree_find_leaf(o, arg, &key, 1);
+    
+    return BTree_make_ref(leaf, BTree_lower_bound(arg, leaf->keys, leaf->count, &key));
+}
+
+static BTreeRef BTree_GetLastLesserEqual (const BTree *o, BTreeArg arg, BTreeKey key)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    BTree__Leaf *leaf = BTree_find_leaf(o, arg, &key, 1);
+    
+    return BTree_make_ref(leaf, BTree_upper_bound(arg, leaf->keys, leaf->count, &key) - 1);
+}
+
+static BTreeRef BTree_GetFirst (const BTree *o)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    void *node = o->root;
+    for (int level = o->height - 1; level > 0; level--) {
+        node = ((BTree__Inner *)node)->children[0];
+    }
+    
+    BTreeRef ref = {(BTree__Leaf *)node, 0};
+    return ref;
+}
+
+static BTreeRef BTree_GetLast (const BTree *o)
+{
+    if (!o->root) {
+        return BTreeNullRef();
+    }
+    
+    void *node = o->root;
+    for (int level = o->height - 1; level > 0; level--) {
+        BTree__Inner *inner = (BTree__Inner *)node;
+        node = inner->children[inner->count];
+    }
+    
+    BTreeRef ref = {(BTree__Leaf *)node, ((BTree__Leaf *)node)->count - 1};
+    return ref;
+}
+
+static BTreeRef BTree_GetNext (const BTree *o, BTreeRef ref)
+{
+    ASSERT(!BTreeIsNullRef(ref))
+    ASSERT(ref.index < ref.leaf->count)
+    
+    return BTree_make_ref(ref.leaf, ref.index + 1);
+}
+
+static BTreeRef BTree_GetPrev (const BTree *o, BTreeRef ref)
+{
+    ASSERT(!BTreeIsNullRef(ref))
+    ASSERT(ref.index < ref.leaf->count)
+    
+    return BTree_make_ref(ref.leaf, ref.index - 1);
+}
+
+static int BTree_IsEmpty (const BTree *o)
+{
+    return !o->root;
+}
+
+static size_t BTree_Count (const BTree *o)
+{
+    return o->count;
+}
+
+static void BTree_Verify (const BTree *o, BTreeArg arg)
+{
+    if (!o->root) {
+        ASSERT_FORCE(o->height == 0)
+        ASSERT_FORCE(o->count == 0)
+        return;
+    }
+    
+    ASSERT_FORCE(o->height >= 1)
+    ASSERT_FORCE(o->height <= BTREE_MAX_HEIGHT)
+    
+    BTree__Leaf *last_leaf = NULL;
+    size_t count = BTree_verify_node(o, arg, o->root, o->height - 1, NULL, NULL, &last_leaf);
+    
+    ASSERT_FORCE(count == o->count)
+    ASSERT_FORCE(last_leaf->next == NULL)
+}
+
+#include "BTree_footer.h"
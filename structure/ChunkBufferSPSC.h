@@ -0,0 +1,222 @@
+/**
+ * @file ChunkBufferSPSC.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Single-producer single-consumer chunk ring for passing packets between two
+ * threads without locks. Packets are stored in the chunk format of
+ * {@link ChunkBuffer2}: a block holding the length followed by the data,
+ * padded to whole blocks. Where a packet of MTU size wouldn't fit before the
+ * end of the ring, the producer leaves a wrap marker and continues at the start.
+ * The producer and the consumer each keep their position in their own cache
+ * line, and publish it to the other side with release/acquire ordering.
+ */
+
+#ifndef BADVPN_STRUCTURE_CHUNKBUFFERSPSC_H
+#define BADVPN_STRUCTURE_CHUNKBUFFERSPSC_H
+
+#include <stdint.h>
+
+#include <misc/balign.h>
+#include <misc/debug.h>
+#include <structure/ChunkBuffer2.h>
+
+#define CHUNKBUFFERSPSC_CACHE_LINE 64
+
+#define CHUNKBUFFERSPSC_WRAP -1
+
+typedef struct {
+    struct ChunkBuffer2_block *buffer;
+    int size;
+    int mtu;
+    int mtu_blocks;
+    char pad0[CHUNKBUFFERSPSC_CACHE_LINE];
+    
+    // written by the producer
+    int tail;
+    char pad1[CHUNKBUFFERSPSC_CACHE_LINE];
+    
+    // written by the consumer
+    int head;
+    char pad2[CHUNKBUFFERSPSC_CACHE_LINE];
+    
+    // private to the producer
+    int prod_tail;
+    int prod_head;
+    int prod_write;
+    char pad3[CHUNKBUFFERSPSC_CACHE_LINE];
+    
+    // private to the consumer
+    int cons_head;
+    int cons_tail;
+    char pad4[CHUNKBUFFERSPSC_CACHE_LINE];
+} ChunkBufferSPSC;
+
+// initialize; blocks should come from ChunkBuffer2_calc_blocks(mtu, num)
+static void ChunkBufferSPSC_Init (ChunkBufferSPSC *o, struct ChunkBuffer2_block *buffer, int blocks, int mtu);
+
+// producer: get space for a packet of up to MTU bytes, or NULL if the ring is full
+static uint8_t * ChunkBufferSPSC_ProducerGet (ChunkBufferSPSC *o);
+
+// producer: publish the packet written to the space from ChunkBufferSPSC_ProducerGet
+static void ChunkBufferSPSC_ProducerSubmit (ChunkBufferSPSC *o, int len);
+
+// consumer: get the first packet and return its length, or -1 if the ring is empty
+static int ChunkBufferSPSC_ConsumerGet (ChunkBufferSPSC *o, uint8_t **data);
+
+// consumer: remove the packet from ChunkBufferSPSC_ConsumerGet, making its space available
+static void ChunkBufferSPSC_ConsumerConsume (ChunkBufferSPSC *o);
+
+void ChunkBufferSPSC_Init (ChunkBufferSPSC *o, struct ChunkBuffer2_block *buffer, int blocks, int mtu)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(blocks > 1 + bdivide_up(mtu, sizeof(struct ChunkBuffer2_block)))
+    
+    o->buffer = buffer;
+    o->size = blocks;
+    o->mtu = mtu;
+    o->mtu_blocks = 1 + bdivide_up(mtu, sizeof(struct ChunkBuffer2_block));
+    
+    o->tail = 0;
+    o->head = 0;
+    
+    o->prod_tail = 0;
+    o->prod_head = 0;
+    o->prod_write = -1;
+    
+    o->cons_head = 0;
+    o->cons_tail = 0;
+}
+
+uint8_t * ChunkBufferSPSC_ProducerGet (ChunkBufferSPSC *o)
+{
+    int t = o->prod_tail;
+    int n = o->mtu_blocks;
+    
+    // try with the head we saw last time, and look at the current one if
+    // that isn't enough. The tail must never catch up with the head, as
+    // that would look like an empty ring.
+    for (int i = 0; i < 2; i++) {
+        int h = o->prod_head;
+        
+        if (t >= h) {
+            // room up to the end
+            if (t + n <= o->size - (h == 0)) {
+                o->prod_write = t;
+                return (uint8_t *)&o->buffer[t + 1];
+            }
+            
+            // room at the start, past a wrap marker
+            if (n < h) {
+                o->prod_write = 0;
+                return (uint8_t *)&o->buffer[1];
+            }
+        } else {
+            // room up to the head
+            if (t + n < h) {
+                o->prod_write = t;
+                return (uint8_t *)&o->buffer[t + 1];
+            }
+        }
+        
+        o->prod_head = __atomic_load_n(&o->head, __ATOMIC_ACQUIRE);
+    }
+    
+    o->prod_write = -1;
+    return NULL;
+}
+
+void ChunkBufferSPSC_ProducerSubmit (ChunkBufferSPSC *o, int len)
+{
+    ASSERT(o->prod_write >= 0)
+    ASSERT(len >= 0)
+    ASSERT(len <= o->mtu)
+    
+    int w = o->prod_write;
+    int blocks = 1 + bdivide_up(len, sizeof(struct ChunkBuffer2_block));
+    
+    // write header, and the wrap marker if we continued at the start
+    o->buffer[w].len = len;
+    if (w != o->prod_tail) {
+        ASSERT(w == 0)
+        o->buffer[o->prod_tail].len = CHUNKBUFFERSPSC_WRAP;
+    }
+    
+    int t = w + blocks;
+    if (t == o->size) {
+        t = 0;
+    }
+    o->prod_tail = t;
+    o->prod_write = -1;
+    
+    // publish the packet
+    __atomic_store_n(&o->tail, t, __ATOMIC_RELEASE);
+}
+
+int ChunkBufferSPSC_ConsumerGet (ChunkBufferSPSC *o, uint8_t **data)
+{
+    int h = o->cons_head;
+    
+    // look at the current tail only if we've taken everything we knew of
+    if (h == o->cons_tail) {
+        o->cons_tail = __atomic_load_n(&o->tail, __ATOMIC_ACQUIRE);
+        if (h == o->cons_tail) {
+            return -1;
+        }
+    }
+    
+    // follow wrap marker
+    if (o->buffer[h].len == CHUNKBUFFERSPSC_WRAP) {
+        h = 0;
+        o->cons_head = h;
+    }
+    
+    ASSERT(o->buffer[h].len >= 0)
+    ASSERT(o->buffer[h].len <= o->mtu)
+    
+    *data = (uint8_t *)&o->buffer[h + 1];
+    return o->buffer[h].len;
+}
+
+void ChunkBufferSPSC_ConsumerConsume (ChunkBufferSPSC *o)
+{
+    int h = o->cons_head;
+    ASSERT(h != o->cons_tail)
+    ASSERT(o->buffer[h].len >= 0)
+    
+    h += 1 + bdivide_up(o->buffer[h].len, sizeof(struct ChunkBuffer2_block));
+    if (h == o->size) {
+        h = 0;
+    }
+    o->cons_head = h;
+    
+    // give the space back
+    __atomic_store_n(&o->head, h, __ATOMIC_RELEASE);
+}
+
+#endif
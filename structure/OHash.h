@@ -0,0 +1,143 @@
+/**
+ * @file OHash.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Open-addressing hash table template, an alternative to CHash.
+ * 
+ * Slots are arranged in groups of OHASH_GROUP_SIZE. Each slot has a control
+ * byte which is either empty, deleted or holds 7 bits of the entry's hash.
+ * A lookup probes whole groups of control bytes at once (using SSE2 or NEON
+ * where available), so that usually only the control bytes of one group and
+ * the matching entry are touched. The table grows automatically when it
+ * becomes 7/8 full.
+ */
+
+#ifndef BADVPN_OHASH_H
+#define BADVPN_OHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <misc/debug.h>
+#include <misc/merge.h>
+#include <misc/balloc.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OHASH_USE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define OHASH_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define OHASH_GROUP_SIZE 16
+
+#define OHASH_CTRL_EMPTY ((uint8_t)0x80)
+#define OHASH_CTRL_DELETED ((uint8_t)0xFE)
+
+// Match masks have one bit set for each matching slot in a group.
+// With NEON, this is the top bit of a nibble per slot.
+typedef uint64_t ohash_mask;
+
+#ifdef OHASH_USE_NEON
+#define OHASH_MASK_SHIFT 2
+#else
+#define OHASH_MASK_SHIFT 0
+#endif
+
+#ifdef OHASH_USE_NEON
+static ohash_mask ohash_neon_mask (uint8x16_t cmp)
+{
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & UINT64_C(0x8888888888888888);
+}
+#endif
+
+static ohash_mask ohash_group_match (const uint8_t *group, uint8_t h2)
+{
+#if defined(OHASH_USE_SSE2)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#elif defined(OHASH_USE_NEON)
+    return ohash_neon_mask(vceqq_u8(vld1q_u8(group), vdupq_n_u8(h2)));
+#else
+    ohash_mask mask = 0;
+    for (int i = 0; i < OHASH_GROUP_SIZE; i++) {
+        mask |= (ohash_mask)(group[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+static ohash_mask ohash_group_match_empty (const uint8_t *group)
+{
+    return ohash_group_match(group, OHASH_CTRL_EMPTY);
+}
+
+static ohash_mask ohash_group_match_free (const uint8_t *group)
+{
+#if defined(OHASH_USE_SSE2)
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#elif defined(OHASH_USE_NEON)
+    return ohash_neon_mask(vtstq_u8(vld1q_u8(group), vdupq_n_u8(0x80)));
+#else
+    ohash_mask mask = 0;
+    for (int i = 0; i < OHASH_GROUP_SIZE; i++) {
+        mask |= (ohash_mask)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static int ohash_mask_first (ohash_mask mask)
+{
+    ASSERT(mask)
+    
+#ifdef __GNUC__
+    return __builtin_ctzll(mask) >> OHASH_MASK_SHIFT;
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i >> OHASH_MASK_SHIFT;
+#endif
+}
+
+static ohash_mask ohash_mask_clear_first (ohash_mask mask)
+{
+    ASSERT(mask)
+    
+    return mask & (mask - 1);
+}
+
+#endif
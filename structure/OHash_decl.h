@@ -0,0 +1,61 @@
+/**
+ * @file OHash_decl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OHash_header.h"
+
+typedef struct {
+    uint8_t *ctrl;
+    OHashLink *slots;
+    size_t num_groups;
+    size_t count;
+    size_t growth_left;
+} OHash;
+
+typedef struct {
+    OHashEntry *ptr;
+    OHashLink link;
+} OHashRef;
+
+static OHashLink OHashNullLink (void);
+static OHashRef OHashNullRef (void);
+static int OHashIsNullLink (OHashLink link);
+static int OHashIsNullRef (OHashRef ref);
+static OHashRef OHashDerefMayNull (OHashArg arg, OHashLink link);
+static OHashRef OHashDerefNonNull (OHashArg arg, OHashLink link);
+
+static int OHash_Init (OHash *o, size_t capacity);
+static void OHash_Free (OHash *o);
+static int OHash_Insert (OHash *o, OHashArg arg, OHashRef entry, OHashRef *out_existing);
+static void OHash_Remove (OHash *o, OHashArg arg, OHashRef entry);
+static OHashRef OHash_Lookup (const OHash *o, OHashArg arg, OHashKey key);
+static size_t OHash_Count (const OHash *o);
+static void OHash_Verify (const OHash *o, OHashArg arg);
+
+#include "OHash_footer.h"
@@ -0,0 +1,74 @@
+/**
+ * @file OHash_footer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// preprocessor inputs
+#undef OHASH_PARAM_NAME
+#undef OHASH_PARAM_ENTRY
+#undef OHASH_PARAM_LINK
+#undef OHASH_PARAM_KEY
+#undef OHASH_PARAM_ARG
+#undef OHASH_PARAM_NULL
+#undef OHASH_PARAM_DEREF
+#undef OHASH_PARAM_ENTRYHASH
+#undef OHASH_PARAM_KEYHASH
+#undef OHASH_PARAM_COMPARE_ENTRIES
+#undef OHASH_PARAM_COMPARE_KEY_ENTRY
+
+// types
+#undef OHash
+#undef OHashEntry
+#undef OHashLink
+#undef OHashRef
+#undef OHashArg
+#undef OHashKey
+
+// non-object public functions
+#undef OHashNullLink
+#undef OHashNullRef
+#undef OHashIsNullLink
+#undef OHashIsNullRef
+#undef OHashDerefMayNull
+#undef OHashDerefNonNull
+
+// public functions
+#undef OHash_Init
+#undef OHash_Free
+#undef OHash_Insert
+#undef OHash_Remove
+#undef OHash_Lookup
+#undef OHash_Count
+#undef OHash_Verify
+
+// private things
+#undef OHash_assert_valid_entry
+#undef OHash_max_entries
+#undef OHash_alloc
+#undef OHash_find_free
+#undef OHash_rehash
@@ -0,0 +1,78 @@
+/**
+ * @file OHash_header.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Preprocessor inputs:
+// OHASH_PARAM_NAME - name of this data structure
+// OHASH_PARAM_ENTRY - type of entry
+// OHASH_PARAM_LINK - type of entry link (usually a pointer or index to an array)
+// OHASH_PARAM_KEY - type of key
+// OHASH_PARAM_ARG - type of argument pass through to comparisons
+// OHASH_PARAM_NULL - invalid link
+// OHASH_PARAM_DEREF(arg, link) - dereference a non-null link
+// OHASH_PARAM_ENTRYHASH(arg, entry) - hash function for entries; returns size_t
+// OHASH_PARAM_KEYHASH(arg, key) - hash function for keys; returns size_t
+// OHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) - compares two entries; returns 1 for equality, 0 otherwise
+// OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) - compares key and entry; returns 1 for equality, 0 otherwise
+
+#ifndef BADVPN_OHASH_H
+#error OHash.h has not been included
+#endif
+
+// types
+#define OHash OHASH_PARAM_NAME
+#define OHashEntry OHASH_PARAM_ENTRY
+#define OHashLink OHASH_PARAM_LINK
+#define OHashRef MERGE(OHash, Ref)
+#define OHashArg OHASH_PARAM_ARG
+#define OHashKey OHASH_PARAM_KEY
+
+// non-object public functions
+#define OHashNullLink MERGE(OHash, NullLink)
+#define OHashNullRef MERGE(OHash, NullRef)
+#define OHashIsNullLink MERGE(OHash, IsNullLink)
+#define OHashIsNullRef MERGE(OHash, IsNullRef)
+#define OHashDerefMayNull MERGE(OHash, DerefMayNull)
+#define OHashDerefNonNull MERGE(OHash, DerefNonNull)
+
+// public functions
+#define OHash_Init MERGE(OHash, _Init)
+#define OHash_Free MERGE(OHash, _Free)
+#define OHash_Insert MERGE(OHash, _Insert)
+#define OHash_Remove MERGE(OHash, _Remove)
+#define OHash_Lookup MERGE(OHash, _Lookup)
+#define OHash_Count MERGE(OHash, _Count)
+#define OHash_Verify MERGE(OHash, _Verify)
+
+// private things
+#define OHash_assert_valid_entry MERGE(OHash, _assert_valid_entry)
+#define OHash_max_entries MERGE(OHash, _max_entries)
+#define OHash_alloc MERGE(OHash, _alloc)
+#define OHash_find_free MERGE(OHash, _find_free)
+#define OHash_rehash MERGE(OHash, _rehash)
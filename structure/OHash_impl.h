@@ -0,0 +1,377 @@
+/**
+ * @file OHash_impl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OHash_header.h"
+
+static void OHash_assert_valid_entry (OHashArg arg, OHashRef entry)
+{
+    ASSERT(entry.link != OHashNullLink())
+    ASSERT(entry.ptr == OHASH_PARAM_DEREF(arg, entry.link))
+}
+
+static size_t OHash_max_entries (size_t num_groups)
+{
+    // keep at least 1/8 of slots empty so that probing terminates quickly
+    return num_groups * (OHASH_GROUP_SIZE - OHASH_GROUP_SIZE / 8);
+}
+
+static int OHash_alloc (OHash *o, size_t num_groups)
+{
+    ASSERT(num_groups > 0)
+    ASSERT((num_groups & (num_groups - 1)) == 0)
+    
+    if (num_groups > SIZE_MAX / OHASH_GROUP_SIZE) {
+        return 0;
+    }
+    size_t num_slots = num_groups * OHASH_GROUP_SIZE;
+    
+    o->ctrl = (uint8_t *)BAllocArray(num_slots, sizeof(o->ctrl[0]));
+    if (!o->ctrl) {
+        return 0;
+    }
+    
+    o->slots = (OHashLink *)BAllocArray(num_slots, sizeof(o->slots[0]));
+    if (!o->slots) {
+        BFree(o->ctrl);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < num_slots; i++) {
+        o->ctrl[i] = OHASH_CTRL_EMPTY;
+    }
+    
+    o->num_groups = num_groups;
+    o->count = 0;
+    o->growth_left = OHash_max_entries(num_groups);
+    
+    return 1;
+}
+
+static size_t OHash_find_free (const OHash *o, size_t hash)
+{
+    size_t group_mask = o->num_groups - 1;
+    size_t group = (hash >> 7) & group_mask;
+    
+    for (size_t step = 1;; step++) {
+        ohash_mask free_mask = ohash_group_match_free(o->ctrl + group * OHASH_GROUP_SIZE);
+        if (free_mask) {
+            return group * OHASH_GROUP_SIZE + ohash_mask_first(free_mask);
+        }
+        ASSERT(step <= o->num_groups)
+        group = (group + step) & group_mask;
+    }
+}
+
+static int OHash_rehash (OHash *o, OHashArg arg, size_t new_num_groups)
+{
+    ASSERT(o->count <= OHash_max_entries(new_num_groups))
+    
+    OHash old = *o;
+    
+    if (!OHash_alloc(o, new_num_groups)) {
+        *o = old;
+        return 0;
+    }
+    
+    for (size_t i = 0; i < old.num_groups * OHASH_GROUP_SIZE; i++) {
+        if ((old.ctrl[i] & 0x80)) {
+            continue;
+        }
+        
+        OHashRef cur = OHashDerefNonNull(arg, old.slots[i]);
+        size_t hash = OHASH_PARAM_ENTRYHASH(arg, cur);
+        
+        size_t index = OHash_find_free(o, hash);
+        o->ctrl[index] = hash & 0x7F;
+        o->slots[index] = old.slots[i];
+    }
+    
+    o->count = old.count;
+    o->growth_left -= old.count;
+    
+    BFree(old.slots);
+    BFree(old.ctrl);
+    
+    return 1;
+}
+
+static OHashLink OHashNullLink (void)
+{
+    return OHASH_PARAM_NULL;
+}
+
+static OHashRef OHashNullRef (void)
+{
+    OHashRef entry = {NULL, OHashNullLink()};
+    return entry;
+}
+
+static int OHashIsNullLink (OHashLink link)
+{
+    return (link == OHashNullLink());
+}
+
+static int OHashIsNullRef (OHashRef ref)
+{
+    return OHashIsNullLink(ref.link);
+}
+
+static OHashRef OHashDerefMayNull (OHashArg arg, OHashLink link)
+{
+    if (link == OHashNullLink()) {
+        return OHashNullRef();
+    }
+    
+    OHashRef entry = {OHASH_PARAM_DEREF(arg, link), link};
+    ASSERT(entry.ptr)
+    
+    return entry;
+}
+
+static OHashRef OHashDerefNonNull (OHashArg arg, OHashLink link)
+{
+    ASSERT(link != OHashNullLink())
+    
+    OHashRef entry = {OHASH_PARAM_DEREF(arg, link), link};
+    ASSERT(entry.ptr)
+    
+    return entry;
+}
+
+static int OHash_Init (OHash *o, size_t capacity)
+{
+    size_t num_groups = 1;
+    while (OHash_max_entries(num_groups) < capacity) {
+        if (num_groups > SIZE_MAX / 2 / OHASH_GROUP_SIZE) {
+            return 0;
+        }
+        num_groups *= 2;
+    }
+    
+    return OHash_alloc(o, num_groups);
+}
+
+static void OHash_Free (OHash *o)
+{
+    BFree(o->slots);
+    BFree(o->ctrl);
+}
+
+static int OHash_Insert (OHash *o, OHashArg arg, OHashRef entry, OHashRef *out_existing)
+{
+    OHash_assert_valid_entry(arg, entry);
+    
+    size_t hash = OHASH_PARAM_ENTRYHASH(arg, entry);
+    uint8_t h2 = hash & 0x7F;
+    size_t group_mask = o->num_groups - 1;
+    size_t group = (hash >> 7) & group_mask;
+    
+    // look for an equal entry
+    for (size_t step = 1;; step++) {
+        const uint8_t *ctrl = o->ctrl + group * OHASH_GROUP_SIZE;
+        
+        for (ohash_mask m = ohash_group_match(ctrl, h2); m; m = ohash_mask_clear_first(m)) {
+            size_t index = group * OHASH_GROUP_SIZE + ohash_mask_first(m);
+            OHashRef cur = OHashDerefNonNull(arg, o->slots[index]);
+            if (OHASH_PARAM_COMPARE_ENTRIES(arg, cur, entry)) {
+                if (out_existing) {
+                    *out_existing = cur;
+                }
+                return 0;
+            }
+        }
+        
+        if (ohash_group_match_empty(ctrl)) {
+            break;
+        }
+        
+        ASSERT(step <= o->num_groups)
+        group = (group + step) & group_mask;
+    }
+    
+    // make space if needed; if the table is mostly deleted slots,
+    // just clean them up, otherwise grow
+    if (o->growth_left == 0) {
+        size_t new_num_groups = o->num_groups;
+        if (o->count > OHash_max_entries(o->num_groups) / 2) {
+            if (o->num_groups > SIZE_MAX / 2 / OHASH_GROUP_SIZE) {
+                goto fail;
+            }
+            new_num_groups *= 2;
+        }
+        if (!OHash_rehash(o, arg, new_num_groups)) {
+            goto fail;
+        }
+    }
+    
+    size_t index = OHash_find_free(o, hash);
+    
+    // reusing a deleted slot does not reduce the number of empty slots
+    if (o->ctrl[index] == OHASH_CTRL_EMPTY) {
+        ASSERT(o->growth_left > 0)
+        o->growth_left--;
+    }
+    
+    o->ctrl[index] = h2;
+    o->slots[index] = entry.link;
+    o->count++;
+    
+    return 1;
+    
+fail:
+    if (out_existing) {
+        *out_existing = OHashNullRef();
+    }
+    return 0;
+}
+
+static void OHash_Remove (OHash *o, OHashArg arg, OHashRef entry)
+{
+    OHash_assert_valid_entry(arg, entry);
+    
+    size_t hash = OHASH_PARAM_ENTRYHASH(arg, entry);
+    uint8_t h2 = hash & 0x7F;
+    size_t group_mask = o->num_groups - 1;
+    size_t group = (hash >> 7) & group_mask;
+    
+    for (size_t step = 1;; step++) {
+        uint8_t *ctrl = o->ctrl + group * OHASH_GROUP_SIZE;
+        
+        for (ohash_mask m = ohash_group_match(ctrl, h2); m; m = ohash_mask_clear_first(m)) {
+            size_t index = group * OHASH_GROUP_SIZE + ohash_mask_first(m);
+            if (o->slots[index] != entry.link) {
+                continue;
+            }
+            
+            // If the group has an empty slot, no probe has ever continued
+            // past it, and the slot can become empty. Otherwise, lookups
+            // must continue past it, so leave a deleted marker.
+            if (ohash_group_match_empty(ctrl)) {
+                o->ctrl[index] = OHASH_CTRL_EMPTY;
+                o->growth_left++;
+            } else {
+                o->ctrl[index] = OHASH_CTRL_DELETED;
+            }
+            
+            o->count--;
+            return;
+        }
+        
+        ASSERT(!ohash_group_match_empty(ctrl))
+        ASSERT(step <= o->num_groups)
+        group = (group + step) & group_mask;
+    }
+}
+
+static OHashRef OHash_Lookup (const OHash *o, OHashArg arg, OHashKey key)
+{
+    size_t hash = OHASH_PARAM_KEYHASH(arg, key);
+    uint8_t h2 = hash & 0x7F;
+    size_t group_mask = o->num_groups - 1;
+    size_t group = (hash >> 7) & group_mask;
+    
+    for (size_t step = 1;; step++) {
+        const uint8_t *ctrl = o->ctrl + group * OHASH_GROUP_SIZE;
+        
+        for (ohash_mask m = ohash_group_match(ctrl, h2); m; m = ohash_mask_clear_first(m)) {
+            size_t index = group * OHASH_GROUP_SIZE + ohash_mask_first(m);
+            OHashRef cur = OHashDerefNonNull(arg, o->slots[index]);
+            if (OHASH_PARAM_COMPARE_KEY_ENTRY(arg, key, cur)) {
+                return cur;
+            }
+        }
+        
+        if (ohash_group_match_empty(ctrl)) {
+            return OHashNullRef();
+        }
+        
+        ASSERT(step <= o->num_groups)
+        group = (group + step) & group_mask;
+    }
+}
+
+static size_t OHash_Count (const OHash *o)
+{
+    return o->count;
+}
+
+static void OHash_Verify (const OHash *o, OHashArg arg)
+{
+    ASSERT_FORCE(o->num_groups > 0)
+    ASSERT_FORCE((o->num_groups & (o->num_groups - 1)) == 0)
+    ASSERT_FORCE(o->ctrl)
+    ASSERT_FORCE(o->slots)
+    
+    size_t count = 0;
+    size_t num_empty = 0;
+    
+    for (size_t i = 0; i < o->num_groups * OHASH_GROUP_SIZE; i++) {
+        if (o->ctrl[i] == OHASH_CTRL_EMPTY) {
+            num_empty++;
+            continue;
+        }
+        if (o->ctrl[i] == OHASH_CTRL_DELETED) {
+            continue;
+        }
+        ASSERT_FORCE(!(o->ctrl[i] & 0x80))
+        
+        OHashRef cur = OHashDerefNonNull(arg, o->slots[i]);
+        size_t hash = OHASH_PARAM_ENTRYHASH(arg, cur);
+        ASSERT_FORCE(o->ctrl[i] == (hash & 0x7F))
+        
+        // the entry must be reachable by probing, and must be the
+        // only entry equal to itself
+        size_t group_mask = o->num_groups - 1;
+        size_t group = (hash >> 7) & group_mask;
+        int found = 0;
+        for (size_t step = 1;; step++) {
+            ASSERT_FORCE(step <= o->num_groups)
+            for (size_t j = group * OHASH_GROUP_SIZE; j < (group + 1) * OHASH_GROUP_SIZE; j++) {
+                if ((o->ctrl[j] & 0x80) || j == i) {
+                    found |= (j == i);
+                    continue;
+                }
+                ASSERT_FORCE(!OHASH_PARAM_COMPARE_ENTRIES(arg, OHashDerefNonNull(arg, o->slots[j]), cur))
+            }
+            if (found || ohash_group_match_empty(o->ctrl + group * OHASH_GROUP_SIZE)) {
+                break;
+            }
+            group = (group + step) & group_mask;
+        }
+        ASSERT_FORCE(found)
+        
+        count++;
+    }
+    
+    ASSERT_FORCE(count == o->count)
+    ASSERT_FORCE(num_empty == o->growth_left + (o->num_groups * OHASH_GROUP_SIZE - OHash_max_entries(o->num_groups)))
+}
+
+#include "OHash_footer.h"
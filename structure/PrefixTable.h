@@ -0,0 +1,730 @@
+/**
+ * @file PrefixTable.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Longest-prefix-match table for IPv4 and IPv6 prefixes.
+ * 
+ * Lookups use a Poptrie-style multibit trie. Each node consumes 6 address
+ * bits and has two 64-bit bitmaps: one for slots that continue in a child
+ * node, and one that marks where a run of equal results starts. Children and
+ * results are stored in dense arrays indexed by population counts, and the
+ * result of the longest matching prefix is pushed down into every slot it
+ * covers. A lookup is therefore a few bitmap operations and one memory
+ * access per 6 bits, and stops at the first slot without a child.
+ * 
+ * Prefixes are also kept in a binary trie, from which the lookup nodes are
+ * built. An insertion or removal rebuilds only the lookup node that
+ * contains the prefix and the nodes below it. Many changes can be batched
+ * between {@link PrefixTable_BeginBulk} and {@link PrefixTable_EndBulk},
+ * which rebuilds everything once at the end.
+ */
+
+#ifndef BADVPN_PREFIXTABLE_H
+#define BADVPN_PREFIXTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/ipaddr6.h>
+#include <system/BAddr.h>
+
+#define PREFIXTABLE_STRIDE 6
+
+struct PrefixTable__tnode {
+    struct PrefixTable__tnode *child[2];
+    void *value;
+};
+
+struct PrefixTable__node {
+    uint64_t child_bits;
+    uint64_t leaf_bits;
+    struct PrefixTable__node *children;
+    void **leaves;
+};
+
+struct PrefixTable__family {
+    int key_bits;
+    struct PrefixTable__tnode *troot;
+    struct PrefixTable__node root;
+};
+
+typedef struct {
+    struct PrefixTable__family ipv4;
+    struct PrefixTable__family ipv6;
+    size_t count;
+    int bulk;
+} PrefixTable;
+
+/**
+ * Initializes the table. It starts empty and not in bulk mode.
+ * 
+ * @param o the object
+ */
+static void PrefixTable_Init (PrefixTable *o);
+
+/**
+ * Frees the table.
+ * 
+ * @param o the object
+ */
+static void PrefixTable_Free (PrefixTable *o);
+
+/**
+ * Adds an IPv4 prefix.
+ * 
+ * @param o the object
+ * @param addr network address in network byte order; bits beyond the prefix
+ *             length are ignored
+ * @param prefix prefix length, 0-32
+ * @param value value to associate with the prefix; must not be NULL
+ * @param out_existing if not NULL, on failure, receives the value of the
+ *                     same prefix if it exists, or NULL if memory could not
+ *                     be allocated
+ * @return 1 on success, 0 if the prefix already exists or memory could not
+ *         be allocated; in that case the table is unchanged
+ */
+static int PrefixTable_Insert4 (PrefixTable *o, uint32_t addr, int prefix, void *value, void **out_existing) WARN_UNUSED;
+
+/**
+ * Adds an IPv6 prefix. See {@link PrefixTable_Insert4}.
+ */
+static int PrefixTable_Insert6 (PrefixTable *o, struct ipv6_addr addr, int prefix, void *value, void **out_existing) WARN_UNUSED;
+
+/**
+ * Removes an IPv4 prefix, which must exist.
+ * 
+ * @param o the object
+ * @param addr network address in network byte order
+ * @param prefix prefix length, 0-32
+ * @return 1 on success, 0 if memory could not be allocated; in that case
+ *         the table is unchanged. Never fails in bulk mode.
+ */
+static int PrefixTable_Remove4 (PrefixTable *o, uint32_t addr, int prefix) WARN_UNUSED;
+
+/**
+ * Removes an IPv6 prefix, which must exist. See {@link PrefixTable_Remove4}.
+ */
+static int PrefixTable_Remove6 (PrefixTable *o, struct ipv6_addr addr, int prefix) WARN_UNUSED;
+
+/**
+ * Returns the value of exactly this IPv4 prefix, or NULL if it has not been
+ * added. Works in bulk mode too.
+ */
+static void * PrefixTable_GetExact4 (const PrefixTable *o, uint32_t addr, int prefix);
+
+/**
+ * Returns the value of exactly this IPv6 prefix, or NULL if it has not been
+ * added. Works in bulk mode too.
+ */
+static void * PrefixTable_GetExact6 (const PrefixTable *o, struct ipv6_addr addr, int prefix);
+
+/**
+ * Finds the longest prefix containing an IPv4 address.
+ * Must not be called in bulk mode.
+ * 
+ * @param o the object
+ * @param addr address in network byte order
+ * @return value of the longest matching prefix, or NULL if none matches
+ */
+static void * PrefixTable_Lookup4 (const PrefixTable *o, uint32_t addr);
+
+/**
+ * Finds the longest prefix containing an IPv6 address.
+ * Must not be called in bulk mode.
+ */
+static void * PrefixTable_Lookup6 (const PrefixTable *o, const struct ipv6_addr *addr);
+
+/**
+ * Finds the longest prefix containing an address of either family.
+ * Must not be called in bulk mode.
+ * 
+ * @return value of the longest matching prefix, or NULL if none matches or
+ *         the address is neither IPv4 nor IPv6
+ */
+static void * PrefixTable_LookupIPAddr (const PrefixTable *o, const BIPAddr *addr);
+
+/**
+ * Returns the number of prefixes in the table.
+ */
+static size_t PrefixTable_Count (const PrefixTable *o);
+
+/**
+ * Enters bulk mode. In bulk mode, insertions and removals only update the
+ * binary trie, and lookups are not allowed.
+ * 
+ * @param o the object, not in bulk mode
+ */
+static void PrefixTable_BeginBulk (PrefixTable *o);
+
+/**
+ * Rebuilds the lookup structures and leaves bulk mode.
+ * 
+ * @param o the object, in bulk mode
+ * @return 1 on success, 0 if memory could not be allocated; in that case
+ *         the table stays in bulk mode
+ */
+static int PrefixTable_EndBulk (PrefixTable *o) WARN_UNUSED;
+
+static int PrefixTable__popcount (uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    while (x) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// mask of slots 0..slot
+static uint64_t PrefixTable__upto (int slot)
+{
+    return (~(uint64_t)0) >> (63 - slot);
+}
+
+// keys are 128-bit big-endian numbers split into hi and lo;
+// IPv4 addresses are in the top 32 bits of hi
+static int PrefixTable__key_bit (uint64_t hi, uint64_t lo, int i)
+{
+    ASSERT(i >= 0)
+    ASSERT(i < 128)
+    
+    return (i < 64 ? (hi >> (63 - i)) : (lo >> (127 - i))) & 1;
+}
+
+static int PrefixTable__key_slot (uint64_t hi, uint64_t lo, int d)
+{
+    ASSERT(d >= 0)
+    ASSERT(d < 128)
+    
+    if (d <= 64 - PREFIXTABLE_STRIDE) {
+        return (hi >> (64 - PREFIXTABLE_STRIDE - d)) & 63;
+    }
+    if (d < 64) {
+        return ((hi << (d - (64 - PREFIXTABLE_STRIDE))) | (lo >> (128 - PREFIXTABLE_STRIDE - d))) & 63;
+    }
+    if (d <= 128 - PREFIXTABLE_STRIDE) {
+        return (lo >> (128 - PREFIXTABLE_STRIDE - d)) & 63;
+    }
+    return (lo << (d - (128 - PREFIXTABLE_STRIDE))) & 63;
+}
+
+static void PrefixTable__key4 (uint32_t addr, uint64_t *hi, uint64_t *lo)
+{
+    *hi = (uint64_t)ntoh32(addr) << 32;
+    *lo = 0;
+}
+
+static void PrefixTable__key6 (const struct ipv6_addr *addr, uint64_t *hi, uint64_t *lo)
+{
+    uint64_t h = 0;
+    uint64_t l = 0;
+    for (int i = 0; i < 8; i++) {
+        h = (h << 8) | addr->bytes[i];
+        l = (l << 8) | addr->bytes[8 + i];
+    }
+    *hi = h;
+    *lo = l;
+}
+
+static void PrefixTable__free_node (struct PrefixTable__node *node)
+{
+    int num_children = PrefixTable__popcount(node->child_bits);
+    for (int i = 0; i < num_children; i++) {
+        PrefixTable__free_node(&node->children[i]);
+    }
+    
+    BFree(node->children);
+    BFree(node->leaves);
+}
+
+static void PrefixTable__free_tnode (struct PrefixTable__tnode *t)
+{
+    while (t) {
+        PrefixTable__free_tnode(t->child[0]);
+        struct PrefixTable__tnode *next = t->child[1];
+        BFree(t);
+        t = next;
+    }
+}
+
+// builds the lookup node at depth d from the binary trie node at the same
+// depth (or NULL), where best is the value of the longest prefix up to and
+// including depth d
+static int PrefixTable__build (struct PrefixTable__node *out, const struct PrefixTable__tnode *t, void *best, int d, int key_bits)
+{
+    const struct PrefixTable__tnode *slot_t[64];
+    void *slot_best[64];
+    uint64_t child_bits = 0;
+    uint64_t leaf_bits = 0;
+    int num_leaves = 0;
+    void *prev = NULL;
+    
+    for (int s = 0; s < 64; s++) {
+        const struct PrefixTable__tnode *c = t;
+        void *b = best;
+        
+        for (int j = 0; j < PREFIXTABLE_STRIDE && c && d + j < key_bits; j++) {
+            c = c->child[(s >> (PREFIXTABLE_STRIDE - 1 - j)) & 1];
+            if (c && c->value) {
+                b = c->value;
+            }
+        }
+        
+        slot_t[s] = c;
+        slot_best[s] = b;
+        
+        if (c && d + PREFIXTABLE_STRIDE < key_bits && (c->child[0] || c->child[1])) {
+            child_bits |= (uint64_t)1 << s;
+        }
+        else if (b != prev) {
+            leaf_bits |= (uint64_t)1 << s;
+            num_leaves++;
+            prev = b;
+        }
+    }
+    
+    int num_children = PrefixTable__popcount(child_bits);
+    
+    out->child_bits = child_bits;
+    out->leaf_bits = leaf_bits;
+    out->children = NULL;
+    out->leaves = NULL;
+    
+    if (num_leaves > 0) {
+        out->leaves = (void **)BAllocArray(num_leaves, sizeof(out->leaves[0]));
+        if (!out->leaves) {
+            goto fail0;
+        }
+        
+        int k = 0;
+        for (int s = 0; s < 64; s++) {
+            if ((leaf_bits >> s) & 1) {
+                out->leaves[k++] = slot_best[s];
+            }
+        }
+    }
+    
+    if (num_children > 0) {
+        out->children = (struct PrefixTable__node *)BAllocArray(num_children, sizeof(out->children[0]));
+        if (!out->children) {
+            goto fail1;
+        }
+        
+        int k = 0;
+        for (int s = 0; s < 64; s++) {
+            if ((child_bits >> s) & 1) {
+                if (!PrefixTable__build(&out->children[k], slot_t[s], slot_best[s], d + PREFIXTABLE_STRIDE, key_bits)) {
+                    while (k-- > 0) {
+                        PrefixTable__free_node(&out->children[k]);
+                    }
+                    goto fail2;
+                }
+                k++;
+            }
+        }
+    }
+    
+    return 1;
+    
+fail2:
+    BFree(out->children);
+fail1:
+    BFree(out->leaves);
+fail0:
+    return 0;
+}
+
+static void * PrefixTable__lookup (const struct PrefixTable__family *f, uint64_t hi, uint64_t lo)
+{
+    const struct PrefixTable__node *node = &f->root;
+    int d = 0;
+    
+    while (1) {
+        int slot = PrefixTable__key_slot(hi, lo, d);
+        uint64_t upto = PrefixTable__upto(slot);
+        
+        if (!((node->child_bits >> slot) & 1)) {
+            int n = PrefixTable__popcount(node->leaf_bits & upto);
+            return (n > 0 ? node->leaves[n - 1] : NULL);
+        }
+        
+        node = &node->children[PrefixTable__popcount(node->child_bits & upto) - 1];
+        d += PREFIXTABLE_STRIDE;
+    }
+}
+
+// finds the lookup node which contains a prefix, i.e. the one that has to be
+// rebuilt when the prefix changes, and the binary trie node and best value
+// at its depth
+static struct PrefixTable__node * PrefixTable__find_rebuild (struct PrefixTable__family *f, uint64_t hi, uint64_t lo, int prefix, int *out_d)
+{
+    struct PrefixTable__node *node = &f->root;
+    int d = 0;
+    
+    while (prefix >= d + PREFIXTABLE_STRIDE) {
+        int slot = PrefixTable__key_slot(hi, lo, d);
+        if (!((node->child_bits >> slot) & 1)) {
+            break;
+        }
+        node = &node->children[PrefixTable__popcount(node->child_bits & PrefixTable__upto(slot)) - 1];
+        d += PREFIXTABLE_STRIDE;
+    }
+    
+    *out_d = d;
+    return node;
+}
+
+static int PrefixTable__rebuild (struct PrefixTable__family *f, uint64_t hi, uint64_t lo, int prefix)
+{
+    int d;
+    struct PrefixTable__node *node = PrefixTable__find_rebuild(f, hi, lo, prefix, &d);
+    
+    const struct PrefixTable__tnode *t = f->troot;
+    void *best = (t ? t->value : NULL);
+    for (int i = 0; i < d && t; i++) {
+        t = t->child[PrefixTable__key_bit(hi, lo, i)];
+        if (t && t->value) {
+            best = t->value;
+        }
+    }
+    
+    struct PrefixTable__node new_node;
+    if (!PrefixTable__build(&new_node, t, best, d, f->key_bits)) {
+        return 0;
+    }
+    
+    PrefixTable__free_node(node);
+    *node = new_node;
+    
+    return 1;
+}
+
+static void PrefixTable__family_init (struct PrefixTable__family *f, int key_bits)
+{
+    f->key_bits = key_bits;
+    f->troot = NULL;
+    f->root.child_bits = 0;
+    f->root.leaf_bits = 0;
+    f->root.children = NULL;
+    f->root.leaves = NULL;
+}
+
+static void PrefixTable__family_free (struct PrefixTable__family *f)
+{
+    PrefixTable__free_node(&f->root);
+    PrefixTable__free_tnode(f->troot);
+}
+
+static struct PrefixTable__tnode * PrefixTable__tnode_new (void)
+{
+    struct PrefixTable__tnode *t = (struct PrefixTable__tnode *)BAlloc(sizeof(*t));
+    if (t) {
+        t->child[0] = NULL;
+        t->child[1] = NULL;
+        t->value = NULL;
+    }
+    return t;
+}
+
+static int PrefixTable__insert (PrefixTable *o, struct PrefixTable__family *f, uint64_t hi, uint64_t lo, int prefix, void *value, void **out_existing)
+{
+    ASSERT(prefix >= 0)
+    ASSERT(prefix <= f->key_bits)
+    ASSERT(value)
+    
+    // find or create the binary trie path, remembering where new nodes were
+    // attached so they can be detached if building fails
+    struct PrefixTable__tnode **new_link = NULL;
+    struct PrefixTable__tnode **link = &f->troot;
+    
+    for (int i = 0; ; i++) {
+        if (!*link) {
+            struct PrefixTable__tnode *t = PrefixTable__tnode_new();
+            if (!t) {
+                goto fail;
+            }
+            *link = t;
+            if (!new_link) {
+                new_link = link;
+            }
+        }
+        if (i == prefix) {
+            break;
+        }
+        link = &(*link)->child[PrefixTable__key_bit(hi, lo, i)];
+    }
+    
+    struct PrefixTable__tnode *t = *link;
+    
+    if (t->value) {
+        ASSERT(!new_link)
+        if (out_existing) {
+            *out_existing = t->value;
+        }
+        return 0;
+    }
+    
+    t->value = value;
+    
+    if (!o->bulk && !PrefixTable__rebuild(f, hi, lo, prefix)) {
+        t->value = NULL;
+        goto fail;
+    }
+    
+    o->count++;
+    return 1;
+    
+fail:
+    if (new_link) {
+        PrefixTable__free_tnode(*new_link);
+        *new_link = NULL;
+    }
+    if (out_existing) {
+        *out_existing = NULL;
+    }
+    return 0;
+}
+
+static int PrefixTable__remove (PrefixTable *o, struct PrefixTable__family *f, uint64_t hi, uint64_t lo, int prefix)
+{
+    ASSERT(prefix >= 0)
+    ASSERT(prefix <= f->key_bits)
+    
+    // walk the path, remembering the link to the topmost node of the chain
+    // that will be left without values and other branches
+    struct PrefixTable__tnode **dead_link = NULL;
+    struct PrefixTable__tnode **link = &f->troot;
+    
+    for (int i = 0; i < prefix; i++) {
+        struct PrefixTable__tnode *t = *link;
+        ASSERT(t)
+        
+        int dir = PrefixTable__key_bit(hi, lo, i);
+        
+        if (t->value || t->child[!dir]) {
+            dead_link = NULL;
+        } else if (!dead_link) {
+            dead_link = link;
+        }
+        
+        link = &t->child[dir];
+    }
+    
+    ASSERT(*link)
+    
+    if ((*link)->child[0] || (*link)->child[1]) {
+        dead_link = NULL;
+    } else if (!dead_link) {
+        dead_link = link;
+    }
+    
+    struct PrefixTable__tnode *t = *link;
+    ASSERT(t->value)
+    
+    void *value = t->value;
+    t->value = NULL;
+    
+    struct PrefixTable__tnode *dead = NULL;
+    if (dead_link) {
+        dead = *dead_link;
+        *dead_link = NULL;
+    }
+    
+    if (!o->bulk && !PrefixTable__rebuild(f, hi, lo, prefix)) {
+        if (dead_link) {
+            *dead_link = dead;
+        }
+        t->value = value;
+        return 0;
+    }
+    
+    PrefixTable__free_tnode(dead);
+    
+    o->count--;
+    return 1;
+}
+
+static void * PrefixTable__get_exact (const struct PrefixTable__family *f, uint64_t hi, uint64_t lo, int prefix)
+{
+    ASSERT(prefix >= 0)
+    ASSERT(prefix <= f->key_bits)
+    
+    const struct PrefixTable__tnode *t = f->troot;
+    for (int i = 0; i < prefix && t; i++) {
+        t = t->child[PrefixTable__key_bit(hi, lo, i)];
+    }
+    
+    return (t ? t->value : NULL);
+}
+
+static void PrefixTable_Init (PrefixTable *o)
+{
+    PrefixTable__family_init(&o->ipv4, 32);
+    PrefixTable__family_init(&o->ipv6, 128);
+    o->count = 0;
+    o->bulk = 0;
+}
+
+static void PrefixTable_Free (PrefixTable *o)
+{
+    PrefixTable__family_free(&o->ipv6);
+    PrefixTable__family_free(&o->ipv4);
+}
+
+static int PrefixTable_Insert4 (PrefixTable *o, uint32_t addr, int prefix, void *value, void **out_existing)
+{
+    uint64_t hi, lo;
+    PrefixTable__key4(addr, &hi, &lo);
+    
+    return PrefixTable__insert(o, &o->ipv4, hi, lo, prefix, value, out_existing);
+}
+
+static int PrefixTable_Insert6 (PrefixTable *o, struct ipv6_addr addr, int prefix, void *value, void **out_existing)
+{
+    uint64_t hi, lo;
+    PrefixTable__key6(&addr, &hi, &lo);
+    
+    return PrefixTable__insert(o, &o->ipv6, hi, lo, prefix, value, out_existing);
+}
+
+static int PrefixTable_Remove4 (PrefixTable *o, uint32_t addr, int prefix)
+{
+    uint64_t hi, lo;
+    PrefixTable__key4(addr, &hi, &lo);
+    
+    return PrefixTable__remove(o, &o->ipv4, hi, lo, prefix);
+}
+
+static int PrefixTable_Remove6 (PrefixTable *o, struct ipv6_addr addr, int prefix)
+{
+    uint64_t hi, lo;
+    PrefixTable__key6(&addr, &hi, &lo);
+    
+    return PrefixTable__remove(o, &o->ipv6, hi, lo, prefix);
+}
+
+static void * PrefixTable_GetExact4 (const PrefixTable *o, uint32_t addr, int prefix)
+{
+    uint64_t hi, lo;
+    PrefixTable__key4(addr, &hi, &lo);
+    
+    return PrefixTable__get_exact(&o->ipv4, hi, lo, prefix);
+}
+
+static void * PrefixTable_GetExact6 (const PrefixTable *o, struct ipv6_addr addr, int prefix)
+{
+    uint64_t hi, lo;
+    PrefixTable__key6(&addr, &hi, &lo);
+    
+    return PrefixTable__get_exact(&o->ipv6, hi, lo, prefix);
+}
+
+static void * PrefixTable_Lookup4 (const PrefixTable *o, uint32_t addr)
+{
+    ASSERT(!o->bulk)
+    
+    return PrefixTable__lookup(&o->ipv4, (uint64_t)ntoh32(addr) << 32, 0);
+}
+
+static void * PrefixTable_Lookup6 (const PrefixTable *o, const struct ipv6_addr *addr)
+{
+    ASSERT(!o->bulk)
+    
+    uint64_t hi, lo;
+    PrefixTable__key6(addr, &hi, &lo);
+    
+    return PrefixTable__lookup(&o->ipv6, hi, lo);
+}
+
+static void * PrefixTable_LookupIPAddr (const PrefixTable *o, const BIPAddr *addr)
+{
+    ASSERT(!o->bulk)
+    
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4:
+            return PrefixTable_Lookup4(o, addr->ipv4);
+        case BADDR_TYPE_IPV6: {
+            struct ipv6_addr a;
+            memcpy(a.bytes, addr->ipv6, 16);
+            return PrefixTable_Lookup6(o, &a);
+        }
+        default:
+            return NULL;
+    }
+}
+
+static size_t PrefixTable_Count (const PrefixTable *o)
+{
+    return o->count;
+}
+
+static void PrefixTable_BeginBulk (PrefixTable *o)
+{
+    ASSERT(!o->bulk)
+    
+    o->bulk = 1;
+}
+
+static int PrefixTable_EndBulk (PrefixTable *o)
+{
+    ASSERT(o->bulk)
+    
+    struct PrefixTable__family *families[2] = {&o->ipv4, &o->ipv6};
+    struct PrefixTable__node new_roots[2];
+    
+    for (int i = 0; i < 2; i++) {
+        struct PrefixTable__family *f = families[i];
+        void *best = (f->troot ? f->troot->value : NULL);
+        if (!PrefixTable__build(&new_roots[i], f->troot, best, 0, f->key_bits)) {
+            if (i > 0) {
+                PrefixTable__free_node(&new_roots[0]);
+            }
+            return 0;
+        }
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        PrefixTable__free_node(&families[i]->root);
+        families[i]->root = new_roots[i];
+    }
+    
+    o->bulk = 0;
+    return 1;
+}
+
+#endif
@@ -33,10 +33,13 @@ typedef struct {
     VectorElem *elems;
     size_t capacity;
     size_t count;
+    VectorElem *inline_elems;
 } Vector;
 
 static int Vector_Init (Vector *o, size_t capacity) WARN_UNUSED;
+static void Vector_InitBuf (Vector *o, VectorElem *elems, size_t capacity);
 static void Vector_Free (Vector *o);
+static void Vector_Clear (Vector *o);
 static size_t Vector_Count (Vector *o);
 static VectorElem * Vector_Get (Vector *o, size_t index);
 static int Vector_Reserve (Vector *o, size_t capacity) WARN_UNUSED;
@@ -33,7 +33,9 @@
 #undef Vector
 #undef VectorElem
 #undef Vector_Init
+#undef Vector_InitBuf
 #undef Vector_Free
+#undef Vector_Clear
 #undef Vector_Count
 #undef Vector_Get
 #undef Vector_Reserve
@@ -34,7 +34,9 @@
 #define Vector VECTOR_NAME
 #define VectorElem VECTOR_ELEM_TYPE
 #define Vector_Init MERGE(VECTOR_NAME, _Init)
+#define Vector_InitBuf MERGE(VECTOR_NAME, _InitBuf)
 #define Vector_Free MERGE(VECTOR_NAME, _Free)
+#define Vector_Clear MERGE(VECTOR_NAME, _Clear)
 #define Vector_Count MERGE(VECTOR_NAME, _Count)
 #define Vector_Get MERGE(VECTOR_NAME, _Get)
 #define Vector_Reserve MERGE(VECTOR_NAME, _Reserve)
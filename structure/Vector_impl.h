@@ -41,12 +41,31 @@ static int Vector_Init (Vector *o, size_t capacity)
     }
     o->capacity = capacity;
     o->count = 0;
+    o->inline_elems = NULL;
     return 1;
 }
 
+static void Vector_InitBuf (Vector *o, VectorElem *elems, size_t capacity)
+{
+    ASSERT(elems)
+    ASSERT(capacity > 0)
+    
+    o->elems = elems;
+    o->capacity = capacity;
+    o->count = 0;
+    o->inline_elems = elems;
+}
+
 static void Vector_Free (Vector *o)
 {
-    BFree(o->elems);
+    if (o->elems != o->inline_elems) {
+        BFree(o->elems);
+    }
+}
+
+static void Vector_Clear (Vector *o)
+{
+    o->count = 0;
 }
 
 static size_t Vector_Count (Vector *o)
@@ -81,7 +100,9 @@ static int Vector_Reserve (Vector *o, size_t capacity)
             memcpy(new_elems, o->elems, o->count * sizeof(VectorElem));
         }
         
-        BFree(o->elems);
+        if (o->elems != o->inline_elems) {
+            BFree(o->elems);
+        }
         
         o->elems = new_elems;
         o->capacity = new_capacity;
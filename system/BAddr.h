@@ -281,6 +281,15 @@ static int BAddr_Compare (BAddr *addr1, BAddr *addr2);
 
 static int BAddr_CompareOrder (BAddr *addr1, BAddr *addr2);
 
+/**
+ * Computes a hash of an address for use in hash tables.
+ * Addresses equal according to {@link BAddr_Compare} have equal hashes.
+ * 
+ * @param addr the address
+ * @return hash value
+ */
+static size_t BAddr_Hash (BAddr *addr);
+
 void BIPAddr_InitInvalid (BIPAddr *addr)
 {
     addr->type = BADDR_TYPE_NONE;
@@ -807,6 +816,36 @@ int BAddr_CompareOrder (BAddr *addr1, BAddr *addr2)
     }
 }
 
+static uint64_t BAddr__hash_mix (uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * UINT64_C(0x9E3779B97F4A7C15);
+    return h ^ (h >> 32);
+}
+
+size_t BAddr_Hash (BAddr *addr)
+{
+    BAddr_Assert(addr);
+    
+    uint64_t h = addr->type;
+    
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4: {
+            h = BAddr__hash_mix(h, ((uint64_t)addr->ipv4.ip << 16) | addr->ipv4.port);
+        } break;
+        case BADDR_TYPE_IPV6: {
+            uint64_t ip_hi;
+            uint64_t ip_lo;
+            memcpy(&ip_hi, addr->ipv6.ip, 8);
+            memcpy(&ip_lo, addr->ipv6.ip + 8, 8);
+            h = BAddr__hash_mix(h, ip_hi);
+            h = BAddr__hash_mix(h, ip_lo);
+            h = BAddr__hash_mix(h, addr->ipv6.port);
+        } break;
+    }
+    
+    return h;
+}
+
 void BIPAddr_InitLocalhost (BIPAddr *addr, int addr_type)
 {
     if (addr_type == BADDR_TYPE_IPV4) {
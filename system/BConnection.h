@@ -51,17 +51,25 @@ int BConnection_AddressSupported (BAddr addr);
 
 #define BLISCON_FROM_ADDR 1
 #define BLISCON_FROM_UNIX 2
+#define BLISCON_FROM_FD 3
 
 struct BLisCon_from {
     int type;
     union {
         struct {
             BAddr addr;
+            int reuse_port;
+            int reuse_port_steer_cpus;
+            int fast_open;
         } from_addr;
 #ifndef BADVPN_USE_WINAPI
         struct {
             char const *socket_path;
         } from_unix;
+        struct {
+            int fd;
+            char const *socket_path;
+        } from_fd;
 #endif
     } u;
 };
@@ -71,6 +79,64 @@ static struct BLisCon_from BLisCon_from_addr (BAddr addr)
     struct BLisCon_from res;
     res.type = BLISCON_FROM_ADDR;
     res.u.from_addr.addr = addr;
+    res.u.from_addr.reuse_port = 0;
+    res.u.from_addr.reuse_port_steer_cpus = 0;
+    res.u.from_addr.fast_open = 0;
+    return res;
+}
+
+/**
+ * Like {@link BLisCon_from_addr}, but for a listener, also sets SO_REUSEPORT
+ * so that several listeners (e.g. in different processes) can share the
+ * address, with the kernel spreading incoming connections among them.
+ * Not supported on Windows.
+ */
+static struct BLisCon_from BLisCon_from_addr_reuseport (BAddr addr)
+{
+    struct BLisCon_from res = BLisCon_from_addr(addr);
+    res.u.from_addr.reuse_port = 1;
+    return res;
+}
+
+/**
+ * Like {@link BLisCon_from_addr_reuseport}, but also attaches a steering
+ * program (SO_ATTACH_REUSEPORT_CBPF) to the group of listeners sharing the
+ * address, so that a connection goes to the listener with index
+ * (CPU which received the SYN) % num_listeners. A listener's index is its
+ * position in the order the listeners were bound. The program applies to the
+ * whole group, so all listeners should be created with the same
+ * num_listeners. Combined with one reactor per CPU, a connection is then
+ * handled on the CPU that processed its packets.
+ * Only supported on Linux; where it isn't available, a warning is logged and
+ * the kernel spreads connections by hash.
+ * 
+ * @param addr address to listen on
+ * @param num_listeners number of listeners in the group. Must be >0.
+ */
+static struct BLisCon_from BLisCon_from_addr_reuseport_cpu (BAddr addr, int num_listeners)
+{
+    ASSERT(num_listeners > 0)
+    
+    struct BLisCon_from res = BLisCon_from_addr_reuseport(addr);
+    res.u.from_addr.reuse_port_steer_cpus = num_listeners;
+    return res;
+}
+
+/**
+ * Like {@link BLisCon_from_addr}, but also enables TCP Fast Open.
+ * For a connector, connecting is deferred (TCP_FASTOPEN_CONNECT) when the
+ * kernel has a cookie for the server, so that the connector reports success
+ * right away and the first send goes out with the SYN. For a listener, data
+ * in the SYN of incoming connections is accepted (TCP_FASTOPEN).
+ * Only effective on Linux; where it isn't available, a warning is logged and
+ * the usual handshake is done.
+ * Use {@link BConnection_FastOpenAccepted} to find out whether the server
+ * took the data.
+ */
+static struct BLisCon_from BLisCon_from_addr_fastopen (BAddr addr)
+{
+    struct BLisCon_from res = BLisCon_from_addr(addr);
+    res.u.from_addr.fast_open = 1;
     return res;
 }
 
@@ -82,6 +148,27 @@ static struct BLisCon_from BLisCon_from_unix (char const *socket_path)
     res.u.from_unix.socket_path = socket_path;
     return res;
 }
+
+/**
+ * For a listener only, adopts a stream socket which is already bound and
+ * listening, for example one received from another process
+ * (see {@link BListenerHandoff_Receive}). The listener owns the socket and
+ * closes it when freed, also if initialization fails.
+ * 
+ * @param fd the listening socket
+ * @param socket_path if not NULL, the path a Unix socket is bound to, which
+ *                    is removed when the listener is freed
+ */
+static struct BLisCon_from BLisCon_from_fd (int fd, char const *socket_path)
+{
+    ASSERT(fd >= 0)
+    
+    struct BLisCon_from res;
+    res.type = BLISCON_FROM_FD;
+    res.u.from_fd.fd = fd;
+    res.u.from_fd.socket_path = socket_path;
+    return res;
+}
 #endif
 
 
@@ -91,6 +178,9 @@ struct BListener_s;
  * Object which listens for connections on an address.
  * When a connection is ready, the {@link BListener_handler} handler is called, from which
  * the connection can be accepted into a new {@link BConnection} object.
+ * On Unix-like systems, after a connection is accepted, the listener goes on to offer the next one from a job,
+ * up to BCONNECTION_ACCEPT_BATCH connections per readiness event, so a burst of connections
+ * is drained without waiting for the reactor to poll again.
  */
 typedef struct BListener_s BListener;
 
@@ -151,6 +241,37 @@ int BListener_InitUnix (BListener *o, const char *socket_path, BReactor *reactor
  */
 void BListener_Free (BListener *o);
 
+/**
+ * Determines the number of connections waiting in the accept queue of a
+ * TCP listener, and the limit of the queue (the listen backlog).
+ * Only supported on Linux.
+ * 
+ * @param o the object
+ * @param out_len returns the number of queued connections
+ * @param out_max returns the queue limit
+ * @return 1 on success, 0 on failure or if not supported
+ */
+int BListener_GetQueueLength (BListener *o, int *out_len, int *out_max);
+
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Returns the listening socket, e.g. for passing it to another process with
+ * {@link BListenerHandoff_Send}. The socket remains owned by the listener.
+ * 
+ * @param o the object
+ * @return the socket file descriptor
+ */
+int BListener_GetFd (BListener *o);
+
+/**
+ * Makes {@link BListener_Free} leave the file of a Unix socket listener in
+ * place, for when another process has taken over the socket.
+ * 
+ * @param o the object
+ */
+void BListener_KeepSocketFile (BListener *o);
+#endif
+
 
 
 struct BConnector_s;
@@ -338,6 +459,21 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
  */
 void BConnection_Free (BConnection *o);
 
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Frees the object without closing its file descriptor, and returns the
+ * file descriptor. This allows moving the connection to another reactor,
+ * where it can be initialized again with a BCONNECTION_SOURCE_PIPE 'source'
+ * argument.
+ * The send and receive interfaces must not be initialized.
+ * 
+ * @param o the object
+ * @return file descriptor of the connection, now owned by the caller
+ *         if the connection owned it
+ */
+int BConnection_ReleaseFd (BConnection *o);
+#endif
+
 /**
  * Updates the handler function.
  * 
@@ -359,6 +495,28 @@ void BConnection_SetHandlers (BConnection *o, void *user, BConnection_handler ha
  */
 int BConnection_SetSendBuffer (BConnection *o, int buf_size);
 
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Sets up zero-copy sending (MSG_ZEROCOPY) for large sends.
+ * 
+ * Sends of at least threshold bytes are passed to the kernel without copying.
+ * The send interface then reports them done only when the kernel has
+ * signalled through the socket error queue that it no longer needs the data.
+ * Smaller sends, and sends the kernel can't pin memory for, are done normally.
+ * If the kernel reports that it had to copy the data anyway (e.g. on loopback),
+ * zero-copy is disabled for the connection.
+ * 
+ * Only supported on Linux, for TCP sockets. May not be called while a send
+ * is in progress.
+ * 
+ * @param o the object
+ * @param threshold minimum send size for zero-copy, or 0 to disable.
+ *                  Must be >=0.
+ * @return 1 on success, 0 on failure (zero-copy is not supported)
+ */
+int BConnection_SetZeroCopy (BConnection *o, int threshold) WARN_UNUSED;
+#endif
+
 /**
  * Determines the local address.
  * 
@@ -372,6 +530,28 @@ int BConnection_SetSendBuffer (BConnection *o, int buf_size);
  */
 int BConnection_GetLocalAddress (BConnection *o, BAddr *local_addr);
 
+/**
+ * Determines whether data sent in the SYN with TCP Fast Open was acknowledged
+ * by the server (see {@link BLisCon_from_addr_fastopen}).
+ * The answer is only final once something has been received from the server.
+ * 
+ * @param o the object
+ * @return 1 if the SYN data was accepted, 0 if not, or not known
+ */
+int BConnection_FastOpenAccepted (BConnection *o);
+
+/**
+ * Determines how long an accepted TCP connection waited in the accept queue,
+ * i.e. the time since the last ACK of the handshake was received, in
+ * milliseconds. Only meaningful right after the connection was accepted
+ * and before anything was received on it. Only supported on Linux.
+ * 
+ * @param o the object
+ * @param out_ms returns the time in milliseconds
+ * @return 1 on success, 0 on failure or if not supported
+ */
+int BConnection_GetAcceptDelay (BConnection *o, int *out_ms);
+
 /**
  * Initializes the send interface for the connection.
  * The send interface must not be initialized.
@@ -0,0 +1,328 @@
+/**
+ * @file BConnectionPipe.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include <base/BLog.h>
+
+#include "BConnectionPipe.h"
+
+#include <generated/blog_channel_BConnectionPipe.h>
+
+static int dir_init (struct BConnectionPipe_dir *d, int src, int dst)
+{
+    int pipefds[2];
+    if (pipe2(pipefds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        BLog(BLOG_ERROR, "pipe2 failed");
+        return 0;
+    }
+    
+    // a bigger pipe means fewer splice calls; keep the default if not allowed
+    fcntl(pipefds[1], F_SETPIPE_SZ, BCONNECTIONPIPE_PIPE_SIZE);
+    int size = fcntl(pipefds[1], F_GETPIPE_SZ);
+    
+    d->src = src;
+    d->dst = dst;
+    d->pipe_r = pipefds[0];
+    d->pipe_w = pipefds[1];
+    d->pipe_size = (size > 0 ? size : 65536);
+    d->in_pipe = 0;
+    d->src_eof = 0;
+    d->done = 0;
+    d->bytes = 0;
+    
+    return 1;
+}
+
+static void dir_free (struct BConnectionPipe_dir *d)
+{
+    if (close(d->pipe_r) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    if (close(d->pipe_w) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+}
+
+static int dir_process (BConnectionPipe *o, struct BConnectionPipe_dir *d)
+{
+    ASSERT(!d->done)
+    
+    int moved = 0;
+    
+    while (moved < BCONNECTIONPIPE_MAX_PER_EVENT) {
+        int progress = 0;
+        
+        // move from the source socket into the pipe
+        if (!d->src_eof && d->in_pipe < d->pipe_size) {
+            ssize_t res = splice(o->fds[d->src], NULL, d->pipe_w, NULL, d->pipe_size - d->in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (res < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    BLog(BLOG_INFO, "splice from socket failed (%d)", errno);
+                    return 0;
+                }
+            }
+            else if (res == 0) {
+                d->src_eof = 1;
+            }
+            else {
+                d->in_pipe += res;
+                progress = 1;
+            }
+        }
+        
+        // move from the pipe into the destination socket
+        if (d->in_pipe > 0) {
+            ssize_t res = splice(d->pipe_r, NULL, o->fds[d->dst], NULL, d->in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (res < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    BLog(BLOG_INFO, "splice to socket failed (%d)", errno);
+                    return 0;
+                }
+            }
+            else {
+                ASSERT(res <= d->in_pipe)
+                d->in_pipe -= res;
+                d->bytes += res;
+                moved += res;
+                progress = (res > 0 || progress);
+            }
+        }
+        
+        if (!progress) {
+            break;
+        }
+    }
+    
+    // forward end of stream once everything was delivered
+    if (d->src_eof && d->in_pipe == 0) {
+        if (shutdown(o->fds[d->dst], SHUT_WR) < 0) {
+            BLog(BLOG_INFO, "shutdown failed (%d)", errno);
+            return 0;
+        }
+        d->done = 1;
+        o->num_done++;
+    }
+    
+    return 1;
+}
+
+static void update_events (BConnectionPipe *o)
+{
+    int events[2] = {0, 0};
+    
+    for (int i = 0; i < o->num_dirs; i++) {
+        struct BConnectionPipe_dir *d = &o->dirs[i];
+        if (d->done) {
+            continue;
+        }
+        if (!d->src_eof && d->in_pipe < d->pipe_size) {
+            events[d->src] |= BREACTOR_READ;
+        }
+        if (d->in_pipe > 0) {
+            events[d->dst] |= BREACTOR_WRITE;
+        }
+    }
+    
+    for (int i = 0; i < o->num_fds; i++) {
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfds[i], events[i]);
+    }
+}
+
+static void fd_handler (BConnectionPipe *o, int fd_index, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    
+    for (int i = 0; i < o->num_dirs; i++) {
+        struct BConnectionPipe_dir *d = &o->dirs[i];
+        if (d->done) {
+            continue;
+        }
+        
+        // only work on directions this event can unblock
+        int relevant = (events & (BREACTOR_ERROR | BREACTOR_HUP)) ||
+                       (d->src == fd_index && (events & BREACTOR_READ)) ||
+                       (d->dst == fd_index && (events & BREACTOR_WRITE));
+        if (!relevant) {
+            continue;
+        }
+        
+        if (!dir_process(o, d)) {
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfds[0], 0);
+            if (o->num_fds > 1) {
+                BReactor_SetFileDescriptorEvents(o->reactor, &o->bfds[1], 0);
+            }
+            
+            DEBUGERROR(&o->d_err, o->handler(o->user, BCONNECTIONPIPE_EVENT_ERROR));
+            return;
+        }
+    }
+    
+    update_events(o);
+    
+    if (o->num_done == o->num_dirs) {
+        DEBUGERROR(&o->d_err, o->handler(o->user, BCONNECTIONPIPE_EVENT_FINISHED));
+        return;
+    }
+}
+
+static void fd0_handler (BConnectionPipe *o, int events)
+{
+    fd_handler(o, 0, events);
+}
+
+static void fd1_handler (BConnectionPipe *o, int events)
+{
+    fd_handler(o, 1, events);
+}
+
+static int is_stream_socket (int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+        return 0;
+    }
+    
+    int type;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0) {
+        return 0;
+    }
+    
+    return (type == SOCK_STREAM);
+}
+
+int BConnectionPipe_Init (BConnectionPipe *o, BReactor *reactor, int fd1, int fd2, BConnectionPipe_handler handler, void *user)
+{
+    ASSERT(fd1 >= 0)
+    ASSERT(fd2 >= 0)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->handler = handler;
+    o->user = user;
+    
+    // check sockets
+    if (!is_stream_socket(fd1) || !is_stream_socket(fd2)) {
+        BLog(BLOG_ERROR, "not stream sockets");
+        goto fail0;
+    }
+    
+    // set fds
+    o->fds[0] = fd1;
+    o->fds[1] = fd2;
+    o->num_fds = (fd1 == fd2 ? 1 : 2);
+    
+    // init directions
+    o->num_dirs = 0;
+    if (!dir_init(&o->dirs[0], 0, o->num_fds - 1)) {
+        goto fail0;
+    }
+    o->num_dirs++;
+    if (o->num_fds > 1) {
+        if (!dir_init(&o->dirs[1], 1, 0)) {
+            goto fail1;
+        }
+        o->num_dirs++;
+    }
+    o->num_done = 0;
+    
+    // init file descriptor objects
+    BFileDescriptor_Init(&o->bfds[0], o->fds[0], (BFileDescriptor_handler)fd0_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfds[0])) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail1;
+    }
+    if (o->num_fds > 1) {
+        BFileDescriptor_Init(&o->bfds[1], o->fds[1], (BFileDescriptor_handler)fd1_handler, o);
+        if (!BReactor_AddFileDescriptor(o->reactor, &o->bfds[1])) {
+            BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+            goto fail2;
+        }
+    }
+    
+    // wait for data from both sides
+    update_events(o);
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail2:
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfds[0]);
+fail1:
+    while (o->num_dirs > 0) {
+        dir_free(&o->dirs[--o->num_dirs]);
+    }
+fail0:
+    return 0;
+}
+
+void BConnectionPipe_Free (BConnectionPipe *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free file descriptor objects
+    for (int i = 0; i < o->num_fds; i++) {
+        BReactor_RemoveFileDescriptor(o->reactor, &o->bfds[i]);
+    }
+    
+    // free directions
+    for (int i = 0; i < o->num_dirs; i++) {
+        dir_free(&o->dirs[i]);
+    }
+    
+    // close sockets
+    for (int i = 0; i < o->num_fds; i++) {
+        if (close(o->fds[i]) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+    }
+}
+
+uint64_t BConnectionPipe_GetBytes (BConnectionPipe *o, int dir)
+{
+    ASSERT(dir >= 0)
+    ASSERT(dir < o->num_dirs)
+    DebugObject_Access(&o->d_obj);
+    
+    return o->dirs[dir].bytes;
+}
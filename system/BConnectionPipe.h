@@ -0,0 +1,126 @@
+/**
+ * @file BConnectionPipe.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Kernel-side relay between two stream sockets, using splice() through a
+ * pipe per direction so that relayed data is never copied to user space.
+ */
+
+#ifndef BADVPN_SYSTEM_BCONNECTIONPIPE_H
+#define BADVPN_SYSTEM_BCONNECTIONPIPE_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+
+#define BCONNECTIONPIPE_EVENT_FINISHED 1
+#define BCONNECTIONPIPE_EVENT_ERROR 2
+
+#define BCONNECTIONPIPE_PIPE_SIZE (256 * 1024)
+#define BCONNECTIONPIPE_MAX_PER_EVENT (1024 * 1024)
+
+/**
+ * Handler function called when the relay is finished or failed.
+ * The object must be freed from within this handler.
+ * 
+ * @param user as in {@link BConnectionPipe_Init}
+ * @param event BCONNECTIONPIPE_EVENT_FINISHED if both directions have seen
+ *              end of stream and all data was delivered (write ends were
+ *              shut down in turn), or BCONNECTIONPIPE_EVENT_ERROR if a socket
+ *              or the pipe failed
+ */
+typedef void (*BConnectionPipe_handler) (void *user, int event);
+
+struct BConnectionPipe_dir {
+    int src;
+    int dst;
+    int pipe_r;
+    int pipe_w;
+    int pipe_size;
+    int in_pipe;
+    int src_eof;
+    int done;
+    uint64_t bytes;
+};
+
+typedef struct {
+    BReactor *reactor;
+    BConnectionPipe_handler handler;
+    void *user;
+    int fds[2];
+    int num_fds;
+    BFileDescriptor bfds[2];
+    struct BConnectionPipe_dir dirs[2];
+    int num_dirs;
+    int num_done;
+    DebugError d_err;
+    DebugObject d_obj;
+} BConnectionPipe;
+
+/**
+ * Initializes the relay. Data received from fd1 is sent to fd2 and data
+ * received from fd2 is sent to fd1, with end of stream forwarded as
+ * shutdown(SHUT_WR). If fd1 and fd2 are the same, data received from the
+ * socket is sent back to it.
+ * Both file descriptors must be connected, non-blocking stream sockets, e.g.
+ * obtained from {@link BConnection_ReleaseFd}. On success, the relay takes
+ * ownership of them; on failure, they remain owned by the caller, who can
+ * fall back to relaying in user space.
+ * SIGPIPE must be ignored, see {@link BNetwork_GlobalInit}.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param fd1 first socket
+ * @param fd2 second socket, or fd1 to echo
+ * @param handler handler called when the relay is finished or failed
+ * @param user argument to handler
+ * @return 1 on success, 0 on failure
+ */
+int BConnectionPipe_Init (BConnectionPipe *o, BReactor *reactor, int fd1, int fd2, BConnectionPipe_handler handler, void *user) WARN_UNUSED;
+
+/**
+ * Frees the relay, closing both sockets and the pipes.
+ * 
+ * @param o the object
+ */
+void BConnectionPipe_Free (BConnectionPipe *o);
+
+/**
+ * Returns the number of bytes delivered in a direction so far.
+ * 
+ * @param o the object
+ * @param dir 0 for fd1 to fd2, 1 for fd2 to fd1. Must be 0 when echoing.
+ * @return number of bytes written to the destination socket
+ */
+uint64_t BConnectionPipe_GetBytes (BConnectionPipe *o, int dir);
+
+#endif
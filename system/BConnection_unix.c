@@ -27,16 +27,29 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef BADVPN_LINUX
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#endif
 
 #include <misc/nonblocking.h>
 #include <misc/strdup.h>
+#include <misc/usdt.h>
 #include <base/BLog.h>
 
 #include "BConnection.h"
@@ -45,9 +58,31 @@
 
 #define MAX_UNIX_SOCKET_PATH 200
 
+#ifdef BADVPN_LINUX
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef TCPI_OPT_SYN_DATA
+#define TCPI_OPT_SYN_DATA 32
+#endif
+#endif
+
 #define SEND_STATE_NOT_INITED 0
 #define SEND_STATE_READY 1
 #define SEND_STATE_BUSY 2
+#define SEND_STATE_ZC_WAIT 3
 
 #define RECV_STATE_NOT_INITED 0
 #define RECV_STATE_READY 1
@@ -75,8 +110,11 @@ struct unix_addr {
 static int build_unix_address (struct unix_addr *out, const char *socket_path);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
+static void listener_accept (BListener *o);
 static void listener_fd_handler (BListener *o, int events);
 static void listener_default_job_handler (BListener *o);
+static void listener_next_job_handler (BListener *o);
+static int listener_steer_cpus (BListener *o, int num_listeners);
 static void connector_fd_handler (BConnector *o, int events);
 static void connector_job_handler (BConnector *o);
 static void connection_report_error (BConnection *o);
@@ -147,9 +185,41 @@ static void addr_sys_to_socket (BAddr *out, struct sys_addr addr)
     }
 }
 
-static void listener_fd_handler (BListener *o, int events)
+static void listener_accept (BListener *o)
 {
-    DebugObject_Access(&o->d_obj);
+    ASSERT(o->accepted_fd < 0)
+    ASSERT(!BPending_IsSet(&o->default_job))
+    
+    // accept
+    struct sys_addr sysaddr;
+    sysaddr.len = sizeof(sysaddr.addr);
+#ifdef BADVPN_LINUX
+    int newfd = accept4(o->fd, &sysaddr.addr.generic, &sysaddr.len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int newfd = accept(o->fd, &sysaddr.addr.generic, &sysaddr.len);
+#endif
+    if (newfd < 0) {
+        // the queue is empty, or the connection went away while queued
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+            BLog(BLOG_ERROR, "accept failed");
+        }
+        return;
+    }
+    
+#ifndef BADVPN_LINUX
+    // set non-blocking
+    if (!badvpn_set_nonblocking(newfd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        if (close(newfd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+        return;
+    }
+#endif
+    
+    // remember connection
+    o->accepted_fd = newfd;
+    addr_sys_to_socket(&o->accepted_addr, sysaddr);
     
     // set default job
     BPending_Set(&o->default_job);
@@ -159,23 +229,71 @@ static void listener_fd_handler (BListener *o, int events)
     return;
 }
 
-static void listener_default_job_handler (BListener *o)
+static void listener_fd_handler (BListener *o, int events)
 {
     DebugObject_Access(&o->d_obj);
     
-    BLog(BLOG_ERROR, "discarding connection");
-    
-    // accept
-    int newfd = accept(o->fd, NULL, NULL);
-    if (newfd < 0) {
-        BLog(BLOG_ERROR, "accept failed");
+    // With a job budget the fd can be reported while an accepted connection
+    // or the rest of a batch is still pending. Leave it to the jobs; the fd
+    // is reported again while connections are queued.
+    if (BPending_IsSet(&o->default_job) || BPending_IsSet(&o->next_job)) {
         return;
     }
     
+    // start a new batch
+    o->accept_batch_left = BCONNECTION_ACCEPT_BATCH;
+    
+    listener_accept(o);
+    return;
+}
+
+static void listener_default_job_handler (BListener *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->accepted_fd >= 0)
+    
+    BLog(BLOG_ERROR, "discarding connection");
+    
     // close new fd
-    if (close(newfd) < 0) {
+    if (close(o->accepted_fd) < 0) {
         BLog(BLOG_ERROR, "close failed");
     }
+    o->accepted_fd = -1;
+}
+
+static void listener_next_job_handler (BListener *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->accepted_fd < 0)
+    ASSERT(o->accept_batch_left > 0)
+    
+    listener_accept(o);
+    return;
+}
+
+static int listener_steer_cpus (BListener *o, int num_listeners)
+{
+    ASSERT(num_listeners > 0)
+    
+#if defined(BADVPN_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    // return (CPU % num_listeners) as the index of the socket in the group
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_listeners},
+        {BPF_RET | BPF_A, 0, 0, 0}
+    };
+    struct sock_fprog prog = {sizeof(code) / sizeof(code[0]), code};
+    
+    if (setsockopt(o->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        BLog(BLOG_WARNING, "setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed");
+        return 0;
+    }
+    
+    return 1;
+#else
+    BLog(BLOG_WARNING, "reuseport CPU steering not supported");
+    return 0;
+#endif
 }
 
 static void connector_fd_handler (BConnector *o, int events)
@@ -236,6 +354,110 @@ static void connection_report_error (BConnection *o)
     return;
 }
 
+static int connection_write (BConnection *o, int *out_zerocopy)
+{
+    *out_zerocopy = 0;
+    
+    #ifdef BADVPN_LINUX
+    int use_zerocopy = (o->send.zc_threshold > 0 && o->send.busy_data_len >= o->send.zc_threshold);
+    #else
+    int use_zerocopy = 0;
+    #endif
+    
+    if (o->send.busy_vec_count == 0 && !use_zerocopy) {
+        return write(o->fd, o->send.busy_data, o->send.busy_data_len);
+    }
+    
+    struct iovec iov[STREAMPASSINTERFACE_MAX_VEC];
+    int iov_count;
+    if (o->send.busy_vec_count > 0) {
+        for (int i = 0; i < o->send.busy_vec_count; i++) {
+            iov[i].iov_base = o->send.busy_vec[i].data;
+            iov[i].iov_len = o->send.busy_vec[i].len;
+        }
+        iov_count = o->send.busy_vec_count;
+    } else {
+        iov[0].iov_base = (uint8_t *)o->send.busy_data;
+        iov[0].iov_len = o->send.busy_data_len;
+        iov_count = 1;
+    }
+    
+    #ifdef BADVPN_LINUX
+    if (use_zerocopy) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        
+        int bytes = sendmsg(o->fd, &msg, MSG_ZEROCOPY);
+        if (bytes > 0) {
+            *out_zerocopy = 1;
+            return bytes;
+        }
+        
+        // out of memory for pinning pages, send this one normally
+        if (!(bytes < 0 && errno == ENOBUFS)) {
+            return bytes;
+        }
+    }
+    #endif
+    
+    return writev(o->fd, iov, iov_count);
+}
+
+#ifdef BADVPN_LINUX
+
+static void connection_zc_read_completions (BConnection *o, int *out_done, int *out_have_notif)
+{
+    ASSERT(o->send.zc_sockopt)
+    
+    *out_done = 0;
+    *out_have_notif = 0;
+    
+    while (1) {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        if (recvmsg(o->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                BLog(BLOG_ERROR, "recvmsg(MSG_ERRQUEUE) failed");
+            }
+            return;
+        }
+        
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr.ee_errno != 0) {
+                continue;
+            }
+            
+            *out_have_notif = 1;
+            
+            // notification covers sends ee_info to ee_data inclusive
+            if (o->send.state == SEND_STATE_ZC_WAIT && (int32_t)(serr.ee_data - o->send.zc_wait_seq) >= 0) {
+                *out_done = 1;
+            }
+            
+            // the kernel had to copy after all, which is slower than a plain send
+            if ((serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && o->send.zc_threshold > 0) {
+                BLog(BLOG_INFO, "zero-copy send fell back to copying, disabling");
+                o->send.zc_threshold = 0;
+            }
+        }
+    }
+}
+
+#endif
+
 static void connection_send (BConnection *o)
 {
     DebugError_AssertNoError(&o->d_err);
@@ -252,10 +474,12 @@ static void connection_send (BConnection *o)
     }
     
     // send
-    int bytes = write(o->fd, o->send.busy_data, o->send.busy_data_len);
+    int zerocopy;
+    int bytes = connection_write(o, &zerocopy);
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_WRITE);
             o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -269,6 +493,18 @@ static void connection_send (BConnection *o)
     ASSERT(bytes > 0)
     ASSERT(bytes <= o->send.busy_data_len)
     
+    BTRACE2(bconnection_send, o, bytes);
+    
+    #ifdef BADVPN_LINUX
+    // the kernel still references the data; finish once it tells us it's done
+    if (zerocopy) {
+        o->send.zc_wait_seq = o->send.zc_next_seq++;
+        o->send.zc_wait_bytes = bytes;
+        o->send.state = SEND_STATE_ZC_WAIT;
+        return;
+    }
+    #endif
+    
     // set ready
     o->send.state = SEND_STATE_READY;
     
@@ -296,6 +532,7 @@ static void connection_recv (BConnection *o)
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_READ);
             o->wait_events |= BREACTOR_READ;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -318,6 +555,8 @@ static void connection_recv (BConnection *o)
     ASSERT(bytes > 0)
     ASSERT(bytes <= o->recv.busy_data_avail)
     
+    BTRACE2(bconnection_recv, o, bytes);
+    
     // set not busy
     o->recv.state = RECV_STATE_READY;
     
@@ -338,6 +577,40 @@ static void connection_fd_handler (BConnection *o, int events)
     int have_send = 0;
     int have_recv = 0;
     
+    #ifdef BADVPN_LINUX
+    // zero-copy completions are reported as error events; there may also be
+    // stale ones if the send interface was freed while waiting for one
+    if (o->send.zc_sockopt && (events & (BREACTOR_ERROR|BREACTOR_HUP))) {
+        int done;
+        int have_notif;
+        connection_zc_read_completions(o, &done, &have_notif);
+        
+        if (have_notif) {
+            events &= ~BREACTOR_ERROR;
+        }
+        
+        if (done) {
+            // set ready
+            o->send.state = SEND_STATE_READY;
+            
+            // done
+            StreamPassInterface_Done(&o->send.iface, o->send.zc_wait_bytes);
+        }
+        else if (o->send.state == SEND_STATE_ZC_WAIT && (events & BREACTOR_HUP)) {
+            // no more events will come
+            BLog(BLOG_ERROR, "hang-up with zero-copy send in progress");
+            BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+            o->is_hupd = 1;
+            connection_report_error(o);
+            return;
+        }
+        
+        if (!events) {
+            return;
+        }
+    }
+    #endif
+    
     // if we got a HUP event, stop monitoring the file descriptor
     if ((events & BREACTOR_HUP)) {
         BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
@@ -405,6 +678,31 @@ static void connection_send_if_handler_send (BConnection *o, uint8_t *data, int
     // remember data
     o->send.busy_data = data;
     o->send.busy_data_len = data_len;
+    o->send.busy_vec_count = 0;
+    
+    // set busy
+    o->send.state = SEND_STATE_BUSY;
+    
+    connection_send(o);
+    return;
+}
+
+static void connection_send_if_handler_send_vec (BConnection *o, struct StreamPassInterface_vec *vec, int vec_count)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.state == SEND_STATE_READY)
+    ASSERT(vec_count > 0)
+    ASSERT(vec_count <= STREAMPASSINTERFACE_MAX_VEC)
+    
+    // remember data; the vector lives in the interface until we call Done
+    int total = 0;
+    for (int i = 0; i < vec_count; i++) {
+        total += vec[i].len;
+    }
+    o->send.busy_data_len = total;
+    o->send.busy_vec = vec;
+    o->send.busy_vec_count = vec_count;
     
     // set busy
     o->send.state = SEND_STATE_BUSY;
@@ -442,8 +740,9 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
                         BReactor *reactor, void *user,
                         BListener_handler handler)
 {
-    ASSERT(from.type == BLISCON_FROM_ADDR || from.type == BLISCON_FROM_UNIX)
+    ASSERT(from.type == BLISCON_FROM_ADDR || from.type == BLISCON_FROM_UNIX || from.type == BLISCON_FROM_FD)
     ASSERT(from.type != BLISCON_FROM_UNIX || from.u.from_unix.socket_path)
+    ASSERT(from.type != BLISCON_FROM_FD || from.u.from_fd.fd >= 0)
     ASSERT(handler)
     BNetwork_Assert();
     
@@ -454,10 +753,15 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
     
     // init socket path
     o->unix_socket_path = NULL;
-    if (from.type == BLISCON_FROM_UNIX) {
-        o->unix_socket_path = b_strdup(from.u.from_unix.socket_path);
+    char const *socket_path = (from.type == BLISCON_FROM_UNIX ? from.u.from_unix.socket_path :
+                               from.type == BLISCON_FROM_FD ? from.u.from_fd.socket_path : NULL);
+    if (socket_path) {
+        o->unix_socket_path = b_strdup(socket_path);
         if (!o->unix_socket_path) {
             BLog(BLOG_ERROR, "b_strdup failed");
+            if (from.type == BLISCON_FROM_FD && close(from.u.from_fd.fd) < 0) {
+                BLog(BLOG_ERROR, "close failed");
+            }
             goto fail0;
         }
     }
@@ -465,7 +769,11 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
     struct unix_addr unixaddr;
     struct sys_addr sysaddr;
     
-    if (from.type == BLISCON_FROM_UNIX) {
+    if (from.type == BLISCON_FROM_FD) {
+        // adopt the socket, which is already listening
+        o->fd = from.u.from_fd.fd;
+    }
+    else if (from.type == BLISCON_FROM_UNIX) {
         // build address
         if (!build_unix_address(&unixaddr, o->unix_socket_path)) {
             BLog(BLOG_ERROR, "build_unix_address failed");
@@ -500,6 +808,10 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
         goto fail2;
     }
     
+    if (from.type == BLISCON_FROM_FD) {
+        goto listening;
+    }
+    
     if (from.type == BLISCON_FROM_UNIX) {
         // unlink existing socket
         if (unlink(o->unix_socket_path) < 0 && errno != ENOENT) {
@@ -519,11 +831,36 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
             BLog(BLOG_ERROR, "setsockopt(SO_REUSEADDR) failed");
         }
         
+        // set SO_REUSEPORT
+        if (from.u.from_addr.reuse_port) {
+#ifdef SO_REUSEPORT
+            if (setsockopt(o->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(SO_REUSEPORT) failed");
+                goto fail2;
+            }
+#else
+            BLog(BLOG_ERROR, "SO_REUSEPORT not supported");
+            goto fail2;
+#endif
+        }
+        
         // bind
         if (bind(o->fd, &sysaddr.addr.generic, sysaddr.len) < 0) {
             BLog(BLOG_ERROR, "bind failed");
             goto fail2;
         }
+        
+        // accept data in SYN
+        if (from.u.from_addr.fast_open) {
+#ifdef TCP_FASTOPEN
+            int qlen = BCONNECTION_LISTEN_BACKLOG;
+            if (setsockopt(o->fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) {
+                BLog(BLOG_WARNING, "setsockopt(TCP_FASTOPEN) failed");
+            }
+#else
+            BLog(BLOG_WARNING, "TCP Fast Open not supported");
+#endif
+        }
     }
     
     // listen
@@ -532,6 +869,12 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
         goto fail3;
     }
     
+    // steer connections by CPU; the socket is in the reuseport group only once listening
+    if (from.type == BLISCON_FROM_ADDR && from.u.from_addr.reuse_port_steer_cpus > 0) {
+        listener_steer_cpus(o, from.u.from_addr.reuse_port_steer_cpus);
+    }
+    
+listening:
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)listener_fd_handler, o);
     if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
@@ -543,11 +886,18 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
     // init default job
     BPending_Init(&o->default_job, BReactor_PendingGroup(o->reactor), (BPending_handler)listener_default_job_handler, o);
     
+    // init next job
+    BPending_Init(&o->next_job, BReactor_PendingGroup(o->reactor), (BPending_handler)listener_next_job_handler, o);
+    
+    // no connection accepted
+    o->accept_batch_left = 0;
+    o->accepted_fd = -1;
+    
     DebugObject_Init(&o->d_obj);
     return 1;
     
 fail3:
-    if (from.type == BLISCON_FROM_UNIX) {
+    if (o->unix_socket_path) {
         if (unlink(o->unix_socket_path) < 0) {
             BLog(BLOG_ERROR, "unlink socket failed");
         }
@@ -566,6 +916,16 @@ void BListener_Free (BListener *o)
 {
     DebugObject_Free(&o->d_obj);
     
+    // close connection not taken by the user
+    if (o->accepted_fd >= 0) {
+        if (close(o->accepted_fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+    }
+    
+    // free next job
+    BPending_Free(&o->next_job);
+    
     // free default job
     BPending_Free(&o->default_job);
     
@@ -590,6 +950,41 @@ void BListener_Free (BListener *o)
     }
 }
 
+int BListener_GetQueueLength (BListener *o, int *out_len, int *out_max)
+{
+    DebugObject_Access(&o->d_obj);
+    
+#ifdef BADVPN_LINUX
+    // for listening sockets, the kernel reports the accept queue in these fields
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(o->fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0) {
+        return 0;
+    }
+    
+    *out_len = info.tcpi_unacked;
+    *out_max = info.tcpi_sacked;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int BListener_GetFd (BListener *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->fd;
+}
+
+void BListener_KeepSocketFile (BListener *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    free(o->unix_socket_path);
+    o->unix_socket_path = NULL;
+}
+
 int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
                          BConnector_handler handler)
 {
@@ -646,6 +1041,18 @@ int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reac
         goto fail2;
     }
     
+    // defer connecting until the first send, if the kernel can do that
+    if (from.type == BLISCON_FROM_ADDR && from.u.from_addr.fast_open) {
+#ifdef BADVPN_LINUX
+        int optval = 1;
+        if (setsockopt(o->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &optval, sizeof(optval)) < 0) {
+            BLog(BLOG_WARNING, "setsockopt(TCP_FASTOPEN_CONNECT) failed");
+        }
+#else
+        BLog(BLOG_WARNING, "TCP Fast Open not supported");
+#endif
+    }
+    
     // connect fd
     int connect_res;
     if (from.type == BLISCON_FROM_UNIX) {
@@ -724,6 +1131,7 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
             BListener *listener = source.u.listener.listener;
             DebugObject_Access(&listener->d_obj);
             ASSERT(BPending_IsSet(&listener->default_job))
+            ASSERT(listener->accepted_fd >= 0)
         } break;
         case BCONNECTION_SOURCE_TYPE_CONNECTOR: {
             BConnector *connector = source.u.connector.connector;
@@ -753,24 +1161,19 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
             // unset listener's default job
             BPending_Unset(&listener->default_job);
             
-            // accept
-            struct sys_addr sysaddr;
-            sysaddr.len = sizeof(sysaddr.addr);
-            if ((o->fd = accept(listener->fd, &sysaddr.addr.generic, &sysaddr.len)) < 0) {
-                BLog(BLOG_ERROR, "accept failed");
-                goto fail0;
-            }
+            // take the accepted fd (already non-blocking)
+            o->fd = listener->accepted_fd;
+            listener->accepted_fd = -1;
             o->close_fd = 1;
             
-            // set non-blocking
-            if (!badvpn_set_nonblocking(o->fd)) {
-                BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
-                goto fail1;
-            }
-            
             // return address
             if (source.u.listener.out_addr) {
-                addr_sys_to_socket(source.u.listener.out_addr, sysaddr);
+                *source.u.listener.out_addr = listener->accepted_addr;
+            }
+            
+            // offer the next connection of the batch
+            if (--listener->accept_batch_left > 0) {
+                BPending_Set(&listener->next_job);
             }
         } break;
         
@@ -801,8 +1204,8 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)connection_fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+    if (!BReactor_AddFileDescriptorEdge(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptorEdge failed");
         goto fail1;
     }
     
@@ -813,6 +1216,11 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
     BReactorLimit_Init(&o->send.limit, o->reactor, BCONNECTION_SEND_LIMIT);
     BReactorLimit_Init(&o->recv.limit, o->reactor, BCONNECTION_RECV_LIMIT);
     
+    // zero-copy disabled
+    o->send.zc_threshold = 0;
+    o->send.zc_sockopt = 0;
+    o->send.zc_next_seq = 0;
+    
     // set send and recv not inited
     o->send.state = SEND_STATE_NOT_INITED;
     o->recv.state = RECV_STATE_NOT_INITED;
@@ -827,11 +1235,10 @@ fail1:
             BLog(BLOG_ERROR, "close failed");
         }
     }
-fail0:
     return 0;
 }
 
-void BConnection_Free (BConnection *o)
+static void connection_free_common (BConnection *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
@@ -846,6 +1253,11 @@ void BConnection_Free (BConnection *o)
     if (!o->is_hupd) {
         BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
     }
+}
+
+void BConnection_Free (BConnection *o)
+{
+    connection_free_common(o);
     
     // close fd
     if (o->close_fd) {
@@ -855,6 +1267,13 @@ void BConnection_Free (BConnection *o)
     }
 }
 
+int BConnection_ReleaseFd (BConnection *o)
+{
+    connection_free_common(o);
+    
+    return o->fd;
+}
+
 void BConnection_SetHandlers (BConnection *o, void *user, BConnection_handler handler)
 {
     DebugObject_Access(&o->d_obj);
@@ -876,6 +1295,72 @@ int BConnection_SetSendBuffer (BConnection *o, int buf_size)
     return 1;
 }
 
+int BConnection_FastOpenAccepted (BConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+#ifdef BADVPN_LINUX
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(o->fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0) {
+        return 0;
+    }
+    
+    return !!(info.tcpi_options & TCPI_OPT_SYN_DATA);
+#else
+    return 0;
+#endif
+}
+
+int BConnection_GetAcceptDelay (BConnection *o, int *out_ms)
+{
+    DebugObject_Access(&o->d_obj);
+    
+#ifdef BADVPN_LINUX
+    // for a new connection, the last ACK received is the one completing the handshake
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(o->fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0) {
+        return 0;
+    }
+    
+    *out_ms = info.tcpi_last_ack_recv;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int BConnection_SetZeroCopy (BConnection *o, int threshold)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(threshold >= 0)
+    ASSERT(o->send.state != SEND_STATE_BUSY)
+    ASSERT(o->send.state != SEND_STATE_ZC_WAIT)
+    
+    if (threshold == 0) {
+        o->send.zc_threshold = 0;
+        return 1;
+    }
+    
+    #ifdef BADVPN_LINUX
+    if (!o->send.zc_sockopt) {
+        int on = 1;
+        if (setsockopt(o->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_ZEROCOPY) failed");
+            return 0;
+        }
+        o->send.zc_sockopt = 1;
+    }
+    
+    o->send.zc_threshold = threshold;
+    return 1;
+    #else
+    BLog(BLOG_ERROR, "zero-copy send not supported");
+    return 0;
+    #endif
+}
+
 int BConnection_GetLocalAddress (BConnection *o, BAddr *local_addr)
 {
     DebugObject_Access(&o->d_obj);
@@ -908,6 +1393,7 @@ void BConnection_SendAsync_Init (BConnection *o)
     
     // init interface
     StreamPassInterface_Init(&o->send.iface, (StreamPassInterface_handler_send)connection_send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    StreamPassInterface_EnableVec(&o->send.iface, (StreamPassInterface_handler_send_vec)connection_send_if_handler_send_vec);
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)connection_send_job_handler, o);
@@ -919,7 +1405,7 @@ void BConnection_SendAsync_Init (BConnection *o)
 void BConnection_SendAsync_Free (BConnection *o)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->send.state == SEND_STATE_READY || o->send.state == SEND_STATE_BUSY)
+    ASSERT(o->send.state == SEND_STATE_READY || o->send.state == SEND_STATE_BUSY || o->send.state == SEND_STATE_ZC_WAIT)
     
     // update events
     if (!o->is_hupd) {
@@ -940,7 +1426,7 @@ void BConnection_SendAsync_Free (BConnection *o)
 StreamPassInterface * BConnection_SendAsync_GetIf (BConnection *o)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->send.state == SEND_STATE_READY || o->send.state == SEND_STATE_BUSY)
+    ASSERT(o->send.state == SEND_STATE_READY || o->send.state == SEND_STATE_BUSY || o->send.state == SEND_STATE_ZC_WAIT)
     
     return &o->send.iface;
 }
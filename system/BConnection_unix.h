@@ -32,7 +32,8 @@
 
 #define BCONNECTION_SEND_LIMIT 2
 #define BCONNECTION_RECV_LIMIT 2
-#define BCONNECTION_LISTEN_BACKLOG 128
+#define BCONNECTION_LISTEN_BACKLOG 1024
+#define BCONNECTION_ACCEPT_BATCH 16
 
 struct BListener_s {
     BReactor *reactor;
@@ -42,6 +43,10 @@ struct BListener_s {
     int fd;
     BFileDescriptor bfd;
     BPending default_job;
+    BPending next_job;
+    int accept_batch_left;
+    int accepted_fd;
+    BAddr accepted_addr;
     DebugObject d_obj;
 };
 
@@ -72,6 +77,13 @@ struct BConnection_s {
         BPending job;
         const uint8_t *busy_data;
         int busy_data_len;
+        const struct StreamPassInterface_vec *busy_vec;
+        int busy_vec_count;
+        int zc_threshold;
+        int zc_sockopt;
+        uint32_t zc_next_seq;
+        uint32_t zc_wait_seq;
+        int zc_wait_bytes;
         int state;
     } send;
     struct {
@@ -456,6 +456,17 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
         goto fail0;
     }
     
+    // check SO_REUSEPORT
+    if (from.u.from_addr.reuse_port) {
+        BLog(BLOG_ERROR, "SO_REUSEPORT not supported");
+        goto fail0;
+    }
+    
+    // check TCP Fast Open
+    if (from.u.from_addr.fast_open) {
+        BLog(BLOG_WARNING, "TCP Fast Open not supported");
+    }
+    
     // convert address
     struct sys_addr sysaddr;
     addr_socket_to_sys(&sysaddr, from.u.from_addr.addr);
@@ -564,6 +575,13 @@ void BListener_Free (BListener *o)
     BReactorIOCPOverlapped_Free(&o->olap);
 }
 
+int BListener_GetQueueLength (BListener *o, int *out_len, int *out_max)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return 0;
+}
+
 int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
                          BConnector_handler handler)
 {
@@ -582,6 +600,11 @@ int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reac
         goto fail0;
     }
     
+    // check TCP Fast Open
+    if (from.u.from_addr.fast_open) {
+        BLog(BLOG_WARNING, "TCP Fast Open not supported");
+    }
+    
     // convert address
     struct sys_addr sysaddr;
     addr_socket_to_sys(&sysaddr, from.u.from_addr.addr);
@@ -792,6 +815,20 @@ int BConnection_SetSendBuffer (BConnection *o, int buf_size)
     return 1;
 }
 
+int BConnection_FastOpenAccepted (BConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return 0;
+}
+
+int BConnection_GetAcceptDelay (BConnection *o, int *out_ms)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return 0;
+}
+
 int BConnection_GetLocalAddress (BConnection *o, BAddr *local_addr)
 {
     DebugObject_Access(&o->d_obj);
@@ -0,0 +1,248 @@
+/**
+ * @file BControlServer.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <misc/offset.h>
+#include <base/BLog.h>
+
+#include "BControlServer.h"
+
+#include <generated/blog_channel_BControlServer.h>
+
+struct connection {
+    BControlServer *o;
+    BConnection con;
+    BTimer timeout_timer;
+    LinkedList1Node list_node;
+    int recv_len;
+    int sending;
+    ExpString reply;
+    size_t send_pos;
+    uint8_t recv_buf[BCONTROLSERVER_COMMAND_SIZE];
+};
+
+static void connection_free (struct connection *c)
+{
+    BControlServer *o = c->o;
+    
+    if (c->sending) {
+        ExpString_Free(&c->reply);
+    }
+    
+    BReactor_RemoveTimer(o->reactor, &c->timeout_timer);
+    BConnection_RecvAsync_Free(&c->con);
+    BConnection_SendAsync_Free(&c->con);
+    BConnection_Free(&c->con);
+    
+    LinkedList1_Remove(&o->connections, &c->list_node);
+    o->num_connections--;
+    
+    free(c);
+}
+
+static void connection_handler (struct connection *c, int event)
+{
+    // a client may shut down sending after its command, keep sending the reply
+    if (event == BCONNECTION_EVENT_RECVCLOSED && c->sending) {
+        return;
+    }
+    
+    BLog(BLOG_DEBUG, "connection %s", (event == BCONNECTION_EVENT_RECVCLOSED ? "closed" : "error"));
+    
+    connection_free(c);
+}
+
+static void connection_timeout_handler (struct connection *c)
+{
+    BLog(BLOG_DEBUG, "connection timed out");
+    
+    connection_free(c);
+}
+
+static void connection_send_more (struct connection *c)
+{
+    ASSERT(c->sending)
+    ASSERT(c->send_pos < ExpString_Length(&c->reply))
+    
+    size_t left = ExpString_Length(&c->reply) - c->send_pos;
+    int len = (left > INT_MAX ? INT_MAX : left);
+    
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&c->con), (uint8_t *)ExpString_Get(&c->reply) + c->send_pos, len);
+}
+
+static void connection_send_handler_done (struct connection *c, int data_len)
+{
+    ASSERT(c->sending)
+    
+    c->send_pos += data_len;
+    
+    if (c->send_pos < ExpString_Length(&c->reply)) {
+        connection_send_more(c);
+        return;
+    }
+    
+    // the whole reply is sent, the client will see the connection close
+    connection_free(c);
+}
+
+static void connection_recv_handler_done (struct connection *c, int data_len)
+{
+    BControlServer *o = c->o;
+    ASSERT(!c->sending)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= sizeof(c->recv_buf) - c->recv_len)
+    
+    int old_len = c->recv_len;
+    c->recv_len += data_len;
+    
+    // wait for the end of the command
+    uint8_t *nl = memchr(c->recv_buf + old_len, '\n', data_len);
+    if (!nl) {
+        if (c->recv_len == sizeof(c->recv_buf)) {
+            BLog(BLOG_INFO, "command too long");
+            connection_free(c);
+            return;
+        }
+        
+        StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->recv_buf + c->recv_len, sizeof(c->recv_buf) - c->recv_len);
+        return;
+    }
+    
+    size_t len = nl - c->recv_buf;
+    if (len > 0 && c->recv_buf[len - 1] == '\r') {
+        len--;
+    }
+    
+    if (!ExpString_Init(&c->reply)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        connection_free(c);
+        return;
+    }
+    
+    if (!o->handler(o->user, MemRef_Make((const char *)c->recv_buf, len), &c->reply)) {
+        BLog(BLOG_ERROR, "failed to build reply");
+        ExpString_Free(&c->reply);
+        connection_free(c);
+        return;
+    }
+    
+    // nothing to send, just close
+    if (ExpString_Length(&c->reply) == 0) {
+        ExpString_Free(&c->reply);
+        connection_free(c);
+        return;
+    }
+    
+    c->sending = 1;
+    c->send_pos = 0;
+    connection_send_more(c);
+}
+
+static void listener_handler (BControlServer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // make room by dropping the oldest connection
+    if (o->num_connections == BCONTROLSERVER_MAX_CONNECTIONS) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections), struct connection, list_node));
+    }
+    
+    struct connection *c = malloc(sizeof(*c));
+    if (!c) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    c->o = o;
+    
+    if (!BConnection_Init(&c->con, BConnection_source_listener(&o->listener, NULL), o->reactor, c, (BConnection_handler)connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1;
+    }
+    
+    BConnection_SendAsync_Init(&c->con);
+    BConnection_RecvAsync_Init(&c->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&c->con), (StreamPassInterface_handler_done)connection_send_handler_done, c);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&c->con), (StreamRecvInterface_handler_done)connection_recv_handler_done, c);
+    
+    BTimer_Init(&c->timeout_timer, BCONTROLSERVER_CONNECTION_TIMEOUT, (BTimer_handler)connection_timeout_handler, c);
+    BReactor_SetTimer(o->reactor, &c->timeout_timer);
+    
+    c->recv_len = 0;
+    c->sending = 0;
+    
+    LinkedList1_Append(&o->connections, &c->list_node);
+    o->num_connections++;
+    
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->recv_buf, sizeof(c->recv_buf));
+    return;
+    
+fail1:
+    free(c);
+fail0:
+    return;
+}
+
+int BControlServer_Init (BControlServer *o, const char *socket_path, BReactor *reactor, void *user,
+                         BControlServer_handler handler)
+{
+    ASSERT(socket_path)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->user = user;
+    o->handler = handler;
+    
+    // init listener
+    if (!BListener_InitUnix(&o->listener, socket_path, reactor, o, (BListener_handler)listener_handler)) {
+        BLog(BLOG_ERROR, "BListener_InitUnix failed");
+        return 0;
+    }
+    
+    // init connections
+    LinkedList1_Init(&o->connections);
+    o->num_connections = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void BControlServer_Free (BControlServer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    while (!LinkedList1_IsEmpty(&o->connections)) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections), struct connection, list_node));
+    }
+    BListener_Free(&o->listener);
+}
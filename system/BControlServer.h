@@ -0,0 +1,100 @@
+/**
+ * @file BControlServer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Answers one-line text commands on a local Unix socket. A client connects,
+ * sends a command ending with a newline, and reads the reply until the
+ * connection is closed. What commands there are is up to the user, which
+ * builds the reply.
+ */
+
+#ifndef BADVPN_SYSTEM_BCONTROLSERVER_H
+#define BADVPN_SYSTEM_BCONTROLSERVER_H
+
+#include <misc/debug.h>
+#include <misc/memref.h>
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BConnection.h>
+
+// max number of simultaneous connections; the oldest is dropped
+#define BCONTROLSERVER_MAX_CONNECTIONS 8
+
+// connections which take longer are dropped, in milliseconds
+#define BCONTROLSERVER_CONNECTION_TIMEOUT 5000
+
+// max length of a command, including the newline
+#define BCONTROLSERVER_COMMAND_SIZE 512
+
+/**
+ * Handler called to answer a command.
+ * 
+ * @param user as in {@link BControlServer_Init}
+ * @param command the command, without the line ending
+ * @param reply initialized string to append the reply to
+ * @return 1 on success, 0 if the reply could not be built, which closes the
+ *         connection without one
+ */
+typedef int (*BControlServer_handler) (void *user, MemRef command, ExpString *reply);
+
+typedef struct {
+    BReactor *reactor;
+    void *user;
+    BControlServer_handler handler;
+    BListener listener;
+    LinkedList1 connections;
+    int num_connections;
+    DebugObject d_obj;
+} BControlServer;
+
+/**
+ * Initializes the server, listening on a Unix socket.
+ * {@link BNetwork_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param socket_path socket path; an existing socket there is replaced
+ * @param reactor reactor we live in
+ * @param user argument to handler
+ * @param handler handler answering commands
+ * @return 1 on success, 0 on failure
+ */
+int BControlServer_Init (BControlServer *o, const char *socket_path, BReactor *reactor, void *user,
+                         BControlServer_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the server, closing any connections.
+ * 
+ * @param o the object
+ */
+void BControlServer_Free (BControlServer *o);
+
+#endif
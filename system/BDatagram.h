@@ -37,6 +37,10 @@
 #include <system/BReactor.h>
 #include <system/BNetwork.h>
 
+#ifdef BADVPN_USE_AF_XDP
+#include <system/BXdpSocket.h>
+#endif
+
 struct BDatagram_s;
 
 /**
@@ -82,6 +86,26 @@ int BDatagram_AddressFamilySupported (int family);
 int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
                     BDatagram_handler handler) WARN_UNUSED;
 
+/**
+ * Initializes the object with an unprivileged ICMP echo socket instead of
+ * a UDP socket.
+ * Datagrams sent and received are ICMP (or ICMPv6) echo messages, starting
+ * with the ICMP header. The kernel replaces the echo identifier with its own
+ * and delivers only replies to it; ports in addresses are ignored.
+ * On Linux this requires the process's group to be in the
+ * net.ipv4.ping_group_range sysctl. Not supported on Windows.
+ * {@link BNetwork_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param family address family, BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6
+ * @param reactor reactor we live in
+ * @param user argument to handler
+ * @param handler handler called when an error occurs
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_InitIcmp (BDatagram *o, int family, BReactor *reactor, void *user,
+                        BDatagram_handler handler) WARN_UNUSED;
+
 /**
  * Frees the object.
  * The send and receive interfaces must not be initialized.
@@ -166,6 +190,40 @@ int BDatagram_GetFd (BDatagram *o);
  */
 int BDatagram_SetReuseAddr (BDatagram *o, int reuse);
 
+/**
+ * Sets whether the socket is used for packetization layer path MTU
+ * discovery. When enabled, datagrams are sent with the don't-fragment bit
+ * regardless of the path MTU known to the system, so that oversized
+ * datagrams are lost rather than fragmented. Datagrams which the system
+ * refuses to send because they are too large are dropped silently in
+ * either case. Only supported on Linux.
+ * 
+ * @param o the object
+ * @param enable 1 to enable, 0 to disable
+ * @return 1 on success, 0 if not available
+ */
+int BDatagram_SetPathMtuProbe (BDatagram *o, int enable);
+
+/**
+ * Enables or disables connecting the socket to the remote send address.
+ * 
+ * When enabled and no local source address is set for sending, the socket is
+ * connect()ed to the remote send address, and datagrams are then sent without
+ * a destination address or control message, letting the system reuse the
+ * cached route. While connected, only datagrams from the remote address are
+ * received. When the send addresses change, the socket is disconnected, and
+ * connected to the new address once the datagrams queued for the old one have
+ * been sent. An unbound socket is first bound to the wildcard address and an
+ * ephemeral port, so that disconnecting does not lose its port; this should
+ * therefore be enabled before anything is sent.
+ * Only supported for IPv4 and IPv6 on Unix-like systems.
+ * 
+ * @param o the object
+ * @param enable 1 to enable, 0 to disable
+ * @return 1 on success, 0 if not available
+ */
+int BDatagram_SetAutoConnect (BDatagram *o, int enable);
+
 /**
  * Initializes the send interface.
  * The send interface must not be initialized.
@@ -175,6 +233,24 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse);
  */
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu);
 
+/**
+ * Initializes the send interface, optionally with batching.
+ * The send interface must not be initialized.
+ * 
+ * With batch>1, packets passed to the send interface are copied into a queue
+ * of up to batch packets and accepted immediately. The queue is flushed once
+ * the sender stops supplying packets (from a job), or when it becomes full, and
+ * the queued packets are sent with a single sendmmsg() call where available.
+ * Each queued packet keeps the send addresses which were in effect when it
+ * was accepted. Not supported on Windows, where batch is ignored.
+ * 
+ * @param o the object
+ * @param mtu maximum transmission unit. Must be >=0.
+ * @param batch maximum number of packets to queue. Must be >=1; 1 disables batching.
+ * @return 1 on success, 0 on failure. Cannot fail with batch=1.
+ */
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch) WARN_UNUSED;
+
 /**
  * Frees the send interface.
  * The send interface must be initialized.
@@ -195,6 +271,23 @@ void BDatagram_SendAsync_Free (BDatagram *o);
  */
 PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o);
 
+/**
+ * Enables or disables UDP segmentation offload (GSO) for sending.
+ * The send interface must be initialized.
+ * 
+ * When enabled, runs of queued packets with the same addresses and the same
+ * size (the last one may be shorter) are passed to the kernel as a single
+ * buffer, which it splits into individual datagrams. This requires the send
+ * interface to have been initialized with batch>1. If a segmented send fails,
+ * GSO is disabled automatically and the packets are sent individually.
+ * Only supported on Linux.
+ * 
+ * @param o the object
+ * @param enable 1 to enable, 0 to disable
+ * @return 1 on success, 0 if GSO is not available
+ */
+int BDatagram_SendAsync_SetGSO (BDatagram *o, int enable);
+
 /**
  * Initializes the receive interface.
  * The receive interface must not be initialized.
@@ -204,6 +297,26 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o);
  */
 void BDatagram_RecvAsync_Init (BDatagram *o, int mtu);
 
+/**
+ * Initializes the receive interface, optionally with batching.
+ * The receive interface must not be initialized.
+ * 
+ * With batch>1, when a packet is requested and none are queued, up to batch
+ * datagrams are read at once (with recvmmsg() where available) into a
+ * queue of preallocated buffers, and handed out one by one. Addresses reported
+ * by {@link BDatagram_GetLastReceiveAddrs} follow the packet most recently
+ * handed out. On Windows, batch receives are instead kept posted as overlapped
+ * operations into the buffers once receiving has started, and completed
+ * datagrams are handed out in the order they were posted; the receive
+ * interface then counts as busy whenever receives are posted.
+ * 
+ * @param o the object
+ * @param mtu maximum transmission unit. Must be >=0.
+ * @param batch maximum number of datagrams to read at once. Must be >=1; 1 disables batching.
+ * @return 1 on success, 0 on failure. Cannot fail with batch=1.
+ */
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch) WARN_UNUSED;
+
 /**
  * Frees the receive interface.
  * The receive interface must be initialized.
@@ -224,6 +337,51 @@ void BDatagram_RecvAsync_Free (BDatagram *o);
  */
 PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o);
 
+/**
+ * Sets how many times the socket may be read from within one reactor
+ * iteration before waiting for it to become readable again. This lets a
+ * burst of datagrams be drained in one go. The default is BDATAGRAM_RECV_LIMIT.
+ * The receive interface must be initialized. Ignored on Windows.
+ * 
+ * @param o the object
+ * @param limit receive limit. Must be >0.
+ */
+void BDatagram_RecvAsync_SetLimit (BDatagram *o, int limit);
+
+/**
+ * Enables or disables UDP receive offload (GRO).
+ * The receive interface must be initialized and not busy.
+ * 
+ * When enabled, the kernel may deliver a train of datagrams from one sender as
+ * one buffer; it is split back into the original datagrams, which are provided
+ * to the receive interface one by one. While enabled, receive batching is not
+ * used. Only supported on Linux.
+ * 
+ * @param o the object
+ * @param enable 1 to enable, 0 to disable
+ * @return 1 on success, 0 if GRO is not available
+ */
+int BDatagram_RecvAsync_SetGRO (BDatagram *o, int enable);
+
+#ifdef BADVPN_USE_AF_XDP
+/**
+ * Additionally receives datagrams addressed to the local port of the socket
+ * through an AF_XDP socket (see {@link BXdpSocket}). Datagrams steered there
+ * are provided to the receive interface like the ones read from the socket,
+ * and take precedence over them. Sending is not affected.
+ * If the socket is not bound yet, it is bound to the wildcard address and an
+ * ephemeral port first, which also starts receiving.
+ * The receive interface must be initialized, and this must not have been done
+ * already. The socket must be IPv4 or IPv6. The AF_XDP socket must outlive
+ * the receive interface.
+ * 
+ * @param o the object
+ * @param xsk AF_XDP socket to receive from
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_RecvAsync_SetXdp (BDatagram *o, BXdpSocket *xsk) WARN_UNUSED;
+#endif
+
 #ifdef BADVPN_USE_WINAPI
 #include "BDatagram_win.h"
 #else
@@ -41,8 +41,15 @@
 #    include <netpacket/packet.h>
 #    include <net/ethernet.h>
 #endif
+#include <netinet/in.h>
+#ifdef BADVPN_USE_UDP_GSO
+#    include <netinet/udp.h>
+#endif
 
 #include <misc/nonblocking.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+#include <misc/usdt.h>
 #include <base/BLog.h>
 
 #include "BDatagram.h"
@@ -61,16 +68,77 @@ struct sys_addr {
     } addr;
 };
 
+union pktinfo_cdata {
+#ifdef BADVPN_FREEBSD
+    char in[CMSG_SPACE(sizeof(struct in_addr))];
+#else
+    char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#endif
+    char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+};
+
+#ifdef BADVPN_USE_MMSG
+typedef struct mmsghdr batch_hdr;
+#else
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} batch_hdr;
+#endif
+
+union batch_cdata {
+    struct cmsghdr align;
+    union pktinfo_cdata pktinfo;
+#ifdef BADVPN_USE_UDP_GSO
+    char pktinfo_udp[sizeof(union pktinfo_cdata) + CMSG_SPACE(sizeof(int))];
+#endif
+};
+
+struct batch_msg {
+    struct sys_addr sysaddr;
+    union batch_cdata cdata;
+};
+
 static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void set_pktinfo (int fd, int family);
+static void set_send_pktinfo (struct msghdr *msg, union pktinfo_cdata *cdata, BIPAddr local_addr);
+static void get_recv_addrs (struct msghdr *msg, struct sys_addr sysaddr, BAddr *remote_addr, BIPAddr *local_addr);
+static void batch_init_single (struct BDatagram_batch *b);
+static int batch_init (struct BDatagram_batch *b, int batch, int mtu);
+static void batch_free (struct BDatagram_batch *b);
+static batch_hdr * batch_hdrs (struct BDatagram_batch *b);
+static struct batch_msg * batch_msgs (struct BDatagram_batch *b);
+static struct iovec * batch_iovs (struct BDatagram_batch *b);
+#ifdef BADVPN_USE_UDP_GSO
+static int gso_segments (BDatagram *o, int first, int avail);
+static void set_send_gso (struct msghdr *msg, union batch_cdata *cdata, int segment_size);
+static int get_recv_gro (struct msghdr *msg, int bytes);
+static void do_recv_gro (BDatagram *o);
+#endif
+static int sys_sendmmsg (int fd, batch_hdr *hdrs, unsigned int num);
+static int sys_recvmmsg (int fd, batch_hdr *hdrs, unsigned int num);
 static void report_error (BDatagram *o);
+static void start_recv_after_send (BDatagram *o);
+static void maybe_connect (BDatagram *o);
+static void disconnect (BDatagram *o);
 static void do_send (BDatagram *o);
+static int flush_send_batch (BDatagram *o);
+static void queue_send_batch (BDatagram *o);
+static void continue_send_batch (BDatagram *o);
+static void do_recv_batch (BDatagram *o);
 static void do_recv (BDatagram *o);
+#ifdef BADVPN_USE_AF_XDP
+static void do_recv_xdp (BDatagram *o);
+static void xdp_port_handler (BDatagram *o);
+#endif
 static void fd_handler (BDatagram *o, int events);
 static void send_job_handler (BDatagram *o);
 static void recv_job_handler (BDatagram *o);
+static void send_flush_job_handler (BDatagram *o);
+static void send_init_rest (BDatagram *o);
+static void recv_init_rest (BDatagram *o);
 static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len);
 static void recv_if_handler_recv (BDatagram *o, uint8_t *data);
 
@@ -231,61 +299,16 @@ static void set_pktinfo (int fd, int family)
     }
 }
 
-static void report_error (BDatagram *o)
-{
-    DebugError_AssertNoError(&o->d_err);
-    
-    // report error
-    DEBUGERROR(&o->d_err, o->handler(o->user, BDATAGRAM_EVENT_ERROR));
-    return;
-}
-
-static void do_send (BDatagram *o)
+static void set_send_pktinfo (struct msghdr *msg, union pktinfo_cdata *cdata, BIPAddr local_addr)
 {
-    DebugError_AssertNoError(&o->d_err);
-    ASSERT(o->send.inited)
-    ASSERT(o->send.busy)
-    ASSERT(o->send.have_addrs)
-    
-    // limit
-    if (!BReactorLimit_Increment(&o->send.limit)) {
-        // wait for fd
-        o->wait_events |= BREACTOR_WRITE;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-        return;
-    }
-    
-    // convert destination address
-    struct sys_addr sysaddr;
-    addr_socket_to_sys(&sysaddr, o->send.remote_addr);
-    
-    struct iovec iov;
-    iov.iov_base = (uint8_t *)o->send.busy_data;
-    iov.iov_len = o->send.busy_data_len;
-    
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
-    
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sysaddr.addr.generic;
-    msg.msg_namelen = sysaddr.len;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = &cdata;
-    msg.msg_controllen = sizeof(cdata);
+    msg->msg_control = cdata;
+    msg->msg_controllen = sizeof(*cdata);
     
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
     
     size_t controllen = 0;
     
-    switch (o->send.local_addr.type) {
+    switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
 #ifdef BADVPN_FREEBSD
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
@@ -293,7 +316,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_SENDSRCADDR;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
             struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            addrinfo->s_addr = o->send.local_addr.ipv4;
+            addrinfo->s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_addr));
 #else
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
@@ -301,7 +324,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
             struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            pktinfo->ipi_spec_dst.s_addr = o->send.local_addr.ipv4;
+            pktinfo->ipi_spec_dst.s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
 #endif
         } break;
@@ -312,29 +335,390 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IPV6_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
             struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            memcpy(pktinfo->ipi6_addr.s6_addr, o->send.local_addr.ipv6, 16);
+            memcpy(pktinfo->ipi6_addr.s6_addr, local_addr.ipv6, 16);
             controllen += CMSG_SPACE(sizeof(struct in6_pktinfo));
         } break;
     }
     
-    msg.msg_controllen = controllen;
+    msg->msg_controllen = controllen;
+    
+    if (msg->msg_controllen == 0) {
+        msg->msg_control = NULL;
+    }
+}
+
+static void get_recv_addrs (struct msghdr *msg, struct sys_addr sysaddr, BAddr *remote_addr, BIPAddr *local_addr)
+{
+    // read returned address
+    sysaddr.len = msg->msg_namelen;
+    addr_sys_to_socket(remote_addr, sysaddr);
+    
+    // read returned local address
+    BIPAddr_InitInvalid(local_addr);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef BADVPN_FREEBSD
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
+            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv4(local_addr, addrinfo->s_addr);
+        }
+#else
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv4(local_addr, pktinfo->ipi_addr.s_addr);
+        }
+#endif
+        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv6(local_addr, pktinfo->ipi6_addr.s6_addr);
+        }
+    }
+}
+
+static void batch_init_single (struct BDatagram_batch *b)
+{
+    // a batch of one is just the regular unbatched mode
+    b->start = 0;
+    b->used = 0;
+    b->size = 0;
+}
+
+static int batch_init (struct BDatagram_batch *b, int batch, int mtu)
+{
+    ASSERT(batch >= 1)
+    ASSERT(mtu >= 0)
+    
+    if (batch == 1) {
+        batch_init_single(b);
+        return 1;
+    }
+    
+    b->start = 0;
+    b->used = 0;
+    b->size = batch;
+    
+    // allocate packet buffers
+    if (!(b->bufs = (uint8_t *)BAllocArray2(batch, (mtu > 0 ? mtu : 1), 1))) {
+        goto fail0;
+    }
+    
+    // allocate slots
+    if (!(b->slots = (struct BDatagram_batch_slot *)BAllocArray(batch, sizeof(b->slots[0])))) {
+        goto fail1;
+    }
+    
+    // allocate message headers, followed by per-message addresses and control data,
+    // followed by per-packet I/O vectors
+    if (!(b->msgs = BAllocArray(batch, sizeof(batch_hdr) + sizeof(struct batch_msg) + sizeof(struct iovec)))) {
+        goto fail2;
+    }
+    
+    return 1;
+    
+fail2:
+    BFree(b->slots);
+fail1:
+    BFree(b->bufs);
+fail0:
+    return 0;
+}
+
+static void batch_free (struct BDatagram_batch *b)
+{
+    if (b->size == 0) {
+        return;
+    }
+    
+    BFree(b->msgs);
+    BFree(b->slots);
+    BFree(b->bufs);
+}
+
+static batch_hdr * batch_hdrs (struct BDatagram_batch *b)
+{
+    return (batch_hdr *)b->msgs;
+}
+
+static struct batch_msg * batch_msgs (struct BDatagram_batch *b)
+{
+    return (struct batch_msg *)((batch_hdr *)b->msgs + b->size);
+}
+
+static struct iovec * batch_iovs (struct BDatagram_batch *b)
+{
+    return (struct iovec *)(batch_msgs(b) + b->size);
+}
+
+#ifdef BADVPN_USE_UDP_GSO
+
+static int gso_segments (BDatagram *o, int first, int avail)
+{
+    ASSERT(o->send.gso)
+    ASSERT(avail >= 1)
+    
+    // returns the number of queued packets starting at first which can be
+    // sent as one GSO buffer: same addresses, same size except that the
+    // last one may be shorter
+    
+    struct BDatagram_batch_slot *first_slot = &o->send.batch.slots[first];
+    int seg_len = first_slot->len;
+    
+    if (seg_len == 0) {
+        return 1;
+    }
+    
+    int count = 1;
+    int total = seg_len;
+    
+    while (count < avail && count < BDATAGRAM_GSO_MAX_SEGMENTS) {
+        struct BDatagram_batch_slot *slot = &o->send.batch.slots[first + count];
+        
+        if (slot->len == 0 || slot->len > seg_len || total + slot->len > BDATAGRAM_GSO_MAX_BYTES) {
+            break;
+        }
+        
+        if (!BAddr_Compare(&slot->remote_addr, &first_slot->remote_addr) ||
+            slot->local_addr.type != first_slot->local_addr.type ||
+            (slot->local_addr.type != BADDR_TYPE_NONE && !BIPAddr_Compare(&slot->local_addr, &first_slot->local_addr))
+        ) {
+            break;
+        }
+        
+        count++;
+        total += slot->len;
+        
+        // a short segment ends the buffer
+        if (slot->len < seg_len) {
+            break;
+        }
+    }
+    
+    return count;
+}
+
+static void set_send_gso (struct msghdr *msg, union batch_cdata *cdata, int segment_size)
+{
+    ASSERT(segment_size > 0)
+    ASSERT(segment_size <= UINT16_MAX)
+    
+    // append the segment size after any pktinfo control message
+    size_t controllen = msg->msg_controllen;
+    msg->msg_control = cdata;
+    msg->msg_controllen = controllen + CMSG_SPACE(sizeof(uint16_t));
+    
+    struct cmsghdr *cmsg = (struct cmsghdr *)((char *)cdata + controllen);
+    memset(cmsg, 0, CMSG_SPACE(sizeof(uint16_t)));
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t size = segment_size;
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+}
+
+static int get_recv_gro (struct msghdr *msg, int bytes)
+{
+    // returns the size of segments coalesced by GRO, or the whole
+    // datagram if it was not coalesced
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            if (size > 0) {
+                return size;
+            }
+        }
+    }
+    
+    return bytes;
+}
+
+#endif
+
+static int sys_sendmmsg (int fd, batch_hdr *hdrs, unsigned int num)
+{
+    ASSERT(num > 0)
+    
+#ifdef BADVPN_USE_MMSG
+    return sendmmsg(fd, hdrs, num, 0);
+#else
+    for (unsigned int i = 0; i < num; i++) {
+        int bytes = sendmsg(fd, &hdrs[i].msg_hdr, 0);
+        if (bytes < 0) {
+            // like sendmmsg, only report the error if nothing was sent
+            return (i > 0) ? (int)i : -1;
+        }
+        hdrs[i].msg_len = bytes;
+    }
+    return num;
+#endif
+}
+
+static int sys_recvmmsg (int fd, batch_hdr *hdrs, unsigned int num)
+{
+    ASSERT(num > 0)
+    
+#ifdef BADVPN_USE_MMSG
+    return recvmmsg(fd, hdrs, num, 0, NULL);
+#else
+    for (unsigned int i = 0; i < num; i++) {
+        int bytes = recvmsg(fd, &hdrs[i].msg_hdr, 0);
+        if (bytes < 0) {
+            // like recvmmsg, only report the error if nothing was received
+            return (i > 0) ? (int)i : -1;
+        }
+        hdrs[i].msg_len = bytes;
+    }
+    return num;
+#endif
+}
+
+static void report_error (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    
+    // report error
+    DEBUGERROR(&o->d_err, o->handler(o->user, BDATAGRAM_EVENT_ERROR));
+    return;
+}
+
+static void start_recv_after_send (BDatagram *o)
+{
+    // if recv wasn't started yet, start it
+    if (!o->recv.started) {
+        // set recv started
+        o->recv.started = 1;
+        
+        // continue receiving
+        if (o->recv.inited && o->recv.busy) {
+            BPending_Set(&o->recv.job);
+        }
+    }
+}
+
+static void maybe_connect (BDatagram *o)
+{
+    ASSERT(o->send.have_addrs)
+    
+    // only connect when sending plainly to the remote address, and only once
+    // nothing queued for other addresses is left
+    if (!o->send.auto_connect || o->send.connected || o->send.local_addr.type != BADDR_TYPE_NONE ||
+        o->send.remote_addr.type != o->family || (o->send.inited && o->send.batch.used > 0)
+    ) {
+        return;
+    }
+    
+    struct sys_addr sysaddr;
+    addr_socket_to_sys(&sysaddr, o->send.remote_addr);
+    
+    if (connect(o->fd, &sysaddr.addr.generic, sysaddr.len) < 0) {
+        BLog(BLOG_WARNING, "connect failed, not connecting anymore");
+        o->send.auto_connect = 0;
+        return;
+    }
+    
+    o->send.connected = 1;
+}
+
+static void disconnect (BDatagram *o)
+{
+    ASSERT(o->send.connected)
+    
+    struct sockaddr sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_family = AF_UNSPEC;
+    
+    // some systems report an error even though the socket was disconnected
+    if (connect(o->fd, &sa, sizeof(sa)) < 0 && errno != EAFNOSUPPORT) {
+        BLog(BLOG_ERROR, "disconnect failed");
+    }
+    
+    o->send.connected = 0;
+    
+    // queued packets now need their destination address
+    if (o->send.inited) {
+        struct BDatagram_batch *b = &o->send.batch;
+        for (int i = 0; i < b->used; i++) {
+            b->slots[b->start + i].connected = 0;
+        }
+    }
+}
+
+static void do_send (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    
+    if (o->send.batch.size > 0) {
+        queue_send_batch(o);
+        return;
+    }
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    // connect to the destination if allowed
+    maybe_connect(o);
     
-    if (msg.msg_controllen == 0) {
-        msg.msg_control = NULL;
+    int bytes;
+    
+    if (o->send.connected) {
+        // send to the connected address
+        bytes = send(o->fd, o->send.busy_data, o->send.busy_data_len, 0);
+    } else {
+        // convert destination address
+        struct sys_addr sysaddr;
+        addr_socket_to_sys(&sysaddr, o->send.remote_addr);
+        
+        struct iovec iov;
+        iov.iov_base = (uint8_t *)o->send.busy_data;
+        iov.iov_len = o->send.busy_data_len;
+        
+        union pktinfo_cdata cdata;
+        
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &sysaddr.addr.generic;
+        msg.msg_namelen = sysaddr.len;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        
+        // set source address
+        set_send_pktinfo(&msg, &cdata, o->send.local_addr);
+        
+        // send
+        bytes = sendmsg(o->fd, &msg, 0);
     }
     
-    // send
-    int bytes = sendmsg(o->fd, &msg, 0);
     if (bytes < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             // wait for fd
+            BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_WRITE);
             o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
         }
         
-        report_error(o);
-        return;
+        if (errno == ECONNREFUSED) {
+            // a connected socket reports an ICMP error for an earlier
+            // datagram instead of sending; try again
+            BPending_Set(&o->send.job);
+            return;
+        }
+        
+        if (errno != EMSGSIZE) {
+            report_error(o);
+            return;
+        }
+        
+        // the datagram is larger than the route allows, it is dropped
+        BLog(BLOG_DEBUG, "send: message too long");
+        bytes = o->send.busy_data_len;
     }
     
     ASSERT(bytes >= 0)
@@ -344,16 +728,10 @@ static void do_send (BDatagram *o)
         BLog(BLOG_ERROR, "send sent too little");
     }
     
+    BTRACE2(bdatagram_send, o, 1);
+    
     // if recv wasn't started yet, start it
-    if (!o->recv.started) {
-        // set recv started
-        o->recv.started = 1;
-        
-        // continue receiving
-        if (o->recv.inited && o->recv.busy) {
-            BPending_Set(&o->recv.job);
-        }
-    }
+    start_recv_after_send(o);
     
     // set not busy
     o->send.busy = 0;
@@ -369,6 +747,25 @@ static void do_recv (BDatagram *o)
     ASSERT(o->recv.busy)
     ASSERT(o->recv.started)
     
+#ifdef BADVPN_USE_AF_XDP
+    if (o->recv.have_xdp && BXdpSocketPort_Peek(&o->recv.xdp_port, NULL, NULL, NULL, NULL)) {
+        do_recv_xdp(o);
+        return;
+    }
+#endif
+    
+#ifdef BADVPN_USE_UDP_GSO
+    if (o->recv.gro_buf) {
+        do_recv_gro(o);
+        return;
+    }
+#endif
+    
+    if (o->recv.batch.size > 0) {
+        do_recv_batch(o);
+        return;
+    }
+    
     // limit
     if (!BReactorLimit_Increment(&o->recv.limit)) {
         // wait for fd
@@ -383,14 +780,7 @@ static void do_recv (BDatagram *o)
     iov.iov_base = o->recv.busy_data;
     iov.iov_len = o->recv.mtu;
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
+    union pktinfo_cdata cdata;
     
     struct msghdr msg;
     memset(&msg, 0, sizeof(msg));
@@ -405,42 +795,473 @@ static void do_recv (BDatagram *o)
     int bytes = recvmsg(o->fd, &msg, 0);
     if (bytes < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_READ);
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (errno == ECONNREFUSED) {
+            // ICMP error for a datagram sent on a connected socket; keep receiving
+            BPending_Set(&o->recv.job);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recv failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(bytes >= 0)
+    ASSERT(bytes <= o->recv.mtu)
+    
+    // read returned addresses
+    get_recv_addrs(&msg, sysaddr, &o->recv.remote_addr, &o->recv.local_addr);
+    
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    BTRACE2(bdatagram_recv, o, bytes);
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+#ifdef BADVPN_USE_AF_XDP
+
+static void do_recv_xdp (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.started)
+    ASSERT(o->recv.have_xdp)
+    
+    // take datagram from the queue
+    const uint8_t *data;
+    int data_len;
+    ASSERT_EXECUTE(BXdpSocketPort_Peek(&o->recv.xdp_port, &data, &data_len, &o->recv.remote_addr, &o->recv.local_addr))
+    
+    // truncate like recvmsg does
+    int bytes = (data_len < o->recv.mtu ? data_len : o->recv.mtu);
+    memcpy(o->recv.busy_data, data, bytes);
+    
+    // return frame
+    BXdpSocketPort_Pop(&o->recv.xdp_port);
+    
+    // no longer waiting for the socket
+    if ((o->wait_events & BREACTOR_READ)) {
+        o->wait_events &= ~BREACTOR_READ;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+    }
+    
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    BTRACE2(bdatagram_recv, o, bytes);
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+static void xdp_port_handler (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.have_xdp)
+    
+    // continue receiving if waiting for a datagram
+    if (o->recv.busy && o->recv.started) {
+        BPending_Set(&o->recv.job);
+    }
+}
+
+#endif
+
+static int flush_send_batch (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch.size > 0)
+    
+    // returns 1 if all queued packets were sent, 0 if we have to wait
+    // for the fd or an error was reported
+    
+    struct BDatagram_batch *b = &o->send.batch;
+    batch_hdr *hdrs = batch_hdrs(b);
+    struct batch_msg *msgs = batch_msgs(b);
+    struct iovec *iovs = batch_iovs(b);
+    
+    while (b->used > 0) {
+        // limit
+        if (!BReactorLimit_Increment(&o->send.limit)) {
+            // wait for fd
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return 0;
+        }
+        
+        // build messages for queued packets
+        int num_msgs = 0;
+#ifdef BADVPN_USE_UDP_GSO
+        int have_gso = 0;
+#endif
+        int pos = 0;
+        while (pos < b->used) {
+            int j = b->start + pos;
+            struct BDatagram_batch_slot *slot = &b->slots[j];
+            struct batch_msg *m = &msgs[num_msgs];
+            
+            // number of packets in this message
+            int count = 1;
+#ifdef BADVPN_USE_UDP_GSO
+            if (o->send.gso) {
+                count = gso_segments(o, j, b->used - pos);
+            }
+#endif
+            
+            for (int k = 0; k < count; k++) {
+                iovs[pos + k].iov_base = b->bufs + (size_t)(j + k) * o->send.mtu;
+                iovs[pos + k].iov_len = b->slots[j + k].len;
+            }
+            
+            struct msghdr *msg = &hdrs[num_msgs].msg_hdr;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_iov = &iovs[pos];
+            msg->msg_iovlen = count;
+            
+            // packets for the connected address need no addressing
+            if (!slot->connected) {
+                addr_socket_to_sys(&m->sysaddr, slot->remote_addr);
+                msg->msg_name = &m->sysaddr.addr.generic;
+                msg->msg_namelen = m->sysaddr.len;
+                set_send_pktinfo(msg, &m->cdata.pktinfo, slot->local_addr);
+            }
+            
+#ifdef BADVPN_USE_UDP_GSO
+            if (count > 1) {
+                set_send_gso(msg, &m->cdata, slot->len);
+                have_gso = 1;
+            }
+#endif
+            
+            num_msgs++;
+            pos += count;
+        }
+        
+        // send
+        int num = sys_sendmmsg(o->fd, hdrs, num_msgs);
+        if (num < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for fd
+                BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_WRITE);
+                o->wait_events |= BREACTOR_WRITE;
+                BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+                return 0;
+            }
+            
+            if (errno == ECONNREFUSED) {
+                // a connected socket reports an ICMP error for an earlier
+                // datagram instead of sending; try again
+                continue;
+            }
+            
+#ifdef BADVPN_USE_UDP_GSO
+            // the route may not support segmentation offload; send
+            // packets individually from now on
+            if (have_gso) {
+                BLog(BLOG_WARNING, "GSO send failed, disabling GSO");
+                o->send.gso = 0;
+                continue;
+            }
+#endif
+            
+            if (errno != EMSGSIZE) {
+                report_error(o);
+                return 0;
+            }
+            
+            // the first datagram is larger than the route allows, drop it
+            BLog(BLOG_DEBUG, "send: message too long");
+            b->start++;
+            b->used--;
+            continue;
+        }
+        
+        ASSERT(num > 0)
+        ASSERT(num <= num_msgs)
+        
+        // check lengths, counting sent packets
+        int num_packets = 0;
+        for (int i = 0; i < num; i++) {
+            struct msghdr *msg = &hdrs[i].msg_hdr;
+            size_t msg_len = 0;
+            for (size_t k = 0; k < msg->msg_iovlen; k++) {
+                msg_len += msg->msg_iov[k].iov_len;
+            }
+            if (hdrs[i].msg_len < msg_len) {
+                BLog(BLOG_ERROR, "send sent too little");
+            }
+            num_packets += msg->msg_iovlen;
+        }
+        
+        BTRACE2(bdatagram_send, o, num_packets);
+        
+        // remove sent packets
+        b->start += num_packets;
+        b->used -= num_packets;
+        
+        // if recv wasn't started yet, start it
+        start_recv_after_send(o);
+    }
+    
+    b->start = 0;
+    
+    return 1;
+}
+
+static void queue_send_batch (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    ASSERT(o->send.batch.size > 0)
+    
+    struct BDatagram_batch *b = &o->send.batch;
+    
+    // if there is no room for the packet, send what we have first
+    if (b->start + b->used == b->size) {
+        if (!flush_send_batch(o)) {
+            return;
+        }
+    }
+    
+    ASSERT(b->start + b->used < b->size)
+    
+    // connect to the destination if allowed
+    maybe_connect(o);
+    
+    // copy packet into the queue, remembering the current addresses
+    int j = b->start + b->used;
+    struct BDatagram_batch_slot *slot = &b->slots[j];
+    memcpy(b->bufs + (size_t)j * o->send.mtu, o->send.busy_data, o->send.busy_data_len);
+    slot->len = o->send.busy_data_len;
+    slot->remote_addr = o->send.remote_addr;
+    slot->local_addr = o->send.local_addr;
+    slot->connected = o->send.connected;
+    b->used++;
+    
+    // flush once the sender has nothing more for us; this job was set
+    // before the sender is informed, so it runs after the sender's job
+    BPending_Set(&o->send.flush_job);
+    
+    // set not busy
+    o->send.busy = 0;
+    
+    // done
+    PacketPassInterface_Done(&o->send.iface);
+}
+
+static void continue_send_batch (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch.size > 0)
+    
+    // send queued packets
+    if (!flush_send_batch(o)) {
+        return;
+    }
+    
+    // queue a packet which was waiting for room
+    if (o->send.busy && o->send.have_addrs) {
+        queue_send_batch(o);
+        return;
+    }
+}
+
+static void do_recv_batch (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.started)
+    ASSERT(o->recv.batch.size > 0)
+    
+    struct BDatagram_batch *b = &o->recv.batch;
+    
+    // read a new batch if we have nothing queued
+    if (b->used == 0) {
+        // limit
+        if (!BReactorLimit_Increment(&o->recv.limit)) {
+            // wait for fd
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        batch_hdr *hdrs = batch_hdrs(b);
+        struct batch_msg *msgs = batch_msgs(b);
+        struct iovec *iovs = batch_iovs(b);
+        
+        for (int i = 0; i < b->size; i++) {
+            struct batch_msg *m = &msgs[i];
+            iovs[i].iov_base = b->bufs + (size_t)i * o->recv.mtu;
+            iovs[i].iov_len = o->recv.mtu;
+            
+            struct msghdr *msg = &hdrs[i].msg_hdr;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name = &m->sysaddr.addr.generic;
+            msg->msg_namelen = sizeof(m->sysaddr.addr);
+            msg->msg_iov = &iovs[i];
+            msg->msg_iovlen = 1;
+            msg->msg_control = &m->cdata;
+            msg->msg_controllen = sizeof(m->cdata);
+        }
+        
+        // recv
+        int num = sys_recvmmsg(o->fd, hdrs, b->size);
+        if (num < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for fd
+                BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_READ);
+                o->wait_events |= BREACTOR_READ;
+                BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+                return;
+            }
+            
+            if (errno == ECONNREFUSED) {
+                // ICMP error for a datagram sent on a connected socket; keep receiving
+                BPending_Set(&o->recv.job);
+                return;
+            }
+            
+            BLog(BLOG_ERROR, "recv failed");
+            report_error(o);
+            return;
+        }
+        
+        ASSERT(num > 0)
+        ASSERT(num <= b->size)
+        
+        // read lengths and addresses
+        for (int i = 0; i < num; i++) {
+            struct BDatagram_batch_slot *slot = &b->slots[i];
+            ASSERT(hdrs[i].msg_len <= o->recv.mtu)
+            slot->len = hdrs[i].msg_len;
+            get_recv_addrs(&hdrs[i].msg_hdr, msgs[i].sysaddr, &slot->remote_addr, &slot->local_addr);
+        }
+        
+        b->start = 0;
+        b->used = num;
+    }
+    
+    // hand out the first queued datagram
+    struct BDatagram_batch_slot *slot = &b->slots[b->start];
+    int bytes = slot->len;
+    memcpy(o->recv.busy_data, b->bufs + (size_t)b->start * o->recv.mtu, bytes);
+    o->recv.remote_addr = slot->remote_addr;
+    o->recv.local_addr = slot->local_addr;
+    b->start++;
+    b->used--;
+    
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    BTRACE2(bdatagram_recv, o, bytes);
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+#ifdef BADVPN_USE_UDP_GSO
+
+static void do_recv_gro (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.started)
+    ASSERT(o->recv.gro_buf)
+    
+    // read a new datagram if we have no segments left
+    if (o->recv.gro_len < 0) {
+        // limit
+        if (!BReactorLimit_Increment(&o->recv.limit)) {
             // wait for fd
             o->wait_events |= BREACTOR_READ;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
         }
         
-        BLog(BLOG_ERROR, "recv failed");
-        report_error(o);
-        return;
+        struct sys_addr sysaddr;
+        
+        struct iovec iov;
+        iov.iov_base = o->recv.gro_buf;
+        iov.iov_len = BDATAGRAM_GRO_BUF_SIZE;
+        
+        union batch_cdata cdata;
+        
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &sysaddr.addr.generic;
+        msg.msg_namelen = sizeof(sysaddr.addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &cdata;
+        msg.msg_controllen = sizeof(cdata);
+        
+        // recv
+        int bytes = recvmsg(o->fd, &msg, 0);
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for fd
+                BReactor_ClearFileDescriptorReady(o->reactor, &o->bfd, BREACTOR_READ);
+                o->wait_events |= BREACTOR_READ;
+                BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+                return;
+            }
+            
+            if (errno == ECONNREFUSED) {
+                // ICMP error for a datagram sent on a connected socket; keep receiving
+                BPending_Set(&o->recv.job);
+                return;
+            }
+            
+            BLog(BLOG_ERROR, "recv failed");
+            report_error(o);
+            return;
+        }
+        
+        ASSERT(bytes <= BDATAGRAM_GRO_BUF_SIZE)
+        
+        // all segments share the addresses of the coalesced datagram
+        get_recv_addrs(&msg, sysaddr, &o->recv.remote_addr, &o->recv.local_addr);
+        
+        o->recv.gro_len = bytes;
+        o->recv.gro_pos = 0;
+        o->recv.gro_seg = get_recv_gro(&msg, bytes);
     }
     
-    ASSERT(bytes >= 0)
-    ASSERT(bytes <= o->recv.mtu)
-    
-    // read returned address
-    sysaddr.len = msg.msg_namelen;
-    addr_sys_to_socket(&o->recv.remote_addr, sysaddr);
+    // hand out the next segment, truncating it to the MTU like a regular recv would
+    int seg_len = bmin_int(o->recv.gro_seg, o->recv.gro_len - o->recv.gro_pos);
+    int bytes = bmin_int(seg_len, o->recv.mtu);
+    memcpy(o->recv.busy_data, o->recv.gro_buf + o->recv.gro_pos, bytes);
+    o->recv.gro_pos += seg_len;
     
-    // read returned local address
-    BIPAddr_InitInvalid(&o->recv.local_addr);
-    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-#ifdef BADVPN_FREEBSD
-        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
-            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv4(&o->recv.local_addr, addrinfo->s_addr);
-        }
-#else
-        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
-            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv4(&o->recv.local_addr, pktinfo->ipi_addr.s_addr);
-        }
-#endif
-        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
-            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv6(&o->recv.local_addr, pktinfo->ipi6_addr.s6_addr);
-        }
+    if (o->recv.gro_pos >= o->recv.gro_len) {
+        o->recv.gro_len = -1;
     }
     
     // set have addresses
@@ -449,10 +1270,14 @@ static void do_recv (BDatagram *o)
     // set not busy
     o->recv.busy = 0;
     
+    BTRACE2(bdatagram_recv, o, bytes);
+    
     // done
     PacketRecvInterface_Done(&o->recv.iface, bytes);
 }
 
+#endif
+
 static void fd_handler (BDatagram *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -465,10 +1290,12 @@ static void fd_handler (BDatagram *o, int events)
     int have_send = 0;
     int have_recv = 0;
     
-    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && o->send.busy && o->send.have_addrs)) {
+    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited &&
+        (o->send.batch.size > 0 ? o->send.batch.used > 0 : (o->send.busy && o->send.have_addrs)))
+    ) {
         ASSERT(o->send.inited)
-        ASSERT(o->send.busy)
-        ASSERT(o->send.have_addrs)
+        ASSERT(o->send.batch.size > 0 || o->send.busy)
+        ASSERT(o->send.batch.size > 0 || o->send.have_addrs)
         
         have_send = 1;
     }
@@ -486,6 +1313,11 @@ static void fd_handler (BDatagram *o, int events)
             BPending_Set(&o->recv.job);
         }
         
+        if (o->send.batch.size > 0) {
+            continue_send_batch(o);
+            return;
+        }
+        
         do_send(o);
         return;
     }
@@ -524,6 +1356,17 @@ static void recv_job_handler (BDatagram *o)
     return;
 }
 
+static void send_flush_job_handler (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch.size > 0)
+    
+    continue_send_batch(o);
+    return;
+}
+
 static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
@@ -585,20 +1428,17 @@ int BDatagram_AddressFamilySupported (int family)
     return 0;
 }
 
-int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
-                    BDatagram_handler handler)
+static int init_with_protocol (BDatagram *o, int family, int protocol, BReactor *reactor, void *user,
+                               BDatagram_handler handler)
 {
-    ASSERT(BDatagram_AddressFamilySupported(family))
-    ASSERT(handler)
-    BNetwork_Assert();
-    
     // init arguments
     o->reactor = reactor;
     o->user = user;
     o->handler = handler;
+    o->family = family;
     
     // init fd
-    if ((o->fd = socket(family_socket_to_sys(family), SOCK_DGRAM, 0)) < 0) {
+    if ((o->fd = socket(family_socket_to_sys(family), SOCK_DGRAM, protocol)) < 0) {
         BLog(BLOG_ERROR, "socket failed");
         goto fail0;
     }
@@ -614,8 +1454,8 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+    if (!BReactor_AddFileDescriptorEdge(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptorEdge failed");
         goto fail1;
     }
     
@@ -630,6 +1470,10 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->send.have_addrs = 0;
     o->recv.have_addrs = 0;
     
+    // set not connecting
+    o->send.auto_connect = 0;
+    o->send.connected = 0;
+    
     // set recv not started
     o->recv.started = 0;
     
@@ -649,6 +1493,26 @@ fail0:
     return 0;
 }
 
+int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
+                    BDatagram_handler handler)
+{
+    ASSERT(BDatagram_AddressFamilySupported(family))
+    ASSERT(handler)
+    BNetwork_Assert();
+    
+    return init_with_protocol(o, family, 0, reactor, user, handler);
+}
+
+int BDatagram_InitIcmp (BDatagram *o, int family, BReactor *reactor, void *user,
+                        BDatagram_handler handler)
+{
+    ASSERT(family == BADDR_TYPE_IPV4 || family == BADDR_TYPE_IPV6)
+    ASSERT(handler)
+    BNetwork_Assert();
+    
+    return init_with_protocol(o, family, (family == BADDR_TYPE_IPV6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP), reactor, user, handler);
+}
+
 void BDatagram_Free (BDatagram *o)
 {
     DebugObject_Free(&o->d_obj);
@@ -706,6 +1570,11 @@ void BDatagram_SetSendAddrs (BDatagram *o, BAddr remote_addr, BIPAddr local_addr
     ASSERT(BDatagram_AddressFamilySupported(remote_addr.type))
     ASSERT(local_addr.type == BADDR_TYPE_NONE || BDatagram_AddressFamilySupported(local_addr.type))
     
+    // disconnect if the addresses no longer allow it
+    if (o->send.connected && (!BAddr_Compare(&remote_addr, &o->send.remote_addr) || local_addr.type != BADDR_TYPE_NONE)) {
+        disconnect(o);
+    }
+    
     // set addresses
     o->send.remote_addr = remote_addr;
     o->send.local_addr = local_addr;
@@ -777,15 +1646,13 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
     return 1;
 }
 
-void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
+static void send_init_rest (BDatagram *o)
 {
-    DebugObject_Access(&o->d_obj);
-    DebugError_AssertNoError(&o->d_err);
-    ASSERT(!o->send.inited)
-    ASSERT(mtu >= 0)
+    // init flush job
+    BPending_Init(&o->send.flush_job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_flush_job_handler, o);
     
-    // init arguments
-    o->send.mtu = mtu;
+    // set GSO disabled
+    o->send.gso = 0;
     
     // init interface
     PacketPassInterface_Init(&o->send.iface, o->send.mtu, (PacketPassInterface_handler_send)send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
@@ -800,6 +1667,44 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     o->send.inited = 1;
 }
 
+void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->send.inited)
+    ASSERT(mtu >= 0)
+    
+    // init arguments
+    o->send.mtu = mtu;
+    
+    // init batch, which cannot fail without batching
+    batch_init_single(&o->send.batch);
+    
+    send_init_rest(o);
+}
+
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->send.inited)
+    ASSERT(mtu >= 0)
+    ASSERT(batch >= 1)
+    
+    // init arguments
+    o->send.mtu = mtu;
+    
+    // init batch
+    if (!batch_init(&o->send.batch, batch, mtu)) {
+        BLog(BLOG_ERROR, "failed to allocate send batch");
+        return 0;
+    }
+    
+    send_init_rest(o);
+    
+    return 1;
+}
+
 void BDatagram_SendAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -815,6 +1720,12 @@ void BDatagram_SendAsync_Free (BDatagram *o)
     // free interface
     PacketPassInterface_Free(&o->send.iface);
     
+    // free flush job
+    BPending_Free(&o->send.flush_job);
+    
+    // free batch, dropping any queued packets
+    batch_free(&o->send.batch);
+    
     // set not inited
     o->send.inited = 0;
 }
@@ -827,15 +1738,137 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o)
     return &o->send.iface;
 }
 
-void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
+int BDatagram_SetPathMtuProbe (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(enable == 0 || enable == 1)
+    
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    switch (o->family) {
+        case BADDR_TYPE_IPV4: {
+            int val = (enable ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT);
+            if (setsockopt(o->fd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0) {
+                return 0;
+            }
+        } break;
+        
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+        case BADDR_TYPE_IPV6: {
+            int val = (enable ? IPV6_PMTUDISC_PROBE : IPV6_PMTUDISC_WANT);
+            if (setsockopt(o->fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val, sizeof(val)) < 0) {
+                return 0;
+            }
+        } break;
+#endif
+        
+        default:
+            return !enable;
+    }
+    
+    return 1;
+#else
+    return !enable;
+#endif
+}
+
+int BDatagram_SetAutoConnect (BDatagram *o, int enable)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    ASSERT(!o->recv.inited)
-    ASSERT(mtu >= 0)
+    ASSERT(enable == 0 || enable == 1)
     
-    // init arguments
-    o->recv.mtu = mtu;
+    if (!enable) {
+        if (o->send.connected) {
+            disconnect(o);
+        }
+        o->send.auto_connect = 0;
+        return 1;
+    }
+    
+    if (o->family != BADDR_TYPE_IPV4 && o->family != BADDR_TYPE_IPV6) {
+        return 0;
+    }
+    
+    if (o->send.auto_connect) {
+        return 1;
+    }
+    
+    // bind to an ephemeral port if not bound yet
+    BAddr addr;
+    if (!BDatagram_GetLocalAddr(o, &addr)) {
+        return 0;
+    }
+    if (BAddr_GetPort(&addr) == 0) {
+        BIPAddr any;
+        if (o->family == BADDR_TYPE_IPV4) {
+            BIPAddr_InitIPv4(&any, 0);
+        } else {
+            uint8_t zero[16] = {0};
+            BIPAddr_InitIPv6(&any, zero);
+        }
+        BAddr_InitFromIpaddrAndPort(&addr, any, 0);
+        if (!BDatagram_Bind(o, addr) || !BDatagram_GetLocalAddr(o, &addr)) {
+            return 0;
+        }
+    }
+    
+    // Linux releases a port which was not bound explicitly when the socket
+    // is disconnected; if that happens, bind to the port explicitly so that
+    // later disconnects keep it
+    o->send.connected = 1;
+    disconnect(o);
+    BAddr new_addr;
+    if (!BDatagram_GetLocalAddr(o, &new_addr)) {
+        return 0;
+    }
+    if (BAddr_GetPort(&new_addr) == 0 && !BDatagram_Bind(o, addr)) {
+        return 0;
+    }
+    
+    o->send.auto_connect = 1;
+    return 1;
+}
+
+int BDatagram_SendAsync_SetGSO (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send.inited)
+    ASSERT(enable == 0 || enable == 1)
+    
+    if (!enable) {
+        o->send.gso = 0;
+        return 1;
+    }
+    
+#ifdef BADVPN_USE_UDP_GSO
+    // segments are only collected from the send queue
+    if (o->send.batch.size == 0) {
+        return 0;
+    }
+    
+    // check that the socket supports segmentation
+    int size;
+    socklen_t size_len = sizeof(size);
+    if (getsockopt(o->fd, IPPROTO_UDP, UDP_SEGMENT, &size, &size_len) < 0) {
+        return 0;
+    }
+    
+    o->send.gso = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void recv_init_rest (BDatagram *o)
+{
+    // set GRO disabled
+    o->recv.gro_buf = NULL;
+    
+#ifdef BADVPN_USE_AF_XDP
+    // set no AF_XDP
+    o->recv.have_xdp = 0;
+#endif
     
     // init interface
     PacketRecvInterface_Init(&o->recv.iface, o->recv.mtu, (PacketRecvInterface_handler_recv)recv_if_handler_recv, o, BReactor_PendingGroup(o->reactor));
@@ -850,6 +1883,44 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     o->recv.inited = 1;
 }
 
+void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->recv.inited)
+    ASSERT(mtu >= 0)
+    
+    // init arguments
+    o->recv.mtu = mtu;
+    
+    // init batch, which cannot fail without batching
+    batch_init_single(&o->recv.batch);
+    
+    recv_init_rest(o);
+}
+
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->recv.inited)
+    ASSERT(mtu >= 0)
+    ASSERT(batch >= 1)
+    
+    // init arguments
+    o->recv.mtu = mtu;
+    
+    // init batch
+    if (!batch_init(&o->recv.batch, batch, mtu)) {
+        BLog(BLOG_ERROR, "failed to allocate receive batch");
+        return 0;
+    }
+    
+    recv_init_rest(o);
+    
+    return 1;
+}
+
 void BDatagram_RecvAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -865,6 +1936,21 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
     // free interface
     PacketRecvInterface_Free(&o->recv.iface);
     
+    // free GRO buffer, dropping any queued segments
+    if (o->recv.gro_buf) {
+        BFree(o->recv.gro_buf);
+    }
+    
+#ifdef BADVPN_USE_AF_XDP
+    // stop receiving through AF_XDP, dropping any queued datagrams
+    if (o->recv.have_xdp) {
+        BXdpSocketPort_Free(&o->recv.xdp_port);
+    }
+#endif
+    
+    // free batch, dropping any queued datagrams
+    batch_free(&o->recv.batch);
+    
     // set not inited
     o->recv.inited = 0;
 }
@@ -876,3 +1962,98 @@ PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
     
     return &o->recv.iface;
 }
+
+void BDatagram_RecvAsync_SetLimit (BDatagram *o, int limit)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    ASSERT(limit > 0)
+    
+    BReactorLimit_SetLimit(&o->recv.limit, limit);
+}
+
+int BDatagram_RecvAsync_SetGRO (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    ASSERT(!o->recv.busy)
+    ASSERT(enable == 0 || enable == 1)
+    
+#ifdef BADVPN_USE_UDP_GSO
+    if (enable && !o->recv.gro_buf) {
+        // allocate buffer for coalesced datagrams
+        if (!(o->recv.gro_buf = (uint8_t *)BAlloc(BDATAGRAM_GRO_BUF_SIZE))) {
+            BLog(BLOG_ERROR, "failed to allocate GRO buffer");
+            return 0;
+        }
+        
+        // enable GRO
+        if (setsockopt(o->fd, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable)) < 0) {
+            BFree(o->recv.gro_buf);
+            o->recv.gro_buf = NULL;
+            return 0;
+        }
+        
+        // set have no segments
+        o->recv.gro_len = -1;
+    }
+    else if (!enable && o->recv.gro_buf) {
+        // disable GRO
+        if (setsockopt(o->fd, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(UDP_GRO) failed");
+        }
+        
+        // free buffer, dropping any queued segments
+        BFree(o->recv.gro_buf);
+        o->recv.gro_buf = NULL;
+    }
+    
+    return 1;
+#else
+    return !enable;
+#endif
+}
+
+#ifdef BADVPN_USE_AF_XDP
+
+int BDatagram_RecvAsync_SetXdp (BDatagram *o, BXdpSocket *xsk)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(!o->recv.have_xdp)
+    ASSERT(o->family == BADDR_TYPE_IPV4 || o->family == BADDR_TYPE_IPV6)
+    
+    // get local port
+    BAddr addr;
+    if (!BDatagram_GetLocalAddr(o, &addr)) {
+        return 0;
+    }
+    
+    // bind to an ephemeral port if not bound yet
+    if (BAddr_GetPort(&addr) == 0) {
+        BIPAddr any;
+        if (o->family == BADDR_TYPE_IPV4) {
+            BIPAddr_InitIPv4(&any, 0);
+        } else {
+            uint8_t zero[16] = {0};
+            BIPAddr_InitIPv6(&any, zero);
+        }
+        BAddr_InitFromIpaddrAndPort(&addr, any, 0);
+        if (!BDatagram_Bind(o, addr) || !BDatagram_GetLocalAddr(o, &addr)) {
+            return 0;
+        }
+    }
+    
+    // register port
+    if (!BXdpSocketPort_Init(&o->recv.xdp_port, xsk, o->family, BAddr_GetPort(&addr), BDATAGRAM_XDP_QUEUE_LEN, (BXdpSocketPort_handler)xdp_port_handler, o)) {
+        return 0;
+    }
+    
+    // set have AF_XDP
+    o->recv.have_xdp = 1;
+    
+    return 1;
+}
+
+#endif
@@ -32,11 +32,32 @@
 
 #define BDATAGRAM_SEND_LIMIT 2
 #define BDATAGRAM_RECV_LIMIT 2
+#define BDATAGRAM_GSO_MAX_SEGMENTS 64
+#define BDATAGRAM_GSO_MAX_BYTES 65000
+#define BDATAGRAM_GRO_BUF_SIZE 65535
+#define BDATAGRAM_XDP_QUEUE_LEN 64
+
+struct BDatagram_batch_slot {
+    int len;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    int connected;
+};
+
+struct BDatagram_batch {
+    int size;
+    uint8_t *bufs;
+    struct BDatagram_batch_slot *slots;
+    void *msgs;
+    int start;
+    int used;
+};
 
 struct BDatagram_s {
     BReactor *reactor;
     void *user;
     BDatagram_handler handler;
+    int family;
     int fd;
     BFileDescriptor bfd;
     int wait_events;
@@ -52,6 +73,11 @@ struct BDatagram_s {
         int busy;
         const uint8_t *busy_data;
         int busy_data_len;
+        struct BDatagram_batch batch;
+        BPending flush_job;
+        int gso;
+        int auto_connect;
+        int connected;
     } send;
     struct {
         BReactorLimit limit;
@@ -65,6 +91,15 @@ struct BDatagram_s {
         BPending job;
         int busy;
         uint8_t *busy_data;
+        struct BDatagram_batch batch;
+        uint8_t *gro_buf;
+        int gro_len;
+        int gro_pos;
+        int gro_seg;
+#ifdef BADVPN_USE_AF_XDP
+        int have_xdp;
+        BXdpSocketPort xdp_port;
+#endif
     } recv;
     DebugError d_err;
     DebugObject d_obj;
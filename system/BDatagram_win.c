@@ -29,12 +29,17 @@
 
 #include <stdlib.h>
 
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include "BDatagram.h"
 
 #include <generated/blog_channel_BDatagram.h>
 
+#define POSTED_STATE_IDLE 0
+#define POSTED_STATE_PENDING 1
+#define POSTED_STATE_DONE 2
+
 static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct BDatagram_sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct BDatagram_sys_addr addr);
@@ -49,6 +54,11 @@ static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len);
 static void recv_if_handler_recv (BDatagram *o, uint8_t *data);
 static void send_olap_handler (BDatagram *o, int event, DWORD bytes);
 static void recv_olap_handler (BDatagram *o, int event, DWORD bytes);
+static void set_recv_addrs (BDatagram *o, struct BDatagram_sys_addr *sysaddr, WSAMSG *msg);
+static int recv_busy (BDatagram *o);
+static int post_recvs (BDatagram *o);
+static void deliver_posted (BDatagram *o);
+static void posted_olap_handler (struct BDatagram_win_recv *r, int event, DWORD bytes);
 
 static int family_socket_to_sys (int family)
 {
@@ -140,7 +150,7 @@ static void datagram_abort (BDatagram *o)
     ASSERT(!o->aborted)
     
     // cancel I/O
-    if ((o->recv.inited && o->recv.data_have && o->recv.data_busy) || (o->send.inited && o->send.data_len >= 0 && o->send.data_busy)) {
+    if (recv_busy(o) || (o->send.inited && o->send.data_len >= 0 && o->send.data_busy)) {
         if (!CancelIo((HANDLE)o->sock)) {
             BLog(BLOG_ERROR, "CancelIo failed");
         }
@@ -156,6 +166,17 @@ static void datagram_abort (BDatagram *o)
         BReactorIOCPOverlapped_Wait(&o->recv.olap, NULL, NULL);
     }
     
+    // wait for posted receives to complete
+    if (o->recv.inited && o->recv.batch > 1) {
+        for (int i = 0; i < o->recv.batch; i++) {
+            struct BDatagram_win_recv *r = &o->recv.posted[i];
+            if (r->state == POSTED_STATE_PENDING) {
+                BReactorIOCPOverlapped_Wait(&r->olap, NULL, NULL);
+                r->state = POSTED_STATE_IDLE;
+            }
+        }
+    }
+    
     // wait for sending to complete
     if (o->send.inited && o->send.data_len >= 0 && o->send.data_busy) {
         BReactorIOCPOverlapped_Wait(&o->send.olap, NULL, NULL);
@@ -257,6 +278,12 @@ static void start_recv (BDatagram *o)
     ASSERT(!o->recv.data_busy)
     ASSERT(o->recv.started)
     
+    // with posted receives, hand out a completed one
+    if (o->recv.batch > 1) {
+        deliver_posted(o);
+        return;
+    }
+    
     WSABUF buf;
     buf.buf = (char *)o->recv.data;
     buf.len = (o->recv.mtu > ULONG_MAX ? ULONG_MAX : o->recv.mtu);
@@ -317,10 +344,20 @@ static void recv_job_handler (BDatagram *o)
     DebugError_AssertNoError(&o->d_err);
     ASSERT(!o->aborted)
     ASSERT(o->recv.inited)
-    ASSERT(o->recv.data_have)
+    ASSERT(o->recv.data_have || o->recv.batch > 1)
     ASSERT(!o->recv.data_busy)
     ASSERT(o->recv.started)
     
+    // with posted receives, receiving has just started
+    if (o->recv.batch > 1) {
+        if (!post_recvs(o)) {
+            report_error(o);
+            return;
+        }
+        deliver_posted(o);
+        return;
+    }
+    
     // recv
     start_recv(o);
     return;
@@ -404,8 +441,8 @@ static void send_olap_handler (BDatagram *o, int event, DWORD bytes)
         // set recv started
         o->recv.started = 1;
         
-        // continue receiving
-        if (o->recv.inited && o->recv.data_have) {
+        // continue receiving, or start posting receives
+        if (o->recv.inited && (o->recv.data_have || o->recv.batch > 1)) {
             ASSERT(!o->recv.data_busy)
             
             BPending_Set(&o->recv.job);
@@ -441,17 +478,29 @@ static void recv_olap_handler (BDatagram *o, int event, DWORD bytes)
     ASSERT(bytes >= 0)
     ASSERT(bytes <= o->recv.mtu)
     
+    // read addresses
+    set_recv_addrs(o, &o->recv.sysaddr, &o->recv.msg);
+    
+    // set no data
+    o->recv.data_have = 0;
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+static void set_recv_addrs (BDatagram *o, struct BDatagram_sys_addr *sysaddr, WSAMSG *msg)
+{
     if (o->fnWSARecvMsg) {
-        o->recv.sysaddr.len = o->recv.msg.namelen;
+        sysaddr->len = msg->namelen;
     }
     
     // read remote address
-    addr_sys_to_socket(&o->recv.remote_addr, o->recv.sysaddr);
+    addr_sys_to_socket(&o->recv.remote_addr, *sysaddr);
     
     // read local address
     BIPAddr_InitInvalid(&o->recv.local_addr);
     if (o->fnWSARecvMsg) {
-        for (WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&o->recv.msg); cmsg; cmsg = WSA_CMSG_NXTHDR(&o->recv.msg, cmsg)) {
+        for (WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(msg); cmsg; cmsg = WSA_CMSG_NXTHDR(msg, cmsg)) {
             if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
                 struct in_pktinfo *pktinfo = (struct in_pktinfo *)WSA_CMSG_DATA(cmsg);
                 BIPAddr_InitIPv4(&o->recv.local_addr, pktinfo->ipi_addr.s_addr);
@@ -465,6 +514,116 @@ static void recv_olap_handler (BDatagram *o, int event, DWORD bytes)
     
     // set have addresses
     o->recv.have_addrs = 1;
+}
+
+static int recv_busy (BDatagram *o)
+{
+    if (!o->recv.inited) {
+        return 0;
+    }
+    
+    if (o->recv.batch > 1) {
+        for (int i = 0; i < o->recv.batch; i++) {
+            if (o->recv.posted[i].state == POSTED_STATE_PENDING) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    
+    return (o->recv.data_have && o->recv.data_busy);
+}
+
+static int post_recvs (BDatagram *o)
+{
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.batch > 1)
+    ASSERT(o->recv.started)
+    
+    // returns 1 on success, 0 on fatal error
+    
+    while (o->recv.posted_used < o->recv.batch) {
+        struct BDatagram_win_recv *r = &o->recv.posted[(o->recv.posted_start + o->recv.posted_used) % o->recv.batch];
+        ASSERT(r->state == POSTED_STATE_IDLE)
+        
+        r->wsabuf.buf = (char *)r->buf;
+        r->wsabuf.len = (o->recv.mtu > ULONG_MAX ? ULONG_MAX : o->recv.mtu);
+        
+        memset(&r->olap.olap, 0, sizeof(r->olap.olap));
+        
+        // the message and address must stay valid until the receive completes
+        if (o->fnWSARecvMsg) {
+            r->msg.name = &r->sysaddr.addr.generic;
+            r->msg.namelen = sizeof(r->sysaddr.addr);
+            r->msg.lpBuffers = &r->wsabuf;
+            r->msg.dwBufferCount = 1;
+            r->msg.Control.buf = (char *)&r->cdata;
+            r->msg.Control.len = sizeof(r->cdata);
+            r->msg.dwFlags = 0;
+            
+            int res = o->fnWSARecvMsg(o->sock, &r->msg, NULL, &r->olap.olap, NULL);
+            if (res == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+                BLog(BLOG_ERROR, "WSARecvMsg failed (%d)", WSAGetLastError());
+                return 0;
+            }
+        } else {
+            r->sysaddr.len = sizeof(r->sysaddr.addr);
+            r->flags = 0;
+            
+            int res = WSARecvFrom(o->sock, &r->wsabuf, 1, NULL, &r->flags, &r->sysaddr.addr.generic, &r->sysaddr.len, &r->olap.olap, NULL);
+            if (res == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+                BLog(BLOG_ERROR, "WSARecvFrom failed (%d)", WSAGetLastError());
+                return 0;
+            }
+        }
+        
+        r->state = POSTED_STATE_PENDING;
+        o->recv.posted_used++;
+    }
+    
+    return 1;
+}
+
+static void deliver_posted (BDatagram *o)
+{
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.batch > 1)
+    
+    // datagrams are handed out in the order the receives were posted
+    if (!o->recv.data_have || !o->recv.started || o->recv.posted_used == 0) {
+        return;
+    }
+    
+    struct BDatagram_win_recv *r = &o->recv.posted[o->recv.posted_start];
+    if (r->state != POSTED_STATE_DONE) {
+        return;
+    }
+    
+    r->state = POSTED_STATE_IDLE;
+    o->recv.posted_start = (o->recv.posted_start + 1) % o->recv.batch;
+    o->recv.posted_used--;
+    
+    if (!r->succeeded) {
+        BLog(BLOG_ERROR, "receiving failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(r->bytes <= o->recv.mtu)
+    
+    int bytes = r->bytes;
+    memcpy(o->recv.data, r->buf, bytes);
+    
+    // read addresses
+    set_recv_addrs(o, &r->sysaddr, &r->msg);
+    
+    // keep the receives posted
+    if (!post_recvs(o)) {
+        report_error(o);
+        return;
+    }
     
     // set no data
     o->recv.data_have = 0;
@@ -473,6 +632,23 @@ static void recv_olap_handler (BDatagram *o, int event, DWORD bytes)
     PacketRecvInterface_Done(&o->recv.iface, bytes);
 }
 
+static void posted_olap_handler (struct BDatagram_win_recv *r, int event, DWORD bytes)
+{
+    BDatagram *o = r->parent;
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.inited)
+    ASSERT(r->state == POSTED_STATE_PENDING)
+    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    
+    r->state = POSTED_STATE_DONE;
+    r->succeeded = (event == BREACTOR_IOCP_EVENT_SUCCEEDED);
+    r->bytes = bytes;
+    
+    deliver_posted(o);
+}
+
 int BDatagram_AddressFamilySupported (int family)
 {
     return (family == BADDR_TYPE_IPV4 || family == BADDR_TYPE_IPV6);
@@ -556,6 +732,17 @@ fail0:
     return 0;
 }
 
+int BDatagram_InitIcmp (BDatagram *o, int family, BReactor *reactor, void *user,
+                        BDatagram_handler handler)
+{
+    ASSERT(family == BADDR_TYPE_IPV4 || family == BADDR_TYPE_IPV6)
+    ASSERT(handler)
+    BNetwork_Assert();
+    
+    BLog(BLOG_ERROR, "ICMP sockets are not supported");
+    return 0;
+}
+
 void BDatagram_Free (BDatagram *o)
 {
     DebugObject_Free(&o->d_obj);
@@ -590,8 +777,8 @@ int BDatagram_Bind (BDatagram *o, BAddr addr)
         // set recv started
         o->recv.started = 1;
         
-        // continue receiving
-        if (o->recv.inited && o->recv.data_have) {
+        // continue receiving, or start posting receives
+        if (o->recv.inited && (o->recv.data_have || o->recv.batch > 1)) {
             ASSERT(!o->recv.data_busy)
             
             BPending_Set(&o->recv.job);
@@ -716,6 +903,14 @@ void BDatagram_SendAsync_Free (BDatagram *o)
     o->send.inited = 0;
 }
 
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    ASSERT(batch >= 1)
+    
+    BDatagram_SendAsync_Init(o, mtu);
+    return 1;
+}
+
 PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -724,6 +919,31 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o)
     return &o->send.iface;
 }
 
+int BDatagram_SetPathMtuProbe (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(enable == 0 || enable == 1)
+    
+    return !enable;
+}
+
+int BDatagram_SetAutoConnect (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(enable == 0 || enable == 1)
+    
+    return !enable;
+}
+
+int BDatagram_SendAsync_SetGSO (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send.inited)
+    ASSERT(enable == 0 || enable == 1)
+    
+    return !enable;
+}
+
 void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -744,6 +964,9 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     // set have no data
     o->recv.data_have = 0;
     
+    // set not posting receives
+    o->recv.batch = 0;
+    
     // set inited
     o->recv.inited = 1;
 }
@@ -754,10 +977,21 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
     ASSERT(o->recv.inited)
     
     // abort if busy
-    if (o->recv.data_have && o->recv.data_busy && !o->aborted) {
+    if (recv_busy(o) && !o->aborted) {
         datagram_abort(o);
     }
     
+    // free posted receives
+    if (o->recv.batch > 1) {
+        for (int i = 0; i < o->recv.batch; i++) {
+            struct BDatagram_win_recv *r = &o->recv.posted[i];
+            ASSERT(r->state != POSTED_STATE_PENDING)
+            BReactorIOCPOverlapped_Free(&r->olap);
+            BFree(r->buf);
+        }
+        BFree(o->recv.posted);
+    }
+    
     // free job
     BPending_Free(&o->recv.job);
     
@@ -768,6 +1002,58 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
     o->recv.inited = 0;
 }
 
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    ASSERT(batch >= 1)
+    
+    BDatagram_RecvAsync_Init(o, mtu);
+    
+    if (batch <= 1) {
+        return 1;
+    }
+    
+    // allocate posted receives
+    if (!(o->recv.posted = (struct BDatagram_win_recv *)BAllocArray(batch, sizeof(o->recv.posted[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    int i;
+    for (i = 0; i < batch; i++) {
+        struct BDatagram_win_recv *r = &o->recv.posted[i];
+        
+        if (!(r->buf = (uint8_t *)BAlloc(mtu > 0 ? mtu : 1))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            goto fail1;
+        }
+        
+        r->parent = o;
+        r->state = POSTED_STATE_IDLE;
+        BReactorIOCPOverlapped_Init(&r->olap, o->reactor, r, (BReactorIOCPOverlapped_handler)posted_olap_handler);
+    }
+    
+    o->recv.batch = batch;
+    o->recv.posted_start = 0;
+    o->recv.posted_used = 0;
+    
+    // start posting receives, if receiving has started already
+    if (o->recv.started) {
+        BPending_Set(&o->recv.job);
+    }
+    
+    return 1;
+    
+fail1:
+    while (i-- > 0) {
+        BReactorIOCPOverlapped_Free(&o->recv.posted[i].olap);
+        BFree(o->recv.posted[i].buf);
+    }
+    BFree(o->recv.posted);
+fail0:
+    BDatagram_RecvAsync_Free(o);
+    return 0;
+}
+
 PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -775,3 +1061,19 @@ PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
     
     return &o->recv.iface;
 }
+
+void BDatagram_RecvAsync_SetLimit (BDatagram *o, int limit)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    ASSERT(limit > 0)
+}
+
+int BDatagram_RecvAsync_SetGRO (BDatagram *o, int enable)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    ASSERT(enable == 0 || enable == 1)
+    
+    return !enable;
+}
@@ -47,6 +47,25 @@ struct BDatagram_sys_addr {
     } addr;
 };
 
+struct BDatagram_s;
+
+struct BDatagram_win_recv {
+    struct BDatagram_s *parent;
+    BReactorIOCPOverlapped olap;
+    uint8_t *buf;
+    int state;
+    int succeeded;
+    DWORD bytes;
+    struct BDatagram_sys_addr sysaddr;
+    union {
+        char in[WSA_CMSG_SPACE(sizeof(struct in_pktinfo))];
+        char in6[WSA_CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    } cdata;
+    WSABUF wsabuf;
+    DWORD flags;
+    WSAMSG msg;
+};
+
 struct BDatagram_s {
     BReactor *reactor;
     void *user;
@@ -93,6 +112,10 @@ struct BDatagram_s {
             char in6[WSA_CMSG_SPACE(sizeof(struct in6_pktinfo))];
         } cdata;
         WSAMSG msg;
+        int batch;
+        struct BDatagram_win_recv *posted;
+        int posted_start;
+        int posted_used;
     } recv;
     DebugError d_err;
     DebugObject d_obj;
@@ -0,0 +1,208 @@
+/**
+ * @file BFlowAddr.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compact IP address and port, for use as a key in flow tables.
+ */
+
+#ifndef BADVPN_SYSTEM_BFLOWADDR_H
+#define BADVPN_SYSTEM_BFLOWADDR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/compare.h>
+#include <system/BAddr.h>
+
+/**
+ * An IPv4 or IPv6 address and port in 20 bytes.
+ * 
+ * Unlike {@link BAddr}, every bit is significant: an IPv4 address occupies the
+ * first four bytes of ip, and the remaining bytes as well as reserved are zero.
+ * This lets {@link BFlowAddr_Equal}, {@link BFlowAddr_CompareOrder} and
+ * {@link BFlowAddr_Hash} work on the raw words without looking at the type.
+ */
+typedef struct {
+    uint8_t type; // BADDR_TYPE_NONE, BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6
+    uint8_t reserved;
+    uint16_t port; // network byte order
+    uint8_t ip[16];
+} BFlowAddr;
+
+/**
+ * Converts an address to the compact form.
+ * 
+ * @param addr address; must be BADDR_TYPE_NONE, BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6
+ * @return compact address
+ */
+static BFlowAddr BFlowAddr_FromBAddr (const BAddr *addr);
+
+/**
+ * Converts a compact address back to a {@link BAddr}.
+ * 
+ * @param fa compact address
+ * @return address
+ */
+static BAddr BFlowAddr_ToBAddr (const BFlowAddr *fa);
+
+/**
+ * Checks if two compact addresses are equal.
+ * Agrees with {@link BAddr_Compare} on the addresses they were made from.
+ * 
+ * @return 1 if equal, 0 if not
+ */
+static int BFlowAddr_Equal (const BFlowAddr *fa1, const BFlowAddr *fa2);
+
+/**
+ * Compares two compact addresses for ordering.
+ * This is a total order consistent with {@link BFlowAddr_Equal}, suitable for
+ * search trees, but addresses are not ordered numerically and the order
+ * depends on the byte order of the host.
+ * 
+ * @return -1, 0 or 1
+ */
+static int BFlowAddr_CompareOrder (const BFlowAddr *fa1, const BFlowAddr *fa2);
+
+/**
+ * Computes a hash of a compact address.
+ * Addresses equal according to {@link BFlowAddr_Equal} have equal hashes.
+ */
+static size_t BFlowAddr_Hash (const BFlowAddr *fa);
+
+/**
+ * Computes a hash of a pair of compact addresses, such as the
+ * local and remote address of a flow.
+ */
+static size_t BFlowAddr_HashPair (const BFlowAddr *fa1, const BFlowAddr *fa2);
+
+struct BFlowAddr__words {
+    uint64_t w0;
+    uint64_t w1;
+    uint32_t w2;
+};
+
+static struct BFlowAddr__words BFlowAddr__load (const BFlowAddr *fa)
+{
+    struct BFlowAddr__words w;
+    memcpy(&w.w0, (const uint8_t *)fa, 8);
+    memcpy(&w.w1, (const uint8_t *)fa + 8, 8);
+    memcpy(&w.w2, (const uint8_t *)fa + 16, 4);
+    return w;
+}
+
+static uint64_t BFlowAddr__hash_mix (uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * UINT64_C(0x9E3779B97F4A7C15);
+    return h ^ (h >> 32);
+}
+
+static uint64_t BFlowAddr__hash (uint64_t h, const BFlowAddr *fa)
+{
+    struct BFlowAddr__words w = BFlowAddr__load(fa);
+    
+    h = BFlowAddr__hash_mix(h, w.w0);
+    h = BFlowAddr__hash_mix(h, w.w1);
+    h = BFlowAddr__hash_mix(h, w.w2);
+    
+    return h;
+}
+
+BFlowAddr BFlowAddr_FromBAddr (const BAddr *addr)
+{
+    ASSERT(addr->type == BADDR_TYPE_NONE || addr->type == BADDR_TYPE_IPV4 || addr->type == BADDR_TYPE_IPV6)
+    
+    BFlowAddr fa;
+    memset(&fa, 0, sizeof(fa));
+    fa.type = addr->type;
+    
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4:
+            fa.port = addr->ipv4.port;
+            memcpy(fa.ip, &addr->ipv4.ip, sizeof(addr->ipv4.ip));
+            break;
+        case BADDR_TYPE_IPV6:
+            fa.port = addr->ipv6.port;
+            memcpy(fa.ip, addr->ipv6.ip, sizeof(addr->ipv6.ip));
+            break;
+    }
+    
+    return fa;
+}
+
+BAddr BFlowAddr_ToBAddr (const BFlowAddr *fa)
+{
+    switch (fa->type) {
+        case BADDR_TYPE_IPV4: {
+            uint32_t ip;
+            memcpy(&ip, fa->ip, sizeof(ip));
+            return BAddr_MakeIPv4(ip, fa->port);
+        } break;
+        case BADDR_TYPE_IPV6: {
+            return BAddr_MakeIPv6(fa->ip, fa->port);
+        } break;
+        default: {
+            return BAddr_MakeNone();
+        } break;
+    }
+}
+
+int BFlowAddr_Equal (const BFlowAddr *fa1, const BFlowAddr *fa2)
+{
+    struct BFlowAddr__words a = BFlowAddr__load(fa1);
+    struct BFlowAddr__words b = BFlowAddr__load(fa2);
+    
+    return !((a.w0 ^ b.w0) | (a.w1 ^ b.w1) | (a.w2 ^ b.w2));
+}
+
+int BFlowAddr_CompareOrder (const BFlowAddr *fa1, const BFlowAddr *fa2)
+{
+    struct BFlowAddr__words a = BFlowAddr__load(fa1);
+    struct BFlowAddr__words b = BFlowAddr__load(fa2);
+    
+    // the first differing word decides; the results are combined without branching
+    int cmp = B_COMPARE(a.w0, b.w0);
+    cmp += (cmp == 0) * B_COMPARE(a.w1, b.w1);
+    cmp += (cmp == 0) * B_COMPARE(a.w2, b.w2);
+    
+    return cmp;
+}
+
+size_t BFlowAddr_Hash (const BFlowAddr *fa)
+{
+    return BFlowAddr__hash(0, fa);
+}
+
+size_t BFlowAddr_HashPair (const BFlowAddr *fa1, const BFlowAddr *fa2)
+{
+    return BFlowAddr__hash(BFlowAddr__hash(0, fa1), fa2);
+}
+
+#endif
@@ -0,0 +1,469 @@
+/**
+ * @file BListenerHandoff.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <misc/nonblocking.h>
+#include <misc/strdup.h>
+#include <base/BLog.h>
+
+#include "BListenerHandoff.h"
+
+#include <generated/blog_channel_BListenerHandoff.h>
+
+static int build_address (struct sockaddr_un *out, const char *socket_path)
+{
+    if (strlen(socket_path) >= sizeof(out->sun_path)) {
+        BLog(BLOG_ERROR, "socket path too long");
+        return 0;
+    }
+    
+    memset(out, 0, sizeof(*out));
+    out->sun_family = AF_UNIX;
+    strcpy(out->sun_path, socket_path);
+    
+    return 1;
+}
+
+static void set_timeout (int fd, int optname)
+{
+    struct timeval tv;
+    tv.tv_sec = BLISTENERHANDOFF_TIMEOUT / 1000;
+    tv.tv_usec = (BLISTENERHANDOFF_TIMEOUT % 1000) * 1000;
+    if (setsockopt(fd, SOL_SOCKET, optname, &tv, sizeof(tv)) < 0) {
+        BLog(BLOG_WARNING, "setsockopt(timeout) failed");
+    }
+}
+
+static int is_listening_stream (int fd)
+{
+    int type;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM) {
+        return 0;
+    }
+    
+#ifdef SO_ACCEPTCONN
+    int listening;
+    len = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening) {
+        return 0;
+    }
+#endif
+    
+    return 1;
+}
+
+static int take_fd (int *fds, int *num_fds, int i)
+{
+    int fd = fds[i];
+    fds[i] = fds[*num_fds - 1];
+    (*num_fds)--;
+    return fd;
+}
+
+static void fd_handler (BListenerHandoff *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->con_fd < 0)
+    
+    int fd = accept(o->fd, NULL, NULL);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            BLog(BLOG_ERROR, "accept failed");
+        }
+        return;
+    }
+    
+    // sending blocks, but not for long; on some systems the accepted socket
+    // inherits non-blocking mode
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        BLog(BLOG_ERROR, "fcntl failed");
+        if (close(fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+        return;
+    }
+    set_timeout(fd, SO_SNDTIMEO);
+    
+    // only one process takes over
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    o->con_fd = fd;
+    
+    BLog(BLOG_NOTICE, "new process connected");
+    
+    // call handler
+    o->handler(o->user);
+}
+
+int BListenerHandoff_Init (BListenerHandoff *o, const char *socket_path, BReactor *reactor, void *user,
+                           BListenerHandoff_handler handler)
+{
+    ASSERT(socket_path)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->user = user;
+    o->handler = handler;
+    
+    // remember path, to remove the socket
+    if (!(o->socket_path = b_strdup(socket_path))) {
+        BLog(BLOG_ERROR, "b_strdup failed");
+        goto fail0;
+    }
+    
+    struct sockaddr_un addr;
+    if (!build_address(&addr, socket_path)) {
+        goto fail1;
+    }
+    
+    // init socket
+    if ((o->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        BLog(BLOG_ERROR, "socket failed");
+        goto fail1;
+    }
+    
+    // set non-blocking
+    if (!badvpn_set_nonblocking(o->fd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        goto fail2;
+    }
+    
+    // replace socket of a previous process
+    if (unlink(socket_path) < 0 && errno != ENOENT) {
+        BLog(BLOG_ERROR, "unlink existing socket failed");
+        goto fail2;
+    }
+    
+    // bind and listen
+    if (bind(o->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        BLog(BLOG_ERROR, "bind failed");
+        goto fail2;
+    }
+    if (listen(o->fd, 1) < 0) {
+        BLog(BLOG_ERROR, "listen failed");
+        goto fail3;
+    }
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail3;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    // no process connected
+    o->con_fd = -1;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail3:
+    if (unlink(o->socket_path) < 0) {
+        BLog(BLOG_ERROR, "unlink socket failed");
+    }
+fail2:
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail1:
+    free(o->socket_path);
+fail0:
+    return 0;
+}
+
+void BListenerHandoff_Free (BListenerHandoff *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free BFileDescriptor
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    
+    // free socket
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    // remove the socket file before letting the new process go on, since it
+    // will then create its own
+    if (unlink(o->socket_path) < 0) {
+        BLog(BLOG_ERROR, "unlink socket failed");
+    }
+    free(o->socket_path);
+    
+    // close connection to new process
+    if (o->con_fd >= 0) {
+        if (close(o->con_fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+    }
+}
+
+int BListenerHandoff_Send (BListenerHandoff *o, const int *fds, int num_fds)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->con_fd >= 0)
+    ASSERT(num_fds >= 0)
+    ASSERT(num_fds <= BLISTENERHANDOFF_MAX_FDS)
+    
+    // one byte of data carries the sockets
+    uint8_t byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = sizeof(byte);
+    
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(BLISTENERHANDOFF_MAX_FDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    
+    if (num_fds > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+    
+    ssize_t res;
+    do {
+        res = sendmsg(o->con_fd, &msg, 0);
+    } while (res < 0 && errno == EINTR);
+    
+    if (res != sizeof(byte)) {
+        BLog(BLOG_ERROR, "sendmsg failed");
+        return 0;
+    }
+    
+    BLog(BLOG_NOTICE, "handed over %d sockets", num_fds);
+    
+    return 1;
+}
+
+int BListenerHandoff_Receive (const char *socket_path, int *fds, int *out_num_fds)
+{
+    ASSERT(socket_path)
+    
+    struct sockaddr_un addr;
+    if (!build_address(&addr, socket_path)) {
+        goto fail0;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        BLog(BLOG_ERROR, "socket failed");
+        goto fail0;
+    }
+    
+    // nobody to take over from, unless something serves the socket
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            BLog(BLOG_INFO, "no process to take over from");
+            *out_num_fds = 0;
+            if (close(fd) < 0) {
+                BLog(BLOG_ERROR, "close failed");
+            }
+            return 1;
+        }
+        BLog(BLOG_ERROR, "connect failed");
+        goto fail1;
+    }
+    
+    set_timeout(fd, SO_RCVTIMEO);
+    
+    // receive sockets
+    uint8_t byte;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = sizeof(byte);
+    
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(BLISTENERHANDOFF_MAX_FDS * sizeof(int))];
+    } control;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    
+    ssize_t res;
+    do {
+        res = recvmsg(fd, &msg, 0);
+    } while (res < 0 && errno == EINTR);
+    
+    if (res != sizeof(byte)) {
+        BLog(BLOG_ERROR, "recvmsg failed");
+        goto fail1;
+    }
+    
+    int num_fds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n && num_fds < BLISTENERHANDOFF_MAX_FDS; i++) {
+            memcpy(&fds[num_fds], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (fcntl(fds[num_fds], F_SETFD, FD_CLOEXEC) < 0) {
+                BLog(BLOG_WARNING, "fcntl(FD_CLOEXEC) failed");
+            }
+            num_fds++;
+        }
+    }
+    
+    if ((msg.msg_flags & MSG_CTRUNC)) {
+        BLog(BLOG_ERROR, "too many sockets");
+        goto fail2;
+    }
+    
+    // wait for the old process to stop using the sockets
+    while (1) {
+        res = recv(fd, &byte, sizeof(byte), 0);
+        if (res == 0) {
+            break;
+        }
+        if (res < 0 && errno != EINTR) {
+            BLog(BLOG_ERROR, "old process did not let go of the sockets");
+            goto fail2;
+        }
+    }
+    
+    if (close(fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    BLog(BLOG_NOTICE, "took over %d sockets", num_fds);
+    
+    *out_num_fds = num_fds;
+    return 1;
+    
+fail2:
+    BListenerHandoff_CloseFds(fds, num_fds);
+fail1:
+    if (close(fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail0:
+    return 0;
+}
+
+int BListenerHandoff_TakeAddr (int *fds, int *num_fds, BAddr addr)
+{
+    ASSERT(*num_fds >= 0)
+    
+    for (int i = 0; i < *num_fds; i++) {
+        if (!is_listening_stream(fds[i])) {
+            continue;
+        }
+        
+        struct sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        if (getsockname(fds[i], (struct sockaddr *)&ss, &len) < 0) {
+            continue;
+        }
+        
+        switch (addr.type) {
+            case BADDR_TYPE_IPV4: {
+                struct sockaddr_in *sa = (struct sockaddr_in *)&ss;
+                if (ss.ss_family == AF_INET && sa->sin_port == addr.ipv4.port && sa->sin_addr.s_addr == addr.ipv4.ip) {
+                    return take_fd(fds, num_fds, i);
+                }
+            } break;
+            
+            case BADDR_TYPE_IPV6: {
+                struct sockaddr_in6 *sa = (struct sockaddr_in6 *)&ss;
+                if (ss.ss_family == AF_INET6 && sa->sin6_port == addr.ipv6.port && !memcmp(sa->sin6_addr.s6_addr, addr.ipv6.ip, 16)) {
+                    return take_fd(fds, num_fds, i);
+                }
+            } break;
+        }
+    }
+    
+    return -1;
+}
+
+int BListenerHandoff_TakeUnix (int *fds, int *num_fds, const char *socket_path)
+{
+    ASSERT(*num_fds >= 0)
+    ASSERT(socket_path)
+    
+    for (int i = 0; i < *num_fds; i++) {
+        if (!is_listening_stream(fds[i])) {
+            continue;
+        }
+        
+        struct sockaddr_un sa;
+        socklen_t len = sizeof(sa);
+        memset(&sa, 0, sizeof(sa));
+        if (getsockname(fds[i], (struct sockaddr *)&sa, &len) < 0 || sa.sun_family != AF_UNIX) {
+            continue;
+        }
+        
+        if (len > offsetof(struct sockaddr_un, sun_path) && !strncmp(sa.sun_path, socket_path, sizeof(sa.sun_path))) {
+            return take_fd(fds, num_fds, i);
+        }
+    }
+    
+    return -1;
+}
+
+void BListenerHandoff_CloseFds (const int *fds, int num_fds)
+{
+    ASSERT(num_fds >= 0)
+    
+    for (int i = 0; i < num_fds; i++) {
+        if (close(fds[i]) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+    }
+}
@@ -0,0 +1,168 @@
+/**
+ * @file BListenerHandoff.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Passing of listening sockets from a running process to a new instance of
+ * the program, so that it can be restarted without refusing connections.
+ * 
+ * The running process serves a handoff socket (a Unix socket) with a
+ * {@link BListenerHandoff} object. The new process, before setting up its
+ * listeners, connects to it with {@link BListenerHandoff_Receive} and receives
+ * the listening sockets, which it adopts with {@link BLisCon_from_fd}. The old
+ * process then stops accepting connections and closes the handoff connection,
+ * after which the new process binds whatever was not handed over (and its own
+ * handoff socket), while the old one finishes serving its clients.
+ */
+
+#ifndef BADVPN_B_LISTENER_HANDOFF_H
+#define BADVPN_B_LISTENER_HANDOFF_H
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+
+/**
+ * Maximum number of sockets passed in a handoff.
+ */
+#define BLISTENERHANDOFF_MAX_FDS 64
+
+/**
+ * How long, in milliseconds, {@link BListenerHandoff_Receive} waits for the
+ * old process to send its sockets, and then to let go of them.
+ */
+#define BLISTENERHANDOFF_TIMEOUT 10000
+
+/**
+ * Handler called when a new process has connected to the handoff socket.
+ * The user should pass its listening sockets with {@link BListenerHandoff_Send},
+ * stop using them, and then free the object, which lets the new process
+ * proceed. If the object is not freed from the handler, it must not be
+ * used other than being freed.
+ * 
+ * @param user as in {@link BListenerHandoff_Init}
+ */
+typedef void (*BListenerHandoff_handler) (void *user);
+
+/**
+ * Object serving a handoff socket, to which a new process connects to take
+ * over listening sockets.
+ */
+typedef struct {
+    BReactor *reactor;
+    void *user;
+    BListenerHandoff_handler handler;
+    char *socket_path;
+    int fd;
+    BFileDescriptor bfd;
+    int con_fd;
+    DebugObject d_obj;
+} BListenerHandoff;
+
+/**
+ * Initializes the object, listening on a Unix socket.
+ * An existing socket file at the path is replaced.
+ * 
+ * @param o the object
+ * @param socket_path path of the handoff socket
+ * @param reactor reactor we live in
+ * @param user argument to handler
+ * @param handler handler called when a new process connects
+ * @return 1 on success, 0 on failure
+ */
+int BListenerHandoff_Init (BListenerHandoff *o, const char *socket_path, BReactor *reactor, void *user,
+                           BListenerHandoff_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the object. This removes the handoff socket, and if a new process
+ * has connected, closes the connection to it, telling it that the sockets
+ * it was sent are no longer used here.
+ * 
+ * @param o the object
+ */
+void BListenerHandoff_Free (BListenerHandoff *o);
+
+/**
+ * Sends listening sockets to the new process which has connected.
+ * May only be called from the handler, and at most once. Blocks until the
+ * sockets are sent.
+ * 
+ * @param o the object
+ * @param fds sockets to send
+ * @param num_fds number of sockets. Must be >=0 and <=BLISTENERHANDOFF_MAX_FDS.
+ * @return 1 on success, 0 on failure
+ */
+int BListenerHandoff_Send (BListenerHandoff *o, const int *fds, int num_fds) WARN_UNUSED;
+
+/**
+ * Receives listening sockets from a process serving a handoff socket, and
+ * waits until it has stopped using them. Blocks, for up to
+ * BLISTENERHANDOFF_TIMEOUT for each step.
+ * If no process serves the socket, succeeds with no sockets.
+ * The received sockets are close-on-exec.
+ * 
+ * @param socket_path path of the handoff socket
+ * @param fds array to receive the sockets into, with room for
+ *            BLISTENERHANDOFF_MAX_FDS sockets
+ * @param out_num_fds returns the number of sockets received
+ * @return 1 on success, 0 on failure
+ */
+int BListenerHandoff_Receive (const char *socket_path, int *fds, int *out_num_fds) WARN_UNUSED;
+
+/**
+ * Finds a received stream socket listening on an IP address, and removes it
+ * from the array.
+ * 
+ * @param fds received sockets
+ * @param num_fds number of received sockets, decremented if one is found
+ * @param addr address to look for
+ * @return the socket, or -1 if none listens on the address
+ */
+int BListenerHandoff_TakeAddr (int *fds, int *num_fds, BAddr addr);
+
+/**
+ * Finds a received stream socket listening on a Unix socket path, and removes
+ * it from the array.
+ * 
+ * @param fds received sockets
+ * @param num_fds number of received sockets, decremented if one is found
+ * @param socket_path path to look for
+ * @return the socket, or -1 if none listens on the path
+ */
+int BListenerHandoff_TakeUnix (int *fds, int *num_fds, const char *socket_path);
+
+/**
+ * Closes received sockets.
+ * 
+ * @param fds received sockets
+ * @param num_fds number of received sockets
+ */
+void BListenerHandoff_CloseFds (const int *fds, int num_fds);
+
+#endif
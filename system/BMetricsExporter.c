@@ -0,0 +1,469 @@
+/**
+ * @file BMetricsExporter.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include <misc/offset.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+
+#include "BMetricsExporter.h"
+
+#include <generated/blog_channel_BMetricsExporter.h>
+
+struct connection {
+    BMetricsExporter *o;
+    BConnection con;
+    BTimer timeout_timer;
+    LinkedList1Node list_node;
+    int recv_len;
+    int sending;
+    ExpString reply;
+    size_t send_pos;
+    uint8_t recv_buf[BMETRICSEXPORTER_REQUEST_SIZE];
+};
+
+static void connection_free (struct connection *c)
+{
+    BMetricsExporter *o = c->o;
+    
+    if (c->sending) {
+        ExpString_Free(&c->reply);
+    }
+    
+    BReactor_RemoveTimer(o->reactor, &c->timeout_timer);
+    BConnection_RecvAsync_Free(&c->con);
+    BConnection_SendAsync_Free(&c->con);
+    BConnection_Free(&c->con);
+    
+    LinkedList1_Remove(&o->connections, &c->list_node);
+    o->num_connections--;
+    
+    free(c);
+}
+
+static void connection_handler (struct connection *c, int event)
+{
+    // a client may shut down sending after its request, keep sending the reply
+    if (event == BCONNECTION_EVENT_RECVCLOSED && c->sending) {
+        return;
+    }
+    
+    BLog(BLOG_DEBUG, "connection %s", (event == BCONNECTION_EVENT_RECVCLOSED ? "closed" : "error"));
+    
+    connection_free(c);
+}
+
+static void connection_timeout_handler (struct connection *c)
+{
+    BLog(BLOG_DEBUG, "connection timed out");
+    
+    connection_free(c);
+}
+
+static void connection_send_more (struct connection *c)
+{
+    ASSERT(c->sending)
+    ASSERT(c->send_pos < ExpString_Length(&c->reply))
+    
+    size_t left = ExpString_Length(&c->reply) - c->send_pos;
+    int len = (left > INT_MAX ? INT_MAX : left);
+    
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&c->con), (uint8_t *)ExpString_Get(&c->reply) + c->send_pos, len);
+}
+
+static void connection_send_handler_done (struct connection *c, int data_len)
+{
+    ASSERT(c->sending)
+    
+    c->send_pos += data_len;
+    
+    if (c->send_pos < ExpString_Length(&c->reply)) {
+        connection_send_more(c);
+        return;
+    }
+    
+    // the whole reply is sent, the client will see the connection close
+    connection_free(c);
+}
+
+// Checks for the empty line ending the request headers.
+static int request_complete (const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < len && data[i + 1] == '\n') {
+            return 1;
+        }
+        if (i + 2 < len && data[i + 1] == '\r' && data[i + 2] == '\n') {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static int build_reply (struct connection *c, int is_get)
+{
+    ExpString body;
+    if (!ExpString_Init(&body)) {
+        goto fail0;
+    }
+    
+    const char *status = "200 OK";
+    
+    if (!is_get) {
+        status = "405 Method Not Allowed";
+        if (!ExpString_Append(&body, "only GET is supported\n")) {
+            goto fail1;
+        }
+    }
+    else if (!BMetrics_WritePrometheus(&body)) {
+        goto fail1;
+    }
+    
+    char length[32];
+    sprintf(length, "%zu", ExpString_Length(&body));
+    
+    if (!ExpString_Init(&c->reply)) {
+        goto fail1;
+    }
+    
+    if (!ExpString_Append(&c->reply, "HTTP/1.0 ") ||
+        !ExpString_Append(&c->reply, status) ||
+        !ExpString_Append(&c->reply, "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ") ||
+        !ExpString_Append(&c->reply, length) ||
+        !ExpString_Append(&c->reply, "\r\nConnection: close\r\n\r\n") ||
+        !ExpString_AppendBinaryMr(&c->reply, ExpString_GetMr(&body))
+    ) {
+        goto fail2;
+    }
+    
+    ExpString_Free(&body);
+    return 1;
+    
+fail2:
+    ExpString_Free(&c->reply);
+fail1:
+    ExpString_Free(&body);
+fail0:
+    return 0;
+}
+
+static void connection_recv_handler_done (struct connection *c, int data_len)
+{
+    ASSERT(!c->sending)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= sizeof(c->recv_buf) - c->recv_len)
+    
+    c->recv_len += data_len;
+    
+    // wait for the end of the request headers
+    if (!request_complete(c->recv_buf, c->recv_len)) {
+        if (c->recv_len == sizeof(c->recv_buf)) {
+            BLog(BLOG_INFO, "request too long");
+            connection_free(c);
+            return;
+        }
+        
+        StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->recv_buf + c->recv_len, sizeof(c->recv_buf) - c->recv_len);
+        return;
+    }
+    
+    // the request path is not looked at, any GET returns the metrics
+    int is_get = (c->recv_len >= 4 && !memcmp(c->recv_buf, "GET ", 4));
+    
+    if (!build_reply(c, is_get)) {
+        BLog(BLOG_ERROR, "failed to build reply");
+        connection_free(c);
+        return;
+    }
+    
+    c->sending = 1;
+    c->send_pos = 0;
+    connection_send_more(c);
+}
+
+static void listener_handler (BMetricsExporter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_listen)
+    
+    // make room by dropping the oldest connection
+    if (o->num_connections == BMETRICSEXPORTER_MAX_CONNECTIONS) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections), struct connection, list_node));
+    }
+    
+    struct connection *c = malloc(sizeof(*c));
+    if (!c) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    c->o = o;
+    
+    if (!BConnection_Init(&c->con, BConnection_source_listener(&o->listener, NULL), o->reactor, c, (BConnection_handler)connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1;
+    }
+    
+    BConnection_SendAsync_Init(&c->con);
+    BConnection_RecvAsync_Init(&c->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&c->con), (StreamPassInterface_handler_done)connection_send_handler_done, c);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&c->con), (StreamRecvInterface_handler_done)connection_recv_handler_done, c);
+    
+    BTimer_Init(&c->timeout_timer, BMETRICSEXPORTER_CONNECTION_TIMEOUT, (BTimer_handler)connection_timeout_handler, c);
+    BReactor_SetTimer(o->reactor, &c->timeout_timer);
+    
+    c->recv_len = 0;
+    c->sending = 0;
+    
+    LinkedList1_Append(&o->connections, &c->list_node);
+    o->num_connections++;
+    
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->recv_buf, sizeof(c->recv_buf));
+    return;
+    
+fail1:
+    free(c);
+fail0:
+    return;
+}
+
+static void statsd_send_next (BMetricsExporter *o)
+{
+    ASSERT(o->statsd_sending)
+    
+    const char *data = ExpString_Get(&o->statsd_data);
+    size_t total = ExpString_Length(&o->statsd_data);
+    
+    while (o->statsd_pos < total) {
+        // take as many whole lines as fit into a datagram
+        size_t start = o->statsd_pos;
+        size_t end = start;
+        while (end < total) {
+            const char *nl = memchr(data + end, '\n', total - end);
+            size_t line_end = (nl ? nl - data + 1 : total);
+            if (line_end - start > BMETRICSEXPORTER_STATSD_MTU) {
+                break;
+            }
+            end = line_end;
+        }
+        
+        // skip a line which doesn't fit into a datagram on its own
+        if (end == start) {
+            const char *nl = memchr(data + start, '\n', total - start);
+            o->statsd_pos = (nl ? nl - data + 1 : total);
+            continue;
+        }
+        
+        o->statsd_pos = end;
+        PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&o->statsd_dgram), (uint8_t *)data + start, end - start);
+        return;
+    }
+    
+    o->statsd_sending = 0;
+}
+
+static void statsd_send_handler_done (BMetricsExporter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->statsd_sending)
+    
+    statsd_send_next(o);
+}
+
+static void statsd_dgram_handler (BMetricsExporter *o, int event)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->statsd_error)
+    
+    BLog(BLOG_ERROR, "StatsD socket error, no longer pushing metrics");
+    
+    o->statsd_error = 1;
+    BReactor_RemoveTimer(o->reactor, &o->statsd_timer);
+}
+
+static void statsd_timer_handler (BMetricsExporter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_statsd)
+    ASSERT(!o->statsd_error)
+    
+    BReactor_SetTimer(o->reactor, &o->statsd_timer);
+    
+    // don't pile up if the previous push hasn't finished
+    if (o->statsd_sending) {
+        return;
+    }
+    
+    // reuse the buffer of the previous push
+    ExpString_Reset(&o->statsd_data);
+    
+    if (!BMetrics_WriteStatsd(&o->statsd_data)) {
+        BLog(BLOG_ERROR, "BMetrics_WriteStatsd failed");
+        return;
+    }
+    
+    o->statsd_sending = 1;
+    o->statsd_pos = 0;
+    statsd_send_next(o);
+}
+
+static void probe_timer_handler (BMetricsExporter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    btime_t now = btime_gettime();
+    btime_t lateness = now - o->probe_expected;
+    BMetric_Observe(&o->loop_latency_metric, (lateness > 0 ? lateness : 0));
+    
+    // bring busy polling counters up to date
+    uint64_t spins;
+    uint64_t hits;
+    BReactor_BusyPollCounts(o->reactor, &spins, &hits);
+    BMetric_Add(&o->busy_poll_spins_metric, spins - o->busy_poll_spins);
+    BMetric_Add(&o->busy_poll_hits_metric, hits - o->busy_poll_hits);
+    o->busy_poll_spins = spins;
+    o->busy_poll_hits = hits;
+    
+    o->probe_expected = now + BMETRICSEXPORTER_PROBE_INTERVAL;
+    BReactor_SetTimerAbsolute(o->reactor, &o->probe_timer, o->probe_expected);
+}
+
+static int64_t uptime_func (BMetricsExporter *o)
+{
+    return (btime_gettime() - o->start_time) / 1000;
+}
+
+int BMetricsExporter_Init (BMetricsExporter *o, BReactor *reactor, int have_listen, BAddr listen_addr,
+                           int have_statsd, BAddr statsd_addr, btime_t statsd_interval)
+{
+    ASSERT(have_listen == 0 || have_listen == 1)
+    ASSERT(have_statsd == 0 || have_statsd == 1)
+    ASSERT(!have_statsd || statsd_interval > 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->have_listen = have_listen;
+    o->have_statsd = have_statsd;
+    
+    if (have_listen) {
+        // init listener
+        if (!BListener_Init(&o->listener, listen_addr, reactor, o, (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "BListener_Init failed");
+            goto fail0;
+        }
+        
+        LinkedList1_Init(&o->connections);
+        o->num_connections = 0;
+    }
+    
+    if (have_statsd) {
+        // init push buffer, kept across pushes
+        if (!ExpString_Init(&o->statsd_data)) {
+            BLog(BLOG_ERROR, "ExpString_Init failed");
+            goto fail1;
+        }
+        
+        // init datagram socket
+        if (!BDatagram_Init(&o->statsd_dgram, statsd_addr.type, reactor, o, (BDatagram_handler)statsd_dgram_handler)) {
+            BLog(BLOG_ERROR, "BDatagram_Init failed");
+            goto fail2;
+        }
+        
+        BIPAddr local_addr;
+        BIPAddr_InitInvalid(&local_addr);
+        BDatagram_SetSendAddrs(&o->statsd_dgram, statsd_addr, local_addr);
+        
+        BDatagram_SendAsync_Init(&o->statsd_dgram, BMETRICSEXPORTER_STATSD_MTU);
+        PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&o->statsd_dgram), (PacketPassInterface_handler_done)statsd_send_handler_done, o);
+        
+        BTimer_Init(&o->statsd_timer, statsd_interval, (BTimer_handler)statsd_timer_handler, o);
+        BReactor_SetTimer(reactor, &o->statsd_timer);
+        
+        o->statsd_error = 0;
+        o->statsd_sending = 0;
+    }
+    
+    // register own metrics
+    o->start_time = btime_gettime();
+    BMetric_InitGaugeFunc(&o->uptime_metric, "badvpn_uptime_seconds", NULL, "Time since the program started.", (BMetric_gauge_func)uptime_func, o);
+    BMetric_InitHistogram(&o->loop_latency_metric, "badvpn_reactor_loop_latency_milliseconds", NULL, "How late a periodic timer was dispatched by the event loop.");
+    BMetric_InitCounter(&o->busy_poll_spins_metric, "badvpn_reactor_busy_poll_spins_total", NULL, "Times the event loop spun waiting for events.");
+    BMetric_InitCounter(&o->busy_poll_hits_metric, "badvpn_reactor_busy_poll_hits_total", NULL, "Times the event loop found events while spinning.");
+    BReactor_BusyPollCounts(reactor, &o->busy_poll_spins, &o->busy_poll_hits);
+    
+    // start measuring event loop latency
+    BTimer_Init(&o->probe_timer, 0, (BTimer_handler)probe_timer_handler, o);
+    o->probe_expected = btime_gettime() + BMETRICSEXPORTER_PROBE_INTERVAL;
+    BReactor_SetTimerAbsolute(reactor, &o->probe_timer, o->probe_expected);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail2:
+    ExpString_Free(&o->statsd_data);
+fail1:
+    if (have_listen) {
+        BListener_Free(&o->listener);
+    }
+fail0:
+    return 0;
+}
+
+void BMetricsExporter_Free (BMetricsExporter *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    BReactor_RemoveTimer(o->reactor, &o->probe_timer);
+    BMetric_Free(&o->busy_poll_hits_metric);
+    BMetric_Free(&o->busy_poll_spins_metric);
+    BMetric_Free(&o->loop_latency_metric);
+    BMetric_Free(&o->uptime_metric);
+    
+    if (o->have_statsd) {
+        BReactor_RemoveTimer(o->reactor, &o->statsd_timer);
+        BDatagram_SendAsync_Free(&o->statsd_dgram);
+        BDatagram_Free(&o->statsd_dgram);
+        ExpString_Free(&o->statsd_data);
+    }
+    
+    if (o->have_listen) {
+        while (!LinkedList1_IsEmpty(&o->connections)) {
+            connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections), struct connection, list_node));
+        }
+        BListener_Free(&o->listener);
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file BMetricsExporter.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Exports the metrics registered with {@link BMetric} over HTTP in the
+ * Prometheus text format, and/or pushes them periodically to a StatsD server
+ * over UDP. Also registers metrics of its own: the process uptime, and the
+ * latency of the event loop, measured as the lateness of a periodic timer,
+ * and the busy polling counters of the reactor.
+ */
+
+#ifndef BADVPN_SYSTEM_BMETRICSEXPORTER_H
+#define BADVPN_SYSTEM_BMETRICSEXPORTER_H
+
+#include <misc/debug.h>
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <base/BMetrics.h>
+#include <system/BReactor.h>
+#include <system/BConnection.h>
+#include <system/BDatagram.h>
+
+// interval for measuring event loop latency, in milliseconds
+#define BMETRICSEXPORTER_PROBE_INTERVAL 100
+
+// max number of simultaneous HTTP connections; the oldest is dropped
+#define BMETRICSEXPORTER_MAX_CONNECTIONS 8
+
+// HTTP connections which take longer are dropped, in milliseconds
+#define BMETRICSEXPORTER_CONNECTION_TIMEOUT 5000
+
+// max size of an HTTP request
+#define BMETRICSEXPORTER_REQUEST_SIZE 2048
+
+// default interval for pushing to StatsD, in milliseconds
+#define BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL 10000
+
+// max size of a StatsD datagram
+#define BMETRICSEXPORTER_STATSD_MTU 1432
+
+typedef struct {
+    BReactor *reactor;
+    int have_listen;
+    int have_statsd;
+    BListener listener;
+    LinkedList1 connections;
+    int num_connections;
+    BDatagram statsd_dgram;
+    BTimer statsd_timer;
+    int statsd_error;
+    int statsd_sending;
+    ExpString statsd_data;
+    size_t statsd_pos;
+    BTimer probe_timer;
+    btime_t probe_expected;
+    btime_t start_time;
+    BMetric uptime_metric;
+    BMetric loop_latency_metric;
+    BMetric busy_poll_spins_metric;
+    BMetric busy_poll_hits_metric;
+    uint64_t busy_poll_spins;
+    uint64_t busy_poll_hits;
+    DebugObject d_obj;
+} BMetricsExporter;
+
+/**
+ * Initializes the exporter.
+ * {@link BNetwork_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param have_listen whether to serve metrics over HTTP
+ * @param listen_addr address to listen on for HTTP, if have_listen is set
+ * @param have_statsd whether to push metrics to StatsD
+ * @param statsd_addr StatsD server address, if have_statsd is set
+ * @param statsd_interval interval for pushing to StatsD in milliseconds. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BMetricsExporter_Init (BMetricsExporter *o, BReactor *reactor, int have_listen, BAddr listen_addr,
+                           int have_statsd, BAddr statsd_addr, btime_t statsd_interval) WARN_UNUSED;
+
+/**
+ * Frees the exporter, closing any HTTP connections.
+ * 
+ * @param o the object
+ */
+void BMetricsExporter_Free (BMetricsExporter *o);
+
+#endif
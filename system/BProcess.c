@@ -27,6 +27,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
@@ -41,6 +45,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef BADVPN_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
 #include <misc/offset.h>
 #include <misc/open_standard_streams.h>
 #include <base/BLog.h>
@@ -50,12 +59,141 @@
 #include <generated/blog_channel_BProcess.h>
 
 #define INITIAL_NUM_GROUPS 24
+#define CHILD_STACK_SIZE 65536
+
+#if defined(BADVPN_LINUX) && defined(SYS_pidfd_open)
+#define BPROCESS_HAVE_PIDFD 1
+#endif
+
+struct BProcess_watch {
+    BProcessManager *m;
+    BProcess *p; // NULL if the process was freed
+    pid_t pid;
+    int pidfd;
+    int active;
+    BFileDescriptor bfd; // if active
+    LinkedList1Node orphans_list_node; // if !p && active
+};
+
+struct child_params {
+    const char *file;
+    char *const *argv;
+    int *fds;
+    const int *fds_map;
+    int max_fd;
+    int do_setsid;
+    const char *username;
+    struct passwd *pwd;
+    gid_t *groups;
+    int num_groups;
+};
 
 static void call_handler (BProcess *o, int normally, uint8_t normally_exit_status)
 {
     DEBUGERROR(&o->d_err, o->handler(o->user, normally, normally_exit_status))
 }
 
+static void report_status (BProcess *p, pid_t pid, int status)
+{
+    if (WIFEXITED(status)) {
+        uint8_t exit_status = WEXITSTATUS(status);
+        
+        BLog(BLOG_INFO, "child %"PRIiMAX" exited with status %"PRIu8, (intmax_t)pid, exit_status);
+        
+        if (p) {
+            call_handler(p, 1, exit_status);
+            return;
+        }
+    }
+    else if (WIFSIGNALED(status)) {
+        int signo = WTERMSIG(status);
+        
+        BLog(BLOG_INFO, "child %"PRIiMAX" exited with signal %d", (intmax_t)pid, signo);
+        
+        if (p) {
+            call_handler(p, 0, 0);
+            return;
+        }
+    }
+    else {
+        BLog(BLOG_ERROR, "unknown wait status type for pid %"PRIiMAX" (%d)", (intmax_t)pid, status);
+    }
+}
+
+#ifdef BPROCESS_HAVE_PIDFD
+
+static int pidfd_open_pid (pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+static void watch_stop (struct BProcess_watch *w)
+{
+    ASSERT(w->active)
+    
+    BReactor_RemoveFileDescriptor(w->m->reactor, &w->bfd);
+    close(w->pidfd);
+    w->active = 0;
+}
+
+static void watch_fd_handler (struct BProcess_watch *w, int events)
+{
+    ASSERT(w->active)
+    
+    int status;
+    pid_t pid = waitpid(w->pid, &status, WNOHANG);
+    if (pid == 0) {
+        return;
+    }
+    
+    // the process is gone, stop watching it
+    watch_stop(w);
+    
+    // free watch of a freed process
+    if (!w->p) {
+        LinkedList1_Remove(&w->m->orphans, &w->orphans_list_node);
+        free(w);
+        return;
+    }
+    
+    if (pid < 0) {
+        BLog(BLOG_ERROR, "waitpid failed for pid %"PRIiMAX, (intmax_t)w->pid);
+        call_handler(w->p, 0, 0);
+        return;
+    }
+    
+    report_status(w->p, pid, status);
+}
+
+static int watch_start (BProcess *o)
+{
+    struct BProcess_watch *w = o->watch;
+    
+    w->m = o->m;
+    w->p = o;
+    w->pid = o->pid;
+    w->active = 0;
+    
+    if ((w->pidfd = pidfd_open_pid(o->pid)) < 0) {
+        BLog(BLOG_ERROR, "pidfd_open failed");
+        return 0;
+    }
+    
+    BFileDescriptor_Init(&w->bfd, w->pidfd, (BFileDescriptor_handler)watch_fd_handler, w);
+    if (!BReactor_AddFileDescriptor(o->m->reactor, &w->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        close(w->pidfd);
+        return 0;
+    }
+    BReactor_SetFileDescriptorEvents(o->m->reactor, &w->bfd, BREACTOR_READ);
+    
+    w->active = 1;
+    
+    return 1;
+}
+
+#endif
+
 static BProcess * find_process (BProcessManager *o, pid_t pid)
 {
     for (LinkedList1Node *node = LinkedList1_GetFirst(&o->processes); node; node = LinkedList1Node_Next(node)) {
@@ -83,32 +221,10 @@ static void work_signals (BProcessManager *o)
     // find process
     BProcess *p = find_process(o, pid);
     if (!p) {
-        BLog(BLOG_DEBUG, "unknown child %p");
+        BLog(BLOG_DEBUG, "unknown child %"PRIiMAX, (intmax_t)pid);
     }
     
-    if (WIFEXITED(status)) {
-        uint8_t exit_status = WEXITSTATUS(status);
-        
-        BLog(BLOG_INFO, "child %"PRIiMAX" exited with status %"PRIu8, (intmax_t)pid, exit_status);
-        
-        if (p) {
-            call_handler(p, 1, exit_status);
-            return;
-        }
-    }
-    else if (WIFSIGNALED(status)) {
-        int signo = WTERMSIG(status);
-        
-        BLog(BLOG_INFO, "child %"PRIiMAX" exited with signal %d", (intmax_t)pid, signo);
-        
-        if (p) {
-            call_handler(p, 0, 0);
-            return;
-        }
-    }
-    else {
-        BLog(BLOG_ERROR, "unknown wait status type for pid %"PRIiMAX" (%d)", (intmax_t)pid, status);
-    }
+    report_status(p, pid, status);
 }
 
 static void wait_job_handler (BProcessManager *o)
@@ -133,18 +249,33 @@ int BProcessManager_Init (BProcessManager *o, BReactor *reactor)
     // init arguments
     o->reactor = reactor;
     
+    // use pidfds if the kernel supports them
+    o->use_pidfd = 0;
+#ifdef BPROCESS_HAVE_PIDFD
+    int test_pidfd = pidfd_open_pid(getpid());
+    if (test_pidfd >= 0) {
+        close(test_pidfd);
+        o->use_pidfd = 1;
+    }
+#endif
+    
     // init signal handling
-    sigset_t sset;
-    ASSERT_FORCE(sigemptyset(&sset) == 0)
-    ASSERT_FORCE(sigaddset(&sset, SIGCHLD) == 0)
-    if (!BUnixSignal_Init(&o->signal, o->reactor, sset, (BUnixSignal_handler)signal_handler, o)) {
-        BLog(BLOG_ERROR, "BUnixSignal_Init failed");
-        goto fail0;
+    if (!o->use_pidfd) {
+        sigset_t sset;
+        ASSERT_FORCE(sigemptyset(&sset) == 0)
+        ASSERT_FORCE(sigaddset(&sset, SIGCHLD) == 0)
+        if (!BUnixSignal_Init(&o->signal, o->reactor, sset, (BUnixSignal_handler)signal_handler, o)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            goto fail0;
+        }
     }
     
     // init processes list
     LinkedList1_Init(&o->processes);
     
+    // init orphans list
+    LinkedList1_Init(&o->orphans);
+    
     // init wait job
     BPending_Init(&o->wait_job, BReactor_PendingGroup(o->reactor), (BPending_handler)wait_job_handler, o);
     
@@ -164,8 +295,21 @@ void BProcessManager_Free (BProcessManager *o)
     // free wait job
     BPending_Free(&o->wait_job);
     
+#ifdef BPROCESS_HAVE_PIDFD
+    // stop watching freed processes which are still running
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&o->orphans)) {
+        struct BProcess_watch *w = UPPER_OBJECT(ln, struct BProcess_watch, orphans_list_node);
+        watch_stop(w);
+        LinkedList1_Remove(&o->orphans, &w->orphans_list_node);
+        free(w);
+    }
+#endif
+    
     // free signal handling
-    BUnixSignal_Free(&o->signal, 1);
+    if (!o->use_pidfd) {
+        BUnixSignal_Free(&o->signal, 1);
+    }
 }
 
 static int fds_contains (const int *fds, int fd, size_t *pos)
@@ -183,6 +327,133 @@ static int fds_contains (const int *fds, int fd, size_t *pos)
     return 0;
 }
 
+static void child_abort (void)
+{
+#ifdef BADVPN_LINUX
+    // In a child sharing our memory, abort() may signal the parent's thread
+    // since the thread ID comes from the shared thread structure.
+    syscall(SYS_kill, (pid_t)syscall(SYS_getpid), SIGABRT);
+#endif
+    abort();
+}
+
+static void close_other_fds (const int *fds, int max_fd)
+{
+#ifdef SYS_close_range
+    // close ranges of fds between the fds to keep
+    unsigned int cur = 0;
+    while (1) {
+        int next = -1;
+        for (size_t i = 0; fds[i] >= 0; i++) {
+            if ((unsigned int)fds[i] >= cur && (next < 0 || fds[i] < next)) {
+                next = fds[i];
+            }
+        }
+        
+        if (next < 0) {
+            if (syscall(SYS_close_range, cur, ~0U, 0) < 0) {
+                break;
+            }
+            return;
+        }
+        
+        if ((unsigned int)next > cur && syscall(SYS_close_range, cur, (unsigned int)next - 1, 0) < 0) {
+            break;
+        }
+        
+        cur = (unsigned int)next + 1;
+    }
+#endif
+    
+    for (int i = 0; i < max_fd; i++) {
+        if (!fds_contains(fds, i, NULL)) {
+            close(i);
+        }
+    }
+}
+
+static int child_main (void *arg)
+{
+    struct child_params *cp = arg;
+    int *fds2 = cp->fds;
+    const int *fds_map = cp->fds_map;
+    
+    // restore signal dispositions
+    for (int i = 1; i < NSIG; i++) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sa.sa_flags = 0;
+        sigaction(i, &sa, NULL);
+    }
+    
+    // unblock signals
+    sigset_t sset_none;
+    sigemptyset(&sset_none);
+    if (pthread_sigmask(SIG_SETMASK, &sset_none, NULL) != 0) {
+        child_abort();
+    }
+    
+    // close file descriptors, except the given fds
+    close_other_fds(fds2, cp->max_fd);
+    
+    // map fds to requested fd numbers
+    while (*fds2 >= 0) {
+        // resolve possible conflict
+        size_t cpos;
+        if (fds_contains(fds2 + 1, *fds_map, &cpos)) {
+            // dup() the fd to a new number; the old one will be closed
+            // in the following dup2()
+            if ((fds2[1 + cpos] = dup(fds2[1 + cpos])) < 0) {
+                child_abort();
+            }
+        }
+        
+        if (*fds2 != *fds_map) {
+            // dup fd
+            if (dup2(*fds2, *fds_map) < 0) {
+                child_abort();
+            }
+            
+            // close original fd
+            close(*fds2);
+        }
+        
+        fds2++;
+        fds_map++;
+    }
+    
+    // make sure standard streams are open
+    open_standard_streams();
+    
+    // make session leader if requested
+    if (cp->do_setsid) {
+        setsid();
+    }
+    
+    // assume identity of username, if requested
+    if (cp->username) {
+        if (setgroups(cp->num_groups, cp->groups) < 0) {
+            child_abort();
+        }
+        
+        if (setgid(cp->pwd->pw_gid) < 0) {
+            child_abort();
+        }
+        
+        if (setuid(cp->pwd->pw_uid) < 0) {
+            child_abort();
+        }
+    }
+    
+    // do the exec
+    execv(cp->file, cp->argv);
+    
+    // if we're still here, something went wrong
+    child_abort();
+    return 0;
+}
+
 int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, void *user, const char *file, char *const argv[], struct BProcess_params params)
 {
     int res = 0;
@@ -268,6 +539,15 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     }
     memcpy(fds2, params.fds, (num_fds + 1) * sizeof(fds2[0]));
     
+#ifdef BADVPN_LINUX
+    // allocate stack for a child started with clone()
+    char *child_stack = NULL;
+    if (!params.username && !(child_stack = malloc(CHILD_STACK_SIZE))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail3;
+    }
+#endif
+    
     // block signals
     // needed to prevent parent's signal handlers from being called
     // in the child
@@ -276,92 +556,38 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     sigset_t sset_old;
     if (pthread_sigmask(SIG_SETMASK, &sset_all, &sset_old) != 0) {
         BLog(BLOG_ERROR, "pthread_sigmask failed");
-        goto fail3;
+        goto fail4;
     }
     
-    // fork
-    pid_t pid = fork();
-    
-    if (pid == 0) {
-        // this is child
-        
-        // restore signal dispositions
-        for (int i = 1; i < NSIG; i++) {
-            struct sigaction sa;
-            memset(&sa, 0, sizeof(sa));
-            sa.sa_handler = SIG_DFL;
-            sa.sa_flags = 0;
-            sigaction(i, &sa, NULL);
-        }
-        
-        // unblock signals
-        sigset_t sset_none;
-        sigemptyset(&sset_none);
-        if (pthread_sigmask(SIG_SETMASK, &sset_none, NULL) != 0) {
-            abort();
-        }
-        
-        // close file descriptors, except the given fds
-        for (int i = 0; i < max_fd; i++) {
-            if (!fds_contains(fds2, i, NULL)) {
-                close(i);
-            }
+    // parameters for the child
+    struct child_params cp;
+    cp.file = file;
+    cp.argv = argv;
+    cp.fds = fds2;
+    cp.fds_map = params.fds_map;
+    cp.max_fd = max_fd;
+    cp.do_setsid = params.do_setsid;
+    cp.username = params.username;
+    cp.pwd = &pwd;
+    cp.groups = groups;
+    cp.num_groups = num_groups;
+    
+    pid_t pid;
+    
+#ifdef BADVPN_LINUX
+    if (!params.username) {
+        // Start the child sharing our memory, suspending us until it execs, so our
+        // address space need not be copied. The child only makes plain system calls;
+        // switching users is left to fork() because glibc's set*id() functions
+        // coordinate with the threads of the calling process.
+        pid = clone(child_main, child_stack + CHILD_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &cp);
+    } else
+#endif
+    {
+        pid = fork();
+        if (pid == 0) {
+            child_main(&cp);
         }
-        
-        // map fds to requested fd numbers
-        while (*fds2 >= 0) {
-            // resolve possible conflict
-            size_t cpos;
-            if (fds_contains(fds2 + 1, *params.fds_map, &cpos)) {
-                // dup() the fd to a new number; the old one will be closed
-                // in the following dup2()
-                if ((fds2[1 + cpos] = dup(fds2[1 + cpos])) < 0) {
-                    abort();
-                }
-            }
-            
-            if (*fds2 != *params.fds_map) {
-                // dup fd
-                if (dup2(*fds2, *params.fds_map) < 0) {
-                    abort();
-                }
-                
-                // close original fd
-                close(*fds2);
-            }
-            
-            fds2++;
-            params.fds_map++;
-        }
-        
-        // make sure standard streams are open
-        open_standard_streams();
-        
-        // make session leader if requested
-        if (params.do_setsid) {
-            setsid();
-        }
-        
-        // assume identity of username, if requested
-        if (params.username) {
-            if (setgroups(num_groups, groups) < 0) {
-                abort();
-            }
-            
-            if (setgid(pwd.pw_gid) < 0) {
-                abort();
-            }
-            
-            if (setuid(pwd.pw_uid) < 0) {
-                abort();
-            }
-        }
-        
-        // do the exec
-        execv(file, argv);
-        
-        // if we're still here, something went wrong
-        abort();
     }
     
     // restore original signal mask
@@ -369,12 +595,27 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     
     if (pid < 0) {
         BLog(BLOG_ERROR, "fork failed");
-        goto fail3;
+        goto fail4;
     }
     
     // remember pid
     o->pid = pid;
     
+    // watch the process through a pidfd
+    o->watch = NULL;
+#ifdef BPROCESS_HAVE_PIDFD
+    if (m->use_pidfd) {
+        if (!(o->watch = malloc(sizeof(*o->watch))) || !watch_start(o)) {
+            // nobody would reap the child otherwise
+            BLog(BLOG_ERROR, "failed to watch child, killing it");
+            free(o->watch);
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            goto fail4;
+        }
+    }
+#endif
+    
     // add to processes list
     LinkedList1_Append(&o->m->processes, &o->list_node);
     
@@ -384,6 +625,10 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     // Returning success, but cleanup first.
     res = 1;
     
+fail4:
+#ifdef BADVPN_LINUX
+    free(child_stack);
+#endif
 fail3:
     free(fds2);
 fail2:
@@ -421,6 +666,18 @@ void BProcess_Free (BProcess *o)
     
     // remove from processes list
     LinkedList1_Remove(&o->m->processes, &o->list_node);
+    
+#ifdef BPROCESS_HAVE_PIDFD
+    if (o->watch) {
+        if (o->watch->active) {
+            // keep watching so the child is still reaped
+            o->watch->p = NULL;
+            LinkedList1_Append(&o->m->orphans, &o->watch->orphans_list_node);
+        } else {
+            free(o->watch);
+        }
+    }
+#endif
 }
 
 int BProcess_Terminate (BProcess *o)
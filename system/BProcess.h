@@ -44,11 +44,17 @@
  * Manages child processes.
  * There may be at most one process manager at any given time. This restriction is not
  * enforced, however.
+ * 
+ * Where the system supports process file descriptors (Linux pidfd), each child is
+ * watched through its own pidfd in the reactor, and SIGCHLD is not used. Otherwise,
+ * children are reaped with waitpid() on SIGCHLD.
  */
 typedef struct {
     BReactor *reactor;
-    BUnixSignal signal;
+    int use_pidfd;
+    BUnixSignal signal; // if !use_pidfd
     LinkedList1 processes;
+    LinkedList1 orphans; // watches of freed processes which have not exited yet
     BPending wait_job;
     DebugObject d_obj;
 } BProcessManager;
@@ -66,6 +72,8 @@ typedef struct {
  */
 typedef void (*BProcess_handler) (void *user, int normally, uint8_t normally_exit_status);
 
+struct BProcess_watch;
+
 /**
  * Represents a child process.
  */
@@ -75,6 +83,7 @@ typedef struct {
     void *user;
     pid_t pid;
     LinkedList1Node list_node; // node in BProcessManager.processes
+    struct BProcess_watch *watch; // if m->use_pidfd
     DebugObject d_obj;
     DebugError d_err;
 } BProcess;
@@ -0,0 +1,448 @@
+/**
+ * @file BReactorGroup.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+
+#ifdef BADVPN_LINUX
+#include <sys/eventfd.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+
+#include "BReactorGroup.h"
+
+#include <generated/blog_channel_BReactorGroup.h>
+
+static void inbox_push (BReactorGroupMember *m, BReactorGroupMessage *msg)
+{
+    // Intrusive multiple-producer single-consumer queue: producers swing the head
+    // and then link the previous head to the new message.
+    __atomic_store_n(&msg->next, NULL, __ATOMIC_RELAXED);
+    BReactorGroupMessage *prev = __atomic_exchange_n(&m->inbox_head, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+static BReactorGroupMessage * inbox_pop (BReactorGroupMember *m)
+{
+    BReactorGroupMessage *tail = m->inbox_tail;
+    BReactorGroupMessage *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    
+    // skip the stub
+    if (tail == &m->inbox_stub) {
+        if (!next) {
+            return NULL;
+        }
+        m->inbox_tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    
+    if (next) {
+        m->inbox_tail = next;
+        return tail;
+    }
+    
+    // a producer has swung the head but not linked yet; it will signal
+    // after linking, so we'll get to the message then
+    if (tail != __atomic_load_n(&m->inbox_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    
+    // tail is the last message, put the stub behind it so it can be taken
+    inbox_push(m, &m->inbox_stub);
+    
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        m->inbox_tail = next;
+        return tail;
+    }
+    
+    return NULL;
+}
+
+static int inbox_signal (BReactorGroupMember *m)
+{
+    #ifdef BADVPN_LINUX
+    uint64_t value = 1;
+    ssize_t res = write(m->inbox_fd[1], &value, sizeof(value));
+    #else
+    char value = 0;
+    ssize_t res = write(m->inbox_fd[1], &value, sizeof(value));
+    #endif
+    
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        // a wakeup is already pending
+        return 1;
+    }
+    
+    return (res == sizeof(value));
+}
+
+static void inbox_bfd_handler (BReactorGroupMember *m, int events)
+{
+    // consume wakeups
+    #ifdef BADVPN_LINUX
+    uint64_t value;
+    #else
+    char value[64];
+    #endif
+    while (read(m->inbox_fd[0], &value, sizeof(value)) > 0);
+    
+    // allow producers to wake us again before looking at the queue,
+    // so that messages pushed from now on are not missed
+    __atomic_store_n(&m->inbox_signaled, 0, __ATOMIC_SEQ_CST);
+    
+    BPending_Set(&m->inbox_job);
+}
+
+static void inbox_job_handler (BReactorGroupMember *m)
+{
+    // deliver a batch of messages, continuing in a new job so that other
+    // events get a chance when the inbox is busy
+    for (int i = 0; i < BREACTORGROUP_INBOX_BATCH; i++) {
+        BReactorGroupMessage *msg = inbox_pop(m);
+        if (!msg) {
+            return;
+        }
+        
+        msg->handler(msg);
+    }
+    
+    BPending_Set(&m->inbox_job);
+}
+
+static void quit_msg_handler (BReactorGroupMessage *msg)
+{
+    BReactorGroupMember *m = UPPER_OBJECT(msg, BReactorGroupMember, quit_msg);
+    
+    BReactor_Quit(m->reactor, 0);
+}
+
+static int member_init_inbox (BReactorGroupMember *m)
+{
+    #ifdef BADVPN_LINUX
+    if ((m->inbox_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        BLog(BLOG_ERROR, "eventfd failed");
+        return 0;
+    }
+    m->inbox_fd[1] = m->inbox_fd[0];
+    #else
+    if (pipe(m->inbox_fd) < 0) {
+        BLog(BLOG_ERROR, "pipe failed");
+        return 0;
+    }
+    
+    if (!badvpn_set_nonblocking(m->inbox_fd[0]) || !badvpn_set_nonblocking(m->inbox_fd[1])) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        close(m->inbox_fd[0]);
+        close(m->inbox_fd[1]);
+        return 0;
+    }
+    #endif
+    
+    // init queue with the stub
+    m->inbox_stub.handler = NULL;
+    m->inbox_stub.next = NULL;
+    m->inbox_head = &m->inbox_stub;
+    m->inbox_tail = &m->inbox_stub;
+    m->inbox_signaled = 0;
+    
+    return 1;
+}
+
+static void member_free_inbox (BReactorGroupMember *m)
+{
+    if (close(m->inbox_fd[0]) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    #ifndef BADVPN_LINUX
+    if (close(m->inbox_fd[1]) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    #endif
+}
+
+static int member_attach (BReactorGroupMember *m)
+{
+    BFileDescriptor_Init(&m->inbox_bfd, m->inbox_fd[0], (BFileDescriptor_handler)inbox_bfd_handler, m);
+    if (!BReactor_AddFileDescriptor(m->reactor, &m->inbox_bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        return 0;
+    }
+    BReactor_SetFileDescriptorEvents(m->reactor, &m->inbox_bfd, BREACTOR_READ);
+    
+    BPending_Init(&m->inbox_job, BReactor_PendingGroup(m->reactor), (BPending_handler)inbox_job_handler, m);
+    
+    return 1;
+}
+
+static void member_detach (BReactorGroupMember *m)
+{
+    BPending_Free(&m->inbox_job);
+    BReactor_RemoveFileDescriptor(m->reactor, &m->inbox_bfd);
+}
+
+static void * member_thread (void *arg)
+{
+    BReactorGroupMember *m = arg;
+    
+    // place the thread first, so that everything it allocates ends up near its CPU
+    if (m->group->placement) {
+        BThreadPlacement_Apply(m->group->placement, m->index, "reactor");
+    }
+    
+    if (!BReactor_Init(&m->own_reactor)) {
+        BLog(BLOG_ERROR, "BReactor_Init failed");
+        goto fail0;
+    }
+    
+    // init arena
+    if (m->group->arena_pages) {
+        BArena_Init(&m->own_arena, m->group->arena_pages);
+        BPendingGroup_SetArena(BReactor_PendingGroup(&m->own_reactor), &m->own_arena);
+    }
+    
+    if (!member_attach(m)) {
+        goto fail1;
+    }
+    
+    // report success
+    m->thread_ok = 1;
+    sem_post(&m->group->ready_sem);
+    
+    BReactor_Exec(&m->own_reactor);
+    
+    member_detach(m);
+    BReactor_Free(&m->own_reactor);
+    if (m->group->arena_pages) {
+        BArena_Free(&m->own_arena);
+    }
+    return NULL;
+    
+fail1:
+    if (m->group->arena_pages) {
+        BArena_Free(&m->own_arena);
+    }
+    BReactor_Free(&m->own_reactor);
+fail0:
+    m->thread_ok = 0;
+    sem_post(&m->group->ready_sem);
+    return NULL;
+}
+
+static void stop_threads (BReactorGroup *o, int num)
+{
+    for (int i = 1; i < num; i++) {
+        BReactorGroupMember *m = &o->members[i];
+        BReactorGroupMember_Post(m, &m->quit_msg, quit_msg_handler);
+    }
+    
+    for (int i = 1; i < num; i++) {
+        BReactorGroupMember *m = &o->members[i];
+        ASSERT_FORCE(pthread_join(m->thread, NULL) == 0)
+    }
+}
+
+int BReactorGroup_Init (BReactorGroup *o, BReactor *reactor, int num_reactors, const BThreadPlacement *placement, int arena_pages)
+{
+    ASSERT(num_reactors >= 1)
+    ASSERT(num_reactors <= BREACTORGROUP_MAX_REACTORS)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->num_members = num_reactors;
+    o->placement = placement;
+    o->arena_pages = arena_pages;
+    
+    // start round-robin at the first member
+    o->next_member = 0;
+    
+    // allocate members
+    if (!(o->members = BAllocArray(o->num_members, sizeof(o->members[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // init ready semaphore
+    if (sem_init(&o->ready_sem, 0, 0) < 0) {
+        BLog(BLOG_ERROR, "sem_init failed");
+        goto fail1;
+    }
+    
+    // init inboxes, so that messages can be posted to any member
+    // as soon as its thread exists
+    int num_inboxes;
+    for (num_inboxes = 0; num_inboxes < o->num_members; num_inboxes++) {
+        BReactorGroupMember *m = &o->members[num_inboxes];
+        m->group = o;
+        m->index = num_inboxes;
+        m->reactor = (num_inboxes == 0 ? o->reactor : &m->own_reactor);
+        
+        if (!member_init_inbox(m)) {
+            goto fail2;
+        }
+    }
+    
+    // attach first member to our reactor
+    if (!member_attach(&o->members[0])) {
+        goto fail2;
+    }
+    
+    // start threads
+    int num_threads;
+    for (num_threads = 1; num_threads < o->num_members; num_threads++) {
+        BReactorGroupMember *m = &o->members[num_threads];
+        
+        if (pthread_create(&m->thread, NULL, member_thread, m) != 0) {
+            BLog(BLOG_ERROR, "pthread_create failed");
+            goto fail3;
+        }
+        
+        // wait for the thread to set up its reactor
+        while (sem_wait(&o->ready_sem) < 0);
+        
+        if (!m->thread_ok) {
+            ASSERT_FORCE(pthread_join(m->thread, NULL) == 0)
+            goto fail3;
+        }
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail3:
+    stop_threads(o, num_threads);
+    member_detach(&o->members[0]);
+fail2:
+    while (num_inboxes-- > 0) {
+        member_free_inbox(&o->members[num_inboxes]);
+    }
+    sem_destroy(&o->ready_sem);
+fail1:
+    BFree(o->members);
+fail0:
+    return 0;
+}
+
+void BReactorGroup_Free (BReactorGroup *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // stop threads
+    stop_threads(o, o->num_members);
+    
+    // deliver messages the threads posted to the first member before exiting
+    BReactorGroupMessage *msg;
+    while ((msg = inbox_pop(&o->members[0]))) {
+        msg->handler(msg);
+    }
+    
+    // detach first member
+    member_detach(&o->members[0]);
+    
+    // free inboxes
+    for (int i = 0; i < o->num_members; i++) {
+        member_free_inbox(&o->members[i]);
+    }
+    
+    // free ready semaphore
+    sem_destroy(&o->ready_sem);
+    
+    // free members
+    BFree(o->members);
+}
+
+int BReactorGroup_NumMembers (BReactorGroup *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_members;
+}
+
+BReactorGroupMember * BReactorGroup_GetMember (BReactorGroup *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_members)
+    
+    return &o->members[index];
+}
+
+BReactorGroupMember * BReactorGroup_AssignNext (BReactorGroup *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BReactorGroupMember *m = &o->members[o->next_member];
+    o->next_member = (o->next_member + 1) % o->num_members;
+    
+    return m;
+}
+
+BReactorGroupMember * BReactorGroup_AssignHash (BReactorGroup *o, uint32_t hash)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->members[hash % o->num_members];
+}
+
+BReactor * BReactorGroupMember_Reactor (BReactorGroupMember *m)
+{
+    return m->reactor;
+}
+
+int BReactorGroupMember_Index (BReactorGroupMember *m)
+{
+    return m->index;
+}
+
+void BReactorGroupMember_Post (BReactorGroupMember *m, BReactorGroupMessage *msg, BReactorGroupMessage_handler handler)
+{
+    ASSERT(msg != &m->inbox_stub)
+    ASSERT(handler)
+    
+    msg->handler = handler;
+    inbox_push(m, msg);
+    
+    // wake up the member unless someone already did
+    if (!__atomic_exchange_n(&m->inbox_signaled, 1, __ATOMIC_SEQ_CST)) {
+        if (!inbox_signal(m)) {
+            BLog(BLOG_ERROR, "failed to wake up reactor %d", m->index);
+        }
+    }
+}
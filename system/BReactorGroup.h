@@ -0,0 +1,210 @@
+/**
+ * @file BReactorGroup.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Group of reactors each running in its own thread, with lock-free inboxes
+ * for passing messages (and with them, ownership of objects such as
+ * connection file descriptors) between them.
+ */
+
+#ifndef BADVPN_SYSTEM_BREACTORGROUP_H
+#define BADVPN_SYSTEM_BREACTORGROUP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+#include <system/BThreadPlacement.h>
+
+#define BREACTORGROUP_MAX_REACTORS 64
+#define BREACTORGROUP_INBOX_BATCH 64
+
+struct BReactorGroupMessage_s;
+struct BReactorGroupMember_s;
+struct BReactorGroup_s;
+
+/**
+ * Handler called in the thread of the receiving reactor for a message
+ * posted with {@link BReactorGroupMember_Post}. From this point on, the
+ * message belongs to the receiving side again and may be freed or reused.
+ * 
+ * @param msg the message
+ */
+typedef void (*BReactorGroupMessage_handler) (struct BReactorGroupMessage_s *msg);
+
+/**
+ * Message which can be posted to a reactor in a {@link BReactorGroup}.
+ * Users embed it in their own structures and use {@link UPPER_OBJECT}
+ * in the handler to get to them.
+ */
+typedef struct BReactorGroupMessage_s {
+    BReactorGroupMessage_handler handler;
+    struct BReactorGroupMessage_s *next;
+} BReactorGroupMessage;
+
+typedef struct BReactorGroupMember_s {
+    struct BReactorGroup_s *group;
+    int index;
+    BReactor *reactor;
+    BReactor own_reactor;
+    BArena own_arena;
+    pthread_t thread;
+    int thread_ok;
+    int inbox_fd[2];
+    BFileDescriptor inbox_bfd;
+    BPending inbox_job;
+    BReactorGroupMessage *inbox_head;
+    BReactorGroupMessage *inbox_tail;
+    BReactorGroupMessage inbox_stub;
+    int inbox_signaled;
+    BReactorGroupMessage quit_msg;
+} BReactorGroupMember;
+
+typedef struct BReactorGroup_s {
+    BReactor *reactor;
+    int num_members;
+    BReactorGroupMember *members;
+    unsigned int next_member;
+    const BThreadPlacement *placement;
+    int arena_pages;
+    sem_t ready_sem;
+    DebugObject d_obj;
+} BReactorGroup;
+
+/**
+ * Initializes the reactor group.
+ * The first member of the group is the given reactor, running in the calling
+ * thread. For each further member, a thread is started which runs its own
+ * {@link BReactor}. Code in a member's thread may only use that member's reactor;
+ * the way to reach another reactor is {@link BReactorGroupMember_Post}.
+ * 
+ * @param o the object
+ * @param reactor reactor of the calling thread, used as the first member
+ * @param num_reactors number of reactors in the group, including the given one.
+ *                     Must be >=1 and <=BREACTORGROUP_MAX_REACTORS.
+ * @param placement if not NULL, the thread of each additional member applies this
+ *                  placement with {@link BThreadPlacement_Apply}, using the member
+ *                  index. The calling thread is not affected. Must remain valid
+ *                  until the group is freed.
+ * @param arena_pages if nonzero, each additional member gets a {@link BArena} with
+ *                    pages of this kind (one of BARENA_PAGES_*), set on its reactor's
+ *                    pending group. The memory is placed on the NUMA node of the
+ *                    member's CPU. The first member's reactor is left as it is.
+ * @return 1 on success, 0 on failure
+ */
+int BReactorGroup_Init (BReactorGroup *o, BReactor *reactor, int num_reactors, const BThreadPlacement *placement, int arena_pages) WARN_UNUSED;
+
+/**
+ * Frees the reactor group.
+ * Stops the threads of the additional members and waits for them to exit.
+ * Before this, users must have freed all their objects in those reactors
+ * (e.g. by posting messages which do that), and no more messages may be
+ * posted to any member. Messages which are still waiting for the first
+ * member, e.g. replies posted by the threads before they exited, are
+ * delivered here, so their handlers can release what the messages carry.
+ * Such handlers must not post further messages.
+ * Must be called from the thread of the first member.
+ * 
+ * @param o the object
+ */
+void BReactorGroup_Free (BReactorGroup *o);
+
+/**
+ * Returns the number of reactors in the group.
+ * 
+ * @param o the object
+ * @return number of reactors
+ */
+int BReactorGroup_NumMembers (BReactorGroup *o);
+
+/**
+ * Returns a member of the group.
+ * May be called from any thread.
+ * 
+ * @param o the object
+ * @param index member index, >=0 and <{@link BReactorGroup_NumMembers}
+ * @return the member
+ */
+BReactorGroupMember * BReactorGroup_GetMember (BReactorGroup *o, int index);
+
+/**
+ * Picks members in round-robin order, e.g. to assign newly accepted connections.
+ * Must be called from the thread of the first member.
+ * 
+ * @param o the object
+ * @return the next member
+ */
+BReactorGroupMember * BReactorGroup_AssignNext (BReactorGroup *o);
+
+/**
+ * Picks a member based on a hash, so that equal hashes always go to the same member.
+ * May be called from any thread.
+ * 
+ * @param o the object
+ * @param hash hash value, e.g. of the peer address
+ * @return the member for this hash
+ */
+BReactorGroupMember * BReactorGroup_AssignHash (BReactorGroup *o, uint32_t hash);
+
+/**
+ * Returns the reactor of a member.
+ * Objects in it may only be used from the member's thread.
+ * 
+ * @param m the member
+ * @return reactor of the member
+ */
+BReactor * BReactorGroupMember_Reactor (BReactorGroupMember *m);
+
+/**
+ * Returns the index of a member in its group.
+ * 
+ * @param m the member
+ * @return index of the member
+ */
+int BReactorGroupMember_Index (BReactorGroupMember *m);
+
+/**
+ * Posts a message to a member. The handler will be called in the member's
+ * thread, from a job of its reactor. Messages posted from the same thread are
+ * delivered in order.
+ * May be called from any thread, including the member's own. Never blocks;
+ * the member is woken up only if it has not been woken up already.
+ * The message must not be posted again until its handler is called.
+ * 
+ * @param m the member to post to
+ * @param msg the message
+ * @param handler handler to call in the member's thread
+ */
+void BReactorGroupMember_Post (BReactorGroupMember *m, BReactorGroupMessage *msg, BReactorGroupMessage_handler handler);
+
+#endif
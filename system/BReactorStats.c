@@ -0,0 +1,291 @@
+/**
+ * @file BReactorStats.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef BADVPN_USE_WINAPI
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+#include "BReactorStats.h"
+
+#include <generated/blog_channel_BReactorStats.h>
+
+static const char *kind_names[BREACTORSTATS_NUM_KINDS] = {"job", "timer", "fd", "other"};
+
+static void hist_add (BReactorStatsHist *h, uint64_t v)
+{
+    int b = 0;
+    while (b < BREACTORSTATS_HIST_BUCKETS - 1 && (v >> b) != 0) {
+        b++;
+    }
+    
+    h->count++;
+    h->sum += v;
+    if (v > h->max) {
+        h->max = v;
+    }
+    h->buckets[b]++;
+}
+
+static uint64_t hist_quantile (BReactorStatsHist *h, int permille)
+{
+    ASSERT(h->count > 0)
+    
+    uint64_t want = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    
+    for (int b = 0; b < BREACTORSTATS_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want) {
+            // report the bucket's upper bound, but never above the maximum
+            uint64_t upper = (b == 0 ? 0 : ((uint64_t)1 << b) - 1);
+            return (upper < h->max ? upper : h->max);
+        }
+    }
+    
+    return h->max;
+}
+
+static void hist_log (const char *name, BReactorStatsHist *h, int level)
+{
+    if (h->count == 0) {
+        BLog(level, "%s: none", name);
+        return;
+    }
+    
+    BLog(level, "%s: n=%"PRIu64" mean=%"PRIu64" p50<=%"PRIu64" p99<=%"PRIu64" max=%"PRIu64,
+         name, h->count, h->sum / h->count, hist_quantile(h, 500), hist_quantile(h, 990), h->max);
+}
+
+static size_t hash_callsite (BReactorStats_callsite callsite, int kind)
+{
+    uint64_t x = (uint64_t)(uintptr_t)callsite ^ (uint64_t)kind;
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    return (size_t)(x & (BREACTORSTATS_TABLE_SIZE - 1));
+}
+
+static BReactorStatsEntry * find_entry (BReactorStats *o, int kind, BReactorStats_callsite callsite)
+{
+    size_t i = hash_callsite(callsite, kind);
+    
+    while (1) {
+        BReactorStatsEntry *e = &o->table[i];
+        
+        if (!e->callsite) {
+            // not found, add it unless the table is too full
+            if (o->num_callsites == BREACTORSTATS_MAX_CALLSITES) {
+                return &o->overflow[kind];
+            }
+            e->callsite = callsite;
+            e->kind = kind;
+            o->num_callsites++;
+            return e;
+        }
+        
+        if (e->callsite == callsite && e->kind == kind) {
+            return e;
+        }
+        
+        i = (i + 1) & (BREACTORSTATS_TABLE_SIZE - 1);
+    }
+}
+
+static int compare_entries (const void *v1, const void *v2)
+{
+    const BReactorStatsEntry *e1 = *(const BReactorStatsEntry **)v1;
+    const BReactorStatsEntry *e2 = *(const BReactorStatsEntry **)v2;
+    
+    // descending by total time
+    if (e1->duration.sum != e2->duration.sum) {
+        return (e1->duration.sum < e2->duration.sum) ? 1 : -1;
+    }
+    return 0;
+}
+
+static void clear (BReactorStats *o)
+{
+    memset(o, 0, sizeof(*o));
+    
+    o->start_ns = BReactorStats_Now();
+    
+    for (int i = 0; i < BREACTORSTATS_NUM_KINDS; i++) {
+        o->overflow[i].kind = i;
+    }
+}
+
+void BReactorStats_Init (BReactorStats *o)
+{
+    clear(o);
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void BReactorStats_Free (BReactorStats *o)
+{
+    DebugObject_Free(&o->d_obj);
+}
+
+void BReactorStats_Reset (BReactorStats *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    DebugObject d_obj = o->d_obj;
+    clear(o);
+    o->d_obj = d_obj;
+}
+
+uint64_t BReactorStats_Now (void)
+{
+    #ifdef BADVPN_USE_WINAPI
+    
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+    ASSERT_FORCE(QueryPerformanceCounter(&count))
+    ASSERT_FORCE(QueryPerformanceFrequency(&freq))
+    return (uint64_t)((double)count.QuadPart * (1000000000.0 / (double)freq.QuadPart));
+    
+    #else
+    
+    struct timespec ts;
+    ASSERT_FORCE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    
+    #endif
+}
+
+void BReactorStats_AddCall (BReactorStats *o, int kind, BReactorStats_callsite callsite, uint64_t duration_ns)
+{
+    ASSERT(kind >= 0)
+    ASSERT(kind < BREACTORSTATS_NUM_KINDS)
+    ASSERT(callsite)
+    DebugObject_Access(&o->d_obj);
+    
+    BReactorStatsEntry *e = find_entry(o, kind, callsite);
+    hist_add(&e->duration, duration_ns);
+    
+    if (kind == BREACTORSTATS_KIND_JOB) {
+        o->cur_iteration_jobs++;
+    }
+}
+
+void BReactorStats_AddWait (BReactorStats *o, int num_events, uint64_t duration_ns)
+{
+    ASSERT(num_events >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    hist_add(&o->wait_events, num_events);
+    hist_add(&o->wait_duration, duration_ns);
+    hist_add(&o->iteration_jobs, o->cur_iteration_jobs);
+    o->cur_iteration_jobs = 0;
+}
+
+void BReactorStats_AddTimerLateness (BReactorStats *o, int64_t lateness_ms)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    hist_add(&o->timer_lateness, (lateness_ms > 0 ? lateness_ms : 0));
+}
+
+void BReactorStats_AddBudgetExceeded (BReactorStats *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->budget_exceeded++;
+}
+
+void BReactorStats_AddSpin (BReactorStats *o, int hit, uint64_t duration_ns)
+{
+    ASSERT(hit == 0 || hit == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    hist_add(&o->spin_duration, duration_ns);
+    o->spin_hits += hit;
+}
+
+void BReactorStats_Log (BReactorStats *o, int level)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint64_t elapsed_ms = (BReactorStats_Now() - o->start_ns) / 1000000;
+    
+    BLog(level, "reactor statistics over %"PRIu64" ms, %d callsites", elapsed_ms, o->num_callsites);
+    hist_log("events per wait", &o->wait_events, level);
+    hist_log("wait duration (ns)", &o->wait_duration, level);
+    hist_log("jobs per iteration", &o->iteration_jobs, level);
+    hist_log("timer lateness (ms)", &o->timer_lateness, level);
+    BLog(level, "job budget exceeded: %"PRIu64, o->budget_exceeded);
+    if (o->spin_duration.count > 0) {
+        BLog(level, "busy poll: %"PRIu64" spins, %"PRIu64" found events (%"PRIu64"%%)",
+             o->spin_duration.count, o->spin_hits, 100 * o->spin_hits / o->spin_duration.count);
+        hist_log("spin duration (ns)", &o->spin_duration, level);
+    }
+    
+    // collect used entries
+    BReactorStatsEntry *entries[BREACTORSTATS_MAX_CALLSITES + BREACTORSTATS_NUM_KINDS];
+    size_t num_entries = 0;
+    for (size_t i = 0; i < BREACTORSTATS_TABLE_SIZE; i++) {
+        if (o->table[i].callsite) {
+            entries[num_entries++] = &o->table[i];
+        }
+    }
+    for (int i = 0; i < BREACTORSTATS_NUM_KINDS; i++) {
+        if (o->overflow[i].duration.count > 0) {
+            entries[num_entries++] = &o->overflow[i];
+        }
+    }
+    
+    qsort(entries, num_entries, sizeof(entries[0]), compare_entries);
+    
+    for (size_t i = 0; i < num_entries; i++) {
+        BReactorStatsEntry *e = entries[i];
+        BReactorStatsHist *h = &e->duration;
+        ASSERT(h->count > 0)
+        
+        char name[64];
+        if (e->callsite) {
+            snprintf(name, sizeof(name), "%s %p", kind_names[e->kind], (void *)(uintptr_t)e->callsite);
+        } else {
+            snprintf(name, sizeof(name), "%s (other callsites)", kind_names[e->kind]);
+        }
+        
+        BLog(level, "%s: calls=%"PRIu64" total=%"PRIu64"us mean=%"PRIu64"ns p50<=%"PRIu64"ns p99<=%"PRIu64"ns max=%"PRIu64"ns",
+             name, h->count, h->sum / 1000, h->sum / h->count, hist_quantile(h, 500), hist_quantile(h, 990), h->max);
+    }
+}
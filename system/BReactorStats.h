@@ -0,0 +1,173 @@
+/**
+ * @file BReactorStats.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Event loop instrumentation data for {@link BReactor}: per-callsite handler
+ * durations, events returned per wait, jobs run per iteration and timer
+ * lateness, kept as power-of-two histograms.
+ */
+
+#ifndef BADVPN_SYSTEM_BREACTORSTATS_H
+#define BADVPN_SYSTEM_BREACTORSTATS_H
+
+#include <stdint.h>
+
+#include <base/DebugObject.h>
+
+#define BREACTORSTATS_KIND_JOB 0
+#define BREACTORSTATS_KIND_TIMER 1
+#define BREACTORSTATS_KIND_FD 2
+#define BREACTORSTATS_KIND_OTHER 3
+#define BREACTORSTATS_NUM_KINDS 4
+
+#define BREACTORSTATS_HIST_BUCKETS 40
+#define BREACTORSTATS_TABLE_SIZE 512
+#define BREACTORSTATS_MAX_CALLSITES 256
+
+/**
+ * Generic handler function pointer identifying a callsite. Handlers of all
+ * types are cast to this; it is never called.
+ */
+typedef void (*BReactorStats_callsite) (void);
+
+/**
+ * Histogram with bucket i counting values v with 2^(i-1) <= v < 2^i
+ * (bucket 0 counts zeros).
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[BREACTORSTATS_HIST_BUCKETS];
+} BReactorStatsHist;
+
+typedef struct {
+    BReactorStats_callsite callsite;
+    int kind;
+    BReactorStatsHist duration;
+} BReactorStatsEntry;
+
+typedef struct {
+    uint64_t start_ns;
+    BReactorStatsEntry table[BREACTORSTATS_TABLE_SIZE];
+    int num_callsites;
+    BReactorStatsEntry overflow[BREACTORSTATS_NUM_KINDS];
+    BReactorStatsHist wait_events;
+    BReactorStatsHist wait_duration;
+    BReactorStatsHist iteration_jobs;
+    BReactorStatsHist timer_lateness;
+    uint64_t cur_iteration_jobs;
+    uint64_t budget_exceeded;
+    BReactorStatsHist spin_duration;
+    uint64_t spin_hits;
+    DebugObject d_obj;
+} BReactorStats;
+
+/**
+ * Initializes the statistics, with everything zero.
+ * 
+ * @param o the object
+ */
+void BReactorStats_Init (BReactorStats *o);
+
+/**
+ * Frees the statistics.
+ * 
+ * @param o the object
+ */
+void BReactorStats_Free (BReactorStats *o);
+
+/**
+ * Clears all recorded data.
+ * 
+ * @param o the object
+ */
+void BReactorStats_Reset (BReactorStats *o);
+
+/**
+ * Returns a monotonic time in nanoseconds, for measuring durations.
+ * 
+ * @return current time in nanoseconds
+ */
+uint64_t BReactorStats_Now (void);
+
+/**
+ * Records one handler invocation.
+ * 
+ * @param o the object
+ * @param kind one of BREACTORSTATS_KIND_*
+ * @param callsite handler function which was called
+ * @param duration_ns how long the handler ran
+ */
+void BReactorStats_AddCall (BReactorStats *o, int kind, BReactorStats_callsite callsite, uint64_t duration_ns);
+
+/**
+ * Records one wait for events, closing the current iteration.
+ * 
+ * @param o the object
+ * @param num_events number of events returned by the wait
+ * @param duration_ns how long the wait took
+ */
+void BReactorStats_AddWait (BReactorStats *o, int num_events, uint64_t duration_ns);
+
+/**
+ * Records how late a timer was dispatched relative to its expiry time.
+ * 
+ * @param o the object
+ * @param lateness_ms lateness in milliseconds; negative values count as zero
+ */
+void BReactorStats_AddTimerLateness (BReactorStats *o, int64_t lateness_ms);
+
+/**
+ * Records that the reactor's job budget was used up.
+ * 
+ * @param o the object
+ */
+void BReactorStats_AddBudgetExceeded (BReactorStats *o);
+
+/**
+ * Records one busy polling spin of the reactor.
+ * 
+ * @param o the object
+ * @param hit 1 if the spin found events, 0 if it ran out of time
+ * @param duration_ns how long the spin took
+ */
+void BReactorStats_AddSpin (BReactorStats *o, int hit, uint64_t duration_ns);
+
+/**
+ * Logs all recorded data at the given level, callsites sorted by total
+ * time spent. Callsites are printed as function addresses, which can be
+ * resolved with addr2line or a debugger.
+ * 
+ * @param o the object
+ * @param level log level
+ */
+void BReactorStats_Log (BReactorStats *o, int level);
+
+#endif
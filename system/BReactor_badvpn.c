@@ -41,6 +41,16 @@
 #include <unistd.h>
 #endif
 
+#ifdef BADVPN_USE_EPOLL
+#include <sys/ioctl.h>
+#endif
+
+#ifdef BADVPN_USE_IO_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #include <misc/debug.h>
 #include <misc/offset.h>
 #include <misc/balloc.h>
@@ -51,9 +61,23 @@
 
 #include <generated/blog_channel_BReactor.h>
 
+#if defined(BADVPN_USE_EPOLL) && !defined(EPIOCSPARAMS)
+// from linux/eventpoll.h, for building against older headers
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
 #define KEVENT_TAG_FD 1
 #define KEVENT_TAG_KEVENT 2
 
+#define EDGE_LISTED_PENDING 1
+#define EDGE_LISTED_DISPATCH 2
+
 #define TIMER_STATE_INACTIVE 1
 #define TIMER_STATE_RUNNING 2
 #define TIMER_STATE_EXPIRED 3
@@ -77,6 +101,330 @@ static void assert_timer (BSmallTimer *bt)
            bt->state == TIMER_STATE_EXPIRED)
 }
 
+#ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+
+#define WHEEL_SLOTS (1 << BSYSTEM_TIMER_WHEEL_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_RANGE_BITS (BSYSTEM_TIMER_WHEEL_LEVELS * BSYSTEM_TIMER_WHEEL_BITS)
+
+#define WHEEL_POS_TREE -1
+#define WHEEL_POS_DUE -2
+
+static btime_t wheel_ceil_tick (btime_t time)
+{
+    if (time <= 0) {
+        return 0;
+    }
+    
+    return time / BADVPN_TIMER_WHEEL_RESOLUTION + (time % BADVPN_TIMER_WHEEL_RESOLUTION != 0);
+}
+
+static btime_t wheel_tick_time (btime_t tick)
+{
+    if (tick > INT64_MAX / BADVPN_TIMER_WHEEL_RESOLUTION) {
+        return INT64_MAX;
+    }
+    
+    return tick * BADVPN_TIMER_WHEEL_RESOLUTION;
+}
+
+static int wheel_first_bit (uint64_t bits)
+{
+    ASSERT(bits)
+    
+    #ifdef __GNUC__
+    return __builtin_ctzll(bits);
+    #else
+    int i = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        i++;
+    }
+    return i;
+    #endif
+}
+
+static void wheel_insert (BReactor *bsys, BSmallTimer *bt)
+{
+    ASSERT(bt->state == TIMER_STATE_RUNNING)
+    
+    btime_t tick = wheel_ceil_tick(bt->absTime);
+    btime_t base = bsys->timers_wheel_base;
+    
+    // already passed, expire on the next wait
+    if (tick < base) {
+        LinkedList1_Append(&bsys->timers_wheel_due_list, &bt->u.list_node);
+        bt->wheel_pos = WHEEL_POS_DUE;
+        return;
+    }
+    
+    // too far in the future, keep in the tree until in range
+    uint64_t diff = (uint64_t)(tick ^ base);
+    if ((diff >> WHEEL_RANGE_BITS)) {
+        BReactor__TimersTreeRef ref = {bt, bt};
+        int res = BReactor__TimersTree_Insert(&bsys->timers_tree, 0, ref, NULL);
+        ASSERT_EXECUTE(res)
+        bt->wheel_pos = WHEEL_POS_TREE;
+        return;
+    }
+    
+    // put to the highest level in which the tick differs from the base, so the
+    // slot is cascaded to lower levels once the base reaches its start
+    int level = 0;
+    while ((diff >> ((level + 1) * BSYSTEM_TIMER_WHEEL_BITS))) {
+        level++;
+    }
+    int slot = (tick >> (level * BSYSTEM_TIMER_WHEEL_BITS)) & WHEEL_SLOT_MASK;
+    
+    LinkedList1_Append(&bsys->timers_wheel[level][slot], &bt->u.list_node);
+    bsys->timers_wheel_bitmap[level] |= (uint64_t)1 << slot;
+    bt->wheel_pos = level * WHEEL_SLOTS + slot;
+}
+
+static void wheel_remove (BReactor *bsys, BSmallTimer *bt)
+{
+    ASSERT(bt->state == TIMER_STATE_RUNNING)
+    
+    if (bt->wheel_pos == WHEEL_POS_TREE) {
+        BReactor__TimersTreeRef ref = {bt, bt};
+        BReactor__TimersTree_Remove(&bsys->timers_tree, 0, ref);
+        return;
+    }
+    
+    if (bt->wheel_pos == WHEEL_POS_DUE) {
+        LinkedList1_Remove(&bsys->timers_wheel_due_list, &bt->u.list_node);
+        return;
+    }
+    
+    ASSERT(bt->wheel_pos >= 0)
+    ASSERT(bt->wheel_pos < BSYSTEM_TIMER_WHEEL_LEVELS * WHEEL_SLOTS)
+    
+    int level = bt->wheel_pos / WHEEL_SLOTS;
+    int slot = bt->wheel_pos % WHEEL_SLOTS;
+    
+    LinkedList1_Remove(&bsys->timers_wheel[level][slot], &bt->u.list_node);
+    if (LinkedList1_IsEmpty(&bsys->timers_wheel[level][slot])) {
+        bsys->timers_wheel_bitmap[level] &= ~((uint64_t)1 << slot);
+    }
+}
+
+static int wheel_is_empty (BReactor *bsys)
+{
+    for (int level = 0; level < BSYSTEM_TIMER_WHEEL_LEVELS; level++) {
+        if (bsys->timers_wheel_bitmap[level]) {
+            return 0;
+        }
+    }
+    
+    return (BReactor__TimersTree_IsEmpty(&bsys->timers_tree) && LinkedList1_IsEmpty(&bsys->timers_wheel_due_list));
+}
+
+static int wheel_next_tick (BReactor *bsys, btime_t *out_tick)
+{
+    // Find the first tick at which the wheel has something to do: expire a slot
+    // of level zero, cascade a slot of a higher level, or move timers from the tree.
+    // Nonempty slots are never behind the base digit of their level.
+    btime_t base = bsys->timers_wheel_base;
+    int found = 0;
+    btime_t first = 0; // to remove warning
+    
+    for (int level = 0; level < BSYSTEM_TIMER_WHEEL_LEVELS; level++) {
+        int shift = level * BSYSTEM_TIMER_WHEEL_BITS;
+        int digit = (base >> shift) & WHEEL_SLOT_MASK;
+        uint64_t bits = bsys->timers_wheel_bitmap[level] & (~(uint64_t)0 << digit);
+        ASSERT(bits == bsys->timers_wheel_bitmap[level])
+        if (!bits) {
+            continue;
+        }
+        
+        btime_t upper = (base >> (shift + BSYSTEM_TIMER_WHEEL_BITS)) << (shift + BSYSTEM_TIMER_WHEEL_BITS);
+        btime_t tick = upper | ((btime_t)wheel_first_bit(bits) << shift);
+        ASSERT(tick >= base)
+        
+        if (!found || tick < first) {
+            first = tick;
+            found = 1;
+        }
+    }
+    
+    BSmallTimer *tree_timer = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0).link;
+    if (tree_timer) {
+        btime_t tick = (wheel_ceil_tick(tree_timer->absTime) >> WHEEL_RANGE_BITS) << WHEEL_RANGE_BITS;
+        if (tick < base) {
+            tick = base;
+        }
+        
+        if (!found || tick < first) {
+            first = tick;
+            found = 1;
+        }
+    }
+    
+    if (found) {
+        *out_tick = first;
+    }
+    
+    return found;
+}
+
+static int wheel_process_tick (BReactor *bsys, btime_t tick)
+{
+    ASSERT(tick >= bsys->timers_wheel_base)
+    
+    int moved = 0;
+    
+    bsys->timers_wheel_base = tick;
+    
+    // move timers which came in range from the tree to the wheel
+    BReactor__TimersTreeRef ref;
+    BSmallTimer *timer;
+    while (timer = (ref = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0)).link) {
+        ASSERT(timer->state == TIMER_STATE_RUNNING)
+        ASSERT(timer->wheel_pos == WHEEL_POS_TREE)
+        
+        if (((uint64_t)(wheel_ceil_tick(timer->absTime) ^ tick) >> WHEEL_RANGE_BITS)) {
+            break;
+        }
+        
+        BReactor__TimersTree_Remove(&bsys->timers_tree, 0, ref);
+        wheel_insert(bsys, timer);
+    }
+    
+    // cascade slots of higher levels which start at this tick, highest first,
+    // since cascading may fill the slot of the level below
+    for (int level = BSYSTEM_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        int shift = level * BSYSTEM_TIMER_WHEEL_BITS;
+        if ((tick & (((btime_t)1 << shift) - 1))) {
+            continue;
+        }
+        
+        int slot = (tick >> shift) & WHEEL_SLOT_MASK;
+        LinkedList1 *list = &bsys->timers_wheel[level][slot];
+        
+        LinkedList1Node *list_node;
+        while (list_node = LinkedList1_GetFirst(list)) {
+            timer = UPPER_OBJECT(list_node, BSmallTimer, u.list_node);
+            ASSERT(timer->state == TIMER_STATE_RUNNING)
+            ASSERT(timer->wheel_pos == level * WHEEL_SLOTS + slot)
+            
+            LinkedList1_Remove(list, &timer->u.list_node);
+            wheel_insert(bsys, timer);
+        }
+        bsys->timers_wheel_bitmap[level] &= ~((uint64_t)1 << slot);
+    }
+    
+    // expire timers of this tick
+    int slot = tick & WHEEL_SLOT_MASK;
+    LinkedList1 *list = &bsys->timers_wheel[0][slot];
+    
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(list)) {
+        timer = UPPER_OBJECT(list_node, BSmallTimer, u.list_node);
+        ASSERT(timer->state == TIMER_STATE_RUNNING)
+        ASSERT(timer->wheel_pos == slot)
+        ASSERT(wheel_ceil_tick(timer->absTime) == tick)
+        
+        // move to expired timers list
+        LinkedList1_Remove(list, &timer->u.list_node);
+        LinkedList1_Append(&bsys->timers_expired_list, &timer->u.list_node);
+        
+        // set expired
+        timer->state = TIMER_STATE_EXPIRED;
+        moved = 1;
+    }
+    bsys->timers_wheel_bitmap[0] &= ~((uint64_t)1 << slot);
+    
+    bsys->timers_wheel_base = tick + 1;
+    
+    return moved;
+}
+
+static int wheel_advance (BReactor *bsys, btime_t target)
+{
+    int moved = 0;
+    
+    // process ticks with something to do, up to the target
+    btime_t tick;
+    while (wheel_next_tick(bsys, &tick) && tick <= target) {
+        moved |= wheel_process_tick(bsys, tick);
+    }
+    
+    // no more work up to the target, skip to it
+    if (bsys->timers_wheel_base <= target) {
+        bsys->timers_wheel_base = target + 1;
+    }
+    
+    return moved;
+}
+
+static int have_running_timers (BReactor *bsys)
+{
+    return !wheel_is_empty(bsys);
+}
+
+static btime_t first_timer_time (BReactor *bsys)
+{
+    ASSERT(LinkedList1_IsEmpty(&bsys->timers_wheel_due_list))
+    
+    btime_t tick;
+    int res = wheel_next_tick(bsys, &tick);
+    ASSERT_EXECUTE(res)
+    
+    return wheel_tick_time(tick);
+}
+
+static int move_expired_timers (BReactor *bsys, btime_t now)
+{
+    int moved = 0;
+    
+    // move timers set to already processed ticks to the expired list
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(&bsys->timers_wheel_due_list)) {
+        BSmallTimer *timer = UPPER_OBJECT(list_node, BSmallTimer, u.list_node);
+        ASSERT(timer->state == TIMER_STATE_RUNNING)
+        ASSERT(timer->wheel_pos == WHEEL_POS_DUE)
+        
+        LinkedList1_Remove(&bsys->timers_wheel_due_list, &timer->u.list_node);
+        LinkedList1_Append(&bsys->timers_expired_list, &timer->u.list_node);
+        timer->state = TIMER_STATE_EXPIRED;
+        moved = 1;
+    }
+    
+    // process ticks up to now
+    if (now >= 0) {
+        moved |= wheel_advance(bsys, now / BADVPN_TIMER_WHEEL_RESOLUTION);
+    }
+    
+    return moved;
+}
+
+static void move_first_timers (BReactor *bsys)
+{
+    // process ticks up to the one reported by first_timer_time;
+    // this may only cascade timers, in which case we'll wait again
+    btime_t tick;
+    int res = wheel_next_tick(bsys, &tick);
+    ASSERT_EXECUTE(res)
+    
+    wheel_advance(bsys, tick);
+}
+
+#else
+
+static int have_running_timers (BReactor *bsys)
+{
+    return !BReactor__TimersTree_IsEmpty(&bsys->timers_tree);
+}
+
+static btime_t first_timer_time (BReactor *bsys)
+{
+    BSmallTimer *first_timer = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0).link;
+    ASSERT(first_timer)
+    ASSERT(first_timer->state == TIMER_STATE_RUNNING)
+    
+    return first_timer->absTime;
+}
+
 static int move_expired_timers (BReactor *bsys, btime_t now)
 {
     int moved = 0;
@@ -147,6 +495,8 @@ static void move_first_timers (BReactor *bsys)
     }
 }
 
+#endif
+
 #ifdef BADVPN_USE_WINAPI
 
 static void set_iocp_ready (BReactorIOCPOverlapped *olap, int succeeded, DWORD bytes)
@@ -165,6 +515,26 @@ static void set_iocp_ready (BReactorIOCPOverlapped *olap, int succeeded, DWORD b
     olap->is_ready = 1;
 }
 
+static void collect_iocp_entries (BReactor *reactor, OVERLAPPED_ENTRY *entries, ULONG num_entries)
+{
+    for (ULONG i = 0; i < num_entries; i++) {
+        BReactorIOCPOverlapped *olap = (BReactorIOCPOverlapped *)entries[i].lpOverlapped;
+        ASSERT_FORCE(olap)
+        DebugObject_Access(&olap->d_obj);
+        ASSERT(olap->reactor == reactor)
+        
+        // With PostQueuedCompletionStatus used to signal events, an olap may
+        // complete again before it is dispatched; discard any excess events.
+        if (olap->is_ready) {
+            continue;
+        }
+        
+        // the status of the operation is left in the OVERLAPPED
+        int succeeded = ((LONG)olap->olap.Internal >= 0);
+        set_iocp_ready(olap, succeeded, entries[i].dwNumberOfBytesTransferred);
+    }
+}
+
 #endif
 
 #ifdef BADVPN_USE_EPOLL
@@ -184,6 +554,234 @@ static void set_epoll_fd_pointers (BReactor *bsys)
     }
 }
 
+static int epoll_spin (BReactor *bsys, int have_timeout, btime_t timeout_abs)
+{
+    ASSERT(bsys->busy_poll_spin_us > 0)
+    
+    int64_t start_us = btime_gettime_us();
+    int res;
+    
+    while (1) {
+        res = epoll_wait(bsys->efd, bsys->epoll_results, BSYSTEM_MAX_RESULTS, 0);
+        if (res != 0) {
+            // leave errors to the blocking wait
+            res = (res > 0 ? res : 0);
+            break;
+        }
+        
+        if (btime_gettime_us() - start_us >= bsys->busy_poll_spin_us ||
+            (have_timeout && btime_gettime() >= timeout_abs)
+        ) {
+            break;
+        }
+    }
+    
+    bsys->busy_poll_spins++;
+    if (res > 0) {
+        bsys->busy_poll_hits++;
+    }
+    if (bsys->stats) {
+        BReactorStats_AddSpin(bsys->stats, (res > 0), 1000 * (uint64_t)(btime_gettime_us() - start_us));
+    }
+    
+    return res;
+}
+
+#endif
+
+#ifdef BADVPN_USE_IO_URING
+
+struct BReactor__UringFd_t {
+    BFileDescriptor *bfd; // NULL after the fd has been removed
+    int armed; // whether a poll request is in flight
+    int armed_events; // events the poll in flight was armed for
+    int cancel_queued; // whether a cancellation of the poll in flight has been queued
+    int returned; // whether the completed poll is in the results array
+    int dirty; // whether in the dirty list
+    LinkedList1Node fds_list_node;
+    LinkedList1Node dirty_list_node;
+};
+
+static int uring_setup (unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter (int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static void uring_free_fd (BReactor *bsys, struct BReactor__UringFd_t *ufd)
+{
+    ASSERT(!ufd->bfd)
+    ASSERT(!ufd->armed)
+    ASSERT(!ufd->returned)
+    
+    if (ufd->dirty) {
+        LinkedList1_Remove(&bsys->uring_dirty_list, &ufd->dirty_list_node);
+    }
+    LinkedList1_Remove(&bsys->uring_fds_list, &ufd->fds_list_node);
+    BFree(ufd);
+}
+
+static void uring_mark_dirty (BReactor *bsys, struct BReactor__UringFd_t *ufd)
+{
+    if (!ufd->dirty) {
+        LinkedList1_Append(&bsys->uring_dirty_list, &ufd->dirty_list_node);
+        ufd->dirty = 1;
+    }
+}
+
+static void uring_submit_queued (BReactor *bsys)
+{
+    while (bsys->uring_sq_queued > 0) {
+        int res = uring_enter(bsys->uring_fd, bsys->uring_sq_queued, 0, 0, NULL, 0);
+        if (res < 0) {
+            int error = errno;
+            if (error == EINTR) {
+                continue;
+            }
+            perror("io_uring_enter");
+            ASSERT_FORCE(0)
+        }
+        ASSERT_FORCE((unsigned int)res <= bsys->uring_sq_queued)
+        bsys->uring_sq_queued -= res;
+    }
+}
+
+static struct io_uring_sqe * uring_get_sqe (BReactor *bsys)
+{
+    // make room if the submission queue is full
+    if (bsys->uring_sq_queued == bsys->uring_sq_entries) {
+        uring_submit_queued(bsys);
+    }
+    
+    unsigned int tail = *bsys->uring_sq_tail;
+    ASSERT(tail - __atomic_load_n(bsys->uring_sq_head, __ATOMIC_ACQUIRE) < bsys->uring_sq_entries)
+    
+    struct io_uring_sqe *sqe = &bsys->uring_sqes[tail & bsys->uring_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    
+    return sqe;
+}
+
+static void uring_commit_sqe (BReactor *bsys)
+{
+    __atomic_store_n(bsys->uring_sq_tail, *bsys->uring_sq_tail + 1, __ATOMIC_RELEASE);
+    bsys->uring_sq_queued++;
+}
+
+static void uring_sync_polls (BReactor *bsys)
+{
+    // Arm polls for fds which have wanted events but no poll in flight, and cancel
+    // polls which miss some of the wanted events; they get re-armed when the
+    // cancellation completes. Polls armed for more events than wanted are left
+    // alone and the extra events are filtered out when dispatching, so turning
+    // events off and back on costs nothing.
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(&bsys->uring_dirty_list)) {
+        struct BReactor__UringFd_t *ufd = UPPER_OBJECT(list_node, struct BReactor__UringFd_t, dirty_list_node);
+        ASSERT(ufd->dirty)
+        ASSERT(!ufd->returned)
+        
+        LinkedList1_Remove(&bsys->uring_dirty_list, &ufd->dirty_list_node);
+        ufd->dirty = 0;
+        
+        int events = (ufd->bfd ? ufd->bfd->waitEvents : 0);
+        
+        if (!ufd->armed) {
+            if (!ufd->bfd) {
+                uring_free_fd(bsys, ufd);
+                continue;
+            }
+            
+            // arm even with no wanted events, so that errors and hang-ups are
+            // reported like with epoll and poll
+            {
+                int pevents = 0;
+                if ((events & BREACTOR_READ)) {
+                    pevents |= POLLIN;
+                }
+                if ((events & BREACTOR_WRITE)) {
+                    pevents |= POLLOUT;
+                }
+                
+                struct io_uring_sqe *sqe = uring_get_sqe(bsys);
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = ufd->bfd->fd;
+                #ifdef BADVPN_BIG_ENDIAN
+                sqe->poll32_events = ((uint32_t)pevents << 16) | ((uint32_t)pevents >> 16);
+                #else
+                sqe->poll32_events = pevents;
+                #endif
+                sqe->user_data = (uintptr_t)ufd;
+                uring_commit_sqe(bsys);
+                
+                ufd->armed = 1;
+                ufd->armed_events = events;
+            }
+        }
+        else if (!ufd->cancel_queued && (!ufd->bfd || (events & ~ufd->armed_events))) {
+            struct io_uring_sqe *sqe = uring_get_sqe(bsys);
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = (uintptr_t)ufd;
+            sqe->user_data = 0;
+            uring_commit_sqe(bsys);
+            
+            ufd->cancel_queued = 1;
+        }
+    }
+}
+
+static int uring_collect_results (BReactor *bsys)
+{
+    ASSERT(bsys->uring_results_num == 0)
+    
+    unsigned int head = *bsys->uring_cq_head;
+    unsigned int tail = __atomic_load_n(bsys->uring_cq_tail, __ATOMIC_ACQUIRE);
+    
+    while (head != tail && bsys->uring_results_num < BSYSTEM_MAX_RESULTS) {
+        struct io_uring_cqe *cqe = &bsys->uring_cqes[head & bsys->uring_cq_mask];
+        head++;
+        
+        // ignore completions of cancellations
+        if (!cqe->user_data) {
+            continue;
+        }
+        
+        struct BReactor__UringFd_t *ufd = (struct BReactor__UringFd_t *)(uintptr_t)cqe->user_data;
+        ASSERT(ufd->armed)
+        ASSERT(!ufd->returned)
+        
+        ufd->armed = 0;
+        ufd->cancel_queued = 0;
+        
+        if (!ufd->bfd) {
+            uring_free_fd(bsys, ufd);
+            continue;
+        }
+        
+        ASSERT(ufd->bfd->active)
+        
+        if (cqe->res == -ECANCELED) {
+            // cancelled for re-arming
+            uring_mark_dirty(bsys, ufd);
+            continue;
+        }
+        
+        bsys->uring_results[bsys->uring_results_num] = ufd;
+        bsys->uring_results_events[bsys->uring_results_num] = (cqe->res < 0 ? POLLERR : cqe->res);
+        bsys->uring_results_num++;
+        ufd->returned = 1;
+    }
+    
+    __atomic_store_n(bsys->uring_cq_head, head, __ATOMIC_RELEASE);
+    
+    return bsys->uring_results_num;
+}
+
 #endif
 
 #ifdef BADVPN_USE_KEVENT
@@ -270,16 +868,190 @@ static void set_poll_fd_pointers (BReactor *bsys)
 
 #endif
 
-static void wait_for_events (BReactor *bsys)
+static int stats_num_wait_events (BReactor *bsys)
 {
-    // must have processed all pending events
-    ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
+    #ifdef BADVPN_USE_EPOLL
+    return bsys->epoll_results_num;
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    return bsys->uring_results_num;
+    #endif
+    #ifdef BADVPN_USE_KEVENT
+    return bsys->kevent_results_num;
+    #endif
+    #ifdef BADVPN_USE_POLL
+    return bsys->poll_results_num;
+    #endif
+    #ifdef BADVPN_USE_WINAPI
+    return LinkedList1_IsEmpty(&bsys->iocp_ready_list) ? 0 : 1;
+    #endif
+}
+
+static void dispatch_job (BReactor *bsys)
+{
+    if (!bsys->stats) {
+        BPendingGroup_ExecuteJob(&bsys->pending_jobs);
+        return;
+    }
+    
+    BReactorStats_callsite callsite = (BReactorStats_callsite)BPendingGroup_PeekJob(&bsys->pending_jobs)->handler;
+    uint64_t start = BReactorStats_Now();
+    BPendingGroup_ExecuteJob(&bsys->pending_jobs);
+    BReactorStats_AddCall(bsys->stats, BREACTORSTATS_KIND_JOB, callsite, BReactorStats_Now() - start);
+}
+
+static void dispatch_timer (BReactor *bsys, BSmallTimer *timer)
+{
+    if (!bsys->stats) {
+        if (timer->is_small) {
+            timer->handler.smalll(timer);
+        } else {
+            BTimer *btimer = UPPER_OBJECT(timer, BTimer, base);
+            timer->handler.heavy(btimer->user);
+        }
+        return;
+    }
+    
+    BReactorStats_AddTimerLateness(bsys->stats, btime_gettime() - timer->absTime);
+    
+    BReactorStats_callsite callsite;
+    uint64_t start = BReactorStats_Now();
+    if (timer->is_small) {
+        callsite = (BReactorStats_callsite)timer->handler.smalll;
+        timer->handler.smalll(timer);
+    } else {
+        BTimer *btimer = UPPER_OBJECT(timer, BTimer, base);
+        callsite = (BReactorStats_callsite)timer->handler.heavy;
+        timer->handler.heavy(btimer->user);
+    }
+    BReactorStats_AddCall(bsys->stats, BREACTORSTATS_KIND_TIMER, callsite, BReactorStats_Now() - start);
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+static void dispatch_fd (BReactor *bsys, BFileDescriptor *bfd, int events)
+{
+    if (!bsys->stats) {
+        bfd->handler(bfd->user, events);
+        return;
+    }
+    
+    BReactorStats_callsite callsite = (BReactorStats_callsite)bfd->handler;
+    uint64_t start = BReactorStats_Now();
+    bfd->handler(bfd->user, events);
+    BReactorStats_AddCall(bsys->stats, BREACTORSTATS_KIND_FD, callsite, BReactorStats_Now() - start);
+}
+
+#endif
+
+static void wait_timed_out (BReactor *bsys, int poll_only)
+{
+    // when only polling, expired timers were already collected, and the
+    // first timer is not due yet
+    if (!poll_only) {
+        move_first_timers(bsys);
+    }
+}
+
+static void start_job_slice (BReactor *bsys)
+{
+    bsys->job_slice_jobs = 0;
+    if (bsys->job_budget_us > 0) {
+        bsys->job_slice_start_us = btime_gettime_us();
+    }
+}
+
+static int job_budget_exhausted (BReactor *bsys)
+{
+    ASSERT(bsys->job_budget_jobs > 0 || bsys->job_budget_us > 0)
+    
+    if (bsys->job_budget_jobs > 0 && bsys->job_slice_jobs >= bsys->job_budget_jobs) {
+        return 1;
+    }
+    
+    // reading the clock for every job would cost more than many jobs do
+    if (bsys->job_budget_us > 0 && bsys->job_slice_jobs > 0 && bsys->job_slice_jobs % BSYSTEM_JOB_BUDGET_CLOCK_INTERVAL == 0 &&
+        btime_gettime_us() - bsys->job_slice_start_us >= bsys->job_budget_us
+    ) {
+        return 1;
+    }
+    
+    bsys->job_slice_jobs++;
+    
+    return 0;
+}
+
+static int have_undispatched_events (BReactor *bsys)
+{
+    if (!LinkedList1_IsEmpty(&bsys->timers_expired_list)) {
+        return 1;
+    }
+    #ifdef BADVPN_USE_WINAPI
+    if (!LinkedList1_IsEmpty(&bsys->iocp_ready_list)) {
+        return 1;
+    }
+    #endif
+    #ifdef BADVPN_USE_EPOLL
+    if (bsys->epoll_results_pos < bsys->epoll_results_num) {
+        return 1;
+    }
+    if (!LinkedList1_IsEmpty(&bsys->edge_dispatch_list)) {
+        return 1;
+    }
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    if (bsys->uring_results_pos < bsys->uring_results_num) {
+        return 1;
+    }
+    #endif
+    #ifdef BADVPN_USE_KEVENT
+    if (bsys->kevent_results_pos < bsys->kevent_results_num) {
+        return 1;
+    }
+    #endif
+    #ifdef BADVPN_USE_POLL
+    if (bsys->poll_results_pos < bsys->poll_results_num) {
+        return 1;
+    }
+    #endif
+    return 0;
+}
+
+static void wait_for_events (BReactor *bsys, int poll_only);
+
+static void defer_jobs (BReactor *bsys)
+{
+    BLog(BLOG_DEBUG, "Job budget exceeded");
+    
+    bsys->job_budget_exceeded++;
+    if (bsys->stats) {
+        BReactorStats_AddBudgetExceeded(bsys->stats);
+    }
+    
+    // if there are no events left over from the last wait, check for new ones
+    if (!have_undispatched_events(bsys)) {
+        wait_for_events(bsys, 1);
+    }
+    
+    // let one event be dispatched before the remaining jobs
+    bsys->jobs_deferred = 1;
+    start_job_slice(bsys);
+}
+
+static void wait_for_events (BReactor *bsys, int poll_only)
+{
+    // must have processed all pending events, except jobs when only polling
+    ASSERT(poll_only || !BPendingGroup_HasJobs(&bsys->pending_jobs))
     ASSERT(LinkedList1_IsEmpty(&bsys->timers_expired_list))
     #ifdef BADVPN_USE_WINAPI
     ASSERT(LinkedList1_IsEmpty(&bsys->iocp_ready_list))
     #endif
     #ifdef BADVPN_USE_EPOLL
     ASSERT(bsys->epoll_results_pos == bsys->epoll_results_num)
+    ASSERT(LinkedList1_IsEmpty(&bsys->edge_dispatch_list))
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    ASSERT(bsys->uring_results_pos == bsys->uring_results_num)
     #endif
     #ifdef BADVPN_USE_KEVENT
     ASSERT(bsys->kevent_results_pos == bsys->kevent_results_num)
@@ -290,10 +1062,22 @@ static void wait_for_events (BReactor *bsys)
 
     // clean up epoll results
     #ifdef BADVPN_USE_EPOLL
+    
+    // don't block if edge-triggered fds may already be ready
+    if (!LinkedList1_IsEmpty(&bsys->edge_pending_list)) {
+        poll_only = 1;
+    }
+    
     bsys->epoll_results_num = 0;
     bsys->epoll_results_pos = 0;
     #endif
     
+    // clean up io_uring results
+    #ifdef BADVPN_USE_IO_URING
+    bsys->uring_results_num = 0;
+    bsys->uring_results_pos = 0;
+    #endif
+    
     // clean up kevent results
     #ifdef BADVPN_USE_KEVENT
     bsys->kevent_results_num = 0;
@@ -306,30 +1090,50 @@ static void wait_for_events (BReactor *bsys)
     bsys->poll_results_pos = 0;
     #endif
     
+    // start measuring the wait
+    uint64_t stats_start = 0; // to remove warning
+    if (bsys->stats) {
+        stats_start = BReactorStats_Now();
+    }
+    
     // timeout vars
     int have_timeout = 0;
-    btime_t timeout_abs;
+    btime_t timeout_abs = 0;
     btime_t now = 0; // to remove warning
     
     // compute timeout
-    BSmallTimer *first_timer = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0).link;
-    if (first_timer) {
-        ASSERT(first_timer->state == TIMER_STATE_RUNNING)
-        
+    if (poll_only) {
+        // collect expired timers, then check for I/O without blocking
+        now = btime_gettime();
+        move_expired_timers(bsys, now);
+        have_timeout = 1;
+        timeout_abs = now;
+    }
+    else if (have_running_timers(bsys)) {
         // get current time
         now = btime_gettime();
         
         // if some timers have already timed out, return them immediately
         if (move_expired_timers(bsys, now)) {
             BLog(BLOG_DEBUG, "Got already expired timers");
+            bsys->cached_time = now;
+            start_job_slice(bsys);
+            if (bsys->stats) {
+                BReactorStats_AddWait(bsys->stats, 0, BReactorStats_Now() - stats_start);
+            }
             return;
         }
         
         // timeout is first timer, remember absolute time
         have_timeout = 1;
-        timeout_abs = first_timer->absTime;
+        timeout_abs = first_timer_time(bsys);
     }
     
+    #ifdef BADVPN_USE_EPOLL
+    // spin at most once per wait, before the first blocking wait
+    int may_spin = (bsys->busy_poll_spin_us > 0 && !poll_only);
+    #endif
+    
     // wait until the timeout is reached or the file descriptor / handle in ready
     while (1) {
         // compute timeout
@@ -350,25 +1154,24 @@ static void wait_for_events (BReactor *bsys)
             }
         }
         
-        DWORD bytes = 0;
-        ULONG_PTR key;
-        BReactorIOCPOverlapped *olap = NULL;
-        BOOL res = GetQueuedCompletionStatus(bsys->iocp_handle, &bytes, &key, (OVERLAPPED **)&olap, (have_timeout ? timeout_rel_trunc : INFINITE));
+        // harvest a batch of completions, e.g. from several outstanding reads of a device
+        OVERLAPPED_ENTRY entries[BSYSTEM_MAX_RESULTS];
+        ULONG num_entries = 0;
+        BOOL res = GetQueuedCompletionStatusEx(bsys->iocp_handle, entries, BSYSTEM_MAX_RESULTS, &num_entries, (have_timeout ? timeout_rel_trunc : INFINITE), FALSE);
         
-        ASSERT_FORCE(olap || have_timeout)
+        ASSERT_FORCE(res == TRUE || have_timeout)
         
-        if (olap || timeout_rel_trunc == timeout_rel) {
-            if (olap) {
-                BLog(BLOG_DEBUG, "GetQueuedCompletionStatus returned event");
-                
-                DebugObject_Access(&olap->d_obj);
-                ASSERT(olap->reactor == bsys)
-                ASSERT(!olap->is_ready)
-                
-                set_iocp_ready(olap, (res == TRUE), bytes);
+        if (res == FALSE) {
+            num_entries = 0;
+        }
+        
+        if (num_entries > 0 || timeout_rel_trunc == timeout_rel) {
+            if (num_entries > 0) {
+                BLog(BLOG_DEBUG, "GetQueuedCompletionStatusEx returned %d events", (int)num_entries);
+                collect_iocp_entries(bsys, entries, num_entries);
             } else {
-                BLog(BLOG_DEBUG, "GetQueuedCompletionStatus timed out");
-                move_first_timers(bsys);
+                BLog(BLOG_DEBUG, "GetQueuedCompletionStatusEx timed out");
+                wait_timed_out(bsys, poll_only);
             }
             break;
         }
@@ -383,34 +1186,102 @@ static void wait_for_events (BReactor *bsys)
             }
         }
         
-        BLog(BLOG_DEBUG, "Calling epoll_wait");
+        if (may_spin) {
+            may_spin = 0;
+            
+            int spinres = epoll_spin(bsys, have_timeout, timeout_abs);
+            if (spinres > 0) {
+                BLog(BLOG_DEBUG, "epoll_wait returned %d file descriptors while spinning", spinres);
+                bsys->epoll_results_num = spinres;
+                set_epoll_fd_pointers(bsys);
+                break;
+            }
+            
+            // recompute the timeout, which may have passed while spinning
+            goto try_again;
+        }
+        
+        BLog(BLOG_DEBUG, "Calling epoll_wait");
+        
+        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, BSYSTEM_MAX_RESULTS, (have_timeout ? timeout_rel_trunc : -1));
+        if (waitres < 0) {
+            int error = errno;
+            if (error == EINTR) {
+                BLog(BLOG_DEBUG, "epoll_wait interrupted");
+                goto try_again;
+            }
+            perror("epoll_wait");
+            ASSERT_FORCE(0)
+        }
+        
+        ASSERT_FORCE(!(waitres == 0) || have_timeout)
+        ASSERT_FORCE(waitres <= BSYSTEM_MAX_RESULTS)
+        
+        if (waitres != 0 || timeout_rel_trunc == timeout_rel) {
+            if (waitres != 0) {
+                BLog(BLOG_DEBUG, "epoll_wait returned %d file descriptors", waitres);
+                bsys->epoll_results_num = waitres;
+                set_epoll_fd_pointers(bsys);
+            } else {
+                BLog(BLOG_DEBUG, "epoll_wait timed out");
+                wait_timed_out(bsys, poll_only);
+            }
+            break;
+        }
+        
+        #endif
+        
+        #ifdef BADVPN_USE_IO_URING
+        
+        // queue poll changes, to be submitted together with the wait
+        uring_sync_polls(bsys);
+        
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (have_timeout) {
+            if (timeout_rel_trunc > 86400000) {
+                timeout_rel_trunc = 86400000;
+            }
+            ts.tv_sec = timeout_rel_trunc / 1000;
+            ts.tv_nsec = (timeout_rel_trunc % 1000) * 1000000;
+            arg.ts = (uintptr_t)&ts;
+        }
+        
+        BLog(BLOG_DEBUG, "Calling io_uring_enter");
         
-        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, BSYSTEM_MAX_RESULTS, (have_timeout ? timeout_rel_trunc : -1));
+        int timed_out = 0;
+        int waitres = uring_enter(bsys->uring_fd, bsys->uring_sq_queued, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
         if (waitres < 0) {
             int error = errno;
-            if (error == EINTR) {
-                BLog(BLOG_DEBUG, "epoll_wait interrupted");
-                goto try_again;
+            if (error == ETIME) {
+                timed_out = 1;
             }
-            perror("epoll_wait");
-            ASSERT_FORCE(0)
+            else if (error != EINTR) {
+                perror("io_uring_enter");
+                ASSERT_FORCE(0)
+            }
+        } else {
+            ASSERT_FORCE((unsigned int)waitres <= bsys->uring_sq_queued)
+            bsys->uring_sq_queued -= waitres;
         }
         
-        ASSERT_FORCE(!(waitres == 0) || have_timeout)
-        ASSERT_FORCE(waitres <= BSYSTEM_MAX_RESULTS)
+        int numres = uring_collect_results(bsys);
         
-        if (waitres != 0 || timeout_rel_trunc == timeout_rel) {
-            if (waitres != 0) {
-                BLog(BLOG_DEBUG, "epoll_wait returned %d file descriptors", waitres);
-                bsys->epoll_results_num = waitres;
-                set_epoll_fd_pointers(bsys);
-            } else {
-                BLog(BLOG_DEBUG, "epoll_wait timed out");
-                move_first_timers(bsys);
-            }
+        if (numres != 0) {
+            BLog(BLOG_DEBUG, "io_uring returned %d file descriptors", numres);
+            break;
+        }
+        
+        if (timed_out && timeout_rel_trunc == timeout_rel) {
+            BLog(BLOG_DEBUG, "io_uring_enter timed out");
+            wait_timed_out(bsys, poll_only);
             break;
         }
         
+        BLog(BLOG_DEBUG, "io_uring_enter interrupted");
+        goto try_again;
+        
         #endif
         
         #ifdef BADVPN_USE_KEVENT
@@ -447,7 +1318,7 @@ static void wait_for_events (BReactor *bsys)
                 set_kevent_fd_pointers(bsys);
             } else {
                 BLog(BLOG_DEBUG, "kevent timed out");
-                move_first_timers(bsys);
+                wait_timed_out(bsys, poll_only);
             }
             break;
         }
@@ -519,7 +1390,7 @@ static void wait_for_events (BReactor *bsys)
                 set_poll_fd_pointers(bsys);
             } else {
                 BLog(BLOG_DEBUG, "poll timed out");
-                move_first_timers(bsys);
+                wait_timed_out(bsys, poll_only);
             }
             break;
         }
@@ -533,12 +1404,37 @@ static void wait_for_events (BReactor *bsys)
             // check if we already reached the time we're waiting for
             if (now >= timeout_abs) {
                 BLog(BLOG_DEBUG, "already timed out while trying again");
-                move_first_timers(bsys);
+                wait_timed_out(bsys, poll_only);
                 break;
             }
         }
     }
     
+    #ifdef BADVPN_USE_EPOLL
+    
+    // report edge-triggered fds which may be ready in this iteration
+    LinkedList1Node *edge_node;
+    while (edge_node = LinkedList1_GetFirst(&bsys->edge_pending_list)) {
+        BFileDescriptor *bfd = UPPER_OBJECT(edge_node, BFileDescriptor, edge_list_node);
+        ASSERT(bfd->edge_listed == EDGE_LISTED_PENDING)
+        LinkedList1_Remove(&bsys->edge_pending_list, &bfd->edge_list_node);
+        LinkedList1_Append(&bsys->edge_dispatch_list, &bfd->edge_list_node);
+        bfd->edge_listed = EDGE_LISTED_DISPATCH;
+    }
+    
+    #endif
+    
+    // sample time once for this iteration
+    bsys->cached_time = btime_gettime();
+    
+    // start a new job budget slice
+    start_job_slice(bsys);
+    
+    // record the wait
+    if (bsys->stats) {
+        BReactorStats_AddWait(bsys->stats, stats_num_wait_events(bsys), BReactorStats_Now() - stats_start);
+    }
+    
     // reset limit objects
     LinkedList1Node *list_node;
     while (list_node = LinkedList1_GetFirst(&bsys->active_limits_list)) {
@@ -596,12 +1492,42 @@ int BReactor_Init (BReactor *bsys)
     // set not exiting
     bsys->exiting = 0;
     
+    // init cached time
+    bsys->cached_time = btime_gettime();
+    
+    // statistics are off until enabled
+    bsys->stats = NULL;
+    
+    // no job budget until set
+    bsys->job_budget_enabled = 0;
+    bsys->job_budget_jobs = 0;
+    bsys->job_budget_us = 0;
+    bsys->job_slice_jobs = 0;
+    bsys->job_slice_start_us = 0;
+    bsys->jobs_deferred = 0;
+    bsys->job_budget_exceeded = 0;
+    
+    // no busy polling until set
+    bsys->busy_poll_spin_us = 0;
+    bsys->busy_poll_spins = 0;
+    bsys->busy_poll_hits = 0;
+    
     // init jobs
     BPendingGroup_Init(&bsys->pending_jobs);
     
     // init timers
     BReactor__TimersTree_Init(&bsys->timers_tree);
     LinkedList1_Init(&bsys->timers_expired_list);
+    #ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+    for (int level = 0; level < BSYSTEM_TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            LinkedList1_Init(&bsys->timers_wheel[level][slot]);
+        }
+        bsys->timers_wheel_bitmap[level] = 0;
+    }
+    bsys->timers_wheel_base = btime_gettime() / BADVPN_TIMER_WHEEL_RESOLUTION;
+    LinkedList1_Init(&bsys->timers_wheel_due_list);
+    #endif
     
     // init limits
     LinkedList1_Init(&bsys->active_limits_list);
@@ -634,6 +1560,72 @@ int BReactor_Init (BReactor *bsys)
     bsys->epoll_results_num = 0;
     bsys->epoll_results_pos = 0;
     
+    // init edge-triggered state
+    bsys->edge_triggered = 0;
+    LinkedList1_Init(&bsys->edge_pending_list);
+    LinkedList1_Init(&bsys->edge_dispatch_list);
+    
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    
+    // create io_uring
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if ((bsys->uring_fd = uring_setup(BSYSTEM_IO_URING_ENTRIES, &params)) < 0) {
+        BLog(BLOG_ERROR, "io_uring_setup failed");
+        goto fail0;
+    }
+    
+    // the wait relies on a single ring mapping and timeouts passed to io_uring_enter
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        BLog(BLOG_ERROR, "io_uring lacks required features");
+        goto fail1;
+    }
+    
+    // map rings
+    size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bsys->uring_ring_size = (sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size);
+    bsys->uring_ring_mem = mmap(NULL, bsys->uring_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, bsys->uring_fd, IORING_OFF_SQ_RING);
+    if (bsys->uring_ring_mem == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap io_uring rings failed");
+        goto fail1;
+    }
+    
+    // map submission queue entries
+    bsys->uring_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    bsys->uring_sqes = mmap(NULL, bsys->uring_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, bsys->uring_fd, IORING_OFF_SQES);
+    if (bsys->uring_sqes == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap io_uring entries failed");
+        goto fail2;
+    }
+    
+    char *ring = bsys->uring_ring_mem;
+    bsys->uring_sq_head = (unsigned int *)(ring + params.sq_off.head);
+    bsys->uring_sq_tail = (unsigned int *)(ring + params.sq_off.tail);
+    bsys->uring_sq_mask = *(unsigned int *)(ring + params.sq_off.ring_mask);
+    bsys->uring_sq_entries = params.sq_entries;
+    bsys->uring_sq_queued = 0;
+    bsys->uring_cq_head = (unsigned int *)(ring + params.cq_off.head);
+    bsys->uring_cq_tail = (unsigned int *)(ring + params.cq_off.tail);
+    bsys->uring_cq_mask = *(unsigned int *)(ring + params.cq_off.ring_mask);
+    bsys->uring_cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+    
+    // submission slots map to entries one to one
+    unsigned int *sq_array = (unsigned int *)(ring + params.sq_off.array);
+    for (unsigned int i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    
+    // init poll record lists
+    LinkedList1_Init(&bsys->uring_fds_list);
+    LinkedList1_Init(&bsys->uring_dirty_list);
+    
+    // init results array
+    bsys->uring_results_num = 0;
+    bsys->uring_results_pos = 0;
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -685,6 +1677,12 @@ int BReactor_Init (BReactor *bsys)
     
     return 1;
     
+    #ifdef BADVPN_USE_IO_URING
+fail2:
+    ASSERT_FORCE(munmap(bsys->uring_ring_mem, bsys->uring_ring_size) == 0)
+fail1:
+    ASSERT_FORCE(close(bsys->uring_fd) == 0)
+    #endif
     #ifdef BADVPN_USE_POLL
 fail1:
     BFree(bsys->poll_results_pollfds);
@@ -709,7 +1707,7 @@ void BReactor_Free (BReactor *bsys)
     
     // {pending group has no BPending objects}
     ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
-    ASSERT(BReactor__TimersTree_IsEmpty(&bsys->timers_tree))
+    ASSERT(!have_running_timers(bsys))
     ASSERT(LinkedList1_IsEmpty(&bsys->timers_expired_list))
     ASSERT(LinkedList1_IsEmpty(&bsys->active_limits_list))
     DebugObject_Free(&bsys->d_obj);
@@ -728,6 +1726,10 @@ void BReactor_Free (BReactor *bsys)
     ASSERT(bsys->poll_num_enabled_fds == 0)
     ASSERT(LinkedList1_IsEmpty(&bsys->poll_enabled_fds_list))
     #endif
+    #ifdef BADVPN_USE_EPOLL
+    ASSERT(LinkedList1_IsEmpty(&bsys->edge_pending_list))
+    ASSERT(LinkedList1_IsEmpty(&bsys->edge_dispatch_list))
+    #endif
     
     BLog(BLOG_DEBUG, "Reactor freeing");
     
@@ -745,6 +1747,25 @@ void BReactor_Free (BReactor *bsys)
     
     #endif
     
+    #ifdef BADVPN_USE_IO_URING
+    
+    // free poll records of removed fds whose polls are still in flight;
+    // closing the ring cancels the polls
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(&bsys->uring_fds_list)) {
+        struct BReactor__UringFd_t *ufd = UPPER_OBJECT(list_node, struct BReactor__UringFd_t, fds_list_node);
+        ASSERT(!ufd->bfd)
+        LinkedList1_Remove(&bsys->uring_fds_list, &ufd->fds_list_node);
+        BFree(ufd);
+    }
+    
+    // unmap rings and close io_uring fd
+    ASSERT_FORCE(munmap(bsys->uring_sqes, bsys->uring_sqes_size) == 0)
+    ASSERT_FORCE(munmap(bsys->uring_ring_mem, bsys->uring_ring_size) == 0)
+    ASSERT_FORCE(close(bsys->uring_fd) == 0)
+    
+    #endif
+    
     #ifdef BADVPN_USE_KEVENT
     
     // close kqueue fd
@@ -760,6 +1781,12 @@ void BReactor_Free (BReactor *bsys)
     
     #endif
     
+    // free statistics
+    if (bsys->stats) {
+        BReactorStats_Free(bsys->stats);
+        BFree(bsys->stats);
+    }
+    
     // free jobs
     BPendingGroup_Free(&bsys->pending_jobs);
 }
@@ -771,8 +1798,17 @@ int BReactor_Exec (BReactor *bsys)
     while (!bsys->exiting) {
         // dispatch job
         if (BPendingGroup_HasJobs(&bsys->pending_jobs)) {
-            BPendingGroup_ExecuteJob(&bsys->pending_jobs);
-            continue;
+            if (!bsys->jobs_deferred) {
+                if (bsys->job_budget_enabled && job_budget_exhausted(bsys)) {
+                    defer_jobs(bsys);
+                    continue;
+                }
+                dispatch_job(bsys);
+                continue;
+            }
+            
+            // jobs were deferred to let an event through first
+            bsys->jobs_deferred = 0;
         }
         
         // dispatch timer
@@ -789,12 +1825,7 @@ int BReactor_Exec (BReactor *bsys)
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching timer");
-            if (timer->is_small) {
-                timer->handler.smalll(timer);
-            } else {
-                BTimer *btimer = UPPER_OBJECT(timer, BTimer, base);
-                timer->handler.heavy(btimer->user);
-            }
+            dispatch_timer(bsys, timer);
             continue;
         }
         
@@ -814,7 +1845,14 @@ int BReactor_Exec (BReactor *bsys)
             int event = (olap->ready_succeeded ? BREACTOR_IOCP_EVENT_SUCCEEDED : BREACTOR_IOCP_EVENT_FAILED);
             
             // call handler
-            olap->handler(olap->user, event, olap->ready_bytes);
+            if (bsys->stats) {
+                BReactorStats_callsite callsite = (BReactorStats_callsite)olap->handler;
+                uint64_t start = BReactorStats_Now();
+                olap->handler(olap->user, event, olap->ready_bytes);
+                BReactorStats_AddCall(bsys->stats, BREACTORSTATS_KIND_OTHER, callsite, BReactorStats_Now() - start);
+            } else {
+                olap->handler(olap->user, event, olap->ready_bytes);
+            }
             continue;
         }
         
@@ -841,6 +1879,16 @@ int BReactor_Exec (BReactor *bsys)
             // zero pointer to the epoll entry
             bfd->epoll_returned_ptr = NULL;
             
+            // remember readiness of edge-triggered fds until the user sees EAGAIN
+            if (bfd->edge) {
+                if ((event->events & (EPOLLIN|EPOLLERR|EPOLLHUP))) {
+                    bfd->edge_ready |= BREACTOR_READ;
+                }
+                if ((event->events & (EPOLLOUT|EPOLLERR|EPOLLHUP))) {
+                    bfd->edge_ready |= BREACTOR_WRITE;
+                }
+            }
+            
             // calculate events to report
             int events = 0;
             if ((bfd->waitEvents&BREACTOR_READ) && (event->events&EPOLLIN)) {
@@ -857,13 +1905,90 @@ int BReactor_Exec (BReactor *bsys)
             }
             
             if (!events) {
-                BLog(BLOG_ERROR, "no events detected?");
+                // edge-triggered fds report edges of events not waited for
+                if (!bfd->edge) {
+                    BLog(BLOG_ERROR, "no events detected?");
+                }
+                continue;
+            }
+            
+            // call handler
+            BLog(BLOG_DEBUG, "Dispatching file descriptor");
+            dispatch_fd(bsys, bfd, events);
+            continue;
+        }
+        
+        // dispatch edge-triggered file descriptor which may still be ready
+        if (!LinkedList1_IsEmpty(&bsys->edge_dispatch_list)) {
+            BFileDescriptor *bfd = UPPER_OBJECT(LinkedList1_GetFirst(&bsys->edge_dispatch_list), BFileDescriptor, edge_list_node);
+            ASSERT(bfd->active)
+            ASSERT(bfd->edge)
+            ASSERT(bfd->edge_listed == EDGE_LISTED_DISPATCH)
+            
+            LinkedList1_Remove(&bsys->edge_dispatch_list, &bfd->edge_list_node);
+            bfd->edge_listed = 0;
+            
+            // the user may have stopped waiting or seen EAGAIN since
+            int events = bfd->waitEvents & bfd->edge_ready;
+            if (events) {
+                BLog(BLOG_DEBUG, "Dispatching edge-triggered file descriptor");
+                dispatch_fd(bsys, bfd, events);
+            }
+            continue;
+        }
+        
+        #endif
+        
+        #ifdef BADVPN_USE_IO_URING
+        
+        // dispatch file descriptor
+        if (bsys->uring_results_pos < bsys->uring_results_num) {
+            // grab completed poll
+            struct BReactor__UringFd_t *ufd = bsys->uring_results[bsys->uring_results_pos];
+            int revents = bsys->uring_results_events[bsys->uring_results_pos];
+            bsys->uring_results_pos++;
+            
+            ASSERT(ufd->returned)
+            ASSERT(!ufd->armed)
+            ufd->returned = 0;
+            
+            // check if the BFileDescriptor was removed
+            if (!ufd->bfd) {
+                uring_free_fd(bsys, ufd);
+                continue;
+            }
+            
+            // get BFileDescriptor
+            BFileDescriptor *bfd = ufd->bfd;
+            ASSERT(bfd->active)
+            ASSERT(bfd->uring_fd == ufd)
+            
+            // the poll was consumed, re-arm it before the next wait
+            uring_mark_dirty(bsys, ufd);
+            
+            // calculate events to report
+            int events = 0;
+            if ((bfd->waitEvents&BREACTOR_READ) && (revents&POLLIN)) {
+                events |= BREACTOR_READ;
+            }
+            if ((bfd->waitEvents&BREACTOR_WRITE) && (revents&POLLOUT)) {
+                events |= BREACTOR_WRITE;
+            }
+            if ((revents&POLLERR)) {
+                events |= BREACTOR_ERROR;
+            }
+            if ((revents&POLLHUP)) {
+                events |= BREACTOR_HUP;
+            }
+            
+            // the poll may have been armed for events no longer wanted
+            if (!events) {
                 continue;
             }
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching file descriptor");
-            bfd->handler(bfd->user, events);
+            dispatch_fd(bsys, bfd, events);
             continue;
         }
         
@@ -912,7 +2037,7 @@ int BReactor_Exec (BReactor *bsys)
                     
                     // call handler
                     BLog(BLOG_DEBUG, "Dispatching file descriptor");
-                    bfd->handler(bfd->user, events);
+                    dispatch_fd(bsys, bfd, events);
                     continue;
                 } break;
                 
@@ -928,7 +2053,14 @@ int BReactor_Exec (BReactor *bsys)
                     
                     // call handler
                     BLog(BLOG_DEBUG, "Dispatching kevent");
-                    kev->handler(kev->user, event->fflags, event->data);
+                    if (bsys->stats) {
+                        BReactorStats_callsite callsite = (BReactorStats_callsite)kev->handler;
+                        uint64_t start = BReactorStats_Now();
+                        kev->handler(kev->user, event->fflags, event->data);
+                        BReactorStats_AddCall(bsys->stats, BREACTORSTATS_KIND_OTHER, callsite, BReactorStats_Now() - start);
+                    } else {
+                        kev->handler(kev->user, event->fflags, event->data);
+                    }
                     continue;
                 } break;
                 
@@ -976,13 +2108,18 @@ int BReactor_Exec (BReactor *bsys)
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching file descriptor");
-            bfd->handler(bfd->user, events);
+            dispatch_fd(bsys, bfd, events);
             continue;
         }
         
         #endif
         
-        wait_for_events(bsys);
+        // jobs were deferred but no event was dispatched after all
+        if (BPendingGroup_HasJobs(&bsys->pending_jobs)) {
+            continue;
+        }
+        
+        wait_for_events(bsys, 0);
     }
 
     BLog(BLOG_DEBUG, "Exiting event loop, exit code %d", bsys->exit_code);
@@ -1015,10 +2152,19 @@ void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t
     // set running
     bt->state = TIMER_STATE_RUNNING;
     
+    #ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+    
+    // insert to timer wheel
+    wheel_insert(bsys, bt);
+    
+    #else
+    
     // insert to running timers tree
     BReactor__TimersTreeRef ref = {bt, bt};
     int res = BReactor__TimersTree_Insert(&bsys->timers_tree, 0, ref, NULL);
     ASSERT_EXECUTE(res)
+    
+    #endif
 }
 
 void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt)
@@ -1033,9 +2179,14 @@ void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt)
         // remove from expired list
         LinkedList1_Remove(&bsys->timers_expired_list, &bt->u.list_node);
     } else {
+        #ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+        // remove from timer wheel
+        wheel_remove(bsys, bt);
+        #else
         // remove from running tree
         BReactor__TimersTreeRef ref = {bt, bt};
         BReactor__TimersTree_Remove(&bsys->timers_tree, 0, ref);
+        #endif
     }
 
     // set inactive
@@ -1067,6 +2218,105 @@ BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
     return &bsys->pending_jobs;
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return bsys->cached_time;
+}
+
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us)
+{
+    ASSERT(max_jobs >= 0)
+    ASSERT(max_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    bsys->job_budget_jobs = max_jobs;
+    bsys->job_budget_us = max_us;
+    bsys->job_budget_enabled = (max_jobs > 0 || max_us > 0);
+    start_job_slice(bsys);
+}
+
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return bsys->job_budget_exceeded;
+}
+
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us)
+{
+    ASSERT(spin_us >= 0)
+    ASSERT(kernel_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    #ifdef BADVPN_USE_EPOLL
+    
+    bsys->busy_poll_spin_us = spin_us;
+    
+    if (kernel_us > 0) {
+        struct epoll_params params;
+        memset(&params, 0, sizeof(params));
+        params.busy_poll_usecs = kernel_us;
+        
+        // a zero budget means the kernel default
+        if (ioctl(bsys->efd, EPIOCSPARAMS, &params) < 0) {
+            BLog(BLOG_WARNING, "failed to set epoll busy poll parameters: %s", strerror(errno));
+        }
+    }
+    
+    #else
+    
+    if (spin_us > 0 || kernel_us > 0) {
+        BLog(BLOG_WARNING, "busy polling is only supported with epoll, ignoring");
+    }
+    
+    #endif
+}
+
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    *out_spins = bsys->busy_poll_spins;
+    *out_hits = bsys->busy_poll_hits;
+}
+
+int BReactor_EnableStats (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (bsys->stats) {
+        return 1;
+    }
+    
+    if (!(bsys->stats = BAlloc(sizeof(*bsys->stats)))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    BReactorStats_Init(bsys->stats);
+    
+    return 1;
+}
+
+int BReactor_LogStats (BReactor *bsys, int level, int reset)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (!bsys->stats) {
+        return 0;
+    }
+    
+    BReactorStats_Log(bsys->stats, level);
+    
+    if (reset) {
+        BReactorStats_Reset(bsys->stats);
+    }
+    
+    return 1;
+}
+
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
 {
     ASSERT(ref)
@@ -1084,18 +2334,35 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
     return 0;
 }
 
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    #ifdef BADVPN_USE_EPOLL
+    
+    bsys->edge_triggered = !!enabled;
+    
+    #else
+    
+    if (enabled) {
+        BLog(BLOG_WARNING, "edge-triggered mode is only supported with epoll, ignoring");
+    }
+    
+    #endif
+}
+
 #ifndef BADVPN_USE_WINAPI
 
-int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
+static int add_file_descriptor (BReactor *bsys, BFileDescriptor *bs, int edge)
 {
     ASSERT(!bs->active)
     
     #ifdef BADVPN_USE_EPOLL
     
-    // add epoll entry
+    // add epoll entry; edge-triggered fds are registered for all events once
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.events = 0;
+    event.events = (edge ? (EPOLLIN|EPOLLOUT|EPOLLET) : 0);
     event.data.ptr = bs;
     if (epoll_ctl(bsys->efd, EPOLL_CTL_ADD, bs->fd, &event) < 0) {
         int error = errno;
@@ -1106,6 +2373,34 @@ int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
     // set epoll returned pointer
     bs->epoll_returned_ptr = NULL;
     
+    // the fd may be ready for anything until the user sees EAGAIN
+    bs->edge = edge;
+    bs->edge_ready = (edge ? (BREACTOR_READ|BREACTOR_WRITE) : 0);
+    bs->edge_listed = 0;
+    
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    
+    // allocate poll record
+    struct BReactor__UringFd_t *ufd = BAlloc(sizeof(*ufd));
+    if (!ufd) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    ufd->bfd = bs;
+    ufd->armed = 0;
+    ufd->armed_events = 0;
+    ufd->cancel_queued = 0;
+    ufd->returned = 0;
+    ufd->dirty = 0;
+    LinkedList1_Append(&bsys->uring_fds_list, &ufd->fds_list_node);
+    
+    bs->uring_fd = ufd;
+    
+    // arm before the next wait, for errors and hang-ups
+    uring_mark_dirty(bsys, ufd);
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -1141,6 +2436,20 @@ int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
     return 1;
 }
 
+int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
+{
+    return add_file_descriptor(bsys, bs, 0);
+}
+
+int BReactor_AddFileDescriptorEdge (BReactor *bsys, BFileDescriptor *bs)
+{
+    #ifdef BADVPN_USE_EPOLL
+    return add_file_descriptor(bsys, bs, bsys->edge_triggered);
+    #else
+    return add_file_descriptor(bsys, bs, 0);
+    #endif
+}
+
 void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
 {
     ASSERT(bs->active)
@@ -1160,6 +2469,29 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
         *bs->epoll_returned_ptr = NULL;
     }
     
+    // remove from edge-triggered lists
+    if (bs->edge_listed == EDGE_LISTED_PENDING) {
+        LinkedList1_Remove(&bsys->edge_pending_list, &bs->edge_list_node);
+    }
+    else if (bs->edge_listed == EDGE_LISTED_DISPATCH) {
+        LinkedList1_Remove(&bsys->edge_dispatch_list, &bs->edge_list_node);
+    }
+    
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    
+    // detach poll record; it is freed once no poll is in flight and
+    // it is not in the results array
+    struct BReactor__UringFd_t *ufd = bs->uring_fd;
+    ufd->bfd = NULL;
+    if (!ufd->armed && !ufd->returned) {
+        uring_free_fd(bsys, ufd);
+    }
+    else if (ufd->armed) {
+        uring_mark_dirty(bsys, ufd);
+    }
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -1207,6 +2539,17 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     
     #ifdef BADVPN_USE_EPOLL
     
+    // edge-triggered fds stay registered for all events; if the fd may
+    // already be ready, no new edge will come, so report it after the next wait
+    if (bs->edge) {
+        if ((events & bs->edge_ready) && !bs->edge_listed) {
+            LinkedList1_Append(&bsys->edge_pending_list, &bs->edge_list_node);
+            bs->edge_listed = EDGE_LISTED_PENDING;
+        }
+        bs->waitEvents = events;
+        return;
+    }
+    
     // calculate epoll events
     int eevents = 0;
     if ((events & BREACTOR_READ)) {
@@ -1225,6 +2568,13 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     
     #endif
     
+    #ifdef BADVPN_USE_IO_URING
+    
+    // polls are updated before the next wait
+    uring_mark_dirty(bsys, bs->uring_fd);
+    
+    #endif
+    
     #ifdef BADVPN_USE_KEVENT
     
     update_kevent_fd_events(bsys, bs, events);
@@ -1235,6 +2585,16 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     bs->waitEvents = events;
 }
 
+void BReactor_ClearFileDescriptorReady (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
+    
+    #ifdef BADVPN_USE_EPOLL
+    bs->edge_ready &= ~events;
+    #endif
+}
+
 #endif
 
 void BReactorLimit_Init (BReactorLimit *o, BReactor *reactor, int limit)
@@ -1407,23 +2767,16 @@ void BReactorIOCPOverlapped_Wait (BReactorIOCPOverlapped *o, int *out_succeeded,
     BReactor *reactor = o->reactor;
     DebugObject_Access(&o->d_obj);
     
-    // wait for IOCP events until we get an event for this olap
+    // wait for IOCP events until we get an event for this olap; completions of
+    // other olaps are left in the ready list, to be dispatched by the reactor
     while (!o->is_ready) {
-        DWORD bytes = 0;
-        ULONG_PTR key;
-        BReactorIOCPOverlapped *olap = NULL;
-        BOOL res = GetQueuedCompletionStatus(reactor->iocp_handle, &bytes, &key, (OVERLAPPED **)&olap, INFINITE);
+        OVERLAPPED_ENTRY entries[BSYSTEM_MAX_RESULTS];
+        ULONG num_entries = 0;
+        BOOL res = GetQueuedCompletionStatusEx(reactor->iocp_handle, entries, BSYSTEM_MAX_RESULTS, &num_entries, INFINITE, FALSE);
         
-        ASSERT_FORCE(olap)
-        DebugObject_Access(&olap->d_obj);
-        ASSERT(olap->reactor == reactor)
+        ASSERT_FORCE(res == TRUE)
         
-        // regular I/O should be done synchronously, so we shoudln't ever get a second completion before an
-        // existing one is dispatched. If however PostQueuedCompletionStatus is being used to signal events,
-        // just discard any excess events.
-        if (!olap->is_ready) {
-            set_iocp_ready(olap, (res == TRUE), bytes);
-        }
+        collect_iocp_entries(reactor, entries, num_entries);
     }
     
     // remove from IOCP ready list
@@ -35,7 +35,7 @@
 #ifndef BADVPN_SYSTEM_BREACTOR_H
 #define BADVPN_SYSTEM_BREACTOR_H
 
-#if (defined(BADVPN_USE_WINAPI) + defined(BADVPN_USE_EPOLL) + defined(BADVPN_USE_KEVENT) + defined(BADVPN_USE_POLL)) != 1
+#if (defined(BADVPN_USE_WINAPI) + defined(BADVPN_USE_EPOLL) + defined(BADVPN_USE_IO_URING) + defined(BADVPN_USE_KEVENT) + defined(BADVPN_USE_POLL)) != 1
 #error Unknown event backend or too many event backends
 #endif
 
@@ -47,6 +47,10 @@
 #include <sys/epoll.h>
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
 #ifdef BADVPN_USE_KEVENT
 #include <sys/types.h>
 #include <sys/event.h>
@@ -66,6 +70,7 @@
 #include <structure/CAvl.h>
 #include <system/BTime.h>
 #include <base/BPending.h>
+#include <system/BReactorStats.h>
 
 struct BSmallTimer_t;
 typedef struct BSmallTimer_t *BReactor_timerstree_link;
@@ -116,6 +121,9 @@ typedef struct BSmallTimer_t {
     int8_t tree_balance;
     uint8_t state;
     uint8_t is_small;
+    #ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+    int16_t wheel_pos;
+    #endif
 } BSmallTimer;
 
 /**
@@ -199,6 +207,14 @@ typedef struct BFileDescriptor_t {
     
     #ifdef BADVPN_USE_EPOLL
     struct BFileDescriptor_t **epoll_returned_ptr;
+    int edge; // registered edge-triggered
+    int edge_ready; // events which may be ready, as no EAGAIN was reported since the last edge
+    int edge_listed; // 0, or which list edge_list_node is in
+    LinkedList1Node edge_list_node;
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    struct BReactor__UringFd_t *uring_fd;
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -230,21 +246,63 @@ void BFileDescriptor_Init (BFileDescriptor *bs, int fd, BFileDescriptor_handler
 #define BSYSTEM_MAX_RESULTS 64
 #define BSYSTEM_MAX_HANDLES 64
 #define BSYSTEM_MAX_POLL_FDS 4096
+#define BSYSTEM_IO_URING_ENTRIES 256
+#define BSYSTEM_TIMER_WHEEL_LEVELS 4
+#define BSYSTEM_TIMER_WHEEL_BITS 6
+#define BSYSTEM_JOB_BUDGET_CLOCK_INTERVAL 16
+
+#ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+#if BADVPN_TIMER_WHEEL_RESOLUTION < 1
+#error BADVPN_TIMER_WHEEL_RESOLUTION must be positive
+#endif
+#endif
 
 /**
  * Event loop that supports file desciptor (Linux) or HANDLE (Windows) events
  * and timers.
+ * 
+ * If BADVPN_TIMER_WHEEL_RESOLUTION is defined, running timers are kept in a
+ * hierarchical timer wheel with that resolution in milliseconds, making
+ * starting and stopping timers O(1). Timers then expire up to one resolution
+ * step late, and timers expiring in the same step expire in no particular
+ * order. Timers too far in the future for the wheel are kept in the tree.
  */
 typedef struct {
     int exiting;
     int exit_code;
     
+    // time sampled once per event loop iteration
+    btime_t cached_time;
+    
+    // instrumentation, NULL unless enabled
+    BReactorStats *stats;
+    
+    // job budget
+    int job_budget_enabled;
+    int job_budget_jobs;
+    int job_budget_us;
+    int job_slice_jobs;
+    int64_t job_slice_start_us;
+    int jobs_deferred;
+    uint64_t job_budget_exceeded;
+    
+    // busy polling
+    int busy_poll_spin_us;
+    uint64_t busy_poll_spins;
+    uint64_t busy_poll_hits;
+    
     // jobs
     BPendingGroup pending_jobs;
     
     // timers
     BReactor__TimersTree timers_tree;
     LinkedList1 timers_expired_list;
+    #ifdef BADVPN_TIMER_WHEEL_RESOLUTION
+    LinkedList1 timers_wheel[BSYSTEM_TIMER_WHEEL_LEVELS][1 << BSYSTEM_TIMER_WHEEL_BITS];
+    uint64_t timers_wheel_bitmap[BSYSTEM_TIMER_WHEEL_LEVELS]; // nonempty slots of each level
+    btime_t timers_wheel_base; // next tick to be processed
+    LinkedList1 timers_wheel_due_list; // timers set to expire at an already processed tick
+    #endif
     
     // limits
     LinkedList1 active_limits_list;
@@ -260,6 +318,32 @@ typedef struct {
     struct epoll_event epoll_results[BSYSTEM_MAX_RESULTS]; // epoll returned events buffer
     int epoll_results_num; // number of events in the array
     int epoll_results_pos; // number of events processed so far
+    int edge_triggered; // whether to register file descriptors edge-triggered where allowed
+    LinkedList1 edge_pending_list; // edge-triggered fds to report after the next wait
+    LinkedList1 edge_dispatch_list; // edge-triggered fds to report now
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    int uring_fd; // io_uring fd
+    void *uring_ring_mem; // mapped submission and completion rings
+    size_t uring_ring_size;
+    struct io_uring_sqe *uring_sqes; // mapped submission queue entries
+    size_t uring_sqes_size;
+    unsigned int *uring_sq_head;
+    unsigned int *uring_sq_tail;
+    unsigned int uring_sq_mask;
+    unsigned int uring_sq_entries;
+    unsigned int uring_sq_queued; // number of entries written but not yet submitted
+    unsigned int *uring_cq_head;
+    unsigned int *uring_cq_tail;
+    unsigned int uring_cq_mask;
+    struct io_uring_cqe *uring_cqes;
+    LinkedList1 uring_fds_list; // all poll records, including those of removed fds with polls in flight
+    LinkedList1 uring_dirty_list; // poll records which need to be armed or cancelled before waiting
+    struct BReactor__UringFd_t *uring_results[BSYSTEM_MAX_RESULTS]; // completed polls buffer
+    int uring_results_events[BSYSTEM_MAX_RESULTS]; // poll events of completed polls
+    int uring_results_num; // number of completed polls in the array
+    int uring_results_pos; // number of completed polls processed so far
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -405,7 +489,9 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
 /**
  * Returns a {@link BPendingGroup} object that can be used to schedule jobs for
  * the reactor to execute. These jobs have complete priority over other events
- * (timers, file descriptors and Windows handles).
+ * (timers, file descriptors and Windows handles), unless a job budget is set
+ * with {@link BReactor_SetJobBudget}, in which case single events may be
+ * dispatched while jobs are pending.
  * The returned pending group may only be used as an argument to {@link BPending_Init},
  * and must not be accessed by other means.
  * All {@link BPending} and {@link BSmallPending} objects using this group must be
@@ -416,6 +502,126 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
  */
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
 
+/**
+ * Returns the time as sampled by the reactor when it last returned from
+ * waiting for events, in the same time base as {@link btime_gettime}.
+ * This is much cheaper than {@link btime_gettime} but lags behind it by however
+ * long the current iteration of the event loop has been running. It is meant
+ * for bookkeeping on hot paths (e.g. last-activity stamps), not for arming
+ * timers which need precise relative expiry.
+ * 
+ * @param bsys the object
+ * @return cached current time
+ */
+btime_t BReactor_GetTime (BReactor *bsys);
+
+/**
+ * Sets a budget for running jobs. Normally the reactor runs all pending jobs
+ * before looking at timers and I/O again, so a job which keeps scheduling
+ * more jobs can delay everything else for a long time. With a budget, once
+ * the reactor has run max_jobs jobs or spent max_us microseconds running
+ * jobs since it last dispatched something else, it dispatches one expired
+ * timer or I/O event (checking for I/O without blocking if none are left
+ * over) before continuing with the jobs.
+ * Note that this allows events to be dispatched while jobs are pending,
+ * which does not happen without a budget. Code using the reactor must then not
+ * rely on a job it has set running before its timers or file descriptor
+ * handlers are called; in particular, a level-triggered file descriptor which
+ * is still ready will be reported again. An object which keeps a job pending
+ * for state its file descriptor handler also works on (e.g. {@link BListener}
+ * with an accepted connection not yet taken) has to check for that job in the
+ * handler.
+ * The time budget is only checked every {@link BSYSTEM_JOB_BUDGET_CLOCK_INTERVAL}
+ * jobs, to keep clock reads off the job path.
+ * 
+ * @param bsys the object
+ * @param max_jobs maximum number of jobs in a row, or 0 for no limit. Must be >=0.
+ * @param max_us maximum time running jobs in a row in microseconds, or 0
+ *               for no limit. Must be >=0.
+ */
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us);
+
+/**
+ * Returns how many times the job budget set with {@link BReactor_SetJobBudget}
+ * was used up, i.e. how many times jobs were deferred to let events through.
+ * 
+ * @param bsys the object
+ * @return number of times the job budget was exceeded
+ */
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys);
+
+/**
+ * Sets up busy polling, trading CPU time for lower wakeup latency.
+ * With spin_us, before going to sleep waiting for events, the reactor keeps
+ * checking for them without blocking for up to spin_us microseconds (or until
+ * the first timer is due). Events which arrive during this time are picked up
+ * without the latency of a wakeup, but the thread uses a CPU while spinning.
+ * With kernel_us, the kernel is asked to busy-poll the network device queues
+ * of the reactor's sockets for up to kernel_us microseconds when it waits
+ * (epoll busy poll parameters, Linux 6.9 and later); failure to set this only
+ * produces a warning.
+ * Only supported with the epoll backend; otherwise a warning is logged.
+ * Statistics can be obtained with {@link BReactor_BusyPollCounts}, and are
+ * included in the data logged by {@link BReactor_LogStats}.
+ * 
+ * @param bsys the object
+ * @param spin_us how long to spin before sleeping in microseconds, or 0 to
+ *                never spin. Must be >=0.
+ * @param kernel_us kernel busy poll time in microseconds, or 0 to leave the
+ *                  kernel setting alone. Must be >=0.
+ */
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us);
+
+/**
+ * Returns busy polling statistics: the number of times the reactor spun
+ * waiting for events (see {@link BReactor_SetBusyPoll}), and how many of these
+ * found events before the spin time ran out. The ratio is the hit rate; a low
+ * hit rate means the spinning mostly wastes CPU time.
+ * 
+ * @param bsys the object
+ * @param out_spins returns the number of spins
+ * @param out_hits returns the number of spins which found events
+ */
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits);
+
+/**
+ * Enables or disables edge-triggered registration of file descriptors added
+ * with {@link BReactor_AddFileDescriptorEdge} from now on. Such file descriptors
+ * are registered once for both reading and writing, and changing the monitored
+ * events with {@link BReactor_SetFileDescriptorEvents} then needs no system call.
+ * Only supported with the epoll backend; otherwise a warning is logged and file
+ * descriptors stay level-triggered.
+ * 
+ * @param bsys the object
+ * @param enabled 1 to enable, 0 to disable
+ */
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled);
+
+/**
+ * Enables event loop instrumentation. From now on, the reactor records, for
+ * every handler function it dispatches (jobs, timers, file descriptors),
+ * the number of calls and a histogram of their durations, as well as the
+ * number of events returned per wait, the time spent waiting, the number of
+ * jobs run between waits and timer lateness.
+ * While disabled, the cost is one branch per dispatch.
+ * Does nothing if instrumentation is already enabled.
+ * 
+ * @param bsys the object
+ * @return 1 on success, 0 on failure
+ */
+int BReactor_EnableStats (BReactor *bsys) WARN_UNUSED;
+
+/**
+ * Logs the data recorded since instrumentation was enabled or last reset,
+ * using the BReactorStats log channel.
+ * 
+ * @param bsys the object
+ * @param level log level
+ * @param reset whether to clear the data afterwards
+ * @return 1 if data was logged, 0 if instrumentation is not enabled
+ */
+int BReactor_LogStats (BReactor *bsys, int level, int reset);
+
 /**
  * Executes pending jobs until either:
  *   - the reference job is reached, or
@@ -450,6 +656,23 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
  */
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
 
+/**
+ * Starts monitoring a file descriptor, edge-triggered if enabled with
+ * {@link BReactor_SetEdgeTriggered}, and like {@link BReactor_AddFileDescriptor}
+ * otherwise.
+ * For the user, the difference is that it must only wait for an event after the
+ * corresponding operation failed with EAGAIN, and must report that by calling
+ * {@link BReactor_ClearFileDescriptorReady} before it waits. Waiting for an event
+ * which was not reported this way yields the event after the next wait for
+ * events (without a system call), since the file descriptor may still be ready
+ * and no new edge would come.
+ * 
+ * @param bsys the object
+ * @param bs file descriptor object, as in {@link BReactor_AddFileDescriptor}
+ * @return 1 on success, 0 on failure
+ */
+int BReactor_AddFileDescriptorEdge (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
+
 /**
  * Stops monitoring a file descriptor.
  *
@@ -472,6 +695,20 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
  */
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
 
+/**
+ * Reports that an operation on a file descriptor added with
+ * {@link BReactor_AddFileDescriptorEdge} failed with EAGAIN, so that the
+ * corresponding events are only reported again after a new edge.
+ * Does nothing for level-triggered file descriptors.
+ * 
+ * @param bsys the object
+ * @param bs {@link BFileDescriptor} object. Must be in active state,
+ *           associated with this reactor.
+ * @param events events which are not ready. Must not have any bits other than
+ *               BREACTOR_READ and BREACTOR_WRITE.
+ */
+void BReactor_ClearFileDescriptorReady (BReactor *bsys, BFileDescriptor *bs, int events);
+
 #endif
 
 typedef struct {
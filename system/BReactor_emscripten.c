@@ -125,6 +125,74 @@ BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
     return &bsys->pending_jobs;
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return btime_gettime();
+}
+
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us)
+{
+    ASSERT(max_jobs >= 0)
+    ASSERT(max_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (max_jobs > 0 || max_us > 0) {
+        BLog(BLOG_WARNING, "job budget is not supported by this reactor, ignoring");
+    }
+}
+
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return 0;
+}
+
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us)
+{
+    ASSERT(spin_us >= 0)
+    ASSERT(kernel_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (spin_us > 0 || kernel_us > 0) {
+        BLog(BLOG_WARNING, "busy polling is not supported by this reactor, ignoring");
+    }
+}
+
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    *out_spins = 0;
+    *out_hits = 0;
+}
+
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (enabled) {
+        BLog(BLOG_WARNING, "edge-triggered mode is not supported by this reactor, ignoring");
+    }
+}
+
+int BReactor_EnableStats (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    BLog(BLOG_ERROR, "reactor statistics are not supported by this reactor");
+    return 0;
+}
+
+int BReactor_LogStats (BReactor *bsys, int level, int reset)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return 0;
+}
+
 void BReactor_SetTimer (BReactor *bsys, BTimer *bt)
 {
     BReactor_SetTimerAfter(bsys, bt, bt->msTime);
@@ -76,6 +76,14 @@ void BReactor_EmscriptenFree (BReactor *bsys);
 void BReactor_EmscriptenSync (BReactor *bsys);
 
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
+btime_t BReactor_GetTime (BReactor *bsys);
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us);
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys);
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us);
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits);
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled);
+int BReactor_EnableStats (BReactor *bsys) WARN_UNUSED;
+int BReactor_LogStats (BReactor *bsys, int level, int reset);
 
 void BReactor_SetTimer (BReactor *bsys, BTimer *bt);
 void BReactor_SetTimerAfter (BReactor *bsys, BTimer *bt, btime_t after);
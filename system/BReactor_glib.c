@@ -29,25 +29,43 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <misc/offset.h>
+#include <misc/compare.h>
 #include <base/BLog.h>
 
 #include "BReactor_glib.h"
 
 #include <generated/blog_channel_BReactor.h>
 
-struct fd_source {
+#define TIMER_STATE_INACTIVE 1
+#define TIMER_STATE_RUNNING 2
+#define TIMER_STATE_EXPIRED 3
+
+struct reactor_source {
     GSource source;
-    BFileDescriptor *bfd;
+    BReactor *reactor;
 };
 
+static int compare_timers (BSmallTimer *t1, BSmallTimer *t2)
+{
+    int cmp = B_COMPARE(t1->absTime, t2->absTime);
+    if (cmp) {
+        return cmp;
+    }
+    
+    return B_COMPARE((uintptr_t)t1, (uintptr_t)t2);
+}
+
+#include "BReactor_glib_timerstree.h"
+#include <structure/CAvl_impl.h>
+
 static void assert_timer (BSmallTimer *bt)
 {
     ASSERT(bt->is_small == 0 || bt->is_small == 1)
-    ASSERT(bt->active == 0 || bt->active == 1)
-    ASSERT(!bt->active || bt->reactor)
-    ASSERT(!bt->active || bt->source)
+    ASSERT(bt->state == TIMER_STATE_INACTIVE || bt->state == TIMER_STATE_RUNNING ||
+           bt->state == TIMER_STATE_EXPIRED)
 }
 
 static void dispatch_pending (BReactor *o)
@@ -68,9 +86,9 @@ static void reset_limits (BReactor *o)
     }
 }
 
-static gushort get_glib_wait_events (int ev)
+static GIOCondition get_glib_wait_events (int ev)
 {
-    gushort gev = G_IO_ERR | G_IO_HUP;
+    GIOCondition gev = G_IO_ERR | G_IO_HUP;
     
     if (ev & BREACTOR_READ) {
         gev |= G_IO_IN;
@@ -89,93 +107,186 @@ static int get_fd_dispatchable_events (BFileDescriptor *bfd)
     
     int ev = 0;
     
-    if ((bfd->waitEvents & BREACTOR_READ) && (bfd->pollfd.revents & G_IO_IN)) {
+    if ((bfd->waitEvents & BREACTOR_READ) && (bfd->revents & G_IO_IN)) {
         ev |= BREACTOR_READ;
     }
     
-    if ((bfd->waitEvents & BREACTOR_WRITE) && (bfd->pollfd.revents & G_IO_OUT)) {
+    if ((bfd->waitEvents & BREACTOR_WRITE) && (bfd->revents & G_IO_OUT)) {
         ev |= BREACTOR_WRITE;
     }
     
-    if ((bfd->pollfd.revents & G_IO_ERR)) {
+    if ((bfd->revents & G_IO_ERR)) {
         ev |= BREACTOR_ERROR;
     }
     
-    if ((bfd->pollfd.revents & G_IO_HUP)) {
+    if ((bfd->revents & G_IO_HUP)) {
         ev |= BREACTOR_HUP;
     }
     
     return ev;
 }
 
-static gboolean timer_source_handler (gpointer data)
+static int have_ready_work (BReactor *o, btime_t now)
 {
-    BSmallTimer *bt = (void *)data;
-    assert_timer(bt);
-    ASSERT(bt->active)
-    
-    BReactor *reactor = bt->reactor;
-    
-    if (reactor->exiting) {
-        return FALSE;
+    if (BPendingGroup_HasJobs(&o->pending_jobs) || !LinkedList1_IsEmpty(&o->timers_expired_list) ||
+        !LinkedList1_IsEmpty(&o->fds_ready_list)
+    ) {
+        return 1;
     }
     
-    g_source_destroy(bt->source);
-    g_source_unref(bt->source);
-    bt->active = 0;
-    DebugCounter_Decrement(&reactor->d_timers_ctr);
+    BSmallTimer *first_timer = BReactorGlib__TimersTree_GetFirst(&o->timers_tree, 0).link;
+    
+    return (first_timer && first_timer->absTime <= now);
+}
+
+static void move_expired_timers (BReactor *o, btime_t now)
+{
+    BSmallTimer *timer;
+    BReactorGlib__TimersTreeRef ref;
     
+    while (timer = (ref = BReactorGlib__TimersTree_GetFirst(&o->timers_tree, 0)).link) {
+        ASSERT(timer->state == TIMER_STATE_RUNNING)
+        
+        if (timer->absTime > now) {
+            break;
+        }
+        
+        // remove from running timers tree
+        BReactorGlib__TimersTree_Remove(&o->timers_tree, 0, ref);
+        
+        // add to expired timers list
+        LinkedList1_Append(&o->timers_expired_list, &timer->u.list_node);
+        
+        // set expired
+        timer->state = TIMER_STATE_EXPIRED;
+    }
+}
+
+static void collect_ready_fds (BReactor *o)
+{
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->fds_list); ln; ln = LinkedList1Node_Next(ln)) {
+        BFileDescriptor *bfd = UPPER_OBJECT(ln, BFileDescriptor, list_node);
+        ASSERT(bfd->active)
+        
+        if (bfd->ready) {
+            continue;
+        }
+        
+        // pick up what the main loop's poll returned for this fd
+        bfd->revents = g_source_query_unix_fd(o->source, bfd->tag);
+        
+        if (get_fd_dispatchable_events(bfd)) {
+            LinkedList1_Append(&o->fds_ready_list, &bfd->ready_list_node);
+            bfd->ready = 1;
+        }
+    }
+}
+
+static void dispatch_timer (BReactor *o, BSmallTimer *bt)
+{
     if (bt->is_small) {
         bt->handler.smalll(bt);
     } else {
         BTimer *btimer = UPPER_OBJECT(bt, BTimer, base);
         bt->handler.heavy(btimer->user);
     }
-    
-    dispatch_pending(reactor);
-    reset_limits(reactor);
-    
-    return FALSE;
 }
 
-static gboolean fd_source_func_prepare (GSource *source, gint *timeout)
+static gboolean source_func_prepare (GSource *source, gint *timeout)
 {
-    BFileDescriptor *bfd = ((struct fd_source *)source)->bfd;
-    ASSERT(bfd->active)
-    ASSERT(bfd->source == source)
+    BReactor *o = ((struct reactor_source *)source)->reactor;
+    ASSERT(o->source == source)
+    
+    if (o->exiting) {
+        *timeout = -1;
+        return FALSE;
+    }
+    
+    btime_t now = btime_gettime();
+    
+    if (have_ready_work(o, now)) {
+        *timeout = 0;
+        return TRUE;
+    }
+    
+    // sleep until the first timer expires, if any
+    BSmallTimer *first_timer = BReactorGlib__TimersTree_GetFirst(&o->timers_tree, 0).link;
+    if (!first_timer) {
+        *timeout = -1;
+    } else {
+        btime_t diff = first_timer->absTime - now;
+        *timeout = (diff > INT_MAX ? INT_MAX : diff);
+    }
     
-    *timeout = -1;
     return FALSE;
 }
 
-static gboolean fd_source_func_check (GSource *source)
+static gboolean source_func_check (GSource *source)
 {
-    BFileDescriptor *bfd = ((struct fd_source *)source)->bfd;
-    ASSERT(bfd->active)
-    ASSERT(bfd->source == source)
+    BReactor *o = ((struct reactor_source *)source)->reactor;
+    ASSERT(o->source == source)
     
-    return (get_fd_dispatchable_events(bfd) ? TRUE : FALSE);
+    // readiness of file descriptors is checked by glib itself
+    return (!o->exiting && have_ready_work(o, btime_gettime()));
 }
 
-static gboolean fd_source_func_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+static gboolean source_func_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
 {
-    BFileDescriptor *bfd = ((struct fd_source *)source)->bfd;
-    BReactor *reactor = bfd->reactor;
-    ASSERT(bfd->active)
-    ASSERT(bfd->source == source)
+    BReactor *o = ((struct reactor_source *)source)->reactor;
+    ASSERT(o->source == source)
     
-    if (reactor->exiting) {
-        return TRUE;
-    }
+    // dispatch any jobs queued from outside of the reactor
+    dispatch_pending(o);
+    reset_limits(o);
     
-    int events = get_fd_dispatchable_events(bfd);
-    if (!events) {
-        return TRUE;
-    }
+    // pick up everything that became ready in this iteration
+    move_expired_timers(o, btime_gettime());
+    collect_ready_fds(o);
     
-    bfd->handler(bfd->user, events);
-    dispatch_pending(reactor);
-    reset_limits(reactor);
+    while (!o->exiting) {
+        // dispatch timer
+        LinkedList1Node *list_node = LinkedList1_GetFirst(&o->timers_expired_list);
+        if (list_node) {
+            BSmallTimer *timer = UPPER_OBJECT(list_node, BSmallTimer, u.list_node);
+            ASSERT(timer->state == TIMER_STATE_EXPIRED)
+            
+            // remove from expired list
+            LinkedList1_Remove(&o->timers_expired_list, &timer->u.list_node);
+            
+            // set inactive
+            timer->state = TIMER_STATE_INACTIVE;
+            DebugCounter_Decrement(&o->d_timers_ctr);
+            
+            // call handler
+            dispatch_timer(o, timer);
+            dispatch_pending(o);
+            reset_limits(o);
+            continue;
+        }
+        
+        // dispatch file descriptor
+        list_node = LinkedList1_GetFirst(&o->fds_ready_list);
+        if (list_node) {
+            BFileDescriptor *bfd = UPPER_OBJECT(list_node, BFileDescriptor, ready_list_node);
+            ASSERT(bfd->active)
+            ASSERT(bfd->ready)
+            
+            // remove from ready list
+            LinkedList1_Remove(&o->fds_ready_list, &bfd->ready_list_node);
+            bfd->ready = 0;
+            
+            // wait events may have changed since the fd was collected
+            int events = get_fd_dispatchable_events(bfd);
+            if (events) {
+                bfd->handler(bfd->user, events);
+                dispatch_pending(o);
+                reset_limits(o);
+            }
+            continue;
+        }
+        
+        break;
+    }
     
     return TRUE;
 }
@@ -183,7 +294,7 @@ static gboolean fd_source_func_dispatch (GSource *source, GSourceFunc callback,
 void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler)
 {
     bt->handler.smalll = handler;
-    bt->active = 0;
+    bt->state = TIMER_STATE_INACTIVE;
     bt->is_small = 1;
 }
 
@@ -191,13 +302,13 @@ int BSmallTimer_IsRunning (BSmallTimer *bt)
 {
     assert_timer(bt);
     
-    return bt->active;
+    return (bt->state != TIMER_STATE_INACTIVE);
 }
 
 void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user)
 {
     bt->base.handler.heavy = handler;
-    bt->base.active = 0;
+    bt->base.state = TIMER_STATE_INACTIVE;
     bt->base.is_small = 0;
     bt->user = user;
     bt->msTime = msTime;
@@ -228,8 +339,15 @@ void BReactor_Free (BReactor *bsys)
     DebugCounter_Free(&bsys->d_limits_ctr);
     DebugCounter_Free(&bsys->d_fds_counter);
     ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
+    ASSERT(BReactorGlib__TimersTree_IsEmpty(&bsys->timers_tree))
+    ASSERT(LinkedList1_IsEmpty(&bsys->timers_expired_list))
+    ASSERT(LinkedList1_IsEmpty(&bsys->fds_list))
     ASSERT(LinkedList1_IsEmpty(&bsys->active_limits_list))
     
+    // free source
+    g_source_destroy(bsys->source);
+    g_source_unref(bsys->source);
+    
     // free job queue
     BPendingGroup_Free(&bsys->pending_jobs);
     
@@ -276,24 +394,27 @@ void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t
 {
     DebugObject_Access(&bsys->d_obj);
     assert_timer(bt);
+    ASSERT(mode == BTIMER_SET_ABSOLUTE || mode == BTIMER_SET_RELATIVE)
     
     // remove timer if it's already set
     BReactor_RemoveSmallTimer(bsys, bt);
     
-    // if mode is absolute, subtract current time
-    if (mode == BTIMER_SET_ABSOLUTE) {
-        btime_t now = btime_gettime();
-        time = (time < now ? 0 : time - now);
+    // if mode is relative, add current time
+    if (mode == BTIMER_SET_RELATIVE) {
+        time = btime_add(btime_gettime(), time);
     }
     
-    // set active and reactor
-    bt->active = 1;
-    bt->reactor = bsys;
+    // set time
+    bt->absTime = time;
     
-    // init source
-    bt->source = g_timeout_source_new(time);
-    g_source_set_callback(bt->source, timer_source_handler, bt, NULL);
-    g_source_attach(bt->source, g_main_loop_get_context(bsys->gloop));
+    // set running
+    bt->state = TIMER_STATE_RUNNING;
+    
+    // insert to running timers tree; the reactor source picks up the new
+    // first timer when the main loop prepares its next iteration
+    BReactorGlib__TimersTreeRef ref = {bt, bt};
+    int res = BReactorGlib__TimersTree_Insert(&bsys->timers_tree, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
     
     DebugCounter_Increment(&bsys->d_timers_ctr);
 }
@@ -304,16 +425,20 @@ void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt)
     assert_timer(bt);
     
     // do nothing if timer is not active
-    if (!bt->active) {
+    if (bt->state == TIMER_STATE_INACTIVE) {
         return;
     }
     
-    // free source
-    g_source_destroy(bt->source);
-    g_source_unref(bt->source);
+    // remove it from running timers tree or expired timers list
+    if (bt->state == TIMER_STATE_EXPIRED) {
+        LinkedList1_Remove(&bsys->timers_expired_list, &bt->u.list_node);
+    } else {
+        BReactorGlib__TimersTreeRef ref = {bt, bt};
+        BReactorGlib__TimersTree_Remove(&bsys->timers_tree, 0, ref);
+    }
     
-    // set not active
-    bt->active = 0;
+    // set inactive
+    bt->state = TIMER_STATE_INACTIVE;
     
     DebugCounter_Decrement(&bsys->d_timers_ctr);
 }
@@ -345,6 +470,74 @@ BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
     return &bsys->pending_jobs;
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return btime_gettime();
+}
+
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us)
+{
+    ASSERT(max_jobs >= 0)
+    ASSERT(max_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (max_jobs > 0 || max_us > 0) {
+        BLog(BLOG_WARNING, "job budget is not supported by this reactor, ignoring");
+    }
+}
+
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return 0;
+}
+
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us)
+{
+    ASSERT(spin_us >= 0)
+    ASSERT(kernel_us >= 0)
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (spin_us > 0 || kernel_us > 0) {
+        BLog(BLOG_WARNING, "busy polling is not supported by this reactor, ignoring");
+    }
+}
+
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    *out_spins = 0;
+    *out_hits = 0;
+}
+
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    if (enabled) {
+        BLog(BLOG_WARNING, "edge-triggered mode is not supported by this reactor, ignoring");
+    }
+}
+
+int BReactor_EnableStats (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    BLog(BLOG_ERROR, "reactor statistics are not supported by this reactor");
+    return 0;
+}
+
+int BReactor_LogStats (BReactor *bsys, int level, int reset)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return 0;
+}
+
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
 {
     DebugObject_Access(&bsys->d_obj);
@@ -372,33 +565,40 @@ int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
     bs->active = 1;
     bs->waitEvents = 0;
     bs->reactor = bsys;
+    bs->revents = 0;
+    bs->ready = 0;
     
-    // create source
-    bs->source = g_source_new(&bsys->fd_source_funcs, sizeof(struct fd_source));
-    ((struct fd_source *)bs->source)->bfd = bs;
-    
-    // init pollfd
-    bs->pollfd.fd = bs->fd;
-    bs->pollfd.events = get_glib_wait_events(bs->waitEvents);
-    bs->pollfd.revents = 0;
+    // poll fd as part of the reactor source
+    bs->tag = g_source_add_unix_fd(bsys->source, bs->fd, get_glib_wait_events(bs->waitEvents));
     
-    // start source
-    g_source_add_poll(bs->source, &bs->pollfd);
-    g_source_attach(bs->source, g_main_loop_get_context(bsys->gloop));
+    // insert to file descriptors list
+    LinkedList1_Append(&bsys->fds_list, &bs->list_node);
     
     DebugCounter_Increment(&bsys->d_fds_counter);
     return 1;
 }
 
+int BReactor_AddFileDescriptorEdge (BReactor *bsys, BFileDescriptor *bs)
+{
+    return BReactor_AddFileDescriptor(bsys, bs);
+}
+
 void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
 {
     DebugObject_Access(&bsys->d_obj);
     DebugCounter_Decrement(&bsys->d_fds_counter);
     ASSERT(bs->active)
     
-    // free source
-    g_source_destroy(bs->source);
-    g_source_unref(bs->source);
+    // remove from ready list
+    if (bs->ready) {
+        LinkedList1_Remove(&bsys->fds_ready_list, &bs->ready_list_node);
+    }
+    
+    // remove from file descriptors list
+    LinkedList1_Remove(&bsys->fds_list, &bs->list_node);
+    
+    // stop polling fd
+    g_source_remove_unix_fd(bsys->source, bs->tag);
     
     // set not active
     bs->active = 0;
@@ -413,8 +613,15 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     // set new wait events
     bs->waitEvents = events;
     
-    // update pollfd wait events
-    bs->pollfd.events = get_glib_wait_events(bs->waitEvents);
+    // update polled events
+    g_source_modify_unix_fd(bsys->source, bs->tag, get_glib_wait_events(bs->waitEvents));
+}
+
+void BReactor_ClearFileDescriptorReady (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
 }
 
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free)
@@ -429,16 +636,30 @@ int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int un
     bsys->gloop = gloop;
     bsys->unref_gloop_on_free = unref_gloop_on_free;
     
-    // init fd source functions table
-    memset(&bsys->fd_source_funcs, 0, sizeof(bsys->fd_source_funcs));
-    bsys->fd_source_funcs.prepare = fd_source_func_prepare;
-    bsys->fd_source_funcs.check = fd_source_func_check;
-    bsys->fd_source_funcs.dispatch = fd_source_func_dispatch;
-    bsys->fd_source_funcs.finalize = NULL;
+    // init source functions table
+    memset(&bsys->source_funcs, 0, sizeof(bsys->source_funcs));
+    bsys->source_funcs.prepare = source_func_prepare;
+    bsys->source_funcs.check = source_func_check;
+    bsys->source_funcs.dispatch = source_func_dispatch;
+    bsys->source_funcs.finalize = NULL;
     
     // init job queue
     BPendingGroup_Init(&bsys->pending_jobs);
     
+    // init timers
+    BReactorGlib__TimersTree_Init(&bsys->timers_tree);
+    LinkedList1_Init(&bsys->timers_expired_list);
+    
+    // init file descriptor lists
+    LinkedList1_Init(&bsys->fds_list);
+    LinkedList1_Init(&bsys->fds_ready_list);
+    
+    // create the single source which dispatches jobs, timers and
+    // file descriptors, and attach it to the main loop's context
+    bsys->source = g_source_new(&bsys->source_funcs, sizeof(struct reactor_source));
+    ((struct reactor_source *)bsys->source)->reactor = bsys;
+    g_source_attach(bsys->source, g_main_loop_get_context(bsys->gloop));
+    
     // init active limits list
     LinkedList1_Init(&bsys->active_limits_list);
     
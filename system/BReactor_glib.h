@@ -38,6 +38,7 @@
 #include <misc/debugcounter.h>
 #include <misc/offset.h>
 #include <structure/LinkedList1.h>
+#include <structure/CAvl.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
 #include <system/BTime.h>
@@ -45,6 +46,10 @@
 typedef struct BReactor_s BReactor;
 
 struct BSmallTimer_t;
+typedef struct BSmallTimer_t *BReactorGlib_timerstree_link;
+
+#include "BReactor_glib_timerstree.h"
+#include <structure/CAvl_decl.h>
 
 #define BTIMER_SET_ABSOLUTE 1
 #define BTIMER_SET_RELATIVE 2
@@ -57,9 +62,14 @@ typedef struct BSmallTimer_t {
         BSmallTimer_handler smalll; // MSVC doesn't like "small"
         BTimer_handler heavy;
     } handler;
-    BReactor *reactor;
-    GSource *source;
-    uint8_t active;
+    union {
+        LinkedList1Node list_node;
+        struct BSmallTimer_t *tree_child[2];
+    } u;
+    struct BSmallTimer_t *tree_parent;
+    btime_t absTime;
+    int8_t tree_balance;
+    uint8_t state;
     uint8_t is_small;
 } BSmallTimer;
 
@@ -91,8 +101,11 @@ typedef struct BFileDescriptor_t {
     int active;
     int waitEvents;
     BReactor *reactor;
-    GSource *source;
-    GPollFD pollfd;
+    gpointer tag;
+    GIOCondition revents;
+    int ready;
+    LinkedList1Node list_node;
+    LinkedList1Node ready_list_node;
 } BFileDescriptor;
 
 void BFileDescriptor_Init (BFileDescriptor *bs, int fd, BFileDescriptor_handler handler, void *user);
@@ -102,8 +115,13 @@ struct BReactor_s {
     int exit_code;
     GMainLoop *gloop;
     int unref_gloop_on_free;
-    GSourceFuncs fd_source_funcs;
+    GSourceFuncs source_funcs;
+    GSource *source;
     BPendingGroup pending_jobs;
+    BReactorGlib__TimersTree timers_tree;
+    LinkedList1 timers_expired_list;
+    LinkedList1 fds_list;
+    LinkedList1 fds_ready_list;
     LinkedList1 active_limits_list;
     
     DebugCounter d_fds_counter;
@@ -123,10 +141,20 @@ void BReactor_SetTimerAfter (BReactor *bsys, BTimer *bt, btime_t after);
 void BReactor_SetTimerAbsolute (BReactor *bsys, BTimer *bt, btime_t time);
 void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
+btime_t BReactor_GetTime (BReactor *bsys);
+void BReactor_SetJobBudget (BReactor *bsys, int max_jobs, int max_us);
+uint64_t BReactor_JobBudgetExceededCount (BReactor *bsys);
+void BReactor_SetBusyPoll (BReactor *bsys, int spin_us, int kernel_us);
+void BReactor_BusyPollCounts (BReactor *bsys, uint64_t *out_spins, uint64_t *out_hits);
+void BReactor_SetEdgeTriggered (BReactor *bsys, int enabled);
+int BReactor_EnableStats (BReactor *bsys) WARN_UNUSED;
+int BReactor_LogStats (BReactor *bsys, int level, int reset);
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
+int BReactor_AddFileDescriptorEdge (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
 void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
+void BReactor_ClearFileDescriptorReady (BReactor *bsys, BFileDescriptor *bs, int events);
 
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free);
 GMainLoop * BReactor_GetGMainLoop (BReactor *bsys);
@@ -0,0 +1,530 @@
+/**
+ * @file BShardConnection.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <misc/offset.h>
+#include <misc/minmax.h>
+#include <base/BLog.h>
+
+#include "BShardConnection.h"
+
+#include <generated/blog_channel_BShardConnection.h>
+
+// State shared by the two sides. Fields are grouped by the thread which may
+// access them; chunks belong to whichever side last received them.
+struct BShardConnection_shared {
+    BReactorGroupMember *home_member;
+    BReactorGroupMember *shard_member;
+    int fd;
+    
+    // home side
+    BShardConnection *home;
+    
+    // shard side
+    int con_up;
+    int recv_closed;
+    BConnection con;
+    LinkedList1 recv_free_list;
+    struct BShardConnection_chunk *recv_chunk;
+    LinkedList1 send_list;
+    int sending;
+    
+    BReactorGroupMessage open_msg;
+    BReactorGroupMessage close_msg;
+    BReactorGroupMessage error_msg;
+    BReactorGroupMessage recvclosed_msg;
+    struct BShardConnection_chunk recv_chunks[BSHARDCONNECTION_NUM_CHUNKS];
+    struct BShardConnection_chunk send_chunks[BSHARDCONNECTION_NUM_CHUNKS];
+};
+
+static void home_serve_send (BShardConnection *o);
+static void home_serve_recv (BShardConnection *o);
+static void home_send_handler (BShardConnection *o, uint8_t *data, int data_len);
+static void home_recv_handler (BShardConnection *o, uint8_t *data, int data_avail);
+static void home_event_job_handler (BShardConnection *o);
+static void home_send_chunk_handler (BReactorGroupMessage *msg);
+static void home_recv_chunk_handler (BReactorGroupMessage *msg);
+static void home_error_handler (BReactorGroupMessage *msg);
+static void home_recvclosed_handler (BReactorGroupMessage *msg);
+static void home_close_handler (BReactorGroupMessage *msg);
+static void shard_start_send (struct BShardConnection_shared *s);
+static void shard_start_recv (struct BShardConnection_shared *s);
+static void shard_free_con (struct BShardConnection_shared *s);
+static void shard_con_handler (struct BShardConnection_shared *s, int event);
+static void shard_send_done_handler (struct BShardConnection_shared *s, int data_len);
+static void shard_recv_done_handler (struct BShardConnection_shared *s, int data_len);
+static void shard_open_handler (BReactorGroupMessage *msg);
+static void shard_close_handler (BReactorGroupMessage *msg);
+static void shard_send_chunk_handler (BReactorGroupMessage *msg);
+static void shard_recv_chunk_handler (BReactorGroupMessage *msg);
+
+static void home_serve_send (BShardConnection *o)
+{
+    ASSERT(o->send_data)
+    ASSERT(!LinkedList1_IsEmpty(&o->send_free_list))
+    
+    // take a free chunk
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->send_free_list);
+    struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+    LinkedList1_Remove(&o->send_free_list, &c->list_node);
+    
+    // fill it
+    int len = bmin_int(o->send_len, BSHARDCONNECTION_CHUNK_SIZE);
+    memcpy(c->data, o->send_data, len);
+    c->len = len;
+    c->pos = 0;
+    
+    // pass it to the shard
+    BReactorGroupMember_Post(o->s->shard_member, &c->msg, shard_send_chunk_handler);
+    
+    // the data is ours now, complete the send
+    o->send_data = NULL;
+    StreamPassInterface_Done(&o->send_if, len);
+}
+
+static void home_serve_recv (BShardConnection *o)
+{
+    ASSERT(o->recv_data)
+    ASSERT(!LinkedList1_IsEmpty(&o->recv_list))
+    
+    // copy from the oldest chunk
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->recv_list);
+    struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+    int len = bmin_int(o->recv_avail, c->len - c->pos);
+    memcpy(o->recv_data, c->data + c->pos, len);
+    c->pos += len;
+    
+    // give the chunk back once it's used up
+    if (c->pos == c->len) {
+        LinkedList1_Remove(&o->recv_list, &c->list_node);
+        BReactorGroupMember_Post(o->s->shard_member, &c->msg, shard_recv_chunk_handler);
+    }
+    
+    o->recv_data = NULL;
+    StreamRecvInterface_Done(&o->recv_if, len);
+    
+    // report end of stream once everything before it was received
+    if (o->recv_closed && LinkedList1_IsEmpty(&o->recv_list)) {
+        BPending_Set(&o->event_job);
+    }
+}
+
+static void home_send_handler (BShardConnection *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len > 0)
+    ASSERT(!o->send_data)
+    
+    o->send_data = data;
+    o->send_len = data_len;
+    
+    if (!LinkedList1_IsEmpty(&o->send_free_list)) {
+        home_serve_send(o);
+    }
+}
+
+static void home_recv_handler (BShardConnection *o, uint8_t *data, int data_avail)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_avail > 0)
+    ASSERT(!o->recv_data)
+    
+    o->recv_data = data;
+    o->recv_avail = data_avail;
+    
+    if (!LinkedList1_IsEmpty(&o->recv_list)) {
+        home_serve_recv(o);
+    }
+}
+
+static void home_event_job_handler (BShardConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->error) {
+        o->handler(o->user, BCONNECTION_EVENT_ERROR);
+        return;
+    }
+    
+    ASSERT(o->recv_closed == 1)
+    ASSERT(LinkedList1_IsEmpty(&o->recv_list))
+    
+    // report only once
+    o->recv_closed = 2;
+    
+    o->handler(o->user, BCONNECTION_EVENT_RECVCLOSED);
+    return;
+}
+
+static void home_send_chunk_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_chunk *c = UPPER_OBJECT(msg, struct BShardConnection_chunk, msg);
+    BShardConnection *o = c->s->home;
+    if (!o) {
+        return;
+    }
+    
+    LinkedList1_Append(&o->send_free_list, &c->list_node);
+    
+    if (o->send_data) {
+        home_serve_send(o);
+    }
+}
+
+static void home_recv_chunk_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_chunk *c = UPPER_OBJECT(msg, struct BShardConnection_chunk, msg);
+    BShardConnection *o = c->s->home;
+    if (!o) {
+        return;
+    }
+    
+    LinkedList1_Append(&o->recv_list, &c->list_node);
+    
+    if (o->recv_data) {
+        home_serve_recv(o);
+    }
+}
+
+static void home_error_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_shared *s = UPPER_OBJECT(msg, struct BShardConnection_shared, error_msg);
+    BShardConnection *o = s->home;
+    if (!o) {
+        return;
+    }
+    
+    o->error = 1;
+    BPending_Set(&o->event_job);
+}
+
+static void home_recvclosed_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_shared *s = UPPER_OBJECT(msg, struct BShardConnection_shared, recvclosed_msg);
+    BShardConnection *o = s->home;
+    if (!o) {
+        return;
+    }
+    
+    o->recv_closed = 1;
+    
+    if (LinkedList1_IsEmpty(&o->recv_list)) {
+        BPending_Set(&o->event_job);
+    }
+}
+
+static void home_close_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_shared *s = UPPER_OBJECT(msg, struct BShardConnection_shared, close_msg);
+    ASSERT(!s->home)
+    
+    // the shard is done with us, and this was the last message it posted
+    free(s);
+}
+
+static void shard_start_send (struct BShardConnection_shared *s)
+{
+    if (!s->con_up || s->sending) {
+        return;
+    }
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&s->send_list);
+    if (!node) {
+        return;
+    }
+    struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+    
+    s->sending = 1;
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&s->con), c->data + c->pos, c->len - c->pos);
+}
+
+static void shard_start_recv (struct BShardConnection_shared *s)
+{
+    if (!s->con_up || s->recv_closed || s->recv_chunk) {
+        return;
+    }
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&s->recv_free_list);
+    if (!node) {
+        return;
+    }
+    struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+    LinkedList1_Remove(&s->recv_free_list, &c->list_node);
+    
+    s->recv_chunk = c;
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&s->con), c->data, BSHARDCONNECTION_CHUNK_SIZE);
+}
+
+static void shard_free_con (struct BShardConnection_shared *s)
+{
+    if (!s->con_up) {
+        return;
+    }
+    
+    // free connection, closing the socket
+    BConnection_RecvAsync_Free(&s->con);
+    BConnection_SendAsync_Free(&s->con);
+    BConnection_Free(&s->con);
+    s->con_up = 0;
+    
+    // take back the chunk being received into
+    if (s->recv_chunk) {
+        LinkedList1_Append(&s->recv_free_list, &s->recv_chunk->list_node);
+        s->recv_chunk = NULL;
+    }
+    
+    // give back chunks which will never be sent
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&s->send_list))) {
+        struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+        LinkedList1_Remove(&s->send_list, &c->list_node);
+        BReactorGroupMember_Post(s->home_member, &c->msg, home_send_chunk_handler);
+    }
+    s->sending = 0;
+}
+
+static void shard_con_handler (struct BShardConnection_shared *s, int event)
+{
+    ASSERT(s->con_up)
+    
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        // no more receiving; the chunk being received into stays unused
+        s->recv_closed = 1;
+        if (s->recv_chunk) {
+            LinkedList1_Append(&s->recv_free_list, &s->recv_chunk->list_node);
+            s->recv_chunk = NULL;
+        }
+        
+        BReactorGroupMember_Post(s->home_member, &s->recvclosed_msg, home_recvclosed_handler);
+        return;
+    }
+    
+    BLog(BLOG_INFO, "connection error");
+    
+    shard_free_con(s);
+    
+    BReactorGroupMember_Post(s->home_member, &s->error_msg, home_error_handler);
+}
+
+static void shard_send_done_handler (struct BShardConnection_shared *s, int data_len)
+{
+    ASSERT(s->con_up)
+    ASSERT(s->sending)
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&s->send_list);
+    struct BShardConnection_chunk *c = UPPER_OBJECT(node, struct BShardConnection_chunk, list_node);
+    ASSERT(data_len <= c->len - c->pos)
+    
+    c->pos += data_len;
+    s->sending = 0;
+    
+    // give the chunk back once it's sent
+    if (c->pos == c->len) {
+        LinkedList1_Remove(&s->send_list, &c->list_node);
+        BReactorGroupMember_Post(s->home_member, &c->msg, home_send_chunk_handler);
+    }
+    
+    shard_start_send(s);
+}
+
+static void shard_recv_done_handler (struct BShardConnection_shared *s, int data_len)
+{
+    ASSERT(s->con_up)
+    ASSERT(s->recv_chunk)
+    
+    struct BShardConnection_chunk *c = s->recv_chunk;
+    c->len = data_len;
+    c->pos = 0;
+    s->recv_chunk = NULL;
+    
+    BReactorGroupMember_Post(s->home_member, &c->msg, home_recv_chunk_handler);
+    
+    shard_start_recv(s);
+}
+
+static void shard_open_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_shared *s = UPPER_OBJECT(msg, struct BShardConnection_shared, open_msg);
+    BReactor *reactor = BReactorGroupMember_Reactor(s->shard_member);
+    
+    // init connection; this closes the socket on failure
+    if (!BConnection_Init(&s->con, BConnection_source_pipe(s->fd, 1), reactor, s, (BConnection_handler)shard_con_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        BReactorGroupMember_Post(s->home_member, &s->error_msg, home_error_handler);
+        return;
+    }
+    
+    // init interfaces
+    BConnection_SendAsync_Init(&s->con);
+    BConnection_RecvAsync_Init(&s->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&s->con), (StreamPassInterface_handler_done)shard_send_done_handler, s);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&s->con), (StreamRecvInterface_handler_done)shard_recv_done_handler, s);
+    
+    s->con_up = 1;
+    
+    shard_start_recv(s);
+    shard_start_send(s);
+}
+
+static void shard_close_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_shared *s = UPPER_OBJECT(msg, struct BShardConnection_shared, close_msg);
+    
+    shard_free_con(s);
+    
+    // tell the home side it can free the shared state; being posted last,
+    // this arrives after everything else we posted
+    BReactorGroupMember_Post(s->home_member, &s->close_msg, home_close_handler);
+}
+
+static void shard_send_chunk_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_chunk *c = UPPER_OBJECT(msg, struct BShardConnection_chunk, msg);
+    struct BShardConnection_shared *s = c->s;
+    
+    // if the connection is gone, give it right back
+    if (!s->con_up) {
+        BReactorGroupMember_Post(s->home_member, &c->msg, home_send_chunk_handler);
+        return;
+    }
+    
+    LinkedList1_Append(&s->send_list, &c->list_node);
+    
+    shard_start_send(s);
+}
+
+static void shard_recv_chunk_handler (BReactorGroupMessage *msg)
+{
+    struct BShardConnection_chunk *c = UPPER_OBJECT(msg, struct BShardConnection_chunk, msg);
+    struct BShardConnection_shared *s = c->s;
+    
+    LinkedList1_Append(&s->recv_free_list, &c->list_node);
+    
+    shard_start_recv(s);
+}
+
+int BShardConnection_Init (BShardConnection *o, int fd, BReactorGroupMember *home, BReactorGroupMember *shard,
+                           void *user, BConnection_handler handler)
+{
+    ASSERT(fd >= 0)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = BReactorGroupMember_Reactor(home);
+    o->user = user;
+    o->handler = handler;
+    
+    // allocate shared state
+    struct BShardConnection_shared *s = malloc(sizeof(*s));
+    if (!s) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    o->s = s;
+    s->home_member = home;
+    s->shard_member = shard;
+    s->fd = fd;
+    s->home = o;
+    s->con_up = 0;
+    s->recv_closed = 0;
+    s->recv_chunk = NULL;
+    s->sending = 0;
+    
+    // receive chunks start in the shard, send chunks at home
+    LinkedList1_Init(&s->recv_free_list);
+    LinkedList1_Init(&s->send_list);
+    LinkedList1_Init(&o->send_free_list);
+    LinkedList1_Init(&o->recv_list);
+    for (int i = 0; i < BSHARDCONNECTION_NUM_CHUNKS; i++) {
+        s->recv_chunks[i].s = s;
+        LinkedList1_Append(&s->recv_free_list, &s->recv_chunks[i].list_node);
+        s->send_chunks[i].s = s;
+        LinkedList1_Append(&o->send_free_list, &s->send_chunks[i].list_node);
+    }
+    
+    // init interfaces
+    StreamPassInterface_Init(&o->send_if, (StreamPassInterface_handler_send)home_send_handler, o, BReactor_PendingGroup(o->reactor));
+    StreamRecvInterface_Init(&o->recv_if, (StreamRecvInterface_handler_recv)home_recv_handler, o, BReactor_PendingGroup(o->reactor));
+    
+    // init event job
+    BPending_Init(&o->event_job, BReactor_PendingGroup(o->reactor), (BPending_handler)home_event_job_handler, o);
+    
+    // set no operations, no events
+    o->send_data = NULL;
+    o->recv_data = NULL;
+    o->recv_closed = 0;
+    o->error = 0;
+    
+    // let the shard open the connection
+    BReactorGroupMember_Post(s->shard_member, &s->open_msg, shard_open_handler);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    if (close(fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    return 0;
+}
+
+void BShardConnection_Free (BShardConnection *o)
+{
+    DebugObject_Free(&o->d_obj);
+    struct BShardConnection_shared *s = o->s;
+    
+    // free event job
+    BPending_Free(&o->event_job);
+    
+    // free interfaces
+    StreamRecvInterface_Free(&o->recv_if);
+    StreamPassInterface_Free(&o->send_if);
+    
+    // detach from shared state; messages still on their way to us will
+    // be ignored, and the shard frees it through the close message
+    s->home = NULL;
+    BReactorGroupMember_Post(s->shard_member, &s->close_msg, shard_close_handler);
+}
+
+StreamPassInterface * BShardConnection_GetSendIf (BShardConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->send_if;
+}
+
+StreamRecvInterface * BShardConnection_GetRecvIf (BShardConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->recv_if;
+}
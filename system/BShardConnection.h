@@ -0,0 +1,143 @@
+/**
+ * @file BShardConnection.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Stream connection whose socket is served by another reactor of a
+ * {@link BReactorGroup}, while its interfaces are used in the home reactor.
+ */
+
+#ifndef BADVPN_SYSTEM_BSHARDCONNECTION_H
+#define BADVPN_SYSTEM_BSHARDCONNECTION_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <flow/StreamPassInterface.h>
+#include <flow/StreamRecvInterface.h>
+#include <system/BReactorGroup.h>
+#include <system/BConnection.h>
+
+#define BSHARDCONNECTION_CHUNK_SIZE 8192
+#define BSHARDCONNECTION_NUM_CHUNKS 2
+
+struct BShardConnection_shared;
+
+struct BShardConnection_chunk {
+    BReactorGroupMessage msg;
+    struct BShardConnection_shared *s;
+    LinkedList1Node list_node;
+    int len;
+    int pos;
+    uint8_t data[BSHARDCONNECTION_CHUNK_SIZE];
+};
+
+/**
+ * Object which represents a stream connection living in another reactor of
+ * a {@link BReactorGroup}. The socket is read and written by the reactor of
+ * the shard member, and data is passed to and from the home reactor in chunks
+ * through the members' inboxes, so that the system calls for many connections
+ * can be spread over threads while all processing stays in the home reactor.
+ * 
+ * Sending and receiving is performed via {@link StreamPassInterface} and
+ * {@link StreamRecvInterface} in the home reactor. Each direction has
+ * BSHARDCONNECTION_NUM_CHUNKS chunks of BSHARDCONNECTION_CHUNK_SIZE bytes
+ * in flight; sends complete as soon as the data is copied into a chunk.
+ * 
+ * The object may be freed at any time. The part living in the shard is
+ * released asynchronously; this completes before {@link BReactorGroup_Free}
+ * returns.
+ */
+typedef struct BShardConnection_s {
+    struct BShardConnection_shared *s;
+    BReactor *reactor;
+    void *user;
+    BConnection_handler handler;
+    StreamPassInterface send_if;
+    StreamRecvInterface recv_if;
+    LinkedList1 send_free_list;
+    uint8_t *send_data;
+    int send_len;
+    LinkedList1 recv_list;
+    uint8_t *recv_data;
+    int recv_avail;
+    int recv_closed;
+    int error;
+    BPending event_job;
+    DebugObject d_obj;
+} BShardConnection;
+
+/**
+ * Initializes the object.
+ * Must be called from the thread of the home member.
+ * 
+ * @param o the object
+ * @param fd connected non-blocking stream socket, e.g. obtained from
+ *           {@link BConnection_ReleaseFd}. The object takes ownership of it,
+ *           also when initialization fails.
+ * @param home member whose reactor the interfaces live in
+ * @param shard member whose reactor serves the socket. May be the same as home.
+ * @param user argument to handler
+ * @param handler handler called from a job of the home reactor when an error
+ *                occurs or the receive end of the connection was closed by the
+ *                remote peer, with the same meaning as for {@link BConnection}.
+ *                BCONNECTION_EVENT_RECVCLOSED is reported after all data
+ *                received before it was passed on.
+ * @return 1 on success, 0 on failure
+ */
+int BShardConnection_Init (BShardConnection *o, int fd, BReactorGroupMember *home, BReactorGroupMember *shard,
+                           void *user, BConnection_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * The socket is closed by the shard afterwards.
+ * 
+ * @param o the object
+ */
+void BShardConnection_Free (BShardConnection *o);
+
+/**
+ * Returns the send interface.
+ * 
+ * @param o the object
+ * @return send interface, in the home reactor
+ */
+StreamPassInterface * BShardConnection_GetSendIf (BShardConnection *o);
+
+/**
+ * Returns the receive interface.
+ * 
+ * @param o the object
+ * @return receive interface, in the home reactor
+ */
+StreamRecvInterface * BShardConnection_GetRecvIf (BShardConnection *o);
+
+#endif
@@ -47,6 +47,8 @@ static struct {
     BReactor *reactor;
     BSignal_handler handler;
     void *user;
+    BSignal_handler hangup_handler;
+    void *hangup_user;
     #ifdef BADVPN_USE_WINAPI
     BReactorIOCPOverlapped olap;
     CRITICAL_SECTION iocp_handle_mutex;
@@ -100,6 +102,12 @@ static void unix_signal_handler (void *user, int signo)
     
     BLog(BLOG_DEBUG, "Dispatching signal");
     
+    // call hangup handler if there is one
+    if (signo == SIGHUP && bsignal_global.hangup_handler) {
+        bsignal_global.hangup_handler(bsignal_global.hangup_user);
+        return;
+    }
+    
     // call handler
     bsignal_global.handler(bsignal_global.user);
     return;
@@ -115,6 +123,8 @@ int BSignal_Init (BReactor *reactor, BSignal_handler handler, void *user)
     bsignal_global.reactor = reactor;
     bsignal_global.handler = handler;
     bsignal_global.user = user;
+    bsignal_global.hangup_handler = NULL;
+    bsignal_global.hangup_user = NULL;
     
     BLog(BLOG_DEBUG, "BSignal initializing");
     
@@ -187,3 +197,13 @@ void BSignal_Finish (void)
     
     bsignal_global.finished = 1;
 }
+
+void BSignal_SetHangupHandler (BSignal_handler handler, void *user)
+{
+    ASSERT(bsignal_global.initialized)
+    ASSERT(!bsignal_global.finished)
+    ASSERT(handler)
+    
+    bsignal_global.hangup_handler = handler;
+    bsignal_global.hangup_user = user;
+}
@@ -62,4 +62,16 @@ int BSignal_Init (BReactor *reactor, BSignal_handler handler, void *user) WARN_U
  */
 void BSignal_Finish (void);
 
+/**
+ * Makes SIGHUP call the given handler instead of requesting termination,
+ * for programs which reload their configuration on SIGHUP.
+ * Does nothing on Windows, where there is no SIGHUP.
+ * {@link BSignal_Init} must have been done, and {@link BSignal_Finish}
+ * not yet.
+ * 
+ * @param handler callback function invoked from the reactor on SIGHUP
+ * @param user value passed to callback function
+ */
+void BSignal_SetHangupHandler (BSignal_handler handler, void *user);
+
 #endif
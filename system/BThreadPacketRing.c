@@ -0,0 +1,396 @@
+/**
+ * @file BReactorGroup.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef BADVPN_LINUX
+#include <sys/eventfd.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+
+#include "BThreadPacketRing.h"
+
+#include <generated/blog_channel_BThreadPacketRing.h>
+
+static int wakeup_init (int *fd)
+{
+    #ifdef BADVPN_LINUX
+    if ((fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        BLog(BLOG_ERROR, "eventfd failed");
+        return 0;
+    }
+    fd[1] = fd[0];
+    #else
+    if (pipe(fd) < 0) {
+        BLog(BLOG_ERROR, "pipe failed");
+        return 0;
+    }
+    
+    if (!badvpn_set_nonblocking(fd[0]) || !badvpn_set_nonblocking(fd[1])) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        close(fd[0]);
+        close(fd[1]);
+        return 0;
+    }
+    #endif
+    
+    return 1;
+}
+
+static void wakeup_free (int *fd)
+{
+    if (close(fd[0]) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    #ifndef BADVPN_LINUX
+    if (close(fd[1]) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    #endif
+}
+
+static void wakeup_drain (int *fd)
+{
+    #ifdef BADVPN_LINUX
+    uint64_t value;
+    #else
+    char value[64];
+    #endif
+    while (read(fd[0], &value, sizeof(value)) > 0);
+}
+
+static void wakeup (int *fd, int *waiting)
+{
+    // Only signal if the other side has said it's waiting, and only once for
+    // that; the fence pairs with the one in wait_begin, so that either we see
+    // the flag or the other side sees our update to the ring.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(waiting, __ATOMIC_RELAXED) || !__atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    
+    #ifdef BADVPN_LINUX
+    uint64_t value = 1;
+    #else
+    char value = 0;
+    #endif
+    ssize_t res = write(fd[1], &value, sizeof(value));
+    
+    // EAGAIN means a wakeup is already pending
+    if (res != sizeof(value) && !(res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+        BLog(BLOG_ERROR, "write failed");
+    }
+}
+
+static void wait_begin (int *waiting)
+{
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void wait_cancel (int *waiting)
+{
+    // if the other side has already taken the flag, we'll get a spurious wakeup
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+static void producer_try_send (BThreadPacketRingProducer *o)
+{
+    ASSERT(o->in_len >= 0)
+    
+    BThreadPacketRing *r = o->ring;
+    
+    uint8_t *dest = ChunkBufferSPSC_ProducerGet(&r->buf);
+    if (!dest) {
+        // ring is full; ask to be woken up, then look again in case the
+        // consumer made room before it could see that
+        wait_begin(&r->producer_waiting);
+        if (!(dest = ChunkBufferSPSC_ProducerGet(&r->buf))) {
+            return;
+        }
+        wait_cancel(&r->producer_waiting);
+    }
+    
+    // copy packet into the ring
+    memcpy(dest, o->in, o->in_len);
+    ChunkBufferSPSC_ProducerSubmit(&r->buf, o->in_len);
+    
+    // set no input packet
+    o->in_len = -1;
+    
+    // wake up consumer if it's waiting
+    wakeup(r->consumer_fd, &r->consumer_waiting);
+    
+    // finish input packet
+    PacketPassInterface_Done(&o->input);
+}
+
+static void producer_input_handler_send (BThreadPacketRingProducer *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->in_len == -1)
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember input packet
+    o->in = data;
+    o->in_len = data_len;
+    
+    producer_try_send(o);
+}
+
+static void producer_bfd_handler (BThreadPacketRingProducer *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    wakeup_drain(o->ring->producer_fd);
+    
+    if (o->in_len >= 0) {
+        producer_try_send(o);
+    }
+}
+
+static void consumer_try_recv (BThreadPacketRingConsumer *o)
+{
+    ASSERT(o->out)
+    
+    BThreadPacketRing *r = o->ring;
+    
+    uint8_t *src;
+    int len = ChunkBufferSPSC_ConsumerGet(&r->buf, &src);
+    if (len < 0) {
+        // ring is empty; ask to be woken up, then look again in case the
+        // producer submitted before it could see that
+        wait_begin(&r->consumer_waiting);
+        if ((len = ChunkBufferSPSC_ConsumerGet(&r->buf, &src)) < 0) {
+            return;
+        }
+        wait_cancel(&r->consumer_waiting);
+    }
+    
+    // copy packet out of the ring
+    memcpy(o->out, src, len);
+    ChunkBufferSPSC_ConsumerConsume(&r->buf);
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // wake up producer if it's waiting
+    wakeup(r->producer_fd, &r->producer_waiting);
+    
+    // finish output packet
+    PacketRecvInterface_Done(&o->output, len);
+}
+
+static void consumer_output_handler_recv (BThreadPacketRingConsumer *o, uint8_t *data)
+{
+    ASSERT(!o->out)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember output packet
+    o->out = data;
+    
+    consumer_try_recv(o);
+}
+
+static void consumer_bfd_handler (BThreadPacketRingConsumer *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    wakeup_drain(o->ring->consumer_fd);
+    
+    if (o->out) {
+        consumer_try_recv(o);
+    }
+}
+
+int BThreadPacketRing_Init (BThreadPacketRing *o, int mtu, int num_packets)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(num_packets > 0)
+    
+    // init arguments
+    o->mtu = mtu;
+    
+    // calculate buffer size
+    int num_blocks = ChunkBuffer2_calc_blocks(o->mtu, num_packets);
+    if (num_blocks < 0) {
+        BLog(BLOG_ERROR, "buffer too large");
+        goto fail0;
+    }
+    
+    // allocate buffer
+    if (!(o->blocks = BAllocArray(num_blocks, sizeof(o->blocks[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // init wakeups
+    if (!wakeup_init(o->producer_fd)) {
+        goto fail1;
+    }
+    if (!wakeup_init(o->consumer_fd)) {
+        goto fail2;
+    }
+    
+    // nobody is waiting
+    o->producer_waiting = 0;
+    o->consumer_waiting = 0;
+    
+    // init buffer
+    ChunkBufferSPSC_Init(&o->buf, o->blocks, num_blocks, o->mtu);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail2:
+    wakeup_free(o->producer_fd);
+fail1:
+    BFree(o->blocks);
+fail0:
+    return 0;
+}
+
+void BThreadPacketRing_Free (BThreadPacketRing *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free wakeups
+    wakeup_free(o->consumer_fd);
+    wakeup_free(o->producer_fd);
+    
+    // free buffer
+    BFree(o->blocks);
+}
+
+int BThreadPacketRing_GetMTU (BThreadPacketRing *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->mtu;
+}
+
+int BThreadPacketRingProducer_Init (BThreadPacketRingProducer *o, BThreadPacketRing *ring, BReactor *reactor)
+{
+    DebugObject_Access(&ring->d_obj);
+    
+    // init arguments
+    o->ring = ring;
+    o->reactor = reactor;
+    
+    // init wakeup fd
+    BFileDescriptor_Init(&o->bfd, o->ring->producer_fd[0], (BFileDescriptor_handler)producer_bfd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        return 0;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    // init input
+    PacketPassInterface_Init(&o->input, o->ring->mtu, (PacketPassInterface_handler_send)producer_input_handler_send, o, BReactor_PendingGroup(o->reactor));
+    
+    // set no input packet
+    o->in_len = -1;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void BThreadPacketRingProducer_Free (BThreadPacketRingProducer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // don't leave a wakeup for a future producer
+    __atomic_store_n(&o->ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free wakeup fd
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+}
+
+PacketPassInterface * BThreadPacketRingProducer_GetInput (BThreadPacketRingProducer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+int BThreadPacketRingConsumer_Init (BThreadPacketRingConsumer *o, BThreadPacketRing *ring, BReactor *reactor)
+{
+    DebugObject_Access(&ring->d_obj);
+    
+    // init arguments
+    o->ring = ring;
+    o->reactor = reactor;
+    
+    // init wakeup fd
+    BFileDescriptor_Init(&o->bfd, o->ring->consumer_fd[0], (BFileDescriptor_handler)consumer_bfd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        return 0;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    // init output
+    PacketRecvInterface_Init(&o->output, o->ring->mtu, (PacketRecvInterface_handler_recv)consumer_output_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    
+    // set no output packet
+    o->out = NULL;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void BThreadPacketRingConsumer_Free (BThreadPacketRingConsumer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // don't leave a wakeup for a future consumer
+    __atomic_store_n(&o->ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    
+    // free output
+    PacketRecvInterface_Free(&o->output);
+    
+    // free wakeup fd
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+}
+
+PacketRecvInterface * BThreadPacketRingConsumer_GetOutput (BThreadPacketRingConsumer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->output;
+}
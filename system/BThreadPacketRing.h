@@ -0,0 +1,168 @@
+/**
+ * @file BReactorGroup.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Lock-free packet ring for passing packets from one reactor thread to another,
+ * e.g. between members of a {@link BReactorGroup}, with a {@link PacketPassInterface}
+ * on the producing side and a {@link PacketRecvInterface} on the consuming side.
+ */
+
+#ifndef BADVPN_SYSTEM_BTHREADPACKETRING_H
+#define BADVPN_SYSTEM_BTHREADPACKETRING_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/ChunkBufferSPSC.h>
+#include <base/DebugObject.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/PacketRecvInterface.h>
+#include <system/BReactor.h>
+
+typedef struct {
+    int mtu;
+    struct ChunkBuffer2_block *blocks;
+    int producer_fd[2];
+    int consumer_fd[2];
+    int producer_waiting;
+    char pad[CHUNKBUFFERSPSC_CACHE_LINE];
+    int consumer_waiting;
+    ChunkBufferSPSC buf;
+    DebugObject d_obj;
+} BThreadPacketRing;
+
+typedef struct {
+    BThreadPacketRing *ring;
+    BReactor *reactor;
+    PacketPassInterface input;
+    BFileDescriptor bfd;
+    uint8_t *in;
+    int in_len;
+    DebugObject d_obj;
+} BThreadPacketRingProducer;
+
+typedef struct {
+    BThreadPacketRing *ring;
+    BReactor *reactor;
+    PacketRecvInterface output;
+    BFileDescriptor bfd;
+    uint8_t *out;
+    DebugObject d_obj;
+} BThreadPacketRingConsumer;
+
+/**
+ * Initializes the ring.
+ * The ring itself isn't tied to a reactor; one {@link BThreadPacketRingProducer}
+ * and one {@link BThreadPacketRingConsumer} attach to it, each in its own thread.
+ * 
+ * @param o the object
+ * @param mtu maximum packet size. Must be >=0.
+ * @param num_packets number of packets of MTU size the ring can hold. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BThreadPacketRing_Init (BThreadPacketRing *o, int mtu, int num_packets) WARN_UNUSED;
+
+/**
+ * Frees the ring.
+ * The producer and the consumer must have been freed, and the threads must have
+ * synchronized since then (e.g. through a {@link BReactorGroupMember_Post} message).
+ * Packets still in the ring are dropped.
+ * 
+ * @param o the object
+ */
+void BThreadPacketRing_Free (BThreadPacketRing *o);
+
+/**
+ * Returns the MTU of the ring.
+ * 
+ * @param o the object
+ * @return MTU
+ */
+int BThreadPacketRing_GetMTU (BThreadPacketRing *o);
+
+/**
+ * Initializes the producer side of a ring.
+ * Packets sent to the input are copied into the ring, and the input is done
+ * with them right away, unless the ring is full; then the send completes
+ * once the consumer has made room.
+ * 
+ * @param o the object
+ * @param ring ring to write to. There may only be one producer at a time.
+ * @param reactor reactor of the calling thread. All further calls to the
+ *                producer must be made from this thread.
+ * @return 1 on success, 0 on failure
+ */
+int BThreadPacketRingProducer_Init (BThreadPacketRingProducer *o, BThreadPacketRing *ring, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the producer.
+ * 
+ * @param o the object
+ */
+void BThreadPacketRingProducer_Free (BThreadPacketRingProducer *o);
+
+/**
+ * Returns the input interface of the producer.
+ * Its MTU is the MTU of the ring.
+ * 
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * BThreadPacketRingProducer_GetInput (BThreadPacketRingProducer *o);
+
+/**
+ * Initializes the consumer side of a ring.
+ * Packets are copied out of the ring into the buffers provided by the
+ * receiver of the output.
+ * 
+ * @param o the object
+ * @param ring ring to read from. There may only be one consumer at a time.
+ * @param reactor reactor of the calling thread. All further calls to the
+ *                consumer must be made from this thread.
+ * @return 1 on success, 0 on failure
+ */
+int BThreadPacketRingConsumer_Init (BThreadPacketRingConsumer *o, BThreadPacketRing *ring, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the consumer.
+ * 
+ * @param o the object
+ */
+void BThreadPacketRingConsumer_Free (BThreadPacketRingConsumer *o);
+
+/**
+ * Returns the output interface of the consumer.
+ * Its MTU is the MTU of the ring.
+ * 
+ * @param o the object
+ * @return output interface
+ */
+PacketRecvInterface * BThreadPacketRingConsumer_GetOutput (BThreadPacketRingConsumer *o);
+
+#endif
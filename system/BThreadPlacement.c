@@ -0,0 +1,444 @@
+/**
+ * @file BThreadPlacement.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#ifdef BADVPN_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include <misc/memref.h>
+#include <misc/parse_number.h>
+#include <misc/read_file.h>
+#include <base/BLog.h>
+
+#include "BThreadPlacement.h"
+
+#include <generated/blog_channel_BThreadPlacement.h>
+
+static int parse_cpu_list (MemRef str, uint8_t set[BTHREADPLACEMENT_MAX_CPUS])
+{
+    memset(set, 0, BTHREADPLACEMENT_MAX_CPUS);
+    
+    while (str.len > 0) {
+        // cut off the next element
+        size_t elem_len;
+        if (!MemRef_FindChar(str, ',', &elem_len)) {
+            elem_len = str.len;
+        }
+        MemRef elem = MemRef_SubTo(str, elem_len);
+        str = MemRef_SubFrom(str, (elem_len < str.len) ? elem_len + 1 : elem_len);
+        
+        // parse a CPU or a range of CPUs
+        uintmax_t first;
+        uintmax_t last;
+        size_t dash;
+        if (MemRef_FindChar(elem, '-', &dash)) {
+            if (!parse_unsigned_integer(MemRef_SubTo(elem, dash), &first) ||
+                !parse_unsigned_integer(MemRef_SubFrom(elem, dash + 1), &last)) {
+                return 0;
+            }
+        } else {
+            if (!parse_unsigned_integer(elem, &first)) {
+                return 0;
+            }
+            last = first;
+        }
+        
+        if (first > last || last >= BTHREADPLACEMENT_MAX_CPUS) {
+            return 0;
+        }
+        
+        for (uintmax_t cpu = first; cpu <= last; cpu++) {
+            set[cpu] = 1;
+        }
+    }
+    
+    return 1;
+}
+
+static int read_cpu_list_file (const char *file, uint8_t set[BTHREADPLACEMENT_MAX_CPUS])
+{
+    uint8_t *data;
+    size_t len;
+    if (!read_file(file, &data, &len)) {
+        return 0;
+    }
+    
+    // strip the trailing newline
+    while (len > 0 && isspace(data[len - 1])) {
+        len--;
+    }
+    
+    int res = (len > 0 && parse_cpu_list(MemRef_Make((const char *)data, len), set));
+    free(data);
+    
+    return res;
+}
+
+static void set_cpus_from_set (BThreadPlacement *o, const uint8_t set[BTHREADPLACEMENT_MAX_CPUS])
+{
+    o->num_cpus = 0;
+    for (int cpu = 0; cpu < BTHREADPLACEMENT_MAX_CPUS; cpu++) {
+        if (set[cpu]) {
+            o->cpus[o->num_cpus++] = cpu;
+        }
+    }
+}
+
+static int line_mentions_interface (const char *line, size_t len, const char *ifname)
+{
+    size_t name_len = strlen(ifname);
+    
+    // the device names come after the counters; match whole names, or names
+    // of queues such as eth0-TxRx-0
+    for (size_t i = 0; i + name_len <= len; i++) {
+        if (memcmp(line + i, ifname, name_len)) {
+            continue;
+        }
+        int start_ok = (i == 0 || line[i - 1] == ' ' || line[i - 1] == ',');
+        int end_ok = (i + name_len == len || !isalnum((unsigned char)line[i + name_len]));
+        if (start_ok && end_ok) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static void format_cpu_set (const uint8_t set[BTHREADPLACEMENT_MAX_CPUS], char *out, size_t out_size)
+{
+    ASSERT(out_size >= 4)
+    
+    size_t pos = 0;
+    out[0] = '\0';
+    
+    for (int cpu = 0; cpu < BTHREADPLACEMENT_MAX_CPUS; cpu++) {
+        if (!set[cpu]) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < BTHREADPLACEMENT_MAX_CPUS && set[last + 1]) {
+            last++;
+        }
+        
+        char elem[32];
+        if (last > cpu) {
+            snprintf(elem, sizeof(elem), "%s%d-%d", (pos > 0 ? "," : ""), cpu, last);
+        } else {
+            snprintf(elem, sizeof(elem), "%s%d", (pos > 0 ? "," : ""), cpu);
+        }
+        
+        size_t elem_len = strlen(elem);
+        if (pos + elem_len >= out_size - 3) {
+            strcpy(out + pos, "...");
+            return;
+        }
+        memcpy(out + pos, elem, elem_len + 1);
+        pos += elem_len;
+        
+        cpu = last;
+    }
+}
+
+void BThreadPlacement_Init (BThreadPlacement *o)
+{
+    o->num_cpus = 0;
+    o->spread = 0;
+    o->sched = BTHREADPLACEMENT_SCHED_DEFAULT;
+    o->sched_value = 0;
+}
+
+int BThreadPlacement_ParseCpus (BThreadPlacement *o, const char *str)
+{
+    uint8_t set[BTHREADPLACEMENT_MAX_CPUS];
+    if (!*str || !parse_cpu_list(MemRef_MakeCstr(str), set)) {
+        return 0;
+    }
+    
+    set_cpus_from_set(o, set);
+    o->spread = 1;
+    
+    return 1;
+}
+
+int BThreadPlacement_ParseSched (BThreadPlacement *o, const char *str)
+{
+    MemRef ref = MemRef_MakeCstr(str);
+    
+    size_t colon;
+    if (!MemRef_FindChar(ref, ':', &colon)) {
+        return 0;
+    }
+    MemRef kind = MemRef_SubTo(ref, colon);
+    MemRef value = MemRef_SubFrom(ref, colon + 1);
+    
+    int sign;
+    uintmax_t mag;
+    if (!parse_signmag_integer(value, &sign, &mag) || mag > 99) {
+        return 0;
+    }
+    int v = sign * (int)mag;
+    
+    if (MemRef_Equal(kind, MemRef_MakeCstr("nice"))) {
+        if (v < -20 || v > 19) {
+            return 0;
+        }
+        o->sched = BTHREADPLACEMENT_SCHED_NICE;
+    }
+    else if (MemRef_Equal(kind, MemRef_MakeCstr("fifo"))) {
+        if (v < 1 || v > 99) {
+            return 0;
+        }
+        o->sched = BTHREADPLACEMENT_SCHED_FIFO;
+    }
+    else {
+        return 0;
+    }
+    
+    o->sched_value = v;
+    
+    return 1;
+}
+
+int BThreadPlacement_AvoidIrqCpus (BThreadPlacement *o, const char *ifname)
+{
+    uint8_t set[BTHREADPLACEMENT_MAX_CPUS];
+    
+    // start from the listed CPUs, or all online CPUs
+    if (o->num_cpus > 0) {
+        memset(set, 0, sizeof(set));
+        for (int i = 0; i < o->num_cpus; i++) {
+            set[o->cpus[i]] = 1;
+        }
+    } else if (!read_cpu_list_file("/sys/devices/system/cpu/online", set)) {
+        BLog(BLOG_ERROR, "cannot read online CPUs");
+        return 0;
+    }
+    
+    uint8_t *data;
+    size_t len;
+    if (!read_file("/proc/interrupts", &data, &len)) {
+        BLog(BLOG_ERROR, "cannot read /proc/interrupts");
+        return 0;
+    }
+    
+    int num_irqs = 0;
+    uint8_t keep[BTHREADPLACEMENT_MAX_CPUS];
+    memcpy(keep, set, sizeof(keep));
+    
+    size_t pos = 0;
+    while (pos < len) {
+        const char *line = (const char *)data + pos;
+        const char *nl = memchr(line, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+        pos += line_len + 1;
+        
+        // lines of numbered interrupts start with the number and a colon
+        size_t i = 0;
+        while (i < line_len && line[i] == ' ') {
+            i++;
+        }
+        size_t num_start = i;
+        while (i < line_len && isdigit((unsigned char)line[i])) {
+            i++;
+        }
+        if (i == num_start || i == line_len || line[i] != ':') {
+            continue;
+        }
+        
+        if (!line_mentions_interface(line + i + 1, line_len - (i + 1), ifname)) {
+            continue;
+        }
+        
+        uintmax_t irq;
+        if (!parse_unsigned_integer(MemRef_Make(line + num_start, i - num_start), &irq)) {
+            continue;
+        }
+        
+        // prefer where the interrupt is actually delivered
+        char file[64];
+        uint8_t irq_set[BTHREADPLACEMENT_MAX_CPUS];
+        snprintf(file, sizeof(file), "/proc/irq/%ju/effective_affinity_list", irq);
+        if (!read_cpu_list_file(file, irq_set)) {
+            snprintf(file, sizeof(file), "/proc/irq/%ju/smp_affinity_list", irq);
+            if (!read_cpu_list_file(file, irq_set)) {
+                BLog(BLOG_WARNING, "cannot read affinity of IRQ %ju", irq);
+                continue;
+            }
+        }
+        
+        for (int cpu = 0; cpu < BTHREADPLACEMENT_MAX_CPUS; cpu++) {
+            if (irq_set[cpu]) {
+                keep[cpu] = 0;
+            }
+        }
+        num_irqs++;
+    }
+    
+    free(data);
+    
+    if (num_irqs == 0) {
+        BLog(BLOG_WARNING, "no IRQs found for interface %s", ifname);
+        return 1;
+    }
+    
+    int num_kept = 0;
+    for (int cpu = 0; cpu < BTHREADPLACEMENT_MAX_CPUS; cpu++) {
+        num_kept += keep[cpu];
+    }
+    
+    if (num_kept == 0) {
+        BLog(BLOG_WARNING, "IRQs of interface %s are handled by all CPUs, not avoiding them", ifname);
+        return 1;
+    }
+    
+    char str[128];
+    format_cpu_set(keep, str, sizeof(str));
+    BLog(BLOG_INFO, "avoiding %d IRQs of interface %s, leaving CPUs %s", num_irqs, ifname, str);
+    
+    // keep the order and spreading of explicitly listed CPUs
+    if (o->num_cpus > 0) {
+        int n = 0;
+        for (int i = 0; i < o->num_cpus; i++) {
+            if (keep[o->cpus[i]]) {
+                o->cpus[n++] = o->cpus[i];
+            }
+        }
+        o->num_cpus = n;
+    } else {
+        set_cpus_from_set(o, keep);
+        o->spread = 0;
+    }
+    
+    return 1;
+}
+
+int BThreadPlacement_IsSet (const BThreadPlacement *o)
+{
+    return (o->num_cpus > 0 || o->sched != BTHREADPLACEMENT_SCHED_DEFAULT);
+}
+
+#ifdef BADVPN_LINUX
+
+static void log_placement (const char *name, int level)
+{
+    char cpus_str[128] = "?";
+    cpu_set_t cpus;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+        uint8_t set[BTHREADPLACEMENT_MAX_CPUS];
+        for (int cpu = 0; cpu < BTHREADPLACEMENT_MAX_CPUS; cpu++) {
+            set[cpu] = (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &cpus));
+        }
+        format_cpu_set(set, cpus_str, sizeof(cpus_str));
+    }
+    
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) {
+        policy = -1;
+    }
+    
+    if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        BLog(level, "%s: CPUs %s, %s priority %d", name, cpus_str, (policy == SCHED_FIFO ? "fifo" : "rr"), param.sched_priority);
+    } else {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+        BLog(level, "%s: CPUs %s, nice %d", name, cpus_str, (errno ? 0 : nice));
+    }
+}
+
+void BThreadPlacement_Apply (const BThreadPlacement *o, int index, const char *name)
+{
+    ASSERT(index >= 0)
+    
+    if (o->num_cpus > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        
+        if (o->spread) {
+            CPU_SET(o->cpus[index % o->num_cpus], &cpus);
+        } else {
+            for (int i = 0; i < o->num_cpus; i++) {
+                CPU_SET(o->cpus[i], &cpus);
+            }
+        }
+        
+        int res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (res != 0) {
+            BLog(BLOG_WARNING, "%s: pthread_setaffinity_np failed: %s", name, strerror(res));
+        }
+    }
+    
+    switch (o->sched) {
+        case BTHREADPLACEMENT_SCHED_NICE: {
+            // on Linux, this only affects the calling thread
+            if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), o->sched_value) < 0) {
+                BLog(BLOG_WARNING, "%s: setpriority failed: %s", name, strerror(errno));
+            }
+        } break;
+        
+        case BTHREADPLACEMENT_SCHED_FIFO: {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = o->sched_value;
+            int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (res != 0) {
+                BLog(BLOG_WARNING, "%s: cannot use real-time scheduling: %s", name, strerror(res));
+            }
+        } break;
+    }
+    
+    log_placement(name, (BThreadPlacement_IsSet(o) ? BLOG_NOTICE : BLOG_INFO));
+}
+
+#else
+
+void BThreadPlacement_Apply (const BThreadPlacement *o, int index, const char *name)
+{
+    ASSERT(index >= 0)
+    
+    if (BThreadPlacement_IsSet(o)) {
+        BLog(BLOG_WARNING, "%s: thread placement is not supported on this platform", name);
+    }
+}
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @file BThreadPlacement.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Placement of threads on CPUs, and their scheduling policy.
+ */
+
+#ifndef BADVPN_BTHREADPLACEMENT_H
+#define BADVPN_BTHREADPLACEMENT_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+#define BTHREADPLACEMENT_MAX_CPUS 1024
+
+#define BTHREADPLACEMENT_SCHED_DEFAULT 0
+#define BTHREADPLACEMENT_SCHED_NICE 1
+#define BTHREADPLACEMENT_SCHED_FIFO 2
+
+/**
+ * Where threads should run, and with what scheduling policy.
+ * 
+ * A placement is typically filled in from command line options and then
+ * applied by each thread of a group (reactor threads, worker threads) to
+ * itself with {@link BThreadPlacement_Apply}, which logs where the thread
+ * actually ended up. If CPUs were listed explicitly, the threads are spread
+ * over them one CPU each, in the listed order; if the CPUs are only what is
+ * left after {@link BThreadPlacement_AvoidIrqCpus}, every thread may run on
+ * all of them.
+ * 
+ * Only implemented on Linux; elsewhere, applying a placement which is set
+ * only logs a warning.
+ */
+typedef struct {
+    int num_cpus;
+    int spread;
+    uint16_t cpus[BTHREADPLACEMENT_MAX_CPUS];
+    int sched;
+    int sched_value;
+} BThreadPlacement;
+
+/**
+ * Initializes a placement which leaves threads as they are.
+ * 
+ * @param o the object
+ */
+void BThreadPlacement_Init (BThreadPlacement *o);
+
+/**
+ * Sets the CPUs from a list such as "0-3,8,10-11".
+ * 
+ * @param o the object
+ * @param str the list
+ * @return 1 on success, 0 if the list is invalid
+ */
+int BThreadPlacement_ParseCpus (BThreadPlacement *o, const char *str) WARN_UNUSED;
+
+/**
+ * Sets the scheduling policy from "nice:<-20..19>" or "fifo:<1..99>".
+ * 
+ * @param o the object
+ * @param str the policy
+ * @return 1 on success, 0 if the policy is invalid
+ */
+int BThreadPlacement_ParseSched (BThreadPlacement *o, const char *str) WARN_UNUSED;
+
+/**
+ * Removes the CPUs which handle interrupts of a network interface, as found
+ * in /proc/interrupts and /proc/irq. If no CPUs were set, starts from all
+ * online CPUs. If no CPUs would remain, the CPUs are left as they were.
+ * 
+ * @param o the object
+ * @param ifname name of the network interface
+ * @return 1 on success, 0 if the interrupt configuration could not be read
+ */
+int BThreadPlacement_AvoidIrqCpus (BThreadPlacement *o, const char *ifname) WARN_UNUSED;
+
+/**
+ * Checks whether applying the placement would change anything.
+ * 
+ * @param o the object
+ * @return 1 if CPUs or a scheduling policy are set, 0 if not
+ */
+int BThreadPlacement_IsSet (const BThreadPlacement *o);
+
+/**
+ * Applies the placement to the calling thread and logs the resulting
+ * placement. Failures, e.g. missing permissions for real-time scheduling,
+ * are logged and otherwise ignored.
+ * 
+ * @param o the object
+ * @param index index of the thread in its group, selecting its CPU when
+ *              threads are spread over the CPUs. Must be >=0.
+ * @param name name of the thread for the log, e.g. "reactor"
+ */
+void BThreadPlacement_Apply (const BThreadPlacement *o, int index, const char *name);
+
+#endif
@@ -137,6 +137,68 @@ static btime_t btime_gettime (void)
     #endif
 }
 
+/**
+ * Like {@link btime_gettime}, but may use a cheaper clock source with
+ * reduced resolution (CLOCK_MONOTONIC_COARSE on Linux).
+ * The result may lag behind {@link btime_gettime} by up to one kernel tick
+ * (typically 1-4 ms), so this must only be used where such error is
+ * acceptable, e.g. for inactivity bookkeeping, and never to arm timers
+ * that need to fire relative to a precise time.
+ * Falls back to {@link btime_gettime} where no coarse clock exists.
+ */
+static btime_t btime_gettime_coarse (void)
+{
+    ASSERT(btime_global.initialized)
+    
+    #if !defined(BADVPN_USE_WINAPI) && !defined(BADVPN_EMSCRIPTEN) && defined(CLOCK_MONOTONIC_COARSE)
+    
+    if (!btime_global.use_gettimeofday) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+            return (((int64_t)ts.tv_sec * 1000 + (int64_t)ts.tv_nsec/1000000) - btime_global.start_time);
+        }
+    }
+    
+    #endif
+    
+    return btime_gettime();
+}
+
+/**
+ * Returns the current time in microseconds, for measuring short durations.
+ * Uses the same clock as {@link btime_gettime} but does not share its base.
+ */
+static int64_t btime_gettime_us (void)
+{
+    ASSERT(btime_global.initialized)
+    
+    #if defined(BADVPN_USE_WINAPI)
+    
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+    ASSERT_FORCE(QueryPerformanceCounter(&count))
+    ASSERT_FORCE(QueryPerformanceFrequency(&freq))
+    return (int64_t)((double)count.QuadPart * (1000000.0 / (double)freq.QuadPart));
+    
+    #elif defined(BADVPN_EMSCRIPTEN)
+    
+    return (int64_t)(emscripten_get_now() * 1000.0);
+    
+    #else
+    
+    if (btime_global.use_gettimeofday) {
+        struct timeval tv;
+        ASSERT_FORCE(gettimeofday(&tv, NULL) == 0)
+        return ((int64_t)tv.tv_sec * 1000000 + (int64_t)tv.tv_usec);
+    } else {
+        struct timespec ts;
+        ASSERT_FORCE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ((int64_t)ts.tv_sec * 1000000 + (int64_t)ts.tv_nsec/1000);
+    }
+    
+    #endif
+}
+
 static btime_t btime_add (btime_t t1, btime_t t2)
 {
     // handle overflow
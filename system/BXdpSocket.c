@@ -0,0 +1,750 @@
+/**
+ * @file BXdpSocket.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#include <misc/offset.h>
+#include <misc/compare.h>
+#include <misc/byteorder.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
+#include <misc/udp_proto.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include "BXdpSocket.h"
+
+#include <generated/blog_channel_BXdpSocket.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// the completion ring is only used for sending, but must exist
+#define COMPLETION_RING_SIZE 64
+
+// bits in the values of the ports map
+#define FAMILY_BIT_IPV4 1
+#define FAMILY_BIT_IPV6 2
+
+#define MAX_PROG_INSNS 64
+
+enum {LABEL_PASS, LABEL_IPV4, LABEL_IPV6, LABEL_UDP, NUM_LABELS};
+
+struct prog {
+    struct bpf_insn insns[MAX_PROG_INSNS];
+    int jump_labels[MAX_PROG_INSNS];
+    int labels[NUM_LABELS];
+    int num;
+};
+
+#define INSN(_code, _dst, _src, _off, _imm) ((struct bpf_insn){.code = (_code), .dst_reg = (_dst), .src_reg = (_src), .off = (_off), .imm = (_imm)})
+#define MOV_REG(_dst, _src) INSN(BPF_ALU64 | BPF_MOV | BPF_X, _dst, _src, 0, 0)
+#define MOV_IMM(_dst, _imm) INSN(BPF_ALU64 | BPF_MOV | BPF_K, _dst, 0, 0, _imm)
+#define ALU_IMM(_op, _dst, _imm) INSN(BPF_ALU64 | (_op) | BPF_K, _dst, 0, 0, _imm)
+#define ALU_REG(_op, _dst, _src) INSN(BPF_ALU64 | (_op) | BPF_X, _dst, _src, 0, 0)
+#define LDX(_size, _dst, _src, _off) INSN(BPF_LDX | (_size) | BPF_MEM, _dst, _src, _off, 0)
+#define STX(_size, _dst, _off, _src) INSN(BPF_STX | (_size) | BPF_MEM, _dst, _src, _off, 0)
+#define JMP_IMM(_op, _dst, _imm) INSN(BPF_JMP | (_op) | BPF_K, _dst, 0, 0, _imm)
+#define JMP_REG(_op, _dst, _src) INSN(BPF_JMP | (_op) | BPF_X, _dst, _src, 0, 0)
+#define JA INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0)
+#define CALL(_func) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, _func)
+#define EXIT INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static int comparator (void *unused, struct BXdpSocketPort_key *k1, struct BXdpSocketPort_key *k2)
+{
+    int c = B_COMPARE(k1->family, k2->family);
+    if (c) {
+        return c;
+    }
+    return B_COMPARE(k1->port, k2->port);
+}
+
+static int sys_bpf (int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int create_map (int type, int key_size, int value_size, int max_entries)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int update_map (int fd, const void *key, const void *value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uintptr_t)key;
+    attr.value = (uintptr_t)value;
+    attr.flags = BPF_ANY;
+    
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int delete_map (int fd, const void *key)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uintptr_t)key;
+    
+    return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static void prog_emit (struct prog *p, struct bpf_insn insn)
+{
+    ASSERT(p->num < MAX_PROG_INSNS)
+    
+    p->insns[p->num] = insn;
+    p->jump_labels[p->num] = -1;
+    p->num++;
+}
+
+static void prog_emit_jump (struct prog *p, struct bpf_insn insn, int label)
+{
+    prog_emit(p, insn);
+    p->jump_labels[p->num - 1] = label;
+}
+
+static void prog_emit_map (struct prog *p, int dst, int map_fd)
+{
+    prog_emit(p, INSN(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map_fd));
+    prog_emit(p, INSN(0, 0, 0, 0, 0));
+}
+
+static void prog_label (struct prog *p, int label)
+{
+    p->labels[label] = p->num;
+}
+
+static void build_prog (struct prog *p, int ports_map_fd, int xsks_map_fd)
+{
+    p->num = 0;
+    
+    // r6 = packet start, r3 = packet end, r7 = receive queue
+    prog_emit(p, LDX(BPF_W, BPF_REG_6, BPF_REG_1, offsetof(struct xdp_md, data)));
+    prog_emit(p, LDX(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)));
+    prog_emit(p, LDX(BPF_W, BPF_REG_7, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index)));
+    
+    // ethernet header
+    prog_emit(p, MOV_REG(BPF_REG_4, BPF_REG_6));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_4, sizeof(struct ethernet_header)));
+    prog_emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3), LABEL_PASS);
+    prog_emit(p, LDX(BPF_H, BPF_REG_5, BPF_REG_6, offsetof(struct ethernet_header, type)));
+    prog_emit_jump(p, JMP_IMM(BPF_JEQ, BPF_REG_5, hton16(ETHERTYPE_IPV4)), LABEL_IPV4);
+    prog_emit_jump(p, JMP_IMM(BPF_JEQ, BPF_REG_5, hton16(ETHERTYPE_IPV6)), LABEL_IPV6);
+    prog_emit_jump(p, JA, LABEL_PASS);
+    
+    // IPv4 header: UDP, not fragmented; r4 = UDP header
+    prog_label(p, LABEL_IPV4);
+    int ip = sizeof(struct ethernet_header);
+    prog_emit(p, MOV_REG(BPF_REG_4, BPF_REG_6));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_4, ip + sizeof(struct ipv4_header)));
+    prog_emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3), LABEL_PASS);
+    prog_emit(p, LDX(BPF_B, BPF_REG_5, BPF_REG_6, ip + offsetof(struct ipv4_header, protocol)));
+    prog_emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, IPV4_PROTOCOL_UDP), LABEL_PASS);
+    prog_emit(p, LDX(BPF_H, BPF_REG_5, BPF_REG_6, ip + offsetof(struct ipv4_header, flags3_fragmentoffset13)));
+    prog_emit(p, ALU_IMM(BPF_AND, BPF_REG_5, hton16(0x3FFF)));
+    prog_emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, 0), LABEL_PASS);
+    prog_emit(p, LDX(BPF_B, BPF_REG_5, BPF_REG_6, ip + offsetof(struct ipv4_header, version4_ihl4)));
+    prog_emit(p, ALU_IMM(BPF_AND, BPF_REG_5, 0x0F));
+    prog_emit(p, ALU_IMM(BPF_LSH, BPF_REG_5, 2));
+    prog_emit_jump(p, JMP_IMM(BPF_JLT, BPF_REG_5, sizeof(struct ipv4_header)), LABEL_PASS);
+    prog_emit(p, MOV_REG(BPF_REG_4, BPF_REG_6));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_4, ip));
+    prog_emit(p, ALU_REG(BPF_ADD, BPF_REG_4, BPF_REG_5));
+    prog_emit(p, MOV_IMM(BPF_REG_9, FAMILY_BIT_IPV4));
+    prog_emit_jump(p, JA, LABEL_UDP);
+    
+    // IPv6 header: UDP without extension headers; r4 = UDP header
+    prog_label(p, LABEL_IPV6);
+    prog_emit(p, MOV_REG(BPF_REG_4, BPF_REG_6));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_4, ip + sizeof(struct ipv6_header)));
+    prog_emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3), LABEL_PASS);
+    prog_emit(p, LDX(BPF_B, BPF_REG_5, BPF_REG_6, ip + offsetof(struct ipv6_header, next_header)));
+    prog_emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, IPV6_NEXT_UDP), LABEL_PASS);
+    prog_emit(p, MOV_IMM(BPF_REG_9, FAMILY_BIT_IPV6));
+    
+    // UDP header: look up the destination port
+    prog_label(p, LABEL_UDP);
+    prog_emit(p, MOV_REG(BPF_REG_5, BPF_REG_4));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_5, sizeof(struct udp_header)));
+    prog_emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_5, BPF_REG_3), LABEL_PASS);
+    prog_emit(p, LDX(BPF_H, BPF_REG_5, BPF_REG_4, offsetof(struct udp_header, dest_port)));
+    prog_emit(p, STX(BPF_W, BPF_REG_10, -4, BPF_REG_5));
+    prog_emit(p, MOV_REG(BPF_REG_2, BPF_REG_10));
+    prog_emit(p, ALU_IMM(BPF_ADD, BPF_REG_2, -4));
+    prog_emit_map(p, BPF_REG_1, ports_map_fd);
+    prog_emit(p, CALL(BPF_FUNC_map_lookup_elem));
+    prog_emit_jump(p, JMP_IMM(BPF_JEQ, BPF_REG_0, 0), LABEL_PASS);
+    prog_emit(p, LDX(BPF_B, BPF_REG_5, BPF_REG_0, 0));
+    prog_emit(p, ALU_REG(BPF_AND, BPF_REG_5, BPF_REG_9));
+    prog_emit_jump(p, JMP_IMM(BPF_JEQ, BPF_REG_5, 0), LABEL_PASS);
+    
+    // redirect to the socket of this queue, passing to the stack if there is none
+    prog_emit_map(p, BPF_REG_1, xsks_map_fd);
+    prog_emit(p, MOV_REG(BPF_REG_2, BPF_REG_7));
+    prog_emit(p, MOV_IMM(BPF_REG_3, XDP_PASS));
+    prog_emit(p, CALL(BPF_FUNC_redirect_map));
+    prog_emit(p, EXIT);
+    
+    prog_label(p, LABEL_PASS);
+    prog_emit(p, MOV_IMM(BPF_REG_0, XDP_PASS));
+    prog_emit(p, EXIT);
+    
+    // resolve jumps
+    for (int i = 0; i < p->num; i++) {
+        if (p->jump_labels[i] >= 0) {
+            p->insns[i].off = p->labels[p->jump_labels[i]] - (i + 1);
+        }
+    }
+}
+
+static int load_prog (int ports_map_fd, int xsks_map_fd)
+{
+    struct prog p;
+    build_prog(&p, ports_map_fd, xsks_map_fd);
+    
+    static const char license[] = "Dual BSD/GPL";
+    
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)p.insns;
+    attr.insn_cnt = p.num;
+    attr.license = (uintptr_t)license;
+    
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int map_ring (struct BXdpSocket_ring *r, int fd, struct xdp_ring_offset *off, uint32_t size, size_t desc_size, off_t pgoff)
+{
+    r->map_size = off->desc + size * desc_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        return 0;
+    }
+    
+    r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+    r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+    r->descs = (uint8_t *)r->map + off->desc;
+    r->mask = size - 1;
+    
+    return 1;
+}
+
+static void fill_frame (BXdpSocket *o, uint64_t addr)
+{
+    // we are the only producer, and there are never more frames than fit the ring
+    uint32_t prod = *o->fill.producer;
+    ASSERT(prod - __atomic_load_n(o->fill.consumer, __ATOMIC_ACQUIRE) < (uint32_t)o->num_frames)
+    
+    ((uint64_t *)o->fill.descs)[prod & o->fill.mask] = addr - addr % BXDPSOCKET_FRAME_SIZE;
+    __atomic_store_n(o->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+static int parse_frame (uint8_t *data, int len, struct BXdpSocketPort_key *key, struct BXdpSocketPort_frame *frame)
+{
+    // ethernet
+    if (len < sizeof(struct ethernet_header)) {
+        return 0;
+    }
+    struct ethernet_header eh;
+    memcpy(&eh, data, sizeof(eh));
+    uint8_t *ip_data = data + sizeof(eh);
+    int ip_len = len - sizeof(eh);
+    
+    uint8_t *udp_data;
+    int udp_len;
+    struct ipv4_header ipv4_header;
+    struct ipv6_header ipv6_header;
+    
+    switch (ntoh16(eh.type)) {
+        case ETHERTYPE_IPV4: {
+            if (!ipv4_check(ip_data, ip_len, &ipv4_header, &udp_data, &udp_len) || ipv4_header.protocol != IPV4_PROTOCOL_UDP) {
+                return 0;
+            }
+            key->family = BADDR_TYPE_IPV4;
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            if (!ipv6_check(ip_data, ip_len, &ipv6_header, &udp_data, &udp_len) || ipv6_header.next_header != IPV6_NEXT_UDP) {
+                return 0;
+            }
+            key->family = BADDR_TYPE_IPV6;
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    struct udp_header uh;
+    uint8_t *payload;
+    int payload_len;
+    if (!udp_check(udp_data, udp_len, &uh, &payload, &payload_len)) {
+        return 0;
+    }
+    
+    // verify the checksum, which the kernel would have done; it is optional with IPv4
+    uint16_t checksum = uh.checksum;
+    uh.checksum = 0;
+    if (key->family == BADDR_TYPE_IPV4) {
+        if (checksum != 0 && udp_checksum(&uh, payload, payload_len, ipv4_header.source_address, ipv4_header.destination_address) != checksum) {
+            return 0;
+        }
+        BAddr_InitIPv4(&frame->remote_addr, ipv4_header.source_address, uh.source_port);
+        BIPAddr_InitIPv4(&frame->local_addr, ipv4_header.destination_address);
+    } else {
+        if (udp_ip6_checksum(&uh, payload, payload_len, ipv6_header.source_address, ipv6_header.destination_address) != checksum) {
+            return 0;
+        }
+        BAddr_InitIPv6(&frame->remote_addr, ipv6_header.source_address, uh.source_port);
+        BIPAddr_InitIPv6(&frame->local_addr, ipv6_header.destination_address);
+    }
+    
+    key->port = uh.dest_port;
+    frame->data_off = payload - data;
+    frame->data_len = payload_len;
+    
+    return 1;
+}
+
+static void receive_frame (BXdpSocket *o, uint64_t addr, uint32_t len)
+{
+    struct BXdpSocketPort_key key;
+    struct BXdpSocketPort_frame frame;
+    
+    // find the port the datagram is for
+    BAVLNode *node;
+    if (addr + len > o->umem_size || !parse_frame(o->umem + addr, len, &key, &frame) || !(node = BAVL_LookupExact(&o->ports_tree, &key))) {
+        fill_frame(o, addr);
+        return;
+    }
+    BXdpSocketPort *port = UPPER_OBJECT(node, BXdpSocketPort, ports_tree_node);
+    
+    // drop if the queue is full
+    if (port->used == port->queue_len) {
+        fill_frame(o, addr);
+        return;
+    }
+    
+    // queue frame
+    frame.addr = addr;
+    port->frames[(port->start + port->used) % port->queue_len] = frame;
+    port->used++;
+    
+    // tell the user if the queue was empty
+    if (port->used == 1) {
+        port->handler(port->user);
+    }
+}
+
+static void fd_handler (BXdpSocket *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint32_t cons = *o->rx.consumer;
+    uint32_t prod = __atomic_load_n(o->rx.producer, __ATOMIC_ACQUIRE);
+    
+    while (cons != prod) {
+        struct xdp_desc *desc = &((struct xdp_desc *)o->rx.descs)[cons & o->rx.mask];
+        receive_frame(o, desc->addr, desc->len);
+        cons++;
+    }
+    
+    __atomic_store_n(o->rx.consumer, cons, __ATOMIC_RELEASE);
+}
+
+static int update_port_map (BXdpSocket *o, uint16_t port)
+{
+    // collect families the port is registered with
+    uint8_t families = 0;
+    struct BXdpSocketPort_key key;
+    key.port = port;
+    key.family = BADDR_TYPE_IPV4;
+    if (BAVL_LookupExact(&o->ports_tree, &key)) {
+        families |= FAMILY_BIT_IPV4;
+    }
+    key.family = BADDR_TYPE_IPV6;
+    if (BAVL_LookupExact(&o->ports_tree, &key)) {
+        families |= FAMILY_BIT_IPV6;
+    }
+    
+    uint32_t map_key = port;
+    if (!families) {
+        delete_map(o->ports_map_fd, &map_key);
+        return 1;
+    }
+    
+    if (update_map(o->ports_map_fd, &map_key, &families) < 0) {
+        BLog(BLOG_ERROR, "failed to update ports map (%d)", errno);
+        return 0;
+    }
+    
+    return 1;
+}
+
+int BXdpSocket_Init (BXdpSocket *o, BReactor *reactor, const char *ifname, int queue_id, int num_frames)
+{
+    ASSERT(ifname)
+    ASSERT(queue_id >= 0)
+    ASSERT(num_frames >= 64)
+    ASSERT(num_frames <= 65536)
+    ASSERT((num_frames & (num_frames - 1)) == 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->queue_id = queue_id;
+    o->num_frames = num_frames;
+    
+    // find interface
+    if (!(o->ifindex = if_nametoindex(ifname))) {
+        BLog(BLOG_ERROR, "interface %s not found", ifname);
+        goto fail0;
+    }
+    
+    // allocate UMEM
+    o->umem_size = (size_t)num_frames * BXDPSOCKET_FRAME_SIZE;
+    o->umem = (uint8_t *)mmap(NULL, o->umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (o->umem == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap failed");
+        goto fail0;
+    }
+    
+    // create socket
+    if ((o->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        BLog(BLOG_ERROR, "socket(AF_XDP) failed (%d)", errno);
+        goto fail1;
+    }
+    
+    // register UMEM
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)o->umem;
+    reg.len = o->umem_size;
+    reg.chunk_size = BXDPSOCKET_FRAME_SIZE;
+    if (setsockopt(o->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(XDP_UMEM_REG) failed (%d)", errno);
+        goto fail2;
+    }
+    
+    // set ring sizes
+    int ring_size = num_frames;
+    int comp_size = COMPLETION_RING_SIZE;
+    if (setsockopt(o->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(o->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp_size, sizeof(comp_size)) < 0 ||
+        setsockopt(o->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0
+    ) {
+        BLog(BLOG_ERROR, "setsockopt(ring size) failed (%d)", errno);
+        goto fail2;
+    }
+    
+    // map rings
+    struct xdp_mmap_offsets offs;
+    socklen_t offs_len = sizeof(offs);
+    if (getsockopt(o->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offs, &offs_len) < 0) {
+        BLog(BLOG_ERROR, "getsockopt(XDP_MMAP_OFFSETS) failed (%d)", errno);
+        goto fail2;
+    }
+    if (!map_ring(&o->rx, o->fd, &offs.rx, num_frames, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)) {
+        BLog(BLOG_ERROR, "mmap(RX ring) failed");
+        goto fail2;
+    }
+    if (!map_ring(&o->fill, o->fd, &offs.fr, num_frames, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING)) {
+        BLog(BLOG_ERROR, "mmap(fill ring) failed");
+        goto fail3;
+    }
+    
+    // give all frames to the kernel
+    for (int i = 0; i < num_frames; i++) {
+        fill_frame(o, (uint64_t)i * BXDPSOCKET_FRAME_SIZE);
+    }
+    
+    // bind to queue
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = o->ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+    if (bind(o->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        BLog(BLOG_ERROR, "bind(AF_XDP) to %s queue %d failed (%d)", ifname, queue_id, errno);
+        goto fail4;
+    }
+    
+    // create maps
+    if ((o->xsks_map_fd = create_map(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), queue_id + 1)) < 0) {
+        BLog(BLOG_ERROR, "failed to create XSKMAP (%d)", errno);
+        goto fail4;
+    }
+    if ((o->ports_map_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint8_t), BXDPSOCKET_MAX_PORTS)) < 0) {
+        BLog(BLOG_ERROR, "failed to create ports map (%d)", errno);
+        goto fail5;
+    }
+    
+    // point the queue to the socket
+    uint32_t xsk_key = queue_id;
+    uint32_t xsk_value = o->fd;
+    if (update_map(o->xsks_map_fd, &xsk_key, &xsk_value) < 0) {
+        BLog(BLOG_ERROR, "failed to update XSKMAP (%d)", errno);
+        goto fail6;
+    }
+    
+    // load program
+    if ((o->prog_fd = load_prog(o->ports_map_fd, o->xsks_map_fd)) < 0) {
+        BLog(BLOG_ERROR, "failed to load XDP program (%d)", errno);
+        goto fail6;
+    }
+    
+    // attach program; it is detached when the link is closed
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = o->prog_fd;
+    attr.link_create.target_ifindex = o->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    if ((o->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+        BLog(BLOG_ERROR, "failed to attach XDP program to %s (%d)", ifname, errno);
+        goto fail7;
+    }
+    
+    // init ports tree
+    BAVL_Init(&o->ports_tree, OFFSET_DIFF(BXdpSocketPort, key, ports_tree_node), (BAVL_comparator)comparator, NULL);
+    
+    // init file descriptor
+    BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail8;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    BLog(BLOG_INFO, "receiving on %s queue %d", ifname, queue_id);
+    
+    DebugCounter_Init(&o->d_ports_ctr);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail8:
+    if (close(o->link_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail7:
+    if (close(o->prog_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail6:
+    if (close(o->ports_map_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail5:
+    if (close(o->xsks_map_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail4:
+    munmap(o->fill.map, o->fill.map_size);
+fail3:
+    munmap(o->rx.map, o->rx.map_size);
+fail2:
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail1:
+    munmap(o->umem, o->umem_size);
+fail0:
+    return 0;
+}
+
+void BXdpSocket_Free (BXdpSocket *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_ports_ctr);
+    ASSERT(BAVL_IsEmpty(&o->ports_tree))
+    
+    // free file descriptor
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    
+    // detach program
+    if (close(o->link_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    // free program and maps
+    if (close(o->prog_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    if (close(o->ports_map_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    if (close(o->xsks_map_fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    // free rings and socket
+    munmap(o->fill.map, o->fill.map_size);
+    munmap(o->rx.map, o->rx.map_size);
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    // free UMEM
+    munmap(o->umem, o->umem_size);
+}
+
+int BXdpSocketPort_Init (BXdpSocketPort *o, BXdpSocket *xsk, int family, uint16_t port, int queue_len, BXdpSocketPort_handler handler, void *user)
+{
+    DebugObject_Access(&xsk->d_obj);
+    ASSERT(family == BADDR_TYPE_IPV4 || family == BADDR_TYPE_IPV6)
+    ASSERT(port != 0)
+    ASSERT(queue_len > 0)
+    ASSERT(handler)
+    
+    // init arguments
+    o->xsk = xsk;
+    o->key.family = family;
+    o->key.port = port;
+    o->queue_len = queue_len;
+    o->handler = handler;
+    o->user = user;
+    
+    // allocate queue
+    if (!(o->frames = (struct BXdpSocketPort_frame *)BAllocArray(queue_len, sizeof(o->frames[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    o->start = 0;
+    o->used = 0;
+    
+    // insert to ports tree
+    if (!BAVL_Insert(&xsk->ports_tree, &o->ports_tree_node, NULL)) {
+        BLog(BLOG_ERROR, "port %d already registered", (int)ntoh16(port));
+        goto fail1;
+    }
+    
+    // let the program steer the port
+    if (!update_port_map(xsk, port)) {
+        goto fail2;
+    }
+    
+    DebugCounter_Increment(&xsk->d_ports_ctr);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail2:
+    BAVL_Remove(&xsk->ports_tree, &o->ports_tree_node);
+fail1:
+    BFree(o->frames);
+fail0:
+    return 0;
+}
+
+void BXdpSocketPort_Free (BXdpSocketPort *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Decrement(&o->xsk->d_ports_ctr);
+    BXdpSocket *xsk = o->xsk;
+    
+    // remove from ports tree
+    BAVL_Remove(&xsk->ports_tree, &o->ports_tree_node);
+    
+    // stop steering the port, unless registered for the other family
+    update_port_map(xsk, o->key.port);
+    
+    // return queued frames
+    for (; o->used > 0; o->used--) {
+        fill_frame(xsk, o->frames[o->start].addr);
+        o->start = (o->start + 1) % o->queue_len;
+    }
+    
+    // free queue
+    BFree(o->frames);
+}
+
+int BXdpSocketPort_Peek (BXdpSocketPort *o, const uint8_t **data, int *data_len, BAddr *remote_addr, BIPAddr *local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->used == 0) {
+        return 0;
+    }
+    
+    struct BXdpSocketPort_frame *frame = &o->frames[o->start];
+    
+    if (data) {
+        *data = o->xsk->umem + frame->addr + frame->data_off;
+    }
+    if (data_len) {
+        *data_len = frame->data_len;
+    }
+    if (remote_addr) {
+        *remote_addr = frame->remote_addr;
+    }
+    if (local_addr) {
+        *local_addr = frame->local_addr;
+    }
+    
+    return 1;
+}
+
+void BXdpSocketPort_Pop (BXdpSocketPort *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->used > 0)
+    
+    // return frame to the kernel
+    fill_frame(o->xsk, o->frames[o->start].addr);
+    
+    // remove from queue
+    o->start = (o->start + 1) % o->queue_len;
+    o->used--;
+}
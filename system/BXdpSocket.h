@@ -0,0 +1,195 @@
+/**
+ * @file BXdpSocket.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Linux AF_XDP receive path for UDP sockets. An XDP program attached to a
+ * network interface steers UDP datagrams addressed to registered local ports
+ * on one receive queue into an AF_XDP socket, bypassing the kernel network
+ * stack. Received frames stay in a shared memory area (UMEM) and are queued
+ * to the port they are addressed to until the user consumes them.
+ * Datagrams arriving on other queues, and all sending, go through the normal
+ * sockets.
+ */
+
+#ifndef BADVPN_SYSTEM_BXDPSOCKET_H
+#define BADVPN_SYSTEM_BXDPSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/BAVL.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BReactor.h>
+
+#define BXDPSOCKET_FRAME_SIZE 2048
+#define BXDPSOCKET_MAX_PORTS 1024
+
+/**
+ * Handler function called when a port's queue goes from empty to non-empty.
+ * It must not free the port or the socket.
+ * 
+ * @param user as in {@link BXdpSocketPort_Init}
+ */
+typedef void (*BXdpSocketPort_handler) (void *user);
+
+struct BXdpSocket_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *descs;
+    uint32_t mask;
+    void *map;
+    size_t map_size;
+};
+
+typedef struct {
+    BReactor *reactor;
+    int ifindex;
+    int queue_id;
+    int num_frames;
+    uint8_t *umem;
+    size_t umem_size;
+    int xsks_map_fd;
+    int ports_map_fd;
+    int prog_fd;
+    int link_fd;
+    int fd;
+    struct BXdpSocket_ring rx;
+    struct BXdpSocket_ring fill;
+    BAVL ports_tree;
+    BFileDescriptor bfd;
+    DebugCounter d_ports_ctr;
+    DebugObject d_obj;
+} BXdpSocket;
+
+struct BXdpSocketPort_frame {
+    uint64_t addr;
+    int data_off;
+    int data_len;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+};
+
+struct BXdpSocketPort_key {
+    int family;
+    uint16_t port;
+};
+
+typedef struct {
+    BXdpSocket *xsk;
+    struct BXdpSocketPort_key key;
+    BXdpSocketPort_handler handler;
+    void *user;
+    BAVLNode ports_tree_node;
+    struct BXdpSocketPort_frame *frames;
+    int queue_len;
+    int start;
+    int used;
+    DebugObject d_obj;
+} BXdpSocketPort;
+
+/**
+ * Initializes the socket. Creates the UMEM with num_frames frames of
+ * BXDPSOCKET_FRAME_SIZE bytes, binds an AF_XDP socket to the given receive
+ * queue of the interface, and attaches the steering XDP program to the
+ * interface. The program is detached when the socket is freed, or when the
+ * process exits.
+ * Requires CAP_NET_ADMIN and CAP_BPF (or root). Only one XDP program can be
+ * attached to an interface, so this fails if another one is.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param ifname name of the network interface to receive on
+ * @param queue_id receive queue of the interface. Must be >=0. Datagrams
+ *                 the NIC puts on other queues are not affected.
+ * @param num_frames number of frames in the UMEM. Must be a power of two,
+ *                   >=64 and <=65536.
+ * @return 1 on success, 0 on failure
+ */
+int BXdpSocket_Init (BXdpSocket *o, BReactor *reactor, const char *ifname, int queue_id, int num_frames) WARN_UNUSED;
+
+/**
+ * Frees the socket, detaching the XDP program.
+ * There must be no ports.
+ * 
+ * @param o the object
+ */
+void BXdpSocket_Free (BXdpSocket *o);
+
+/**
+ * Registers a local UDP port. From now on, datagrams on the socket's queue
+ * which are addressed to this port (at any local address) and are of the
+ * given family are queued to the port instead of being delivered to the
+ * kernel socket bound to it.
+ * Datagrams arriving while the queue is full are dropped.
+ * A port may only be registered once for each family.
+ * 
+ * @param o the object
+ * @param xsk socket to receive from
+ * @param family BADDR_TYPE_IPV4 or BADDR_TYPE_IPV6
+ * @param port port in network byte order. Must not be 0.
+ * @param queue_len maximum number of queued datagrams. Must be >0.
+ * @param handler handler called when the queue becomes non-empty
+ * @param user argument to handler
+ * @return 1 on success, 0 on failure
+ */
+int BXdpSocketPort_Init (BXdpSocketPort *o, BXdpSocket *xsk, int family, uint16_t port, int queue_len, BXdpSocketPort_handler handler, void *user) WARN_UNUSED;
+
+/**
+ * Unregisters the port, dropping any queued datagrams.
+ * 
+ * @param o the object
+ */
+void BXdpSocketPort_Free (BXdpSocketPort *o);
+
+/**
+ * Returns the oldest queued datagram, if any.
+ * The datagram remains valid until {@link BXdpSocketPort_Pop} or
+ * {@link BXdpSocketPort_Free} is called.
+ * 
+ * @param o the object
+ * @param data if not NULL, receives a pointer to the UDP payload
+ * @param data_len if not NULL, receives the payload length
+ * @param remote_addr if not NULL, receives the sender address
+ * @param local_addr if not NULL, receives the address the datagram was sent to
+ * @return 1 if a datagram was returned, 0 if the queue is empty
+ */
+int BXdpSocketPort_Peek (BXdpSocketPort *o, const uint8_t **data, int *data_len, BAddr *remote_addr, BIPAddr *local_addr);
+
+/**
+ * Removes the oldest queued datagram, returning its frame to the kernel.
+ * The queue must not be empty.
+ * 
+ * @param o the object
+ */
+void BXdpSocketPort_Pop (BXdpSocketPort *o);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file barena_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <base/BArena.h>
+#include <structure/BObjectPool.h>
+
+struct obj {
+    int a;
+    char data[13];
+};
+
+static void test_arena (int pages)
+{
+    BArena arena;
+    BArena_Init(&arena, pages);
+    
+    ASSERT_FORCE(BArena_BytesMapped(&arena) == 0)
+    
+    static const size_t sizes[] = {1, 64, 65, 1500, 4096, 65536, 1000000, 3000000};
+    int num = sizeof(sizes) / sizeof(sizes[0]);
+    uint8_t *blocks[sizeof(sizes) / sizeof(sizes[0])];
+    
+    // allocate blocks of various sizes, including one larger than a chunk
+    for (int i = 0; i < num; i++) {
+        blocks[i] = (uint8_t *)BArena_Alloc(&arena, sizes[i]);
+        ASSERT_FORCE(blocks[i])
+        ASSERT_FORCE((uintptr_t)blocks[i] % 16 == 0)
+        memset(blocks[i], i, sizes[i]);
+    }
+    
+    ASSERT_FORCE(BArena_BytesUsed(&arena) > 0)
+    ASSERT_FORCE(BArena_BytesMapped(&arena) >= BArena_BytesUsed(&arena))
+    
+    // blocks must not overlap
+    for (int i = 0; i < num; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            ASSERT_FORCE(blocks[i][j] == i)
+        }
+    }
+    
+    // a released block is reused for the same size class
+    BArena_Release(&arena, blocks[3], sizes[3]);
+    uint8_t *b = (uint8_t *)BArena_Alloc(&arena, 1400);
+    ASSERT_FORCE(b == blocks[3])
+    BArena_Release(&arena, b, 1400);
+    
+    for (int i = 0; i < num; i++) {
+        if (i != 3) {
+            BArena_Release(&arena, blocks[i], sizes[i]);
+        }
+    }
+    
+    ASSERT_FORCE(BArena_BytesUsed(&arena) == 0)
+    
+    // object pool slabs from the arena
+    BObjectPool pool;
+    BObjectPool_InitArena(&pool, sizeof(struct obj), 4, -1, &arena);
+    
+    struct obj *objs[10];
+    for (int i = 0; i < 10; i++) {
+        objs[i] = (struct obj *)BObjectPool_Alloc(&pool);
+        ASSERT_FORCE(objs[i])
+        objs[i]->a = i;
+    }
+    for (int i = 0; i < 10; i++) {
+        ASSERT_FORCE(objs[i]->a == i)
+        BObjectPool_Release(&pool, objs[i]);
+    }
+    
+    BObjectPool_Free(&pool);
+    
+    ASSERT_FORCE(BArena_BytesUsed(&arena) == 0)
+    
+    BArena_Free(&arena);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    
+    // allocating without an arena
+    void *m = BArena_Alloc(NULL, 100);
+    ASSERT_FORCE(m)
+    BArena_Release(NULL, m, 100);
+    
+    test_arena(BARENA_PAGES_NORMAL);
+    test_arena(BARENA_PAGES_THP);
+    
+    // falls back to transparent huge pages if none are reserved
+    test_arena(BARENA_PAGES_HUGETLB);
+    
+    BLog_Free();
+    
+    return 0;
+}
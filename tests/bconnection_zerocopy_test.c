@@ -0,0 +1,190 @@
+/**
+ * @file bconnection_zerocopy_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BConnection.h>
+
+#define TOTAL_BYTES (16 * 1024 * 1024)
+#define SEND_SIZE 65536
+#define SMALL_SIZE 100
+#define ZEROCOPY_THRESHOLD 4096
+
+static BReactor reactor;
+static BConnection con;
+static StreamPassInterface *send_if;
+static uint8_t send_buf[SEND_SIZE];
+static int sent;
+static int cur_len;
+static int num_sends;
+static int reader_fd;
+
+static uint8_t pattern (int i)
+{
+    return (uint8_t)(i * 7 + i / 251);
+}
+
+static void * reader_thread (void *arg)
+{
+    uint8_t buf[16384];
+    
+    int pos = 0;
+    while (1) {
+        ssize_t res = read(reader_fd, buf, sizeof(buf));
+        ASSERT_FORCE(res >= 0)
+        if (res == 0) {
+            break;
+        }
+        for (int i = 0; i < res; i++) {
+            ASSERT_FORCE(buf[i] == pattern(pos + i))
+        }
+        pos += res;
+    }
+    
+    ASSERT_FORCE(pos == TOTAL_BYTES)
+    return NULL;
+}
+
+static void start_send (void)
+{
+    // alternate large sends, small sends below the threshold, and vectored sends
+    cur_len = (num_sends % 3 == 1 ? SMALL_SIZE : SEND_SIZE);
+    if (cur_len > TOTAL_BYTES - sent) {
+        cur_len = TOTAL_BYTES - sent;
+    }
+    
+    for (int i = 0; i < cur_len; i++) {
+        send_buf[i] = pattern(sent + i);
+    }
+    
+    if (num_sends % 3 == 2 && cur_len > 1) {
+        struct StreamPassInterface_vec vec[2];
+        vec[0].data = send_buf;
+        vec[0].len = cur_len / 2;
+        vec[1].data = send_buf + cur_len / 2;
+        vec[1].len = cur_len - cur_len / 2;
+        StreamPassInterface_Sender_SendVec(send_if, vec, 2);
+    } else {
+        StreamPassInterface_Sender_Send(send_if, send_buf, cur_len);
+    }
+    
+    num_sends++;
+}
+
+static void send_handler_done (void *user, int data_len)
+{
+    ASSERT_FORCE(data_len > 0)
+    ASSERT_FORCE(data_len <= cur_len)
+    
+    // the rest of a partial send is regenerated at the new offset
+    sent += data_len;
+    
+    if (sent == TOTAL_BYTES) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    start_send();
+}
+
+static void connection_handler (void *user, int event)
+{
+    ASSERT_FORCE(0)
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    
+    // connect a loopback pair
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_FORCE(listen_fd >= 0)
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_FORCE(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_FORCE(getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == 0)
+    ASSERT_FORCE(listen(listen_fd, 1) == 0)
+    
+    reader_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_FORCE(reader_fd >= 0)
+    ASSERT_FORCE(connect(reader_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    int send_fd = accept(listen_fd, NULL, NULL);
+    ASSERT_FORCE(send_fd >= 0)
+    ASSERT_FORCE(close(listen_fd) == 0)
+    
+    ASSERT_FORCE(BConnection_Init(&con, BConnection_source_pipe(send_fd, 1), &reactor, NULL, connection_handler))
+    
+    // loopback makes the kernel copy, which turns zero-copy off after the
+    // first completion; the sends before that still go through the error queue
+    int zerocopy = BConnection_SetZeroCopy(&con, ZEROCOPY_THRESHOLD);
+    
+    BConnection_SendAsync_Init(&con);
+    send_if = BConnection_SendAsync_GetIf(&con);
+    StreamPassInterface_Sender_Init(send_if, send_handler_done, NULL);
+    
+    pthread_t thread;
+    ASSERT_FORCE(pthread_create(&thread, NULL, reader_thread, NULL) == 0)
+    
+    sent = 0;
+    num_sends = 0;
+    start_send();
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    BConnection_SendAsync_Free(&con);
+    BConnection_Free(&con);
+    
+    ASSERT_FORCE(pthread_join(thread, NULL) == 0)
+    ASSERT_FORCE(close(reader_fd) == 0)
+    
+    BReactor_Free(&reactor);
+    BLog_Free();
+    
+    printf("sent %d bytes in %d sends, zero-copy %s\n", TOTAL_BYTES, num_sends, (zerocopy ? "enabled" : "unavailable"));
+    
+    return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file bconnectionpipe_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BConnectionPipe.h>
+
+#define RELAY_BYTES (8 * 1024 * 1024)
+#define ECHO_BYTES (4 * 1024 * 1024)
+#define CHUNK 16384
+
+struct stream {
+    int fd;
+    int seed;
+    int len;
+};
+
+static BReactor reactor;
+static BConnectionPipe relay;
+static BConnectionPipe echo;
+static int num_finished;
+
+static uint8_t pattern (int seed, int i)
+{
+    return (uint8_t)(i * 7 + i / 251 + seed);
+}
+
+static void * writer_thread (void *arg)
+{
+    struct stream *s = arg;
+    uint8_t buf[CHUNK];
+    
+    int pos = 0;
+    while (pos < s->len) {
+        int n = (s->len - pos < CHUNK ? s->len - pos : CHUNK);
+        for (int i = 0; i < n; i++) {
+            buf[i] = pattern(s->seed, pos + i);
+        }
+        int done = 0;
+        while (done < n) {
+            ssize_t res = write(s->fd, buf + done, n - done);
+            ASSERT_FORCE(res > 0)
+            done += res;
+        }
+        pos += n;
+    }
+    
+    ASSERT_FORCE(shutdown(s->fd, SHUT_WR) == 0)
+    return NULL;
+}
+
+static void * reader_thread (void *arg)
+{
+    struct stream *s = arg;
+    uint8_t buf[CHUNK];
+    
+    int pos = 0;
+    while (1) {
+        ssize_t res = read(s->fd, buf, sizeof(buf));
+        ASSERT_FORCE(res >= 0)
+        if (res == 0) {
+            break;
+        }
+        for (int i = 0; i < res; i++) {
+            ASSERT_FORCE(buf[i] == pattern(s->seed, pos + i))
+        }
+        pos += res;
+    }
+    
+    ASSERT_FORCE(pos == s->len)
+    return NULL;
+}
+
+static void connect_pair (int listen_fd, struct sockaddr_in *addr, int *out_client, int *out_server)
+{
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_FORCE(client >= 0)
+    ASSERT_FORCE(connect(client, (struct sockaddr *)addr, sizeof(*addr)) == 0)
+    
+    int server = accept(listen_fd, NULL, NULL);
+    ASSERT_FORCE(server >= 0)
+    ASSERT_FORCE(badvpn_set_nonblocking(server))
+    
+    *out_client = client;
+    *out_server = server;
+}
+
+static void pipe_handler (BConnectionPipe *p, int event)
+{
+    ASSERT_FORCE(event == BCONNECTIONPIPE_EVENT_FINISHED)
+    
+    if (p == &relay) {
+        ASSERT_FORCE(BConnectionPipe_GetBytes(p, 0) == RELAY_BYTES)
+        ASSERT_FORCE(BConnectionPipe_GetBytes(p, 1) == RELAY_BYTES / 2)
+    } else {
+        ASSERT_FORCE(BConnectionPipe_GetBytes(p, 0) == ECHO_BYTES)
+    }
+    
+    BConnectionPipe_Free(p);
+    
+    if (++num_finished == 2) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    
+    // listen on a loopback port
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_FORCE(listen_fd >= 0)
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_FORCE(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_FORCE(getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == 0)
+    ASSERT_FORCE(listen(listen_fd, 4) == 0)
+    
+    // c1 <-> r1 <=relay=> r2 <-> c2, and c3 <-> r3 echoed
+    int c1, r1, c2, r2, c3, r3;
+    connect_pair(listen_fd, &addr, &c1, &r1);
+    connect_pair(listen_fd, &addr, &c2, &r2);
+    connect_pair(listen_fd, &addr, &c3, &r3);
+    ASSERT_FORCE(close(listen_fd) == 0)
+    
+    // a pipe is not a socket, so it must be refused
+    int pipefds[2];
+    ASSERT_FORCE(pipe(pipefds) == 0)
+    ASSERT_FORCE(!BConnectionPipe_Init(&relay, &reactor, pipefds[0], r1, (BConnectionPipe_handler)pipe_handler, &relay))
+    ASSERT_FORCE(close(pipefds[0]) == 0)
+    ASSERT_FORCE(close(pipefds[1]) == 0)
+    
+    ASSERT_FORCE(BConnectionPipe_Init(&relay, &reactor, r1, r2, (BConnectionPipe_handler)pipe_handler, &relay))
+    ASSERT_FORCE(BConnectionPipe_Init(&echo, &reactor, r3, r3, (BConnectionPipe_handler)pipe_handler, &echo))
+    num_finished = 0;
+    
+    struct stream streams[] = {
+        {c1, 1, RELAY_BYTES}, // written to c1
+        {c2, 1, RELAY_BYTES}, // read from c2
+        {c2, 2, RELAY_BYTES / 2}, // written to c2
+        {c1, 2, RELAY_BYTES / 2}, // read from c1
+        {c3, 3, ECHO_BYTES}, // written to c3
+        {c3, 3, ECHO_BYTES}, // read back from c3
+    };
+    pthread_t threads[6];
+    for (int i = 0; i < 6; i++) {
+        ASSERT_FORCE(pthread_create(&threads[i], NULL, (i % 2 == 0 ? writer_thread : reader_thread), &streams[i]) == 0)
+    }
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    for (int i = 0; i < 6; i++) {
+        ASSERT_FORCE(pthread_join(threads[i], NULL) == 0)
+    }
+    
+    ASSERT_FORCE(close(c1) == 0)
+    ASSERT_FORCE(close(c2) == 0)
+    ASSERT_FORCE(close(c3) == 0)
+    
+    BReactor_Free(&reactor);
+    BLog_Free();
+    
+    printf("relayed %d + %d bytes, echoed %d bytes\n", RELAY_BYTES, RELAY_BYTES / 2, ECHO_BYTES);
+    
+    return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file bdatagram_connect_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BDatagram.h>
+
+#define MTU 1500
+#define NUM_PACKETS 16
+
+static BReactor reactor;
+static BDatagram dgram;
+static BTimer timer;
+static PacketPassInterface *send_if;
+static PacketRecvInterface *recv_if;
+static int peer1, peer2, closed_port_fd;
+static struct sockaddr_in peer1_addr, peer2_addr, closed_addr, dgram_addr;
+static int phase;
+static int num_sent;
+static int num_to_send;
+static uint8_t send_buf[MTU];
+static uint8_t recv_buf[MTU];
+
+static int make_peer (struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_FORCE(fd >= 0)
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_FORCE(bind(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0)
+    socklen_t len = sizeof(*addr);
+    ASSERT_FORCE(getsockname(fd, (struct sockaddr *)addr, &len) == 0)
+    
+    struct timeval tv = {2, 0};
+    ASSERT_FORCE(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0)
+    
+    return fd;
+}
+
+static BAddr to_baddr (struct sockaddr_in *addr)
+{
+    BAddr baddr;
+    BAddr_InitIPv4(&baddr, addr->sin_addr.s_addr, addr->sin_port);
+    return baddr;
+}
+
+static void set_send_addr (struct sockaddr_in *addr)
+{
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&dgram, to_baddr(addr), local_addr);
+}
+
+static int connected_to (struct sockaddr_in *addr)
+{
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(BDatagram_GetFd(&dgram), (struct sockaddr *)&peer, &len) < 0) {
+        ASSERT_FORCE(errno == ENOTCONN)
+        return 0;
+    }
+    ASSERT_FORCE(addr)
+    return peer.sin_port == addr->sin_port && peer.sin_addr.s_addr == addr->sin_addr.s_addr;
+}
+
+static void expect_packets (int fd, int num, int first_seq)
+{
+    for (int i = 0; i < num; i++) {
+        uint8_t buf[MTU];
+        struct sockaddr_in from;
+        socklen_t len = sizeof(from);
+        ssize_t res = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &len);
+        ASSERT_FORCE(res == 100)
+        ASSERT_FORCE(buf[0] == (uint8_t)(first_seq + i))
+        
+        // the source port never changes, also not across disconnects
+        ASSERT_FORCE(from.sin_port == dgram_addr.sin_port)
+    }
+}
+
+static void send_next (void)
+{
+    memset(send_buf, 0, 100);
+    send_buf[0] = num_sent;
+    PacketPassInterface_Sender_Send(send_if, send_buf, 100);
+}
+
+static void send_packets (int next_phase, int num)
+{
+    phase = next_phase;
+    num_sent = 0;
+    num_to_send = num;
+    send_next();
+}
+
+static void dgram_handler (void *unused, int event)
+{
+    ASSERT_FORCE(0)
+}
+
+static void send_if_handler_done (void *unused)
+{
+    num_sent++;
+    
+    if (num_sent < num_to_send) {
+        send_next();
+        return;
+    }
+    
+    // check what arrived once the queued packets have been flushed
+    BReactor_SetTimerAfter(&reactor, &timer, 1);
+}
+
+static void recv_if_handler_done (void *unused, int data_len)
+{
+    BAddr remote;
+    BIPAddr local;
+    ASSERT_FORCE(BDatagram_GetLastReceiveAddrs(&dgram, &remote, &local))
+    
+    switch (phase) {
+        case 1: {
+            // the datagram from peer2 was dropped by the connected socket
+            ASSERT_FORCE(data_len == 1 && recv_buf[0] == 'y')
+            ASSERT_FORCE(remote.ipv4.port == peer1_addr.sin_port)
+            
+            // changing the address disconnects
+            set_send_addr(&peer2_addr);
+            ASSERT_FORCE(!connected_to(NULL))
+            send_packets(2, 1);
+        } break;
+        
+        case 5: {
+            ASSERT_FORCE(data_len == 1 && recv_buf[0] == 'z')
+            ASSERT_FORCE(remote.ipv4.port == peer2_addr.sin_port)
+            
+            BReactor_Quit(&reactor, 0);
+        } break;
+        
+        default:
+            ASSERT_FORCE(0);
+    }
+}
+
+static void timer_handler (void *unused)
+{
+    switch (phase) {
+        case 0: {
+            expect_packets(peer1, NUM_PACKETS, 0);
+            ASSERT_FORCE(connected_to(&peer1_addr))
+            
+            // only the datagram from the connected address is received
+            ASSERT_FORCE(sendto(peer2, "x", 1, 0, (struct sockaddr *)&dgram_addr, sizeof(dgram_addr)) == 1)
+            ASSERT_FORCE(sendto(peer1, "y", 1, 0, (struct sockaddr *)&dgram_addr, sizeof(dgram_addr)) == 1)
+            phase = 1;
+            PacketRecvInterface_Receiver_Recv(recv_if, recv_buf);
+        } break;
+        
+        case 2: {
+            expect_packets(peer2, 1, 0);
+            ASSERT_FORCE(connected_to(&peer2_addr))
+            
+            // sending to a closed port makes the system report errors for
+            // later sends and receives, which must not be fatal
+            set_send_addr(&closed_addr);
+            PacketRecvInterface_Receiver_Recv(recv_if, recv_buf);
+            send_packets(3, 4);
+        } break;
+        
+        case 3: {
+            set_send_addr(&peer2_addr);
+            send_packets(4, 1);
+        } break;
+        
+        case 4: {
+            expect_packets(peer2, 1, 0);
+            ASSERT_FORCE(connected_to(&peer2_addr))
+            
+            ASSERT_FORCE(sendto(peer2, "z", 1, 0, (struct sockaddr *)&dgram_addr, sizeof(dgram_addr)) == 1)
+            phase = 5;
+        } break;
+        
+        default:
+            ASSERT_FORCE(0);
+    }
+}
+
+static void run (int batch)
+{
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    BTimer_Init(&timer, 0, (BTimer_handler)timer_handler, NULL);
+    
+    peer1 = make_peer(&peer1_addr);
+    peer2 = make_peer(&peer2_addr);
+    closed_port_fd = make_peer(&closed_addr);
+    ASSERT_FORCE(close(closed_port_fd) == 0)
+    
+    ASSERT_FORCE(BDatagram_Init(&dgram, BADDR_TYPE_IPV4, &reactor, NULL, dgram_handler))
+    set_send_addr(&peer1_addr);
+    ASSERT_FORCE(BDatagram_SetAutoConnect(&dgram, 1))
+    
+    // enabling binds the socket so that its port is kept
+    BAddr local;
+    ASSERT_FORCE(BDatagram_GetLocalAddr(&dgram, &local))
+    ASSERT_FORCE(local.ipv4.port != 0)
+    memset(&dgram_addr, 0, sizeof(dgram_addr));
+    dgram_addr.sin_family = AF_INET;
+    dgram_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    dgram_addr.sin_port = local.ipv4.port;
+    
+    ASSERT_FORCE(BDatagram_SendAsync_Init2(&dgram, MTU, batch))
+    ASSERT_FORCE(BDatagram_RecvAsync_Init2(&dgram, MTU, batch))
+    send_if = BDatagram_SendAsync_GetIf(&dgram);
+    recv_if = BDatagram_RecvAsync_GetIf(&dgram);
+    PacketPassInterface_Sender_Init(send_if, (PacketPassInterface_handler_done)send_if_handler_done, NULL);
+    PacketRecvInterface_Receiver_Init(recv_if, (PacketRecvInterface_handler_done)recv_if_handler_done, NULL);
+    
+    send_packets(0, NUM_PACKETS);
+    
+    ASSERT_FORCE(BReactor_Exec(&reactor) == 0)
+    
+    BDatagram_RecvAsync_Free(&dgram);
+    BDatagram_SendAsync_Free(&dgram);
+    BDatagram_Free(&dgram);
+    ASSERT_FORCE(close(peer1) == 0)
+    ASSERT_FORCE(close(peer2) == 0)
+    BReactor_RemoveTimer(&reactor, &timer);
+    BReactor_Free(&reactor);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    
+    run(1);
+    run(8);
+    
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    return 0;
+}
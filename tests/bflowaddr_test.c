@@ -0,0 +1,117 @@
+/**
+ * @file bflowaddr_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <system/BAddr.h>
+#include <system/BFlowAddr.h>
+
+#define NUM_ADDRS 64
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng (void)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return rng_state >> 8;
+}
+
+static BAddr random_addr (void)
+{
+    // few distinct values, so that equal addresses come up often
+    uint16_t port = hton16(rng() % 3);
+    switch (rng() % 3) {
+        case 0: {
+            return BAddr_MakeNone();
+        } break;
+        case 1: {
+            return BAddr_MakeIPv4(hton32(rng() % 3), port);
+        } break;
+        default: {
+            uint8_t ip[16] = {0};
+            ip[rng() % 2 ? 0 : 15] = rng() % 3;
+            return BAddr_MakeIPv6(ip, port);
+        } break;
+    }
+}
+
+int main ()
+{
+    ASSERT_FORCE(sizeof(BFlowAddr) == 20)
+    
+    BAddr addrs[NUM_ADDRS];
+    BFlowAddr fas[NUM_ADDRS];
+    
+    for (int i = 0; i < NUM_ADDRS; i++) {
+        // garbage in the unused parts of the BAddr must not matter
+        memset(&addrs[i], rng() & 0xFF, sizeof(addrs[i]));
+        BAddr a = random_addr();
+        addrs[i].type = a.type;
+        switch (a.type) {
+            case BADDR_TYPE_IPV4: addrs[i].ipv4 = a.ipv4; break;
+            case BADDR_TYPE_IPV6: addrs[i].ipv6 = a.ipv6; break;
+        }
+        
+        fas[i] = BFlowAddr_FromBAddr(&addrs[i]);
+        
+        // round trip
+        BAddr back = BFlowAddr_ToBAddr(&fas[i]);
+        ASSERT_FORCE(back.type == addrs[i].type)
+        ASSERT_FORCE(back.type == BADDR_TYPE_NONE || BAddr_Compare(&back, &addrs[i]))
+    }
+    
+    for (int i = 0; i < NUM_ADDRS; i++) {
+        for (int j = 0; j < NUM_ADDRS; j++) {
+            BFlowAddr *f1 = &fas[i];
+            BFlowAddr *f2 = &fas[j];
+            
+            // equality agrees with BAddr
+            int eq = (addrs[i].type == BADDR_TYPE_NONE && addrs[j].type == BADDR_TYPE_NONE) || BAddr_Compare(&addrs[i], &addrs[j]);
+            ASSERT_FORCE(BFlowAddr_Equal(f1, f2) == eq)
+            ASSERT_FORCE(!eq || BFlowAddr_Hash(f1) == BFlowAddr_Hash(f2))
+            
+            // ordering is consistent with equality and antisymmetric
+            int cmp = BFlowAddr_CompareOrder(f1, f2);
+            ASSERT_FORCE(cmp >= -1 && cmp <= 1)
+            ASSERT_FORCE((cmp == 0) == eq)
+            ASSERT_FORCE(BFlowAddr_CompareOrder(f2, f1) == -cmp)
+            
+            // and transitive
+            for (int k = 0; k < NUM_ADDRS; k++) {
+                if (cmp < 0 && BFlowAddr_CompareOrder(f2, &fas[k]) < 0) {
+                    ASSERT_FORCE(BFlowAddr_CompareOrder(f1, &fas[k]) < 0)
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
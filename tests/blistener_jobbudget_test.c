@@ -0,0 +1,130 @@
+/**
+ * @file blistener_jobbudget_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <base/BPending.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BConnection.h>
+
+#define NUM_CLIENTS 8
+#define BUSY_JOBS 50
+
+static BReactor reactor;
+static BListener listener;
+static BPending busy_job;
+static char socket_path[64];
+static int clients[NUM_CLIENTS];
+static int busy_left;
+static int num_declined;
+
+static void busy_job_handler (void *unused)
+{
+    // keep the job queue from draining so that the budget runs out while the
+    // listener's default job is still pending
+    if (busy_left > 0) {
+        busy_left--;
+        BPending_Set(&busy_job);
+        return;
+    }
+    
+    if (num_declined == NUM_CLIENTS) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+static void listener_handler (void *unused)
+{
+    ASSERT_FORCE(num_declined < NUM_CLIENTS)
+    
+    // decline the connection, like udpgw does at --max-clients, leaving
+    // it to the listener's default job
+    num_declined++;
+    
+    busy_left = BUSY_JOBS;
+    BPending_Set(&busy_job);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    BReactor_SetJobBudget(&reactor, 1, 0);
+    
+    snprintf(socket_path, sizeof(socket_path), "/tmp/blistener_jobbudget_test.%d", (int)getpid());
+    unlink(socket_path);
+    ASSERT_FORCE(BListener_InitUnix(&listener, socket_path, &reactor, NULL, listener_handler))
+    
+    BPending_Init(&busy_job, BReactor_PendingGroup(&reactor), busy_job_handler, NULL);
+    
+    // queue all connections up front, so the listener fd stays readable
+    // while each declined connection waits for the default job
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        ASSERT_FORCE((clients[i] = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0)
+        ASSERT_FORCE(connect(clients[i], (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    }
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    ASSERT_FORCE(num_declined == NUM_CLIENTS)
+    ASSERT_FORCE(BReactor_JobBudgetExceededCount(&reactor) > 0)
+    
+    BPending_Free(&busy_job);
+    BListener_Free(&listener);
+    
+    // every declined connection must have been closed exactly once
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        char c;
+        ASSERT_FORCE(read(clients[i], &c, 1) == 0)
+        ASSERT_FORCE(close(clients[i]) == 0)
+    }
+    
+    printf("declined %d connections, budget exceeded %llu times\n", num_declined,
+           (unsigned long long)BReactor_JobBudgetExceededCount(&reactor));
+    
+    BReactor_Free(&reactor);
+    BLog_Free();
+    
+    return 0;
+}
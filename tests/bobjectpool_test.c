@@ -0,0 +1,93 @@
+/**
+ * @file bobjectpool_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/debug.h>
+#include <structure/BObjectPool.h>
+
+struct obj {
+    int a;
+    char data[13];
+};
+
+int main ()
+{
+    BObjectPool pool;
+    BObjectPool_Init(&pool, sizeof(struct obj), 4, 10);
+    
+    ASSERT_FORCE(BObjectPool_NumAllocated(&pool) == 0)
+    
+    struct obj *objs[10];
+    
+    // allocate up to the limit
+    for (int i = 0; i < 10; i++) {
+        objs[i] = (struct obj *)BObjectPool_Alloc(&pool);
+        ASSERT_FORCE(objs[i])
+        objs[i]->a = i;
+        memset(objs[i]->data, i, sizeof(objs[i]->data));
+    }
+    
+    ASSERT_FORCE(!BObjectPool_Alloc(&pool))
+    ASSERT_FORCE(BObjectPool_NumUsed(&pool) == 10)
+    ASSERT_FORCE(BObjectPool_MaxUsed(&pool) == 10)
+    ASSERT_FORCE(BObjectPool_NumAllocated(&pool) == 10)
+    
+    // objects must not overlap
+    for (int i = 0; i < 10; i++) {
+        ASSERT_FORCE(objs[i]->a == i)
+        for (int j = 0; j < sizeof(objs[i]->data); j++) {
+            ASSERT_FORCE(objs[i]->data[j] == i)
+        }
+    }
+    
+    // released objects are reused without allocating
+    BObjectPool_Release(&pool, objs[3]);
+    BObjectPool_Release(&pool, objs[7]);
+    ASSERT_FORCE(BObjectPool_NumUsed(&pool) == 8)
+    
+    struct obj *o1 = (struct obj *)BObjectPool_Alloc(&pool);
+    struct obj *o2 = (struct obj *)BObjectPool_Alloc(&pool);
+    ASSERT_FORCE((o1 == objs[3] && o2 == objs[7]) || (o1 == objs[7] && o2 == objs[3]))
+    ASSERT_FORCE(BObjectPool_NumAllocated(&pool) == 10)
+    ASSERT_FORCE(BObjectPool_MaxUsed(&pool) == 10)
+    objs[3] = o1;
+    objs[7] = o2;
+    
+    for (int i = 0; i < 10; i++) {
+        BObjectPool_Release(&pool, objs[i]);
+    }
+    
+    ASSERT_FORCE(BObjectPool_NumUsed(&pool) == 0)
+    ASSERT_FORCE(BObjectPool_MaxUsed(&pool) == 10)
+    
+    BObjectPool_Free(&pool);
+    
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file bpredicate_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <predicate/BPredicate.h>
+
+static int num_calls;
+static char *strings_seen[2];
+
+static int name_cb (void *user, void **args)
+{
+    if (num_calls < 2) {
+        strings_seen[num_calls] = (char *)args[0];
+    }
+    num_calls++;
+    
+    return !strcmp((char *)args[0], (char *)user);
+}
+
+static int either_cb (void *user, void **args)
+{
+    num_calls++;
+    
+    return (*(int *)args[0] || *(int *)args[1]);
+}
+
+static int bad_cb (void *user, void **args)
+{
+    num_calls++;
+    
+    return 5;
+}
+
+static int eval (const char *str, int expected_res, int expected_calls, char *name)
+{
+    BPredicate p;
+    ASSERT_FORCE(BPredicate_Init(&p, (char *)str))
+    
+    int string_args[] = {PREDICATE_TYPE_STRING};
+    int bool_args[] = {PREDICATE_TYPE_BOOL, PREDICATE_TYPE_BOOL};
+    BPredicateFunction f_name;
+    BPredicateFunction f_either;
+    BPredicateFunction f_bad;
+    BPredicateFunction_Init(&f_name, &p, "name", string_args, 1, name_cb, name);
+    BPredicateFunction_Init(&f_either, &p, "either", bool_args, 2, either_cb, NULL);
+    BPredicateFunction_Init(&f_bad, &p, "bad", NULL, 0, bad_cb, NULL);
+    
+    // evaluate twice, the program is built once
+    for (int i = 0; i < 2; i++) {
+        num_calls = 0;
+        int res = BPredicate_Eval(&p);
+        if (res != expected_res || num_calls != expected_calls) {
+            printf("%s: got %d with %d calls, expected %d with %d calls\n", str, res, num_calls, expected_res, expected_calls);
+            ASSERT_FORCE(0)
+        }
+    }
+    
+    // functions going away are noticed
+    BPredicateFunction_Free(&f_bad);
+    BPredicateFunction_Free(&f_either);
+    BPredicateFunction_Free(&f_name);
+    ASSERT_FORCE(BPredicate_Eval(&p) == (expected_calls > 0 ? -1 : expected_res))
+    
+    BPredicate_Free(&p);
+    
+    return 1;
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    
+    // constants and folding
+    eval("true", 1, 0, "a");
+    eval("NOT true", 0, 0, "a");
+    eval("false OR NOT false", 1, 0, "a");
+    eval("false AND name(\"a\")", 0, 0, "a");
+    eval("true OR name(\"a\")", 1, 0, "a");
+    eval("true AND name(\"a\")", 1, 1, "a");
+    
+    // short-circuit after calls
+    eval("name(\"a\") OR name(\"b\")", 1, 1, "a");
+    eval("name(\"b\") OR name(\"a\")", 1, 2, "a");
+    eval("name(\"b\") AND name(\"a\")", 0, 1, "a");
+    eval("NOT (name(\"b\") OR name(\"c\"))", 1, 2, "a");
+    
+    // boolean arguments
+    eval("either(name(\"b\"), name(\"a\"))", 1, 3, "a");
+    eval("either(false, NOT name(\"a\"))", 0, 2, "a");
+    eval("either(name(\"a\"), either(false, true)) AND name(\"a\")", 1, 4, "a");
+    
+    // errors
+    eval("unknown()", -1, 0, "a");
+    eval("name(\"b\") AND unknown()", 0, 1, "a");
+    eval("name(\"a\") AND unknown()", -1, 1, "a");
+    eval("name(true)", -1, 0, "a");
+    eval("name(\"a\", \"b\")", -1, 0, "a");
+    eval("either(true)", -1, 0, "a");
+    eval("either(name(\"a\"), unknown())", -1, 0, "a");
+    eval("bad() OR true", -1, 1, "a");
+    eval("false OR bad()", -1, 1, "a");
+    
+    // equal strings are merged
+    BPredicate p;
+    ASSERT_FORCE(BPredicate_Init(&p, "name(\"x\") OR name(\"x\")"))
+    int string_args[] = {PREDICATE_TYPE_STRING};
+    BPredicateFunction f_name;
+    BPredicateFunction_Init(&f_name, &p, "name", string_args, 1, name_cb, "y");
+    num_calls = 0;
+    ASSERT_FORCE(BPredicate_Eval(&p) == 0)
+    ASSERT_FORCE(num_calls == 2)
+    ASSERT_FORCE(strings_seen[0] == strings_seen[1])
+    BPredicateFunction_Free(&f_name);
+    BPredicate_Free(&p);
+    
+    printf("ok\n");
+    
+    BLog_Free();
+    
+    return 0;
+}
@@ -70,6 +70,17 @@ int main ()
     
     ASSERT(msg1Parser_GotEverything(&parser))
     
+    // single fields are returned once until reset, absent ones never
+    
+    uint32_t p_b;
+    ASSERT_EXECUTE(!msg1Parser_Getb(&parser, &p_b))
+    ASSERT_EXECUTE(!msg1Parser_Geta(&parser, &p_a))
+    ASSERT_EXECUTE(!msg1Parser_Getf(&parser, &p_f, &p_f_len))
+    msg1Parser_Resetf(&parser);
+    ASSERT_EXECUTE(msg1Parser_Getf(&parser, &p_f, &p_f_len))
+    ASSERT(p_f_len == strlen(f) && !memcmp(p_f, f, p_f_len))
+    ASSERT(msg1Parser_GotEverything(&parser))
+    
     BFree(msg);
     
     return 0;
@@ -0,0 +1,140 @@
+/**
+ * @file breactor_busypoll_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+
+#define TIMER_AFTER 5
+#define NUM_ROUNDS 20
+
+static BReactor reactor;
+static BTimer timer;
+static BFileDescriptor bfd;
+static int pipefds[2];
+static int rounds;
+
+static void timer_handler (void *unused)
+{
+    // the pipe becomes readable while the reactor is not waiting, so the
+    // next wait finds it when spinning
+    ASSERT_FORCE(write(pipefds[1], "x", 1) == 1)
+}
+
+static void fd_handler (void *unused, int events)
+{
+    ASSERT_FORCE(events & BREACTOR_READ)
+    
+    char c;
+    ASSERT_FORCE(read(pipefds[0], &c, 1) == 1)
+    
+    if (++rounds == NUM_ROUNDS) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    // the wait for this spins in vain, as nothing happens until the timer
+    BReactor_SetTimer(&reactor, &timer);
+}
+
+static void run (int spin_us, int kernel_us)
+{
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    BReactor_SetBusyPoll(&reactor, spin_us, kernel_us);
+    
+    ASSERT_FORCE(pipe(pipefds) == 0)
+    ASSERT_FORCE(badvpn_set_nonblocking(pipefds[0]))
+    
+    BFileDescriptor_Init(&bfd, pipefds[0], fd_handler, NULL);
+    ASSERT_FORCE(BReactor_AddFileDescriptor(&reactor, &bfd))
+    BReactor_SetFileDescriptorEvents(&reactor, &bfd, BREACTOR_READ);
+    
+    BTimer_Init(&timer, TIMER_AFTER, timer_handler, NULL);
+    BReactor_SetTimer(&reactor, &timer);
+    
+    rounds = 0;
+    
+    btime_t start = btime_gettime();
+    int ret = BReactor_Exec(&reactor);
+    btime_t elapsed = btime_gettime() - start;
+    ASSERT_FORCE(ret == 0)
+    ASSERT_FORCE(rounds == NUM_ROUNDS)
+    
+    uint64_t spins;
+    uint64_t hits;
+    BReactor_BusyPollCounts(&reactor, &spins, &hits);
+    
+    printf("spin %d us: %llu spins, %llu found events, %lld ms\n", spin_us,
+           (unsigned long long)spins, (unsigned long long)hits, (long long)elapsed);
+    
+    if (spin_us > 0) {
+        ASSERT_FORCE(hits > 0)
+        ASSERT_FORCE(hits < spins)
+    } else {
+        ASSERT_FORCE(spins == 0)
+    }
+    
+    // spinning must not hold up timers
+    ASSERT_FORCE(elapsed < 2 * NUM_ROUNDS * TIMER_AFTER)
+    
+    BReactor_RemoveFileDescriptor(&reactor, &bfd);
+    ASSERT_FORCE(close(pipefds[0]) == 0)
+    ASSERT_FORCE(close(pipefds[1]) == 0)
+    BReactor_Free(&reactor);
+}
+
+int main ()
+{
+#ifndef BADVPN_USE_EPOLL
+    // busy polling is only implemented for epoll, other backends just warn
+    printf("not using epoll, skipping\n");
+    return 0;
+#endif
+    
+    BLog_InitStdout();
+    BTime_Init();
+    
+    run(0, 0);
+    run(1000, 0);
+    
+    // longer than the timer interval, so spins end at the timer
+    run(50000, 0);
+    
+    // kernel busy polling may not be supported, which only gives a warning
+    run(1000, 50);
+    
+    BLog_Free();
+    
+    return 0;
+}
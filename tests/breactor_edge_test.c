@@ -0,0 +1,184 @@
+/**
+ * @file breactor_edge_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BConnection.h>
+
+#define ECHO_BYTES (8 * 1024 * 1024)
+#define CHUNK 16384
+#define RECV_SIZE 1000
+
+static BReactor reactor;
+static BConnection con;
+static int fds[2];
+static uint8_t buf[RECV_SIZE];
+static int buf_len;
+static int buf_sent;
+static int echoed;
+
+static uint8_t pattern (int i)
+{
+    return (uint8_t)(i * 7 + i / 251);
+}
+
+static void * writer_thread (void *arg)
+{
+    uint8_t wbuf[CHUNK];
+    
+    int pos = 0;
+    while (pos < ECHO_BYTES) {
+        int n = (ECHO_BYTES - pos < CHUNK ? ECHO_BYTES - pos : CHUNK);
+        for (int i = 0; i < n; i++) {
+            wbuf[i] = pattern(pos + i);
+        }
+        int done = 0;
+        while (done < n) {
+            ssize_t res = write(fds[0], wbuf + done, n - done);
+            ASSERT_FORCE(res > 0)
+            done += res;
+        }
+        pos += n;
+    }
+    
+    ASSERT_FORCE(shutdown(fds[0], SHUT_WR) == 0)
+    return NULL;
+}
+
+static void * reader_thread (void *arg)
+{
+    uint8_t rbuf[CHUNK];
+    
+    int pos = 0;
+    while (1) {
+        ssize_t res = read(fds[0], rbuf, sizeof(rbuf));
+        ASSERT_FORCE(res >= 0)
+        if (res == 0) {
+            break;
+        }
+        for (int i = 0; i < res; i++) {
+            ASSERT_FORCE(rbuf[i] == pattern(pos + i))
+        }
+        pos += res;
+    }
+    
+    ASSERT_FORCE(pos == ECHO_BYTES)
+    return NULL;
+}
+
+static void connection_handler (void *user, int event)
+{
+    ASSERT_FORCE(event == BCONNECTION_EVENT_RECVCLOSED)
+    ASSERT_FORCE(echoed == ECHO_BYTES)
+    
+    BConnection_RecvAsync_Free(&con);
+    BConnection_SendAsync_Free(&con);
+    BConnection_Free(&con);
+    
+    // let the reader see the end of the echo
+    ASSERT_FORCE(shutdown(fds[1], SHUT_WR) == 0)
+    
+    BReactor_Quit(&reactor, 0);
+}
+
+static void recv_handler_done (void *user, int data_len)
+{
+    // send back what was received
+    buf_len = data_len;
+    buf_sent = 0;
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&con), buf, buf_len);
+}
+
+static void send_handler_done (void *user, int data_len)
+{
+    buf_sent += data_len;
+    echoed += data_len;
+    
+    if (buf_sent < buf_len) {
+        StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&con), buf + buf_sent, buf_len - buf_sent);
+        return;
+    }
+    
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&con), buf, sizeof(buf));
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    BReactor_SetEdgeTriggered(&reactor, 1);
+    
+    // small buffers, so that the echo keeps running into EAGAIN both ways
+    ASSERT_FORCE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+    int sndbuf = 4096;
+    ASSERT_FORCE(setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0)
+    ASSERT_FORCE(badvpn_set_nonblocking(fds[1]))
+    
+    ASSERT_FORCE(BConnection_Init(&con, BConnection_source_pipe(fds[1], 0), &reactor, NULL, connection_handler))
+    BConnection_SendAsync_Init(&con);
+    BConnection_RecvAsync_Init(&con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&con), send_handler_done, NULL);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&con), recv_handler_done, NULL);
+    echoed = 0;
+    
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&con), buf, sizeof(buf));
+    
+    pthread_t threads[2];
+    ASSERT_FORCE(pthread_create(&threads[0], NULL, writer_thread, NULL) == 0)
+    ASSERT_FORCE(pthread_create(&threads[1], NULL, reader_thread, NULL) == 0)
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    for (int i = 0; i < 2; i++) {
+        ASSERT_FORCE(pthread_join(threads[i], NULL) == 0)
+    }
+    
+    ASSERT_FORCE(close(fds[0]) == 0)
+    ASSERT_FORCE(close(fds[1]) == 0)
+    
+    BReactor_Free(&reactor);
+    BLog_Free();
+    
+    printf("echoed %d bytes edge-triggered\n", echoed);
+    
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file breactor_jobbudget_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+#include <base/BPending.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+
+#define TIMER_AFTER 20
+
+static BReactor reactor;
+static BPending busy_job;
+static BTimer timer;
+static BFileDescriptor bfd;
+static int pipefds[2];
+static uint64_t num_jobs;
+static int timer_fired;
+static int fd_fired;
+
+static void check_done (void)
+{
+    if (timer_fired && fd_fired) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+static void busy_job_handler (void *unused)
+{
+    // a job which never lets the job queue drain
+    num_jobs++;
+    BPending_Set(&busy_job);
+}
+
+static void timer_handler (void *unused)
+{
+    ASSERT_FORCE(!timer_fired)
+    timer_fired = 1;
+    check_done();
+}
+
+static void fd_handler (void *unused, int events)
+{
+    ASSERT_FORCE(!fd_fired)
+    ASSERT_FORCE(events & BREACTOR_READ)
+    
+    char c;
+    ASSERT_FORCE(read(pipefds[0], &c, 1) == 1)
+    BReactor_SetFileDescriptorEvents(&reactor, &bfd, 0);
+    
+    fd_fired = 1;
+    check_done();
+}
+
+static void run (int max_jobs, int max_us)
+{
+    ASSERT_FORCE(BReactor_Init(&reactor))
+    BReactor_SetJobBudget(&reactor, max_jobs, max_us);
+    
+    ASSERT_FORCE(pipe(pipefds) == 0)
+    ASSERT_FORCE(badvpn_set_nonblocking(pipefds[0]))
+    ASSERT_FORCE(write(pipefds[1], "x", 1) == 1)
+    
+    BFileDescriptor_Init(&bfd, pipefds[0], fd_handler, NULL);
+    ASSERT_FORCE(BReactor_AddFileDescriptor(&reactor, &bfd))
+    BReactor_SetFileDescriptorEvents(&reactor, &bfd, BREACTOR_READ);
+    
+    BTimer_Init(&timer, TIMER_AFTER, timer_handler, NULL);
+    BReactor_SetTimer(&reactor, &timer);
+    
+    BPending_Init(&busy_job, BReactor_PendingGroup(&reactor), busy_job_handler, NULL);
+    BPending_Set(&busy_job);
+    
+    num_jobs = 0;
+    timer_fired = 0;
+    fd_fired = 0;
+    
+    // without a budget this would never return, as the busy job would starve
+    // the timer and the file descriptor
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    ASSERT_FORCE(timer_fired)
+    ASSERT_FORCE(fd_fired)
+    ASSERT_FORCE(BReactor_JobBudgetExceededCount(&reactor) > 0)
+    
+    printf("budget %d jobs %d us: %llu jobs, budget exceeded %llu times\n", max_jobs, max_us,
+           (unsigned long long)num_jobs, (unsigned long long)BReactor_JobBudgetExceededCount(&reactor));
+    
+    BPending_Free(&busy_job);
+    BReactor_RemoveFileDescriptor(&reactor, &bfd);
+    ASSERT_FORCE(close(pipefds[0]) == 0)
+    ASSERT_FORCE(close(pipefds[1]) == 0)
+    BReactor_Free(&reactor);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    run(100, 0);
+    run(0, 500);
+    run(1, 0);
+    
+    BLog_Free();
+    
+    return 0;
+}
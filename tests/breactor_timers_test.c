@@ -0,0 +1,152 @@
+/**
+ * @file breactor_timers_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+
+#define NUM_TIMERS 2000
+#define NUM_FAR_TIMERS 100
+#define NUM_ROUNDS 2
+#define MAX_DELAY 1000
+#define MAX_LATENESS 100
+
+struct test_timer {
+    BTimer timer;
+    btime_t expected;
+    int rounds;
+};
+
+static BReactor reactor;
+static struct test_timer timers[NUM_TIMERS];
+static BTimer far_timers[NUM_FAR_TIMERS];
+static int num_done;
+static btime_t max_lateness;
+
+static void start_timer (struct test_timer *t)
+{
+    btime_t delay = random() % MAX_DELAY;
+    t->expected = btime_gettime() + delay;
+    BReactor_SetTimerAbsolute(&reactor, &t->timer, t->expected);
+}
+
+static void far_timer_handler (void *unused)
+{
+    ASSERT_FORCE(0)
+}
+
+static void timer_handler (void *user)
+{
+    struct test_timer *t = user;
+    ASSERT_FORCE(!BTimer_IsRunning(&t->timer))
+    
+    // must not expire early
+    btime_t now = btime_gettime();
+    ASSERT_FORCE(now >= t->expected)
+    
+    // the reactor's cached time is sampled after the wait, so it has also
+    // reached the expiry time but cannot be ahead of the clock
+    btime_t cached = BReactor_GetTime(&reactor);
+    ASSERT_FORCE(cached >= t->expected)
+    ASSERT_FORCE(cached <= now)
+    
+    if (now - t->expected > max_lateness) {
+        max_lateness = now - t->expected;
+    }
+    
+    // move some other running timer, or stop it and start it again
+    struct test_timer *other = &timers[random() % NUM_TIMERS];
+    if (other != t && BTimer_IsRunning(&other->timer)) {
+        if (random() % 2) {
+            start_timer(other);
+        } else {
+            BReactor_RemoveTimer(&reactor, &other->timer);
+            ASSERT_FORCE(!BTimer_IsRunning(&other->timer))
+            start_timer(other);
+        }
+    }
+    
+    if (++t->rounds < NUM_ROUNDS) {
+        start_timer(t);
+        return;
+    }
+    
+    if (++num_done == NUM_TIMERS) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    srandom(1);
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    // timers which never expire during the test
+    for (int i = 0; i < NUM_FAR_TIMERS; i++) {
+        BTimer_Init(&far_timers[i], 0, far_timer_handler, NULL);
+        BReactor_SetTimerAfter(&reactor, &far_timers[i], ((btime_t)1 << 30) + i * 1000000);
+    }
+    
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        BTimer_Init(&timers[i].timer, 0, timer_handler, &timers[i]);
+        timers[i].rounds = 0;
+        start_timer(&timers[i]);
+    }
+    
+    num_done = 0;
+    max_lateness = 0;
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    printf("max lateness %d ms\n", (int)max_lateness);
+    ASSERT_FORCE(max_lateness <= MAX_LATENESS)
+    
+    for (int i = 0; i < NUM_FAR_TIMERS; i++) {
+        ASSERT_FORCE(BTimer_IsRunning(&far_timers[i]))
+        BReactor_RemoveTimer(&reactor, &far_timers[i]);
+    }
+    
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    return 0;
+}
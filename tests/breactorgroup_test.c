@@ -0,0 +1,223 @@
+/**
+ * @file breactorgroup_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BNetwork.h>
+#include <system/BReactorGroup.h>
+#include <system/BConnection.h>
+
+#define NUM_REACTORS 4
+#define NUM_MESSAGES 20000
+
+struct test_msg {
+    BReactorGroupMessage msg;
+    int from;
+    int to;
+    int seq;
+};
+
+struct member_state {
+    BReactorGroupMessage start_msg;
+    BReactorGroupMessage done_msg;
+    struct test_msg msgs[NUM_REACTORS][NUM_MESSAGES];
+    int next_seq[NUM_REACTORS];
+    int num_received;
+};
+
+struct handoff {
+    BReactorGroupMessage msg;
+    int fd;
+    BConnection con;
+    uint8_t buf[16];
+    int received;
+};
+
+static BReactor reactor;
+static BReactorGroup group;
+static struct member_state states[NUM_REACTORS];
+static struct handoff handoff;
+static int num_done;
+
+static void done_msg_handler (BReactorGroupMessage *msg)
+{
+    ASSERT_FORCE(BReactorGroupMember_Index(BReactorGroup_GetMember(&group, 0)) == 0)
+    
+    if (++num_done == NUM_REACTORS + 1) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+static void test_msg_handler (BReactorGroupMessage *msg)
+{
+    struct test_msg *m = UPPER_OBJECT(msg, struct test_msg, msg);
+    struct member_state *st = &states[m->to];
+    
+    // messages from one sender arrive in order
+    ASSERT_FORCE(m->seq == st->next_seq[m->from])
+    st->next_seq[m->from]++;
+    
+    if (++st->num_received == NUM_REACTORS * NUM_MESSAGES) {
+        BReactorGroupMember_Post(BReactorGroup_GetMember(&group, 0), &st->done_msg, done_msg_handler);
+    }
+}
+
+static void start_msg_handler (BReactorGroupMessage *msg)
+{
+    struct member_state *st = UPPER_OBJECT(msg, struct member_state, start_msg);
+    int from = st - states;
+    
+    // post messages to all members, including ourselves
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        for (int to = 0; to < NUM_REACTORS; to++) {
+            struct test_msg *m = &states[to].msgs[from][i];
+            m->from = from;
+            m->to = to;
+            m->seq = i;
+            BReactorGroupMember_Post(BReactorGroup_GetMember(&group, to), &m->msg, test_msg_handler);
+        }
+    }
+}
+
+static void handoff_connection_handler (void *user, int event)
+{
+    ASSERT_FORCE(0)
+}
+
+static void handoff_recv_handler (void *user, int data_len)
+{
+    handoff.received += data_len;
+    
+    if (handoff.received < 5) {
+        StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&handoff.con), handoff.buf + handoff.received, sizeof(handoff.buf) - handoff.received);
+        return;
+    }
+    
+    ASSERT_FORCE(handoff.received == 5)
+    ASSERT_FORCE(!memcmp(handoff.buf, "hello", 5))
+    
+    BConnection_RecvAsync_Free(&handoff.con);
+    BConnection_Free(&handoff.con);
+    
+    BReactorGroupMember_Post(BReactorGroup_GetMember(&group, 0), &handoff.msg, done_msg_handler);
+}
+
+static void handoff_msg_handler (BReactorGroupMessage *msg)
+{
+    // we are the last member now; take over the connection
+    BReactor *r = BReactorGroupMember_Reactor(BReactorGroup_GetMember(&group, NUM_REACTORS - 1));
+    
+    ASSERT_FORCE(BConnection_Init(&handoff.con, BConnection_source_pipe(handoff.fd, 1), r, NULL, handoff_connection_handler))
+    BConnection_RecvAsync_Init(&handoff.con);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&handoff.con), handoff_recv_handler, NULL);
+    
+    handoff.received = 0;
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&handoff.con), handoff.buf, sizeof(handoff.buf));
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    // all member threads on CPU 0, which every machine has
+    BThreadPlacement placement;
+    BThreadPlacement_Init(&placement);
+    ASSERT_FORCE(BThreadPlacement_ParseCpus(&placement, "0"))
+    ASSERT_FORCE(!BThreadPlacement_ParseCpus(&placement, "3-1"))
+    ASSERT_FORCE(!BThreadPlacement_ParseSched(&placement, "fifo:0"))
+    ASSERT_FORCE(BThreadPlacement_IsSet(&placement))
+    
+    if (!BReactorGroup_Init(&group, &reactor, NUM_REACTORS, &placement, BARENA_PAGES_THP)) {
+        DEBUG("BReactorGroup_Init failed");
+        return 1;
+    }
+    
+    ASSERT_FORCE(BReactorGroup_NumMembers(&group) == NUM_REACTORS)
+    
+    // hash and round-robin assignment
+    for (int i = 0; i < 2 * NUM_REACTORS; i++) {
+        ASSERT_FORCE(BReactorGroupMember_Index(BReactorGroup_AssignNext(&group)) == i % NUM_REACTORS)
+        ASSERT_FORCE(BReactorGroup_AssignHash(&group, 1000 + i) == BReactorGroup_AssignHash(&group, 1000 + i))
+    }
+    
+    num_done = 0;
+    
+    // start message storms
+    for (int i = 0; i < NUM_REACTORS; i++) {
+        states[i].num_received = 0;
+        for (int j = 0; j < NUM_REACTORS; j++) {
+            states[i].next_seq[j] = 0;
+        }
+    }
+    for (int i = 0; i < NUM_REACTORS; i++) {
+        BReactorGroupMember_Post(BReactorGroup_GetMember(&group, i), &states[i].start_msg, start_msg_handler);
+    }
+    
+    // move a connection from our reactor to the last member
+    int fds[2];
+    ASSERT_FORCE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+    BConnection con;
+    ASSERT_FORCE(BConnection_Init(&con, BConnection_source_pipe(fds[0], 1), &reactor, NULL, handoff_connection_handler))
+    handoff.fd = BConnection_ReleaseFd(&con);
+    ASSERT_FORCE(handoff.fd == fds[0])
+    BReactorGroupMember_Post(BReactorGroup_GetMember(&group, NUM_REACTORS - 1), &handoff.msg, handoff_msg_handler);
+    ASSERT_FORCE(write(fds[1], "hello", 5) == 5)
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    for (int i = 0; i < NUM_REACTORS; i++) {
+        ASSERT_FORCE(states[i].num_received == NUM_REACTORS * NUM_MESSAGES)
+    }
+    
+    printf("delivered %d messages\n", NUM_REACTORS * NUM_REACTORS * NUM_MESSAGES);
+    
+    ASSERT_FORCE(close(fds[1]) == 0)
+    
+    BReactorGroup_Free(&group);
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file bshardconnection_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BNetwork.h>
+#include <system/BReactorGroup.h>
+#include <system/BConnection.h>
+#include <system/BShardConnection.h>
+
+#define DATA_SIZE 1000000
+
+static BReactor reactor;
+static BReactorGroup group;
+static BShardConnection shardcon;
+static BConnection peer;
+static uint8_t data[DATA_SIZE];
+static uint8_t result[DATA_SIZE];
+static uint8_t peer_buf[3000];
+static int sent;
+static int received;
+static int peer_len;
+static int peer_up;
+
+static void shardcon_handler (void *user, int event)
+{
+    ASSERT_FORCE(event == BCONNECTION_EVENT_RECVCLOSED)
+    ASSERT_FORCE(received == DATA_SIZE)
+    
+    BShardConnection_Free(&shardcon);
+    BReactor_Quit(&reactor, 0);
+}
+
+static void shardcon_send_handler (void *user, int data_len)
+{
+    sent += data_len;
+    
+    if (sent < DATA_SIZE) {
+        StreamPassInterface_Sender_Send(BShardConnection_GetSendIf(&shardcon), data + sent, DATA_SIZE - sent);
+    }
+}
+
+static void shardcon_recv_handler (void *user, int data_len)
+{
+    received += data_len;
+    
+    if (received < DATA_SIZE) {
+        StreamRecvInterface_Receiver_Recv(BShardConnection_GetRecvIf(&shardcon), result + received, DATA_SIZE - received);
+        return;
+    }
+    
+    ASSERT_FORCE(!memcmp(data, result, DATA_SIZE))
+    
+    // close the other end; we should see end of stream
+    BConnection_RecvAsync_Free(&peer);
+    BConnection_SendAsync_Free(&peer);
+    BConnection_Free(&peer);
+    peer_up = 0;
+}
+
+static void peer_handler (void *user, int event)
+{
+    ASSERT_FORCE(0)
+}
+
+static void peer_recv_handler (void *user, int data_len)
+{
+    // echo it back
+    peer_len = data_len;
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&peer), peer_buf, peer_len);
+}
+
+static void peer_send_handler (void *user, int data_len)
+{
+    ASSERT_FORCE(data_len <= peer_len)
+    
+    if (data_len < peer_len) {
+        memmove(peer_buf, peer_buf + data_len, peer_len - data_len);
+        peer_len -= data_len;
+        StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&peer), peer_buf, peer_len);
+        return;
+    }
+    
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&peer), peer_buf, sizeof(peer_buf));
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    if (!BReactorGroup_Init(&group, &reactor, 2, NULL, 0)) {
+        DEBUG("BReactorGroup_Init failed");
+        return 1;
+    }
+    
+    for (int i = 0; i < DATA_SIZE; i++) {
+        data[i] = (i * 7) + (i >> 11);
+    }
+    
+    int fds[2];
+    ASSERT_FORCE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+    
+    // the echoing end lives in our reactor
+    ASSERT_FORCE(BConnection_Init(&peer, BConnection_source_pipe(fds[1], 1), &reactor, NULL, peer_handler))
+    BConnection_SendAsync_Init(&peer);
+    BConnection_RecvAsync_Init(&peer);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&peer), peer_send_handler, NULL);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&peer), peer_recv_handler, NULL);
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&peer), peer_buf, sizeof(peer_buf));
+    peer_up = 1;
+    
+    // our end is served by the second member
+    ASSERT_FORCE(BShardConnection_Init(&shardcon, fds[0], BReactorGroup_GetMember(&group, 0), BReactorGroup_GetMember(&group, 1), NULL, shardcon_handler))
+    StreamPassInterface_Sender_Init(BShardConnection_GetSendIf(&shardcon), shardcon_send_handler, NULL);
+    StreamRecvInterface_Receiver_Init(BShardConnection_GetRecvIf(&shardcon), shardcon_recv_handler, NULL);
+    
+    sent = 0;
+    received = 0;
+    StreamPassInterface_Sender_Send(BShardConnection_GetSendIf(&shardcon), data, DATA_SIZE);
+    StreamRecvInterface_Receiver_Recv(BShardConnection_GetRecvIf(&shardcon), result, DATA_SIZE);
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    ASSERT_FORCE(sent == DATA_SIZE)
+    ASSERT_FORCE(!peer_up)
+    
+    printf("echoed %d bytes\n", received);
+    
+    // frees the shared state once the shard has let go of it
+    BReactorGroup_Free(&group);
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    return 0;
+}
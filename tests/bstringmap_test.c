@@ -0,0 +1,112 @@
+/**
+ * @file bstringmap_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <stringmap/BStringMap.h>
+
+#define NUM_KEYS 300
+#define NUM_OPS 20000
+
+static char keys[NUM_KEYS][16];
+static char values[NUM_KEYS][32];
+static int present[NUM_KEYS];
+
+static void verify (const BStringMap *map)
+{
+    // every key maps to what was last set
+    int count = 0;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        const char *value = BStringMap_Get(map, keys[i]);
+        if (present[i]) {
+            ASSERT_FORCE(value)
+            ASSERT_FORCE(!strcmp(value, values[i]))
+            count++;
+        } else {
+            ASSERT_FORCE(!value)
+        }
+    }
+    
+    // iteration is sorted and visits each key once
+    int seen = 0;
+    const char *prev = NULL;
+    for (const char *key = BStringMap_First(map); key; key = BStringMap_Next(map, key)) {
+        ASSERT_FORCE(!prev || strcmp(prev, key) < 0)
+        prev = key;
+        seen++;
+    }
+    ASSERT_FORCE(seen == count)
+}
+
+int main ()
+{
+    srandom(1);
+    
+    for (int i = 0; i < NUM_KEYS; i++) {
+        sprintf(keys[i], "KEY_%d", i);
+        present[i] = 0;
+    }
+    
+    BStringMap map;
+    BStringMap_Init(&map);
+    
+    ASSERT_FORCE(!BStringMap_Get(&map, "KEY_0"))
+    ASSERT_FORCE(!BStringMap_First(&map))
+    BStringMap_Unset(&map, "KEY_0");
+    
+    for (int op = 0; op < NUM_OPS; op++) {
+        int i = random() % NUM_KEYS;
+        if (random() % 4 == 0) {
+            BStringMap_Unset(&map, keys[i]);
+            present[i] = 0;
+        } else {
+            sprintf(values[i], "value %ld", (long)(random() % 8));
+            ASSERT_FORCE(BStringMap_Set(&map, keys[i], values[i]))
+            present[i] = 1;
+        }
+        
+        if (op % 1000 == 0) {
+            verify(&map);
+        }
+    }
+    
+    verify(&map);
+    
+    BStringMap copy;
+    ASSERT_FORCE(BStringMap_InitCopy(&copy, &map))
+    BStringMap_Free(&map);
+    verify(&copy);
+    
+    BStringMap_Free(&copy);
+    
+    return 0;
+}
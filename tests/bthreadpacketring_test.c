@@ -0,0 +1,162 @@
+/**
+ * @file breactorgroup_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BNetwork.h>
+#include <system/BReactorGroup.h>
+#include <system/BThreadPacketRing.h>
+
+#define MTU 1500
+#define RING_PACKETS 4
+#define NUM_PACKETS 200000
+
+static BReactor reactor;
+static BReactorGroup group;
+static BThreadPacketRing ring;
+static BThreadPacketRingProducer producer;
+static BThreadPacketRingConsumer consumer;
+static BReactorGroupMessage start_msg;
+static BReactorGroupMessage done_msg;
+static uint8_t send_buf[MTU];
+static uint8_t recv_buf[MTU];
+static int num_sent;
+static int num_received;
+
+static int packet_len (int seq)
+{
+    return (seq * 13) % (MTU + 1);
+}
+
+static void make_packet (int seq, uint8_t *data)
+{
+    for (int i = 0; i < packet_len(seq); i++) {
+        data[i] = (uint8_t)(seq * 7 + i);
+    }
+}
+
+static void send_next (void)
+{
+    make_packet(num_sent, send_buf);
+    PacketPassInterface_Sender_Send(BThreadPacketRingProducer_GetInput(&producer), send_buf, packet_len(num_sent));
+}
+
+static void producer_handler_done (void *user)
+{
+    if (++num_sent < NUM_PACKETS) {
+        send_next();
+    }
+}
+
+static void done_msg_handler (BReactorGroupMessage *msg)
+{
+    ASSERT_FORCE(num_sent == NUM_PACKETS)
+    
+    BReactor_Quit(&reactor, 0);
+}
+
+static void consumer_handler_done (void *user, int data_len)
+{
+    // packets arrive in order and intact
+    uint8_t expected[MTU];
+    make_packet(num_received, expected);
+    ASSERT_FORCE(data_len == packet_len(num_received))
+    ASSERT_FORCE(!memcmp(recv_buf, expected, data_len))
+    
+    if (++num_received < NUM_PACKETS) {
+        PacketRecvInterface_Receiver_Recv(BThreadPacketRingConsumer_GetOutput(&consumer), recv_buf);
+        return;
+    }
+    
+    BThreadPacketRingConsumer_Free(&consumer);
+    
+    BReactorGroupMember_Post(BReactorGroup_GetMember(&group, 0), &done_msg, done_msg_handler);
+}
+
+static void start_msg_handler (BReactorGroupMessage *msg)
+{
+    BReactor *r = BReactorGroupMember_Reactor(BReactorGroup_GetMember(&group, 1));
+    
+    ASSERT_FORCE(BThreadPacketRingConsumer_Init(&consumer, &ring, r))
+    PacketRecvInterface_Receiver_Init(BThreadPacketRingConsumer_GetOutput(&consumer), consumer_handler_done, NULL);
+    
+    PacketRecvInterface_Receiver_Recv(BThreadPacketRingConsumer_GetOutput(&consumer), recv_buf);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    ASSERT_FORCE(BNetwork_GlobalInit())
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    if (!BReactorGroup_Init(&group, &reactor, 2, NULL, 0)) {
+        DEBUG("BReactorGroup_Init failed");
+        return 1;
+    }
+    
+    // use a small ring so that both sides have to wait for each other
+    ASSERT_FORCE(BThreadPacketRing_Init(&ring, MTU, RING_PACKETS))
+    ASSERT_FORCE(BThreadPacketRing_GetMTU(&ring) == MTU)
+    
+    // start consumer in the other reactor
+    num_received = 0;
+    BReactorGroupMember_Post(BReactorGroup_GetMember(&group, 1), &start_msg, start_msg_handler);
+    
+    // start producer here
+    ASSERT_FORCE(BThreadPacketRingProducer_Init(&producer, &ring, &reactor))
+    PacketPassInterface_Sender_Init(BThreadPacketRingProducer_GetInput(&producer), producer_handler_done, NULL);
+    num_sent = 0;
+    send_next();
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    ASSERT_FORCE(num_received == NUM_PACKETS)
+    
+    printf("passed %d packets\n", NUM_PACKETS);
+    
+    BThreadPacketRingProducer_Free(&producer);
+    BThreadPacketRing_Free(&ring);
+    BReactorGroup_Free(&group);
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    return 0;
+}
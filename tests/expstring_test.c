@@ -0,0 +1,133 @@
+/**
+ * @file expstring_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/expstring.h>
+#include <structure/Vector.h>
+
+#define VECTOR_NAME IntVector
+#define VECTOR_ELEM_TYPE int
+#include <structure/Vector_decl.h>
+
+#define VECTOR_NAME IntVector
+#define VECTOR_ELEM_TYPE int
+#include <structure/Vector_impl.h>
+
+static void test_expstring (void)
+{
+    char buf[8];
+    ExpString str;
+    ExpString_InitBuf(&str, buf, sizeof(buf));
+    ASSERT_FORCE(ExpString_Get(&str) == buf)
+    ASSERT_FORCE(ExpString_Length(&str) == 0)
+    
+    // fits inline, including the terminator
+    ASSERT_FORCE(ExpString_Append(&str, "abcdefg"))
+    ASSERT_FORCE(ExpString_Get(&str) == buf)
+    
+    // spills to the heap, keeping the contents
+    ASSERT_FORCE(ExpString_AppendChar(&str, 'h'))
+    ASSERT_FORCE(ExpString_Get(&str) != buf)
+    ASSERT_FORCE(!strcmp(ExpString_Get(&str), "abcdefgh"))
+    
+    // reset keeps the heap memory
+    char *heap = ExpString_Get(&str);
+    ExpString_Reset(&str);
+    ASSERT_FORCE(ExpString_Length(&str) == 0)
+    ASSERT_FORCE(!strcmp(ExpString_Get(&str), ""))
+    for (int i = 0; i < 15; i++) {
+        ASSERT_FORCE(ExpString_AppendChar(&str, 'x'))
+    }
+    ASSERT_FORCE(ExpString_Get(&str) == heap)
+    
+    ExpString_Free(&str);
+    
+    // reset of an inline string stays inline
+    ExpString_InitBuf(&str, buf, sizeof(buf));
+    ASSERT_FORCE(ExpString_Append(&str, "abc"))
+    ExpString_Reset(&str);
+    ASSERT_FORCE(ExpString_Append(&str, "de"))
+    ASSERT_FORCE(ExpString_Get(&str) == buf)
+    ASSERT_FORCE(!strcmp(ExpString_Get(&str), "de"))
+    ExpString_Free(&str);
+    
+    // heap strings still work as before
+    ASSERT_FORCE(ExpString_Init(&str))
+    ExpString_Reset(&str);
+    ASSERT_FORCE(ExpString_AppendZeros(&str, 100))
+    ASSERT_FORCE(ExpString_Length(&str) == 100)
+    ExpString_Free(&str);
+}
+
+static void test_vector (void)
+{
+    int elems[4];
+    IntVector v;
+    IntVector_InitBuf(&v, elems, 4);
+    
+    for (int i = 0; i < 4; i++) {
+        int *e = IntVector_Push(&v, NULL);
+        ASSERT_FORCE(e == &elems[i])
+        *e = i;
+    }
+    
+    // spills to the heap, keeping the elements
+    for (int i = 4; i < 100; i++) {
+        size_t index;
+        int *e = IntVector_Push(&v, &index);
+        ASSERT_FORCE(e)
+        ASSERT_FORCE(index == i)
+        *e = i;
+    }
+    ASSERT_FORCE(IntVector_Get(&v, 0) != &elems[0])
+    for (int i = 0; i < 100; i++) {
+        ASSERT_FORCE(*IntVector_Get(&v, i) == i)
+    }
+    
+    // clear keeps the capacity
+    int *heap = IntVector_Get(&v, 0);
+    IntVector_Clear(&v);
+    ASSERT_FORCE(IntVector_Count(&v) == 0)
+    for (int i = 0; i < 100; i++) {
+        ASSERT_FORCE(IntVector_Push(&v, NULL))
+    }
+    ASSERT_FORCE(IntVector_Get(&v, 0) == heap)
+    
+    IntVector_Free(&v);
+}
+
+int main ()
+{
+    test_expstring();
+    test_vector();
+    
+    return 0;
+}
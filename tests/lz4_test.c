@@ -0,0 +1,145 @@
+/**
+ * @file lz4_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/lz4.h>
+
+#define MAX_LEN 4000
+#define NUM_ROUNDS 2000
+
+static struct lz4_state st;
+static uint8_t in[MAX_LEN];
+static uint8_t comp[LZ4_COMPRESS_BOUND(MAX_LEN)];
+static uint8_t out[MAX_LEN];
+
+static void fill (int len, int kind)
+{
+    switch (kind) {
+        case 0: // random
+            for (int i = 0; i < len; i++) {
+                in[i] = random();
+            }
+            break;
+        case 1: // constant
+            memset(in, random(), len);
+            break;
+        case 2: // few symbols
+            for (int i = 0; i < len; i++) {
+                in[i] = 'a' + random() % 3;
+            }
+            break;
+        default: // repeated random pieces, like headers of similar packets
+            for (int i = 0; i < len; i++) {
+                in[i] = (i > 40 && random() % 8) ? in[i - 1 - random() % 40] : random();
+            }
+            break;
+    }
+}
+
+static int round_trip (int len)
+{
+    // with a small buffer, the result fits or is refused
+    int cap = random() % (len + 1);
+    int small_len = lz4_compress(&st, in, len, comp, cap);
+    ASSERT_FORCE(small_len >= 0 && small_len <= cap)
+    if (small_len > 0) {
+        ASSERT_FORCE(lz4_decompress(comp, small_len, out, len) == len)
+        ASSERT_FORCE(!memcmp(in, out, len))
+    }
+    
+    // with enough space, compression always succeeds
+    int comp_len = lz4_compress(&st, in, len, comp, sizeof(comp));
+    ASSERT_FORCE(len == 0 || comp_len > 0)
+    ASSERT_FORCE(comp_len <= LZ4_COMPRESS_BOUND(len))
+    
+    if (len > 0) {
+        ASSERT_FORCE(lz4_decompress(comp, comp_len, out, len) == len)
+        ASSERT_FORCE(!memcmp(in, out, len))
+        
+        // one byte less of output space is not enough
+        ASSERT_FORCE(lz4_decompress(comp, comp_len, out, len - 1) == -1)
+    }
+    
+    return comp_len;
+}
+
+int main ()
+{
+    srandom(1);
+    lz4_state_init(&st);
+    
+    // sizes around the limits of the format
+    for (int len = 0; len <= 300; len++) {
+        for (int kind = 0; kind < 4; kind++) {
+            fill(len, kind);
+            round_trip(len);
+        }
+    }
+    
+    for (int i = 0; i < NUM_ROUNDS; i++) {
+        int len = random() % (MAX_LEN + 1);
+        int kind = random() % 4;
+        fill(len, kind);
+        int comp_len = round_trip(len);
+        
+        // compressible data compresses
+        if (kind == 1 && len >= 100) {
+            ASSERT_FORCE(comp_len < len / 4)
+        }
+        
+        // corrupted blocks never write past the output buffer
+        if (comp_len > 0) {
+            for (int j = 0; j < 8; j++) {
+                int corrupt_len = random() % (comp_len + 1);
+                comp[random() % comp_len] = random();
+                int res = lz4_decompress(comp, corrupt_len, out, len);
+                ASSERT_FORCE(res >= -1 && res <= len)
+            }
+        }
+    }
+    
+    // an offset before the start of the output is refused
+    static const uint8_t bad_offset[] = {0x10, 'x', 0x02, 0x00, 0x10, 'y'};
+    ASSERT_FORCE(lz4_decompress(bad_offset, sizeof(bad_offset), out, MAX_LEN) == -1)
+    
+    // a block without the final literals is refused
+    static const uint8_t no_last[] = {0x10, 'x', 0x01, 0x00};
+    ASSERT_FORCE(lz4_decompress(no_last, sizeof(no_last), out, MAX_LEN) == -1)
+    
+    // an overlapping match repeats the data
+    static const uint8_t overlap[] = {0x24, 'a', 'b', 0x02, 0x00, 0x00};
+    ASSERT_FORCE(lz4_decompress(overlap, sizeof(overlap), out, MAX_LEN) == 10)
+    ASSERT_FORCE(!memcmp(out, "ababababab", 10))
+    
+    return 0;
+}
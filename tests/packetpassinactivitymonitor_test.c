@@ -0,0 +1,164 @@
+/**
+ * @file packetpassinactivitymonitor_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <flow/PacketPassInterface.h>
+#include <flowextra/PacketPassInactivityMonitor.h>
+
+#define NUM_MONITORS 1000
+#define INTERVAL 200
+#define SEND_INTERVAL 20
+#define DURATION 1100
+#define MAX_LATENESS (INTERVAL / PACKETPASSINACTIVITYMONITOR_SLOTS + 50)
+
+struct test_monitor {
+    PacketPassInterface sink;
+    PacketPassInactivityMonitor monitor;
+    int active;
+    int sending;
+    btime_t last_done;
+    int reports;
+};
+
+static BReactor reactor;
+static struct test_monitor monitors[NUM_MONITORS];
+static BTimer send_timer;
+static BTimer end_timer;
+static uint8_t packet[1];
+static btime_t max_lateness;
+
+static void sink_handler_send (struct test_monitor *m, uint8_t *data, int data_len)
+{
+    PacketPassInterface_Done(&m->sink);
+}
+
+static void input_handler_done (struct test_monitor *m)
+{
+    ASSERT_FORCE(m->sending)
+    
+    m->sending = 0;
+    m->last_done = btime_gettime();
+}
+
+static void monitor_handler (struct test_monitor *m)
+{
+    ASSERT_FORCE(!m->active)
+    ASSERT_FORCE(!m->sending)
+    
+    // must not report before the interval has passed since the last activity
+    btime_t since = btime_gettime() - m->last_done;
+    ASSERT_FORCE(since >= INTERVAL)
+    
+    if (since - INTERVAL > max_lateness) {
+        max_lateness = since - INTERVAL;
+    }
+    
+    m->last_done = btime_gettime();
+    m->reports++;
+}
+
+static void send_timer_handler (void *unused)
+{
+    for (int i = 0; i < NUM_MONITORS; i++) {
+        struct test_monitor *m = &monitors[i];
+        if (m->active && !m->sending) {
+            PacketPassInterface_Sender_Send(PacketPassInactivityMonitor_GetInput(&m->monitor), packet, sizeof(packet));
+            m->sending = 1;
+        }
+    }
+    
+    BReactor_SetTimer(&reactor, &send_timer);
+}
+
+static void end_timer_handler (void *unused)
+{
+    BReactor_Quit(&reactor, 0);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    // half of the monitors see traffic all the time, the other half none
+    for (int i = 0; i < NUM_MONITORS; i++) {
+        struct test_monitor *m = &monitors[i];
+        PacketPassInterface_Init(&m->sink, sizeof(packet), (PacketPassInterface_handler_send)sink_handler_send, m, BReactor_PendingGroup(&reactor));
+        PacketPassInactivityMonitor_Init(&m->monitor, &m->sink, &reactor, INTERVAL, (PacketPassInactivityMonitor_handler)monitor_handler, m);
+        PacketPassInterface_Sender_Init(PacketPassInactivityMonitor_GetInput(&m->monitor), (PacketPassInterface_handler_done)input_handler_done, m);
+        m->active = (i % 2 == 0);
+        m->sending = 0;
+        m->last_done = btime_gettime();
+        m->reports = 0;
+    }
+    
+    max_lateness = 0;
+    
+    BTimer_Init(&send_timer, SEND_INTERVAL, send_timer_handler, NULL);
+    BReactor_SetTimer(&reactor, &send_timer);
+    
+    BTimer_Init(&end_timer, DURATION, end_timer_handler, NULL);
+    BReactor_SetTimer(&reactor, &end_timer);
+    
+    int ret = BReactor_Exec(&reactor);
+    ASSERT_FORCE(ret == 0)
+    
+    printf("max lateness %d ms\n", (int)max_lateness);
+    ASSERT_FORCE(max_lateness <= MAX_LATENESS)
+    
+    for (int i = 0; i < NUM_MONITORS; i++) {
+        struct test_monitor *m = &monitors[i];
+        if (m->active) {
+            ASSERT_FORCE(m->reports == 0)
+        } else {
+            ASSERT_FORCE(m->reports >= DURATION / (INTERVAL + MAX_LATENESS))
+            ASSERT_FORCE(m->reports <= DURATION / INTERVAL)
+        }
+        PacketPassInactivityMonitor_Free(&m->monitor);
+        PacketPassInterface_Free(&m->sink);
+    }
+    
+    BReactor_RemoveTimer(&reactor, &send_timer);
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    return 0;
+}
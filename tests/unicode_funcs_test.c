@@ -0,0 +1,297 @@
+/**
+ * @file unicode_funcs_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/unicode_funcs.h>
+
+#define MAX_INPUT_LEN 600
+#define NUM_ROUNDS 20000
+
+// per-character reference implementations, without the ASCII fast paths
+
+static char * ref_utf16_to_utf8 (const uint8_t *data, size_t data_len, int *out_is_error)
+{
+    ExpString str;
+    ASSERT_FORCE(ExpString_Init(&str))
+    
+    Utf16Decoder decoder;
+    Utf16Decoder_Init(&decoder);
+    
+    size_t i_in = 0;
+    size_t i_ch = 0;
+    int error = 0;
+    
+    while (i_in < data_len) {
+        uint8_t x = data[i_in++];
+        if (i_in == data_len) {
+            break;
+        }
+        uint8_t y = data[i_in++];
+        
+        uint32_t ch;
+        if (!Utf16Decoder_Input(&decoder, ((uint16_t)x << 8) | y, &ch)) {
+            continue;
+        }
+        
+        if (!error) {
+            uint16_t chenc[2];
+            int chenc_n = Utf16Encoder_EncodeCharacter(ch, chenc);
+            ASSERT_FORCE(chenc_n > 0)
+            for (int k = 0; k < 2 * chenc_n; k++) {
+                uint8_t c = (k % 2 == 0) ? (chenc[k / 2] >> 8) : (chenc[k / 2] & 0xFF);
+                if (i_ch >= data_len || data[i_ch] != c) {
+                    error = 1;
+                    break;
+                }
+                i_ch++;
+            }
+        }
+        
+        if (ch == 0) {
+            error = 1;
+            continue;
+        }
+        
+        uint8_t enc[5];
+        int enc_n = Utf8Encoder_EncodeCharacter(ch, enc);
+        ASSERT_FORCE(enc_n > 0)
+        enc[enc_n] = 0;
+        ASSERT_FORCE(ExpString_Append(&str, (char *)enc))
+    }
+    
+    if (i_ch < data_len) {
+        error = 1;
+    }
+    
+    *out_is_error = error;
+    return ExpString_Get(&str);
+}
+
+static void ref_utf8_to_utf16 (const uint8_t *data, size_t data_len, uint8_t *out, size_t out_avail, bsize_t *out_len, int *out_is_error)
+{
+    Utf8Decoder decoder;
+    Utf8Decoder_Init(&decoder);
+    
+    size_t i_in = 0;
+    size_t i_ch = 0;
+    bsize_t len = bsize_fromsize(0);
+    int error = 0;
+    
+    while (i_in < data_len) {
+        uint32_t ch;
+        if (!Utf8Decoder_Input(&decoder, data[i_in++], &ch)) {
+            continue;
+        }
+        
+        if (!error) {
+            uint8_t chenc[4];
+            int chenc_n = Utf8Encoder_EncodeCharacter(ch, chenc);
+            ASSERT_FORCE(chenc_n > 0)
+            for (int k = 0; k < chenc_n; k++) {
+                if (i_ch >= data_len || data[i_ch] != chenc[k]) {
+                    error = 1;
+                    break;
+                }
+                i_ch++;
+            }
+        }
+        
+        uint16_t enc[2];
+        int enc_n = Utf16Encoder_EncodeCharacter(ch, enc);
+        ASSERT_FORCE(enc_n > 0)
+        len = bsize_add(len, bsize_fromsize(2 * enc_n));
+        
+        for (int k = 0; k < 2 * enc_n && out_avail > 0; k++) {
+            *(out++) = (k % 2 == 0) ? (enc[k / 2] >> 8) : (enc[k / 2] & 0xFF);
+            out_avail--;
+        }
+    }
+    
+    if (i_ch < data_len) {
+        error = 1;
+    }
+    
+    *out_len = len;
+    *out_is_error = error;
+}
+
+static uint32_t random_char (void)
+{
+    switch (random() % 4) {
+        case 0: return 0x80 + random() % 0x780;
+        case 1: return 0x800 + random() % 0xF800;
+        case 2: return 0x10000 + random() % 0x100000;
+        default: return (random() % 8 == 0) ? UINT32_C(0x10FFFF) : (uint32_t)(random() % 0x80);
+    }
+}
+
+static size_t gen_utf8 (uint8_t *buf)
+{
+    size_t len = 0;
+    
+    while (len < MAX_INPUT_LEN - 64) {
+        int what = random() % 10;
+        if (what < 4) {
+            // ASCII run, sometimes containing a null
+            size_t n = random() % 60;
+            for (size_t i = 0; i < n; i++) {
+                buf[len++] = (random() % 50 == 0) ? 0 : 1 + random() % 0x7F;
+            }
+        }
+        else if (what < 8) {
+            // well-formed character, possibly a surrogate
+            uint32_t ch = (random() % 20 == 0) ? 0xD800 + random() % 0x800 : random_char();
+            if (ch >= 0xD800 && ch <= 0xDFFF) {
+                buf[len++] = 0xED;
+                buf[len++] = 0x80 | ((ch >> 6) & 0x3F);
+                buf[len++] = 0x80 | (ch & 0x3F);
+            } else {
+                len += Utf8Encoder_EncodeCharacter(ch, buf + len);
+            }
+        }
+        else if (what < 9) {
+            // random byte
+            buf[len++] = random() % 256;
+        }
+        else {
+            break;
+        }
+    }
+    
+    // maybe truncate within the last character
+    if (len > 0 && random() % 4 == 0) {
+        len--;
+    }
+    
+    return len;
+}
+
+static size_t gen_utf16 (uint8_t *buf)
+{
+    size_t len = 0;
+    
+    while (len < MAX_INPUT_LEN - 64) {
+        int what = random() % 10;
+        uint16_t units[2];
+        int n = 0;
+        if (what < 4) {
+            size_t run = random() % 60;
+            for (size_t i = 0; i < run; i++) {
+                uint16_t u = (random() % 50 == 0) ? (random() % 3 == 0 ? 0 : 0x100 + random() % 0x100) : 1 + random() % 0x7F;
+                buf[len++] = u >> 8;
+                buf[len++] = u & 0xFF;
+            }
+        }
+        else if (what < 8) {
+            n = Utf16Encoder_EncodeCharacter(random_char(), units);
+        }
+        else if (what < 9) {
+            // lone or swapped surrogate
+            units[0] = 0xD800 + random() % 0x800;
+            n = 1;
+        }
+        else {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            buf[len++] = units[i] >> 8;
+            buf[len++] = units[i] & 0xFF;
+        }
+    }
+    
+    // maybe leave an odd trailing byte
+    if (len > 0 && random() % 4 == 0) {
+        len--;
+    }
+    
+    return len;
+}
+
+int main ()
+{
+    srandom(1);
+    
+    static uint8_t input[MAX_INPUT_LEN];
+    static uint8_t out[4 * MAX_INPUT_LEN];
+    static uint8_t ref_out[4 * MAX_INPUT_LEN];
+    
+    // the ASCII prefix at every offset and length around the vector width
+    for (size_t i = 0; i < 100; i++) {
+        input[i] = 'a' + i % 26;
+    }
+    for (size_t pos = 0; pos < 40; pos++) {
+        input[pos] = 0x80;
+        for (size_t len = 0; len <= 40; len++) {
+            ASSERT_FORCE(unicode_ascii_prefix_len(input, len) == (pos < len ? pos : len))
+        }
+        input[pos] = 'x';
+    }
+    
+    // U+10FFFF is the last character that can be encoded
+    const uint8_t max_char[] = {0xF4, 0x8F, 0xBF, 0xBF};
+    ASSERT_FORCE(unicode_utf8_is_valid(max_char, sizeof(max_char)))
+    
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        // UTF-8 to UTF-16, with the output buffer sometimes too short
+        size_t len = gen_utf8(input);
+        size_t out_avail = (random() % 3 == 0) ? random() % (2 * len + 2) : sizeof(out);
+        
+        bsize_t out_len;
+        int is_error;
+        memset(out, 0xAA, sizeof(out));
+        unicode_decode_utf8_to_utf16(input, len, out, out_avail, &out_len, &is_error);
+        
+        bsize_t ref_len;
+        int ref_is_error;
+        memset(ref_out, 0xAA, sizeof(ref_out));
+        ref_utf8_to_utf16(input, len, ref_out, out_avail, &ref_len, &ref_is_error);
+        
+        ASSERT_FORCE(!out_len.is_overflow && !ref_len.is_overflow)
+        ASSERT_FORCE(out_len.value == ref_len.value)
+        ASSERT_FORCE(is_error == ref_is_error)
+        ASSERT_FORCE(!memcmp(out, ref_out, sizeof(out)))
+        ASSERT_FORCE(unicode_utf8_is_valid(input, len) == !ref_is_error)
+        
+        // UTF-16 to UTF-8
+        len = gen_utf16(input);
+        
+        char *str = unicode_decode_utf16_to_utf8(input, len, &is_error);
+        char *ref_str = ref_utf16_to_utf8(input, len, &ref_is_error);
+        ASSERT_FORCE(str && ref_str)
+        ASSERT_FORCE(!strcmp(str, ref_str))
+        ASSERT_FORCE(is_error == ref_is_error)
+        free(str);
+        free(ref_str);
+    }
+    
+    return 0;
+}
@@ -37,6 +37,8 @@
 #endif
 
 #include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/usdt.h>
 #include <base/BLog.h>
 
 #include <generated/blog_channel_BThreadWork.h>
@@ -49,6 +51,10 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
 {
     BThreadWorkDispatcher *o = t->d;
     
+    if (o->placement) {
+        BThreadPlacement_Apply(o->placement, t - o->threads, "worker thread");
+    }
+    
     ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
     
     while (1) {
@@ -59,7 +65,9 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
         
         if (LinkedList1_IsEmpty(&o->pending_list)) {
             // wait for event
-            ASSERT_FORCE(pthread_cond_wait(&t->new_cond, &o->mutex) == 0)
+            o->num_idle++;
+            ASSERT_FORCE(pthread_cond_wait(&o->new_cond, &o->mutex) == 0)
+            o->num_idle--;
             continue;
         }
         
@@ -72,6 +80,7 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
         
         // do the work
         ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+        BTRACE1(threadwork_start, w);
         w->work_func(w->work_func_user);
         ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
         
@@ -81,12 +90,17 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
         w->state = BTHREADWORK_STATE_FINISHED;
         ASSERT_FORCE(sem_post(&w->finished_sem) == 0)
         
-        // write to pipe
-        uint8_t b = 0;
-        int res = write(o->pipe[1], &b, sizeof(b));
-        if (res < 0) {
-            int error = errno;
-            ASSERT_FORCE(error == EAGAIN || error == EWOULDBLOCK)
+        // wake up the event loop, unless already done since it last collected
+        if (!o->notified) {
+            o->notified = 1;
+            
+            // write to pipe
+            uint8_t b = 0;
+            int res = write(o->pipe[1], &b, sizeof(b));
+            if (res < 0) {
+                int error = errno;
+                ASSERT_FORCE(error == EAGAIN || error == EWOULDBLOCK)
+            }
         }
     }
     
@@ -95,34 +109,55 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
     return NULL;
 }
 
-static void dispatch_job (BThreadWorkDispatcher *o)
+static void collect_finished (BThreadWorkDispatcher *o)
 {
     ASSERT(o->num_threads > 0)
     
     // lock
     ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
     
+    // threads have to wake us up for anything finishing after this
+    o->notified = 0;
+    
+    // move all finished works to the deliver list
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->finished_list)) {
+        BThreadWork *w = UPPER_OBJECT(node, BThreadWork, list_node);
+        ASSERT(w->state == BTHREADWORK_STATE_FINISHED)
+        LinkedList1_Remove(&o->finished_list, &w->list_node);
+        LinkedList1_Append(&o->deliver_list, &w->list_node);
+        w->state = BTHREADWORK_STATE_DELIVERING;
+    }
+    
+    // unlock
+    ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+}
+
+static void dispatch_job (BThreadWorkDispatcher *o)
+{
+    ASSERT(o->num_threads > 0)
+    
+    // the deliver list is only accessed from the event loop, no need to lock
+    
     // check for finished job
-    if (LinkedList1_IsEmpty(&o->finished_list)) {
-        ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+    if (LinkedList1_IsEmpty(&o->deliver_list)) {
         return;
     }
     
     // grab finished job
-    BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->finished_list), BThreadWork, list_node);
-    ASSERT(w->state == BTHREADWORK_STATE_FINISHED)
-    LinkedList1_Remove(&o->finished_list, &w->list_node);
+    BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->deliver_list), BThreadWork, list_node);
+    ASSERT(w->state == BTHREADWORK_STATE_DELIVERING)
+    LinkedList1_Remove(&o->deliver_list, &w->list_node);
     
     // schedule more
-    if (!LinkedList1_IsEmpty(&o->finished_list)) {
+    if (!LinkedList1_IsEmpty(&o->deliver_list)) {
         BPending_Set(&o->more_job);
     }
     
     // set state forgotten
     w->state = BTHREADWORK_STATE_FORGOTTEN;
     
-    // unlock
-    ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+    BTRACE1(threadwork_complete, w);
     
     // call handler
     w->handler_done(w->user);
@@ -144,6 +179,8 @@ static void pipe_fd_handler (BThreadWorkDispatcher *o, int events)
         ASSERT(res > 0)
     }
     
+    collect_finished(o);
+    
     dispatch_job(o);
     return;
 }
@@ -159,23 +196,18 @@ static void more_job_handler (BThreadWorkDispatcher *o)
 
 static void stop_threads (BThreadWorkDispatcher *o)
 {
-    // set cancelling
+    // set cancelling and wake up threads
     ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
     o->cancel = 1;
+    ASSERT_FORCE(pthread_cond_broadcast(&o->new_cond) == 0)
     ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
     
     while (o->num_threads > 0) {
         struct BThreadWorkDispatcher_thread *t = &o->threads[o->num_threads - 1];
         
-        // wake up thread
-        ASSERT_FORCE(pthread_cond_signal(&t->new_cond) == 0)
-        
         // wait for thread to exit
         ASSERT_FORCE(pthread_join(t->thread, NULL) == 0)
         
-        // free condition variable
-        ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
-        
         o->num_threads--;
     }
 }
@@ -190,27 +222,36 @@ static void work_job_handler (BThreadWork *o)
     DebugObject_Access(&o->d_obj);
     
     // do the work
+    BTRACE1(threadwork_start, o);
     o->work_func(o->work_func_user);
     
+    BTRACE1(threadwork_complete, o);
+    
     // call handler
     o->handler_done(o->user);
     return;
 }
 
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint)
+{
+    return BThreadWorkDispatcher_Init2(o, reactor, num_threads_hint, NULL);
+}
+
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, const BThreadPlacement *placement)
 {
     // init arguments
     o->reactor = reactor;
     
     if (num_threads_hint < 0) {
-        num_threads_hint = 2;
-    }
-    if (num_threads_hint > BTHREADWORK_MAX_THREADS) {
-        num_threads_hint = BTHREADWORK_MAX_THREADS;
+        num_threads_hint = BTHREADWORK_DEFAULT_THREADS;
     }
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     
+    // no threads unless they are started below
+    o->num_threads = 0;
+    o->placement = placement;
+    
     if (num_threads_hint > 0) {
         // init pending list
         LinkedList1_Init(&o->pending_list);
@@ -218,10 +259,25 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
         // init finished list
         LinkedList1_Init(&o->finished_list);
         
+        // init deliver list
+        LinkedList1_Init(&o->deliver_list);
+        
+        // allocate threads
+        if (!(o->threads = (struct BThreadWorkDispatcher_thread *)BAllocArray(num_threads_hint, sizeof(o->threads[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail0;
+        }
+        
         // init mutex
         if (pthread_mutex_init(&o->mutex, NULL) != 0) {
             BLog(BLOG_ERROR, "pthread_mutex_init failed");
-            goto fail0;
+            goto fail0a;
+        }
+        
+        // init condition variable
+        if (pthread_cond_init(&o->new_cond, NULL) != 0) {
+            BLog(BLOG_ERROR, "pthread_cond_init failed");
+            goto fail0b;
         }
         
         // init pipe
@@ -256,6 +312,10 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
         // set not cancelling
         o->cancel = 0;
         
+        // no threads waiting yet, event loop not woken up
+        o->num_idle = 0;
+        o->notified = 0;
+        
         // init threads
         o->num_threads = 0;
         for (int i = 0; i < num_threads_hint; i++) {
@@ -267,16 +327,9 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
             // set no running work
             t->running_work = NULL;
             
-            // init condition variable
-            if (pthread_cond_init(&t->new_cond, NULL) != 0) {
-                BLog(BLOG_ERROR, "pthread_cond_init failed");
-                goto fail3;
-            }
-            
             // init thread
             if (pthread_create(&t->thread, NULL, (void * (*) (void *))dispatcher_thread, t) != 0) {
                 BLog(BLOG_ERROR, "pthread_create failed");
-                ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
                 goto fail3;
             }
         
@@ -299,7 +352,11 @@ fail2:
     ASSERT_FORCE(close(o->pipe[0]) == 0)
     ASSERT_FORCE(close(o->pipe[1]) == 0)
 fail1:
+    ASSERT_FORCE(pthread_cond_destroy(&o->new_cond) == 0)
+fail0b:
     ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+fail0a:
+    BFree(o->threads);
 fail0:
     return 0;
     #endif
@@ -312,6 +369,7 @@ void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
         ASSERT(LinkedList1_IsEmpty(&o->pending_list))
         for (int i = 0; i < o->num_threads; i++) { ASSERT(!o->threads[i].running_work) }
         ASSERT(LinkedList1_IsEmpty(&o->finished_list))
+        ASSERT(LinkedList1_IsEmpty(&o->deliver_list))
     }
     #endif
     DebugObject_Free(&o->d_obj);
@@ -333,8 +391,14 @@ void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
         ASSERT_FORCE(close(o->pipe[0]) == 0)
         ASSERT_FORCE(close(o->pipe[1]) == 0)
         
+        // free condition variable
+        ASSERT_FORCE(pthread_cond_destroy(&o->new_cond) == 0)
+        
         // free mutex
         ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+        
+        // free threads
+        BFree(o->threads);
     }
     
     #endif
@@ -360,6 +424,8 @@ void BThreadWork_Init (BThreadWork *o, BThreadWorkDispatcher *d, BThreadWork_han
     o->work_func = work_func;
     o->work_func_user = work_func_user;
     
+    BTRACE1(threadwork_queue, o);
+    
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     if (d->num_threads > 0) {
         // set state
@@ -371,11 +437,8 @@ void BThreadWork_Init (BThreadWork *o, BThreadWorkDispatcher *d, BThreadWork_han
         // post work
         ASSERT_FORCE(pthread_mutex_lock(&d->mutex) == 0)
         LinkedList1_Append(&d->pending_list, &o->list_node);
-        for (int i = 0; i < d->num_threads; i++) {
-            if (!d->threads[i].running_work) {
-                ASSERT_FORCE(pthread_cond_signal(&d->threads[i].new_cond) == 0)
-                break;
-            }
+        if (d->num_idle > 0) {
+            ASSERT_FORCE(pthread_cond_signal(&d->new_cond) == 0)
         }
         ASSERT_FORCE(pthread_mutex_unlock(&d->mutex) == 0)
     } else {
@@ -430,6 +493,13 @@ void BThreadWork_Free (BThreadWork *o)
                 LinkedList1_Remove(&d->finished_list, &o->list_node);
             } break;
             
+            case BTHREADWORK_STATE_DELIVERING: {
+                BLog(BLOG_DEBUG, "remove delivering work");
+                
+                // remove from deliver list
+                LinkedList1_Remove(&d->deliver_list, &o->list_node);
+            } break;
+            
             case BTHREADWORK_STATE_FORGOTTEN: {
                 BLog(BLOG_DEBUG, "remove forgotten work");
             } break;
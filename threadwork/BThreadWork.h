@@ -44,13 +44,15 @@
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
+#include <system/BThreadPlacement.h>
 
 #define BTHREADWORK_STATE_PENDING 1
 #define BTHREADWORK_STATE_RUNNING 2
 #define BTHREADWORK_STATE_FINISHED 3
 #define BTHREADWORK_STATE_FORGOTTEN 4
+#define BTHREADWORK_STATE_DELIVERING 5
 
-#define BTHREADWORK_MAX_THREADS 8
+#define BTHREADWORK_DEFAULT_THREADS 2
 
 struct BThreadWork_s;
 struct BThreadWorkDispatcher_s;
@@ -74,7 +76,6 @@ typedef void (*BThreadWork_handler_done) (void *user);
 struct BThreadWorkDispatcher_thread {
     struct BThreadWorkDispatcher_s *d;
     struct BThreadWork_s *running_work;
-    pthread_cond_t new_cond;
     pthread_t thread;
 };
 #endif
@@ -84,13 +85,18 @@ typedef struct BThreadWorkDispatcher_s {
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     LinkedList1 pending_list;
     LinkedList1 finished_list;
+    LinkedList1 deliver_list;
     pthread_mutex_t mutex;
+    pthread_cond_t new_cond;
+    int num_idle;
+    int notified;
     int pipe[2];
     BFileDescriptor bfd;
     BPending more_job;
     int cancel;
     int num_threads;
-    struct BThreadWorkDispatcher_thread threads[BTHREADWORK_MAX_THREADS];
+    struct BThreadWorkDispatcher_thread *threads;
+    const BThreadPlacement *placement;
     #endif
     DebugObject d_obj;
     DebugCounter d_ctr;
@@ -121,16 +127,35 @@ typedef struct BThreadWork_s {
  * Initializes the work dispatcher.
  * Works may be started using {@link BThreadWork_Init}.
  * 
+ * Finished works are collected in batches: the event loop is woken up once for
+ * all works which finish before it gets to them, and their handlers are then
+ * called from consecutive jobs.
+ * 
  * @param o the object
  * @param reactor reactor we live in
  * @param num_threads_hint hint for the number of threads to use:
- *                         <0 - A choice will be made automatically, probably based on the number of CPUs.
+ *                         <0 - A choice will be made automatically (currently BTHREADWORK_DEFAULT_THREADS).
  *                         0 - No additional threads will be used, and computations will be performed directly
  *                             in the event loop in job handlers.
  * @return 1 on success, 0 on failure
  */
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint) WARN_UNUSED;
 
+/**
+ * Initializes the work dispatcher, placing its threads on CPUs.
+ * Like {@link BThreadWorkDispatcher_Init}, but each thread first applies the
+ * given placement with {@link BThreadPlacement_Apply}, using its index among
+ * the dispatcher's threads.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param num_threads_hint as in {@link BThreadWorkDispatcher_Init}
+ * @param placement placement of the threads, or NULL to leave them as they are.
+ *                  Must remain valid until the dispatcher is freed.
+ * @return 1 on success, 0 on failure
+ */
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, const BThreadPlacement *placement) WARN_UNUSED;
+
 /**
  * Frees the work dispatcher.
  * There must be no {@link BThreadWork}'s with this dispatcher.
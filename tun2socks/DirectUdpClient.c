@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BAddr.h>
+
+#include <tun2socks/DirectUdpClient.h>
+
+#include <generated/blog_channel_DirectUdpClient.h>
+
+static size_t flow_hash (struct DirectUdpClient_flow_key *key)
+{
+    return BFlowAddr_HashPair(&key->local_addr, &key->remote_addr);
+}
+
+static int flow_key_equal (struct DirectUdpClient_flow_key *key1, struct DirectUdpClient_flow_key *key2)
+{
+    return BFlowAddr_Equal(&key1->local_addr, &key2->local_addr) & BFlowAddr_Equal(&key1->remote_addr, &key2->remote_addr);
+}
+
+#include "DirectUdpClient_hash.h"
+#include <structure/CHash_impl.h>
+
+static void datagram_handler (struct DirectUdpClient_flow *flow, int event);
+static void send_monitor_handler (struct DirectUdpClient_flow *flow);
+static void recv_if_handler_send (struct DirectUdpClient_flow *flow, uint8_t *data, int data_len);
+static struct DirectUdpClient_flow * flow_init (DirectUdpClient *o, BAddr local_addr, BAddr remote_addr,
+                                                const uint8_t *first_data, int first_data_len);
+static void flow_free (struct DirectUdpClient_flow *flow);
+static void flow_send (struct DirectUdpClient_flow *flow, const uint8_t *data, int data_len);
+static void first_job_handler (struct DirectUdpClient_flow *flow);
+
+void datagram_handler (struct DirectUdpClient_flow *flow, int event)
+{
+    DebugObject_Access(&flow->client->d_obj);
+    
+    if (event == BDATAGRAM_EVENT_ERROR) {
+        char remote_buffer[BADDR_MAX_PRINT_LEN];
+        BAddr remote_addr = BFlowAddr_ToBAddr(&flow->key.remote_addr);
+        BAddr_Print(&remote_addr, remote_buffer);
+        BLog(BLOG_ERROR, "datagram error for %s, removing flow", remote_buffer);
+        
+        // BDatagram must be freed after an error
+        flow_free(flow);
+    }
+}
+
+void send_monitor_handler (struct DirectUdpClient_flow *flow)
+{
+    DebugObject_Access(&flow->client->d_obj);
+    
+    BLog(BLOG_DEBUG, "removing flow due to inactivity");
+    
+    flow_free(flow);
+}
+
+void recv_if_handler_send (struct DirectUdpClient_flow *flow, uint8_t *data, int data_len)
+{
+    DirectUdpClient *o = flow->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // accept packet
+    PacketPassInterface_Done(&flow->recv_if);
+    
+    // only pass on replies from the remote address, as a connected socket would
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    if (!BDatagram_GetLastReceiveAddrs(&flow->socket, &remote_addr, &local_addr) ||
+        (remote_addr.type != BADDR_TYPE_IPV4 && remote_addr.type != BADDR_TYPE_IPV6)
+    ) {
+        BLog(BLOG_INFO, "dropping packet not from the remote address of the flow");
+        return;
+    }
+    BFlowAddr remote_key = BFlowAddr_FromBAddr(&remote_addr);
+    if (!BFlowAddr_Equal(&remote_key, &flow->key.remote_addr)) {
+        BLog(BLOG_INFO, "dropping packet not from the remote address of the flow");
+        return;
+    }
+    
+    // pass packet to user
+    o->handler_received(o->user, BFlowAddr_ToBAddr(&flow->key.local_addr), remote_addr, data, data_len);
+}
+
+struct DirectUdpClient_flow * flow_init (DirectUdpClient *o, BAddr local_addr, BAddr remote_addr,
+                                         const uint8_t *first_data, int first_data_len)
+{
+    ASSERT(o->num_flows < o->max_flows)
+    
+    // allocate structure
+    struct DirectUdpClient_flow *flow = (struct DirectUdpClient_flow *)BAlloc(sizeof(*flow));
+    if (!flow) {
+        BLog(BLOG_ERROR, "BAlloc flow failed");
+        goto fail0;
+    }
+    
+    // set basic things
+    flow->client = o;
+    flow->key.local_addr = BFlowAddr_FromBAddr(&local_addr);
+    flow->key.remote_addr = BFlowAddr_FromBAddr(&remote_addr);
+    
+    // store first packet
+    if (!(flow->first_data = BAlloc(first_data_len))) {
+        BLog(BLOG_ERROR, "BAlloc first data failed");
+        goto fail1;
+    }
+    memcpy(flow->first_data, first_data, first_data_len);
+    flow->first_data_len = first_data_len;
+    
+    BPendingGroup *pg = BReactor_PendingGroup(o->reactor);
+    
+    // init first job; it is set before the buffer below, so that it runs after
+    // the buffer has connected to the writer
+    BPending_Init(&flow->first_job, pg, (BPending_handler)first_job_handler, flow);
+    BPending_Set(&flow->first_job);
+    
+    // init socket
+    if (!BDatagram_Init(&flow->socket, remote_addr.type, o->reactor, flow, (BDatagram_handler)datagram_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail2;
+    }
+    
+    // bind to any address, letting the kernel choose the port
+    BAddr bind_addr;
+    if (remote_addr.type == BADDR_TYPE_IPV6) {
+        uint8_t any6[16] = {0};
+        BAddr_InitIPv6(&bind_addr, any6, 0);
+    } else {
+        BAddr_InitIPv4(&bind_addr, 0, 0);
+    }
+    if (!BDatagram_Bind(&flow->socket, bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail3;
+    }
+    
+    // send everything to the remote address
+    BIPAddr send_local_addr;
+    BIPAddr_InitInvalid(&send_local_addr);
+    BDatagram_SetSendAddrs(&flow->socket, remote_addr, send_local_addr);
+    
+    // replies are only accepted from the remote address anyway, so let the
+    // socket be connected to it
+    if (!BDatagram_SetAutoConnect(&flow->socket, 1)) {
+        BLog(BLOG_WARNING, "BDatagram_SetAutoConnect failed");
+    }
+    
+    // send pipeline: send_writer -> send_buffer -> send_monitor -> socket
+    BDatagram_SendAsync_Init(&flow->socket, o->udp_mtu);
+    PacketPassInactivityMonitor_Init(&flow->send_monitor, BDatagram_SendAsync_GetIf(&flow->socket),
+        o->reactor, o->keepalive_time, (PacketPassInactivityMonitor_handler)send_monitor_handler, flow);
+    BufferWriter_Init(&flow->send_writer, o->udp_mtu, pg);
+    if (!PacketBuffer_Init(&flow->send_buffer, BufferWriter_GetOutput(&flow->send_writer),
+        PacketPassInactivityMonitor_GetInput(&flow->send_monitor), o->send_buf_size, pg))
+    {
+        BLog(BLOG_ERROR, "PacketBuffer_Init failed");
+        goto fail4;
+    }
+    
+    // receive pipeline: socket -> recv_buffer -> recv_if; not batched, so that
+    // the last receive addresses belong to the packet being passed on
+    BDatagram_RecvAsync_Init(&flow->socket, o->udp_mtu);
+    PacketPassInterface_Init(&flow->recv_if, o->udp_mtu, (PacketPassInterface_handler_send)recv_if_handler_send, flow, pg);
+    if (!SinglePacketBuffer_Init(&flow->recv_buffer, BDatagram_RecvAsync_GetIf(&flow->socket), &flow->recv_if, pg)) {
+        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
+        goto fail5;
+    }
+    
+    // insert to flows hash table; it was checked not to be there
+    flow->hash = flow_hash(&flow->key);
+    DirectUdpClientHashRef ref = {flow, flow};
+    int inserted = DirectUdpClientHash_Insert(&o->flows_hash, 0, ref, NULL);
+    ASSERT(inserted)
+    B_USE(inserted)
+    
+    // insert to flows list as most recently used
+    LinkedList1_Append(&o->flows_list, &flow->flows_list_node);
+    flow->last_used = BReactor_GetTime(o->reactor);
+    o->num_flows++;
+    
+    return flow;
+    
+fail5:
+    PacketPassInterface_Free(&flow->recv_if);
+    BDatagram_RecvAsync_Free(&flow->socket);
+    PacketBuffer_Free(&flow->send_buffer);
+fail4:
+    BufferWriter_Free(&flow->send_writer);
+    PacketPassInactivityMonitor_Free(&flow->send_monitor);
+    BDatagram_SendAsync_Free(&flow->socket);
+fail3:
+    BDatagram_Free(&flow->socket);
+fail2:
+    BPending_Free(&flow->first_job);
+    BFree(flow->first_data);
+fail1:
+    BFree(flow);
+fail0:
+    return NULL;
+}
+
+void flow_free (struct DirectUdpClient_flow *flow)
+{
+    DirectUdpClient *o = flow->client;
+    ASSERT(o->num_flows > 0)
+    
+    // remove from flows list and hash table
+    o->num_flows--;
+    LinkedList1_Remove(&o->flows_list, &flow->flows_list_node);
+    DirectUdpClientHashRef ref = {flow, flow};
+    DirectUdpClientHash_Remove(&o->flows_hash, 0, ref);
+    
+    // free receive pipeline
+    SinglePacketBuffer_Free(&flow->recv_buffer);
+    PacketPassInterface_Free(&flow->recv_if);
+    BDatagram_RecvAsync_Free(&flow->socket);
+    
+    // free send pipeline
+    PacketBuffer_Free(&flow->send_buffer);
+    BufferWriter_Free(&flow->send_writer);
+    PacketPassInactivityMonitor_Free(&flow->send_monitor);
+    BDatagram_SendAsync_Free(&flow->socket);
+    
+    // free socket
+    BDatagram_Free(&flow->socket);
+    
+    // free first packet
+    BPending_Free(&flow->first_job);
+    BFree(flow->first_data);
+    
+    BFree(flow);
+}
+
+void flow_send (struct DirectUdpClient_flow *flow, const uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= flow->client->udp_mtu)
+    
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(&flow->send_writer, &out)) {
+        BLog(BLOG_INFO, "send buffer is full");
+        return;
+    }
+    memcpy(out, data, data_len);
+    BufferWriter_EndPacket(&flow->send_writer, data_len);
+}
+
+void first_job_handler (struct DirectUdpClient_flow *flow)
+{
+    DebugObject_Access(&flow->client->d_obj);
+    ASSERT(flow->first_data)
+    
+    flow_send(flow, flow->first_data, flow->first_data_len);
+    
+    BFree(flow->first_data);
+    flow->first_data = NULL;
+}
+
+int DirectUdpClient_Init (DirectUdpClient *o, int udp_mtu, int max_flows, int send_buf_size,
+    btime_t keepalive_time, BReactor *reactor, void *user,
+    DirectUdpClient_handler_received handler_received)
+{
+    ASSERT(udp_mtu >= 0)
+    ASSERT(max_flows > 0)
+    ASSERT(send_buf_size > 0)
+    
+    // init arguments
+    o->udp_mtu = udp_mtu;
+    o->max_flows = max_flows;
+    o->send_buf_size = send_buf_size;
+    o->keepalive_time = keepalive_time;
+    o->admit_new = 1;
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_received = handler_received;
+    
+    // init flows hash table
+    if (!DirectUdpClientHash_Init(&o->flows_hash, max_flows)) {
+        BLog(BLOG_ERROR, "DirectUdpClientHash_Init failed");
+        return 0;
+    }
+    
+    // init flows list
+    LinkedList1_Init(&o->flows_list);
+    o->num_flows = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void DirectUdpClient_Free (DirectUdpClient *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free flows
+    while (!LinkedList1_IsEmpty(&o->flows_list)) {
+        flow_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->flows_list), struct DirectUdpClient_flow, flows_list_node));
+    }
+    
+    // free flows hash table
+    DirectUdpClientHash_Free(&o->flows_hash);
+}
+
+void DirectUdpClient_SubmitPacket (DirectUdpClient *o,
+    BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // lookup flow
+    struct DirectUdpClient_flow_key key;
+    key.local_addr = BFlowAddr_FromBAddr(&local_addr);
+    key.remote_addr = BFlowAddr_FromBAddr(&remote_addr);
+    struct DirectUdpClient_flow *flow = DirectUdpClientHash_Lookup(&o->flows_hash, 0, &key).ptr;
+    
+    if (!flow) {
+        // forget the least recently used flow to make room, or to not hold
+        // more flows while new ones are not admitted
+        if (o->num_flows >= o->max_flows || (!o->admit_new && o->num_flows > 0)) {
+            BLog(BLOG_INFO, "no room for a new flow, closing least recently used");
+            flow_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->flows_list), struct DirectUdpClient_flow, flows_list_node));
+        }
+        
+        // create flow, which sends the packet first
+        flow_init(o, local_addr, remote_addr, data, data_len);
+        return;
+    }
+    
+    // move flow to the end of the list
+    LinkedList1_Remove(&o->flows_list, &flow->flows_list_node);
+    LinkedList1_Append(&o->flows_list, &flow->flows_list_node);
+    flow->last_used = BReactor_GetTime(o->reactor);
+    
+    // send packet
+    flow_send(flow, data, data_len);
+}
+
+void DirectUdpClient_SetAdmitNew (DirectUdpClient *o, int admit_new)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->admit_new = !!admit_new;
+}
+
+size_t DirectUdpClient_GetMemoryUsage (DirectUdpClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // each flow holds a structure, its send buffer and a receive buffer
+    size_t flow_size = sizeof(struct DirectUdpClient_flow) + (size_t)(o->send_buf_size + 1) * o->udp_mtu;
+    
+    return o->num_flows * flow_size;
+}
+
+int DirectUdpClient_EvictIdle (DirectUdpClient *o, btime_t idle_time, int max_num)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(idle_time >= 0)
+    ASSERT(max_num >= 0)
+    
+    btime_t now = BReactor_GetTime(o->reactor);
+    int num = 0;
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->flows_list);
+    while (node && num < max_num) {
+        struct DirectUdpClient_flow *flow = UPPER_OBJECT(node, struct DirectUdpClient_flow, flows_list_node);
+        node = LinkedList1Node_Next(node);
+        
+        // the list is in the order the flows were used
+        if (now - flow->last_used < idle_time) {
+            break;
+        }
+        
+        if (flow->first_data) {
+            continue;
+        }
+        
+        flow_free(flow);
+        num++;
+    }
+    
+    return num;
+}
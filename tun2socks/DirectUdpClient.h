@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_TUN2SOCKS_DIRECTUDPCLIENT_H
+#define BADVPN_TUN2SOCKS_DIRECTUDPCLIENT_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/BPending.h>
+#include <base/DebugObject.h>
+#include <flow/BufferWriter.h>
+#include <flow/PacketBuffer.h>
+#include <flow/SinglePacketBuffer.h>
+#include <flow/PacketPassInterface.h>
+#include <flowextra/PacketPassInactivityMonitor.h>
+#include <structure/CHash.h>
+#include <structure/LinkedList1.h>
+#include <system/BAddr.h>
+#include <system/BFlowAddr.h>
+#include <system/BDatagram.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+
+typedef void (*DirectUdpClient_handler_received) (
+    void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+struct DirectUdpClient_flow;
+
+struct DirectUdpClient_flow_key {
+    BFlowAddr local_addr;
+    BFlowAddr remote_addr;
+};
+
+typedef struct DirectUdpClient_flow *DirectUdpClientHash_link;
+typedef struct DirectUdpClient_flow_key *DirectUdpClientHash_key;
+
+#include "DirectUdpClient_hash.h"
+#include <structure/CHash_decl.h>
+
+typedef struct {
+    int udp_mtu;
+    int max_flows;
+    int send_buf_size;
+    btime_t keepalive_time;
+    int admit_new;
+    BReactor *reactor;
+    void *user;
+    DirectUdpClient_handler_received handler_received;
+    DirectUdpClientHash flows_hash; // By (local_addr, remote_addr)
+    LinkedList1 flows_list; // Least recently used first
+    int num_flows;
+    DebugObject d_obj;
+} DirectUdpClient;
+
+// One (local_addr, remote_addr) flow, relayed through its own UDP socket.
+struct DirectUdpClient_flow {
+    DirectUdpClient *client;
+    struct DirectUdpClient_flow_key key;
+    BDatagram socket;
+    BufferWriter send_writer;
+    PacketBuffer send_buffer;
+    PacketPassInactivityMonitor send_monitor;
+    PacketPassInterface recv_if;
+    SinglePacketBuffer recv_buffer;
+    // The first packet waits here until send_writer becomes ready.
+    uint8_t *first_data;
+    int first_data_len;
+    BPending first_job;
+    btime_t last_used;
+    size_t hash;
+    DirectUdpClientHash_link hash_next;
+    LinkedList1Node flows_list_node;
+};
+
+/**
+ * Initializes the direct UDP client object, which sends UDP packets to their
+ * destinations from local sockets instead of through a proxy.
+ * 
+ * This function only initializes the object and does not perform network access.
+ * 
+ * @param o the object
+ * @param udp_mtu the maximum size of packets that will be sent
+ * @param max_flows how many flows to track before evicting the least recently used one
+ * @param send_buf_size maximum number of buffered outgoing packets per flow
+ * @param keepalive_time how long to track an idle flow before forgetting it
+ * @param reactor reactor we live in
+ * @param user value passed to handler
+ * @param handler_received handler for incoming UDP packets
+ * @return 1 on success, 0 on failure
+ */
+int DirectUdpClient_Init (DirectUdpClient *o, int udp_mtu, int max_flows, int send_buf_size,
+    btime_t keepalive_time, BReactor *reactor, void *user,
+    DirectUdpClient_handler_received handler_received) WARN_UNUSED;
+
+/**
+ * Frees the direct UDP client object.
+ * 
+ * @param o the object
+ */
+void DirectUdpClient_Free (DirectUdpClient *o);
+
+/**
+ * Submits a packet to be sent directly to remote_addr.
+ * 
+ * This will reuse the socket of the (local_addr, remote_addr) flow, or create one
+ * if there is none. Replies arriving on the socket from remote_addr are passed to
+ * the handler with the addresses of the flow; anything else arriving on it is dropped.
+ * If the number of buffered packets of the flow exceeds a limit, packets will be
+ * dropped silently.
+ * 
+ * @param o the object
+ * @param local_addr the UDP packet's source address, and the destination for replies
+ * @param remote_addr the destination of the packet
+ * @param data the packet payload
+ * @param data_len the payload length, in bytes; must not exceed udp_mtu
+ */
+void DirectUdpClient_SubmitPacket (DirectUdpClient *o,
+    BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+/**
+ * Sets whether packets of unknown flows may add flows below max_flows.
+ * If not, such a packet takes over the least recently used flow, as when there
+ * are max_flows flows already. Initially, new flows are admitted.
+ * 
+ * @param o the object
+ * @param admit_new whether to admit new flows
+ */
+void DirectUdpClient_SetAdmitNew (DirectUdpClient *o, int admit_new);
+
+/**
+ * Returns an estimate of the memory held by the flows, in bytes.
+ * 
+ * @param o the object
+ * @return number of bytes
+ */
+size_t DirectUdpClient_GetMemoryUsage (DirectUdpClient *o);
+
+/**
+ * Forgets up to max_num flows which no packet was submitted to for idle_time,
+ * starting from the least recently used, skipping flows whose first packet has
+ * not been sent yet.
+ * 
+ * @param o the object
+ * @param idle_time how long a flow must have been idle, in milliseconds; must be >=0
+ * @param max_num maximum number of flows to forget; must be >=0
+ * @return number of flows forgotten
+ */
+int DirectUdpClient_EvictIdle (DirectUdpClient *o, btime_t idle_time, int max_num);
+
+#endif
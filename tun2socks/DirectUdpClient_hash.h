@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME DirectUdpClientHash
+#define CHASH_PARAM_ENTRY struct DirectUdpClient_flow
+#define CHASH_PARAM_LINK DirectUdpClientHash_link
+#define CHASH_PARAM_KEY DirectUdpClientHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((DirectUdpClientHash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) flow_hash((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) flow_key_equal(&(entry1).ptr->key, &(entry2).ptr->key)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) flow_key_equal((key1), &(entry2).ptr->key)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
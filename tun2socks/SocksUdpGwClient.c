@@ -27,127 +27,262 @@
  */
 
 #include <misc/debug.h>
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include <tun2socks/SocksUdpGwClient.h>
 
 #include <generated/blog_channel_SocksUdpGwClient.h>
 
-static void free_socks (SocksUdpGwClient *o);
-static void try_connect (SocksUdpGwClient *o);
-static void reconnect_timer_handler (SocksUdpGwClient *o);
-static void socks_client_handler (SocksUdpGwClient *o, int event);
-static void udpgw_handler_servererror (SocksUdpGwClient *o);
+static void free_con (struct SocksUdpGwClient_server *s);
+static void free_dgram (struct SocksUdpGwClient_server *s);
+static void try_connect (struct SocksUdpGwClient_server *s);
+static void reconnect_timer_handler (struct SocksUdpGwClient_server *s);
+static void socks_client_handler (struct SocksUdpGwClient_server *s, int event);
+#ifndef BADVPN_USE_WINAPI
+static void unix_connector_handler (struct SocksUdpGwClient_server *s, int is_error);
+static void unix_connection_handler (struct SocksUdpGwClient_server *s, int event);
+#endif
+static void udpgw_handler_servererror (SocksUdpGwClient *o, int server_index);
 static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void udpgw_handler_icmp (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void udpgw_handler_datagram (SocksUdpGwClient *o, int server_index, uint16_t port);
+static void dgram_handler (struct SocksUdpGwClient_server *s, int event);
 
-static void free_socks (SocksUdpGwClient *o)
+static void free_con (struct SocksUdpGwClient_server *s)
 {
-    ASSERT(o->have_socks)
+    ASSERT(s->have_con)
     
-    // disconnect udpgw client from SOCKS
-    if (o->socks_up) {
-        UdpGwClient_DisconnectServer(&o->udpgw_client);
+    // free datagram transport
+    if (s->have_dgram) {
+        free_dgram(s);
     }
     
-    // free SOCKS client
-    BSocksClient_Free(&o->socks_client);
+    // disconnect udpgw client from the connection
+    if (s->con_up) {
+        UdpGwClient_DisconnectServer(&s->client->udpgw_client, s->index);
+    }
+    
+#ifndef BADVPN_USE_WINAPI
+    if (s->client->remote_udpgw_unix) {
+        // free Unix socket connection
+        if (s->con_up) {
+            BConnection_RecvAsync_Free(&s->unix_con);
+            BConnection_SendAsync_Free(&s->unix_con);
+            BConnection_Free(&s->unix_con);
+        }
+        
+        // free Unix socket connector
+        BConnector_Free(&s->unix_connector);
+    } else
+#endif
+    {
+        // free SOCKS client
+        BSocksClient_Free(&s->socks_client);
+    }
     
-    // set have no SOCKS
-    o->have_socks = 0;
+    // set have no connection
+    s->have_con = 0;
 }
 
-static void try_connect (SocksUdpGwClient *o)
+static void free_dgram (struct SocksUdpGwClient_server *s)
 {
-    ASSERT(!o->have_socks)
-    ASSERT(!BTimer_IsRunning(&o->reconnect_timer))
+    ASSERT(s->have_dgram)
     
-    // init SOCKS client
-    if (!BSocksClient_Init(&o->socks_client, o->socks_server_addr,
-        o->auth_info, o->num_auth_info, o->remote_udpgw_addr, /*udp=*/false,
-        (BSocksClient_handler)socks_client_handler, o, o->reactor))
+    // disconnect udpgw client from the datagram socket
+    UdpGwClient_DisconnectDatagram(&s->client->udpgw_client, s->index);
+    
+    // free datagram socket
+    BDatagram_RecvAsync_Free(&s->dgram);
+    BDatagram_SendAsync_Free(&s->dgram);
+    BDatagram_Free(&s->dgram);
+    
+    // set have no datagram transport
+    s->have_dgram = 0;
+}
+
+static void try_connect (struct SocksUdpGwClient_server *s)
+{
+    SocksUdpGwClient *o = s->client;
+    ASSERT(!s->have_con)
+    ASSERT(!BTimer_IsRunning(&s->reconnect_timer))
+    
+#ifndef BADVPN_USE_WINAPI
+    if (o->remote_udpgw_unix) {
+        // init Unix socket connector
+        if (!BConnector_InitUnix(&s->unix_connector, o->remote_udpgw_unix, o->reactor, s, (BConnector_handler)unix_connector_handler)) {
+            BLog(BLOG_ERROR, "BConnector_InitUnix failed");
+            goto fail0;
+        }
+    } else
+#endif
     {
-        BLog(BLOG_ERROR, "BSocksClient_Init failed");
-        goto fail0;
+        // init SOCKS client
+        if (!BSocksClient_Init(&s->socks_client, o->socks_server_addr,
+            o->auth_info, o->num_auth_info, o->remote_udpgw_addr, /*udp=*/false,
+            (BSocksClient_handler)socks_client_handler, s, o->reactor))
+        {
+            BLog(BLOG_ERROR, "BSocksClient_Init failed");
+            goto fail0;
+        }
     }
     
-    // set have SOCKS
-    o->have_socks = 1;
+    // set have connection
+    s->have_con = 1;
+    
+    // set connection not up
+    s->con_up = 0;
     
-    // set SOCKS not up
-    o->socks_up = 0;
+    // set have no datagram transport
+    s->have_dgram = 0;
     
     return;
     
 fail0:
     // set reconnect timer
-    BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+    BReactor_SetTimer(o->reactor, &s->reconnect_timer);
 }
 
-static void reconnect_timer_handler (SocksUdpGwClient *o)
+static void reconnect_timer_handler (struct SocksUdpGwClient_server *s)
 {
-    DebugObject_Access(&o->d_obj);
-    ASSERT(!o->have_socks)
+    DebugObject_Access(&s->client->d_obj);
+    ASSERT(!s->have_con)
     
     // try connecting
-    try_connect(o);
+    try_connect(s);
 }
 
-static void socks_client_handler (SocksUdpGwClient *o, int event)
+static void socks_client_handler (struct SocksUdpGwClient_server *s, int event)
 {
+    SocksUdpGwClient *o = s->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_socks)
+    ASSERT(s->have_con)
     
     switch (event) {
         case BSOCKSCLIENT_EVENT_UP: {
-            ASSERT(!o->socks_up)
+            ASSERT(!s->con_up)
             
-            BLog(BLOG_INFO, "SOCKS up");
+            BLog(BLOG_INFO, "SOCKS up (connection %d)", s->index);
             
             // connect udpgw client to SOCKS
-            if (!UdpGwClient_ConnectServer(&o->udpgw_client, BSocksClient_GetSendInterface(&o->socks_client), BSocksClient_GetRecvInterface(&o->socks_client))) {
+            if (!UdpGwClient_ConnectServer(&o->udpgw_client, s->index, BSocksClient_GetSendInterface(&s->socks_client), BSocksClient_GetRecvInterface(&s->socks_client))) {
                 BLog(BLOG_ERROR, "UdpGwClient_ConnectServer failed");
                 goto fail0;
             }
             
             // set SOCKS up
-            o->socks_up = 1;
+            s->con_up = 1;
             
             return;
             
         fail0:
             // free SOCKS
-            free_socks(o);
+            free_con(s);
             
             // set reconnect timer
-            BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+            BReactor_SetTimer(o->reactor, &s->reconnect_timer);
         } break;
         
         case BSOCKSCLIENT_EVENT_ERROR:
         case BSOCKSCLIENT_EVENT_ERROR_CLOSED: {
-            BLog(BLOG_INFO, "SOCKS error");
+            BLog(BLOG_INFO, "SOCKS error (connection %d)", s->index);
             
-            // free SOCKS
-            free_socks(o);
+            // free SOCKS; until it reconnects, the udpgw client moves flows
+            // to the other connections
+            free_con(s);
             
             // set reconnect timer
-            BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+            BReactor_SetTimer(o->reactor, &s->reconnect_timer);
         } break;
     }
 }
 
-static void udpgw_handler_servererror (SocksUdpGwClient *o)
+#ifndef BADVPN_USE_WINAPI
+
+static void unix_connector_handler (struct SocksUdpGwClient_server *s, int is_error)
+{
+    SocksUdpGwClient *o = s->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->remote_udpgw_unix)
+    ASSERT(s->have_con)
+    ASSERT(!s->con_up)
+    
+    if (is_error) {
+        BLog(BLOG_INFO, "Unix socket connect failed (connection %d)", s->index);
+        goto fail0;
+    }
+    
+    // init connection
+    if (!BConnection_Init(&s->unix_con, BConnection_source_connector(&s->unix_connector), o->reactor, s, (BConnection_handler)unix_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    // init send and receive interfaces
+    BConnection_SendAsync_Init(&s->unix_con);
+    BConnection_RecvAsync_Init(&s->unix_con);
+    
+    // connect udpgw client to the connection
+    if (!UdpGwClient_ConnectServer(&o->udpgw_client, s->index, BConnection_SendAsync_GetIf(&s->unix_con), BConnection_RecvAsync_GetIf(&s->unix_con))) {
+        BLog(BLOG_ERROR, "UdpGwClient_ConnectServer failed");
+        goto fail1;
+    }
+    
+    BLog(BLOG_INFO, "Unix socket up (connection %d)", s->index);
+    
+    // set connection up
+    s->con_up = 1;
+    
+    return;
+    
+fail1:
+    BConnection_RecvAsync_Free(&s->unix_con);
+    BConnection_SendAsync_Free(&s->unix_con);
+    BConnection_Free(&s->unix_con);
+fail0:
+    // free connector
+    free_con(s);
+    
+    // set reconnect timer
+    BReactor_SetTimer(o->reactor, &s->reconnect_timer);
+}
+
+static void unix_connection_handler (struct SocksUdpGwClient_server *s, int event)
 {
+    SocksUdpGwClient *o = s->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_socks)
-    ASSERT(o->socks_up)
+    ASSERT(o->remote_udpgw_unix)
+    ASSERT(s->have_con)
+    ASSERT(s->con_up)
     
-    BLog(BLOG_ERROR, "client reports server error");
+    BLog(BLOG_INFO, "Unix socket %s (connection %d)", (event == BCONNECTION_EVENT_RECVCLOSED ? "closed" : "error"), s->index);
     
-    // free SOCKS
-    free_socks(o);
+    // free connection; until it reconnects, the udpgw client moves flows
+    // to the other connections
+    free_con(s);
     
     // set reconnect timer
-    BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+    BReactor_SetTimer(o->reactor, &s->reconnect_timer);
+}
+
+#endif
+
+static void udpgw_handler_servererror (SocksUdpGwClient *o, int server_index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct SocksUdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(s->have_con)
+    ASSERT(s->con_up)
+    
+    BLog(BLOG_ERROR, "client reports server error (connection %d)", s->index);
+    
+    // free connection
+    free_con(s);
+    
+    // set reconnect timer
+    BReactor_SetTimer(o->reactor, &s->reconnect_timer);
 }
 
 static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
@@ -159,14 +294,91 @@ static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr
     return;
 }
 
-int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time,
+static void udpgw_handler_icmp (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->handler_icmp)
+    
+    // submit to user
+    o->handler_icmp(o->user, local_addr, remote_addr, data, data_len);
+}
+
+static void udpgw_handler_datagram (SocksUdpGwClient *o, int server_index, uint16_t port)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->datagram)
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct SocksUdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(s->have_con)
+    ASSERT(s->con_up)
+    ASSERT(!s->have_dgram)
+    
+    // the datagram port is on the host of the udpgw address
+    BAddr addr = o->remote_udpgw_addr;
+    BAddr_SetPort(&addr, port);
+    
+    // init datagram socket
+    if (!BDatagram_Init(&s->dgram, addr.type, o->reactor, s, (BDatagram_handler)dgram_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // set addresses
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&s->dgram, addr, local_addr);
+    
+    // init send and receive interfaces
+    int mtu = UdpGwClient_GetDatagramMtu(&o->udpgw_client);
+    BDatagram_SendAsync_Init(&s->dgram, mtu);
+    BDatagram_RecvAsync_Init(&s->dgram, mtu);
+    
+    // connect udpgw client to the datagram socket
+    if (!UdpGwClient_ConnectDatagram(&o->udpgw_client, s->index, BDatagram_SendAsync_GetIf(&s->dgram), BDatagram_RecvAsync_GetIf(&s->dgram))) {
+        BLog(BLOG_ERROR, "UdpGwClient_ConnectDatagram failed");
+        goto fail1;
+    }
+    
+    // set have datagram transport
+    s->have_dgram = 1;
+    
+    return;
+    
+fail1:
+    BDatagram_RecvAsync_Free(&s->dgram);
+    BDatagram_SendAsync_Free(&s->dgram);
+    BDatagram_Free(&s->dgram);
+fail0:
+    // keep using the stream; the server repeats the offer
+    return;
+}
+
+static void dgram_handler (struct SocksUdpGwClient_server *s, int event)
+{
+    SocksUdpGwClient *o = s->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(s->have_con)
+    ASSERT(s->have_dgram)
+    
+    BLog(BLOG_INFO, "datagram socket error (connection %d)", s->index);
+    
+    // free datagram transport, keeping the stream; the server repeats the
+    // offer with the next keepalive
+    free_dgram(s);
+}
+
+int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, int num_servers,
                            BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
-                           BAddr remote_udpgw_addr, btime_t reconnect_time, BReactor *reactor, void *user,
+                           BAddr remote_udpgw_addr, const char *remote_udpgw_unix, btime_t reconnect_time, BReactor *reactor, void *user,
                            SocksUdpGwClient_handler_received handler_received)
 {
     // see asserts in UdpGwClient_Init
-    ASSERT(!BAddr_IsInvalid(&socks_server_addr))
-    ASSERT(remote_udpgw_addr.type == BADDR_TYPE_IPV4 || remote_udpgw_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_udpgw_unix || !BAddr_IsInvalid(&socks_server_addr))
+    ASSERT(remote_udpgw_unix || remote_udpgw_addr.type == BADDR_TYPE_IPV4 || remote_udpgw_addr.type == BADDR_TYPE_IPV6)
+#ifdef BADVPN_USE_WINAPI
+    ASSERT(!remote_udpgw_unix)
+#endif
     
     // init arguments
     o->udp_mtu = udp_mtu;
@@ -174,30 +386,48 @@ int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections
     o->auth_info = auth_info;
     o->num_auth_info = num_auth_info;
     o->remote_udpgw_addr = remote_udpgw_addr;
+    o->remote_udpgw_unix = remote_udpgw_unix;
+    o->datagram = 0;
     o->reactor = reactor;
     o->user = user;
     o->handler_received = handler_received;
+    o->handler_icmp = NULL;
+    o->num_servers = num_servers;
+    
+    // allocate servers
+    if (!(o->servers = (struct SocksUdpGwClient_server *)BAllocArray(o->num_servers, sizeof(o->servers[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
     
     // init udpgw client
-    if (!UdpGwClient_Init(&o->udpgw_client, udp_mtu, max_connections, send_buffer_size, keepalive_time, o->reactor, o,
+    if (!UdpGwClient_Init(&o->udpgw_client, udp_mtu, max_connections, send_buffer_size, keepalive_time, o->num_servers, o->reactor, o,
                           (UdpGwClient_handler_servererror)udpgw_handler_servererror,
                           (UdpGwClient_handler_received)udpgw_handler_received
     )) {
-        goto fail0;
+        goto fail1;
     }
     
-    // init reconnect timer
-    BTimer_Init(&o->reconnect_timer, reconnect_time, (BTimer_handler)reconnect_timer_handler, o);
-    
-    // set have no SOCKS
-    o->have_socks = 0;
-    
-    // try connecting
-    try_connect(o);
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUdpGwClient_server *s = &o->servers[i];
+        s->client = o;
+        s->index = i;
+        
+        // init reconnect timer
+        BTimer_Init(&s->reconnect_timer, reconnect_time, (BTimer_handler)reconnect_timer_handler, s);
+        
+        // set have no connection
+        s->have_con = 0;
+        
+        // try connecting
+        try_connect(s);
+    }
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail1:
+    BFree(o->servers);
 fail0:
     return 0;
 }
@@ -206,16 +436,90 @@ void SocksUdpGwClient_Free (SocksUdpGwClient *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // free SOCKS
-    if (o->have_socks) {
-        free_socks(o);
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUdpGwClient_server *s = &o->servers[i];
+        
+        // free connection
+        if (s->have_con) {
+            free_con(s);
+        }
+        
+        // free reconnect timer
+        BReactor_RemoveTimer(o->reactor, &s->reconnect_timer);
     }
     
-    // free reconnect timer
-    BReactor_RemoveTimer(o->reactor, &o->reconnect_timer);
-    
     // free udpgw client
     UdpGwClient_Free(&o->udpgw_client);
+    
+    // free servers
+    BFree(o->servers);
+}
+
+void SocksUdpGwClient_EnableDatagram (SocksUdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->remote_udpgw_unix)
+    ASSERT(!o->datagram)
+    
+    o->datagram = 1;
+    
+    UdpGwClient_EnableDatagram(&o->udpgw_client, (UdpGwClient_handler_datagram)udpgw_handler_datagram);
+}
+
+void SocksUdpGwClient_SetSendRate (SocksUdpGwClient *o, int rate, int burst)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    UdpGwClient_SetSendRate(&o->udpgw_client, rate, burst);
+}
+
+void SocksUdpGwClient_EnableCoDel (SocksUdpGwClient *o, int target, int interval)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    UdpGwClient_EnableCoDel(&o->udpgw_client, target, interval);
+}
+
+uint64_t SocksUdpGwClient_GetCoDelDrops (SocksUdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return UdpGwClient_GetCoDelDrops(&o->udpgw_client);
+}
+
+void SocksUdpGwClient_SetAdmitNew (SocksUdpGwClient *o, int admit_new)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    UdpGwClient_SetAdmitNew(&o->udpgw_client, admit_new);
+}
+
+size_t SocksUdpGwClient_GetMemoryUsage (SocksUdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return UdpGwClient_GetMemoryUsage(&o->udpgw_client);
+}
+
+int SocksUdpGwClient_EvictIdle (SocksUdpGwClient *o, btime_t idle_time, int max_num)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return UdpGwClient_EvictIdle(&o->udpgw_client, idle_time, max_num);
+}
+
+int SocksUdpGwClient_GetNumConnections (SocksUdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return UdpGwClient_GetNumConnections(&o->udpgw_client);
+}
+
+int SocksUdpGwClient_HasConnection (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return UdpGwClient_HasConnection(&o->udpgw_client, local_addr, remote_addr);
 }
 
 void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
@@ -227,3 +531,22 @@ void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr
     UdpGwClient_SubmitPacket(&o->udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
 }
 
+void SocksUdpGwClient_EnableIcmp (SocksUdpGwClient *o, SocksUdpGwClient_handler_received handler_icmp)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(handler_icmp)
+    ASSERT(!o->handler_icmp)
+    
+    o->handler_icmp = handler_icmp;
+    
+    UdpGwClient_EnableIcmp(&o->udpgw_client, (UdpGwClient_handler_received)udpgw_handler_icmp);
+}
+
+int SocksUdpGwClient_SubmitIcmpPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    // see asserts in UdpGwClient_SubmitIcmpPacket
+    
+    // submit to udpgw client
+    return UdpGwClient_SubmitIcmpPacket(&o->udpgw_client, local_addr, remote_addr, data, data_len);
+}
@@ -32,33 +32,64 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
+#include <system/BConnection.h>
+#include <system/BDatagram.h>
 #include <udpgw_client/UdpGwClient.h>
 #include <socksclient/BSocksClient.h>
 
 typedef void (*SocksUdpGwClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
+struct SocksUdpGwClient_server;
+
 typedef struct {
     int udp_mtu;
     BAddr socks_server_addr;
     const struct BSocksClient_auth_info *auth_info;
     size_t num_auth_info;
     BAddr remote_udpgw_addr;
+    const char *remote_udpgw_unix;
+    int datagram;
     BReactor *reactor;
     void *user;
     SocksUdpGwClient_handler_received handler_received;
+    SocksUdpGwClient_handler_received handler_icmp;
+    int num_servers;
+    struct SocksUdpGwClient_server *servers;
     UdpGwClient udpgw_client;
-    BTimer reconnect_timer;
-    int have_socks;
-    BSocksClient socks_client;
-    int socks_up;
     DebugObject d_obj;
 } SocksUdpGwClient;
 
-int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time,
+struct SocksUdpGwClient_server {
+    SocksUdpGwClient *client;
+    int index;
+    BTimer reconnect_timer;
+    int have_con;
+    int con_up;
+    BSocksClient socks_client;
+    int have_dgram;
+    BDatagram dgram;
+#ifndef BADVPN_USE_WINAPI
+    BConnector unix_connector;
+    BConnection unix_con;
+#endif
+};
+
+int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, int num_servers,
                            BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
-                           BAddr remote_udpgw_addr, btime_t reconnect_time, BReactor *reactor, void *user,
+                           BAddr remote_udpgw_addr, const char *remote_udpgw_unix, btime_t reconnect_time, BReactor *reactor, void *user,
                            SocksUdpGwClient_handler_received handler_received) WARN_UNUSED;
 void SocksUdpGwClient_Free (SocksUdpGwClient *o);
+void SocksUdpGwClient_EnableDatagram (SocksUdpGwClient *o);
+void SocksUdpGwClient_SetSendRate (SocksUdpGwClient *o, int rate, int burst);
+void SocksUdpGwClient_EnableCoDel (SocksUdpGwClient *o, int target, int interval);
+uint64_t SocksUdpGwClient_GetCoDelDrops (SocksUdpGwClient *o);
+void SocksUdpGwClient_SetAdmitNew (SocksUdpGwClient *o, int admit_new);
+size_t SocksUdpGwClient_GetMemoryUsage (SocksUdpGwClient *o);
+int SocksUdpGwClient_EvictIdle (SocksUdpGwClient *o, btime_t idle_time, int max_num);
+int SocksUdpGwClient_GetNumConnections (SocksUdpGwClient *o);
+int SocksUdpGwClient_HasConnection (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr);
 void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len);
+void SocksUdpGwClient_EnableIcmp (SocksUdpGwClient *o, SocksUdpGwClient_handler_received handler_icmp);
+int SocksUdpGwClient_SubmitIcmpPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len) WARN_UNUSED;
 
 #endif
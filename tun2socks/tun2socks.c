@@ -31,28 +31,51 @@
 #include <stddef.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include <misc/version.h>
 #include <misc/loggers_string.h>
 #include <misc/loglevel.h>
 #include <misc/minmax.h>
+#include <misc/array_length.h>
 #include <misc/offset.h>
 #include <misc/dead.h>
 #include <misc/ipv4_proto.h>
 #include <misc/ipv6_proto.h>
 #include <misc/udp_proto.h>
+#include <misc/icmp_proto.h>
+#include <misc/tcp_proto.h>
 #include <misc/byteorder.h>
 #include <misc/balloc.h>
 #include <misc/open_standard_streams.h>
 #include <misc/read_file.h>
+#include <misc/ipaddr.h>
 #include <misc/ipaddr6.h>
 #include <misc/concat_strings.h>
+#include <misc/hashfun.h>
+#include <misc/mempressure.h>
+#include <misc/parse_number.h>
+#include <misc/strdup.h>
+#include <misc/memref.h>
+#include <misc/BRefTarget.h>
 #include <structure/LinkedList1.h>
+#include <structure/BObjectPool.h>
+#include <structure/PrefixTable.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BArena.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
+#include <system/BMetricsExporter.h>
+#include <system/BControlServer.h>
+#include <system/BThreadPlacement.h>
+#ifndef BADVPN_USE_WINAPI
+#include <system/BUnixSignal.h>
+#endif
 #include <system/BAddr.h>
+#include <system/BTime.h>
 #include <system/BNetwork.h>
+#include <system/BConnection.h>
 #include <flow/SinglePacketBuffer.h>
 #include <socksclient/BSocksClient.h>
 #include <tuntap/BTap.h>
@@ -64,13 +87,30 @@
 #include <lwip/ip4_frag.h>
 #include <lwip/nd6.h>
 #include <lwip/ip6_frag.h>
+#include <lwip/custom/mempools.h>
 #include <tun2socks/SocksUdpGwClient.h>
+#include <tun2socks/DirectUdpClient.h>
+#include <dnscache/DnsCache.h>
+#include <fakedns/FakeDns.h>
+#include <resolver/BResolver.h>
 #include <socks_udp_client/SocksUdpClient.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
 #endif
 
+#ifdef BADVPN_USE_BLOG_ASYNC
+#include <base/BLog_async.h>
+#endif
+
+#ifdef BADVPN_LINUX
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
 #include <tun2socks/tun2socks.h>
 
 #include <generated/blog_channel_tun2socks.h>
@@ -103,22 +143,160 @@ struct {
     #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
+    #ifdef BADVPN_USE_BLOG_ASYNC
+    int log_async;
+    #endif
     char *tundev;
+    int tundev_io_reads;
+    int tundev_io_writes;
     char *netif_ipaddr;
     char *netif_netmask;
     char *netif_ip6addr;
-    char *socks_server_addr;
+    char *socks_server_addrs[MAX_SOCKS_SERVERS];
+    int num_socks_server_addrs;
+    int socks_balance;
     char *username;
     char *password;
     char *password_file;
     int append_source_to_username;
     char *udpgw_remote_server_addr;
+    #ifndef BADVPN_USE_WINAPI
+    char *udpgw_remote_server_unix;
+    #endif
+    int udpgw_datagram;
+    int udpgw_icmp;
     int udpgw_max_connections;
     int udpgw_connection_buffer_size;
+    int udpgw_tcp_connections;
+    int udpgw_send_rate;
+    int udpgw_send_burst;
+    int udpgw_codel_target;
+    int udpgw_codel_interval;
     int udpgw_transparent_dns;
     int socks5_udp;
+    int socks5_udp_shared;
+    int udp_direct;
+    int udp_direct_max_flows;
+    int udp_direct_idle_timeout;
+    int socks_fast_open;
+    int socks_pipelined;
+    int socks_early_data;
+    int socks_pool_size;
+    int socks_pool_idle_time;
+    int resolver_cache_time;
+    int dns_cache_size;
+    char *fake_dns_pool;
+    int fake_dns_max_entries;
+    int fake_dns_ttl;
+    char *bypass_file;
+    char *config_file;
+    int max_tcp_clients;
+    int tcp_max_pending;
+    int tcp_accept_rate;
+    int tcp_accept_burst;
+    int tcp_evict_idle;
+    #ifdef BADVPN_LINUX
+    int tun_offload;
+    #endif
+    int tcp_rcv_wnd;
+    int tcp_snd_buf;
+    int tcp_wnd_autotune;
+    int lwip_pool_nums[LWIP_MEMPOOLS_NUM];
+    int lwip_hugepages;
+    size_t memory_limit;
+    int buffer_arena;
+    BThreadPlacement reactor_placement;
+    char *avoid_irq_cpus;
+    #ifdef BADVPN_LINUX
+    int num_workers;
+    #endif
+    #ifndef BADVPN_USE_WINAPI
+    int reactor_stats;
+    #endif
+    int reactor_job_budget_jobs;
+    int reactor_job_budget_us;
+    int reactor_busy_poll_spin_us;
+    int reactor_busy_poll_kernel_us;
+    int reactor_edge_triggered;
+    char *metrics_listen_addr;
+    char *metrics_statsd_addr;
+    int metrics_statsd_interval;
+    #ifndef BADVPN_USE_WINAPI
+    char *control_socket;
+    #endif
 } options;
 
+// SOCKS server selection policy
+enum SocksBalance {SocksBalanceLeastConn, SocksBalanceLatency, SocksBalanceHash};
+
+// SOCKS server with its load and health
+struct socks_server {
+    BAddr addr;
+    int by_name; // connect by resolving name each time, addr is from startup
+    char name[BRESOLVER_NAME_MAX + 1];
+    int num_sessions;
+    int failures;
+    btime_t down_until;
+    btime_t latency; // smoothed handshake time in ms, 0 until known
+};
+
+// SOCKS servers and authentication, with the udpgw server reached through the
+// first server. A reload replaces the current configuration, while sessions and
+// udpgw clients keep a reference to the one they were started with.
+struct socks_config {
+    BRefTarget ref_target;
+    struct socks_server servers[MAX_SOCKS_SERVERS];
+    int num_servers;
+    char *username;
+    char *password;
+    size_t password_len;
+    struct BSocksClient_auth_info auth_info[2];
+    size_t num_auth_info;
+    BAddr udpgw_remote_server_addr; // none if not given
+};
+
+// options which the configuration file can replace, and a reload sets again
+struct reload_options {
+    char *socks_server_addrs[MAX_SOCKS_SERVERS];
+    int num_socks_server_addrs;
+    char *username;
+    char *password;
+    char *password_file;
+    char *udpgw_remote_server_addr;
+};
+
+// udpgw client, with the SOCKS configuration it connects with
+struct udpgw_instance {
+    SocksUdpGwClient client;
+    struct socks_config *config;
+    LinkedList1Node retired_node;
+};
+
+// SOCKS session, either used by a TCP client or waiting in the pool; for a
+// destination bypassing the proxy, a direct connection reporting the same events
+struct socks_session {
+    BSocksClient socks;
+    struct socks_config *config; // only if server is not NULL
+    struct socks_server *server; // NULL if direct
+    btime_t start_time;
+    int handshake_done;
+    int ready;
+    btime_t ready_time;
+    LinkedList1Node pool_node;
+    // direct connection, if server is NULL
+    BConnector direct_connector;
+    BConnection direct_con;
+    int direct_connected;
+    BSocksClient_handler direct_handler;
+    void *direct_user;
+};
+
+// what to do with traffic to a destination, by the bypass table
+enum BypassAction {BypassActionProxy, BypassActionDirect, BypassActionDrop};
+
+// names of the actions in the bypass file; the table values point into this array
+static const char *const bypass_action_names[] = {"proxy", "direct", "drop"};
+
 // TCP client
 struct tcp_client {
     int aborted;
@@ -127,22 +305,51 @@ struct tcp_client {
     BAddr local_addr;
     BAddr remote_addr;
     struct tcp_pcb *pcb;
+    btime_t last_active;
     int client_closed;
-    uint8_t buf[TCP_WND];
+    // statistics for the connection table
+    uint64_t id;
+    btime_t start_time;
+    btime_t socks_up_time; // -1 until SOCKS is up
+    btime_t close_time; // when the first side closed, -1 before
+    uint64_t bytes_up;
+    uint64_t bytes_down;
+    btime_t socks_send_since; // -1 unless a send to SOCKS is in progress
+    btime_t socks_send_blocked;
+    btime_t snd_buf_wait_since; // while socks_recv_waiting
+    btime_t snd_buf_blocked;
+    uint64_t rate_bytes; // bytes each way at rate_time
+    btime_t rate_time;
+    uint64_t rate; // bytes per second, measured up to rate_time
+    struct pbuf *buf_pbuf;
+    int buf_offset;
     int buf_used;
+    int rcv_wnd;
+    int rcv_wnd_filled;
+    int snd_buf;
     char *socks_username;
-    BSocksClient socks_client;
+    struct socks_session *socks;
     int socks_up;
     int socks_closed;
+    int socks_early_taken;
     StreamPassInterface *socks_send_if;
     StreamRecvInterface *socks_recv_if;
-    uint8_t socks_recv_buf[CLIENT_SOCKS_RECV_BUF_SIZE];
+    uint8_t *socks_recv_buf;
+    int socks_recv_buf_class;
     int socks_recv_buf_used;
     int socks_recv_buf_sent;
     int socks_recv_waiting;
     int socks_recv_tcp_pending;
 };
 
+// connection rate of a source, with --tcp-accept-rate
+struct tcp_accept_slot {
+    int used;
+    uint8_t addr[16]; // IPv4 addresses are zero-padded
+    btime_t time;
+    int64_t tokens; // in thousandths of a connection
+};
+
 // IP address of netif
 BIPAddr netif_ipaddr;
 
@@ -152,22 +359,40 @@ BIPAddr netif_netmask;
 // IP6 address of netif
 struct ipv6_addr netif_ip6addr;
 
-// SOCKS server address
-BAddr socks_server_addr;
+// pool of fake DNS addresses
+struct ipv4_ifaddr fake_dns_pool;
+
+// current SOCKS configuration; UDP forwarding always goes through the first server
+struct socks_config *socks_config;
 
-// allocated password file contents
-uint8_t *password_file_contents;
+// reloadable options as given on the command line, which a reload starts from
+struct reload_options cmdline_reload_options;
 
-// SOCKS authentication information
-struct BSocksClient_auth_info socks_auth_info[2];
-size_t socks_num_auth_info;
+// contents of the configuration file, which options point into, if options.config_file
+char *config_file_contents;
 
-// remote udpgw server addr, if provided
-BAddr udpgw_remote_server_addr;
+// metrics export addresses
+BAddr metrics_listen_addr;
+BAddr metrics_statsd_addr;
+
+// bypass table, if options.bypass_file
+int have_bypass;
+PrefixTable bypass_table;
 
 // reactor
 BReactor ss;
 
+// arena for buffers and pools, if options.buffer_arena
+BArena ss_arena;
+
+#ifndef BADVPN_USE_WINAPI
+// signal for dumping reactor statistics, if options.reactor_stats
+BUnixSignal stats_signal;
+
+// signal for reloading the bypass table, if have_bypass
+BUnixSignal bypass_signal;
+#endif
+
 // set to 1 by terminate
 int quitting;
 
@@ -177,20 +402,59 @@ BTap device;
 // device write buffer
 uint8_t *device_write_buf;
 
+// whether packets on the device carry offload headers, and the length of
+// these headers (0 without offloads)
+int device_offload;
+int device_hdr_len;
+
+// TCP segments for the device being merged into one large packet,
+// which the kernel segments again (GSO)
+uint8_t *device_gso_buf;
+int device_gso_len; // 0 if there is no packet
+int device_gso_ip_hdr_len;
+int device_gso_hdr_len;
+int device_gso_seg_size;
+int device_gso_last_seg_len;
+int device_gso_num_segs;
+uint32_t device_gso_next_seq;
+BPending device_gso_flush_job;
+
 // device reading
 SinglePacketBuffer device_read_buffer;
 PacketPassInterface device_read_interface;
 
 // UDP support mode
-enum UdpMode {UdpModeNone, UdpModeUdpgw, UdpModeSocks};
+enum UdpMode {UdpModeNone, UdpModeUdpgw, UdpModeSocks, UdpModeDirect};
 enum UdpMode udp_mode;
 
-// udpgw client
-SocksUdpGwClient udpgw_client;
+// udpgw client for new flows
+struct udpgw_instance *udpgw_current;
 int udp_mtu;
 
-// SOCKS5-UDP client
+// udpgw clients replaced by a reload, which keep serving their flows until
+// these have been idle for a while
+LinkedList1 udpgw_retired;
+BTimer udpgw_retired_timer;
+
+// SOCKS5-UDP client, with the SOCKS configuration it was started with
 SocksUdpClient socks_udp_client;
+struct socks_config *socks_udp_config;
+
+// client for UDP sent directly, if have_bypass or udp_mode==UdpModeDirect
+int have_direct_udp;
+DirectUdpClient direct_udp_client;
+
+// DNS cache
+int have_dns_cache;
+DnsCache dns_cache;
+
+// fake-IP DNS responder
+int have_fake_dns;
+FakeDns fake_dns;
+
+// resolver for SOCKS servers given by name
+int have_resolver;
+BResolver resolver;
 
 // TCP timer
 BTimer tcp_timer;
@@ -209,34 +473,180 @@ struct tcp_pcb *listener;
 // lwip TCP/IPv6 listener
 struct tcp_pcb *listener_ip6;
 
+// SOCKS sessions authenticated in advance, waiting for the CONNECT request
+LinkedList1 socks_pool_connecting;
+LinkedList1 socks_pool_ready; // oldest first
+int socks_pool_num;
+
+// timers for replacing failed and expiring pooled SOCKS sessions
+BTimer socks_pool_refill_timer;
+BTimer socks_pool_expire_timer;
+
 // TCP clients
 LinkedList1 tcp_clients;
 
 // number of clients
 int num_clients;
 
+// pool of client structures
+BObjectPool clients_pool;
+
+// connection rates of sources hashed into slots, if options.tcp_accept_rate>0
+struct tcp_accept_slot *tcp_accept_slots;
+uint64_t tcp_accept_seed;
+
+// connections accepted at the previous buffer statistics
+uint64_t tcp_accepted_last;
+
+// ID of the next client, for the connection table
+uint64_t next_client_id;
+
+// sizes of client receive buffers
+static const int client_buf_sizes[] = {CLIENT_SOCKS_RECV_BUF_IDLE_SIZE, CLIENT_SOCKS_RECV_BUF_SIZE, CLIENT_SOCKS_RECV_BUF_LARGE_SIZE};
+#define CLIENT_BUF_NUM_CLASSES (sizeof(client_buf_sizes) / sizeof(client_buf_sizes[0]))
+
+// unused client receive buffers, linked through their first bytes
+void *client_buf_free[CLIENT_BUF_NUM_CLASSES];
+int client_buf_num_free[CLIENT_BUF_NUM_CLASSES];
+
+// bytes held in client buffers, and the maximum seen
+size_t client_bufs_pinned;
+size_t client_bufs_pinned_max;
+
+// bytes in receive buffers taken from the pool; unlike client_bufs_pinned,
+// this leaves out the pbufs, which lwIP accounts for
+size_t client_bufs_allocated;
+
+// timer for logging buffer statistics
+BTimer client_buf_stats_timer;
+
+// accounted memory and its pressure level, and the timer evicting idle UDP
+// associations under pressure, if options.memory_limit>0
+MemPressure memory_pressure;
+BTimer memory_pressure_timer;
+
+// metrics, and their exporter if options.metrics_listen_addr or options.metrics_statsd_addr
+BMetric metric_tcp_clients;
+BMetric metric_socks_pool_sessions;
+BMetric metric_client_buf_bytes;
+BMetric metric_device_packets_in;
+BMetric metric_device_packets_out;
+BMetric metric_device_bytes_in;
+BMetric metric_device_bytes_out;
+BMetric metric_device_drops_in;
+BMetric metric_device_drops_out;
+BMetric metric_socks_server_failures;
+BMetric metric_socks_handshake_time;
+BMetric metric_tcp_accepted;
+BMetric metric_tcp_refused_rate;
+BMetric metric_tcp_refused_full;
+BMetric metric_tcp_refused_memory;
+BMetric metric_tcp_evicted;
+int have_metrics_exporter;
+BMetricsExporter metrics_exporter;
+
+#ifndef BADVPN_USE_WINAPI
+// control socket, if options.control_socket
+int have_control_server;
+BControlServer control_server;
+#endif
+
+#ifdef BADVPN_LINUX
+static int spawn_workers (int *out_worker);
+#endif
 static void terminate (void);
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
+static int have_udpgw (void);
+static const char * udpgw_remote_server_unix (void);
 static void signal_handler (void *unused);
+#ifndef BADVPN_USE_WINAPI
+static void stats_signal_handler (void *unused, int signo);
+static void bypass_signal_handler (void *unused, int signo);
+#endif
+static int bypass_next_word (MemRef *line, MemRef *out_word);
+static int bypass_parse_line (PrefixTable *table, MemRef line);
+static int bypass_load (PrefixTable *table);
+static void bypass_reload (void);
+static int bypass_lookup (BAddr addr);
 static BAddr baddr_from_lwip (const ip_addr_t *ip_addr, uint16_t port_hostorder);
 static void lwip_init_job_hadler (void *unused);
 static void tcp_timer_handler (void *unused);
+static int lwip_timers_needed (void);
+static void lwip_timers_start (void);
+static uint8_t * client_buf_alloc (int buf_class);
+static void client_buf_release (uint8_t *buf, int buf_class);
+static void client_buf_pin (size_t bytes);
+static void client_buf_unpin (size_t bytes);
+static void client_buf_free_all (void);
+static void client_buf_stats_timer_handler (void *unused);
+static int memory_pressure_update (int may_fall);
+static int memory_pressure_level (void);
+static void memory_pressure_timer_handler (void *unused);
+static void init_metrics (void);
+static void free_metrics (void);
+static int64_t metric_tcp_clients_func (void *unused);
+static int64_t metric_socks_pool_sessions_func (void *unused);
+static int64_t metric_client_buf_bytes_func (void *unused);
+#ifndef BADVPN_USE_WINAPI
+static int control_handler (void *unused, MemRef command, ExpString *reply);
+static int control_connections (MemRef args, ExpString *reply);
+#endif
 static void device_error_handler (void *unused);
 static void device_read_handler_send (void *unused, uint8_t *data, int data_len);
-static int process_device_udp_packet (uint8_t *data, int data_len);
+static int process_device_udp_packet (uint8_t *data, int data_len, int csum_valid);
+static int process_device_icmp_packet (uint8_t *data, int data_len);
+static int tcp_accept_admit (const uint8_t *data, int data_len);
+static void device_send_packet (uint8_t *buf, int packet_len, struct BTap_offload_header *hdr);
+static int device_netif_checksums (int check_tcp);
+static void device_offload_output (struct pbuf *p);
+static int device_gso_can_merge (const uint8_t *hdrs, int ip_hdr_len, int tcp_hdr_len, uint32_t seq, int payload_len);
+static void device_gso_flush (void);
+static void device_gso_flush_job_handler (void *unused);
 static err_t netif_init_func (struct netif *netif);
 static err_t netif_output_func (struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr);
 static err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr);
 static err_t common_netif_output (struct netif *netif, struct pbuf *p);
+static int device_pbuf_chunks (struct pbuf *p, struct BTap_chunk *chunks, int first);
 static err_t netif_input_func (struct pbuf *p, struct netif *inp);
+static void reload_options_get (struct reload_options *ro);
+static void reload_options_set (const struct reload_options *ro);
+static int config_file_load (char **out_contents);
+static struct socks_config * socks_config_create (void);
+static void socks_config_release (BRefTarget *ref_target);
+static int socks_config_udpgw_equal (struct socks_config *c1, struct socks_config *c2);
+static void reload_handler (void *unused);
+static struct udpgw_instance * udpgw_instance_new (struct socks_config *config);
+static void udpgw_instance_free (struct udpgw_instance *u);
+static SocksUdpGwClient * udpgw_client_for_flow (BAddr local_addr, BAddr remote_addr);
+static void udpgw_retired_timer_handler (void *unused);
+static struct socks_server * socks_server_select (struct socks_config *config, BAddr dest_addr);
+static int socks_session_init (struct socks_session *s, BAddr dest_addr, BSocksClient_handler handler, void *user);
+static int socks_session_init_direct (struct socks_session *s, BAddr dest_addr, BSocksClient_handler handler, void *user);
+static void socks_session_free (struct socks_session *s);
+static void socks_session_direct_connector_handler (struct socks_session *s, int is_error);
+static void socks_session_direct_connection_handler (struct socks_session *s, int event);
+static StreamPassInterface * socks_session_get_send_if (struct socks_session *s);
+static StreamRecvInterface * socks_session_get_recv_if (struct socks_session *s);
+static int socks_session_send_early (struct socks_session *s, const uint8_t *data, int data_len);
+static void socks_session_account (struct socks_session *s, int event);
+static void socks_pool_fill (void);
+static struct socks_session * socks_pool_take (BAddr dest_addr);
+static void socks_pool_remove (struct socks_session *s);
+static void socks_pool_free_all (void);
+static void socks_pool_session_handler (struct socks_session *s, int event);
+static void socks_pool_refill_timer_handler (void *unused);
+static void socks_pool_expire_timer_handler (void *unused);
 static void client_logfunc (struct tcp_client *client);
 static void client_log (struct tcp_client *client, int level, const char *fmt, ...);
 static err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err);
+static int client_evict_idle (void);
+static void client_touch (struct tcp_client *client);
 static void client_handle_freed_client (struct tcp_client *client);
 static void client_free_client (struct tcp_client *client);
+static void client_log_tcp_stats (struct tcp_client *client);
 static void client_abort_client (struct tcp_client *client);
 static void client_abort_pcb (struct tcp_client *client);
 static void client_free_socks (struct tcp_client *client);
@@ -246,12 +656,46 @@ static void client_err_func (void *arg, err_t err);
 static err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static void client_socks_handler (struct tcp_client *client, int event);
 static void client_send_to_socks (struct tcp_client *client);
+static void client_send_early_to_socks (struct tcp_client *client);
+static void client_buf_advance (struct tcp_client *client, int len);
+static void client_open_rcv_wnd (struct tcp_client *client, int len);
+static void client_confirm_data (struct tcp_client *client, int len);
+static void client_confirm_data (struct tcp_client *client, int len)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(len >= 0)
+    
+    int base_wnd = bmin_int(options.tcp_rcv_wnd, TCP_WND_MAX(client->pcb));
+    
+    if (memory_pressure_level() >= MEMPRESSURE_LEVEL_SHRINK) {
+        // keep the window of confirmed data closed, shrinking the window
+        // down to a minimum, so that the client has less data in flight
+        int min_wnd = bmin_int(MEMORY_SHRINK_MIN_RCV_WND, base_wnd);
+        int shrink = bmax_int(0, bmin_int(len, client->rcv_wnd - min_wnd));
+        client->rcv_wnd -= shrink;
+        len -= shrink;
+    }
+    else if (client->rcv_wnd < base_wnd) {
+        // the pressure is gone, give back the window taken away
+        client_log(client, BLOG_DEBUG, "receive window %d -> %d", client->rcv_wnd, base_wnd);
+        len += base_wnd - client->rcv_wnd;
+        client->rcv_wnd = base_wnd;
+    }
+    
+    client_open_rcv_wnd(client, len);
+}
+
+void client_grow_rcv_wnd (struct tcp_client *client);
+static void client_grow_snd_buf (struct tcp_client *client);
 static void client_socks_send_handler_done (struct tcp_client *client, int data_len);
 static void client_socks_recv_initiate (struct tcp_client *client);
+static void client_socks_recv_resize (struct tcp_client *client, int last_len);
 static void client_socks_recv_handler_done (struct tcp_client *client, int data_len);
 static int client_socks_recv_send_out (struct tcp_client *client);
 static err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len);
 static void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void udp_write_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void icmp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
 int main (int argc, char **argv)
 {
@@ -307,10 +751,21 @@ int main (int argc, char **argv)
         }
     }
     
+    #ifdef BADVPN_USE_BLOG_ASYNC
+    // make logging asynchronous
+    if (options.log_async && !BLog_StartAsync()) {
+        BLog(BLOG_WARNING, "failed to start asynchronous logging");
+    }
+    #endif
+    
     BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
     
-    // clear password contents pointer
-    password_file_contents = NULL;
+    // set no SOCKS configuration and configuration file contents
+    socks_config = NULL;
+    config_file_contents = NULL;
+    
+    // set no bypass table
+    have_bypass = 0;
     
     // initialize network
     if (!BNetwork_GlobalInit()) {
@@ -324,6 +779,25 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    int worker_index = 0;
+    
+#ifdef BADVPN_LINUX
+    // In multi-worker mode, fork the workers here. Each worker continues below
+    // with its own reactor, TUN queue and lwIP stack; the parent only
+    // supervises them and returns from spawn_workers when they are all gone.
+    if (options.num_workers > 1) {
+        if (!spawn_workers(&worker_index)) {
+            goto fail1;
+        }
+        if (worker_index < 0) {
+            goto fail1;
+        }
+    }
+#endif
+    
+    // place the reactor thread, before it allocates anything
+    BThreadPlacement_Apply(&options.reactor_placement, worker_index, "reactor");
+    
     // init time
     BTime_Init();
     
@@ -333,6 +807,21 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    // allocate buffers of the reactor's objects from an arena
+    if (options.buffer_arena) {
+        BArena_Init(&ss_arena, options.buffer_arena);
+        BPendingGroup_SetArena(BReactor_PendingGroup(&ss), &ss_arena);
+    }
+    
+    // bound how long jobs may run before timers and I/O get a turn
+    BReactor_SetJobBudget(&ss, options.reactor_job_budget_jobs, options.reactor_job_budget_us);
+    
+    // spin for events before sleeping, if asked to
+    BReactor_SetBusyPoll(&ss, options.reactor_busy_poll_spin_us, options.reactor_busy_poll_kernel_us);
+    
+    // register sockets edge-triggered, if asked to
+    BReactor_SetEdgeTriggered(&ss, options.reactor_edge_triggered);
+    
     // set not quitting
     quitting = 0;
     
@@ -342,12 +831,60 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
+#ifndef BADVPN_USE_WINAPI
+    // enable reactor statistics, dumped on SIGUSR1
+    if (options.reactor_stats) {
+        if (!BReactor_EnableStats(&ss)) {
+            BLog(BLOG_ERROR, "BReactor_EnableStats failed");
+            goto fail2a;
+        }
+        
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGUSR1);
+        if (!BUnixSignal_Init(&stats_signal, &ss, sigs, stats_signal_handler, NULL)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            goto fail2a;
+        }
+    }
+    
+    // reload the bypass table on SIGUSR2
+    if (have_bypass) {
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGUSR2);
+        if (!BUnixSignal_Init(&bypass_signal, &ss, sigs, bypass_signal_handler, NULL)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            goto fail2b;
+        }
+    }
+#endif
+    
     // init TUN device
-    if (!BTap_Init(&device, &ss, options.tundev, device_error_handler, NULL, 1)) {
-        BLog(BLOG_ERROR, "BTap_Init failed");
+    struct BTap_init_data tap_init_data;
+    tap_init_data.dev_type = BTAP_DEV_TUN;
+    tap_init_data.init_type = BTAP_INIT_STRING;
+    tap_init_data.flags = 0;
+    tap_init_data.recv_batch = options.tundev_io_reads;
+    tap_init_data.send_queue = options.tundev_io_writes;
+    tap_init_data.init.string = options.tundev;
+#ifdef BADVPN_LINUX
+    if (options.num_workers > 1) {
+        tap_init_data.flags |= BTAP_INIT_FLAG_MULTI_QUEUE;
+    }
+    if (options.tun_offload) {
+        tap_init_data.flags |= BTAP_INIT_FLAG_OFFLOAD;
+    }
+#endif
+    if (!BTap_Init2(&device, &ss, tap_init_data, device_error_handler, NULL)) {
+        BLog(BLOG_ERROR, "BTap_Init2 failed");
         goto fail3;
     }
     
+    // remember if packets come with offload headers
+    device_offload = !!(tap_init_data.flags & BTAP_INIT_FLAG_OFFLOAD);
+    device_hdr_len = device_offload ? sizeof(struct BTap_offload_header) : 0;
+    
     // NOTE: the order of the following is important:
     // first device writing must evaluate,
     // then lwip (so it can send packets to the device),
@@ -362,9 +899,9 @@ int main (int argc, char **argv)
     
     // Compute the largest possible UDP payload that we can receive from or send to the
     // TUN device.
-    udp_mtu = BTap_GetMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header));
+    udp_mtu = BTap_GetLinkMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header));
     if (options.netif_ip6addr) {
-        int udp_ip6_mtu = BTap_GetMTU(&device) - (int)(sizeof(struct ipv6_header) + sizeof(struct udp_header));
+        int udp_ip6_mtu = BTap_GetLinkMTU(&device) - (int)(sizeof(struct ipv6_header) + sizeof(struct udp_header));
         if (udp_mtu < udp_ip6_mtu) {
             udp_mtu = udp_ip6_mtu;
         }
@@ -373,7 +910,7 @@ int main (int argc, char **argv)
         udp_mtu = 0;
     }
 
-    if (options.udpgw_remote_server_addr) {
+    if (have_udpgw()) {
         udp_mode = UdpModeUdpgw;
 
         // make sure our UDP payloads aren't too large for udpgw
@@ -384,25 +921,88 @@ int main (int argc, char **argv)
         }
         
         // init udpgw client
-        if (!SocksUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS,
-            options.udpgw_connection_buffer_size, UDPGW_KEEPALIVE_TIME, socks_server_addr,
-            socks_auth_info, socks_num_auth_info, udpgw_remote_server_addr,
-            UDPGW_RECONNECT_TIME, &ss, NULL, udp_send_packet_to_device))
-        {
-            BLog(BLOG_ERROR, "SocksUdpGwClient_Init failed");
+        if (!(udpgw_current = udpgw_instance_new(socks_config))) {
             goto fail4a;
         }
+        
+        // init list of udpgw clients replaced by a reload
+        LinkedList1_Init(&udpgw_retired);
+        BTimer_Init(&udpgw_retired_timer, UDPGW_RETIRED_CHECK_TIME, udpgw_retired_timer_handler, NULL);
     } else if (options.socks5_udp) {
         udp_mode = UdpModeSocks;
+        
+        // keep the SOCKS configuration, which the client refers to
+        if (!BRefTarget_Ref(&socks_config->ref_target)) {
+            BLog(BLOG_ERROR, "BRefTarget_Ref failed");
+            goto fail4a;
+        }
+        socks_udp_config = socks_config;
 
         // init SOCKS UDP client
-        SocksUdpClient_Init(&socks_udp_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS,
-            SOCKS_UDP_SEND_BUFFER_PACKETS, UDPGW_KEEPALIVE_TIME, socks_server_addr,
-            socks_auth_info, socks_num_auth_info, &ss, NULL, udp_send_packet_to_device);
+        if (!SocksUdpClient_Init(&socks_udp_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS,
+            SOCKS_UDP_SEND_BUFFER_PACKETS, UDPGW_KEEPALIVE_TIME, options.socks5_udp_shared, socks_udp_config->servers[0].addr,
+            socks_udp_config->auth_info, socks_udp_config->num_auth_info, &ss, NULL, udp_send_packet_to_device))
+        {
+            BLog(BLOG_ERROR, "SocksUdpClient_Init failed");
+            BRefTarget_Deref(&socks_udp_config->ref_target);
+            goto fail4a;
+        }
+    } else if (options.udp_direct) {
+        // all UDP goes out through direct_udp_client
+        udp_mode = UdpModeDirect;
     } else {
         udp_mode = UdpModeNone;
     }
     
+    // init DNS cache
+    have_dns_cache = 0;
+    if (udp_mode != UdpModeNone && options.dns_cache_size > 0) {
+        if (!DnsCache_Init(&dns_cache, options.dns_cache_size, udp_mtu, udp_write_packet_to_device, NULL)) {
+            BLog(BLOG_ERROR, "DnsCache_Init failed");
+            goto fail4b;
+        }
+        have_dns_cache = 1;
+    }
+    
+    // init direct UDP client for bypassed destinations, or for everything
+    have_direct_udp = (have_bypass || udp_mode == UdpModeDirect);
+    if (have_direct_udp) {
+        if (!DirectUdpClient_Init(&direct_udp_client, udp_mtu, options.udp_direct_max_flows, DIRECT_UDP_SEND_BUFFER_PACKETS,
+            options.udp_direct_idle_timeout, &ss, NULL, udp_send_packet_to_device))
+        {
+            BLog(BLOG_ERROR, "DirectUdpClient_Init failed");
+            goto fail4c;
+        }
+    }
+    
+    // init fake-IP DNS responder
+    have_fake_dns = 0;
+    if (options.fake_dns_pool) {
+        if (!FakeDns_Init(&fake_dns, fake_dns_pool.addr, fake_dns_pool.prefix, options.fake_dns_max_entries,
+            options.fake_dns_ttl, udp_write_packet_to_device, NULL))
+        {
+            BLog(BLOG_ERROR, "FakeDns_Init failed");
+            goto fail4d;
+        }
+        have_fake_dns = 1;
+    }
+    
+    // init resolver if a SOCKS server is given by name
+    have_resolver = 0;
+    for (int i = 0; i < socks_config->num_servers; i++) {
+        have_resolver |= socks_config->servers[i].by_name;
+    }
+    if (have_resolver && !BResolver_Init(&resolver, &ss, -1, MAX_SOCKS_SERVERS, options.resolver_cache_time)) {
+        BLog(BLOG_ERROR, "BResolver_Init failed");
+        goto fail4e;
+    }
+    
+    // init lwip memory pools
+    if (!lwip_mempools_init(options.lwip_pool_nums, options.lwip_hugepages)) {
+        BLog(BLOG_ERROR, "lwip_mempools_init failed");
+        goto fail4f;
+    }
+    
     // init lwip init job
     BPending_Init(&lwip_init_job, BReactor_PendingGroup(&ss), lwip_init_job_hadler, NULL);
     BPending_Set(&lwip_init_job);
@@ -413,6 +1013,53 @@ int main (int argc, char **argv)
         goto fail5;
     }
     
+    // init merging of TCP segments for the device
+    device_gso_buf = NULL;
+    device_gso_len = 0;
+    if (device_offload) {
+        if (!(device_gso_buf = (uint8_t *)BAlloc(BTap_GetMTU(&device)))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            goto fail6;
+        }
+    }
+    BPending_Init(&device_gso_flush_job, BReactor_PendingGroup(&ss), device_gso_flush_job_handler, NULL);
+    
+    // init connection rates of sources
+    tcp_accept_slots = NULL;
+    if (options.tcp_accept_rate > 0) {
+        if (!(tcp_accept_slots = (struct tcp_accept_slot *)BAllocArray(TCP_ACCEPT_RATE_SLOTS, sizeof(tcp_accept_slots[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail6a;
+        }
+        for (int i = 0; i < TCP_ACCEPT_RATE_SLOTS; i++) {
+            tcp_accept_slots[i].used = 0;
+        }
+        tcp_accept_seed = badvpn_hash_seed();
+    }
+    tcp_accepted_last = 0;
+    
+    // init metrics
+    init_metrics();
+    
+    // init metrics exporter
+    have_metrics_exporter = (options.metrics_listen_addr || options.metrics_statsd_addr);
+    if (have_metrics_exporter) {
+        if (!BMetricsExporter_Init(&metrics_exporter, &ss, !!options.metrics_listen_addr, metrics_listen_addr,
+                                   !!options.metrics_statsd_addr, metrics_statsd_addr, options.metrics_statsd_interval)) {
+            BLog(BLOG_ERROR, "BMetricsExporter_Init failed");
+            goto fail7;
+        }
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // init control socket
+    have_control_server = !!options.control_socket;
+    if (have_control_server && !BControlServer_Init(&control_server, options.control_socket, &ss, NULL, control_handler)) {
+        BLog(BLOG_ERROR, "BControlServer_Init failed");
+        goto fail7a;
+    }
+    #endif
+    
     // init TCP timer
     // it won't trigger before lwip is initialized, becuase the lwip init is a job
     BTimer_Init(&tcp_timer, TCP_TMR_INTERVAL, tcp_timer_handler, NULL);
@@ -431,6 +1078,43 @@ int main (int argc, char **argv)
     
     // init number of clients
     num_clients = 0;
+    next_client_id = 0;
+    
+    // init clients pool
+    BObjectPool_InitArena(&clients_pool, sizeof(struct tcp_client), CLIENT_POOL_SLAB_SIZE, options.max_tcp_clients, BPendingGroup_Arena(BReactor_PendingGroup(&ss)));
+    
+    // init client buffer pool
+    for (int i = 0; i < CLIENT_BUF_NUM_CLASSES; i++) {
+        client_buf_free[i] = NULL;
+        client_buf_num_free[i] = 0;
+    }
+    client_bufs_pinned = 0;
+    client_bufs_pinned_max = 0;
+    client_bufs_allocated = 0;
+    
+    // init client buffer statistics timer
+    BTimer_Init(&client_buf_stats_timer, CLIENT_BUF_STATS_INTERVAL, client_buf_stats_timer_handler, NULL);
+    BReactor_SetTimer(&ss, &client_buf_stats_timer);
+    
+    // init memory accounting
+    MemPressure_Init(&memory_pressure, options.memory_limit);
+    BTimer_Init(&memory_pressure_timer, MEMORY_PRESSURE_INTERVAL, memory_pressure_timer_handler, NULL);
+    if (options.memory_limit > 0) {
+        BReactor_SetTimer(&ss, &memory_pressure_timer);
+    }
+    
+    // init SOCKS session pool
+    LinkedList1_Init(&socks_pool_connecting);
+    LinkedList1_Init(&socks_pool_ready);
+    socks_pool_num = 0;
+    BTimer_Init(&socks_pool_refill_timer, SOCKS_POOL_RETRY_TIME, socks_pool_refill_timer_handler, NULL);
+    BTimer_Init(&socks_pool_expire_timer, 0, socks_pool_expire_timer_handler, NULL);
+    
+    // start authenticating pooled SOCKS sessions
+    socks_pool_fill();
+    
+    // reload the configuration on SIGHUP, instead of terminating
+    BSignal_SetHangupHandler(reload_handler, NULL);
     
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
@@ -443,6 +1127,19 @@ int main (int argc, char **argv)
         client_murder(client);
     }
     
+    // free SOCKS session pool
+    socks_pool_free_all();
+    
+    // free memory accounting
+    BReactor_RemoveTimer(&ss, &memory_pressure_timer);
+    
+    // free client buffer pool
+    BReactor_RemoveTimer(&ss, &client_buf_stats_timer);
+    client_buf_free_all();
+    
+    // free clients pool
+    BObjectPool_Free(&clients_pool);
+    
     // free listener
     if (listener_ip6) {
         tcp_close(listener_ip6);
@@ -457,13 +1154,58 @@ int main (int argc, char **argv)
     }
     
     BReactor_RemoveTimer(&ss, &tcp_timer);
+    
+    #ifndef BADVPN_USE_WINAPI
+    // free control socket
+    if (have_control_server) {
+        BControlServer_Free(&control_server);
+    }
+fail7a:
+    #endif
+    // free metrics exporter
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+    }
+fail7:
+    free_metrics();
+    BFree(tcp_accept_slots);
+fail6a:
+    BPending_Free(&device_gso_flush_job);
+    BFree(device_gso_buf);
+fail6:
     BFree(device_write_buf);
 fail5:
     BPending_Free(&lwip_init_job);
+    lwip_mempools_free();
+fail4f:
+    if (have_resolver) {
+        BResolver_Free(&resolver);
+    }
+fail4e:
+    if (have_fake_dns) {
+        FakeDns_Free(&fake_dns);
+    }
+fail4d:
+    if (have_direct_udp) {
+        DirectUdpClient_Free(&direct_udp_client);
+    }
+fail4c:
+    if (have_dns_cache) {
+        DnsCache_Free(&dns_cache);
+    }
+fail4b:
     if (udp_mode == UdpModeUdpgw) {
-        SocksUdpGwClient_Free(&udpgw_client);
+        BReactor_RemoveTimer(&ss, &udpgw_retired_timer);
+        LinkedList1Node *rnode;
+        while ((rnode = LinkedList1_GetFirst(&udpgw_retired))) {
+            struct udpgw_instance *u = UPPER_OBJECT(rnode, struct udpgw_instance, retired_node);
+            LinkedList1_Remove(&udpgw_retired, &u->retired_node);
+            udpgw_instance_free(u);
+        }
+        udpgw_instance_free(udpgw_current);
     } else if (udp_mode == UdpModeSocks) {
         SocksUdpClient_Free(&socks_udp_client);
+        BRefTarget_Deref(&socks_udp_config->ref_target);
     }
 fail4a:
     SinglePacketBuffer_Free(&device_read_buffer);
@@ -471,11 +1213,31 @@ fail4:
     PacketPassInterface_Free(&device_read_interface);
     BTap_Free(&device);
 fail3:
+#ifndef BADVPN_USE_WINAPI
+    if (have_bypass) {
+        BUnixSignal_Free(&bypass_signal, 0);
+    }
+fail2b:
+    if (options.reactor_stats) {
+        BReactor_LogStats(&ss, BLOG_NOTICE, 0);
+        BUnixSignal_Free(&stats_signal, 0);
+    }
+fail2a:
+#endif
     BSignal_Finish();
 fail2:
+    if (options.buffer_arena) {
+        BArena_Free(&ss_arena);
+    }
     BReactor_Free(&ss);
 fail1:
-    BFree(password_file_contents);
+    if (socks_config) {
+        BRefTarget_Deref(&socks_config->ref_target);
+    }
+    free(config_file_contents);
+    if (have_bypass) {
+        PrefixTable_Free(&bypass_table);
+    }
     BLog(BLOG_NOTICE, "exiting");
     BLog_Free();
 fail0:
@@ -484,6 +1246,131 @@ fail0:
     return 1;
 }
 
+#ifdef BADVPN_LINUX
+
+int spawn_workers (int *out_worker)
+{
+    ASSERT(options.num_workers > 1)
+    
+    // The lwIP stack and all of our state are process-global, so each worker
+    // is a separate process. Block the signals we care about so that we can
+    // wait for them synchronously, and so that children don't receive them
+    // before they've installed their own handler.
+    sigset_t sset;
+    sigemptyset(&sset);
+    sigaddset(&sset, SIGINT);
+    sigaddset(&sset, SIGTERM);
+    sigaddset(&sset, SIGCHLD);
+    sigaddset(&sset, SIGHUP);
+    if (options.bypass_file) {
+        sigaddset(&sset, SIGUSR2);
+    }
+    sigset_t sset_old;
+    if (sigprocmask(SIG_BLOCK, &sset, &sset_old) < 0) {
+        BLog(BLOG_ERROR, "sigprocmask failed");
+        return 0;
+    }
+    
+    pid_t *pids = (pid_t *)BAllocArray(options.num_workers, sizeof(pids[0]));
+    if (!pids) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    int num_running = 0;
+    int stopping = 0;
+    int signalled = 0;
+    
+    // don't let the workers inherit and repeat buffered log output
+    fflush(NULL);
+    
+    for (int i = 0; i < options.num_workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            BLog(BLOG_ERROR, "fork failed");
+            stopping = 1;
+            break;
+        }
+        
+        if (pid == 0) {
+            // this is a worker; move it out of our process group so that terminal
+            // signals only reach the supervisor, which forwards them exactly once
+            setpgid(0, 0);
+            BFree(pids);
+            sigprocmask(SIG_SETMASK, &sset_old, NULL);
+            BLog(BLOG_NOTICE, "worker %d started", i);
+            *out_worker = i;
+            return 1;
+        }
+        
+        pids[num_running++] = pid;
+    }
+    
+    if (!stopping) {
+        BLog(BLOG_NOTICE, "started %d workers", num_running);
+    }
+    
+    while (num_running > 0) {
+        if (stopping && !signalled) {
+            for (int i = 0; i < num_running; i++) {
+                kill(pids[i], SIGTERM);
+            }
+            signalled = 1;
+        }
+        
+        int signo;
+        if (sigwait(&sset, &signo) != 0) {
+            BLog(BLOG_ERROR, "sigwait failed");
+            continue;
+        }
+        
+        if (signo == SIGINT || signo == SIGTERM) {
+            if (!stopping) {
+                BLog(BLOG_NOTICE, "termination requested");
+                stopping = 1;
+            }
+            continue;
+        }
+        
+        // have every worker reload its configuration or bypass table
+        if (signo == SIGHUP || signo == SIGUSR2) {
+            for (int i = 0; i < num_running; i++) {
+                kill(pids[i], signo);
+            }
+            continue;
+        }
+        
+        // reap exited workers
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < num_running; i++) {
+                if (pids[i] == pid) {
+                    pids[i] = pids[--num_running];
+                    break;
+                }
+            }
+            
+            // a worker exiting on its own brings down the whole gateway
+            if (!stopping) {
+                BLog(BLOG_ERROR, "worker %"PRIiMAX" exited unexpectedly", (intmax_t)pid);
+                stopping = 1;
+            }
+        }
+    }
+    
+    BFree(pids);
+    sigprocmask(SIG_SETMASK, &sset_old, NULL);
+    *out_worker = -1;
+    return 1;
+    
+fail0:
+    sigprocmask(SIG_SETMASK, &sset_old, NULL);
+    return 0;
+}
+
+#endif
+
 void terminate (void)
 {
     ASSERT(!quitting)
@@ -513,21 +1400,84 @@ void print_help (const char *name)
         #endif
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
+        #ifdef BADVPN_USE_BLOG_ASYNC
+        "        [--log-async]\n"
+        #endif
         "        [--tundev <name>]\n"
+        "        [--tundev-io-depth <reads> <writes>]\n"
         "        --netif-ipaddr <ipaddr>\n"
         "        --netif-netmask <ipnetmask>\n"
-        "        --socks-server-addr <addr>\n"
+        "        --socks-server-addr <addr> ...\n"
+        "        [--socks-balance <least-conn/latency/hash>]\n"
         "        [--netif-ip6addr <addr>]\n"
         "        [--username <username>]\n"
         "        [--password <password>]\n"
         "        [--password-file <file>]\n"
         "        [--append-source-to-username]\n"
         "        [--udpgw-remote-server-addr <addr>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--udpgw-remote-server-unix <socket path>]\n"
+        #endif
+        "        [--udpgw-datagram]\n"
+        "        [--udpgw-icmp]\n"
         "        [--udpgw-max-connections <number>]\n"
         "        [--udpgw-connection-buffer-size <number>]\n"
+        "        [--udpgw-tcp-connections <number>]\n"
+        "        [--udpgw-send-rate <bytes-per-second>]\n"
+        "        [--udpgw-send-burst <bytes>]\n"
+        "        [--udpgw-codel-target <ms>]\n"
+        "        [--udpgw-codel-interval <ms>]\n"
         "        [--udpgw-transparent-dns]\n"
         "        [--socks5-udp]\n"
-        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        "        [--socks5-udp-shared]\n"
+        "        [--udp-direct]\n"
+        "        [--udp-direct-max-flows <number>]\n"
+        "        [--udp-direct-idle-timeout <ms>]\n"
+        "        [--socks-fast-open]\n"
+        "        [--socks-pipelined]\n"
+        "        [--socks-early-data]\n"
+        "        [--socks-pool-size <number>]\n"
+        "        [--socks-pool-idle-time <ms>]\n"
+        "        [--resolver-cache-time <ms>]\n"
+        "        [--dns-cache-size <entries>]\n"
+        "        [--fake-dns-pool <ipaddr/prefix>]\n"
+        "        [--fake-dns-max-entries <number>]\n"
+        "        [--fake-dns-ttl <seconds>]\n"
+        "        [--bypass-file <file>]\n"
+        "        [--config-file <file>]\n"
+        "        [--max-tcp-clients <number>]\n"
+        "        [--tcp-max-pending <number>]\n"
+        "        [--tcp-accept-rate <connections/s> [--tcp-accept-burst <connections>]]\n"
+        "        [--tcp-evict-idle <ms>]\n"
+        "        [--tcp-rcv-wnd <bytes>]\n"
+        "        [--tcp-snd-buf <bytes>]\n"
+        "        [--tcp-wnd-autotune <max bytes>]\n"
+        "        [--lwip-pbufs <number>]\n"
+        "        [--lwip-tcp-segs <number>]\n"
+        "        [--lwip-tcp-pcbs <number>]\n"
+        "        [--lwip-hugepages]\n"
+        "        [--buffer-arena <normal/thp/hugetlb>]\n"
+        "        [--reactor-cpus <cpu list>]\n"
+        "        [--reactor-sched <nice:N / fifo:P>]\n"
+        "        [--avoid-irq-cpus <ifname>]\n"
+        "        [--memory-limit <bytes>]\n"
+        #ifdef BADVPN_LINUX
+        "        [--num-workers <number>]\n"
+        "        [--tun-offload]\n"
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        "        [--reactor-stats]\n"
+        #endif
+        "        [--reactor-job-budget <jobs / 0> <microseconds / 0>]\n"
+        "        [--reactor-busy-poll <spin microseconds / 0> <kernel microseconds / 0>]\n"
+        "        [--reactor-edge-triggered]\n"
+        "        [--metrics-listen-addr <addr>]\n"
+        "        [--metrics-statsd-addr <addr> [--metrics-statsd-interval <ms>]]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--control-socket <socket path>]\n"
+        #endif
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n"
+        "SIGHUP reloads the configuration file, password file and bypass file for new connections.\n",
         name
     );
 }
@@ -554,20 +1504,88 @@ int parse_arguments (int argc, char *argv[])
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
     }
+    #ifdef BADVPN_USE_BLOG_ASYNC
+    options.log_async = 0;
+    #endif
     options.tundev = NULL;
+    options.tundev_io_reads = DEVICE_RECV_BATCH;
+    options.tundev_io_writes = DEVICE_SEND_QUEUE;
     options.netif_ipaddr = NULL;
     options.netif_netmask = NULL;
     options.netif_ip6addr = NULL;
-    options.socks_server_addr = NULL;
+    options.num_socks_server_addrs = 0;
+    options.socks_balance = SocksBalanceLeastConn;
     options.username = NULL;
     options.password = NULL;
     options.password_file = NULL;
     options.append_source_to_username = 0;
     options.udpgw_remote_server_addr = NULL;
+    #ifndef BADVPN_USE_WINAPI
+    options.udpgw_remote_server_unix = NULL;
+    #endif
+    options.udpgw_datagram = 0;
+    options.udpgw_icmp = 0;
     options.udpgw_max_connections = DEFAULT_UDPGW_MAX_CONNECTIONS;
     options.udpgw_connection_buffer_size = DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE;
+    options.udpgw_tcp_connections = DEFAULT_UDPGW_TCP_CONNECTIONS;
+    options.udpgw_send_rate = 0;
+    options.udpgw_send_burst = 0;
+    options.udpgw_codel_target = 0;
+    options.udpgw_codel_interval = DEFAULT_UDPGW_CODEL_INTERVAL;
     options.udpgw_transparent_dns = 0;
     options.socks5_udp = 0;
+    options.socks5_udp_shared = 0;
+    options.udp_direct = 0;
+    options.udp_direct_max_flows = -1;
+    options.udp_direct_idle_timeout = DIRECT_UDP_KEEPALIVE_TIME;
+    options.socks_fast_open = 0;
+    options.socks_pipelined = 0;
+    options.socks_early_data = 0;
+    options.socks_pool_size = 0;
+    options.socks_pool_idle_time = SOCKS_POOL_DEFAULT_IDLE_TIME;
+    options.resolver_cache_time = DEFAULT_RESOLVER_CACHE_TIME;
+    options.dns_cache_size = 0;
+    options.fake_dns_pool = NULL;
+    options.fake_dns_max_entries = DEFAULT_FAKE_DNS_MAX_ENTRIES;
+    options.fake_dns_ttl = DEFAULT_FAKE_DNS_TTL;
+    options.bypass_file = NULL;
+    options.config_file = NULL;
+    options.max_tcp_clients = -1;
+    options.tcp_max_pending = DEFAULT_TCP_MAX_PENDING;
+    options.tcp_accept_rate = 0;
+    options.tcp_accept_burst = 0;
+    options.tcp_evict_idle = -1;
+    options.tcp_rcv_wnd = DEFAULT_TCP_RCV_WND;
+    options.tcp_snd_buf = DEFAULT_TCP_SND_BUF;
+    options.tcp_wnd_autotune = 0;
+    options.lwip_pool_nums[LWIP_MEMPOOLS_PBUF] = DEFAULT_LWIP_POOL_PBUFS;
+    options.lwip_pool_nums[LWIP_MEMPOOLS_TCP_SEG] = DEFAULT_LWIP_POOL_TCP_SEGS;
+    options.lwip_pool_nums[LWIP_MEMPOOLS_TCP_PCB] = DEFAULT_LWIP_POOL_TCP_PCBS;
+    options.lwip_hugepages = 0;
+    options.buffer_arena = 0;
+    BThreadPlacement_Init(&options.reactor_placement);
+    options.avoid_irq_cpus = NULL;
+    options.memory_limit = 0;
+    #ifdef BADVPN_LINUX
+    options.num_workers = 1;
+    options.tun_offload = 0;
+    #endif
+    #ifndef BADVPN_USE_WINAPI
+    options.reactor_stats = 0;
+    #endif
+    options.reactor_job_budget_jobs = 0;
+    options.reactor_job_budget_us = 0;
+    options.reactor_busy_poll_spin_us = 0;
+    options.reactor_busy_poll_kernel_us = 0;
+    options.reactor_edge_triggered = 0;
+    options.metrics_listen_addr = NULL;
+    options.metrics_statsd_addr = NULL;
+    options.metrics_statsd_interval = BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL;
+    #ifndef BADVPN_USE_WINAPI
+    options.control_socket = NULL;
+    #endif
+    
+    int have_metrics_statsd_interval = 0;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -616,6 +1634,11 @@ int parse_arguments (int argc, char *argv[])
             i++;
         }
         #endif
+        #ifdef BADVPN_USE_BLOG_ASYNC
+        else if (!strcmp(arg, "--log-async")) {
+            options.log_async = 1;
+        }
+        #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -653,6 +1676,21 @@ int parse_arguments (int argc, char *argv[])
             options.tundev = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--tundev-io-depth")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.tundev_io_reads = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.tundev_io_writes = atoi(argv[i + 2])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
         else if (!strcmp(arg, "--netif-ipaddr")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -682,7 +1720,33 @@ int parse_arguments (int argc, char *argv[])
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            options.socks_server_addr = argv[i + 1];
+            if (options.num_socks_server_addrs == MAX_SOCKS_SERVERS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.socks_server_addrs[options.num_socks_server_addrs] = argv[i + 1];
+            options.num_socks_server_addrs++;
+            i++;
+        }
+        else if (!strcmp(arg, "--socks-balance")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            char *arg2 = argv[i + 1];
+            if (!strcmp(arg2, "least-conn")) {
+                options.socks_balance = SocksBalanceLeastConn;
+            }
+            else if (!strcmp(arg2, "latency")) {
+                options.socks_balance = SocksBalanceLatency;
+            }
+            else if (!strcmp(arg2, "hash")) {
+                options.socks_balance = SocksBalanceHash;
+            }
+            else {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
             i++;
         }
         else if (!strcmp(arg, "--username")) {
@@ -720,6 +1784,22 @@ int parse_arguments (int argc, char *argv[])
             options.udpgw_remote_server_addr = argv[i + 1];
             i++;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--udpgw-remote-server-unix")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.udpgw_remote_server_unix = argv[i + 1];
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--udpgw-datagram")) {
+            options.udpgw_datagram = 1;
+        }
+        else if (!strcmp(arg, "--udpgw-icmp")) {
+            options.udpgw_icmp = 1;
+        }
         else if (!strcmp(arg, "--udpgw-max-connections")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -742,544 +1822,3155 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--udpgw-tcp-connections")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_tcp_connections = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udpgw-send-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_send_rate = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udpgw-send-burst")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_send_burst = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udpgw-codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_codel_target = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udpgw-codel-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_codel_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--udpgw-transparent-dns")) {
             options.udpgw_transparent_dns = 1;
         }
         else if (!strcmp(arg, "--socks5-udp")) {
             options.socks5_udp = 1;
         }
-        else {
-            fprintf(stderr, "unknown option: %s\n", arg);
-            return 0;
+        else if (!strcmp(arg, "--socks5-udp-shared")) {
+            options.socks5_udp_shared = 1;
         }
-    }
-    
-    if (options.help || options.version) {
-        return 1;
-    }
-    
-    if (!options.netif_ipaddr) {
-        fprintf(stderr, "--netif-ipaddr is required\n");
-        return 0;
-    }
-    
-    if (!options.netif_netmask) {
-        fprintf(stderr, "--netif-netmask is required\n");
-        return 0;
-    }
-    
-    if (!options.socks_server_addr) {
-        fprintf(stderr, "--socks-server-addr is required\n");
-        return 0;
-    }
-    
-    if (options.username) {
-        if (!options.password && !options.password_file) {
-            fprintf(stderr, "username given but password not given\n");
-            return 0;
+        else if (!strcmp(arg, "--udp-direct")) {
+            options.udp_direct = 1;
         }
-        
-        if (options.password && options.password_file) {
-            fprintf(stderr, "--password and --password-file cannot both be given\n");
-            return 0;
+        else if (!strcmp(arg, "--udp-direct-max-flows")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_direct_max_flows = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-    }
-    
-    return 1;
-}
-
-int process_arguments (void)
-{
-    ASSERT(!password_file_contents)
-    
-    // resolve netif ipaddr
-    if (!BIPAddr_Resolve(&netif_ipaddr, options.netif_ipaddr, 0)) {
-        BLog(BLOG_ERROR, "netif ipaddr: BIPAddr_Resolve failed");
-        return 0;
-    }
-    if (netif_ipaddr.type != BADDR_TYPE_IPV4) {
-        BLog(BLOG_ERROR, "netif ipaddr: must be an IPv4 address");
-        return 0;
-    }
-    
-    // resolve netif netmask
-    if (!BIPAddr_Resolve(&netif_netmask, options.netif_netmask, 0)) {
-        BLog(BLOG_ERROR, "netif netmask: BIPAddr_Resolve failed");
-        return 0;
-    }
-    if (netif_netmask.type != BADDR_TYPE_IPV4) {
-        BLog(BLOG_ERROR, "netif netmask: must be an IPv4 address");
-        return 0;
-    }
-    
-    // parse IP6 address
-    if (options.netif_ip6addr) {
-        if (!ipaddr6_parse_ipv6_addr(MemRef_MakeCstr(options.netif_ip6addr), &netif_ip6addr)) {
-            BLog(BLOG_ERROR, "netif ip6addr: incorrect");
-            return 0;
+        else if (!strcmp(arg, "--udp-direct-idle-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_direct_idle_timeout = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-    }
-    
-    // resolve SOCKS server address
-    if (!BAddr_Parse2(&socks_server_addr, options.socks_server_addr, NULL, 0, 0)) {
-        BLog(BLOG_ERROR, "socks server addr: BAddr_Parse2 failed");
-        return 0;
-    }
-    
-    // add none socks authentication method
-    socks_auth_info[0] = BSocksClient_auth_none();
-    socks_num_auth_info = 1;
-    
-    // add password socks authentication method
-    if (options.username) {
-        const char *password;
-        size_t password_len;
-        if (options.password) {
-            password = options.password;
-            password_len = strlen(options.password);
-        } else {
-            if (!read_file(options.password_file, &password_file_contents, &password_len)) {
-                BLog(BLOG_ERROR, "failed to read password file");
+        else if (!strcmp(arg, "--socks-fast-open")) {
+            options.socks_fast_open = 1;
+        }
+        else if (!strcmp(arg, "--socks-pipelined")) {
+            options.socks_pipelined = 1;
+        }
+        else if (!strcmp(arg, "--socks-early-data")) {
+            options.socks_early_data = 1;
+        }
+        else if (!strcmp(arg, "--socks-pool-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            password = (char *)password_file_contents;
+            if ((options.socks_pool_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-        
-        socks_auth_info[socks_num_auth_info++] = BSocksClient_auth_password(
-            options.username, strlen(options.username),
-            password, password_len
-        );
-    }
-    
-    // resolve remote udpgw server address
-    if (options.udpgw_remote_server_addr) {
-        if (!BAddr_Parse2(&udpgw_remote_server_addr, options.udpgw_remote_server_addr, NULL, 0, 0)) {
-            BLog(BLOG_ERROR, "remote udpgw server addr: BAddr_Parse2 failed");
-            return 0;
+        else if (!strcmp(arg, "--socks-pool-idle-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.socks_pool_idle_time = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-    }
-    
-    return 1;
-}
-
-void signal_handler (void *unused)
-{
-    ASSERT(!quitting)
-    
-    BLog(BLOG_NOTICE, "termination requested");
-    
-    terminate();
-}
-
-BAddr baddr_from_lwip (const ip_addr_t *ip_addr, uint16_t port_hostorder)
-{
-    BAddr addr;
-    if (IP_IS_V6(ip_addr)) {
-        BAddr_InitIPv6(&addr, (uint8_t *)ip_addr->u_addr.ip6.addr, hton16(port_hostorder));
-    } else {
-        BAddr_InitIPv4(&addr, ip_addr->u_addr.ip4.addr, hton16(port_hostorder));
-    }
-    return addr;
-}
-
-void lwip_init_job_hadler (void *unused)
-{
-    ASSERT(!quitting)
-    ASSERT(netif_ipaddr.type == BADDR_TYPE_IPV4)
-    ASSERT(netif_netmask.type == BADDR_TYPE_IPV4)
-    ASSERT(!have_netif)
-    ASSERT(!listener)
-    ASSERT(!listener_ip6)
-    
-    BLog(BLOG_DEBUG, "lwip init");
-    
-    // NOTE: the device may fail during this, but there's no harm in not checking
-    // for that at every step
-    
-    // init lwip
-    lwip_init();
-    
-    // make addresses for netif
-    ip4_addr_t addr;
-    addr.addr = netif_ipaddr.ipv4;
-    ip4_addr_t netmask;
-    netmask.addr = netif_netmask.ipv4;
-    ip4_addr_t gw;
-    ip4_addr_set_any(&gw);
-    
-    // init netif
-    if (!netif_add(&the_netif, &addr, &netmask, &gw, NULL, netif_init_func, netif_input_func)) {
-        BLog(BLOG_ERROR, "netif_add failed");
-        goto fail;
-    }
-    have_netif = 1;
-    
-    // set netif up
-    netif_set_up(&the_netif);
-    
-    // set netif link up, otherwise ip route will refuse to route
-    netif_set_link_up(&the_netif);
-    
-    // set netif pretend TCP
-    netif_set_pretend_tcp(&the_netif, 1);
-    
-    // set netif default
-    netif_set_default(&the_netif);
-    
-    if (options.netif_ip6addr) {
-        // add IPv6 address
-        ip6_addr_t ip6addr;
+        else if (!strcmp(arg, "--resolver-cache-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.resolver_cache_time = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--dns-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.dns_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--fake-dns-pool")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.fake_dns_pool = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--fake-dns-max-entries")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.fake_dns_max_entries = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--fake-dns-ttl")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.fake_dns_ttl = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--bypass-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.bypass_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--config-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.config_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--max-tcp-clients")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_tcp_clients = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-max-pending")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_max_pending = atoi(argv[i + 1])) <= 0 || options.tcp_max_pending > DEFAULT_TCP_MAX_PENDING) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-accept-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_accept_rate = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-accept-burst")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_accept_burst = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-evict-idle")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_evict_idle = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-rcv-wnd")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_rcv_wnd = atoi(argv[i + 1])) < TCPWND_MIN16(TCP_WND) || options.tcp_rcv_wnd > TCP_WND) {
+                fprintf(stderr, "%s: wrong argument, must be between %d and %d\n", arg, (int)TCPWND_MIN16(TCP_WND), (int)TCP_WND);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-snd-buf")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_snd_buf = atoi(argv[i + 1])) < 2 * TCP_MSS || options.tcp_snd_buf > TCP_SND_BUF) {
+                fprintf(stderr, "%s: wrong argument, must be between %d and %d\n", arg, 2 * TCP_MSS, (int)TCP_SND_BUF);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-wnd-autotune")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_wnd_autotune = atoi(argv[i + 1])) <= 0 || options.tcp_wnd_autotune > TCP_WND) {
+                fprintf(stderr, "%s: wrong argument, must be between 1 and %d\n", arg, (int)TCP_WND);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--lwip-pbufs") || !strcmp(arg, "--lwip-tcp-segs") || !strcmp(arg, "--lwip-tcp-pcbs")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            int pool = !strcmp(arg, "--lwip-pbufs") ? LWIP_MEMPOOLS_PBUF :
+                       !strcmp(arg, "--lwip-tcp-segs") ? LWIP_MEMPOOLS_TCP_SEG : LWIP_MEMPOOLS_TCP_PCB;
+            if ((options.lwip_pool_nums[pool] = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--lwip-hugepages")) {
+            options.lwip_hugepages = 1;
+        }
+        else if (!strcmp(arg, "--buffer-arena")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BArena_ParsePages(argv[i + 1], &options.buffer_arena)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BThreadPlacement_ParseCpus(&options.reactor_placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-sched")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BThreadPlacement_ParseSched(&options.reactor_placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--avoid-irq-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.avoid_irq_cpus = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--memory-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            uintmax_t limit;
+            if (!parse_unsigned_integer(MemRef_MakeCstr(argv[i + 1]), &limit) || limit == 0 || limit > SIZE_MAX) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.memory_limit = limit;
+            i++;
+        }
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--num-workers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.num_workers = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tun-offload")) {
+            options.tun_offload = 1;
+        }
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--reactor-stats")) {
+            options.reactor_stats = 1;
+        }
+        #endif
+        else if (!strcmp(arg, "--reactor-job-budget")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_job_budget_jobs = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_job_budget_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-busy-poll")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_spin_us = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_kernel_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-edge-triggered")) {
+            options.reactor_edge_triggered = 1;
+        }
+        else if (!strcmp(arg, "--metrics-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_statsd_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.metrics_statsd_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_metrics_statsd_interval = 1;
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--control-socket")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.control_socket = argv[i + 1];
+            i++;
+        }
+        #endif
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    if (!options.netif_ipaddr) {
+        fprintf(stderr, "--netif-ipaddr is required\n");
+        return 0;
+    }
+    
+    if (!options.netif_netmask) {
+        fprintf(stderr, "--netif-netmask is required\n");
+        return 0;
+    }
+    
+    if (options.num_socks_server_addrs == 0 && !options.config_file) {
+        fprintf(stderr, "--socks-server-addr or --config-file is required\n");
+        return 0;
+    }
+    
+    #ifdef BADVPN_LINUX
+    if (options.num_workers > 1 && !options.tundev) {
+        fprintf(stderr, "--num-workers requires --tundev\n");
+        return 0;
+    }
+    
+    // workers would compete for the metrics address, and each has its own counters
+    if (options.num_workers > 1 && (options.metrics_listen_addr || options.metrics_statsd_addr)) {
+        fprintf(stderr, "exporting metrics requires --num-workers 1\n");
+        return 0;
+    }
+    
+    if (options.num_workers > 1 && options.control_socket) {
+        fprintf(stderr, "--control-socket requires --num-workers 1\n");
+        return 0;
+    }
+    #endif
+    
+    if (have_metrics_statsd_interval && !options.metrics_statsd_addr) {
+        fprintf(stderr, "--metrics-statsd-interval requires --metrics-statsd-addr\n");
+        return 0;
+    }
+    
+    if (options.tcp_accept_burst > 0 && options.tcp_accept_rate == 0) {
+        fprintf(stderr, "--tcp-accept-burst requires --tcp-accept-rate\n");
+        return 0;
+    }
+    
+    // there is only something to evict for when the number of clients is limited
+    if (options.tcp_evict_idle >= 0 && options.max_tcp_clients < 0) {
+        fprintf(stderr, "--tcp-evict-idle requires --max-tcp-clients\n");
+        return 0;
+    }
+    
+    if (options.socks_pool_size > 0 && options.append_source_to_username) {
+        fprintf(stderr, "--socks-pool-size cannot be used with --append-source-to-username\n");
+        return 0;
+    }
+    
+    if (options.socks5_udp_shared && !options.socks5_udp) {
+        fprintf(stderr, "--socks5-udp-shared requires --socks5-udp\n");
+        return 0;
+    }
+    
+    if (options.tcp_wnd_autotune > 0 && (options.tcp_wnd_autotune < options.tcp_rcv_wnd || options.tcp_wnd_autotune < options.tcp_snd_buf)) {
+        fprintf(stderr, "--tcp-wnd-autotune must not be less than --tcp-rcv-wnd and --tcp-snd-buf\n");
+        return 0;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.udpgw_remote_server_addr && options.udpgw_remote_server_unix) {
+        fprintf(stderr, "--udpgw-remote-server-addr cannot be used with --udpgw-remote-server-unix\n");
+        return 0;
+    }
+    #endif
+    
+    if (options.udpgw_datagram && !options.udpgw_remote_server_addr) {
+        fprintf(stderr, "--udpgw-datagram requires --udpgw-remote-server-addr\n");
+        return 0;
+    }
+    
+    if (options.udpgw_icmp && !have_udpgw()) {
+        fprintf(stderr, "--udpgw-icmp requires --udpgw-remote-server-addr or --udpgw-remote-server-unix\n");
+        return 0;
+    }
+    
+    if (options.udp_direct && (have_udpgw() || options.socks5_udp)) {
+        fprintf(stderr, "--udp-direct cannot be used with --udpgw-remote-server-addr/unix or --socks5-udp\n");
+        return 0;
+    }
+    
+    // a gateway relaying all UDP needs more flows than the bypassed destinations
+    if (options.udp_direct_max_flows < 0) {
+        options.udp_direct_max_flows = (options.udp_direct ? DEFAULT_UDP_DIRECT_MAX_FLOWS : DIRECT_UDP_MAX_FLOWS);
+    }
+    
+    if (options.dns_cache_size > 0 && !have_udpgw() && !options.socks5_udp && !options.udp_direct) {
+        fprintf(stderr, "--dns-cache-size requires --udpgw-remote-server-addr/unix, --socks5-udp or --udp-direct\n");
+        return 0;
+    }
+    
+    if (options.username) {
+        if (!options.password && !options.password_file) {
+            fprintf(stderr, "username given but password not given\n");
+            return 0;
+        }
+        
+        if (options.password && options.password_file) {
+            fprintf(stderr, "--password and --password-file cannot both be given\n");
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+int process_arguments (void)
+{
+    ASSERT(!socks_config)
+    ASSERT(!config_file_contents)
+    
+    // resolve netif ipaddr
+    if (!BIPAddr_Resolve(&netif_ipaddr, options.netif_ipaddr, 0)) {
+        BLog(BLOG_ERROR, "netif ipaddr: BIPAddr_Resolve failed");
+        return 0;
+    }
+    if (netif_ipaddr.type != BADDR_TYPE_IPV4) {
+        BLog(BLOG_ERROR, "netif ipaddr: must be an IPv4 address");
+        return 0;
+    }
+    
+    // resolve netif netmask
+    if (!BIPAddr_Resolve(&netif_netmask, options.netif_netmask, 0)) {
+        BLog(BLOG_ERROR, "netif netmask: BIPAddr_Resolve failed");
+        return 0;
+    }
+    if (netif_netmask.type != BADDR_TYPE_IPV4) {
+        BLog(BLOG_ERROR, "netif netmask: must be an IPv4 address");
+        return 0;
+    }
+    
+    // parse IP6 address
+    if (options.netif_ip6addr) {
+        if (!ipaddr6_parse_ipv6_addr(MemRef_MakeCstr(options.netif_ip6addr), &netif_ip6addr)) {
+            BLog(BLOG_ERROR, "netif ip6addr: incorrect");
+            return 0;
+        }
+    }
+    
+    // remember the reloadable options from the command line, and replace
+    // them with those in the configuration file
+    reload_options_get(&cmdline_reload_options);
+    if (options.config_file) {
+        if (!config_file_load(&config_file_contents)) {
+            return 0;
+        }
+    }
+    
+    // resolve SOCKS servers and read the password
+    if (!(socks_config = socks_config_create())) {
+        return 0;
+    }
+    
+    // resolve metrics addresses
+    if (options.metrics_listen_addr) {
+        if (!BAddr_Parse(&metrics_listen_addr, options.metrics_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics listen addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    if (options.metrics_statsd_addr) {
+        if (!BAddr_Parse(&metrics_statsd_addr, options.metrics_statsd_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics statsd addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    
+    // parse fake DNS address pool
+    if (options.fake_dns_pool) {
+        if (!ipaddr_parse_ipv4_ifaddr(MemRef_MakeCstr(options.fake_dns_pool), &fake_dns_pool)) {
+            BLog(BLOG_ERROR, "fake dns pool: incorrect");
+            return 0;
+        }
+        if (fake_dns_pool.prefix > 30) {
+            BLog(BLOG_ERROR, "fake dns pool: prefix must be at most 30");
+            return 0;
+        }
+    }
+    
+    // load bypass table
+    if (options.bypass_file) {
+        if (!bypass_load(&bypass_table)) {
+            return 0;
+        }
+        have_bypass = 1;
+    }
+    
+    // keep the reactor off the CPUs handling the network interrupts
+    if (options.avoid_irq_cpus) {
+        if (!BThreadPlacement_AvoidIrqCpus(&options.reactor_placement, options.avoid_irq_cpus)) {
+            BLog(BLOG_ERROR, "avoid IRQ CPUs: BThreadPlacement_AvoidIrqCpus failed");
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+int have_udpgw (void)
+{
+    return (options.udpgw_remote_server_addr || udpgw_remote_server_unix());
+}
+
+const char * udpgw_remote_server_unix (void)
+{
+    #ifndef BADVPN_USE_WINAPI
+    return options.udpgw_remote_server_unix;
+    #else
+    return NULL;
+    #endif
+}
+
+void signal_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    BLog(BLOG_NOTICE, "termination requested");
+    
+    terminate();
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void stats_signal_handler (void *unused, int signo)
+{
+    ASSERT(options.reactor_stats)
+    
+    BReactor_LogStats(&ss, BLOG_NOTICE, 1);
+}
+
+void bypass_signal_handler (void *unused, int signo)
+{
+    ASSERT(have_bypass)
+    
+    bypass_reload();
+}
+
+#endif
+
+void reload_options_get (struct reload_options *ro)
+{
+    for (int i = 0; i < options.num_socks_server_addrs; i++) {
+        ro->socks_server_addrs[i] = options.socks_server_addrs[i];
+    }
+    ro->num_socks_server_addrs = options.num_socks_server_addrs;
+    ro->username = options.username;
+    ro->password = options.password;
+    ro->password_file = options.password_file;
+    ro->udpgw_remote_server_addr = options.udpgw_remote_server_addr;
+}
+
+void reload_options_set (const struct reload_options *ro)
+{
+    for (int i = 0; i < ro->num_socks_server_addrs; i++) {
+        options.socks_server_addrs[i] = ro->socks_server_addrs[i];
+    }
+    options.num_socks_server_addrs = ro->num_socks_server_addrs;
+    options.username = ro->username;
+    options.password = ro->password;
+    options.password_file = ro->password_file;
+    options.udpgw_remote_server_addr = ro->udpgw_remote_server_addr;
+}
+
+int config_file_load (char **out_contents)
+{
+    ASSERT(options.config_file)
+    
+    // read file, making room for a null terminator after the last line
+    uint8_t *data;
+    size_t len;
+    if (!read_file(options.config_file, &data, &len)) {
+        BLog(BLOG_ERROR, "config file: failed to read %s", options.config_file);
+        goto fail0;
+    }
+    char *contents = (char *)realloc(data, len + 1);
+    if (!contents) {
+        BLog(BLOG_ERROR, "config file: realloc failed");
+        free(data);
+        goto fail0;
+    }
+    contents[len] = '\0';
+    
+    // the SOCKS servers in the file replace those on the command line
+    int have_socks_server_addrs = 0;
+    
+    // each line is an option name without the dashes and its argument; the
+    // arguments are terminated in place, and the options point to them
+    MemRef rest = MemRef_Make(contents, len);
+    int line_num = 0;
+    while (rest.len > 0) {
+        line_num++;
+        
+        size_t line_len;
+        if (!MemRef_FindChar(rest, '\n', &line_len)) {
+            line_len = rest.len;
+        }
+        MemRef line = MemRef_SubTo(rest, line_len);
+        rest = MemRef_SubFrom(rest, bmin_size(line_len + 1, rest.len));
+        
+        // strip comment
+        size_t comment_pos;
+        if (MemRef_FindChar(line, '#', &comment_pos)) {
+            line = MemRef_SubTo(line, comment_pos);
+        }
+        
+        // skip empty lines
+        MemRef name;
+        if (!bypass_next_word(&line, &name)) {
+            continue;
+        }
+        
+        MemRef arg;
+        MemRef extra;
+        if (!bypass_next_word(&line, &arg) || bypass_next_word(&line, &extra)) {
+            BLog(BLOG_ERROR, "config file: line %d: expected an option and one argument", line_num);
+            goto fail1;
+        }
+        char *value = (char *)arg.ptr;
+        value[arg.len] = '\0';
+        
+        if (MemRef_Equal(name, MemRef_MakeCstr("socks-server-addr"))) {
+            if (!have_socks_server_addrs) {
+                options.num_socks_server_addrs = 0;
+                have_socks_server_addrs = 1;
+            }
+            if (options.num_socks_server_addrs == MAX_SOCKS_SERVERS) {
+                BLog(BLOG_ERROR, "config file: line %d: too many SOCKS servers", line_num);
+                goto fail1;
+            }
+            options.socks_server_addrs[options.num_socks_server_addrs++] = value;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("username"))) {
+            options.username = value;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("password"))) {
+            options.password = value;
+            options.password_file = NULL;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("password-file"))) {
+            options.password_file = value;
+            options.password = NULL;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("udpgw-remote-server-addr"))) {
+            // which way UDP is forwarded is decided at startup
+            if (!cmdline_reload_options.udpgw_remote_server_addr) {
+                BLog(BLOG_ERROR, "config file: line %d: udpgw-remote-server-addr requires --udpgw-remote-server-addr", line_num);
+                goto fail1;
+            }
+            options.udpgw_remote_server_addr = value;
+        }
+        else {
+            BLog(BLOG_ERROR, "config file: line %d: unknown option", line_num);
+            goto fail1;
+        }
+    }
+    
+    *out_contents = contents;
+    return 1;
+    
+fail1:
+    free(contents);
+fail0:
+    return 0;
+}
+
+struct socks_config * socks_config_create (void)
+{
+    if (options.num_socks_server_addrs == 0) {
+        BLog(BLOG_ERROR, "no SOCKS server address given");
+        goto fail0;
+    }
+    
+    if (options.username && !options.password == !options.password_file) {
+        BLog(BLOG_ERROR, "username given without exactly one of password and password file");
+        goto fail0;
+    }
+    
+    struct socks_config *c = (struct socks_config *)malloc(sizeof(*c));
+    if (!c) {
+        BLog(BLOG_ERROR, "socks config: malloc failed");
+        goto fail0;
+    }
+    c->username = NULL;
+    c->password = NULL;
+    
+    // resolve SOCKS server addresses
+    c->num_servers = 0;
+    for (int i = 0; i < options.num_socks_server_addrs; i++) {
+        struct socks_server *server = &c->servers[c->num_servers];
+        if (!BAddr_Parse2(&server->addr, options.socks_server_addrs[i], server->name, sizeof(server->name), 0)) {
+            BLog(BLOG_ERROR, "socks server addr: BAddr_Parse2 failed");
+            goto fail1;
+        }
+        
+        // a server given by name is resolved again at runtime, so that changes
+        // of its addresses are followed
+        BAddr numeric_addr;
+        server->by_name = !BAddr_Parse2(&numeric_addr, options.socks_server_addrs[i], NULL, 0, 1);
+        server->num_sessions = 0;
+        server->failures = 0;
+        server->down_until = 0;
+        server->latency = 0;
+        c->num_servers++;
+    }
+    
+    // add none socks authentication method
+    c->auth_info[0] = BSocksClient_auth_none();
+    c->num_auth_info = 1;
+    
+    // add password socks authentication method, with copies of the username and
+    // password, as the options may point into a configuration file being replaced
+    if (options.username) {
+        if (options.password) {
+            c->password_len = strlen(options.password);
+            if (!(c->password = b_strdup_bin(options.password, c->password_len))) {
+                BLog(BLOG_ERROR, "socks config: b_strdup_bin failed");
+                goto fail1;
+            }
+        } else {
+            uint8_t *password;
+            if (!read_file(options.password_file, &password, &c->password_len)) {
+                BLog(BLOG_ERROR, "failed to read password file");
+                goto fail1;
+            }
+            c->password = (char *)password;
+        }
+        
+        if (!(c->username = b_strdup(options.username))) {
+            BLog(BLOG_ERROR, "socks config: b_strdup failed");
+            goto fail1;
+        }
+        
+        c->auth_info[c->num_auth_info++] = BSocksClient_auth_password(
+            c->username, strlen(c->username),
+            c->password, c->password_len
+        );
+    }
+    
+    // resolve remote udpgw server address
+    BAddr_InitNone(&c->udpgw_remote_server_addr);
+    if (options.udpgw_remote_server_addr) {
+        if (!BAddr_Parse2(&c->udpgw_remote_server_addr, options.udpgw_remote_server_addr, NULL, 0, 0)) {
+            BLog(BLOG_ERROR, "remote udpgw server addr: BAddr_Parse2 failed");
+            goto fail1;
+        }
+    }
+    
+    BRefTarget_Init(&c->ref_target, socks_config_release);
+    
+    return c;
+    
+fail1:
+    free(c->username);
+    free(c->password);
+    free(c);
+fail0:
+    return NULL;
+}
+
+void socks_config_release (BRefTarget *ref_target)
+{
+    struct socks_config *c = UPPER_OBJECT(ref_target, struct socks_config, ref_target);
+    
+    free(c->username);
+    free(c->password);
+    free(c);
+}
+
+int socks_config_udpgw_equal (struct socks_config *c1, struct socks_config *c2)
+{
+    // the udpgw client connects to the first SOCKS server by its address at the time
+    if (!BAddr_Compare(&c1->servers[0].addr, &c2->servers[0].addr)) {
+        return 0;
+    }
+    
+    if (c1->udpgw_remote_server_addr.type != c2->udpgw_remote_server_addr.type ||
+        (c1->udpgw_remote_server_addr.type != BADDR_TYPE_NONE && !BAddr_Compare(&c1->udpgw_remote_server_addr, &c2->udpgw_remote_server_addr))
+    ) {
+        return 0;
+    }
+    
+    if (!c1->username != !c2->username) {
+        return 0;
+    }
+    
+    if (c1->username && (strcmp(c1->username, c2->username) || c1->password_len != c2->password_len ||
+        memcmp(c1->password, c2->password, c1->password_len))
+    ) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+void reload_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    BLog(BLOG_NOTICE, "reloading configuration");
+    
+    // the bypass table is reloaded on its own; a bad file keeps the old table
+    if (have_bypass) {
+        bypass_reload();
+    }
+    
+    // read the configuration file again, starting from the command line
+    struct reload_options saved;
+    reload_options_get(&saved);
+    char *contents = NULL;
+    if (options.config_file) {
+        reload_options_set(&cmdline_reload_options);
+        if (!config_file_load(&contents)) {
+            goto fail0;
+        }
+    }
+    
+    // build the new SOCKS configuration, reading the password file again
+    struct socks_config *config = socks_config_create();
+    if (!config) {
+        goto fail1;
+    }
+    
+    // init resolver if a SOCKS server is now given by name
+    for (int i = 0; i < config->num_servers; i++) {
+        if (config->servers[i].by_name && !have_resolver) {
+            if (!BResolver_Init(&resolver, &ss, -1, MAX_SOCKS_SERVERS, options.resolver_cache_time)) {
+                BLog(BLOG_ERROR, "BResolver_Init failed");
+                goto fail2;
+            }
+            have_resolver = 1;
+        }
+    }
+    
+    // switch to the new configuration; sessions and udpgw clients started
+    // before keep the old one as long as they need it
+    free(config_file_contents);
+    config_file_contents = contents;
+    BRefTarget_Deref(&socks_config->ref_target);
+    socks_config = config;
+    
+    // replace the pooled sessions, which are authenticated with the old configuration
+    socks_pool_free_all();
+    socks_pool_fill();
+    
+    // if the udpgw server is now reached differently, start a new udpgw client
+    // for new flows, and retire the old one with the flows it has
+    if (udp_mode == UdpModeUdpgw && !socks_config_udpgw_equal(udpgw_current->config, socks_config)) {
+        struct udpgw_instance *u = udpgw_instance_new(socks_config);
+        if (!u) {
+            BLog(BLOG_ERROR, "udpgw: new flows keep using the old udpgw client");
+        } else {
+            SocksUdpGwClient_SetAdmitNew(&u->client, MemPressure_Level(&memory_pressure) < MEMPRESSURE_LEVEL_NO_ADMIT);
+            
+            LinkedList1_Append(&udpgw_retired, &udpgw_current->retired_node);
+            udpgw_current = u;
+            
+            if (!BTimer_IsRunning(&udpgw_retired_timer)) {
+                BReactor_SetTimer(&ss, &udpgw_retired_timer);
+            }
+            
+            BLog(BLOG_NOTICE, "udpgw: new flows use a new udpgw client");
+        }
+    }
+    
+    BLog(BLOG_NOTICE, "configuration reloaded, %d SOCKS servers", socks_config->num_servers);
+    return;
+    
+fail2:
+    BRefTarget_Deref(&config->ref_target);
+fail1:
+    free(contents);
+fail0:
+    reload_options_set(&saved);
+    BLog(BLOG_ERROR, "keeping the old configuration");
+}
+
+struct udpgw_instance * udpgw_instance_new (struct socks_config *config)
+{
+    struct udpgw_instance *u = (struct udpgw_instance *)malloc(sizeof(*u));
+    if (!u) {
+        BLog(BLOG_ERROR, "udpgw: malloc failed");
+        goto fail0;
+    }
+    
+    // keep the SOCKS configuration, which the client refers to
+    if (!BRefTarget_Ref(&config->ref_target)) {
+        BLog(BLOG_ERROR, "BRefTarget_Ref failed");
+        goto fail1;
+    }
+    u->config = config;
+    
+    // init udpgw client
+    if (!SocksUdpGwClient_Init(&u->client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS,
+        options.udpgw_connection_buffer_size, UDPGW_KEEPALIVE_TIME, options.udpgw_tcp_connections, config->servers[0].addr,
+        config->auth_info, config->num_auth_info, config->udpgw_remote_server_addr, udpgw_remote_server_unix(),
+        UDPGW_RECONNECT_TIME, &ss, NULL, udp_send_packet_to_device))
+    {
+        BLog(BLOG_ERROR, "SocksUdpGwClient_Init failed");
+        goto fail2;
+    }
+    
+    // exchange UDP with udpgw as datagrams once it offers that
+    if (options.udpgw_datagram) {
+        SocksUdpGwClient_EnableDatagram(&u->client);
+    }
+    
+    // relay pings through udpgw once it says it can
+    if (options.udpgw_icmp) {
+        SocksUdpGwClient_EnableIcmp(&u->client, icmp_send_packet_to_device);
+    }
+    
+    // drop UDP packets which have been waiting too long to be sent
+    if (options.udpgw_codel_target > 0) {
+        SocksUdpGwClient_EnableCoDel(&u->client, options.udpgw_codel_target, options.udpgw_codel_interval);
+    }
+    
+    // shape sending to the udpgw server
+    if (options.udpgw_send_rate > 0) {
+        SocksUdpGwClient_SetSendRate(&u->client, options.udpgw_send_rate, (options.udpgw_send_burst > 0 ? options.udpgw_send_burst : options.udpgw_send_rate / 20));
+    }
+    
+    return u;
+    
+fail2:
+    BRefTarget_Deref(&config->ref_target);
+fail1:
+    free(u);
+fail0:
+    return NULL;
+}
+
+void udpgw_instance_free (struct udpgw_instance *u)
+{
+    if (options.udpgw_codel_target > 0) {
+        BLog(BLOG_NOTICE, "udpgw: CoDel dropped %"PRIu64" packets", SocksUdpGwClient_GetCoDelDrops(&u->client));
+    }
+    
+    SocksUdpGwClient_Free(&u->client);
+    BRefTarget_Deref(&u->config->ref_target);
+    free(u);
+}
+
+SocksUdpGwClient * udpgw_client_for_flow (BAddr local_addr, BAddr remote_addr)
+{
+    // flows started before a reload stay with the client they started on
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&udpgw_retired); node; node = LinkedList1Node_Next(node)) {
+        struct udpgw_instance *u = UPPER_OBJECT(node, struct udpgw_instance, retired_node);
+        if (SocksUdpGwClient_HasConnection(&u->client, local_addr, remote_addr)) {
+            return &u->client;
+        }
+    }
+    
+    return &udpgw_current->client;
+}
+
+void udpgw_retired_timer_handler (void *unused)
+{
+    ASSERT(!quitting)
+    ASSERT(udp_mode == UdpModeUdpgw)
+    
+    // close flows which have gone idle, and free the clients left without flows
+    LinkedList1Node *node = LinkedList1_GetFirst(&udpgw_retired);
+    while (node) {
+        struct udpgw_instance *u = UPPER_OBJECT(node, struct udpgw_instance, retired_node);
+        node = LinkedList1Node_Next(node);
+        
+        SocksUdpGwClient_EvictIdle(&u->client, UDPGW_RETIRED_IDLE_TIME, INT_MAX);
+        
+        if (SocksUdpGwClient_GetNumConnections(&u->client) == 0) {
+            BLog(BLOG_INFO, "udpgw: freeing retired udpgw client");
+            LinkedList1_Remove(&udpgw_retired, &u->retired_node);
+            udpgw_instance_free(u);
+        }
+    }
+    
+    if (!LinkedList1_IsEmpty(&udpgw_retired)) {
+        BReactor_SetTimer(&ss, &udpgw_retired_timer);
+    }
+}
+
+int bypass_next_word (MemRef *line, MemRef *out_word)
+{
+    size_t pos = 0;
+    while (pos < line->len && (line->ptr[pos] == ' ' || line->ptr[pos] == '\t' || line->ptr[pos] == '\r')) {
+        pos++;
+    }
+    
+    size_t end = pos;
+    while (end < line->len && !(line->ptr[end] == ' ' || line->ptr[end] == '\t' || line->ptr[end] == '\r')) {
+        end++;
+    }
+    
+    if (end == pos) {
+        return 0;
+    }
+    
+    *out_word = MemRef_Sub(*line, pos, end - pos);
+    *line = MemRef_SubFrom(*line, end);
+    return 1;
+}
+
+int bypass_parse_line (PrefixTable *table, MemRef line)
+{
+    // strip comment
+    size_t comment_pos;
+    if (MemRef_FindChar(line, '#', &comment_pos)) {
+        line = MemRef_SubTo(line, comment_pos);
+    }
+    
+    // skip empty lines
+    MemRef prefix_str;
+    if (!bypass_next_word(&line, &prefix_str)) {
+        return 1;
+    }
+    
+    // parse action, which defaults to direct
+    int action = BypassActionDirect;
+    MemRef action_str;
+    if (bypass_next_word(&line, &action_str)) {
+        for (action = 0; action < B_ARRAY_LENGTH(bypass_action_names); action++) {
+            if (MemRef_Equal(action_str, MemRef_MakeCstr(bypass_action_names[action]))) {
+                break;
+            }
+        }
+        if (action == B_ARRAY_LENGTH(bypass_action_names)) {
+            BLog(BLOG_ERROR, "unknown action");
+            return 0;
+        }
+        
+        MemRef extra_str;
+        if (bypass_next_word(&line, &extra_str)) {
+            BLog(BLOG_ERROR, "too many words");
+            return 0;
+        }
+    }
+    
+    void *value = (void *)&bypass_action_names[action];
+    void *existing;
+    int res;
+    size_t pos;
+    
+    // parse prefix; a bare address stands for itself only
+    if (MemRef_FindChar(prefix_str, ':', &pos)) {
+        struct ipv6_ifaddr ifaddr;
+        if (MemRef_FindChar(prefix_str, '/', &pos)) {
+            res = ipaddr6_parse_ipv6_ifaddr(prefix_str, &ifaddr);
+        } else {
+            res = ipaddr6_parse_ipv6_addr(prefix_str, &ifaddr.addr);
+            ifaddr.prefix = 128;
+        }
+        if (!res) {
+            BLog(BLOG_ERROR, "bad IPv6 prefix");
+            return 0;
+        }
+        res = PrefixTable_Insert6(table, ifaddr.addr, ifaddr.prefix, value, &existing);
+    } else {
+        struct ipv4_ifaddr ifaddr;
+        if (MemRef_FindChar(prefix_str, '/', &pos)) {
+            res = ipaddr_parse_ipv4_ifaddr(prefix_str, &ifaddr);
+        } else {
+            res = ipaddr_parse_ipv4_addr(prefix_str, &ifaddr.addr);
+            ifaddr.prefix = 32;
+        }
+        if (!res) {
+            BLog(BLOG_ERROR, "bad IPv4 prefix");
+            return 0;
+        }
+        res = PrefixTable_Insert4(table, ifaddr.addr, ifaddr.prefix, value, &existing);
+    }
+    
+    if (!res) {
+        BLog(BLOG_ERROR, (existing ? "duplicate prefix" : "PrefixTable_Insert failed"));
+        return 0;
+    }
+    
+    return 1;
+}
+
+int bypass_load (PrefixTable *table)
+{
+    ASSERT(options.bypass_file)
+    
+    // read file
+    uint8_t *data;
+    size_t len;
+    if (!read_file(options.bypass_file, &data, &len)) {
+        BLog(BLOG_ERROR, "bypass file: failed to read %s", options.bypass_file);
+        goto fail0;
+    }
+    
+    // build the table at once from all lines
+    PrefixTable_Init(table);
+    PrefixTable_BeginBulk(table);
+    
+    MemRef rest = MemRef_Make((char *)data, len);
+    int line_num = 0;
+    while (rest.len > 0) {
+        line_num++;
+        
+        size_t line_len;
+        if (!MemRef_FindChar(rest, '\n', &line_len)) {
+            line_len = rest.len;
+        }
+        
+        if (!bypass_parse_line(table, MemRef_SubTo(rest, line_len))) {
+            BLog(BLOG_ERROR, "bypass file: error on line %d", line_num);
+            goto fail1;
+        }
+        
+        rest = MemRef_SubFrom(rest, bmin_size(line_len + 1, rest.len));
+    }
+    
+    if (!PrefixTable_EndBulk(table)) {
+        BLog(BLOG_ERROR, "bypass file: PrefixTable_EndBulk failed");
+        goto fail1;
+    }
+    
+    BLog(BLOG_NOTICE, "bypass file: loaded %zu prefixes", PrefixTable_Count(table));
+    
+    free(data);
+    return 1;
+    
+fail1:
+    PrefixTable_Free(table);
+    free(data);
+fail0:
+    return 0;
+}
+
+void bypass_reload (void)
+{
+    ASSERT(have_bypass)
+    
+    BLog(BLOG_NOTICE, "reloading bypass file");
+    
+    // existing connections keep their path; only new ones see the new table
+    PrefixTable table;
+    if (!bypass_load(&table)) {
+        BLog(BLOG_ERROR, "keeping the old bypass table");
+        return;
+    }
+    
+    PrefixTable_Free(&bypass_table);
+    bypass_table = table;
+}
+
+int bypass_lookup (BAddr addr)
+{
+    if (!have_bypass) {
+        return BypassActionProxy;
+    }
+    
+    BIPAddr ipaddr;
+    BAddr_GetIPAddr(&addr, &ipaddr);
+    
+    const char *const *name = (const char *const *)PrefixTable_LookupIPAddr(&bypass_table, &ipaddr);
+    if (!name) {
+        return BypassActionProxy;
+    }
+    
+    return (int)(name - bypass_action_names);
+}
+
+BAddr baddr_from_lwip (const ip_addr_t *ip_addr, uint16_t port_hostorder)
+{
+    BAddr addr;
+    if (IP_IS_V6(ip_addr)) {
+        BAddr_InitIPv6(&addr, (uint8_t *)ip_addr->u_addr.ip6.addr, hton16(port_hostorder));
+    } else {
+        BAddr_InitIPv4(&addr, ip_addr->u_addr.ip4.addr, hton16(port_hostorder));
+    }
+    return addr;
+}
+
+void lwip_init_job_hadler (void *unused)
+{
+    ASSERT(!quitting)
+    ASSERT(netif_ipaddr.type == BADDR_TYPE_IPV4)
+    ASSERT(netif_netmask.type == BADDR_TYPE_IPV4)
+    ASSERT(!have_netif)
+    ASSERT(!listener)
+    ASSERT(!listener_ip6)
+    
+    BLog(BLOG_DEBUG, "lwip init");
+    
+    // NOTE: the device may fail during this, but there's no harm in not checking
+    // for that at every step
+    
+    // init lwip
+    lwip_init();
+    
+    // make addresses for netif
+    ip4_addr_t addr;
+    addr.addr = netif_ipaddr.ipv4;
+    ip4_addr_t netmask;
+    netmask.addr = netif_netmask.ipv4;
+    ip4_addr_t gw;
+    ip4_addr_set_any(&gw);
+    
+    // init netif
+    if (!netif_add(&the_netif, &addr, &netmask, &gw, NULL, netif_init_func, netif_input_func)) {
+        BLog(BLOG_ERROR, "netif_add failed");
+        goto fail;
+    }
+    have_netif = 1;
+    
+    // set netif up
+    netif_set_up(&the_netif);
+    
+    // set netif link up, otherwise ip route will refuse to route
+    netif_set_link_up(&the_netif);
+    
+    // set netif pretend TCP
+    netif_set_pretend_tcp(&the_netif, 1);
+    
+    // set netif default
+    netif_set_default(&the_netif);
+    
+    if (options.netif_ip6addr) {
+        // add IPv6 address
+        ip6_addr_t ip6addr;
         memset(&ip6addr, 0, sizeof(ip6addr)); // clears any "zone"
         memcpy(ip6addr.addr, netif_ip6addr.bytes, sizeof(netif_ip6addr.bytes));
         netif_ip6_addr_set(&the_netif, 0, &ip6addr);
         netif_ip6_addr_set_state(&the_netif, 0, IP6_ADDR_VALID);
     }
     
-    // init listener
-    struct tcp_pcb *l = tcp_new_ip_type(IPADDR_TYPE_V4);
-    if (!l) {
-        BLog(BLOG_ERROR, "tcp_new_ip_type failed");
-        goto fail;
+    // init listener
+    struct tcp_pcb *l = tcp_new_ip_type(IPADDR_TYPE_V4);
+    if (!l) {
+        BLog(BLOG_ERROR, "tcp_new_ip_type failed");
+        goto fail;
+    }
+    
+    // bind listener
+    if (tcp_bind_to_netif(l, "ho0") != ERR_OK) {
+        BLog(BLOG_ERROR, "tcp_bind_to_netif failed");
+        tcp_close(l);
+        goto fail;
+    }
+    
+    // ensure the listener only accepts connections from this netif
+    tcp_bind_netif(l, &the_netif);
+    
+    // listen listener, bounding connections in the handshake so that SYNs
+    // cannot take up PCBs without end
+    if (!(listener = tcp_listen_with_backlog(l, options.tcp_max_pending))) {
+        BLog(BLOG_ERROR, "tcp_listen_with_backlog failed");
+        tcp_close(l);
+        goto fail;
+    }
+    
+    // setup listener accept handler
+    tcp_accept(listener, listener_accept_func);
+    
+    if (options.netif_ip6addr) {
+        struct tcp_pcb *l_ip6 = tcp_new_ip_type(IPADDR_TYPE_V6);
+        if (!l_ip6) {
+            BLog(BLOG_ERROR, "tcp_new_ip_type failed");
+            goto fail;
+        }
+        
+        if (tcp_bind_to_netif(l_ip6, "ho0") != ERR_OK) {
+            BLog(BLOG_ERROR, "tcp_bind_to_netif failed");
+            tcp_close(l_ip6);
+            goto fail;
+        }
+        
+        tcp_bind_netif(l_ip6, &the_netif);
+        
+        if (!(listener_ip6 = tcp_listen_with_backlog(l_ip6, options.tcp_max_pending))) {
+            BLog(BLOG_ERROR, "tcp_listen_with_backlog failed");
+            tcp_close(l_ip6);
+            goto fail;
+        }
+        
+        tcp_accept(listener_ip6, listener_accept_func);
+    }
+    
+    return;
+    
+fail:
+    if (!quitting) {
+        terminate();
+    }
+}
+
+uint8_t * client_buf_alloc (int buf_class)
+{
+    ASSERT(buf_class >= 0)
+    ASSERT(buf_class < CLIENT_BUF_NUM_CLASSES)
+    
+    uint8_t *buf;
+    
+    // reuse a free buffer if there is one
+    if (client_buf_free[buf_class]) {
+        buf = (uint8_t *)client_buf_free[buf_class];
+        memcpy(&client_buf_free[buf_class], buf, sizeof(void *));
+        client_buf_num_free[buf_class]--;
+    } else {
+        if (!(buf = (uint8_t *)BArena_Alloc(BPendingGroup_Arena(BReactor_PendingGroup(&ss)), client_buf_sizes[buf_class]))) {
+            return NULL;
+        }
+    }
+    
+    client_buf_pin(client_buf_sizes[buf_class]);
+    client_bufs_allocated += client_buf_sizes[buf_class];
+    
+    return buf;
+}
+
+void client_buf_release (uint8_t *buf, int buf_class)
+{
+    ASSERT(buf)
+    ASSERT(buf_class >= 0)
+    ASSERT(buf_class < CLIENT_BUF_NUM_CLASSES)
+    
+    client_buf_unpin(client_buf_sizes[buf_class]);
+    client_bufs_allocated -= client_buf_sizes[buf_class];
+    
+    // free the buffer if we already keep enough of them
+    if (client_buf_num_free[buf_class] >= CLIENT_BUF_POOL_MAX_FREE) {
+        BArena_Release(BPendingGroup_Arena(BReactor_PendingGroup(&ss)), buf, client_buf_sizes[buf_class]);
+        return;
+    }
+    
+    memcpy(buf, &client_buf_free[buf_class], sizeof(void *));
+    client_buf_free[buf_class] = buf;
+    client_buf_num_free[buf_class]++;
+}
+
+void client_buf_pin (size_t bytes)
+{
+    client_bufs_pinned += bytes;
+    
+    if (client_bufs_pinned > client_bufs_pinned_max) {
+        client_bufs_pinned_max = client_bufs_pinned;
+    }
+}
+
+void client_buf_unpin (size_t bytes)
+{
+    ASSERT(bytes <= client_bufs_pinned)
+    
+    client_bufs_pinned -= bytes;
+}
+
+void client_buf_free_all (void)
+{
+    for (int i = 0; i < CLIENT_BUF_NUM_CLASSES; i++) {
+        while (client_buf_free[i]) {
+            uint8_t *buf = (uint8_t *)client_buf_free[i];
+            memcpy(&client_buf_free[i], buf, sizeof(void *));
+            BArena_Release(BPendingGroup_Arena(BReactor_PendingGroup(&ss)), buf, client_buf_sizes[i]);
+        }
+        client_buf_num_free[i] = 0;
+    }
+}
+
+void client_buf_stats_timer_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    // schedule next timer
+    BReactor_SetTimer(&ss, &client_buf_stats_timer);
+    
+    BLog(BLOG_INFO, "client buffers: %zu bytes pinned (max %zu), %d clients (max %d), %d+%d+%d free buffers",
+         client_bufs_pinned, client_bufs_pinned_max, num_clients, BObjectPool_MaxUsed(&clients_pool),
+         client_buf_num_free[0], client_buf_num_free[1], client_buf_num_free[2]);
+    
+    for (int i = 0; i < LWIP_MEMPOOLS_NUM; i++) {
+        struct lwip_mempools_stats stats;
+        lwip_mempools_get_stats(i, &stats);
+        BLog(BLOG_INFO, "lwip %s pool: %d/%d used (max %d), %"PRIu64" allocations beyond pool",
+             lwip_mempools_name(i), stats.used, stats.num, stats.max_used, stats.fallbacks);
+    }
+    
+    if (options.memory_limit > 0) {
+        int level = memory_pressure_level();
+        BLog(BLOG_INFO, "memory: %zu of %zu bytes, pressure %s", memory_pressure.used, memory_pressure.limit, MemPressure_LevelName(level));
+    }
+    
+    // connections accepted since the last time, against what we let in
+    uint64_t accepted = BMetric_Value(&metric_tcp_accepted);
+    int pending = 0;
+    if (listener) {
+        pending += ((struct tcp_pcb_listen *)listener)->accepts_pending;
+    }
+    if (listener_ip6) {
+        pending += ((struct tcp_pcb_listen *)listener_ip6)->accepts_pending;
+    }
+    BLog(BLOG_INFO, "tcp accept: %.1f/s (%"PRIu64" total), %d in handshake (max %d), refused %"PRIu64" over rate, %"PRIu64" full, %"PRIu64" memory, %"PRIu64" evicted",
+         (double)(accepted - tcp_accepted_last) * 1000 / CLIENT_BUF_STATS_INTERVAL, accepted, pending, options.tcp_max_pending,
+         BMetric_Value(&metric_tcp_refused_rate), BMetric_Value(&metric_tcp_refused_full), BMetric_Value(&metric_tcp_refused_memory), BMetric_Value(&metric_tcp_evicted));
+    if (options.tcp_accept_rate > 0) {
+        BLog(BLOG_INFO, "tcp accept: capacity %d/s per source, burst %d", options.tcp_accept_rate,
+             (options.tcp_accept_burst > 0 ? options.tcp_accept_burst : options.tcp_accept_rate));
+    }
+    tcp_accepted_last = accepted;
+}
+
+int memory_pressure_update (int may_fall)
+{
+    if (options.memory_limit == 0) {
+        return MEMPRESSURE_LEVEL_NONE;
+    }
+    
+    // count client buffers, everything lwIP holds, and the buffers of UDP associations
+    size_t used = client_bufs_allocated + lwip_mempools_bytes_used();
+    if (udp_mode == UdpModeUdpgw) {
+        used += SocksUdpGwClient_GetMemoryUsage(&udpgw_current->client);
+        for (LinkedList1Node *node = LinkedList1_GetFirst(&udpgw_retired); node; node = LinkedList1Node_Next(node)) {
+            struct udpgw_instance *u = UPPER_OBJECT(node, struct udpgw_instance, retired_node);
+            used += SocksUdpGwClient_GetMemoryUsage(&u->client);
+        }
+    }
+    if (have_direct_udp) {
+        used += DirectUdpClient_GetMemoryUsage(&direct_udp_client);
+    }
+    
+    int old_level = MemPressure_Level(&memory_pressure);
+    
+    if (MemPressure_Update(&memory_pressure, used, may_fall)) {
+        int level = MemPressure_Level(&memory_pressure);
+        BLog((level > old_level ? BLOG_WARNING : BLOG_NOTICE), "memory pressure %s -> %s (%zu of %zu bytes)",
+             MemPressure_LevelName(old_level), MemPressure_LevelName(level), used, memory_pressure.limit);
+        
+        // new UDP associations take over old ones while flows are not admitted
+        int admit_new = (level < MEMPRESSURE_LEVEL_NO_ADMIT);
+        if (udp_mode == UdpModeUdpgw) {
+            SocksUdpGwClient_SetAdmitNew(&udpgw_current->client, admit_new);
+        }
+        if (have_direct_udp) {
+            DirectUdpClient_SetAdmitNew(&direct_udp_client, admit_new);
+        }
+    }
+    
+    return MemPressure_Level(&memory_pressure);
+}
+
+int memory_pressure_level (void)
+{
+    // the level only drops from the timer, so that it does not follow every burst
+    return memory_pressure_update(0);
+}
+
+void memory_pressure_timer_handler (void *unused)
+{
+    ASSERT(!quitting)
+    ASSERT(options.memory_limit > 0)
+    
+    // schedule next timer
+    BReactor_SetTimer(&ss, &memory_pressure_timer);
+    
+    // let the level drop if usage stayed down
+    memory_pressure_update(1);
+    
+    // evict idle UDP associations until the pressure drops out of the eviction level
+    int evicted = 0;
+    while (memory_pressure_level() == MEMPRESSURE_LEVEL_EVICT) {
+        int num = 0;
+        if (udp_mode == UdpModeUdpgw) {
+            num += SocksUdpGwClient_EvictIdle(&udpgw_current->client, MEMORY_EVICT_IDLE_TIME, MEMORY_EVICT_BATCH);
+        }
+        if (have_direct_udp) {
+            num += DirectUdpClient_EvictIdle(&direct_udp_client, MEMORY_EVICT_IDLE_TIME, MEMORY_EVICT_BATCH);
+        }
+        if (num == 0) {
+            break;
+        }
+        evicted += num;
+    }
+    
+    if (evicted > 0) {
+        BLog(BLOG_WARNING, "memory pressure: evicted %d idle UDP associations", evicted);
+    }
+}
+
+void init_metrics (void)
+{
+    BMetric_InitGaugeFunc(&metric_tcp_clients, "badvpn_tun2socks_tcp_clients", NULL, "TCP connections being forwarded.", metric_tcp_clients_func, NULL);
+    BMetric_InitGaugeFunc(&metric_socks_pool_sessions, "badvpn_tun2socks_socks_pool_sessions", NULL, "SOCKS sessions authenticated in advance.", metric_socks_pool_sessions_func, NULL);
+    BMetric_InitGaugeFunc(&metric_client_buf_bytes, "badvpn_tun2socks_client_buffer_bytes", NULL, "Bytes held in TCP client receive buffers.", metric_client_buf_bytes_func, NULL);
+    BMetric_InitCounter(&metric_device_packets_in, "badvpn_tun2socks_device_packets_total", "direction=\"in\"", "Packets read from and written to the TUN device.");
+    BMetric_InitCounter(&metric_device_packets_out, "badvpn_tun2socks_device_packets_total", "direction=\"out\"", "Packets read from and written to the TUN device.");
+    BMetric_InitCounter(&metric_device_bytes_in, "badvpn_tun2socks_device_bytes_total", "direction=\"in\"", "Bytes read from and written to the TUN device.");
+    BMetric_InitCounter(&metric_device_bytes_out, "badvpn_tun2socks_device_bytes_total", "direction=\"out\"", "Bytes read from and written to the TUN device.");
+    BMetric_InitCounter(&metric_device_drops_in, "badvpn_tun2socks_device_dropped_packets_total", "direction=\"in\"", "Packets dropped on the way from or to the TUN device.");
+    BMetric_InitCounter(&metric_device_drops_out, "badvpn_tun2socks_device_dropped_packets_total", "direction=\"out\"", "Packets dropped on the way from or to the TUN device.");
+    BMetric_InitCounter(&metric_socks_server_failures, "badvpn_tun2socks_socks_server_failures_total", NULL, "Failed SOCKS handshakes.");
+    BMetric_InitHistogram(&metric_socks_handshake_time, "badvpn_tun2socks_socks_handshake_milliseconds", NULL, "Time to complete a SOCKS handshake.");
+    BMetric_InitCounter(&metric_tcp_accepted, "badvpn_tun2socks_tcp_accepted_total", NULL, "TCP connections accepted from the TUN device.");
+    BMetric_InitCounter(&metric_tcp_refused_rate, "badvpn_tun2socks_tcp_refused_total", "reason=\"rate\"", "TCP connections refused, by reason.");
+    BMetric_InitCounter(&metric_tcp_refused_full, "badvpn_tun2socks_tcp_refused_total", "reason=\"full\"", "TCP connections refused, by reason.");
+    BMetric_InitCounter(&metric_tcp_refused_memory, "badvpn_tun2socks_tcp_refused_total", "reason=\"memory\"", "TCP connections refused, by reason.");
+    BMetric_InitCounter(&metric_tcp_evicted, "badvpn_tun2socks_tcp_evicted_total", NULL, "Idle TCP connections reset to make room for new ones.");
+}
+
+void free_metrics (void)
+{
+    BMetric_Free(&metric_tcp_evicted);
+    BMetric_Free(&metric_tcp_refused_memory);
+    BMetric_Free(&metric_tcp_refused_full);
+    BMetric_Free(&metric_tcp_refused_rate);
+    BMetric_Free(&metric_tcp_accepted);
+    BMetric_Free(&metric_socks_handshake_time);
+    BMetric_Free(&metric_socks_server_failures);
+    BMetric_Free(&metric_device_drops_out);
+    BMetric_Free(&metric_device_drops_in);
+    BMetric_Free(&metric_device_bytes_out);
+    BMetric_Free(&metric_device_bytes_in);
+    BMetric_Free(&metric_device_packets_out);
+    BMetric_Free(&metric_device_packets_in);
+    BMetric_Free(&metric_client_buf_bytes);
+    BMetric_Free(&metric_socks_pool_sessions);
+    BMetric_Free(&metric_tcp_clients);
+}
+
+int64_t metric_tcp_clients_func (void *unused)
+{
+    return num_clients;
+}
+
+int64_t metric_socks_pool_sessions_func (void *unused)
+{
+    return socks_pool_num;
+}
+
+int64_t metric_client_buf_bytes_func (void *unused)
+{
+    return client_bufs_pinned;
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+int control_handler (void *unused, MemRef command, ExpString *reply)
+{
+    ASSERT(!quitting)
+    
+    MemRef word;
+    if (!bypass_next_word(&command, &word)) {
+        return 1;
+    }
+    
+    if (MemRef_Equal(word, MemRef_MakeCstr("connections"))) {
+        return control_connections(command, reply);
+    }
+    
+    if (MemRef_Equal(word, MemRef_MakeCstr("help"))) {
+        return ExpString_Append(reply,
+            "connections [sort age/rate] [limit <number>]\n"
+            "    TCP connections, oldest or fastest first; times are in ms, rates in bytes/s\n"
+        );
+    }
+    
+    return ExpString_Append(reply, "unknown command, try help\n");
+}
+
+static int control_compare_age (const void *v1, const void *v2)
+{
+    struct tcp_client *c1 = *(struct tcp_client * const *)v1;
+    struct tcp_client *c2 = *(struct tcp_client * const *)v2;
+    return (c1->id > c2->id) - (c1->id < c2->id);
+}
+
+static int control_compare_rate (const void *v1, const void *v2)
+{
+    struct tcp_client *c1 = *(struct tcp_client * const *)v1;
+    struct tcp_client *c2 = *(struct tcp_client * const *)v2;
+    return (c1->rate < c2->rate) - (c1->rate > c2->rate);
+}
+
+int control_connections (MemRef args, ExpString *reply)
+{
+    // parse arguments
+    int sort_rate = 0;
+    uintmax_t limit = UINTMAX_MAX;
+    MemRef word;
+    MemRef value;
+    while (bypass_next_word(&args, &word)) {
+        if (!bypass_next_word(&args, &value)) {
+            return ExpString_Append(reply, "missing argument\n");
+        }
+        if (MemRef_Equal(word, MemRef_MakeCstr("sort")) && MemRef_Equal(value, MemRef_MakeCstr("age"))) {
+            sort_rate = 0;
+        }
+        else if (MemRef_Equal(word, MemRef_MakeCstr("sort")) && MemRef_Equal(value, MemRef_MakeCstr("rate"))) {
+            sort_rate = 1;
+        }
+        else if (MemRef_Equal(word, MemRef_MakeCstr("limit")) && parse_unsigned_integer(value, &limit)) {
+        }
+        else {
+            return ExpString_Append(reply, "bad arguments, try help\n");
+        }
+    }
+    
+    // collect clients, bringing their rates up to date; a rate is measured over
+    // the time since it was last measured, so that it follows what the
+    // connection is doing now
+    struct tcp_client **clients = (struct tcp_client **)BAllocArray(num_clients, sizeof(clients[0]));
+    if (num_clients > 0 && !clients) {
+        return 0;
+    }
+    btime_t now = BReactor_GetTime(&ss);
+    int num = 0;
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&tcp_clients); node; node = LinkedList1Node_Next(node)) {
+        struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+        ASSERT(num < num_clients)
+        
+        uint64_t bytes = client->bytes_up + client->bytes_down;
+        btime_t elapsed = now - client->rate_time;
+        if (elapsed >= CLIENT_RATE_MIN_INTERVAL) {
+            client->rate = (bytes - client->rate_bytes) * 1000 / elapsed;
+            client->rate_bytes = bytes;
+            client->rate_time = now;
+        }
+        else if (client->rate_time == client->start_time) {
+            client->rate = bytes * 1000 / bmax_int64(elapsed, 1);
+        }
+        
+        clients[num++] = client;
+    }
+    ASSERT(num == num_clients)
+    
+    qsort(clients, num, sizeof(clients[0]), (sort_rate ? control_compare_rate : control_compare_age));
+    
+    int res = 0;
+    char line[2 * BADDR_MAX_PRINT_LEN + 256];
+    
+    sprintf(line, "%-8s %-22s %-22s %-10s %9s %9s %9s %9s %12s %12s %10s %9s %9s %8s %8s %8s\n",
+            "ID", "SOURCE", "DESTINATION", "STATE", "AGE", "CONNECT", "OPEN", "CLOSING",
+            "UP_BYTES", "DOWN_BYTES", "RATE", "SNDBUF_W", "SOCKS_W", "SND_BUF", "SND_WND", "BUFFERED");
+    if (!ExpString_Append(reply, line)) {
+        goto out;
+    }
+    
+    for (int i = 0; i < num && i < limit; i++) {
+        struct tcp_client *client = clients[i];
+        
+        char local_addr_s[BADDR_MAX_PRINT_LEN];
+        BAddr_Print(&client->local_addr, local_addr_s);
+        char remote_addr_s[BADDR_MAX_PRINT_LEN];
+        BAddr_Print(&client->remote_addr, remote_addr_s);
+        
+        // time spent connecting SOCKS, forwarding, and since one side closed
+        btime_t closed = (client->close_time >= 0 ? client->close_time : now);
+        btime_t up = (client->socks_up_time >= 0 ? client->socks_up_time : closed);
+        const char *state = (client->close_time >= 0 ? "closing" : client->socks_up_time >= 0 ? "open" : "connecting");
+        
+        // blocked times, including a wait still going on
+        btime_t socks_blocked = client->socks_send_blocked;
+        if (client->socks_send_since >= 0 && !client->socks_closed) {
+            socks_blocked += now - client->socks_send_since;
+        }
+        btime_t snd_buf_blocked = client->snd_buf_blocked;
+        if (client->socks_up && client->socks_recv_waiting && !client->client_closed) {
+            snd_buf_blocked += now - client->snd_buf_wait_since;
+        }
+        
+        // what lwIP lets us queue and send to the client
+        char snd_buf_s[16] = "-";
+        char snd_wnd_s[16] = "-";
+        if (!client->client_closed) {
+            sprintf(snd_buf_s, "%d", (int)tcp_sndbuf(client->pcb));
+            sprintf(snd_wnd_s, "%d", (int)bmin_int64(client->pcb->snd_wnd, client->pcb->cwnd));
+        }
+        
+        sprintf(line, "%-8"PRIu64" %-22s %-22s %-10s %9"PRIi64" %9"PRIi64" %9"PRIi64" %9"PRIi64" %12"PRIu64" %12"PRIu64" %10"PRIu64" %9"PRIi64" %9"PRIi64" %8s %8s %8d\n",
+                client->id, remote_addr_s, local_addr_s, state, (int64_t)(now - client->start_time),
+                (int64_t)(up - client->start_time), (int64_t)(closed - up), (int64_t)(now - closed),
+                client->bytes_up, client->bytes_down, client->rate, (int64_t)snd_buf_blocked, (int64_t)socks_blocked,
+                snd_buf_s, snd_wnd_s, client->buf_used);
+        if (!ExpString_Append(reply, line)) {
+            goto out;
+        }
+    }
+    
+    res = 1;
+    
+out:
+    BFree(clients);
+    return res;
+}
+
+#endif
+
+void tcp_timer_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    BLog(BLOG_DEBUG, "TCP timer");
+    
+    // call the TCP timer function (every 1/4 second)
+    tcp_tmr();
+    
+    // increment tcp_timer_mod4
+    tcp_timer_mod4 = (tcp_timer_mod4 + 1) % 4;
+    
+    // every second, call other timer functions
+    if (tcp_timer_mod4 == 0) {
+#if IP_REASSEMBLY
+        ASSERT(IP_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
+        ip_reass_tmr();
+#endif
+        
+#if LWIP_IPV6
+        ASSERT(ND6_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
+        nd6_tmr();
+#endif
+    
+#if LWIP_IPV6 && LWIP_IPV6_REASS
+        ASSERT(IP6_REASS_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
+        ip6_reass_tmr();
+#endif
+    }
+    
+    // schedule next timer only while lwIP has something to time, so that idle
+    // connections don't wake us up; lwIP and the device input start it again
+    if (lwip_timers_needed()) {
+        BReactor_SetTimer(&ss, &tcp_timer);
+    }
+}
+
+int lwip_timers_needed (void)
+{
+    if (tcp_tmr_needed()) {
+        return 1;
+    }
+    
+#if IP_REASSEMBLY
+    if (ip_reass_tmr_needed()) {
+        return 1;
+    }
+#endif
+    
+#if LWIP_IPV6 && LWIP_IPV6_REASS
+    if (ip6_reass_tmr_needed()) {
+        return 1;
+    }
+#endif
+    
+    // nd6_tmr has nothing to time: the netif outputs without neighbor
+    // discovery and its address is valid from the start
+    
+    return 0;
+}
+
+void lwip_timers_start (void)
+{
+    if (!BTimer_IsRunning(&tcp_timer)) {
+        BReactor_SetTimer(&ss, &tcp_timer);
+    }
+}
+
+void tcp_timer_needed (void)
+{
+    // called by lwIP when a PCB may need tcp_tmr
+    lwip_timers_start();
+}
+
+void device_error_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    BLog(BLOG_ERROR, "device error");
+    
+    terminate();
+    return;
+}
+
+void device_read_handler_send (void *unused, uint8_t *data, int data_len)
+{
+    ASSERT(!quitting)
+    ASSERT(data_len >= 0)
+    
+    BLog(BLOG_DEBUG, "device: received packet");
+    
+    BMetric_Add(&metric_device_packets_in, 1);
+    BMetric_Add(&metric_device_bytes_in, data_len);
+    
+    // accept packet
+    PacketPassInterface_Done(&device_read_interface);
+    
+    // strip the offload header; checksums which the kernel has verified or left
+    // for us to compute don't need to be verified
+    int csum_valid = 0;
+    if (device_offload) {
+        if (data_len < device_hdr_len) {
+            BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "device read: missing offload header");
+            BMetric_Add(&metric_device_drops_in, 1);
+            return;
+        }
+        struct BTap_offload_header hdr;
+        memcpy(&hdr, data, sizeof(hdr));
+        csum_valid = !!(hdr.flags & (BTAP_OFFLOAD_FLAG_NEEDS_CSUM | BTAP_OFFLOAD_FLAG_DATA_VALID));
+        data += device_hdr_len;
+        data_len -= device_hdr_len;
+    }
+    
+    // process UDP directly
+    if (process_device_udp_packet(data, data_len, csum_valid)) {
+        return;
+    }
+    
+    // relay pings instead of having lwIP answer them
+    if (options.udpgw_icmp && process_device_icmp_packet(data, data_len)) {
+        return;
+    }
+    
+    // drop connection attempts of sources over their rate, before lwIP takes a PCB
+    // for them; the SYN is retransmitted like one which got lost
+    if (tcp_accept_slots && !tcp_accept_admit(data, data_len)) {
+        return;
+    }
+    
+    // obtain pbuf
+    if (data_len > UINT16_MAX) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "device read: packet too large");
+        BMetric_Add(&metric_device_drops_in, 1);
+        return;
+    }
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, data_len, PBUF_POOL);
+    if (!p) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "device read: pbuf_alloc failed");
+        BMetric_Add(&metric_device_drops_in, 1);
+        return;
+    }
+    
+    // write packet to pbuf
+    ASSERT_FORCE(pbuf_take(p, data, data_len) == ERR_OK)
+    
+    // let lwIP skip the TCP checksum if it needs no verification
+    if (device_offload) {
+        NETIF_SET_CHECKSUM_CTRL(&the_netif, device_netif_checksums(!csum_valid));
+    }
+    
+    // pass pbuf to input
+    if (the_netif.input(p, &the_netif) != ERR_OK) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "device read: input failed");
+        BMetric_Add(&metric_device_drops_in, 1);
+        pbuf_free(p);
+    }
+    
+    // the packet may have been queued for reassembly
+    lwip_timers_start();
+}
+
+int process_device_udp_packet (uint8_t *data, int data_len, int csum_valid)
+{
+    ASSERT(data_len >= 0)
+    
+    // do nothing if we don't forward UDP, there is no bypass table and no fake DNS
+    if (udp_mode == UdpModeNone && !have_bypass && !have_fake_dns) {
+        goto fail;
+    }
+    
+    BAddr local_addr;
+    BAddr remote_addr;
+    int is_dns;
+    
+    uint8_t ip_version = 0;
+    if (data_len > 0) {
+        ip_version = (data[0] >> 4);
+    }
+    
+    switch (ip_version) {
+        case 4: {
+            // ignore non-UDP packets
+            if (data_len < sizeof(struct ipv4_header) || data[offsetof(struct ipv4_header, protocol)] != IPV4_PROTOCOL_UDP) {
+                goto fail;
+            }
+            
+            // parse IPv4 header
+            struct ipv4_header ipv4_header;
+            if (!ipv4_check(data, data_len, &ipv4_header, &data, &data_len)) {
+                goto fail;
+            }
+            
+            // parse UDP
+            struct udp_header udp_header;
+            if (!udp_check(data, data_len, &udp_header, &data, &data_len)) {
+                goto fail;
+            }
+            
+            // verify UDP checksum, unless the kernel did or left it to us
+            if (!csum_valid) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
+            }
+            
+            BLog(BLOG_INFO, "UDP: from device %d bytes", data_len);
+            
+            // construct addresses
+            BAddr_InitIPv4(&local_addr, ipv4_header.source_address, udp_header.source_port);
+            BAddr_InitIPv4(&remote_addr, ipv4_header.destination_address, udp_header.dest_port);
+            
+            // if transparent DNS is enabled, any packet arriving at out netif
+            // address to port 53 is considered a DNS packet
+            is_dns = (options.udpgw_transparent_dns &&
+                      ipv4_header.destination_address == netif_ipaddr.ipv4 &&
+                      udp_header.dest_port == hton16(53));
+        } break;
+        
+        case 6: {
+            // ignore if IPv6 support is disabled
+            if (!options.netif_ip6addr) {
+                goto fail;
+            }
+            
+            // ignore non-UDP packets
+            if (data_len < sizeof(struct ipv6_header) || data[offsetof(struct ipv6_header, next_header)] != IPV6_NEXT_UDP) {
+                goto fail;
+            }
+            
+            // parse IPv6 header
+            struct ipv6_header ipv6_header;
+            if (!ipv6_check(data, data_len, &ipv6_header, &data, &data_len)) {
+                goto fail;
+            }
+            
+            // parse UDP
+            struct udp_header udp_header;
+            if (!udp_check(data, data_len, &udp_header, &data, &data_len)) {
+                goto fail;
+            }
+            
+            // verify UDP checksum, unless the kernel did or left it to us
+            if (!csum_valid) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
+            }
+            
+            BLog(BLOG_INFO, "UDP/IPv6: from device %d bytes", data_len);
+            
+            // construct addresses
+            BAddr_InitIPv6(&local_addr, ipv6_header.source_address, udp_header.source_port);
+            BAddr_InitIPv6(&remote_addr, ipv6_header.destination_address, udp_header.dest_port);
+            
+            // TODO dns
+            is_dns = 0;
+        } break;
+        
+        default: {
+            goto fail;
+        } break;
+    }
+    
+    // check payload length
+    if (data_len > udp_mtu) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "packet is too large, cannot send to udpgw");
+        goto fail;
+    }
+    
+    // answer DNS queries with fake addresses, and drop other packets to fake
+    // addresses, since there is no name to send them to
+    if (have_fake_dns) {
+        if (BAddr_GetPort(&remote_addr) == hton16(53) &&
+            FakeDns_SubmitQuery(&fake_dns, local_addr, remote_addr, data, data_len)
+        ) {
+            return 1;
+        }
+        if (remote_addr.type == BADDR_TYPE_IPV4 && FakeDns_IsFakeAddr(&fake_dns, remote_addr.ipv4.ip)) {
+            return 1;
+        }
+    }
+    
+    // send packets to bypassed destinations directly, or drop them
+    switch (bypass_lookup(remote_addr)) {
+        case BypassActionDirect:
+            DirectUdpClient_SubmitPacket(&direct_udp_client, local_addr, remote_addr, data, data_len);
+            return 1;
+        case BypassActionDrop:
+            return 1;
+    }
+    
+    // the rest is only forwarded with udpgw, SOCKS UDP, or directly
+    if (udp_mode == UdpModeNone) {
+        goto fail;
+    }
+    
+    // answer DNS queries from the cache, or join an outstanding request
+    if (have_dns_cache && BAddr_GetPort(&remote_addr) == hton16(53) &&
+        DnsCache_SubmitQuery(&dns_cache, local_addr, remote_addr, data, data_len)
+    ) {
+        return 1;
+    }
+    
+    // submit packet to udpgw or SOCKS UDP
+    if (udp_mode == UdpModeUdpgw) {
+        SocksUdpGwClient_SubmitPacket(udpgw_client_for_flow(local_addr, remote_addr), local_addr, remote_addr,
+                                      is_dns, data, data_len);
+    } else if (udp_mode == UdpModeSocks) {
+        SocksUdpClient_SubmitPacket(&socks_udp_client, local_addr, remote_addr, data, data_len);
+    } else if (udp_mode == UdpModeDirect) {
+        DirectUdpClient_SubmitPacket(&direct_udp_client, local_addr, remote_addr, data, data_len);
+    }
+    
+    return 1;
+    
+fail:
+    return 0;
+}
+
+int process_device_icmp_packet (uint8_t *data, int data_len)
+{
+    ASSERT(options.udpgw_icmp)
+    ASSERT(data_len >= 0)
+    
+    BAddr local_addr;
+    BAddr remote_addr;
+    struct icmp_echo_header icmp_header;
+    uint8_t *payload;
+    int payload_len;
+    
+    uint8_t ip_version = 0;
+    if (data_len > 0) {
+        ip_version = (data[0] >> 4);
+    }
+    
+    switch (ip_version) {
+        case 4: {
+            // ignore non-ICMP packets
+            if (data_len < sizeof(struct ipv4_header) || data[offsetof(struct ipv4_header, protocol)] != IPV4_PROTOCOL_ICMP) {
+                return 0;
+            }
+            
+            // parse IPv4 header
+            struct ipv4_header ipv4_header;
+            if (!ipv4_check(data, data_len, &ipv4_header, &data, &data_len)) {
+                return 0;
+            }
+            
+            // leave fragments to reassembly in lwIP, and pings to our own
+            // address to be answered there
+            if ((ntoh16(ipv4_header.flags3_fragmentoffset13) & 0x3FFF) || ipv4_header.destination_address == netif_ipaddr.ipv4) {
+                return 0;
+            }
+            
+            // parse echo request
+            if (!icmp_echo_check(data, data_len, ICMP_TYPE_ECHO_REQUEST, &icmp_header, &payload, &payload_len) ||
+                icmp_checksum(&icmp_header, payload, payload_len) != 0
+            ) {
+                return 0;
+            }
+            
+            // construct addresses; the port is the echo identifier, which tells
+            // flows from the same source apart
+            BAddr_InitIPv4(&local_addr, ipv4_header.source_address, icmp_header.identifier);
+            BAddr_InitIPv4(&remote_addr, ipv4_header.destination_address, icmp_header.identifier);
+        } break;
+        
+        case 6: {
+            // ignore if IPv6 support is disabled
+            if (!options.netif_ip6addr) {
+                return 0;
+            }
+            
+            // ignore non-ICMPv6 packets
+            if (data_len < sizeof(struct ipv6_header) || data[offsetof(struct ipv6_header, next_header)] != IPV6_NEXT_ICMPV6) {
+                return 0;
+            }
+            
+            // parse IPv6 header
+            struct ipv6_header ipv6_header;
+            if (!ipv6_check(data, data_len, &ipv6_header, &data, &data_len)) {
+                return 0;
+            }
+            
+            // leave pings to our own address to lwIP
+            if (!memcmp(ipv6_header.destination_address, netif_ip6addr.bytes, 16)) {
+                return 0;
+            }
+            
+            // parse echo request
+            if (!icmp_echo_check(data, data_len, ICMPV6_TYPE_ECHO_REQUEST, &icmp_header, &payload, &payload_len) ||
+                icmp_ip6_checksum(&icmp_header, payload, payload_len, ipv6_header.source_address, ipv6_header.destination_address) != 0
+            ) {
+                return 0;
+            }
+            
+            // construct addresses
+            BAddr_InitIPv6(&local_addr, ipv6_header.source_address, icmp_header.identifier);
+            BAddr_InitIPv6(&remote_addr, ipv6_header.destination_address, icmp_header.identifier);
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    // check length
+    if (data_len > udp_mtu) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "ICMP: echo request is too large, cannot send to udpgw");
+        return 0;
+    }
+    
+    // bypassed and fake destinations aren't reached through udpgw
+    if (bypass_lookup(remote_addr) != BypassActionProxy ||
+        (have_fake_dns && remote_addr.type == BADDR_TYPE_IPV4 && FakeDns_IsFakeAddr(&fake_dns, remote_addr.ipv4.ip))
+    ) {
+        return 0;
+    }
+    
+    // submit the whole echo message; if the server doesn't relay ICMP,
+    // leave it to lwIP
+    if (!SocksUdpGwClient_SubmitIcmpPacket(udpgw_client_for_flow(local_addr, remote_addr), local_addr, remote_addr, data, data_len)) {
+        return 0;
+    }
+    
+    BLog(BLOG_INFO, "ICMP: echo request to udpgw %d bytes", payload_len);
+    
+    return 1;
+}
+
+int tcp_accept_admit (const uint8_t *data, int data_len)
+{
+    ASSERT(tcp_accept_slots)
+    ASSERT(data_len >= 0)
+    
+    // find where the TCP header is and the source address; packets we cannot
+    // read this from are left for lwIP to deal with
+    uint8_t source[16];
+    int tcp_offset;
+    
+    uint8_t ip_version = 0;
+    if (data_len > 0) {
+        ip_version = (data[0] >> 4);
+    }
+    
+    switch (ip_version) {
+        case 4: {
+            struct ipv4_header ipv4_header;
+            if (data_len < sizeof(ipv4_header)) {
+                return 1;
+            }
+            memcpy(&ipv4_header, data, sizeof(ipv4_header));
+            
+            // only the first fragment has the TCP header
+            if (ipv4_header.protocol != IPV4_PROTOCOL_TCP || (ntoh16(ipv4_header.flags3_fragmentoffset13) & 0x1FFF) != 0) {
+                return 1;
+            }
+            
+            tcp_offset = IPV4_GET_IHL(ipv4_header) * 4;
+            memset(source, 0, sizeof(source));
+            memcpy(source, &ipv4_header.source_address, sizeof(ipv4_header.source_address));
+        } break;
+        
+        case 6: {
+            struct ipv6_header ipv6_header;
+            if (data_len < sizeof(ipv6_header)) {
+                return 1;
+            }
+            memcpy(&ipv6_header, data, sizeof(ipv6_header));
+            
+            // extension headers are not looked through
+            if (ipv6_header.next_header != IPV6_NEXT_TCP) {
+                return 1;
+            }
+            
+            tcp_offset = sizeof(ipv6_header);
+            memcpy(source, ipv6_header.source_address, sizeof(source));
+        } break;
+        
+        default:
+            return 1;
     }
     
-    // bind listener
-    if (tcp_bind_to_netif(l, "ho0") != ERR_OK) {
-        BLog(BLOG_ERROR, "tcp_bind_to_netif failed");
-        tcp_close(l);
-        goto fail;
+    struct tcp_header tcp_header;
+    if (tcp_offset < 20 || data_len - tcp_offset < (int)sizeof(tcp_header)) {
+        return 1;
     }
+    memcpy(&tcp_header, data + tcp_offset, sizeof(tcp_header));
     
-    // ensure the listener only accepts connections from this netif
-    tcp_bind_netif(l, &the_netif);
+    // only a SYN opening a connection takes from the rate
+    if ((tcp_header.flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST)) != TCP_FLAG_SYN) {
+        return 1;
+    }
     
-    // listen listener
-    if (!(listener = tcp_listen(l))) {
-        BLog(BLOG_ERROR, "tcp_listen failed");
-        tcp_close(l);
-        goto fail;
+    // the bucket holds up to a burst of connections, in thousandths so that it
+    // fills by the rate times the milliseconds passed
+    int64_t burst = (int64_t)(options.tcp_accept_burst > 0 ? options.tcp_accept_burst : options.tcp_accept_rate) * 1000;
+    btime_t now = btime_gettime();
+    
+    // find the slot of the source, taking it over if another source has it
+    struct tcp_accept_slot *slot = &tcp_accept_slots[badvpn_hash_bin(source, sizeof(source), tcp_accept_seed) % TCP_ACCEPT_RATE_SLOTS];
+    if (!slot->used || memcmp(slot->addr, source, sizeof(source))) {
+        slot->used = 1;
+        memcpy(slot->addr, source, sizeof(source));
+        slot->tokens = burst;
+    } else if (now > slot->time) {
+        slot->tokens = bmin_int64(burst, slot->tokens + bmin_int64(now - slot->time, burst) * options.tcp_accept_rate);
     }
+    slot->time = now;
     
-    // setup listener accept handler
-    tcp_accept(listener, listener_accept_func);
+    if (slot->tokens < 1000) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "device read: dropping SYN over the connection rate of its source");
+        BMetric_Add(&metric_tcp_refused_rate, 1);
+        return 0;
+    }
     
-    if (options.netif_ip6addr) {
-        struct tcp_pcb *l_ip6 = tcp_new_ip_type(IPADDR_TYPE_V6);
-        if (!l_ip6) {
-            BLog(BLOG_ERROR, "tcp_new_ip_type failed");
-            goto fail;
+    slot->tokens -= 1000;
+    return 1;
+}
+
+err_t netif_init_func (struct netif *netif)
+{
+    BLog(BLOG_DEBUG, "netif func init");
+    
+    netif->name[0] = 'h';
+    netif->name[1] = 'o';
+    netif->output = netif_output_func;
+    netif->output_ip6 = netif_output_ip6_func;
+    
+    // with offloads, TCP checksums are computed by the kernel
+    if (device_offload) {
+        NETIF_SET_CHECKSUM_CTRL(netif, device_netif_checksums(1));
+    }
+    
+    return ERR_OK;
+}
+
+err_t netif_output_func (struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    return common_netif_output(netif, p);
+}
+
+err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+{
+    return common_netif_output(netif, p);
+}
+
+err_t common_netif_output (struct netif *netif, struct pbuf *p)
+{
+    SYNC_DECL
+    
+    BLog(BLOG_DEBUG, "device write: send packet");
+    
+    if (quitting) {
+        return ERR_OK;
+    }
+    
+    // with offloads, packets need a header and TCP segments may be merged;
+    // no SYNC here, that would run the job that sends merged segments right away
+    if (device_offload) {
+        device_offload_output(p);
+        goto out;
+    }
+    
+    // if there is just one chunk, send it directly, else via buffer
+    if (!p->next) {
+        if (p->len > BTap_GetMTU(&device)) {
+            BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "netif func output: no space left");
+            BMetric_Add(&metric_device_drops_out, 1);
+            goto out;
         }
         
-        if (tcp_bind_to_netif(l_ip6, "ho0") != ERR_OK) {
-            BLog(BLOG_ERROR, "tcp_bind_to_netif failed");
-            tcp_close(l_ip6);
-            goto fail;
+        BMetric_Add(&metric_device_packets_out, 1);
+        BMetric_Add(&metric_device_bytes_out, p->len);
+        
+        SYNC_FROMHERE
+        BTap_Send(&device, (uint8_t *)p->payload, p->len);
+        SYNC_COMMIT
+    } else {
+        if (p->tot_len > BTap_GetMTU(&device)) {
+            BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "netif func output: no space left");
+            BMetric_Add(&metric_device_drops_out, 1);
+            goto out;
         }
         
-        tcp_bind_netif(l_ip6, &the_netif);
+        BMetric_Add(&metric_device_packets_out, 1);
+        BMetric_Add(&metric_device_bytes_out, p->tot_len);
         
-        if (!(listener_ip6 = tcp_listen(l_ip6))) {
-            BLog(BLOG_ERROR, "tcp_listen failed");
-            tcp_close(l_ip6);
-            goto fail;
+        // write the chunks as they are, unless there are too many
+        struct BTap_chunk chunks[BTAP_SEND_MAX_CHUNKS];
+        int num_chunks = device_pbuf_chunks(p, chunks, 0);
+        
+        SYNC_FROMHERE
+        if (num_chunks > 0) {
+            BTap_SendChunks(&device, chunks, num_chunks);
+        } else {
+            pbuf_copy_partial(p, device_write_buf, p->tot_len, 0);
+            BTap_Send(&device, device_write_buf, p->tot_len);
+        }
+        SYNC_COMMIT
+    }
+    
+out:
+    return ERR_OK;
+}
+
+int device_pbuf_chunks (struct pbuf *p, struct BTap_chunk *chunks, int first)
+{
+    ASSERT(first >= 0)
+    ASSERT(first < BTAP_SEND_MAX_CHUNKS)
+    
+    int num_chunks = first;
+    for (struct pbuf *q = p; q; q = q->next) {
+        if (q->len == 0) {
+            continue;
+        }
+        if (num_chunks == BTAP_SEND_MAX_CHUNKS) {
+            return 0;
+        }
+        chunks[num_chunks].data = (const uint8_t *)q->payload;
+        chunks[num_chunks].len = q->len;
+        num_chunks++;
+    }
+    
+    return num_chunks;
+}
+
+void device_send_packet (uint8_t *buf, int packet_len, struct BTap_offload_header *hdr)
+{
+    ASSERT(packet_len >= 0)
+    ASSERT(device_hdr_len + packet_len <= BTap_GetMTU(&device))
+    
+    // the packet follows room for the offload header
+    if (device_offload) {
+        memcpy(buf, hdr, sizeof(*hdr));
+    }
+    
+    BMetric_Add(&metric_device_packets_out, 1);
+    BMetric_Add(&metric_device_bytes_out, packet_len);
+    
+    BTap_Send(&device, buf, device_hdr_len + packet_len);
+}
+
+int device_netif_checksums (int check_tcp)
+{
+    ASSERT(device_offload)
+    
+    // TCP checksums are never generated, the kernel does that
+    int flags = NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP;
+    if (!check_tcp) {
+        flags &= ~NETIF_CHECKSUM_CHECK_TCP;
+    }
+    
+    return flags;
+}
+
+void device_offload_output (struct pbuf *p)
+{
+    ASSERT(device_offload)
+    
+    int len = p->tot_len;
+    if (len > BTap_GetMTU(&device) - device_hdr_len) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "netif func output: no space left");
+        BMetric_Add(&metric_device_drops_out, 1);
+        return;
+    }
+    
+    // look at the IP and TCP headers
+    uint8_t hdrs[sizeof(struct ipv6_header) + 60];
+    int hdrs_len = pbuf_copy_partial(p, hdrs, bmin_int(len, sizeof(hdrs)), 0);
+    int ip_hdr_len = 0;
+    int is_tcp = 0;
+    if (hdrs_len >= sizeof(struct ipv4_header) && (hdrs[0] >> 4) == 4) {
+        ip_hdr_len = (hdrs[0] & 0x0F) * 4;
+        is_tcp = (hdrs[offsetof(struct ipv4_header, protocol)] == IPV4_PROTOCOL_TCP);
+    }
+    else if (hdrs_len >= sizeof(struct ipv6_header) && (hdrs[0] >> 4) == 6) {
+        ip_hdr_len = sizeof(struct ipv6_header);
+        is_tcp = (hdrs[offsetof(struct ipv6_header, next_header)] == IPV6_NEXT_TCP);
+    }
+    
+    struct tcp_header tcph;
+    int tcp_hdr_len = 0;
+    if (is_tcp && hdrs_len >= ip_hdr_len + sizeof(tcph)) {
+        memcpy(&tcph, hdrs + ip_hdr_len, sizeof(tcph));
+        tcp_hdr_len = TCP_GET_HEADER_LENGTH(tcph);
+    }
+    if (tcp_hdr_len < sizeof(tcph) || tcp_hdr_len > hdrs_len - ip_hdr_len) {
+        is_tcp = 0;
+    }
+    
+    // anything but TCP goes out as it is
+    if (!is_tcp) {
+        device_gso_flush();
+        
+        struct BTap_offload_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        
+        // write the header and the chunks as they are, unless there are too many
+        struct BTap_chunk chunks[BTAP_SEND_MAX_CHUNKS];
+        int num_chunks = device_pbuf_chunks(p, chunks, 1);
+        if (num_chunks > 0) {
+            chunks[0].data = (const uint8_t *)&hdr;
+            chunks[0].len = sizeof(hdr);
+            
+            BMetric_Add(&metric_device_packets_out, 1);
+            BMetric_Add(&metric_device_bytes_out, len);
+            
+            BTap_SendChunks(&device, chunks, num_chunks);
+            return;
         }
         
-        tcp_accept(listener_ip6, listener_accept_func);
+        pbuf_copy_partial(p, device_write_buf + device_hdr_len, len, 0);
+        device_send_packet(device_write_buf, len, &hdr);
+        return;
+    }
+    
+    uint32_t seq = ntoh32(tcph.seq);
+    int payload_len = len - ip_hdr_len - tcp_hdr_len;
+    
+    // append the payload to the pending packet if this segment continues it
+    if (device_gso_can_merge(hdrs, ip_hdr_len, tcp_hdr_len, seq, payload_len)) {
+        uint8_t *packet = device_gso_buf + device_hdr_len;
+        pbuf_copy_partial(p, packet + device_gso_len, payload_len, ip_hdr_len + tcp_hdr_len);
+        
+        // the segments are split again with the flags of the last one
+        packet[ip_hdr_len + offsetof(struct tcp_header, flags)] |= (tcph.flags & TCP_FLAG_PSH);
+        
+        device_gso_len += payload_len;
+        device_gso_last_seg_len = payload_len;
+        device_gso_num_segs++;
+        device_gso_next_seq += payload_len;
+        return;
+    }
+    
+    device_gso_flush();
+    
+    // start a new packet
+    pbuf_copy_partial(p, device_gso_buf + device_hdr_len, len, 0);
+    device_gso_len = len;
+    device_gso_ip_hdr_len = ip_hdr_len;
+    device_gso_hdr_len = ip_hdr_len + tcp_hdr_len;
+    device_gso_seg_size = payload_len;
+    device_gso_last_seg_len = payload_len;
+    device_gso_num_segs = 1;
+    device_gso_next_seq = seq + payload_len;
+    
+    // only data segments with nothing special about them can be continued;
+    // wait for more of them until the current job is done
+    if (payload_len > 0 && (tcph.flags & ~(TCP_FLAG_ACK | TCP_FLAG_PSH)) == 0) {
+        BPending_Set(&device_gso_flush_job);
+    } else {
+        device_gso_flush();
+    }
+}
+
+int device_gso_can_merge (const uint8_t *hdrs, int ip_hdr_len, int tcp_hdr_len, uint32_t seq, int payload_len)
+{
+    ASSERT(device_offload)
+    
+    if (device_gso_len == 0) {
+        return 0;
+    }
+    
+    const uint8_t *packet = device_gso_buf + device_hdr_len;
+    const uint8_t *tcp = hdrs + ip_hdr_len;
+    const uint8_t *gso_tcp = packet + device_gso_ip_hdr_len;
+    
+    // must be a data segment right after the previous ones, which must all have
+    // been full, so that the kernel splits the packet back into the same segments
+    if (payload_len <= 0 || payload_len > device_gso_seg_size ||
+        device_gso_last_seg_len != device_gso_seg_size ||
+        seq != device_gso_next_seq ||
+        device_gso_len + payload_len > BTap_GetMTU(&device) - device_hdr_len
+    ) {
+        return 0;
+    }
+    
+    // flags must be plain
+    if ((tcp[offsetof(struct tcp_header, flags)] & ~(TCP_FLAG_ACK | TCP_FLAG_PSH)) != 0) {
+        return 0;
+    }
+    
+    // headers must be the same, apart from lengths, sequence numbers and checksums
+    if (ip_hdr_len != device_gso_ip_hdr_len || ip_hdr_len + tcp_hdr_len != device_gso_hdr_len) {
+        return 0;
+    }
+    if (ip_hdr_len == sizeof(struct ipv4_header)) {
+        if (hdrs[0] != packet[0] ||
+            memcmp(hdrs + offsetof(struct ipv4_header, source_address), packet + offsetof(struct ipv4_header, source_address), 8)
+        ) {
+            return 0;
+        }
+    } else {
+        if (hdrs[0] != packet[0] ||
+            memcmp(hdrs + offsetof(struct ipv6_header, source_address), packet + offsetof(struct ipv6_header, source_address), 32)
+        ) {
+            return 0;
+        }
+    }
+    if (memcmp(tcp, gso_tcp, offsetof(struct tcp_header, seq)) ||
+        memcmp(tcp + offsetof(struct tcp_header, ack), gso_tcp + offsetof(struct tcp_header, ack), 5) ||
+        memcmp(tcp + offsetof(struct tcp_header, window), gso_tcp + offsetof(struct tcp_header, window), 2) ||
+        memcmp(tcp + sizeof(struct tcp_header), gso_tcp + sizeof(struct tcp_header), tcp_hdr_len - sizeof(struct tcp_header))
+    ) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+void device_gso_flush (void)
+{
+    ASSERT(device_offload)
+    
+    if (device_gso_len == 0) {
+        return;
+    }
+    
+    BPending_Unset(&device_gso_flush_job);
+    
+    uint8_t *packet = device_gso_buf + device_hdr_len;
+    int len = device_gso_len;
+    int ip_hdr_len = device_gso_ip_hdr_len;
+    device_gso_len = 0;
+    
+    struct BTap_offload_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    
+    // fix up the IP header for the merged length, and leave the TCP checksum to
+    // the kernel, which needs the sum of the pseudo-header for that
+    uint16_t tcp_checksum;
+    if (ip_hdr_len == sizeof(struct ipv4_header)) {
+        struct ipv4_header iph;
+        memcpy(&iph, packet, sizeof(iph));
+        if (device_gso_num_segs > 1) {
+            uint16_t old_total_length = iph.total_length;
+            iph.total_length = hton16(len);
+            iph.checksum = ipchecksum_update16(iph.checksum, old_total_length, iph.total_length);
+            memcpy(packet, &iph, sizeof(iph));
+        }
+        tcp_checksum = tcp_pseudo_checksum(len - ip_hdr_len, iph.source_address, iph.destination_address);
+        hdr.gso_type = BTAP_OFFLOAD_GSO_TCPV4;
+    } else {
+        struct ipv6_header iph;
+        memcpy(&iph, packet, sizeof(iph));
+        if (device_gso_num_segs > 1) {
+            iph.payload_length = hton16(len - ip_hdr_len);
+            memcpy(packet, &iph, sizeof(iph));
+        }
+        tcp_checksum = tcp_ip6_pseudo_checksum(len - ip_hdr_len, iph.source_address, iph.destination_address);
+        hdr.gso_type = BTAP_OFFLOAD_GSO_TCPV6;
+    }
+    memcpy(packet + ip_hdr_len + offsetof(struct tcp_header, checksum), &tcp_checksum, sizeof(tcp_checksum));
+    
+    hdr.flags = BTAP_OFFLOAD_FLAG_NEEDS_CSUM;
+    hdr.csum_start = ip_hdr_len;
+    hdr.csum_offset = offsetof(struct tcp_header, checksum);
+    if (device_gso_num_segs > 1) {
+        hdr.hdr_len = device_gso_hdr_len;
+        hdr.gso_size = device_gso_seg_size;
+    } else {
+        hdr.gso_type = BTAP_OFFLOAD_GSO_NONE;
+    }
+    
+    device_send_packet(device_gso_buf, len, &hdr);
+}
+
+void device_gso_flush_job_handler (void *unused)
+{
+    ASSERT(device_offload)
+    ASSERT(device_gso_len > 0)
+    
+    device_gso_flush();
+}
+
+err_t netif_input_func (struct pbuf *p, struct netif *inp)
+{
+    uint8_t ip_version = 0;
+    if (p->len > 0) {
+        ip_version = (((uint8_t *)p->payload)[0] >> 4);
+    }
+    
+    switch (ip_version) {
+        case 4: {
+            return ip_input(p, inp);
+        } break;
+        case 6: {
+            if (options.netif_ip6addr) {
+                return ip6_input(p, inp);
+            }
+        } break;
+    }
+    
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+struct socks_server * socks_server_select (struct socks_config *config, BAddr dest_addr)
+{
+    ASSERT(config->num_servers > 0)
+    
+    if (config->num_servers == 1) {
+        return &config->servers[0];
+    }
+    
+    btime_t now = btime_gettime();
+    
+    // hash the destination host for rendezvous hashing, so that only destinations
+    // of a server which goes down or comes back move. The seed is fixed so that
+    // destinations map to the same servers across restarts.
+    int hash = (options.socks_balance == SocksBalanceHash && !BAddr_IsInvalid(&dest_addr));
+    uint64_t dest_hash = 0;
+    if (hash) {
+        switch (dest_addr.type) {
+            case BADDR_TYPE_IPV4:
+                dest_hash = badvpn_hash_4((uint8_t *)&dest_addr.ipv4.ip, 0);
+                break;
+            case BADDR_TYPE_IPV6:
+                dest_hash = badvpn_hash_16(dest_addr.ipv6.ip, 0);
+                break;
+        }
+    }
+    
+    struct socks_server *best = NULL;
+    uint64_t best_score = 0;
+    struct socks_server *soonest_up = NULL;
+    
+    for (int i = 0; i < config->num_servers; i++) {
+        struct socks_server *server = &config->servers[i];
+        
+        // skip servers which failed recently, but remember which comes back first
+        if (server->down_until > now) {
+            if (!soonest_up || server->down_until < soonest_up->down_until) {
+                soonest_up = server;
+            }
+            continue;
+        }
+        
+        // compute score, lower is better
+        uint64_t score;
+        if (hash) {
+            uint64_t x = dest_hash ^ ((uint64_t)(i + 1) * UINT64_C(0x9E3779B97F4A7C15));
+            x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+            x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+            score = ~(x ^ (x >> 31));
+        }
+        else if (options.socks_balance == SocksBalanceLatency) {
+            // servers of unknown latency come first, so that they get measured
+            score = (uint64_t)(server->num_sessions + 1) * (uint64_t)(server->latency + 1);
+        }
+        else {
+            score = server->num_sessions;
+        }
+        
+        if (!best || score < best_score) {
+            best = server;
+            best_score = score;
+        }
     }
     
-    return;
-    
-fail:
-    if (!quitting) {
-        terminate();
-    }
+    // if all servers are down, use the one which should come back first
+    return (best ? best : soonest_up);
 }
 
-void tcp_timer_handler (void *unused)
+int socks_session_init (struct socks_session *s, BAddr dest_addr, BSocksClient_handler handler, void *user)
 {
-    ASSERT(!quitting)
+    // keep the current SOCKS configuration for the life of the session
+    if (!BRefTarget_Ref(&socks_config->ref_target)) {
+        BLog(BLOG_ERROR, "BRefTarget_Ref failed");
+        goto fail0;
+    }
+    s->config = socks_config;
     
-    BLog(BLOG_DEBUG, "TCP timer");
+    // choose server
+    s->server = socks_server_select(s->config, dest_addr);
     
-    // schedule next timer
-    BReactor_SetTimer(&ss, &tcp_timer);
+    if (s->server->by_name) {
+        if (!BSocksClient_InitName(&s->socks, &resolver, s->server->name, BAddr_GetPort(&s->server->addr),
+            options.socks_fast_open, s->config->auth_info, s->config->num_auth_info, dest_addr,
+            /*udp=*/false, handler, user, &ss))
+        {
+            BLog(BLOG_ERROR, "BSocksClient_InitName failed");
+            goto fail1;
+        }
+    } else {
+        struct BLisCon_from socks_from = (options.socks_fast_open ? BLisCon_from_addr_fastopen(s->server->addr) : BLisCon_from_addr(s->server->addr));
+        if (!BSocksClient_InitFrom(&s->socks, socks_from, s->config->auth_info, s->config->num_auth_info, dest_addr,
+            /*udp=*/false, handler, user, &ss))
+        {
+            BLog(BLOG_ERROR, "BSocksClient_InitFrom failed");
+            goto fail1;
+        }
+    }
     
-    // call the TCP timer function (every 1/4 second)
-    tcp_tmr();
+    // send the whole handshake at once if requested
+    BSocksClient_SetPipelined(&s->socks, options.socks_pipelined);
     
-    // increment tcp_timer_mod4
-    tcp_timer_mod4 = (tcp_timer_mod4 + 1) % 4;
+    s->ready = 0;
+    s->start_time = btime_gettime();
+    s->handshake_done = 0;
+    s->server->num_sessions++;
     
-    // every second, call other timer functions
-    if (tcp_timer_mod4 == 0) {
-#if IP_REASSEMBLY
-        ASSERT(IP_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
-        ip_reass_tmr();
-#endif
-        
-#if LWIP_IPV6
-        ASSERT(ND6_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
-        nd6_tmr();
-#endif
+    return 1;
     
-#if LWIP_IPV6 && LWIP_IPV6_REASS
-        ASSERT(IP6_REASS_TMR_INTERVAL == 4 * TCP_TMR_INTERVAL)
-        ip6_reass_tmr();
-#endif
-    }
+fail1:
+    BRefTarget_Deref(&s->config->ref_target);
+fail0:
+    return 0;
 }
 
-void device_error_handler (void *unused)
+int socks_session_init_direct (struct socks_session *s, BAddr dest_addr, BSocksClient_handler handler, void *user)
 {
-    ASSERT(!quitting)
+    s->server = NULL;
+    s->direct_handler = handler;
+    s->direct_user = user;
     
-    BLog(BLOG_ERROR, "device error");
+    // connect to the destination
+    if (!BConnector_Init(&s->direct_connector, dest_addr, &ss, s, (BConnector_handler)socks_session_direct_connector_handler)) {
+        BLog(BLOG_ERROR, "BConnector_Init failed");
+        return 0;
+    }
     
-    terminate();
-    return;
+    s->direct_connected = 0;
+    s->ready = 0;
+    s->start_time = btime_gettime();
+    
+    // there is no server to account the handshake to
+    s->handshake_done = 1;
+    
+    return 1;
 }
 
-void device_read_handler_send (void *unused, uint8_t *data, int data_len)
+void socks_session_free (struct socks_session *s)
 {
-    ASSERT(!quitting)
-    ASSERT(data_len >= 0)
+    if (!s->server) {
+        if (s->direct_connected) {
+            BConnection_RecvAsync_Free(&s->direct_con);
+            BConnection_SendAsync_Free(&s->direct_con);
+            BConnection_Free(&s->direct_con);
+        }
+        BConnector_Free(&s->direct_connector);
+        free(s);
+        return;
+    }
     
-    BLog(BLOG_DEBUG, "device: received packet");
+    ASSERT(s->server->num_sessions > 0)
     
-    // accept packet
-    PacketPassInterface_Done(&device_read_interface);
+    s->server->num_sessions--;
+    BSocksClient_Free(&s->socks);
+    BRefTarget_Deref(&s->config->ref_target);
+    free(s);
+}
+
+void socks_session_direct_connector_handler (struct socks_session *s, int is_error)
+{
+    ASSERT(!s->server)
+    ASSERT(!s->direct_connected)
     
-    // process UDP directly
-    if (process_device_udp_packet(data, data_len)) {
-        return;
+    if (is_error) {
+        BLog(BLOG_INFO, "direct connection failed");
+        goto fail;
     }
     
-    // obtain pbuf
-    if (data_len > UINT16_MAX) {
-        BLog(BLOG_WARNING, "device read: packet too large");
-        return;
-    }
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, data_len, PBUF_POOL);
-    if (!p) {
-        BLog(BLOG_WARNING, "device read: pbuf_alloc failed");
-        return;
+    // init connection
+    if (!BConnection_Init(&s->direct_con, BConnection_source_connector(&s->direct_connector), &ss, s, (BConnection_handler)socks_session_direct_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail;
     }
     
-    // write packet to pbuf
-    ASSERT_FORCE(pbuf_take(p, data, data_len) == ERR_OK)
+    // init I/O
+    BConnection_SendAsync_Init(&s->direct_con);
+    BConnection_RecvAsync_Init(&s->direct_con);
+    s->direct_connected = 1;
     
-    // pass pbuf to input
-    if (the_netif.input(p, &the_netif) != ERR_OK) {
-        BLog(BLOG_WARNING, "device read: input failed");
-        pbuf_free(p);
-    }
+    // report up as a SOCKS client would
+    s->direct_handler(s->direct_user, BSOCKSCLIENT_EVENT_UP);
+    return;
+    
+fail:
+    s->direct_handler(s->direct_user, BSOCKSCLIENT_EVENT_ERROR);
 }
 
-int process_device_udp_packet (uint8_t *data, int data_len)
+void socks_session_direct_connection_handler (struct socks_session *s, int event)
 {
-    ASSERT(data_len >= 0)
+    ASSERT(!s->server)
+    ASSERT(s->direct_connected)
     
-    // do nothing if we don't use udpgw or SOCKS UDP
-    if (udp_mode == UdpModeNone) {
-        goto fail;
+    s->direct_handler(s->direct_user, (event == BCONNECTION_EVENT_RECVCLOSED ? BSOCKSCLIENT_EVENT_ERROR_CLOSED : BSOCKSCLIENT_EVENT_ERROR));
+}
+
+StreamPassInterface * socks_session_get_send_if (struct socks_session *s)
+{
+    if (!s->server) {
+        ASSERT(s->direct_connected)
+        return BConnection_SendAsync_GetIf(&s->direct_con);
     }
     
-    BAddr local_addr;
-    BAddr remote_addr;
-    int is_dns;
+    return BSocksClient_GetSendInterface(&s->socks);
+}
+
+StreamRecvInterface * socks_session_get_recv_if (struct socks_session *s)
+{
+    if (!s->server) {
+        ASSERT(s->direct_connected)
+        return BConnection_RecvAsync_GetIf(&s->direct_con);
+    }
     
-    uint8_t ip_version = 0;
-    if (data_len > 0) {
-        ip_version = (data[0] >> 4);
+    return BSocksClient_GetRecvInterface(&s->socks);
+}
+
+int socks_session_send_early (struct socks_session *s, const uint8_t *data, int data_len)
+{
+    // a direct connection has no request to send data along with
+    if (!s->server) {
+        return 0;
     }
     
-    switch (ip_version) {
-        case 4: {
-            // ignore non-UDP packets
-            if (data_len < sizeof(struct ipv4_header) || data[offsetof(struct ipv4_header, protocol)] != IPV4_PROTOCOL_UDP) {
-                goto fail;
-            }
-            
-            // parse IPv4 header
-            struct ipv4_header ipv4_header;
-            if (!ipv4_check(data, data_len, &ipv4_header, &data, &data_len)) {
-                goto fail;
-            }
-            
-            // parse UDP
-            struct udp_header udp_header;
-            if (!udp_check(data, data_len, &udp_header, &data, &data_len)) {
-                goto fail;
-            }
-            
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
-            }
-            
-            BLog(BLOG_INFO, "UDP: from device %d bytes", data_len);
-            
-            // construct addresses
-            BAddr_InitIPv4(&local_addr, ipv4_header.source_address, udp_header.source_port);
-            BAddr_InitIPv4(&remote_addr, ipv4_header.destination_address, udp_header.dest_port);
-            
-            // if transparent DNS is enabled, any packet arriving at out netif
-            // address to port 53 is considered a DNS packet
-            is_dns = (options.udpgw_transparent_dns &&
-                      ipv4_header.destination_address == netif_ipaddr.ipv4 &&
-                      udp_header.dest_port == hton16(53));
-        } break;
+    return BSocksClient_SendEarlyData(&s->socks, data, data_len);
+}
+
+void socks_session_account (struct socks_session *s, int event)
+{
+    // only the outcome of the handshake says something about the server
+    if (s->handshake_done || event == BSOCKSCLIENT_EVENT_CONNECTED) {
+        return;
+    }
+    s->handshake_done = 1;
+    
+    struct socks_server *server = s->server;
+    btime_t now = btime_gettime();
+    
+    char addr_str[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&server->addr, addr_str);
+    
+    if (event == BSOCKSCLIENT_EVENT_UP || event == BSOCKSCLIENT_EVENT_READY) {
+        // update smoothed latency
+        btime_t sample = now - s->start_time;
+        BMetric_Observe(&metric_socks_handshake_time, sample);
+        if (server->latency == 0) {
+            server->latency = sample;
+        } else {
+            server->latency += (sample - server->latency) / (1 << SOCKS_SERVER_LATENCY_SHIFT);
+        }
         
-        case 6: {
-            // ignore if IPv6 support is disabled
-            if (!options.netif_ip6addr) {
-                goto fail;
-            }
-            
-            // ignore non-UDP packets
-            if (data_len < sizeof(struct ipv6_header) || data[offsetof(struct ipv6_header, next_header)] != IPV6_NEXT_UDP) {
-                goto fail;
-            }
-            
-            // parse IPv6 header
-            struct ipv6_header ipv6_header;
-            if (!ipv6_check(data, data_len, &ipv6_header, &data, &data_len)) {
-                goto fail;
-            }
-            
-            // parse UDP
-            struct udp_header udp_header;
-            if (!udp_check(data, data_len, &udp_header, &data, &data_len)) {
-                goto fail;
-            }
-            
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
-            }
-            
-            BLog(BLOG_INFO, "UDP/IPv6: from device %d bytes", data_len);
-            
-            // construct addresses
-            BAddr_InitIPv6(&local_addr, ipv6_header.source_address, udp_header.source_port);
-            BAddr_InitIPv6(&remote_addr, ipv6_header.destination_address, udp_header.dest_port);
-            
-            // TODO dns
-            is_dns = 0;
-        } break;
+        if (server->failures > 0) {
+            BLog(BLOG_NOTICE, "SOCKS server %s is working again", addr_str);
+        }
+        server->failures = 0;
+        server->down_until = 0;
+    } else {
+        // avoid the server for a while, longer with each consecutive failure
+        int shift = bmin_int(server->failures, SOCKS_SERVER_DOWN_MAX_SHIFT);
+        btime_t down_time = (btime_t)SOCKS_SERVER_DOWN_TIME << shift;
+        server->failures++;
+        server->down_until = now + down_time;
+        BMetric_Add(&metric_socks_server_failures, 1);
         
-        default: {
-            goto fail;
-        } break;
+        if (s->config->num_servers > 1) {
+            BLog(BLOG_WARNING, "SOCKS server %s failed, avoiding it for %d ms", addr_str, (int)down_time);
+        }
     }
-    
-    // check payload length
-    if (data_len > udp_mtu) {
-        BLog(BLOG_ERROR, "packet is too large, cannot send to udpgw");
-        goto fail;
+}
+
+void socks_pool_fill (void)
+{
+    // don't replace sessions while a failure is being waited out
+    if (BTimer_IsRunning(&socks_pool_refill_timer)) {
+        return;
     }
     
-    // submit packet to udpgw or SOCKS UDP
-    if (udp_mode == UdpModeUdpgw) {
-        SocksUdpGwClient_SubmitPacket(&udpgw_client, local_addr, remote_addr,
-                                      is_dns, data, data_len);
-    } else if (udp_mode == UdpModeSocks) {
-        SocksUdpClient_SubmitPacket(&socks_udp_client, local_addr, remote_addr, data, data_len);
+    // start sessions without a destination, so that they stop after authentication
+    BAddr none_addr;
+    BAddr_InitNone(&none_addr);
+    
+    while (socks_pool_num < options.socks_pool_size) {
+        struct socks_session *s = (struct socks_session *)malloc(sizeof(*s));
+        if (!s) {
+            BLog(BLOG_ERROR, "socks pool: malloc failed");
+            goto retry;
+        }
+        
+        if (!socks_session_init(s, none_addr, (BSocksClient_handler)socks_pool_session_handler, s)) {
+            free(s);
+            goto retry;
+        }
+        
+        LinkedList1_Append(&socks_pool_connecting, &s->pool_node);
+        socks_pool_num++;
     }
     
-    return 1;
+    return;
     
-fail:
-    return 0;
+retry:
+    BReactor_SetTimer(&ss, &socks_pool_refill_timer);
 }
 
-err_t netif_init_func (struct netif *netif)
+struct socks_session * socks_pool_take (BAddr dest_addr)
 {
-    BLog(BLOG_DEBUG, "netif func init");
+    // with hashing, the session must be to the server for this destination
+    struct socks_server *server = NULL;
+    if (options.socks_balance == SocksBalanceHash) {
+        server = socks_server_select(socks_config, dest_addr);
+    }
     
-    netif->name[0] = 'h';
-    netif->name[1] = 'o';
-    netif->output = netif_output_func;
-    netif->output_ip6 = netif_output_ip6_func;
+    // use the newest session, which is least likely to have been closed by the server
+    for (LinkedList1Node *node = LinkedList1_GetLast(&socks_pool_ready); node; node = LinkedList1Node_Prev(node)) {
+        struct socks_session *s = UPPER_OBJECT(node, struct socks_session, pool_node);
+        if (!server || s->server == server) {
+            socks_pool_remove(s);
+            return s;
+        }
+    }
     
-    return ERR_OK;
+    return NULL;
 }
 
-err_t netif_output_func (struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+void socks_pool_remove (struct socks_session *s)
 {
-    return common_netif_output(netif, p);
+    ASSERT(socks_pool_num > 0)
+    
+    LinkedList1_Remove((s->ready ? &socks_pool_ready : &socks_pool_connecting), &s->pool_node);
+    socks_pool_num--;
 }
 
-err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+void socks_pool_free_all (void)
 {
-    return common_netif_output(netif, p);
+    BReactor_RemoveTimer(&ss, &socks_pool_expire_timer);
+    BReactor_RemoveTimer(&ss, &socks_pool_refill_timer);
+    
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&socks_pool_ready)) || (node = LinkedList1_GetFirst(&socks_pool_connecting))) {
+        struct socks_session *s = UPPER_OBJECT(node, struct socks_session, pool_node);
+        socks_pool_remove(s);
+        socks_session_free(s);
+    }
+    
+    ASSERT(socks_pool_num == 0)
 }
 
-err_t common_netif_output (struct netif *netif, struct pbuf *p)
+void socks_pool_session_handler (struct socks_session *s, int event)
 {
-    SYNC_DECL
-    
-    BLog(BLOG_DEBUG, "device write: send packet");
-    
-    if (quitting) {
-        return ERR_OK;
-    }
+    socks_session_account(s, event);
     
-    // if there is just one chunk, send it directly, else via buffer
-    if (!p->next) {
-        if (p->len > BTap_GetMTU(&device)) {
-            BLog(BLOG_WARNING, "netif func output: no space left");
-            goto out;
-        }
+    switch (event) {
+        case BSOCKSCLIENT_EVENT_CONNECTED: {
+        } break;
         
-        SYNC_FROMHERE
-        BTap_Send(&device, (uint8_t *)p->payload, p->len);
-        SYNC_COMMIT
-    } else {
-        int len = 0;
-        do {
-            if (p->len > BTap_GetMTU(&device) - len) {
-                BLog(BLOG_WARNING, "netif func output: no space left");
-                goto out;
+        case BSOCKSCLIENT_EVENT_READY: {
+            ASSERT(!s->ready)
+            
+            BLog(BLOG_DEBUG, "socks pool: session ready");
+            
+            // move to ready list
+            LinkedList1_Remove(&socks_pool_connecting, &s->pool_node);
+            LinkedList1_Append(&socks_pool_ready, &s->pool_node);
+            s->ready = 1;
+            s->ready_time = btime_gettime();
+            
+            // make sure it will expire
+            if (!BTimer_IsRunning(&socks_pool_expire_timer)) {
+                BReactor_SetTimerAfter(&ss, &socks_pool_expire_timer, options.socks_pool_idle_time);
             }
-            memcpy(device_write_buf + len, p->payload, p->len);
-            len += p->len;
-        } while (p = p->next);
+        } break;
         
-        SYNC_FROMHERE
-        BTap_Send(&device, device_write_buf, len);
-        SYNC_COMMIT
+        default: {
+            BLog(BLOG_INFO, "socks pool: session failed");
+            
+            socks_pool_remove(s);
+            socks_session_free(s);
+            
+            // replace it after a while, in case the server is unreachable
+            if (!BTimer_IsRunning(&socks_pool_refill_timer)) {
+                BReactor_SetTimer(&ss, &socks_pool_refill_timer);
+            }
+        } break;
     }
-    
-out:
-    return ERR_OK;
 }
 
-err_t netif_input_func (struct pbuf *p, struct netif *inp)
+void socks_pool_refill_timer_handler (void *unused)
 {
-    uint8_t ip_version = 0;
-    if (p->len > 0) {
-        ip_version = (((uint8_t *)p->payload)[0] >> 4);
-    }
+    socks_pool_fill();
+}
+
+void socks_pool_expire_timer_handler (void *unused)
+{
+    btime_t now = btime_gettime();
     
-    switch (ip_version) {
-        case 4: {
-            return ip_input(p, inp);
-        } break;
-        case 6: {
-            if (options.netif_ip6addr) {
-                return ip6_input(p, inp);
-            }
-        } break;
+    // replace sessions which have been idle for too long, before the server gives up on them
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&socks_pool_ready))) {
+        struct socks_session *s = UPPER_OBJECT(node, struct socks_session, pool_node);
+        btime_t expire_time = s->ready_time + options.socks_pool_idle_time;
+        if (expire_time > now) {
+            BReactor_SetTimerAfter(&ss, &socks_pool_expire_timer, expire_time - now);
+            break;
+        }
+        
+        BLog(BLOG_DEBUG, "socks pool: session expired");
+        
+        socks_pool_remove(s);
+        socks_session_free(s);
     }
     
-    pbuf_free(p);
-    return ERR_OK;
+    socks_pool_fill();
 }
 
 void client_logfunc (struct tcp_client *client)
@@ -1302,12 +4993,54 @@ void client_log (struct tcp_client *client, int level, const char *fmt, ...)
 
 err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
 {
-    ASSERT(err == ERR_OK)
+    // lwIP had no PCB for the connection and dropped the SYN
+    if (err != ERR_OK) {
+        ASSERT(!newpcb)
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_WARNING, "listener accept: no PCB available (%d)", (int)err);
+        BMetric_Add(&metric_tcp_refused_memory, 1);
+        return ERR_MEM;
+    }
+    
+    // under memory pressure, refuse new connections rather than run out of
+    // memory serving them
+    if (memory_pressure_level() >= MEMPRESSURE_LEVEL_NO_ADMIT) {
+        BLog(BLOG_INFO, "listener accept: resetting connection under memory pressure");
+        BMetric_Add(&metric_tcp_refused_memory, 1);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    
+    // connections to fake addresses are made to the name the address was given to;
+    // reset them if the mapping is gone, since there is nowhere to connect to
+    BAddr dest_addr = baddr_from_lwip(&newpcb->local_ip, newpcb->local_port);
+    const char *fake_name = NULL;
+    int fake_name_len = 0;
+    if (have_fake_dns && dest_addr.type == BADDR_TYPE_IPV4 && FakeDns_IsFakeAddr(&fake_dns, dest_addr.ipv4.ip) &&
+        !FakeDns_LookupAddr(&fake_dns, dest_addr.ipv4.ip, &fake_name, &fake_name_len)
+    ) {
+        BLog(BLOG_INFO, "listener accept: resetting connection to unmapped fake address");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    
+    // look up the destination in the bypass table, and reset connections to dropped destinations;
+    // this does not apply to fake addresses
+    int bypass = (fake_name ? BypassActionProxy : bypass_lookup(dest_addr));
+    if (bypass == BypassActionDrop) {
+        BLog(BLOG_INFO, "listener accept: dropping connection to bypassed destination");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
     
-    // allocate client structure
-    struct tcp_client *client = (struct tcp_client *)malloc(sizeof(*client));
+    // allocate client structure, making room by evicting the client idle
+    // the longest if allowed
+    struct tcp_client *client = (struct tcp_client *)BObjectPool_Alloc(&clients_pool);
+    if (!client && options.tcp_evict_idle >= 0 && client_evict_idle()) {
+        client = (struct tcp_client *)BObjectPool_Alloc(&clients_pool);
+    }
     if (!client) {
-        BLog(BLOG_ERROR, "listener accept: malloc failed");
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "listener accept: no client structure available");
+        BMetric_Add(&metric_tcp_refused_full, 1);
         goto fail0;
     }
     client->socks_username = NULL;
@@ -1326,36 +5059,81 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
 #endif
     
     // add source address to username if requested
-    if (options.username && options.append_source_to_username) {
+    if (socks_config->username && options.append_source_to_username) {
         char addr_str[BADDR_MAX_PRINT_LEN];
         BAddr_Print(&client->remote_addr, addr_str);
-        client->socks_username = concat_strings(3, options.username, "@", addr_str);
+        client->socks_username = concat_strings(3, socks_config->username, "@", addr_str);
         if (!client->socks_username) {
             goto fail1;
         }
-        socks_auth_info[1].password.username = client->socks_username;
-        socks_auth_info[1].password.username_len = strlen(client->socks_username);
+        socks_config->auth_info[1].password.username = client->socks_username;
+        socks_config->auth_info[1].password.username_len = strlen(client->socks_username);
     }
     
-    // init SOCKS
-    if (!BSocksClient_Init(&client->socks_client,
-        socks_server_addr, socks_auth_info, socks_num_auth_info, addr, /*udp=*/false,
-        (BSocksClient_handler)client_socks_handler, client, &ss))
-    {
-        BLog(BLOG_ERROR, "listener accept: BSocksClient_Init failed");
-        goto fail1;
+    // init SOCKS, using a pooled session if one is ready so that only the
+    // CONNECT request remains to be done; bypassed destinations are connected
+    // to directly instead
+    if (bypass != BypassActionDirect && (client->socks = socks_pool_take(addr))) {
+        if (fake_name && !BSocksClient_SetDestName(&client->socks->socks, fake_name, fake_name_len)) {
+            BLog(BLOG_ERROR, "listener accept: BSocksClient_SetDestName failed");
+            socks_session_free(client->socks);
+            goto fail1;
+        }
+        BSocksClient_SetHandler(&client->socks->socks, (BSocksClient_handler)client_socks_handler, client);
+        BSocksClient_Connect(&client->socks->socks, addr);
+        
+        // replace the session we took
+        socks_pool_fill();
+    } else {
+        if (!(client->socks = (struct socks_session *)malloc(sizeof(*client->socks)))) {
+            BLog(BLOG_ERROR, "listener accept: malloc failed");
+            goto fail1;
+        }
+        if (bypass == BypassActionDirect) {
+            if (!socks_session_init_direct(client->socks, client->local_addr, (BSocksClient_handler)client_socks_handler, client)) {
+                BLog(BLOG_ERROR, "listener accept: socks_session_init_direct failed");
+                free(client->socks);
+                goto fail1;
+            }
+        }
+        else if (!socks_session_init(client->socks, addr, (BSocksClient_handler)client_socks_handler, client)) {
+            BLog(BLOG_ERROR, "listener accept: socks_session_init failed");
+            free(client->socks);
+            goto fail1;
+        }
+        else if (fake_name && !BSocksClient_SetDestName(&client->socks->socks, fake_name, fake_name_len)) {
+            BLog(BLOG_ERROR, "listener accept: BSocksClient_SetDestName failed");
+            socks_session_free(client->socks);
+            goto fail1;
+        }
     }
     
     // init aborted and dead_aborted
     client->aborted = 0;
     DEAD_INIT(client->dead_aborted);
     
-    // add to linked list
+    // add to linked list, which is kept with the most recently active client last
     LinkedList1_Append(&tcp_clients, &client->list_node);
+    client->last_active = BReactor_GetTime(&ss);
+    
+    // init statistics
+    client->id = next_client_id++;
+    client->start_time = BReactor_GetTime(&ss);
+    client->socks_up_time = -1;
+    client->close_time = -1;
+    client->bytes_up = 0;
+    client->bytes_down = 0;
+    client->socks_send_since = -1;
+    client->socks_send_blocked = 0;
+    client->snd_buf_blocked = 0;
+    client->rate_bytes = 0;
+    client->rate_time = client->start_time;
+    client->rate = 0;
     
     // increment counter
     ASSERT(num_clients >= 0)
     num_clients++;
+    BMetric_Add(&metric_tcp_accepted, 1);
     
     // set pcb
     client->pcb = newpcb;
@@ -1371,11 +5149,30 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
     tcp_recv(client->pcb, client_recv_func);
     
     // setup buffer
+    client->buf_pbuf = NULL;
     client->buf_used = 0;
     
+    // set up the receive window; lwIP opens the whole window once the client agrees
+    // to window scaling, but only the unscaled window went out with the SYN-ACK,
+    // so we can still bring it down to our limit
+    client->rcv_wnd = bmin_int(options.tcp_rcv_wnd, TCP_WND_MAX(client->pcb));
+    client->rcv_wnd_filled = 0;
+    client->pcb->rcv_wnd = client->rcv_wnd;
+    client->pcb->rcv_ann_wnd = client->rcv_wnd;
+    client->pcb->rcv_ann_right_edge = client->pcb->rcv_nxt + TCPWND_MIN16(TCP_WND);
+    
+    // set up the send buffer; lwIP only ever gives back what was acknowledged,
+    // so this is the limit from now on
+    client->snd_buf = options.tcp_snd_buf;
+    client->pcb->snd_buf = client->snd_buf;
+    
+    // have no SOCKS receive buffer until SOCKS is up
+    client->socks_recv_buf = NULL;
+    
     // set SOCKS not up, not closed
     client->socks_up = 0;
     client->socks_closed = 0;
+    client->socks_early_taken = 0;
     
     client_log(client, BLOG_INFO, "accepted");
     
@@ -1389,11 +5186,47 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
 fail1:
     SYNC_BREAK
     free(client->socks_username);
-    free(client);
+    BObjectPool_Release(&clients_pool, client);
 fail0:
     return ERR_MEM;
 }
 
+int client_evict_idle (void)
+{
+    ASSERT(options.tcp_evict_idle >= 0)
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&tcp_clients);
+    if (!node) {
+        return 0;
+    }
+    struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+    
+    // the first client is the one idle the longest
+    btime_t idle = BReactor_GetTime(&ss) - client->last_active;
+    if (idle < options.tcp_evict_idle) {
+        return 0;
+    }
+    
+    client_log(client, BLOG_INFO, "evicting after %"PRIi64" ms idle to make room", (int64_t)idle);
+    BMetric_Add(&metric_tcp_evicted, 1);
+    
+    client_murder(client);
+    return 1;
+}
+
+void client_touch (struct tcp_client *client)
+{
+    // move the client to the end of the list, so that the first one is the one
+    // idle the longest; only needed for eviction
+    if (options.tcp_evict_idle < 0) {
+        return;
+    }
+    
+    client->last_active = BReactor_GetTime(&ss);
+    LinkedList1_Remove(&tcp_clients, &client->list_node);
+    LinkedList1_Append(&tcp_clients, &client->list_node);
+}
+
 void client_handle_freed_client (struct tcp_client *client)
 {
     ASSERT(!client->client_closed)
@@ -1402,9 +5235,13 @@ void client_handle_freed_client (struct tcp_client *client)
     
     // set client closed
     client->client_closed = 1;
+    if (client->close_time < 0) {
+        client->close_time = BReactor_GetTime(&ss);
+    }
     
-    // if we have data to be sent to SOCKS and can send it, keep sending
-    if (client->buf_used > 0 && !client->socks_closed) {
+    // if we have data to be sent to SOCKS and can send it, keep sending; this includes
+    // data given to SOCKS early, which is only known to be sent once SOCKS is up
+    if ((client->buf_used > 0 || (client->socks_early_taken && !client->socks_up)) && !client->socks_closed) {
         client_log(client, BLOG_INFO, "waiting untill buffered data is sent to SOCKS");
     } else {
         if (!client->socks_closed) {
@@ -1419,11 +5256,17 @@ void client_free_client (struct tcp_client *client)
 {
     ASSERT(!client->client_closed)
     
+    client_log_tcp_stats(client);
+    
     // remove callbacks
     tcp_err(client->pcb, NULL);
     tcp_recv(client->pcb, NULL);
     tcp_sent(client->pcb, NULL);
     
+    // lwIP resets instead of closing if the window is not fully open, so hand it the
+    // part of the window we never opened; it then only resets for unconsumed data
+    client->pcb->rcv_wnd += TCP_WND_MAX(client->pcb) - client->rcv_wnd;
+    
     // free pcb
     err_t err = tcp_close(client->pcb);
     if (err != ERR_OK) {
@@ -1438,6 +5281,8 @@ void client_abort_client (struct tcp_client *client)
 {
     ASSERT(!client->client_closed)
     
+    client_log_tcp_stats(client);
+    
     // remove callbacks
     tcp_err(client->pcb, NULL);
     tcp_recv(client->pcb, NULL);
@@ -1449,6 +5294,20 @@ void client_abort_client (struct tcp_client *client)
     client_handle_freed_client(client);
 }
 
+void client_log_tcp_stats (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    
+    // connections which never needed to recover from loss are not worth a line
+    struct tcp_pcb_stats *stats = &client->pcb->stats;
+    if (stats->rexmit_segs == 0 && stats->rtos == 0) {
+        return;
+    }
+    
+    client_log(client, BLOG_INFO, "TCP loss recovery: %"PRIu32" segments retransmitted, %"PRIu32" fast recoveries, %"PRIu32" timeouts (SACK %s)",
+               stats->rexmit_segs, stats->fast_recoveries, stats->rtos, (client->pcb->flags & TF_SACK) ? "on" : "off");
+}
+
 void client_abort_pcb (struct tcp_client *client)
 {
     ASSERT(!client->aborted)
@@ -1478,10 +5337,13 @@ void client_free_socks (struct tcp_client *client)
     }
     
     // free SOCKS
-    BSocksClient_Free(&client->socks_client);
+    socks_session_free(client->socks);
     
     // set SOCKS closed
     client->socks_closed = 1;
+    if (client->close_time < 0) {
+        client->close_time = BReactor_GetTime(&ss);
+    }
     
     // if we have data to be sent to the client and we can send it, keep sending
     if (client->socks_up && (client->socks_recv_buf_used >= 0 || client->socks_recv_tcp_pending > 0) && !client->client_closed) {
@@ -1514,7 +5376,7 @@ void client_murder (struct tcp_client *client)
     // free SOCKS
     if (!client->socks_closed) {
         // free SOCKS
-        BSocksClient_Free(&client->socks_client);
+        socks_session_free(client->socks);
         
         // set SOCKS closed
         client->socks_closed = 1;
@@ -1541,9 +5403,20 @@ void client_dealloc (struct tcp_client *client)
         DEAD_KILL_WITH(client->dead_aborted, -1);
     }
     
+    // free any data not sent to SOCKS
+    if (client->buf_pbuf) {
+        client_buf_unpin(client->buf_used);
+        pbuf_free(client->buf_pbuf);
+    }
+    
+    // release SOCKS receive buffer
+    if (client->socks_recv_buf) {
+        client_buf_release(client->socks_recv_buf, client->socks_recv_buf_class);
+    }
+    
     // free memory
     free(client->socks_username);
-    free(client);
+    BObjectPool_Release(&clients_pool, client);
 }
 
 void client_err_func (void *arg, err_t err)
@@ -1572,20 +5445,35 @@ err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t e
     } else {
         ASSERT(p->tot_len > 0)
         
+        client_touch(client);
+        
         // check if we have enough buffer
-        if (p->tot_len > sizeof(client->buf) - client->buf_used) {
+        if (p->tot_len > client->rcv_wnd - client->buf_used) {
             client_log(client, BLOG_ERROR, "no buffer for data !?!");
             DEAD_LEAVE2(client->dead_aborted)
             return ERR_MEM;
         }
         
-        // copy data to buffer
-        ASSERT_EXECUTE(pbuf_copy_partial(p, client->buf + client->buf_used, p->tot_len, 0) == p->tot_len)
-        client->buf_used += p->tot_len;
-        
-        // free pbuff
+        // keep the pbuf, we send from it directly and free it once sent
         int p_tot_len = p->tot_len;
-        pbuf_free(p);
+        client_buf_pin(p_tot_len);
+        if (client->buf_pbuf) {
+            pbuf_cat(client->buf_pbuf, p);
+            client->buf_used += p_tot_len;
+        } else {
+            client->buf_pbuf = p;
+            client->buf_offset = 0;
+            client->buf_used = p_tot_len;
+            
+            // skip any empty pbufs at the start
+            client_buf_advance(client, 0);
+        }
+        
+        // remember if the client filled most of its window; if SOCKS then drains
+        // all of it, it was the window that held the client back
+        if (client->buf_used > client->rcv_wnd - client->rcv_wnd / 4) {
+            client->rcv_wnd_filled = 1;
+        }
         
         // if there was nothing in the buffer before, and SOCKS is up, start send data
         if (client->buf_used == p_tot_len && client->socks_up) {
@@ -1596,6 +5484,10 @@ err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t e
             client_send_to_socks(client);
             SYNC_COMMIT
         }
+        // if SOCKS is not up yet, it may send the data along with its request
+        else if (!client->socks_up && !client->socks_closed && options.socks_early_data) {
+            client_send_early_to_socks(client);
+        }
     }
     
     DEAD_LEAVE2(client->dead_aborted)
@@ -1608,6 +5500,8 @@ void client_socks_handler (struct tcp_client *client, int event)
 {
     ASSERT(!client->socks_closed)
     
+    socks_session_account(client->socks, event);
+    
     switch (event) {
         case BSOCKSCLIENT_EVENT_ERROR: {
             client_log(client, BLOG_INFO, "SOCKS error");
@@ -1619,13 +5513,22 @@ void client_socks_handler (struct tcp_client *client, int event)
             ASSERT(!client->socks_up)
             
             client_log(client, BLOG_INFO, "SOCKS up");
+            client->socks_up_time = BReactor_GetTime(&ss);
+            
+            // allocate receive buffer; start small, most connections are mostly idle
+            if (!(client->socks_recv_buf = client_buf_alloc(0))) {
+                client_log(client, BLOG_ERROR, "failed to allocate receive buffer");
+                client_free_socks(client);
+                return;
+            }
+            client->socks_recv_buf_class = 0;
             
             // init sending
-            client->socks_send_if = BSocksClient_GetSendInterface(&client->socks_client);
+            client->socks_send_if = socks_session_get_send_if(client->socks);
             StreamPassInterface_Sender_Init(client->socks_send_if, (StreamPassInterface_handler_done)client_socks_send_handler_done, client);
             
             // init receiving
-            client->socks_recv_if = BSocksClient_GetRecvInterface(&client->socks_client);
+            client->socks_recv_if = socks_session_get_recv_if(client->socks);
             StreamRecvInterface_Receiver_Init(client->socks_recv_if, (StreamRecvInterface_handler_done)client_socks_recv_handler_done, client);
             client->socks_recv_buf_used = -1;
             client->socks_recv_tcp_pending = 0;
@@ -1640,6 +5543,12 @@ void client_socks_handler (struct tcp_client *client, int event)
             if (client->buf_used > 0) {
                 client_send_to_socks(client);
             }
+            // if the client is gone and all its data was sent early, we're done
+            else if (client->client_closed) {
+                client_log(client, BLOG_INFO, "removing after client went down");
+                client_free_socks(client);
+                return;
+            }
             
             // start receiving data if client is still up
             if (!client->client_closed) {
@@ -1662,9 +5571,122 @@ void client_send_to_socks (struct tcp_client *client)
     ASSERT(!client->socks_closed)
     ASSERT(client->socks_up)
     ASSERT(client->buf_used > 0)
+    ASSERT(client->buf_offset < client->buf_pbuf->len)
+    
+    // schedule sending the rest of the first pbuf
+    client->socks_send_since = BReactor_GetTime(&ss);
+    struct pbuf *p = client->buf_pbuf;
+    StreamPassInterface_Sender_Send(client->socks_send_if, (uint8_t *)p->payload + client->buf_offset, p->len - client->buf_offset);
+}
+
+void client_send_early_to_socks (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(!client->socks_closed)
+    ASSERT(!client->socks_up)
+    
+    // hand over data from the start of the buffer for as long as it is accepted
+    while (client->buf_used > 0) {
+        struct pbuf *p = client->buf_pbuf;
+        int len = socks_session_send_early(client->socks, (uint8_t *)p->payload + client->buf_offset, p->len - client->buf_offset);
+        if (len == 0) {
+            break;
+        }
+        
+        client->socks_early_taken = 1;
+        client->bytes_up += len;
+        
+        // the data is SOCKS's responsibility now
+        client_buf_advance(client, len);
+        client_confirm_data(client, len);
+    }
+}
+
+void client_buf_advance (struct tcp_client *client, int len)
+{
+    ASSERT(client->buf_pbuf)
+    ASSERT(len >= 0)
+    ASSERT(len <= client->buf_pbuf->len - client->buf_offset)
     
-    // schedule sending
-    StreamPassInterface_Sender_Send(client->socks_send_if, client->buf, client->buf_used);
+    client->buf_offset += len;
+    client->buf_used -= len;
+    client_buf_unpin(len);
+    
+    // free pbufs which were sent completely
+    while (client->buf_pbuf && client->buf_offset == client->buf_pbuf->len) {
+        struct pbuf *p = client->buf_pbuf;
+        
+        // keep the rest of the chain
+        client->buf_pbuf = p->next;
+        if (client->buf_pbuf) {
+            pbuf_ref(client->buf_pbuf);
+        }
+        pbuf_free(p);
+        
+        client->buf_offset = 0;
+    }
+    
+    ASSERT(!client->buf_pbuf == (client->buf_used == 0))
+}
+
+void client_open_rcv_wnd (struct tcp_client *client, int len)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(len >= 0)
+    
+    // tcp_recved takes at most 16 bits at a time
+    while (len > 0) {
+        int chunk = bmin_int(len, UINT16_MAX);
+        tcp_recved(client->pcb, chunk);
+        len -= chunk;
+    }
+}
+
+void client_grow_rcv_wnd (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(client->rcv_wnd_filled)
+    
+    client->rcv_wnd_filled = 0;
+    
+    if (options.tcp_wnd_autotune <= 0 || memory_pressure_level() >= MEMPRESSURE_LEVEL_SHRINK) {
+        return;
+    }
+    
+    // double the window, up to the configured maximum
+    int max_wnd = bmin_int(options.tcp_wnd_autotune, TCP_WND_MAX(client->pcb));
+    int new_wnd = bmin_int(2 * client->rcv_wnd, max_wnd);
+    if (new_wnd <= client->rcv_wnd) {
+        return;
+    }
+    
+    client_log(client, BLOG_DEBUG, "receive window %d -> %d", client->rcv_wnd, new_wnd);
+    
+    client_open_rcv_wnd(client, new_wnd - client->rcv_wnd);
+    client->rcv_wnd = new_wnd;
+}
+
+void client_grow_snd_buf (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    
+    if (options.tcp_wnd_autotune <= 0 || memory_pressure_level() >= MEMPRESSURE_LEVEL_SHRINK) {
+        return;
+    }
+    
+    // keep room for two congestion windows so that TCP always has data ready
+    // while acknowledgements for the previous window come in
+    uint64_t want = 2 * (uint64_t)LWIP_MIN(client->pcb->cwnd, client->pcb->snd_wnd);
+    int max_buf = bmin_int(options.tcp_wnd_autotune, TCP_SND_BUF);
+    int new_buf = (want < (uint64_t)max_buf) ? (int)want : max_buf;
+    if (new_buf <= client->snd_buf) {
+        return;
+    }
+    
+    client_log(client, BLOG_DEBUG, "send buffer %d -> %d", client->snd_buf, new_buf);
+    
+    client->pcb->snd_buf += new_buf - client->snd_buf;
+    client->snd_buf = new_buf;
 }
 
 void client_socks_send_handler_done (struct tcp_client *client, int data_len)
@@ -1674,19 +5696,28 @@ void client_socks_send_handler_done (struct tcp_client *client, int data_len)
     ASSERT(client->buf_used > 0)
     ASSERT(data_len > 0)
     ASSERT(data_len <= client->buf_used)
+    ASSERT(client->socks_send_since >= 0)
+    
+    client->bytes_up += data_len;
+    client->socks_send_blocked += BReactor_GetTime(&ss) - client->socks_send_since;
+    client->socks_send_since = -1;
     
     // remove sent data from buffer
-    memmove(client->buf, client->buf + data_len, client->buf_used - data_len);
-    client->buf_used -= data_len;
+    client_buf_advance(client, data_len);
     
     if (!client->client_closed) {
         // confirm sent data
-        tcp_recved(client->pcb, data_len);
+        client_confirm_data(client, data_len);
+        
+        // SOCKS keeps up with the client, let it send more at once
+        if (client->buf_used == 0 && client->rcv_wnd_filled) {
+            client_grow_rcv_wnd(client);
+        }
     }
     
     if (client->buf_used > 0) {
         // send any further data
-        StreamPassInterface_Sender_Send(client->socks_send_if, client->buf, client->buf_used);
+        client_send_to_socks(client);
     }
     else if (client->client_closed) {
         // client was closed we've sent everything we had buffered; we're done with it
@@ -1702,14 +5733,50 @@ void client_socks_recv_initiate (struct tcp_client *client)
     ASSERT(!client->socks_closed)
     ASSERT(client->socks_up)
     ASSERT(client->socks_recv_buf_used == -1)
+    ASSERT(client->socks_recv_buf)
+    
+    StreamRecvInterface_Receiver_Recv(client->socks_recv_if, client->socks_recv_buf, client_buf_sizes[client->socks_recv_buf_class]);
+}
+
+void client_socks_recv_resize (struct tcp_client *client, int last_len)
+{
+    ASSERT(client->socks_recv_buf)
+    ASSERT(client->socks_recv_buf_used == -1)
+    
+    // use larger buffers while receives fill the buffer, and go back to the
+    // idle buffer when the connection gets quiet; buffers larger than the
+    // normal one are only used once the TCP send buffer can take them, and
+    // not under memory pressure
+    int buf_class = client->socks_recv_buf_class;
+    if (last_len == client_buf_sizes[buf_class] && buf_class < CLIENT_BUF_NUM_CLASSES - 1 &&
+        client_buf_sizes[buf_class + 1] <= bmax_int(CLIENT_SOCKS_RECV_BUF_SIZE, client->snd_buf / 2) &&
+        (client_buf_sizes[buf_class + 1] <= CLIENT_SOCKS_RECV_BUF_SIZE || memory_pressure_level() < MEMPRESSURE_LEVEL_SHRINK)
+    ) {
+        buf_class++;
+    }
+    else if (buf_class > 0 && last_len <= client_buf_sizes[buf_class - 1]) {
+        buf_class--;
+    }
+    
+    if (buf_class == client->socks_recv_buf_class) {
+        return;
+    }
     
-    StreamRecvInterface_Receiver_Recv(client->socks_recv_if, client->socks_recv_buf, sizeof(client->socks_recv_buf));
+    // keep the current buffer if we can't get another one
+    uint8_t *buf = client_buf_alloc(buf_class);
+    if (!buf) {
+        return;
+    }
+    
+    client_buf_release(client->socks_recv_buf, client->socks_recv_buf_class);
+    client->socks_recv_buf = buf;
+    client->socks_recv_buf_class = buf_class;
 }
 
 void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
 {
     ASSERT(data_len > 0)
-    ASSERT(data_len <= sizeof(client->socks_recv_buf))
+    ASSERT(data_len <= client_buf_sizes[client->socks_recv_buf_class])
     ASSERT(!client->socks_closed)
     ASSERT(client->socks_up)
     ASSERT(client->socks_recv_buf_used == -1)
@@ -1719,6 +5786,9 @@ void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
         return;
     }
     
+    client_touch(client);
+    client->bytes_down += data_len;
+    
     // set amount of data in buffer
     client->socks_recv_buf_used = data_len;
     client->socks_recv_buf_sent = 0;
@@ -1731,6 +5801,7 @@ void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
     
     // continue receiving if needed
     if (client->socks_recv_buf_used == -1) {
+        client_socks_recv_resize(client, data_len);
         client_socks_recv_initiate(client);
     }
 }
@@ -1788,6 +5859,7 @@ int client_socks_recv_send_out (struct tcp_client *client)
         
         // set waiting, continue in client_sent_func
         client->socks_recv_waiting = 1;
+        client->snd_buf_wait_since = BReactor_GetTime(&ss);
         return 0;
     }
     
@@ -1811,6 +5883,11 @@ err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len)
     // decrement pending
     client->socks_recv_tcp_pending -= len;
     
+    // if the send buffer is what keeps data from SOCKS waiting, grow it
+    if (client->socks_recv_waiting) {
+        client_grow_snd_buf(client);
+    }
+    
     // continue queuing
     if (client->socks_recv_buf_used > 0) {
         ASSERT(client->socks_recv_waiting)
@@ -1818,6 +5895,7 @@ err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len)
         
         // set not waiting
         client->socks_recv_waiting = 0;
+        client->snd_buf_blocked += BReactor_GetTime(&ss) - client->snd_buf_wait_since;
         
         // possibly send more data
         if (client_socks_recv_send_out(client) < 0) {
@@ -1831,6 +5909,7 @@ err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len)
         if (client->socks_recv_buf_used == -1 && !client->socks_closed) {
             SYNC_DECL
             SYNC_FROMHERE
+            client_socks_recv_resize(client, client->socks_recv_buf_sent);
             client_socks_recv_initiate(client);
             SYNC_COMMIT
         }
@@ -1851,13 +5930,32 @@ out:
 
 void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
 {
-    ASSERT(udp_mode != UdpModeNone)
+    ASSERT(udp_mode != UdpModeNone || have_bypass)
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(local_addr.type == remote_addr.type)
+    ASSERT(data_len >= 0)
+    
+    // let the DNS cache answer all clients waiting for this response
+    if (have_dns_cache && BAddr_GetPort(&remote_addr) == hton16(53) &&
+        DnsCache_SubmitResponse(&dns_cache, local_addr, remote_addr, data, data_len)
+    ) {
+        return;
+    }
+    
+    udp_write_packet_to_device(NULL, local_addr, remote_addr, data, data_len);
+}
+
+void udp_write_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    ASSERT(udp_mode != UdpModeNone || have_bypass || have_fake_dns)
     ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
     ASSERT(local_addr.type == remote_addr.type)
     ASSERT(data_len >= 0)
 
-    char const *source_name = (udp_mode == UdpModeUdpgw) ? "udpgw" : "SOCKS UDP";
+    char const *source_name = (udp_mode == UdpModeUdpgw) ? "udpgw" : (udp_mode == UdpModeSocks) ? "SOCKS UDP" : "direct UDP";
     
+    // build the packet after the offload header, if any
+    uint8_t *packet = device_write_buf + device_hdr_len;
     int packet_length = 0;
     
     switch (local_addr.type) {
@@ -1865,9 +5963,9 @@ void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_add
             BLog(BLOG_INFO, "UDP: from %s %d bytes", source_name, data_len);
             
             if (data_len > UINT16_MAX - (sizeof(struct ipv4_header) + sizeof(struct udp_header)) ||
-                data_len > BTap_GetMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header))
+                data_len > BTap_GetLinkMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header))
             ) {
-                BLog(BLOG_ERROR, "UDP: packet is too large");
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "UDP: packet is too large");
                 return;
             }
             
@@ -1894,9 +5992,9 @@ void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_add
             udph.checksum = udp_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
             
             // write packet
-            memcpy(device_write_buf, &iph, sizeof(iph));
-            memcpy(device_write_buf + sizeof(iph), &udph, sizeof(udph));
-            memcpy(device_write_buf + sizeof(iph) + sizeof(udph), data, data_len);
+            memcpy(packet, &iph, sizeof(iph));
+            memcpy(packet + sizeof(iph), &udph, sizeof(udph));
+            memcpy(packet + sizeof(iph) + sizeof(udph), data, data_len);
             packet_length = sizeof(iph) + sizeof(udph) + data_len;
         } break;
         
@@ -1904,14 +6002,14 @@ void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_add
             BLog(BLOG_INFO, "UDP/IPv6: from %s %d bytes", source_name, data_len);
             
             if (!options.netif_ip6addr) {
-                BLog(BLOG_ERROR, "got IPv6 packet from %s but IPv6 is disabled", source_name);
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "got IPv6 packet from %s but IPv6 is disabled", source_name);
                 return;
             }
             
             if (data_len > UINT16_MAX - sizeof(struct udp_header) ||
-                data_len > BTap_GetMTU(&device) - (int)(sizeof(struct ipv6_header) + sizeof(struct udp_header))
+                data_len > BTap_GetLinkMTU(&device) - (int)(sizeof(struct ipv6_header) + sizeof(struct udp_header))
             ) {
-                BLog(BLOG_ERROR, "UDP/IPv6: packet is too large");
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "UDP/IPv6: packet is too large");
                 return;
             }
             
@@ -1935,13 +6033,119 @@ void udp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_add
             udph.checksum = udp_ip6_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
             
             // write packet
-            memcpy(device_write_buf, &iph, sizeof(iph));
-            memcpy(device_write_buf + sizeof(iph), &udph, sizeof(udph));
-            memcpy(device_write_buf + sizeof(iph) + sizeof(udph), data, data_len);
+            memcpy(packet, &iph, sizeof(iph));
+            memcpy(packet + sizeof(iph), &udph, sizeof(udph));
+            memcpy(packet + sizeof(iph) + sizeof(udph), data, data_len);
             packet_length = sizeof(iph) + sizeof(udph) + data_len;
         } break;
     }
     
     // submit packet
-    BTap_Send(&device, device_write_buf, packet_length);
+    struct BTap_offload_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    device_send_packet(device_write_buf, packet_length, &hdr);
+}
+
+void icmp_send_packet_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    ASSERT(options.udpgw_icmp)
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(local_addr.type == remote_addr.type)
+    ASSERT(data_len >= 0)
+    
+    // build the packet after the offload header, if any
+    uint8_t *packet = device_write_buf + device_hdr_len;
+    int packet_length = 0;
+    
+    struct icmp_echo_header icmph;
+    uint8_t *payload;
+    int payload_len;
+    
+    switch (local_addr.type) {
+        case BADDR_TYPE_IPV4: {
+            // parse echo reply
+            if (!icmp_echo_check(data, data_len, ICMP_TYPE_ECHO_REPLY, &icmph, &payload, &payload_len)) {
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "ICMP: bad echo reply from udpgw");
+                return;
+            }
+            
+            BLog(BLOG_INFO, "ICMP: echo reply from udpgw %d bytes", payload_len);
+            
+            if (data_len > UINT16_MAX - sizeof(struct ipv4_header) ||
+                data_len > BTap_GetLinkMTU(&device) - (int)sizeof(struct ipv4_header)
+            ) {
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "ICMP: packet is too large");
+                return;
+            }
+            
+            // build IP header
+            struct ipv4_header iph;
+            iph.version4_ihl4 = IPV4_MAKE_VERSION_IHL(sizeof(iph));
+            iph.ds = hton8(0);
+            iph.total_length = hton16(sizeof(iph) + data_len);
+            iph.identification = hton16(0);
+            iph.flags3_fragmentoffset13 = hton16(0);
+            iph.ttl = hton8(64);
+            iph.protocol = hton8(IPV4_PROTOCOL_ICMP);
+            iph.checksum = hton16(0);
+            iph.source_address = remote_addr.ipv4.ip;
+            iph.destination_address = local_addr.ipv4.ip;
+            iph.checksum = ipv4_checksum(&iph, NULL, 0);
+            
+            // restore the identifier which udpgw's socket replaced
+            icmph.identifier = local_addr.ipv4.port;
+            icmph.checksum = hton16(0);
+            icmph.checksum = icmp_checksum(&icmph, payload, payload_len);
+            
+            // write packet
+            memcpy(packet, &iph, sizeof(iph));
+            memcpy(packet + sizeof(iph), &icmph, sizeof(icmph));
+            memcpy(packet + sizeof(iph) + sizeof(icmph), payload, payload_len);
+            packet_length = sizeof(iph) + data_len;
+        } break;
+        
+        case BADDR_TYPE_IPV6: {
+            // parse echo reply
+            if (!icmp_echo_check(data, data_len, ICMPV6_TYPE_ECHO_REPLY, &icmph, &payload, &payload_len)) {
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "ICMPv6: bad echo reply from udpgw");
+                return;
+            }
+            
+            BLog(BLOG_INFO, "ICMPv6: echo reply from udpgw %d bytes", payload_len);
+            
+            if (data_len > UINT16_MAX ||
+                data_len > BTap_GetLinkMTU(&device) - (int)sizeof(struct ipv6_header)
+            ) {
+                BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_ERROR, "ICMPv6: packet is too large");
+                return;
+            }
+            
+            // build IPv6 header
+            struct ipv6_header iph;
+            iph.version4_tc4 = hton8((6 << 4));
+            iph.tc4_fl4 = hton8(0);
+            iph.fl = hton16(0);
+            iph.payload_length = hton16(data_len);
+            iph.next_header = hton8(IPV6_NEXT_ICMPV6);
+            iph.hop_limit = hton8(64);
+            memcpy(iph.source_address, remote_addr.ipv6.ip, 16);
+            memcpy(iph.destination_address, local_addr.ipv6.ip, 16);
+            
+            // restore the identifier which udpgw's socket replaced
+            icmph.identifier = local_addr.ipv6.port;
+            icmph.checksum = hton16(0);
+            icmph.checksum = icmp_ip6_checksum(&icmph, payload, payload_len, iph.source_address, iph.destination_address);
+            
+            // write packet
+            memcpy(packet, &iph, sizeof(iph));
+            memcpy(packet + sizeof(iph), &icmph, sizeof(icmph));
+            memcpy(packet + sizeof(iph) + sizeof(icmph), payload, payload_len);
+            packet_length = sizeof(iph) + data_len;
+        } break;
+    }
+    
+    // submit packet
+    struct BTap_offload_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    device_send_packet(device_write_buf, packet_length, &hdr);
 }
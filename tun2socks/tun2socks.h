@@ -30,18 +30,105 @@
 // size of temporary buffer for passing data from the SOCKS server to TCP for sending
 #define CLIENT_SOCKS_RECV_BUF_SIZE 8192
 
+// size of the temporary buffer used while a connection is idle; a connection switches
+// to the full buffer when a receive fills this one, and back when it goes quiet
+#define CLIENT_SOCKS_RECV_BUF_IDLE_SIZE 512
+
+// size of the temporary buffer used by connections whose TCP send buffer has grown
+// to at least twice this size
+#define CLIENT_SOCKS_RECV_BUF_LARGE_SIZE 65536
+
+// maximum number of unused buffers kept for reuse, per buffer size
+#define CLIENT_BUF_POOL_MAX_FREE 256
+
+// interval for logging client buffer statistics
+#define CLIENT_BUF_STATS_INTERVAL 60000
+
+// shortest time over which the rate of a connection is measured for the
+// connection table, in milliseconds
+#define CLIENT_RATE_MIN_INTERVAL 1000
+
+// with --memory-limit, how often to check whether idle UDP associations need to
+// be evicted, and how many to evict at once before checking again
+#define MEMORY_PRESSURE_INTERVAL 1000
+#define MEMORY_EVICT_BATCH 16
+
+// how long a UDP association must have been idle to be evicted under memory pressure
+#define MEMORY_EVICT_IDLE_TIME 5000
+
+// smallest receive window of a connection shrunk under memory pressure, in bytes
+#define MEMORY_SHRINK_MIN_RCV_WND 8192
+
+// default TCP receive window and send buffer of a connection, in bytes
+#define DEFAULT_TCP_RCV_WND 65535
+#define DEFAULT_TCP_SND_BUF 65535
+
+// default number of elements in the lwIP memory pools
+#define DEFAULT_LWIP_POOL_PBUFS 256
+#define DEFAULT_LWIP_POOL_TCP_SEGS 4096
+#define DEFAULT_LWIP_POOL_TCP_PCBS 256
+
+// default and largest number of TCP connections in the handshake per listener,
+// which lwIP counts in a byte
+#define DEFAULT_TCP_MAX_PENDING 255
+
+// number of sources whose connection rate is tracked with --tcp-accept-rate; a
+// source taking over the slot of another starts with a full bucket
+#define TCP_ACCEPT_RATE_SLOTS 4096
+
+// number of TCP client structures allocated at once
+#define CLIENT_POOL_SLAB_SIZE 64
+
+// number of packets which may be read ahead from the TUN device per readiness event
+// (on Windows, number of outstanding reads)
+#define DEVICE_RECV_BATCH 32
+
+// number of outstanding writes to the TUN device on Windows
+#define DEVICE_SEND_QUEUE 32
+
 // maximum number of udpgw connections
 #define DEFAULT_UDPGW_MAX_CONNECTIONS 256
 
 // udpgw per-connection send buffer size, in number of packets
 #define DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE 8
 
+// CoDel interval for udpgw per-connection send buffers, in milliseconds
+#define DEFAULT_UDPGW_CODEL_INTERVAL 100
+
+// number of TCP connections to udpgw which UDP flows are spread over
+#define DEFAULT_UDPGW_TCP_CONNECTIONS 1
+
+// maximum number of SOCKS servers
+#define MAX_SOCKS_SERVERS 16
+
+// default time the addresses of a SOCKS server given by name are cached, in ms
+#define DEFAULT_RESOLVER_CACHE_TIME 60000
+
+// time a SOCKS server is avoided after a failed handshake; doubles with each
+// further consecutive failure, up to SOCKS_SERVER_DOWN_MAX_SHIFT times
+#define SOCKS_SERVER_DOWN_TIME 2000
+#define SOCKS_SERVER_DOWN_MAX_SHIFT 5
+
+// weight of a new sample in the smoothed handshake latency of a SOCKS server, 1/2^n
+#define SOCKS_SERVER_LATENCY_SHIFT 3
+
+// default time a SOCKS session authenticated in advance is kept unused before it is replaced
+#define SOCKS_POOL_DEFAULT_IDLE_TIME 30000
+
+// time to wait before replacing SOCKS sessions authenticated in advance that failed
+#define SOCKS_POOL_RETRY_TIME 1000
+
 // udpgw reconnect time after connection fails
 #define UDPGW_RECONNECT_TIME 5000
 
 // udpgw keepalive sending interval
 #define UDPGW_KEEPALIVE_TIME 10000
 
+// how long the flows of a udpgw client replaced by a configuration reload may
+// stay idle before they are closed, and how often these are checked
+#define UDPGW_RETIRED_IDLE_TIME 60000
+#define UDPGW_RETIRED_CHECK_TIME 10000
+
 // option to override the destination addresses to give the SOCKS server
 //#define OVERRIDE_DEST_ADDR "10.111.0.2:2000"
 
@@ -50,3 +137,23 @@
 // or far-away SOCKS server could require 300 ms to connect, and a chatty client (e.g.
 // STUN) could send a packet every 20 ms, so a default limit of 16 seems reasonable.
 #define SOCKS_UDP_SEND_BUFFER_PACKETS 16
+
+// Max number of UDP flows sent directly to bypassed destinations, the number of
+// buffered outgoing packets per flow, and how long an idle flow is kept
+#define DIRECT_UDP_MAX_FLOWS 256
+#define DIRECT_UDP_SEND_BUFFER_PACKETS 16
+#define DIRECT_UDP_KEEPALIVE_TIME 30000
+
+// Default max number of UDP flows with --udp-direct, where every flow has its own socket
+#define DEFAULT_UDP_DIRECT_MAX_FLOWS 4096
+
+// Default max number of names mapped to fake addresses, and the TTL of fake answers in
+// seconds. The TTL is short so that resolvers and applications don't keep an address
+// long after it may have been recycled for another name.
+#define DEFAULT_FAKE_DNS_MAX_ENTRIES 65536
+#define DEFAULT_FAKE_DNS_TTL 1
+
+// Max number of messages logged per interval by each call site which
+// logs per packet, so that a misbehaving peer cannot flood the log
+#define PACKET_LOG_RATELIMIT_INTERVAL 10000
+#define PACKET_LOG_RATELIMIT_BURST 10
@@ -45,6 +45,7 @@
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <net/if.h>
     #include <net/if_arp.h>
     #ifdef BADVPN_LINUX
@@ -56,41 +57,271 @@
     #endif
 #endif
 
+#include <misc/balloc.h>
+#include <misc/usdt.h>
 #include <base/BLog.h>
 
 #include <tuntap/BTap.h>
 
 #include <generated/blog_channel_BTap.h>
 
+#ifdef BADVPN_USE_WINAPI
+#define IO_STATE_IDLE 0
+#define IO_STATE_PENDING 1
+#define IO_STATE_DONE 2
+#endif
+
 static void report_error (BTap *o);
 static void output_handler_recv (BTap *o, uint8_t *data);
 
 #ifdef BADVPN_USE_WINAPI
 
-static void recv_olap_handler (BTap *o, int event, DWORD bytes)
+static int init_ios (BTap *o, struct BTap_win_io **out_ios, int num, BReactorIOCPOverlapped_handler handler)
 {
-    DebugObject_Access(&o->d_obj);
-    ASSERT(o->output_packet)
-    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    struct BTap_win_io *ios = (struct BTap_win_io *)BAllocArray(num, sizeof(ios[0]));
+    if (!ios) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
     
-    // set no output packet
-    o->output_packet = NULL;
+    int i;
+    for (i = 0; i < num; i++) {
+        struct BTap_win_io *io = &ios[i];
+        
+        if (!(io->buf = (uint8_t *)BAlloc(o->frame_mtu))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            goto fail;
+        }
+        
+        io->parent = o;
+        io->state = IO_STATE_IDLE;
+        BReactorIOCPOverlapped_Init(&io->olap, o->reactor, io, handler);
+    }
+    
+    *out_ios = ios;
+    return 1;
+    
+fail:
+    while (i-- > 0) {
+        BReactorIOCPOverlapped_Free(&ios[i].olap);
+        BFree(ios[i].buf);
+    }
+    BFree(ios);
+    return 0;
+}
+
+static void free_ios (struct BTap_win_io *ios, int num)
+{
+    for (int i = 0; i < num; i++) {
+        struct BTap_win_io *io = &ios[i];
+        
+        // wait for an operation which was cancelled but may not have completed yet
+        if (io->state == IO_STATE_PENDING) {
+            BLog(BLOG_DEBUG, "waiting for I/O to finish");
+            BReactorIOCPOverlapped_Wait(&io->olap, NULL, NULL);
+        }
+        
+        BReactorIOCPOverlapped_Free(&io->olap);
+        BFree(io->buf);
+    }
+    
+    BFree(ios);
+}
+
+static int issue_reads (BTap *o)
+{
+    // returns 1 on success, 0 on fatal error
+    
+    while (o->recv_used < o->recv_queue) {
+        struct BTap_win_io *io = &o->recv_ios[(o->recv_start + o->recv_used) % o->recv_queue];
+        ASSERT(io->state == IO_STATE_IDLE)
+        
+        memset(&io->olap.olap, 0, sizeof(io->olap.olap));
+        
+        // the completion is queued to the IOCP even if the read finishes immediately
+        BOOL res = ReadFile(o->device, io->buf, o->frame_mtu, NULL, &io->olap.olap);
+        if (res == FALSE && GetLastError() != ERROR_IO_PENDING) {
+            BLog(BLOG_ERROR, "ReadFile failed (%u)", GetLastError());
+            return 0;
+        }
+        
+        io->state = IO_STATE_PENDING;
+        o->recv_used++;
+    }
+    
+    return 1;
+}
+
+static void deliver_frame (BTap *o)
+{
+    // frames are handed out in the order the reads were issued
+    if (!o->output_packet || o->recv_used == 0) {
+        return;
+    }
+    
+    struct BTap_win_io *io = &o->recv_ios[o->recv_start];
+    if (io->state != IO_STATE_DONE) {
+        return;
+    }
     
-    if (event == BREACTOR_IOCP_EVENT_FAILED) {
+    io->state = IO_STATE_IDLE;
+    o->recv_start = (o->recv_start + 1) % o->recv_queue;
+    o->recv_used--;
+    
+    if (!io->succeeded) {
         BLog(BLOG_ERROR, "read operation failed");
         report_error(o);
         return;
     }
     
-    ASSERT(bytes >= 0)
-    ASSERT(bytes <= o->frame_mtu)
+    ASSERT(io->bytes <= o->frame_mtu)
+    
+    uint8_t *data = o->output_packet;
+    int bytes = io->bytes;
+    memcpy(data, io->buf, bytes);
+    
+    // set no output packet
+    o->output_packet = NULL;
+    
+    // keep the queue of reads full
+    if (!issue_reads(o)) {
+        report_error(o);
+        return;
+    }
     
     // done
     PacketRecvInterface_Done(&o->output, bytes);
 }
 
+static void recv_olap_handler (struct BTap_win_io *io, int event, DWORD bytes)
+{
+    BTap *o = io->parent;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(io->state == IO_STATE_PENDING)
+    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    
+    io->state = IO_STATE_DONE;
+    io->succeeded = (event == BREACTOR_IOCP_EVENT_SUCCEEDED);
+    io->bytes = bytes;
+    
+    deliver_frame(o);
+}
+
+static void release_writes (BTap *o)
+{
+    // release completed writes in the order they were issued
+    while (o->send_used > 0) {
+        struct BTap_win_io *io = &o->send_ios[o->send_start];
+        if (io->state != IO_STATE_DONE) {
+            break;
+        }
+        
+        if (!io->succeeded) {
+            BLog(BLOG_ERROR, "write operation failed");
+        }
+        else if (io->bytes < io->len) {
+            BLog(BLOG_ERROR, "write operation didn't write everything");
+        }
+        
+        io->state = IO_STATE_IDLE;
+        o->send_start = (o->send_start + 1) % o->send_queue;
+        o->send_used--;
+    }
+}
+
+static void send_olap_handler (struct BTap_win_io *io, int event, DWORD bytes)
+{
+    BTap *o = io->parent;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(io->state == IO_STATE_PENDING)
+    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    
+    io->state = IO_STATE_DONE;
+    io->succeeded = (event == BREACTOR_IOCP_EVENT_SUCCEEDED);
+    io->bytes = bytes;
+    
+    release_writes(o);
+}
+
+static struct BTap_win_io * get_write_slot (BTap *o)
+{
+    // with all writes outstanding, wait for the oldest one
+    if (o->send_used == o->send_queue) {
+        struct BTap_win_io *io = &o->send_ios[o->send_start];
+        ASSERT(io->state == IO_STATE_PENDING)
+        
+        int succeeded;
+        DWORD bytes;
+        BReactorIOCPOverlapped_Wait(&io->olap, &succeeded, &bytes);
+        
+        io->state = IO_STATE_DONE;
+        io->succeeded = succeeded;
+        io->bytes = bytes;
+        
+        release_writes(o);
+    }
+    
+    ASSERT(o->send_used < o->send_queue)
+    
+    return &o->send_ios[(o->send_start + o->send_used) % o->send_queue];
+}
+
+static void submit_write (BTap *o, struct BTap_win_io *io, int data_len)
+{
+    ASSERT(io->state == IO_STATE_IDLE)
+    
+    memset(&io->olap.olap, 0, sizeof(io->olap.olap));
+    io->len = data_len;
+    
+    // write
+    BOOL res = WriteFile(o->device, io->buf, data_len, NULL, &io->olap.olap);
+    if (res == FALSE && GetLastError() != ERROR_IO_PENDING) {
+        BLog(BLOG_ERROR, "WriteFile failed (%u)", GetLastError());
+        return;
+    }
+    
+    io->state = IO_STATE_PENDING;
+    o->send_used++;
+}
+
 #else
 
+static void update_events (BTap *o)
+{
+    // Keep read interest while someone is waiting for a frame, or while there
+    // is room left for reading ahead.
+    int events = 0;
+    if (o->output_packet || o->ring_used < o->ring_size) {
+        events |= BREACTOR_READ;
+    }
+    
+    if (events != o->poll_events) {
+        o->poll_events = events;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+    }
+}
+
+static int read_frame (BTap *o, uint8_t *data)
+{
+    // returns >0 on success, 0 if no frame is available, -1 on fatal error
+    
+    int bytes = read(o->fd, data, o->frame_mtu);
+    if (bytes <= 0) {
+        // Treat zero return value the same as EAGAIN.
+        // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
+        if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+    
+    ASSERT_FORCE(bytes <= o->frame_mtu)
+    
+    BTRACE2(btap_recv, o, bytes);
+    
+    return bytes;
+}
+
 static void fd_handler (BTap *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -100,35 +331,58 @@ static void fd_handler (BTap *o, int events)
         BLog(BLOG_WARNING, "device fd reports error?");
     }
     
-    if (events&BREACTOR_READ) do {
-        ASSERT(o->output_packet)
+    if (!(events&BREACTOR_READ)) {
+        return;
+    }
+    
+    int done_bytes = -1;
+    
+    // read directly into the requested packet, if any
+    if (o->output_packet) {
+        ASSERT(o->ring_used == 0)
         
-        // try reading into the buffer
-        int bytes = read(o->fd, o->output_packet, o->frame_mtu);
-        if (bytes <= 0) {
-            // Treat zero return value the same as EAGAIN.
-            // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
-            if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
-                // retry later
-                break;
-            }
+        int bytes = read_frame(o, o->output_packet);
+        if (bytes < 0) {
             // report fatal error
             report_error(o);
             return;
         }
-        
-        ASSERT_FORCE(bytes <= o->frame_mtu)
+        if (bytes == 0) {
+            // retry later
+            return;
+        }
         
         // set no output packet
         o->output_packet = NULL;
         
-        // update events
-        o->poll_events &= ~BREACTOR_READ;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+        done_bytes = bytes;
+    }
+    
+    // read ahead into the ring
+    while (o->ring_used < o->ring_size) {
+        int slot = (o->ring_start + o->ring_used) % o->ring_size;
+        
+        int bytes = read_frame(o, o->ring_buf + (size_t)slot * o->frame_mtu);
+        if (bytes < 0) {
+            // report fatal error
+            report_error(o);
+            return;
+        }
+        if (bytes == 0) {
+            break;
+        }
         
+        o->ring_lens[slot] = bytes;
+        o->ring_used++;
+    }
+    
+    // update events
+    update_events(o);
+    
+    if (done_bytes >= 0) {
         // inform receiver we finished the packet
-        PacketRecvInterface_Done(&o->output, bytes);
-    } while (0);
+        PacketRecvInterface_Done(&o->output, done_bytes);
+    }
 }
 
 #endif
@@ -147,39 +401,44 @@ void output_handler_recv (BTap *o, uint8_t *data)
     
 #ifdef BADVPN_USE_WINAPI
     
-    memset(&o->recv_olap.olap, 0, sizeof(o->recv_olap.olap));
-    
-    // read
-    BOOL res = ReadFile(o->device, data, o->frame_mtu, NULL, &o->recv_olap.olap);
-    if (res == FALSE && GetLastError() != ERROR_IO_PENDING) {
-        BLog(BLOG_ERROR, "ReadFile failed (%u)", GetLastError());
-        report_error(o);
-        return;
-    }
-    
+    // remember packet
     o->output_packet = data;
     
+    // hand out a frame if the oldest read completed already
+    deliver_frame(o);
+    
 #else
     
+    // hand out a frame which was read ahead
+    if (o->ring_used > 0) {
+        int bytes = o->ring_lens[o->ring_start];
+        memcpy(data, o->ring_buf + (size_t)o->ring_start * o->frame_mtu, bytes);
+        
+        o->ring_start = (o->ring_start + 1) % o->ring_size;
+        o->ring_used--;
+        
+        // the ring has room now, make sure we keep reading ahead
+        update_events(o);
+        
+        PacketRecvInterface_Done(&o->output, bytes);
+        return;
+    }
+    
     // attempt read
-    int bytes = read(o->fd, data, o->frame_mtu);
-    if (bytes <= 0) {
-        if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
-            // See note about zero return in fd_handler.
-            // retry later in fd_handler
-            // remember packet
-            o->output_packet = data;
-            // update events
-            o->poll_events |= BREACTOR_READ;
-            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
-            return;
-        }
+    int bytes = read_frame(o, data);
+    if (bytes < 0) {
         // report fatal error
         report_error(o);
         return;
     }
-    
-    ASSERT_FORCE(bytes <= o->frame_mtu)
+    if (bytes == 0) {
+        // retry later in fd_handler
+        // remember packet
+        o->output_packet = data;
+        // update events
+        update_events(o);
+        return;
+    }
     
     PacketRecvInterface_Done(&o->output, bytes);
     
@@ -193,6 +452,9 @@ int BTap_Init (BTap *o, BReactor *reactor, char *devname, BTap_handler_error han
     struct BTap_init_data init_data;
     init_data.dev_type = tun ? BTAP_DEV_TUN : BTAP_DEV_TAP;
     init_data.init_type = BTAP_INIT_STRING;
+    init_data.flags = 0;
+    init_data.recv_batch = 0;
+    init_data.send_queue = 0;
     init_data.init.string = devname;
     
     return BTap_Init2(o, reactor, init_data, handler_error, handler_error_user);
@@ -201,6 +463,9 @@ int BTap_Init (BTap *o, BReactor *reactor, char *devname, BTap_handler_error han
 int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTap_handler_error handler_error, void *handler_error_user)
 {
     ASSERT(init_data.dev_type == BTAP_DEV_TUN || init_data.dev_type == BTAP_DEV_TAP)
+    ASSERT(!(init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE) || init_data.init_type == BTAP_INIT_STRING)
+    ASSERT(!(init_data.flags & BTAP_INIT_FLAG_OFFLOAD) || init_data.init_type == BTAP_INIT_STRING)
+    ASSERT(!(init_data.flags & BTAP_INIT_FLAG_OFFLOAD) || init_data.dev_type == BTAP_DEV_TUN)
     
     // init arguments
     o->reactor = reactor;
@@ -211,6 +476,16 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     
     ASSERT(init_data.init_type == BTAP_INIT_STRING)
     
+    if ((init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE)) {
+        BLog(BLOG_ERROR, "multi-queue devices not supported on Windows");
+        goto fail0;
+    }
+    
+    if ((init_data.flags & BTAP_INIT_FLAG_OFFLOAD)) {
+        BLog(BLOG_ERROR, "offloads not supported on Windows");
+        goto fail0;
+    }
+    
     // parse device specification
     
     if (!init_data.init.string) {
@@ -280,6 +555,7 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     } else {
         o->frame_mtu = umtu + BTAP_ETHERNET_HEADER_LENGTH;
     }
+    o->link_mtu = o->frame_mtu;
     
     // set connected
     
@@ -298,17 +574,39 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
         goto fail2;
     }
     
-    // init send olap
-    BReactorIOCPOverlapped_Init(&o->send_olap, o->reactor, o, NULL);
+    // init queue of reads
+    o->recv_queue = (init_data.recv_batch > 1 ? init_data.recv_batch : 1);
+    o->recv_start = 0;
+    o->recv_used = 0;
+    if (!init_ios(o, &o->recv_ios, o->recv_queue, (BReactorIOCPOverlapped_handler)recv_olap_handler)) {
+        goto fail2;
+    }
+    
+    // init queue of writes
+    o->send_queue = (init_data.send_queue > 1 ? init_data.send_queue : 1);
+    o->send_start = 0;
+    o->send_used = 0;
+    if (!init_ios(o, &o->send_ios, o->send_queue, (BReactorIOCPOverlapped_handler)send_olap_handler)) {
+        goto fail3;
+    }
+    
+    // start reading ahead
+    if (!issue_reads(o)) {
+        goto fail4;
+    }
     
-    // init recv olap
-    BReactorIOCPOverlapped_Init(&o->recv_olap, o->reactor, o, (BReactorIOCPOverlapped_handler)recv_olap_handler);
+    BLog(BLOG_INFO, "Device I/O queues: %d reads, %d writes", o->recv_queue, o->send_queue);
     
     free(device_name);
     free(device_component_id);
     
     goto success;
     
+fail4:
+    ASSERT_FORCE(CancelIo(o->device))
+    free_ios(o->send_ios, o->send_queue);
+fail3:
+    free_ios(o->recv_ios, o->recv_queue);
 fail2:
     ASSERT_FORCE(CloseHandle(o->device))
 fail1:
@@ -331,6 +629,7 @@ fail0:
             
             o->fd = init_data.init.fd.fd;
             o->frame_mtu = init_data.init.fd.mtu;
+            o->link_mtu = o->frame_mtu;
         } break;
         
         case BTAP_INIT_STRING: {
@@ -355,6 +654,17 @@ fail0:
             } else {
                 ifr.ifr_flags |= IFF_TAP;
             }
+            if ((init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE)) {
+                #ifdef IFF_MULTI_QUEUE
+                ifr.ifr_flags |= IFF_MULTI_QUEUE;
+                #else
+                BLog(BLOG_ERROR, "multi-queue devices not supported");
+                goto fail1;
+                #endif
+            }
+            if ((init_data.flags & BTAP_INIT_FLAG_OFFLOAD)) {
+                ifr.ifr_flags |= IFF_VNET_HDR;
+            }
             if (init_data.init.string) {
                 snprintf(ifr.ifr_name, IFNAMSIZ, "%s", init_data.init.string);
             }
@@ -366,10 +676,39 @@ fail0:
             
             strcpy(devname_real, ifr.ifr_name);
             
+            // enable checksum offload and TCP segmentation offload
+            if ((init_data.flags & BTAP_INIT_FLAG_OFFLOAD)) {
+                int hdr_size = sizeof(struct BTap_offload_header);
+                if (ioctl(o->fd, TUNSETVNETHDRSZ, (void *)&hdr_size) < 0) {
+                    BLog(BLOG_ERROR, "error setting offload header size");
+                    goto fail1;
+                }
+                
+                unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+                if (ioctl(o->fd, TUNSETOFFLOAD, offloads) < 0) {
+                    BLog(BLOG_ERROR, "error enabling offloads");
+                    goto fail1;
+                }
+            } else {
+                // a persistent device keeps offloads from a previous user, and
+                // without the header we would get packets with partial checksums
+                ioctl(o->fd, TUNSETOFFLOAD, 0U);
+            }
+            
             #endif
             
             #ifdef BADVPN_FREEBSD
             
+            if ((init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE)) {
+                BLog(BLOG_ERROR, "multi-queue devices not supported on FreeBSD");
+                goto fail0;
+            }
+            
+            if ((init_data.flags & BTAP_INIT_FLAG_OFFLOAD)) {
+                BLog(BLOG_ERROR, "offloads not supported on FreeBSD");
+                goto fail0;
+            }
+            
             if (init_data.dev_type == BTAP_DEV_TUN) {
                 BLog(BLOG_ERROR, "TUN not supported on FreeBSD");
                 goto fail0;
@@ -426,6 +765,12 @@ fail0:
             } else {
                 o->frame_mtu = ifr.ifr_mtu + BTAP_ETHERNET_HEADER_LENGTH;
             }
+            o->link_mtu = o->frame_mtu;
+            
+            // with offloads, packets are as large as GSO allows, plus the header
+            if ((init_data.flags & BTAP_INIT_FLAG_OFFLOAD)) {
+                o->frame_mtu = sizeof(struct BTap_offload_header) + BTAP_OFFLOAD_MAX_PACKET;
+            }
             
             close(sock);
         } break;
@@ -439,16 +784,42 @@ fail0:
         goto fail1;
     }
     
+    // allocate read-ahead ring
+    o->ring_size = (init_data.recv_batch > 1) ? init_data.recv_batch : 0;
+    o->ring_buf = NULL;
+    o->ring_lens = NULL;
+    if (o->ring_size > 0) {
+        if (!(o->ring_buf = (uint8_t *)BAllocArray2(o->ring_size, o->frame_mtu, 1))) {
+            BLog(BLOG_ERROR, "BAllocArray2 failed");
+            goto fail1;
+        }
+        if (!(o->ring_lens = (int *)BAllocArray(o->ring_size, sizeof(o->ring_lens[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail2;
+        }
+    }
+    o->ring_start = 0;
+    o->ring_used = 0;
+    
     // init file descriptor object
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
     if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
         BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
-        goto fail1;
+        goto fail2;
     }
     o->poll_events = 0;
     
+    // set no output packet, so update_events sees a consistent state
+    o->output_packet = NULL;
+    
+    // start reading ahead right away
+    update_events(o);
+    
     goto success;
     
+fail2:
+    BFree(o->ring_lens);
+    BFree(o->ring_buf);
 fail1:
     if (o->close_fd) {
         ASSERT_FORCE(close(o->fd) == 0)
@@ -483,17 +854,11 @@ void BTap_Free (BTap *o)
     // cancel I/O
     ASSERT_FORCE(CancelIo(o->device))
     
-    // wait receiving to finish
-    if (o->output_packet) {
-        BLog(BLOG_DEBUG, "waiting for receiving to finish");
-        BReactorIOCPOverlapped_Wait(&o->recv_olap, NULL, NULL);
-    }
-    
-    // free recv olap
-    BReactorIOCPOverlapped_Free(&o->recv_olap);
+    // free queue of writes, waiting for cancelled ones
+    free_ios(o->send_ios, o->send_queue);
     
-    // free send olap
-    BReactorIOCPOverlapped_Free(&o->send_olap);
+    // free queue of reads, waiting for cancelled ones
+    free_ios(o->recv_ios, o->recv_queue);
     
     // close device
     ASSERT_FORCE(CloseHandle(o->device))
@@ -503,6 +868,10 @@ void BTap_Free (BTap *o)
     // free BFileDescriptor
     BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
     
+    // free read-ahead ring
+    BFree(o->ring_lens);
+    BFree(o->ring_buf);
+    
     if (o->close_fd) {
         // close file descriptor
         ASSERT_FORCE(close(o->fd) == 0)
@@ -518,6 +887,13 @@ int BTap_GetMTU (BTap *o)
     return o->frame_mtu;
 }
 
+int BTap_GetLinkMTU (BTap *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->link_mtu;
+}
+
 void BTap_Send (BTap *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
@@ -525,6 +901,8 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->frame_mtu)
     
+    BTRACE2(btap_send, o, data_len);
+    
 #ifdef BADVPN_USE_WINAPI
     
     // ignore frames without an Ethernet header, or we get errors in WriteFile
@@ -532,34 +910,77 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
         return;
     }
     
-    memset(&o->send_olap.olap, 0, sizeof(o->send_olap.olap));
+    // copy the frame, so that the write can complete after we return
+    struct BTap_win_io *io = get_write_slot(o);
+    memcpy(io->buf, data, data_len);
     
-    // write
-    BOOL res = WriteFile(o->device, data, data_len, NULL, &o->send_olap.olap);
-    if (res == FALSE && GetLastError() != ERROR_IO_PENDING) {
-        BLog(BLOG_ERROR, "WriteFile failed (%u)", GetLastError());
-        return;
-    }
+    submit_write(o, io, data_len);
     
-    // wait
-    int succeeded;
-    DWORD bytes;
-    BReactorIOCPOverlapped_Wait(&o->send_olap, &succeeded, &bytes);
+#else
     
-    if (!succeeded) {
-        BLog(BLOG_ERROR, "write operation failed");
+    int bytes = write(o->fd, data, data_len);
+    if (bytes < 0) {
+        // malformed packets will cause errors, ignore them and act like
+        // the packet was accepeted
     } else {
-        ASSERT(bytes >= 0)
-        ASSERT(bytes <= data_len)
-        
-        if (bytes < data_len) {
-            BLog(BLOG_ERROR, "write operation didn't write everything");
+        if (bytes != data_len) {
+            BLog(BLOG_WARNING, "written %d expected %d", bytes, data_len);
         }
     }
     
+#endif
+}
+
+void BTap_SendChunks (BTap *o, const struct BTap_chunk *chunks, int num_chunks)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(num_chunks >= 1)
+    ASSERT(num_chunks <= BTAP_SEND_MAX_CHUNKS)
+    
+#ifdef BADVPN_USE_WINAPI
+    
+    int data_len = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        ASSERT(chunks[i].len >= 0)
+        ASSERT(chunks[i].len <= o->frame_mtu - data_len)
+        
+        data_len += chunks[i].len;
+    }
+    
+    BTRACE2(btap_send, o, data_len);
+    
+    // ignore frames without an Ethernet header, or we get errors in WriteFile
+    if (data_len < 14) {
+        return;
+    }
+    
+    // WriteFileGather needs whole pages, so gather into the buffer of a write
+    struct BTap_win_io *io = get_write_slot(o);
+    int pos = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        memcpy(io->buf + pos, chunks[i].data, chunks[i].len);
+        pos += chunks[i].len;
+    }
+    
+    submit_write(o, io, data_len);
+    
 #else
     
-    int bytes = write(o->fd, data, data_len);
+    struct iovec iov[BTAP_SEND_MAX_CHUNKS];
+    int data_len = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        ASSERT(chunks[i].len >= 0)
+        ASSERT(chunks[i].len <= o->frame_mtu - data_len)
+        
+        iov[i].iov_base = (void *)chunks[i].data;
+        iov[i].iov_len = chunks[i].len;
+        data_len += chunks[i].len;
+    }
+    
+    BTRACE2(btap_send, o, data_len);
+    
+    int bytes = writev(o->fd, iov, num_chunks);
     if (bytes < 0) {
         // malformed packets will cause errors, ignore them and act like
         // the packet was accepeted
@@ -62,23 +62,49 @@
  */
 typedef void (*BTap_handler_error) (void *used);
 
-typedef struct {
+#ifdef BADVPN_USE_WINAPI
+struct BTap_s;
+
+struct BTap_win_io {
+    struct BTap_s *parent;
+    BReactorIOCPOverlapped olap;
+    uint8_t *buf;
+    int state;
+    int len;
+    int succeeded;
+    DWORD bytes;
+};
+#endif
+
+typedef struct BTap_s {
     BReactor *reactor;
     BTap_handler_error handler_error;
     void *handler_error_user;
     int frame_mtu;
+    int link_mtu;
     PacketRecvInterface output;
     uint8_t *output_packet;
     
 #ifdef BADVPN_USE_WINAPI
     HANDLE device;
-    BReactorIOCPOverlapped send_olap;
-    BReactorIOCPOverlapped recv_olap;
+    int recv_queue;
+    struct BTap_win_io *recv_ios;
+    int recv_start;
+    int recv_used;
+    int send_queue;
+    struct BTap_win_io *send_ios;
+    int send_start;
+    int send_used;
 #else
     int close_fd;
     int fd;
     BFileDescriptor bfd;
     int poll_events;
+    int ring_size;
+    uint8_t *ring_buf;
+    int *ring_lens;
+    int ring_start;
+    int ring_used;
 #endif
     
     DebugError d_err;
@@ -109,6 +135,51 @@ int BTap_Init (BTap *o, BReactor *bsys, char *devname, BTap_handler_error handle
 
 enum BTap_dev_type {BTAP_DEV_TUN, BTAP_DEV_TAP};
 
+/**
+ * Request a multi-queue TUN/TAP device (IFF_MULTI_QUEUE). Opening the same
+ * device name with this flag multiple times attaches an additional queue
+ * each time, and the kernel distributes packets between the queues by flow
+ * hash. Only supported on Linux, and only for BTAP_INIT_STRING.
+ */
+#define BTAP_INIT_FLAG_MULTI_QUEUE (1 << 0)
+
+/**
+ * Enable offloads on a TUN device (IFF_VNET_HDR with TUNSETOFFLOAD): every
+ * packet read from or written to the device is preceded by a
+ * {@link BTap_offload_header}, the kernel may pass TCP packets of up to 64 KB
+ * to be handled as one (GSO) and accepts such packets for segmentation on
+ * write, and checksums may be left to the kernel. Only supported on Linux,
+ * for TUN devices with BTAP_INIT_STRING.
+ */
+#define BTAP_INIT_FLAG_OFFLOAD (1 << 1)
+
+/**
+ * Header in front of each packet with {@link BTAP_INIT_FLAG_OFFLOAD}.
+ * This is Linux's struct virtio_net_hdr, in host byte order.
+ */
+struct BTap_offload_header {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+
+// the checksum from csum_start on is still to be computed; the checksum field
+// at csum_start + csum_offset holds the sum of the pseudo-header
+#define BTAP_OFFLOAD_FLAG_NEEDS_CSUM 1
+// the checksum was verified already
+#define BTAP_OFFLOAD_FLAG_DATA_VALID 2
+
+#define BTAP_OFFLOAD_GSO_NONE 0
+#define BTAP_OFFLOAD_GSO_TCPV4 1
+#define BTAP_OFFLOAD_GSO_TCPV6 4
+#define BTAP_OFFLOAD_GSO_ECN 0x80
+
+// largest packet following the offload header
+#define BTAP_OFFLOAD_MAX_PACKET 65535
+
 enum BTap_init_type {
     BTAP_INIT_STRING,
 #ifndef BADVPN_USE_WINAPI
@@ -119,6 +190,9 @@ enum BTap_init_type {
 struct BTap_init_data {
     enum BTap_dev_type dev_type;
     enum BTap_init_type init_type;
+    int flags;
+    int recv_batch;
+    int send_queue;
     union {
         char *string;
         struct {
@@ -153,6 +227,18 @@ struct BTap_init_data {
  *                  and init_data.init.fd.mtu must be set to the largest IP packet or
  *                  Ethernet frame supported, for a TUN or TAP device, respectively.
  *                  File descriptor initialization is not supported on Windows.
+ *                  init_data.flags is a bitmask of BTAP_INIT_FLAG_* values; see
+ *                  {@link BTAP_INIT_FLAG_MULTI_QUEUE} and {@link BTAP_INIT_FLAG_OFFLOAD}.
+ *                  init_data.recv_batch is the number of frames that may be read ahead
+ *                  from the device when it becomes readable. Read-ahead frames are
+ *                  queued in a ring of preallocated buffers and handed out to the
+ *                  output without waiting for readiness again. Values <=1 disable
+ *                  read-ahead. On Windows, this is the number of overlapped reads kept
+ *                  outstanding on the device; frames are still handed out in order.
+ *                  init_data.send_queue is, on Windows, the number of overlapped writes
+ *                  which may be outstanding; {@link BTap_Send} copies the frame and returns
+ *                  without waiting for the write, unless the queue is full. Values <1 are
+ *                  treated as 1. Ignored on other systems, where writes do not block.
  * @param handler_error error handler function
  * @param handler_error_user value passed to error handler
  * @return 1 on success, 0 on failure
@@ -168,12 +254,24 @@ void BTap_Free (BTap *o);
 
 /**
  * Returns the device's maximum transmission unit (including any protocol headers).
+ * With {@link BTAP_INIT_FLAG_OFFLOAD}, this is the largest offload header and
+ * packet, which may be larger than the MTU of the link, see {@link BTap_GetLinkMTU}.
  *
  * @param o the object
  * @return device's MTU
  */
 int BTap_GetMTU (BTap *o);
 
+/**
+ * Returns the largest packet on the device's link (including any protocol headers,
+ * but not the offload header). This is the same as {@link BTap_GetMTU} unless
+ * {@link BTAP_INIT_FLAG_OFFLOAD} was used.
+ *
+ * @param o the object
+ * @return device's link MTU
+ */
+int BTap_GetLinkMTU (BTap *o);
+
 /**
  * Sends a packet to the device.
  * Any errors will be reported via a job.
@@ -184,6 +282,32 @@ int BTap_GetMTU (BTap *o);
  */
 void BTap_Send (BTap *o, uint8_t *data, int data_len);
 
+/**
+ * Maximum number of chunks for {@link BTap_SendChunks}.
+ */
+#define BTAP_SEND_MAX_CHUNKS 16
+
+/**
+ * A part of a packet for {@link BTap_SendChunks}.
+ */
+struct BTap_chunk {
+    const uint8_t *data;
+    int len;
+};
+
+/**
+ * Sends a packet given as a sequence of chunks to the device, without first
+ * copying it into one buffer (on Windows, the chunks are copied into an
+ * internal buffer).
+ * Any errors will be reported via a job.
+ * 
+ * @param o the object
+ * @param chunks chunks of the packet, in order
+ * @param num_chunks number of chunks. Must be >=1 and <=BTAP_SEND_MAX_CHUNKS.
+ *                   The total length must be <=MTU, as reported by {@link BTap_GetMTU}.
+ */
+void BTap_SendChunks (BTap *o, const struct BTap_chunk *chunks, int num_chunks);
+
 /**
  * Returns a {@link PacketRecvInterface} for reading packets from the device.
  * The MTU of the interface will be {@link BTap_GetMTU}.
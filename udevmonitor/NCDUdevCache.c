@@ -40,18 +40,77 @@
 
 #include <generated/blog_channel_NCDUdevCache.h>
 
+// properties which clients commonly match on
+static const char *indexed_properties[NCDUDEVCACHE_NUM_INDEXES] = {"SUBSYSTEM", "INTERFACE", "DEVNAME"};
+
 static int string_comparator (void *unused, const char **str1, const char **str2)
 {
     int c = strcmp(*str1, *str2);
     return B_COMPARE(c, 0);
 }
 
+static void index_device (NCDUdevCache *o, struct NCDUdevCache_device *device)
+{
+    for (int j = 0; j < NCDUDEVCACHE_NUM_INDEXES; j++) {
+        device->index[j].group = NULL;
+        
+        const char *value = BStringMap_Get(&device->map, indexed_properties[j]);
+        if (!value) {
+            continue;
+        }
+        
+        // find or create group for this value
+        struct NCDUdevCache_group *group;
+        BAVLNode *tree_node = BAVL_LookupExact(&o->groups_trees[j], &value);
+        if (tree_node) {
+            group = UPPER_OBJECT(tree_node, struct NCDUdevCache_group, groups_tree_node);
+        } else {
+            if (!(group = malloc(sizeof(*group)))) {
+                BLog(BLOG_ERROR, "malloc failed");
+                continue;
+            }
+            if (!(group->value = strdup(value))) {
+                BLog(BLOG_ERROR, "strdup failed");
+                free(group);
+                continue;
+            }
+            LinkedList1_Init(&group->devices_list);
+            ASSERT_EXECUTE(BAVL_Insert(&o->groups_trees[j], &group->groups_tree_node, NULL))
+        }
+        
+        LinkedList1_Append(&group->devices_list, &device->index[j].group_list_node);
+        device->index[j].group = group;
+    }
+}
+
+static void unindex_device (NCDUdevCache *o, struct NCDUdevCache_device *device)
+{
+    for (int j = 0; j < NCDUDEVCACHE_NUM_INDEXES; j++) {
+        struct NCDUdevCache_group *group = device->index[j].group;
+        if (!group) {
+            continue;
+        }
+        
+        LinkedList1_Remove(&group->devices_list, &device->index[j].group_list_node);
+        
+        // free group if it's empty
+        if (LinkedList1_IsEmpty(&group->devices_list)) {
+            BAVL_Remove(&o->groups_trees[j], &group->groups_tree_node);
+            free(group->value);
+            free(group);
+        }
+    }
+}
+
 static void free_device (NCDUdevCache *o, struct NCDUdevCache_device *device)
 {
     if (device->is_cleaned) {
         // remove from cleaned devices list
         LinkedList1_Remove(&o->cleaned_devices_list, &device->cleaned_devices_list_node);
     } else {
+        // remove from indexes
+        unindex_device(o, device);
+        
         // remove from devices tree
         BAVL_Remove(&o->devices_tree, &device->devices_tree_node);
     }
@@ -182,6 +241,9 @@ static int add_device (NCDUdevCache *o, BStringMap map)
         BLog(BLOG_DEBUG, "add %s", device->devpath);
     }
     
+    // insert to indexes
+    index_device(o, device);
+    
     // set not cleaned
     device->is_cleaned = 0;
     
@@ -202,6 +264,11 @@ void NCDUdevCache_Init (NCDUdevCache *o)
     // init cleaned devices list
     LinkedList1_Init(&o->cleaned_devices_list);
     
+    // init indexes
+    for (int j = 0; j < NCDUDEVCACHE_NUM_INDEXES; j++) {
+        BAVL_Init(&o->groups_trees[j], OFFSET_DIFF(struct NCDUdevCache_group, value, groups_tree_node), (BAVL_comparator)string_comparator, NULL);
+    }
+    
     DebugObject_Init(&o->d_obj);
 }
 
@@ -350,6 +417,9 @@ void NCDUdevCache_FinishClean (NCDUdevCache *o)
         if (!device->is_refreshed) {
             BLog(BLOG_DEBUG, "clean %s", device->devpath);
             
+            // remove from indexes
+            unindex_device(o, device);
+            
             // remove from devices tree
             BAVL_Remove(&o->devices_tree, &device->devices_tree_node);
             
@@ -415,3 +485,52 @@ const char * NCDUdevCache_Next (NCDUdevCache *o, const char *key)
     
     return device->devpath;
 }
+
+int NCDUdevCache_IndexOf (const char *name)
+{
+    for (int j = 0; j < NCDUDEVCACHE_NUM_INDEXES; j++) {
+        if (!strcmp(indexed_properties[j], name)) {
+            return j;
+        }
+    }
+    
+    return -1;
+}
+
+const char * NCDUdevCache_FirstMatch (NCDUdevCache *o, const char *name, const char *value)
+{
+    DebugObject_Access(&o->d_obj);
+    int j = NCDUdevCache_IndexOf(name);
+    ASSERT(j >= 0)
+    
+    BAVLNode *tree_node = BAVL_LookupExact(&o->groups_trees[j], &value);
+    if (!tree_node) {
+        return NULL;
+    }
+    struct NCDUdevCache_group *group = UPPER_OBJECT(tree_node, struct NCDUdevCache_group, groups_tree_node);
+    ASSERT(!LinkedList1_IsEmpty(&group->devices_list))
+    
+    struct NCDUdevCache_device *device = UPPER_OBJECT(LinkedList1_GetFirst(&group->devices_list), struct NCDUdevCache_device, index[j].group_list_node);
+    ASSERT(!device->is_cleaned)
+    
+    return device->devpath;
+}
+
+const char * NCDUdevCache_NextMatch (NCDUdevCache *o, const char *name, const char *key)
+{
+    ASSERT(lookup_device(o, key))
+    int j = NCDUdevCache_IndexOf(name);
+    ASSERT(j >= 0)
+    
+    struct NCDUdevCache_device *device = lookup_device(o, key);
+    ASSERT(device->index[j].group)
+    
+    LinkedList1Node *list_node = LinkedList1Node_Next(&device->index[j].group_list_node);
+    if (!list_node) {
+        return NULL;
+    }
+    device = UPPER_OBJECT(list_node, struct NCDUdevCache_device, index[j].group_list_node);
+    ASSERT(!device->is_cleaned)
+    
+    return device->devpath;
+}
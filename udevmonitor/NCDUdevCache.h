@@ -36,6 +36,11 @@
 #include <base/DebugObject.h>
 #include <stringmap/BStringMap.h>
 
+// number of properties in the secondary indexes, see NCDUdevCache_IndexOf
+#define NCDUDEVCACHE_NUM_INDEXES 3
+
+struct NCDUdevCache_group;
+
 struct NCDUdevCache_device {
     BStringMap map;
     const char *devpath;
@@ -45,11 +50,22 @@ struct NCDUdevCache_device {
         LinkedList1Node cleaned_devices_list_node;
     };
     int is_refreshed;
+    struct {
+        struct NCDUdevCache_group *group; // NULL if not indexed
+        LinkedList1Node group_list_node;
+    } index[NCDUDEVCACHE_NUM_INDEXES]; // if !is_cleaned
+};
+
+struct NCDUdevCache_group {
+    char *value;
+    BAVLNode groups_tree_node;
+    LinkedList1 devices_list;
 };
 
 typedef struct {
     BAVL devices_tree;
     LinkedList1 cleaned_devices_list;
+    BAVL groups_trees[NCDUDEVCACHE_NUM_INDEXES];
     DebugObject d_obj;
 } NCDUdevCache;
 
@@ -62,5 +78,8 @@ void NCDUdevCache_FinishClean (NCDUdevCache *o);
 int NCDUdevCache_GetCleanedDevice (NCDUdevCache *o, BStringMap *out_map);
 const char * NCDUdevCache_First (NCDUdevCache *o);
 const char * NCDUdevCache_Next (NCDUdevCache *o, const char *key);
+int NCDUdevCache_IndexOf (const char *name);
+const char * NCDUdevCache_FirstMatch (NCDUdevCache *o, const char *name, const char *value);
+const char * NCDUdevCache_NextMatch (NCDUdevCache *o, const char *name, const char *key);
 
 #endif
@@ -53,6 +53,34 @@ static void info_monitor_handler_event (NCDUdevManager *o);
 static void info_monitor_handler_error (NCDUdevManager *o, int is_error);
 static void next_job_handler (NCDUdevClient *o);
 
+static const char * event_get_property (NCDUdevMonitor *monitor, const char *name)
+{
+    NCDUdevMonitor_AssertReady(monitor);
+    
+    int num_properties = NCDUdevMonitor_GetNumProperties(monitor);
+    for (int i = 0; i < num_properties; i++) {
+        const char *p_name;
+        const char *p_value;
+        NCDUdevMonitor_GetProperty(monitor, i, &p_name, &p_value);
+        
+        if (!strcmp(p_name, name)) {
+            return p_value;
+        }
+    }
+    
+    return NULL;
+}
+
+static int client_filter_matches (NCDUdevClient *client, const BStringMap *map)
+{
+    if (!client->filter_name) {
+        return 1;
+    }
+    
+    const char *value = (map ? BStringMap_Get(map, client->filter_name) : NULL);
+    return (value && !strcmp(value, client->filter_value));
+}
+
 static int event_to_map (NCDUdevMonitor *monitor, BStringMap *out_map)
 {
     NCDUdevMonitor_AssertReady(monitor);
@@ -185,6 +213,30 @@ static void process_event (NCDUdevManager *o, NCDUdevMonitor *monitor)
 {
     NCDUdevMonitor_AssertReady(monitor);
     
+    // Find clients interested in this event, before the cache is updated. Besides
+    // the event's own properties, also match the device's previously cached properties
+    // so that clients learn when a device stops matching.
+    const char *devpath = event_get_property(monitor, "DEVPATH");
+    const char *devpath_old = event_get_property(monitor, "DEVPATH_OLD");
+    const BStringMap *old_map = (devpath ? NCDUdevCache_Query(&o->cache, devpath) : NULL);
+    const BStringMap *moved_map = (devpath_old ? NCDUdevCache_Query(&o->cache, devpath_old) : NULL);
+    
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->clients_list); ln; ln = LinkedList1Node_Next(ln)) {
+        NCDUdevClient *client = UPPER_OBJECT(ln, NCDUdevClient, clients_list_node);
+        
+        if (!client->filter_name) {
+            client->filter_matched = 1;
+            continue;
+        }
+        
+        const char *value = event_get_property(monitor, client->filter_name);
+        client->filter_matched = (
+            (value && !strcmp(value, client->filter_value)) ||
+            client_filter_matches(client, old_map) ||
+            client_filter_matches(client, moved_map)
+        );
+    }
+    
     // build map from event
     BStringMap map;
     if (!event_to_map(monitor, &map)) {
@@ -199,11 +251,13 @@ static void process_event (NCDUdevManager *o, NCDUdevMonitor *monitor)
         return;
     }
     
-    // queue event to clients
+    // queue event to interested clients
     LinkedList1Node *list_node = LinkedList1_GetFirst(&o->clients_list);
     while (list_node) {
         NCDUdevClient *client = UPPER_OBJECT(list_node, NCDUdevClient, clients_list_node);
-        queue_event(o, monitor, client);
+        if (client->filter_matched) {
+            queue_event(o, monitor, client);
+        }
         list_node = LinkedList1Node_Next(list_node);
     }
 }
@@ -366,11 +420,13 @@ static void info_monitor_handler_error (NCDUdevManager *o, int is_error)
             const char *devpath = BStringMap_Get(&map, "DEVPATH");
             ASSERT(devpath)
             
-            // queue mapless event to clients
+            // queue mapless event to interested clients
             LinkedList1Node *list_node = LinkedList1_GetFirst(&o->clients_list);
             while (list_node) {
                 NCDUdevClient *client = UPPER_OBJECT(list_node, NCDUdevClient, clients_list_node);
-                queue_mapless_event(o, devpath, client);
+                if (client_filter_matches(client, &map)) {
+                    queue_mapless_event(o, devpath, client);
+                }
                 list_node = LinkedList1Node_Next(list_node);
             }
             
@@ -466,13 +522,23 @@ const BStringMap * NCDUdevManager_Query (NCDUdevManager *o, const char *devpath)
 
 void NCDUdevClient_Init (NCDUdevClient *o, NCDUdevManager *m, void *user,
                          NCDUdevClient_handler handler)
+{
+    NCDUdevClient_InitFilter(o, m, user, handler, NULL, NULL);
+}
+
+void NCDUdevClient_InitFilter (NCDUdevClient *o, NCDUdevManager *m, void *user,
+                               NCDUdevClient_handler handler, const char *filter_name, const char *filter_value)
 {
     DebugObject_Access(&m->d_obj);
+    ASSERT(!filter_name || NCDUdevCache_IndexOf(filter_name) >= 0)
+    ASSERT(!filter_name == !filter_value)
     
     // init arguments
     o->m = m;
     o->user = user;
     o->handler = handler;
+    o->filter_name = filter_name;
+    o->filter_value = filter_value;
     
     // insert to manager's list
     LinkedList1_Append(&m->clients_list, &o->clients_list_node);
@@ -486,11 +552,19 @@ void NCDUdevClient_Init (NCDUdevClient *o, NCDUdevManager *m, void *user,
     // set running
     o->running = 1;
     
-    // queue all devices from cache
-    const char *devpath = NCDUdevCache_First(&m->cache);
-    while (devpath) {
-        queue_mapless_event(m, devpath, o);
-        devpath = NCDUdevCache_Next(&m->cache, devpath);
+    // queue all matching devices from cache
+    if (o->filter_name) {
+        const char *devpath = NCDUdevCache_FirstMatch(&m->cache, o->filter_name, o->filter_value);
+        while (devpath) {
+            queue_mapless_event(m, devpath, o);
+            devpath = NCDUdevCache_NextMatch(&m->cache, o->filter_name, devpath);
+        }
+    } else {
+        const char *devpath = NCDUdevCache_First(&m->cache);
+        while (devpath) {
+            queue_mapless_event(m, devpath, o);
+            devpath = NCDUdevCache_Next(&m->cache, devpath);
+        }
     }
     
     // if this is the first client, init monitor
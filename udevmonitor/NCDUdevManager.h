@@ -57,6 +57,9 @@ typedef struct {
     NCDUdevManager *m;
     void *user;
     NCDUdevClient_handler handler;
+    const char *filter_name;
+    const char *filter_value;
+    int filter_matched;
     LinkedList1Node clients_list_node;
     LinkedList1 events_list;
     BPending next_job;
@@ -77,6 +80,8 @@ const BStringMap * NCDUdevManager_Query (NCDUdevManager *o, const char *devpath)
 
 void NCDUdevClient_Init (NCDUdevClient *o, NCDUdevManager *m, void *user,
                          NCDUdevClient_handler handler);
+void NCDUdevClient_InitFilter (NCDUdevClient *o, NCDUdevManager *m, void *user,
+                               NCDUdevClient_handler handler, const char *filter_name, const char *filter_value);
 void NCDUdevClient_Free (NCDUdevClient *o);
 void NCDUdevClient_Pause (NCDUdevClient *o);
 void NCDUdevClient_Continue (NCDUdevClient *o);
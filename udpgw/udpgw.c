@@ -31,6 +31,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include <protocol/udpgw_proto.h>
 #include <misc/debug.h>
@@ -43,27 +44,60 @@
 #include <misc/open_standard_streams.h>
 #include <misc/balloc.h>
 #include <misc/compare.h>
+#include <misc/icmp_proto.h>
 #include <misc/print_macros.h>
+#include <misc/minmax.h>
+#include <misc/mempressure.h>
+#include <misc/memref.h>
+#include <misc/parse_number.h>
+#include <misc/read_file.h>
+#include <misc/ipaddr.h>
+#include <misc/ipaddr6.h>
 #include <structure/LinkedList1.h>
 #include <structure/BAVL.h>
+#include <structure/SAvl.h>
+#include <structure/BObjectPool.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BArena.h>
 #include <system/BReactor.h>
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BDatagram.h>
+#include <system/BFlowAddr.h>
 #include <system/BSignal.h>
+#include <system/BMetricsExporter.h>
+#include <system/BThreadPlacement.h>
+#ifndef BADVPN_USE_WINAPI
+#include <system/BUnixSignal.h>
+#include <system/BListenerHandoff.h>
+#endif
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketStreamSender.h>
+#include <flow/PacketProtoBatcher.h>
 #include <flow/PacketProtoFlow.h>
 #include <flow/SinglePacketBuffer.h>
+#include <flow/PacketBuffer.h>
+#include <flow/BufferWriter.h>
+#include <flowextra/PacketPassRateLimiter.h>
+#include <dnscache/DnsCache.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <random/BRandom2.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
 #endif
 
+#ifdef BADVPN_LINUX
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#endif
+
 #include <udpgw/udpgw.h>
 
 #include <generated/blog_channel_udpgw.h>
@@ -73,21 +107,94 @@
 
 #define DNS_UPDATE_TIME 2000
 
+// classes of connections with their own idle timeout
+#define IDLE_CLASS_OTHER 0
+#define IDLE_CLASS_DNS 1
+#define NUM_IDLE_CLASSES 2
+
+struct connection;
+struct port_group;
+
+B_START_PACKED
+struct control_packet {
+    struct packetproto_header pp;
+    struct udpgw_header udpgw;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct offer_packet {
+    struct packetproto_header pp;
+    struct udpgw_header udpgw;
+    struct udpgw_datagram_offer offer;
+} B_PACKED;
+B_END_PACKED
+
+typedef BFlowAddr *PortGroupsTree_key;
+
+#include "udpgw_port_groups_tree.h"
+#include <structure/SAvl_decl.h>
+
+#include "udpgw_port_group_ports_tree.h"
+#include <structure/SAvl_decl.h>
+
+// per-client metrics, if options.client_metrics
+struct client_metrics {
+    char labels[BADDR_MAX_PRINT_LEN + 16];
+    char labels_to_udp[BADDR_MAX_PRINT_LEN + 40];
+    char labels_to_client[BADDR_MAX_PRINT_LEN + 40];
+    BMetric packets_to_udp;
+    BMetric packets_to_client;
+    BMetric bytes_to_udp;
+    BMetric bytes_to_client;
+    BMetric queued_connections;
+};
+
 struct client {
     BConnection con;
     BAddr addr;
+    int weight;
+    int rate_limited;
+    int max_connections;
+    struct client_metrics *metrics;
     BTimer disconnect_timer;
     PacketProtoDecoder recv_decoder;
+    PacketPassRateLimiter recv_limiter;
     PacketPassInterface recv_if;
     PacketPassFairQueue send_queue;
+    PacketPassRateLimiter send_limiter;
+    PacketProtoBatcher send_batcher;
     PacketStreamSender send_sender;
+    PacketPassFairQueueFlow control_qflow;
+    int control_sending;
+    struct control_packet forget_packet;
+    struct offer_packet offer_packet;
+    struct control_packet ack_packet;
+    int batching;
+    int icmp;
+    int have_dgram_token;
+    uint64_t dgram_token;
+    BAVLNode dgram_tree_node;
+    BAddr dgram_addr;
+    int dgram_up;
+    BTimer dgram_timer;
     BAVL connections_tree;
     LinkedList1 connections_list;
+    LinkedList1 idle_lists[NUM_IDLE_CLASSES];
     int num_connections;
     LinkedList1 closing_connections_list;
     LinkedList1Node clients_list_node;
 };
 
+// connections bound to local ports, sharing a remote address
+// (or a remote IP if options.unique_local_ports)
+struct port_group {
+    BFlowAddr key;
+    PortGroupPortsTree ports_tree;
+    LinkedList1 lru_list;
+    PortGroupsTreeNode groups_tree_node;
+};
+
 struct connection {
     struct client *client;
     uint16_t conid;
@@ -95,9 +202,11 @@ struct connection {
     BAddr orig_addr;
     const uint8_t *first_data;
     int first_data_len;
-    btime_t last_use_time;
+    int addr_sent;
+    int is_icmp;
     int closing;
     BPending first_job;
+    btime_t last_used;
     BufferWriter *send_if;
     PacketProtoFlow send_ppflow;
     PacketPassFairQueueFlow send_qflow;
@@ -105,12 +214,19 @@ struct connection {
         struct {
             BDatagram udp_dgram;
             int local_port_index;
+            struct port_group *port_group;
+            PortGroupPortsTreeNode port_group_ports_tree_node;
+            LinkedList1Node port_group_lru_list_node;
             BufferWriter udp_send_writer;
             PacketBuffer udp_send_buffer;
             SinglePacketBuffer udp_recv_buffer;
             PacketPassInterface udp_recv_if;
             BAVLNode connections_tree_node;
             LinkedList1Node connections_list_node;
+            int idle_class;
+            LinkedList1Node idle_list_node;
+            uint64_t dns_serial;
+            BAVLNode dns_connections_tree_node;
         };
         struct {
             LinkedList1Node closing_connections_list_node;
@@ -131,21 +247,63 @@ struct {
     int loglevels[BLOG_NUM_CHANNELS];
     char *listen_addrs[MAX_LISTEN_ADDRS];
     int num_listen_addrs;
+    #ifndef BADVPN_USE_WINAPI
+    char *listen_unix;
+    char *listen_udp_addr;
+    char *handoff_socket;
+    int handoff_drain_timeout;
+    #endif
     int udp_mtu;
+    int udp_recv_batch;
+    int udp_connect;
+    int icmp_echo;
     int max_clients;
     int max_connections_for_client;
+    size_t memory_limit;
+    int idle_timeout;
+    int dns_idle_timeout;
+    int buffer_arena;
+    BThreadPlacement reactor_placement;
+    char *avoid_irq_cpus;
     int client_socket_sndbuf;
+    int client_rate;
+    int client_burst;
+    char *client_weight_addrs[MAX_CLIENT_WEIGHTS];
+    int client_weights[MAX_CLIENT_WEIGHTS];
+    int num_client_weights;
+    int client_metrics;
     int local_udp_num_ports;
     char *local_udp_addr;
     int local_udp_ip6_num_ports;
     char *local_udp_ip6_addr;
     int unique_local_ports;
+    int dns_cache_size;
+    char *dns_server_addr;
+    char *config_file;
+    #ifdef BADVPN_LINUX
+    int num_workers;
+    int steer_cpus;
+    #endif
+    #ifndef BADVPN_USE_WINAPI
+    int reactor_stats;
+    #endif
+    int reactor_job_budget_jobs;
+    int reactor_job_budget_us;
+    int reactor_busy_poll_spin_us;
+    int reactor_busy_poll_kernel_us;
+    int reactor_edge_triggered;
+    char *metrics_listen_addr;
+    char *metrics_statsd_addr;
+    int metrics_statsd_interval;
 } options;
 
 // MTUs
 int udpgw_mtu;
 int pp_mtu;
 
+// header of batches sent to clients
+struct udpgw_header batch_prefix;
+
 // listen addresses
 BAddr listen_addrs[MAX_LISTEN_ADDRS];
 int num_listen_addrs;
@@ -156,38 +314,205 @@ BAddr local_udp_addr;
 // local UDP/IPv6 port range, if options.local_udp_ip6_num_ports>=0
 BAddr local_udp_ip6_addr;
 
+// client weights, from options.client_weight_addrs
+struct client_weight {
+    int type;
+    struct ipv4_ifaddr ipv4;
+    struct ipv6_ifaddr ipv6;
+    int weight;
+} client_weights[MAX_CLIENT_WEIGHTS];
+int num_client_weights;
+
+// metrics export addresses
+BAddr metrics_listen_addr;
+BAddr metrics_statsd_addr;
+
 // DNS forwarding
 BAddr dns_addr;
 btime_t last_dns_update_time;
 
+// settings which the configuration file can replace, and a reload sets again;
+// clients keep the limits they were accepted with
+struct reload_settings {
+    int max_clients;
+    int max_connections_for_client;
+    int client_rate;
+    int client_burst;
+    BAddr dns_server_addr; // none to use the system's name server
+};
+
+// settings from the command line, which a reload starts from
+struct reload_settings cmdline_settings;
+
+// DNS server to forward DNS to, or none to use the system's name server
+BAddr dns_server_addr;
+
+// DNS response cache, if options.dns_cache_size>0; shared by all clients,
+// which it tells apart by the serial number of the forwarding connection
+int have_dns_cache;
+DnsCache dns_cache;
+BAVL dns_connections_tree;
+uint64_t next_dns_serial;
+
 // reactor
 BReactor ss;
 
-// listeners
-BListener listeners[MAX_LISTEN_ADDRS];
+// arena for buffers and pools, if options.buffer_arena
+BArena ss_arena;
+
+#ifndef BADVPN_USE_WINAPI
+// signal for dumping reactor statistics, if options.reactor_stats
+BUnixSignal stats_signal;
+#endif
+
+// listeners, and the Unix socket listener last if options.listen_unix
+BListener listeners[MAX_LISTEN_ADDRS + 1];
 int num_listeners;
 
+#ifndef BADVPN_USE_WINAPI
+// handoff socket serving a new instance, if options.handoff_socket, until the
+// listeners have been handed over; then the remaining clients are drained,
+// until they are gone or the timer expires
+int have_handoff;
+BListenerHandoff handoff;
+int draining;
+BTimer drain_timer;
+#endif
+
+// address of the datagram transport, and the source of client tokens,
+// if options.listen_udp_addr
+BAddr udp_listener_addr;
+#ifndef BADVPN_USE_WINAPI
+BRandom2 dgram_random;
+#endif
+
+// datagram transport socket, unless it has failed to be set up; datagrams to
+// clients are queued with their destination address in front
+int have_udp_listener;
+BDatagram udp_listener;
+uint16_t udp_listener_port;
+SinglePacketBuffer udp_listener_recv_buffer;
+PacketPassInterface udp_listener_recv_if;
+BufferWriter udp_listener_send_writer;
+PacketBuffer udp_listener_send_buffer;
+PacketPassInterface udp_listener_send_if;
+
+// clients with a datagram transport token, by token
+BAVL dgram_clients_tree;
+
+// metrics, and their exporter if options.metrics_listen_addr or options.metrics_statsd_addr
+BMetric metric_clients;
+BMetric metric_connections;
+BMetric metric_packets_to_udp;
+BMetric metric_packets_to_client;
+BMetric metric_bytes_to_udp;
+BMetric metric_bytes_to_client;
+BMetric metric_drops_udp_buffer;
+BMetric metric_drops_client_buffer;
+BMetric metric_drops_too_large;
+BMetric metric_dns_cache_answers;
+BMetric metric_idle_closed;
+int have_metrics_exporter;
+BMetricsExporter metrics_exporter;
+
 // clients
 LinkedList1 clients_list;
 int num_clients;
 
+#ifdef BADVPN_LINUX
+// number of clients of all workers, if options.num_workers>1
+int *shared_num_clients;
+#endif
+
+// pools of client, connection and port group structures
+BObjectPool clients_pool;
+BObjectPool connections_pool;
+BObjectPool port_groups_pool;
+
+// port groups, by remote address
+PortGroupsTree port_groups_tree;
+
+// estimated memory held by a client and by a connection, the accounted memory
+// and its pressure level, and the timer evicting idle connections under
+// pressure, if options.memory_limit>0
+size_t client_memory_size;
+size_t connection_memory_size;
+MemPressure memory_pressure;
+BTimer memory_pressure_timer;
+
+// idle timeout of each class of connections, zero if they don't expire, and
+// the timer closing idle connections, if any expire
+btime_t idle_timeouts[NUM_IDLE_CLASSES];
+BTimer idle_timer;
+
+#ifdef BADVPN_LINUX
+static int spawn_workers (int *out_worker);
+static void worker_split_ports (int worker, BAddr *addr, int *num_ports);
+#endif
+static int clients_limit_reserve (void);
+static void clients_limit_release (void);
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
+#ifndef BADVPN_USE_WINAPI
+static void stats_signal_handler (void *unused, int signo);
+#endif
+static void reload_settings_get (struct reload_settings *rs);
+static void reload_settings_set (const struct reload_settings *rs);
+static int config_next_word (MemRef *line, MemRef *out_word);
+static int config_file_load (struct reload_settings *rs);
+static void reload_handler (void *unused);
+static void init_metrics (void);
+static void free_metrics (void);
+static int64_t metric_clients_func (void *unused);
+static int64_t metric_connections_func (void *unused);
+static int memory_pressure_update (int may_fall);
+static int memory_pressure_level (void);
+static void memory_pressure_timer_handler (void *unused);
+static void idle_timer_handler (void *unused);
 static void listener_handler (BListener *listener);
+#ifndef BADVPN_USE_WINAPI
+static void handoff_handler (void *unused);
+static void drain_timer_handler (void *unused);
+#endif
+static int udp_listener_init (void);
+static void udp_listener_free (void);
+static void udp_listener_stop (void);
+static void udp_listener_handler_error (void *unused, int event);
+static void udp_listener_recv_if_handler_send (void *unused, uint8_t *data, int data_len);
+static void udp_listener_send_if_handler_send (void *unused, uint8_t *data, int data_len);
+static void udp_listener_send_handler_done (void *unused);
 static void client_free (struct client *client);
+static int client_weight_for_addr (BAddr addr);
+static int client_metrics_init (struct client *client);
+static void client_metrics_free (struct client *client);
+static int64_t metric_client_queued_func (struct client *client);
 static void client_logfunc (struct client *client);
 static void client_log (struct client *client, int level, const char *fmt, ...);
 static void client_disconnect_timer_handler (struct client *client);
 static void client_connection_handler (struct client *client, int event);
 static void client_decoder_handler_error (struct client *client);
 static void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static void client_recv_if_handler_send_batch (struct client *client, struct PacketPassInterface_packet *packets, int num_packets);
+static void client_process_packet (struct client *client, const uint8_t *data, int data_len, int from_dgram);
+static void client_process_message (struct client *client, const uint8_t *data, int data_len, int from_dgram);
+static void client_control_if_handler_done (struct client *client);
+static int client_init_dgram_token (struct client *client);
+static void client_send_dgram_keepalive (struct client *client);
+static void client_dgram_timer_handler (struct client *client);
 static int get_local_num_ports (int addr_type);
 static BAddr get_local_addr (int addr_type);
-static uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con);
-static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len);
+static BFlowAddr port_group_key (BAddr remote_addr);
+static struct port_group * port_group_init (BFlowAddr key);
+static void port_group_free (struct port_group *group);
+static int port_group_find_free_index (struct port_group *group, int start);
+static struct connection * port_group_find_least_used (struct port_group *group);
+static void connection_port_group_insert (struct connection *con, struct port_group *group, int local_port_index);
+static void connection_port_group_remove (struct connection *con);
+static void connection_port_group_touch (struct connection *con);
+static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int is_dns, int is_icmp, const uint8_t *data, int data_len);
 static void connection_free (struct connection *con);
 static void connection_logfunc (struct connection *con);
 static void connection_log (struct connection *con, int level, const char *fmt, ...);
@@ -196,13 +521,23 @@ static void connection_first_job_handler (struct connection *con);
 static void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len);
 static int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len);
 static void connection_close (struct connection *con);
+static void connection_send_forget (struct client *client, uint16_t conid);
 static void connection_send_qflow_busy_handler (struct connection *con);
 static void connection_dgram_handler_event (struct connection *con, int event);
 static void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len);
 static struct connection * find_connection (struct client *client, uint16_t conid);
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+static int uint64_comparator (void *unused, uint64_t *v1, uint64_t *v2);
+static BAddr connection_dns_id (struct connection *con);
+static void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 static void maybe_update_dns (void);
 
+#include "udpgw_port_groups_tree.h"
+#include <structure/SAvl_impl.h>
+
+#include "udpgw_port_group_ports_tree.h"
+#include <structure/SAvl_impl.h>
+
 int main (int argc, char **argv)
 {
     if (argc <= 0) {
@@ -278,60 +613,348 @@ int main (int argc, char **argv)
     }
     pp_mtu = udpgw_mtu + sizeof(struct packetproto_header);
     
+    // construct batch header
+    batch_prefix.flags = htol8(UDPGW_CLIENT_FLAG_BATCH);
+    batch_prefix.conid = htol16(0);
+    
+    int worker_index = 0;
+    
+#ifdef BADVPN_LINUX
+    shared_num_clients = NULL;
+    
+    // In multi-worker mode, fork the workers here. Each worker continues below
+    // with its own reactor, SO_REUSEPORT listeners and clients; the parent only
+    // supervises them and returns from spawn_workers when they are all gone.
+    if (options.num_workers > 1) {
+        // the client limit is shared, so keep the count in shared memory
+        void *shm = mmap(NULL, sizeof(*shared_num_clients), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (shm == MAP_FAILED) {
+            BLog(BLOG_ERROR, "mmap failed");
+            goto fail1;
+        }
+        shared_num_clients = (int *)shm;
+        *shared_num_clients = 0;
+        
+        int worker;
+        int res = spawn_workers(&worker);
+        if (!res || worker < 0) {
+            munmap(shm, sizeof(*shared_num_clients));
+            goto fail1;
+        }
+        
+        // workers bound to the same local port for the same remote address would
+        // steal each other's replies, so give each worker its own part of the range
+        if (options.local_udp_num_ports >= 0) {
+            worker_split_ports(worker, &local_udp_addr, &options.local_udp_num_ports);
+        }
+        if (options.local_udp_ip6_num_ports >= 0) {
+            worker_split_ports(worker, &local_udp_ip6_addr, &options.local_udp_ip6_num_ports);
+        }
+        
+        worker_index = worker;
+    }
+#endif
+    
+    // place the reactor thread, before it allocates anything
+    BThreadPlacement_Apply(&options.reactor_placement, worker_index, "reactor");
+    
     // init time
     BTime_Init();
     
-    // init DNS forwarding
+    // init DNS forwarding, to the configured server or the system's
     BAddr_InitNone(&dns_addr);
     last_dns_update_time = INT64_MIN;
     maybe_update_dns();
     
+    // init DNS cache
+    have_dns_cache = 0;
+    if (options.dns_cache_size > 0) {
+        if (!DnsCache_Init(&dns_cache, options.dns_cache_size, options.udp_mtu, dns_cache_handler_send, NULL)) {
+            BLog(BLOG_ERROR, "DnsCache_Init failed");
+            goto fail1;
+        }
+        BAVL_Init(&dns_connections_tree, OFFSET_DIFF(struct connection, dns_serial, dns_connections_tree_node), (BAVL_comparator)uint64_comparator, NULL);
+        next_dns_serial = 1;
+        have_dns_cache = 1;
+    }
+    
     // init reactor
     if (!BReactor_Init(&ss)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
-        goto fail1;
+        goto fail1a;
+    }
+    
+    // allocate buffers of the reactor's objects from an arena
+    if (options.buffer_arena) {
+        BArena_Init(&ss_arena, options.buffer_arena);
+        BPendingGroup_SetArena(BReactor_PendingGroup(&ss), &ss_arena);
     }
     
+    // bound how long jobs may run before timers and I/O get a turn
+    BReactor_SetJobBudget(&ss, options.reactor_job_budget_jobs, options.reactor_job_budget_us);
+    
+    // spin for events before sleeping, if asked to
+    BReactor_SetBusyPoll(&ss, options.reactor_busy_poll_spin_us, options.reactor_busy_poll_kernel_us);
+    
+    // register sockets edge-triggered, if asked to
+    BReactor_SetEdgeTriggered(&ss, options.reactor_edge_triggered);
+    
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
         goto fail2;
     }
     
+#ifndef BADVPN_USE_WINAPI
+    // enable reactor statistics, dumped on SIGUSR1
+    if (options.reactor_stats) {
+        if (!BReactor_EnableStats(&ss)) {
+            BLog(BLOG_ERROR, "BReactor_EnableStats failed");
+            goto fail2a;
+        }
+        
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGUSR1);
+        if (!BUnixSignal_Init(&stats_signal, &ss, sigs, stats_signal_handler, NULL)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            goto fail2a;
+        }
+    }
+#endif
+    
     // initialize listeners
     num_listeners = 0;
+    
+#ifndef BADVPN_USE_WINAPI
+    // take over the listeners of a running instance, which then stops
+    // accepting and drains its clients
+    int handoff_fds[BLISTENERHANDOFF_MAX_FDS];
+    int handoff_num_fds = 0;
+    if (options.handoff_socket) {
+        if (!BListenerHandoff_Receive(options.handoff_socket, handoff_fds, &handoff_num_fds)) {
+            BLog(BLOG_ERROR, "BListenerHandoff_Receive failed");
+            goto fail3;
+        }
+    }
+#endif
+    
     while (num_listeners < num_listen_addrs) {
-        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+        struct BLisCon_from from = BLisCon_from_addr(listen_addrs[num_listeners]);
+#ifndef BADVPN_USE_WINAPI
+        int fd = BListenerHandoff_TakeAddr(handoff_fds, &handoff_num_fds, listen_addrs[num_listeners]);
+        if (fd >= 0) {
+            from = BLisCon_from_fd(fd, NULL);
+        }
+#endif
+#ifdef BADVPN_LINUX
+        if (options.num_workers > 1) {
+            from = BLisCon_from_addr_reuseport(listen_addrs[num_listeners]);
+            if (options.steer_cpus) {
+                // workers bind in no particular order, so this only makes all
+                // connections arriving on one CPU go to the same worker
+                from = BLisCon_from_addr_reuseport_cpu(listen_addrs[num_listeners], options.num_workers);
+            }
+        }
+#endif
+        if (!BListener_InitFrom(&listeners[num_listeners], from, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
             BLog(BLOG_ERROR, "Listener_Init failed");
             goto fail3;
         }
         num_listeners++;
     }
     
+#ifndef BADVPN_USE_WINAPI
+    // initialize Unix socket listener; with multiple workers it is only served
+    // by the first one, since they would replace each other's socket file
+    if (options.listen_unix && worker_index == 0) {
+        struct BLisCon_from from = BLisCon_from_unix(options.listen_unix);
+        int fd = BListenerHandoff_TakeUnix(handoff_fds, &handoff_num_fds, options.listen_unix);
+        if (fd >= 0) {
+            from = BLisCon_from_fd(fd, options.listen_unix);
+        }
+        if (!BListener_InitFrom(&listeners[num_listeners], from, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "BListener_InitFrom failed");
+            goto fail3;
+        }
+        num_listeners++;
+    }
+    
+    // close sockets handed over which are no longer listened on
+    if (handoff_num_fds > 0) {
+        BLog(BLOG_WARNING, "closing %d handed over sockets not listened on", handoff_num_fds);
+        BListenerHandoff_CloseFds(handoff_fds, handoff_num_fds);
+        handoff_num_fds = 0;
+    }
+#endif
+    
+    // initialize datagram transport
+    have_udp_listener = 0;
+#ifndef BADVPN_USE_WINAPI
+    if (options.listen_udp_addr) {
+        if (!BRandom2_Init(&dgram_random, 0)) {
+            BLog(BLOG_ERROR, "BRandom2_Init failed");
+            goto fail3;
+        }
+        
+        BAVL_Init(&dgram_clients_tree, OFFSET_DIFF(struct client, dgram_token, dgram_tree_node), (BAVL_comparator)uint64_comparator, NULL);
+        
+        if (!udp_listener_init()) {
+            BRandom2_Free(&dgram_random);
+            goto fail3;
+        }
+    }
+#endif
+    
+    // init metrics
+    init_metrics();
+    
+    // init metrics exporter
+    have_metrics_exporter = (options.metrics_listen_addr || options.metrics_statsd_addr);
+    if (have_metrics_exporter) {
+        if (!BMetricsExporter_Init(&metrics_exporter, &ss, !!options.metrics_listen_addr, metrics_listen_addr,
+                                   !!options.metrics_statsd_addr, metrics_statsd_addr, options.metrics_statsd_interval)) {
+            BLog(BLOG_ERROR, "BMetricsExporter_Init failed");
+            goto fail3a;
+        }
+    }
+    
+#ifndef BADVPN_USE_WINAPI
+    // serve the handoff socket, for the next instance to take over
+    have_handoff = 0;
+    draining = 0;
+    BTimer_Init(&drain_timer, options.handoff_drain_timeout, drain_timer_handler, NULL);
+    if (options.handoff_socket) {
+        if (!BListenerHandoff_Init(&handoff, options.handoff_socket, &ss, NULL, handoff_handler)) {
+            BLog(BLOG_ERROR, "BListenerHandoff_Init failed");
+            goto fail3b;
+        }
+        have_handoff = 1;
+    }
+#endif
+    
     // init clients list
     LinkedList1_Init(&clients_list);
     num_clients = 0;
     
+    // init pools; connections may outlive their slot while closing, and a
+    // reload may raise the number of clients, so these are limited elsewhere
+    BArena *arena = BPendingGroup_Arena(BReactor_PendingGroup(&ss));
+    BObjectPool_InitArena(&clients_pool, sizeof(struct client), options.max_clients, -1, arena);
+    BObjectPool_InitArena(&connections_pool, sizeof(struct connection), CONNECTION_POOL_SLAB_SIZE, -1, arena);
+    BObjectPool_InitArena(&port_groups_pool, sizeof(struct port_group), PORT_GROUP_POOL_SLAB_SIZE, -1, arena);
+    
+    // init port groups tree
+    PortGroupsTree_Init(&port_groups_tree);
+    
+    // init memory accounting; besides the structures, a client has its receive,
+    // coalescing and batching buffers, and a connection its send buffers and
+    // receive buffers
+    client_memory_size = sizeof(struct client) + CLIENT_RECV_BUFFER_SIZE + CLIENT_SEND_COALESCE_SIZE + UDPGW_BATCH_MTU;
+    connection_memory_size = sizeof(struct connection) + (size_t)CONNECTION_CLIENT_BUFFER_SIZE * pp_mtu +
+                             (size_t)(CONNECTION_UDP_BUFFER_SIZE + 1) * options.udp_mtu +
+                             (options.udp_recv_batch > 1 ? (size_t)options.udp_recv_batch * options.udp_mtu : 0);
+    MemPressure_Init(&memory_pressure, options.memory_limit);
+    BTimer_Init(&memory_pressure_timer, MEMORY_PRESSURE_INTERVAL, memory_pressure_timer_handler, NULL);
+    if (options.memory_limit > 0) {
+        BReactor_SetTimer(&ss, &memory_pressure_timer);
+    }
+    
+    // init idle expiry
+    idle_timeouts[IDLE_CLASS_OTHER] = options.idle_timeout;
+    idle_timeouts[IDLE_CLASS_DNS] = options.dns_idle_timeout;
+    BTimer_Init(&idle_timer, CONNECTION_IDLE_REAP_INTERVAL, idle_timer_handler, NULL);
+    if (options.idle_timeout > 0 || options.dns_idle_timeout > 0) {
+        BReactor_SetTimer(&ss, &idle_timer);
+    }
+    
+    // reload the configuration on SIGHUP, instead of terminating
+    BSignal_SetHangupHandler(reload_handler, NULL);
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+#ifndef BADVPN_USE_WINAPI
+    // freeing the clients below is not the end of draining
+    draining = 0;
+#endif
+    
+    // free idle expiry
+    BReactor_RemoveTimer(&ss, &idle_timer);
+    
+    // free memory accounting
+    BReactor_RemoveTimer(&ss, &memory_pressure_timer);
+    
     // free clients
     while (!LinkedList1_IsEmpty(&clients_list)) {
         struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
         client_free(client);
     }
+    
+    // free pools
+    BLog(BLOG_NOTICE, "peak usage: %d clients, %d connections",
+         BObjectPool_MaxUsed(&clients_pool), BObjectPool_MaxUsed(&connections_pool));
+    ASSERT(PortGroupsTree_IsEmpty(&port_groups_tree))
+    BObjectPool_Free(&port_groups_pool);
+    BObjectPool_Free(&connections_pool);
+    BObjectPool_Free(&clients_pool);
+    
+#ifndef BADVPN_USE_WINAPI
+    // free handoff
+    BReactor_RemoveTimer(&ss, &drain_timer);
+    if (have_handoff) {
+        BListenerHandoff_Free(&handoff);
+    }
+fail3b:
+#endif
+    // free metrics exporter
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+    }
+fail3a:
+    // free metrics
+    free_metrics();
+#ifndef BADVPN_USE_WINAPI
+    // free datagram transport
+    if (options.listen_udp_addr) {
+        if (have_udp_listener) {
+            udp_listener_free();
+        }
+        BRandom2_Free(&dgram_random);
+    }
+#endif
 fail3:
     // free listeners
     while (num_listeners > 0) {
         num_listeners--;
         BListener_Free(&listeners[num_listeners]);
     }
+#ifndef BADVPN_USE_WINAPI
+    // close handed over sockets, if failed before listening on them
+    BListenerHandoff_CloseFds(handoff_fds, handoff_num_fds);
+    // log and free reactor statistics signal
+    if (options.reactor_stats) {
+        BReactor_LogStats(&ss, BLOG_NOTICE, 0);
+        BUnixSignal_Free(&stats_signal, 0);
+    }
+fail2a:
+#endif
     // finish signal handling
     BSignal_Finish();
 fail2:
+    // free arena
+    if (options.buffer_arena) {
+        BArena_Free(&ss_arena);
+    }
+    
     // free reactor
     BReactor_Free(&ss);
+fail1a:
+    // free DNS cache
+    if (have_dns_cache) {
+        DnsCache_Free(&dns_cache);
+    }
 fail1:
     // free logger
     BLog(BLOG_NOTICE, "exiting");
@@ -360,14 +983,48 @@ void print_help (const char *name)
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--listen-addr <addr>] ...\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--listen-unix <socket path>]\n"
+        "        [--listen-udp-addr <addr>]\n"
+        "        [--handoff-socket <socket path> [--handoff-drain-timeout <ms / 0>]]\n"
+        #endif
         "        [--udp-mtu <bytes>]\n"
+        "        [--udp-recv-batch <datagrams>]\n"
+        "        [--udp-connect]\n"
+        "        [--icmp-echo]\n"
         "        [--max-clients <number>]\n"
         "        [--max-connections-for-client <number>]\n"
+        "        [--memory-limit <bytes>]\n"
+        "        [--idle-timeout <ms / 0>]\n"
+        "        [--dns-idle-timeout <ms / 0>]\n"
+        "        [--buffer-arena <normal/thp/hugetlb>]\n"
+        "        [--reactor-cpus <cpu list>]\n"
+        "        [--reactor-sched <nice:N / fifo:P>]\n"
+        "        [--avoid-irq-cpus <ifname>]\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
+        "        [--client-rate <bytes per second / 0> [--client-burst <bytes>]]\n"
+        "        [--client-weight <addr>[/<prefix>] <weight>] ...\n"
+        "        [--client-metrics]\n"
         "        [--local-udp-addrs <addr> <num_ports>]\n"
         "        [--local-udp-ip6-addrs <addr> <num_ports>]\n"
         "        [--unique-local-ports]\n"
-        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        "        [--dns-cache-size <entries>]\n"
+        "        [--dns-server-addr <addr>]\n"
+        "        [--config-file <file>]\n"
+        #ifdef BADVPN_LINUX
+        "        [--num-workers <number>]\n"
+        "        [--steer-cpus]\n"
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        "        [--reactor-stats]\n"
+        #endif
+        "        [--reactor-job-budget <jobs / 0> <microseconds / 0>]\n"
+        "        [--reactor-busy-poll <spin microseconds / 0> <kernel microseconds / 0>]\n"
+        "        [--reactor-edge-triggered]\n"
+        "        [--metrics-listen-addr <addr>]\n"
+        "        [--metrics-statsd-addr <addr> [--metrics-statsd-interval <ms>]]\n"
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n"
+        "SIGHUP reloads the configuration file and the system's name server for new clients and connections.\n",
         name
     );
 }
@@ -395,13 +1052,55 @@ int parse_arguments (int argc, char *argv[])
         options.loglevels[i] = -1;
     }
     options.num_listen_addrs = 0;
+    #ifndef BADVPN_USE_WINAPI
+    options.listen_unix = NULL;
+    options.listen_udp_addr = NULL;
+    options.handoff_socket = NULL;
+    options.handoff_drain_timeout = DEFAULT_HANDOFF_DRAIN_TIMEOUT;
+    #endif
     options.udp_mtu = DEFAULT_UDP_MTU;
+    options.udp_recv_batch = 1;
+    options.udp_connect = 0;
+    options.icmp_echo = 0;
     options.max_clients = DEFAULT_MAX_CLIENTS;
     options.max_connections_for_client = DEFAULT_MAX_CONNECTIONS_FOR_CLIENT;
+    options.memory_limit = 0;
+    options.idle_timeout = DEFAULT_CONNECTION_IDLE_TIMEOUT;
+    options.dns_idle_timeout = DEFAULT_DNS_CONNECTION_IDLE_TIMEOUT;
+    options.buffer_arena = 0;
+    BThreadPlacement_Init(&options.reactor_placement);
+    options.avoid_irq_cpus = NULL;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SEND_BUFFER;
+    options.client_rate = 0;
+    options.client_burst = 0;
+    options.num_client_weights = 0;
+    options.client_metrics = 0;
     options.local_udp_num_ports = -1;
     options.local_udp_ip6_num_ports = -1;
     options.unique_local_ports = 0;
+    options.dns_cache_size = 0;
+    options.dns_server_addr = NULL;
+    options.config_file = NULL;
+    #ifdef BADVPN_LINUX
+    options.num_workers = 1;
+    options.steer_cpus = 0;
+    #endif
+    #ifndef BADVPN_USE_WINAPI
+    options.reactor_stats = 0;
+    #endif
+    options.reactor_job_budget_jobs = 0;
+    options.reactor_job_budget_us = 0;
+    options.reactor_busy_poll_spin_us = 0;
+    options.reactor_busy_poll_kernel_us = 0;
+    options.reactor_edge_triggered = 0;
+    options.metrics_listen_addr = NULL;
+    options.metrics_statsd_addr = NULL;
+    options.metrics_statsd_interval = BMETRICSEXPORTER_DEFAULT_STATSD_INTERVAL;
+    
+    int have_metrics_statsd_interval = 0;
+    #ifndef BADVPN_USE_WINAPI
+    int have_handoff_drain_timeout = 0;
+    #endif
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -492,6 +1191,44 @@ int parse_arguments (int argc, char *argv[])
             options.num_listen_addrs++;
             i++;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--listen-unix")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.listen_unix = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--listen-udp-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.listen_udp_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--handoff-socket")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.handoff_socket = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--handoff-drain-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.handoff_drain_timeout = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_handoff_drain_timeout = 1;
+            i++;
+        }
+        #endif
         else if (!strcmp(arg, "--udp-mtu")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -503,6 +1240,23 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--udp-recv-batch")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_recv_batch = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udp-connect")) {
+            options.udp_connect = 1;
+        }
+        else if (!strcmp(arg, "--icmp-echo")) {
+            options.icmp_echo = 1;
+        }
         else if (!strcmp(arg, "--max-clients")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -525,59 +1279,363 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
-        else if (!strcmp(arg, "--client-socket-sndbuf")) {
+        else if (!strcmp(arg, "--memory-limit")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.client_socket_sndbuf = atoi(argv[i + 1])) < 0) {
+            uintmax_t limit;
+            if (!parse_unsigned_integer(MemRef_MakeCstr(argv[i + 1]), &limit) || limit == 0 || limit > SIZE_MAX) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
+            options.memory_limit = limit;
             i++;
         }
-        else if (!strcmp(arg, "--local-udp-addrs")) {
-            if (2 >= argc - i) {
-                fprintf(stderr, "%s: requires two arguments\n", arg);
+        else if (!strcmp(arg, "--idle-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            options.local_udp_addr = argv[i + 1];
-            if ((options.local_udp_num_ports = atoi(argv[i + 2])) < 0) {
+            if ((options.idle_timeout = atoi(argv[i + 1])) < 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
-            i += 2;
+            i++;
         }
-        else if (!strcmp(arg, "--local-udp-ip6-addrs")) {
-            if (2 >= argc - i) {
-                fprintf(stderr, "%s: requires two arguments\n", arg);
+        else if (!strcmp(arg, "--dns-idle-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            options.local_udp_ip6_addr = argv[i + 1];
-            if ((options.local_udp_ip6_num_ports = atoi(argv[i + 2])) < 0) {
+            if ((options.dns_idle_timeout = atoi(argv[i + 1])) < 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
-            i += 2;
+            i++;
         }
-        else if (!strcmp(arg, "--unique-local-ports")) {
-            options.unique_local_ports = 1;
+        else if (!strcmp(arg, "--buffer-arena")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BArena_ParsePages(argv[i + 1], &options.buffer_arena)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-        else {
-            fprintf(stderr, "unknown option: %s\n", arg);
-            return 0;
+        else if (!strcmp(arg, "--reactor-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BThreadPlacement_ParseCpus(&options.reactor_placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-    }
-    
-    if (options.help || options.version) {
-        return 1;
-    }
-    
-    return 1;
-}
-
+        else if (!strcmp(arg, "--reactor-sched")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BThreadPlacement_ParseSched(&options.reactor_placement, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--avoid-irq-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.avoid_irq_cpus = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--client-socket-sndbuf")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_socket_sndbuf = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_rate = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-burst")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_burst = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-weight")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if (options.num_client_weights == MAX_CLIENT_WEIGHTS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            int weight = atoi(argv[i + 2]);
+            if (weight <= 0 || weight > MAX_CLIENT_WEIGHT) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.client_weight_addrs[options.num_client_weights] = argv[i + 1];
+            options.client_weights[options.num_client_weights] = weight;
+            options.num_client_weights++;
+            i += 2;
+        }
+        else if (!strcmp(arg, "--client-metrics")) {
+            options.client_metrics = 1;
+        }
+        else if (!strcmp(arg, "--local-udp-addrs")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            options.local_udp_addr = argv[i + 1];
+            if ((options.local_udp_num_ports = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--local-udp-ip6-addrs")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            options.local_udp_ip6_addr = argv[i + 1];
+            if ((options.local_udp_ip6_num_ports = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--unique-local-ports")) {
+            options.unique_local_ports = 1;
+        }
+        else if (!strcmp(arg, "--dns-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.dns_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--dns-server-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.dns_server_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--config-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.config_file = argv[i + 1];
+            i++;
+        }
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--num-workers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.num_workers = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--steer-cpus")) {
+            options.steer_cpus = 1;
+        }
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--reactor-stats")) {
+            options.reactor_stats = 1;
+        }
+        #endif
+        else if (!strcmp(arg, "--reactor-job-budget")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_job_budget_jobs = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_job_budget_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-busy-poll")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_spin_us = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_busy_poll_kernel_us = atoi(argv[i + 2])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--reactor-edge-triggered")) {
+            options.reactor_edge_triggered = 1;
+        }
+        else if (!strcmp(arg, "--metrics-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.metrics_statsd_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--metrics-statsd-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.metrics_statsd_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_metrics_statsd_interval = 1;
+            i++;
+        }
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    if (have_metrics_statsd_interval && !options.metrics_statsd_addr) {
+        fprintf(stderr, "--metrics-statsd-interval requires --metrics-statsd-addr\n");
+        return 0;
+    }
+    
+    if (options.client_burst > 0 && options.client_rate == 0) {
+        fprintf(stderr, "--client-burst requires --client-rate\n");
+        return 0;
+    }
+    
+    if (options.client_metrics && !options.metrics_listen_addr && !options.metrics_statsd_addr) {
+        fprintf(stderr, "--client-metrics requires --metrics-listen-addr or --metrics-statsd-addr\n");
+        return 0;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // the datagram transport has no backpressure to limit a client with
+    if (options.client_rate > 0 && options.listen_udp_addr) {
+        fprintf(stderr, "--client-rate cannot be used with --listen-udp-addr\n");
+        return 0;
+    }
+    #endif
+    
+    #ifdef BADVPN_LINUX
+    // workers would compete for the metrics address, and each has its own counters
+    if (options.num_workers > 1 && (options.metrics_listen_addr || options.metrics_statsd_addr)) {
+        fprintf(stderr, "exporting metrics requires --num-workers 1\n");
+        return 0;
+    }
+    
+    if (options.steer_cpus && options.num_workers <= 1) {
+        fprintf(stderr, "--steer-cpus requires --num-workers\n");
+        return 0;
+    }
+    
+    // a datagram could arrive at a worker other than the one with its client
+    if (options.num_workers > 1 && options.listen_udp_addr) {
+        fprintf(stderr, "--listen-udp-addr requires --num-workers 1\n");
+        return 0;
+    }
+    
+    // the workers' listeners are bound separately, and only one could take over
+    if (options.num_workers > 1 && options.handoff_socket) {
+        fprintf(stderr, "--handoff-socket requires --num-workers 1\n");
+        return 0;
+    }
+    #endif
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (have_handoff_drain_timeout && !options.handoff_socket) {
+        fprintf(stderr, "--handoff-drain-timeout requires --handoff-socket\n");
+        return 0;
+    }
+    #endif
+    
+    return 1;
+}
+
 int process_arguments (void)
 {
+    // resolve DNS server address
+    BAddr_InitNone(&dns_server_addr);
+    if (options.dns_server_addr) {
+        if (!BAddr_Parse(&dns_server_addr, options.dns_server_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "dns server addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    
+    // remember the reloadable settings from the command line, and replace
+    // them with those in the configuration file
+    reload_settings_get(&cmdline_settings);
+    if (options.config_file) {
+        struct reload_settings rs = cmdline_settings;
+        if (!config_file_load(&rs)) {
+            return 0;
+        }
+        reload_settings_set(&rs);
+    }
+    
     // resolve listen addresses
     num_listen_addrs = 0;
     while (num_listen_addrs < options.num_listen_addrs) {
@@ -585,62 +1643,607 @@ int process_arguments (void)
             BLog(BLOG_ERROR, "listen addr: BAddr_Parse failed");
             return 0;
         }
-        num_listen_addrs++;
+        num_listen_addrs++;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // resolve datagram transport address
+    if (options.listen_udp_addr) {
+        if (!BAddr_Parse(&udp_listener_addr, options.listen_udp_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "listen UDP addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    #endif
+    
+    // parse client weights
+    for (num_client_weights = 0; num_client_weights < options.num_client_weights; num_client_weights++) {
+        struct client_weight *cw = &client_weights[num_client_weights];
+        MemRef str = MemRef_MakeCstr(options.client_weight_addrs[num_client_weights]);
+        size_t slash_pos;
+        int has_prefix = MemRef_FindChar(str, '/', &slash_pos);
+        if (has_prefix ? ipaddr_parse_ipv4_ifaddr(str, &cw->ipv4) : ipaddr_parse_ipv4_addr(str, &cw->ipv4.addr)) {
+            cw->type = BADDR_TYPE_IPV4;
+            if (!has_prefix) {
+                cw->ipv4.prefix = 32;
+            }
+        }
+        else if (has_prefix ? ipaddr6_parse_ipv6_ifaddr(str, &cw->ipv6) : ipaddr6_parse_ipv6_addr(str, &cw->ipv6.addr)) {
+            cw->type = BADDR_TYPE_IPV6;
+            if (!has_prefix) {
+                cw->ipv6.prefix = 128;
+            }
+        }
+        else {
+            BLog(BLOG_ERROR, "client weight: wrong address");
+            return 0;
+        }
+        cw->weight = options.client_weights[num_client_weights];
+    }
+    
+    // resolve local UDP address
+    if (options.local_udp_num_ports >= 0) {
+        if (!BAddr_Parse(&local_udp_addr, options.local_udp_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "local udp addr: BAddr_Parse failed");
+            return 0;
+        }
+        if (local_udp_addr.type != BADDR_TYPE_IPV4) {
+            BLog(BLOG_ERROR, "local udp addr: must be an IPv4 address");
+            return 0;
+        }
+    }
+    
+    // resolve local UDP/IPv6 address
+    if (options.local_udp_ip6_num_ports >= 0) {
+        if (!BAddr_Parse(&local_udp_ip6_addr, options.local_udp_ip6_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "local udp ip6 addr: BAddr_Parse failed");
+            return 0;
+        }
+        if (local_udp_ip6_addr.type != BADDR_TYPE_IPV6) {
+            BLog(BLOG_ERROR, "local udp ip6 addr: must be an IPv6 address");
+            return 0;
+        }
+    }
+    
+    // resolve metrics addresses
+    if (options.metrics_listen_addr) {
+        if (!BAddr_Parse(&metrics_listen_addr, options.metrics_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics listen addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    if (options.metrics_statsd_addr) {
+        if (!BAddr_Parse(&metrics_statsd_addr, options.metrics_statsd_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "metrics statsd addr: BAddr_Parse failed");
+            return 0;
+        }
+    }
+    
+    // keep the reactor off the CPUs handling the network interrupts
+    if (options.avoid_irq_cpus) {
+        if (!BThreadPlacement_AvoidIrqCpus(&options.reactor_placement, options.avoid_irq_cpus)) {
+            BLog(BLOG_ERROR, "avoid IRQ CPUs: BThreadPlacement_AvoidIrqCpus failed");
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+#ifdef BADVPN_LINUX
+
+int spawn_workers (int *out_worker)
+{
+    ASSERT(options.num_workers > 1)
+    
+    // Block the signals we care about so that we can wait for them
+    // synchronously, and so that children don't receive them before
+    // they've installed their own handler.
+    sigset_t sset;
+    sigemptyset(&sset);
+    sigaddset(&sset, SIGINT);
+    sigaddset(&sset, SIGTERM);
+    sigaddset(&sset, SIGCHLD);
+    sigaddset(&sset, SIGHUP);
+    sigset_t sset_old;
+    if (sigprocmask(SIG_BLOCK, &sset, &sset_old) < 0) {
+        BLog(BLOG_ERROR, "sigprocmask failed");
+        return 0;
+    }
+    
+    pid_t *pids = (pid_t *)BAllocArray(options.num_workers, sizeof(pids[0]));
+    if (!pids) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    int num_running = 0;
+    int stopping = 0;
+    int signalled = 0;
+    
+    // don't let the workers inherit and repeat buffered log output
+    fflush(NULL);
+    
+    for (int i = 0; i < options.num_workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            BLog(BLOG_ERROR, "fork failed");
+            stopping = 1;
+            break;
+        }
+        
+        if (pid == 0) {
+            // this is a worker; move it out of our process group so that terminal
+            // signals only reach the supervisor, which forwards them exactly once
+            setpgid(0, 0);
+            BFree(pids);
+            sigprocmask(SIG_SETMASK, &sset_old, NULL);
+            BLog(BLOG_NOTICE, "worker %d started", i);
+            *out_worker = i;
+            return 1;
+        }
+        
+        pids[num_running++] = pid;
+    }
+    
+    if (!stopping) {
+        BLog(BLOG_NOTICE, "started %d workers", num_running);
+    }
+    
+    while (num_running > 0) {
+        if (stopping && !signalled) {
+            for (int i = 0; i < num_running; i++) {
+                kill(pids[i], SIGTERM);
+            }
+            signalled = 1;
+        }
+        
+        int signo;
+        if (sigwait(&sset, &signo) != 0) {
+            BLog(BLOG_ERROR, "sigwait failed");
+            continue;
+        }
+        
+        if (signo == SIGINT || signo == SIGTERM) {
+            if (!stopping) {
+                BLog(BLOG_NOTICE, "termination requested");
+                stopping = 1;
+            }
+            continue;
+        }
+        
+        // have every worker reload its configuration
+        if (signo == SIGHUP) {
+            for (int i = 0; i < num_running; i++) {
+                kill(pids[i], SIGHUP);
+            }
+            continue;
+        }
+        
+        // reap exited workers
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < num_running; i++) {
+                if (pids[i] == pid) {
+                    pids[i] = pids[--num_running];
+                    break;
+                }
+            }
+            
+            // a worker exiting on its own brings down the whole gateway
+            if (!stopping) {
+                BLog(BLOG_ERROR, "worker %"PRIiMAX" exited unexpectedly", (intmax_t)pid);
+                stopping = 1;
+            }
+        }
+    }
+    
+    BFree(pids);
+    sigprocmask(SIG_SETMASK, &sset_old, NULL);
+    *out_worker = -1;
+    return 1;
+    
+fail0:
+    sigprocmask(SIG_SETMASK, &sset_old, NULL);
+    return 0;
+}
+
+void worker_split_ports (int worker, BAddr *addr, int *num_ports)
+{
+    ASSERT(worker >= 0)
+    ASSERT(worker < options.num_workers)
+    ASSERT(*num_ports >= 0)
+    
+    int start = (int)((int64_t)*num_ports * worker / options.num_workers);
+    int end = (int)((int64_t)*num_ports * (worker + 1) / options.num_workers);
+    
+    BAddr_SetPort(addr, hton16(ntoh16(BAddr_GetPort(addr)) + (uint16_t)start));
+    *num_ports = end - start;
+    
+    if (*num_ports == 0) {
+        BLog(BLOG_WARNING, "no local UDP ports left for this worker");
+    }
+}
+
+#endif
+
+int clients_limit_reserve (void)
+{
+#ifdef BADVPN_LINUX
+    if (shared_num_clients) {
+        if (__sync_add_and_fetch(shared_num_clients, 1) > options.max_clients) {
+            __sync_sub_and_fetch(shared_num_clients, 1);
+            return 0;
+        }
+        return 1;
+    }
+#endif
+    
+    return (num_clients < options.max_clients);
+}
+
+void clients_limit_release (void)
+{
+#ifdef BADVPN_LINUX
+    if (shared_num_clients) {
+        __sync_sub_and_fetch(shared_num_clients, 1);
+    }
+#endif
+}
+
+void signal_handler (void *unused)
+{
+    BLog(BLOG_NOTICE, "termination requested");
+    
+    // exit event loop
+    BReactor_Quit(&ss, 1);
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void stats_signal_handler (void *unused, int signo)
+{
+    ASSERT(options.reactor_stats)
+    
+    BReactor_LogStats(&ss, BLOG_NOTICE, 1);
+}
+
+#endif
+
+void reload_settings_get (struct reload_settings *rs)
+{
+    rs->max_clients = options.max_clients;
+    rs->max_connections_for_client = options.max_connections_for_client;
+    rs->client_rate = options.client_rate;
+    rs->client_burst = options.client_burst;
+    rs->dns_server_addr = dns_server_addr;
+}
+
+void reload_settings_set (const struct reload_settings *rs)
+{
+    options.max_clients = rs->max_clients;
+    options.max_connections_for_client = rs->max_connections_for_client;
+    options.client_rate = rs->client_rate;
+    options.client_burst = rs->client_burst;
+    dns_server_addr = rs->dns_server_addr;
+}
+
+int config_next_word (MemRef *line, MemRef *out_word)
+{
+    size_t pos = 0;
+    while (pos < line->len && (line->ptr[pos] == ' ' || line->ptr[pos] == '\t' || line->ptr[pos] == '\r')) {
+        pos++;
+    }
+    
+    size_t end = pos;
+    while (end < line->len && !(line->ptr[end] == ' ' || line->ptr[end] == '\t' || line->ptr[end] == '\r')) {
+        end++;
+    }
+    
+    if (end == pos) {
+        return 0;
+    }
+    
+    *out_word = MemRef_Sub(*line, pos, end - pos);
+    *line = MemRef_SubFrom(*line, end);
+    return 1;
+}
+
+int config_file_load (struct reload_settings *rs)
+{
+    ASSERT(options.config_file)
+    
+    // read file
+    uint8_t *data;
+    size_t len;
+    if (!read_file(options.config_file, &data, &len)) {
+        BLog(BLOG_ERROR, "config file: failed to read %s", options.config_file);
+        goto fail0;
+    }
+    
+    // each line is an option name without the dashes and its argument
+    MemRef rest = MemRef_Make((char *)data, len);
+    int line_num = 0;
+    while (rest.len > 0) {
+        line_num++;
+        
+        size_t line_len;
+        if (!MemRef_FindChar(rest, '\n', &line_len)) {
+            line_len = rest.len;
+        }
+        MemRef line = MemRef_SubTo(rest, line_len);
+        rest = MemRef_SubFrom(rest, bmin_size(line_len + 1, rest.len));
+        
+        // strip comment
+        size_t comment_pos;
+        if (MemRef_FindChar(line, '#', &comment_pos)) {
+            line = MemRef_SubTo(line, comment_pos);
+        }
+        
+        // skip empty lines
+        MemRef name;
+        if (!config_next_word(&line, &name)) {
+            continue;
+        }
+        
+        MemRef arg;
+        MemRef extra;
+        if (!config_next_word(&line, &arg) || config_next_word(&line, &extra)) {
+            BLog(BLOG_ERROR, "config file: line %d: expected an option and one argument", line_num);
+            goto fail1;
+        }
+        
+        if (MemRef_Equal(name, MemRef_MakeCstr("dns-server-addr"))) {
+            char *addr_str = MemRef_StrDup(arg);
+            if (!addr_str) {
+                BLog(BLOG_ERROR, "config file: MemRef_StrDup failed");
+                goto fail1;
+            }
+            int res = BAddr_Parse(&rs->dns_server_addr, addr_str, NULL, 0);
+            free(addr_str);
+            if (!res) {
+                BLog(BLOG_ERROR, "config file: line %d: bad address", line_num);
+                goto fail1;
+            }
+            continue;
+        }
+        
+        uintmax_t value;
+        if (!parse_unsigned_integer(arg, &value) || value > INT_MAX) {
+            BLog(BLOG_ERROR, "config file: line %d: bad number", line_num);
+            goto fail1;
+        }
+        
+        if (MemRef_Equal(name, MemRef_MakeCstr("max-clients")) && value > 0) {
+            rs->max_clients = value;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("max-connections-for-client")) && value > 0) {
+            rs->max_connections_for_client = value;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("client-rate"))) {
+            rs->client_rate = value;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("client-burst")) && value > 0) {
+            rs->client_burst = value;
+        }
+        else {
+            BLog(BLOG_ERROR, "config file: line %d: unknown option or wrong argument", line_num);
+            goto fail1;
+        }
+    }
+    
+    if (rs->client_burst > 0 && rs->client_rate == 0) {
+        BLog(BLOG_ERROR, "config file: client-burst requires client-rate");
+        goto fail1;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (rs->client_rate > 0 && options.listen_udp_addr) {
+        BLog(BLOG_ERROR, "config file: client-rate cannot be used with --listen-udp-addr");
+        goto fail1;
+    }
+    #endif
+    
+    free(data);
+    return 1;
+    
+fail1:
+    free(data);
+fail0:
+    return 0;
+}
+
+void reload_handler (void *unused)
+{
+    BLog(BLOG_NOTICE, "reloading configuration");
+    
+    // read the configuration file again, starting from the command line
+    if (options.config_file) {
+        struct reload_settings rs = cmdline_settings;
+        if (!config_file_load(&rs)) {
+            BLog(BLOG_ERROR, "keeping the old configuration");
+            return;
+        }
+        reload_settings_set(&rs);
     }
     
-    // resolve local UDP address
-    if (options.local_udp_num_ports >= 0) {
-        if (!BAddr_Parse(&local_udp_addr, options.local_udp_addr, NULL, 0)) {
-            BLog(BLOG_ERROR, "local udp addr: BAddr_Parse failed");
-            return 0;
-        }
-        if (local_udp_addr.type != BADDR_TYPE_IPV4) {
-            BLog(BLOG_ERROR, "local udp addr: must be an IPv4 address");
-            return 0;
-        }
+    // look up the DNS server again for the next DNS connection; connections
+    // keep the address they were opened to
+    last_dns_update_time = INT64_MIN;
+    
+    BLog(BLOG_NOTICE, "configuration reloaded");
+}
+
+void init_metrics (void)
+{
+    BMetric_InitGaugeFunc(&metric_clients, "badvpn_udpgw_clients", NULL, "Connected clients.", metric_clients_func, NULL);
+    BMetric_InitGaugeFunc(&metric_connections, "badvpn_udpgw_connections", NULL, "UDP connections, including closing ones.", metric_connections_func, NULL);
+    BMetric_InitCounter(&metric_packets_to_udp, "badvpn_udpgw_packets_total", "direction=\"to_udp\"", "Packets forwarded.");
+    BMetric_InitCounter(&metric_packets_to_client, "badvpn_udpgw_packets_total", "direction=\"to_client\"", "Packets forwarded.");
+    BMetric_InitCounter(&metric_bytes_to_udp, "badvpn_udpgw_bytes_total", "direction=\"to_udp\"", "Payload bytes forwarded.");
+    BMetric_InitCounter(&metric_bytes_to_client, "badvpn_udpgw_bytes_total", "direction=\"to_client\"", "Payload bytes forwarded.");
+    BMetric_InitCounter(&metric_drops_udp_buffer, "badvpn_udpgw_dropped_packets_total", "reason=\"udp_buffer_full\"", "Packets dropped.");
+    BMetric_InitCounter(&metric_drops_client_buffer, "badvpn_udpgw_dropped_packets_total", "reason=\"client_buffer_full\"", "Packets dropped.");
+    BMetric_InitCounter(&metric_drops_too_large, "badvpn_udpgw_dropped_packets_total", "reason=\"too_large\"", "Packets dropped.");
+    BMetric_InitCounter(&metric_dns_cache_answers, "badvpn_udpgw_dns_cache_answers_total", NULL, "DNS queries answered from the cache or by a pending identical query.");
+    BMetric_InitCounter(&metric_idle_closed, "badvpn_udpgw_idle_closed_connections_total", NULL, "Connections closed after being idle.");
+}
+
+void free_metrics (void)
+{
+    BMetric_Free(&metric_idle_closed);
+    BMetric_Free(&metric_dns_cache_answers);
+    BMetric_Free(&metric_drops_too_large);
+    BMetric_Free(&metric_drops_client_buffer);
+    BMetric_Free(&metric_drops_udp_buffer);
+    BMetric_Free(&metric_bytes_to_client);
+    BMetric_Free(&metric_bytes_to_udp);
+    BMetric_Free(&metric_packets_to_client);
+    BMetric_Free(&metric_packets_to_udp);
+    BMetric_Free(&metric_connections);
+    BMetric_Free(&metric_clients);
+}
+
+int64_t metric_clients_func (void *unused)
+{
+    return num_clients;
+}
+
+int64_t metric_connections_func (void *unused)
+{
+    return BObjectPool_NumUsed(&connections_pool);
+}
+
+int memory_pressure_update (int may_fall)
+{
+    if (options.memory_limit == 0) {
+        return MEMPRESSURE_LEVEL_NONE;
     }
     
-    // resolve local UDP/IPv6 address
-    if (options.local_udp_ip6_num_ports >= 0) {
-        if (!BAddr_Parse(&local_udp_ip6_addr, options.local_udp_ip6_addr, NULL, 0)) {
-            BLog(BLOG_ERROR, "local udp ip6 addr: BAddr_Parse failed");
-            return 0;
+    // closing connections still hold their buffers to the client
+    size_t used = num_clients * client_memory_size + BObjectPool_NumUsed(&connections_pool) * connection_memory_size;
+    
+    int old_level = MemPressure_Level(&memory_pressure);
+    
+    if (MemPressure_Update(&memory_pressure, used, may_fall)) {
+        int level = MemPressure_Level(&memory_pressure);
+        BLog((level > old_level ? BLOG_WARNING : BLOG_NOTICE), "memory pressure %s -> %s (%zu of %zu bytes)",
+             MemPressure_LevelName(old_level), MemPressure_LevelName(level), used, memory_pressure.limit);
+    }
+    
+    return MemPressure_Level(&memory_pressure);
+}
+
+int memory_pressure_level (void)
+{
+    // the level only drops from the timer, so that it does not follow every burst
+    return memory_pressure_update(0);
+}
+
+void memory_pressure_timer_handler (void *unused)
+{
+    ASSERT(options.memory_limit > 0)
+    
+    // schedule next timer
+    BReactor_SetTimer(&ss, &memory_pressure_timer);
+    
+    // let the level drop if usage stayed down
+    memory_pressure_update(1);
+    
+    btime_t now = BReactor_GetTime(&ss);
+    
+    // evict the least recently used connection of each client in turn, until
+    // the pressure drops out of the eviction level; connections used recently
+    // or with packets on their way to the client are left alone
+    int evicted = 0;
+    while (memory_pressure_level() == MEMPRESSURE_LEVEL_EVICT) {
+        int num = 0;
+        for (LinkedList1Node *node = LinkedList1_GetFirst(&clients_list); node; node = LinkedList1Node_Next(node)) {
+            struct client *client = UPPER_OBJECT(node, struct client, clients_list_node);
+            LinkedList1Node *con_node = LinkedList1_GetFirst(&client->connections_list);
+            if (!con_node) {
+                continue;
+            }
+            struct connection *con = UPPER_OBJECT(con_node, struct connection, connections_list_node);
+            if (now - con->last_used < MEMORY_EVICT_IDLE_TIME ||
+                BPending_IsSet(&con->first_job) || PacketPassFairQueueFlow_IsBusy(&con->send_qflow)
+            ) {
+                continue;
+            }
+            connection_log(con, BLOG_DEBUG, "evicting under memory pressure");
+            connection_close(con);
+            num++;
         }
-        if (local_udp_ip6_addr.type != BADDR_TYPE_IPV6) {
-            BLog(BLOG_ERROR, "local udp ip6 addr: must be an IPv6 address");
-            return 0;
+        if (num == 0) {
+            break;
         }
+        evicted += num;
     }
     
-    return 1;
+    if (evicted > 0) {
+        BLog(BLOG_WARNING, "memory pressure: evicted %d idle connections", evicted);
+    }
 }
 
-void signal_handler (void *unused)
+void idle_timer_handler (void *unused)
 {
-    BLog(BLOG_NOTICE, "termination requested");
+    btime_t now = BReactor_GetTime(&ss);
+    
+    // close connections idle for longer than the timeout of their class; each
+    // class list is in order of use, so only expired ones are looked at
+    int num = 0;
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&clients_list); node && num < CONNECTION_IDLE_REAP_BATCH; node = LinkedList1Node_Next(node)) {
+        struct client *client = UPPER_OBJECT(node, struct client, clients_list_node);
+        for (int i = 0; i < NUM_IDLE_CLASSES; i++) {
+            if (idle_timeouts[i] <= 0) {
+                continue;
+            }
+            LinkedList1Node *con_node;
+            while (num < CONNECTION_IDLE_REAP_BATCH && (con_node = LinkedList1_GetFirst(&client->idle_lists[i]))) {
+                struct connection *con = UPPER_OBJECT(con_node, struct connection, idle_list_node);
+                if (now - con->last_used < idle_timeouts[i]) {
+                    break;
+                }
+                connection_log(con, BLOG_DEBUG, "closing idle connection");
+                connection_close(con);
+                num++;
+            }
+        }
+    }
     
-    // exit event loop
-    BReactor_Quit(&ss, 1);
+    BMetric_Add(&metric_idle_closed, num);
+    
+    // if the batch was used up, continue once other events have been handled
+    BReactor_SetTimerAfter(&ss, &idle_timer, (num == CONNECTION_IDLE_REAP_BATCH ? 0 : CONNECTION_IDLE_REAP_INTERVAL));
 }
 
 void listener_handler (BListener *listener)
 {
-    if (num_clients == options.max_clients) {
+    // under memory pressure, let the connection be discarded, rather than run
+    // out of memory serving it
+    if (memory_pressure_level() >= MEMPRESSURE_LEVEL_NO_ADMIT) {
+        BLog(BLOG_WARNING, "refusing client under memory pressure");
+        return;
+    }
+    
+    // reserve a client slot
+    if (!clients_limit_reserve()) {
         BLog(BLOG_ERROR, "maximum number of clients reached");
         goto fail0;
     }
     
     // allocate structure
-    struct client *client = (struct client *)malloc(sizeof(*client));
+    struct client *client = (struct client *)BObjectPool_Alloc(&clients_pool);
     if (!client) {
-        BLog(BLOG_ERROR, "malloc failed");
-        goto fail0;
+        BLog(BLOG_ERROR, "failed to allocate client");
+        goto fail1;
     }
     
     // accept client
     if (!BConnection_Init(&client->con, BConnection_source_listener(listener, &client->addr), &ss, client, (BConnection_handler)client_connection_handler)) {
         BLog(BLOG_ERROR, "BConnection_Init failed");
-        goto fail1;
+        goto fail2;
     }
     
     // limit socket send buffer, else our scheduling is pointless
@@ -654,36 +2257,98 @@ void listener_handler (BListener *listener)
     BConnection_SendAsync_Init(&client->con);
     BConnection_RecvAsync_Init(&client->con);
     
+    // the client keeps the limits it was accepted with across reloads
+    client->rate_limited = (options.client_rate > 0);
+    client->max_connections = options.max_connections_for_client;
+    
+    // the client's share of the rate limit
+    client->weight = client_weight_for_addr(client->addr);
+    int64_t rate = (int64_t)options.client_rate * client->weight;
+    int64_t burst = (options.client_burst > 0 ? (int64_t)options.client_burst * client->weight : rate / 20);
+    rate = bmin_int64(rate, INT_MAX);
+    burst = bmin_int64(burst, INT_MAX);
+    
+    // init per-client metrics
+    client->metrics = NULL;
+    if (options.client_metrics && !client_metrics_init(client)) {
+        goto fail2a;
+    }
+    
     // init disconnect timer
     BTimer_Init(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT, (BTimer_handler)client_disconnect_timer_handler, client);
     BReactor_SetTimer(&ss, &client->disconnect_timer);
     
-    // init recv interface
-    PacketPassInterface_Init(&client->recv_if, udpgw_mtu, (PacketPassInterface_handler_send)client_recv_if_handler_send, client, BReactor_PendingGroup(&ss));
+    // init recv interface, large enough for batches
+    PacketPassInterface_Init(&client->recv_if, bmax_int(udpgw_mtu, UDPGW_BATCH_MTU - sizeof(struct packetproto_header)), (PacketPassInterface_handler_send)client_recv_if_handler_send, client, BReactor_PendingGroup(&ss));
+    PacketPassInterface_EnableBatch(&client->recv_if, (PacketPassInterface_handler_send_batch)client_recv_if_handler_send_batch);
+    
+    // with a rate limit, stop reading from the client while it is over it,
+    // so that TCP pushes back on it
+    PacketPassInterface *recv_output = &client->recv_if;
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Init(&client->recv_limiter, recv_output, &ss, rate, burst);
+        recv_output = PacketPassRateLimiter_GetInput(&client->recv_limiter);
+    }
     
     // init recv decoder
-    if (!PacketProtoDecoder_Init(&client->recv_decoder, BConnection_RecvAsync_GetIf(&client->con), &client->recv_if, BReactor_PendingGroup(&ss), client,
+    if (!PacketProtoDecoder_Init2(&client->recv_decoder, BConnection_RecvAsync_GetIf(&client->con), recv_output, CLIENT_RECV_BUFFER_SIZE, BReactor_PendingGroup(&ss), client,
         (PacketProtoDecoder_handler_error)client_decoder_handler_error
     )) {
-        BLog(BLOG_ERROR, "PacketProtoDecoder_Init failed");
-        goto fail2;
+        BLog(BLOG_ERROR, "PacketProtoDecoder_Init2 failed");
+        goto fail3;
     }
     
-    // init send sender
-    PacketStreamSender_Init(&client->send_sender, BConnection_SendAsync_GetIf(&client->con), pp_mtu, BReactor_PendingGroup(&ss));
+    // init send sender, coalescing packets into larger writes
+    if (!PacketStreamSender_Init2(&client->send_sender, BConnection_SendAsync_GetIf(&client->con), bmax_int(pp_mtu, UDPGW_BATCH_MTU), CLIENT_SEND_COALESCE_SIZE, BReactor_PendingGroup(&ss))) {
+        BLog(BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail4;
+    }
     
-    // init send queue
-    if (!PacketPassFairQueue_Init(&client->send_queue, PacketStreamSender_GetInput(&client->send_sender), BReactor_PendingGroup(&ss), 0, 1)) {
-        BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
-        goto fail3;
+    // init send batcher; enabled if the client asks for batching
+    if (!PacketProtoBatcher_Init(&client->send_batcher, PacketStreamSender_GetInput(&client->send_sender), pp_mtu, (uint8_t *)&batch_prefix, sizeof(batch_prefix), UDPGW_BATCH_MTU, BReactor_PendingGroup(&ss))) {
+        BLog(BLOG_ERROR, "PacketProtoBatcher_Init failed");
+        goto fail5;
+    }
+    
+    // with a rate limit, hold back packets to the client while it is over
+    // it; they then queue up and are dropped in its own connections' buffers
+    PacketPassInterface *send_output = PacketProtoBatcher_GetInput(&client->send_batcher);
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Init(&client->send_limiter, send_output, &ss, rate, burst);
+        send_output = PacketPassRateLimiter_GetInput(&client->send_limiter);
+    }
+    
+    // init send queue; O(1) scheduling, as a client may have many connections
+    if (!PacketPassFairQueue_InitDRR(&client->send_queue, send_output, BReactor_PendingGroup(&ss), 0, 1)) {
+        BLog(BLOG_ERROR, "PacketPassFairQueue_InitDRR failed");
+        goto fail6;
     }
     
+    // init control queue flow
+    PacketPassFairQueueFlow_Init(&client->control_qflow, &client->send_queue);
+    PacketPassInterface_Sender_Init(PacketPassFairQueueFlow_GetInput(&client->control_qflow), (PacketPassInterface_handler_done)client_control_if_handler_done, client);
+    
+    // set not sending a control packet, not batching, and not relaying ICMP
+    client->control_sending = 0;
+    client->batching = 0;
+    client->icmp = 0;
+    
+    // no datagram transport until the client asks for it
+    client->have_dgram_token = 0;
+    client->dgram_up = 0;
+    BTimer_Init(&client->dgram_timer, UDPGW_DATAGRAM_SERVER_TIMEOUT, (BTimer_handler)client_dgram_timer_handler, client);
+    
     // init connections tree
     BAVL_Init(&client->connections_tree, OFFSET_DIFF(struct connection, conid, connections_tree_node), (BAVL_comparator)uint16_comparator, NULL);
     
     // init connections list
     LinkedList1_Init(&client->connections_list);
     
+    // init idle lists
+    for (int i = 0; i < NUM_IDLE_CLASSES; i++) {
+        LinkedList1_Init(&client->idle_lists[i]);
+    }
+    
     // set zero connections
     client->num_connections = 0;
     
@@ -698,21 +2363,272 @@ void listener_handler (BListener *listener)
     
     return;
     
-fail3:
+fail6:
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Free(&client->send_limiter);
+    }
+    PacketProtoBatcher_Free(&client->send_batcher);
+fail5:
     PacketStreamSender_Free(&client->send_sender);
+fail4:
     PacketProtoDecoder_Free(&client->recv_decoder);
-fail2:
+fail3:
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Free(&client->recv_limiter);
+    }
     PacketPassInterface_Free(&client->recv_if);
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
+    if (client->metrics) {
+        client_metrics_free(client);
+    }
+fail2a:
     BConnection_RecvAsync_Free(&client->con);
     BConnection_SendAsync_Free(&client->con);
     BConnection_Free(&client->con);
+fail2:
+    BObjectPool_Release(&clients_pool, client);
 fail1:
-    free(client);
+    clients_limit_release();
 fail0:
     return;
 }
 
+#ifndef BADVPN_USE_WINAPI
+
+void handoff_handler (void *unused)
+{
+    ASSERT(have_handoff)
+    ASSERT(!draining)
+    
+    // pass the listening sockets
+    int fds[MAX_LISTEN_ADDRS + 1];
+    for (int i = 0; i < num_listeners; i++) {
+        fds[i] = BListener_GetFd(&listeners[i]);
+    }
+    if (!BListenerHandoff_Send(&handoff, fds, num_listeners)) {
+        BLog(BLOG_ERROR, "handoff: BListenerHandoff_Send failed");
+        
+        // the new instance gives up; wait for another one
+        BListenerHandoff_Free(&handoff);
+        if (!BListenerHandoff_Init(&handoff, options.handoff_socket, &ss, NULL, handoff_handler)) {
+            BLog(BLOG_ERROR, "handoff: BListenerHandoff_Init failed");
+            have_handoff = 0;
+        }
+        return;
+    }
+    
+    // stop accepting clients; the Unix socket file now belongs to the new instance
+    while (num_listeners > 0) {
+        num_listeners--;
+        BListener_KeepSocketFile(&listeners[num_listeners]);
+        BListener_Free(&listeners[num_listeners]);
+    }
+    
+    // release the datagram transport address
+    if (have_udp_listener) {
+        udp_listener_stop();
+    }
+    
+    // release the metrics address
+    if (have_metrics_exporter) {
+        BMetricsExporter_Free(&metrics_exporter);
+        have_metrics_exporter = 0;
+    }
+    
+    // let the new instance bind what it needs
+    BListenerHandoff_Free(&handoff);
+    have_handoff = 0;
+    
+    // drain clients
+    draining = 1;
+    if (num_clients == 0) {
+        BLog(BLOG_NOTICE, "handoff: no clients, exiting");
+        BReactor_Quit(&ss, 1);
+        return;
+    }
+    BLog(BLOG_NOTICE, "handoff: draining %d clients", num_clients);
+    if (options.handoff_drain_timeout > 0) {
+        BReactor_SetTimer(&ss, &drain_timer);
+    }
+}
+
+void drain_timer_handler (void *unused)
+{
+    ASSERT(draining)
+    
+    BLog(BLOG_NOTICE, "handoff: drain timeout, exiting with %d clients", num_clients);
+    
+    BReactor_Quit(&ss, 1);
+}
+
+#endif
+
+int udp_listener_init (void)
+{
+    ASSERT(!have_udp_listener)
+    
+    int mtu = sizeof(struct udpgw_datagram_header) + udpgw_mtu;
+    
+    // init datagram object
+    if (!BDatagram_Init(&udp_listener, udp_listener_addr.type, &ss, NULL, udp_listener_handler_error)) {
+        BLog(BLOG_ERROR, "datagram transport: BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // bind
+    if (!BDatagram_Bind(&udp_listener, udp_listener_addr)) {
+        BLog(BLOG_ERROR, "datagram transport: BDatagram_Bind failed");
+        goto fail1;
+    }
+    
+    // get the port to offer to clients
+    if (!BDatagram_GetLocalPort(&udp_listener, &udp_listener_port)) {
+        BLog(BLOG_ERROR, "datagram transport: BDatagram_GetLocalPort failed");
+        goto fail1;
+    }
+    
+    // init datagram interfaces
+    BDatagram_SendAsync_Init(&udp_listener, mtu);
+    BDatagram_RecvAsync_Init(&udp_listener, mtu);
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&udp_listener), udp_listener_send_handler_done, NULL);
+    
+    // init send writer and buffer, with the destination in front of each datagram
+    BufferWriter_Init(&udp_listener_send_writer, sizeof(BAddr) + mtu, BReactor_PendingGroup(&ss));
+    PacketPassInterface_Init(&udp_listener_send_if, sizeof(BAddr) + mtu, udp_listener_send_if_handler_send, NULL, BReactor_PendingGroup(&ss));
+    if (!PacketBuffer_Init(&udp_listener_send_buffer, BufferWriter_GetOutput(&udp_listener_send_writer), &udp_listener_send_if, UDP_LISTENER_SEND_BUFFER_SIZE, BReactor_PendingGroup(&ss))) {
+        BLog(BLOG_ERROR, "datagram transport: PacketBuffer_Init failed");
+        goto fail2;
+    }
+    
+    // init receive interface and buffer
+    PacketPassInterface_Init(&udp_listener_recv_if, mtu, udp_listener_recv_if_handler_send, NULL, BReactor_PendingGroup(&ss));
+    if (!SinglePacketBuffer_Init(&udp_listener_recv_buffer, BDatagram_RecvAsync_GetIf(&udp_listener), &udp_listener_recv_if, BReactor_PendingGroup(&ss))) {
+        BLog(BLOG_ERROR, "datagram transport: SinglePacketBuffer_Init failed");
+        goto fail3;
+    }
+    
+    have_udp_listener = 1;
+    
+    return 1;
+    
+fail3:
+    PacketPassInterface_Free(&udp_listener_recv_if);
+    PacketBuffer_Free(&udp_listener_send_buffer);
+fail2:
+    PacketPassInterface_Free(&udp_listener_send_if);
+    BufferWriter_Free(&udp_listener_send_writer);
+    BDatagram_RecvAsync_Free(&udp_listener);
+    BDatagram_SendAsync_Free(&udp_listener);
+fail1:
+    BDatagram_Free(&udp_listener);
+fail0:
+    return 0;
+}
+
+void udp_listener_free (void)
+{
+    ASSERT(have_udp_listener)
+    
+    // free receive buffer and interface
+    SinglePacketBuffer_Free(&udp_listener_recv_buffer);
+    PacketPassInterface_Free(&udp_listener_recv_if);
+    
+    // free send buffer and writer
+    PacketBuffer_Free(&udp_listener_send_buffer);
+    PacketPassInterface_Free(&udp_listener_send_if);
+    BufferWriter_Free(&udp_listener_send_writer);
+    
+    // free datagram interfaces
+    BDatagram_RecvAsync_Free(&udp_listener);
+    BDatagram_SendAsync_Free(&udp_listener);
+    
+    // free datagram object
+    BDatagram_Free(&udp_listener);
+    
+    have_udp_listener = 0;
+}
+
+void udp_listener_stop (void)
+{
+    ASSERT(have_udp_listener)
+    
+    udp_listener_free();
+    
+    // clients are back on the stream until they send over datagrams again
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&clients_list); node; node = LinkedList1Node_Next(node)) {
+        struct client *client = UPPER_OBJECT(node, struct client, clients_list_node);
+        client->dgram_up = 0;
+    }
+}
+
+void udp_listener_handler_error (void *unused, int event)
+{
+    ASSERT(have_udp_listener)
+    
+    BLog(BLOG_ERROR, "datagram transport: socket error, restarting it");
+    
+    udp_listener_stop();
+    
+    if (!udp_listener_init()) {
+        BLog(BLOG_ERROR, "datagram transport: disabled");
+    }
+}
+
+void udp_listener_recv_if_handler_send (void *unused, uint8_t *data, int data_len)
+{
+    ASSERT(have_udp_listener)
+    ASSERT(data_len >= 0)
+    
+    // accept packet
+    PacketPassInterface_Done(&udp_listener_recv_if);
+    
+    // find client by token
+    struct udpgw_datagram_header header;
+    if (data_len < sizeof(header)) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_INFO, "datagram transport: missing header");
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    BAVLNode *node = BAVL_LookupExact(&dgram_clients_tree, &header.token);
+    if (!node) {
+        BLogRateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_INFO, "datagram transport: unknown token");
+        return;
+    }
+    struct client *client = UPPER_OBJECT(node, struct client, dgram_tree_node);
+    ASSERT(client->have_dgram_token)
+    
+    // reply to where the client sends from, which may change behind a NAT
+    BIPAddr local_addr;
+    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&udp_listener, &client->dgram_addr, &local_addr))
+    
+    // the client is still sending over datagrams
+    BReactor_SetTimer(&ss, &client->dgram_timer);
+    
+    client_process_packet(client, data + sizeof(header), data_len - sizeof(header), 1);
+}
+
+void udp_listener_send_if_handler_send (void *unused, uint8_t *data, int data_len)
+{
+    ASSERT(have_udp_listener)
+    ASSERT(data_len >= sizeof(BAddr))
+    
+    // send to the address in front
+    BAddr addr;
+    memcpy(&addr, data, sizeof(addr));
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&udp_listener, addr, local_addr);
+    
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&udp_listener), data + sizeof(addr), data_len - sizeof(addr));
+}
+
+void udp_listener_send_handler_done (void *unused)
+{
+    ASSERT(have_udp_listener)
+    
+    PacketPassInterface_Done(&udp_listener_send_if);
+}
+
 void client_free (struct client *client)
 {
     // allow freeing send queue flows
@@ -734,30 +2650,147 @@ void client_free (struct client *client)
     LinkedList1_Remove(&clients_list, &client->clients_list_node);
     num_clients--;
     
+#ifndef BADVPN_USE_WINAPI
+    // done draining once the last client is gone
+    if (draining && num_clients == 0) {
+        BLog(BLOG_NOTICE, "handoff: all clients gone, exiting");
+        BReactor_Quit(&ss, 1);
+    }
+#endif
+    
+    // release client slot
+    clients_limit_release();
+    
+    // free datagram transport state
+    BReactor_RemoveTimer(&ss, &client->dgram_timer);
+    if (client->have_dgram_token) {
+        BAVL_Remove(&dgram_clients_tree, &client->dgram_tree_node);
+    }
+    
+    // free control queue flow
+    PacketPassFairQueueFlow_Free(&client->control_qflow);
+    
     // free send queue
     PacketPassFairQueue_Free(&client->send_queue);
     
+    // free send rate limiter
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Free(&client->send_limiter);
+    }
+    
+    // free send batcher
+    PacketProtoBatcher_Free(&client->send_batcher);
+    
     // free send sender
     PacketStreamSender_Free(&client->send_sender);
     
     // free recv decoder
     PacketProtoDecoder_Free(&client->recv_decoder);
     
+    // free recv rate limiter
+    if (client->rate_limited) {
+        PacketPassRateLimiter_Free(&client->recv_limiter);
+    }
+    
     // free recv interface
     PacketPassInterface_Free(&client->recv_if);
     
     // free disconnect timer
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
     
+    // free per-client metrics
+    if (client->metrics) {
+        client_metrics_free(client);
+    }
+    
     // free connection interfaces
     BConnection_RecvAsync_Free(&client->con);
     BConnection_SendAsync_Free(&client->con);
     
-    // free connection
-    BConnection_Free(&client->con);
+    // free connection
+    BConnection_Free(&client->con);
+    
+    // free structure
+    BObjectPool_Release(&clients_pool, client);
+}
+
+int client_weight_for_addr (BAddr addr)
+{
+    // the first matching --client-weight applies
+    for (int i = 0; i < num_client_weights; i++) {
+        struct client_weight *cw = &client_weights[i];
+        if (cw->type != addr.type) {
+            continue;
+        }
+        switch (cw->type) {
+            case BADDR_TYPE_IPV4: {
+                if (ipaddr_ipv4_addrs_in_network(cw->ipv4.addr, addr.ipv4.ip, cw->ipv4.prefix)) {
+                    return cw->weight;
+                }
+            } break;
+            case BADDR_TYPE_IPV6: {
+                struct ipv6_addr ip;
+                memcpy(ip.bytes, addr.ipv6.ip, sizeof(ip.bytes));
+                if (ipaddr6_ipv6_addrs_in_network(cw->ipv6.addr, ip, cw->ipv6.prefix)) {
+                    return cw->weight;
+                }
+            } break;
+        }
+    }
+    
+    return 1;
+}
+
+int client_metrics_init (struct client *client)
+{
+    struct client_metrics *m = (struct client_metrics *)malloc(sizeof(*m));
+    if (!m) {
+        client_log(client, BLOG_ERROR, "malloc failed");
+        return 0;
+    }
+    
+    // label the metrics with the client address
+    char addr_str[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&client->addr, addr_str);
+    snprintf(m->labels, sizeof(m->labels), "client=\"%s\"", addr_str);
+    snprintf(m->labels_to_udp, sizeof(m->labels_to_udp), "client=\"%s\",direction=\"to_udp\"", addr_str);
+    snprintf(m->labels_to_client, sizeof(m->labels_to_client), "client=\"%s\",direction=\"to_client\"", addr_str);
+    
+    BMetric_InitCounter(&m->packets_to_udp, "badvpn_udpgw_client_packets_total", m->labels_to_udp, "Packets forwarded for a client.");
+    BMetric_InitCounter(&m->packets_to_client, "badvpn_udpgw_client_packets_total", m->labels_to_client, "Packets forwarded for a client.");
+    BMetric_InitCounter(&m->bytes_to_udp, "badvpn_udpgw_client_bytes_total", m->labels_to_udp, "Payload bytes forwarded for a client.");
+    BMetric_InitCounter(&m->bytes_to_client, "badvpn_udpgw_client_bytes_total", m->labels_to_client, "Payload bytes forwarded for a client.");
+    BMetric_InitGaugeFunc(&m->queued_connections, "badvpn_udpgw_client_queued_connections", m->labels, "Connections of a client with a packet waiting to be sent to it.", (BMetric_gauge_func)metric_client_queued_func, client);
+    
+    client->metrics = m;
+    
+    return 1;
+}
+
+void client_metrics_free (struct client *client)
+{
+    struct client_metrics *m = client->metrics;
+    
+    BMetric_Free(&m->queued_connections);
+    BMetric_Free(&m->bytes_to_client);
+    BMetric_Free(&m->bytes_to_udp);
+    BMetric_Free(&m->packets_to_client);
+    BMetric_Free(&m->packets_to_udp);
+    
+    free(m);
+    client->metrics = NULL;
+}
+
+int64_t metric_client_queued_func (struct client *client)
+{
+    int64_t num = 0;
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&client->connections_list); node; node = LinkedList1Node_Next(node)) {
+        struct connection *con = UPPER_OBJECT(node, struct connection, connections_list_node);
+        num += PacketPassFairQueueFlow_IsBusy(&con->send_qflow);
+    }
     
-    // free structure
-    free(client);
+    return num;
 }
 
 void client_logfunc (struct client *client)
@@ -776,6 +2809,10 @@ void client_log (struct client *client, int level, const char *fmt, ...)
     va_end(vl);
 }
 
+// for errors in client messages, which a misbehaving client can trigger per packet
+#define client_log_ratelimited(client, level, ...) \
+    BLog_RateLimited(PACKET_LOG_RATELIMIT_INTERVAL, PACKET_LOG_RATELIMIT_BURST, BLOG_CURRENT_CHANNEL, (level), client_log((client), (level), __VA_ARGS__))
+
 void client_disconnect_timer_handler (struct client *client)
 {
     client_log(client, BLOG_INFO, "timed out, disconnecting");
@@ -807,14 +2844,72 @@ void client_decoder_handler_error (struct client *client)
 void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
-    ASSERT(data_len <= udpgw_mtu)
     
     // accept packet
     PacketPassInterface_Done(&client->recv_if);
     
+    client_process_packet(client, data, data_len, 0);
+}
+
+void client_recv_if_handler_send_batch (struct client *client, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    ASSERT(num_packets > 0)
+    
+    // accept packets
+    PacketPassInterface_Done(&client->recv_if);
+    
+    for (int i = 0; i < num_packets; i++) {
+        client_process_packet(client, packets[i].data, packets[i].len, 0);
+    }
+}
+
+void client_process_packet (struct client *client, const uint8_t *data, int data_len, int from_dgram)
+{
+    ASSERT(data_len >= 0)
+    
+    // a batch carries PacketProto-encoded messages after its header
+    if (udpgw_is_batch(data, data_len)) {
+        data += sizeof(struct udpgw_header);
+        data_len -= sizeof(struct udpgw_header);
+        
+        while (data_len > 0) {
+            struct packetproto_header pp;
+            if (data_len < sizeof(pp)) {
+                client_log_ratelimited(client, BLOG_ERROR, "batch: missing message header");
+                return;
+            }
+            memcpy(&pp, data, sizeof(pp));
+            data += sizeof(pp);
+            data_len -= sizeof(pp);
+            int len = ltoh16(pp.len);
+            if (len > data_len) {
+                client_log_ratelimited(client, BLOG_ERROR, "batch: message too long");
+                return;
+            }
+            
+            client_process_message(client, data, len, from_dgram);
+            
+            data += len;
+            data_len -= len;
+        }
+        return;
+    }
+    
+    client_process_message(client, data, data_len, from_dgram);
+}
+
+void client_process_message (struct client *client, const uint8_t *data, int data_len, int from_dgram)
+{
+    ASSERT(data_len >= 0)
+    
+    if (data_len > udpgw_mtu) {
+        client_log_ratelimited(client, BLOG_ERROR, "message too long");
+        return;
+    }
+    
     // parse header
     if (data_len < sizeof(struct udpgw_header)) {
-        client_log(client, BLOG_ERROR, "missing header");
+        client_log_ratelimited(client, BLOG_ERROR, "missing header");
         return;
     }
     struct udpgw_header header;
@@ -830,6 +2925,80 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     // if this is keepalive, ignore any payload
     if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
         client_log(client, BLOG_DEBUG, "received keepalive");
+        
+        // answer a keepalive datagram, so that the client knows the path works
+        if (from_dgram) {
+            client_send_dgram_keepalive(client);
+            return;
+        }
+        
+        // accept a batching offer
+        int ack = 0;
+        if ((flags & UDPGW_CLIENT_FLAG_BATCH) && !client->batching) {
+            client_log(client, BLOG_INFO, "batching enabled");
+            client->batching = 1;
+            PacketProtoBatcher_Enable(&client->send_batcher);
+            ack = 1;
+        }
+        
+        // accept ICMP echo relay; asked for with every keepalive, so
+        // acknowledged again if the acknowledgement could not be sent
+        int ack_icmp = (flags & UDPGW_CLIENT_FLAG_ICMP) && options.icmp_echo && !client->icmp;
+        
+        // offer the datagram transport if asked; this is repeated on every
+        // keepalive asking for it, in case an offer could not be sent
+        int offer = (flags & UDPGW_CLIENT_FLAG_DATAGRAM) && have_udp_listener && client_init_dgram_token(client);
+        
+        if ((ack || ack_icmp || offer) && !client->control_sending) {
+            client->control_sending = 1;
+            if (ack_icmp) {
+                client_log(client, BLOG_INFO, "ICMP echo relay enabled");
+                client->icmp = 1;
+            }
+            uint8_t ack_flags = UDPGW_CLIENT_FLAG_KEEPALIVE|(client->batching ? UDPGW_CLIENT_FLAG_BATCH : 0)|(client->icmp ? UDPGW_CLIENT_FLAG_ICMP : 0);
+            if (offer) {
+                client->offer_packet.pp.len = htol16(sizeof(client->offer_packet.udpgw) + sizeof(client->offer_packet.offer));
+                client->offer_packet.udpgw.flags = htol8(ack_flags|UDPGW_CLIENT_FLAG_DATAGRAM);
+                client->offer_packet.udpgw.conid = htol16(0);
+                client->offer_packet.offer.token = client->dgram_token;
+                client->offer_packet.offer.port = udp_listener_port;
+                PacketPassInterface_Sender_Send(PacketPassFairQueueFlow_GetInput(&client->control_qflow), (uint8_t *)&client->offer_packet, sizeof(client->offer_packet));
+            } else {
+                client->ack_packet.pp.len = htol16(sizeof(client->ack_packet.udpgw));
+                client->ack_packet.udpgw.flags = htol8(ack_flags);
+                client->ack_packet.udpgw.conid = htol16(0);
+                PacketPassInterface_Sender_Send(PacketPassFairQueueFlow_GetInput(&client->control_qflow), (uint8_t *)&client->ack_packet, sizeof(client->ack_packet));
+            }
+        }
+        return;
+    }
+    
+    // reply over the transport the client sends data over
+    if (from_dgram != client->dgram_up) {
+        client_log(client, BLOG_INFO, "replying over %s", (from_dgram ? "datagrams" : "the stream"));
+        client->dgram_up = from_dgram;
+    }
+    
+    if ((flags & UDPGW_CLIENT_FLAG_BATCH)) {
+        client_log_ratelimited(client, BLOG_ERROR, "nested batch");
+        return;
+    }
+    
+    // a compact message is for an existing connection, at its known address
+    if ((flags & UDPGW_CLIENT_FLAG_COMPACT)) {
+        if (data_len > options.udp_mtu) {
+            client_log_ratelimited(client, BLOG_ERROR, "too much data");
+            return;
+        }
+        struct connection *con = find_connection(client, conid);
+        if (!con || (flags & UDPGW_CLIENT_FLAG_REBIND) || con->is_icmp != !!(flags & UDPGW_CLIENT_FLAG_ICMP)) {
+            // the connection may have been closed here, e.g. evicted under memory
+            // pressure; have the client send the address again
+            client_log_ratelimited(client, BLOG_INFO, "compact message for unknown conid");
+            connection_send_forget(client, conid);
+            return;
+        }
+        connection_send_to_udp(con, data, data_len);
         return;
     }
     
@@ -837,7 +3006,7 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     BAddr orig_addr;
     if ((flags & UDPGW_CLIENT_FLAG_IPV6)) {
         if (data_len < sizeof(struct udpgw_addr_ipv6)) {
-            client_log(client, BLOG_ERROR, "missing ipv6 address");
+            client_log_ratelimited(client, BLOG_ERROR, "missing ipv6 address");
             return;
         }
         struct udpgw_addr_ipv6 addr_ipv6;
@@ -847,7 +3016,7 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
         BAddr_InitIPv6(&orig_addr, addr_ipv6.addr_ip, addr_ipv6.addr_port);
     } else {
         if (data_len < sizeof(struct udpgw_addr_ipv4)) {
-            client_log(client, BLOG_ERROR, "missing ipv4 address");
+            client_log_ratelimited(client, BLOG_ERROR, "missing ipv4 address");
             return;
         }
         struct udpgw_addr_ipv4 addr_ipv4;
@@ -859,16 +3028,33 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     
     // check payload length
     if (data_len > options.udp_mtu) {
-        client_log(client, BLOG_ERROR, "too much data");
+        client_log_ratelimited(client, BLOG_ERROR, "too much data");
         return;
     }
     
+    // an ICMP message must be an echo request, which is all an unprivileged
+    // ICMP socket sends
+    int is_icmp = !!(flags & UDPGW_CLIENT_FLAG_ICMP);
+    if (is_icmp) {
+        if (!options.icmp_echo) {
+            client_log_ratelimited(client, BLOG_ERROR, "ICMP echo relay is not enabled");
+            return;
+        }
+        struct icmp_echo_header icmp_header;
+        uint8_t *icmp_payload;
+        int icmp_payload_len;
+        if (!icmp_echo_check(data, data_len, (orig_addr.type == BADDR_TYPE_IPV6 ? ICMPV6_TYPE_ECHO_REQUEST : ICMP_TYPE_ECHO_REQUEST), &icmp_header, &icmp_payload, &icmp_payload_len)) {
+            client_log_ratelimited(client, BLOG_ERROR, "not an ICMP echo request");
+            return;
+        }
+    }
+    
     // find connection
     struct connection *con = find_connection(client, conid);
     ASSERT(!con || !con->closing)
     
     // if connection exists, close it if needed
-    if (con && ((flags & UDPGW_CLIENT_FLAG_REBIND) || !BAddr_Compare(&con->orig_addr, &orig_addr))) {
+    if (con && ((flags & UDPGW_CLIENT_FLAG_REBIND) || !BAddr_Compare(&con->orig_addr, &orig_addr) || con->is_icmp != is_icmp)) {
         connection_log(con, BLOG_DEBUG, "close old");
         connection_close(con);
         con = NULL;
@@ -876,8 +3062,11 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     
     // if connection doesn't exists, create it
     if (!con) {
-        // check number of connections
-        if (client->num_connections == options.max_connections_for_client) {
+        // check number of connections; under memory pressure, a client only
+        // gets a new connection in place of an old one
+        if (client->num_connections == client->max_connections ||
+            (client->num_connections > 0 && memory_pressure_level() >= MEMPRESSURE_LEVEL_NO_ADMIT)
+        ) {
             // close least recently used connection
             con = UPPER_OBJECT(LinkedList1_GetFirst(&client->connections_list), struct connection, connections_list_node);
             connection_close(con);
@@ -885,24 +3074,95 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
         
         // if this is DNS, replace actual address, but keep still remember the orig_addr
         BAddr addr = orig_addr;
-        if ((flags & UDPGW_CLIENT_FLAG_DNS)) {
+        int is_dns = 0;
+        if ((flags & UDPGW_CLIENT_FLAG_DNS) && !is_icmp) {
             maybe_update_dns();
             if (dns_addr.type == BADDR_TYPE_NONE) {
                 client_log(client, BLOG_WARNING, "received DNS packet, but no DNS server available");
             } else {
                 client_log(client, BLOG_DEBUG, "received DNS");
                 addr = dns_addr;
+                is_dns = 1;
             }
         }
         
         // create new connection
-        connection_init(client, conid, addr, orig_addr, data, data_len);
+        connection_init(client, conid, addr, orig_addr, is_dns, is_icmp, data, data_len);
     } else {
         // submit packet to existing connection
         connection_send_to_udp(con, data, data_len);
     }
 }
 
+void client_control_if_handler_done (struct client *client)
+{
+    ASSERT(client->control_sending)
+    
+    client->control_sending = 0;
+}
+
+int client_init_dgram_token (struct client *client)
+{
+    if (client->have_dgram_token) {
+        return 1;
+    }
+    
+#ifndef BADVPN_USE_WINAPI
+    // the token is all that authenticates datagrams, so it must not be guessable
+    do {
+        if (!BRandom2_GenBytes(&dgram_random, &client->dgram_token, sizeof(client->dgram_token))) {
+            client_log(client, BLOG_ERROR, "BRandom2_GenBytes failed");
+            return 0;
+        }
+    } while (!BAVL_Insert(&dgram_clients_tree, &client->dgram_tree_node, NULL));
+    
+    client->have_dgram_token = 1;
+    
+    client_log(client, BLOG_INFO, "offering datagram transport");
+    
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void client_send_dgram_keepalive (struct client *client)
+{
+    ASSERT(client->have_dgram_token)
+    
+    if (!have_udp_listener) {
+        return;
+    }
+    
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(&udp_listener_send_writer, &out)) {
+        client_log_ratelimited(client, BLOG_WARNING, "out of datagram buffer");
+        return;
+    }
+    
+    struct udpgw_datagram_header dheader;
+    dheader.token = client->dgram_token;
+    struct udpgw_header header;
+    header.flags = htol8(UDPGW_CLIENT_FLAG_KEEPALIVE);
+    header.conid = htol16(0);
+    
+    memcpy(out, &client->dgram_addr, sizeof(client->dgram_addr));
+    memcpy(out + sizeof(client->dgram_addr), &dheader, sizeof(dheader));
+    memcpy(out + sizeof(client->dgram_addr) + sizeof(dheader), &header, sizeof(header));
+    
+    BufferWriter_EndPacket(&udp_listener_send_writer, sizeof(client->dgram_addr) + sizeof(dheader) + sizeof(header));
+}
+
+void client_dgram_timer_handler (struct client *client)
+{
+    ASSERT(client->have_dgram_token)
+    
+    if (client->dgram_up) {
+        client_log(client, BLOG_INFO, "no datagrams, replying over the stream");
+        client->dgram_up = 0;
+    }
+}
+
 int get_local_num_ports (int addr_type)
 {
     switch (addr_type) {
@@ -923,69 +3183,156 @@ BAddr get_local_addr (int addr_type)
     }
 }
 
-uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con)
+BFlowAddr port_group_key (BAddr remote_addr)
 {
     ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
-    ASSERT(get_local_num_ports(remote_addr.type) >= 0)
     
-    int local_num_ports = get_local_num_ports(remote_addr.type);
+    // with unique local ports, only the remote IP matters
+    if (options.unique_local_ports) {
+        BAddr_SetPort(&remote_addr, 0);
+    }
+    
+    return BFlowAddr_FromBAddr(&remote_addr);
+}
+
+struct port_group * port_group_init (BFlowAddr key)
+{
+    ASSERT(!PortGroupsTree_LookupExact(&port_groups_tree, 0, &key))
     
-    // allocate port usage array
-    uint8_t *port_usage = (uint8_t *)BAllocSize(bsize_fromint(local_num_ports));
-    if (!port_usage) {
+    // allocate structure
+    struct port_group *group = (struct port_group *)BObjectPool_Alloc(&port_groups_pool);
+    if (!group) {
+        BLog(BLOG_ERROR, "failed to allocate port group");
         return NULL;
     }
     
-    // zero array
-    memset(port_usage, 0, local_num_ports);
+    // set key
+    group->key = key;
+    
+    // init ports tree
+    PortGroupPortsTree_Init(&group->ports_tree);
+    
+    // init LRU list
+    LinkedList1_Init(&group->lru_list);
     
-    struct connection *least_con = NULL;
+    // insert to port groups tree
+    ASSERT_EXECUTE(PortGroupsTree_Insert(&port_groups_tree, 0, group, NULL))
     
-    // flag inappropriate ports (those with the same remote address)
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&clients_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct client *client = UPPER_OBJECT(ln, struct client, clients_list_node);
+    return group;
+}
+
+void port_group_free (struct port_group *group)
+{
+    ASSERT(PortGroupPortsTree_IsEmpty(&group->ports_tree))
+    ASSERT(LinkedList1_IsEmpty(&group->lru_list))
+    
+    // remove from port groups tree
+    PortGroupsTree_Remove(&port_groups_tree, 0, group);
+    
+    // free structure
+    BObjectPool_Release(&port_groups_pool, group);
+}
+
+int port_group_find_free_index (struct port_group *group, int start)
+{
+    ASSERT(start >= 0)
+    
+    // find the first used index not below start
+    struct connection *first = PortGroupPortsTree_GetFirstGreaterEqual(&group->ports_tree, 0, start);
+    if (!first) {
+        return start;
+    }
+    
+    // Used indices are distinct, so the one at rank r0+k is at least start+k,
+    // and once it is greater it stays greater. Binary search for the first
+    // rank where that happens; everything below it is a contiguous run.
+    int r0 = PortGroupPortsTree_IndexOf(&group->ports_tree, 0, first);
+    int lo = r0;
+    int hi = PortGroupPortsTree_Count(&group->ports_tree, 0);
+    
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct connection *con = PortGroupPortsTree_GetAt(&group->ports_tree, 0, mid);
+        if (con->local_port_index > start + (mid - r0)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    
+    return start + (lo - r0);
+}
+
+struct connection * port_group_find_least_used (struct port_group *group)
+{
+    // the LRU list is ordered by last use; skip connections still
+    // sending to the client, we can't close them right away
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&group->lru_list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct connection *con = UPPER_OBJECT(ln, struct connection, port_group_lru_list_node);
+        ASSERT(con->port_group == group)
+        ASSERT(!con->closing)
         
-        for (LinkedList1Node *ln2 = LinkedList1_GetFirst(&client->connections_list); ln2; ln2 = LinkedList1Node_Next(ln2)) {
-            struct connection *con = UPPER_OBJECT(ln2, struct connection, connections_list_node);
-            ASSERT(con->client == client)
-            ASSERT(!con->closing)
-            
-            if (con->addr.type != remote_addr.type || con->local_port_index < 0) {
-                continue;
-            }
-            ASSERT(con->local_port_index < local_num_ports)
-            
-            if (options.unique_local_ports) {
-                BIPAddr ip1;
-                BIPAddr ip2;
-                BAddr_GetIPAddr(&con->addr, &ip1);
-                BAddr_GetIPAddr(&remote_addr, &ip2);
-                if (!BIPAddr_Compare(&ip1, &ip2)) {
-                    continue;
-                }
-            } else {
-                if (!BAddr_Compare(&con->addr, &remote_addr)) {
-                    continue;
-                }
-            }
-            
-            port_usage[con->local_port_index] = 1;
-            
-            if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
-                if (!least_con || con->last_use_time < least_con->last_use_time) {
-                    least_con = con;
-                }
-            }
+        if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
+            return con;
         }
     }
     
-    *out_con = least_con;
-    return port_usage;
+    return NULL;
+}
+
+void connection_port_group_insert (struct connection *con, struct port_group *group, int local_port_index)
+{
+    ASSERT(con->local_port_index == -1)
+    ASSERT(local_port_index >= 0)
+    ASSERT(!PortGroupPortsTree_LookupExact(&group->ports_tree, 0, local_port_index))
+    
+    // remember which port we're using
+    con->local_port_index = local_port_index;
+    con->port_group = group;
+    
+    // insert to group's ports tree
+    ASSERT_EXECUTE(PortGroupPortsTree_Insert(&group->ports_tree, 0, con, NULL))
+    
+    // insert to back of group's LRU list
+    LinkedList1_Append(&group->lru_list, &con->port_group_lru_list_node);
+}
+
+void connection_port_group_remove (struct connection *con)
+{
+    ASSERT(con->local_port_index >= 0)
+    
+    struct port_group *group = con->port_group;
+    
+    // remove from group's LRU list
+    LinkedList1_Remove(&group->lru_list, &con->port_group_lru_list_node);
+    
+    // remove from group's ports tree
+    PortGroupPortsTree_Remove(&group->ports_tree, 0, con);
+    
+    con->local_port_index = -1;
+    
+    // free group if this was its last connection
+    if (PortGroupPortsTree_IsEmpty(&group->ports_tree)) {
+        port_group_free(group);
+    }
+}
+
+void connection_port_group_touch (struct connection *con)
+{
+    if (con->local_port_index < 0) {
+        return;
+    }
+    
+    struct port_group *group = con->port_group;
+    
+    // move connection to back of group's LRU list
+    LinkedList1_Remove(&group->lru_list, &con->port_group_lru_list_node);
+    LinkedList1_Append(&group->lru_list, &con->port_group_lru_list_node);
 }
 
-void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len)
+void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int is_dns, int is_icmp, const uint8_t *data, int data_len)
 {
-    ASSERT(client->num_connections < options.max_connections_for_client)
+    ASSERT(client->num_connections < client->max_connections)
     ASSERT(!find_connection(client, conid))
     BAddr_Assert(&addr);
     ASSERT(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6)
@@ -994,9 +3341,9 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     ASSERT(data_len <= options.udp_mtu)
     
     // allocate structure
-    struct connection *con = (struct connection *)malloc(sizeof(*con));
+    struct connection *con = (struct connection *)BObjectPool_Alloc(&connections_pool);
     if (!con) {
-        client_log(client, BLOG_ERROR, "malloc failed");
+        client_log(client, BLOG_ERROR, "failed to allocate connection");
         goto fail0;
     }
     
@@ -1007,9 +3354,10 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     con->orig_addr = orig_addr;
     con->first_data = data;
     con->first_data_len = data_len;
+    con->is_icmp = is_icmp;
     
-    // set last use time
-    con->last_use_time = btime_gettime();
+    // set address not sent to client
+    con->addr_sent = 0;
     
     // set not closing
     con->closing = 0;
@@ -1028,25 +3376,25 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     }
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
-    // init UDP dgram
-    if (!BDatagram_Init(&con->udp_dgram, addr.type, &ss, con, (BDatagram_handler)connection_dgram_handler_event)) {
-        client_log(client, BLOG_ERROR, "BDatagram_Init failed");
-        goto fail2;
+    // init UDP dgram, or an ICMP socket for echo requests; the kernel then
+    // picks the identifier, and replies only come back for it
+    if (is_icmp) {
+        if (!BDatagram_InitIcmp(&con->udp_dgram, addr.type, &ss, con, (BDatagram_handler)connection_dgram_handler_event)) {
+            client_log(client, BLOG_ERROR, "BDatagram_InitIcmp failed; is the group in net.ipv4.ping_group_range?");
+            goto fail2;
+        }
+    } else {
+        if (!BDatagram_Init(&con->udp_dgram, addr.type, &ss, con, (BDatagram_handler)connection_dgram_handler_event)) {
+            client_log(client, BLOG_ERROR, "BDatagram_Init failed");
+            goto fail2;
+        }
     }
     
     con->local_port_index = -1;
     
-    int local_num_ports = get_local_num_ports(addr.type);
+    int local_num_ports = (is_icmp ? -1 : get_local_num_ports(addr.type));
     
     if (local_num_ports >= 0) {
-        // build port usage array, find least used connection
-        struct connection *least_con;
-        uint8_t *port_usage = build_port_usage_array_and_find_least_used_connection(addr, &least_con);
-        if (!port_usage) {
-            client_log(client, BLOG_ERROR, "build_port_usage_array failed");
-            goto failed;
-        }
-        
         // set SO_REUSEADDR
         if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
             client_log(client, BLOG_ERROR, "set SO_REUSEADDR failed");
@@ -1056,24 +3404,29 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
         // get starting local address
         BAddr local_addr = get_local_addr(addr.type);
         
-        // try different ports
-        for (int i = 0; i < local_num_ports; i++) {
-            // skip inappropriate ports
-            if (port_usage[i]) {
-                continue;
-            }
-            
+        // find or create port group of ports used for this remote address
+        BFlowAddr key = port_group_key(addr);
+        struct port_group *group = PortGroupsTree_LookupExact(&port_groups_tree, 0, &key);
+        if (!group && !(group = port_group_init(key))) {
+            goto failed;
+        }
+        
+        // try different ports, skipping ports used for this remote address
+        for (int i = port_group_find_free_index(group, 0); i < local_num_ports; i = port_group_find_free_index(group, i + 1)) {
             BAddr bind_addr = local_addr;
             BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
             if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-                // remember which port we're using
-                con->local_port_index = i;
+                connection_port_group_insert(con, group, i);
                 goto cont;
             }
         }
         
         // try closing an unused connection with the same remote addr
+        struct connection *least_con = port_group_find_least_used(group);
         if (!least_con) {
+            if (PortGroupPortsTree_IsEmpty(&group->ports_tree)) {
+                port_group_free(group);
+            }
             goto failed;
         }
         
@@ -1086,22 +3439,30 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
         
         BLog(BLOG_INFO, "closing connection for its remote address");
         
-        // close the offending connection
+        // close the offending connection; this frees the group if it was the last one
         connection_close(least_con);
         
+        // find or create port group again
+        group = PortGroupsTree_LookupExact(&port_groups_tree, 0, &key);
+        if (!group && !(group = port_group_init(key))) {
+            goto failed;
+        }
+        
         // try binding to its port
         BAddr bind_addr = local_addr;
         BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
         if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-            // remember which port we're using
-            con->local_port_index = i;
+            connection_port_group_insert(con, group, i);
             goto cont;
         }
         
+        if (PortGroupPortsTree_IsEmpty(&group->ports_tree)) {
+            port_group_free(group);
+        }
+        
     failed:
         client_log(client, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
     cont:;
-        BFree(port_usage);
     }
     
     // set UDP dgram send address
@@ -1109,9 +3470,20 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     BIPAddr_InitInvalid(&ipaddr);
     BDatagram_SetSendAddrs(&con->udp_dgram, addr, ipaddr);
     
+    // send through a connected socket; replies from other addresses are then dropped
+    if (options.udp_connect && !BDatagram_SetAutoConnect(&con->udp_dgram, 1)) {
+        connection_log(con, BLOG_WARNING, "BDatagram_SetAutoConnect failed");
+    }
+    
     // init UDP dgram interfaces
     BDatagram_SendAsync_Init(&con->udp_dgram, options.udp_mtu);
-    BDatagram_RecvAsync_Init(&con->udp_dgram, options.udp_mtu);
+    if (!BDatagram_RecvAsync_Init2(&con->udp_dgram, options.udp_mtu, options.udp_recv_batch)) {
+        client_log(client, BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
+        goto fail3;
+    }
+    
+    // drain bursts of datagrams without going back to the reactor
+    BDatagram_RecvAsync_SetLimit(&con->udp_dgram, CONNECTION_UDP_RECV_LIMIT);
     
     // init UDP writer
     BufferWriter_Init(&con->udp_send_writer, options.udp_mtu, BReactor_PendingGroup(&ss));
@@ -1136,10 +3508,23 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     
     // insert to client's connections list
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    con->last_used = BReactor_GetTime(&ss);
+    
+    // insert to client's idle list for the class of connection; echo
+    // exchanges are as short-lived as DNS ones
+    con->idle_class = ((is_dns || is_icmp || BAddr_GetPort(&orig_addr) == hton16(53)) ? IDLE_CLASS_DNS : IDLE_CLASS_OTHER);
+    LinkedList1_Append(&client->idle_lists[con->idle_class], &con->idle_list_node);
     
     // increment number of connections
     client->num_connections++;
     
+    // let DNS queries go through the cache
+    con->dns_serial = 0;
+    if (have_dns_cache && is_dns) {
+        con->dns_serial = next_dns_serial++;
+        ASSERT_EXECUTE(BAVL_Insert(&dns_connections_tree, &con->dns_connections_tree_node, NULL))
+    }
+    
     connection_log(con, BLOG_DEBUG, "initialized");
     
     return;
@@ -1150,6 +3535,10 @@ fail5:
 fail4:
     BufferWriter_Free(&con->udp_send_writer);
     BDatagram_RecvAsync_Free(&con->udp_dgram);
+fail3:
+    if (con->local_port_index >= 0) {
+        connection_port_group_remove(con);
+    }
     BDatagram_SendAsync_Free(&con->udp_dgram);
     BDatagram_Free(&con->udp_dgram);
 fail2:
@@ -1157,7 +3546,7 @@ fail2:
 fail1:
     PacketPassFairQueueFlow_Free(&con->send_qflow);
     BPending_Free(&con->first_job);
-    free(con);
+    BObjectPool_Release(&connections_pool, con);
 fail0:
     return;
 }
@@ -1177,6 +3566,9 @@ void connection_free (struct connection *con)
         // remove from client's connections list
         LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
         
+        // remove from client's idle list
+        LinkedList1_Remove(&client->idle_lists[con->idle_class], &con->idle_list_node);
+        
         // remove from client's connections tree
         BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
         
@@ -1194,7 +3586,7 @@ void connection_free (struct connection *con)
     BPending_Free(&con->first_job);
     
     // free structure
-    free(con);
+    BObjectPool_Release(&connections_pool, con);
 }
 
 void connection_logfunc (struct connection *con)
@@ -1218,6 +3610,16 @@ void connection_log (struct connection *con, int level, const char *fmt, ...)
 
 void connection_free_udp (struct connection *con)
 {
+    // remove from DNS connections tree
+    if (con->dns_serial) {
+        BAVL_Remove(&dns_connections_tree, &con->dns_connections_tree_node);
+    }
+    
+    // release local port
+    if (con->local_port_index >= 0) {
+        connection_port_group_remove(con);
+    }
+    
     // free UDP receive buffer
     SinglePacketBuffer_Free(&con->udp_recv_buffer);
     
@@ -1250,25 +3652,55 @@ void connection_send_to_client (struct connection *con, uint8_t flags, const uin
     ASSERT(data_len >= 0)
     ASSERT(data_len <= options.udp_mtu)
     
-    size_t addr_len = (con->orig_addr.type == BADDR_TYPE_IPV6) ? sizeof(struct udpgw_addr_ipv6) :
+    // reply over datagrams if the client sends over them
+    struct client *client = con->client;
+    int dgram = client->dgram_up && have_udp_listener;
+    
+    // once the client has seen the address, leave it out; a datagram may be
+    // lost, so it always carries the address
+    int compact = client->batching && con->addr_sent && !dgram;
+    
+    size_t addr_len = compact ? 0 :
+                      (con->orig_addr.type == BADDR_TYPE_IPV6) ? sizeof(struct udpgw_addr_ipv6) :
                       (con->orig_addr.type == BADDR_TYPE_IPV4) ? sizeof(struct udpgw_addr_ipv4) : 0;
     if (data_len > udpgw_mtu - (int)(sizeof(struct udpgw_header) + addr_len)) {
         connection_log(con, BLOG_WARNING, "packet is too large, cannot send to client");
+        BMetric_Add(&metric_drops_too_large, 1);
         return;
     }
     
     // get buffer location
+    BufferWriter *writer = (dgram ? &udp_listener_send_writer : con->send_if);
     uint8_t *out;
-    if (!BufferWriter_StartPacket(con->send_if, &out)) {
+    if (!BufferWriter_StartPacket(writer, &out)) {
         connection_log(con, BLOG_ERROR, "out of client buffer");
+        BMetric_Add(&metric_drops_client_buffer, 1);
         return;
     }
     int out_pos = 0;
     
+    // write destination and datagram header
+    if (dgram) {
+        memcpy(out + out_pos, &client->dgram_addr, sizeof(client->dgram_addr));
+        out_pos += sizeof(client->dgram_addr);
+        
+        struct udpgw_datagram_header dheader;
+        dheader.token = client->dgram_token;
+        memcpy(out + out_pos, &dheader, sizeof(dheader));
+        out_pos += sizeof(dheader);
+    }
+#ifndef NDEBUG
+    int msg_pos = out_pos;
+#endif
+    
     if (con->orig_addr.type == BADDR_TYPE_IPV6) {
         flags |= UDPGW_CLIENT_FLAG_IPV6;
     }
     
+    if (compact) {
+        flags |= UDPGW_CLIENT_FLAG_COMPACT;
+    }
+    
     // write header
     struct udpgw_header header;
     header.flags = htol8(flags);
@@ -1277,21 +3709,23 @@ void connection_send_to_client (struct connection *con, uint8_t flags, const uin
     out_pos += sizeof(header);
     
     // write address
-    switch (con->orig_addr.type) {
-        case BADDR_TYPE_IPV4: {
-            struct udpgw_addr_ipv4 addr_ipv4;
-            addr_ipv4.addr_ip = con->orig_addr.ipv4.ip;
-            addr_ipv4.addr_port = con->orig_addr.ipv4.port;
-            memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
-            out_pos += sizeof(addr_ipv4);
-        } break;
-        case BADDR_TYPE_IPV6: {
-            struct udpgw_addr_ipv6 addr_ipv6;
-            memcpy(addr_ipv6.addr_ip, con->orig_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
-            addr_ipv6.addr_port = con->orig_addr.ipv6.port;
-            memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
-            out_pos += sizeof(addr_ipv6);
-        } break;
+    if (!compact) {
+        switch (con->orig_addr.type) {
+            case BADDR_TYPE_IPV4: {
+                struct udpgw_addr_ipv4 addr_ipv4;
+                addr_ipv4.addr_ip = con->orig_addr.ipv4.ip;
+                addr_ipv4.addr_port = con->orig_addr.ipv4.port;
+                memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
+                out_pos += sizeof(addr_ipv4);
+            } break;
+            case BADDR_TYPE_IPV6: {
+                struct udpgw_addr_ipv6 addr_ipv6;
+                memcpy(addr_ipv6.addr_ip, con->orig_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
+                addr_ipv6.addr_port = con->orig_addr.ipv6.port;
+                memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
+                out_pos += sizeof(addr_ipv6);
+            } break;
+        }
     }
     
     // write message
@@ -1299,8 +3733,18 @@ void connection_send_to_client (struct connection *con, uint8_t flags, const uin
     out_pos += data_len;
     
     // submit written message
-    ASSERT(out_pos <= udpgw_mtu)
-    BufferWriter_EndPacket(con->send_if, out_pos);
+    ASSERT(out_pos - msg_pos <= udpgw_mtu)
+    BufferWriter_EndPacket(writer, out_pos);
+    
+    BMetric_Add(&metric_packets_to_client, 1);
+    BMetric_Add(&metric_bytes_to_client, data_len);
+    if (client->metrics) {
+        BMetric_Add(&client->metrics->packets_to_client, 1);
+        BMetric_Add(&client->metrics->bytes_to_client, data_len);
+    }
+    
+    // the client now knows the address
+    con->addr_sent = 1;
 }
 
 int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len)
@@ -1312,17 +3756,27 @@ int connection_send_to_udp (struct connection *con, const uint8_t *data, int dat
     
     connection_log(con, BLOG_DEBUG, "from client %d bytes", data_len);
     
-    // set last use time
-    con->last_use_time = btime_gettime();
-    
     // move connection to front
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    LinkedList1_Remove(&client->idle_lists[con->idle_class], &con->idle_list_node);
+    LinkedList1_Append(&client->idle_lists[con->idle_class], &con->idle_list_node);
+    con->last_used = BReactor_GetTime(&ss);
+    
+    // update port group LRU
+    connection_port_group_touch(con);
+    
+    // a DNS query may be answered from the cache, or wait for an identical one
+    if (con->dns_serial && DnsCache_SubmitQuery(&dns_cache, connection_dns_id(con), con->addr, data, data_len)) {
+        BMetric_Add(&metric_dns_cache_answers, 1);
+        return 1;
+    }
     
     // get buffer location
     uint8_t *out;
     if (!BufferWriter_StartPacket(&con->udp_send_writer, &out)) {
         connection_log(con, BLOG_ERROR, "out of UDP buffer");
+        BMetric_Add(&metric_drops_udp_buffer, 1);
         return 0;
     }
     
@@ -1332,6 +3786,13 @@ int connection_send_to_udp (struct connection *con, const uint8_t *data, int dat
     // submit written message
     BufferWriter_EndPacket(&con->udp_send_writer, data_len);
     
+    BMetric_Add(&metric_packets_to_udp, 1);
+    BMetric_Add(&metric_bytes_to_udp, data_len);
+    if (client->metrics) {
+        BMetric_Add(&client->metrics->packets_to_udp, 1);
+        BMetric_Add(&client->metrics->bytes_to_udp, data_len);
+    }
+    
     return 1;
 }
 
@@ -1354,6 +3815,9 @@ void connection_close (struct connection *con)
     // remove from client's connections list
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     
+    // remove from client's idle list
+    LinkedList1_Remove(&client->idle_lists[con->idle_class], &con->idle_list_node);
+    
     // remove from client's connections tree
     BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
     
@@ -1373,6 +3837,22 @@ void connection_close (struct connection *con)
     con->closing = 1;
 }
 
+void connection_send_forget (struct client *client, uint16_t conid)
+{
+    // at most one control packet is in flight; if one is, the client will send
+    // another compact message and be told then
+    if (client->control_sending) {
+        return;
+    }
+    
+    client->forget_packet.pp.len = htol16(sizeof(client->forget_packet.udpgw));
+    client->forget_packet.udpgw.flags = htol8(UDPGW_CLIENT_FLAG_REBIND);
+    client->forget_packet.udpgw.conid = htol16(conid);
+    
+    client->control_sending = 1;
+    PacketPassInterface_Sender_Send(PacketPassFairQueueFlow_GetInput(&client->control_qflow), (uint8_t *)&client->forget_packet, sizeof(client->forget_packet));
+}
+
 void connection_send_qflow_busy_handler (struct connection *con)
 {
     ASSERT(con->closing)
@@ -1403,18 +3883,26 @@ void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data,
     
     connection_log(con, BLOG_DEBUG, "from UDP %d bytes", data_len);
     
-    // set last use time
-    con->last_use_time = btime_gettime();
-    
     // move connection to front
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    LinkedList1_Remove(&client->idle_lists[con->idle_class], &con->idle_list_node);
+    LinkedList1_Append(&client->idle_lists[con->idle_class], &con->idle_list_node);
+    con->last_used = BReactor_GetTime(&ss);
+    
+    // update port group LRU
+    connection_port_group_touch(con);
     
     // accept packet
     PacketPassInterface_Done(&con->udp_recv_if);
     
+    // a DNS response goes to the cache, which answers every client waiting for it
+    if (con->dns_serial && DnsCache_SubmitResponse(&dns_cache, connection_dns_id(con), con->addr, data, data_len)) {
+        return;
+    }
+    
     // send packet to client
-    connection_send_to_client(con, 0, data, data_len);
+    connection_send_to_client(con, (con->is_icmp ? UDPGW_CLIENT_FLAG_ICMP : 0), data, data_len);
 }
 
 struct connection * find_connection (struct client *client, uint16_t conid)
@@ -1435,10 +3923,55 @@ int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
     return B_COMPARE(*v1, *v2);
 }
 
+int uint64_comparator (void *unused, uint64_t *v1, uint64_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
+BAddr connection_dns_id (struct connection *con)
+{
+    ASSERT(con->dns_serial)
+    
+    // the cache identifies clients by address; use the serial number, which
+    // unlike the conid is never reused for another connection
+    uint8_t ip[16];
+    memset(ip, 0, sizeof(ip));
+    memcpy(ip, &con->dns_serial, sizeof(con->dns_serial));
+    
+    BAddr addr;
+    BAddr_InitIPv6(&addr, ip, 0);
+    return addr;
+}
+
+void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    ASSERT(local_addr.type == BADDR_TYPE_IPV6)
+    
+    uint64_t serial;
+    memcpy(&serial, local_addr.ipv6.ip, sizeof(serial));
+    
+    // the connection may be gone by the time the response arrives
+    BAVLNode *tree_node = BAVL_LookupExact(&dns_connections_tree, &serial);
+    if (!tree_node) {
+        BLog(BLOG_DEBUG, "DNS response for a closed connection");
+        return;
+    }
+    struct connection *con = UPPER_OBJECT(tree_node, struct connection, dns_connections_tree_node);
+    ASSERT(con->dns_serial == serial)
+    
+    connection_send_to_client(con, 0, data, data_len);
+}
+
 void maybe_update_dns (void)
 {
+    // a configured DNS server overrides the system's
+    if (dns_server_addr.type != BADDR_TYPE_NONE) {
+        dns_addr = dns_server_addr;
+        return;
+    }
+    
 #ifndef BADVPN_USE_WINAPI
-    btime_t now = btime_gettime();
+    btime_t now = btime_gettime_coarse();
     if (now < btime_add(last_dns_update_time, DNS_UPDATE_TIME)) {
         return;
     }
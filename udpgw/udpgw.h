@@ -30,6 +30,12 @@
 // maxiumum listen addresses
 #define MAX_LISTEN_ADDRS 16
 
+// maximum number of --client-weight options
+#define MAX_CLIENT_WEIGHTS 16
+
+// maximum weight of a client
+#define MAX_CLIENT_WEIGHT 1000
+
 // maximum datagram size
 #define DEFAULT_UDP_MTU 65520
 
@@ -48,5 +54,48 @@
 // how long after nothing has been received to disconnect a client
 #define CLIENT_DISCONNECT_TIMEOUT 20000
 
+// with --memory-limit, how often to check whether idle connections need to be evicted
+#define MEMORY_PRESSURE_INTERVAL 1000
+
+// how long a connection must have been idle to be evicted under memory pressure
+#define MEMORY_EVICT_IDLE_TIME 5000
+
+// how long a connection may be idle before it is closed, by default; DNS
+// connections are mostly used for a single query
+#define DEFAULT_CONNECTION_IDLE_TIMEOUT 120000
+#define DEFAULT_DNS_CONNECTION_IDLE_TIMEOUT 10000
+
+// with --handoff-socket, how long the old process keeps serving its clients
+// after handing over its listeners, by default
+#define DEFAULT_HANDOFF_DRAIN_TIMEOUT 60000
+
+// how often idle connections are looked for, and how many are closed before
+// letting other events be handled
+#define CONNECTION_IDLE_REAP_INTERVAL 1000
+#define CONNECTION_IDLE_REAP_BATCH 64
+
+// how many datagrams a connection may receive per reactor iteration
+#define CONNECTION_UDP_RECV_LIMIT 16
+
+// size of buffer in which packets to a client are coalesced into larger writes
+#define CLIENT_SEND_COALESCE_SIZE 16384
+
+// size of buffer into which data from a client is received
+#define CLIENT_RECV_BUFFER_SIZE 32768
+
+// number of connection structures allocated at once
+#define CONNECTION_POOL_SLAB_SIZE 64
+
+// number of port group structures allocated at once
+#define PORT_GROUP_POOL_SLAB_SIZE 64
+
+// number of datagrams to clients buffered by the datagram transport
+#define UDP_LISTENER_SEND_BUFFER_SIZE 64
+
 // SO_SNDBFUF socket option for clients, 0 to not set
 #define CLIENT_DEFAULT_SOCKET_SEND_BUFFER 1048576
+
+// Max number of messages logged per interval by each call site which
+// logs per packet, so that a misbehaving client cannot flood the log
+#define PACKET_LOG_RATELIMIT_INTERVAL 10000
+#define PACKET_LOG_RATELIMIT_BURST 10
@@ -0,0 +1,11 @@
+#define SAVL_PARAM_NAME PortGroupPortsTree
+#define SAVL_PARAM_FEATURE_COUNTS 1
+#define SAVL_PARAM_FEATURE_NOKEYS 0
+#define SAVL_PARAM_TYPE_ENTRY struct connection
+#define SAVL_PARAM_TYPE_KEY int
+#define SAVL_PARAM_TYPE_ARG int
+#define SAVL_PARAM_TYPE_COUNT int
+#define SAVL_PARAM_VALUE_COUNT_MAX INT_MAX
+#define SAVL_PARAM_FUN_COMPARE_ENTRIES(arg, entry1, entry2) B_COMPARE((entry1)->local_port_index, (entry2)->local_port_index)
+#define SAVL_PARAM_FUN_COMPARE_KEY_ENTRY(arg, key1, entry2) B_COMPARE((key1), (entry2)->local_port_index)
+#define SAVL_PARAM_MEMBER_NODE port_group_ports_tree_node
@@ -0,0 +1,9 @@
+#define SAVL_PARAM_NAME PortGroupsTree
+#define SAVL_PARAM_FEATURE_COUNTS 0
+#define SAVL_PARAM_FEATURE_NOKEYS 0
+#define SAVL_PARAM_TYPE_ENTRY struct port_group
+#define SAVL_PARAM_TYPE_KEY PortGroupsTree_key
+#define SAVL_PARAM_TYPE_ARG int
+#define SAVL_PARAM_FUN_COMPARE_ENTRIES(arg, entry1, entry2) BFlowAddr_CompareOrder(&(entry1)->key, &(entry2)->key)
+#define SAVL_PARAM_FUN_COMPARE_KEY_ENTRY(arg, key1, entry2) BFlowAddr_CompareOrder((key1), &(entry2)->key)
+#define SAVL_PARAM_MEMBER_NODE groups_tree_node
@@ -27,83 +27,288 @@
  */
 
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 
 #include <misc/offset.h>
 #include <misc/byteorder.h>
-#include <misc/compare.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
 #include <base/BLog.h>
 
 #include <udpgw_client/UdpGwClient.h>
 
 #include <generated/blog_channel_UdpGwClient.h>
 
-static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
-static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2);
-static void free_server (UdpGwClient *o);
-static void decoder_handler_error (UdpGwClient *o);
-static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data_len);
-static void send_monitor_handler (UdpGwClient *o);
-static void keepalive_if_handler_done (UdpGwClient *o);
+static size_t conaddr_hash (struct UdpGwClient_conaddr *conaddr);
+static int conaddr_equal (struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2);
+
+#include "UdpGwClient_hash.h"
+#include <structure/CHash_impl.h>
+
+static int server_init (struct UdpGwClient_server *s, UdpGwClient *o, int index);
+static void server_free (struct UdpGwClient_server *s);
+static void free_server (struct UdpGwClient_server *s);
+static struct UdpGwClient_server * choose_server (UdpGwClient *o);
+static void decoder_handler_error (struct UdpGwClient_server *s);
+static void recv_interface_handler_send (struct UdpGwClient_server *s, uint8_t *data, int data_len);
+static void recv_interface_handler_send_batch (struct UdpGwClient_server *s, struct PacketPassInterface_packet *packets, int num_packets);
+static void process_packet (struct UdpGwClient_server *s, const uint8_t *data, int data_len);
+static void process_message (struct UdpGwClient_server *s, const uint8_t *data, int data_len);
+static void send_monitor_handler (struct UdpGwClient_server *s);
+static void keepalive_if_handler_done (struct UdpGwClient_server *s);
+static void dgram_send_keepalive (struct UdpGwClient_server *s);
+static void dgram_timer_handler (struct UdpGwClient_server *s);
+static void dgram_recv_if_handler_send (struct UdpGwClient_server *s, uint8_t *data, int data_len);
 static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr);
 static struct UdpGwClient_connection * find_connection_by_conid (UdpGwClient *o, uint16_t conid);
 static uint16_t find_unused_conid (UdpGwClient *o);
 static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr, uint8_t flags, const uint8_t *data, int data_len);
+static void connection_unlink (struct UdpGwClient_connection *con);
 static void connection_free (struct UdpGwClient_connection *con);
 static void connection_first_job_handler (struct UdpGwClient_connection *con);
 static void connection_send (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len);
+static int connection_move (struct UdpGwClient_connection *con, struct UdpGwClient_server *s);
 static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct UdpGwClient_conaddr conaddr);
+static void deliver_packet (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len);
+static void submit_packet (UdpGwClient *o, struct UdpGwClient_conaddr conaddr, uint8_t flags, const uint8_t *data, int data_len);
+
+static size_t conaddr_hash (struct UdpGwClient_conaddr *conaddr)
+{
+    return BFlowAddr_HashPair(&conaddr->remote_addr, &conaddr->local_addr) + conaddr->is_icmp;
+}
+
+static int conaddr_equal (struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2)
+{
+    return BFlowAddr_Equal(&v1->remote_addr, &v2->remote_addr) & BFlowAddr_Equal(&v1->local_addr, &v2->local_addr) & (v1->is_icmp == v2->is_icmp);
+}
+
+static struct UdpGwClient_conaddr make_conaddr (BAddr local_addr, BAddr remote_addr, int is_icmp)
+{
+    struct UdpGwClient_conaddr conaddr;
+    conaddr.local_addr = BFlowAddr_FromBAddr(&local_addr);
+    conaddr.remote_addr = BFlowAddr_FromBAddr(&remote_addr);
+    conaddr.is_icmp = is_icmp;
+    return conaddr;
+}
+
+static UdpGwClientHashRef conaddr_hash_ref (struct UdpGwClient_connection *con)
+{
+    UdpGwClientHashRef ref = {con, con};
+    return ref;
+}
 
-static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
+static int server_init (struct UdpGwClient_server *s, UdpGwClient *o, int index)
 {
-    return B_COMPARE(*v1, *v2);
+    // init arguments
+    s->client = o;
+    s->index = index;
+    
+    // set zero connections
+    s->num_connections = 0;
+    
+    // init send connector
+    PacketPassConnector_Init(&s->send_connector, o->pp_mtu, BReactor_PendingGroup(o->reactor));
+    
+    // init send rate limiter, not limiting until UdpGwClient_SetSendRate
+    PacketPassRateLimiter_Init(&s->send_limiter, PacketPassConnector_GetInput(&s->send_connector), o->reactor, 0, 0);
+    
+    // init send monitor
+    PacketPassInactivityMonitor_Init(&s->send_monitor, PacketPassRateLimiter_GetInput(&s->send_limiter), o->reactor, o->keepalive_time, (PacketPassInactivityMonitor_handler)send_monitor_handler, s);
+    
+    // init send queue; O(1) scheduling, as there may be many connections
+    if (!PacketPassFairQueue_InitDRR(&s->send_queue, PacketPassInactivityMonitor_GetInput(&s->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1)) {
+        goto fail0;
+    }
+    
+    // init keepalive queue flow
+    PacketPassFairQueueFlow_Init(&s->keepalive_qflow, &s->send_queue);
+    s->keepalive_if = PacketPassFairQueueFlow_GetInput(&s->keepalive_qflow);
+    
+    // init keepalive output
+    PacketPassInterface_Sender_Init(s->keepalive_if, (PacketPassInterface_handler_done)keepalive_if_handler_done, s);
+    
+    // set not sending keepalive
+    s->keepalive_sending = 0;
+    
+    // set no hello pending
+    s->hello_pending = 0;
+    
+    // set have no server
+    s->have_server = 0;
+    
+    // set no server generation yet
+    s->generation = 0;
+    
+    // set not batching, and no ICMP relay
+    s->batching = 0;
+    s->icmp = 0;
+    
+    // set no datagram transport
+    s->have_dgram_offer = 0;
+    s->have_dgram = 0;
+    s->dgram_up = 0;
+    
+    // init datagram probe timer
+    BTimer_Init(&s->dgram_timer, UDPGW_DATAGRAM_PROBE_INTERVAL, (BTimer_handler)dgram_timer_handler, s);
+    
+    return 1;
+    
+fail0:
+    PacketPassInactivityMonitor_Free(&s->send_monitor);
+    PacketPassRateLimiter_Free(&s->send_limiter);
+    PacketPassConnector_Free(&s->send_connector);
+    return 0;
 }
 
-static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2)
+static void server_free (struct UdpGwClient_server *s)
 {
-    int r = BAddr_CompareOrder(&v1->remote_addr, &v2->remote_addr);
-    if (r) {
-        return r;
+    ASSERT(s->num_connections == 0)
+    ASSERT(!s->have_dgram)
+    
+    // free datagram timer
+    BReactor_RemoveTimer(s->client->reactor, &s->dgram_timer);
+    
+    // free server
+    if (s->have_server) {
+        free_server(s);
     }
-    return BAddr_CompareOrder(&v1->local_addr, &v2->local_addr);
+    
+    // free keepalive queue flow
+    PacketPassFairQueueFlow_Free(&s->keepalive_qflow);
+    
+    // free send queue
+    PacketPassFairQueue_Free(&s->send_queue);
+    
+    // free send monitor
+    PacketPassInactivityMonitor_Free(&s->send_monitor);
+    
+    // free send rate limiter
+    PacketPassRateLimiter_Free(&s->send_limiter);
+    
+    // free send connector
+    PacketPassConnector_Free(&s->send_connector);
 }
 
-static void free_server (UdpGwClient *o)
+static void free_server (struct UdpGwClient_server *s)
 {
     // disconnect send connector
-    PacketPassConnector_DisconnectOutput(&o->send_connector);
+    PacketPassConnector_DisconnectOutput(&s->send_connector);
+    
+    // free send batcher
+    PacketProtoBatcher_Free(&s->send_batcher);
     
     // free send sender
-    PacketStreamSender_Free(&o->send_sender);
+    PacketStreamSender_Free(&s->send_sender);
     
     // free receive decoder
-    PacketProtoDecoder_Free(&o->recv_decoder);
+    PacketProtoDecoder_Free(&s->recv_decoder);
     
     // free receive interface
-    PacketPassInterface_Free(&o->recv_if);
+    PacketPassInterface_Free(&s->recv_if);
 }
 
-static void decoder_handler_error (UdpGwClient *o)
+static struct UdpGwClient_server * choose_server (UdpGwClient *o)
 {
+    // prefer the connected server with the fewest connections, so that flows
+    // are spread evenly and don't queue up behind a server that is down
+    struct UdpGwClient_server *best = &o->servers[0];
+    
+    for (int i = 1; i < o->num_servers; i++) {
+        struct UdpGwClient_server *s = &o->servers[i];
+        if (s->have_server != best->have_server ? s->have_server : s->num_connections < best->num_connections) {
+            best = s;
+        }
+    }
+    
+    return best;
+}
+
+static void decoder_handler_error (struct UdpGwClient_server *s)
+{
+    UdpGwClient *o = s->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_server)
+    ASSERT(s->have_server)
     
     BLog(BLOG_ERROR, "decoder error");
     
     // report error
-    o->handler_servererror(o->user);
+    o->handler_servererror(o->user, s->index);
     return;
 }
 
-static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data_len)
+static void recv_interface_handler_send (struct UdpGwClient_server *s, uint8_t *data, int data_len)
 {
+    UdpGwClient *o = s->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_server)
+    ASSERT(s->have_server)
     ASSERT(data_len >= 0)
-    ASSERT(data_len <= o->udpgw_mtu)
     
     // accept packet
-    PacketPassInterface_Done(&o->recv_if);
+    PacketPassInterface_Done(&s->recv_if);
+    
+    process_packet(s, data, data_len);
+}
+
+static void recv_interface_handler_send_batch (struct UdpGwClient_server *s, struct PacketPassInterface_packet *packets, int num_packets)
+{
+    UdpGwClient *o = s->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(s->have_server)
+    ASSERT(num_packets > 0)
+    
+    // accept packets
+    PacketPassInterface_Done(&s->recv_if);
+    
+    for (int i = 0; i < num_packets; i++) {
+        process_packet(s, packets[i].data, packets[i].len);
+    }
+}
+
+static void process_packet (struct UdpGwClient_server *s, const uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    
+    // a batch carries PacketProto-encoded messages after its header
+    if (udpgw_is_batch(data, data_len)) {
+        data += sizeof(struct udpgw_header);
+        data_len -= sizeof(struct udpgw_header);
+        
+        while (data_len > 0) {
+            struct packetproto_header pp;
+            if (data_len < sizeof(pp)) {
+                BLog(BLOG_ERROR, "batch: missing message header");
+                return;
+            }
+            memcpy(&pp, data, sizeof(pp));
+            data += sizeof(pp);
+            data_len -= sizeof(pp);
+            int len = ltoh16(pp.len);
+            if (len > data_len) {
+                BLog(BLOG_ERROR, "batch: message too long");
+                return;
+            }
+            
+            process_message(s, data, len);
+            
+            data += len;
+            data_len -= len;
+        }
+        return;
+    }
+    
+    process_message(s, data, data_len);
+}
+
+static void process_message (struct UdpGwClient_server *s, const uint8_t *data, int data_len)
+{
+    UdpGwClient *o = s->client;
+    ASSERT(data_len >= 0)
+    
+    if (data_len > o->udpgw_mtu) {
+        BLog(BLOG_ERROR, "message too long");
+        return;
+    }
     
     // check header
     if (data_len < sizeof(struct udpgw_header)) {
@@ -117,6 +322,75 @@ static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data
     uint8_t flags = ltoh8(header.flags);
     uint16_t conid = ltoh16(header.conid);
     
+    // a keepalive from the server acknowledges batching, and may offer the
+    // datagram transport
+    if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
+        if ((flags & UDPGW_CLIENT_FLAG_BATCH) && !s->batching) {
+            BLog(BLOG_INFO, "server supports batching (connection %d)", s->index);
+            s->batching = 1;
+            PacketProtoBatcher_Enable(&s->send_batcher);
+        }
+        if ((flags & UDPGW_CLIENT_FLAG_ICMP) && o->handler_icmp && !s->icmp) {
+            BLog(BLOG_INFO, "server relays ICMP echo (connection %d)", s->index);
+            s->icmp = 1;
+        }
+        if ((flags & UDPGW_CLIENT_FLAG_DATAGRAM) && o->handler_datagram && !s->have_dgram && data_len >= sizeof(struct udpgw_datagram_offer)) {
+            struct udpgw_datagram_offer offer;
+            memcpy(&offer, data, sizeof(offer));
+            
+            BLog(BLOG_INFO, "server offers datagram transport (connection %d)", s->index);
+            
+            s->have_dgram_offer = 1;
+            s->dgram_token = offer.token;
+            
+            // let the user open a socket and call UdpGwClient_ConnectDatagram
+            o->handler_datagram(o->user, s->index, offer.port);
+            
+            // if that failed, ask again later
+            if (!s->have_dgram) {
+                BReactor_SetTimerAfter(o->reactor, &s->dgram_timer, UDPGWCLIENT_DATAGRAM_RETRY_TIME);
+            }
+        }
+        return;
+    }
+    
+    if ((flags & UDPGW_CLIENT_FLAG_BATCH)) {
+        BLog(BLOG_ERROR, "nested batch");
+        return;
+    }
+    
+    // the server forgot a connection; send the address with its next message
+    if ((flags & UDPGW_CLIENT_FLAG_REBIND)) {
+        struct UdpGwClient_connection *con = find_connection_by_conid(o, conid);
+        if (con && con->server == s) {
+            BLog(BLOG_INFO, "server forgot connection %"PRIu16, conid);
+            con->addr_sent_generation = 0;
+        }
+        return;
+    }
+    
+    // compact messages are for the address the server last sent in full
+    if ((flags & UDPGW_CLIENT_FLAG_COMPACT)) {
+        if (data_len > o->udp_mtu) {
+            BLog(BLOG_ERROR, "too much data");
+            return;
+        }
+        struct UdpGwClient_connection *con = find_connection_by_conid(o, conid);
+        if (!con || !con->addr_received) {
+            BLog(BLOG_ERROR, "compact message for unknown conid");
+            return;
+        }
+        
+        // move connection to front of the list
+        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+        con->last_used = BReactor_GetTime(o->reactor);
+        
+        // pass packet to user
+        deliver_packet(con, flags, data, data_len);
+        return;
+    }
+    
     // parse address
     BAddr remote_addr;
     if ((flags & UDPGW_CLIENT_FLAG_IPV6)) {
@@ -155,64 +429,148 @@ static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data
     }
     
     // check remote address
-    if (BAddr_CompareOrder(&con->conaddr.remote_addr, &remote_addr) != 0) {
+    BFlowAddr remote_key = BFlowAddr_FromBAddr(&remote_addr);
+    if (!BFlowAddr_Equal(&con->conaddr.remote_addr, &remote_key)) {
         BLog(BLOG_ERROR, "wrong remote address");
         return;
     }
     
+    // the server may now omit the address
+    con->addr_received = 1;
+    
     // move connection to front of the list
     LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
     LinkedList1_Append(&o->connections_list, &con->connections_list_node);
     
     // pass packet to user
-    o->handler_received(o->user, con->conaddr.local_addr, con->conaddr.remote_addr, data, data_len);
+    deliver_packet(con, flags, data, data_len);
     return;
 }
 
-static void send_monitor_handler (UdpGwClient *o)
+static void send_monitor_handler (struct UdpGwClient_server *s)
 {
+    UdpGwClient *o = s->client;
     DebugObject_Access(&o->d_obj);
     
-    if (o->keepalive_sending) {
+    if (s->keepalive_sending) {
         return;
     }
     
     BLog(BLOG_INFO, "keepalive");
     
     // send keepalive
-    PacketPassInterface_Sender_Send(o->keepalive_if, (uint8_t *)&o->keepalive_packet, sizeof(o->keepalive_packet));
+    PacketPassInterface_Sender_Send(s->keepalive_if, (uint8_t *)&o->keepalive_packet, sizeof(o->keepalive_packet));
     
     // set sending keep-alive
-    o->keepalive_sending = 1;
+    s->keepalive_sending = 1;
 }
 
-static void keepalive_if_handler_done (UdpGwClient *o)
+static void keepalive_if_handler_done (struct UdpGwClient_server *s)
 {
-    DebugObject_Access(&o->d_obj);
-    ASSERT(o->keepalive_sending)
+    DebugObject_Access(&s->client->d_obj);
+    ASSERT(s->keepalive_sending)
     
     // set not sending keepalive
-    o->keepalive_sending = 0;
+    s->keepalive_sending = 0;
+    
+    // send hello which had to wait for the keepalive
+    if (s->hello_pending) {
+        PacketPassInterface_Sender_Send(s->keepalive_if, (uint8_t *)&s->client->hello_packet, sizeof(s->client->hello_packet));
+        s->keepalive_sending = 1;
+        s->hello_pending = 0;
+    }
 }
 
-static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
+static void dgram_send_keepalive (struct UdpGwClient_server *s)
 {
-    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conaddr, &conaddr);
-    if (!tree_node) {
-        return NULL;
+    ASSERT(s->have_dgram)
+    
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(&s->dgram_send_writer, &out)) {
+        return;
+    }
+    
+    struct udpgw_datagram_header dheader;
+    dheader.token = s->dgram_token;
+    memcpy(out, &dheader, sizeof(dheader));
+    memcpy(out + sizeof(dheader), &s->client->keepalive_packet.udpgw, sizeof(s->client->keepalive_packet.udpgw));
+    
+    BufferWriter_EndPacket(&s->dgram_send_writer, sizeof(dheader) + sizeof(s->client->keepalive_packet.udpgw));
+}
+
+static void dgram_timer_handler (struct UdpGwClient_server *s)
+{
+    UdpGwClient *o = s->client;
+    DebugObject_Access(&o->d_obj);
+    
+    // without the datagram transport, ask the server to offer it again; the
+    // keepalive asks for it
+    if (!s->have_dgram) {
+        ASSERT(s->have_server)
+        if (s->keepalive_sending) {
+            BReactor_SetTimer(o->reactor, &s->dgram_timer);
+            return;
+        }
+        PacketPassInterface_Sender_Send(s->keepalive_if, (uint8_t *)&o->keepalive_packet, sizeof(o->keepalive_packet));
+        s->keepalive_sending = 1;
+        return;
+    }
+    
+    // stop sending over datagrams if the server stopped answering
+    if (s->dgram_up && BReactor_GetTime(o->reactor) - s->dgram_last_recv >= UDPGW_DATAGRAM_CLIENT_TIMEOUT) {
+        BLog(BLOG_INFO, "datagram transport down, sending over the stream (connection %d)", s->index);
+        s->dgram_up = 0;
+    }
+    
+    // probe the path
+    dgram_send_keepalive(s);
+    
+    BReactor_SetTimer(o->reactor, &s->dgram_timer);
+}
+
+static void dgram_recv_if_handler_send (struct UdpGwClient_server *s, uint8_t *data, int data_len)
+{
+    UdpGwClient *o = s->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(s->have_dgram)
+    ASSERT(data_len >= 0)
+    
+    // accept packet
+    PacketPassInterface_Done(&s->dgram_recv_if);
+    
+    // drop datagrams which don't carry our token
+    struct udpgw_datagram_header dheader;
+    if (data_len < sizeof(dheader)) {
+        return;
     }
+    memcpy(&dheader, data, sizeof(dheader));
+    if (dheader.token != s->dgram_token) {
+        return;
+    }
+    
+    s->dgram_last_recv = BReactor_GetTime(o->reactor);
     
-    return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conaddr_node);
+    if (!s->dgram_up) {
+        BLog(BLOG_INFO, "datagram transport up (connection %d)", s->index);
+        s->dgram_up = 1;
+    }
+    
+    process_message(s, data + sizeof(dheader), data_len - sizeof(dheader));
+}
+
+static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
+{
+    return UdpGwClientHash_Lookup(&o->connections_hash_by_conaddr, 0, &conaddr).ptr;
 }
 
 static struct UdpGwClient_connection * find_connection_by_conid (UdpGwClient *o, uint16_t conid)
 {
-    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conid, &conid);
-    if (!tree_node) {
+    // conids are allocated below max_connections, but the server may send anything
+    if (conid >= o->max_connections) {
         return NULL;
     }
     
-    return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conid_node);
+    return o->connections_by_conid[conid];
 }
 
 static uint16_t find_unused_conid (UdpGwClient *o)
@@ -248,6 +606,7 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     
     // init arguments
     con->client = o;
+    con->server = choose_server(o);
     con->conaddr = conaddr;
     con->first_flags = flags;
     con->first_data = data;
@@ -256,34 +615,51 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     // allocate conid
     con->conid = find_unused_conid(o);
     
+    // no address exchanged yet
+    con->addr_sent_generation = 0;
+    con->addr_received = 0;
+    
     // init first job
     BPending_Init(&con->first_job, BReactor_PendingGroup(o->reactor), (BPending_handler)connection_first_job_handler, con);
     BPending_Set(&con->first_job);
     
+    con->last_used = BReactor_GetTime(o->reactor);
+    
     // init queue flow
-    PacketPassFairQueueFlow_Init(&con->send_qflow, &o->send_queue);
+    PacketPassFairQueueFlow_Init(&con->send_qflow, &con->server->send_queue);
     
     // init PacketProtoFlow
     if (!PacketProtoFlow_Init(&con->send_ppflow, o->udpgw_mtu, o->send_buffer_size, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(o->reactor))) {
         BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
         goto fail1;
     }
+    
+    // drop packets which have been waiting too long
+    if (o->codel_target > 0 && !PacketProtoFlow_EnableCoDel(&con->send_ppflow, o->codel_target, o->codel_interval)) {
+        BLog(BLOG_ERROR, "PacketProtoFlow_EnableCoDel failed");
+        goto fail2;
+    }
+    
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
-    // insert to connections tree by conaddr
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
+    // insert to connections hash table by conaddr
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
+    ASSERT_EXECUTE(UdpGwClientHash_Insert(&o->connections_hash_by_conaddr, 0, conaddr_hash_ref(con), NULL))
     
-    // insert to connections tree by conid
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node, NULL))
+    // insert to connections array by conid
+    o->connections_by_conid[con->conid] = con;
     
     // insert to connections list
     LinkedList1_Append(&o->connections_list, &con->connections_list_node);
     
     // increment number of connections
     o->num_connections++;
+    con->server->num_connections++;
     
     return;
     
+fail2:
+    PacketProtoFlow_Free(&con->send_ppflow);
 fail1:
     PacketPassFairQueueFlow_Free(&con->send_qflow);
     BPending_Free(&con->first_job);
@@ -292,24 +668,33 @@ fail0:
     return;
 }
 
-static void connection_free (struct UdpGwClient_connection *con)
+static void connection_unlink (struct UdpGwClient_connection *con)
 {
     UdpGwClient *o = con->client;
-    PacketPassFairQueueFlow_AssertFree(&con->send_qflow);
     
     // decrement number of connections
     o->num_connections--;
+    con->server->num_connections--;
     
     // remove from connections list
     LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
     
-    // remove from connections tree by conid
-    BAVL_Remove(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node);
+    // remove from connections array by conid
+    o->connections_by_conid[con->conid] = NULL;
+    
+    // remove from connections hash table by conaddr
+    UdpGwClientHash_Remove(&o->connections_hash_by_conaddr, 0, conaddr_hash_ref(con));
+}
+
+static void connection_free (struct UdpGwClient_connection *con)
+{
+    PacketPassFairQueueFlow_AssertFree(&con->send_qflow);
     
-    // remove from connections tree by conaddr
-    BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
+    // unlink connection
+    connection_unlink(con);
     
     // free PacketProtoFlow
+    con->client->codel_drops += PacketProtoFlow_GetCoDelDrops(&con->send_ppflow);
     PacketProtoFlow_Free(&con->send_ppflow);
     
     // free queue flow
@@ -334,18 +719,44 @@ static void connection_send (struct UdpGwClient_connection *con, uint8_t flags,
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->udp_mtu)
     
+    // send over the datagram transport while it works, bypassing the queue
+    struct UdpGwClient_server *s = con->server;
+    int dgram = s->dgram_up;
+    BufferWriter *writer = (dgram ? &s->dgram_send_writer : con->send_if);
+    
     // get buffer location
     uint8_t *out;
-    if (!BufferWriter_StartPacket(con->send_if, &out)) {
+    if (!BufferWriter_StartPacket(writer, &out)) {
         BLog(BLOG_ERROR, "out of buffer");
         return;
     }
     int out_pos = 0;
     
+    // write token
+    if (dgram) {
+        struct udpgw_datagram_header dheader;
+        dheader.token = s->dgram_token;
+        memcpy(out + out_pos, &dheader, sizeof(dheader));
+        out_pos += sizeof(dheader);
+    }
+    
     if (con->conaddr.remote_addr.type == BADDR_TYPE_IPV6) {
         flags |= UDPGW_CLIENT_FLAG_IPV6;
     }
     
+    if (con->conaddr.is_icmp) {
+        flags |= UDPGW_CLIENT_FLAG_ICMP;
+    }
+    
+    // once the server has seen the address over this connection, leave it out;
+    // datagrams may be lost, so they always carry it
+    int compact = !dgram && s->batching && !(flags & UDPGW_CLIENT_FLAG_REBIND) && con->addr_sent_generation == s->generation;
+    if (compact) {
+        flags |= UDPGW_CLIENT_FLAG_COMPACT;
+    } else if (!dgram) {
+        con->addr_sent_generation = s->generation;
+    }
+    
     // write header
     struct udpgw_header header;
     header.flags = ltoh8(flags);
@@ -354,21 +765,23 @@ static void connection_send (struct UdpGwClient_connection *con, uint8_t flags,
     out_pos += sizeof(header);
     
     // write address
-    switch (con->conaddr.remote_addr.type) {
-        case BADDR_TYPE_IPV4: {
-            struct udpgw_addr_ipv4 addr_ipv4;
-            addr_ipv4.addr_ip = con->conaddr.remote_addr.ipv4.ip;
-            addr_ipv4.addr_port = con->conaddr.remote_addr.ipv4.port;
-            memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
-            out_pos += sizeof(addr_ipv4);
-        } break;
-        case BADDR_TYPE_IPV6: {
-            struct udpgw_addr_ipv6 addr_ipv6;
-            memcpy(addr_ipv6.addr_ip, con->conaddr.remote_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
-            addr_ipv6.addr_port = con->conaddr.remote_addr.ipv6.port;
-            memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
-            out_pos += sizeof(addr_ipv6);
-        } break;
+    if (!compact) {
+        switch (con->conaddr.remote_addr.type) {
+            case BADDR_TYPE_IPV4: {
+                struct udpgw_addr_ipv4 addr_ipv4;
+                memcpy(&addr_ipv4.addr_ip, con->conaddr.remote_addr.ip, sizeof(addr_ipv4.addr_ip));
+                addr_ipv4.addr_port = con->conaddr.remote_addr.port;
+                memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
+                out_pos += sizeof(addr_ipv4);
+            } break;
+            case BADDR_TYPE_IPV6: {
+                struct udpgw_addr_ipv6 addr_ipv6;
+                memcpy(addr_ipv6.addr_ip, con->conaddr.remote_addr.ip, sizeof(addr_ipv6.addr_ip));
+                addr_ipv6.addr_port = con->conaddr.remote_addr.port;
+                memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
+                out_pos += sizeof(addr_ipv6);
+            } break;
+        }
     }
     
     // write packet to buffer
@@ -376,7 +789,58 @@ static void connection_send (struct UdpGwClient_connection *con, uint8_t flags,
     out_pos += data_len;
     
     // submit packet to buffer
-    BufferWriter_EndPacket(con->send_if, out_pos);
+    BufferWriter_EndPacket(writer, out_pos);
+}
+
+static int connection_move (struct UdpGwClient_connection *con, struct UdpGwClient_server *s)
+{
+    UdpGwClient *o = con->client;
+    ASSERT(s != con->server)
+    ASSERT(!PacketPassFairQueueFlow_IsBusy(&con->send_qflow))
+    
+    // free PacketProtoFlow, dropping packets queued for the old server
+    o->codel_drops += PacketProtoFlow_GetCoDelDrops(&con->send_ppflow);
+    PacketProtoFlow_Free(&con->send_ppflow);
+    
+    // free queue flow
+    PacketPassFairQueueFlow_Free(&con->send_qflow);
+    
+    // move to new server
+    con->server->num_connections--;
+    con->server = s;
+    s->num_connections++;
+    
+    // the new server doesn't know the address
+    con->addr_sent_generation = 0;
+    con->addr_received = 0;
+    
+    // init queue flow
+    PacketPassFairQueueFlow_Init(&con->send_qflow, &s->send_queue);
+    
+    // init PacketProtoFlow
+    if (!PacketProtoFlow_Init(&con->send_ppflow, o->udpgw_mtu, o->send_buffer_size, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
+        goto fail0;
+    }
+    
+    // drop packets which have been waiting too long
+    if (o->codel_target > 0 && !PacketProtoFlow_EnableCoDel(&con->send_ppflow, o->codel_target, o->codel_interval)) {
+        BLog(BLOG_ERROR, "PacketProtoFlow_EnableCoDel failed");
+        goto fail1;
+    }
+    
+    con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
+    
+    return 1;
+    
+fail1:
+    PacketProtoFlow_Free(&con->send_ppflow);
+fail0:
+    connection_unlink(con);
+    PacketPassFairQueueFlow_Free(&con->send_qflow);
+    BPending_Free(&con->first_job);
+    free(con);
+    return 0;
 }
 
 static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
@@ -387,19 +851,82 @@ static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct
     // get least recently used connection
     struct UdpGwClient_connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct UdpGwClient_connection, connections_list_node);
     
-    // remove from connections tree by conaddr
-    BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
+    // remove from connections hash table by conaddr
+    UdpGwClientHash_Remove(&o->connections_hash_by_conaddr, 0, conaddr_hash_ref(con));
     
     // set new conaddr
     con->conaddr = conaddr;
     
-    // insert to connections tree by conaddr
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
+    // the server doesn't know the new address
+    con->addr_sent_generation = 0;
+    con->addr_received = 0;
+    
+    // insert to connections hash table by conaddr
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
+    ASSERT_EXECUTE(UdpGwClientHash_Insert(&o->connections_hash_by_conaddr, 0, conaddr_hash_ref(con), NULL))
     
     return con;
 }
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+static void deliver_packet (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len)
+{
+    UdpGwClient *o = con->client;
+    
+    // a reply meant for what the conid was bound to before
+    if (!!(flags & UDPGW_CLIENT_FLAG_ICMP) != con->conaddr.is_icmp) {
+        BLog(BLOG_INFO, "message of wrong kind for conid %"PRIu16, con->conid);
+        return;
+    }
+    
+    BAddr local_addr = BFlowAddr_ToBAddr(&con->conaddr.local_addr);
+    BAddr remote_addr = BFlowAddr_ToBAddr(&con->conaddr.remote_addr);
+    
+    if (con->conaddr.is_icmp) {
+        o->handler_icmp(o->user, local_addr, remote_addr, data, data_len);
+    } else {
+        o->handler_received(o->user, local_addr, remote_addr, data, data_len);
+    }
+}
+
+static void submit_packet (UdpGwClient *o, struct UdpGwClient_conaddr conaddr, uint8_t flags, const uint8_t *data, int data_len)
+{
+    // lookup connection
+    struct UdpGwClient_connection *con = find_connection_by_conaddr(o, conaddr);
+    
+    // if no connection and can't create a new one, or shouldn't, reuse the
+    // least recently used une
+    if (!con && (o->num_connections == o->max_connections || (!o->admit_new && o->num_connections > 0))) {
+        con = reuse_connection(o, conaddr);
+        flags |= UDPGW_CLIENT_FLAG_REBIND;
+    }
+    
+    // move a connection whose server is down to one that is up; the new
+    // server doesn't know its conid yet
+    if (con && !con->server->have_server && !PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
+        struct UdpGwClient_server *s = choose_server(o);
+        if (s->have_server) {
+            if (!connection_move(con, s)) {
+                return;
+            }
+            flags |= UDPGW_CLIENT_FLAG_REBIND;
+        }
+    }
+    
+    if (!con) {
+        // create new connection
+        connection_init(o, conaddr, flags, data, data_len);
+    } else {
+        // move connection to front of the list
+        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+        con->last_used = BReactor_GetTime(o->reactor);
+        
+        // send packet to existing connection
+        connection_send(con, flags, data, data_len);
+    }
+}
+
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, int num_servers, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received)
 {
@@ -408,16 +935,24 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     ASSERT(udpgw_compute_mtu(udp_mtu) <= PACKETPROTO_MAXPAYLOAD)
     ASSERT(max_connections > 0)
     ASSERT(send_buffer_size > 0)
+    ASSERT(num_servers > 0)
     
     // init arguments
     o->udp_mtu = udp_mtu;
     o->max_connections = max_connections;
     o->send_buffer_size = send_buffer_size;
     o->keepalive_time = keepalive_time;
+    o->admit_new = 1;
+    o->num_servers = num_servers;
+    o->codel_target = 0;
+    o->codel_interval = 0;
+    o->codel_drops = 0;
     o->reactor = reactor;
     o->user = user;
     o->handler_servererror = handler_servererror;
     o->handler_received = handler_received;
+    o->handler_datagram = NULL;
+    o->handler_icmp = NULL;
     
     // limit max connections to number of conid's
     if (o->max_connections > UINT16_MAX + 1) {
@@ -427,12 +962,22 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     // compute MTUs
     o->udpgw_mtu = udpgw_compute_mtu(o->udp_mtu);
     o->pp_mtu = o->udpgw_mtu + sizeof(struct packetproto_header);
+    o->dgram_mtu = sizeof(struct udpgw_datagram_header) + o->udpgw_mtu;
     
-    // init connections tree by conaddr
-    BAVL_Init(&o->connections_tree_by_conaddr, OFFSET_DIFF(struct UdpGwClient_connection, conaddr, connections_tree_by_conaddr_node), (BAVL_comparator)conaddr_comparator, NULL);
+    // init connections hash table by conaddr, sized for max_connections
+    if (!UdpGwClientHash_Init(&o->connections_hash_by_conaddr, o->max_connections)) {
+        BLog(BLOG_ERROR, "UdpGwClientHash_Init failed");
+        goto fail0;
+    }
     
-    // init connections tree by conid
-    BAVL_Init(&o->connections_tree_by_conid, OFFSET_DIFF(struct UdpGwClient_connection, conid, connections_tree_by_conid_node), (BAVL_comparator)uint16_comparator, NULL);
+    // init connections array by conid; conids are below max_connections
+    if (!(o->connections_by_conid = (struct UdpGwClient_connection **)BAllocArray(o->max_connections, sizeof(o->connections_by_conid[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    for (int i = 0; i < o->max_connections; i++) {
+        o->connections_by_conid[i] = NULL;
+    }
     
     // init connections list
     LinkedList1_Init(&o->connections_list);
@@ -443,41 +988,46 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     // set next conid
     o->next_conid = 0;
     
-    // init send connector
-    PacketPassConnector_Init(&o->send_connector, o->pp_mtu, BReactor_PendingGroup(o->reactor));
-    
-    // init send monitor
-    PacketPassInactivityMonitor_Init(&o->send_monitor, PacketPassConnector_GetInput(&o->send_connector), o->reactor, o->keepalive_time, (PacketPassInactivityMonitor_handler)send_monitor_handler, o);
-    
-    // init send queue
-    if (!PacketPassFairQueue_Init(&o->send_queue, PacketPassInactivityMonitor_GetInput(&o->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1)) {
-        goto fail0;
-    }
-    
     // construct keepalive packet
     o->keepalive_packet.pp.len = sizeof(o->keepalive_packet.udpgw);
     memset(&o->keepalive_packet.udpgw, 0, sizeof(o->keepalive_packet.udpgw));
     o->keepalive_packet.udpgw.flags = UDPGW_CLIENT_FLAG_KEEPALIVE;
     
-    // init keepalive queue flow
-    PacketPassFairQueueFlow_Init(&o->keepalive_qflow, &o->send_queue);
-    o->keepalive_if = PacketPassFairQueueFlow_GetInput(&o->keepalive_qflow);
+    // construct hello packet, a keepalive offering batching
+    o->hello_packet = o->keepalive_packet;
+    o->hello_packet.udpgw.flags = UDPGW_CLIENT_FLAG_KEEPALIVE|UDPGW_CLIENT_FLAG_BATCH;
     
-    // init keepalive output
-    PacketPassInterface_Sender_Init(o->keepalive_if, (PacketPassInterface_handler_done)keepalive_if_handler_done, o);
+    // construct batch prefix
+    memset(&o->batch_prefix, 0, sizeof(o->batch_prefix));
+    o->batch_prefix.flags = UDPGW_CLIENT_FLAG_BATCH;
     
-    // set not sending keepalive
-    o->keepalive_sending = 0;
+    // allocate servers
+    if (!(o->servers = (struct UdpGwClient_server *)BAllocArray(o->num_servers, sizeof(o->servers[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
     
-    // set have no server
-    o->have_server = 0;
+    // init servers
+    int num_inited;
+    for (num_inited = 0; num_inited < o->num_servers; num_inited++) {
+        if (!server_init(&o->servers[num_inited], o, num_inited)) {
+            goto fail3;
+        }
+    }
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail3:
+    while (num_inited-- > 0) {
+        server_free(&o->servers[num_inited]);
+    }
+    BFree(o->servers);
+fail2:
+    BFree(o->connections_by_conid);
+fail1:
+    UdpGwClientHash_Free(&o->connections_hash_by_conaddr);
 fail0:
-    PacketPassInactivityMonitor_Free(&o->send_monitor);
-    PacketPassConnector_Free(&o->send_connector);
     return 0;
 }
 
@@ -486,7 +1036,9 @@ void UdpGwClient_Free (UdpGwClient *o)
     DebugObject_Free(&o->d_obj);
     
     // allow freeing send queue flows
-    PacketPassFairQueue_PrepareFree(&o->send_queue);
+    for (int i = 0; i < o->num_servers; i++) {
+        PacketPassFairQueue_PrepareFree(&o->servers[i].send_queue);
+    }
     
     // free connections
     while (!LinkedList1_IsEmpty(&o->connections_list)) {
@@ -494,22 +1046,117 @@ void UdpGwClient_Free (UdpGwClient *o)
         connection_free(con);
     }
     
-    // free server
-    if (o->have_server) {
-        free_server(o);
+    // free servers
+    for (int i = 0; i < o->num_servers; i++) {
+        server_free(&o->servers[i]);
     }
+    BFree(o->servers);
     
-    // free keepalive queue flow
-    PacketPassFairQueueFlow_Free(&o->keepalive_qflow);
+    // free connections array by conid
+    BFree(o->connections_by_conid);
     
-    // free send queue
-    PacketPassFairQueue_Free(&o->send_queue);
+    // free connections hash table by conaddr
+    UdpGwClientHash_Free(&o->connections_hash_by_conaddr);
+}
+
+void UdpGwClient_SetSendRate (UdpGwClient *o, int rate, int burst)
+{
+    DebugObject_Access(&o->d_obj);
     
-    // free send
-    PacketPassInactivityMonitor_Free(&o->send_monitor);
+    // the limit applies to each server connection separately
+    for (int i = 0; i < o->num_servers; i++) {
+        PacketPassRateLimiter_SetRate(&o->servers[i].send_limiter, rate, burst);
+    }
+}
+
+void UdpGwClient_EnableCoDel (UdpGwClient *o, int target, int interval)
+{
+    ASSERT(target > 0)
+    ASSERT(interval > 0)
+    ASSERT(o->num_connections == 0)
+    DebugObject_Access(&o->d_obj);
     
-    // free send connector
-    PacketPassConnector_Free(&o->send_connector);
+    // applies to connections created from now on
+    o->codel_target = target;
+    o->codel_interval = interval;
+}
+
+uint64_t UdpGwClient_GetCoDelDrops (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint64_t drops = o->codel_drops;
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->connections_list); node; node = LinkedList1Node_Next(node)) {
+        struct UdpGwClient_connection *con = UPPER_OBJECT(node, struct UdpGwClient_connection, connections_list_node);
+        drops += PacketProtoFlow_GetCoDelDrops(&con->send_ppflow);
+    }
+    
+    return drops;
+}
+
+void UdpGwClient_SetAdmitNew (UdpGwClient *o, int admit_new)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->admit_new = !!admit_new;
+}
+
+size_t UdpGwClient_GetMemoryUsage (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // each connection holds a structure and its send buffer
+    size_t con_size = sizeof(struct UdpGwClient_connection) + (size_t)o->send_buffer_size * o->pp_mtu;
+    
+    return o->num_connections * con_size;
+}
+
+int UdpGwClient_EvictIdle (UdpGwClient *o, btime_t idle_time, int max_num)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(idle_time >= 0)
+    ASSERT(max_num >= 0)
+    
+    btime_t now = BReactor_GetTime(o->reactor);
+    int num = 0;
+    
+    // free connections from the least recently used, until one has been used
+    // recently, skipping those with anything left to send
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->connections_list);
+    while (node && num < max_num) {
+        struct UdpGwClient_connection *con = UPPER_OBJECT(node, struct UdpGwClient_connection, connections_list_node);
+        node = LinkedList1Node_Next(node);
+        
+        if (now - con->last_used < idle_time) {
+            break;
+        }
+        
+        if (BPending_IsSet(&con->first_job) || PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
+            continue;
+        }
+        
+        connection_free(con);
+        num++;
+    }
+    
+    return num;
+}
+
+int UdpGwClient_GetNumConnections (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_connections;
+}
+
+int UdpGwClient_HasConnection (UdpGwClient *o, BAddr local_addr, BAddr remote_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct UdpGwClient_conaddr conaddr = make_conaddr(local_addr, remote_addr, 0);
+    
+    return !!find_connection_by_conaddr(o, conaddr);
 }
 
 void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
@@ -521,12 +1168,7 @@ void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_ad
     ASSERT(data_len <= o->udp_mtu)
     
     // build conaddr
-    struct UdpGwClient_conaddr conaddr;
-    conaddr.local_addr = local_addr;
-    conaddr.remote_addr = remote_addr;
-    
-    // lookup connection
-    struct UdpGwClient_connection *con = find_connection_by_conaddr(o, conaddr);
+    struct UdpGwClient_conaddr conaddr = make_conaddr(local_addr, remote_addr, 0);
     
     uint8_t flags = 0;
 
@@ -535,63 +1177,239 @@ void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_ad
         flags |= UDPGW_CLIENT_FLAG_DNS;
     }
     
-    // if no connection and can't create a new one, reuse the least recently used une
-    if (!con && o->num_connections == o->max_connections) {
-        con = reuse_connection(o, conaddr);
-        flags |= UDPGW_CLIENT_FLAG_REBIND;
+    submit_packet(o, conaddr, flags, data, data_len);
+}
+
+void UdpGwClient_EnableIcmp (UdpGwClient *o, UdpGwClient_handler_received handler_icmp)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(handler_icmp)
+#ifndef NDEBUG
+    for (int i = 0; i < o->num_servers; i++) {
+        ASSERT(!o->servers[i].have_server)
     }
+#endif
     
-    if (!con) {
-        // create new connection
-        connection_init(o, conaddr, flags, data, data_len);
-    } else {
-        // move connection to front of the list
-        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
-        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
-        
-        // send packet to existing connection
-        connection_send(con, flags, data, data_len);
+    o->handler_icmp = handler_icmp;
+    
+    // ask servers to relay ICMP echo with every keepalive
+    o->keepalive_packet.udpgw.flags |= UDPGW_CLIENT_FLAG_ICMP;
+    o->hello_packet.udpgw.flags |= UDPGW_CLIENT_FLAG_ICMP;
+}
+
+int UdpGwClient_SubmitIcmpPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->handler_icmp)
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // build conaddr
+    struct UdpGwClient_conaddr conaddr = make_conaddr(local_addr, remote_addr, 1);
+    
+    // only send to a server which has said it relays ICMP echo; an older
+    // server would take the message for UDP
+    struct UdpGwClient_connection *con = find_connection_by_conaddr(o, conaddr);
+    struct UdpGwClient_server *s = (con ? con->server : choose_server(o));
+    if (!s->have_server || !s->icmp) {
+        return 0;
     }
+    
+    submit_packet(o, conaddr, 0, data, data_len);
+    return 1;
 }
 
-int UdpGwClient_ConnectServer (UdpGwClient *o, StreamPassInterface *send_if, StreamRecvInterface *recv_if)
+int UdpGwClient_ConnectServer (UdpGwClient *o, int server_index, StreamPassInterface *send_if, StreamRecvInterface *recv_if)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(!o->have_server)
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct UdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(!s->have_server)
     
-    // init receive interface
-    PacketPassInterface_Init(&o->recv_if, o->udpgw_mtu, (PacketPassInterface_handler_send)recv_interface_handler_send, o, BReactor_PendingGroup(o->reactor));
+    // init receive interface, large enough for batches
+    PacketPassInterface_Init(&s->recv_if, bmax_int(o->udpgw_mtu, UDPGW_BATCH_MTU - sizeof(struct packetproto_header)), (PacketPassInterface_handler_send)recv_interface_handler_send, s, BReactor_PendingGroup(o->reactor));
+    PacketPassInterface_EnableBatch(&s->recv_if, (PacketPassInterface_handler_send_batch)recv_interface_handler_send_batch);
     
     // init receive decoder
-    if (!PacketProtoDecoder_Init(&o->recv_decoder, recv_if, &o->recv_if, BReactor_PendingGroup(o->reactor), o, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
-        BLog(BLOG_ERROR, "PacketProtoDecoder_Init failed");
+    if (!PacketProtoDecoder_Init2(&s->recv_decoder, recv_if, &s->recv_if, UDPGWCLIENT_RECV_BUFFER_SIZE, BReactor_PendingGroup(o->reactor), s, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
+        BLog(BLOG_ERROR, "PacketProtoDecoder_Init2 failed");
         goto fail1;
     }
     
     // init send sender
-    PacketStreamSender_Init(&o->send_sender, send_if, o->pp_mtu, BReactor_PendingGroup(o->reactor));
+    if (!PacketStreamSender_Init2(&s->send_sender, send_if, bmax_int(o->pp_mtu, UDPGW_BATCH_MTU), UDPGWCLIENT_SEND_COALESCE_SIZE, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail2;
+    }
+    
+    // init send batcher; enabled once the server acknowledges batching
+    if (!PacketProtoBatcher_Init(&s->send_batcher, PacketStreamSender_GetInput(&s->send_sender), o->pp_mtu, (uint8_t *)&o->batch_prefix, sizeof(o->batch_prefix), UDPGW_BATCH_MTU, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketProtoBatcher_Init failed");
+        goto fail3;
+    }
     
     // connect send connector
-    PacketPassConnector_ConnectOutput(&o->send_connector, PacketStreamSender_GetInput(&o->send_sender));
+    PacketPassConnector_ConnectOutput(&s->send_connector, PacketProtoBatcher_GetInput(&s->send_batcher));
     
     // set have server
-    o->have_server = 1;
+    s->have_server = 1;
+    
+    // new server generation; addresses must be sent again
+    s->generation++;
+    
+    // offer batching
+    if (s->keepalive_sending) {
+        s->hello_pending = 1;
+    } else {
+        PacketPassInterface_Sender_Send(s->keepalive_if, (uint8_t *)&o->hello_packet, sizeof(o->hello_packet));
+        s->keepalive_sending = 1;
+    }
     
     return 1;
     
+fail3:
+    PacketStreamSender_Free(&s->send_sender);
+fail2:
+    PacketProtoDecoder_Free(&s->recv_decoder);
 fail1:
-    PacketPassInterface_Free(&o->recv_if);
+    PacketPassInterface_Free(&s->recv_if);
     return 0;
 }
 
-void UdpGwClient_DisconnectServer (UdpGwClient *o)
+void UdpGwClient_DisconnectServer (UdpGwClient *o, int server_index)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_server)
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct UdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(s->have_server)
+    ASSERT(!s->have_dgram)
     
     // free server
-    free_server(o);
+    free_server(s);
+    
+    // the offer was for this connection
+    s->have_dgram_offer = 0;
+    BReactor_RemoveTimer(o->reactor, &s->dgram_timer);
     
     // set have no server
-    o->have_server = 0;
+    s->have_server = 0;
+    
+    // set not batching, and no ICMP relay
+    s->batching = 0;
+    s->icmp = 0;
+    s->hello_pending = 0;
+}
+
+void UdpGwClient_EnableDatagram (UdpGwClient *o, UdpGwClient_handler_datagram handler_datagram)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(handler_datagram)
+#ifndef NDEBUG
+    for (int i = 0; i < o->num_servers; i++) {
+        ASSERT(!o->servers[i].have_server)
+    }
+#endif
+    
+    o->handler_datagram = handler_datagram;
+    
+    // ask servers for the datagram transport with every keepalive
+    o->keepalive_packet.udpgw.flags |= UDPGW_CLIENT_FLAG_DATAGRAM;
+    o->hello_packet.udpgw.flags |= UDPGW_CLIENT_FLAG_DATAGRAM;
+}
+
+int UdpGwClient_GetDatagramMtu (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->dgram_mtu;
+}
+
+int UdpGwClient_ConnectDatagram (UdpGwClient *o, int server_index, PacketPassInterface *send_if, PacketRecvInterface *recv_if)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct UdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(s->have_server)
+    ASSERT(s->have_dgram_offer)
+    ASSERT(!s->have_dgram)
+    ASSERT(PacketPassInterface_GetMTU(send_if) >= o->dgram_mtu)
+    ASSERT(PacketRecvInterface_GetMTU(recv_if) <= o->dgram_mtu)
+    
+    // init send writer
+    BufferWriter_Init(&s->dgram_send_writer, o->dgram_mtu, BReactor_PendingGroup(o->reactor));
+    
+    // init send buffer
+    if (!PacketBuffer_Init(&s->dgram_send_buffer, BufferWriter_GetOutput(&s->dgram_send_writer), send_if, UDPGWCLIENT_DATAGRAM_SEND_BUFFER_SIZE, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketBuffer_Init failed");
+        goto fail0;
+    }
+    
+    // init receive interface
+    PacketPassInterface_Init(&s->dgram_recv_if, o->dgram_mtu, (PacketPassInterface_handler_send)dgram_recv_if_handler_send, s, BReactor_PendingGroup(o->reactor));
+    
+    // init receive buffer
+    if (!SinglePacketBuffer_Init(&s->dgram_recv_buffer, recv_if, &s->dgram_recv_if, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
+        goto fail1;
+    }
+    
+    // set have datagram transport, not known to work yet
+    s->have_dgram = 1;
+    s->dgram_up = 0;
+    
+    // probe the path now and periodically
+    dgram_send_keepalive(s);
+    BReactor_SetTimer(o->reactor, &s->dgram_timer);
+    
+    return 1;
+    
+fail1:
+    PacketPassInterface_Free(&s->dgram_recv_if);
+    PacketBuffer_Free(&s->dgram_send_buffer);
+fail0:
+    BufferWriter_Free(&s->dgram_send_writer);
+    return 0;
+}
+
+void UdpGwClient_DisconnectDatagram (UdpGwClient *o, int server_index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(server_index >= 0)
+    ASSERT(server_index < o->num_servers)
+    struct UdpGwClient_server *s = &o->servers[server_index];
+    ASSERT(s->have_dgram)
+    
+    if (s->dgram_up) {
+        BLog(BLOG_INFO, "datagram transport down, sending over the stream (connection %d)", s->index);
+    }
+    
+    // stop probing
+    BReactor_RemoveTimer(o->reactor, &s->dgram_timer);
+    
+    // free receive buffer
+    SinglePacketBuffer_Free(&s->dgram_recv_buffer);
+    
+    // free receive interface
+    PacketPassInterface_Free(&s->dgram_recv_if);
+    
+    // free send buffer
+    PacketBuffer_Free(&s->dgram_send_buffer);
+    
+    // free send writer
+    BufferWriter_Free(&s->dgram_send_writer);
+    
+    // set no datagram transport
+    s->have_dgram = 0;
+    s->dgram_up = 0;
+    s->have_dgram_offer = 0;
+    
+    // ask for a new offer later
+    if (s->have_server) {
+        BReactor_SetTimerAfter(o->reactor, &s->dgram_timer, UDPGWCLIENT_DATAGRAM_RETRY_TIME);
+    }
 }
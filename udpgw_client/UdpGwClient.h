@@ -34,20 +34,53 @@
 #include <protocol/udpgw_proto.h>
 #include <misc/debug.h>
 #include <misc/packed.h>
-#include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <system/BAddr.h>
+#include <system/BFlowAddr.h>
 #include <base/BPending.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketStreamSender.h>
+#include <flow/PacketProtoBatcher.h>
 #include <flow/PacketProtoFlow.h>
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketPassConnector.h>
+#include <flow/PacketBuffer.h>
+#include <flow/SinglePacketBuffer.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
+#include <flowextra/PacketPassRateLimiter.h>
 
-typedef void (*UdpGwClient_handler_servererror) (void *user);
+// size of buffer into which data from a server is received
+#define UDPGWCLIENT_RECV_BUFFER_SIZE 65536
+
+// size of buffer in which packets to a server are coalesced into larger writes
+#define UDPGWCLIENT_SEND_COALESCE_SIZE 16384
+
+// number of packets buffered for sending over the datagram transport
+#define UDPGWCLIENT_DATAGRAM_SEND_BUFFER_SIZE 64
+
+// time after which to ask for the datagram transport again after losing it
+#define UDPGWCLIENT_DATAGRAM_RETRY_TIME 10000
+
+typedef void (*UdpGwClient_handler_servererror) (void *user, int server_index);
 typedef void (*UdpGwClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+typedef void (*UdpGwClient_handler_datagram) (void *user, int server_index, uint16_t port);
+
+struct UdpGwClient_conaddr {
+    BFlowAddr local_addr;
+    BFlowAddr remote_addr;
+    int is_icmp;
+};
+
+struct UdpGwClient_connection;
+struct UdpGwClient_server;
+
+typedef struct UdpGwClient_connection *UdpGwClientHash_link;
+typedef struct UdpGwClient_conaddr *UdpGwClientHash_key;
+
+#include "UdpGwClient_hash.h"
+#include <structure/CHash_decl.h>
 
 B_START_PACKED
 struct UdpGwClient__keepalive_packet {
@@ -61,58 +94,104 @@ typedef struct {
     int max_connections;
     int send_buffer_size;
     btime_t keepalive_time;
+    int admit_new;
+    int codel_target;
+    int codel_interval;
+    uint64_t codel_drops;
     BReactor *reactor;
     void *user;
     UdpGwClient_handler_servererror handler_servererror;
     UdpGwClient_handler_received handler_received;
+    UdpGwClient_handler_datagram handler_datagram;
+    UdpGwClient_handler_received handler_icmp;
+    int num_servers;
     int udpgw_mtu;
     int pp_mtu;
-    BAVL connections_tree_by_conaddr;
-    BAVL connections_tree_by_conid;
+    int dgram_mtu;
+    UdpGwClientHash connections_hash_by_conaddr;
+    struct UdpGwClient_connection **connections_by_conid;
     LinkedList1 connections_list;
     int num_connections;
     int next_conid;
+    struct UdpGwClient__keepalive_packet keepalive_packet;
+    struct UdpGwClient__keepalive_packet hello_packet;
+    struct udpgw_header batch_prefix;
+    struct UdpGwClient_server *servers;
+    DebugObject d_obj;
+} UdpGwClient;
+
+struct UdpGwClient_server {
+    UdpGwClient *client;
+    int index;
+    int num_connections;
     PacketPassFairQueue send_queue;
     PacketPassInactivityMonitor send_monitor;
+    PacketPassRateLimiter send_limiter;
     PacketPassConnector send_connector;
-    struct UdpGwClient__keepalive_packet keepalive_packet;
     PacketPassInterface *keepalive_if;
     PacketPassFairQueueFlow keepalive_qflow;
     int keepalive_sending;
+    int hello_pending;
     int have_server;
+    unsigned int generation;
+    int batching;
+    int icmp;
     PacketStreamSender send_sender;
+    PacketProtoBatcher send_batcher;
     PacketProtoDecoder recv_decoder;
     PacketPassInterface recv_if;
-    DebugObject d_obj;
-} UdpGwClient;
-
-struct UdpGwClient_conaddr {
-    BAddr local_addr;
-    BAddr remote_addr;
+    int have_dgram_offer;
+    uint64_t dgram_token;
+    int have_dgram;
+    int dgram_up;
+    btime_t dgram_last_recv;
+    BTimer dgram_timer;
+    BufferWriter dgram_send_writer;
+    PacketBuffer dgram_send_buffer;
+    PacketPassInterface dgram_recv_if;
+    SinglePacketBuffer dgram_recv_buffer;
 };
 
 struct UdpGwClient_connection {
     UdpGwClient *client;
+    struct UdpGwClient_server *server;
     struct UdpGwClient_conaddr conaddr;
     uint8_t first_flags;
     const uint8_t *first_data;
     int first_data_len;
     uint16_t conid;
+    unsigned int addr_sent_generation;
+    int addr_received;
     BPending first_job;
+    btime_t last_used;
     BufferWriter *send_if;
     PacketProtoFlow send_ppflow;
     PacketPassFairQueueFlow send_qflow;
-    BAVLNode connections_tree_by_conaddr_node;
-    BAVLNode connections_tree_by_conid_node;
+    size_t conaddr_hash;
+    UdpGwClientHash_link conaddr_hash_next;
     LinkedList1Node connections_list_node;
 };
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, int num_servers, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received) WARN_UNUSED;
 void UdpGwClient_Free (UdpGwClient *o);
+void UdpGwClient_SetSendRate (UdpGwClient *o, int rate, int burst);
+void UdpGwClient_EnableCoDel (UdpGwClient *o, int target, int interval);
+uint64_t UdpGwClient_GetCoDelDrops (UdpGwClient *o);
+void UdpGwClient_SetAdmitNew (UdpGwClient *o, int admit_new);
+size_t UdpGwClient_GetMemoryUsage (UdpGwClient *o);
+int UdpGwClient_EvictIdle (UdpGwClient *o, btime_t idle_time, int max_num);
+int UdpGwClient_GetNumConnections (UdpGwClient *o);
+int UdpGwClient_HasConnection (UdpGwClient *o, BAddr local_addr, BAddr remote_addr);
 void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len);
-int UdpGwClient_ConnectServer (UdpGwClient *o, StreamPassInterface *send_if, StreamRecvInterface *recv_if) WARN_UNUSED;
-void UdpGwClient_DisconnectServer (UdpGwClient *o);
+void UdpGwClient_EnableIcmp (UdpGwClient *o, UdpGwClient_handler_received handler_icmp);
+int UdpGwClient_SubmitIcmpPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len) WARN_UNUSED;
+int UdpGwClient_ConnectServer (UdpGwClient *o, int server_index, StreamPassInterface *send_if, StreamRecvInterface *recv_if) WARN_UNUSED;
+void UdpGwClient_DisconnectServer (UdpGwClient *o, int server_index);
+void UdpGwClient_EnableDatagram (UdpGwClient *o, UdpGwClient_handler_datagram handler_datagram);
+int UdpGwClient_GetDatagramMtu (UdpGwClient *o);
+int UdpGwClient_ConnectDatagram (UdpGwClient *o, int server_index, PacketPassInterface *send_if, PacketRecvInterface *recv_if) WARN_UNUSED;
+void UdpGwClient_DisconnectDatagram (UdpGwClient *o, int server_index);
 
 #endif